@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+namespace watchman {
+
+/**
+ * Chooses the settle period of a root from the idle gaps it has seen between
+ * batches of filesystem events.
+ *
+ * Gaps no longer than the maximum settle period are taken to be pauses within
+ * a burst of activity, such as a build writing its outputs, and are averaged.
+ * The settle period is a multiple of that average, so that a root settles
+ * about once per burst rather than at every pause. A longer gap means the
+ * root went quiet, and the period drops back to the minimum so that the first
+ * change after a quiet spell is reported promptly.
+ */
+class AdaptiveSettle {
+ public:
+  AdaptiveSettle(
+      std::chrono::milliseconds minSettle,
+      std::chrono::milliseconds maxSettle)
+      : minSettle_{minSettle}, maxSettle_{std::max(minSettle, maxSettle)} {}
+
+  /**
+   * Records that events arrived after the root was idle for `idle`.
+   */
+  void noteIdleGap(std::chrono::milliseconds idle) {
+    if (idle > maxSettle_) {
+      averageGapMs_ = 0;
+    } else if (averageGapMs_ == 0) {
+      averageGapMs_ = double(idle.count());
+    } else {
+      averageGapMs_ += (double(idle.count()) - averageGapMs_) * kSmoothing;
+    }
+  }
+
+  /**
+   * How long the root must be idle before it is considered settled.
+   */
+  std::chrono::milliseconds settlePeriod() const {
+    auto period = std::chrono::milliseconds{
+        static_cast<std::chrono::milliseconds::rep>(averageGapMs_ * kHeadroom)};
+    return std::clamp(period, minSettle_, maxSettle_);
+  }
+
+ private:
+  // Weight of the newest gap in the moving average
+  static constexpr double kSmoothing = 0.25;
+  // How much longer than the average gap the root must be idle to settle
+  static constexpr double kHeadroom = 2.0;
+
+  const std::chrono::milliseconds minSettle_;
+  const std::chrono::milliseconds maxSettle_;
+  double averageGapMs_{0};
+};
+
+} // namespace watchman
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ChangeJournal.h"
+#include <fmt/core.h>
+#include <folly/String.h>
+#include <folly/system/MemoryMapping.h>
+#include <string.h>
+#include <algorithm>
+#include <system_error>
+#include "watchman/Logging.h"
+
+/* Layout (native byte order, every record is 8-byte aligned):
+ *
+ *   JournalHeader
+ *   any number of { JournalRecord, path bytes, padded }
+ *
+ * Like the view snapshot, the journal is a host-local cache rather than an
+ * interchange format.
+ */
+
+namespace watchman {
+
+namespace {
+
+constexpr char kMagic[8] = {'W', 'M', 'J', 'R', 'N', 'L', '0', '1'};
+constexpr uint32_t kVersion = 1;
+
+struct JournalHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t snapshotTicks;
+};
+
+enum class RecordKind : uint8_t {
+  // A file changed at `ticks`
+  Change = 1,
+  // A server instance started writing at `ticks`
+  Writer = 2,
+  // The journal is complete up to `ticks`
+  Complete = 3,
+  // As Complete, and the writer shut down cleanly
+  Closed = 4,
+};
+
+struct JournalRecord {
+  RecordKind kind;
+  uint8_t exists;
+  uint8_t padding[2];
+  uint32_t pathLen;
+  uint64_t ticks;
+  // Change: the file's otime timestamp.  Writer: the process start time.
+  int64_t timestamp;
+  // Writer only
+  int64_t pid;
+  uint64_t rootNumber;
+};
+
+static_assert(sizeof(JournalHeader) % 8 == 0);
+static_assert(sizeof(JournalRecord) % 8 == 0);
+
+size_t padded(size_t len) {
+  return (len + 7) & ~size_t(7);
+}
+
+void appendRecord(
+    std::string& out,
+    const JournalRecord& record,
+    w_string_piece path = {}) {
+  static const char kZeroes[8] = {0};
+  out.append(reinterpret_cast<const char*>(&record), sizeof(record));
+  out.append(path.data(), path.size());
+  out.append(kZeroes, padded(path.size()) - path.size());
+}
+
+JournalRecord writerRecord(const ClockSpec::Clock& writer) {
+  JournalRecord record{};
+  record.kind = RecordKind::Writer;
+  record.ticks = writer.position.ticks;
+  record.timestamp = int64_t(writer.start_time);
+  record.pid = writer.pid;
+  record.rootNumber = writer.position.rootNumber;
+  return record;
+}
+
+} // namespace
+
+std::optional<ChangeJournal::Contents> ChangeJournal::read(const char* path) {
+  std::optional<folly::MemoryMapping> mapping;
+  try {
+    mapping.emplace(path);
+  } catch (const std::exception&) {
+    return std::nullopt;
+  }
+  auto data = mapping->range();
+
+  if (data.size() < sizeof(JournalHeader)) {
+    return std::nullopt;
+  }
+  JournalHeader header;
+  memcpy(&header, data.data(), sizeof(header));
+  data.advance(sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion) {
+    return std::nullopt;
+  }
+
+  Contents contents;
+  contents.snapshotTicks = header.snapshotTicks;
+  contents.lastTicks = header.snapshotTicks;
+
+  bool closed = false;
+  while (data.size() >= sizeof(JournalRecord)) {
+    JournalRecord record;
+    memcpy(&record, data.data(), sizeof(record));
+    if (data.size() - sizeof(record) < padded(record.pathLen)) {
+      // Torn by a crash mid-write
+      break;
+    }
+    w_string_piece recordPath{
+        reinterpret_cast<const char*>(data.data()) + sizeof(record),
+        record.pathLen};
+    data.advance(sizeof(record) + padded(record.pathLen));
+
+    closed = false;
+    switch (record.kind) {
+      case RecordKind::Change:
+        contents.changes.push_back(Change{
+            record.ticks,
+            time_t(record.timestamp),
+            recordPath.asWString(),
+            record.exists != 0});
+        break;
+      case RecordKind::Writer:
+        contents.writers.push_back(ClockSpec::Clock{
+            uint64_t(record.timestamp),
+            int(record.pid),
+            ClockPosition{record.rootNumber, record.ticks}});
+        break;
+      case RecordKind::Complete:
+        contents.lastTicks = std::max(contents.lastTicks, record.ticks);
+        break;
+      case RecordKind::Closed:
+        contents.lastTicks = std::max(contents.lastTicks, record.ticks);
+        closed = true;
+        break;
+      default:
+        // Garbage; treat it like a torn record
+        contents.closedCleanly = false;
+        return contents;
+    }
+  }
+
+  contents.closedCleanly = closed;
+  return contents;
+}
+
+ChangeJournal::ChangeJournal(w_string path) : path_{std::move(path)} {}
+
+ChangeJournal::~ChangeJournal() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  closeLocked();
+}
+
+void ChangeJournal::reset(
+    ClockTicks snapshotTicks,
+    const ClockSpec::Clock& writer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  closeLocked();
+
+  JournalHeader header{};
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.snapshotTicks = snapshotTicks;
+
+  std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+  appendRecord(data, writerRecord(writer));
+
+  auto tmpPath = w_string::build(path_, ".tmp");
+  file_ = fopen(tmpPath.c_str(), "wb");
+  if (!file_) {
+    buffer_.clear();
+    throw std::system_error(
+        errno, std::generic_category(), fmt::format("fopen {}", tmpPath));
+  }
+  size_ = 0;
+  try {
+    writeLocked(data);
+    if (fflush(file_) != 0) {
+      throw std::system_error(errno, std::generic_category(), "fflush");
+    }
+    if (rename(tmpPath.c_str(), path_.c_str()) != 0) {
+      throw std::system_error(
+          errno, std::generic_category(), fmt::format("rename {}", path_));
+    }
+  } catch (const std::exception&) {
+    closeLocked();
+    buffer_.clear();
+    remove(tmpPath.c_str());
+    throw;
+  }
+
+  // Keep only the changes that the snapshot doesn't have.  The records are
+  // in tick order, so they are a suffix of the buffer.
+  size_t keepFrom = 0;
+  for (size_t pos = 0; pos < buffer_.size();) {
+    JournalRecord record;
+    memcpy(&record, buffer_.data() + pos, sizeof(record));
+    if (record.ticks > snapshotTicks) {
+      break;
+    }
+    pos += sizeof(record) + padded(record.pathLen);
+    keepFrom = pos;
+  }
+  buffer_.erase(0, keepFrom);
+}
+
+void ChangeJournal::resume(const ClockSpec::Clock& writer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  closeLocked();
+
+  buffer_.clear();
+  file_ = fopen(path_.c_str(), "ab");
+  if (!file_) {
+    throw std::system_error(
+        errno, std::generic_category(), fmt::format("fopen {}", path_));
+  }
+  fseek(file_, 0, SEEK_END);
+  size_ = ftell(file_);
+  appendRecord(buffer_, writerRecord(writer));
+}
+
+void ChangeJournal::close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  closeLocked();
+  buffer_.clear();
+}
+
+bool ChangeJournal::isOpen() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return file_ != nullptr;
+}
+
+void ChangeJournal::append(
+    ClockTicks ticks,
+    time_t timestamp,
+    w_string_piece relPath,
+    bool exists) {
+  JournalRecord record{};
+  record.kind = RecordKind::Change;
+  record.exists = exists;
+  record.pathLen = uint32_t(relPath.size());
+  record.ticks = ticks;
+  record.timestamp = int64_t(timestamp);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!file_) {
+    return;
+  }
+  appendRecord(buffer_, record, relPath);
+}
+
+void ChangeJournal::flush(ClockTicks ticks, bool close) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!file_) {
+    return;
+  }
+
+  JournalRecord record{};
+  record.kind = close ? RecordKind::Closed : RecordKind::Complete;
+  record.ticks = ticks;
+  appendRecord(buffer_, record);
+
+  try {
+    writeLocked(buffer_);
+    if (fflush(file_) != 0) {
+      throw std::system_error(errno, std::generic_category(), "fflush");
+    }
+  } catch (const std::exception& exc) {
+    logf(
+        ERR,
+        "failed to write change journal {}: {}; clocks from before the next "
+        "restart will be treated as fresh instances\n",
+        path_,
+        folly::exceptionStr(exc).toStdString());
+    closeLocked();
+    remove(path_.c_str());
+  }
+  buffer_.clear();
+  if (close) {
+    closeLocked();
+  }
+}
+
+size_t ChangeJournal::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return size_;
+}
+
+void ChangeJournal::writeLocked(const std::string& data) {
+  if (!data.empty() &&
+      fwrite(data.data(), 1, data.size(), file_) != data.size()) {
+    throw std::system_error(errno, std::generic_category(), "fwrite");
+  }
+  size_ += data.size();
+}
+
+void ChangeJournal::closeLocked() {
+  if (file_) {
+    fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+} // namespace watchman
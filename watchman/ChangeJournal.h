@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include "watchman/Clock.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * An append-only log of the files that changed in a view since its last
+ * snapshot was saved.
+ *
+ * When the server restarts, replaying the journal on top of the snapshot
+ * reproduces the view as it was when the previous instance shut down, with
+ * the same ticks, so that clocks handed out by the previous instance can
+ * still be honored.  The journal also records each server instance that
+ * wrote to it, since those are the clocks that remain valid.
+ *
+ * Changes are buffered in memory and written by flush(), which the IO thread
+ * calls whenever the view settles and when it shuts down.  A record torn by
+ * a crash ends the journal.  Changes made after the last flush before a
+ * crash are lost, so only a journal that was closed cleanly can vouch for
+ * old clocks.
+ */
+class ChangeJournal {
+ public:
+  struct Change {
+    ClockTicks ticks;
+    time_t timestamp;
+    // Relative to the root
+    w_string path;
+    bool exists;
+  };
+
+  struct Contents {
+    // The tick of the snapshot that this journal extends
+    ClockTicks snapshotTicks{0};
+    // The instances that wrote to the journal, oldest first.  The position
+    // of each is the tick at which it started writing.
+    std::vector<ClockSpec::Clock> writers;
+    std::vector<Change> changes;
+    // The highest tick that the journal is known to be complete up to
+    ClockTicks lastTicks{0};
+    // True if the last writer shut down cleanly, so that no changes are
+    // missing after lastTicks
+    bool closedCleanly{false};
+  };
+
+  /**
+   * Reads the journal at `path`.  Returns nullopt if it doesn't exist or
+   * has an incompatible format.
+   */
+  static std::optional<Contents> read(const char* path);
+
+  explicit ChangeJournal(w_string path);
+  ~ChangeJournal();
+
+  ChangeJournal(const ChangeJournal&) = delete;
+  ChangeJournal& operator=(const ChangeJournal&) = delete;
+
+  const w_string& path() const {
+    return path_;
+  }
+
+  /**
+   * Atomically replaces the journal with an empty one that extends the
+   * snapshot saved at `snapshotTicks` by `writer`.  Buffered changes up to
+   * `snapshotTicks` are discarded, as the snapshot already has them.
+   * Throws std::system_error on failure, leaving the journal closed.
+   */
+  void reset(ClockTicks snapshotTicks, const ClockSpec::Clock& writer);
+
+  /**
+   * Reopens an existing journal, after it was replayed, so that `writer`
+   * continues appending to it.
+   * Throws std::system_error on failure, leaving the journal closed.
+   */
+  void resume(const ClockSpec::Clock& writer);
+
+  /**
+   * Closes the journal; appends are ignored until the next reset.
+   */
+  void close();
+
+  bool isOpen() const;
+
+  /**
+   * Buffers a change to the file at `relPath`.  Called with the view's
+   * write lock held, so it does no I/O.
+   */
+  void append(
+      ClockTicks ticks,
+      time_t timestamp,
+      w_string_piece relPath,
+      bool exists);
+
+  /**
+   * Writes the buffered changes, and records that the journal is complete
+   * up to `ticks`.  If `close` is set, also records a clean shutdown and
+   * closes the journal.  On failure, logs and closes the journal.
+   */
+  void flush(ClockTicks ticks, bool close = false);
+
+  /**
+   * Returns the number of bytes written to the journal so far.
+   */
+  size_t size() const;
+
+ private:
+  void writeLocked(const std::string& data);
+  void closeLocked();
+
+  const w_string path_;
+  mutable std::mutex mutex_;
+  FILE* file_{nullptr};
+  std::string buffer_;
+  size_t size_{0};
+};
+
+} // namespace watchman
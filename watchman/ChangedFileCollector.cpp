@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ChangedFileCollector.h"
+#include "watchman/query/CompiledGlob.h"
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+#include "watchman/watchman_file.h"
+
+namespace watchman {
+
+ChangedFileCollector::ChangedFileCollector(
+    const std::vector<std::string>& patterns,
+    const w_string& queryRoot,
+    CaseSensitivity caseSensitive,
+    size_t maxFiles)
+    : prefix_(w_string::build(queryRoot, "/")),
+      caseSensitive_(caseSensitive),
+      maxFiles_(maxFiles) {
+  int flags = WM_PATHNAME |
+      (caseSensitive == CaseSensitivity::CaseInSensitive ? WM_CASEFOLD : 0);
+  for (const auto& pattern : patterns) {
+    patterns_.push_back(CompiledGlob::get(pattern, flags));
+  }
+}
+
+bool ChangedFileCollector::matches(w_string_piece fullPath) const {
+  bool caseInsensitive = caseSensitive_ == CaseSensitivity::CaseInSensitive;
+  if (caseInsensitive ? !fullPath.startsWithCaseInsensitive(prefix_)
+                      : !fullPath.startsWith(prefix_)) {
+    return false;
+  }
+
+  // wildmatch wants a NUL terminated string
+  w_string_piece relative{
+      fullPath.data() + prefix_.size(), fullPath.size() - prefix_.size()};
+  w_string name =
+      caseInsensitive ? relative.asLowerCase() : relative.asWString();
+
+  for (const auto& pattern : patterns_) {
+    if (pattern->match(name.view())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ChangedFileCollector::fileChanged(
+    watchman_file* file,
+    w_string_piece fullPath) {
+  if (!matches(fullPath)) {
+    return;
+  }
+
+  auto state = state_.lock();
+  if (state->overflowed) {
+    return;
+  }
+  if (state->files.size() >= maxFiles_) {
+    // Walking the view will be cheaper than evaluating this many files one
+    // at a time, so stop collecting until the next evaluation.
+    state->overflowed = true;
+    state->files.clear();
+    return;
+  }
+  state->files.insert(file);
+}
+
+void ChangedFileCollector::restart(ClockPosition position) {
+  auto state = state_.lock();
+  state->startedAt = position;
+  state->overflowed = false;
+  state->files.clear();
+}
+
+std::optional<std::vector<watchman_file*>> ChangedFileCollector::take(
+    ClockRoot rootNumber,
+    ClockTicks sinceTicks,
+    ClockTicks upToTicks,
+    ClockPosition now) {
+  auto state = state_.lock();
+  bool complete = !state->overflowed &&
+      state->startedAt.rootNumber == rootNumber &&
+      upToTicks >= state->startedAt.ticks;
+  if (!complete) {
+    state->startedAt = now;
+    state->overflowed = false;
+    state->files.clear();
+    return std::nullopt;
+  }
+
+  std::optional<std::vector<watchman_file*>> result;
+  if (sinceTicks >= state->startedAt.ticks) {
+    result.emplace(state->files.begin(), state->files.end());
+  }
+
+  // Whether or not the caller could use them, the next caller will only ask
+  // for changes after upToTicks.
+  state->startedAt.ticks = upToTicks;
+  for (auto it = state->files.begin(); it != state->files.end();) {
+    if ((*it)->otime.ticks <= upToTicks) {
+      it = state->files.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return result;
+}
+
+} // namespace watchman
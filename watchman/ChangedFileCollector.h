@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "watchman/Clock.h"
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/watchman_string.h"
+
+struct watchman_file;
+
+namespace watchman {
+
+class CompiledGlob;
+
+/**
+ * Collects the files of an InMemoryView that change and may match a query,
+ * so that a subscription can evaluate its query against just those files
+ * rather than walking every file that changed since its last clock.
+ *
+ * The view offers each changed file to every registered collector while it
+ * holds its write lock, so the filter is deliberately cheap: the file's path
+ * is matched against the glob upper bound of the query's expression, and the
+ * query itself is evaluated later, on the subscription's own thread.
+ */
+class ChangedFileCollector {
+ public:
+  /**
+   * `patterns` are evaluated by wildmatch with WM_PATHNAME against paths
+   * relative to `queryRoot`, and are expected to be lowercase if
+   * `caseSensitive` is false. `maxFiles` bounds the number of files held
+   * between two evaluations; past that the collector gives up until the
+   * next evaluation, which then falls back to walking the view.
+   */
+  ChangedFileCollector(
+      const std::vector<std::string>& patterns,
+      const w_string& queryRoot,
+      CaseSensitivity caseSensitive,
+      size_t maxFiles);
+
+  /**
+   * Called by the view, with its write lock held, each time `file` changes.
+   * `fullPath` is the absolute path of the file.
+   */
+  void fileChanged(watchman_file* file, w_string_piece fullPath);
+
+  /**
+   * Called by the view, with its write lock held, when the collector starts
+   * collecting and whenever the files it holds may have been freed. Files
+   * that change after `position` are collected from now on.
+   */
+  void restart(ClockPosition position);
+
+  /**
+   * Called with the view's read lock held, by a query that reports the
+   * changes after `sinceTicks` and up to at least `upToTicks`, the tick at
+   * which it started. If every file that matches the patterns and changed
+   * after `sinceTicks` in the root `rootNumber` has been collected, returns
+   * them, and otherwise nullopt. Either way, only the files that changed
+   * after `upToTicks` are kept for the next call, or if even those are
+   * incomplete, collecting restarts from `now`.
+   */
+  std::optional<std::vector<watchman_file*>> take(
+      ClockRoot rootNumber,
+      ClockTicks sinceTicks,
+      ClockTicks upToTicks,
+      ClockPosition now);
+
+ private:
+  bool matches(w_string_piece fullPath) const;
+
+  std::vector<std::shared_ptr<const CompiledGlob>> patterns_;
+  const w_string prefix_;
+  const CaseSensitivity caseSensitive_;
+  const size_t maxFiles_;
+
+  struct State {
+    // Files that changed after `startedAt` are all in `files`, unless
+    // `overflowed` is set.
+    ClockPosition startedAt;
+    bool overflowed{false};
+    std::unordered_set<watchman_file*> files;
+  };
+  folly::Synchronized<State, std::mutex> state_;
+};
+
+} // namespace watchman
@@ -13,6 +13,7 @@
 #include <system_error>
 #include <thread>
 #include "watchman/Logging.h"
+#include "watchman/SpawnHelper.h"
 
 namespace watchman {
 
@@ -174,6 +175,7 @@ void ChildProcess::Options::dup2(int fd, int targetFd) {
     throw std::system_error(
         err, std::generic_category(), "posix_spawn_file_actions_adddup2");
   }
+  fileActions_.push_back(FileAction{fd, targetFd, {}, 0, 0});
 }
 
 void ChildProcess::Options::dup2(const FileDescriptor& fd, int targetFd) {
@@ -187,12 +189,7 @@ void ChildProcess::Options::dup2(const FileDescriptor& fd, int targetFd) {
         "posix_spawn_file_actions_adddup2_handle_np");
   }
 #else
-  auto err =
-      posix_spawn_file_actions_adddup2(&inner_->actions, fd.fd(), targetFd);
-  if (err) {
-    throw std::system_error(
-        err, std::generic_category(), "posix_spawn_file_actions_adddup2");
-  }
+  dup2(fd.fd(), targetFd);
 #endif
 }
 
@@ -207,6 +204,7 @@ void ChildProcess::Options::open(
     throw std::system_error(
         err, std::generic_category(), "posix_spawn_file_actions_addopen");
   }
+  fileActions_.push_back(FileAction{-1, targetFd, path, flags, mode});
 }
 
 void ChildProcess::Options::pipe(int targetFd, bool childRead) {
@@ -295,41 +293,13 @@ ChildProcess::ChildProcess(
   }
   argv.emplace_back(nullptr);
 
-#ifndef _WIN32
-  auto lock = lockCwdMutex();
-  char savedCwd[WATCHMAN_NAME_MAX];
-  if (!getcwd(savedCwd, sizeof(savedCwd))) {
-    throw std::system_error(errno, std::generic_category(), "failed to getcwd");
-  }
-  SCOPE_EXIT {
-    if (!options.cwd_.empty()) {
-      if (chdir(savedCwd) != 0) {
-        // log(FATAL) rather than throw because SCOPE_EXIT is
-        // a noexcept destructor and will call std::terminate
-        // in this case anyway.
-        log(FATAL, "failed to restore cwd of ", savedCwd);
-      }
-    }
-  };
-
-  if (!options.cwd_.empty()) {
-    if (chdir(options.cwd_.c_str()) != 0) {
-      throw std::system_error(
-          errno,
-          std::generic_category(),
-          fmt::format("failed to chdir to {}", options.cwd_));
-    }
-  }
-#endif
-
   auto envp = options.env_.asEnviron();
-  auto ret = posix_spawnp(
-      &pid_,
-      argv[0],
-      &options.inner_->actions,
-      &options.inner_->attr,
-      &argv[0],
-      envp.get());
+  std::optional<int> helperRet;
+  if (auto* helper = SpawnHelper::get()) {
+    helperRet = helper->spawn(pid_, argv.data(), envp.get(), options);
+  }
+  auto ret = helperRet ? *helperRet
+                       : spawnDirectly(pid_, argv.data(), envp.get(), options);
 
   if (ret) {
     // Failed, so the creator cannot call wait() on us.
@@ -361,6 +331,47 @@ ChildProcess::ChildProcess(
   }
 }
 
+int ChildProcess::spawnDirectly(
+    pid_t& pid,
+    char* const* argv,
+    char* const* envp,
+    Options& options) {
+#ifndef _WIN32
+  auto lock = lockCwdMutex();
+  char savedCwd[WATCHMAN_NAME_MAX];
+  if (!getcwd(savedCwd, sizeof(savedCwd))) {
+    throw std::system_error(errno, std::generic_category(), "failed to getcwd");
+  }
+  SCOPE_EXIT {
+    if (!options.cwd_.empty()) {
+      if (chdir(savedCwd) != 0) {
+        // log(FATAL) rather than throw because SCOPE_EXIT is
+        // a noexcept destructor and will call std::terminate
+        // in this case anyway.
+        log(FATAL, "failed to restore cwd of ", savedCwd);
+      }
+    }
+  };
+
+  if (!options.cwd_.empty()) {
+    if (chdir(options.cwd_.c_str()) != 0) {
+      throw std::system_error(
+          errno,
+          std::generic_category(),
+          fmt::format("failed to chdir to {}", options.cwd_));
+    }
+  }
+#endif
+
+  return posix_spawnp(
+      &pid,
+      argv[0],
+      &options.inner_->actions,
+      &options.inner_->attr,
+      argv,
+      envp);
+}
+
 static std::mutex& getCwdMutex() {
   // Meyers singleton
   static std::mutex m;
@@ -436,6 +447,14 @@ std::unique_ptr<Pipe> ChildProcess::takeStdin() {
   return pipe;
 }
 
+std::unique_ptr<Pipe> ChildProcess::takePipe(int targetFd) {
+  auto it = pipes_.find(targetFd);
+  CHECK(it != pipes_.end());
+  auto pipe = std::move(it->second);
+  pipes_.erase(it);
+  return pipe;
+}
+
 std::pair<std::optional<w_string>, std::optional<w_string>>
 ChildProcess::communicate(pipeWriteCallback writeCallback) {
 #ifdef _WIN32
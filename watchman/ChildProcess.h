@@ -125,7 +125,21 @@ class ChildProcess {
     std::unordered_map<int, std::unique_ptr<Pipe>> pipes_;
     std::string cwd_;
 
+    // The file actions, in the order they were added.  They can't be read
+    // back out of posix_spawn_file_actions_t, and the SpawnHelper needs them
+    // to replay them in its child.
+    struct FileAction {
+      // The fd to dup2 from, or -1 to open path instead
+      int sourceFd;
+      int targetFd;
+      std::string path;
+      int flags;
+      int mode;
+    };
+    std::vector<FileAction> fileActions_;
+
     friend class ChildProcess;
+    friend class SpawnHelper;
   };
 
   ChildProcess(std::vector<std::string_view> args, Options&& options);
@@ -163,6 +177,10 @@ class ChildProcess {
   // terminate.
   std::unique_ptr<Pipe> takeStdin();
 
+  // Extracts the pipe set up for targetFd, for talking to a long-running
+  // child directly rather than through communicate().
+  std::unique_ptr<Pipe> takePipe(int targetFd);
+
   // The pipeWriteCallback is called by communicate when it is safe to write
   // data to the pipe.  The callback should then attempt to write to it.
   // The callback must return true when it has nothing more
@@ -199,6 +217,13 @@ class ChildProcess {
   static size_t getArgMax();
 
  private:
+  // Spawns argv from this process with posix_spawnp, returning its error
+  static int spawnDirectly(
+      pid_t& pid,
+      char* const* argv,
+      char* const* envp,
+      Options& options);
+
   pid_t pid_;
   bool waited_{false};
   int status_;
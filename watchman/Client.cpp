@@ -12,6 +12,7 @@
 
 #include "eden/common/utils/ProcessInfoCache.h"
 #include "watchman/ClientContext.h"
+#include "watchman/ClientEventLoop.h"
 #include "watchman/Command.h"
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
@@ -20,6 +21,9 @@
 #include "watchman/ProcessUtil.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Shutdown.h"
+#include "watchman/ThreadPlacement.h"
+#include "watchman/Tracepoint.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/root/Root.h"
 #include "watchman/telemetry/LogEvent.h"
 #include "watchman/telemetry/WatchmanStructuredLogger.h"
@@ -31,6 +35,9 @@ namespace {
 
 constexpr size_t kResponseLogLimit = 0;
 
+// Queued responses written out by a single flush at most
+constexpr size_t kMaxCoalescedResponses = 64;
+
 folly::Synchronized<std::unordered_set<UserClient*>> clients;
 
 // TODO: If used in a hot loop, EdenFS has a faster implementation.
@@ -236,6 +243,15 @@ std::string ClientStatus::getName() const {
 void UserClient::create(std::unique_ptr<watchman_stream> stm) {
   auto uc = std::make_shared<UserClient>(PrivateBadge{}, std::move(stm));
 
+  if (auto* loop = ClientEventLoop::get()) {
+    // Requests are still decoded and dispatched with blocking calls, but on
+    // a shared worker pool rather than a thread of our own.
+    uc->beginSession();
+    uc->status_.transitionTo(ClientStatus::WAITING_FOR_REQUEST);
+    loop->add(std::move(uc));
+    return;
+  }
+
   // Start a thread for the client.
   //
   // We used to use libevent for this, but we have a low volume of concurrent
@@ -319,187 +335,284 @@ void UserClient::vacateStates() {
   }
 }
 
-void UserClient::clientThread() noexcept {
+void UserClient::beginSession() {
   status_.transitionTo(ClientStatus::THREAD_STARTED);
-
-  // Keep a persistent vector around so that we can avoid allocating
-  // and releasing heap memory when we collect items from the publisher
-  std::vector<std::shared_ptr<const watchman::Publisher::Item>> pending;
-
   stm->setNonBlock(true);
-  w_set_thread_name(
-      "client=", unique_id, ":stm=", uintptr_t(stm.get()), ":pid=", peerPid_);
-
   client_is_owner = stm->peerIsOwner();
+}
 
-  EventPoll pfd[2];
-  pfd[0].evt = stm->getEvents();
-  pfd[1].evt = ping.get();
+void UserClient::endSession() {
+  status_.transitionTo(ClientStatus::THREAD_STOPPING);
+}
 
+bool UserClient::processEvents(bool streamReady, bool pingReady) {
   bool client_alive = true;
-  while (!w_is_stopping() && client_alive) {
-    // Wait for input from either the client socket or
-    // via the ping pipe, which signals that some other
-    // thread wants to unilaterally send data to the client
-
-    status_.transitionTo(ClientStatus::WAITING_FOR_REQUEST);
-    ignore_result(w_poll_events(pfd, 2, 2000));
-    if (w_is_stopping()) {
-      break;
-    }
 
-    if (pfd[0].ready) {
-      status_.transitionTo(ClientStatus::DECODING_REQUEST);
-      json_error_t jerr;
-      auto request = reader.decodeNext(stm.get(), &jerr);
-
-      if (!request && errno == EAGAIN) {
-        // That's fine
-      } else if (!request) {
-        // Not so cool
-        if (reader.wpos == reader.rpos) {
-          // If they disconnected in between PDUs, no need to log
-          // any error
-          goto disconnected;
-        }
-        sendErrorResponse(
-            "invalid json at position {}: {}", jerr.position, jerr.text);
-        logf(ERR, "invalid data from client: {}\n", jerr.text);
-
-        goto disconnected;
-      } else if (request) {
-        format = reader.format;
-        status_.transitionTo(ClientStatus::DISPATCHING_COMMAND);
-        dispatchCommand(Command::parse(*request), CMD_DAEMON);
+  // A client that pipelines its requests may send several in one write, and
+  // they are all read into the buffer at once.  The stream won't become
+  // readable again for the ones left there, so keep decoding while a whole
+  // request is buffered.
+  while (streamReady) {
+    status_.transitionTo(ClientStatus::DECODING_REQUEST);
+    json_error_t jerr;
+    auto request = reader.decodeNext(stm.get(), &jerr);
+
+    if (!request && errno == EAGAIN) {
+      // That's fine
+    } else if (!request) {
+      // Not so cool
+      if (reader.wpos == reader.rpos) {
+        // If they disconnected in between PDUs, no need to log
+        // any error
+        return false;
       }
+      sendErrorResponse(
+          "invalid json at position {}: {}", jerr.position, jerr.text);
+      logf(ERR, "invalid data from client: {}\n", jerr.text);
+
+      return false;
+    } else if (request) {
+      format = reader.format;
+      status_.transitionTo(ClientStatus::DISPATCHING_COMMAND);
+      dispatchCommand(Command::parse(*request), CMD_DAEMON);
     }
+    streamReady = request.has_value() && reader.hasBufferedPdu();
+  }
 
-    if (pfd[1].ready) {
-      while (ping->testAndClear()) {
-        status_.transitionTo(ClientStatus::PROCESSING_SUBSCRIPTION);
-        // Enqueue refs to pending log payloads
-        pending.clear();
-        getPending(pending, debugSub, errorSub);
-        for (auto& item : pending) {
-          enqueueResponse(json_ref(item->payload));
-        }
+  if (pingReady) {
+    while (ping->testAndClear()) {
+      status_.transitionTo(ClientStatus::PROCESSING_SUBSCRIPTION);
+      // Enqueue refs to pending log payloads
+      pendingItems_.clear();
+      getPending(pendingItems_, debugSub, errorSub);
+      uint64_t dropped = (debugSub ? debugSub->takeDropped() : 0) +
+          (errorSub ? errorSub->takeDropped() : 0);
+      if (dropped) {
+        // Let the client know that it fell too far behind to see everything
+        enqueueResponse(json_object(
+            {{"log",
+              typed_string_to_json(w_string::build(
+                  "[watchman] ",
+                  dropped,
+                  " log messages were dropped because this client was not "
+                  "reading them quickly enough\n"))},
+             {"unilateral", json_true()},
+             {"level",
+              typed_string_to_json(
+                  watchman::logLevelToLabel(watchman::ERR))}}));
+      }
+      for (auto& item : pendingItems_) {
+        enqueueResponse(json_ref(item->payload));
+      }
 
-        // Maybe we have subscriptions to dispatch?
-        std::vector<w_string> subsToDelete;
-        for (auto& [sub, subStream] : unilateralSub) {
+      // Maybe we have subscriptions to dispatch?
+      std::vector<w_string> subsToDelete;
+      for (auto& [sub, subStream] : unilateralSub) {
+        watchman::log(
+            watchman::DBG, "consider fan out sub ", sub->name, "\n");
+
+        pendingItems_.clear();
+        subStream->getPending(pendingItems_);
+        bool seenSettle = false;
+        for (auto& item : pendingItems_) {
+          auto dumped = json_dumps(item->payload, 0);
           watchman::log(
-              watchman::DBG, "consider fan out sub ", sub->name, "\n");
-
-          pending.clear();
-          subStream->getPending(pending);
-          bool seenSettle = false;
-          for (auto& item : pending) {
-            auto dumped = json_dumps(item->payload, 0);
+              watchman::DBG,
+              "Unilateral payload for sub ",
+              sub->name,
+              " ",
+              dumped,
+              "\n");
+
+          if (item->payload.get_optional("canceled")) {
             watchman::log(
-                watchman::DBG,
-                "Unilateral payload for sub ",
+                watchman::ERR,
+                "Cancel subscription ",
                 sub->name,
-                " ",
-                dumped,
-                "\n");
-
-            if (item->payload.get_optional("canceled")) {
-              watchman::log(
-                  watchman::ERR,
-                  "Cancel subscription ",
-                  sub->name,
-                  " due to root cancellation\n");
-
-              UntypedResponse resp;
-              resp.set(
-                  {{"unilateral", json_true()},
-                   {"canceled", json_true()},
-                   {"subscription", w_string_to_json(sub->name)}});
-              if (auto root = item->payload.get_optional("root")) {
-                resp.set("root", *root);
-              }
-              enqueueResponse(std::move(resp));
-              // Remember to cancel this subscription.
-              // We can't do it in this loop because that would
-              // invalidate the iterators and cause a headache.
-              subsToDelete.push_back(sub->name);
-              continue;
+                " due to root cancellation\n");
+
+            UntypedResponse resp;
+            resp.set(
+                {{"unilateral", json_true()},
+                 {"canceled", json_true()},
+                 {"subscription", w_string_to_json(sub->name)}});
+            if (auto root = item->payload.get_optional("root")) {
+              resp.set("root", *root);
             }
+            enqueueResponse(std::move(resp));
+            // Remember to cancel this subscription.
+            // We can't do it in this loop because that would
+            // invalidate the iterators and cause a headache.
+            subsToDelete.push_back(sub->name);
+            continue;
+          }
 
-            if (item->payload.get_optional("state-enter") ||
-                item->payload.get_optional("state-leave")) {
-              UntypedResponse resp;
-              resp.insert(
-                  item->payload.object().begin(), item->payload.object().end());
-              // We have the opportunity to populate additional response
-              // fields here (since we don't want to block the command).
-              // We don't populate the fat clock for SCM aware queries
-              // because determination of mergeBase could add latency.
-              resp.set(
-                  {{"unilateral", json_true()},
-                   {"subscription", w_string_to_json(sub->name)}});
-              enqueueResponse(std::move(resp));
-
-              watchman::log(
-                  watchman::DBG,
-                  "Fan out subscription state change for ",
-                  sub->name,
-                  "\n");
-              continue;
-            }
+          if (item->payload.get_optional("state-enter") ||
+              item->payload.get_optional("state-leave")) {
+            UntypedResponse resp;
+            resp.insert(
+                item->payload.object().begin(), item->payload.object().end());
+            // We have the opportunity to populate additional response
+            // fields here (since we don't want to block the command).
+            // We don't populate the fat clock for SCM aware queries
+            // because determination of mergeBase could add latency.
+            resp.set(
+                {{"unilateral", json_true()},
+                 {"subscription", w_string_to_json(sub->name)}});
+            enqueueResponse(std::move(resp));
 
-            if (!sub->debug_paused && item->payload.get_optional("settled")) {
-              seenSettle = true;
-              continue;
-            }
+            watchman::log(
+                watchman::DBG,
+                "Fan out subscription state change for ",
+                sub->name,
+                "\n");
+            continue;
           }
 
-          if (seenSettle) {
-            sub->processSubscription();
+          if (!sub->debug_paused && item->payload.get_optional("settled")) {
+            seenSettle = true;
+            continue;
           }
         }
 
-        for (auto& name : subsToDelete) {
-          unsubByName(name);
+        if (seenSettle) {
+          sub->processSubscription();
         }
       }
+
+      for (auto& name : subsToDelete) {
+        unsubByName(name);
+      }
     }
+  }
 
-    /* now send our response(s) */
-    while (!responses.empty() && client_alive) {
-      status_.transitionTo(ClientStatus::SENDING_SUBSCRIPTION_RESPONSES);
-      auto& response_to_send = responses.front();
-
-      stm->setNonBlock(false);
-      /* Return the data in the same format that was used to ask for it.
-       * Update client liveness based on send success.
-       */
-      auto encodeResult =
-          writer.pduEncodeToStream(this->format, response_to_send, stm.get());
-      client_alive = encodeResult.hasValue();
-      stm->setNonBlock(true);
-
-      std::optional<json_ref> subscriptionValue =
-          response_to_send.get_optional("subscription");
-      if (kResponseLogLimit && subscriptionValue &&
-          subscriptionValue->isString() &&
-          json_string_value(*subscriptionValue)) {
-        auto subscriptionName = json_to_w_string(*subscriptionValue);
-        if (auto* sub = folly::get_ptr(subscriptions, subscriptionName)) {
-          if ((*sub)->lastResponses.size() >= kResponseLogLimit) {
-            (*sub)->lastResponses.pop_front();
-          }
-          (*sub)->lastResponses.push_back(ClientSubscription::LoggedResponse{
-              std::chrono::system_clock::now(), response_to_send});
+  if (hasDeferredSubscriptions()) {
+    processDeferredSubscriptions();
+  }
+
+  /* now send our response(s) */
+  bool sending = !responses.empty() && client_alive;
+  if (sending) {
+    status_.transitionTo(ClientStatus::SENDING_SUBSCRIPTION_RESPONSES);
+    stm->setNonBlock(false);
+  }
+  size_t unflushed = 0;
+  while (!responses.empty() && client_alive) {
+    auto& response_to_send = responses.front();
+
+    /* Return the data in the same format that was used to ask for it.
+     * Update client liveness based on send success.  Queued responses are
+     * written together, a bounded number at a time, so that a burst of
+     * small unilateral PDUs costs fewer writes and client wakeups.
+     */
+    auto encodeResult =
+        writer.pduEncodeBuffered(this->format, response_to_send, stm.get());
+    client_alive = encodeResult.hasValue();
+    if (client_alive &&
+        (responses.size() == 1 || ++unflushed == kMaxCoalescedResponses)) {
+      WATCHMAN_TRACE(client__write__start, unique_id, writer.wpos);
+      client_alive = writer.flushToStream(stm.get()).hasValue();
+      WATCHMAN_TRACE(client__write__end, unique_id, client_alive);
+      unflushed = 0;
+    }
+    if (!client_alive) {
+      // Don't leave part of a PDU for whatever writes next
+      writer.clear();
+    }
+
+    std::optional<json_ref> subscriptionValue =
+        response_to_send.get_optional("subscription");
+    if (kResponseLogLimit && subscriptionValue &&
+        subscriptionValue->isString() &&
+        json_string_value(*subscriptionValue)) {
+      auto subscriptionName = json_to_w_string(*subscriptionValue);
+      if (auto* sub = folly::get_ptr(subscriptions, subscriptionName)) {
+        if ((*sub)->lastResponses.size() >= kResponseLogLimit) {
+          (*sub)->lastResponses.pop_front();
         }
+        (*sub)->lastResponses.push_back(ClientSubscription::LoggedResponse{
+            std::chrono::system_clock::now(), response_to_send});
       }
+    }
+
+    responses.pop_front();
+  }
+  if (sending) {
+    stm->setNonBlock(true);
+  }
+
+  return client_alive;
+}
+
+bool UserClient::isBacklogged() {
+  auto maxQueued = cfg_get_int("subscription_backpressure_max_queued", 256);
+  if (maxQueued <= 0) {
+    return false;
+  }
+  // Responses are written out before the client next waits, so a full
+  // socket buffer is the usual sign of a client that isn't reading.
+  return responses.size() >= size_t(maxQueued) || !stm->isWritable();
+}
 
-      responses.pop_front();
+void UserClient::processDeferredSubscriptions() {
+  if (isBacklogged()) {
+    return;
+  }
+  hasDeferredSubscriptions_.store(false, std::memory_order_relaxed);
+  for (auto& [name, sub] : subscriptions) {
+    if (sub->deferredForBackpressure && !sub->debug_paused) {
+      sub->deferredForBackpressure = false;
+      log(DBG, "client caught up, resuming subscription ", name, "\n");
+      status_.transitionTo(ClientStatus::PROCESSING_SUBSCRIPTION);
+      // Sends a single notification for everything held back
+      sub->processSubscription();
+    } else if (sub->deferredForBackpressure) {
+      hasDeferredSubscriptions_.store(true, std::memory_order_relaxed);
     }
   }
+}
 
-disconnected:
-  status_.transitionTo(ClientStatus::THREAD_STOPPING);
+bool UserClient::processReadyEvents() {
+  if (w_is_stopping()) {
+    return false;
+  }
+
+  EventPoll pfd[2];
+  pfd[0].evt = stm->getEvents();
+  pfd[1].evt = ping.get();
+  ignore_result(w_poll_events(pfd, 2, 0));
+  bool alive = processEvents(pfd[0].ready, pfd[1].ready);
+  status_.transitionTo(ClientStatus::WAITING_FOR_REQUEST);
+  return alive;
+}
+
+void UserClient::clientThread() noexcept {
+  beginSession();
+  w_set_thread_name(
+      "client=", unique_id, ":stm=", uintptr_t(stm.get()), ":pid=", peerPid_);
+  placeCurrentThread(ThreadRole::Client);
+
+  EventPoll pfd[2];
+  pfd[0].evt = stm->getEvents();
+  pfd[1].evt = ping.get();
+
+  while (!w_is_stopping()) {
+    // Wait for input from either the client socket or
+    // via the ping pipe, which signals that some other
+    // thread wants to unilaterally send data to the client
+
+    status_.transitionTo(ClientStatus::WAITING_FOR_REQUEST);
+    ignore_result(w_poll_events(pfd, 2, 2000));
+    if (w_is_stopping()) {
+      break;
+    }
+
+    if (!processEvents(pfd[0].ready, pfd[1].ready)) {
+      break;
+    }
+  }
+
+  endSession();
   w_set_thread_name(
       "NOT_CONN:client=",
       unique_id,
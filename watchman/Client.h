@@ -9,6 +9,7 @@
 
 #include <fmt/core.h>
 
+#include <atomic>
 #include <chrono>
 #include <deque>
 #include <unordered_map>
@@ -24,9 +25,11 @@
 
 namespace watchman {
 
+class ChangedFileCollector;
 class ClientStateAssertion;
 class Command;
 class Root;
+class SubscriptionRoute;
 struct Query;
 struct QueryResult;
 struct ClientContext;
@@ -105,6 +108,11 @@ class ClientSubscription
       const std::shared_ptr<Root>& root,
       ClockSpec& position,
       OnStateTransition onStateTransition);
+  /**
+   * Enqueues the results built by buildSubscriptionResults, split into
+   * batches if this is a change feed.
+   */
+  void enqueueResults(Client* client, UntypedResponse&& response);
 
  public:
   struct LoggedResponse {
@@ -119,7 +127,21 @@ class ClientSubscription
   bool debug_paused = false;
 
   std::shared_ptr<Query> query;
+  // Gathers the files that may match the query as they change, if the
+  // subscription is evaluated incrementally.
+  std::shared_ptr<ChangedFileCollector> changedFiles;
+  // Lets the view tell whether anything the query may produce results from
+  // changed, so that the query needn't run when nothing did.
+  std::shared_ptr<SubscriptionRoute> route;
+  // If non-zero, this subscription is a change feed, and its results are
+  // sent in batches of at most this many files.
+  uint32_t changeFeedBatchSize{0};
   bool vcs_defer;
+  // Set while notifications are held back because the client is not keeping
+  // up; the next run covers everything since the last one sent.
+  bool deferredForBackpressure{false};
+  // How many notifications were folded into a later one this way.
+  std::atomic<uint64_t> backpressureDeferrals{0};
   uint32_t last_sub_tick{0};
   // map of statename => bool.  If true, policy is drop, else defer
   std::unordered_map<w_string, bool> drop_or_defer;
@@ -131,7 +153,13 @@ class ClientSubscription
   ClockSpec runSubscriptionRules(
       UserClient* client,
       const std::shared_ptr<Root>& root);
-  void updateSubscriptionTicks(QueryResult* res);
+  void updateSubscriptionTicks(const ClockSpec& clockAtStartOfQuery);
+  // Identifies the results of the next query when they can be shared with
+  // other subscriptions on the same root.
+  std::optional<w_string> sharedResultKey() const;
+  // Whether nothing the query may produce results from changed between its
+  // since clock and `position`, where the root last settled.
+  bool isUnchangedInScope(ClockPosition position) const;
   void processSubscriptionImpl();
 };
 
@@ -198,7 +226,9 @@ struct ClientDebugStatus : serde::Object {
  * the watchman per-user process.
  *
  * Each UserClient has a corresponding thread that reads and decodes json
- * packets and dispatches the commands that it finds.
+ * packets and dispatches the commands that it finds, unless the
+ * ClientEventLoop is enabled, in which case that work is done on its worker
+ * pool whenever the client has something to process.
  */
 class UserClient final : public Client {
  public:
@@ -225,6 +255,10 @@ class UserClient final : public Client {
 
   bool unsubByName(const w_string& name);
 
+  // True if the client has fallen far enough behind in reading its responses
+  // that subscriptions should hold back their notifications.
+  bool isBacklogged();
+
  private:
   UserClient() = delete;
   UserClient(UserClient&&) = delete;
@@ -244,9 +278,44 @@ class UserClient final : public Client {
 
   void clientThread() noexcept;
 
+  // Prepares the stream for serving requests; called once before the first
+  // call to processEvents.
+  void beginSession();
+  // Marks the client as disconnected.
+  void endSession();
+
+  // Handles a readable socket and/or signalled ping event: dispatches at most
+  // one request, fans out pending unilateral responses and writes everything
+  // queued for the client. Returns false once the client should be
+  // disconnected.
+  bool processEvents(bool streamReady, bool pingReady);
+
+  // Checks which of the client's events are ready without blocking, then
+  // processes them.  Used by ClientEventLoop.
+  bool processReadyEvents();
+
+  // Runs the subscriptions that were held back by isBacklogged, if the
+  // client has since caught up.
+  void processDeferredSubscriptions();
+
+  // Whether any subscription is waiting on processDeferredSubscriptions.
+  // Read by ClientEventLoop without holding the client.
+  bool hasDeferredSubscriptions() const {
+    return hasDeferredSubscriptions_.load(std::memory_order_relaxed);
+  }
+
+  friend class ClientEventLoop;
+
   const std::chrono::system_clock::time_point since_;
 
+  // Reused by processEvents to avoid reallocating on every wakeup.
+  std::vector<std::shared_ptr<const Publisher::Item>> pendingItems_;
+
   ClientStatus status_;
+
+  std::atomic<bool> hasDeferredSubscriptions_{false};
+
+  friend class ClientSubscription;
 };
 
 } // namespace watchman
@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ClientEventLoop.h"
+#include <folly/ScopeGuard.h>
+#include <folly/String.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <unordered_set>
+#include "watchman/Client.h"
+#include "watchman/Logging.h"
+#include "watchman/Shutdown.h"
+#include "watchman/ThreadPlacement.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/fs/FileDescriptor.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#elif !defined(_WIN32)
+#include <poll.h>
+#endif
+
+namespace watchman {
+
+#ifndef _WIN32
+
+namespace {
+// How often the I/O threads check whether the server is shutting down
+constexpr int kIoWaitTimeoutMs = 2000;
+} // namespace
+
+class ClientEventLoop::IoThread {
+ public:
+  IoThread(ClientEventLoop& loop, size_t index)
+      : loop_(loop), wake_(w_event_make_sockets()) {
+#ifdef __linux__
+    epollFd_ = FileDescriptor(
+        epoll_create1(EPOLL_CLOEXEC),
+        "epoll_create1",
+        FileDescriptor::FDType::Generic);
+    struct epoll_event evt {};
+    evt.events = EPOLLIN;
+    evt.data.u64 = kWakeId;
+    if (epoll_ctl(
+            epollFd_.system_handle(),
+            EPOLL_CTL_ADD,
+            wake_->system_handle(),
+            &evt) == -1) {
+      throw std::system_error(
+          errno, std::generic_category(), "epoll_ctl wake event");
+    }
+#endif
+    thread_ = std::thread([this, index]() noexcept {
+      w_set_thread_name("clientio", index);
+      placeCurrentThread(ThreadRole::Client);
+      run();
+    });
+  }
+
+  ~IoThread() {
+    *stopping_.lock() = true;
+    wake_->notify();
+    thread_.join();
+  }
+
+  // Called from any thread to start watching a client, either for the first
+  // time or again after a worker has finished with it.
+  void watch(std::shared_ptr<UserClient> client) {
+    pending_.lock()->toWatch.push_back(std::move(client));
+    wake_->notify();
+  }
+
+  // Called from any thread once a client has disconnected.
+  void forget(std::shared_ptr<UserClient> client) {
+    pending_.lock()->toForget.push_back(std::move(client));
+    wake_->notify();
+  }
+
+ private:
+  // Never a valid client id, which start at 1
+  static constexpr uint64_t kWakeId = 0;
+
+  struct Pending {
+    std::vector<std::shared_ptr<UserClient>> toWatch;
+    std::vector<std::shared_ptr<UserClient>> toForget;
+  };
+
+  void run() noexcept {
+    SCOPE_EXIT {
+      // Drop our references; in-flight workers hold their own
+      clients_.clear();
+    };
+
+    std::vector<uint64_t> ready;
+    auto lastRetry = std::chrono::steady_clock::now();
+    while (!w_is_stopping() && !*stopping_.lock()) {
+      applyPending();
+      ready.clear();
+      waitForReady(ready);
+
+      for (auto id : ready) {
+        if (id == kWakeId) {
+          wake_->testAndClear();
+          continue;
+        }
+        auto it = clients_.find(id);
+        if (it == clients_.end() || !busy_.insert(id).second) {
+          // Gone, or both of its events fired and it is already with a
+          // worker
+          continue;
+        }
+        loop_.dispatch(*this, it->second);
+      }
+
+      auto now = std::chrono::steady_clock::now();
+      if (now - lastRetry >= std::chrono::milliseconds{kIoWaitTimeoutMs}) {
+        lastRetry = now;
+        retryDeferredSubscriptions();
+      }
+    }
+  }
+
+  // A client whose subscriptions were held back because it wasn't reading
+  // has nothing to wake us up once it catches up, so give it another look
+  // every so often.
+  void retryDeferredSubscriptions() {
+    for (auto& [id, client] : clients_) {
+      if (client->hasDeferredSubscriptions() && busy_.insert(id).second) {
+        loop_.dispatch(*this, client);
+      }
+    }
+  }
+
+  void applyPending() {
+    Pending pending;
+    std::swap(pending, *pending_.lock());
+
+    for (auto& client : pending.toForget) {
+      auto id = client->unique_id;
+#ifdef __linux__
+      for (auto fd : fdsFor(*client)) {
+        epoll_ctl(epollFd_.system_handle(), EPOLL_CTL_DEL, fd, nullptr);
+      }
+#endif
+      busy_.erase(id);
+      clients_.erase(id);
+    }
+
+    for (auto& client : pending.toWatch) {
+      auto id = client->unique_id;
+      bool isNew = clients_.emplace(id, client).second;
+      busy_.erase(id);
+#ifdef __linux__
+      // One-shot so that a client's events are not reported again until its
+      // worker is done and it is watched again.
+      for (auto fd : fdsFor(*client)) {
+        struct epoll_event evt {};
+        evt.events = EPOLLIN | EPOLLONESHOT;
+        evt.data.u64 = id;
+        if (epoll_ctl(
+                epollFd_.system_handle(),
+                isNew ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+                fd,
+                &evt) == -1) {
+          log(ERR,
+              "failed to watch client ",
+              id,
+              ": ",
+              folly::errnoStr(errno),
+              "\n");
+        }
+      }
+#else
+      (void)isNew;
+#endif
+    }
+  }
+
+  static std::array<int, 2> fdsFor(UserClient& client) {
+    return {
+        int(client.stm->getEvents()->system_handle()),
+        int(client.ping->system_handle())};
+  }
+
+#ifdef __linux__
+  void waitForReady(std::vector<uint64_t>& ready) {
+    struct epoll_event events[64];
+    int n = epoll_wait(
+        epollFd_.system_handle(),
+        events,
+        int(std::size(events)),
+        kIoWaitTimeoutMs);
+    for (int i = 0; i < n; ++i) {
+      ready.push_back(events[i].data.u64);
+    }
+  }
+#else
+  void waitForReady(std::vector<uint64_t>& ready) {
+    pfds_.clear();
+    ids_.clear();
+    pfds_.push_back({int(wake_->system_handle()), POLLIN, 0});
+    ids_.push_back(kWakeId);
+    for (auto& [id, client] : clients_) {
+      if (busy_.count(id)) {
+        continue;
+      }
+      for (auto fd : fdsFor(*client)) {
+        pfds_.push_back({fd, POLLIN, 0});
+        ids_.push_back(id);
+      }
+    }
+
+    if (poll(pfds_.data(), pfds_.size(), kIoWaitTimeoutMs) <= 0) {
+      return;
+    }
+    for (size_t i = 0; i < pfds_.size(); ++i) {
+      if (pfds_[i].revents != 0) {
+        ready.push_back(ids_[i]);
+      }
+    }
+  }
+
+  std::vector<struct pollfd> pfds_;
+  std::vector<uint64_t> ids_;
+#endif
+
+  ClientEventLoop& loop_;
+  std::unique_ptr<watchman_event> wake_;
+#ifdef __linux__
+  FileDescriptor epollFd_;
+#endif
+  folly::Synchronized<bool, std::mutex> stopping_{false};
+  folly::Synchronized<Pending, std::mutex> pending_;
+
+  // Only accessed by the I/O thread
+  std::unordered_map<uint64_t, std::shared_ptr<UserClient>> clients_;
+  // Clients currently being processed by a worker
+  std::unordered_set<uint64_t> busy_;
+
+  std::thread thread_;
+};
+
+ClientEventLoop* ClientEventLoop::get() {
+  // Deliberately leaked, like the per-client threads it replaces, so that
+  // clients are never torn down underneath a running command at exit.
+  static ClientEventLoop* loop = []() -> ClientEventLoop* {
+    if (!cfg_get_bool("client_event_loop", false)) {
+      return nullptr;
+    }
+    try {
+      return new ClientEventLoop(
+          std::max(json_int_t(1), cfg_get_int("client_event_loop_threads", 2)),
+          std::max(
+              json_int_t(1), cfg_get_int("client_event_loop_workers", 16)));
+    } catch (const std::exception& exc) {
+      log(ERR,
+          "failed to start the client event loop, falling back to a thread "
+          "per client: ",
+          exc.what(),
+          "\n");
+      return nullptr;
+    }
+  }();
+  return loop;
+}
+
+ClientEventLoop::ClientEventLoop(size_t numIoThreads, size_t numWorkers) {
+  workers_.start(
+      numWorkers, 1024 * 1024, "ClientWorker-", ThreadRole::Client);
+  for (size_t i = 0; i < numIoThreads; ++i) {
+    ioThreads_.emplace_back(std::make_unique<IoThread>(*this, i));
+  }
+}
+
+ClientEventLoop::~ClientEventLoop() {
+  // Workers hand clients back to the I/O threads, so stop them first
+  workers_.stop();
+  ioThreads_.clear();
+}
+
+void ClientEventLoop::add(std::shared_ptr<UserClient> client) {
+  auto index = nextIoThread_++ % ioThreads_.size();
+  ioThreads_[index]->watch(std::move(client));
+}
+
+void ClientEventLoop::dispatch(
+    IoThread& io,
+    std::shared_ptr<UserClient> client) {
+  try {
+    workers_.add([&io, client]() mutable {
+      if (client->processReadyEvents()) {
+        io.watch(std::move(client));
+      } else {
+        client->endSession();
+        io.forget(std::move(client));
+      }
+    });
+  } catch (const std::exception& exc) {
+    log(ERR,
+        "disconnecting client ",
+        client->unique_id,
+        ": unable to schedule it: ",
+        exc.what(),
+        "\n");
+    client->endSession();
+    io.forget(std::move(client));
+  }
+}
+
+#else
+
+class ClientEventLoop::IoThread {};
+
+ClientEventLoop* ClientEventLoop::get() {
+  return nullptr;
+}
+
+ClientEventLoop::ClientEventLoop(size_t, size_t) {
+  throw std::runtime_error("ClientEventLoop is not supported on Windows");
+}
+
+ClientEventLoop::~ClientEventLoop() = default;
+
+void ClientEventLoop::add(std::shared_ptr<UserClient>) {}
+
+void ClientEventLoop::dispatch(IoThread&, std::shared_ptr<UserClient>) {}
+
+#endif
+
+} // namespace watchman
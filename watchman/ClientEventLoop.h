@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "watchman/ThreadPool.h"
+#include "watchman/watchman_stream.h"
+
+namespace watchman {
+
+class UserClient;
+
+/**
+ * Serves UserClient sessions from a few I/O threads instead of a thread per
+ * client.
+ *
+ * Each I/O thread waits for any of its clients' sockets or ping events to
+ * become readable (epoll on Linux, poll elsewhere), then hands that client to
+ * a shared worker pool to decode and dispatch its requests and flush its
+ * responses. A client is not watched again until its worker has finished, so
+ * each client is still only ever processed by one thread at a time, and the
+ * number of threads depends on how many clients are active rather than how
+ * many are connected.
+ *
+ * Enabled by the `client_event_loop` configuration option. Not available on
+ * Windows, where each client keeps its own thread.
+ */
+class ClientEventLoop {
+ public:
+  // Returns the process-wide event loop, or nullptr if it is disabled.
+  static ClientEventLoop* get();
+
+  ClientEventLoop(size_t numIoThreads, size_t numWorkers);
+  ~ClientEventLoop();
+
+  ClientEventLoop(const ClientEventLoop&) = delete;
+  ClientEventLoop& operator=(const ClientEventLoop&) = delete;
+
+  // Start serving the client. The loop holds a reference until the client
+  // disconnects or the server shuts down.
+  void add(std::shared_ptr<UserClient> client);
+
+ private:
+  class IoThread;
+
+  // Runs one step of the client on the worker pool, then hands it back to
+  // its I/O thread to be watched again.
+  void dispatch(IoThread& io, std::shared_ptr<UserClient> client);
+
+  ThreadPool workers_;
+  std::vector<std::unique_ptr<IoThread>> ioThreads_;
+  std::atomic<size_t> nextIoThread_{0};
+};
+
+} // namespace watchman
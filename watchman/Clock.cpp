@@ -6,17 +6,69 @@
  */
 
 #include "watchman/Clock.h"
+#include <folly/Conv.h>
 #include <folly/Overload.h>
 #include <folly/String.h>
 #include <folly/Synchronized.h>
 #include <folly/portability/SysTime.h>
+#include <cstring>
 #include <memory>
+#include <string_view>
+#include "watchman/NamedCursorMap.h"
 
 using namespace watchman;
 
 static int proc_pid;
 static uint64_t proc_start_time;
 
+namespace {
+// "c:<start_time>:<pid>:", which starts every clock this instance hands out
+char proc_clock_prefix[64] = "c:0:0:";
+size_t proc_clock_prefix_len = 6;
+
+// Parses a clock handed out by this instance without going through sscanf,
+// which is by far the most common kind that clients send.
+bool parseCurrentInstanceClock(std::string_view str, ClockPosition& position) {
+  std::string_view prefix{proc_clock_prefix, proc_clock_prefix_len};
+  if (str.substr(0, prefix.size()) != prefix) {
+    return false;
+  }
+  str.remove_prefix(prefix.size());
+  auto colon = str.find(':');
+  if (colon == std::string_view::npos) {
+    return false;
+  }
+  auto rootNumber = folly::tryTo<ClockRoot>(
+      folly::StringPiece{str.data(), colon});
+  auto ticks = folly::tryTo<ClockTicks>(folly::StringPiece{
+      str.data() + colon + 1, str.size() - colon - 1});
+  if (!rootNumber || !ticks) {
+    return false;
+  }
+  position = ClockPosition{*rootNumber, *ticks};
+  return true;
+}
+
+// Earlier server instances whose clocks are honored, by the root number that
+// took over their ticks.
+folly::Synchronized<std::unordered_multimap<ClockRoot, ClockSpec::Clock>>
+    previousInstances;
+
+bool isHonoredPreviousInstance(const ClockSpec::Clock& clock, ClockRoot root) {
+  auto locked = previousInstances.rlock();
+  auto range = locked->equal_range(root);
+  for (auto it = range.first; it != range.second; ++it) {
+    auto& previous = it->second;
+    if (clock.start_time == previous.start_time && clock.pid == previous.pid &&
+        clock.position.rootNumber == previous.position.rootNumber &&
+        clock.position.ticks <= previous.position.ticks) {
+      return true;
+    }
+  }
+  return false;
+}
+} // namespace
+
 void ClockSpec::init() {
   struct timeval tv;
 
@@ -25,10 +77,27 @@ void ClockSpec::init() {
     logf(FATAL, "gettimeofday failed: {}\n", folly::errnoStr(errno));
   }
   proc_start_time = (uint64_t)tv.tv_sec;
+
+  int len = snprintf(
+      proc_clock_prefix,
+      sizeof(proc_clock_prefix),
+      "c:%" PRIu64 ":%d:",
+      proc_start_time,
+      proc_pid);
+  w_check(
+      len > 0 && size_t(len) < sizeof(proc_clock_prefix),
+      "clock prefix is too long");
+  proc_clock_prefix_len = size_t(len);
 }
 
 ClockSpec::ClockSpec(const json_ref& value) {
   auto parseClockString = [=](const char* str) {
+    ClockPosition position;
+    if (parseCurrentInstanceClock(str, position)) {
+      spec = Clock{proc_start_time, proc_pid, position};
+      return true;
+    }
+
     uint64_t start_time;
     int pid;
     ClockRoot root_number;
@@ -130,8 +199,7 @@ ClockSpec::ClockSpec(const ClockPosition& position)
 QuerySince ClockSpec::evaluate(
     const ClockPosition& position,
     ClockTicks lastAgeOutTick,
-    folly::Synchronized<std::unordered_map<w_string, ClockTicks>>* cursorMap)
-    const {
+    NamedCursorMap* cursorMap) const {
   return folly::variant_match(
       spec,
       [](const Timestamp& ts) -> QuerySince {
@@ -139,8 +207,9 @@ QuerySince ClockSpec::evaluate(
       },
       [&](const Clock& clock) -> QuerySince {
         QuerySince::Clock since_clock;
-        if (clock.start_time == proc_start_time && clock.pid == proc_pid &&
-            clock.position.rootNumber == position.rootNumber) {
+        if ((clock.start_time == proc_start_time && clock.pid == proc_pid &&
+             clock.position.rootNumber == position.rootNumber) ||
+            isHonoredPreviousInstance(clock, position.rootNumber)) {
           since_clock.is_fresh_instance = clock.position.ticks < lastAgeOutTick;
           if (since_clock.is_fresh_instance) {
             since_clock.ticks = 0;
@@ -166,22 +235,16 @@ QuerySince ClockSpec::evaluate(
 
         QuerySince::Clock since_clock;
 
-        {
-          auto wlock = cursorMap->wlock();
-          auto& cursors = *wlock;
-          auto it = cursors.find(named_cursor.cursor);
-
-          if (it == cursors.end()) {
-            since_clock.is_fresh_instance = true;
-            since_clock.ticks = 0;
-          } else {
-            since_clock.ticks = it->second;
-            since_clock.is_fresh_instance = since_clock.ticks < lastAgeOutTick;
-          }
-
-          // record the current tick value against the cursor so that we use
-          // that as the basis for a subsequent query.
-          cursors[named_cursor.cursor] = position.ticks;
+        // record the current tick value against the cursor so that we use
+        // that as the basis for a subsequent query.
+        auto previous =
+            cursorMap->exchange(named_cursor.cursor, position.ticks);
+        if (!previous) {
+          since_clock.is_fresh_instance = true;
+          since_clock.ticks = 0;
+        } else {
+          since_clock.ticks = *previous;
+          since_clock.is_fresh_instance = since_clock.ticks < lastAgeOutTick;
         }
 
         log(DBG,
@@ -195,32 +258,65 @@ QuerySince ClockSpec::evaluate(
       });
 }
 
+void ClockSpec::honorPreviousInstance(
+    ClockRoot rootNumber,
+    const Clock& previous) {
+  previousInstances.wlock()->emplace(rootNumber, previous);
+}
+
+void ClockSpec::forgetPreviousInstances(ClockRoot rootNumber) {
+  previousInstances.wlock()->erase(rootNumber);
+}
+
+ClockSpec::Clock ClockSpec::currentInstance(const ClockPosition& position) {
+  return Clock{proc_start_time, proc_pid, position};
+}
+
 bool clock_id_string(
     ClockRoot root_number,
     ClockTicks ticks,
     char* buf,
     size_t bufsize) {
-  int res = snprintf(
-      buf,
-      bufsize,
-      "c:%" PRIu64 ":%d:%" PRIu64 ":%" PRIu64,
-      proc_start_time,
-      proc_pid,
-      root_number,
-      ticks);
-
-  if (res == -1) {
+  // Called for the clock fields of every file in a result, so this avoids
+  // snprintf and formats only the parts that vary.
+  char rootDigits[20];
+  char ticksDigits[20];
+  auto rootLen = folly::uint64ToBufferUnsafe(root_number, rootDigits);
+  auto ticksLen = folly::uint64ToBufferUnsafe(ticks, ticksDigits);
+  size_t len = proc_clock_prefix_len + rootLen + 1 + ticksLen;
+  if (len >= bufsize) {
     return false;
   }
-  return (size_t)res < bufsize;
+
+  char* out = buf;
+  memcpy(out, proc_clock_prefix, proc_clock_prefix_len);
+  out += proc_clock_prefix_len;
+  memcpy(out, rootDigits, rootLen);
+  out += rootLen;
+  *out++ = ':';
+  memcpy(out, ticksDigits, ticksLen);
+  out += ticksLen;
+  *out = '\0';
+  return true;
 }
 
 w_string ClockPosition::toClockString() const {
+  // Every response to a settle, and every subscriber it is fanned out to,
+  // asks for the same clock, so remember the last one formatted.
+  thread_local ClockPosition lastPosition;
+  thread_local w_string lastClock;
+  if (!lastClock.empty() && lastPosition.rootNumber == rootNumber &&
+      lastPosition.ticks == ticks) {
+    return lastClock;
+  }
+
   char clockbuf[128];
   if (!clock_id_string(rootNumber, ticks, clockbuf, sizeof(clockbuf))) {
     throw std::runtime_error("clock is too big for clockbuf");
   }
-  return w_string(clockbuf, W_STRING_UNICODE);
+  lastClock = w_string(clockbuf, W_STRING_UNICODE);
+  lastPosition = *this;
+  return lastClock;
 }
 
 json_ref ClockSpec::toJson() const {
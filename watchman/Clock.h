@@ -14,6 +14,8 @@
 
 namespace watchman {
 
+class NamedCursorMap;
+
 using ClockTicks = uint64_t;
 using ClockRoot = uint64_t;
 
@@ -107,17 +109,28 @@ struct ClockSpec {
 
   /** Evaluate the clockspec against the inputs, returning
    * the effective since parameter.
-   * If cursorMap is passed in, it MUST be unlocked, as this method
-   * will acquire a lock to evaluate a named cursor. */
+   * Evaluating a named cursor moves it to position, so cursorMap is
+   * required for those. */
   QuerySince evaluate(
       const ClockPosition& position,
       const ClockTicks lastAgeOutTick,
-      folly::Synchronized<std::unordered_map<w_string, ClockTicks>>* cursorMap =
-          nullptr) const;
+      NamedCursorMap* cursorMap = nullptr) const;
 
   /** Initializes some global state needed for clockspec evaluation */
   static void init();
 
+  /** From now on, clocks that `previous`, an earlier server instance, handed
+   * out for the root that is now `rootNumber` are evaluated as though this
+   * instance handed them out, if their ticks are no later than those of
+   * `previous`.  Only valid if the root continued the ticks of `previous`. */
+  static void honorPreviousInstance(
+      ClockRoot rootNumber,
+      const Clock& previous);
+  static void forgetPreviousInstances(ClockRoot rootNumber);
+
+  /** Returns the clock that this server instance hands out for `position` */
+  static Clock currentInstance(const ClockPosition& position);
+
   inline const ClockPosition& position() const {
     auto* c = std::get_if<Clock>(&spec);
     w_check(c, "position() called for non-clock clockspec");
@@ -191,7 +191,9 @@ class TypedCommand : public CommandDefinition {
     using Request = typename T::Request;
     auto encodedResponse = serde::encode(T::handle(
         client, serde::decode<Request>(json_array(std::move(adjusted_args)))));
-    return UntypedResponse{encodedResponse.object()};
+    auto& fields = encodedResponse.object();
+    return UntypedResponse{
+        std::unordered_map<w_string, json_ref>{fields.begin(), fields.end()}};
   }
 };
 
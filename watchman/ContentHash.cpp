@@ -8,10 +8,15 @@
 #include "watchman/ContentHash.h"
 #include <fmt/core.h>
 #include <folly/ScopeGuard.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
 #include <string>
 #include "watchman/Hash.h"
 #include "watchman/Logging.h"
+#include "watchman/Options.h"
 #include "watchman/ThreadPool.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/watchman_stream.h"
 
@@ -24,15 +29,33 @@
 #include <openssl/sha.h>
 #endif
 
+#ifdef HAVE_XXHASH
+#include <xxhash.h> // @manual
+#endif
+
 namespace watchman {
 
 using HashValue = typename ContentHashCache::HashValue;
 using Node = typename ContentHashCache::Node;
 
+bool isContentHashAlgorithmSupported(ContentHashAlgorithm algorithm) {
+  switch (algorithm) {
+    case ContentHashAlgorithm::Sha1:
+      return true;
+    case ContentHashAlgorithm::Xxh3:
+#ifdef HAVE_XXHASH
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
 bool ContentHashCacheKey::operator==(const ContentHashCacheKey& other) const {
   return fileSize == other.fileSize && mtime.tv_sec == other.mtime.tv_sec &&
-      mtime.tv_nsec == other.mtime.tv_nsec &&
-      relativePath == other.relativePath;
+      mtime.tv_nsec == other.mtime.tv_nsec && ino == other.ino &&
+      algorithm == other.algorithm && relativePath == other.relativePath;
 }
 
 std::size_t ContentHashCacheKey::hashValue() const {
@@ -40,24 +63,96 @@ std::size_t ContentHashCacheKey::hashValue() const {
       {relativePath.hashValue(),
        fileSize,
        static_cast<uint64_t>(mtime.tv_sec),
-       static_cast<uint64_t>(mtime.tv_nsec)});
+       static_cast<uint64_t>(mtime.tv_nsec),
+       ino,
+       static_cast<uint64_t>(algorithm)});
 }
 
 ContentHashCache::ContentHashCache(
     const w_string& rootPath,
     size_t maxItems,
-    std::chrono::milliseconds errorTTL)
-    : cache_(maxItems, errorTTL), rootPath_(rootPath) {}
+    std::chrono::milliseconds errorTTL,
+    size_t maxConcurrency,
+    size_t inlineMaxSize)
+    : cache_(maxItems, errorTTL),
+      rootPath_(rootPath),
+      maxConcurrency_(maxConcurrency),
+      inlineMaxSize_(inlineMaxSize) {}
 
 folly::Future<std::shared_ptr<const Node>> ContentHashCache::get(
-    const ContentHashCacheKey& key) {
-  return cache_.get(
-      key, [this](const ContentHashCacheKey& k) { return computeHash(k); });
+    const ContentHashCacheKey& key,
+    bool* computed) {
+  if (computed) {
+    *computed = false;
+  }
+  // The getter runs before cache_.get() returns, if at all
+  return cache_.get(key, [this, computed](const ContentHashCacheKey& k) {
+    if (computed) {
+      *computed = true;
+    }
+    return computeHash(k);
+  });
+}
+
+namespace {
+// Large enough that hashing a big file takes few read() calls, but allocated
+// once per thread rather than on the stack.
+constexpr size_t kHashReadBufferSize = 256 * 1024;
+
+uint8_t* getHashReadBuffer() {
+  thread_local std::unique_ptr<uint8_t[]> buffer{
+      new uint8_t[kHashReadBufferSize]};
+  return buffer.get();
 }
 
-HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
+#ifdef HAVE_XXHASH
+HashValue computeXxh3(
+    watchman_stream& stm,
+    uint8_t* buf,
+    const char* fullPath) {
+  // XXH3 picks the widest vector instructions that it was compiled for
+  XXH3_state_t* state = XXH3_createState();
+  if (!state) {
+    throw std::bad_alloc();
+  }
+  SCOPE_EXIT {
+    XXH3_freeState(state);
+  };
+  XXH3_128bits_reset(state);
+
+  while (true) {
+    auto n = stm.read(buf, kHashReadBufferSize);
+    if (n == 0) {
+      break;
+    }
+    if (n < 0) {
+      throw std::system_error(
+          errno,
+          std::generic_category(),
+          fmt::format("while reading from {}", fullPath));
+    }
+    XXH3_128bits_update(state, buf, n);
+  }
+
+  XXH128_canonical_t canonical;
+  XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(state));
+  HashValue result{};
+  static_assert(sizeof(canonical.digest) <= sizeof(HashValue));
+  memcpy(result.data(), canonical.digest, sizeof(canonical.digest));
+  return result;
+}
+#endif
+} // namespace
+
+HashValue ContentHashCache::computeHashImmediate(
+    const char* fullPath,
+    ContentHashAlgorithm algorithm) {
   HashValue result;
-  uint8_t buf[8192];
+  uint8_t* buf = getHashReadBuffer();
+
+  if (!isContentHashAlgorithmSupported(algorithm)) {
+    throw std::runtime_error("content hash not supported by this build");
+  }
 
   auto stm = w_stm_open(fullPath, O_RDONLY);
   if (!stm) {
@@ -65,12 +160,18 @@ HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
         errno, std::generic_category(), fmt::format("w_stm_open {}", fullPath));
   }
 
+#ifdef HAVE_XXHASH
+  if (algorithm == ContentHashAlgorithm::Xxh3) {
+    return computeXxh3(*stm, buf, fullPath);
+  }
+#endif
+
 #ifndef _WIN32
   SHA_CTX ctx;
   SHA1_Init(&ctx);
 
   while (true) {
-    auto n = stm->read(buf, sizeof(buf));
+    auto n = stm->read(buf, kHashReadBufferSize);
     if (n == 0) {
       break;
     }
@@ -112,7 +213,7 @@ HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
   };
 
   while (true) {
-    auto n = stm->read(buf, sizeof(buf));
+    auto n = stm->read(buf, kHashReadBufferSize);
     if (n == 0) {
       break;
     }
@@ -138,10 +239,48 @@ HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
   return result;
 }
 
+std::shared_ptr<ContentHashStore> ContentHashCache::getPersistentStore() {
+  static const std::shared_ptr<ContentHashStore> store =
+      []() -> std::shared_ptr<ContentHashStore> {
+    if (!cfg_get_bool("content_hash_persistent_store", false)) {
+      return nullptr;
+    }
+    auto capacity =
+        cfg_get_int("content_hash_persistent_store_entries", 256 * 1024);
+    auto path = w_string::pathCat(
+        {w_string_piece(flags.watchman_state_file).dirName(),
+         "content-hashes"});
+    try {
+      return std::make_shared<ContentHashStore>(
+          path.string(), size_t(std::max(json_int_t(1), capacity)));
+    } catch (const std::exception& exc) {
+      log(ERR,
+          "failed to open persistent content hash store ",
+          path,
+          ": ",
+          exc.what(),
+          "\n");
+      return nullptr;
+    }
+  }();
+  return store;
+}
+
 HashValue ContentHashCache::computeHashImmediate(
     const ContentHashCacheKey& key) const {
   auto fullPath = w_string::pathCat({rootPath_, key.relativePath});
-  auto result = computeHashImmediate(fullPath.c_str());
+  // The persistent store only holds SHA-1 digests
+  auto store = key.algorithm == ContentHashAlgorithm::Sha1
+      ? getPersistentStore()
+      : nullptr;
+  ContentHashStoreKey storeKey{fullPath, key.fileSize, key.mtime, key.ino};
+  if (store) {
+    if (auto stored = store->lookup(storeKey)) {
+      return *stored;
+    }
+  }
+
+  auto result = computeHashImmediate(fullPath.c_str(), key.algorithm);
 
   // Since TOCTOU is everywhere and everything, double check to make sure that
   // the file looks like we were expecting at the start.  If it isn't, then
@@ -150,18 +289,64 @@ HashValue ContentHashCache::computeHashImmediate(
   auto stat = getFileInformation(fullPath.c_str());
   if (size_t(stat.size) != key.fileSize ||
       stat.mtime.tv_sec != key.mtime.tv_sec ||
-      stat.mtime.tv_nsec != key.mtime.tv_nsec) {
+      stat.mtime.tv_nsec != key.mtime.tv_nsec ||
+      (key.ino && stat.ino != key.ino)) {
     throw std::runtime_error(
         "metadata changed during hashing; query again to get latest status");
   }
 
+  if (store) {
+    store->store(storeKey, result);
+  }
   return result;
 }
 
 folly::Future<HashValue> ContentHashCache::computeHash(
     const ContentHashCacheKey& key) const {
-  return folly::via(
-      &getThreadPool(), [key, this] { return computeHashImmediate(key); });
+  if (key.fileSize <= inlineMaxSize_) {
+    // Cheaper to read it here than to hand it off to another thread
+    return folly::makeFutureWith([&] { return computeHashImmediate(key); });
+  }
+
+  folly::Promise<HashValue> promise;
+  auto future = promise.getFuture();
+  schedule([this, key, promise = std::move(promise)]() mutable {
+    promise.setWith([&] { return computeHashImmediate(key); });
+  });
+  return future;
+}
+
+void ContentHashCache::schedule(folly::Func func) const {
+  {
+    auto state = scheduler_.lock();
+    if (maxConcurrency_ && state->running >= maxConcurrency_) {
+      state->queue.push_back(std::move(func));
+      return;
+    }
+    ++state->running;
+  }
+  dispatch(std::move(func));
+}
+
+void ContentHashCache::dispatch(folly::Func func) const {
+  getThreadPool().add(
+      [this, func = std::move(func)]() mutable {
+        func();
+
+        // Hand our slot to the next waiting computation, if any
+        folly::Func next;
+        {
+          auto state = scheduler_.lock();
+          if (state->queue.empty()) {
+            --state->running;
+            return;
+          }
+          next = std::move(state->queue.front());
+          state->queue.pop_front();
+        }
+        dispatch(std::move(next));
+      },
+      WorkClass::Hash);
 }
 
 const w_string& ContentHashCache::rootPath() const {
@@ -171,4 +356,8 @@ const w_string& ContentHashCache::rootPath() const {
 CacheStats ContentHashCache::stats() const {
   return cache_.stats();
 }
+
+void ContentHashCache::clear() {
+  cache_.clear();
+}
 } // namespace watchman
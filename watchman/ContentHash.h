@@ -6,12 +6,29 @@
  */
 
 #pragma once
+#include <folly/Function.h>
+#include <folly/Synchronized.h>
 #include <array>
+#include <deque>
+#include <mutex>
+#include "watchman/ContentHashStore.h"
 #include "watchman/LRUCache.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
 
 namespace watchman {
+
+// The digests that ContentHashCache can compute
+enum class ContentHashAlgorithm : uint8_t {
+  Sha1,
+  // XXH3 with 128-bit output.  Much cheaper than SHA-1, but not
+  // cryptographic.  Only available when built with xxhash.
+  Xxh3,
+};
+
+// Whether this build can compute digests with `algorithm`
+bool isContentHashAlgorithmSupported(ContentHashAlgorithm algorithm);
+
 struct ContentHashCacheKey {
   // Path relative to the watched root
   w_string relativePath;
@@ -19,6 +36,10 @@ struct ContentHashCacheKey {
   size_t fileSize;
   // The modification time
   struct timespec mtime;
+  // The inode number, so that a replaced file with the same size and mtime
+  // is not mistaken for the original
+  uint64_t ino{0};
+  ContentHashAlgorithm algorithm{ContentHashAlgorithm::Sha1};
 
   // Computes a hash value for use in the cache map
   std::size_t hashValue() const;
@@ -38,24 +59,34 @@ struct hash<watchman::ContentHashCacheKey> {
 namespace watchman {
 class ContentHashCache {
  public:
+  // Large enough for every algorithm.  A 128-bit XXH3 digest fills the
+  // first 16 bytes and leaves the rest zero.
   using HashValue = std::array<uint8_t, 20>;
-  using Node = LRUCache<ContentHashCacheKey, HashValue>::NodeType;
+  using Node = ShardedLRUCache<ContentHashCacheKey, HashValue>::NodeType;
 
   // Construct a cache for a given root, holding the specified
   // maximum number of items, using the configured negative
   // caching TTL.
+  // At most maxConcurrency hashes for this root run on the content hash
+  // pool at once (0 means no per-root limit), and files no larger than
+  // inlineMaxSize bytes are hashed on the calling thread instead.
   ContentHashCache(
       const w_string& rootPath,
       size_t maxItems,
-      std::chrono::milliseconds errorTTL);
+      std::chrono::milliseconds errorTTL,
+      size_t maxConcurrency = 0,
+      size_t inlineMaxSize = 0);
 
   // Obtain the content hash for the given input.
   // If the result is in the cache it will return a ready future
   // holding the result.  Otherwise, computeHash will be invoked
   // to populate the cache.  Returns a future with the result
   // of the lookup.
+  // If `computed` is non-null, it is set to whether the hash had to be
+  // computed rather than being already cached or pending.
   folly::Future<std::shared_ptr<const Node>> get(
-      const ContentHashCacheKey& key);
+      const ContentHashCacheKey& key,
+      bool* computed = nullptr);
 
   // Compute the hash value for a given input.
   // This will block the calling thread while the I/O is performed.
@@ -65,9 +96,16 @@ class ContentHashCache {
   // Compute the hash value for a given input.
   // This will block the calling thread while the I/O is performed.
   // Throws exceptions for any errors that may occur.
-  static HashValue computeHashImmediate(const char* fullPath);
+  static HashValue computeHashImmediate(
+      const char* fullPath,
+      ContentHashAlgorithm algorithm = ContentHashAlgorithm::Sha1);
 
-  // Compute the hash value for a given input via the thread pool.
+  // Returns the process-wide persistent hash store, or nullptr if it is
+  // disabled or could not be opened.
+  static std::shared_ptr<ContentHashStore> getPersistentStore();
+
+  // Compute the hash value for a given input via the content hash pool,
+  // or immediately if the file is small enough.
   // Returns a future to operate on the result of this async operation
   folly::Future<HashValue> computeHash(const ContentHashCacheKey& key) const;
 
@@ -77,8 +115,25 @@ class ContentHashCache {
   // Returns cache statistics
   CacheStats stats() const;
 
+  // Discards every cached entry
+  void clear();
+
  private:
-  LRUCache<ContentHashCacheKey, HashValue> cache_;
+  struct SchedulerState {
+    size_t running{0};
+    // Computations waiting for one of this root's concurrency slots.
+    std::deque<folly::Func> queue;
+  };
+
+  // Runs func on the content hash pool once fewer than maxConcurrency_ of
+  // this root's computations are running there. func must not throw.
+  void schedule(folly::Func func) const;
+  void dispatch(folly::Func func) const;
+
+  ShardedLRUCache<ContentHashCacheKey, HashValue> cache_;
   w_string rootPath_;
+  size_t maxConcurrency_;
+  size_t inlineMaxSize_;
+  mutable folly::Synchronized<SchedulerState, std::mutex> scheduler_;
 };
 } // namespace watchman
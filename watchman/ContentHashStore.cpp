@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ContentHashStore.h"
+#include <fmt/core.h>
+#include <folly/hash/SpookyHashV2.h>
+#include <stddef.h>
+#include <string.h>
+#include <system_error>
+#include "watchman/fs/FileDescriptor.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace watchman {
+
+namespace {
+using folly::hash::SpookyHashV2;
+
+constexpr char kMagic[8] = {'W', 'M', 'C', 'H', 'A', 'S', 'H', '1'};
+constexpr uint32_t kVersion = 1;
+
+// How many consecutive slots a path may occupy before we evict
+constexpr size_t kMaxProbe = 8;
+
+// Rounds up to a power of two so that slot selection is a mask
+size_t roundUpSlotCount(size_t capacity) {
+  size_t count = 64;
+  while (count < capacity) {
+    count <<= 1;
+  }
+  return count;
+}
+} // namespace
+
+struct ContentHashStore::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t slotSize;
+  uint64_t slotCount;
+  uint8_t reserved[40];
+};
+static_assert(sizeof(ContentHashStore::Header) == 64);
+
+struct ContentHashStore::Slot {
+  uint64_t pathHash[2];
+  uint64_t fileSize;
+  int64_t mtimeSec;
+  uint64_t ino;
+  uint32_t mtimeNsec;
+  // Covers every other field; zero for an empty slot.
+  uint32_t checksum;
+  HashValue hash;
+  uint8_t reserved[4];
+
+  uint32_t computeChecksum() const {
+    auto prefix = SpookyHashV2::Hash32(this, offsetof(Slot, checksum), 0);
+    // Never zero, so that an all-zero slot is never mistaken for a valid one
+    return SpookyHashV2::Hash32(&hash, sizeof(hash), prefix) | 1;
+  }
+
+  bool isValid() const {
+    return checksum != 0 && checksum == computeChecksum();
+  }
+};
+static_assert(sizeof(ContentHashStore::Slot) == 72);
+
+#ifndef _WIN32
+ContentHashStore::ContentHashStore(const std::string& path, size_t capacity)
+    : slotCount_(roundUpSlotCount(capacity)) {
+  mappingSize_ = sizeof(Header) + slotCount_ * sizeof(Slot);
+
+  FileDescriptor fd(
+      ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600),
+      FileDescriptor::FDType::Generic);
+  if (!fd) {
+    throw std::system_error(
+        errno, std::generic_category(), fmt::format("open {}", path));
+  }
+
+  Header expected{};
+  memcpy(expected.magic, kMagic, sizeof(kMagic));
+  expected.version = kVersion;
+  expected.slotSize = sizeof(Slot);
+  expected.slotCount = slotCount_;
+
+  Header existing{};
+  struct stat st;
+  if (fstat(fd.fd(), &st) == -1) {
+    throw std::system_error(
+        errno, std::generic_category(), fmt::format("fstat {}", path));
+  }
+  bool reuse = size_t(st.st_size) == mappingSize_ &&
+      pread(fd.fd(), &existing, sizeof(existing), 0) == sizeof(existing) &&
+      memcmp(&existing, &expected, sizeof(expected)) == 0;
+
+  if (!reuse) {
+    // Start from an empty, sparse table
+    if (ftruncate(fd.fd(), 0) == -1 ||
+        ftruncate(fd.fd(), off_t(mappingSize_)) == -1) {
+      throw std::system_error(
+          errno, std::generic_category(), fmt::format("ftruncate {}", path));
+    }
+    if (pwrite(fd.fd(), &expected, sizeof(expected), 0) != sizeof(expected)) {
+      throw std::system_error(
+          errno, std::generic_category(), fmt::format("pwrite {}", path));
+    }
+  }
+
+  mapping_ = mmap(
+      nullptr, mappingSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd.fd(), 0);
+  if (mapping_ == MAP_FAILED) {
+    mapping_ = nullptr;
+    throw std::system_error(
+        errno, std::generic_category(), fmt::format("mmap {}", path));
+  }
+}
+
+ContentHashStore::~ContentHashStore() {
+  if (mapping_) {
+    munmap(mapping_, mappingSize_);
+  }
+}
+#else
+ContentHashStore::ContentHashStore(const std::string& path, size_t) {
+  throw std::system_error(
+      ENOTSUP,
+      std::generic_category(),
+      fmt::format("ContentHashStore {}: not supported on Windows", path));
+}
+
+ContentHashStore::~ContentHashStore() = default;
+#endif
+
+ContentHashStore::Slot* ContentHashStore::slots() const {
+  auto base = static_cast<char*>(mapping_) + sizeof(Header);
+  return reinterpret_cast<Slot*>(base);
+}
+
+std::optional<ContentHashStore::HashValue> ContentHashStore::lookup(
+    const ContentHashStoreKey& key) const {
+  uint64_t h1 = 0;
+  uint64_t h2 = 0;
+  SpookyHashV2::Hash128(key.fullPath.data(), key.fullPath.size(), &h1, &h2);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto* table = slots();
+  for (size_t i = 0; i < kMaxProbe; ++i) {
+    const Slot& slot = table[(h1 + i) & (slotCount_ - 1)];
+    if (slot.pathHash[0] != h1 || slot.pathHash[1] != h2 || !slot.isValid()) {
+      continue;
+    }
+    if (slot.fileSize == key.fileSize &&
+        slot.mtimeSec == int64_t(key.mtime.tv_sec) &&
+        slot.mtimeNsec == uint32_t(key.mtime.tv_nsec) && slot.ino == key.ino) {
+      return slot.hash;
+    }
+    // The file has changed since this entry was recorded
+    return std::nullopt;
+  }
+  return std::nullopt;
+}
+
+void ContentHashStore::store(
+    const ContentHashStoreKey& key,
+    const HashValue& hash) {
+  uint64_t h1 = 0;
+  uint64_t h2 = 0;
+  SpookyHashV2::Hash128(key.fullPath.data(), key.fullPath.size(), &h1, &h2);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto* table = slots();
+  Slot* target = nullptr;
+  for (size_t i = 0; i < kMaxProbe; ++i) {
+    Slot& slot = table[(h1 + i) & (slotCount_ - 1)];
+    if (!slot.isValid()) {
+      if (!target) {
+        target = &slot;
+      }
+      continue;
+    }
+    if (slot.pathHash[0] == h1 && slot.pathHash[1] == h2) {
+      target = &slot;
+      break;
+    }
+  }
+  if (!target) {
+    target = &table[h1 & (slotCount_ - 1)];
+  }
+
+  // Invalidate the slot first so that a crash part way through leaves it
+  // looking empty rather than half-written.
+  target->checksum = 0;
+  target->pathHash[0] = h1;
+  target->pathHash[1] = h2;
+  target->fileSize = key.fileSize;
+  target->mtimeSec = int64_t(key.mtime.tv_sec);
+  target->mtimeNsec = uint32_t(key.mtime.tv_nsec);
+  target->ino = key.ino;
+  target->hash = hash;
+  memset(target->reserved, 0, sizeof(target->reserved));
+  target->checksum = target->computeChecksum();
+}
+
+} // namespace watchman
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <array>
+#include <mutex>
+#include <optional>
+#include <string>
+#include "watchman/watchman_string.h"
+#include "watchman/watchman_system.h"
+
+namespace watchman {
+
+/**
+ * The file metadata that a stored content hash is valid for. If any of these
+ * differ from the time the hash was computed, the hash is not returned.
+ */
+struct ContentHashStoreKey {
+  // Absolute path to the file, so that overlapping roots share entries.
+  w_string_piece fullPath;
+  uint64_t fileSize;
+  struct timespec mtime;
+  uint64_t ino;
+};
+
+/**
+ * A fixed-size, memory-mapped table of content hashes that persists across
+ * restarts of the server.
+ *
+ * Each path hashes to a short run of slots; when all of them are taken, the
+ * first is overwritten, so the table behaves like a lossy cache rather than
+ * growing without bound. Every slot carries a checksum so that a slot torn by
+ * a crash mid-write is treated as empty rather than returning a bad hash.
+ *
+ * Not supported on Windows, where the constructor throws.
+ */
+class ContentHashStore {
+ public:
+  using HashValue = std::array<uint8_t, 20>;
+
+  /**
+   * Opens the store at `path`, creating it with room for about `capacity`
+   * entries if it does not exist, or recreating it if it has a different
+   * format or capacity. Throws std::system_error on failure.
+   */
+  ContentHashStore(const std::string& path, size_t capacity);
+  ~ContentHashStore();
+
+  ContentHashStore(const ContentHashStore&) = delete;
+  ContentHashStore& operator=(const ContentHashStore&) = delete;
+
+  /**
+   * Returns the stored hash for key's path if it was recorded with exactly
+   * the same metadata.
+   */
+  std::optional<HashValue> lookup(const ContentHashStoreKey& key) const;
+
+  /**
+   * Records the hash for key, replacing any entry for the same path.
+   */
+  void store(const ContentHashStoreKey& key, const HashValue& hash);
+
+  /**
+   * Returns the number of slots in the table.
+   */
+  size_t capacity() const {
+    return slotCount_;
+  }
+
+ private:
+  struct Header;
+  struct Slot;
+
+  Slot* slots() const;
+
+  mutable std::mutex mutex_;
+  void* mapping_{nullptr};
+  size_t mappingSize_{0};
+  size_t slotCount_{0};
+};
+
+} // namespace watchman
@@ -11,11 +11,18 @@
 #include <exception>
 #include <optional>
 #include "watchman/Logging.h"
+#include "watchman/Tracepoint.h"
 #include "watchman/watchman_stream.h"
 #include "watchman/watchman_system.h"
 
 namespace watchman {
 
+namespace {
+// A generation that has been outstanding for this long has probably been
+// lost along with its cookie dir, so later callers stop waiting behind it.
+constexpr std::chrono::seconds kStalledGeneration{1};
+} // namespace
+
 CookieSync::Cookie::Cookie(uint64_t numCookies) : numPending(numCookies) {}
 
 CookieSync::CookieSync(FileSystem& fs, const w_string& dir) : fileSystem_{fs} {
@@ -50,16 +57,26 @@ void CookieSync::removeCookieDir(const w_string& dir) {
 
   // Cancel the cookies in the removed directory. These are considered to be
   // serviced.
-  auto cookies = cookies_.wlock();
-  for (auto it = cookies->begin(); it != cookies->end();) {
-    auto& [cookiePath, cookie] = *it;
-    if (cookiePath.piece().startsWith(dir)) {
-      cookie->notify();
-      it = cookies->erase(it);
-    } else {
-      ++it;
+  std::vector<std::shared_ptr<Cookie>> completed;
+  {
+    auto cookies = cookies_.wlock();
+    for (auto it = cookies->begin(); it != cookies->end();) {
+      auto& [cookiePath, cookie] = *it;
+      if (cookiePath.piece().startsWith(dir)) {
+        if (cookie->notify()) {
+          completed.push_back(std::move(cookie));
+        }
+        it = cookies->erase(it);
+      } else {
+        ++it;
+      }
     }
   }
+
+  for (auto& cookie : completed) {
+    cookie->complete();
+    generationDone(/*aborted=*/false);
+  }
 }
 
 void CookieSync::setCookieDir(const w_string& dir) {
@@ -79,8 +96,69 @@ std::vector<w_string> CookieSync::getOutstandingCookieFileList() const {
 }
 
 folly::SemiFuture<CookieSync::SyncResult> CookieSync::sync() {
+  folly::Promise<SyncResult> promise;
+  auto future = promise.getSemiFuture();
+
+  Waiters waiters;
+  {
+    auto generations = generations_.wlock();
+    if (generations->outstanding &&
+        std::chrono::steady_clock::now() - generations->touchedAt <
+            kStalledGeneration) {
+      // The outstanding cookie may have been touched before we were called,
+      // so it can't be shared. Wait for the next one instead.
+      generations->next.push_back(std::move(promise));
+      return future;
+    }
+    generations->outstanding = true;
+    waiters = std::move(generations->next);
+    generations->next.clear();
+  }
+
+  waiters.push_back(std::move(promise));
+  startGeneration(std::move(waiters));
+  return future;
+}
+
+void CookieSync::startGeneration(Waiters waiters) {
+  while (!waiters.empty()) {
+    auto error = touchCookies(waiters);
+    if (!error) {
+      return;
+    }
+    for (auto& waiter : waiters) {
+      waiter.setException(error);
+    }
+    waiters = takeNextWaiters();
+  }
+}
+
+CookieSync::Waiters CookieSync::takeNextWaiters() {
+  auto generations = generations_.wlock();
+  if (generations->next.empty()) {
+    generations->outstanding = false;
+    return {};
+  }
+  return std::exchange(generations->next, {});
+}
+
+void CookieSync::generationDone(bool aborted) {
+  auto waiters = takeNextWaiters();
+  if (!aborted) {
+    startGeneration(std::move(waiters));
+    return;
+  }
+  // Those waiting for the next generation are aborted too, and retry.
+  while (!waiters.empty()) {
+    for (auto& waiter : waiters) {
+      waiter.setException(folly::make_exception_wrapper<CookieSyncAborted>());
+    }
+    waiters = takeNextWaiters();
+  }
+}
+
+folly::exception_wrapper CookieSync::touchCookies(Waiters& waiters) {
   std::shared_ptr<Cookie> cookie;
-  std::vector<w_string> cookieFileNames;
   {
     // We need to hold the cookieDirs lock while we lay cookies on disk to
     // avoid a race where a cookie directory is removed after collecting all
@@ -92,6 +170,7 @@ folly::SemiFuture<CookieSync::SyncResult> CookieSync::sync() {
     auto serial = serial_++;
 
     cookie = std::make_shared<Cookie>(prefixes.size());
+    generations_.wlock()->touchedAt = std::chrono::steady_clock::now();
 
     // Even though we only write to the cookie at the end of the function, we
     // need to hold it while the files are written on disk to avoid a race where
@@ -103,10 +182,10 @@ folly::SemiFuture<CookieSync::SyncResult> CookieSync::sync() {
     CookieMap pendingCookies;
     std::optional<std::tuple<w_string, int>> lastError;
 
-    cookieFileNames.reserve(prefixes.size());
+    cookie->cookieFileNames.reserve(prefixes.size());
     for (const auto& prefix : prefixes) {
       auto path_str = w_string::build(prefix, serial);
-      cookieFileNames.push_back(path_str);
+      cookie->cookieFileNames.push_back(path_str);
 
       /* then touch the file */
       try {
@@ -122,6 +201,8 @@ folly::SemiFuture<CookieSync::SyncResult> CookieSync::sync() {
         continue;
       }
 
+      WATCHMAN_TRACE(cookie__written, path_str.c_str());
+
       /* insert the cookie into the temporary map */
       pendingCookies[path_str] = cookie;
       logf(DBG, "sync created cookie file {}\n", path_str);
@@ -130,7 +211,7 @@ folly::SemiFuture<CookieSync::SyncResult> CookieSync::sync() {
     if (pendingCookies.size() == 0) {
       w_assert(lastError.has_value(), "no cookies written, but no errors set");
       auto errCode = std::get<int>(*lastError);
-      throw std::system_error(
+      return folly::make_exception_wrapper<std::system_error>(
           errCode,
           std::generic_category(),
           fmt::format(
@@ -139,13 +220,13 @@ folly::SemiFuture<CookieSync::SyncResult> CookieSync::sync() {
               folly::errnoStr(errCode)));
     }
 
+    // The cookie can't be observed until the lock is released, so the
+    // waiters are in place before anyone can complete them.
+    cookie->waiters = std::move(waiters);
+    waiters.clear();
     cookiesLock->insert(pendingCookies.begin(), pendingCookies.end());
   }
-
-  return cookie->promise.getSemiFuture().deferValue(
-      [cookieFileNames = std::move(cookieFileNames)](folly::Unit) mutable {
-        return SyncResult{std::move(cookieFileNames)};
-      });
+  return {};
 }
 
 CookieSync::SyncResult CookieSync::syncToNow(
@@ -172,6 +253,9 @@ CookieSync::SyncResult CookieSync::syncToNow(
       // Success!
       return std::move(result).value();
     }
+    if (!result.hasException<CookieSyncAborted>()) {
+      result.throwUnlessValue();
+    }
 
     // Sync was aborted by a recrawl; recompute the timeout
     // and wait again if we still have time
@@ -194,16 +278,26 @@ void CookieSync::abortAllCookies() {
     log(ERR, "syncToNow: aborting cookie ", path, "\n");
     unlink(path.c_str());
 
-    if (cookie->numPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
-      cookie->promise.setException(
-          folly::make_exception_wrapper<CookieSyncAborted>());
+    if (cookie->notify()) {
+      cookie->abort();
+      generationDone(/*aborted=*/true);
     }
   }
 }
 
-void CookieSync::Cookie::notify() {
-  if (numPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
-    promise.setValue();
+bool CookieSync::Cookie::notify() {
+  return numPending.fetch_sub(1, std::memory_order_acq_rel) == 1;
+}
+
+void CookieSync::Cookie::complete() {
+  for (auto& waiter : waiters) {
+    waiter.setValue(SyncResult{cookieFileNames});
+  }
+}
+
+void CookieSync::Cookie::abort() {
+  for (auto& waiter : waiters) {
+    waiter.setException(folly::make_exception_wrapper<CookieSyncAborted>());
   }
 }
 
@@ -226,8 +320,12 @@ void CookieSync::notifyCookie(const w_string& path) {
     }
   }
 
+  WATCHMAN_TRACE(cookie__observed, path.c_str(), bool(cookie));
   if (cookie) {
-    cookie->notify();
+    if (cookie->notify()) {
+      cookie->complete();
+      generationDone(/*aborted=*/false);
+    }
 
     // The file may not exist at this point; we're just taking this
     // opportunity to remove it if nothing else has done so already.
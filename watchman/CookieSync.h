@@ -6,10 +6,12 @@
  */
 
 #pragma once
+#include <folly/SharedMutex.h>
 #include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
 #include "watchman/Cookie.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/telemetry/InstrumentedMutex.h"
 #include "watchman/watchman_string.h"
 
 namespace watchman {
@@ -54,6 +56,9 @@ class CookieSync {
    * Touches a cookie file and returns a Future that will
    * be ready when that cookie file is processed by the IO
    * thread at some future time.
+   * While a cookie is outstanding, callers share the next cookie, which is
+   * touched as soon as the outstanding one is observed, so that a crowd of
+   * concurrent queries costs two round trips rather than one per query.
    * Important: if you chain a lambda onto the future, it
    * will execute in the context of the IO thread.
    * It is recommended that you minimize the actions performed
@@ -91,15 +96,44 @@ class CookieSync {
   CookieSync(CookieSync&&) = delete;
   CookieSync& operator=(CookieSync&&) = delete;
 
+  using Waiters = std::vector<folly::Promise<SyncResult>>;
+
   struct Cookie {
-    folly::Promise<folly::Unit> promise;
+    Waiters waiters;
+    std::vector<w_string> cookieFileNames;
     std::atomic<uint64_t> numPending;
 
     explicit Cookie(uint64_t numCookies);
 
-    void notify();
+    // Returns true if this was the last of the cookie's files to be seen
+    bool notify();
+    void complete();
+    void abort();
+  };
+
+  // Tracks the cookie generation that concurrent syncs can share
+  struct Generations {
+    // Whether a generation has been touched but not yet observed
+    bool outstanding{false};
+    std::chrono::steady_clock::time_point touchedAt;
+    // Callers that arrived while a generation was outstanding
+    Waiters next;
   };
 
+  // Touches a cookie in each cookie dir on behalf of `waiters`, serving any
+  // callers that queue up meanwhile if that fails.
+  void startGeneration(Waiters waiters);
+
+  // Touches the cookie files, taking ownership of `waiters` on success.
+  folly::exception_wrapper touchCookies(Waiters& waiters);
+
+  // Called once the outstanding generation is observed or aborted.
+  void generationDone(bool aborted);
+
+  // Returns the queued callers, or marks that no generation is outstanding
+  // if there are none.
+  Waiters takeNextWaiters();
+
   struct CookieDirectories {
     // paths to the query cookies directories. A cookie will be written to each
     // of these when calling `sync`.
@@ -117,6 +151,13 @@ class CookieSync {
   // Serial number for cookie filename
   std::atomic<uint32_t> serial_{0};
   using CookieMap = std::unordered_map<w_string, std::shared_ptr<Cookie>>;
-  folly::Synchronized<CookieMap> cookies_;
+  folly::Synchronized<
+      CookieMap,
+      InstrumentedSharedMutex<
+          folly::SharedMutex,
+          &LockStats::cookiesWait,
+          &LockStats::cookiesHold>>
+      cookies_;
+  folly::Synchronized<Generations> generations_;
 };
 } // namespace watchman
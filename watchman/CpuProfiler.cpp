@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CpuProfiler.h"
+#include <fmt/core.h>
+#include <folly/Demangle.h>
+#include <folly/ScopeGuard.h>
+#include <folly/experimental/symbolizer/StackTrace.h>
+#include <folly/experimental/symbolizer/Symbolizer.h>
+#include <folly/system/ThreadId.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include "watchman/Logging.h"
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+namespace watchman {
+
+namespace {
+
+// Field numbers and wire types from pprof's profile.proto
+enum ProfileField : uint32_t {
+  kProfileSampleType = 1,
+  kProfileSample = 2,
+  kProfileLocation = 4,
+  kProfileFunction = 5,
+  kProfileStringTable = 6,
+  kProfileTimeNanos = 9,
+  kProfileDurationNanos = 10,
+  kProfilePeriodType = 11,
+  kProfilePeriod = 12,
+};
+enum ValueTypeField : uint32_t { kValueTypeType = 1, kValueTypeUnit = 2 };
+enum SampleField : uint32_t {
+  kSampleLocationId = 1,
+  kSampleValue = 2,
+  kSampleLabel = 3
+};
+enum LabelField : uint32_t { kLabelKey = 1, kLabelStr = 2 };
+enum LocationField : uint32_t {
+  kLocationId = 1,
+  kLocationAddress = 3,
+  kLocationLine = 4
+};
+enum LineField : uint32_t { kLineFunctionId = 1, kLineLine = 2 };
+enum FunctionField : uint32_t {
+  kFunctionId = 1,
+  kFunctionName = 2,
+  kFunctionSystemName = 3,
+  kFunctionFilename = 4,
+};
+
+constexpr uint32_t kWireVarint = 0;
+constexpr uint32_t kWireBytes = 2;
+
+void putVarint(std::string& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(char(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(char(value));
+}
+
+void putInt(std::string& out, uint32_t field, uint64_t value) {
+  putVarint(out, (field << 3) | kWireVarint);
+  putVarint(out, value);
+}
+
+void putBytes(std::string& out, uint32_t field, std::string_view bytes) {
+  putVarint(out, (field << 3) | kWireBytes);
+  putVarint(out, bytes.size());
+  out.append(bytes);
+}
+
+template <typename Int>
+void putPacked(std::string& out, uint32_t field, const std::vector<Int>& ints) {
+  std::string packed;
+  for (auto value : ints) {
+    putVarint(packed, uint64_t(value));
+  }
+  putBytes(out, field, packed);
+}
+
+std::string valueType(int64_t type, int64_t unit) {
+  std::string out;
+  putInt(out, kValueTypeType, type);
+  putInt(out, kValueTypeUnit, unit);
+  return out;
+}
+
+} // namespace
+
+PprofBuilder::PprofBuilder(
+    std::chrono::nanoseconds period,
+    Symbolize symbolize)
+    : period_{period}, symbolize_{std::move(symbolize)} {
+  // The string table starts with the empty string, and encode() needs the
+  // rest
+  for (auto str : {"", "samples", "count", "cpu", "nanoseconds", "thread"}) {
+    intern(str);
+  }
+}
+
+int64_t PprofBuilder::intern(std::string_view str) {
+  auto [it, inserted] =
+      stringIds_.emplace(std::string{str}, int64_t(strings_.size()));
+  if (inserted) {
+    strings_.emplace_back(str);
+  }
+  return it->second;
+}
+
+uint64_t PprofBuilder::locationFor(uintptr_t address, bool isLeaf) {
+  auto key = std::make_pair(address, isLeaf);
+  auto it = locationIds_.find(key);
+  if (it != locationIds_.end()) {
+    return it->second;
+  }
+
+  auto frame = symbolize_(address, isLeaf);
+  if (frame.function.empty()) {
+    frame.function = fmt::format("{:#x}", address);
+  }
+  auto functionKey =
+      std::make_pair(intern(frame.function), intern(frame.file));
+  auto [function, inserted] =
+      functionIds_.emplace(functionKey, functions_.size() + 1);
+  if (inserted) {
+    functions_.push_back(Function{functionKey.first, functionKey.second});
+  }
+
+  locations_.push_back(Location{address, function->second, frame.line});
+  auto id = uint64_t(locations_.size());
+  locationIds_.emplace(key, id);
+  return id;
+}
+
+void PprofBuilder::addSample(
+    const uintptr_t* stack,
+    size_t depth,
+    std::string_view threadName,
+    int64_t count) {
+  std::vector<uint64_t> locations;
+  locations.reserve(depth);
+  for (size_t i = 0; i < depth; ++i) {
+    locations.push_back(locationFor(stack[i], i == 0));
+  }
+  samples_[std::make_pair(intern(threadName), std::move(locations))] += count;
+}
+
+std::string PprofBuilder::encode(
+    std::chrono::system_clock::time_point start,
+    std::chrono::nanoseconds duration) const {
+  auto id = [this](const char* str) { return stringIds_.at(str); };
+
+  std::string out;
+  putBytes(out, kProfileSampleType, valueType(id("samples"), id("count")));
+  putBytes(out, kProfileSampleType, valueType(id("cpu"), id("nanoseconds")));
+
+  for (auto& [key, count] : samples_) {
+    std::string sample;
+    putPacked(sample, kSampleLocationId, key.second);
+    putPacked(
+        sample,
+        kSampleValue,
+        std::vector<int64_t>{count, count * int64_t(period_.count())});
+    std::string label;
+    putInt(label, kLabelKey, id("thread"));
+    putInt(label, kLabelStr, key.first);
+    putBytes(sample, kSampleLabel, label);
+    putBytes(out, kProfileSample, sample);
+  }
+
+  for (size_t i = 0; i < locations_.size(); ++i) {
+    auto& location = locations_[i];
+    std::string encoded;
+    putInt(encoded, kLocationId, i + 1);
+    putInt(encoded, kLocationAddress, location.address);
+    std::string line;
+    putInt(line, kLineFunctionId, location.function);
+    putInt(line, kLineLine, location.line);
+    putBytes(encoded, kLocationLine, line);
+    putBytes(out, kProfileLocation, encoded);
+  }
+
+  for (size_t i = 0; i < functions_.size(); ++i) {
+    auto& function = functions_[i];
+    std::string encoded;
+    putInt(encoded, kFunctionId, i + 1);
+    putInt(encoded, kFunctionName, function.name);
+    putInt(encoded, kFunctionSystemName, function.name);
+    putInt(encoded, kFunctionFilename, function.file);
+    putBytes(out, kProfileFunction, encoded);
+  }
+
+  for (auto& str : strings_) {
+    putBytes(out, kProfileStringTable, str);
+  }
+
+  putInt(
+      out,
+      kProfileTimeNanos,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          start.time_since_epoch())
+          .count());
+  putInt(out, kProfileDurationNanos, duration.count());
+  putBytes(out, kProfilePeriodType, valueType(id("cpu"), id("nanoseconds")));
+  putInt(out, kProfilePeriod, period_.count());
+  return out;
+}
+
+#ifndef _WIN32
+
+namespace {
+
+constexpr size_t kMaxFrames = 64;
+// The signal handler and the signal trampoline
+constexpr size_t kSkipFrames = 2;
+// Bounds the memory used by one profile, at about 40 MB
+constexpr size_t kMaxSamples = 64 * 1024;
+
+struct SampleSlot {
+  char threadName[64];
+  uint64_t threadId;
+  size_t depth;
+  uintptr_t frames[kMaxFrames];
+};
+
+struct Sampler {
+  std::unique_ptr<SampleSlot[]> slots{new SampleSlot[kMaxSamples]};
+  std::atomic<size_t> next{0};
+};
+
+std::atomic<Sampler*> activeSampler{nullptr};
+// Handlers that may still be using activeSampler
+std::atomic<int> samplingHandlers{0};
+std::atomic<bool> profiling{false};
+
+// Everything here has to be async-signal-safe
+void onProfilingSignal(int, siginfo_t*, void*) {
+  auto savedErrno = errno;
+  // Sequentially consistent, so that collectCpuProfile either sees this
+  // handler running or this handler sees the sampler gone
+  samplingHandlers.fetch_add(1);
+  if (auto* sampler = activeSampler.load()) {
+    auto index = sampler->next.fetch_add(1, std::memory_order_relaxed);
+    if (index < kMaxSamples) {
+      auto& slot = sampler->slots[index];
+      auto* name = Log::getThreadNameSignalSafe();
+      size_t len = 0;
+      for (; name[len] && len < sizeof(slot.threadName) - 1; ++len) {
+        slot.threadName[len] = name[len];
+      }
+      slot.threadName[len] = '\0';
+      slot.threadId = folly::getOSThreadID();
+      auto depth =
+          folly::symbolizer::getStackTraceSafe(slot.frames, kMaxFrames);
+      slot.depth = depth < 0 ? 0 : size_t(depth);
+    }
+  }
+  samplingHandlers.fetch_sub(1);
+  errno = savedErrno;
+}
+
+void installHandler() {
+  // The handler stays installed, doing nothing while no profile is being
+  // collected, so that a late SIGPROF can't terminate the process.
+  static bool installed = [] {
+    // The first stack trace may allocate while loading the unwinder
+    uintptr_t frames[kMaxFrames];
+    folly::symbolizer::getStackTraceSafe(frames, kMaxFrames);
+
+    struct sigaction sa {};
+    sa.sa_sigaction = onProfilingSignal;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, nullptr) != 0) {
+      throw std::system_error(
+          errno, std::generic_category(), "sigaction SIGPROF");
+    }
+    return true;
+  }();
+  (void)installed;
+}
+
+void setTimer(int hz) {
+  itimerval timer{};
+  if (hz > 0) {
+    timer.it_interval.tv_usec = 1000000 / hz;
+    timer.it_value = timer.it_interval;
+  }
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    throw std::system_error(
+        errno, std::generic_category(), "setitimer ITIMER_PROF");
+  }
+}
+
+class AddressSymbolizer {
+ public:
+  PprofBuilder::Frame operator()(uintptr_t address, bool isLeaf) {
+    // Return addresses point after the call, which may be the next line
+    auto pc = isLeaf ? address : address - 1;
+    PprofBuilder::Frame frame;
+#if FOLLY_HAVE_ELF && FOLLY_HAVE_DWARF
+    folly::symbolizer::SymbolizedFrame symbolized;
+    if (symbolizer_.symbolize(pc, symbolized) && symbolized.name) {
+      frame.function = folly::demangle(symbolized.name).toStdString();
+      if (symbolized.location.hasFileAndLine) {
+        frame.file = symbolized.location.file.toString();
+        frame.line = symbolized.location.line;
+      }
+      return frame;
+    }
+#endif
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(pc), &info)) {
+      if (info.dli_sname) {
+        frame.function = folly::demangle(info.dli_sname).toStdString();
+      }
+      if (info.dli_fname) {
+        frame.file = info.dli_fname;
+      }
+    }
+    return frame;
+  }
+
+ private:
+#if FOLLY_HAVE_ELF && FOLLY_HAVE_DWARF
+  folly::symbolizer::Symbolizer symbolizer_;
+#endif
+};
+
+} // namespace
+
+CpuProfile collectCpuProfile(std::chrono::milliseconds duration, int hz) {
+  if (hz <= 0 || hz > 1000) {
+    throw std::runtime_error("the sampling rate must be from 1 to 1000 Hz");
+  }
+  if (profiling.exchange(true)) {
+    throw std::runtime_error("a CPU profile is already being collected");
+  }
+  SCOPE_EXIT {
+    profiling.store(false);
+  };
+
+  installHandler();
+  auto sampler = std::make_unique<Sampler>();
+  auto start = std::chrono::system_clock::now();
+  activeSampler.store(sampler.get(), std::memory_order_release);
+  try {
+    setTimer(hz);
+  } catch (const std::exception&) {
+    activeSampler.store(nullptr, std::memory_order_release);
+    throw;
+  }
+  std::this_thread::sleep_for(duration);
+  setTimer(0);
+  activeSampler.store(nullptr);
+  while (samplingHandlers.load() != 0) {
+    std::this_thread::yield();
+  }
+  auto elapsed = std::chrono::system_clock::now() - start;
+
+  CpuProfile profile;
+  auto taken = sampler->next.load(std::memory_order_relaxed);
+  profile.samples = std::min(taken, kMaxSamples);
+  profile.dropped = taken - profile.samples;
+
+  PprofBuilder builder{
+      std::chrono::nanoseconds{1000000000 / hz}, AddressSymbolizer{}};
+  for (size_t i = 0; i < profile.samples; ++i) {
+    auto& slot = sampler->slots[i];
+    auto skip = std::min(slot.depth, kSkipFrames);
+    auto threadName = slot.threadName[0]
+        ? std::string{slot.threadName}
+        : fmt::format("tid {}", slot.threadId);
+    builder.addSample(slot.frames + skip, slot.depth - skip, threadName);
+  }
+  profile.pprof = builder.encode(
+      start,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed));
+  return profile;
+}
+
+#else
+
+CpuProfile collectCpuProfile(std::chrono::milliseconds, int) {
+  throw std::runtime_error("CPU profiling is not supported on Windows");
+}
+
+#endif
+
+} // namespace watchman
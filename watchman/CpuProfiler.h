@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * Builds a CPU profile in the protobuf format that `pprof` reads.  Each
+ * sample is labeled with the name of the thread it was taken on.
+ */
+class PprofBuilder {
+ public:
+  struct Frame {
+    std::string function;
+    std::string file;
+    int64_t line{0};
+  };
+
+  // Describes the code at an address in a stack
+  using Symbolize = std::function<Frame(uintptr_t address, bool isLeaf)>;
+
+  /**
+   * `period` is the CPU time that each sample stands for.
+   */
+  PprofBuilder(std::chrono::nanoseconds period, Symbolize symbolize);
+
+  /**
+   * Records `count` samples of `stack`, leaf first, on `threadName`.
+   */
+  void addSample(
+      const uintptr_t* stack,
+      size_t depth,
+      std::string_view threadName,
+      int64_t count = 1);
+
+  /**
+   * Returns the encoded profile, covering `duration` from `start`.
+   */
+  std::string encode(
+      std::chrono::system_clock::time_point start,
+      std::chrono::nanoseconds duration) const;
+
+ private:
+  struct Function {
+    int64_t name;
+    int64_t file;
+  };
+  struct Location {
+    uintptr_t address;
+    uint64_t function;
+    int64_t line;
+  };
+
+  int64_t intern(std::string_view str);
+  uint64_t locationFor(uintptr_t address, bool isLeaf);
+
+  const std::chrono::nanoseconds period_;
+  const Symbolize symbolize_;
+  std::vector<std::string> strings_;
+  std::unordered_map<std::string, int64_t> stringIds_;
+  // Ids are indices + 1, as 0 means none
+  std::vector<Function> functions_;
+  std::map<std::pair<int64_t, int64_t>, uint64_t> functionIds_;
+  std::vector<Location> locations_;
+  std::map<std::pair<uintptr_t, bool>, uint64_t> locationIds_;
+  // Sample counts by thread name string and location ids
+  std::map<std::pair<int64_t, std::vector<uint64_t>>, int64_t> samples_;
+};
+
+struct CpuProfile {
+  // Encoded by PprofBuilder
+  std::string pprof;
+  size_t samples{0};
+  // Samples that didn't fit in the buffer
+  size_t dropped{0};
+};
+
+/**
+ * Samples the stacks of every thread in the process `hz` times for each
+ * second of CPU time that the process uses, for `duration`, and symbolizes
+ * them.  Blocks the calling thread meanwhile.  Throws std::runtime_error if
+ * the platform doesn't support it or another profile is being collected.
+ */
+CpuProfile collectCpuProfile(std::chrono::milliseconds duration, int hz);
+
+} // namespace watchman
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CrawlScheduler.h"
+#include <folly/String.h>
+#include "watchman/Logging.h"
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace watchman {
+
+CrawlScheduler::QueryScope::QueryScope(CrawlScheduler* scheduler)
+    : scheduler_{scheduler} {
+  std::lock_guard<std::mutex> lock{scheduler_->mutex_};
+  ++scheduler_->runningQueries_;
+}
+
+CrawlScheduler::QueryScope::~QueryScope() {
+  if (!scheduler_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock{scheduler_->mutex_};
+    --scheduler_->runningQueries_;
+  }
+  scheduler_->cond_.notify_all();
+}
+
+CrawlScheduler::CrawlToken::~CrawlToken() {
+  if (!scheduler_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock{scheduler_->mutex_};
+    --scheduler_->backgroundCrawls_;
+  }
+  scheduler_->cond_.notify_all();
+}
+
+CrawlScheduler::CrawlToken CrawlScheduler::acquireBackgroundCrawl(
+    size_t limit,
+    const std::atomic<bool>& stop) {
+  std::unique_lock<std::mutex> lock{mutex_};
+  // stop is not guarded by mutex_, so poll it rather than rely on a
+  // notification.
+  while (backgroundCrawls_ >= limit &&
+         !stop.load(std::memory_order_acquire)) {
+    cond_.wait_for(lock, std::chrono::milliseconds(100));
+  }
+  ++backgroundCrawls_;
+  return CrawlToken{this};
+}
+
+void CrawlScheduler::yieldToQueries(std::chrono::milliseconds maxPause) {
+  std::unique_lock<std::mutex> lock{mutex_};
+  cond_.wait_for(lock, maxPause, [&] { return runningQueries_ == 0; });
+}
+
+CrawlScheduler& getCrawlScheduler() {
+  static CrawlScheduler scheduler;
+  return scheduler;
+}
+
+void lowerCurrentThreadPriority() {
+#ifdef __linux__
+  // Thread nice values and IO priorities are per-thread on Linux.
+  auto tid = static_cast<id_t>(syscall(SYS_gettid));
+  if (setpriority(PRIO_PROCESS, tid, 10) != 0) {
+    log(ERR, "setpriority failed: ", folly::errnoStr(errno), "\n");
+  }
+  // IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 7): the lowest best-effort level
+  constexpr int kIoprioWhoProcess = 1;
+  constexpr int kLowestBestEffort = (2 << 13) | 7;
+  if (syscall(SYS_ioprio_set, kIoprioWhoProcess, tid, kLowestBestEffort) !=
+      0) {
+    log(ERR, "ioprio_set failed: ", folly::errnoStr(errno), "\n");
+  }
+#elif defined(__APPLE__)
+  // Lowers both the CPU and the IO priority of the thread
+  if (setpriority(PRIO_DARWIN_THREAD, 0, PRIO_DARWIN_BG) != 0) {
+    log(ERR, "setpriority failed: ", folly::errnoStr(errno), "\n");
+  }
+#elif defined(_WIN32)
+  if (!SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN)) {
+    log(ERR, "SetThreadPriority failed: ", GetLastError(), "\n");
+  }
+#endif
+}
+
+} // namespace watchman
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+
+namespace watchman {
+
+/**
+ * Coordinates the IO threads of roots configured with
+ * `"root_priority": "background"` with the queries against all other roots.
+ *
+ * While a query against a normal root is running, background roots pause
+ * their crawls at their next view lock yield point, for a bounded time so
+ * that a steady stream of queries cannot starve them.  At most
+ * background_crawl_concurrency background roots run a full crawl at once.
+ */
+class CrawlScheduler {
+ public:
+  /// Counts a query against a normal root for as long as it is alive.
+  class QueryScope {
+   public:
+    explicit QueryScope(CrawlScheduler* scheduler);
+    QueryScope(QueryScope&& other) noexcept
+        : scheduler_{std::exchange(other.scheduler_, nullptr)} {}
+    QueryScope& operator=(QueryScope&&) = delete;
+    ~QueryScope();
+
+   private:
+    CrawlScheduler* scheduler_;
+  };
+
+  /// Holds one of the background full crawl slots for as long as it is
+  /// alive.
+  class CrawlToken {
+   public:
+    explicit CrawlToken(CrawlScheduler* scheduler) : scheduler_{scheduler} {}
+    CrawlToken(CrawlToken&& other) noexcept
+        : scheduler_{std::exchange(other.scheduler_, nullptr)} {}
+    CrawlToken& operator=(CrawlToken&&) = delete;
+    ~CrawlToken();
+
+   private:
+    CrawlScheduler* scheduler_;
+  };
+
+  QueryScope beginQuery() {
+    return QueryScope{this};
+  }
+
+  /**
+   * Blocks until fewer than `limit` background full crawls are running, or
+   * `stop` becomes true, and then takes a slot.
+   */
+  CrawlToken acquireBackgroundCrawl(
+      size_t limit,
+      const std::atomic<bool>& stop);
+
+  /**
+   * Blocks while queries against normal roots are running, for at most
+   * `maxPause`.
+   */
+  void yieldToQueries(std::chrono::milliseconds maxPause);
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  size_t runningQueries_{0};
+  size_t backgroundCrawls_{0};
+};
+
+/// The scheduler shared by every root in the process.
+CrawlScheduler& getCrawlScheduler();
+
+/**
+ * Lowers the CPU and IO scheduling priority of the calling thread, for the
+ * threads of background roots.  Failures are logged and otherwise ignored.
+ */
+void lowerCurrentThreadPriority();
+
+} // namespace watchman
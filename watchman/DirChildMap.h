@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * DirChildMap is the container used by watchman_dir to map a child name to
+ * the owning pointer of the child node.
+ *
+ * Most directories hold only a handful of entries, so the map starts out in
+ * a small mode: a dense array of up to kSmallCapacity entries that is searched
+ * linearly, with no hashing and no per-entry allocation.  Once a directory
+ * grows beyond that, the map switches to an open-addressing hash table with
+ * linear probing.  The table stores the 32-bit hash of each key next to the
+ * entries so that probes rarely need to touch the key bytes, and erasure uses
+ * backward-shift deletion so there are no tombstones to degrade lookups.
+ *
+ * The keys are non-owning w_string_pieces; as with the std::unordered_map
+ * that this replaces, the caller must ensure that the key memory is kept
+ * alive by the value (eg: the name embedded in the watchman_file).
+ *
+ * Insertion may move entries, so iterators and references are invalidated
+ * by operator[] and erase.
+ */
+template <typename Value>
+class DirChildMap {
+ public:
+  using key_type = w_string_piece;
+  using mapped_type = Value;
+  using value_type = std::pair<w_string_piece, Value>;
+
+  static constexpr uint32_t kSmallCapacity = 8;
+
+  template <bool Const>
+  class Iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = DirChildMap::value_type;
+    using difference_type = std::ptrdiff_t;
+    using reference =
+        std::conditional_t<Const, const value_type&, value_type&>;
+    using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+
+    Iterator() = default;
+
+    // Allow conversion from iterator to const_iterator
+    template <bool C = Const, typename = std::enable_if_t<C>>
+    /* implicit */ Iterator(const Iterator<false>& other)
+        : cur_(other.cur_), end_(other.end_), hash_(other.hash_) {}
+
+    reference operator*() const {
+      return *cur_;
+    }
+    pointer operator->() const {
+      return cur_;
+    }
+
+    Iterator& operator++() {
+      ++cur_;
+      if (hash_) {
+        ++hash_;
+        skipEmpty();
+      }
+      return *this;
+    }
+
+    Iterator operator++(int) {
+      auto prior = *this;
+      ++*this;
+      return prior;
+    }
+
+    friend bool operator==(const Iterator& a, const Iterator& b) {
+      return a.cur_ == b.cur_;
+    }
+    friend bool operator!=(const Iterator& a, const Iterator& b) {
+      return a.cur_ != b.cur_;
+    }
+
+   private:
+    friend class DirChildMap;
+    template <bool>
+    friend class Iterator;
+
+    Iterator(pointer cur, pointer end, const uint32_t* hash)
+        : cur_(cur), end_(end), hash_(hash) {
+      if (hash_) {
+        skipEmpty();
+      }
+    }
+
+    void skipEmpty() {
+      while (cur_ != end_ && *hash_ == 0) {
+        ++cur_;
+        ++hash_;
+      }
+    }
+
+    pointer cur_{nullptr};
+    pointer end_{nullptr};
+    // Non-null when the map is in hash mode.
+    const uint32_t* hash_{nullptr};
+  };
+
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  DirChildMap() = default;
+
+  DirChildMap(const DirChildMap&) = delete;
+  DirChildMap& operator=(const DirChildMap&) = delete;
+
+  DirChildMap(DirChildMap&& other) noexcept
+      : entries_(std::move(other.entries_)),
+        hashes_(std::move(other.hashes_)),
+        size_(other.size_),
+        capacity_(other.capacity_) {
+    other.size_ = 0;
+    other.capacity_ = 0;
+  }
+
+  DirChildMap& operator=(DirChildMap&& other) noexcept {
+    if (this != &other) {
+      entries_ = std::move(other.entries_);
+      hashes_ = std::move(other.hashes_);
+      size_ = other.size_;
+      capacity_ = other.capacity_;
+      other.size_ = 0;
+      other.capacity_ = 0;
+    }
+    return *this;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  iterator begin() {
+    return iterator{entries_.get(), endPtr(), hashes_.get()};
+  }
+  iterator end() {
+    return iterator{endPtr(), endPtr(), nullptr};
+  }
+  const_iterator begin() const {
+    return const_iterator{entries_.get(), endPtr(), hashes_.get()};
+  }
+  const_iterator end() const {
+    return const_iterator{endPtr(), endPtr(), nullptr};
+  }
+
+  iterator find(w_string_piece key) {
+    auto index = findIndex(key);
+    if (index == kNotFound) {
+      return end();
+    }
+    return iterator{
+        entries_.get() + index,
+        endPtr(),
+        hashes_ ? hashes_.get() + index : nullptr};
+  }
+
+  const_iterator find(w_string_piece key) const {
+    return const_cast<DirChildMap*>(this)->find(key);
+  }
+
+  /**
+   * Returns a reference to the value associated with key, inserting a
+   * default constructed value if there was none.
+   */
+  Value& operator[](w_string_piece key) {
+    uint32_t hash = 0;
+    if (hashes_) {
+      hash = tagFor(key);
+      auto index = findHashed(key, hash);
+      if (index != kNotFound) {
+        return entries_[index].second;
+      }
+    } else {
+      auto index = findSmall(key);
+      if (index != kNotFound) {
+        return entries_[index].second;
+      }
+      if (size_ < capacity_) {
+        entries_[size_].first = key;
+        return entries_[size_++].second;
+      }
+      if (capacity_ < kSmallCapacity) {
+        growSmall(capacity_ ? capacity_ * 2 : 1);
+        entries_[size_].first = key;
+        return entries_[size_++].second;
+      }
+      hash = tagFor(key);
+    }
+
+    if (!hashes_ || (size_ + 1) > maxLoad(capacity_)) {
+      rehash(capacity_ * 2);
+    }
+    auto index = insertHashed(key, hash);
+    ++size_;
+    return entries_[index].second;
+  }
+
+  /**
+   * Removes the entry for key, if any.  Returns the number of entries erased.
+   */
+  size_t erase(w_string_piece key) {
+    auto index = findIndex(key);
+    if (index == kNotFound) {
+      return 0;
+    }
+    if (hashes_) {
+      eraseHashed(index);
+    } else {
+      auto last = size_ - 1;
+      if (index != last) {
+        entries_[index] = std::move(entries_[last]);
+      }
+      entries_[last] = value_type{};
+    }
+    --size_;
+    return 1;
+  }
+
+  /**
+   * Pre-size the map to hold at least n entries without reallocating.
+   */
+  void reserve(size_t n) {
+    if (n <= capacity_ && (!hashes_ || n <= maxLoad(capacity_))) {
+      return;
+    }
+    if (!hashes_ && n <= kSmallCapacity) {
+      growSmall(uint32_t(n));
+      return;
+    }
+    uint32_t capacity = kSmallCapacity * 2;
+    while (maxLoad(capacity) < n) {
+      capacity *= 2;
+    }
+    rehash(capacity);
+  }
+
+  void clear() {
+    entries_.reset();
+    hashes_.reset();
+    size_ = 0;
+    capacity_ = 0;
+  }
+
+ private:
+  static constexpr uint32_t kNotFound = ~uint32_t(0);
+
+  // The high bit is forced on so that zero can denote an empty slot.
+  static uint32_t tagFor(w_string_piece key) {
+    return key.hashValue() | 0x80000000u;
+  }
+
+  // Keep the table no more than 7/8 full.
+  static size_t maxLoad(uint32_t capacity) {
+    return capacity - capacity / 8;
+  }
+
+  static bool keyEquals(w_string_piece a, w_string_piece b) {
+    return a.size() == b.size() &&
+        (a.size() == 0 || memcmp(a.data(), b.data(), a.size()) == 0);
+  }
+
+  value_type* endPtr() const {
+    return entries_.get() + (hashes_ ? capacity_ : size_);
+  }
+
+  uint32_t findIndex(w_string_piece key) const {
+    if (hashes_) {
+      return findHashed(key, tagFor(key));
+    }
+    return findSmall(key);
+  }
+
+  uint32_t findSmall(w_string_piece key) const {
+    for (uint32_t i = 0; i < size_; ++i) {
+      if (keyEquals(entries_[i].first, key)) {
+        return i;
+      }
+    }
+    return kNotFound;
+  }
+
+  uint32_t findHashed(w_string_piece key, uint32_t hash) const {
+    uint32_t mask = capacity_ - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+      if (hashes_[i] == 0) {
+        return kNotFound;
+      }
+      if (hashes_[i] == hash && keyEquals(entries_[i].first, key)) {
+        return i;
+      }
+    }
+  }
+
+  // Places key in the first free slot of its probe sequence.
+  // The caller must have ensured that key is not already present and that
+  // there is room in the table.
+  uint32_t insertHashed(w_string_piece key, uint32_t hash) {
+    uint32_t mask = capacity_ - 1;
+    uint32_t i = hash & mask;
+    while (hashes_[i] != 0) {
+      i = (i + 1) & mask;
+    }
+    hashes_[i] = hash;
+    entries_[i].first = key;
+    return i;
+  }
+
+  void eraseHashed(uint32_t i) {
+    uint32_t mask = capacity_ - 1;
+    uint32_t j = i;
+    while (true) {
+      j = (j + 1) & mask;
+      if (hashes_[j] == 0) {
+        break;
+      }
+      uint32_t home = hashes_[j] & mask;
+      // The entry at j may only move back to i if its home slot does not
+      // lie cyclically within (i, j].
+      bool homeInRange = i <= j ? (i < home && home <= j)
+                                : (i < home || home <= j);
+      if (homeInRange) {
+        continue;
+      }
+      entries_[i] = std::move(entries_[j]);
+      hashes_[i] = hashes_[j];
+      i = j;
+    }
+    entries_[i] = value_type{};
+    hashes_[i] = 0;
+  }
+
+  void growSmall(uint32_t capacity) {
+    auto entries = std::make_unique<value_type[]>(capacity);
+    for (uint32_t i = 0; i < size_; ++i) {
+      entries[i] = std::move(entries_[i]);
+    }
+    entries_ = std::move(entries);
+    capacity_ = capacity;
+  }
+
+  void rehash(uint32_t capacity) {
+    if (capacity < kSmallCapacity * 2) {
+      capacity = kSmallCapacity * 2;
+    }
+    auto oldEntries = std::move(entries_);
+    auto oldHashes = std::move(hashes_);
+    auto oldCount = oldHashes ? capacity_ : size_;
+
+    entries_ = std::make_unique<value_type[]>(capacity);
+    hashes_ = std::make_unique<uint32_t[]>(capacity);
+    capacity_ = capacity;
+
+    for (uint32_t i = 0; i < oldCount; ++i) {
+      uint32_t hash;
+      if (oldHashes) {
+        hash = oldHashes[i];
+        if (hash == 0) {
+          continue;
+        }
+      } else {
+        hash = tagFor(oldEntries[i].first);
+      }
+      auto index = insertHashed(oldEntries[i].first, hash);
+      entries_[index].second = std::move(oldEntries[i].second);
+    }
+  }
+
+  // In small mode, a dense array of size_ entries with room for capacity_.
+  // In hash mode, capacity_ slots where hashes_[i] == 0 marks an empty slot.
+  std::unique_ptr<value_type[]> entries_;
+  std::unique_ptr<uint32_t[]> hashes_;
+  uint32_t size_{0};
+  uint32_t capacity_{0};
+};
+
+} // namespace watchman
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/EventTrace.h"
+#include <fmt/core.h>
+#include <folly/String.h>
+#include <folly/system/MemoryMapping.h>
+#include <string.h>
+#include <stdexcept>
+#include <system_error>
+#include "watchman/Logging.h"
+
+/* Layout:
+ *
+ *   the magic "WMEVTR01"
+ *   any number of change records, each of three varints and the path:
+ *     nanoseconds since the previous batch, for the first change of a batch
+ *     PendingFlags << 1, | 1 for the first change of a batch
+ *     path length, then the path bytes
+ *
+ * Unlike the change journal, traces are meant to be carried from the
+ * machine that captured them to wherever the benchmarks run.
+ */
+
+namespace watchman {
+
+namespace {
+
+constexpr char kMagic[8] = {'W', 'M', 'E', 'V', 'T', 'R', '0', '1'};
+// Writes are batched up to this size
+constexpr size_t kBufferSize = 64 * 1024;
+
+void appendVarint(std::string& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(char(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(char(value));
+}
+
+bool readVarint(folly::ByteRange& data, uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64 && !data.empty(); shift += 7) {
+    auto byte = data.front();
+    data.advance(1);
+    value |= uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+EventTraceWriter::EventTraceWriter(
+    const char* path,
+    w_string rootPath,
+    size_t maxChanges)
+    : rootPath_{std::move(rootPath)}, maxChanges_{maxChanges} {
+  file_ = fopen(path, "wb");
+  if (!file_) {
+    throw std::system_error(
+        errno, std::generic_category(), fmt::format("fopen {}", path));
+  }
+  buffer_.append(kMagic, sizeof(kMagic));
+}
+
+EventTraceWriter::~EventTraceWriter() {
+  close();
+}
+
+bool EventTraceWriter::record(
+    std::chrono::steady_clock::time_point now,
+    const PendingChanges& changes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!file_ || changes_ >= maxChanges_) {
+    return false;
+  }
+  if (!started_) {
+    started_ = true;
+    last_ = now;
+  }
+
+  bool first = true;
+  changes.forEach([&](const PendingChange& change) {
+    if (changes_ >= maxChanges_) {
+      return;
+    }
+    w_string_piece path = change.path;
+    if (path.startsWith(rootPath_)) {
+      path.advance(rootPath_.size());
+      if (!path.empty() && is_slash(path[0])) {
+        path.advance(1);
+      }
+    }
+
+    appendVarint(
+        buffer_,
+        first ? std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    now - last_)
+                    .count()
+              : 0);
+    appendVarint(buffer_, (uint64_t(change.flags.asRaw()) << 1) | first);
+    appendVarint(buffer_, path.size());
+    buffer_.append(path.data(), path.size());
+    first = false;
+    ++changes_;
+  });
+  if (!first) {
+    last_ = now;
+  }
+
+  if (buffer_.size() >= kBufferSize) {
+    flushLocked();
+  }
+  return file_ != nullptr && changes_ < maxChanges_;
+}
+
+size_t EventTraceWriter::close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_) {
+    flushLocked();
+  }
+  if (file_) {
+    fclose(file_);
+    file_ = nullptr;
+  }
+  return changes_;
+}
+
+void EventTraceWriter::flushLocked() {
+  if (fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size()) {
+    logf(
+        ERR,
+        "failed to write event trace: {}; stopping the trace\n",
+        folly::errnoStr(errno));
+    fclose(file_);
+    file_ = nullptr;
+  }
+  buffer_.clear();
+}
+
+std::vector<TracedBatch> readEventTrace(const char* path) {
+  folly::MemoryMapping mapping{path};
+  auto data = mapping.range();
+  if (data.size() < sizeof(kMagic) ||
+      memcmp(data.data(), kMagic, sizeof(kMagic)) != 0) {
+    throw std::runtime_error(fmt::format("{} is not an event trace", path));
+  }
+  data.advance(sizeof(kMagic));
+
+  std::vector<TracedBatch> batches;
+  std::chrono::nanoseconds offset{0};
+  while (!data.empty()) {
+    uint64_t delay, flags, len;
+    if (!readVarint(data, delay) || !readVarint(data, flags) ||
+        !readVarint(data, len) || data.size() < len) {
+      // Torn by a crash mid-write
+      break;
+    }
+    w_string changePath{
+        reinterpret_cast<const char*>(data.data()), size_t(len)};
+    data.advance(len);
+
+    if ((flags & 1) || batches.empty()) {
+      offset += std::chrono::nanoseconds{delay};
+      batches.emplace_back();
+      batches.back().offset = offset;
+    }
+    batches.back().changes.push_back(TracedBatch::Change{
+        std::move(changePath), PendingFlags::raw(uint8_t(flags >> 1))});
+  }
+  return batches;
+}
+
+} // namespace watchman
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "watchman/PendingCollection.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * One batch of changes that the notify thread handed to the IO thread.
+ */
+struct TracedBatch {
+  // Since the first batch of the trace
+  std::chrono::nanoseconds offset{0};
+  struct Change {
+    // Relative to the root; empty for the root itself
+    w_string path;
+    PendingFlags flags;
+  };
+  std::vector<Change> changes;
+};
+
+/**
+ * Writes a compact, timestamped trace of the changes that a root's watcher
+ * reports, so that real workloads can be replayed through a view by
+ * `benchmarks/replay.cpp`.
+ *
+ * Paths are recorded relative to the root, so that a trace can be replayed
+ * against a tree anywhere.  Records are buffered and written once the
+ * buffer fills up, so tracing costs the notify thread little more than a
+ * copy of each path.
+ */
+class EventTraceWriter {
+ public:
+  /**
+   * Creates the trace at `path`, for changes beneath `rootPath`.  Stops
+   * recording after `maxChanges`.  Throws std::system_error on failure.
+   */
+  EventTraceWriter(const char* path, w_string rootPath, size_t maxChanges);
+  ~EventTraceWriter();
+
+  EventTraceWriter(const EventTraceWriter&) = delete;
+  EventTraceWriter& operator=(const EventTraceWriter&) = delete;
+
+  /**
+   * Records the items in `changes` as one batch, observed at `now`.
+   * Returns false once the trace is full or has failed to write.
+   */
+  bool record(
+      std::chrono::steady_clock::time_point now,
+      const PendingChanges& changes);
+
+  /**
+   * Writes what is buffered and closes the trace.  Returns the number of
+   * changes that it holds.
+   */
+  size_t close();
+
+ private:
+  void flushLocked();
+
+  const w_string rootPath_;
+  const size_t maxChanges_;
+  std::mutex mutex_;
+  FILE* file_{nullptr};
+  std::string buffer_;
+  std::chrono::steady_clock::time_point last_;
+  bool started_{false};
+  size_t changes_{0};
+};
+
+/**
+ * Reads the trace at `path`.  A record torn by a crash ends the trace.
+ * Throws std::runtime_error if it isn't a trace.
+ */
+std::vector<TracedBatch> readEventTrace(const char* path);
+
+} // namespace watchman
@@ -6,92 +6,158 @@
  */
 
 #include "watchman/IgnoreSet.h"
+#include "watchman/query/CompiledGlob.h"
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
 
+namespace watchman {
+
+namespace {
+
+// Nothing at or below the path is ignored.
+constexpr IgnoreSet::MatchState kNotIgnored = 0;
 // The path and everything below it is ignored.
-#define FULL_IGNORE 0x1
-// The grand-children of the path are ignored, but not the path
-// or its direct children.
-#define VCS_IGNORE 0x2
+constexpr IgnoreSet::MatchState kIgnored = 1;
+// The path is a child of an ignore_vcs dir: it is not ignored, but
+// everything below it is.
+constexpr IgnoreSet::MatchState kVcsChild = 2;
+constexpr IgnoreSet::MatchState kTop = 3;
+
+// Calls func with each non-empty component of path.
+template <typename Func>
+void forEachComponent(w_string_piece path, Func&& func) {
+  const char* data = path.data();
+  size_t size = path.size();
+  size_t begin = 0;
+  while (begin < size) {
+    size_t end = begin;
+    while (end < size && !is_slash(data[end])) {
+      ++end;
+    }
+    if (end > begin && !func(w_string_piece{data + begin, end - begin})) {
+      return;
+    }
+    begin = end + 1;
+  }
+}
 
-namespace watchman {
+} // namespace
+
+IgnoreSet::IgnoreSet() {
+  nodes_.resize(kTop + 1);
+  nodes_[kNotIgnored].fallback = kNotIgnored;
+  nodes_[kNotIgnored].ignored = false;
+  nodes_[kIgnored].fallback = kIgnored;
+  nodes_[kIgnored].ignored = true;
+  nodes_[kVcsChild].fallback = kIgnored;
+  nodes_[kVcsChild].ignored = false;
+  nodes_[kTop].fallback = kNotIgnored;
+  nodes_[kTop].ignored = false;
+}
 
 void IgnoreSet::add(const w_string& path, bool is_vcs_ignore) {
-  (is_vcs_ignore ? ignore_vcs : ignore_dirs).insert(path);
-
-  tree.insert(path, is_vcs_ignore ? VCS_IGNORE : FULL_IGNORE);
+  auto& set = is_vcs_ignore ? ignore_vcs : ignore_dirs;
+  // The automaton keys reference the copy held in the set.
+  const w_string& stored = *set.insert(path).first;
+
+  MatchState state = kTop;
+  forEachComponent(stored.piece(), [&](w_string_piece name) {
+    auto it = nodes_[state].children.find(name);
+    if (it != nodes_[state].children.end()) {
+      state = it->second;
+      return true;
+    }
+    // A new prefix behaves like the path it used to fall back to.
+    auto& inherited = nodes_[nodes_[state].fallback];
+    Node node;
+    node.fallback = inherited.fallback;
+    node.ignored = inherited.ignored;
+    auto child = MatchState(nodes_.size());
+    nodes_.push_back(std::move(node));
+    nodes_[state].children.emplace(name, child);
+    state = child;
+    return true;
+  });
 
-  if (!is_vcs_ignore) {
+  if (is_vcs_ignore) {
+    setTerminal(state, kVcsChild, false);
+  } else {
+    setTerminal(state, kIgnored, true);
     dirs_vec.push_back(path);
   }
 }
 
-bool IgnoreSet::isIgnored(const char* path, uint32_t pathlen) const {
-  const char* skip_prefix;
-  uint32_t len;
-  auto leaf = tree.longestMatch((const unsigned char*)path, (int)pathlen);
-
-  if (!leaf) {
-    // No entry -> not ignored.
-    return false;
-  }
+void IgnoreSet::setTerminal(
+    MatchState state,
+    MatchState fallback,
+    bool ignored) {
+  auto& node = nodes_[state];
+  node.fallback = fallback;
+  node.ignored = ignored;
+  node.terminal = true;
+  // The longest matching entry wins, so prefixes of other entries that
+  // were added earlier now fall back to this one.
+  inheritFallback(state);
+}
 
-  if (pathlen < leaf->key.size()) {
-    // We wanted "buil" but matched "build"
-    return false;
+void IgnoreSet::inheritFallback(MatchState state) {
+  auto& inherited = nodes_[nodes_[state].fallback];
+  for (auto& it : nodes_[state].children) {
+    auto& child = nodes_[it.second];
+    if (child.terminal) {
+      continue;
+    }
+    child.fallback = inherited.fallback;
+    child.ignored = inherited.ignored;
+    inheritFallback(it.second);
   }
+}
 
-  if (pathlen == leaf->key.size()) {
-    // Exact match.  This is an ignore if we are in FULL_IGNORE,
-    // but not in VCS_IGNORE mode.
-    return leaf->value == FULL_IGNORE ? true : false;
-  }
+IgnoreSet::MatchState IgnoreSet::match(w_string_piece path) const {
+  MatchState state = kTop;
+  forEachComponent(path, [&](w_string_piece name) {
+    state = descend(state, name);
+    // Both of these absorb every later component.
+    return state != kNotIgnored && state != kIgnored;
+  });
+  return state;
+}
 
-  // Our input string was longer than the leaf key string.
-  // We need to ensure that we observe a directory separator at the
-  // character after the common prefix, otherwise we may be falsely
-  // matching a sibling entry.
-  skip_prefix = path + leaf->key.size();
-  len = pathlen - leaf->key.size();
+void IgnoreSet::addGlob(const w_string& root, std::string_view pattern) {
+  globPrefix_ = w_string::build(root, "/");
+  globs_.push_back(CompiledGlob::get(pattern, WM_PATHNAME));
+}
 
-  if (!is_slash(*skip_prefix)) {
-    // we wanted "foo/bar" but we matched something like "food"
-    // this is not an ignore situation.
+bool IgnoreSet::isIgnored(const char* path, uint32_t pathlen) const {
+  if (isIgnoredState(match(w_string_piece{path, pathlen}))) {
+    return true;
+  }
+  if (globs_.empty()) {
     return false;
   }
-
-  if (leaf->value == FULL_IGNORE) {
-    // Definitely ignoring this portion of the tree
-    return true;
+  // Watchers report paths below a matching dir too, so test each of the
+  // dirs leading to path as well.  This also gives wildmatch the NUL
+  // terminated strings it needs.
+  for (auto i = uint32_t(globPrefix_.size()); i < pathlen; ++i) {
+    if (is_slash(path[i]) && isIgnoreGlob(w_string{path, i})) {
+      return true;
+    }
   }
+  return isIgnoreGlob(w_string{path, pathlen});
+}
 
-  // we need to apply vcs_ignore style logic to determine if we are ignoring
-  // this path.  This devolves to: "is there a '/' character after the end of
-  // the leaf key prefix?"
-
-  if (pathlen <= leaf->key.size()) {
-    // There can't be a slash after this portion of the tree, therefore
-    // this is not ignored.
+bool IgnoreSet::isIgnoreGlob(const w_string& path) const {
+  if (globs_.empty() || !path.piece().startsWith(globPrefix_)) {
     return false;
   }
-
-  // Skip over the '/'
-  skip_prefix++;
-  len--;
-
-#ifndef _WIN32
-  // If we find a '/' from this point, we are ignoring this path.
-  return memchr(skip_prefix, '/', len) != nullptr;
-#else
-  // On windows, both '/' and '\' are possible.
-  while (len > 0) {
-    if (is_slash(*skip_prefix)) {
+  // The remainder of a w_string is NUL terminated, as wildmatch requires
+  std::string_view relative{
+      path.data() + globPrefix_.size(), path.size() - globPrefix_.size()};
+  for (auto& glob : globs_) {
+    if (glob->match(relative)) {
       return true;
     }
-    skip_prefix++;
-    len--;
   }
   return false;
-#endif
 }
 
 bool IgnoreSet::isIgnoreVCS(const w_string& path) const {
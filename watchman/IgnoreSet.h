@@ -7,46 +7,115 @@
 
 #pragma once
 
+#include <memory>
+#include <string_view>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
-#include "watchman/thirdparty/libart/src/art.h"
 #include "watchman/watchman_string.h"
 
 namespace watchman {
 
+class CompiledGlob;
+
 class IgnoreSet {
  public:
+  // A position in the compiled ignore automaton.  The automaton has one
+  // transition per path component, so a crawler that remembers the state
+  // of a directory can classify each of its entries with one lookup.
+  using MatchState = uint32_t;
+
+  IgnoreSet();
+
   // Adds a string to the ignore list.
   // The is_vcs_ignore parameter indicates whether it is a full ignore
   // or a vcs-style grandchild ignore.
   void add(const w_string& path, bool is_vcs_ignore);
 
+  // Adds an ignore_globs pattern. It is matched with WM_PATHNAME against
+  // paths relative to root, which must be the same for every pattern.
+  void addGlob(const w_string& root, std::string_view pattern);
+
   // Tests whether path is ignored.
   // Returns true if the path is ignored, false otherwise.
   bool isIgnored(const char* path, uint32_t pathlen) const;
 
+  // Returns the automaton state for path, walking it one component
+  // at a time from the top.
+  MatchState match(w_string_piece path) const;
+
+  // Returns the state for the entry called name inside the directory
+  // whose state is given.
+  MatchState descend(MatchState state, w_string_piece name) const {
+    auto& node = nodes_[state];
+    if (!node.children.empty()) {
+      auto it = node.children.find(name);
+      if (it != node.children.end()) {
+        return it->second;
+      }
+    }
+    return node.fallback;
+  }
+
+  // Returns true if the path that led to state is ignored.
+  bool isIgnoredState(MatchState state) const {
+    return nodes_[state].ignored;
+  }
+
+  // Returns true if the path that led to state is listed in ignore dir
+  // config, the same answer isIgnoreDir gives for that path.
+  bool isIgnoreDirState(MatchState state) const {
+    return nodes_[state].terminal && nodes_[state].ignored;
+  }
+
   // Test whether path is listed in ignore vcs config
   bool isIgnoreVCS(const w_string& path) const;
 
   // Test whether path is listed in ignore dir config
   bool isIgnoreDir(const w_string& path) const;
 
+  // Test whether path matches one of the ignore_globs patterns
+  bool isIgnoreGlob(const w_string& path) const;
+
+  bool hasIgnoreGlobs() const {
+    return !globs_.empty();
+  }
+
   const std::vector<w_string>& getIgnoredDirs() const {
     return dirs_vec;
   }
 
  private:
+  struct Node {
+    // Keyed by path component.  The keys reference the strings held in
+    // ignore_vcs and ignore_dirs, which live as long as this set.
+    std::unordered_map<w_string_piece, MatchState> children;
+    // The state for components that have no entry in children.
+    MatchState fallback;
+    // Whether the path that led here is ignored.
+    bool ignored;
+    // Whether this node is itself an ignore_dirs or ignore_vcs entry
+    // rather than a prefix of one.
+    bool terminal{false};
+  };
+
+  void setTerminal(MatchState state, MatchState fallback, bool ignored);
+  void inheritFallback(MatchState state);
+
+  // Index 0 matches nothing below it, 1 ignores everything below it,
+  // 2 is a child of an ignore_vcs dir and 3 is the top of the tree.
+  std::vector<Node> nodes_;
   // if the map has an entry for a given dir, we're ignoring it */
   std::unordered_set<w_string> ignore_vcs;
   std::unordered_set<w_string> ignore_dirs;
-  /* radix tree containing the same information as the ignore
-   * entries above.  This is used only on macOS and Windows because
-   * we cannot exclude these dirs using the kernel watching APIs */
-  art_tree<uint8_t, w_string> tree;
   /* On macOS, we need to preserve the order of the ignore list so
    * that we can exclude things deterministically and fit within
    * system limits. */
   std::vector<w_string> dirs_vec;
+  // ignore_globs patterns and the root they are relative to, with a
+  // trailing slash.
+  std::vector<std::shared_ptr<const CompiledGlob>> globs_;
+  w_string globPrefix_;
 };
 
 } // namespace watchman
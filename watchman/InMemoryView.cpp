@@ -10,16 +10,27 @@
 #include <folly/ScopeGuard.h>
 #include <algorithm>
 #include <chrono>
+#include <limits>
 #include <memory>
+#include <string_view>
 #include <thread>
+#include <tuple>
+#include "watchman/CrawlScheduler.h"
 #include "watchman/Errors.h"
+#include "watchman/PathBuilder.h"
+#include "watchman/ThreadPlacement.h"
 #include "watchman/ThreadPool.h"
+#include "watchman/Tracepoint.h"
+#include "watchman/fs/ParallelWalk.h"
+#include "watchman/query/CompiledGlob.h"
 #include "watchman/query/GlobTree.h"
+#include "watchman/query/LocalFileResult.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
+#include "watchman/query/QueryExpr.h"
 #include "watchman/query/eval.h"
 #include "watchman/root/Root.h"
-#include "watchman/thirdparty/wildmatch/wildmatch.h"
+#include "watchman/scm/SCM.h"
 #include "watchman/watcher/Watcher.h"
 #include "watchman/watchman_file.h"
 
@@ -29,46 +40,107 @@ static std::atomic<watchman::ClockRoot> next_root_number{1};
 
 namespace watchman {
 
-namespace {
-/** Concatenate dir_name and name around a unix style directory
- * separator.
- * dir_name may be NULL in which case this returns a copy of name.
- */
-inline std::string make_path_name(
-    const char* dir_name,
-    uint32_t dlen,
-    const char* name,
-    uint32_t nlen) {
-  std::string result;
-  result.reserve(dlen + nlen + 1);
-
-  if (dlen) {
-    result.append(dir_name, dlen);
-    // wildmatch wants unix separators
-    result.push_back('/');
-  }
-  result.append(name, nlen);
-  return result;
-}
-} // namespace
-
 InMemoryViewCaches::InMemoryViewCaches(
     const w_string& rootPath,
     size_t maxHashes,
     size_t maxSymlinks,
-    std::chrono::milliseconds errorTTL)
-    : contentHashCache(rootPath, maxHashes, errorTTL),
+    std::chrono::milliseconds errorTTL,
+    size_t maxHashConcurrency,
+    size_t inlineHashMaxSize)
+    : contentHashCache(
+          rootPath,
+          maxHashes,
+          errorTTL,
+          maxHashConcurrency,
+          inlineHashMaxSize),
       symlinkTargetCache(rootPath, maxSymlinks, errorTTL) {}
 
 InMemoryFileResult::InMemoryFileResult(
     const watchman_file* file,
-    InMemoryViewCaches& caches)
-    : file_(file), caches_(caches) {}
+    InMemoryViewCaches& caches,
+    std::optional<w_string> dirName)
+    : file_(file), dirName_(std::move(dirName)), caches_(caches) {}
+
+namespace {
+
+// Freed InMemoryFileResult storage beyond this many per thread goes back to
+// the allocator.  A generator batch holds far more results than this, but
+// the ones that are rejected one at a time are reused right away.
+constexpr size_t kMaxPooledFileResults = 1024;
+
+// Freed InMemoryFileResult storage, linked through its first word
+struct FileResultFreeList {
+  void* head{nullptr};
+  size_t size{0};
+
+  ~FileResultFreeList() {
+    while (head) {
+      ::operator delete(std::exchange(head, *static_cast<void**>(head)));
+    }
+    // Anything freed on this thread from now on goes to the allocator
+    size = kMaxPooledFileResults;
+  }
+};
+
+thread_local FileResultFreeList fileResultFreeList;
+
+} // namespace
+
+void* InMemoryFileResult::operator new(size_t size) {
+  auto& list = fileResultFreeList;
+  if (size == sizeof(InMemoryFileResult) && list.head) {
+    auto* ptr = std::exchange(list.head, *static_cast<void**>(list.head));
+    --list.size;
+    return ptr;
+  }
+  return ::operator new(size);
+}
+
+void InMemoryFileResult::operator delete(void* ptr, size_t size) {
+  auto& list = fileResultFreeList;
+  if (size == sizeof(InMemoryFileResult) &&
+      list.size < kMaxPooledFileResults) {
+    *static_cast<void**>(ptr) = std::exchange(list.head, ptr);
+    ++list.size;
+    return;
+  }
+  ::operator delete(ptr);
+}
 
 void InMemoryFileResult::batchFetchProperties(
     const std::vector<std::unique_ptr<FileResult>>& files) {
   std::vector<folly::Future<folly::Unit>> readlinkFutures;
-  std::vector<folly::Future<folly::Unit>> sha1Futures;
+  std::vector<folly::Future<folly::Unit>> hashFutures;
+  std::vector<SymlinkTargetCacheKey> readlinkKeys;
+  std::vector<InMemoryFileResult*> readlinkFiles;
+
+  auto lookupContentHash = [this](
+                               InMemoryFileResult* file,
+                               ContentHashAlgorithm algorithm) {
+    auto dir = file->dirName();
+    dir.advance(file->caches_.contentHashCache.rootPath().size());
+
+    // If dirName is the root, dir.size() will now be zero
+    if (dir.size() > 0) {
+      // if not at the root, skip the slash character at the
+      // front of dir
+      dir.advance(1);
+    }
+
+    ContentHashCacheKey key{
+        w_string::pathCat({dir, file->baseName()}),
+        *file->size(),
+        *file->modifiedTime(),
+        file->ino(),
+        algorithm};
+
+    bool computed;
+    auto hash = caches_.contentHashCache.get(key, &computed);
+    if (auto* cost = QueryCost::current()) {
+      ++(computed ? cost->hashCacheMisses : cost->hashCacheHits);
+    }
+    return hash;
+  };
 
   // Since we may initiate some async work in the body of the function
   // below, we need to ensure that we wait for it to complete before
@@ -79,8 +151,8 @@ void InMemoryFileResult::batchFetchProperties(
     if (!readlinkFutures.empty()) {
       folly::collectAll(readlinkFutures.begin(), readlinkFutures.end()).wait();
     }
-    if (!sha1Futures.empty()) {
-      folly::collectAll(sha1Futures.begin(), sha1Futures.end()).wait();
+    if (!hashFutures.empty()) {
+      folly::collectAll(hashFutures.begin(), hashFutures.end()).wait();
     }
   };
 
@@ -88,7 +160,7 @@ void InMemoryFileResult::batchFetchProperties(
     auto* file = dynamic_cast<InMemoryFileResult*>(f.get());
 
     if (file->neededProperties() & FileResult::Property::SymlinkTarget) {
-      if (!file->file_->stat.isSymlink()) {
+      if (!file->isSymlink()) {
         // If this file is not a symlink then we immediately yield
         // a nullptr w_string instance rather than propagating an error.
         // This behavior is relied upon by the field rendering code and
@@ -105,75 +177,116 @@ void InMemoryFileResult::batchFetchProperties(
           dir.advance(1);
         }
 
-        SymlinkTargetCacheKey key{
-            w_string::pathCat({dir, file->baseName()}), file->file_->otime};
-
-        readlinkFutures.emplace_back(
-            caches_.symlinkTargetCache.get(key).thenTry(
-                [file](folly::Try<std::shared_ptr<
-                           const SymlinkTargetCache::Node>>&& result) {
-                  if (result.hasValue()) {
-                    file->symlinkTarget_ = result.value()->value();
-                  } else {
-                    // we don't have a way to report the error for readlink
-                    // due to legacy requirements in the interface, so we
-                    // just set it to empty.
-                    file->symlinkTarget_ = w_string();
-                  }
-                }));
+        // Looked up together below, so that the misses are read in chunks
+        readlinkKeys.push_back(SymlinkTargetCacheKey{
+            w_string::pathCat({dir, file->baseName()}), *file->otime()});
+        readlinkFiles.push_back(file);
       }
     }
 
     if (file->neededProperties() & FileResult::Property::ContentSha1) {
-      auto dir = file->dirName();
-      dir.advance(file->caches_.contentHashCache.rootPath().size());
+      hashFutures.emplace_back(
+          lookupContentHash(file, ContentHashAlgorithm::Sha1)
+              .thenTry([file](folly::Try<std::shared_ptr<
+                                  const ContentHashCache::Node>>&& result) {
+                file->contentSha1_ =
+                    makeResultWith([&] { return result.value()->value(); });
+              }));
+    }
 
-      // If dirName is the root, dir.size() will now be zero
-      if (dir.size() > 0) {
-        // if not at the root, skip the slash character at the
-        // front of dir
-        dir.advance(1);
-      }
+    if (file->neededProperties() & FileResult::Property::ContentXxh3) {
+      hashFutures.emplace_back(
+          lookupContentHash(file, ContentHashAlgorithm::Xxh3)
+              .thenTry([file](folly::Try<std::shared_ptr<
+                                  const ContentHashCache::Node>>&& result) {
+                file->contentXxh3_ = makeResultWith([&] {
+                  auto& value = result.value()->value();
+                  FileResult::ContentXxh3 digest;
+                  std::copy_n(value.begin(), digest.size(), digest.begin());
+                  return digest;
+                });
+              }));
+    }
 
-      ContentHashCacheKey key{
-          w_string::pathCat({dir, file->baseName()}),
-          size_t(file->file_->stat.size),
-          file->file_->stat.mtime};
+    file->clearNeededProperties();
+  }
 
-      sha1Futures.emplace_back(caches_.contentHashCache.get(key).thenTry(
-          [file](folly::Try<std::shared_ptr<const ContentHashCache::Node>>&&
-                     result) {
-            file->contentSha1_ =
-                makeResultWith([&] { return result.value()->value(); });
+  if (!readlinkKeys.empty()) {
+    auto targets = caches_.symlinkTargetCache.getBatch(readlinkKeys);
+    for (size_t i = 0; i < targets.size(); ++i) {
+      readlinkFutures.emplace_back(std::move(targets[i]).thenTry(
+          [file = readlinkFiles[i]](
+              folly::Try<std::shared_ptr<const SymlinkTargetCache::Node>>&&
+                  result) {
+            if (result.hasValue()) {
+              file->symlinkTarget_ = result.value()->value();
+            } else {
+              // we don't have a way to report the error for readlink
+              // due to legacy requirements in the interface, so we
+              // just set it to empty.
+              file->symlinkTarget_ = w_string();
+            }
           }));
     }
+  }
+}
 
-    file->clearNeededProperties();
+void InMemoryFileResult::detach() {
+  if (detached_) {
+    return;
   }
+  dirName();
+  detached_ = Detached{
+      file_->getName().asWString(),
+      file_->stat.decode(),
+      file_->exists,
+      file_->ctime,
+      file_->otime};
+  file_ = nullptr;
+}
+
+const void* InMemoryFileResult::viewNode() const {
+  return file_;
+}
+
+bool InMemoryFileResult::isSymlink() const {
+  return detached_ ? detached_->stat.isSymlink() : file_->stat.isSymlink();
+}
+
+bool InMemoryFileResult::isFile() const {
+  return detached_ ? detached_->stat.isFile() : file_->stat.isFile();
+}
+
+ino_t InMemoryFileResult::ino() const {
+  return detached_ ? detached_->stat.ino : file_->stat.ino();
 }
 
 std::optional<FileInformation> InMemoryFileResult::stat() {
-  return file_->stat;
+  return detached_ ? detached_->stat : file_->stat.decode();
+}
+
+std::optional<DType> InMemoryFileResult::dtype() {
+  return detached_ ? detached_->stat.dtype() : file_->stat.dtype();
 }
 
 std::optional<size_t> InMemoryFileResult::size() {
-  return file_->stat.size;
+  return detached_ ? detached_->stat.size : file_->stat.size();
 }
 
 std::optional<struct timespec> InMemoryFileResult::accessedTime() {
-  return file_->stat.atime;
+  return detached_ ? detached_->stat.atime : file_->stat.atime();
 }
 
 std::optional<struct timespec> InMemoryFileResult::modifiedTime() {
-  return file_->stat.mtime;
+  return detached_ ? detached_->stat.mtime : file_->stat.mtime();
 }
 
 std::optional<struct timespec> InMemoryFileResult::changedTime() {
-  return file_->stat.ctime;
+  return detached_ ? detached_->stat.ctime : file_->stat.ctime();
 }
 
 w_string_piece InMemoryFileResult::baseName() {
-  return file_->getName();
+  return detached_ ? detached_->name.piece() : file_->getName();
 }
 
 w_string_piece InMemoryFileResult::dirName() {
@@ -184,20 +297,20 @@ w_string_piece InMemoryFileResult::dirName() {
 }
 
 std::optional<bool> InMemoryFileResult::exists() {
-  return file_->exists;
+  return detached_ ? detached_->exists : file_->exists;
 }
 
 std::optional<ClockStamp> InMemoryFileResult::ctime() {
-  return file_->ctime;
+  return detached_ ? detached_->ctime : file_->ctime;
 }
 
 std::optional<ClockStamp> InMemoryFileResult::otime() {
-  return file_->otime;
+  return detached_ ? detached_->otime : file_->otime;
 }
 
 std::optional<ResolvedSymlink> InMemoryFileResult::readLink() {
   if (!symlinkTarget_.has_value()) {
-    if (!file_->stat.isSymlink()) {
+    if (!isSymlink()) {
       // We already know it's not a symlink, so there is no need to fetch
       // properties.
       symlinkTarget_ = NotSymlink{};
@@ -211,13 +324,13 @@ std::optional<ResolvedSymlink> InMemoryFileResult::readLink() {
 }
 
 std::optional<FileResult::ContentHash> InMemoryFileResult::getContentSha1() {
-  if (!file_->exists) {
+  if (!*exists()) {
     // Don't return hashes for files that we believe to be deleted.
     throw std::system_error(
         std::make_error_code(std::errc::no_such_file_or_directory));
   }
 
-  if (!file_->stat.isFile()) {
+  if (!isFile()) {
     // We only want to compute the hash for regular files
     throw std::system_error(std::make_error_code(std::errc::is_a_directory));
   }
@@ -229,9 +342,116 @@ std::optional<FileResult::ContentHash> InMemoryFileResult::getContentSha1() {
   return contentSha1_.value();
 }
 
-ViewDatabase::ViewDatabase(const w_string& root_path)
+std::optional<FileResult::ContentXxh3> InMemoryFileResult::getContentXxh3() {
+  if (!*exists()) {
+    // Don't return hashes for files that we believe to be deleted.
+    throw std::system_error(
+        std::make_error_code(std::errc::no_such_file_or_directory));
+  }
+
+  if (!isFile()) {
+    // We only want to compute the hash for regular files
+    throw std::system_error(std::make_error_code(std::errc::is_a_directory));
+  }
+
+  if (contentXxh3_.empty()) {
+    accessorNeedsProperties(FileResult::Property::ContentXxh3);
+    return std::nullopt;
+  }
+  return contentXxh3_.value();
+}
+
+TombstoneFileResult::TombstoneFileResult(
+    const Tombstone* tombstone,
+    w_string dirName)
+    : tombstone_{tombstone}, dirName_{std::move(dirName)} {}
+
+std::optional<FileInformation> TombstoneFileResult::stat() {
+  return tombstone_->stat();
+}
+
+std::optional<struct timespec> TombstoneFileResult::accessedTime() {
+  return tombstone_->stat().atime;
+}
+
+std::optional<struct timespec> TombstoneFileResult::modifiedTime() {
+  return tombstone_->stat().mtime;
+}
+
+std::optional<struct timespec> TombstoneFileResult::changedTime() {
+  return tombstone_->stat().ctime;
+}
+
+std::optional<size_t> TombstoneFileResult::size() {
+  return 0;
+}
+
+w_string_piece TombstoneFileResult::baseName() {
+  return tombstone_->name;
+}
+
+w_string_piece TombstoneFileResult::dirName() {
+  return dirName_;
+}
+
+std::optional<bool> TombstoneFileResult::exists() {
+  return false;
+}
+
+std::optional<ResolvedSymlink> TombstoneFileResult::readLink() {
+  if (!tombstone_->stat().isSymlink()) {
+    return NotSymlink{};
+  }
+  // As for a deleted symlink that was never compacted, whose target can no
+  // longer be read
+  return w_string();
+}
+
+std::optional<ClockStamp> TombstoneFileResult::ctime() {
+  return tombstone_->ctime;
+}
+
+std::optional<ClockStamp> TombstoneFileResult::otime() {
+  return tombstone_->otime;
+}
+
+std::optional<FileResult::ContentHash> TombstoneFileResult::getContentSha1() {
+  // Don't return hashes for files that we believe to be deleted.
+  throw std::system_error(
+      std::make_error_code(std::errc::no_such_file_or_directory));
+}
+
+std::optional<FileResult::ContentXxh3> TombstoneFileResult::getContentXxh3() {
+  // Don't return hashes for files that we believe to be deleted.
+  throw std::system_error(
+      std::make_error_code(std::errc::no_such_file_or_directory));
+}
+
+void TombstoneFileResult::batchFetchProperties(
+    const std::vector<std::unique_ptr<FileResult>>& files) {
+  // Every property is already known, so there is nothing to fetch
+  for (auto& f : files) {
+    if (auto* file = dynamic_cast<TombstoneFileResult*>(f.get())) {
+      file->clearNeededProperties();
+    }
+  }
+}
+
+ViewDatabase::ViewDatabase(
+    const w_string& root_path,
+    bool enableSuffixIndex,
+    bool enableNameIndex,
+    bool hugePageArena,
+    bool enableRecencyLog)
     : rootPath_{root_path},
-      rootDir_{std::make_unique<watchman_dir>(root_path, nullptr)} {}
+      enableSuffixIndex_{enableSuffixIndex},
+      enableNameIndex_{enableNameIndex},
+      arena_{hugePageArena},
+      rootDir_{watchman_dir::makeRoot(root_path, arena_)} {
+  if (enableRecencyLog) {
+    recencyLog_.emplace();
+  }
+}
 
 watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
   if (dir_name == rootPath_) {
@@ -267,15 +487,12 @@ watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
       // we have another pending item for the parent.  We'll create the
       // parent dir now and our other machinery will populate its contents
       // later.
-      w_string child_name(dir_component, (uint32_t)(sep - dir_component));
-
-      // Careful! dir->dirs is keyed by non-owning string pieces so the
-      // child_name MUST be stored or otherwise kept alive by the watchman_dir
-      // instance constructed below!
-      auto& new_child = dir->dirs[child_name];
-      new_child.reset(new watchman_dir(child_name, dir));
-
+      auto new_child = watchman_dir::make(component, dir);
       child = new_child.get();
+
+      // Careful! dir->dirs is keyed by non-owning string pieces so the key
+      // MUST be the name stored in the child itself!
+      dir->dirs[child->name] = std::move(new_child);
     }
 
     parent = dir;
@@ -295,13 +512,13 @@ watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
     dir_component = sep + 1;
   }
 
-  w_string child_name(dir_component, (uint32_t)(dir_end - dir_component));
-  // Careful! parent->dirs is keyed by non-owning string pieces so the
-  // child_name MUST be stored or otherwise kept alive by the watchman_dir
-  // instance constructed below!
-  auto& new_child = parent->dirs[child_name];
-  new_child.reset(new watchman_dir(child_name, parent));
-  return new_child.get();
+  auto new_child =
+      watchman_dir::make(w_string_piece(dir_component, dir_end), parent);
+  auto* result = new_child.get();
+  // Careful! parent->dirs is keyed by non-owning string pieces so the key
+  // MUST be the name stored in the child itself!
+  parent->dirs[result->name] = std::move(new_child);
+  return result;
 }
 
 const watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name) const {
@@ -368,12 +585,33 @@ watchman_file* ViewDatabase::getOrCreateChildFile(
   file_ptr = std::move(file);
 
   file_ptr->ctime = ctime;
+  // The new node supersedes any tombstone that the file left behind
+  if (!dir->tombstones.empty()) {
+    dir->tombstones.erase(file_ptr->getName());
+  }
+  if (enableSuffixIndex_) {
+    insertIntoSuffixIndex(file_ptr.get());
+  }
+  if (enableNameIndex_) {
+    insertIntoNameIndex(file_ptr.get(), file_name);
+  }
 
   return file_ptr.get();
 }
 
 void ViewDatabase::markFileChanged(watchman_file* file, ClockStamp otime) {
+  WATCHMAN_TRACE(file__changed, rootPath_.c_str(), otime.ticks);
+  auto previousTicks = file->otime.ticks;
+  bool wasListed = file->prev != nullptr;
   file->otime = otime;
+  ++contentGeneration_;
+
+  // Ticks only move forwards, so this typically stops at the first ancestor
+  // that has already seen a change in this tick.
+  for (auto* dir = file->parent; dir && dir->maxOtimeTicks < otime.ticks;
+       dir = dir->parent) {
+    dir->maxOtimeTicks = otime.ticks;
+  }
 
   if (latestFile_ != file) {
     // unlink from list
@@ -382,6 +620,51 @@ void ViewDatabase::markFileChanged(watchman_file* file, ClockStamp otime) {
     // and move to the head
     insertAtHeadOfFileList(file);
   }
+  if (recencyLog_) {
+    recencyLog_->nodeChanged(file, wasListed, previousTicks);
+  }
+
+  bool routing = subscriptionRouter_ && subscriptionRouter_->isRouting();
+  if (!changedFileCollectors_.empty() || journal_ || routing) {
+    PathBuilder buf;
+    auto fullPath = file->parent->getFullPathToChild(buf, file->getName());
+    if (routing) {
+      subscriptionRouter_->pathChanged(fullPath);
+    }
+    if (journal_) {
+      journal_->append(
+          otime.ticks,
+          otime.timestamp,
+          w_string_piece{
+              fullPath.data() + rootPath_.size() + 1,
+              fullPath.size() - rootPath_.size() - 1},
+          file->exists);
+    }
+    auto it = changedFileCollectors_.begin();
+    while (it != changedFileCollectors_.end()) {
+      if (auto collector = it->lock()) {
+        collector->fileChanged(file, fullPath);
+        ++it;
+      } else {
+        it = changedFileCollectors_.erase(it);
+      }
+    }
+  }
+}
+
+void ViewDatabase::addChangedFileCollector(
+    const std::shared_ptr<ChangedFileCollector>& collector,
+    ClockPosition position) {
+  collector->restart(position);
+  changedFileCollectors_.push_back(collector);
+}
+
+void ViewDatabase::restartChangedFileCollectors(ClockPosition position) {
+  for (auto& weak : changedFileCollectors_) {
+    if (auto collector = weak.lock()) {
+      collector->restart(position);
+    }
+  }
 }
 
 void ViewDatabase::markDirDeleted(
@@ -393,12 +676,14 @@ void ViewDatabase::markDirDeleted(
     return;
   }
   dir->last_check_existed = false;
+  dir->crawlStamp.reset();
 
+  PathBuilder buf;
   for (auto& it : dir->files) {
     auto file = it.second.get();
 
     if (file->exists) {
-      auto full_name = dir->getFullPathToChild(file->getName());
+      auto full_name = dir->getFullPathToChild(buf, file->getName());
       logf(DBG, "mark_deleted: {}\n", full_name);
       file->exists = false;
       markFileChanged(file, otime);
@@ -414,6 +699,165 @@ void ViewDatabase::markDirDeleted(
   }
 }
 
+void ViewDatabase::insertIntoSuffixIndex(struct watchman_file* file) {
+  auto suffix = file->getName().asLowerCaseSuffix();
+  if (!suffix) {
+    return;
+  }
+  // unordered_map never relocates its values, so it is safe for the
+  // file to point at the list head.
+  auto& head = suffixIndex_[*suffix];
+  file->suffixNext = head;
+  if (head) {
+    head->suffixPrev = &file->suffixNext;
+  }
+  head = file;
+  file->suffixPrev = &head;
+}
+
+const watchman_file* ViewDatabase::getFirstFileWithSuffix(
+    const w_string& suffix) const {
+  auto it = suffixIndex_.find(suffix);
+  if (it == suffixIndex_.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+namespace {
+
+char asciiLower(char c) {
+  return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+// The name index trigram starting at pos, lowercased so that one index
+// serves both case sensitive and insensitive searches
+uint32_t nameTrigram(const char* pos) {
+  static_assert(ViewDatabase::kNameIndexGramSize == 3);
+  return uint32_t(uint8_t(asciiLower(pos[0]))) << 16 |
+      uint32_t(uint8_t(asciiLower(pos[1]))) << 8 |
+      uint32_t(uint8_t(asciiLower(pos[2])));
+}
+
+bool containsCaseless(w_string_piece haystack, w_string_piece needle) {
+  for (size_t i = 0; i + needle.size() <= haystack.size(); ++i) {
+    if (w_string_equal_caseless(
+            w_string_piece(haystack.data() + i, needle.size()), needle)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+void ViewDatabase::insertIntoNameIndex(
+    struct watchman_file* file,
+    const w_string& name) {
+  auto [it, isNewName] = nameIndex_.try_emplace(name, nullptr);
+  // As with the suffix index, the list head never moves.
+  auto& head = it->second;
+  file->nameNext = head;
+  if (head) {
+    head->namePrev = &file->nameNext;
+  }
+  head = file;
+  file->namePrev = &head;
+
+  if (isNewName) {
+    indexNameGrams(&*it);
+  }
+}
+
+void ViewDatabase::indexNameGrams(const NameListHead* names) {
+  w_string_piece name = names->first;
+  if (name.size() < kNameIndexGramSize) {
+    return;
+  }
+  std::vector<uint32_t> grams;
+  grams.reserve(name.size() - kNameIndexGramSize + 1);
+  for (size_t i = 0; i + kNameIndexGramSize <= name.size(); ++i) {
+    grams.push_back(nameTrigram(name.data() + i));
+  }
+  std::sort(grams.begin(), grams.end());
+  grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+  for (auto gram : grams) {
+    nameTrigrams_[gram].push_back(names);
+  }
+}
+
+bool ViewDatabase::findFilesWithNameContaining(
+    w_string_piece fragment,
+    CaseSensitivity caseSensitive,
+    std::vector<const watchman_file*>& out) const {
+  if (!enableNameIndex_ || fragment.size() < kNameIndexGramSize) {
+    return false;
+  }
+
+  // Every matching name contains all of the fragment's trigrams, so it is
+  // enough to check the names in the shortest posting list.
+  const std::vector<const NameListHead*>* candidates = nullptr;
+  for (size_t i = 0; i + kNameIndexGramSize <= fragment.size(); ++i) {
+    auto it = nameTrigrams_.find(nameTrigram(fragment.data() + i));
+    if (it == nameTrigrams_.end()) {
+      return true;
+    }
+    if (!candidates || it->second.size() < candidates->size()) {
+      candidates = &it->second;
+    }
+  }
+
+  for (auto* names : *candidates) {
+    if (!names->second) {
+      // Every file with this name has been aged out
+      continue;
+    }
+    w_string_piece name = names->first;
+    if (caseSensitive == CaseSensitivity::CaseSensitive
+            ? name.contains(fragment)
+            : containsCaseless(name, fragment)) {
+      out.push_back(names->second);
+    }
+  }
+  return true;
+}
+
+void ViewDatabase::pruneNameIndex() {
+  if (!enableNameIndex_) {
+    return;
+  }
+  nameTrigrams_.clear();
+  for (auto it = nameIndex_.begin(); it != nameIndex_.end();) {
+    if (!it->second) {
+      it = nameIndex_.erase(it);
+    } else {
+      indexNameGrams(&*it);
+      ++it;
+    }
+  }
+}
+
+void ViewDatabase::clear() {
+  ++contentGeneration_;
+  ++structureGeneration_;
+  recencyIndex_.clear();
+  if (recencyLog_) {
+    recencyLog_->clear();
+  }
+  // The nodes unlink themselves from the indexes as they are freed, so the
+  // indexes are cleared after them.
+  rootDir_->files.clear();
+  rootDir_->dirs.clear();
+  rootDir_->tombstones.clear();
+  // The root no longer holds the entries that its stamp vouches for
+  rootDir_->crawlStamp.reset();
+  rootDir_->maxOtimeTicks = 0;
+  rootDir_->maxTombstoneTicks = 0;
+  suffixIndex_.clear();
+  nameIndex_.clear();
+  nameTrigrams_.clear();
+}
+
 void ViewDatabase::insertAtHeadOfFileList(struct watchman_file* file) {
   file->next = latestFile_;
   if (file->next) {
@@ -421,6 +865,7 @@ void ViewDatabase::insertAtHeadOfFileList(struct watchman_file* file) {
   }
   latestFile_ = file;
   file->prev = &latestFile_;
+  recencyIndex_.nodeInserted(file);
 }
 
 InMemoryView::PendingChangeLogEntry::PendingChangeLogEntry(
@@ -451,6 +896,30 @@ json_ref InMemoryView::PendingChangeLogEntry::asJsonValue() const {
   });
 }
 
+namespace {
+ContentHashAlgorithm parseContentHashWarmingAlgorithm(
+    const Configuration& config) {
+  std::string_view name =
+      config.getString("content_hash_warming_algorithm", "sha1");
+  if (name == "xxh3" &&
+      isContentHashAlgorithmSupported(ContentHashAlgorithm::Xxh3)) {
+    return ContentHashAlgorithm::Xxh3;
+  }
+  if (name != "sha1") {
+    log(ERR,
+        "content_hash_warming_algorithm ",
+        name,
+        " is not supported; warming sha1 instead\n");
+  }
+  return ContentHashAlgorithm::Sha1;
+}
+
+// Beyond this many changed paths between two settles, every subscription is
+// treated as having seen a change rather than routing them one at a time.
+constexpr size_t kMaxRoutedPaths = 64 * 1024;
+
+} // namespace
+
 InMemoryView::InMemoryView(
     FileSystem& fileSystem,
     const w_string& root_path,
@@ -459,7 +928,14 @@ InMemoryView::InMemoryView(
     : QueryableView{root_path, /*requiresCrawl=*/true},
       fileSystem_{fileSystem},
       config_(std::move(config)),
-      view_(std::in_place, root_path),
+      subscriptionRouter_(kMaxRoutedPaths),
+      view_(
+          std::in_place,
+          root_path,
+          config_.getBool("suffix_index", true),
+          config_.getBool("name_index", false),
+          config_.getBool("view_huge_pages", false),
+          config_.getBool("recency_log", false)),
       rootNumber_(next_root_number++),
       rootPath_(root_path),
       watcher_(std::move(watcher)),
@@ -468,7 +944,9 @@ InMemoryView::InMemoryView(
           config_.getInt("content_hash_max_items", 128 * 1024),
           config_.getInt("symlink_target_max_items", 32 * 1024),
           std::chrono::milliseconds(
-              config_.getInt("content_hash_negative_cache_ttl_ms", 2000))),
+              config_.getInt("content_hash_negative_cache_ttl_ms", 2000)),
+          size_t(config_.getInt("content_hash_max_concurrency", 8)),
+          size_t(config_.getInt("content_hash_inline_max_size", 1024))),
       enableContentCacheWarming_(
           config_.getBool("content_hash_warming", false)),
       maxFilesToWarmInContentCache_(
@@ -477,7 +955,61 @@ InMemoryView::InMemoryView(
           "content_hash_max_file_size_to_warm",
           10 * 1024 * 1024))),
       syncContentCacheWarming_(
-          config_.getBool("content_hash_warm_wait_before_settle", false)) {
+          config_.getBool("content_hash_warm_wait_before_settle", false)),
+      contentCacheWarmingAlgorithm_(
+          parseContentHashWarmingAlgorithm(config_)),
+      busyWarmInterval_(std::chrono::milliseconds(
+          config_.getInt("content_hash_warm_busy_interval_ms", 0))),
+      busyWarmMinAge_(std::chrono::milliseconds(
+          config_.getInt("content_hash_warm_min_age_ms", 1000))),
+      busyWarmMaxBytesPerSec_(uint64_t(std::max<json_int_t>(
+          0,
+          config_.getInt(
+              "content_hash_warm_max_bytes_per_sec", 64 * 1024 * 1024)))),
+      enableSymlinkCacheWarming_(
+          config_.getBool("symlink_target_warming", false)),
+      maxSymlinksToWarm_(size_t(
+          config_.getInt("symlink_target_max_warm_per_settle", 1024))),
+      useSyncBarrier_(config_.getBool("sync_barrier", true)),
+      enableStatIndex_(config_.getBool("stat_index", false)),
+      idleHibernateAge_(config_.getInt("idle_hibernate_age_seconds", 0)),
+      negativeStats_(std::chrono::milliseconds(
+          config_.getInt("stat_negative_cache_ms", 1000))) {
+  view_.wlock()->setSubscriptionRouter(&subscriptionRouter_);
+  if (auto targets = config_.get("scm_prefetch_mergebase_with")) {
+    if (!targets->isArray()) {
+      throw std::runtime_error(
+          "scm_prefetch_mergebase_with must be an array of strings");
+    }
+    for (auto& target : targets->array()) {
+      if (!target.isString()) {
+        throw std::runtime_error(
+            "scm_prefetch_mergebase_with must be an array of strings");
+      }
+      scmPrefetchTargets_.push_back(json_to_w_string(target));
+    }
+  }
+
+  if (config_.getBool("lazy_crawl", false)) {
+    lazyCrawlDepth_ = size_t(std::max<json_int_t>(
+        1, config_.getInt("lazy_crawl_depth", 1)));
+    if (auto prefixes = config_.get("lazy_crawl_hot_prefixes")) {
+      if (!prefixes->isArray()) {
+        throw std::runtime_error(
+            "lazy_crawl_hot_prefixes must be an array of strings");
+      }
+      auto lazy = lazyCrawl_.lock();
+      for (auto& prefix : prefixes->array()) {
+        if (!prefix.isString()) {
+          throw std::runtime_error(
+              "lazy_crawl_hot_prefixes must be an array of strings");
+        }
+        lazy->prefixes.push_back(w_string::pathCat(
+            {root_path, json_to_w_string(prefix).normalizeSeparators()}));
+      }
+    }
+  }
+
   json_int_t in_memory_view_ring_log_size =
       config_.getInt("in_memory_view_ring_log_size", 0);
   if (in_memory_view_ring_log_size) {
@@ -486,7 +1018,9 @@ InMemoryView::InMemoryView(
   }
 }
 
-InMemoryView::~InMemoryView() = default;
+InMemoryView::~InMemoryView() {
+  ClockSpec::forgetPreviousInstances(rootNumber_);
+}
 
 ClockStamp InMemoryView::ageOutFile(
     std::unordered_set<w_string>& dirs_to_erase,
@@ -510,68 +1044,451 @@ ClockStamp InMemoryView::ageOutFile(
   return ageOutOtime;
 }
 
-void InMemoryView::ageOut(
+void InMemoryView::tombstoneFile(watchman_file* file) {
+  auto parent = file->parent;
+
+  Tombstone tombstone;
+  tombstone.name = file->getName().asWString();
+  tombstone.otime = file->otime;
+  tombstone.ctime = file->ctime;
+  tombstone.mode = file->stat.mode();
+#ifdef _WIN32
+  tombstone.fileAttributes = file->stat.fileAttributes();
+#endif
+
+  for (auto* dir = parent;
+       dir && dir->maxTombstoneTicks < tombstone.otime.ticks;
+       dir = dir->parent) {
+    dir->maxTombstoneTicks = tombstone.otime.ticks;
+  }
+
+  // This frees the file node
+  parent->files.erase(file->getName());
+
+  // Careful! tombstones is keyed by non-owning string pieces so the key
+  // MUST be the name stored in the tombstone itself!
+  auto key = tombstone.name.piece();
+  parent->tombstones[key] = std::move(tombstone);
+}
+
+template <typename Remove>
+void InMemoryView::removeDeletedFiles(
+    SynchronizedViewDatabase::WLockedPtr& view,
+    std::chrono::system_clock::time_point cutoff,
     int64_t& walked,
     int64_t& files,
-    int64_t& dirs,
-    std::chrono::seconds minAge) {
-  files = 0;
-  walked = 0;
-  std::unordered_set<w_string> dirs_to_erase;
-
-  auto now = std::chrono::system_clock::now();
-  lastAgeOutTimestamp_ = now;
-  auto view = view_.wlock();
+    Remove&& remove) {
+  auto yieldAfter =
+      std::chrono::milliseconds(config_.getInt("view_lock_yield_ms", 20));
+  auto lockAcquired = std::chrono::steady_clock::now();
+  std::unordered_set<const watchman_file*> freedInSlice;
+
+  // Must be called before the lock is released, whenever files were freed
+  auto forgetFreedFiles = [&] {
+    if (!freedInSlice.empty()) {
+      view->filesRemovedFromRecencyIndex(freedInSlice);
+      // The collectors may be holding some of the files we just freed
+      view->restartChangedFileCollectors(
+          ClockPosition(rootNumber_, mostRecentTick_));
+      freedInSlice.clear();
+    }
+  };
 
   watchman_file* file = view->getLatestFile();
   watchman_file* prior = nullptr;
   while (file) {
     ++walked;
+    if (yieldAfter.count() > 0 && walked % 1024 == 0 &&
+        std::chrono::steady_clock::now() - lockAcquired >= yieldAfter) {
+      // Nothing else frees files, so the last file that was kept is still a
+      // valid cursor. Until the IO thread moves it to the head of the list,
+      // anyway, in which case the walk resumes from its position by tick.
+      ClockTicks resumeTicks = prior ? prior->otime.ticks : 0;
+      forgetFreedFiles();
+      view.unlock();
+      std::this_thread::yield();
+      view = view_.wlock();
+      lockAcquired = std::chrono::steady_clock::now();
+
+      if (!prior) {
+        file = view->getLatestFile();
+      } else if (prior->otime.ticks == resumeTicks) {
+        file = prior->next;
+      } else {
+        prior = nullptr;
+        file = view->findFirstFileChangedAtOrBefore(resumeTicks);
+      }
+      continue;
+    }
+
     if (file->exists ||
-        std::chrono::system_clock::from_time_t(file->otime.timestamp) + minAge >
-            now) {
+        std::chrono::system_clock::from_time_t(file->otime.timestamp) >
+            cutoff) {
       prior = file;
       file = file->next;
       continue;
     }
 
-    auto agedOtime = ageOutFile(dirs_to_erase, file);
-
-    // Revise tick for fresh instance reporting
-    lastAgeOutTick_ = std::max(lastAgeOutTick_, agedOtime.ticks);
-
+    freedInSlice.insert(file);
+    remove(file);
     files++;
 
     // Go back to last good file node; we can't trust that the
     // value of file->next saved before age_out_file is a valid
     // file node as anything past that point may have also been
     // aged out along with it.
-    file = prior;
+    file = prior ? prior->next : view->getLatestFile();
   }
 
-  for (auto& name : dirs_to_erase) {
-    auto parent = view->resolveDir(name.dirName(), false);
-    if (parent) {
-      parent->dirs.erase(name.baseName());
-    }
+  forgetFreedFiles();
+}
+
+namespace {
+
+// Erases the tombstones in and below dir that last changed at or before
+// cutoff, recomputing maxTombstoneTicks on the way back up.  Returns the
+// number erased.
+int64_t ageOutTombstones(
+    watchman_dir* dir,
+    std::chrono::system_clock::time_point cutoff,
+    ClockTicks& lastAgeOutTick,
+    std::unordered_set<w_string>& dirs_to_erase) {
+  if (dir->maxTombstoneTicks == 0) {
+    return 0;
   }
 
-  if (files + dirs_to_erase.size()) {
-    logf(ERR, "aged {} files, {} dirs\n", files, dirs_to_erase.size());
+  int64_t aged = 0;
+  ClockTicks maxTicks = 0;
+  if (!dir->tombstones.empty()) {
+    std::vector<w_string> expired;
+    for (auto& it : dir->tombstones) {
+      auto& tombstone = it.second;
+      if (std::chrono::system_clock::from_time_t(tombstone.otime.timestamp) >
+          cutoff) {
+        maxTicks = std::max(maxTicks, tombstone.otime.ticks);
+        continue;
+      }
+      lastAgeOutTick = std::max(lastAgeOutTick, tombstone.otime.ticks);
+      expired.push_back(tombstone.name);
+    }
+    for (auto& name : expired) {
+      // As in ageOutFile, remove any corresponding dir once we're done
+      dirs_to_erase.insert(dir->getFullPathToChild(name));
+      dir->tombstones.erase(name);
+    }
+    aged += expired.size();
   }
 
-  dirs = dirs_to_erase.size();
+  for (auto& it : dir->dirs) {
+    auto child = it.second.get();
+    aged += ageOutTombstones(child, cutoff, lastAgeOutTick, dirs_to_erase);
+    maxTicks = std::max(maxTicks, child->maxTombstoneTicks);
+  }
+  dir->maxTombstoneTicks = maxTicks;
+  return aged;
 }
 
-void InMemoryView::timeGenerator(const Query* query, QueryContext* ctx) const {
-  // Walk back in time until we hit the boundary
-  auto view = view_.rlock();
-  ctx->generationStarted();
+} // namespace
 
-  for (watchman_file* f = view->getLatestFile(); f; f = f->next) {
-    ctx->bumpNumWalked();
-    // Note that we use <= for the time comparisons in here so that we
-    // report the things that changed inclusive of the boundary presented.
+void InMemoryView::ageOut(
+    int64_t& walked,
+    int64_t& files,
+    int64_t& dirs,
+    std::chrono::seconds minAge) {
+  files = 0;
+  walked = 0;
+  std::unordered_set<w_string> dirs_to_erase;
+
+  auto now = std::chrono::system_clock::now();
+  lastAgeOutTimestamp_ = now;
+  auto view = view_.wlock();
+
+  removeDeletedFiles(
+      view, now - minAge, walked, files, [&](watchman_file* file) {
+        auto agedOtime = ageOutFile(dirs_to_erase, file);
+
+        // Revise tick for fresh instance reporting
+        lastAgeOutTick_ = std::max(lastAgeOutTick_, agedOtime.ticks);
+      });
+
+  // There are few enough tombstones to age them out without yielding
+  files += ageOutTombstones(
+      view->resolveDir(rootPath_, false),
+      now - minAge,
+      lastAgeOutTick_,
+      dirs_to_erase);
+
+  for (auto& name : dirs_to_erase) {
+    auto parent = view->resolveDir(name.dirName(), false);
+    // The dir may have been recreated while the lock was released
+    if (parent && !parent->getChildFile(name.baseName())) {
+      parent->dirs.erase(name.baseName());
+    }
+  }
+
+  if (files + dirs_to_erase.size()) {
+    logf(ERR, "aged {} files, {} dirs\n", files, dirs_to_erase.size());
+    view->filesRemoved();
+    view->pruneNameIndex();
+    view->rebuildRecencyIndex();
+    // Erasing dirs may have freed more files
+    view->restartChangedFileCollectors(
+        ClockPosition(rootNumber_, mostRecentTick_));
+  }
+
+  dirs = dirs_to_erase.size();
+}
+
+void InMemoryView::compactTombstones(
+    int64_t& walked,
+    int64_t& files,
+    std::chrono::seconds minAge) {
+  files = 0;
+  walked = 0;
+
+  auto view = view_.wlock();
+  removeDeletedFiles(
+      view,
+      std::chrono::system_clock::now() - minAge,
+      walked,
+      files,
+      [&](watchman_file* file) { tombstoneFile(file); });
+
+  if (files) {
+    logf(DBG, "compacted {} deleted files into tombstones\n", files);
+    view->filesRemoved();
+    view->pruneNameIndex();
+  }
+}
+
+namespace {
+
+// Generators accumulate files into batches of this many entries before
+// handing them to the query engine, so that large queries can have their
+// expression evaluated in parallel.
+constexpr size_t kGeneratorBatchSize = 64 * 1024;
+
+// Opens the directories that a crawl would descend into, without watching
+// them, for InMemoryView::walkGenerator.
+class WalkFileSystem : public FileSystem {
+ public:
+  WalkFileSystem(FileSystem& fileSystem, std::shared_ptr<Root> root)
+      : fileSystem_{fileSystem}, root_{std::move(root)} {}
+
+  std::unique_ptr<DirHandle> openDir(const char* path, bool strict) override {
+    w_string fullPath{path};
+    if (root_->ignore.isIgnoreDir(fullPath) ||
+        root_->ignore.isIgnoreGlob(fullPath)) {
+      return nullptr;
+    }
+    // The contents of a VCS dir are listed, but not those of its subdirs
+    if (root_->root_path != fullPath &&
+        root_->ignore.isIgnoreVCS(fullPath.dirName())) {
+      return nullptr;
+    }
+    return fileSystem_.openDir(path, strict);
+  }
+
+  FileInformation getFileInformation(
+      const char* path,
+      CaseSensitivity caseSensitive) override {
+    return fileSystem_.getFileInformation(path, caseSensitive);
+  }
+
+  void touch(const char* path) override {
+    fileSystem_.touch(path);
+  }
+
+ private:
+  FileSystem& fileSystem_;
+  std::shared_ptr<Root> root_;
+};
+
+// Beyond this many changes between two evaluations of a subscription, its
+// collector gives up and the time generator walks the view instead.
+constexpr size_t kMaxCollectedFiles = 64 * 1024;
+
+void addToGeneratorBatch(
+    const Query* query,
+    QueryContext* ctx,
+    std::vector<std::unique_ptr<FileResult>>& batch,
+    std::unique_ptr<FileResult> file) {
+  batch.push_back(std::move(file));
+  // With a limit, hand over smaller batches so that the generator can
+  // notice when it has been reached
+  auto batchSize = query->limit && query->sort == QuerySortOrder::None
+      ? std::min(kGeneratorBatchSize, size_t(query->limit))
+      : kGeneratorBatchSize;
+  if (batch.size() >= batchSize) {
+    w_query_process_files(query, ctx, std::move(batch));
+    batch.clear();
+  }
+}
+
+std::optional<std::vector<QueryPath>> computeGlobPathsBound(
+    const Query* query) {
+  // Case sensitive patterns spell out the exact names to look up in the view
+  auto patterns =
+      query->expr->computeGlobUpperBound(CaseSensitivity::CaseSensitive);
+  if (!patterns) {
+    return std::nullopt;
+  }
+
+  std::vector<QueryPath> paths;
+  for (const auto& pattern : *patterns) {
+    // Peel off the leading directories that are spelled out literally
+    std::string_view rest{pattern};
+    std::string dir;
+    size_t slash;
+    while ((slash = rest.find('/')) != std::string_view::npos) {
+      auto component = rest.substr(0, slash);
+      if (component.empty() || component == "." || component == ".." ||
+          component.find_first_of("*?[\\") != std::string_view::npos) {
+        break;
+      }
+      if (!dir.empty()) {
+        dir.push_back('/');
+      }
+      dir.append(component);
+      rest.remove_prefix(slash + 1);
+    }
+    if (dir.empty()) {
+      // This can match files at the top of the root
+      return std::nullopt;
+    }
+
+    // With WM_PATHNAME, only a slash or ** can match across directories
+    bool recursive = rest.find('/') != std::string_view::npos ||
+        rest.find("**") != std::string_view::npos;
+    paths.push_back(QueryPath{w_string{dir}, recursive ? -1 : 0});
+  }
+
+  // Sort recursive paths ahead of the paths that they cover, then drop the
+  // covered ones.
+  std::sort(paths.begin(), paths.end(), [](const auto& a, const auto& b) {
+    return std::tie(a.name, a.depth) < std::tie(b.name, b.depth);
+  });
+  std::vector<QueryPath> result;
+  for (auto& path : paths) {
+    bool covered = false;
+    for (const auto& kept : result) {
+      if (kept.name == path.name
+              ? kept.depth == -1 || kept.depth == path.depth
+              : kept.depth == -1 &&
+                  path.name.piece().startsWith(
+                      w_string::build(kept.name, "/"))) {
+        covered = true;
+        break;
+      }
+    }
+    if (!covered) {
+      result.push_back(std::move(path));
+    }
+  }
+  return result;
+}
+
+/**
+ * Returns paths, relative to the query's root, that together hold every file
+ * that the query's expression can match, or nullopt if it may match files
+ * anywhere. The paths are in the form taken by generatePaths, and none of
+ * them is walked twice.
+ */
+std::optional<std::vector<QueryPath>> computePathsBound(const Query* query) {
+  if (!query->expr) {
+    return std::nullopt;
+  }
+  auto paths = computeGlobPathsBound(query);
+
+  // A depth limit on a dir beats walking the same dir recursively
+  auto depthBound = query->expr->computeDirDepthBound();
+  if (depthBound &&
+      depthBound->maxDepth <= uint32_t(std::numeric_limits<int>::max()) &&
+      (!paths ||
+       (paths->size() == 1 && paths->front().depth == -1 &&
+        paths->front().name == depthBound->dirname))) {
+    return std::vector<QueryPath>{
+        QueryPath{depthBound->dirname, int(depthBound->maxDepth)}};
+  }
+  return paths;
+}
+
+} // namespace
+
+SynchronizedViewDatabase::ConstRLockedPtr InMemoryView::lockForGenerator(
+    QueryContext* ctx) const {
+  auto view = view_.rlock();
+  ctx->deferRenderFetches = config_.getBool("view_lock_defer_fetches", true);
+  ctx->noteViewStructureGeneration(view->getStructureGeneration());
+  return view;
+}
+
+void InMemoryView::timeGenerator(const Query* query, QueryContext* ctx) const {
+  // Walk back in time until we hit the boundary
+  auto view = lockForGenerator(ctx);
+  ctx->generationStarted();
+
+  auto* since_clock = std::get_if<QuerySince::Clock>(&ctx->since.since);
+  if (since_clock && view->getRecencyLog()) {
+    ctx->explainMethod("recency_log");
+    // Scan the log rather than the list, only touching the files below the
+    // relative root.  Each dir is only tested once.
+    std::unordered_map<const watchman_dir*, bool> dirMatches;
+    auto filter = [&](const watchman_dir* dir) {
+      if (!query->relative_root) {
+        return true;
+      }
+      auto [it, inserted] = dirMatches.emplace(dir, false);
+      if (inserted) {
+        PathBuilder buf;
+        it->second = ctx->dirMatchesRelativeRoot(
+            dir->getFullPathToChild(buf, w_string_piece()));
+      }
+      return it->second;
+    };
+    size_t walked = 0;
+    view->getRecencyLog()->forEachAfter(
+        since_clock->ticks,
+        filter,
+        [&](watchman_file* f) {
+          w_query_process_file(
+              query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+          return !ctx->shouldStopGenerating();
+        },
+        walked);
+    ctx->bumpNumWalked(walked);
+  } else {
+    ctx->explainMethod("recency_list");
+    timeGeneratorFromList(query, ctx, *view);
+  }
+
+  // Deleted files that have been compacted are no longer in the recency
+  // list. Fresh instances don't report deleted files, so skip them then.
+  if (since_clock && since_clock->is_fresh_instance) {
+    return;
+  }
+  if (!ctx->shouldStopGenerating()) {
+    tombstoneGenerator(query, ctx, view->resolveDir(rootPath_), rootPath_);
+  }
+}
+
+void InMemoryView::timeGeneratorFromList(
+    const Query* query,
+    QueryContext* ctx,
+    const ViewDatabase& view) const {
+  // For a clock, seek straight to the boundary rather than testing every
+  // file against it
+  watchman_file* end = nullptr;
+  if (auto* since_clock = std::get_if<QuerySince::Clock>(&ctx->since.since)) {
+    end = view.findFirstFileChangedAtOrBefore(since_clock->ticks);
+  }
+
+  for (watchman_file* f = view.getLatestFile();
+       f != end && !ctx->shouldStopGenerating();
+       f = f->next) {
+    ctx->bumpNumWalked();
+    // Note that we use <= for the time comparisons in here so that we
+    // report the things that changed inclusive of the boundary presented.
     // This is especially important for clients using the coarse unix
     // timestamp as the since basis, as they would be much more
     // likely to miss out on changes if we didn't.
@@ -579,11 +1496,107 @@ void InMemoryView::timeGenerator(const Query* query, QueryContext* ctx) const {
         since_ts && f->otime.timestamp <= since_ts->time) {
       break;
     }
-    if (auto* since_clock = std::get_if<QuerySince::Clock>(&ctx->since.since);
-        since_clock && f->otime.ticks <= since_clock->ticks) {
-      break;
+    if (!ctx->fileMatchesRelativeRoot(f)) {
+      continue;
     }
 
+    w_query_process_file(
+        query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+  }
+}
+
+void InMemoryView::tombstoneGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const watchman_dir* dir,
+    const w_string& dirPath) const {
+  // Nothing in a subtree whose tombstones are no newer than this can match
+  auto* since_clock = std::get_if<QuerySince::Clock>(&ctx->since.since);
+  ClockTicks ticksBound = since_clock ? since_clock->ticks : 0;
+  if (dir->maxTombstoneTicks <= ticksBound) {
+    return;
+  }
+
+  if (!dir->tombstones.empty() && ctx->dirMatchesRelativeRoot(dirPath)) {
+    for (auto& it : dir->tombstones) {
+      if (ctx->shouldStopGenerating()) {
+        return;
+      }
+      auto& tombstone = it.second;
+      ctx->bumpNumWalked();
+      if (since_clock ? tombstone.otime.ticks <= since_clock->ticks
+                      : tombstone.otime.timestamp <=
+                  std::get<QuerySince::Timestamp>(ctx->since.since).time) {
+        continue;
+      }
+      w_query_process_file(
+          query,
+          ctx,
+          std::make_unique<TombstoneFileResult>(&tombstone, dirPath));
+    }
+  }
+
+  for (auto& it : dir->dirs) {
+    auto child = it.second.get();
+    if (child->maxTombstoneTicks > ticksBound) {
+      tombstoneGenerator(
+          query, ctx, child, w_string::pathCat({dirPath, child->name}));
+    }
+  }
+}
+
+std::shared_ptr<ChangedFileCollector> InMemoryView::collectChangedFiles(
+    const Query* query) {
+  if (!query->expr) {
+    return nullptr;
+  }
+  auto patterns = query->expr->computeGlobUpperBound(query->case_sensitive);
+  if (!patterns) {
+    // Any changed file may match, so the time generator is as good as it gets
+    return nullptr;
+  }
+
+  auto collector = std::make_shared<ChangedFileCollector>(
+      *patterns,
+      query->relative_root ? *query->relative_root : rootPath_,
+      query->case_sensitive,
+      kMaxCollectedFiles);
+  view_.wlock()->addChangedFileCollector(
+      collector, ClockPosition(rootNumber_, mostRecentTick_));
+  return collector;
+}
+
+void InMemoryView::changedFilesGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    ChangedFileCollector& collector) const {
+  auto* since_clock = std::get_if<QuerySince::Clock>(&ctx->since.since);
+  if (!since_clock || since_clock->is_fresh_instance) {
+    timeGenerator(query, ctx);
+    return;
+  }
+
+  auto view = lockForGenerator(ctx);
+  auto files = collector.take(
+      rootNumber_,
+      since_clock->ticks,
+      ctx->clockAtStartOfQuery.position().ticks,
+      ClockPosition(rootNumber_, mostRecentTick_));
+  if (!files) {
+    view.unlock();
+    timeGenerator(query, ctx);
+    return;
+  }
+
+  ctx->generationStarted();
+  for (auto* f : *files) {
+    if (ctx->shouldStopGenerating()) {
+      break;
+    }
+    ctx->bumpNumWalked();
+    if (f->otime.ticks <= since_clock->ticks) {
+      continue;
+    }
     if (!ctx->fileMatchesRelativeRoot(f)) {
       continue;
     }
@@ -593,7 +1606,111 @@ void InMemoryView::timeGenerator(const Query* query, QueryContext* ctx) const {
   }
 }
 
+void InMemoryView::scmChangesGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const std::vector<w_string>& paths,
+    ClockStamp clock) const {
+  // A big rebase can report hundreds of thousands of paths.  Grouping them
+  // by directory turns the lookups into a join against one directory of
+  // the view at a time, so that each directory's path is built, checked
+  // against the relative root and resolved only once.
+  struct Change {
+    w_string_piece dir;
+    w_string_piece name;
+  };
+  std::vector<Change> changes;
+  changes.reserve(paths.size());
+  for (const auto& path : paths) {
+    w_string_piece piece = path;
+    changes.push_back(Change{piece.dirName(), piece.baseName()});
+  }
+  std::sort(changes.begin(), changes.end(), [](const auto& a, const auto& b) {
+    return std::tie(a.dir, a.name) < std::tie(b.dir, b.name);
+  });
+
+  auto caseSensitive = ctx->root->case_sensitive;
+  auto view = lockForGenerator(ctx);
+  ctx->generationStarted();
+
+  std::vector<std::unique_ptr<FileResult>> batch;
+  std::optional<w_string_piece> currentDir;
+  w_string dirPath;
+  bool dirMatches = false;
+  const watchman_dir* dir = nullptr;
+  for (const auto& change : changes) {
+    if (ctx->shouldStopGenerating()) {
+      break;
+    }
+    if (!currentDir || *currentDir != change.dir) {
+      currentDir = change.dir;
+      dirPath = change.dir.empty() ? rootPath_
+                                   : w_string::pathCat({rootPath_, change.dir});
+      dirMatches = ctx->dirMatchesRelativeRoot(dirPath);
+      dir = dirMatches ? view->resolveDir(dirPath) : nullptr;
+    }
+    if (!dirMatches) {
+      continue;
+    }
+
+    // Still a LocalFileResult, so that the file is reported as changed at
+    // `clock`, but a file the view already knows needs no lstat.  See the
+    // note in QueryableView::scmChangesGenerator about the others.
+    auto fullPath = w_string::pathCat({dirPath, change.name});
+    auto* file = dir ? dir->getChildFile(change.name) : nullptr;
+    std::unique_ptr<FileResult> result;
+    if (file && file->exists && !file->stat.isDir()) {
+      result = std::make_unique<LocalFileResult>(
+          std::move(fullPath), clock, caseSensitive, file->stat.decode());
+    } else {
+      result = std::make_unique<LocalFileResult>(
+          std::move(fullPath), clock, caseSensitive);
+    }
+    addToGeneratorBatch(query, ctx, batch, std::move(result));
+  }
+
+  w_query_process_files(query, ctx, std::move(batch));
+}
+
+std::shared_ptr<SubscriptionRoute> InMemoryView::routeSubscription(
+    const Query* query) {
+  const auto& base = query->relative_root ? *query->relative_root : rootPath_;
+
+  // The bound spells out names to look up in the view, which only match
+  // the changed paths byte for byte if the query is case sensitive.
+  std::vector<w_string> scopes;
+  std::optional<std::vector<QueryPath>> paths;
+  if (query->case_sensitive == CaseSensitivity::CaseSensitive) {
+    paths = computePathsBound(query);
+  }
+  if (paths) {
+    for (auto& path : *paths) {
+      scopes.push_back(w_string::pathCat({base, path.name}));
+    }
+  } else {
+    scopes.push_back(base);
+  }
+
+  auto view = view_.wlock();
+  return subscriptionRouter_.addRoute(
+      std::move(scopes), ClockPosition(rootNumber_, mostRecentTick_));
+}
+
+bool InMemoryView::isUnchangedInScope(
+    const SubscriptionRoute& route,
+    ClockPosition since,
+    ClockPosition now) const {
+  return subscriptionRouter_.isUnchangedSince(route, since, now);
+}
+
 void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
+  generatePaths(query, ctx, *query->paths);
+}
+
+void InMemoryView::generatePaths(
+    const Query* query,
+    QueryContext* ctx,
+    const std::vector<QueryPath>& paths) const {
   w_string_piece relative_root;
   struct watchman_file* f;
 
@@ -603,18 +1720,27 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
     relative_root = rootPath_;
   }
 
-  auto view = view_.rlock();
+  auto view = lockForGenerator(ctx);
   ctx->generationStarted();
 
-  for (const auto& path : *query->paths) {
+  // Files that changed no later than this cannot match the expression
+  ClockTicks otimeBound = query->expr
+      ? query->expr->computeOtimeLowerBound(ctx).value_or(0)
+      : 0;
+
+  std::vector<std::unique_ptr<FileResult>> batch;
+  for (const auto& path : paths) {
+    if (ctx->shouldStopGenerating()) {
+      break;
+    }
     const watchman_dir* dir;
     w_string dir_name;
 
     // Compose path with root
     auto full_name = w_string::pathCat({relative_root, path.name});
 
-    // special case of root dir itself
-    if (rootPath_ == full_name) {
+    // special case of root dir itself, or the relative root
+    if (rootPath_ == full_name || path.name.empty()) {
       // dirname on the root is outside the root, which is useless
       dir = view->resolveDir(full_name);
       goto is_dir;
@@ -643,8 +1769,11 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
       // If it's a file (but not an existent dir)
       if (f && (!f->exists || !f->stat.isDir())) {
         ctx->bumpNumWalked();
-        w_query_process_file(
-            query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+        addToGeneratorBatch(
+            query,
+            ctx,
+            batch,
+            std::make_unique<InMemoryFileResult>(f, caches_, dir_name));
         continue;
       }
     }
@@ -658,29 +1787,100 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
   is_dir:
     // We got a dir; process recursively to specified depth
     if (dir) {
-      dirGenerator(query, ctx, dir, path.depth);
+      dirGenerator(
+          query, ctx, dir, dir->getFullPath(), path.depth, otimeBound, batch);
     }
   }
+
+  w_query_process_files(query, ctx, std::move(batch));
 }
 
 void InMemoryView::dirGenerator(
     const Query* query,
     QueryContext* ctx,
     const watchman_dir* dir,
-    uint32_t depth) const {
-  for (auto& it : dir->files) {
-    auto file = it.second.get();
+    const w_string& dirPath,
+    uint32_t depth,
+    ClockTicks otimeBound,
+    std::vector<std::unique_ptr<FileResult>>& batch) const {
+  if (dir->maxOtimeTicks <= otimeBound) {
+    // Nothing in this subtree has changed recently enough to match
+    return;
+  }
+
+  auto visitFile = [&](const watchman_file* file) {
+    if (file->otime.ticks <= otimeBound) {
+      return;
+    }
     ctx->bumpNumWalked();
 
-    w_query_process_file(
-        query, ctx, std::make_unique<InMemoryFileResult>(file, caches_));
+    addToGeneratorBatch(
+        query,
+        ctx,
+        batch,
+        std::make_unique<InMemoryFileResult>(file, caches_, dirPath));
+  };
+  auto visitDir = [&](const watchman_dir* child) {
+    if (child->maxOtimeTicks <= otimeBound) {
+      return;
+    }
+    dirGenerator(
+        query,
+        ctx,
+        child,
+        w_string::pathCat({dirPath, child->name}),
+        depth - 1,
+        otimeBound,
+        batch);
+  };
+
+  if (query->sort == QuerySortOrder::Name) {
+    // Visit the files and dirs together in name order, each dir right after
+    // its own entry, so that the results come out already sorted by path.
+    // A sorted query never stops early, so there is no limit to check.
+    struct Child {
+      w_string_piece name;
+      const watchman_file* file;
+      const watchman_dir* dir;
+    };
+    std::vector<Child> children;
+    children.reserve(dir->files.size() + (depth > 0 ? dir->dirs.size() : 0));
+    for (auto& it : dir->files) {
+      children.push_back({it.second->getName(), it.second.get(), nullptr});
+    }
+    if (depth > 0) {
+      for (auto& it : dir->dirs) {
+        children.push_back({it.second->name, nullptr, it.second.get()});
+      }
+    }
+    std::sort(
+        children.begin(), children.end(), [](const Child& a, const Child& b) {
+          return std::make_tuple(a.name, !a.file) <
+              std::make_tuple(b.name, !b.file);
+        });
+    for (auto& child : children) {
+      if (child.file) {
+        visitFile(child.file);
+      } else {
+        visitDir(child.dir);
+      }
+    }
+    return;
+  }
+
+  for (auto& it : dir->files) {
+    if (ctx->shouldStopGenerating()) {
+      return;
+    }
+    visitFile(it.second.get());
   }
 
   if (depth > 0) {
     for (auto& it : dir->dirs) {
-      const auto child = it.second.get();
-
-      dirGenerator(query, ctx, child, depth - 1);
+      if (ctx->shouldStopGenerating()) {
+        return;
+      }
+      visitDir(it.second.get());
     }
   }
 }
@@ -701,12 +1901,15 @@ void InMemoryView::globGeneratorDoublestar(
     QueryContext* ctx,
     const struct watchman_dir* dir,
     const GlobTree* node,
-    const char* dir_name,
-    uint32_t dir_name_len) const {
+    PathBuilder& relName) const {
   bool matched;
+  auto relNameSize = relName.size();
 
   // First step is to walk the set of files contained in this node
   for (auto& it : dir->files) {
+    if (ctx->shouldStopGenerating()) {
+      return;
+    }
     auto file = it.second.get();
     auto file_name = file->getName();
 
@@ -717,8 +1920,9 @@ void InMemoryView::globGeneratorDoublestar(
       continue;
     }
 
-    auto subject = make_path_name(
-        dir_name, dir_name_len, file_name.data(), file_name.size());
+    // wildmatch wants unix separators
+    relName.appendComponent(file_name);
+    auto subject = relName.piece();
 
     // Now that we have computed the name of this candidate file node,
     // attempt to match against each of the possible doublestar patterns
@@ -726,15 +1930,7 @@ void InMemoryView::globGeneratorDoublestar(
     // as it doesn't make a lot of sense to yield multiple results for
     // the same file.
     for (const auto& child_node : node->doublestar_children) {
-      matched =
-          wildmatch(
-              child_node->pattern.c_str(),
-              subject.c_str(),
-              ctx->query->glob_flags | WM_PATHNAME |
-                  (ctx->query->case_sensitive == CaseSensitivity::CaseSensitive
-                       ? 0
-                       : WM_CASEFOLD),
-              0) == WM_MATCH;
+      matched = child_node->compiled->match(subject.view());
 
       if (matched) {
         w_query_process_file(
@@ -746,10 +1942,14 @@ void InMemoryView::globGeneratorDoublestar(
         break;
       }
     }
+    relName.truncate(relNameSize);
   }
 
   // And now walk down to any dirs; all dirs are eligible
   for (auto& it : dir->dirs) {
+    if (ctx->shouldStopGenerating()) {
+      return;
+    }
     const auto child = it.second.get();
 
     if (!child->last_check_existed) {
@@ -757,9 +1957,17 @@ void InMemoryView::globGeneratorDoublestar(
       continue;
     }
 
-    auto subject = make_path_name(
-        dir_name, dir_name_len, child->name.data(), child->name.size());
-    globGeneratorDoublestar(ctx, child, node, subject.data(), subject.size());
+    relName.appendComponent(child->name);
+    // Skip dirs that none of the patterns can match inside of, such as
+    // dot dirs when dotfiles are excluded
+    auto dirName = relName.piece().view();
+    for (const auto& child_node : node->doublestar_children) {
+      if (child_node->compiled->mayMatchInside(dirName)) {
+        globGeneratorDoublestar(ctx, child, node, relName);
+        break;
+      }
+    }
+    relName.truncate(relNameSize);
   }
 }
 
@@ -769,10 +1977,14 @@ void InMemoryView::globGeneratorTree(
     const GlobTree* node,
     const struct watchman_dir* dir) const {
   if (!node->doublestar_children.empty()) {
-    globGeneratorDoublestar(ctx, dir, node, nullptr, 0);
+    PathBuilder relName;
+    globGeneratorDoublestar(ctx, dir, node, relName);
   }
 
   for (const auto& child_node : node->children) {
+    if (ctx->shouldStopGenerating()) {
+      return;
+    }
     w_assert(!child_node->is_doublestar, "should not get here with ** glob");
 
     // If there are child dirs, consider them for recursion.
@@ -793,6 +2005,9 @@ void InMemoryView::globGeneratorTree(
       } else {
         // Otherwise we have to walk and match
         for (auto& it : dir->dirs) {
+          if (ctx->shouldStopGenerating()) {
+            return;
+          }
           const auto child_dir = it.second.get();
 
           if (!child_dir->last_check_existed) {
@@ -800,15 +2015,7 @@ void InMemoryView::globGeneratorTree(
             continue;
           }
 
-          if (wildmatch(
-                  child_node->pattern.c_str(),
-                  child_dir->name.c_str(),
-                  ctx->query->glob_flags |
-                      (ctx->query->case_sensitive ==
-                               CaseSensitivity::CaseSensitive
-                           ? 0
-                           : WM_CASEFOLD),
-                  0) == WM_MATCH) {
+          if (child_node->compiled->match(child_dir->name.view())) {
             globGeneratorTree(ctx, child_node.get(), child_dir);
           }
         }
@@ -836,6 +2043,9 @@ void InMemoryView::globGeneratorTree(
         }
       } else {
         for (auto& it : dir->files) {
+          if (ctx->shouldStopGenerating()) {
+            return;
+          }
           // Otherwise we have to walk and match
           auto file = it.second.get();
           auto file_name = file->getName();
@@ -846,15 +2056,7 @@ void InMemoryView::globGeneratorTree(
             continue;
           }
 
-          if (wildmatch(
-                  child_node->pattern.c_str(),
-                  file_name.data(),
-                  ctx->query->glob_flags |
-                      (ctx->query->case_sensitive ==
-                               CaseSensitivity::CaseSensitive
-                           ? 0
-                           : WM_CASEFOLD),
-                  0) == WM_MATCH) {
+          if (child_node->compiled->match(file_name.view())) {
             w_query_process_file(
                 ctx->query,
                 ctx,
@@ -875,7 +2077,7 @@ void InMemoryView::globGenerator(const Query* query, QueryContext* ctx) const {
     relative_root = rootPath_;
   }
 
-  auto view = view_.rlock();
+  auto view = lockForGenerator(ctx);
 
   const auto dir = view->resolveDir(relative_root);
   if (!dir) {
@@ -884,24 +2086,438 @@ void InMemoryView::globGenerator(const Query* query, QueryContext* ctx) const {
         relative_root);
   }
 
+  if (query->suffixes && view->hasSuffixIndex()) {
+    ctx->explainMethod("suffix_index");
+    suffixGenerator(query, ctx, *view, dir);
+    return;
+  }
+
+  ctx->explainMethod("glob_tree");
   globGeneratorTree(ctx, query->glob_tree.get(), dir);
 }
 
+void InMemoryView::suffixGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const ViewDatabase& view,
+    const watchman_dir* dir) const {
+  std::vector<std::unique_ptr<FileResult>> batch;
+  for (const auto& suffix : *query->suffixes) {
+    // The index is keyed by the text after the final dot, so a multi-part
+    // suffix such as "tar.gz" is found via "gz" and then checked in full.
+    auto key = suffix.piece().suffix();
+    auto keyString = key.empty() ? suffix : key.asWString();
+
+    for (auto* file = view.getFirstFileWithSuffix(keyString);
+         file && !ctx->shouldStopGenerating();
+         file = file->suffixNext) {
+      ctx->bumpNumWalked();
+
+      // Globs can only match files that exist, in dirs that exist
+      if (!file->exists || !file->getName().hasSuffix(suffix)) {
+        continue;
+      }
+      if (!ctx->fileMatchesRelativeRoot(file)) {
+        continue;
+      }
+      bool parentsExist = true;
+      for (auto* parent = file->parent; parent != dir;
+           parent = parent->parent) {
+        if (!parent->last_check_existed) {
+          parentsExist = false;
+          break;
+        }
+      }
+      if (!parentsExist) {
+        continue;
+      }
+
+      addToGeneratorBatch(
+          query,
+          ctx,
+          batch,
+          std::make_unique<InMemoryFileResult>(file, caches_));
+    }
+  }
+
+  w_query_process_files(query, ctx, std::move(batch));
+}
+
 void InMemoryView::allFilesGenerator(const Query* query, QueryContext* ctx)
     const {
+  if (auto paths = computePathsBound(query)) {
+    // Nothing outside of these paths can match, so walk just them
+    ctx->explainMethod("bounded_paths");
+    generatePaths(query, ctx, *paths);
+    return;
+  }
+
   struct watchman_file* f;
-  auto view = view_.rlock();
+  auto view = lockForGenerator(ctx);
   ctx->generationStarted();
 
-  for (f = view->getLatestFile(); f; f = f->next) {
+  if (view->hasNameIndex() && query->expr) {
+    if (auto fragments = query->expr->computeNameFragments()) {
+      if (nameIndexGenerator(query, ctx, *view, *fragments)) {
+        return;
+      }
+    }
+  }
+
+  if (enableStatIndex_ && query->expr &&
+      statIndexGenerator(query, ctx, *view)) {
+    return;
+  }
+
+  std::vector<std::unique_ptr<FileResult>> batch;
+  if (query->relative_root) {
+    // Nothing outside the relative root can match, so walk just its subtree
+    // rather than filtering every file in the view
+    ctx->explainMethod("relative_root_tree");
+    if (auto dir = view->resolveDir(*query->relative_root)) {
+      ClockTicks otimeBound = query->expr
+          ? query->expr->computeOtimeLowerBound(ctx).value_or(0)
+          : 0;
+      dirGenerator(
+          query,
+          ctx,
+          dir,
+          *query->relative_root,
+          std::numeric_limits<uint32_t>::max(),
+          otimeBound,
+          batch);
+    }
+    w_query_process_files(query, ctx, std::move(batch));
+    return;
+  }
+
+  if (query->expr && query->expr->matchesOnlyDirs()) {
+    dirIndexGenerator(query, ctx, *view);
+    return;
+  }
+
+  ctx->explainMethod("all_files");
+  for (f = view->getLatestFile(); f && !ctx->shouldStopGenerating();
+       f = f->next) {
     ctx->bumpNumWalked();
     if (!ctx->fileMatchesRelativeRoot(f)) {
       continue;
     }
 
-    w_query_process_file(
-        query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+    addToGeneratorBatch(
+        query, ctx, batch, std::make_unique<InMemoryFileResult>(f, caches_));
+  }
+
+  w_query_process_files(query, ctx, std::move(batch));
+}
+
+bool InMemoryView::canWalkForQuery(const Query& query) {
+  // A walk sees every file once, as it is now.  That is what the all files
+  // generator does against a freshly crawled view, and the suffix generator
+  // only needs the names checked on top.  The others need the view.
+  return !query.since_spec && !query.paths &&
+      (!query.glob_tree || query.suffixes);
+}
+
+void InMemoryView::walkGenerator(
+    const std::shared_ptr<Root>& root,
+    const Query* query,
+    QueryContext* ctx) const {
+  ctx->generationStarted();
+  ctx->explainMethod("walk");
+
+  const auto& top = query->relative_root ? *query->relative_root : rootPath_;
+  ParallelWalker walker{
+      std::make_shared<WalkFileSystem>(fileSystem_, root),
+      AbsolutePath{top.c_str()},
+      root->allow_crawling_other_mounts ? std::nullopt
+                                        : std::optional{root->stat},
+      static_cast<size_t>(root->config.getInt(
+          "crawl_max_queued_entries", kDefaultCrawlMaxQueuedEntries))};
+  ClockStamp clock{
+      ctx->clockAtStartOfQuery.position().ticks, ::time(nullptr)};
+
+  std::vector<std::unique_ptr<FileResult>> batch;
+  bool complete = false;
+  while (!ctx->shouldStopGenerating()) {
+    auto result = walker.nextResult();
+    if (!result) {
+      complete = true;
+      break;
+    }
+    for (auto& entry : result->entries) {
+      if (root->ignore.isIgnoreDir(entry.fullPath) ||
+          root->ignore.isIgnoreGlob(entry.fullPath)) {
+        continue;
+      }
+      if (query->suffixes) {
+        auto name = entry.fullPath.piece().baseName();
+        auto matched = std::any_of(
+            query->suffixes->begin(),
+            query->suffixes->end(),
+            [&](const w_string& suffix) { return name.hasSuffix(suffix); });
+        if (!matched) {
+          continue;
+        }
+      }
+      ctx->bumpNumWalked();
+      addToGeneratorBatch(
+          query,
+          ctx,
+          batch,
+          std::make_unique<LocalFileResult>(
+              std::move(entry.fullPath),
+              clock,
+              root->case_sensitive,
+              std::move(entry.stat)));
+    }
+    // Hand over what this directory held, so that a streaming query sends
+    // its results without waiting for the rest of the walk.
+    if (query->stream_results) {
+      w_query_process_files(query, ctx, std::move(batch));
+      batch.clear();
+    }
+  }
+  w_query_process_files(query, ctx, std::move(batch));
+
+  // An abandoned walk may still have reads deferred, which only nextResult()
+  // resumes; its errors are dropped along with the walker.
+  if (!complete) {
+    return;
+  }
+  while (auto error = walker.nextError()) {
+    logf(
+        ERR,
+        "walk: {}({}): {}\n",
+        error->operationName,
+        error->fullPath,
+        error->error.what());
+  }
+}
+
+bool InMemoryView::nameIndexGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const ViewDatabase& view,
+    const std::vector<NameFragment>& fragments) const {
+  std::vector<const watchman_file*> names;
+  for (auto& fragment : fragments) {
+    if (!view.findFilesWithNameContaining(
+            fragment.text, fragment.caseSensitive, names)) {
+      return false;
+    }
+  }
+  // A name containing more than one of the fragments is found for each
+  std::sort(names.begin(), names.end());
+  names.erase(std::unique(names.begin(), names.end()), names.end());
+  ctx->explainMethod("name_index");
+
+  std::vector<std::unique_ptr<FileResult>> batch;
+  for (auto* first : names) {
+    for (auto* f = first; f && !ctx->shouldStopGenerating();
+         f = f->nameNext) {
+      ctx->bumpNumWalked();
+      if (!ctx->fileMatchesRelativeRoot(f)) {
+        continue;
+      }
+
+      addToGeneratorBatch(
+          query,
+          ctx,
+          batch,
+          std::make_unique<InMemoryFileResult>(f, caches_));
+    }
+  }
+
+  w_query_process_files(query, ctx, std::move(batch));
+  return true;
+}
+
+std::shared_ptr<const InMemoryView::StatIndex> InMemoryView::getStatIndex(
+    const ViewDatabase& view) const {
+  auto locked = statIndex_.lock();
+  auto generation = view.getStructureGeneration();
+  if (*locked && (*locked)->structureGeneration == generation) {
+    return *locked;
+  }
+
+  auto index = std::make_shared<StatIndex>();
+  index->structureGeneration = generation;
+  // The caller holds the view lock, so no file can be marked changed at an
+  // earlier tick than this while we build.
+  index->builtAtTicks = mostRecentTick_.load(std::memory_order_acquire);
+  for (const auto* f = view.getLatestFile(); f; f = f->next) {
+    index->byMtime.emplace_back(int64_t(f->stat.mtime().tv_sec), f);
+    if (f->stat.isDir()) {
+      index->dirs.push_back(f);
+    } else {
+      index->bySize.emplace_back(int64_t(f->stat.size()), f);
+    }
   }
+  std::sort(index->bySize.begin(), index->bySize.end());
+  std::sort(index->byMtime.begin(), index->byMtime.end());
+
+  log(DBG,
+      "built stat index of ",
+      index->byMtime.size(),
+      " files for ",
+      rootPath_,
+      "\n");
+  *locked = index;
+  return index;
+}
+
+std::shared_ptr<const InMemoryView::DirIndex> InMemoryView::getDirIndex(
+    const ViewDatabase& view) const {
+  auto locked = dirIndex_.lock();
+  auto generation = view.getStructureGeneration();
+  if (*locked && (*locked)->structureGeneration == generation) {
+    return *locked;
+  }
+
+  auto index = std::make_shared<DirIndex>();
+  index->structureGeneration = generation;
+  // The caller holds the view lock, so no file can be marked changed at an
+  // earlier tick than this while we build.
+  index->builtAtTicks = mostRecentTick_.load(std::memory_order_acquire);
+  for (const auto* f = view.getLatestFile(); f; f = f->next) {
+    if (f->stat.isDir()) {
+      index->dirs.push_back(f);
+    }
+  }
+
+  log(DBG,
+      "built dir index of ",
+      index->dirs.size(),
+      " dirs for ",
+      rootPath_,
+      "\n");
+  *locked = index;
+  return index;
+}
+
+void InMemoryView::dirIndexGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const ViewDatabase& view) const {
+  auto index = getDirIndex(view);
+  ctx->explainMethod("dir_index", int64_t(index->dirs.size()));
+
+  std::vector<std::unique_ptr<FileResult>> batch;
+  auto consider = [&](const watchman_file* f) {
+    ctx->bumpNumWalked();
+    if (!ctx->fileMatchesRelativeRoot(f)) {
+      return;
+    }
+    addToGeneratorBatch(
+        query, ctx, batch, std::make_unique<InMemoryFileResult>(f, caches_));
+  };
+
+  // These may have become dirs since the index was built
+  for (const auto* f = view.getLatestFile();
+       f && f->otime.ticks >= index->builtAtTicks &&
+       !ctx->shouldStopGenerating();
+       f = f->next) {
+    consider(f);
+  }
+  for (auto it = index->dirs.begin();
+       it != index->dirs.end() && !ctx->shouldStopGenerating();
+       ++it) {
+    if ((*it)->otime.ticks < index->builtAtTicks) {
+      consider(*it);
+    }
+  }
+
+  w_query_process_files(query, ctx, std::move(batch));
+}
+
+bool InMemoryView::statIndexGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const ViewDatabase& view) const {
+  auto sizeRange = query->expr->computeStatRange(StatRangeField::Size);
+  auto mtimeRange = query->expr->computeStatRange(StatRangeField::Mtime);
+  if (!sizeRange && !mtimeRange) {
+    return false;
+  }
+
+  auto index = getStatIndex(view);
+  using Entries = std::vector<std::pair<int64_t, const watchman_file*>>;
+  auto findRange = [](const Entries& entries, const StatRange& range) {
+    auto begin = std::lower_bound(
+        entries.begin(),
+        entries.end(),
+        range.min,
+        [](const auto& entry, int64_t value) { return entry.first < value; });
+    auto end = std::upper_bound(
+        begin,
+        entries.end(),
+        range.max,
+        [](int64_t value, const auto& entry) { return value < entry.first; });
+    return std::make_pair(begin, end);
+  };
+
+  // Scan whichever index narrows the search the most
+  std::optional<std::pair<Entries::const_iterator, Entries::const_iterator>>
+      entries;
+  bool withDirs = false;
+  size_t numCandidates = std::numeric_limits<size_t>::max();
+  if (sizeRange) {
+    auto found = findRange(index->bySize, *sizeRange);
+    entries = found;
+    withDirs = true;
+    numCandidates = size_t(found.second - found.first) + index->dirs.size();
+  }
+  if (mtimeRange) {
+    auto found = findRange(index->byMtime, *mtimeRange);
+    if (size_t(found.second - found.first) < numCandidates) {
+      entries = found;
+      withDirs = false;
+      numCandidates = size_t(found.second - found.first);
+    }
+  }
+  if (numCandidates > index->byMtime.size() / 2) {
+    // Walking everything costs about as much
+    return false;
+  }
+  ctx->explainMethod("stat_index", int64_t(numCandidates));
+
+  std::vector<std::unique_ptr<FileResult>> batch;
+  auto consider = [&](const watchman_file* f) {
+    ctx->bumpNumWalked();
+    if (!ctx->fileMatchesRelativeRoot(f)) {
+      return;
+    }
+    addToGeneratorBatch(
+        query, ctx, batch, std::make_unique<InMemoryFileResult>(f, caches_));
+  };
+
+  // These may have changed size or mtime since the index was built
+  for (const auto* f = view.getLatestFile();
+       f && f->otime.ticks >= index->builtAtTicks &&
+       !ctx->shouldStopGenerating();
+       f = f->next) {
+    consider(f);
+  }
+  for (auto it = entries->first;
+       it != entries->second && !ctx->shouldStopGenerating();
+       ++it) {
+    if (it->second->otime.ticks < index->builtAtTicks) {
+      consider(it->second);
+    }
+  }
+  if (withDirs) {
+    for (auto it = index->dirs.begin();
+         it != index->dirs.end() && !ctx->shouldStopGenerating();
+         ++it) {
+      if ((*it)->otime.ticks < index->builtAtTicks) {
+        consider(*it);
+      }
+    }
+  }
+
+  w_query_process_files(query, ctx, std::move(batch));
+  return true;
 }
 
 ClockPosition InMemoryView::getMostRecentRootNumberAndTickValue() const {
@@ -909,12 +2525,7 @@ ClockPosition InMemoryView::getMostRecentRootNumberAndTickValue() const {
 }
 
 w_string InMemoryView::getCurrentClockString() const {
-  char clockbuf[128];
-  if (!clock_id_string(
-          rootNumber_, mostRecentTick_, clockbuf, sizeof(clockbuf))) {
-    throw std::runtime_error("clock string exceeded clockbuf size");
-  }
-  return w_string(clockbuf, W_STRING_UNICODE);
+  return ClockPosition(rootNumber_, mostRecentTick_).toClockString();
 }
 
 ClockTicks InMemoryView::getLastAgeOutTickValue() const {
@@ -933,6 +2544,10 @@ void InMemoryView::startThreads(const std::shared_ptr<Root>& root) {
   std::thread notifyThreadInstance([self, root]() {
     w_set_thread_name(
         "notify ", uintptr_t(self.get()), " ", self->rootPath_.view());
+    placeCurrentThread(ThreadRole::Notify);
+    if (root->background_priority) {
+      lowerCurrentThreadPriority();
+    }
     try {
       self->notifyThread(root);
     } catch (const std::exception& e) {
@@ -950,6 +2565,10 @@ void InMemoryView::startThreads(const std::shared_ptr<Root>& root) {
   std::thread ioThreadInstance([self, root]() {
     w_set_thread_name(
         "io ", uintptr_t(self.get()), " ", self->rootPath_.view());
+    placeCurrentThread(ThreadRole::Io);
+    if (root->background_priority) {
+      lowerCurrentThreadPriority();
+    }
     try {
       self->ioThread(root);
     } catch (const std::exception& e) {
@@ -1014,6 +2633,22 @@ folly::SemiFuture<folly::Unit> InMemoryView::waitForSettle(
 CookieSync::SyncResult InMemoryView::syncToNow(
     const std::shared_ptr<Root>& root,
     std::chrono::milliseconds timeout) {
+  if (root->viewOwner) {
+    return syncToNow(root->viewOwner, timeout);
+  }
+  if (auto barrier = syncBarrier(); barrier.valid()) {
+    try {
+      std::move(barrier).get(timeout);
+    } catch (folly::FutureTimeout&) {
+      auto why = fmt::format(
+          "syncToNow: timed out waiting for the watcher's sync barrier within {} milliseconds",
+          timeout.count());
+      log(ERR, why, "\n");
+      throw std::system_error(ETIMEDOUT, std::generic_category(), why);
+    }
+    return CookieSync::SyncResult{};
+  }
+
   auto syncResult = syncToNowCookies(root, timeout);
 
   // Some watcher implementations (notably, FSEvents) reorder change events
@@ -1045,9 +2680,24 @@ CookieSync::SyncResult InMemoryView::syncToNow(
 
 folly::SemiFuture<CookieSync::SyncResult> InMemoryView::sync(
     const std::shared_ptr<Root>& root) {
+  if (root->viewOwner) {
+    // Cookies are only recognized by the root that owns the view
+    return sync(root->viewOwner);
+  }
+  if (auto barrier = syncBarrier(); barrier.valid()) {
+    return std::move(barrier).deferValue(
+        [](folly::Unit) { return CookieSync::SyncResult{}; });
+  }
   return root->cookies.sync();
 }
 
+folly::SemiFuture<folly::Unit> InMemoryView::syncBarrier() {
+  if (!useSyncBarrier_) {
+    return folly::SemiFuture<folly::Unit>::makeEmpty();
+  }
+  return watcher_->syncBarrier();
+}
+
 CookieSync::SyncResult InMemoryView::syncToNowCookies(
     const std::shared_ptr<Root>& root,
     std::chrono::milliseconds timeout) {
@@ -1175,8 +2825,35 @@ json_ref InMemoryView::getViewDebugInfo() const {
     }
     processedPathsResult = json_array(std::move(paths));
   }
+  // Taken before the view lock, in the order that considerHibernate uses
+  bool hibernated = *hibernated_.lock();
+  auto view = view_.rlock();
+  auto& arenaStats = view->getArenaStats();
   return json_object({
       {"processed_paths", processedPathsResult},
+      {"node_arena",
+       json_object({
+           {"slabs", json_integer(arenaStats.slabs)},
+           {"slab_bytes",
+            json_integer(arenaStats.slabs * NodeArena::kSlabSize)},
+           {"slab_allocations", json_integer(arenaStats.slabAllocations)},
+           {"large_allocations", json_integer(arenaStats.largeAllocations)},
+           {"allocated_bytes", json_integer(arenaStats.allocatedBytes)},
+           {"huge_page_chunks", json_integer(arenaStats.chunks)},
+           {"interned_dir_names", json_integer(view->getNumDirNames())},
+       })},
+      {"lazy_crawl_deferred_dirs",
+       json_integer(lazyCrawl_.lock()->deferred.size())},
+      {"hibernated", json_boolean(hibernated)},
+      {"parallel_crawl",
+       json_object({
+           {"max_queued_entries",
+            json_integer(parallelCrawlMaxQueuedEntries_.load(
+                std::memory_order_relaxed))},
+           {"deferred_reads",
+            json_integer(
+                parallelCrawlDeferredReads_.load(std::memory_order_relaxed))},
+       })},
   });
 }
 
@@ -1186,68 +2863,103 @@ void InMemoryView::clearViewDebugInfo() {
   }
 }
 
-void InMemoryView::warmContentCache() {
-  if (!enableContentCacheWarming_) {
-    return;
+void InMemoryView::startEventTrace(const char* path, size_t maxChanges) {
+  auto trace = eventTrace_.lock();
+  if (*trace) {
+    throw std::logic_error("an event trace is already being written");
   }
+  *trace = std::make_unique<EventTraceWriter>(path, rootPath_, maxChanges);
+  eventTracing_.store(true, std::memory_order_release);
+}
 
-  log(DBG, "considering files for content hash cache warming\n");
+std::optional<size_t> InMemoryView::stopEventTrace() {
+  auto trace = eventTrace_.lock();
+  if (!*trace) {
+    return std::nullopt;
+  }
+  eventTracing_.store(false, std::memory_order_release);
+  auto changes = (*trace)->close();
+  trace->reset();
+  return changes;
+}
 
-  size_t n = 0;
-  std::deque<folly::Future<std::shared_ptr<const ContentHashCache::Node>>>
-      futures;
+namespace {
+// Cache keys and pending changes own a path whose length we don't track;
+// charge each of them this much on top of the fixed size of its node.
+constexpr size_t kEstimatedPathBytes = 64;
+} // namespace
 
+ViewPipelineTimes InMemoryView::getPipelineTimes() const {
+  return ViewPipelineTimes{
+      lastNotified_.load(std::memory_order_relaxed),
+      lastProcessed_.load(std::memory_order_relaxed),
+      lastSettled_.load(std::memory_order_relaxed)};
+}
+
+ViewMemoryUsage InMemoryView::getMemoryUsage() const {
+  ViewMemoryUsage usage;
   {
-    // Walk back in time until we hit the boundary, or hit the limit
-    // on the number of files we should warm up.
     auto view = view_.rlock();
-    struct watchman_file* f;
-    for (f = view->getLatestFile(); f && n < maxFilesToWarmInContentCache_;
-         f = f->next) {
-      if (f->otime.ticks <= lastWarmedTick_) {
-        log(DBG,
-            "warmContentCache: stop because file ticks ",
-            f->otime.ticks,
-            " is <= lastWarmedTick_ ",
-            lastWarmedTick_,
-            "\n");
-        break;
-      }
+    auto& arenaStats = view->getArenaStats();
+    usage.viewBytes = std::max(
+        {arenaStats.slabs * NodeArena::kSlabSize,
+         arenaStats.chunks * NodeArena::kChunkSize,
+         arenaStats.allocatedBytes});
+  }
+  usage.pendingBytes = pendingFromWatcher_.lock()->getPendingItemCount() *
+      (sizeof(watchman_pending_fs) + kEstimatedPathBytes);
+  usage.contentHashCacheBytes = caches_.contentHashCache.stats().size *
+      (sizeof(ContentHashCache::Node) + kEstimatedPathBytes);
+  usage.symlinkCacheBytes = caches_.symlinkTargetCache.stats().size *
+      (sizeof(SymlinkTargetCache::Node) + 2 * kEstimatedPathBytes);
+  return usage;
+}
 
-      if (f->exists && f->stat.isFile() &&
-          (maxFileSizeToWarmInContentCache_ <= 0 ||
-           f->stat.size <=
-               static_cast<uint64_t>(maxFileSizeToWarmInContentCache_))) {
-        // Note: we could also add an expression to further constrain
-        // the things we warm up here.  Let's see if we need it before
-        // going ahead and adding.
+void InMemoryView::shrinkMemory() {
+  caches_.contentHashCache.clear();
+  caches_.symlinkTargetCache.clear();
+}
 
-        auto dirStr = f->parent->getFullPath();
-        w_string_piece dir(dirStr);
-        dir.advance(caches_.contentHashCache.rootPath().size());
+std::optional<uint64_t> InMemoryView::getContentGeneration() const {
+  return view_.rlock()->getContentGeneration();
+}
 
-        // If dirName is the root, dir.size() will now be zero
-        if (dir.size() > 0) {
-          // if not at the root, skip the slash character at the
-          // front of dir
-          dir.advance(1);
-        }
-        ContentHashCacheKey key{
-            w_string::pathCat({dir, f->getName()}),
-            size_t(f->stat.size),
-            f->stat.mtime};
-
-        log(DBG, "warmContentCache: lookup ", key.relativePath, "\n");
-        auto f_2 = caches_.contentHashCache.get(key);
-        if (syncContentCacheWarming_) {
-          futures.emplace_back(std::move(f_2));
-        }
-        ++n;
-      }
-    }
+void InMemoryView::refreshScmMergeBases(Root& root) {
+  auto* scm = getSCM();
+  if (!scm || !scmStateChanged_.load(std::memory_order_acquire) ||
+      scmRefreshRunning_.exchange(true, std::memory_order_acq_rel)) {
+    // If a refresh is already running, this one waits for a later settle
+    return;
+  }
+  scmStateChanged_.store(false, std::memory_order_release);
 
-    lastWarmedTick_ = mostRecentTick_;
+  try {
+    // Holding the root keeps this view, and so the SCM, alive
+    getThreadPool().add([this, scm, root = root.shared_from_this()] {
+      SCOPE_EXIT {
+        scmRefreshRunning_.store(false, std::memory_order_release);
+      };
+      scm->refreshMergeBases(scmPrefetchTargets_);
+    });
+  } catch (const std::exception& exc) {
+    log(ERR, "failed to schedule refreshing merge bases: ", exc.what(), "\n");
+    scmRefreshRunning_.store(false, std::memory_order_release);
   }
+}
+
+void InMemoryView::warmContentCache() {
+  if (!enableContentCacheWarming_) {
+    return;
+  }
+
+  log(DBG, "considering files for content hash cache warming\n");
+
+  std::deque<folly::Future<std::shared_ptr<const ContentHashCache::Node>>>
+      futures;
+  auto n = scheduleContentCacheWarming(
+      std::chrono::milliseconds{0},
+      std::numeric_limits<uint64_t>::max(),
+      syncContentCacheWarming_ ? &futures : nullptr);
 
   log(DBG,
       "warmContentCache, lastWarmedTick_ now ",
@@ -1266,4 +2978,162 @@ void InMemoryView::warmContentCache() {
   }
 }
 
+void InMemoryView::warmContentCacheWhileBusy() {
+  if (!enableContentCacheWarming_ || busyWarmInterval_.count() <= 0) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (now - lastBusyWarm_ < busyWarmInterval_) {
+    return;
+  }
+  // Spend no more than the configured rate over the time since the last
+  // pass, so that warming can't swamp the disk while the tree is churning.
+  auto elapsed = std::min(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          now - lastBusyWarm_),
+      std::chrono::milliseconds{1000});
+  lastBusyWarm_ = now;
+  uint64_t maxBytes = busyWarmMaxBytesPerSec_ > 0
+      ? std::max<uint64_t>(1, busyWarmMaxBytesPerSec_ * elapsed.count() / 1000)
+      : std::numeric_limits<uint64_t>::max();
+
+  auto n = scheduleContentCacheWarming(busyWarmMinAge_, maxBytes, nullptr);
+  log(DBG,
+      "warmContentCacheWhileBusy, lastWarmedTick_ now ",
+      lastWarmedTick_,
+      " scheduled ",
+      n,
+      " files for hashing\n");
+}
+
+size_t InMemoryView::scheduleContentCacheWarming(
+    std::chrono::milliseconds minMtimeAge,
+    uint64_t maxBytes,
+    std::deque<folly::Future<std::shared_ptr<const ContentHashCache::Node>>>*
+        futures) {
+  size_t n = 0;
+  uint64_t bytes = 0;
+  auto wallNow = std::chrono::system_clock::to_time_t(
+      std::chrono::system_clock::now() - minMtimeAge);
+
+  // Walk back in time until we hit the boundary, or hit the limit
+  // on the number of files we should warm up.
+  auto view = view_.rlock();
+  // Files older than this tick are all warmed, or deliberately skipped
+  ClockTicks warmedTick = mostRecentTick_;
+  struct watchman_file* f;
+  for (f = view->getLatestFile(); f && n < maxFilesToWarmInContentCache_;
+       f = f->next) {
+    if (f->otime.ticks <= lastWarmedTick_) {
+      log(DBG,
+          "warmContentCache: stop because file ticks ",
+          f->otime.ticks,
+          " is <= lastWarmedTick_ ",
+          lastWarmedTick_,
+          "\n");
+      break;
+    }
+
+    if (!f->exists || !f->stat.isFile() ||
+        (maxFileSizeToWarmInContentCache_ > 0 &&
+         f->stat.size() >
+             static_cast<uint64_t>(maxFileSizeToWarmInContentCache_))) {
+      continue;
+    }
+
+    if (minMtimeAge.count() > 0 && f->stat.mtime().tv_sec >= wallNow) {
+      // Probably still being written; hashing it now would be wasted
+      // effort.  Come back to it on a later pass.
+      warmedTick = f->otime.ticks - 1;
+      continue;
+    }
+
+    if (n > 0 && bytes + f->stat.size() > maxBytes) {
+      // Out of budget; resume from here on a later pass
+      warmedTick = f->otime.ticks - 1;
+      break;
+    }
+
+    // Note: we could also add an expression to further constrain
+    // the things we warm up here.  Let's see if we need it before
+    // going ahead and adding.
+
+    auto dirStr = f->parent->getFullPath();
+    w_string_piece dir(dirStr);
+    dir.advance(caches_.contentHashCache.rootPath().size());
+
+    // If dirName is the root, dir.size() will now be zero
+    if (dir.size() > 0) {
+      // if not at the root, skip the slash character at the
+      // front of dir
+      dir.advance(1);
+    }
+    ContentHashCacheKey key{
+        w_string::pathCat({dir, f->getName()}),
+        size_t(f->stat.size()),
+        f->stat.mtime(),
+        f->stat.ino(),
+        contentCacheWarmingAlgorithm_};
+
+    log(DBG, "warmContentCache: lookup ", key.relativePath, "\n");
+    auto f_2 = caches_.contentHashCache.get(key);
+    if (futures) {
+      futures->emplace_back(std::move(f_2));
+    }
+    bytes += f->stat.size();
+    ++n;
+  }
+
+  lastWarmedTick_ = std::max<ClockTicks>(lastWarmedTick_, warmedTick);
+  return n;
+}
+
+void InMemoryView::warmSymlinkCache() {
+  if (!enableSymlinkCacheWarming_) {
+    return;
+  }
+
+  std::vector<SymlinkTargetCacheKey> keys;
+  {
+    // The crawl has already lstat'd these, so we know which are symlinks
+    auto view = view_.rlock();
+    for (auto* f = view->getLatestFile();
+         f && keys.size() < maxSymlinksToWarm_;
+         f = f->next) {
+      if (f->otime.ticks <= lastWarmedSymlinkTick_) {
+        break;
+      }
+      if (!f->exists || !f->stat.isSymlink()) {
+        continue;
+      }
+
+      auto dirStr = f->parent->getFullPath();
+      w_string_piece dir(dirStr);
+      dir.advance(caches_.symlinkTargetCache.rootPath().size());
+
+      // If dirName is the root, dir.size() will now be zero
+      if (dir.size() > 0) {
+        // if not at the root, skip the slash character at the
+        // front of dir
+        dir.advance(1);
+      }
+      keys.push_back(SymlinkTargetCacheKey{
+          w_string::pathCat({dir, f->getName()}), f->otime});
+    }
+
+    lastWarmedSymlinkTick_ = mostRecentTick_;
+  }
+
+  log(DBG,
+      "warmSymlinkCache, lastWarmedSymlinkTick_ now ",
+      lastWarmedSymlinkTick_,
+      " scheduled ",
+      keys.size(),
+      " symlinks for reading\n");
+
+  // Nobody waits for these; queries that want the targets find them in the
+  // cache, or subscribe to the pending reads
+  (void)caches_.symlinkTargetCache.getBatch(keys);
+}
+
 } // namespace watchman
@@ -6,23 +6,41 @@
  */
 
 #pragma once
+#include <folly/SharedMutex.h>
 #include <folly/Synchronized.h>
+#include <chrono>
+#include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
+#include <vector>
+#include "watchman/AdaptiveSettle.h"
+#include "watchman/ChangeJournal.h"
+#include "watchman/ChangedFileCollector.h"
 #include "watchman/ContentHash.h"
 #include "watchman/CookieSync.h"
+#include "watchman/EventTrace.h"
+#include "watchman/NegativeStatCache.h"
+#include "watchman/NodeArena.h"
 #include "watchman/PendingCollection.h"
 #include "watchman/PerfSample.h"
 #include "watchman/QueryableView.h"
+#include "watchman/RecencyIndex.h"
+#include "watchman/RecencyLog.h"
 #include "watchman/Result.h"
 #include "watchman/RingBuffer.h"
+#include "watchman/SubscriptionRouter.h"
 #include "watchman/SymlinkTargets.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/fs/DirHandle.h"
+#include "watchman/telemetry/InstrumentedMutex.h"
 #include "watchman/query/FileResult.h"
+#include "watchman/watchman_dir.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
 
@@ -33,6 +51,9 @@ namespace watchman {
 class FileSystem;
 class RootConfig;
 struct GlobTree;
+struct NameFragment;
+struct QueryPath;
+class PathBuilder;
 class Watcher;
 
 // Helper struct to hold caches used by the InMemoryView
@@ -44,13 +65,31 @@ struct InMemoryViewCaches {
       const w_string& rootPath,
       size_t maxHashes,
       size_t maxSymlinks,
-      std::chrono::milliseconds errorTTL);
+      std::chrono::milliseconds errorTTL,
+      size_t maxHashConcurrency = 0,
+      size_t inlineHashMaxSize = 0);
 };
 
 class InMemoryFileResult final : public FileResult {
  public:
-  InMemoryFileResult(const watchman_file* file, InMemoryViewCaches& caches);
+  /**
+   * dirName is the full path to file's parent dir, for callers that already
+   * have it; otherwise it is computed by walking the parent chain when it is
+   * first needed.
+   */
+  InMemoryFileResult(
+      const watchman_file* file,
+      InMemoryViewCaches& caches,
+      std::optional<w_string> dirName = std::nullopt);
+
+  // Generators create a result for every file they walk, most of which are
+  // rejected right away, so the storage is recycled through a per-thread
+  // free list rather than going back to the allocator each time.
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr, size_t size);
+
   std::optional<FileInformation> stat() override;
+  std::optional<DType> dtype() override;
   std::optional<struct timespec> accessedTime() override;
   std::optional<struct timespec> modifiedTime() override;
   std::optional<struct timespec> changedTime() override;
@@ -62,15 +101,63 @@ class InMemoryFileResult final : public FileResult {
   std::optional<ClockStamp> ctime() override;
   std::optional<ClockStamp> otime() override;
   std::optional<FileResult::ContentHash> getContentSha1() override;
+  std::optional<FileResult::ContentXxh3> getContentXxh3() override;
   void batchFetchProperties(
       const std::vector<std::unique_ptr<FileResult>>& files) override;
+  void detach() override;
+  const void* viewNode() const override;
 
  private:
+  // What the accessors need from file_, copied by detach()
+  struct Detached {
+    w_string name;
+    FileInformation stat;
+    bool exists;
+    ClockStamp ctime;
+    ClockStamp otime;
+  };
+
+  bool isSymlink() const;
+  bool isFile() const;
+  ino_t ino() const;
+
+  // Null once detached
   const watchman_file* file_;
+  std::optional<Detached> detached_;
   std::optional<w_string> dirName_;
   InMemoryViewCaches& caches_;
   std::optional<ResolvedSymlink> symlinkTarget_;
   Result<FileResult::ContentHash> contentSha1_;
+  Result<FileResult::ContentXxh3> contentXxh3_;
+};
+
+/**
+ * A deleted file that has been compacted into a tombstone.  Everything that
+ * can be reported about it is already in memory, other than the stat fields
+ * that the tombstone doesn't keep, which are reported as zero.
+ */
+class TombstoneFileResult final : public FileResult {
+ public:
+  TombstoneFileResult(const Tombstone* tombstone, w_string dirName);
+  std::optional<FileInformation> stat() override;
+  std::optional<struct timespec> accessedTime() override;
+  std::optional<struct timespec> modifiedTime() override;
+  std::optional<struct timespec> changedTime() override;
+  std::optional<size_t> size() override;
+  w_string_piece baseName() override;
+  w_string_piece dirName() override;
+  std::optional<bool> exists() override;
+  std::optional<ResolvedSymlink> readLink() override;
+  std::optional<ClockStamp> ctime() override;
+  std::optional<ClockStamp> otime() override;
+  std::optional<FileResult::ContentHash> getContentSha1() override;
+  std::optional<FileResult::ContentXxh3> getContentXxh3() override;
+  void batchFetchProperties(
+      const std::vector<std::unique_ptr<FileResult>>& files) override;
+
+ private:
+  const Tombstone* tombstone_;
+  w_string dirName_;
 };
 
 /**
@@ -80,12 +167,67 @@ class InMemoryFileResult final : public FileResult {
  */
 class ViewDatabase {
  public:
-  explicit ViewDatabase(const w_string& root_path);
+  ViewDatabase(
+      const w_string& root_path,
+      bool enableSuffixIndex,
+      bool enableNameIndex = false,
+      bool hugePageArena = false,
+      bool enableRecencyLog = false);
 
   watchman_file* getLatestFile() const {
     return latestFile_;
   }
 
+  /**
+   * Returns the most recently changed file whose otime is at or before
+   * `ticks`, or nullptr if there is none.  This is where a walk of the
+   * recency list for changes since `ticks` ends, found without walking it.
+   */
+  watchman_file* findFirstFileChangedAtOrBefore(ClockTicks ticks) const {
+    return recencyIndex_.seek(latestFile_, ticks);
+  }
+
+  /**
+   * Calls func on each file that changed after `ticks`, oldest first,
+   * until it returns false.
+   */
+  template <typename Func>
+  void forEachFileChangedAfterOldestFirst(ClockTicks ticks, Func&& func)
+      const {
+    recencyIndex_.forEachAfterOldestFirst(
+        latestFile_, ticks, std::forward<Func>(func));
+  }
+
+  /**
+   * Returns the log of recent changes if the view keeps one.
+   */
+  const RecencyLog<watchman_file>* getRecencyLog() const {
+    return recencyLog_ ? &*recencyLog_ : nullptr;
+  }
+
+  /**
+   * Must be called after files are removed from the view, as the recency
+   * index points at them.
+   */
+  void rebuildRecencyIndex() {
+    recencyIndex_.rebuild(latestFile_);
+    if (recencyLog_) {
+      recencyLog_->rebuild(latestFile_);
+    }
+  }
+
+  /**
+   * A cheaper alternative to rebuildRecencyIndex, for when only `removed`
+   * have been removed from the view.
+   */
+  void filesRemovedFromRecencyIndex(
+      const std::unordered_set<const watchman_file*>& removed) {
+    recencyIndex_.nodesRemoved(removed);
+    if (recencyLog_) {
+      recencyLog_->nodesRemoved(removed);
+    }
+  }
+
   ino_t getRootInode() const {
     return rootInode_;
   }
@@ -113,6 +255,42 @@ class ViewDatabase {
    */
   void markFileChanged(watchman_file* file, ClockStamp otime);
 
+  /**
+   * Incremented by markFileChanged, and by whoever removes files from the
+   * view.  See QueryableView::getContentGeneration.
+   */
+  uint64_t getContentGeneration() const {
+    return contentGeneration_;
+  }
+
+  void filesRemoved() {
+    ++contentGeneration_;
+    ++structureGeneration_;
+  }
+
+  /**
+   * Incremented whenever file nodes are freed, or loaded wholesale with
+   * ticks that may be older than the view's.  Anything that holds pointers
+   * to file nodes outside of the view lock must start over when it changes.
+   */
+  uint64_t getStructureGeneration() const {
+    return structureGeneration_;
+  }
+
+  /**
+   * Offers every file passed to markFileChanged from now on to `collector`,
+   * until the collector is destroyed.
+   */
+  void addChangedFileCollector(
+      const std::shared_ptr<ChangedFileCollector>& collector,
+      ClockPosition position);
+
+  /**
+   * Restarts every collector from `position`. Must be called whenever files
+   * are removed from the view, as collectors hold pointers to them.
+   */
+  void restartChangedFileCollectors(ClockPosition position);
+
   /**
    * Mark a directory as being removed from the view. Marks the contained set of
    * files as deleted. If recursive is true, is recursively invoked on child
@@ -120,15 +298,160 @@ class ViewDatabase {
    */
   void markDirDeleted(watchman_dir* dir, ClockStamp otime, bool recursive);
 
+  bool hasSuffixIndex() const {
+    return enableSuffixIndex_;
+  }
+
+  /**
+   * Returns the most recently created file whose lowercased suffix (as
+   * returned by w_string_piece::suffix) is `suffix`.  The remaining files
+   * with that suffix are linked through watchman_file::suffixNext.
+   * Returns nullptr if there are none or the suffix index is disabled.
+   */
+  const watchman_file* getFirstFileWithSuffix(const w_string& suffix) const;
+
+  bool hasNameIndex() const {
+    return enableNameIndex_;
+  }
+
+  // Length of the substrings of file names that the name index is keyed by
+  static constexpr size_t kNameIndexGramSize = 3;
+
+  /**
+   * Appends to `out` the most recently created file for each distinct file
+   * name that contains `fragment`.  The remaining files with the same name
+   * are linked through watchman_file::nameNext.  Returns false, leaving `out`
+   * untouched, if the name index is disabled or the fragment is shorter than
+   * kNameIndexGramSize, as the index can't narrow down such a search.
+   */
+  bool findFilesWithNameContaining(
+      w_string_piece fragment,
+      CaseSensitivity caseSensitive,
+      std::vector<const watchman_file*>& out) const;
+
+  /**
+   * Forgets the names that no file in the view has any more.  Called after
+   * files are aged out.
+   */
+  void pruneNameIndex();
+
+  /**
+   * Writes every dir and file node in this view to a snapshot file at path,
+   * including the crawl stamps of the dirs, along with `ticks`, the most
+   * recent tick of the view, and the tick before which clocks are treated
+   * as fresh instances.
+   * Throws on I/O error.
+   */
+  void saveSnapshot(
+      const char* path,
+      ClockTicks ticks,
+      ClockTicks lastAgeOutTicks) const;
+
+  struct SnapshotInfo {
+    ClockTicks ticks;
+    ClockTicks lastAgeOutTicks;
+  };
+
+  /**
+   * Returns the ticks recorded in the snapshot at path.  Throws if it is
+   * unreadable or has an incompatible format.
+   */
+  static SnapshotInfo readSnapshotInfo(const char* path);
+
+  /**
+   * Populates this empty view from a snapshot written by saveSnapshot.
+   * Every node is stamped with `ticks`, or if nullopt, with the ticks it had
+   * when it was saved; the original timestamps are kept.
+   * Returns the number of file nodes loaded.  Throws if the snapshot is
+   * unreadable, corrupt, or was written for a different root path, in which
+   * case the view is left empty.
+   */
+  size_t loadSnapshot(const char* path, std::optional<ClockTicks> ticks);
+
+  /**
+   * Frees every dir and file node in this view, leaving it as it was when
+   * constructed, ready for loadSnapshot.
+   */
+  void clear();
+
+  /**
+   * Applies changes read from a ChangeJournal, oldest first.
+   */
+  void replayChanges(const std::vector<ChangeJournal::Change>& changes);
+
+  /**
+   * Appends every change passed to markFileChanged from now on to journal,
+   * which must outlive this view.
+   */
+  void setChangeJournal(ChangeJournal* journal) {
+    journal_ = journal;
+  }
+
+  /**
+   * Reports the path of every file passed to markFileChanged from now on to
+   * router, which must outlive this view.
+   */
+  void setSubscriptionRouter(SubscriptionRouter* router) {
+    subscriptionRouter_ = router;
+  }
+
+  /**
+   * Returns allocation statistics for the file and dir nodes in this view.
+   */
+  const NodeArena::Stats& getArenaStats() const {
+    return arena_.getStats();
+  }
+
+  /**
+   * Returns the number of distinct names shared by the dirs in this view.
+   */
+  size_t getNumDirNames() const {
+    return arena_.dirNames().size();
+  }
+
  private:
   void insertAtHeadOfFileList(struct watchman_file* file);
+  void insertIntoSuffixIndex(struct watchman_file* file);
+
+  using NameListHead = std::pair<const w_string, watchman_file*>;
+  void insertIntoNameIndex(struct watchman_file* file, const w_string& name);
+  void indexNameGrams(const NameListHead* names);
 
   const w_string rootPath_;
+  const bool enableSuffixIndex_;
+  const bool enableNameIndex_;
 
   /* the most recently changed file */
   watchman_file* latestFile_ = nullptr;
 
-  std::unique_ptr<watchman_dir> rootDir_;
+  // Skips into the list headed by latestFile_ by tick.
+  RecencyIndex<watchman_file> recencyIndex_;
+  // The changes in the list headed by latestFile_, if enabled
+  std::optional<RecencyLog<watchman_file>> recencyLog_;
+
+  // Heads of the lists of files that share a lowercased suffix.  The file
+  // nodes point back into the values, so this must outlive rootDir_.
+  std::unordered_map<w_string, watchman_file*> suffixIndex_;
+
+  // Heads of the lists of files that share a name, and for each lowercased
+  // trigram, the names that contain it.  As with suffixIndex_, the file
+  // nodes point back into nameIndex_, so it must outlive rootDir_.
+  std::unordered_map<w_string, watchman_file*> nameIndex_;
+  std::unordered_map<uint32_t, std::vector<const NameListHead*>>
+      nameTrigrams_;
+
+  // Backs every file and dir node reachable from rootDir_, so it must be
+  // declared before (and therefore destroyed after) rootDir_.
+  NodeArena arena_;
+
+  watchman_dir::Ptr rootDir_;
+
+  std::vector<std::weak_ptr<ChangedFileCollector>> changedFileCollectors_;
+  ChangeJournal* journal_{nullptr};
+  SubscriptionRouter* subscriptionRouter_{nullptr};
+
+  uint64_t contentGeneration_{0};
+  uint64_t structureGeneration_{0};
 
   // Inode number for the root dir.  This is used to detect what should
   // be impossible situations, but is needed in practice to workaround
@@ -136,6 +459,13 @@ class ViewDatabase {
   ino_t rootInode_{0};
 };
 
+using SynchronizedViewDatabase = folly::Synchronized<
+    ViewDatabase,
+    InstrumentedSharedMutex<
+        folly::SharedMutex,
+        &LockStats::viewWait,
+        &LockStats::viewHold>>;
+
 /**
  * Keeps track of the state of the filesystem in-memory and drives a notify
  * thread which consumes events from the watcher.
@@ -170,6 +500,11 @@ class InMemoryView final : public QueryableView {
       int64_t& dirs,
       std::chrono::seconds minAge) override;
 
+  void compactTombstones(
+      int64_t& walked,
+      int64_t& files,
+      std::chrono::seconds minAge) override;
+
   folly::SemiFuture<folly::Unit> waitForSettle(
       std::chrono::milliseconds settle_period) override;
   CookieSync::SyncResult syncToNow(
@@ -196,6 +531,28 @@ class InMemoryView final : public QueryableView {
 
   void allFilesGenerator(const Query* query, QueryContext* ctx) const override;
 
+  std::shared_ptr<ChangedFileCollector> collectChangedFiles(
+      const Query* query) override;
+
+  void changedFilesGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      ChangedFileCollector& collector) const override;
+
+  void scmChangesGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const std::vector<w_string>& paths,
+      ClockStamp clock) const override;
+
+  std::shared_ptr<SubscriptionRoute> routeSubscription(
+      const Query* query) override;
+
+  bool isUnchangedInScope(
+      const SubscriptionRoute& route,
+      ClockPosition since,
+      ClockPosition now) const override;
+
   /**
    * Returns a SemiFuture that completes when any pending recrawls are
    * completed. The primary use of this is so that "watch-project" doesn't send
@@ -206,11 +563,51 @@ class InMemoryView final : public QueryableView {
    */
   folly::SemiFuture<folly::Unit> waitUntilReadyToQuery() override;
 
+  /**
+   * With lazy_crawl configured, queues a crawl of the deferred directories
+   * that the query may produce results from.  If the view is hibernated, has
+   * the IO thread reload it.  The returned SemiFuture completes once the IO
+   * thread did both.
+   */
+  folly::SemiFuture<folly::Unit> crawlForQuery(const Query* query) override;
+
+  /**
+   * With serve_crawled_subtrees configured, true while the initial crawl is
+   * running if it is done with every subtree that the query may produce
+   * results from.
+   */
+  bool isCrawledForQuery(const Query* query) const override;
+
+  /**
+   * Called by the crawlers before they descend into a new directory. Returns
+   * true, and remembers the directory for crawlForQuery, if lazy_crawl
+   * defers its crawl until a query needs it. May be called from the parallel
+   * crawler's threads.
+   */
+  bool deferCrawl(const Root& root, const w_string& fullPath);
+
   void startThreads(const std::shared_ptr<Root>& root) override;
   void stopThreads(std::string_view reason) override;
   void wakeThreads() override;
   void clientModeCrawl(const std::shared_ptr<Root>& root);
 
+  /**
+   * Returns true if walkGenerator() produces the same results for the query
+   * as crawling the root and then running the query's generators would.
+   */
+  static bool canWalkForQuery(const Query& query);
+
+  /**
+   * Generates files by walking the filesystem beneath the query's relative
+   * root instead of reading the view, so that a one-shot client mode query
+   * neither waits for nor holds a view of the whole tree.  The files of each
+   * directory are passed to the query as soon as it has been read.
+   */
+  void walkGenerator(
+      const std::shared_ptr<Root>& root,
+      const Query* query,
+      QueryContext* ctx) const;
+
   const w_string& getName() const override;
   const std::shared_ptr<Watcher>& getWatcher() const;
   json_ref getWatcherDebugInfo() const override;
@@ -218,9 +615,46 @@ class InMemoryView final : public QueryableView {
   json_ref getViewDebugInfo() const;
   void clearViewDebugInfo();
 
+  // Starts writing the changes that the watcher reports to an event trace
+  // at `path`, for replaying in benchmarks, until stopEventTrace is called
+  // or `maxChanges` are written.  Throws if a trace is already being
+  // written or the file can't be created.
+  void startEventTrace(const char* path, size_t maxChanges);
+  // Stops the trace and returns the number of changes it holds, or nullopt
+  // if no trace was being written.
+  std::optional<size_t> stopEventTrace();
+  ViewMemoryUsage getMemoryUsage() const override;
+  void shrinkMemory() override;
+  std::optional<uint64_t> getContentGeneration() const override;
+  ViewPipelineTimes getPipelineTimes() const override;
+
   // If content cache warming is configured, do the warm up now
   void warmContentCache();
 
+  // If content cache warming while busy is configured and enough time has
+  // passed since the last pass, warms the files that changed since then,
+  // within the configured byte budget
+  void warmContentCacheWhileBusy();
+
+  // Looks up the files that changed since lastWarmedTick_ in the content
+  // hash cache, so that it computes their hashes.  Files whose mtime is
+  // within minMtimeAge of now are skipped, as are the files beyond maxBytes.
+  // Both are left for a later call.  Returns the number of files looked up;
+  // if `futures` is set, the lookups are added to it.
+  size_t scheduleContentCacheWarming(
+      std::chrono::milliseconds minMtimeAge,
+      uint64_t maxBytes,
+      std::deque<folly::Future<std::shared_ptr<const ContentHashCache::Node>>>*
+          futures);
+
+  // If symlink target warming is configured, read the targets of the
+  // symlinks that changed since the last call into the cache
+  void warmSymlinkCache();
+
+  // If the working copy has moved to another commit since the last call,
+  // recomputes the SCM merge bases that queries ask for in the background.
+  void refreshScmMergeBases(Root& root);
+
   InMemoryViewCaches& debugAccessCaches() const {
     return caches_;
   }
@@ -230,33 +664,187 @@ class InMemoryView final : public QueryableView {
       const std::shared_ptr<Root>& root,
       std::chrono::milliseconds timeout);
 
+  // Returns the watcher's sync barrier if it is to be used in place of
+  // cookies, or an invalid future otherwise.
+  folly::SemiFuture<folly::Unit> syncBarrier();
+
   // Returns the erased file's otime.
   ClockStamp ageOutFile(
       std::unordered_set<w_string>& dirs_to_erase,
       watchman_file* file);
 
+  // Replaces the deleted file with a tombstone in its parent dir.
+  void tombstoneFile(watchman_file* file);
+
+  /**
+   * Walks the recency list, calling remove on every deleted file that last
+   * changed at or before cutoff. remove must free the file.
+   *
+   * The lock is released every view_lock_yield_ms so that queries aren't
+   * stalled behind a walk of a large view; view is locked again on return.
+   */
+  template <typename Remove>
+  void removeDeletedFiles(
+      SynchronizedViewDatabase::WLockedPtr& view,
+      std::chrono::system_clock::time_point cutoff,
+      int64_t& walked,
+      int64_t& files,
+      Remove&& remove);
+
+  /**
+   * Takes the read lock on the view for a generator.  Unless disabled by
+   * view_lock_defer_fetches, the files that the generator finds are only
+   * hashed or have their symlinks read once the lock has been released.
+   */
+  SynchronizedViewDatabase::ConstRLockedPtr lockForGenerator(
+      QueryContext* ctx) const;
+
+  /**
+   * Produces the files that changed after the query's since clause by
+   * walking the recency list, for the time generator.
+   */
+  void timeGeneratorFromList(
+      const Query* query,
+      QueryContext* ctx,
+      const ViewDatabase& view) const;
+
+  /**
+   * Produces the tombstones in and below dir that changed after the query's
+   * since clause, for the time generator.
+   */
+  void tombstoneGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const watchman_dir* dir,
+      const w_string& dirPath) const;
+
   // When a watcher is desynced, it sets the W_PENDING_IS_DESYNCED flag, and the
   // crawler will set these recursively. If one of these flag is set,
   // processPending will return IsDesynced::Yes and it is expected that the
   // caller will abort all pending cookies after processAllPending returns.
   enum class IsDesynced { Yes, No };
 
-  /** Recursively walks files under a specified dir */
+  /**
+   * Enumerates the files under dir matching query->suffixes from the suffix
+   * index.  Produces the same set of files as the equivalent recursive glob
+   * walk, without visiting files with other suffixes.
+   */
+  void suffixGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const ViewDatabase& view,
+      const watchman_dir* dir) const;
+
+  /**
+   * Enumerates the files whose names contain one of `fragments`, found
+   * through the name index.  Returns false without producing anything if the
+   * index can't be used for these fragments.
+   */
+  bool nameIndexGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const ViewDatabase& view,
+      const std::vector<NameFragment>& fragments) const;
+
+  /**
+   * Sorted copies of the size and mtime of the files in the view, built by
+   * the first query that can use them and reused until files are removed
+   * from the view.  Files that change later are found through the recency
+   * list instead, so the index doesn't have to be maintained as they do.
+   */
+  struct StatIndex {
+    uint64_t structureGeneration;
+    // Files whose otime ticks are at least this may have changed since
+    // the index was built.
+    ClockTicks builtAtTicks;
+    std::vector<std::pair<int64_t, const watchman_file*>> bySize;
+    std::vector<std::pair<int64_t, const watchman_file*>> byMtime;
+    // The size of a dir can change without it being marked as changed, so
+    // they aren't in bySize and always have to be considered.
+    std::vector<const watchman_file*> dirs;
+  };
+
+  /**
+   * Returns the stat index for view, building it if it is out of date.
+   */
+  std::shared_ptr<const StatIndex> getStatIndex(const ViewDatabase& view) const;
+
+  /**
+   * Enumerates the files whose size or mtime falls in the range that the
+   * query's expression requires, found through the stat index.  Returns
+   * false without producing anything if the expression has no such range or
+   * the range covers too much of the view for the index to help.
+   */
+  bool statIndexGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const ViewDatabase& view) const;
+
+  /**
+   * The dir nodes in the view, built by the first query that only matches
+   * dirs and reused until files are removed from the view.  As with the
+   * StatIndex, files that changed later, including those that became dirs,
+   * are found through the recency list instead.  The dirs maps of the tree
+   * can't stand in for it: dirs that weren't crawled, such as those inside
+   * a VCS dir or on another mount, have a node but no watchman_dir.
+   */
+  struct DirIndex {
+    uint64_t structureGeneration;
+    ClockTicks builtAtTicks;
+    std::vector<const watchman_file*> dirs;
+  };
+
+  /**
+   * Returns the dir index for view, building it if it is out of date.
+   */
+  std::shared_ptr<const DirIndex> getDirIndex(const ViewDatabase& view) const;
+
+  /**
+   * Enumerates the dirs in the view, and the files that changed since the
+   * dir index was built, for an expression that only matches dirs.
+   */
+  void dirIndexGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const ViewDatabase& view) const;
+
+  /**
+   * Walks the files that match the supplied set of paths, as for
+   * pathGenerator.
+   */
+  void generatePaths(
+      const Query* query,
+      QueryContext* ctx,
+      const std::vector<QueryPath>& paths) const;
+
+  /**
+   * Recursively walks files under a specified dir, appending them to batch
+   * for processing by the query engine.  Files and subtrees whose otime is
+   * no later than otimeBound are skipped.  dirPath is the full path to dir;
+   * it is extended once per child dir and shared by the results for its
+   * files, rather than rebuilt from the parent chain for each of them.
+   */
   void dirGenerator(
       const Query* query,
       QueryContext* ctx,
       const watchman_dir* dir,
-      uint32_t depth) const;
+      const w_string& dirPath,
+      uint32_t depth,
+      ClockTicks otimeBound,
+      std::vector<std::unique_ptr<FileResult>>& batch) const;
   void globGeneratorTree(
       QueryContext* ctx,
       const GlobTree* node,
       const struct watchman_dir* dir) const;
+  /**
+   * relName holds the path of dir relative to where the walk started.  It
+   * is extended in place as the walk descends and restored on return.
+   */
   void globGeneratorDoublestar(
       QueryContext* ctx,
       const struct watchman_dir* dir,
       const GlobTree* node,
-      const char* dir_name,
-      uint32_t dir_name_len) const;
+      PathBuilder& relName) const;
 
   void notifyThread(const std::shared_ptr<Root>& root);
 
@@ -267,18 +855,61 @@ class InMemoryView final : public QueryableView {
   // Consume entries from `pending` and apply them to the InMemoryView. Any new
   // pending paths generated by processPath will be crawled before
   // processAllPending returns.
+  //
+  // If the write lock has been held for longer than view_lock_yield_ms, it is
+  // briefly released between pending items so that concurrent queries are not
+  // stalled behind a large batch of changes.  The tick is advanced each time
+  // the lock is reacquired, so a query that ran in the gap will still observe
+  // the remainder of the batch as newer than its clock.
   IsDesynced processAllPending(
       const std::shared_ptr<Root>& root,
-      ViewDatabase& view,
+      SynchronizedViewDatabase::WLockedPtr& view,
       PendingChanges& pending);
 
+  /**
+   * The outcome of a stat that processAllPending() made of a pending item
+   * ahead of statPath(), on the thread pool.
+   */
+  struct PrefetchedStat {
+    const watchman_pending_fs* item;
+    FileInformation st;
+    std::error_code error;
+    // When the stat was issued, for the negative stat cache
+    std::chrono::system_clock::time_point issued;
+  };
+
+  /**
+   * Returns an entry, in the order of the chain, for each item of `pending`
+   * that statPath() would stat, or nothing if there are too few of them to
+   * be worth statting on the thread pool.  Doesn't touch the view.
+   */
+  std::vector<PrefetchedStat> collectPendingStats(
+      const Root& root,
+      const PendingChain& pending) const;
+
+  /**
+   * Stats the entries returned by collectPendingStats().  They are grouped
+   * by parent directory and the groups are statted in batches on the thread
+   * pool.
+   */
+  void prefetchPendingStats(
+      const Root& root,
+      std::vector<PrefetchedStat>& stats) const;
+
+  /**
+   * If `parentDir` is non-null, it must be the view's node for the parent of
+   * `pending.path`; passing it saves resolving the parent all over again for
+   * every entry of a directory.
+   */
   void processPath(
       const std::shared_ptr<Root>& root,
       ViewDatabase& view,
       PendingChanges& coll,
       const PendingChange& pending,
       const FileInformation* pre_stat,
-      std::vector<w_string>& pendingCookies);
+      std::vector<w_string>& pendingCookies,
+      watchman_dir* parentDir = nullptr,
+      const PrefetchedStat* prefetched = nullptr);
 
   /**
    * Crawl the given directory. Any cookies discovered during the crawl are
@@ -297,6 +928,10 @@ class InMemoryView final : public QueryableView {
       const PendingChange& pending,
       std::vector<w_string>& pendingCookies);
 
+  // Default for crawl_max_queued_entries: how many entries a ParallelWalker
+  // may hold for this thread before its reads wait.
+  static constexpr size_t kDefaultCrawlMaxQueuedEntries = 262144;
+
   /**
    * Crawl the given directory recursively using ParallelWalker.
    *
@@ -309,10 +944,24 @@ class InMemoryView final : public QueryableView {
       const PendingChange& pending,
       std::vector<w_string>& pendingCookies);
 
+  /**
+   * True if `st`, read by crawlerParallel for the child `name` of `dir`,
+   * matches what the view already holds for it in `file`, so that statPath
+   * would change nothing and can be skipped.
+   */
+  bool isUnchangedEntry(
+      const watchman_dir& dir,
+      const watchman_file& file,
+      w_string_piece name,
+      const FileInformation& st) const;
+
   /**
    * Called on the IO thread. If `pending` is not in the ignored directory list,
    * lstat() the file and update the InMemoryView. This may insert work into
    * `coll` if a directory needs to be rescanned.
+   *
+   * `parentDir` is as for processPath().  `prefetched`, if non-null, is
+   * used in place of stat'ing the path.
    */
   void statPath(
       const Root& root,
@@ -320,7 +969,9 @@ class InMemoryView final : public QueryableView {
       ViewDatabase& view,
       PendingChanges& coll,
       const PendingChange& pending,
-      const FileInformation* pre_stat);
+      const FileInformation* pre_stat,
+      watchman_dir* parentDir = nullptr,
+      const PrefetchedStat* prefetched = nullptr);
 
   // END IOTHREAD
 
@@ -344,6 +995,9 @@ class InMemoryView final : public QueryableView {
 
     // When the iothread last processed a pending event from the Watcher.
     std::optional<std::chrono::steady_clock::time_point> lastUnsettle;
+
+    // Set when the root's settle period adapts to its event rate.
+    std::optional<AdaptiveSettle> adaptiveSettle;
   };
 
   // Returns a reference to the ViewDatabase without synchronizing on the mutex.
@@ -373,10 +1027,53 @@ class InMemoryView final : public QueryableView {
   // Returns whether the root was reaped and the IO thread should terminate.
   Continue doSettleThings(Root& root, IoThreadState& state);
 
+  // Returns the location of the view snapshot for this root, if the
+  // view_snapshot_dir option is configured.
+  std::optional<w_string> getSnapshotPath() const;
+
+  // Populates the view from a previously saved snapshot, if one exists.
+  // Called on the IO thread prior to the initial crawl, which then acts as
+  // a reconciliation pass: only entries that changed while the daemon was
+  // not running are assigned new ticks, and only the dirs whose saved crawl
+  // stamps no longer match are read.  Each InMemoryView has a distinct
+  // root number, so clocks issued by a prior daemon instance are treated as
+  // fresh instances, unless the change_journal brings the view up to date
+  // with the prior instance, in which case its ticks carry on.
+  void loadSnapshot();
+
+  // Saves a snapshot of the view if anything changed since the last one,
+  // and, unless force is set, if view_snapshot_interval_seconds has elapsed.
+  void saveSnapshot(bool force);
+
+  // With idle_hibernate_age_seconds, saves a snapshot of a view that has
+  // been idle for that long and frees it, while the watcher keeps running.
+  // Returns whether the view was hibernated.
+  bool considerHibernate(Root& root);
+
+  // Called on the IO thread while hibernated.  Moves the changes in
+  // `pending` aside, to be applied once the view is reloaded, and returns
+  // true, unless something is waiting for the view to catch up with them.
+  bool stashWhileHibernated(Root& root, PendingChanges& pending);
+
+  // Reloads the hibernated view from its snapshot, and moves the changes
+  // stashed meanwhile into `pending` so that they are applied on top.
+  void thaw(Root& root, PendingChanges& pending);
+
+  // Removes the lazy_crawl deferred directories that the query may produce
+  // results from, and returns them.
+  std::vector<w_string> takeDeferredCrawls(const Query* query);
+
+  // Called on the IO thread after it processed the recursive crawl of `path`
+  // during the initial crawl, to record which subtrees are complete.
+  void updateCrawlProgress(PendingChanges& coll, const w_string& path);
+
   FileSystem& fileSystem_;
   const Configuration config_;
 
-  folly::Synchronized<ViewDatabase> view_;
+  // The view reports changes to it, so it must outlive view_.
+  SubscriptionRouter subscriptionRouter_;
+
+  SynchronizedViewDatabase view_;
   // The most recently observed tick value of an item in the view
   // Only incremented by the iothread, but may be read by other threads.
   std::atomic<ClockTicks> mostRecentTick_{1};
@@ -397,7 +1094,13 @@ class InMemoryView final : public QueryableView {
    *
    * Sorted by settle period.
    */
-  folly::Synchronized<PendingSettles> pendingSettles_;
+  folly::Synchronized<
+      PendingSettles,
+      InstrumentedSharedMutex<
+          folly::SharedMutex,
+          &LockStats::settlesWait,
+          &LockStats::settlesHold>>
+      pendingSettles_;
 
   /*
    * Queue of items that we need to stat/process.
@@ -407,6 +1110,13 @@ class InMemoryView final : public QueryableView {
    */
   PendingCollection pendingFromWatcher_;
 
+  /*
+   * Batches from the notify thread, handed to the IO thread without taking
+   * the pendingFromWatcher_ lock. The notify thread falls back to
+   * pendingFromWatcher_ when it is full.
+   */
+  PendingChangesQueue fromNotifyThread_;
+
   std::atomic<bool> stopThreads_{false};
   std::shared_ptr<Watcher> watcher_;
 
@@ -424,8 +1134,63 @@ class InMemoryView final : public QueryableView {
   // If true, we will wait for the items to be hashed before
   // dispatching the settle to watchman clients
   bool syncContentCacheWarming_{false};
+  // Which digest to warm the cache with
+  ContentHashAlgorithm contentCacheWarmingAlgorithm_{
+      ContentHashAlgorithm::Sha1};
+  // How often to warm the cache while changes keep the view from settling.
+  // Zero to only warm it when settling.
+  std::chrono::milliseconds busyWarmInterval_{0};
+  // Files modified more recently than this aren't warmed while busy
+  std::chrono::milliseconds busyWarmMinAge_{1000};
+  // How many bytes a second to hash while busy; zero for no limit
+  uint64_t busyWarmMaxBytesPerSec_{0};
+  // When the IO thread last warmed the cache while busy
+  std::chrono::steady_clock::time_point lastBusyWarm_;
+
+  // Should we read the targets of changed symlinks when we settle?
+  bool enableSymlinkCacheWarming_{false};
+  // How many of the most recently changed symlinks to warm up when settling
+  size_t maxSymlinksToWarm_{1024};
+
+  // Whether to synchronize through the watcher's syncBarrier, when it has
+  // one, rather than through cookie files
+  bool useSyncBarrier_{true};
+
+  // Whether the stat_index option is enabled
+  const bool enableStatIndex_;
+  mutable folly::Synchronized<std::shared_ptr<const StatIndex>, std::mutex>
+      statIndex_;
+  mutable folly::Synchronized<std::shared_ptr<const DirIndex>, std::mutex>
+      dirIndex_;
+
+  // Merge base targets from the scm_prefetch_mergebase_with option, which
+  // are refreshed along with those that queries have asked for.
+  std::vector<w_string> scmPrefetchTargets_;
+  // Set by the IO thread when it sees the SCM's commit state change
+  std::atomic<bool> scmStateChanged_{false};
+  // Whether a refresh of the merge bases is queued or running
+  std::atomic<bool> scmRefreshRunning_{false};
   // Remember what we've already warmed up
   uint32_t lastWarmedTick_{0};
+  uint32_t lastWarmedSymlinkTick_{0};
+
+  // How long the root must be idle before its view is hibernated, or zero
+  // if it never is.
+  const std::chrono::seconds idleHibernateAge_;
+  // Set while the view is freed by considerHibernate.  A query either finds
+  // it set, and has the IO thread reload the view, or is already listed in
+  // Root::queries, which keeps the view from being hibernated.
+  folly::Synchronized<bool, std::mutex> hibernated_{false};
+  // The changes that the watcher reported while hibernated, coalesced.
+  // Only accessed by the IO thread.
+  PendingChanges hibernatedPending_;
+
+  // Tick and time at which the view snapshot was last written or loaded.
+  // Only accessed by the IO thread.
+  ClockTicks lastSnapshotTick_{0};
+  // Set when the change_journal option is enabled along with snapshots.
+  std::unique_ptr<ChangeJournal> journal_;
+  std::chrono::steady_clock::time_point lastSnapshotTime_;
 
   struct PendingChangeLogEntry {
     PendingChangeLogEntry() noexcept {
@@ -458,8 +1223,51 @@ class InMemoryView final : public QueryableView {
   // If set, paths processed by processPending are logged here.
   std::unique_ptr<RingBuffer<PendingChangeLogEntry>> processedPaths_;
 
+  // For getPipelineTimes: when the notify thread last handed changes to the
+  // IO thread, when the IO thread last applied them, and when the view last
+  // settled after that.
+  std::atomic<std::chrono::system_clock::time_point> lastNotified_{};
+  std::atomic<std::chrono::system_clock::time_point> lastProcessed_{};
+  std::atomic<std::chrono::system_clock::time_point> lastSettled_{};
+
+  // Set by startEventTrace, and written by the notify thread.  The flag
+  // spares the notify thread the lock when no trace is being written.
+  folly::Synchronized<std::unique_ptr<EventTraceWriter>, std::mutex>
+      eventTrace_;
+  std::atomic<bool> eventTracing_{false};
+
   // Track statPath() count during fullCrawl(). Used to report progress.
   std::shared_ptr<std::atomic<size_t>> fullCrawlStatCount_;
+
+  // Queue statistics of the parallel crawls, for debug-status. The most
+  // entries queued by any crawl, and the reads deferred across all of them.
+  std::atomic<size_t> parallelCrawlMaxQueuedEntries_{0};
+  std::atomic<size_t> parallelCrawlDeferredReads_{0};
+
+  // Paths that statPath recently found missing. Only used by the IO thread.
+  NegativeStatCache negativeStats_;
+
+  struct LazyCrawl {
+    // Directories whose crawl was deferred and that no query asked for yet
+    std::unordered_set<w_string> deferred;
+    // The hot prefixes and the paths that queries asked for. Directories
+    // that overlap one of them are crawled as usual.
+    std::vector<w_string> prefixes;
+  };
+
+  // The depth below the root at which lazy_crawl defers crawls, or 0 if it
+  // is not enabled.
+  size_t lazyCrawlDepth_{0};
+  folly::Synchronized<LazyCrawl, std::mutex> lazyCrawl_;
+
+  // While the initial crawl runs with serve_crawled_subtrees, the dirs whose
+  // recursive crawl is queued or running. Subtrees that neither contain nor
+  // lie beneath one of them are complete. Empty before and after the crawl.
+  struct CrawlProgress {
+    bool tracking{false};
+    std::set<w_string> outstanding;
+  };
+  folly::Synchronized<CrawlProgress, std::mutex> crawlProgress_;
 };
 
 } // namespace watchman
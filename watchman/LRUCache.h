@@ -7,13 +7,18 @@
 
 #pragma once
 #include <fmt/core.h>
+#include <folly/SharedMutex.h>
 #include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
+#include <folly/hash/Hash.h>
+#include <algorithm>
 #include <chrono>
 #include <deque>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 #include "watchman/WatchmanConfig.h"
+#include "watchman/telemetry/InstrumentedMutex.h"
 
 namespace watchman {
 
@@ -50,6 +55,10 @@ namespace watchman {
  * and its nodes.  Because the cache is LRU it needs to touch
  * a node as part of a lookup to ensure that it will not
  * be evicted prematurely.
+ *
+ * ShardedLRUCache, at the bottom of this file, splits the
+ * keyspace across several independently locked LRUCache
+ * instances for caches that see many concurrent lookups.
  */
 
 template <typename KeyType, typename ValueType>
@@ -267,7 +276,13 @@ class LRUCache {
 
  private:
   using State = lrucache::InternalState<KeyType, ValueType>;
-  using LockedState = typename folly::Synchronized<State>::LockedPtr;
+  using SynchronizedState = folly::Synchronized<
+      State,
+      InstrumentedSharedMutex<
+          folly::SharedMutex,
+          &LockStats::lruCacheWait,
+          &LockStats::lruCacheHold>>;
+  using LockedState = typename SynchronizedState::LockedPtr;
 
  public:
   // Construct a cache with a defined limit and the specified
@@ -657,6 +672,134 @@ class LRUCache {
   // How long to cache items that have an error Result
   const std::chrono::milliseconds errorTTL_;
   const std::chrono::milliseconds fetchTimeout_;
-  folly::Synchronized<State> state_;
+  SynchronizedState state_;
+};
+
+/**
+ * ShardedLRUCache offers the same interface as LRUCache but
+ * partitions keys across a number of LRUCache shards, each with
+ * its own lock, so that concurrent lookups of different keys
+ * rarely contend with each other.
+ *
+ * Eviction, thundering herd protection and errorTTL handling are
+ * those of LRUCache, applied per shard: each shard holds an equal
+ * share of maxItems and evicts its own least recently used item,
+ * so the overall policy approximates, rather than exactly matches,
+ * a single LRU order.  Small caches use fewer shards so that each
+ * shard still holds a useful number of items.
+ */
+template <typename KeyType, typename ValueType>
+class ShardedLRUCache {
+ public:
+  using Shard = LRUCache<KeyType, ValueType>;
+  using NodeType = typename Shard::NodeType;
+
+  static constexpr size_t kDefaultNumShards = 16;
+  // Don't split the cache into shards smaller than this
+  static constexpr size_t kMinItemsPerShard = 64;
+
+  ShardedLRUCache(
+      size_t maxItems,
+      std::chrono::milliseconds errorTTL,
+      std::chrono::milliseconds fetchTimeout = std::chrono::seconds(300),
+      size_t numShards = kDefaultNumShards) {
+    numShards =
+        std::max(size_t(1), std::min(numShards, maxItems / kMinItemsPerShard));
+    auto itemsPerShard = (maxItems + numShards - 1) / numShards;
+    shards_.reserve(numShards);
+    for (size_t i = 0; i < numShards; ++i) {
+      shards_.emplace_back(
+          std::make_unique<Shard>(itemsPerShard, errorTTL, fetchTimeout));
+    }
+  }
+
+  // No moving or copying
+  ShardedLRUCache(const ShardedLRUCache&) = delete;
+  ShardedLRUCache& operator=(const ShardedLRUCache&) = delete;
+  ShardedLRUCache(ShardedLRUCache&&) = delete;
+  ShardedLRUCache& operator=(ShardedLRUCache&&) = delete;
+
+  // See LRUCache::get()
+  std::shared_ptr<const NodeType> get(
+      const KeyType& key,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    return shardFor(key).get(key, now);
+  }
+
+  // See LRUCache::get() for the getter variant
+  template <typename Func>
+  folly::Future<std::shared_ptr<const NodeType>> get(
+      const KeyType& key,
+      Func&& getter,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    return shardFor(key).get(key, std::forward<Func>(getter), now);
+  }
+
+  // See LRUCache::set()
+  std::shared_ptr<const NodeType> set(
+      const KeyType& key,
+      ValueType&& value,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    return shardFor(key).set(key, std::move(value), now);
+  }
+
+  // See LRUCache::erase()
+  std::shared_ptr<const NodeType> erase(const KeyType& key) {
+    return shardFor(key).erase(key);
+  }
+
+  // Returns the number of cached items across all shards
+  size_t size() const {
+    size_t total = 0;
+    for (auto& shard : shards_) {
+      total += shard->size();
+    }
+    return total;
+  }
+
+  // Returns cache statistics summed across all shards
+  CacheStats stats() const {
+    lrucache::Stats total;
+    size_t size = 0;
+    for (auto& shard : shards_) {
+      auto s = shard->stats();
+      total.cacheHit += s.cacheHit;
+      total.cacheShare += s.cacheShare;
+      total.cacheMiss += s.cacheMiss;
+      total.cacheEvict += s.cacheEvict;
+      total.cacheStore += s.cacheStore;
+      total.cacheLoad += s.cacheLoad;
+      total.cacheErase += s.cacheErase;
+      // Every shard is cleared together
+      total.clearCount = std::max(total.clearCount, s.clearCount);
+      size += s.size;
+    }
+    return CacheStats(total, size);
+  }
+
+  // Purge all of the entries from every shard
+  void clear() {
+    for (auto& shard : shards_) {
+      shard->clear();
+    }
+  }
+
+  // Returns the number of shards in use
+  size_t numShards() const {
+    return shards_.size();
+  }
+
+ private:
+  Shard& shardFor(const KeyType& key) const {
+    // Mix the hash so that the shard choice doesn't correlate with the
+    // bucket choice made by the shard's own map.
+    auto hash = folly::hash::twang_mix64(std::hash<KeyType>()(key));
+    return *shards_[hash % shards_.size()];
+  }
+
+  std::vector<std::unique_ptr<Shard>> shards_;
 };
 } // namespace watchman
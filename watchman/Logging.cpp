@@ -7,6 +7,7 @@
 
 #include "watchman/Logging.h"
 
+#include <folly/ProducerConsumerQueue.h>
 #include <folly/ScopeGuard.h>
 #include <folly/ThreadLocal.h>
 #include <folly/experimental/symbolizer/Symbolizer.h>
@@ -16,10 +17,14 @@
 #include "watchman/portability/Backtrace.h"
 
 #include <fmt/core.h>
+#include <algorithm>
 #include <array>
+#include <condition_variable>
 #include <limits>
+#include <mutex>
 #include <optional>
 #include <sstream>
+#include <thread>
 
 #ifdef __APPLE__
 #include <pthread.h>
@@ -28,6 +33,8 @@
 using namespace watchman;
 
 static folly::ThreadLocal<std::optional<std::string>> threadName;
+// A copy of the name that a signal handler can read without allocating
+static thread_local char signalSafeThreadName[64];
 
 namespace {
 template <typename String>
@@ -97,12 +104,189 @@ LogLevel logLabelToLevel(const w_string& label) {
   return getLevelMaps().labelToLevel.at(label);
 }
 
+namespace {
+struct AsyncRecord {
+  // Orders records from different threads
+  uint64_t seq;
+  LogLevel level;
+  w_string line;
+};
+
+// Written only by its thread, read only by the drain thread.
+struct ThreadLogBuffer {
+  explicit ThreadLogBuffer(size_t capacity) : queue(capacity) {}
+
+  folly::ProducerConsumerQueue<AsyncRecord> queue;
+  // Set when the owning thread exits, so the drain thread can forget the
+  // buffer once it is empty.
+  std::atomic<bool> orphaned{false};
+};
+} // namespace
+
+struct Log::AsyncState {
+  size_t capacity;
+  std::atomic<uint64_t> nextSeq{0};
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool stopping{false};
+  std::vector<std::shared_ptr<ThreadLogBuffer>> buffers;
+
+  std::thread drainer;
+};
+
+namespace {
+// The calling thread's ring, registered with the drain thread on first use.
+struct ThreadLogBufferHolder {
+  std::shared_ptr<ThreadLogBuffer> buffer;
+  // The AsyncState that `buffer` is registered with
+  const void* owner{nullptr};
+
+  ~ThreadLogBufferHolder() {
+    if (buffer) {
+      buffer->orphaned.store(true, std::memory_order_release);
+    }
+  }
+};
+thread_local ThreadLogBufferHolder threadLogBuffer;
+} // namespace
+
+// A client that stops reading its log subscription loses the oldest
+// messages rather than letting them pile up in memory.
+constexpr size_t kMaxUnreadLogItems = 10000;
+
 Log::Log()
-    : errorPub_(std::make_shared<Publisher>()),
-      debugPub_(std::make_shared<Publisher>()) {
+    : errorPub_(std::make_shared<Publisher>(
+          kMaxUnreadLogItems,
+          Publisher::OverflowPolicy::Drop)),
+      debugPub_(std::make_shared<Publisher>(
+          kMaxUnreadLogItems,
+          Publisher::OverflowPolicy::Drop)) {
   setStdErrLoggingLevel(ERR);
 }
 
+Log::~Log() {
+  stopAsync();
+}
+
+void Log::startAsync(size_t perThreadCapacity) {
+  if (async_) {
+    return;
+  }
+  async_ = std::make_unique<AsyncState>();
+  // ProducerConsumerQueue holds one fewer than its size
+  async_->capacity = std::max<size_t>(perThreadCapacity, 1) + 1;
+  async_->drainer = std::thread([this] {
+    w_set_thread_name("logdrain");
+    drainAsync();
+  });
+  asyncEnabled_.store(true, std::memory_order_release);
+}
+
+void Log::stopAsync() {
+  if (!async_) {
+    return;
+  }
+  asyncEnabled_.store(false, std::memory_order_release);
+  {
+    std::lock_guard<std::mutex> lock(async_->mutex);
+    async_->stopping = true;
+  }
+  async_->cond.notify_one();
+  async_->drainer.join();
+  // async_ is kept: a thread may still be between checking asyncEnabled_
+  // and pushing to its ring. Anything queued now is published by the next
+  // FATAL or lost at exit.
+}
+
+void Log::publish(LogLevel level, w_string line) {
+  if (level > OFF && asyncEnabled_.load(std::memory_order_acquire)) {
+    auto& holder = threadLogBuffer;
+    if (holder.owner != async_.get()) {
+      holder.buffer = std::make_shared<ThreadLogBuffer>(async_->capacity);
+      holder.owner = async_.get();
+      std::lock_guard<std::mutex> lock(async_->mutex);
+      async_->buffers.push_back(holder.buffer);
+    }
+    auto seq = async_->nextSeq.fetch_add(1, std::memory_order_relaxed);
+    if (holder.buffer->queue.write(AsyncRecord{seq, level, line})) {
+      return;
+    }
+    // Full: log it ourselves rather than wait or drop it
+  } else if (level <= FATAL && async_) {
+    // Let the messages that led up to this one out first
+    std::unique_lock<std::mutex> lock(async_->mutex);
+    if (!async_->stopping) {
+      async_->cond.notify_all();
+      async_->cond.wait_for(lock, std::chrono::seconds(1), [this] {
+        for (auto& buffer : async_->buffers) {
+          if (!buffer->queue.isEmpty()) {
+            return false;
+          }
+        }
+        return true;
+      });
+    }
+  }
+  publishNow(level, std::move(line));
+}
+
+void Log::publishNow(LogLevel level, w_string line) {
+  auto payload = json_object(
+      {{"log", typed_string_to_json(line)},
+       {"unilateral", json_true()},
+       {"level", typed_string_to_json(logLevelToLabel(level))}});
+
+  levelToPub(level).enqueue(std::move(payload));
+}
+
+void Log::drainAsync() {
+  std::vector<AsyncRecord> records;
+  std::unique_lock<std::mutex> lock(async_->mutex);
+  while (true) {
+    bool stopping = async_->stopping;
+
+    auto& buffers = async_->buffers;
+    for (auto& buffer : buffers) {
+      AsyncRecord record;
+      while (buffer->queue.read(record)) {
+        records.push_back(std::move(record));
+      }
+    }
+    buffers.erase(
+        std::remove_if(
+            buffers.begin(),
+            buffers.end(),
+            [](const std::shared_ptr<ThreadLogBuffer>& buffer) {
+              return buffer->orphaned.load(std::memory_order_acquire) &&
+                  buffer->queue.isEmpty();
+            }),
+        buffers.end());
+
+    if (!records.empty()) {
+      lock.unlock();
+      std::sort(
+          records.begin(),
+          records.end(),
+          [](const AsyncRecord& a, const AsyncRecord& b) {
+            return a.seq < b.seq;
+          });
+      for (auto& record : records) {
+        publishNow(record.level, std::move(record.line));
+      }
+      records.clear();
+      lock.lock();
+      // Wake anyone waiting in publish for the rings to empty
+      async_->cond.notify_all();
+    }
+
+    if (stopping) {
+      return;
+    }
+    async_->cond.wait_for(lock, std::chrono::milliseconds(5));
+  }
+}
+
 Log& getLog() {
   static Log log;
   return log;
@@ -143,10 +327,18 @@ const char* Log::setThreadName(std::string&& name) {
     folly::setThreadName(name);
   }
 
+  auto len = std::min(name.size(), sizeof(signalSafeThreadName) - 1);
+  memcpy(signalSafeThreadName, name.data(), len);
+  signalSafeThreadName[len] = '\0';
+
   threadName->emplace(name);
   return threadName->value().c_str();
 }
 
+const char* Log::getThreadNameSignalSafe() {
+  return signalSafeThreadName;
+}
+
 const char* Log::getThreadName() {
   if (!threadName->has_value()) {
     auto name = folly::getCurrentThreadName();
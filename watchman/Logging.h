@@ -10,6 +10,8 @@
 #include <fmt/ranges.h>
 #include <folly/Synchronized.h>
 #include <folly/portability/Windows.h> // For timeval. Replace this.
+#include <atomic>
+#include <memory>
 
 #include "watchman/PubSub.h"
 #include "watchman/watchman_preprocessor.h"
@@ -34,42 +36,48 @@ class Log {
   static char* timeString(char* buf, size_t bufsize, timeval tv);
   static const char* getThreadName();
   static const char* setThreadName(std::string&& name);
+  // The name last given to the calling thread by setThreadName, truncated
+  // to 63 bytes, or an empty string.  Safe to call from a signal handler.
+  static const char* getThreadNameSignalSafe();
 
   void setStdErrLoggingLevel(LogLevel level);
 
+  // Hand formatted messages to a background thread that publishes them and
+  // writes them to stderr, instead of doing so on the logging thread.
+  // Each thread queues its messages in its own lock-free ring of
+  // `perThreadCapacity` entries; a thread whose ring is full logs
+  // synchronously until the drain thread catches up. FATAL and ABORT
+  // messages are always logged synchronously, after the queued messages.
+  void startAsync(size_t perThreadCapacity);
+
+  // Publish everything queued and go back to logging synchronously.
+  void stopAsync();
+
   // Build a string and log it
   template <typename... Args>
   void log(LogLevel level, Args&&... args) {
-    auto& pub = levelToPub(level);
-
     // Avoid building the string if there are no subscribers
-    if (!pub.hasSubscribers()) {
+    if (!levelToPub(level).hasSubscribers()) {
       return;
     }
 
     char timebuf[64];
 
-    auto payload = json_object(
-        {{"log",
-          typed_string_to_json(w_string::build(
-              currentTimeString(timebuf, sizeof(timebuf)),
-              ": [",
-              getThreadName(),
-              "] ",
-              std::forward<Args>(args)...))},
-         {"unilateral", json_true()},
-         {"level", typed_string_to_json(logLevelToLabel(level))}});
-
-    pub.enqueue(std::move(payload));
+    publish(
+        level,
+        w_string::build(
+            currentTimeString(timebuf, sizeof(timebuf)),
+            ": [",
+            getThreadName(),
+            "] ",
+            std::forward<Args>(args)...));
   }
 
   // Format a string and log it
   template <typename... Args>
   void logf(LogLevel level, fmt::string_view format_str, Args&&... args) {
-    auto& pub = levelToPub(level);
-
     // Avoid building the string if there are no subscribers
-    if (!pub.hasSubscribers()) {
+    if (!levelToPub(level).hasSubscribers()) {
       return;
     }
 
@@ -77,21 +85,18 @@ class Log {
 
     auto message =
         fmt::format(fmt::runtime(format_str), std::forward<Args>(args)...);
-    auto payload = json_object(
-        {{"log",
-          typed_string_to_json(w_string::build(
-              currentTimeString(timebuf, sizeof(timebuf)),
-              ": [",
-              getThreadName(),
-              "] ",
-              std::move(message)))},
-         {"unilateral", json_true()},
-         {"level", typed_string_to_json(logLevelToLabel(level))}});
-
-    pub.enqueue(std::move(payload));
+    publish(
+        level,
+        w_string::build(
+            currentTimeString(timebuf, sizeof(timebuf)),
+            ": [",
+            getThreadName(),
+            "] ",
+            std::move(message)));
   }
 
   Log();
+  ~Log();
 
  private:
   std::shared_ptr<Publisher> errorPub_;
@@ -110,10 +115,19 @@ class Log {
   //    writing to stderr.
   folly::Synchronized<Subscribers, std::mutex> subscribers_;
 
+  struct AsyncState;
+  std::unique_ptr<AsyncState> async_;
+  std::atomic<bool> asyncEnabled_{false};
+
   inline Publisher& levelToPub(LogLevel level) {
     return level == DBG ? *debugPub_ : *errorPub_;
   }
 
+  // Queue `line` for the drain thread, or publish it now.
+  void publish(LogLevel level, w_string line);
+  void publishNow(LogLevel level, w_string line);
+  void drainAsync();
+
   void doLogToStdErr();
 };
 
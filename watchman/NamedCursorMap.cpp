@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/NamedCursorMap.h"
+
+namespace watchman {
+
+std::optional<ClockTicks> NamedCursorMap::exchange(
+    const w_string& name,
+    ClockTicks ticks) {
+  auto it = cursors_.find(name);
+  if (it == cursors_.cend()) {
+    auto [inserted, isNew] = cursors_.try_emplace(
+        name, std::make_unique<std::atomic<ClockTicks>>(ticks));
+    if (isNew) {
+      return std::nullopt;
+    }
+    // Another query created the cursor first
+    it = std::move(inserted);
+  }
+  return it->second->exchange(ticks, std::memory_order_acq_rel);
+}
+
+void NamedCursorMap::eraseBefore(ClockTicks ticks) {
+  std::vector<w_string> stale;
+  for (const auto& [name, cursorTicks] : cursors_) {
+    if (cursorTicks->load(std::memory_order_acquire) < ticks) {
+      stale.push_back(name);
+    }
+  }
+  for (const auto& name : stale) {
+    cursors_.erase(name);
+  }
+}
+
+std::vector<std::pair<w_string, ClockTicks>> NamedCursorMap::snapshot() const {
+  std::vector<std::pair<w_string, ClockTicks>> cursors;
+  for (const auto& [name, ticks] : cursors_) {
+    cursors.emplace_back(name, ticks->load(std::memory_order_acquire));
+  }
+  return cursors;
+}
+
+} // namespace watchman
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/concurrency/ConcurrentHashMap.h>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "watchman/Clock.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * The tick that each named cursor of a root was last evaluated at.
+ *
+ * Every query that uses a named cursor reads it and moves it to the current
+ * tick, so the map is built to take many of those at once: looking up a
+ * cursor takes no lock, and moving an existing cursor is a single atomic
+ * exchange on its tick.  Only the first use of a cursor inserts into the
+ * map.
+ */
+class NamedCursorMap {
+ public:
+  /**
+   * Moves the cursor `name` to `ticks`, and returns the ticks it was at
+   * before, or nullopt if this is the first time it is used.
+   */
+  std::optional<ClockTicks> exchange(const w_string& name, ClockTicks ticks);
+
+  /**
+   * Forgets the cursors that are at ticks before `ticks`.  A cursor that is
+   * moved while this runs may be forgotten too; its next use then reports a
+   * fresh instance, as it would had it aged out.
+   */
+  void eraseBefore(ClockTicks ticks);
+
+  std::vector<std::pair<w_string, ClockTicks>> snapshot() const;
+
+ private:
+  folly::ConcurrentHashMap<w_string, std::unique_ptr<std::atomic<ClockTicks>>>
+      cursors_;
+};
+
+} // namespace watchman
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <unordered_map>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Remembers, for a short while, the paths that the IO thread found to be
+ * missing, so that the notifications trailing behind the removal of a
+ * temporary file do not each cost another stat.
+ *
+ * A path is only reported as missing for a change that was noticed no later
+ * than when the path was found to be missing: the stat already reflects such
+ * a change, while anything noticed after it may have recreated the path.
+ *
+ * Only accessed by the IO thread.
+ */
+class NegativeStatCache {
+ public:
+  using time_point = std::chrono::system_clock::time_point;
+
+  static constexpr size_t kDefaultMaxEntries = 4096;
+
+  explicit NegativeStatCache(
+      std::chrono::milliseconds ttl,
+      size_t maxEntries = kDefaultMaxEntries)
+      : ttl_{ttl}, maxEntries_{maxEntries} {}
+
+  bool enabled() const {
+    return ttl_.count() > 0 && maxEntries_ > 0;
+  }
+
+  /**
+   * Records that `path` did not exist as of `checkedAt`, which must be no
+   * later than when its stat was issued.
+   */
+  void insert(const w_string& path, time_point checkedAt) {
+    if (!enabled()) {
+      return;
+    }
+    if (entries_.size() >= maxEntries_ && !entries_.count(path)) {
+      pruneExpired(checkedAt);
+      if (entries_.size() >= maxEntries_) {
+        entries_.clear();
+      }
+    }
+    entries_[path] = checkedAt;
+  }
+
+  /**
+   * Must be called whenever the path is seen to exist.
+   */
+  void erase(const w_string& path) {
+    entries_.erase(path);
+  }
+
+  /**
+   * Returns true if `path` is known to be missing after the latest change to
+   * it, which was noticed at `changeNoticed`.
+   */
+  bool isMissing(const w_string& path, time_point changeNoticed, time_point now)
+      const {
+    auto it = entries_.find(path);
+    // Distrust the entry if the clock went backwards since
+    return it != entries_.end() && changeNoticed <= it->second &&
+        now >= it->second && now - it->second <= ttl_;
+  }
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+ private:
+  void pruneExpired(time_point now) {
+    for (auto it = entries_.begin(); it != entries_.end();) {
+      if (now - it->second > ttl_) {
+        it = entries_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  const std::chrono::milliseconds ttl_;
+  const size_t maxEntries_;
+  std::unordered_map<w_string, time_point> entries_;
+};
+
+} // namespace watchman
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/NodeArena.h"
+#include <folly/Memory.h>
+#include <algorithm>
+#include <new>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace watchman {
+
+/**
+ * Each slab lives at a kSlabSize aligned address and starts with this header,
+ * which allows deallocate() to find the owning slab by masking the pointer.
+ * The remainder of the slab is carved into blocks of a single size.
+ */
+struct NodeArena::Slab {
+  Slab* prev;
+  Slab* next;
+  // Singly linked list of freed blocks, threaded through the blocks.
+  void* freeList;
+  // Next block that has never been handed out.
+  char* bump;
+  uint32_t blockSize;
+  uint32_t live;
+  uint16_t index;
+  bool isFull;
+
+  char* end() {
+    return reinterpret_cast<char*>(this) + kSlabSize;
+  }
+
+  bool exhausted() {
+    return freeList == nullptr && bump + blockSize > end();
+  }
+};
+
+namespace {
+constexpr size_t kSlabHeaderSize = 64;
+
+template <typename T>
+void linkSlab(T*& head, T* slab) {
+  slab->prev = nullptr;
+  slab->next = head;
+  if (head) {
+    head->prev = slab;
+  }
+  head = slab;
+}
+
+template <typename T>
+void unlinkSlab(T*& head, T* slab) {
+  if (slab->prev) {
+    slab->prev->next = slab->next;
+  } else {
+    head = slab->next;
+  }
+  if (slab->next) {
+    slab->next->prev = slab->prev;
+  }
+  slab->prev = nullptr;
+  slab->next = nullptr;
+}
+
+/**
+ * Maps a kChunkSize aligned chunk and asks for it to be backed by huge
+ * pages.  Returns nullptr if that isn't possible.
+ */
+void* mapHugePageChunk() {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  constexpr size_t kChunkSize = NodeArena::kChunkSize;
+  // Over-allocate so that an aligned chunk fits, then trim the excess
+  void* mem = mmap(
+      nullptr,
+      2 * kChunkSize,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS,
+      -1,
+      0);
+  if (mem == MAP_FAILED) {
+    return nullptr;
+  }
+  auto start = reinterpret_cast<uintptr_t>(mem);
+  auto aligned = (start + kChunkSize - 1) & ~uintptr_t(kChunkSize - 1);
+  if (aligned > start) {
+    munmap(mem, aligned - start);
+  }
+  if (auto tail = start + 2 * kChunkSize - (aligned + kChunkSize)) {
+    munmap(reinterpret_cast<void*>(aligned + kChunkSize), tail);
+  }
+  auto* chunk = reinterpret_cast<void*>(aligned);
+  if (madvise(chunk, kChunkSize, MADV_HUGEPAGE) != 0) {
+    munmap(chunk, kChunkSize);
+    return nullptr;
+  }
+  return chunk;
+#else
+  return nullptr;
+#endif
+}
+
+void unmapHugePageChunk(void* chunk) {
+#ifdef __linux__
+  munmap(chunk, NodeArena::kChunkSize);
+#else
+  (void)chunk;
+#endif
+}
+} // namespace
+
+NodeArena::~NodeArena() {
+  for (auto& list : classes_) {
+    for (auto* head : {list.available, list.full}) {
+      while (head) {
+        auto* next = head->next;
+        freeSlabMemory(head);
+        head = next;
+      }
+    }
+  }
+}
+
+NodeArena::Slab* NodeArena::newSlab(size_t index) {
+  static_assert(sizeof(Slab) <= kSlabHeaderSize, "slab header too large");
+  static_assert(
+      (kSlabSize & (kSlabSize - 1)) == 0, "kSlabSize must be a power of 2");
+
+  void* mem = allocateSlabMemory();
+
+  auto* slab = static_cast<Slab*>(mem);
+  slab->prev = nullptr;
+  slab->next = nullptr;
+  slab->freeList = nullptr;
+  slab->bump = static_cast<char*>(mem) + kSlabHeaderSize;
+  slab->blockSize = uint32_t((index + 1) * kGranularity);
+  slab->live = 0;
+  slab->index = uint16_t(index);
+  slab->isFull = false;
+
+  linkSlab(classes_[index].available, slab);
+  ++stats_.slabs;
+  return slab;
+}
+
+void NodeArena::releaseSlab(Slab* slab) {
+  unlinkSlab(classes_[slab->index].available, slab);
+  freeSlabMemory(slab);
+  --stats_.slabs;
+}
+
+void* NodeArena::allocateSlabMemory() {
+  static_assert(kChunkSize % kSlabSize == 0, "chunks must hold whole slabs");
+
+  if (hugePages_ && freeChunkSlabs_.empty()) {
+    if (auto* chunk = static_cast<char*>(mapHugePageChunk())) {
+      // Hand out the slabs from the start of the chunk first
+      for (size_t offset = kChunkSize; offset > 0; offset -= kSlabSize) {
+        freeChunkSlabs_.push_back(chunk + offset - kSlabSize);
+      }
+      chunkSlabsInUse_[reinterpret_cast<uintptr_t>(chunk)] = 0;
+      ++stats_.chunks;
+    }
+  }
+
+  if (!freeChunkSlabs_.empty()) {
+    void* mem = freeChunkSlabs_.back();
+    freeChunkSlabs_.pop_back();
+    ++chunkSlabsInUse_[reinterpret_cast<uintptr_t>(mem) &
+                       ~uintptr_t(kChunkSize - 1)];
+    return mem;
+  }
+
+  void* mem = folly::aligned_malloc(kSlabSize, kSlabSize);
+  if (!mem) {
+    throw std::bad_alloc();
+  }
+  return mem;
+}
+
+void NodeArena::freeSlabMemory(void* mem) {
+  auto chunk = reinterpret_cast<uintptr_t>(mem) & ~uintptr_t(kChunkSize - 1);
+  auto it = chunkSlabsInUse_.find(chunk);
+  if (it == chunkSlabsInUse_.end()) {
+    folly::aligned_free(mem);
+    return;
+  }
+
+  if (--it->second > 0) {
+    freeChunkSlabs_.push_back(mem);
+    return;
+  }
+
+  chunkSlabsInUse_.erase(it);
+  freeChunkSlabs_.erase(
+      std::remove_if(
+          freeChunkSlabs_.begin(),
+          freeChunkSlabs_.end(),
+          [&](void* slab) {
+            return (reinterpret_cast<uintptr_t>(slab) &
+                    ~uintptr_t(kChunkSize - 1)) == chunk;
+          }),
+      freeChunkSlabs_.end());
+  unmapHugePageChunk(reinterpret_cast<void*>(chunk));
+  --stats_.chunks;
+}
+
+void* NodeArena::allocate(size_t size) {
+  size = std::max(size, sizeof(void*));
+  stats_.allocatedBytes += size;
+
+  if (size > kMaxSlabAllocation) {
+    ++stats_.largeAllocations;
+    return ::operator new(size);
+  }
+
+  auto index = classIndex(size);
+  auto& list = classes_[index];
+  Slab* slab = list.available ? list.available : newSlab(index);
+
+  void* block;
+  if (slab->freeList) {
+    block = slab->freeList;
+    slab->freeList = *static_cast<void**>(block);
+  } else {
+    block = slab->bump;
+    slab->bump += slab->blockSize;
+  }
+  ++slab->live;
+  ++stats_.slabAllocations;
+
+  if (slab->exhausted()) {
+    unlinkSlab(list.available, slab);
+    linkSlab(list.full, slab);
+    slab->isFull = true;
+  }
+
+  return block;
+}
+
+void NodeArena::deallocate(void* ptr, size_t size) noexcept {
+  if (!ptr) {
+    return;
+  }
+  size = std::max(size, sizeof(void*));
+  stats_.allocatedBytes -= size;
+
+  if (size > kMaxSlabAllocation) {
+    --stats_.largeAllocations;
+    ::operator delete(ptr);
+    return;
+  }
+
+  auto* slab = reinterpret_cast<Slab*>(
+      reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t(kSlabSize - 1));
+  auto& list = classes_[slab->index];
+
+  *static_cast<void**>(ptr) = slab->freeList;
+  slab->freeList = ptr;
+  --slab->live;
+  --stats_.slabAllocations;
+
+  if (slab->isFull) {
+    unlinkSlab(list.full, slab);
+    linkSlab(list.available, slab);
+    slab->isFull = false;
+  }
+
+  // Hand empty slabs back to the system, but keep the last one for this
+  // size class around so that a single create/delete cycle doesn't thrash.
+  if (slab->live == 0 && (slab->prev || slab->next)) {
+    releaseSlab(slab);
+  }
+}
+
+} // namespace watchman
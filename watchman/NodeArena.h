@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "watchman/PathComponentTable.h"
+
+namespace watchman {
+
+/**
+ * A size-class slab allocator for the watchman_file and watchman_dir nodes
+ * that make up a ViewDatabase.
+ *
+ * A full crawl of a large tree creates millions of small nodes whose sizes
+ * cluster around a handful of values (sizeof(watchman_file) plus a short
+ * inline name).  Rather than asking the system allocator for each of them,
+ * nodes are carved out of kSlabSize slabs, each of which serves a single size
+ * class.  Freed nodes are threaded onto their slab's free list and reused
+ * before any new memory is requested.  A slab that becomes entirely empty is
+ * returned to the system, so memory released by ageOut or by pruning a
+ * deleted subtree is actually given back rather than fragmenting the heap.
+ *
+ * Requests larger than kMaxSlabAllocation (eg: files with very long names)
+ * fall through to the system allocator.
+ *
+ * The arena also interns the names of the dir nodes it holds, as many of them
+ * share the same few names.
+ *
+ * An arena created with `hugePages` maps kChunkSize chunks and advises the
+ * kernel to back them with transparent huge pages, then carves its slabs out
+ * of those, so that walking a large view takes far fewer TLB misses.  A chunk
+ * is unmapped once none of its slabs are in use.  As the pages of a chunk
+ * are faulted in by the thread that first writes a node to it, normally the
+ * IO thread, the kernel's first-touch policy places them on that thread's
+ * NUMA node.  Where huge pages are unavailable, slabs are allocated as usual.
+ *
+ * NodeArena is not thread safe; the owning ViewDatabase is always accessed
+ * under its own lock.
+ */
+class NodeArena {
+ public:
+  static constexpr size_t kGranularity = 16;
+  static constexpr size_t kMaxSlabAllocation = 1024;
+  static constexpr size_t kSlabSize = 64 * 1024;
+  static constexpr size_t kChunkSize = 2 * 1024 * 1024;
+
+  struct Stats {
+    // Number of slabs currently held from the system allocator.
+    size_t slabs{0};
+    // Number of live allocations served from slabs.
+    size_t slabAllocations{0};
+    // Number of live allocations that were too large for a slab.
+    size_t largeAllocations{0};
+    // Bytes requested by live allocations (slab and large).
+    size_t allocatedBytes{0};
+    // Number of huge page chunks currently mapped.
+    size_t chunks{0};
+  };
+
+  explicit NodeArena(bool hugePages = false) : hugePages_{hugePages} {}
+  ~NodeArena();
+
+  NodeArena(const NodeArena&) = delete;
+  NodeArena(NodeArena&&) = delete;
+  NodeArena& operator=(const NodeArena&) = delete;
+  NodeArena& operator=(NodeArena&&) = delete;
+
+  /**
+   * Returns kGranularity-aligned storage for `size` bytes.
+   * The storage is uninitialized.
+   */
+  void* allocate(size_t size);
+
+  /**
+   * Returns storage obtained from allocate().  `size` must match the size
+   * that was passed to allocate().
+   */
+  void deallocate(void* ptr, size_t size) noexcept;
+
+  const Stats& getStats() const {
+    return stats_;
+  }
+
+  PathComponentTable& dirNames() {
+    return dirNames_;
+  }
+
+  const PathComponentTable& dirNames() const {
+    return dirNames_;
+  }
+
+ private:
+  struct Slab;
+
+  struct SlabList {
+    // Slabs that have at least one unused block.
+    Slab* available{nullptr};
+    // Slabs with no unused blocks.
+    Slab* full{nullptr};
+  };
+
+  static constexpr size_t kNumClasses = kMaxSlabAllocation / kGranularity;
+
+  static size_t classIndex(size_t size) {
+    return (size + kGranularity - 1) / kGranularity - 1;
+  }
+
+  Slab* newSlab(size_t index);
+  void releaseSlab(Slab* slab);
+  void* allocateSlabMemory();
+  void freeSlabMemory(void* mem);
+
+  const bool hugePages_;
+  std::array<SlabList, kNumClasses> classes_{};
+  Stats stats_;
+  PathComponentTable dirNames_;
+  // Slabs of mapped chunks that are not in use
+  std::vector<void*> freeChunkSlabs_;
+  // The number of slabs in use in each mapped chunk, by address
+  std::unordered_map<uintptr_t, size_t> chunkSlabsInUse_;
+};
+
+} // namespace watchman
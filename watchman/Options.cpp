@@ -37,6 +37,14 @@ const OptDesc opts[] = {
      &flags.inetd_style,
      NULL,
      IS_DAEMON},
+    {"takeover",
+     0,
+     "Start the service by taking over the listening socket of the running "
+     "service, which exits once it has saved its state",
+     OPT_NONE,
+     &flags.takeover,
+     NULL,
+     NOT_DAEMON},
 #endif
     {"no-site-spawner",
      'S',
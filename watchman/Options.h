@@ -17,6 +17,7 @@ struct Flags {
   int show_help = 0;
 #ifndef _WIN32
   int inetd_style = 0;
+  int takeover = 0;
 #endif
   int no_site_spawner = 0;
   int show_version = 0;
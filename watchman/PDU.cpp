@@ -7,11 +7,14 @@
 
 #include "watchman/PDU.h"
 #include <folly/Range.h>
+#include <folly/ScopeGuard.h>
 #include <folly/String.h>
 #include "watchman/Constants.h"
 #include "watchman/Logging.h"
+#include "watchman/Tracepoint.h"
 #include "watchman/bser.h"
 #include "watchman/portability/WinError.h"
+#include "watchman/telemetry/WatchmanStats.h"
 #include "watchman/watchman_stream.h"
 
 namespace watchman {
@@ -470,6 +473,32 @@ std::optional<json_ref> PduBuffer::decodePdu(
   }
 }
 
+bool PduBuffer::hasBufferedPdu() const {
+  const char* start = buf + rpos;
+  size_t avail = wpos - rpos;
+  if (avail < 2) {
+    return false;
+  }
+
+  size_t header = 2;
+  if (memcmp(start, BSER_V2_MAGIC, 2) == 0) {
+    header += sizeof(uint32_t);
+  } else if (memcmp(start, BSER_MAGIC, 2) != 0) {
+    // JSON PDUs end at a newline
+    return memchr(start, '\n', avail) != nullptr;
+  }
+  if (avail < header) {
+    return false;
+  }
+
+  size_t needed;
+  auto len = bunser_int(start + header, avail - header, &needed);
+  if (!len) {
+    return needed == kDecodeIntFailed;
+  }
+  return *len >= 0 && avail - header - needed >= uint64_t(*len);
+}
+
 std::optional<json_ref> PduBuffer::decodeNext(
     watchman_stream* stm,
     json_error_t* jerr) {
@@ -485,8 +514,15 @@ namespace {
 struct jbuffer_write_data {
   watchman_stream* stm;
   PduBuffer* jr;
+  std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+  // Time spent in flush(), to tell writing apart from encoding
+  std::chrono::steady_clock::duration writeTime{};
 
   bool flush() {
+    auto flushStart = std::chrono::steady_clock::now();
+    SCOPE_EXIT {
+      writeTime += std::chrono::steady_clock::now() - flushStart;
+    };
     while (jr->wpos - jr->rpos) {
       int x = stm->write(jr->buf + jr->rpos, jr->wpos - jr->rpos);
 
@@ -501,47 +537,69 @@ struct jbuffer_write_data {
     return true;
   }
 
+  // Writes out what is buffered followed by size bytes at buffer, which
+  // spares copying a large chunk through the buffer.
+  bool flushWith(const char* buffer, size_t size) {
+    auto flushStart = std::chrono::steady_clock::now();
+    SCOPE_EXIT {
+      writeTime += std::chrono::steady_clock::now() - flushStart;
+    };
+    StreamBuffer bufs[] = {
+        {jr->buf + jr->rpos, jr->wpos - jr->rpos}, {buffer, size}};
+    int first = 0;
+    while (first < 2) {
+      int x = stm->writev(bufs + first, 2 - first);
+      if (x <= 0) {
+        return false;
+      }
+      size_t left = x;
+      while (first < 2 && left >= bufs[first].size) {
+        left -= bufs[first].size;
+        ++first;
+      }
+      if (first < 2) {
+        bufs[first].data = static_cast<const char*>(bufs[first].data) + left;
+        bufs[first].size -= left;
+      }
+    }
+
+    jr->clear();
+    return true;
+  }
+
+  void recordStats() const {
+    auto stats = getWatchmanStats();
+    auto total = std::chrono::steady_clock::now() - start;
+    stats->addDuration(&PipelineStats::pduEncode, total - writeTime);
+    stats->addDuration(&PipelineStats::pduWrite, writeTime);
+  }
+
   static int write(const char* buffer, size_t size, void* ptr) {
     auto data = (jbuffer_write_data*)ptr;
     return data->write(buffer, size);
   }
 
   int write(const char* buffer, size_t size) {
-    while (size) {
-      // Accumulate in the buffer
-      int room = jr->allocd - jr->wpos;
-
-      // No room? send it over the wire
-      if (!room) {
-        if (!flush()) {
-          return -1;
-        }
-        room = jr->allocd - jr->wpos;
-      }
-
-      if ((int)size < room) {
-        room = (int)size;
-      }
-
-      // Stick it in the buffer
-      memcpy(jr->buf + jr->wpos, buffer, room);
-
-      buffer += room;
-      size -= room;
-      jr->wpos += room;
+    if (size > jr->allocd - jr->wpos) {
+      // Going out with what is already buffered saves copying it through
+      // the buffer in pieces
+      return flushWith(buffer, size) ? 0 : -1;
     }
 
+    memcpy(jr->buf + jr->wpos, buffer, size);
+    jr->wpos += size;
     return 0;
   }
 };
 
 } // namespace
 
-ResultErrno<folly::Unit> PduBuffer::bserEncodeToStream(
+ResultErrno<folly::Unit> PduBuffer::bserEncode(
     uint32_t bser_version,
     uint32_t bser_capabilities,
     const json_ref& json,
-    watchman_stream* stm) {
+    watchman_stream* stm,
+    bool flush) {
   jbuffer_write_data data = {stm, this};
 
   int res = w_bser_write_pdu(
@@ -551,17 +609,19 @@ ResultErrno<folly::Unit> PduBuffer::bserEncodeToStream(
     return errno;
   }
 
-  if (!data.flush()) {
+  if (flush && !data.flush()) {
     return errno;
   }
 
+  data.recordStats();
   return folly::unit;
 }
 
-ResultErrno<folly::Unit> PduBuffer::jsonEncodeToStream(
+ResultErrno<folly::Unit> PduBuffer::jsonEncode(
     const json_ref& json,
     watchman_stream* stm,
-    int flags) {
+    int flags,
+    bool flush) {
   jbuffer_write_data data = {stm, this};
 
   int res = json_dump_callback(json, jbuffer_write_data::write, &data, flags);
@@ -573,32 +633,78 @@ ResultErrno<folly::Unit> PduBuffer::jsonEncodeToStream(
     return errno;
   }
 
-  if (!data.flush()) {
+  if (flush && !data.flush()) {
     return errno;
   }
 
+  data.recordStats();
   return folly::unit;
 }
 
-ResultErrno<folly::Unit> PduBuffer::pduEncodeToStream(
+ResultErrno<folly::Unit> PduBuffer::pduEncode(
     PduFormat format_2,
     const json_ref& json,
-    watchman_stream* stm) {
+    watchman_stream* stm,
+    bool flush) {
+  WATCHMAN_TRACE(pdu__encode__start, uintptr_t(stm), int(format_2.type));
+  SCOPE_EXIT {
+    WATCHMAN_TRACE(pdu__encode__end, uintptr_t(stm), wpos);
+  };
   switch (format_2.type) {
     case is_json_compact:
-      return jsonEncodeToStream(json, stm, JSON_COMPACT);
+      return jsonEncode(json, stm, JSON_COMPACT, flush);
     case is_json_pretty:
-      return jsonEncodeToStream(json, stm, JSON_INDENT(4));
+      return jsonEncode(json, stm, JSON_INDENT(4), flush);
     case is_bser:
-      return bserEncodeToStream(1, format_2.capabilities, json, stm);
+      return bserEncode(1, format_2.capabilities, json, stm, flush);
     case is_bser_v2:
-      return bserEncodeToStream(2, format_2.capabilities, json, stm);
+      return bserEncode(2, format_2.capabilities, json, stm, flush);
     case need_data:
     default:
       return EINVAL;
   }
 }
 
+ResultErrno<folly::Unit> PduBuffer::bserEncodeToStream(
+    uint32_t bser_version,
+    uint32_t bser_capabilities,
+    const json_ref& json,
+    watchman_stream* stm) {
+  return bserEncode(bser_version, bser_capabilities, json, stm, true);
+}
+
+ResultErrno<folly::Unit> PduBuffer::jsonEncodeToStream(
+    const json_ref& json,
+    watchman_stream* stm,
+    int flags) {
+  return jsonEncode(json, stm, flags, true);
+}
+
+ResultErrno<folly::Unit> PduBuffer::pduEncodeToStream(
+    PduFormat format_2,
+    const json_ref& json,
+    watchman_stream* stm) {
+  return pduEncode(format_2, json, stm, true);
+}
+
+ResultErrno<folly::Unit> PduBuffer::pduEncodeBuffered(
+    PduFormat format_2,
+    const json_ref& json,
+    watchman_stream* stm) {
+  return pduEncode(format_2, json, stm, false);
+}
+
+ResultErrno<folly::Unit> PduBuffer::flushToStream(watchman_stream* stm) {
+  auto start = std::chrono::steady_clock::now();
+  jbuffer_write_data data = {stm, this};
+  if (!data.flush()) {
+    return errno;
+  }
+  getWatchmanStats()->addDuration(
+      &PipelineStats::pduWrite, std::chrono::steady_clock::now() - start);
+  return folly::unit;
+}
+
 /* vim:ts=2:sw=2:et:
  */
 
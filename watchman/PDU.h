@@ -68,13 +68,44 @@ class PduBuffer {
   ResultErrno<folly::Unit>
   pduEncodeToStream(PduFormat format, const json_ref& json, Stream* stm);
 
+  /**
+   * Like pduEncodeToStream, but whatever fits in the buffer stays there
+   * until a later flushToStream, so that several small PDUs reach the
+   * stream in one write.
+   */
+  ResultErrno<folly::Unit>
+  pduEncodeBuffered(PduFormat format, const json_ref& json, Stream* stm);
+
+  /// Writes out what pduEncodeBuffered left in the buffer
+  ResultErrno<folly::Unit> flushToStream(Stream* stm);
+
   std::optional<json_ref> decodeNext(Stream* stm, json_error_t* jerr);
 
+  /**
+   * Whether a whole PDU is already in the buffer, so that decodeNext can
+   * decode it without reading from the stream.  Also true if the buffered
+   * data is malformed, so that decodeNext reports it.
+   */
+  bool hasBufferedPdu() const;
+
   bool readAndDetectPdu(Stream* stm, json_error_t* jerr);
   std::optional<json_ref> decodePdu(Stream* stm, json_error_t* jerr);
   bool streamPdu(Stream* stm, json_error_t* jerr);
 
  private:
+  ResultErrno<folly::Unit> bserEncode(
+      uint32_t bser_version,
+      uint32_t bser_capabilities,
+      const json_ref& json,
+      Stream* stm,
+      bool flush);
+  ResultErrno<folly::Unit>
+  jsonEncode(const json_ref& json, Stream* stm, int flags, bool flush);
+  ResultErrno<folly::Unit> pduEncode(
+      PduFormat format,
+      const json_ref& json,
+      Stream* stm,
+      bool flush);
   uint32_t shuntDown();
   bool fillBuffer(Stream* stm);
   PduType detectPdu();
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/small_vector.h>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Assembles a path in an inline buffer, only using the heap for unusually
+ * long paths.
+ *
+ * Every w_string is heap allocated and atomically reference counted so that
+ * it can be shared between threads.  Many paths are only looked at for the
+ * duration of a single call: matched against a relative_root, logged, or
+ * handed to code that copies what it keeps.  Build those here and use
+ * piece(); asWString() makes a w_string for the rare cases where the path
+ * must outlive the builder.
+ *
+ * A PathBuilder is confined to the thread using it, and its pieces are
+ * invalidated by any subsequent modification.
+ */
+class PathBuilder {
+ public:
+  // Long enough for the vast majority of absolute paths in a repository.
+  static constexpr size_t kInlineSize = 256;
+
+  PathBuilder() = default;
+
+  PathBuilder(const PathBuilder&) = delete;
+  PathBuilder& operator=(const PathBuilder&) = delete;
+
+  void clear() {
+    buf_.clear();
+  }
+
+  size_t size() const {
+    return buf_.size();
+  }
+
+  /**
+   * Shortens the path to its first `size` bytes.
+   */
+  void truncate(size_t size) {
+    buf_.resize(size);
+  }
+
+  /**
+   * Appends bytes to the path as-is.
+   */
+  void append(w_string_piece str) {
+    buf_.insert(buf_.end(), str.data(), str.data() + str.size());
+  }
+
+  /**
+   * Appends a path component, preceded by a separator unless the path is
+   * currently empty.  Empty components are skipped, like w_string::pathCat.
+   */
+  void appendComponent(w_string_piece component) {
+    if (component.size() == 0) {
+      return;
+    }
+    if (!buf_.empty()) {
+      buf_.push_back('/');
+    }
+    append(component);
+  }
+
+  /**
+   * Makes room for `size` more bytes at the end of the path and returns a
+   * pointer to them, for callers that fill in the path out of order.
+   */
+  char* extend(size_t size) {
+    auto offset = buf_.size();
+    buf_.resize(offset + size);
+    return buf_.data() + offset;
+  }
+
+  w_string_piece piece() const {
+    return w_string_piece{buf_.data(), buf_.size()};
+  }
+
+  w_string asWString() const {
+    return w_string{buf_.data(), buf_.size()};
+  }
+
+ private:
+  folly::small_vector<char, kInlineSize> buf_;
+};
+
+} // namespace watchman
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PathComponentTable.h"
+
+namespace watchman {
+
+w_string PathComponentTable::intern(w_string_piece component) {
+  auto it = entries_.find(component);
+  if (it != entries_.end()) {
+    ++it->second.uses;
+    return it->second.name;
+  }
+
+  w_string name{component.data(), component.size()};
+  // The key refers to the heap-allocated bytes of name, which don't move
+  // with the entry.
+  entries_.emplace(name.piece(), Entry{name, 1});
+  return name;
+}
+
+void PathComponentTable::release(w_string_piece component) noexcept {
+  auto it = entries_.find(component);
+  if (it == entries_.end()) {
+    return;
+  }
+  if (--it->second.uses == 0) {
+    entries_.erase(it);
+  }
+}
+
+} // namespace watchman
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <unordered_map>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Interns the path components used to name the nodes of a ViewDatabase.
+ *
+ * Large trees repeat the same few directory names (`src`, `test`, `lib`...)
+ * across many thousands of directories.  Handing out a single shared w_string
+ * per distinct component means each repetition costs a reference rather than
+ * its own heap allocation.
+ *
+ * Every intern() must be balanced by a release() of the same component; the
+ * shared string is dropped from the table once it is no longer in use.
+ *
+ * PathComponentTable is not thread safe; the owning ViewDatabase is always
+ * accessed under its own lock.
+ */
+class PathComponentTable {
+ public:
+  PathComponentTable() = default;
+
+  PathComponentTable(const PathComponentTable&) = delete;
+  PathComponentTable& operator=(const PathComponentTable&) = delete;
+
+  /**
+   * Returns the shared copy of component, creating it if necessary.
+   */
+  w_string intern(w_string_piece component);
+
+  /**
+   * Gives up one use of a component previously returned by intern().
+   */
+  void release(w_string_piece component) noexcept;
+
+  /**
+   * Returns the number of distinct components currently in use.
+   */
+  size_t size() const {
+    return entries_.size();
+  }
+
+ private:
+  struct Entry {
+    w_string name;
+    size_t uses;
+  };
+
+  // Keyed by a piece of the entry's own name
+  std::unordered_map<w_string_piece, Entry> entries_;
+};
+
+} // namespace watchman
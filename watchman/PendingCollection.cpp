@@ -7,6 +7,8 @@
 
 #include "watchman/PendingCollection.h"
 #include <folly/Synchronized.h>
+#include <algorithm>
+#include <mutex>
 #include "watchman/Cookie.h"
 #include "watchman/Logging.h"
 #include "watchman/watchman_dir.h"
@@ -49,22 +51,151 @@ bool is_path_prefix(
   return is_slash(path[common_prefix]);
 }
 
+namespace {
+
+// The number of entries that PendingChanges takes from the pool at a time
+constexpr size_t kRefillBatch = 64;
+// Spare entries beyond this many are given back to the pool
+constexpr size_t kMaxSpareItems = 1024;
+// Entries beyond this many are freed rather than kept in the pool
+constexpr size_t kMaxPooledItems = 64 * 1024;
+
+/**
+ * Free watchman_pending_fs entries, linked through their next pointers, with
+ * their path and stat released.  Entries come and go a chain at a time, so
+ * that the lock is taken once per batch of changes rather than per change.
+ */
+class PendingItemPool {
+ public:
+  static PendingItemPool& get() {
+    // Leaked, since chains may be destroyed during static destruction
+    static auto* pool = new PendingItemPool;
+    return *pool;
+  }
+
+  /**
+   * Takes the whole chain starting at head.  Frees what doesn't fit.
+   */
+  void give(watchman_pending_fs* head) {
+    if (!head) {
+      return;
+    }
+    size_t count = 1;
+    auto* tail = head;
+    for (;;) {
+      tail->path = w_string();
+      tail->stat.reset();
+      if (!tail->next) {
+        break;
+      }
+      tail = tail->next;
+      ++count;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (size_ + count <= kMaxPooledItems) {
+        tail->next = free_;
+        free_ = head;
+        size_ += count;
+        return;
+      }
+    }
+    while (head) {
+      delete std::exchange(head, head->next);
+    }
+  }
+
+  /**
+   * Returns up to count entries, linked through their next pointers, and
+   * their number in taken.
+   */
+  watchman_pending_fs* take(size_t count, size_t& taken) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto* head = free_;
+    watchman_pending_fs* tail = nullptr;
+    taken = 0;
+    while (free_ && taken < count) {
+      tail = free_;
+      free_ = free_->next;
+      ++taken;
+    }
+    if (tail) {
+      tail->next = nullptr;
+    }
+    size_ -= taken;
+    return taken ? head : nullptr;
+  }
+
+ private:
+  std::mutex mutex_;
+  watchman_pending_fs* free_{nullptr};
+  size_t size_{0};
+};
+
+} // namespace
+
+PendingChain::PendingChain(PendingChain&& other) noexcept
+    : head_(std::exchange(other.head_, nullptr)),
+      size_(std::exchange(other.size_, 0)) {}
+
+PendingChain& PendingChain::operator=(PendingChain&& other) noexcept {
+  if (this != &other) {
+    PendingItemPool::get().give(head_);
+    head_ = std::exchange(other.head_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+}
+
+PendingChain::~PendingChain() {
+  PendingItemPool::get().give(head_);
+}
+
+void PendingChain::pushFront(PendingChange change) {
+  size_t taken;
+  auto* p = PendingItemPool::get().take(1, taken);
+  if (!p) {
+    p = new watchman_pending_fs(w_string(), {}, PendingFlags{});
+  }
+  static_cast<PendingChange&>(*p) = std::move(change);
+  pushFront(p);
+}
+
+void PendingChain::pushFront(watchman_pending_fs* p) {
+  p->next = head_;
+  head_ = p;
+  ++size_;
+}
+
+watchman_pending_fs* PendingChain::popFront() {
+  auto* p = head_;
+  if (p) {
+    head_ = p->next;
+    p->next = nullptr;
+    --size_;
+  }
+  return p;
+}
+
 } // namespace watchman
 
 void PendingChanges::clear() {
-  pending_.reset();
+  pending_ = PendingChain();
   tree_.clear();
   syncs_.clear();
+  childCounts_.clear();
 }
 
 void PendingChanges::add(
     const w_string& path,
     std::chrono::system_clock::time_point now,
-    PendingFlags flags) {
+    PendingFlags flags,
+    std::shared_ptr<const FileInformation> stat) {
   auto existing = tree_.search(path);
   if (existing) {
     /* Entry already exists: consolidate */
-    consolidateItem(existing->get(), flags);
+    consolidateItem(*existing, now, flags, std::move(stat));
     /* all done */
     return;
   }
@@ -73,15 +204,24 @@ void PendingChanges::add(
     return;
   }
 
+  bool coalescable = isCoalescable(path, flags);
+  if (coalescable && isCoveredByParentScan(path)) {
+    return;
+  }
+
   // Try to allocate the new node before we prune any children.
-  auto p = std::make_shared<watchman_pending_fs>(path, now, flags);
+  auto* p = makeItem(path, now, flags, std::move(stat));
 
   maybePruneObsoletedChildren(path, flags);
 
   logf(DBG, "add_pending: {} {}\n", path, flags.format());
 
   tree_.insert(path, p);
-  linkHead(std::move(p));
+  linkHead(p);
+
+  if (coalescable) {
+    maybeCoalesceIntoParent(path, now);
+  }
 }
 
 void PendingChanges::add(
@@ -92,6 +232,123 @@ void PendingChanges::add(
   return add(dir->getFullPathToChild(name), now, flags);
 }
 
+void PendingChanges::addBatch(std::vector<PendingChange>& changes) {
+  // A stable sort keeps the arrival order among entries for the same path so
+  // that the first of them determines the timestamp, as it would when adding
+  // them one at a time. Lexicographic order also places a directory ahead of
+  // everything beneath it.
+  std::stable_sort(
+      changes.begin(),
+      changes.end(),
+      [](const PendingChange& a, const PendingChange& b) {
+        return a.path < b.path;
+      });
+
+  auto it = changes.begin();
+  while (it != changes.end()) {
+    auto flags = it->flags;
+    auto stat = std::move(it->stat);
+    auto latest = it->latestNow();
+    auto next = std::next(it);
+    while (next != changes.end() && next->path == it->path) {
+      // Mirror consolidateItem: only these flags strengthen an entry, and
+      // the metadata is that of the latest change.
+      flags.set(
+          next->flags &
+          (W_PENDING_CRAWL_ONLY | W_PENDING_RECURSIVE |
+           W_PENDING_NONRECURSIVE_SCAN | W_PENDING_IS_DESYNCED));
+      stat = std::move(next->stat);
+      latest = std::max(latest, next->latestNow());
+      ++next;
+    }
+
+    add(it->path, it->now, flags, std::move(stat));
+    if (latest > it->now) {
+      if (auto added = tree_.search(it->path)) {
+        (*added)->lastNow = std::max((*added)->lastNow, latest);
+      }
+    }
+    it = next;
+  }
+
+  changes.clear();
+}
+
+void PendingChanges::setCoalescing(
+    uint32_t threshold,
+    std::chrono::milliseconds window) {
+  coalesceThreshold_ = threshold;
+  coalesceWindow_ = window;
+  childCounts_.clear();
+}
+
+bool PendingChanges::isCoalescable(
+    const w_string& path,
+    PendingFlags flags) const {
+  return coalesceThreshold_ > 0 &&
+      !(flags &
+        (W_PENDING_RECURSIVE | W_PENDING_NONRECURSIVE_SCAN |
+         W_PENDING_CRAWL_ONLY | W_PENDING_IS_DESYNCED)) &&
+      !isPossiblyACookie(path);
+}
+
+// A pending non-recursive scan of the parent directory will stat every one
+// of its children, so there is no need to track the child separately.
+bool PendingChanges::isCoveredByParentScan(const w_string& path) {
+  auto parent = tree_.search(path.dirName());
+  return parent && (*parent)->flags.contains(W_PENDING_NONRECURSIVE_SCAN);
+}
+
+// Count a newly added child against its parent directory and, if the parent
+// has accumulated too many of them within the window, replace those children
+// with a single non-recursive scan of the parent.
+void PendingChanges::maybeCoalesceIntoParent(
+    const w_string& path,
+    std::chrono::system_clock::time_point now) {
+  auto dir = path.dirName();
+  if (dir.size() == 0 || dir == path) {
+    return;
+  }
+
+  auto& counter = childCounts_[dir];
+  if (counter.count == 0 || now - counter.windowStart > coalesceWindow_) {
+    counter.windowStart = now;
+    counter.count = 0;
+  }
+  if (++counter.count <= coalesceThreshold_) {
+    return;
+  }
+  childCounts_.erase(dir);
+
+  // Collect first: erasing from the tree invalidates the iteration state.
+  std::vector<watchman_pending_fs*> children;
+  tree_.iterPrefix(
+      reinterpret_cast<const uint8_t*>(dir.data()),
+      dir.size(),
+      [&](const w_string& key, watchman_pending_fs* p) {
+        if (key.size() > dir.size() && is_slash(key.data()[dir.size()]) &&
+            key.piece().dirName() == dir.piece() &&
+            isCoalescable(key, p->flags)) {
+          children.push_back(p);
+        }
+        return 0;
+      });
+
+  for (auto* p : children) {
+    unlinkItem(p);
+    tree_.erase(p->path);
+    recycleItem(p);
+  }
+
+  logf(
+      DBG,
+      "coalescing {} pending children of {} into a directory scan\n",
+      children.size(),
+      dir);
+
+  add(dir, now, W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+}
+
 void PendingChanges::startRefusingSyncs(std::string_view reason) {
   refuseSyncs_ = true;
   refuseSyncsReason_ = reason;
@@ -107,30 +364,38 @@ void PendingChanges::addSync(folly::Promise<folly::Unit> promise) {
 }
 
 void PendingChanges::append(
-    std::shared_ptr<watchman_pending_fs> chain,
+    PendingChain chain,
     std::vector<folly::Promise<folly::Unit>> syncs) {
-  auto p = std::move(chain);
-  while (p) {
+  while (auto* p = chain.popFront()) {
     auto target_p =
         tree_.search((const uint8_t*)p->path.data(), p->path.size());
     if (target_p) {
       /* Entry already exists: consolidate */
-      consolidateItem(target_p->get(), p->flags);
-      p = std::move(p->next);
+      consolidateItem(*target_p, p->latestNow(), p->flags, std::move(p->stat));
+      recycleItem(p);
       continue;
     }
 
     if (isObsoletedByContainingDir(p->path)) {
-      p = std::move(p->next);
+      recycleItem(p);
+      continue;
+    }
+
+    bool coalescable = isCoalescable(p->path, p->flags);
+    if (coalescable && isCoveredByParentScan(p->path)) {
+      recycleItem(p);
       continue;
     }
     maybePruneObsoletedChildren(p->path, p->flags);
 
-    auto next = std::move(p->next);
     tree_.insert(p->path, p);
-    linkHead(std::move(p));
+    linkHead(p);
 
-    p = std::move(next);
+    if (coalescable) {
+      // Coalescing may recycle p
+      auto path = p->path;
+      maybeCoalesceIntoParent(path, p->now);
+    }
   }
 
   syncs_.insert(
@@ -139,8 +404,9 @@ void PendingChanges::append(
       std::make_move_iterator(syncs.end()));
 }
 
-std::shared_ptr<watchman_pending_fs> PendingChanges::stealItems() {
+PendingChain PendingChanges::stealItems() {
   tree_.clear();
+  childCounts_.clear();
   return std::move(pending_);
 }
 
@@ -158,6 +424,22 @@ uint32_t PendingChanges::getPendingItemCount() const {
   return tree_.size();
 }
 
+std::vector<w_string> PendingChanges::recursiveItemsWithin(
+    const w_string& dir) {
+  std::vector<w_string> paths;
+  tree_.iterPrefix(
+      reinterpret_cast<const uint8_t*>(dir.data()),
+      dir.size(),
+      [&](const w_string& key, watchman_pending_fs* p) {
+        if ((p->flags & W_PENDING_RECURSIVE) &&
+            (key.size() == dir.size() || is_slash(key.data()[dir.size()]))) {
+          paths.push_back(key);
+        }
+        return 0;
+      });
+  return paths;
+}
+
 // if there are any entries that are obsoleted by a recursive insert,
 // walk over them now and mark them as ignored.
 void PendingChanges::maybePruneObsoletedChildren(
@@ -184,8 +466,7 @@ void PendingChanges::maybePruneObsoletedChildren(
     // a sibling node by mistake (see commentary on the is_path_prefix
     // function for more on that).
 
-    auto callback = [&](const w_string& key,
-                        std::shared_ptr<watchman_pending_fs>& p) -> int {
+    auto callback = [&](const w_string& key, watchman_pending_fs* p) -> int {
       w_check(
           p,
           "Pending changes should be removed from both the list and the tree.");
@@ -209,6 +490,7 @@ void PendingChanges::maybePruneObsoletedChildren(
 
         // Remove it from the art tree.
         tree_.erase(key);
+        recycleItem(p);
 
         // Stop iteration because we just invalidated the iterator state
         // by modifying the tree mid-iteration.
@@ -237,7 +519,9 @@ void PendingChanges::maybePruneObsoletedChildren(
 
 void PendingChanges::consolidateItem(
     watchman_pending_fs* p,
-    PendingFlags flags) {
+    std::chrono::system_clock::time_point now,
+    PendingFlags flags,
+    std::shared_ptr<const FileInformation> stat) {
   // Increase the strength of the pending item if either of these
   // flags are set.
   // We upgrade crawl-only as well as recursive; it indicates that
@@ -247,6 +531,10 @@ void PendingChanges::consolidateItem(
       flags &
       (W_PENDING_CRAWL_ONLY | W_PENDING_RECURSIVE |
        W_PENDING_NONRECURSIVE_SCAN | W_PENDING_IS_DESYNCED));
+  // Metadata from an earlier change would be stale, and a change that came
+  // without any means that the path has to be stat'ed.
+  p->stat = std::move(stat);
+  p->lastNow = std::max(p->lastNow, now);
 
   maybePruneObsoletedChildren(p->path, p->flags);
 }
@@ -281,36 +569,65 @@ bool PendingChanges::isObsoletedByContainingDir(const w_string& path) {
   return false;
 }
 
+// Returns an unlinked item, reusing a spare one if there is any.
+watchman_pending_fs* PendingChanges::makeItem(
+    const w_string& path,
+    std::chrono::system_clock::time_point now,
+    PendingFlags flags,
+    std::shared_ptr<const FileInformation> stat) {
+  if (spare_.empty()) {
+    size_t taken;
+    spare_.head_ = PendingItemPool::get().take(kRefillBatch, taken);
+    spare_.size_ = taken;
+  }
+  auto* p = spare_.popFront();
+  if (!p) {
+    return new watchman_pending_fs(path, now, flags, std::move(stat));
+  }
+  static_cast<PendingChange&>(*p) =
+      PendingChange{path, now, flags, std::move(stat)};
+  return p;
+}
+
+// Keeps an item that is no longer linked or in the tree for reuse.
+void PendingChanges::recycleItem(watchman_pending_fs* p) {
+  p->path = w_string();
+  p->stat.reset();
+  p->prev = nullptr;
+  spare_.pushFront(p);
+  if (spare_.size() > kMaxSpareItems) {
+    spare_ = PendingChain();
+  }
+}
+
 // Helper to doubly-link a pending item to the head of a collection.
-void PendingChanges::linkHead(std::shared_ptr<watchman_pending_fs>&& p) {
-  p->prev.reset();
-  p->next = pending_;
+void PendingChanges::linkHead(watchman_pending_fs* p) {
+  p->prev = nullptr;
+  pending_.pushFront(p);
   if (p->next) {
     p->next->prev = p;
   }
-  pending_ = std::move(p);
 }
 
 // Helper to un-doubly-link a pending item.
-void PendingChanges::unlinkItem(std::shared_ptr<watchman_pending_fs>& p) {
-  if (pending_ == p) {
-    pending_ = p->next;
+void PendingChanges::unlinkItem(watchman_pending_fs* p) {
+  if (pending_.head_ == p) {
+    pending_.head_ = p->next;
   }
-  auto prev = p->prev.lock();
-
-  if (prev) {
-    prev->next = p->next;
+  if (p->prev) {
+    p->prev->next = p->next;
   }
-
   if (p->next) {
-    p->next->prev = prev;
+    p->next->prev = p->prev;
   }
+  --pending_.size_;
 
-  p->next.reset();
-  p->prev.reset();
+  p->next = nullptr;
+  p->prev = nullptr;
 }
 
-PendingCollectionBase::PendingCollectionBase(std::condition_variable& cond)
+PendingCollectionBase::PendingCollectionBase(
+    std::condition_variable_any& cond)
     : cond_(cond) {}
 
 void PendingCollectionBase::ping() {
@@ -319,7 +636,7 @@ void PendingCollectionBase::ping() {
 }
 
 bool PendingCollectionBase::checkAndResetPinged() {
-  if (pending_ || pinged_) {
+  if (!pending_.empty() || pinged_) {
     pinged_ = false;
     return true;
   }
@@ -327,7 +644,7 @@ bool PendingCollectionBase::checkAndResetPinged() {
 }
 
 PendingCollection::PendingCollection()
-    : folly::Synchronized<PendingCollectionBase, std::mutex>{
+    : folly::Synchronized<PendingCollectionBase, PendingCollectionMutex>{
           std::in_place,
           cond_} {}
 
@@ -349,5 +666,48 @@ PendingCollection::LockedPtr PendingCollection::lockAndWait(
   return lock;
 }
 
+PendingChangesQueue::PendingChangesQueue(size_t capacity)
+    : batches_{std::max(size_t(1), capacity)} {}
+
+PendingChangesQueue::PushResult PendingChangesQueue::tryPush(
+    PendingChanges& changes) {
+  Batch batch{changes.stealItems(), changes.stealSyncs()};
+  if (!batches_.write(std::move(batch))) {
+    // write() leaves its argument alone when it fails
+    changes.append(std::move(batch.items), std::move(batch.syncs));
+    return PushResult::Full;
+  }
+  // Pairs with the fence in prepareToWait(): either the consumer sees this
+  // batch before it sleeps, or we see that it may be asleep.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return consumerIdle_.load(std::memory_order_relaxed)
+      ? PushResult::QueuedConsumerIdle
+      : PushResult::Queued;
+}
+
+bool PendingChangesQueue::prepareToWait() {
+  consumerIdle_.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (batches_.isEmpty()) {
+    return true;
+  }
+  consumerIdle_.store(false, std::memory_order_relaxed);
+  return false;
+}
+
+void PendingChangesQueue::finishWait() {
+  consumerIdle_.store(false, std::memory_order_relaxed);
+}
+
+size_t PendingChangesQueue::drainInto(PendingChanges& pending) {
+  size_t count = 0;
+  Batch batch;
+  while (batches_.read(batch)) {
+    pending.append(std::move(batch.items), std::move(batch.syncs));
+    ++count;
+  }
+  return count;
+}
+
 /* vim:ts=2:sw=2:et:
  */
@@ -7,11 +7,20 @@
 
 #pragma once
 
+#include <folly/MPMCQueue.h>
 #include <folly/Synchronized.h>
 #include <folly/futures/Promise.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 #include "eden/common/utils/OptionSet.h"
+#include "watchman/fs/FileInformation.h"
+#include "watchman/telemetry/InstrumentedMutex.h"
 #include "watchman/thirdparty/libart/src/art.h"
 #include "watchman/watchman_string.h"
 
@@ -89,22 +98,80 @@ struct PendingChange {
   w_string path;
   std::chrono::system_clock::time_point now;
   PendingFlags flags;
+  // The metadata of the path as delivered with the event, from watchers that
+  // set WATCHER_HAS_FILE_INFORMATION. When present, the IO thread uses it
+  // instead of stat'ing the path. Null when unknown, including for removals.
+  std::shared_ptr<const FileInformation> stat;
+  // When the latest of the changes consolidated into this one was noticed,
+  // if later than `now`, which is when the first of them was.
+  std::chrono::system_clock::time_point lastNow{};
+
+  std::chrono::system_clock::time_point latestNow() const {
+    return std::max(now, lastNow);
+  }
 };
 
 struct watchman_pending_fs : watchman::PendingChange {
-  // We own the next entry and will destroy that chain when we
-  // are destroyed.
-  std::shared_ptr<watchman_pending_fs> next;
+  // The entry after this one in the chain that owns it.  Entries never own
+  // each other; see PendingChain.
+  watchman_pending_fs* next{nullptr};
 
   watchman_pending_fs(
       w_string path,
       std::chrono::system_clock::time_point now,
-      PendingFlags flags)
-      : PendingChange{std::move(path), now, flags} {}
+      PendingFlags flags,
+      std::shared_ptr<const FileInformation> stat = nullptr)
+      : PendingChange{std::move(path), now, flags, std::move(stat)} {}
 
  private:
   // Only used for unlinking during pruning.
-  std::weak_ptr<watchman_pending_fs> prev;
+  watchman_pending_fs* prev{nullptr};
+  friend class PendingChanges;
+};
+
+/**
+ * The sole owner of a chain of watchman_pending_fs entries, linked through
+ * their next pointers with the most recently added first.
+ *
+ * Entries are allocated from a process-wide pool rather than one at a time,
+ * since every change that the notify thread hands to the IO thread needs
+ * one.  A chain gives all of its entries back to the pool at once when it
+ * is destroyed, which for a chain stolen by the IO thread is once it has
+ * processed all of them.
+ */
+class PendingChain {
+ public:
+  PendingChain() = default;
+  PendingChain(PendingChain&& other) noexcept;
+  PendingChain& operator=(PendingChain&& other) noexcept;
+  PendingChain(const PendingChain&) = delete;
+  PendingChain& operator=(const PendingChain&) = delete;
+  ~PendingChain();
+
+  watchman_pending_fs* head() const {
+    return head_;
+  }
+
+  bool empty() const {
+    return head_ == nullptr;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  /**
+   * Links an entry for change ahead of the others.
+   */
+  void pushFront(PendingChange change);
+
+ private:
+  // Unlinks the first entry, which the caller must link into another chain.
+  watchman_pending_fs* popFront();
+  void pushFront(watchman_pending_fs* p);
+
+  watchman_pending_fs* head_{nullptr};
+  size_t size_{0};
   friend class PendingChanges;
 };
 
@@ -134,17 +201,33 @@ class PendingChanges {
   /**
    * Add a pending entry.  Will consolidate an existing entry with the same
    * name. The caller must own the collection lock.
+   *
+   * `stat` is the metadata that came with the event, if any. It replaces
+   * that of an existing entry, so that an entry only carries metadata if its
+   * latest change did.
    */
   void add(
       const w_string& path,
       std::chrono::system_clock::time_point now,
-      PendingFlags flags);
+      PendingFlags flags,
+      std::shared_ptr<const FileInformation> stat = nullptr);
   void add(
       watchman_dir* dir,
       const char* name,
       std::chrono::system_clock::time_point now,
       PendingFlags flags);
 
+  /**
+   * Add a batch of pending entries, such as a full buffer of watcher events.
+   *
+   * The batch is sorted by path first so that repeated notifications for the
+   * same path are merged before touching the tree, and so that a recursive
+   * directory entry is inserted ahead of its children, which are then
+   * discarded by the cheap containing-dir check rather than being inserted
+   * and pruned again. `changes` is consumed.
+   */
+  void addBatch(std::vector<PendingChange>& changes);
+
   /**
    * Add a sync request. The consumer of this sync should fulfill it after
    * processing all of the pending items.
@@ -158,12 +241,12 @@ class PendingChanges {
    * `chain` is consumed -- the links are broken.
    */
   void append(
-      std::shared_ptr<watchman_pending_fs> chain,
+      PendingChain chain,
       std::vector<folly::Promise<folly::Unit>> syncs);
 
-  /* Moves the head of the chain of items to the caller.
+  /* Moves the chain of items to the caller.
    * The tree is cleared and the caller owns the whole chain */
-  std::shared_ptr<watchman_pending_fs> stealItems();
+  PendingChain stealItems();
 
   std::vector<folly::Promise<folly::Unit>> stealSyncs();
 
@@ -178,26 +261,83 @@ class PendingChanges {
    */
   uint32_t getPendingItemCount() const;
 
+  /**
+   * Calls `func` with each pending item, most recently added first.
+   */
+  template <typename Func>
+  void forEach(Func&& func) const {
+    for (auto* item = pending_.head(); item; item = item->next) {
+      func(static_cast<const PendingChange&>(*item));
+    }
+  }
+
+  /**
+   * Returns the paths of the recursive items for `dir` and the paths beneath
+   * it.
+   */
+  std::vector<w_string> recursiveItemsWithin(const w_string& dir);
+
   void startRefusingSyncs(std::string_view reason);
 
+  /**
+   * Enables directory-level coalescing to bound the size of the collection
+   * during event storms. Once more than `threshold` children of a single
+   * directory have been added within `window`, those children are replaced
+   * by one W_PENDING_NONRECURSIVE_SCAN entry for the directory, and further
+   * changes to its children are absorbed by that entry.
+   *
+   * Only plain notifications are coalesced; recursive, scan, crawl-only,
+   * desynced and cookie entries are always tracked individually. A threshold
+   * of 0, the default, disables coalescing.
+   */
+  void setCoalescing(uint32_t threshold, std::chrono::milliseconds window);
+
  protected:
-  art_tree<std::shared_ptr<watchman_pending_fs>, w_string> tree_;
-  std::shared_ptr<watchman_pending_fs> pending_;
+  art_tree<watchman_pending_fs*, w_string> tree_;
+  PendingChain pending_;
   std::vector<folly::Promise<folly::Unit>> syncs_;
   bool refuseSyncs_{false}; // true if we should refuse to add any more syncs
   std::string refuseSyncsReason_{};
 
  private:
+  struct ChildCount {
+    std::chrono::system_clock::time_point windowStart;
+    uint32_t count;
+  };
+
+  uint32_t coalesceThreshold_{0};
+  std::chrono::milliseconds coalesceWindow_{0};
+  // Keyed by directory; counts children added there in the current window.
+  std::unordered_map<w_string, ChildCount> childCounts_;
+  // Entries that were pruned or consolidated away, reused before any are
+  // taken from the pool.  Their next pointers link them.
+  PendingChain spare_;
+
+  bool isCoalescable(const w_string& path, PendingFlags flags) const;
+  bool isCoveredByParentScan(const w_string& path);
+  void maybeCoalesceIntoParent(
+      const w_string& path,
+      std::chrono::system_clock::time_point now);
   void maybePruneObsoletedChildren(w_string path, PendingFlags flags);
-  inline void consolidateItem(watchman_pending_fs* p, PendingFlags flags);
+  inline void consolidateItem(
+      watchman_pending_fs* p,
+      std::chrono::system_clock::time_point now,
+      PendingFlags flags,
+      std::shared_ptr<const FileInformation> stat);
   bool isObsoletedByContainingDir(const w_string& path);
-  inline void linkHead(std::shared_ptr<watchman_pending_fs>&& p);
-  inline void unlinkItem(std::shared_ptr<watchman_pending_fs>& p);
+  watchman_pending_fs* makeItem(
+      const w_string& path,
+      std::chrono::system_clock::time_point now,
+      PendingFlags flags,
+      std::shared_ptr<const FileInformation> stat);
+  void recycleItem(watchman_pending_fs* p);
+  inline void linkHead(watchman_pending_fs* p);
+  inline void unlinkItem(watchman_pending_fs* p);
 };
 
 class PendingCollectionBase : public PendingChanges {
  public:
-  explicit PendingCollectionBase(std::condition_variable& cond);
+  explicit PendingCollectionBase(std::condition_variable_any& cond);
   PendingCollectionBase(PendingCollectionBase&&) = delete;
   PendingCollectionBase& operator=(PendingCollectionBase&&) = delete;
 
@@ -213,12 +353,18 @@ class PendingCollectionBase : public PendingChanges {
   bool checkAndResetPinged();
 
  private:
-  std::condition_variable& cond_;
+  std::condition_variable_any& cond_;
   bool pinged_{false};
 };
 
-class PendingCollection
-    : public folly::Synchronized<PendingCollectionBase, std::mutex> {
+using PendingCollectionMutex = InstrumentedMutex<
+    std::mutex,
+    &LockStats::pendingWait,
+    &LockStats::pendingHold>;
+
+class PendingCollection : public folly::Synchronized<
+                              PendingCollectionBase,
+                              PendingCollectionMutex> {
  public:
   PendingCollection();
 
@@ -231,8 +377,67 @@ class PendingCollection
   LockedPtr lockAndWait(std::chrono::milliseconds timeoutms);
 
  private:
-  // Notified on ping().
-  std::condition_variable cond_;
+  // Notified on ping(). Not a std::condition_variable, which only works with
+  // a plain std::mutex.
+  std::condition_variable_any cond_;
+};
+
+/**
+ * Lock-free handoff of batches of pending changes from the notify thread to
+ * the IO thread, so that neither has to wait for the PendingCollection lock
+ * while the other holds it.
+ *
+ * The queue is bounded. Once it is full, tryPush() fails and the producer
+ * should append to the PendingCollection instead, which consolidates the
+ * changes while the IO thread is busy.
+ *
+ * Waking the consumer still goes through PendingCollection::ping(), but only
+ * when the consumer announced with prepareToWait() that it may be asleep.
+ */
+class PendingChangesQueue {
+ public:
+  static constexpr size_t kDefaultCapacity = 64;
+
+  enum class PushResult {
+    // Nothing was queued and the changes were left untouched.
+    Full,
+    Queued,
+    // Queued, and the consumer must be pinged.
+    QueuedConsumerIdle,
+  };
+
+  explicit PendingChangesQueue(size_t capacity = kDefaultCapacity);
+
+  /**
+   * Moves the items and syncs of `changes` into the queue as one batch.
+   */
+  PushResult tryPush(PendingChanges& changes);
+
+  /**
+   * Called by the consumer before it waits for a ping. Returns false if
+   * batches are queued, in which case it should not wait.
+   */
+  bool prepareToWait();
+
+  /**
+   * Called by the consumer once it stops waiting.
+   */
+  void finishWait();
+
+  /**
+   * Appends every queued batch to `pending`, oldest first. Returns the number
+   * of batches. Must only be called by the consumer.
+   */
+  size_t drainInto(PendingChanges& pending);
+
+ private:
+  struct Batch {
+    PendingChain items;
+    std::vector<folly::Promise<folly::Unit>> syncs;
+  };
+
+  folly::MPMCQueue<Batch> batches_;
+  std::atomic<bool> consumerIdle_{false};
 };
 
 // Since the tree has no internal knowledge about path structures, when we
@@ -15,10 +15,20 @@
 #include "watchman/Logging.h"
 #include "watchman/Options.h"
 #include "watchman/WatchmanConfig.h"
+#include "watchman/fs/FileDescriptor.h"
 #include "watchman/sockname.h"
 #include "watchman/watchman_system.h"
 #include "watchman/watchman_time.h"
 
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
 using namespace watchman;
 
 namespace watchman {
@@ -106,13 +116,129 @@ void processSamples(
   }
 }
 
-PerfSample::PerfSample(const char* description) : description(description) {
+namespace {
+
+#ifdef _WIN32
+timeval fileTimeToTimeval(const FILETIME& ft) {
+  // FILETIME counts 100ns intervals
+  auto ticks = (uint64_t(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+  timeval tv;
+  tv.tv_sec = long(ticks / 10000000);
+  tv.tv_usec = long((ticks % 10000000) / 10);
+  return tv;
+}
+#endif
+
+// Reads the CPU times of the calling thread into `usage`.  Returns false if
+// the platform can't tell.
+bool getThreadTimes(PerfSample::ThreadUsage& usage) {
+#ifdef __linux__
+  struct rusage ru;
+  if (getrusage(RUSAGE_THREAD, &ru) != 0) {
+    return false;
+  }
+  usage.user_time = ru.ru_utime;
+  usage.system_time = ru.ru_stime;
+  return true;
+#elif defined(__APPLE__)
+  thread_basic_info_data_t info;
+  mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+  auto thread = mach_thread_self();
+  auto result = thread_info(
+      thread,
+      THREAD_BASIC_INFO,
+      reinterpret_cast<thread_info_t>(&info),
+      &count);
+  mach_port_deallocate(mach_task_self(), thread);
+  if (result != KERN_SUCCESS) {
+    return false;
+  }
+  usage.user_time.tv_sec = info.user_time.seconds;
+  usage.user_time.tv_usec = info.user_time.microseconds;
+  usage.system_time.tv_sec = info.system_time.seconds;
+  usage.system_time.tv_usec = info.system_time.microseconds;
+  return true;
+#elif defined(_WIN32)
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+    return false;
+  }
+  usage.user_time = fileTimeToTimeval(user);
+  usage.system_time = fileTimeToTimeval(kernel);
+  ULONG64 cycles;
+  if (QueryThreadCycleTime(GetCurrentThread(), &cycles)) {
+    usage.cycles = cycles;
+  }
+  return true;
+#else
+  (void)usage;
+  return false;
+#endif
+}
+
+bool hwCountersEnabled() {
+  static bool enabled = cfg_get_bool("perf_sample_hw_counters", false);
+  return enabled;
+}
+
+} // namespace
+
+// Per-thread hardware counters, which count for as long as they are open.
+struct PerfSample::HwCounters {
+#ifdef __linux__
+  FileDescriptor instructions;
+  FileDescriptor cacheMisses;
+
+  static FileDescriptor open(uint64_t config) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // pid 0 and cpu -1 count the calling thread on any CPU
+    return FileDescriptor{
+        static_cast<FileDescriptor::system_handle_type>(syscall(
+            SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC)),
+        FileDescriptor::FDType::Generic};
+  }
+
+  static std::optional<uint64_t> read(const FileDescriptor& fd) {
+    uint64_t value;
+    if (!fd || ::read(fd.fd(), &value, sizeof(value)) != sizeof(value)) {
+      return std::nullopt;
+    }
+    return value;
+  }
+
+  HwCounters()
+      : instructions{open(PERF_COUNT_HW_INSTRUCTIONS)},
+        cacheMisses{open(PERF_COUNT_HW_CACHE_MISSES)} {}
+
+  void sample(ThreadUsage& usage) const {
+    usage.instructions = read(instructions);
+    usage.cache_misses = read(cacheMisses);
+  }
+#else
+  void sample(ThreadUsage&) const {}
+#endif
+};
+
+PerfSample::PerfSample(const char* description)
+    : description(description), thread_(std::this_thread::get_id()) {
   gettimeofday(&time_begin, nullptr);
 #ifdef HAVE_SYS_RESOURCE_H
   getrusage(RUSAGE_SELF, &usage_begin);
 #endif
+  if (hwCountersEnabled()) {
+    hw_counters_ = std::make_unique<HwCounters>();
+    hw_counters_->sample(thread_usage_begin);
+  }
+  has_thread_usage = getThreadTimes(thread_usage_begin);
 }
 
+PerfSample::~PerfSample() = default;
+
 double PerfSample::get_perf_sampling_thresh() const {
   static double perf_sampling_thresh{0};
   if (perf_sampling_thresh == 0) {
@@ -156,6 +282,39 @@ bool PerfSample::finish() {
 #undef DIFFU
 #endif
 
+  if (has_thread_usage && std::this_thread::get_id() == thread_) {
+    ThreadUsage end;
+    if (hw_counters_) {
+      hw_counters_->sample(end);
+    }
+    if (getThreadTimes(end)) {
+      w_timeval_sub(
+          end.user_time, thread_usage_begin.user_time, &thread_usage.user_time);
+      w_timeval_sub(
+          end.system_time,
+          thread_usage_begin.system_time,
+          &thread_usage.system_time);
+      auto diff = [](const std::optional<uint64_t>& begin,
+                     const std::optional<uint64_t>& end)
+          -> std::optional<uint64_t> {
+        if (begin && end) {
+          return *end - *begin;
+        }
+        return std::nullopt;
+      };
+      thread_usage.cycles = diff(thread_usage_begin.cycles, end.cycles);
+      thread_usage.instructions =
+          diff(thread_usage_begin.instructions, end.instructions);
+      thread_usage.cache_misses =
+          diff(thread_usage_begin.cache_misses, end.cache_misses);
+    } else {
+      has_thread_usage = false;
+    }
+  } else {
+    has_thread_usage = false;
+  }
+  hw_counters_.reset();
+
   if (!will_log) {
     if (wall_time_elapsed_thresh == 0) {
       wall_time_elapsed_thresh = get_perf_sampling_thresh();
@@ -339,6 +498,19 @@ void PerfSample::log() {
   ADDTV("user_time", usage.ru_utime);
   ADDTV("system_time", usage.ru_stime);
 #endif // HAVE_SYS_RESOURCE_H
+  if (has_thread_usage) {
+    ADDTV("thread_user_time", thread_usage.user_time);
+    ADDTV("thread_system_time", thread_usage.system_time);
+    if (thread_usage.cycles) {
+      info.set("thread_cycles", json_integer(*thread_usage.cycles));
+    }
+    if (thread_usage.instructions) {
+      info.set("thread_instructions", json_integer(*thread_usage.instructions));
+    }
+    if (thread_usage.cache_misses) {
+      info.set("thread_cache_misses", json_integer(*thread_usage.cache_misses));
+    }
+  }
 #undef ADDTV
 
   // Log to the log file
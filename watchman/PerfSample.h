@@ -8,7 +8,10 @@
 #pragma once
 
 #include <folly/portability/SysTime.h>
+#include <memory>
+#include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "watchman/thirdparty/jansson/jansson.h"
@@ -70,6 +73,25 @@ class PerfSample {
   struct rusage usage;
 #endif
 
+  // The CPU used by the thread that started the sample, between starting
+  // and finishing it on that thread.  Unlike the process-wide stats, this
+  // belongs to the sampled action, though not the work that it handed to
+  // other threads.
+  struct ThreadUsage {
+    timeval user_time{};
+    timeval system_time{};
+    // CPU cycles, where the platform counts them per thread (Windows)
+    std::optional<uint64_t> cycles;
+    // Hardware counters, with perf_sample_hw_counters on Linux
+    std::optional<uint64_t> instructions;
+    std::optional<uint64_t> cache_misses;
+  };
+  ThreadUsage thread_usage_begin;
+  ThreadUsage thread_usage;
+  // Whether thread_usage was measured: the sample was finished on the
+  // thread that started it
+  bool has_thread_usage{false};
+
   /**
    * Initialize and mark the start of a sample.
    * The given description is an unowned pointer - it must live as long as the
@@ -101,6 +123,14 @@ class PerfSample {
 
   // If will_log is set, arranges to send the sample to the log
   void log();
+
+  ~PerfSample();
+
+ private:
+  struct HwCounters;
+
+  std::thread::id thread_;
+  std::unique_ptr<HwCounters> hw_counters_;
 };
 
 void perf_shutdown();
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PhaseTimeline.h"
+#include <algorithm>
+
+namespace watchman {
+
+namespace {
+
+int64_t toMillis(PhaseTimeline::Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(duration)
+      .count();
+}
+
+} // namespace
+
+bool PhaseTimeline::record(
+    std::string_view name,
+    Clock::time_point start,
+    Clock::time_point end) {
+  auto phases = phases_.wlock();
+  for (auto& phase : *phases) {
+    if (phase.name == name) {
+      return false;
+    }
+  }
+  auto pos = std::upper_bound(
+      phases->begin(),
+      phases->end(),
+      start,
+      [](Clock::time_point start, const Phase& phase) {
+        return start < phase.start;
+      });
+  phases->insert(
+      pos,
+      Phase{
+          std::string{name},
+          start,
+          std::max(end - start, Clock::duration::zero())});
+  return true;
+}
+
+bool PhaseTimeline::has(std::string_view name) const {
+  auto phases = phases_.rlock();
+  return std::any_of(phases->begin(), phases->end(), [&](const Phase& phase) {
+    return phase.name == name;
+  });
+}
+
+std::vector<PhaseTimeline::Phase> PhaseTimeline::phases() const {
+  return *phases_.rlock();
+}
+
+std::vector<PhaseStatus> PhaseTimeline::getStatus() const {
+  auto phases = phases_.rlock();
+  std::vector<PhaseStatus> result;
+  result.reserve(phases->size());
+  for (auto& phase : *phases) {
+    PhaseStatus status;
+    status.name = w_string{phase.name};
+    status.start_ms = toMillis(phase.start - phases->front().start);
+    status.duration_ms = toMillis(phase.duration);
+    result.push_back(std::move(status));
+  }
+  return result;
+}
+
+json_ref PhaseTimeline::toJson() const {
+  auto phases = phases_.rlock();
+  auto result = json_object();
+  Clock::time_point end;
+  for (auto& phase : *phases) {
+    result.set(phase.name.c_str(), json_integer(toMillis(phase.duration)));
+    end = std::max(end, phase.start + phase.duration);
+  }
+  if (!phases->empty()) {
+    result.set("total", json_integer(toMillis(end - phases->front().start)));
+  }
+  return result;
+}
+
+PhaseTimeline& getStartupTimeline() {
+  static PhaseTimeline timeline;
+  return timeline;
+}
+
+} // namespace watchman
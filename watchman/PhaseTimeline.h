@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "watchman/Serde.h"
+
+namespace watchman {
+
+/**
+ * One phase of a PhaseTimeline, as reported by debug-status.
+ */
+struct PhaseStatus : serde::Object {
+  w_string name;
+  // Since the start of the first phase of the timeline
+  int64_t start_ms = 0;
+  int64_t duration_ms = 0;
+
+  template <typename X>
+  void map(X& x) {
+    x("name", name);
+    x("start_ms", start_ms);
+    x("duration_ms", duration_ms);
+  }
+};
+
+/**
+ * Records how long each phase of an initialization took, such as the
+ * daemon's startup or the first crawl of a root, so that slow starts can
+ * be broken down.  Thread safe.
+ *
+ * Only the first occurrence of each phase is kept, so a phase that repeats,
+ * such as a recrawl, records the initial one.
+ */
+class PhaseTimeline {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Phase {
+    std::string name;
+    Clock::time_point start;
+    Clock::duration duration;
+  };
+
+  /**
+   * Records that the phase `name` ran from `start` to `end`.  Returns false
+   * if `name` was already recorded.
+   */
+  bool record(
+      std::string_view name,
+      Clock::time_point start,
+      Clock::time_point end = Clock::now());
+
+  /// Whether `name` has been recorded.
+  bool has(std::string_view name) const;
+
+  /// The recorded phases, ordered by start time.
+  std::vector<Phase> phases() const;
+
+  std::vector<PhaseStatus> getStatus() const;
+
+  /**
+   * The phases as an object of name to milliseconds, for PerfSample
+   * metadata, with a "total" of the time from the start of the first phase
+   * to the end of the last.
+   */
+  json_ref toJson() const;
+
+ private:
+  folly::Synchronized<std::vector<Phase>> phases_;
+};
+
+/// The phases of the daemon's startup, up to accepting clients.
+PhaseTimeline& getStartupTimeline();
+
+} // namespace watchman
@@ -9,6 +9,8 @@
 
 #include <fmt/core.h>
 #include <folly/String.h>
+#include <algorithm>
+#include <thread>
 
 #include "watchman/Logging.h"
 
@@ -18,8 +20,10 @@
 
 namespace watchman {
 
-ProcessLock ProcessLock::acquire(const std::string& pid_file) {
-  auto result = tryAcquire(pid_file);
+ProcessLock ProcessLock::acquire(
+    const std::string& pid_file,
+    std::chrono::milliseconds timeout) {
+  auto result = tryAcquire(pid_file, timeout);
   if (auto* error = std::get_if<std::string>(&result)) {
     log(ERR, *error, "\n");
     exit(1);
@@ -132,6 +136,22 @@ std::variant<ProcessLock, ProcessLock::LockError> ProcessLock::tryAcquire(
 #endif
 }
 
+std::variant<ProcessLock, ProcessLock::LockError> ProcessLock::tryAcquire(
+    const std::string& pid_file,
+    std::chrono::milliseconds timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  std::chrono::milliseconds interval{10};
+  while (true) {
+    auto result = tryAcquire(pid_file);
+    if (std::holds_alternative<ProcessLock>(result) ||
+        std::chrono::steady_clock::now() >= deadline) {
+      return result;
+    }
+    /* sleep override */ std::this_thread::sleep_for(interval);
+    interval = std::min(interval * 2, std::chrono::milliseconds(1000));
+  }
+}
+
 ProcessLock::Handle ProcessLock::writePid(const std::string& pid_file) {
 #ifndef _WIN32
   CHECK(fd_) << "writePid may only be called after acquire";
@@ -37,9 +37,12 @@ class ProcessLock {
    *
    * Call before fork(), so failure can be printed to the daemonizing process.
    *
-   * Prints an error and exits the process if it fails.
+   * Prints an error and exits the process if it fails, after trying for up
+   * to `timeout`.
    */
-  static ProcessLock acquire(const std::string& pid_file);
+  static ProcessLock acquire(
+      const std::string& pid_file,
+      std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
 
   /**
    * Acquires an fd to the pidfile and locks it.
@@ -51,6 +54,14 @@ class ProcessLock {
   static std::variant<ProcessLock, LockError> tryAcquire(
       const std::string& pid_file);
 
+  /**
+   * Like tryAcquire, but keeps trying for up to `timeout` while another
+   * process holds the lock.  Used to wait for a service that is exiting.
+   */
+  static std::variant<ProcessLock, LockError> tryAcquire(
+      const std::string& pid_file,
+      std::chrono::milliseconds timeout);
+
   ProcessLock(ProcessLock&&) = default;
   ProcessLock& operator=(ProcessLock&&) = default;
 
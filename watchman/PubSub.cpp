@@ -8,6 +8,7 @@
 #include "watchman/PubSub.h"
 #include <algorithm>
 #include <iterator>
+#include <unordered_set>
 
 namespace watchman {
 
@@ -117,6 +118,10 @@ bool Publisher::hasSubscribers() const {
   return !state_.rlock()->subscribers.empty();
 }
 
+size_t Publisher::getItemCount() const {
+  return state_.rlock()->items.size();
+}
+
 void Publisher::state::collectGarbage() {
   if (items.empty()) {
     return;
@@ -135,7 +140,54 @@ void Publisher::state::collectGarbage() {
   }
 }
 
-bool Publisher::enqueue(json_ref&& payload) {
+void Publisher::state::enforceLimit(
+    size_t maxItems,
+    OverflowPolicy policy,
+    const std::vector<std::shared_ptr<Subscriber>>& live) {
+  // Discard items that nobody needs because a later item supersedes them.
+  // Every subscriber will see the later one.
+  if (policy == OverflowPolicy::Coalesce &&
+      items.size() > std::max(maxItems, compactAt)) {
+    std::unordered_set<w_string> seenKeys;
+    std::deque<std::shared_ptr<const Item>> kept;
+    for (auto it = items.rbegin(); it != items.rend(); ++it) {
+      auto& key = (*it)->coalesceKey;
+      if (!key.empty() && !seenKeys.insert(key).second) {
+        continue;
+      }
+      kept.push_front(std::move(*it));
+    }
+    items = std::move(kept);
+    compactAt = items.size() * 2;
+  }
+
+  if (items.size() <= maxItems || policy != OverflowPolicy::Drop) {
+    return;
+  }
+
+  // Move subscribers that are too far behind up to the newest
+  // maxItems items, counting what they skip.
+  uint64_t keepFrom = items[items.size() - maxItems]->serial;
+  for (auto& sub : live) {
+    if (sub->serial_ + 1 >= keepFrom) {
+      continue;
+    }
+    uint64_t skipped = 0;
+    for (auto& item : items) {
+      if (item->serial >= keepFrom) {
+        break;
+      }
+      if (item->serial > sub->serial_) {
+        ++skipped;
+      }
+    }
+    sub->serial_ = keepFrom - 1;
+    sub->totalDropped_ += skipped;
+    sub->dropped_.fetch_add(skipped, std::memory_order_acq_rel);
+  }
+}
+
+bool Publisher::enqueue(json_ref&& payload, w_string coalesceKey) {
   std::vector<std::shared_ptr<Subscriber>> subscribers;
 
   {
@@ -158,14 +210,17 @@ bool Publisher::enqueue(json_ref&& payload) {
       }
     }
 
-    wlock->collectGarbage();
-
     if (subscribers.empty()) {
+      wlock->collectGarbage();
       return false;
     }
 
-    wlock->items.emplace_back(
-        std::make_shared<Item>(wlock->nextSerial++, std::move(payload)));
+    wlock->items.emplace_back(std::make_shared<Item>(
+        wlock->nextSerial++, std::move(payload), std::move(coalesceKey)));
+    if (maxItems_ && wlock->items.size() > maxItems_) {
+      wlock->enforceLimit(maxItems_, policy_, subscribers);
+    }
+    wlock->collectGarbage();
   }
 
   // and notify them outside of the lock
@@ -189,8 +244,17 @@ json_ref Publisher::getDebugInfo() const {
   for (auto& sub_ref : rlock->subscribers) {
     auto sub = sub_ref.lock();
     if (sub) {
+      // The number of queued items it has yet to see
+      int64_t lag = 0;
+      for (auto& item : rlock->items) {
+        if (item->serial > sub->getSerial()) {
+          ++lag;
+        }
+      }
       auto sub_json = json_object({
           {"serial", json_integer(sub->getSerial())},
+          {"lag", json_integer(lag)},
+          {"dropped", json_integer(sub->totalDropped_)},
       });
       if (auto& info = sub->getInfo()) {
         sub_json.set("info", json_ref(*info));
@@ -11,6 +11,7 @@
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
 
+#include <atomic>
 #include <deque>
 #include <functional>
 #include <vector>
@@ -20,13 +21,26 @@ namespace watchman {
 class Publisher : public std::enable_shared_from_this<Publisher> {
  public:
   struct Item {
-    Item(uint64_t s, json_ref p) : serial{s}, payload{std::move(p)} {}
+    Item(uint64_t s, json_ref p, w_string key = {})
+        : serial{s}, payload{std::move(p)}, coalesceKey{std::move(key)} {}
 
     // copy of nextSerial_ at the time this was created.
     // The item can be released when all subscribers have
     // observed this serial number.
     uint64_t serial;
     json_ref payload;
+    // If set, this item is superseded by any later item with the same key.
+    w_string coalesceKey;
+  };
+
+  // What happens to a subscriber that falls more than the publisher's
+  // maxItems behind.
+  enum class OverflowPolicy {
+    // Its oldest unseen items are skipped, and counted as dropped.
+    Drop,
+    // It only loses items that have been superseded by a later item with
+    // the same coalesce key; everything else is kept for it.
+    Coalesce,
   };
 
   // Generic callback that subscribers can register to arrange
@@ -38,6 +52,12 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
     // The serial of the last Item to be consumed by
     // this subscriber.
     uint64_t serial_;
+    // Items skipped because this subscriber fell behind, in total and since
+    // the last takeDropped().
+    uint64_t totalDropped_{0};
+    std::atomic<uint64_t> dropped_{0};
+
+    friend class Publisher;
     // Subscriber keeps the publisher alive so that no Items are lost
     // if the Publisher is released before all of the subscribers.
     std::shared_ptr<Publisher> publisher_;
@@ -61,6 +81,12 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
       return serial_;
     }
 
+    // Returns how many items were dropped for this subscriber since the last
+    // call, so that it can tell its consumer.
+    uint64_t takeDropped() {
+      return dropped_.exchange(0, std::memory_order_acq_rel);
+    }
+
     Notifier& getNotify() {
       return notify_;
     }
@@ -70,6 +96,15 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
     }
   };
 
+  // An unbounded publisher: items are kept until every subscriber has seen
+  // them.
+  Publisher() = default;
+
+  // Keep no more than `maxItems` items that some subscriber has yet to see,
+  // other than those that `policy` says must not be lost.
+  Publisher(size_t maxItems, OverflowPolicy policy)
+      : maxItems_{maxItems}, policy_{policy} {}
+
   // Register a new subscriber.
   // When the Subscriber object is released, the registration is
   // automatically removed.
@@ -82,9 +117,15 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
   // if there are no current subscribers.
   bool hasSubscribers() const;
 
+  // Returns the number of items held for subscribers that have yet to see
+  // them.
+  size_t getItemCount() const;
+
   // Enqueue a new item, but only if there are subscribers.
   // Returns true if the item was queued.
-  bool enqueue(json_ref&& payload);
+  // A non-empty `coalesceKey` allows the item to be discarded, unseen,
+  // once a later item with the same key has been queued.
+  bool enqueue(json_ref&& payload, w_string coalesceKey = {});
 
   // Return debugging info useful for state inspection.
   json_ref getDebugInfo() const;
@@ -99,11 +140,20 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
     std::deque<std::shared_ptr<const Item>> items;
     // The subscribers
     std::vector<std::weak_ptr<Subscriber>> subscribers;
+    // Coalescing is linear in the size of items, so wait for items to double
+    // before doing it again.
+    size_t compactAt{0};
 
     void collectGarbage();
-    void enqueue(json_ref&& payload);
+    void enforceLimit(
+        size_t maxItems,
+        OverflowPolicy policy,
+        const std::vector<std::shared_ptr<Subscriber>>& live);
   };
   folly::Synchronized<state> state_;
+  // 0 means unbounded
+  const size_t maxItems_{0};
+  const OverflowPolicy policy_{OverflowPolicy::Drop};
 
   friend class Subscriber;
 };
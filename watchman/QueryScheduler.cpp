@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/QueryScheduler.h"
+#include <folly/system/HardwareConcurrency.h>
+#include <algorithm>
+#include "watchman/Errors.h"
+#include "watchman/WatchmanConfig.h"
+
+namespace watchman {
+
+QueryScheduler::Ticket::~Ticket() {
+  if (!scheduler_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock{scheduler_->mutex_};
+    scheduler_->finish(client_, root_);
+    scheduler_->dispatch();
+  }
+  scheduler_->cond_.notify_all();
+}
+
+QueryScheduler::QueryScheduler(Limits limits)
+    : limits_{
+          std::max<size_t>(limits.maxRunning, 1),
+          std::max<size_t>(limits.maxPerClient, 1),
+          std::max<size_t>(limits.maxPerRoot, 1),
+          std::max<size_t>(limits.interactiveWeight, 1)} {}
+
+QueryScheduler::Ticket QueryScheduler::admit(
+    pid_t client,
+    const w_string& root,
+    QueryPriority priority,
+    std::chrono::milliseconds timeout) {
+  auto queued = std::chrono::steady_clock::now();
+  Waiter waiter{client, &root, priority};
+
+  std::unique_lock<std::mutex> lock{mutex_};
+  // Even when there is a free slot, go through the queue so that a query
+  // can't jump ahead of waiters that the limits are holding back.
+  waiters_.push_back(&waiter);
+  dispatch();
+  cond_.notify_all();
+  if (!cond_.wait_for(lock, timeout, [&] { return waiter.admitted; })) {
+    waiters_.remove(&waiter);
+    ++timedOut_;
+    QueryExecError::throwf(
+        "timed out after {}ms waiting for other queries to finish",
+        timeout.count());
+  }
+  maxQueueWait_ = std::max(
+      maxQueueWait_,
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - queued));
+  return Ticket{this, client, root};
+}
+
+QueryScheduler::Stats QueryScheduler::getStats() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  Stats stats{
+      running_,
+      0,
+      0,
+      admittedInteractive_,
+      admittedBatch_,
+      timedOut_,
+      maxQueueWait_};
+  for (auto* waiter : waiters_) {
+    if (waiter->priority == QueryPriority::Interactive) {
+      ++stats.queuedInteractive;
+    } else {
+      ++stats.queuedBatch;
+    }
+  }
+  return stats;
+}
+
+bool QueryScheduler::canRun(pid_t client, const w_string& root) const {
+  // Unattributed queries aren't counted in runningPerClient_, so they never
+  // hit the per-client limit.
+  auto clientIt = runningPerClient_.find(client);
+  if (clientIt != runningPerClient_.end() &&
+      clientIt->second >= limits_.maxPerClient) {
+    return false;
+  }
+  auto rootIt = runningPerRoot_.find(root);
+  return rootIt == runningPerRoot_.end() ||
+      rootIt->second < limits_.maxPerRoot;
+}
+
+void QueryScheduler::start(pid_t client, const w_string& root) {
+  ++running_;
+  if (client != kUnattributed) {
+    ++runningPerClient_[client];
+  }
+  ++runningPerRoot_[root];
+}
+
+void QueryScheduler::finish(pid_t client, const w_string& root) {
+  --running_;
+  if (client != kUnattributed) {
+    auto clientIt = runningPerClient_.find(client);
+    if (--clientIt->second == 0) {
+      runningPerClient_.erase(clientIt);
+    }
+  }
+  auto rootIt = runningPerRoot_.find(root);
+  if (--rootIt->second == 0) {
+    runningPerRoot_.erase(rootIt);
+  }
+}
+
+std::list<QueryScheduler::Waiter*>::iterator QueryScheduler::pick(
+    QueryPriority priority) {
+  auto best = waiters_.end();
+  size_t bestRunning = 0;
+  for (auto it = waiters_.begin(); it != waiters_.end(); ++it) {
+    auto* waiter = *it;
+    if (waiter->priority != priority ||
+        !canRun(waiter->client, *waiter->root)) {
+      continue;
+    }
+    auto clientIt = runningPerClient_.find(waiter->client);
+    size_t clientRunning =
+        clientIt == runningPerClient_.end() ? 0 : clientIt->second;
+    if (best == waiters_.end() || clientRunning < bestRunning) {
+      best = it;
+      bestRunning = clientRunning;
+    }
+  }
+  return best;
+}
+
+void QueryScheduler::dispatch() {
+  while (running_ < limits_.maxRunning) {
+    auto interactive = pick(QueryPriority::Interactive);
+    auto batch = pick(QueryPriority::Batch);
+
+    std::list<Waiter*>::iterator next;
+    if (interactive != waiters_.end() &&
+        (batch == waiters_.end() ||
+         interactiveStreak_ < limits_.interactiveWeight)) {
+      next = interactive;
+      interactiveStreak_ = batch == waiters_.end() ? 0 : interactiveStreak_ + 1;
+      ++admittedInteractive_;
+    } else if (batch != waiters_.end()) {
+      next = batch;
+      interactiveStreak_ = 0;
+      ++admittedBatch_;
+    } else {
+      return;
+    }
+
+    auto* waiter = *next;
+    waiters_.erase(next);
+    waiter->admitted = true;
+    start(waiter->client, *waiter->root);
+  }
+}
+
+QueryScheduler& getQueryScheduler() {
+  static QueryScheduler scheduler{[] {
+    auto maxRunning = cfg_get_int(
+        "query_max_concurrency",
+        std::max<json_int_t>(4, folly::hardware_concurrency()));
+    return QueryScheduler::Limits{
+        size_t(maxRunning),
+        size_t(cfg_get_int(
+            "query_max_per_client", std::max<json_int_t>(1, maxRunning / 2))),
+        size_t(cfg_get_int("query_max_per_root", maxRunning)),
+        size_t(cfg_get_int("query_interactive_weight", 4)),
+    };
+  }()};
+  return scheduler;
+}
+
+} // namespace watchman
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include "watchman/watchman_string.h"
+#include "watchman/watchman_system.h"
+
+namespace watchman {
+
+enum class QueryPriority {
+  // A person is waiting on the results
+  Interactive,
+  // Scripts, indexers and the like, which can wait
+  Batch,
+};
+
+/**
+ * Decides when each query may start evaluating against its view, so that no
+ * one client can occupy every core.
+ *
+ * At most maxRunning queries run at once, at most maxPerClient of them for
+ * any one client and at most maxPerRoot of them against any one root.
+ * Queries beyond those limits wait in a queue.  When a slot frees up, the
+ * waiting interactive queries get interactiveWeight turns for each turn of
+ * the waiting batch queries, and within each priority the client with the
+ * fewest running queries goes first, the earliest arrival breaking ties.
+ *
+ * Triggers, queries that watchman runs for itself and clients whose peer
+ * pid the platform can't tell us all arrive as kUnattributed.  Those are
+ * not one client, so the per-client limit doesn't apply to them; they are
+ * still held to maxRunning and maxPerRoot.
+ */
+class QueryScheduler {
+ public:
+  struct Limits {
+    size_t maxRunning;
+    size_t maxPerClient;
+    size_t maxPerRoot;
+    size_t interactiveWeight;
+  };
+
+  /// The client of a query that doesn't come from a known peer process.
+  static constexpr pid_t kUnattributed = 0;
+
+  /// Holds a running slot for as long as it is alive.
+  class Ticket {
+   public:
+    Ticket(Ticket&& other) noexcept
+        : scheduler_{std::exchange(other.scheduler_, nullptr)},
+          client_{other.client_},
+          root_{std::move(other.root_)} {}
+    Ticket& operator=(Ticket&&) = delete;
+    ~Ticket();
+
+   private:
+    Ticket(QueryScheduler* scheduler, pid_t client, w_string root)
+        : scheduler_{scheduler}, client_{client}, root_{std::move(root)} {}
+
+    QueryScheduler* scheduler_;
+    pid_t client_;
+    w_string root_;
+
+    friend class QueryScheduler;
+  };
+
+  struct Stats {
+    size_t running;
+    size_t queuedInteractive;
+    size_t queuedBatch;
+    uint64_t admittedInteractive;
+    uint64_t admittedBatch;
+    uint64_t timedOut;
+    // The longest time that a query has waited in the queue
+    std::chrono::microseconds maxQueueWait;
+  };
+
+  explicit QueryScheduler(Limits limits);
+
+  /**
+   * Blocks until the query may run, and returns its slot.  Throws
+   * QueryExecError if that takes longer than timeout.
+   */
+  Ticket admit(
+      pid_t client,
+      const w_string& root,
+      QueryPriority priority,
+      std::chrono::milliseconds timeout);
+
+  Stats getStats() const;
+
+ private:
+  struct Waiter {
+    pid_t client;
+    const w_string* root;
+    QueryPriority priority;
+    bool admitted{false};
+  };
+
+  bool canRun(pid_t client, const w_string& root) const;
+  void start(pid_t client, const w_string& root);
+  void finish(pid_t client, const w_string& root);
+  // Admits as many waiters as the limits allow.  Requires mutex_.
+  void dispatch();
+  // Returns the waiter of the given priority that should run next, or
+  // waiters_.end().
+  std::list<Waiter*>::iterator pick(QueryPriority priority);
+
+  const Limits limits_;
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  // In order of arrival
+  std::list<Waiter*> waiters_;
+  size_t running_{0};
+  std::unordered_map<pid_t, size_t> runningPerClient_;
+  std::unordered_map<w_string, size_t> runningPerRoot_;
+  // Interactive admissions since the last batch admission, while batch
+  // queries were waiting
+  size_t interactiveStreak_{0};
+  uint64_t admittedInteractive_{0};
+  uint64_t admittedBatch_{0};
+  uint64_t timedOut_{0};
+  std::chrono::microseconds maxQueueWait_{0};
+};
+
+/// The scheduler shared by every root in the process, with the limits from
+/// the global configuration.
+QueryScheduler& getQueryScheduler();
+
+} // namespace watchman
@@ -7,6 +7,10 @@
 
 #include "watchman/QueryableView.h"
 #include "watchman/Errors.h"
+#include "watchman/query/LocalFileResult.h"
+#include "watchman/query/QueryContext.h"
+#include "watchman/query/eval.h"
+#include "watchman/root/Root.h"
 #include "watchman/scm/SCM.h"
 
 namespace watchman {
@@ -14,6 +18,12 @@ namespace watchman {
 QueryableView::QueryableView(const w_string& root_path, bool requiresCrawl)
     : requiresCrawl{requiresCrawl}, scm_(SCM::scmForPath(root_path)) {}
 
+QueryableView::QueryableView(
+    const w_string&,
+    bool requiresCrawl,
+    std::unique_ptr<SCM> scm)
+    : requiresCrawl{requiresCrawl}, scm_(std::move(scm)) {}
+
 QueryableView::~QueryableView() = default;
 
 /** Perform a time-based (since) query and emit results to the supplied
@@ -35,6 +45,56 @@ void QueryableView::allFilesGenerator(const Query*, QueryContext*) const {
   throw QueryExecError("allFilesGenerator not implemented");
 }
 
+std::shared_ptr<ChangedFileCollector> QueryableView::collectChangedFiles(
+    const Query*) {
+  return nullptr;
+}
+
+void QueryableView::changedFilesGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    ChangedFileCollector&) const {
+  timeGenerator(query, ctx);
+}
+
+void QueryableView::scmChangesGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const std::vector<w_string>& paths,
+    ClockStamp clock) const {
+  auto& root = ctx->root;
+  for (const auto& path : paths) {
+    auto fullPath = w_string::pathCat({root->root_path, path});
+    if (!ctx->fileMatchesRelativeRoot(fullPath)) {
+      continue;
+    }
+    // Note well!  At the time of writing the LocalFileResult class
+    // assumes that removed entries must have been regular files.
+    // We don't have enough information returned from
+    // getFilesChangedSinceMergeBaseWith() to distinguish between
+    // deleted files and deleted symlinks.  Also, it is not possible
+    // to see a directory returned from that call; we're only going
+    // to enumerate !dirs for this case.
+    w_query_process_file(
+        query,
+        ctx,
+        std::make_unique<LocalFileResult>(
+            fullPath, clock, root->case_sensitive));
+  }
+}
+
+std::shared_ptr<SubscriptionRoute> QueryableView::routeSubscription(
+    const Query*) {
+  return nullptr;
+}
+
+bool QueryableView::isUnchangedInScope(
+    const SubscriptionRoute&,
+    ClockPosition,
+    ClockPosition) const {
+  return false;
+}
+
 ClockTicks QueryableView::getLastAgeOutTickValue() const {
   return 0;
 }
@@ -47,6 +107,11 @@ std::chrono::system_clock::time_point QueryableView::getLastAgeOutTimeStamp()
 void QueryableView::ageOut(int64_t&, int64_t&, int64_t&, std::chrono::seconds) {
 }
 
+void QueryableView::compactTombstones(
+    int64_t&,
+    int64_t&,
+    std::chrono::seconds) {}
+
 bool QueryableView::isVCSOperationInProgress() const {
   static const std::vector<w_string> lockFiles{".hg/wlock", ".git/index.lock"};
   return doAnyOfTheseFilesExist(lockFiles);
@@ -8,6 +8,7 @@
 #pragma once
 
 #include <folly/futures/Future.h>
+#include <chrono>
 #include <vector>
 
 #include "watchman/Clock.h"
@@ -18,11 +19,37 @@
 
 namespace watchman {
 
+class ChangedFileCollector;
+class SubscriptionRoute;
 struct Query;
 struct QueryContext;
 class Root;
 class SCM;
 
+/**
+ * Estimated bytes held by a view, broken down by where they are held.
+ */
+struct ViewMemoryUsage {
+  size_t viewBytes{0};
+  size_t pendingBytes{0};
+  size_t contentHashCacheBytes{0};
+  size_t symlinkCacheBytes{0};
+};
+
+/**
+ * When the most recent change went through each stage of a view's
+ * pipeline, for reporting where notification latency goes.  A stage that
+ * hasn't happened yet, or that the view doesn't have, is the epoch.
+ */
+struct ViewPipelineTimes {
+  // The notify thread handed the change to the IO thread
+  std::chrono::system_clock::time_point notified;
+  // The IO thread applied it to the view
+  std::chrono::system_clock::time_point processed;
+  // The view settled after it
+  std::chrono::system_clock::time_point settled;
+};
+
 class QueryableView : public std::enable_shared_from_this<QueryableView> {
  public:
   /**
@@ -31,6 +58,12 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
   const bool requiresCrawl;
 
   QueryableView(const w_string& root_path, bool requiresCrawl);
+  // For views that know a better way to answer SCM queries for root_path
+  // than SCM::scmForPath() finds
+  QueryableView(
+      const w_string& root_path,
+      bool requiresCrawl,
+      std::unique_ptr<SCM> scm);
   virtual ~QueryableView();
 
   /**
@@ -48,6 +81,52 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
 
   virtual void allFilesGenerator(const Query* query, QueryContext* ctx) const;
 
+  /**
+   * Returns a collector that gathers the files that change from now on and
+   * may match the query's expression, for use with changedFilesGenerator,
+   * or nullptr if this view cannot narrow the changes down for the query.
+   */
+  virtual std::shared_ptr<ChangedFileCollector> collectChangedFiles(
+      const Query* query);
+
+  /**
+   * Produces the same files as timeGenerator, or a subset that still holds
+   * every file the query's expression can match, by considering only the
+   * files gathered by `collector`.
+   */
+  virtual void changedFilesGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      ChangedFileCollector& collector) const;
+
+  /**
+   * Produces a file for each of `paths`, relative to the root, that source
+   * control reported as changed since a new merge base, for scm-aware
+   * queries.  Each is reported as having changed at `clock`.
+   */
+  virtual void scmChangesGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const std::vector<w_string>& paths,
+      ClockStamp clock) const;
+
+  /**
+   * Registers the query of a subscription with this view, so that
+   * isUnchangedInScope can tell whether anything the query may produce
+   * results from changed, or returns nullptr if this view cannot tell.
+   */
+  virtual std::shared_ptr<SubscriptionRoute> routeSubscription(
+      const Query* query);
+
+  /**
+   * Whether nothing that the query routed by `route` may produce results
+   * from changed after `since`, up to `now`.  False if that isn't known.
+   */
+  virtual bool isUnchangedInScope(
+      const SubscriptionRoute& route,
+      ClockPosition since,
+      ClockPosition now) const;
+
   virtual ClockPosition getMostRecentRootNumberAndTickValue() const = 0;
   virtual w_string getCurrentClockString() const = 0;
   virtual ClockTicks getLastAgeOutTickValue() const;
@@ -58,6 +137,15 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
       int64_t& dirs,
       std::chrono::seconds minAge);
 
+  /**
+   * Compacts the files that were deleted at least minAge ago into tombstones
+   * that take a fraction of the memory of a file node.
+   */
+  virtual void compactTombstones(
+      int64_t& walked,
+      int64_t& files,
+      std::chrono::seconds minAge);
+
   virtual folly::SemiFuture<folly::Unit> waitForSettle(
       std::chrono::milliseconds settle_period) = 0;
   virtual CookieSync::SyncResult syncToNow(
@@ -95,12 +183,57 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
    */
   virtual void wakeThreads() {}
 
+  /**
+   * Returns an estimate of the memory held by this view.  Views that do not
+   * keep the tree in memory report nothing.
+   */
+  virtual ViewMemoryUsage getMemoryUsage() const {
+    return {};
+  }
+  /**
+   * Releases memory that can be rebuilt on demand, such as caches.
+   */
+  virtual void shrinkMemory() {}
+
+  /**
+   * Returns a number that changes whenever a file that queries can observe
+   * changes or is removed, or nullopt if the view can't tell.  Unlike the
+   * tick, it doesn't move for cookie syncs, so while it stays the same a
+   * repeated query will produce the same results.
+   */
+  virtual std::optional<uint64_t> getContentGeneration() const {
+    return std::nullopt;
+  }
+
+  virtual ViewPipelineTimes getPipelineTimes() const {
+    return {};
+  }
+
   virtual const w_string& getName() const = 0;
   virtual json_ref getWatcherDebugInfo() const = 0;
   virtual void clearWatcherDebugInfo() = 0;
   FOLLY_NODISCARD virtual folly::SemiFuture<folly::Unit>
   waitUntilReadyToQuery() = 0;
 
+  /**
+   * Called before a query is evaluated. Views that defer part of their crawl
+   * return a SemiFuture that completes once the parts of the tree the query
+   * may produce results from are crawled.
+   */
+  FOLLY_NODISCARD virtual folly::SemiFuture<folly::Unit> crawlForQuery(
+      const Query* /*query*/) {
+    return folly::makeSemiFuture();
+  }
+
+  /**
+   * Returns true if the initial crawl is still running but already covered
+   * the parts of the tree that the query may produce results from, so the
+   * query can be answered without waiting for the crawl to end.
+   */
+  virtual bool isCrawledForQuery(const Query* /*query*/) const {
+    return false;
+  }
+
   // Return the SCM detected for this watched root
   SCM* getSCM() const {
     return scm_.get();
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <unordered_set>
+#include <vector>
+#include "watchman/Clock.h"
+
+namespace watchman {
+
+/**
+ * Block index over a recency list: a singly-linked list of nodes, linked
+ * through `next`, that is ordered newest first by `otime.ticks` because
+ * nodes are only ever (re)inserted at its head with the current tick.
+ *
+ * Every `blockSize` insertions, the node just inserted is recorded as a
+ * checkpoint along with its tick. Since the list is sorted, every node ahead
+ * of a checkpoint has a tick at least as large, which lets seek() jump to
+ * within about a block of any tick instead of walking the list from its head.
+ * A checkpoint is stale once its node has been moved to the head with a new
+ * tick; stale checkpoints are skipped, and swept out as new ones are added.
+ *
+ * Checkpoints point at the nodes, so rebuild() must be called whenever nodes
+ * are freed.
+ */
+template <typename Node>
+class RecencyIndex {
+ public:
+  static constexpr size_t kDefaultBlockSize = 256;
+
+  explicit RecencyIndex(size_t blockSize = kDefaultBlockSize)
+      : blockSize_{std::max(size_t(1), blockSize)} {}
+
+  /**
+   * Must be called each time a node is inserted at the head of the list,
+   * after its tick has been updated.
+   */
+  void nodeInserted(Node* node) {
+    if (++sinceLastCheckpoint_ < blockSize_) {
+      return;
+    }
+    // At most one checkpoint per tick keeps them strictly ordered along the
+    // list. The earliest one in the tick is kept as it reaches furthest.
+    auto ticks = node->otime.ticks;
+    if (!checkpoints_.empty() && checkpoints_.back().ticks >= ticks) {
+      return;
+    }
+    if (checkpoints_.size() >= nextSweep_) {
+      checkpoints_.erase(
+          std::remove_if(
+              checkpoints_.begin(),
+              checkpoints_.end(),
+              [](const Checkpoint& c) { return !c.isValid(); }),
+          checkpoints_.end());
+      nextSweep_ = std::max(kMinSweepSize, 2 * checkpoints_.size());
+    }
+    checkpoints_.push_back({ticks, node});
+    sinceLastCheckpoint_ = 0;
+  }
+
+  /**
+   * Discards all checkpoints and records new ones from the list at head.
+   */
+  void rebuild(Node* head) {
+    clear();
+    size_t count = 0;
+    for (Node* node = head; node; node = node->next) {
+      // Checkpoint the deepest node of each tick
+      bool lastOfTick =
+          !node->next || node->next->otime.ticks != node->otime.ticks;
+      if (++count >= blockSize_ && lastOfTick) {
+        checkpoints_.push_back({node->otime.ticks, node});
+        count = 0;
+      }
+    }
+    std::reverse(checkpoints_.begin(), checkpoints_.end());
+  }
+
+  /**
+   * Drops any checkpoints at the nodes of `removed`, which have been unlinked
+   * from the list. Cheaper than rebuild() when most of the list remains, but
+   * leaves the checkpoints sparser.
+   */
+  void nodesRemoved(const std::unordered_set<const Node*>& removed) {
+    checkpoints_.erase(
+        std::remove_if(
+            checkpoints_.begin(),
+            checkpoints_.end(),
+            [&](const Checkpoint& c) { return removed.count(c.node) != 0; }),
+        checkpoints_.end());
+  }
+
+  void clear() {
+    checkpoints_.clear();
+    sinceLastCheckpoint_ = 0;
+    nextSweep_ = kMinSweepSize;
+  }
+
+  /**
+   * Returns the first node of the list at head whose tick is at or before
+   * `ticks`, or nullptr if there is none. Every node ahead of it changed
+   * after `ticks`.
+   */
+  Node* seek(Node* head, ClockTicks ticks) const {
+    Node* node = head;
+    auto it = firstCheckpointAfter(ticks);
+    if (it != checkpoints_.end()) {
+      node = it->node;
+    }
+    while (node && node->otime.ticks > ticks) {
+      node = node->next;
+    }
+    return node;
+  }
+
+  /**
+   * Calls func on each node of the list at head whose tick is after
+   * `ticks`, oldest first, until func returns false.
+   */
+  template <typename Func>
+  void forEachAfterOldestFirst(Node* head, ClockTicks ticks, Func&& func)
+      const {
+    // Visit the stretches between consecutive checkpoints from the oldest,
+    // reversing each one through a buffer of about a block.
+    std::vector<Node*> stretch;
+    Node* stop = nullptr;
+    auto visit = [&](Node* start) {
+      stretch.clear();
+      for (Node* node = start;
+           node && node != stop && node->otime.ticks > ticks;
+           node = node->next) {
+        stretch.push_back(node);
+      }
+      stop = start;
+      for (auto node = stretch.rbegin(); node != stretch.rend(); ++node) {
+        if (!func(*node)) {
+          return false;
+        }
+      }
+      return true;
+    };
+
+    for (auto it = firstCheckpointAfter(ticks); it != checkpoints_.end();
+         ++it) {
+      if (it->isValid() && !visit(it->node)) {
+        return;
+      }
+    }
+    if (head) {
+      visit(head);
+    }
+  }
+
+  size_t numCheckpoints() const {
+    return checkpoints_.size();
+  }
+
+ private:
+  // Sweeping is deferred until there are at least this many checkpoints
+  static constexpr size_t kMinSweepSize = 64;
+
+  struct Checkpoint {
+    ClockTicks ticks;
+    Node* node;
+
+    bool isValid() const {
+      return node->otime.ticks == ticks;
+    }
+  };
+
+  // Returns the first valid checkpoint with a tick after `ticks`
+  typename std::vector<Checkpoint>::const_iterator firstCheckpointAfter(
+      ClockTicks ticks) const {
+    auto it = std::upper_bound(
+        checkpoints_.begin(),
+        checkpoints_.end(),
+        ticks,
+        [](ClockTicks t, const Checkpoint& c) { return t < c.ticks; });
+    while (it != checkpoints_.end() && !it->isValid()) {
+      ++it;
+    }
+    return it;
+  }
+
+  const size_t blockSize_;
+  size_t sinceLastCheckpoint_{0};
+  size_t nextSweep_{kMinSweepSize};
+  // Ordered by strictly increasing tick, and so from the tail of the list
+  // towards its head.
+  std::vector<Checkpoint> checkpoints_;
+};
+
+} // namespace watchman
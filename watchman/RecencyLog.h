@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <unordered_set>
+#include <vector>
+#include "watchman/Clock.h"
+
+namespace watchman {
+
+/**
+ * A contiguous copy of the hot fields of a recency list (see RecencyIndex):
+ * for each change to a node, its new tick, the node and its parent, in the
+ * order the changes were made.
+ *
+ * Walking the recency list for the changes since a tick misses the cache on
+ * every node, as the nodes are scattered across the heap.  Scanning the log
+ * instead only reads contiguous memory until a change passes the caller's
+ * filter on the parent, such as a relative root, so the nodes that the
+ * filter rejects are never touched.
+ *
+ * A change to a node leaves its earlier entries in place; they are
+ * recognized as stale because the node's tick has since moved on, and are
+ * swept out once they make up about half of the log.  A node changed again
+ * within the same tick keeps its existing entry.
+ *
+ * The entries point at the nodes, so nodesRemoved() or rebuild() must be
+ * called whenever nodes are freed.
+ */
+template <typename Node>
+class RecencyLog {
+ public:
+  using Parent = decltype(Node::parent);
+
+  struct Entry {
+    ClockTicks ticks;
+    Node* node;
+    Parent parent;
+
+    bool isValid() const {
+      return node->otime.ticks == ticks;
+    }
+  };
+
+  /**
+   * Must be called each time a node is moved to the head of the recency
+   * list, after its tick has been updated.  `wasListed` tells whether the
+   * node was in the list before, with `previousTicks` as its tick.
+   */
+  void nodeChanged(Node* node, bool wasListed, ClockTicks previousTicks) {
+    if (wasListed && previousTicks == node->otime.ticks) {
+      return;
+    }
+    if (entries_.size() >= nextSweep_) {
+      sweep();
+    }
+    entries_.push_back({node->otime.ticks, node, node->parent});
+  }
+
+  /**
+   * Discards all entries and records the nodes of the list at head.
+   */
+  void rebuild(Node* head) {
+    clear();
+    for (Node* node = head; node; node = node->next) {
+      entries_.push_back({node->otime.ticks, node, node->parent});
+    }
+    std::reverse(entries_.begin(), entries_.end());
+    nextSweep_ = std::max(kMinSweepSize, 2 * entries_.size());
+  }
+
+  /**
+   * Drops the entries of `removed`, which have been unlinked from the list.
+   */
+  void nodesRemoved(const std::unordered_set<const Node*>& removed) {
+    entries_.erase(
+        std::remove_if(
+            entries_.begin(),
+            entries_.end(),
+            [&](const Entry& e) { return removed.count(e.node) != 0; }),
+        entries_.end());
+  }
+
+  void clear() {
+    entries_.clear();
+    nextSweep_ = kMinSweepSize;
+  }
+
+  /**
+   * Calls func on each node that changed after `ticks` and whose parent is
+   * accepted by `filter`, newest first, until func returns false.  `walked`
+   * is incremented for each entry that is scanned.  Nodes are only read for
+   * entries whose parent is accepted.
+   */
+  template <typename Filter, typename Func>
+  void forEachAfter(
+      ClockTicks ticks,
+      Filter&& filter,
+      Func&& func,
+      size_t& walked) const {
+    for (auto it = entries_.rbegin();
+         it != entries_.rend() && it->ticks > ticks;
+         ++it) {
+      ++walked;
+      if (!filter(it->parent) || !it->isValid()) {
+        continue;
+      }
+      if (!func(it->node)) {
+        return;
+      }
+    }
+  }
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+ private:
+  // Sweeping is deferred until there are at least this many entries
+  static constexpr size_t kMinSweepSize = 1024;
+
+  void sweep() {
+    entries_.erase(
+        std::remove_if(
+            entries_.begin(),
+            entries_.end(),
+            [](const Entry& e) { return !e.isValid(); }),
+        entries_.end());
+    nextSweep_ = std::max(kMinSweepSize, 2 * entries_.size());
+  }
+
+  size_t nextSweep_{kMinSweepSize};
+  // Ordered by non-decreasing tick
+  std::vector<Entry> entries_;
+};
+
+} // namespace watchman
@@ -44,7 +44,7 @@ namespace detail {
 
 class FieldEncoder {
  public:
-  explicit FieldEncoder(std::unordered_map<w_string, json_ref>& map)
+  explicit FieldEncoder(json_object_map& map)
       : map_{map} {}
 
   template <size_t N, typename T>
@@ -60,12 +60,12 @@ class FieldEncoder {
   void skip_if_default(const char (&name)[N], const T& field);
 
  private:
-  std::unordered_map<w_string, json_ref>& map_;
+  json_object_map& map_;
 };
 
 class FieldDecoder {
  public:
-  explicit FieldDecoder(const std::unordered_map<w_string, json_ref>& map)
+  explicit FieldDecoder(const json_object_map& map)
       : map_{map} {}
 
   template <size_t N, typename T>
@@ -81,7 +81,7 @@ class FieldDecoder {
   void skip_if_default(const char (&name)[N], T& field);
 
  private:
-  const std::unordered_map<w_string, json_ref>& map_;
+  const json_object_map& map_;
 };
 
 } // namespace detail
@@ -142,7 +142,7 @@ struct Serde {
       "T must either derive Object or provide a Serde specialization");
 
   static json_ref toJson(const T& v) {
-    std::unordered_map<w_string, json_ref> o;
+    json_object_map o;
     detail::FieldEncoder encoder{o};
     // The const_cast is gross, but allowing `map` to run in both read and write
     // contexts would otherwise require an additional template parameter.
@@ -378,7 +378,7 @@ struct Serde<std::vector<T>> {
 template <typename V>
 struct Serde<std::map<w_string, V>> {
   static json_ref toJson(const std::map<w_string, V>& m) {
-    std::unordered_map<w_string, json_ref> o;
+    json_object_map o;
     o.reserve(m.size());
     for (auto& [name, value] : m) {
       o.insert_or_assign(name, encode(value));
@@ -452,8 +452,7 @@ void FieldEncoder::skip_if_default(const char (&name)[N], const T& field) {
 
 template <size_t N, typename T>
 void FieldDecoder::operator()(const char (&name)[N], T& field) {
-  // TODO: per-field allocation, yikes
-  auto iter = map_.find(w_string{name});
+  auto iter = map_.find(w_string_piece{name, N - 1});
   if (iter == map_.end()) {
     field = T{};
   } else {
@@ -463,8 +462,7 @@ void FieldDecoder::operator()(const char (&name)[N], T& field) {
 
 template <size_t N, typename T>
 void FieldDecoder::required(const char (&name)[N], T& field) {
-  // TODO: per-field allocation, yikes
-  auto iter = map_.find(w_string{name});
+  auto iter = map_.find(w_string_piece{name, N - 1});
   if (iter == map_.end()) {
     throw MissingKey{"key is missing"};
   } else {
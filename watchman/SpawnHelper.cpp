@@ -0,0 +1,592 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SpawnHelper.h"
+#include <folly/String.h>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "watchman/Logging.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace watchman {
+
+namespace {
+std::unique_ptr<SpawnHelper> helper;
+}
+
+SpawnHelper* SpawnHelper::get() {
+  return helper.get();
+}
+
+SpawnHelper::SpawnHelper(FileDescriptor sock, pid_t helperPid)
+    : sock_(std::move(sock)), helperPid_(helperPid) {}
+
+#ifndef __linux__
+
+bool SpawnHelper::start() {
+  return false;
+}
+
+std::optional<int> SpawnHelper::spawn(
+    pid_t&,
+    char* const*,
+    char* const*,
+    const ChildProcess::Options&) {
+  return std::nullopt;
+}
+
+#else
+
+namespace {
+
+// Requests carry at most this many fds; spawns that need more are made
+// directly by the server.
+constexpr size_t kMaxPassedFds = 16;
+constexpr uint64_t kMaxRequestSize = 64 * 1024 * 1024;
+// Where the helper's child moves the fds it was passed, out of the way of
+// the fds they are to be dup'd onto.
+constexpr int kFirstMovedFd = 256;
+
+constexpr uint32_t kSetPgroup = 1;
+constexpr uint32_t kSetSigMask = 2;
+
+struct FileAction {
+  // Index into the passed fds, or -1 to open path
+  int32_t fdIndex;
+  int32_t targetFd;
+  int32_t flags;
+  int32_t mode;
+  std::string path;
+};
+
+struct Request {
+  uint32_t flags{0};
+  sigset_t sigMask;
+  std::string cwd;
+  std::vector<std::string> argv;
+  std::vector<std::string> envp;
+  std::vector<FileAction> actions;
+};
+
+struct Response {
+  int32_t err;
+  int32_t pid;
+};
+
+class Writer {
+ public:
+  void u32(uint32_t value) {
+    bytes(&value, sizeof(value));
+  }
+
+  void i32(int32_t value) {
+    bytes(&value, sizeof(value));
+  }
+
+  void str(std::string_view value) {
+    u32(value.size());
+    bytes(value.data(), value.size());
+  }
+
+  void bytes(const void* data, size_t size) {
+    auto* p = static_cast<const char*>(data);
+    buf_.insert(buf_.end(), p, p + size);
+  }
+
+  const std::string& buf() const {
+    return buf_;
+  }
+
+ private:
+  std::string buf_;
+};
+
+class Reader {
+ public:
+  explicit Reader(const std::string& buf) : buf_(buf) {}
+
+  bool u32(uint32_t& value) {
+    return bytes(&value, sizeof(value));
+  }
+
+  bool i32(int32_t& value) {
+    return bytes(&value, sizeof(value));
+  }
+
+  bool str(std::string& value) {
+    uint32_t size;
+    if (!u32(size) || size > buf_.size() - pos_) {
+      return false;
+    }
+    value.assign(buf_, pos_, size);
+    pos_ += size;
+    return true;
+  }
+
+  bool bytes(void* data, size_t size) {
+    if (size > buf_.size() - pos_) {
+      return false;
+    }
+    memcpy(data, buf_.data() + pos_, size);
+    pos_ += size;
+    return true;
+  }
+
+ private:
+  const std::string& buf_;
+  size_t pos_{0};
+};
+
+void encodeStrings(Writer& w, const char* const* strs) {
+  uint32_t count = 0;
+  while (strs[count]) {
+    ++count;
+  }
+  w.u32(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    w.str(strs[i]);
+  }
+}
+
+bool decodeStrings(Reader& r, std::vector<std::string>& strs) {
+  uint32_t count;
+  if (!r.u32(count)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    if (!r.str(strs.emplace_back())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool decodeRequest(const std::string& buf, size_t numFds, Request& req) {
+  Reader r{buf};
+  uint32_t numActions;
+  if (!r.u32(req.flags) || !r.bytes(&req.sigMask, sizeof(req.sigMask)) ||
+      !r.str(req.cwd) || !decodeStrings(r, req.argv) ||
+      !decodeStrings(r, req.envp) || !r.u32(numActions)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < numActions; ++i) {
+    auto& action = req.actions.emplace_back();
+    if (!r.i32(action.fdIndex) || !r.i32(action.targetFd) ||
+        !r.i32(action.flags) || !r.i32(action.mode) || !r.str(action.path)) {
+      return false;
+    }
+    if (action.fdIndex >= static_cast<int32_t>(numFds) ||
+        action.targetFd < 0 || action.targetFd >= kFirstMovedFd) {
+      return false;
+    }
+  }
+  return !req.argv.empty();
+}
+
+// Returns false at EOF or on error
+bool readAll(int fd, void* data, size_t size) {
+  auto* p = static_cast<char*>(data);
+  while (size > 0) {
+    auto n = ::read(fd, p, size);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+void writeAll(int fd, const void* data, size_t size) {
+  auto* p = static_cast<const char*>(data);
+  while (size > 0) {
+    auto n = ::send(fd, p, size, MSG_NOSIGNAL);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      throw std::system_error(errno, std::generic_category(), "send");
+    }
+    p += n;
+    size -= n;
+  }
+}
+
+/**
+ * Sends a message to the peer: a length header that carries fds with it,
+ * followed by the payload.
+ */
+void sendMessage(int sock, const std::string& payload, std::vector<int>& fds) {
+  uint64_t size = payload.size();
+  struct iovec iov {
+    &size, sizeof(size)
+  };
+  struct msghdr msg {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  std::vector<char> control;
+  if (!fds.empty()) {
+    control.resize(CMSG_SPACE(sizeof(int) * fds.size()));
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    auto* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+  }
+
+  ssize_t sent;
+  do {
+    sent = ::sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (sent == -1 && errno == EINTR);
+  if (sent == -1) {
+    throw std::system_error(errno, std::generic_category(), "sendmsg");
+  }
+  // The fds went with the first byte; send whatever of the header is left
+  writeAll(sock, reinterpret_cast<char*>(&size) + sent, sizeof(size) - sent);
+  writeAll(sock, payload.data(), payload.size());
+}
+
+/**
+ * Receives a message sent by sendMessage.  Returns false at EOF or if the
+ * message is malformed.  The received fds are close-on-exec.
+ */
+bool receiveMessage(int sock, std::string& payload, std::vector<int>& fds) {
+  uint64_t size;
+  struct iovec iov {
+    &size, sizeof(size)
+  };
+  struct msghdr msg {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t received;
+  do {
+    received = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (received == -1 && errno == EINTR);
+  if (received <= 0) {
+    return false;
+  }
+
+  for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      auto* data = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+      fds.insert(fds.end(), data, data + count);
+    }
+  }
+
+  if ((msg.msg_flags & MSG_CTRUNC) ||
+      !readAll(
+          sock, reinterpret_cast<char*>(&size) + received,
+          sizeof(size) - received) ||
+      size > kMaxRequestSize) {
+    return false;
+  }
+  payload.resize(size);
+  return readAll(sock, payload.data(), size);
+}
+
+std::vector<char*> toPointers(std::vector<std::string>& strs) {
+  std::vector<char*> ptrs;
+  ptrs.reserve(strs.size() + 1);
+  for (auto& str : strs) {
+    ptrs.push_back(str.data());
+  }
+  ptrs.push_back(nullptr);
+  return ptrs;
+}
+
+/**
+ * Runs in the helper's child: sets the process up as posix_spawn would and
+ * execs it.  Only async-signal-safe calls are made here.
+ */
+[[noreturn]] void execChild(
+    Request& req,
+    std::vector<int>& fds,
+    char* const* argv,
+    char* const* envp,
+    int errFd) {
+  auto fail = [&errFd](int err) {
+    ignore_result(::write(errFd, &err, sizeof(err)));
+    _exit(127);
+  };
+
+  // Move everything we need out of the way of the target fds first
+  errFd = fcntl(errFd, F_DUPFD_CLOEXEC, kFirstMovedFd);
+  if (errFd == -1) {
+    _exit(127);
+  }
+  for (auto& fd : fds) {
+    fd = fcntl(fd, F_DUPFD_CLOEXEC, kFirstMovedFd);
+    if (fd == -1) {
+      fail(errno);
+    }
+  }
+
+  if ((req.flags & kSetPgroup) && setpgid(0, 0) == -1) {
+    fail(errno);
+  }
+  if (req.flags & kSetSigMask) {
+    sigprocmask(SIG_SETMASK, &req.sigMask, nullptr);
+  }
+
+  for (auto& action : req.actions) {
+    if (action.fdIndex >= 0) {
+      if (::dup2(fds[action.fdIndex], action.targetFd) == -1) {
+        fail(errno);
+      }
+      continue;
+    }
+    int fd = ::open(action.path.c_str(), action.flags, action.mode);
+    if (fd == -1) {
+      fail(errno);
+    }
+    if (fd != action.targetFd) {
+      if (::dup2(fd, action.targetFd) == -1) {
+        fail(errno);
+      }
+      ::close(fd);
+    }
+  }
+
+  if (!req.cwd.empty() && ::chdir(req.cwd.c_str()) == -1) {
+    fail(errno);
+  }
+
+  execvpe(argv[0], argv, envp);
+  fail(errno);
+  __builtin_unreachable();
+}
+
+Response spawnChild(Request& req, std::vector<int>& fds) {
+  int errPipe[2];
+  if (pipe2(errPipe, O_CLOEXEC) == -1) {
+    return Response{errno, 0};
+  }
+  auto argv = toPointers(req.argv);
+  auto envp = toPointers(req.envp);
+
+  // CLONE_PARENT makes the child a sibling of the helper, which is to say a
+  // child of the server, so that the server can wait for it.
+  auto pid = static_cast<pid_t>(
+      syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0));
+  if (pid == 0) {
+    ::close(errPipe[0]);
+    execChild(req, fds, argv.data(), envp.data(), errPipe[1]);
+  }
+  auto cloneErr = errno;
+  ::close(errPipe[1]);
+  if (pid == -1) {
+    ::close(errPipe[0]);
+    return Response{cloneErr, 0};
+  }
+
+  // Reads EOF once the child has exec'd, or its errno if it failed to
+  int err = 0;
+  if (!readAll(errPipe[0], &err, sizeof(err))) {
+    err = 0;
+  }
+  ::close(errPipe[0]);
+  return Response{err, pid};
+}
+
+void closeOtherFds(int keepFd) {
+#ifdef SYS_close_range
+  if (syscall(SYS_close_range, 3, keepFd - 1, 0) == 0 &&
+      syscall(SYS_close_range, keepFd + 1, ~0U, 0) == 0) {
+    return;
+  }
+#endif
+  auto maxFd = std::min<long>(sysconf(_SC_OPEN_MAX), 65536);
+  for (int fd = 3; fd < maxFd; ++fd) {
+    if (fd != keepFd) {
+      ::close(fd);
+    }
+  }
+}
+
+[[noreturn]] void helperMain(int sock) {
+  // Don't outlive the server
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  prctl(PR_SET_NAME, "watchman-spawn");
+  // The server may have exited before the death signal was armed
+  if (getppid() == 1) {
+    _exit(0);
+  }
+  // Don't hold on to the server's listening socket, pid file lock, and such
+  closeOtherFds(sock);
+
+  while (true) {
+    std::string payload;
+    std::vector<int> fds;
+    if (!receiveMessage(sock, payload, fds)) {
+      _exit(0);
+    }
+
+    Request req;
+    auto resp = decodeRequest(payload, fds.size(), req)
+        ? spawnChild(req, fds)
+        : Response{EINVAL, 0};
+    // The child has its own copies now; ours would keep pipes from ever
+    // reading EOF.
+    for (auto fd : fds) {
+      ::close(fd);
+    }
+
+    try {
+      writeAll(sock, &resp, sizeof(resp));
+    } catch (const std::system_error&) {
+      _exit(0);
+    }
+  }
+}
+
+} // namespace
+
+bool SpawnHelper::start() {
+  int socks[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, socks) == -1) {
+    log(ERR, "failed to start the spawn helper: socketpair: ",
+        folly::errnoStr(errno), "\n");
+    return false;
+  }
+
+  auto pid = fork();
+  if (pid == -1) {
+    log(ERR, "failed to start the spawn helper: fork: ",
+        folly::errnoStr(errno), "\n");
+    ::close(socks[0]);
+    ::close(socks[1]);
+    return false;
+  }
+  if (pid == 0) {
+    ::close(socks[0]);
+    helperMain(socks[1]);
+  }
+
+  ::close(socks[1]);
+  helper.reset(new SpawnHelper(
+      FileDescriptor(socks[0], FileDescriptor::FDType::Socket), pid));
+  log(DBG, "started the spawn helper, pid=", pid, "\n");
+  return true;
+}
+
+std::optional<int> SpawnHelper::spawn(
+    pid_t& pid,
+    char* const* argv,
+    char* const* envp,
+    const ChildProcess::Options& options) {
+  const auto* attr = &options.inner_->attr;
+  short spawnFlags;
+  if (posix_spawnattr_getflags(attr, &spawnFlags) != 0 ||
+      (spawnFlags & ~(POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK))) {
+    return std::nullopt;
+  }
+  pid_t pgroup;
+  if ((spawnFlags & POSIX_SPAWN_SETPGROUP) &&
+      (posix_spawnattr_getpgroup(attr, &pgroup) != 0 || pgroup != 0)) {
+    return std::nullopt;
+  }
+
+  Writer w;
+  uint32_t flags = 0;
+  sigset_t sigMask;
+  sigemptyset(&sigMask);
+  if (spawnFlags & POSIX_SPAWN_SETPGROUP) {
+    flags |= kSetPgroup;
+  }
+  if (spawnFlags & POSIX_SPAWN_SETSIGMASK) {
+    flags |= kSetSigMask;
+    if (posix_spawnattr_getsigmask(attr, &sigMask) != 0) {
+      return std::nullopt;
+    }
+  }
+  w.u32(flags);
+  w.bytes(&sigMask, sizeof(sigMask));
+  w.str(options.cwd_);
+  encodeStrings(w, argv);
+  encodeStrings(w, envp);
+
+  std::vector<int> fds;
+  w.u32(options.fileActions_.size());
+  for (auto& action : options.fileActions_) {
+    if (action.targetFd >= kFirstMovedFd) {
+      return std::nullopt;
+    }
+    int32_t fdIndex = -1;
+    if (action.sourceFd >= 0) {
+      fdIndex = fds.size();
+      fds.push_back(action.sourceFd);
+    }
+    w.i32(fdIndex);
+    w.i32(action.targetFd);
+    w.i32(action.flags);
+    w.i32(action.mode);
+    w.str(action.path);
+  }
+  if (fds.size() > kMaxPassedFds || w.buf().size() > kMaxRequestSize) {
+    return std::nullopt;
+  }
+
+  Response resp;
+  {
+    std::lock_guard lock{mutex_};
+    if (!sock_) {
+      return std::nullopt;
+    }
+    try {
+      sendMessage(sock_.fd(), w.buf(), fds);
+      if (!readAll(sock_.fd(), &resp, sizeof(resp))) {
+        throw std::system_error(
+            EPIPE, std::generic_category(), "reading spawn response");
+      }
+    } catch (const std::system_error& exc) {
+      log(ERR,
+          "the spawn helper failed: ",
+          exc.what(),
+          "; spawning directly from now on\n");
+      sock_.close();
+      waitpid(helperPid_, nullptr, WNOHANG);
+      return std::nullopt;
+    }
+  }
+
+  if (resp.err != 0) {
+    if (resp.pid > 0) {
+      // The child failed to exec; reap it
+      waitpid(resp.pid, nullptr, 0);
+    }
+    return resp.err;
+  }
+  pid = resp.pid;
+  return 0;
+}
+
+#endif
+
+} // namespace watchman
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <optional>
+#include "watchman/ChildProcess.h"
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/watchman_system.h"
+
+namespace watchman {
+
+/**
+ * A small process, forked from the server while it is still small, that
+ * spawns child processes on the server's behalf.
+ *
+ * Once the server has crawled a few large trees, its address space runs to
+ * gigabytes, and spawning a trigger or SCM command from it costs a walk of
+ * all of its page tables, with the pages of every thread pinned meanwhile.
+ * The helper's cost to spawn stays the same however large the server grows.
+ *
+ * The processes that the helper spawns are made children of the server, so
+ * ChildProcess waits for them and signals them exactly as it would if it had
+ * spawned them itself.
+ *
+ * The helper is only available on Linux.  Elsewhere, and whenever the helper
+ * can't perform a spawn, ChildProcess spawns directly.
+ */
+class SpawnHelper {
+ public:
+  /**
+   * Forks the helper.  Call this early in the life of the server, before it
+   * has started its thread pool.  Logs and returns false if the helper
+   * could not be started.
+   */
+  static bool start();
+
+  /**
+   * Returns the running helper, or nullptr if there is none.
+   */
+  static SpawnHelper* get();
+
+  /**
+   * Spawns argv with the given environment and options.  Returns 0 and sets
+   * pid on success, or the errno of the failure, as posix_spawnp would.
+   * Returns nullopt if the helper can't perform this spawn, in which case
+   * the caller should spawn it directly.
+   */
+  std::optional<int> spawn(
+      pid_t& pid,
+      char* const* argv,
+      char* const* envp,
+      const ChildProcess::Options& options);
+
+ private:
+  SpawnHelper(FileDescriptor sock, pid_t helperPid);
+
+  // Serializes requests on sock_, and guards it
+  std::mutex mutex_;
+  FileDescriptor sock_;
+  pid_t helperPid_;
+};
+
+} // namespace watchman
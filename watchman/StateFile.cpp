@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/StateFile.h"
+#include <fmt/core.h>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+#include "watchman/bser.h"
+
+namespace watchman {
+
+namespace {
+
+json_ref decodeBinaryState(std::string_view data) {
+  data.remove_prefix(kStateMagic.size());
+  uint32_t version;
+  if (data.size() < sizeof(version)) {
+    throw std::runtime_error("truncated state file");
+  }
+  memcpy(&version, data.data(), sizeof(version));
+  data.remove_prefix(sizeof(version));
+  if (version != kStateFormatVersion) {
+    throw std::runtime_error(
+        fmt::format("unsupported state file format {}", version));
+  }
+
+  std::optional<json_ref> header;
+  std::vector<json_ref> watched;
+  while (!data.empty()) {
+    uint32_t size;
+    if (data.size() < sizeof(size)) {
+      throw std::runtime_error("truncated state file");
+    }
+    memcpy(&size, data.data(), sizeof(size));
+    data.remove_prefix(sizeof(size));
+    if (data.size() < size) {
+      throw std::runtime_error("truncated state file");
+    }
+    auto value = bunser(data.data(), data.data() + size);
+    data.remove_prefix(size);
+    if (!header) {
+      header = std::move(value);
+    } else {
+      watched.push_back(std::move(value));
+    }
+  }
+
+  auto state = header ? *header : json_object();
+  state.set("watched", json_array(std::move(watched)));
+  return state;
+}
+
+} // namespace
+
+std::string beginStateFile(const json_ref& header) {
+  std::string data{kStateMagic};
+  data.append(
+      reinterpret_cast<const char*>(&kStateFormatVersion),
+      sizeof(kStateFormatVersion));
+  appendStateRecord(data, header);
+  return data;
+}
+
+void appendStateRecord(std::string& out, const json_ref& value) {
+  std::string bytes;
+  bser_ctx_t ctx{2, 0, [](const char* buffer, size_t size, void* data) {
+                   static_cast<std::string*>(data)->append(buffer, size);
+                   return 0;
+                 }};
+  if (w_bser_dump(&ctx, value, &bytes)) {
+    throw std::runtime_error("failed to encode state record");
+  }
+  auto size = static_cast<uint32_t>(bytes.size());
+  out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+  out.append(bytes);
+}
+
+json_ref decodeStateFile(std::string_view data) {
+  if (data.substr(0, kStateMagic.size()) == kStateMagic) {
+    return decodeBinaryState(data);
+  }
+  json_error_t error;
+  auto state = json_loadb(data.data(), data.size(), 0, &error);
+  if (!state) {
+    throw std::runtime_error(error.text);
+  }
+  return *state;
+}
+
+} // namespace watchman
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace watchman {
+
+/**
+ * The state file is kStateMagic, then a uint32 format version, then a
+ * sequence of records.  Each record is a uint32 length followed by that
+ * many bytes of BSER v2.  The first record is an object holding the
+ * "version" of watchman that wrote the file; each later one is the
+ * {"path", "triggers", "last_query"} object for one watched root.
+ *
+ * State files that do not start with kStateMagic are read as the JSON
+ * documents earlier versions wrote.  Those versions can't read this format.
+ */
+inline constexpr std::string_view kStateMagic{"WMSTATE\0", 8};
+inline constexpr uint32_t kStateFormatVersion = 1;
+
+/// Returns the start of a state file whose first record is header.
+std::string beginStateFile(const json_ref& header);
+
+/// Appends value to out as a length-prefixed record.
+void appendStateRecord(std::string& out, const json_ref& value);
+
+/**
+ * Decodes a state file in either format into the document that
+ * w_root_load_state expects: the header with the root records in its
+ * "watched" array.  Throws std::runtime_error if the file is malformed.
+ */
+json_ref decodeStateFile(std::string_view data);
+
+} // namespace watchman
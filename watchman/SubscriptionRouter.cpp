@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SubscriptionRouter.h"
+#include <algorithm>
+
+namespace watchman {
+
+SubscriptionRouter::SubscriptionRouter(size_t maxPaths)
+    : maxPaths_(maxPaths) {}
+
+std::shared_ptr<SubscriptionRoute> SubscriptionRouter::addRoute(
+    std::vector<w_string> scopes,
+    ClockPosition now) {
+  auto route = std::make_shared<SubscriptionRoute>(std::move(scopes));
+
+  auto state = state_.lock();
+  // The paths that changed before now may not have been collected, so the
+  // route starts out as having changed now.
+  route->changedAt_ = now;
+  state->routes.push_back(route);
+  for (auto& scope : route->scopes()) {
+    if (auto* routes = state->scopes.search(scope)) {
+      routes->push_back(route);
+    } else {
+      state->scopes.insert(scope, Routes{route});
+    }
+  }
+  routing_.store(true, std::memory_order_release);
+  return route;
+}
+
+void SubscriptionRouter::pathChanged(w_string_piece fullPath) {
+  auto state = state_.lock();
+  if (state->overflowed) {
+    return;
+  }
+  if (state->paths.size() >= maxPaths_) {
+    state->overflowed = true;
+    state->paths.clear();
+    return;
+  }
+  state->paths.insert(fullPath.asWString());
+}
+
+void SubscriptionRouter::markChanged(
+    const Routes& routes,
+    ClockPosition position) {
+  for (auto& weak : routes) {
+    if (auto route = weak.lock()) {
+      route->changedAt_ = position;
+    }
+  }
+}
+
+void SubscriptionRouter::rebuildScopes(State& state) {
+  state.scopes.clear();
+  for (auto& weak : state.routes) {
+    auto route = weak.lock();
+    if (!route) {
+      continue;
+    }
+    for (auto& scope : route->scopes()) {
+      if (auto* routes = state.scopes.search(scope)) {
+        routes->push_back(route);
+      } else {
+        state.scopes.insert(scope, Routes{route});
+      }
+    }
+  }
+}
+
+void SubscriptionRouter::settled(
+    ClockPosition position,
+    uint64_t structureGeneration) {
+  auto state = state_.lock();
+
+  auto numRoutes = state->routes.size();
+  state->routes.erase(
+      std::remove_if(
+          state->routes.begin(),
+          state->routes.end(),
+          [](const auto& weak) { return weak.expired(); }),
+      state->routes.end());
+  if (state->routes.size() != numRoutes) {
+    rebuildScopes(*state);
+  }
+
+  if (state->overflowed ||
+      position.rootNumber != state->settledAt.rootNumber ||
+      structureGeneration != state->structureGeneration) {
+    markChanged(state->routes, position);
+  } else {
+    for (auto& path : state->paths) {
+      // Scopes at or above the path
+      for (auto dir = path.piece(); !dir.empty(); dir = dir.dirName()) {
+        if (auto* routes = state->scopes.search(
+                reinterpret_cast<const unsigned char*>(dir.data()),
+                dir.size())) {
+          markChanged(*routes, position);
+        }
+      }
+      // Scopes beneath the path, which happen to be changed when it is a
+      // dir that was created or removed
+      auto prefix = w_string::build(path, "/");
+      state->scopes.iterPrefix(
+          reinterpret_cast<const unsigned char*>(prefix.data()),
+          prefix.size(),
+          [&](const w_string&, Routes& routes) {
+            markChanged(routes, position);
+            return 0;
+          });
+    }
+  }
+
+  state->paths.clear();
+  state->overflowed = false;
+  state->settledAt = position;
+  state->structureGeneration = structureGeneration;
+  routing_.store(!state->routes.empty(), std::memory_order_release);
+}
+
+bool SubscriptionRouter::isUnchangedSince(
+    const SubscriptionRoute& route,
+    ClockPosition since,
+    ClockPosition now) const {
+  auto state = state_.lock();
+  return state->settledAt.rootNumber == now.rootNumber &&
+      state->settledAt.ticks == now.ticks &&
+      since.rootNumber == now.rootNumber &&
+      route.changedAt_.rootNumber == now.rootNumber &&
+      route.changedAt_.ticks <= since.ticks;
+}
+
+} // namespace watchman
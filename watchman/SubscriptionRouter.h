@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+#include "watchman/Clock.h"
+#include "watchman/thirdparty/libart/src/art.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+class SubscriptionRouter;
+
+/**
+ * A subscription's registration with a SubscriptionRouter.  The router
+ * forgets the route's scopes once it is destroyed.
+ */
+class SubscriptionRoute {
+ public:
+  explicit SubscriptionRoute(std::vector<w_string> scopes)
+      : scopes_(std::move(scopes)) {}
+
+  const std::vector<w_string>& scopes() const {
+    return scopes_;
+  }
+
+ private:
+  friend class SubscriptionRouter;
+
+  const std::vector<w_string> scopes_;
+  // Nothing in the scopes changed after this, up to the position the router
+  // last settled at.  Guarded by the router's lock.
+  ClockPosition changedAt_;
+};
+
+/**
+ * Routes the changes made to a root to the subscriptions whose results can
+ * come from where they were made, so that a subscription that nothing
+ * relevant changed for can move its clock forwards when the root settles
+ * without running its query.
+ *
+ * The view reports each changed path while it holds its write lock, so that
+ * only remembers the path; the paths are matched against an ART of the
+ * scopes of every route when the root settles.
+ */
+class SubscriptionRouter {
+ public:
+  /**
+   * Past `maxPaths` changed paths between two settles, every route is
+   * treated as changed rather than matching them one at a time.
+   */
+  explicit SubscriptionRouter(size_t maxPaths);
+
+  /**
+   * Registers a subscription whose results can only come from the paths in
+   * `scopes` and what lies beneath them.  `now` is the current position of
+   * the view, and must be read under the same view write lock as this is
+   * called with, so that every change after it is routed.
+   */
+  std::shared_ptr<SubscriptionRoute> addRoute(
+      std::vector<w_string> scopes,
+      ClockPosition now);
+
+  /**
+   * Whether there are routes for pathChanged to collect paths for.
+   */
+  bool isRouting() const {
+    return routing_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Called by the view, with its write lock held, each time the file at
+   * `fullPath` changes.
+   */
+  void pathChanged(w_string_piece fullPath);
+
+  /**
+   * Routes the paths that changed since the previous settle.  `position` is
+   * the position of the view and `structureGeneration` that of its
+   * ViewDatabase, both read under a view lock.  If the root number or the
+   * structure generation moved, files may have changed in ways that were
+   * not reported, so every route is treated as changed.
+   */
+  void settled(ClockPosition position, uint64_t structureGeneration);
+
+  /**
+   * Whether nothing in the scopes of `route` changed after `since`, up to
+   * `now`.  That is only known if `now` is where the root last settled.
+   */
+  bool isUnchangedSince(
+      const SubscriptionRoute& route,
+      ClockPosition since,
+      ClockPosition now) const;
+
+ private:
+  using Routes = std::vector<std::weak_ptr<SubscriptionRoute>>;
+
+  struct State {
+    ClockPosition settledAt;
+    uint64_t structureGeneration{0};
+    // The paths that changed since settledAt, unless `overflowed` is set.
+    std::unordered_set<w_string> paths;
+    bool overflowed{false};
+    // Every route, and the routes for each scope.
+    Routes routes;
+    art_tree<Routes, w_string> scopes;
+  };
+
+  static void markChanged(const Routes& routes, ClockPosition position);
+  static void rebuildScopes(State& state);
+
+  const size_t maxPaths_;
+  // Set while there are routes, so that the view needn't build paths for
+  // the router otherwise.
+  std::atomic<bool> routing_{false};
+  folly::Synchronized<State, std::mutex> state_;
+};
+
+} // namespace watchman
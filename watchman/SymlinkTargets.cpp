@@ -7,6 +7,8 @@
 
 #include "watchman/SymlinkTargets.h"
 #include <folly/ScopeGuard.h>
+#include <algorithm>
+#include <iterator>
 #include <string>
 #include "watchman/Hash.h"
 #include "watchman/Logging.h"
@@ -17,6 +19,11 @@ namespace watchman {
 
 using Node = typename SymlinkTargetCache::Node;
 
+namespace {
+// How many uncached targets getBatch reads in each thread pool task
+constexpr size_t kReadLinkBatchSize = 64;
+} // namespace
+
 bool SymlinkTargetCacheKey::operator==(
     const SymlinkTargetCacheKey& other) const {
   return otime.ticks == other.otime.ticks && relativePath == other.relativePath;
@@ -38,6 +45,41 @@ folly::Future<std::shared_ptr<const Node>> SymlinkTargetCache::get(
       key, [this](const SymlinkTargetCacheKey& k) { return readLink(k); });
 }
 
+std::vector<folly::Future<std::shared_ptr<const Node>>>
+SymlinkTargetCache::getBatch(const std::vector<SymlinkTargetCacheKey>& keys) {
+  // Misses are collected here by the getter rather than read right away
+  struct PendingRead {
+    SymlinkTargetCacheKey key;
+    folly::Promise<w_string> promise;
+  };
+  std::vector<PendingRead> pending;
+
+  std::vector<folly::Future<std::shared_ptr<const Node>>> futures;
+  futures.reserve(keys.size());
+  for (auto& key : keys) {
+    futures.emplace_back(
+        cache_.get(key, [&pending](const SymlinkTargetCacheKey& k) {
+          pending.push_back(PendingRead{k, folly::Promise<w_string>()});
+          return pending.back().promise.getFuture();
+        }));
+  }
+
+  auto executor = getThreadPool().executorFor(WorkClass::Symlink);
+  for (size_t start = 0; start < pending.size(); start += kReadLinkBatchSize) {
+    auto end = std::min(pending.size(), start + kReadLinkBatchSize);
+    std::vector<PendingRead> chunk(
+        std::make_move_iterator(pending.begin() + start),
+        std::make_move_iterator(pending.begin() + end));
+    executor->add([this, chunk = std::move(chunk)]() mutable {
+      for (auto& read : chunk) {
+        read.promise.setWith([&] { return readLinkImmediate(read.key); });
+      }
+    });
+  }
+
+  return futures;
+}
+
 w_string SymlinkTargetCache::readLinkImmediate(
     const SymlinkTargetCacheKey& key) const {
   auto fullPath = w_string::pathCat({rootPath_, key.relativePath});
@@ -47,7 +89,7 @@ w_string SymlinkTargetCache::readLinkImmediate(
 folly::Future<w_string> SymlinkTargetCache::readLink(
     const SymlinkTargetCacheKey& key) const {
   return folly::makeFuture(key)
-      .via(&getThreadPool())
+      .via(getThreadPool().executorFor(WorkClass::Symlink))
       .thenValue(
           [this](SymlinkTargetCacheKey key) { return readLinkImmediate(key); });
 }
@@ -59,4 +101,8 @@ const w_string& SymlinkTargetCache::rootPath() const {
 CacheStats SymlinkTargetCache::stats() const {
   return cache_.stats();
 }
+
+void SymlinkTargetCache::clear() {
+  cache_.clear();
+}
 } // namespace watchman
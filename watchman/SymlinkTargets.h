@@ -7,6 +7,7 @@
 
 #pragma once
 #include <string>
+#include <vector>
 #include "watchman/Clock.h"
 #include "watchman/LRUCache.h"
 #include "watchman/thirdparty/jansson/jansson.h"
@@ -38,7 +39,7 @@ struct hash<watchman::SymlinkTargetCacheKey> {
 namespace watchman {
 class SymlinkTargetCache {
  public:
-  using Node = LRUCache<SymlinkTargetCacheKey, w_string>::NodeType;
+  using Node = ShardedLRUCache<SymlinkTargetCacheKey, w_string>::NodeType;
 
   // Construct a cache for a given root, holding the specified
   // maximum number of items, using the configured negative
@@ -56,6 +57,12 @@ class SymlinkTargetCache {
   folly::Future<std::shared_ptr<const Node>> get(
       const SymlinkTargetCacheKey& key);
 
+  // As get(), but for many keys at once.  The targets that are not
+  // already cached are read a chunk at a time on the thread pool, rather
+  // than with a task per symlink.  The futures are in the order of keys.
+  std::vector<folly::Future<std::shared_ptr<const Node>>> getBatch(
+      const std::vector<SymlinkTargetCacheKey>& keys);
+
   // Read the symlink target.
   // This will block the calling thread while the I/O is performed.
   // Throws exceptions for any errors that may occur.
@@ -71,8 +78,11 @@ class SymlinkTargetCache {
   // Returns cache statistics
   CacheStats stats() const;
 
+  // Discards every cached entry
+  void clear();
+
  private:
-  LRUCache<SymlinkTargetCacheKey, w_string> cache_;
+  ShardedLRUCache<SymlinkTargetCacheKey, w_string> cache_;
   w_string rootPath_;
 };
 } // namespace watchman
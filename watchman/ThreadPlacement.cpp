@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadPlacement.h"
+#include <fmt/core.h>
+#include <folly/String.h>
+#include <folly/system/HardwareConcurrency.h>
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include "watchman/Logging.h"
+#include "watchman/WatchmanConfig.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#include <sys/qos.h>
+#endif
+
+namespace watchman {
+
+namespace {
+
+void parseCpus(const json_ref& spec, std::vector<unsigned>& cpus) {
+  if (!spec.isArray()) {
+    throw std::domain_error("cpus must be an array");
+  }
+  for (auto& item : spec.array()) {
+    if (item.isInt()) {
+      auto cpu = item.asInt();
+      if (cpu < 0) {
+        throw std::domain_error("cpus must not be negative");
+      }
+      cpus.push_back(static_cast<unsigned>(cpu));
+      continue;
+    }
+    // "first-last", inclusive
+    unsigned first, last;
+    char trailing;
+    if (!item.isString() ||
+        sscanf(item.asCString(), "%u-%u%c", &first, &last, &trailing) != 2 ||
+        first > last) {
+      throw std::domain_error(
+          "cpus must hold CPU numbers or ranges such as \"4-7\"");
+    }
+    for (auto cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+}
+
+#ifdef __linux__
+void applyPlacement(const ThreadPlacement& placement) {
+  // Affinity, scheduling policies and nice values are all per-thread on
+  // Linux.
+  auto tid = static_cast<pid_t>(syscall(SYS_gettid));
+  if (!placement.cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : placement.cpus) {
+      if (cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &set);
+      }
+    }
+    if (sched_setaffinity(tid, sizeof(set), &set) != 0) {
+      log(ERR, "sched_setaffinity failed: ", folly::errnoStr(errno), "\n");
+    }
+  }
+  if (placement.policy != ThreadPlacement::Policy::Default) {
+    sched_param param{};
+    auto policy = placement.policy == ThreadPlacement::Policy::Batch
+        ? SCHED_BATCH
+        : SCHED_IDLE;
+    if (sched_setscheduler(tid, policy, &param) != 0) {
+      log(ERR, "sched_setscheduler failed: ", folly::errnoStr(errno), "\n");
+    }
+  }
+  if (placement.nice) {
+    if (setpriority(PRIO_PROCESS, static_cast<id_t>(tid), *placement.nice) !=
+        0) {
+      log(ERR, "setpriority failed: ", folly::errnoStr(errno), "\n");
+    }
+  }
+  if (placement.qos != ThreadPlacement::Qos::Default) {
+    log(DBG, "thread_placement qos is ignored on this platform\n");
+  }
+}
+#elif defined(__APPLE__)
+void applyPlacement(const ThreadPlacement& placement) {
+  // macOS offers no way to pin a thread to CPUs, and schedules threads by
+  // their QoS class rather than by nice values or policies.
+  if (!placement.cpus.empty() || placement.nice ||
+      placement.policy != ThreadPlacement::Policy::Default) {
+    log(DBG,
+        "thread_placement cpus, nice and policy are ignored on this "
+        "platform\n");
+  }
+  qos_class_t qos;
+  switch (placement.qos) {
+    case ThreadPlacement::Qos::Default:
+      return;
+    case ThreadPlacement::Qos::UserInitiated:
+      qos = QOS_CLASS_USER_INITIATED;
+      break;
+    case ThreadPlacement::Qos::Utility:
+      qos = QOS_CLASS_UTILITY;
+      break;
+    case ThreadPlacement::Qos::Background:
+      qos = QOS_CLASS_BACKGROUND;
+      break;
+  }
+  if (auto err = pthread_set_qos_class_self_np(qos, 0)) {
+    log(ERR,
+        "pthread_set_qos_class_self_np failed: ",
+        folly::errnoStr(err),
+        "\n");
+  }
+}
+#elif defined(_WIN32)
+void applyPlacement(const ThreadPlacement& placement) {
+  if (!placement.cpus.empty()) {
+    // Only the CPUs of the thread's processor group can be named here
+    DWORD_PTR mask = 0;
+    for (auto cpu : placement.cpus) {
+      if (cpu < sizeof(mask) * 8) {
+        mask |= DWORD_PTR(1) << cpu;
+      }
+    }
+    if (mask && !SetThreadAffinityMask(GetCurrentThread(), mask)) {
+      log(ERR, "SetThreadAffinityMask failed: ", GetLastError(), "\n");
+    }
+  }
+  if (placement.qos == ThreadPlacement::Qos::Background ||
+      placement.policy == ThreadPlacement::Policy::Idle) {
+    if (!SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN)) {
+      log(ERR, "SetThreadPriority failed: ", GetLastError(), "\n");
+    }
+  } else if (
+      (placement.nice && *placement.nice > 0) ||
+      placement.qos == ThreadPlacement::Qos::Utility ||
+      placement.policy == ThreadPlacement::Policy::Batch) {
+    auto priority = placement.nice && *placement.nice >= 10
+        ? THREAD_PRIORITY_LOWEST
+        : THREAD_PRIORITY_BELOW_NORMAL;
+    if (!SetThreadPriority(GetCurrentThread(), priority)) {
+      log(ERR, "SetThreadPriority failed: ", GetLastError(), "\n");
+    }
+  }
+}
+#else
+void applyPlacement(const ThreadPlacement& placement) {
+  if (!placement.empty()) {
+    log(DBG, "thread_placement is not supported on this platform\n");
+  }
+}
+#endif
+
+} // namespace
+
+std::string_view threadRoleName(ThreadRole role) {
+  switch (role) {
+    case ThreadRole::Pool:
+      return "pool";
+    case ThreadRole::Io:
+      return "io";
+    case ThreadRole::Notify:
+      return "notify";
+    case ThreadRole::Client:
+      return "client";
+  }
+  return "unknown";
+}
+
+ThreadPlacement parseThreadPlacement(const json_ref& spec) {
+  if (!spec.isObject()) {
+    throw std::domain_error("must be an object");
+  }
+
+  ThreadPlacement placement;
+  for (auto& [key, value] : spec.object()) {
+    auto name = key.view();
+    if (name == "cpus") {
+      parseCpus(value, placement.cpus);
+    } else if (name == "nice") {
+      if (!value.isInt() || value.asInt() < -20 || value.asInt() > 19) {
+        throw std::domain_error("nice must be an integer from -20 to 19");
+      }
+      placement.nice = static_cast<int>(value.asInt());
+    } else if (name == "policy") {
+      auto policy = value.isString() ? value.asString().view() : "";
+      if (policy == "default") {
+        placement.policy = ThreadPlacement::Policy::Default;
+      } else if (policy == "batch") {
+        placement.policy = ThreadPlacement::Policy::Batch;
+      } else if (policy == "idle") {
+        placement.policy = ThreadPlacement::Policy::Idle;
+      } else {
+        throw std::domain_error(
+            "policy must be one of \"default\", \"batch\" or \"idle\"");
+      }
+    } else if (name == "qos") {
+      auto qos = value.isString() ? value.asString().view() : "";
+      if (qos == "default") {
+        placement.qos = ThreadPlacement::Qos::Default;
+      } else if (qos == "user-initiated") {
+        placement.qos = ThreadPlacement::Qos::UserInitiated;
+      } else if (qos == "utility") {
+        placement.qos = ThreadPlacement::Qos::Utility;
+      } else if (qos == "background") {
+        placement.qos = ThreadPlacement::Qos::Background;
+      } else {
+        throw std::domain_error(
+            "qos must be one of \"default\", \"user-initiated\", "
+            "\"utility\" or \"background\"");
+      }
+    } else {
+      throw std::domain_error(fmt::format("unknown setting {}", name));
+    }
+  }
+  return placement;
+}
+
+ThreadPlacement getThreadPlacement(ThreadRole role) {
+  auto config = cfg_get_json("thread_placement");
+  if (!config) {
+    return {};
+  }
+  auto name = threadRoleName(role);
+  try {
+    if (!config->isObject()) {
+      throw std::domain_error("must be an object");
+    }
+    auto spec = config->get_optional(std::string{name}.c_str());
+    if (!spec) {
+      return {};
+    }
+    return parseThreadPlacement(*spec);
+  } catch (const std::exception& exc) {
+    log(ERR, "ignoring thread_placement for ", name, ": ", exc.what(), "\n");
+    return {};
+  }
+}
+
+void placeCurrentThread(ThreadRole role) {
+  auto placement = getThreadPlacement(role);
+  if (!placement.empty()) {
+    applyPlacement(placement);
+  }
+}
+
+size_t threadRoleConcurrency(ThreadRole role) {
+  auto placement = getThreadPlacement(role);
+#if defined(__linux__) || defined(_WIN32)
+  if (!placement.cpus.empty()) {
+    return placement.cpus.size();
+  }
+#endif
+  return folly::hardware_concurrency();
+}
+
+} // namespace watchman
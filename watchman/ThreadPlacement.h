@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace watchman {
+
+/**
+ * The kinds of threads that `thread_placement` can be configured for.
+ */
+enum class ThreadRole {
+  // The workers of the shared ThreadPool
+  Pool,
+  // The IO thread of each root
+  Io,
+  // The notify thread of each root
+  Notify,
+  // The threads that serve clients, and the client event loop threads
+  Client,
+};
+
+/// The `thread_placement` key for `role`.
+std::string_view threadRoleName(ThreadRole role);
+
+/**
+ * Where and how the threads of one role are scheduled.
+ */
+struct ThreadPlacement {
+  enum class Policy { Default, Batch, Idle };
+  enum class Qos { Default, UserInitiated, Utility, Background };
+
+  // The CPUs the threads may run on; empty to leave them unpinned.
+  std::vector<unsigned> cpus;
+  std::optional<int> nice;
+  Policy policy{Policy::Default};
+  Qos qos{Qos::Default};
+
+  bool empty() const {
+    return cpus.empty() && !nice && policy == Policy::Default &&
+        qos == Qos::Default;
+  }
+};
+
+/**
+ * Parses one role's entry of the `thread_placement` config, such as
+ * `{"cpus": [0, "4-7"], "nice": 5, "policy": "batch", "qos": "utility"}`.
+ * Throws std::domain_error if it is malformed.
+ */
+ThreadPlacement parseThreadPlacement(const json_ref& spec);
+
+/**
+ * The placement configured for `role` in the global config.  A malformed
+ * entry is logged and treated as unset.
+ */
+ThreadPlacement getThreadPlacement(ThreadRole role);
+
+/**
+ * Applies the placement configured for `role` to the calling thread.
+ * Settings the platform can't honor, and failures, are logged and otherwise
+ * ignored.
+ */
+void placeCurrentThread(ThreadRole role);
+
+/**
+ * The number of CPUs the threads of `role` are pinned to, or the number of
+ * hardware threads if they are not pinned, for sizing thread counts.
+ */
+size_t threadRoleConcurrency(ThreadRole role);
+
+} // namespace watchman
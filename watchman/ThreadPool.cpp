@@ -6,6 +6,7 @@
  */
 
 #include "watchman/ThreadPool.h"
+#include <folly/system/HardwareConcurrency.h>
 #include "watchman/Logging.h"
 
 namespace watchman {
@@ -15,11 +16,33 @@ ThreadPool& getThreadPool() {
   return pool;
 }
 
+ThreadPool& getTriggerThreadPool() {
+  static ThreadPool pool;
+  return pool;
+}
+
+ThreadPool::ThreadPool() {
+  for (size_t i = 0; i < kNumWorkClasses; ++i) {
+    classExecutors_[i].pool_ = this;
+    classExecutors_[i].workClass_ = WorkClass(i);
+  }
+}
+
 ThreadPool::~ThreadPool() {
   stop();
 }
 
-void ThreadPool::start(size_t numWorkers, size_t maxItems) {
+namespace {
+// The pool and index of the worker running on this thread, if any
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local size_t currentWorker = 0;
+} // namespace
+
+void ThreadPool::start(
+    size_t numWorkers,
+    size_t maxItems,
+    const char* threadName,
+    std::optional<ThreadRole> role) {
   std::unique_lock<std::mutex> lock(mutex_);
   if (!workers_.empty()) {
     throw std::runtime_error("ThreadPool already started");
@@ -27,31 +50,112 @@ void ThreadPool::start(size_t numWorkers, size_t maxItems) {
   if (stopping_) {
     throw std::runtime_error("Cannot restart a stopped pool");
   }
+  startLocked(numWorkers, maxItems, threadName, role);
+}
+
+void ThreadPool::startLocked(
+    size_t numWorkers,
+    size_t maxItems,
+    const char* threadName,
+    std::optional<ThreadRole> role) {
   maxItems_ = maxItems;
 
+  // Every worker must exist before any of them can steal from the others
+  for (auto i = 0U; i < numWorkers; ++i) {
+    workers_.emplace_back(std::make_unique<Worker>());
+  }
+  numWorkers_.store(numWorkers, std::memory_order_release);
+
   for (auto i = 0U; i < numWorkers; ++i) {
-    workers_.emplace_back([this, i]() noexcept {
-      w_set_thread_name("ThreadPool-", i);
-      runWorker();
+    workers_[i]->thread = std::thread([this, i, threadName, role]() noexcept {
+      w_set_thread_name(threadName, i);
+      if (role) {
+        placeCurrentThread(*role);
+      }
+      currentPool = this;
+      currentWorker = i;
+      runWorker(i);
     });
   }
 }
 
-void ThreadPool::runWorker() {
-  while (true) {
-    folly::Func task;
+size_t ThreadPool::ensureStarted() {
+  auto numWorkers = numWorkers_.load(std::memory_order_acquire);
+  if (numWorkers == 0) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (workers_.empty() && !stopping_) {
+      // Tools and tests that never configured the pool
+      startLocked(
+          folly::hardware_concurrency(),
+          1024 * 1024,
+          "ThreadPool-",
+          std::nullopt);
+    }
+    numWorkers = workers_.size();
+  }
+  return numWorkers;
+}
+
+bool ThreadPool::hasQueuedTasks() const {
+  for (auto& queued : queued_) {
+    if (queued.load() > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+folly::Func ThreadPool::takeTask(size_t index) {
+  auto numWorkers = workers_.size();
+  for (size_t c = 0; c < kNumWorkClasses; ++c) {
+    if (queued_[c].load(std::memory_order_relaxed) == 0) {
+      continue;
+    }
+    // Our own tasks first, then those of the other workers
+    for (size_t i = 0; i < numWorkers; ++i) {
+      auto& worker = *workers_[(index + i) % numWorkers];
+      folly::Func task;
+      {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        auto& tasks = worker.tasks[c];
+        if (tasks.empty()) {
+          continue;
+        }
+        if (i == 0) {
+          task = std::move(tasks.front());
+          tasks.pop_front();
+        } else {
+          task = std::move(tasks.back());
+          tasks.pop_back();
+        }
+      }
 
-    {
-      std::unique_lock<std::mutex> lock(mutex_);
-      condition_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
-      if (stopping_ && tasks_.empty()) {
-        return;
+      queued_[c].fetch_sub(1);
+      if (blockedAdders_.load() > 0) {
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        roomCondition_.notify_all();
       }
-      task = std::move(tasks_.front());
-      tasks_.pop_front();
+      return task;
     }
+  }
+  return nullptr;
+}
 
-    task();
+void ThreadPool::runWorker(size_t index) {
+  while (true) {
+    if (auto task = takeTask(index)) {
+      task();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++idleWorkers_;
+    condition_.wait(lock, [&] { return hasQueuedTasks() || stopping_; });
+    --idleWorkers_;
+    if (!hasQueuedTasks()) {
+      // Stopping, and the queued tasks have all been taken
+      return;
+    }
   }
 }
 
@@ -61,27 +165,63 @@ void ThreadPool::stop(bool join) {
     stopping_ = true;
   }
   condition_.notify_all();
+  roomCondition_.notify_all();
 
   if (join) {
     for (auto& worker : workers_) {
-      worker.join();
+      if (worker->thread.joinable()) {
+        worker->thread.join();
+      }
     }
   }
 }
 
 void ThreadPool::add(folly::Func func) {
-  {
-    std::unique_lock<std::mutex> lock(mutex_);
+  add(std::move(func), WorkClass::Query);
+}
+
+void ThreadPool::waitForRoom(WorkClass workClass) {
+  auto& queued = queued_[size_t(workClass)];
+  if (queued.load() + 1 < maxItems_) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  ++blockedAdders_;
+  roomCondition_.wait(
+      lock, [&] { return queued.load() + 1 < maxItems_ || stopping_; });
+  --blockedAdders_;
+}
+
+void ThreadPool::add(folly::Func func, WorkClass workClass) {
+  auto numWorkers = ensureStarted();
+  if (stopping_) {
+    throw std::runtime_error("cannot add tasks after pool has stopped");
+  }
+
+  size_t index;
+  if (currentPool == this) {
+    index = currentWorker;
+  } else {
+    waitForRoom(workClass);
     if (stopping_) {
       throw std::runtime_error("cannot add tasks after pool has stopped");
     }
-    if (tasks_.size() + 1 >= maxItems_) {
-      throw std::runtime_error("thread pool queue is full");
-    }
+    index = nextWorker_.fetch_add(1, std::memory_order_relaxed) % numWorkers;
+  }
 
-    tasks_.emplace_back(std::move(func));
+  // Counted before it is queued, so that a worker that finds the count
+  // zero and goes to sleep is woken below
+  queued_[size_t(workClass)].fetch_add(1);
+  {
+    auto& worker = *workers_[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.tasks[size_t(workClass)].emplace_back(std::move(func));
   }
 
-  condition_.notify_one();
+  if (idleWorkers_.load() > 0) {
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    condition_.notify_one();
+  }
 }
 } // namespace watchman
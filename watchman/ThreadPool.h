@@ -7,16 +7,35 @@
 
 #pragma once
 #include <folly/Executor.h>
+#include <atomic>
 #include <condition_variable>
 #include <deque>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <thread>
 #include <vector>
+#include "watchman/ThreadPlacement.h"
 #include "watchman/watchman_system.h" // to avoid system header ordering issue on win32
 
 namespace watchman {
 
-// Almost the dumbest possible thread pool implementation.
+// The classes of work that share the process thread pool, highest priority
+// first.  Idle workers take a task of the highest priority class that has
+// any queued.
+enum class WorkClass {
+  // Fanned out query evaluation, which a client is waiting on
+  Query,
+  // Reading symlink targets for queries
+  Symlink,
+  // Reading directories for the parallel crawler
+  Crawl,
+  // Computing content hashes, and other background work
+  Hash,
+};
+constexpr size_t kNumWorkClasses = 4;
+
+// A fixed size pool of worker threads.
 // This allows us to set an upper bound on the number of concurrent
 // tasks that are executed in the thread pool.  Contrast with
 // std::async which leaves it to the implementation to decide
@@ -24,43 +43,113 @@ namespace watchman {
 // thread pool with an unspecified number of threads.
 // Constraining the concurrency is important for watchman so
 // that we can limit the amount of I/O that we might induce.
+//
+// Every subsystem submits to the one pool, tagging its tasks with a
+// WorkClass, so that roots crawling and hashing at the same time share a
+// fixed number of threads rather than each sizing a pool for the whole
+// machine.
+//
+// Each worker has its own queues, so that submitting and taking tasks
+// doesn't contend on a single lock.  Tasks added by a worker go to its own
+// queues, and tasks added from other threads are spread across the workers
+// in turn.  A worker runs its own tasks oldest first, and steals the newest
+// task of another worker when it has none of a class.
 
 class ThreadPool : public folly::Executor {
  public:
-  ThreadPool() = default;
+  ThreadPool();
   ~ThreadPool() override;
 
   // Start a thread pool with the specified number of worker threads
-  // and the specified upper bound on the number of queued jobs.
+  // and the specified upper bound on the number of queued jobs of each
+  // WorkClass.
   // The queue limit is intended as a brake in case the system
-  // is under a heavy backlog, and can also help surface issues
-  // where there a task executing in the pool is blocking on
-  // the results of some other task also running in the thread
-  // pool.
-  void start(size_t numWorkers, size_t maxItems);
+  // is under a heavy backlog: threads outside the pool that add to a
+  // full class block until the workers catch up.  Workers themselves
+  // are never blocked, as the tasks they are waiting to queue may be
+  // the ones that would drain the backlog.
+  // Worker threads are named `threadName` followed by their index, and
+  // placed as `thread_placement` configures `role`, if given.
+  // A pool that is given work before it is started starts itself with
+  // one worker per hardware thread.
+  void start(
+      size_t numWorkers,
+      size_t maxItems,
+      const char* threadName = "ThreadPool-",
+      std::optional<ThreadRole> role = std::nullopt);
 
-  // Request that the worker threads terminate.
+  // Request that the worker threads terminate once the queued tasks have
+  // run.
   // If `join` is true, wait for the worker threads to terminate.
   void stop(bool join = true);
 
-  // Run a function in the thread pool.
+  // Run a function in the thread pool as WorkClass::Query.
   // This queues up the function for asynchronous execution and
   // may return before func has been executed.
   // If the thread pool has been stopped, throws a runtime_error.
   void add(folly::Func func) override;
 
+  // As add(func), but with the given class of work.
+  void add(folly::Func func, WorkClass workClass);
+
+  // An executor that adds its tasks to this pool with the given class of
+  // work.  It lives as long as the pool.
+  folly::Executor* executorFor(WorkClass workClass) {
+    return &classExecutors_[size_t(workClass)];
+  }
+
  private:
-  std::vector<std::thread> workers_;
-  std::deque<folly::Func> tasks_;
+  class ClassExecutor : public folly::Executor {
+   public:
+    void add(folly::Func func) override {
+      pool_->add(std::move(func), workClass_);
+    }
 
+    ThreadPool* pool_;
+    WorkClass workClass_;
+  };
+
+  struct Worker {
+    std::thread thread;
+    std::mutex mutex;
+    std::deque<folly::Func> tasks[kNumWorkClasses];
+  };
+
+  // Created before numWorkers_ is published, and not changed after
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> numWorkers_{0};
+  std::atomic<size_t> nextWorker_{0};
+  // Tasks queued in each class, across all workers
+  std::atomic<size_t> queued_[kNumWorkClasses]{};
+  ClassExecutor classExecutors_[kNumWorkClasses];
+
+  // Protects starting and stopping, and the sleeping of idle workers and
+  // of threads waiting for room in a full class
   std::mutex mutex_;
   std::condition_variable condition_;
-  bool stopping_{false};
+  std::condition_variable roomCondition_;
+  std::atomic<size_t> idleWorkers_{0};
+  std::atomic<size_t> blockedAdders_{0};
+  std::atomic<bool> stopping_{false};
   size_t maxItems_;
 
-  void runWorker();
+  void startLocked(
+      size_t numWorkers,
+      size_t maxItems,
+      const char* threadName,
+      std::optional<ThreadRole> role);
+  size_t ensureStarted();
+  void waitForRoom(WorkClass workClass);
+  folly::Func takeTask(size_t index);
+  bool hasQueuedTasks() const;
+  void runWorker(size_t index);
 };
 
 // Return a reference to the shared thread pool for the watchman process.
 ThreadPool& getThreadPool();
+
+// Return a reference to the pool that triggers are evaluated and
+// dispatched on.  Trigger tasks wait for query work that they queue to the
+// shared pool, so they must not occupy its workers.
+ThreadPool& getTriggerThreadPool();
 } // namespace watchman
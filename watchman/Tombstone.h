@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "watchman/Clock.h"
+#include "watchman/fs/FileInformation.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * What remains of a file node once the file has been deleted for a while:
+ * just enough to report the deletion to queries with an older clock.
+ *
+ * Tombstones live in their parent dir's `tombstones`, keyed by name, until
+ * they are aged out or the file is created again.
+ */
+struct Tombstone {
+  w_string name;
+  // The otime and ctime of the deleted file
+  ClockStamp otime{};
+  ClockStamp ctime{};
+  // The last known mode of the file
+  mode_t mode{0};
+#ifdef _WIN32
+  uint32_t fileAttributes{0};
+#endif
+
+  /**
+   * Returns the last known mode of the file in the form of its stat
+   * information, with every other field zeroed.
+   */
+  FileInformation stat() const {
+    FileInformation info;
+    info.mode = mode;
+#ifdef _WIN32
+    info.fileAttributes = fileAttributes;
+#endif
+    return info;
+  }
+};
+
+} // namespace watchman
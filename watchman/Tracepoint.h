@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/tracing/StaticTracepoint.h>
+
+/**
+ * Defines a USDT probe named `name` in the `watchman` provider, which
+ * bpftrace, perf and DTrace can attach to in a running server, for example
+ * `bpftrace -e 'usdt:/usr/local/bin/watchman:watchman:query__end { ... }'`.
+ *
+ * A probe that nothing is attached to is a single nop instruction, but its
+ * arguments are still evaluated, so only pass values that are already at
+ * hand.  Probes identify the root by its path, as a C string, and queries
+ * by the address of their QueryContext.  Where the platform has no USDT
+ * support this expands to nothing.
+ */
+#define WATCHMAN_TRACE(name, ...) FOLLY_SDT(watchman, name, ##__VA_ARGS__)
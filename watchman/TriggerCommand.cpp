@@ -7,11 +7,18 @@
 
 #include "watchman/TriggerCommand.h"
 #include <folly/String.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <thread>
+#include <unordered_map>
 #include "watchman/Errors.h"
 #include "watchman/PDU.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Shutdown.h"
+#include "watchman/ThreadPool.h"
 #include "watchman/UserDir.h"
+#include "watchman/bser.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -63,6 +70,17 @@ void parse_redirection(
   }
 }
 
+// Adjusts the results to fit within max_files_stdin, returning true if any
+// were dropped
+bool limit_files_stdin(TriggerCommand* cmd, QueryResult* res) {
+  auto& fileList = res->resultsArray.results;
+  if (cmd->max_files_stdin == 0 || fileList.size() <= cmd->max_files_stdin) {
+    return false;
+  }
+  fileList.erase(fileList.begin() + cmd->max_files_stdin, fileList.end());
+  return true;
+}
+
 ResultErrno<std::unique_ptr<watchman_stream>> prepare_stdin(
     TriggerCommand* cmd,
     QueryResult* res) {
@@ -72,13 +90,7 @@ ResultErrno<std::unique_ptr<watchman_stream>> prepare_stdin(
     return w_stm_open("/dev/null", O_RDONLY | O_CLOEXEC);
   }
 
-  // Adjust result to fit within the specified limit
-  if (cmd->max_files_stdin > 0) {
-    auto& fileList = res->resultsArray.results;
-    if (fileList.size() > cmd->max_files_stdin) {
-      fileList.erase(fileList.begin() + cmd->max_files_stdin, fileList.end());
-    }
-  }
+  limit_files_stdin(cmd, res);
 
   /* prepare the input stream for the child process */
   snprintf(
@@ -141,6 +153,195 @@ ResultErrno<std::unique_ptr<watchman_stream>> prepare_stdin(
   return stdin_file;
 }
 
+// Sets up everything about the command's process except for its stdin
+ChildProcess::Options make_command_options(
+    const std::shared_ptr<Root>& root,
+    TriggerCommand* cmd) {
+  if (cmd->query->relative_root) {
+    cmd->env.set("WATCHMAN_RELATIVE_ROOT", *cmd->query->relative_root);
+  } else {
+    cmd->env.unset("WATCHMAN_RELATIVE_ROOT");
+  }
+
+  ChildProcess::Options opts;
+  opts.environment() = cmd->env;
+#ifndef _WIN32
+  sigset_t mask;
+  sigemptyset(&mask);
+  opts.setSigMask(mask);
+#endif
+  opts.setFlags(POSIX_SPAWN_SETPGROUP);
+
+  if (!cmd->stdout_name.empty()) {
+    opts.open(STDOUT_FILENO, cmd->stdout_name.c_str(), cmd->stdout_flags, 0666);
+  } else {
+    opts.dup2(FileDescriptor::stdOut(), STDOUT_FILENO);
+  }
+
+  if (!cmd->stderr_name.empty()) {
+    opts.open(STDERR_FILENO, cmd->stderr_name.c_str(), cmd->stderr_flags, 0666);
+  } else {
+    opts.dup2(FileDescriptor::stdErr(), STDERR_FILENO);
+  }
+
+  // Figure out the appropriate cwd
+  w_string working_dir =
+      cmd->query->relative_root ? *cmd->query->relative_root : root->root_path;
+
+  auto cwd = cmd->definition.get_optional("chdir");
+  if (cwd) {
+    auto target = json_to_w_string(*cwd);
+    if (w_string_path_is_absolute(target)) {
+      working_dir = target;
+    } else {
+      working_dir = w_string::pathCat({working_dir, target});
+    }
+  }
+
+  log(DBG, "using ", working_dir, " for working dir\n");
+  opts.chdir(working_dir.c_str());
+  return opts;
+}
+
+void stop_worker(TriggerCommand* cmd) {
+  cmd->worker_input.reset();
+  if (cmd->current_proc) {
+    cmd->current_proc->kill();
+    cmd->current_proc->wait();
+    cmd->current_proc.reset();
+  }
+}
+
+// Starts the long-running command of a persistent trigger, replacing any
+// previous one.
+void start_worker(const std::shared_ptr<Root>& root, TriggerCommand* cmd) {
+  stop_worker(cmd);
+
+  // These vary from batch to batch, so the batches carry them instead
+  cmd->env.unset("WATCHMAN_SINCE");
+  cmd->env.unset("WATCHMAN_CLOCK");
+  cmd->env.unset("WATCHMAN_FILES_OVERFLOW");
+
+  auto opts = make_command_options(root, cmd);
+  opts.pipeStdin();
+
+  try {
+    auto proc = std::make_unique<ChildProcess>(
+        json_array(cmd->command.value().array()), std::move(opts));
+    cmd->worker_input =
+        w_stm_fdopen(std::move(proc->takePipe(STDIN_FILENO)->write));
+    // So that a worker that stops reading can't wedge the trigger
+    cmd->worker_input->setNonBlock(true);
+    cmd->current_proc = std::move(proc);
+  } catch (const std::exception& exc) {
+    log(ERR,
+        "trigger ",
+        root->root_path,
+        ":",
+        cmd->triggername,
+        " failed: ",
+        exc.what(),
+        "\n");
+  }
+
+  // We have integration tests that check for this string
+  log(cmd->current_proc ? DBG : ERR, "posix_spawnp: ", cmd->triggername, "\n");
+}
+
+// How long a persistent trigger's worker has to accept a batch before it
+// is considered wedged and restarted
+constexpr std::chrono::seconds kWorkerWriteTimeout{30};
+
+// Writes all of data to the non-blocking stdin of a worker.  Fails with
+// ETIMEDOUT if the worker doesn't take it within kWorkerWriteTimeout.
+bool write_to_worker(watchman_stream* stm, const std::string& data) {
+  auto deadline = std::chrono::steady_clock::now() + kWorkerWriteTimeout;
+  size_t wrote = 0;
+  while (wrote < data.size()) {
+    auto chunk = std::min(data.size() - wrote, size_t(INT_MAX));
+    int n = stm->write(data.data() + wrote, int(chunk));
+    if (n > 0) {
+      wrote += n;
+      continue;
+    }
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      return false;
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      errno = ETIMEDOUT;
+      return false;
+    }
+    // The pipe is full; give the worker a chance to drain it
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return true;
+}
+
+// Hands the results to the worker of a persistent trigger, restarting it
+// once if it has gone away or stopped reading.
+void send_to_worker(
+    const std::shared_ptr<Root>& root,
+    TriggerCommand* cmd,
+    QueryResult* res,
+    ClockSpec* since_spec) {
+  bool file_overflow = limit_files_stdin(cmd, res);
+
+  auto batch = json_object(
+      {{"root", w_string_to_json(root->root_path)},
+       {"trigger", w_string_to_json(cmd->triggername)},
+       {"clock",
+        w_string_to_json(
+            res->clockAtStartOfQuery.position().toClockString())},
+       {"files_overflow", json_boolean(file_overflow)},
+       {"files", std::move(res->resultsArray).toJson()}});
+  if (const auto* clock = since_spec
+          ? std::get_if<ClockSpec::Clock>(&since_spec->spec)
+          : nullptr) {
+    batch.set("since", w_string_to_json(clock->position.toClockString()));
+  }
+
+  std::string pdu;
+  if (w_bser_write_pdu(
+          1,
+          0,
+          [](const char* buffer, size_t size, void* data) {
+            static_cast<std::string*>(data)->append(buffer, size);
+            return 0;
+          },
+          batch,
+          &pdu) != 0) {
+    log(ERR,
+        "trigger ",
+        root->root_path,
+        ":",
+        cmd->triggername,
+        " failed to encode its batch\n");
+    return;
+  }
+
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    if (!cmd->current_proc || cmd->current_proc->terminated()) {
+      start_worker(root, cmd);
+    }
+    if (!cmd->worker_input) {
+      return;
+    }
+    if (write_to_worker(cmd->worker_input.get(), pdu)) {
+      return;
+    }
+    log(ERR,
+        "trigger ",
+        root->root_path,
+        ":",
+        cmd->triggername,
+        " failed to write to its worker: ",
+        folly::errnoStr(errno),
+        "\n");
+    // A partly written batch leaves the worker's input unusable anyway
+    stop_worker(cmd);
+  }
+}
+
 void spawn_command(
     const std::shared_ptr<Root>& root,
     TriggerCommand* cmd,
@@ -177,7 +378,7 @@ void spawn_command(
 
   // Assumption: that only one thread will be executing on a given
   // cmd instance so that mutation of cmd->env is safe.
-  // This is guaranteed in the current architecture.
+  // This is guaranteed by TriggerCommand::run holding runMutex_.
 
   // It is way too much of a hassle to try to recreate the clock value if it's
   // not a relative clock spec, and it's only going to happen on the first run
@@ -193,12 +394,6 @@ void spawn_command(
   cmd->env.set(
       "WATCHMAN_CLOCK", res->clockAtStartOfQuery.position().toClockString());
 
-  if (cmd->query->relative_root) {
-    cmd->env.set("WATCHMAN_RELATIVE_ROOT", *cmd->query->relative_root);
-  } else {
-    cmd->env.unset("WATCHMAN_RELATIVE_ROOT");
-  }
-
   // Compute args
   std::vector<json_ref> args = cmd->command.value().array();
 
@@ -231,46 +426,9 @@ void spawn_command(
 
   cmd->env.setBool("WATCHMAN_FILES_OVERFLOW", file_overflow);
 
-  ChildProcess::Options opts;
-  opts.environment() = cmd->env;
-#ifndef _WIN32
-  sigset_t mask;
-  sigemptyset(&mask);
-  opts.setSigMask(mask);
-#endif
-  opts.setFlags(POSIX_SPAWN_SETPGROUP);
-
+  auto opts = make_command_options(root, cmd);
   opts.dup2(stdin_file->getFileDescriptor(), STDIN_FILENO);
 
-  if (!cmd->stdout_name.empty()) {
-    opts.open(STDOUT_FILENO, cmd->stdout_name.c_str(), cmd->stdout_flags, 0666);
-  } else {
-    opts.dup2(FileDescriptor::stdOut(), STDOUT_FILENO);
-  }
-
-  if (!cmd->stderr_name.empty()) {
-    opts.open(STDERR_FILENO, cmd->stderr_name.c_str(), cmd->stderr_flags, 0666);
-  } else {
-    opts.dup2(FileDescriptor::stdErr(), STDERR_FILENO);
-  }
-
-  // Figure out the appropriate cwd
-  w_string working_dir =
-      cmd->query->relative_root ? *cmd->query->relative_root : root->root_path;
-
-  auto cwd = cmd->definition.get_optional("chdir");
-  if (cwd) {
-    auto target = json_to_w_string(*cwd);
-    if (w_string_path_is_absolute(target)) {
-      working_dir = target;
-    } else {
-      working_dir = w_string::pathCat({working_dir, target});
-    }
-  }
-
-  log(DBG, "using ", working_dir, " for working dir\n");
-  opts.chdir(working_dir.c_str());
-
   try {
     if (cmd->current_proc) {
       cmd->current_proc->kill();
@@ -301,12 +459,12 @@ TriggerCommand::TriggerCommand(
     const json_ref& trig)
     : definition(trig),
       append_files(false),
+      persistent(false),
       stdin_style(input_dev_null),
       max_files_stdin(0),
       stdout_flags(0),
       stderr_flags(0),
-      savedStateFactory_{savedStateFactory},
-      ping_(w_event_make_sockets()) {
+      savedStateFactory_{savedStateFactory} {
   auto queryDef = json_object();
   auto expr = definition.get_optional("expression");
   if (expr) {
@@ -344,10 +502,25 @@ TriggerCommand::TriggerCommand(
     // "easy" workaround, we'll capture the list of names from the deduping
     // mechanism.
     query->dedup_results = true;
+    query->dedup_by_name = true;
+  }
+
+  persistent = trig.get_default("persistent", json_false()).asBool();
+  if (persistent && append_files) {
+    throw CommandValidationError(
+        "append_files cannot be used with persistent triggers");
   }
 
   auto ele = definition.get_optional("stdin");
-  if (!ele) {
+  if (persistent && ele && !ele->isArray()) {
+    throw CommandValidationError(
+        "stdin must be a field list for persistent triggers");
+  }
+  if (!ele && persistent) {
+    stdin_style = input_json;
+    parse_field_list(
+        json_array({typed_string_to_json("name")}), &query->fieldList);
+  } else if (!ele) {
     stdin_style = input_dev_null;
   } else if (ele->isArray()) {
     stdin_style = input_json;
@@ -385,91 +558,52 @@ TriggerCommand::TriggerCommand(
 }
 
 TriggerCommand::~TriggerCommand() {
-  if (triggerThread_.joinable() && !stopTrigger_) {
-    // We could try to call stop() here, but that is paving over the problem,
-    // especially if we happen to be the triggerThread_ for some reason.
+  if (started_ && !stopTrigger_) {
+    // We could try to call stop() here, but that is paving over the problem.
     log(FATAL, "destroying trigger without stopping it first\n");
   }
 }
 
-void TriggerCommand::run(const std::shared_ptr<Root>& root) {
-  std::vector<std::shared_ptr<const Publisher::Item>> pending;
-  w_set_thread_name(
-      "trigger ", triggername.view(), " ", root->root_path.view());
-
-  try {
-    EventPoll pfd[1];
-    pfd[0].evt = ping_.get();
-
-    log(DBG, "waiting for settle\n");
-
-    while (!w_is_stopping() && !stopTrigger_) {
-      ignore_result(w_poll_events(pfd, 1, 86400));
-      if (w_is_stopping() || stopTrigger_) {
-        break;
-      }
-      while (ping_->testAndClear()) {
-        pending.clear();
-        subscriber_->getPending(pending);
-        bool seenSettle = false;
-        for (auto& item : pending) {
-          if (item->payload.get_optional("settled")) {
-            seenSettle = true;
-            break;
-          }
-        }
-
-        if (seenSettle) {
-          if (!maybeSpawn(root)) {
-            continue;
-          }
-          waitNoIntr();
-        }
-      }
-    }
-
-    if (current_proc) {
-      current_proc->kill();
-      current_proc->wait();
-    }
-  } catch (const std::exception& exc) {
-    log(ERR, "Uncaught exception in trigger thread: ", exc.what(), "\n");
-  }
-
-  log(DBG, "out of loop\n");
-}
-
 void TriggerCommand::stop() {
+  std::lock_guard<std::mutex> guard(runMutex_);
   stopTrigger_ = true;
-  if (triggerThread_.joinable()) {
-    ping_->notify();
-    triggerThread_.join();
-  }
+  stop_worker(this);
 }
 
 void TriggerCommand::start(const std::shared_ptr<Root>& root) {
-  subscriber_ =
-      root->unilateralResponses->subscribe([this] { ping_->notify(); });
-  triggerThread_ = std::thread([this, root] {
-    try {
-      run(root);
-    } catch (const std::exception& e) {
-      log(ERR, "exception in trigger thread: ", e.what(), "\n");
+  {
+    std::lock_guard<std::mutex> guard(runMutex_);
+    started_ = true;
+    if (persistent) {
+      start_worker(root, this);
     }
-  });
+  }
+  root->triggerScheduler->start(root);
+  log(DBG, "waiting for settle\n");
 }
 
-bool TriggerCommand::maybeSpawn(const std::shared_ptr<Root>& root) {
-  bool didRun = false;
-
-  // If it looks like we're in a repo undergoing a rebase or
-  // other similar operation, we want to defer triggers until
-  // things settle down
-  if (root->view()->isVCSOperationInProgress()) {
-    logf(DBG, "deferring triggers until VCS operations complete\n");
-    return false;
+w_string TriggerCommand::sharedQueryKey() const {
+  // Everything in the definition that goes into the query
+  auto spec = json_object();
+  for (const char* key :
+       {"expression", "relative_root", "stdin", "append_files", "persistent"}) {
+    if (auto value = definition.get_optional(key)) {
+      spec.set(key, json_ref(*value));
+    }
   }
 
+  const auto* since_spec = query->since_spec.get();
+  const auto* clock = since_spec
+      ? std::get_if<ClockSpec::Clock>(&since_spec->spec)
+      : nullptr;
+  return w_string::build(
+      clock ? clock->position.toClockString() : w_string(),
+      ":",
+      json_dumps(spec, JSON_SORT_KEYS | JSON_COMPACT));
+}
+
+std::optional<QueryResult> TriggerCommand::evaluate(
+    const std::shared_ptr<Root>& root) {
   auto since_spec = query->since_spec.get();
 
   if (const auto* clock = since_spec
@@ -498,23 +632,7 @@ bool TriggerCommand::maybeSpawn(const std::shared_ptr<Root>& root) {
         "\" generated ",
         res.resultsArray.results.size(),
         " results\n");
-
-    // create a new spec that will be used the next time
-    auto saved_spec = std::move(query->since_spec);
-    query->since_spec = std::make_unique<ClockSpec>(res.clockAtStartOfQuery);
-
-    log(DBG,
-        "updating trigger \"",
-        triggername,
-        "\" use ",
-        res.clockAtStartOfQuery.position().ticks,
-        " ticks next time\n");
-
-    if (!res.resultsArray.results.empty()) {
-      didRun = true;
-      spawn_command(root, this, &res, saved_spec.get());
-    }
-    return didRun;
+    return res;
   } catch (const QueryExecError& e) {
     log(ERR,
         "error running trigger \"",
@@ -522,7 +640,55 @@ bool TriggerCommand::maybeSpawn(const std::shared_ptr<Root>& root) {
         "\" query: ",
         e.what(),
         "\n");
-    return false;
+    return std::nullopt;
+  }
+}
+
+void TriggerCommand::run(
+    const std::shared_ptr<Root>& root,
+    std::optional<QueryResult>& shared,
+    bool last) {
+  std::lock_guard<std::mutex> guard(runMutex_);
+  if (stopTrigger_ || w_is_stopping()) {
+    return;
+  }
+  waitNoIntr();
+
+  if (!shared) {
+    shared = evaluate(root);
+    if (!shared) {
+      return;
+    }
+  } else {
+    log(DBG,
+        "trigger \"",
+        triggername,
+        "\" reusing the results of an identical query\n");
+  }
+  auto res = last ? std::move(*shared) : *shared;
+
+  if (!res.isFreshInstance) {
+    // A fresh instance is a poor predictor of the next run's results
+    query->expected_results = res.resultsArray.results.size();
+  }
+
+  // create a new spec that will be used the next time
+  auto saved_spec = std::move(query->since_spec);
+  query->since_spec = std::make_unique<ClockSpec>(res.clockAtStartOfQuery);
+
+  log(DBG,
+      "updating trigger \"",
+      triggername,
+      "\" use ",
+      res.clockAtStartOfQuery.position().ticks,
+      " ticks next time\n");
+
+  if (!res.resultsArray.results.empty()) {
+    if (persistent) {
+      send_to_worker(root, this, &res, saved_spec.get());
+    } else {
+      spawn_command(root, this, &res, saved_spec.get());
+    }
   }
 }
 
@@ -536,4 +702,144 @@ bool TriggerCommand::waitNoIntr() {
   return false;
 }
 
+void TriggerScheduler::start(const std::shared_ptr<Root>& root) {
+  auto state = state_.lock();
+  if (state->subscriber) {
+    return;
+  }
+  state->root = root;
+  state->subscriber =
+      root->unilateralResponses->subscribe([this] { schedule(); });
+}
+
+void TriggerScheduler::schedule() {
+  std::shared_ptr<Root> root;
+  {
+    auto state = state_.lock();
+    if (state->busy) {
+      state->again = true;
+      return;
+    }
+    root = state->root.lock();
+    if (!root) {
+      return;
+    }
+    state->busy = true;
+  }
+
+  try {
+    getTriggerThreadPool().add([this, root] { run(root); });
+  } catch (const std::exception& exc) {
+    log(ERR,
+        "unable to run the triggers of ",
+        root->root_path,
+        ": ",
+        exc.what(),
+        "\n");
+    state_.lock()->busy = false;
+  }
+}
+
+std::shared_ptr<TriggerScheduler::Batch> TriggerScheduler::takeBatch(
+    const std::shared_ptr<Root>& root) {
+  std::vector<std::shared_ptr<const Publisher::Item>> pending;
+  state_.lock()->subscriber->getPending(pending);
+  bool seenSettle = std::any_of(pending.begin(), pending.end(), [](auto& item) {
+    return item->payload.get_optional("settled").has_value();
+  });
+  if (!seenSettle) {
+    return nullptr;
+  }
+
+  // If it looks like we're in a repo undergoing a rebase or
+  // other similar operation, we want to defer triggers until
+  // things settle down
+  if (root->view()->isVCSOperationInProgress()) {
+    logf(DBG, "deferring triggers until VCS operations complete\n");
+    return nullptr;
+  }
+
+  auto batch = std::make_shared<Batch>();
+  batch->root = root;
+  std::unordered_map<w_string, size_t> groupIndex;
+  {
+    auto map = root->triggers.rlock();
+    for (auto& [name, cmd] : *map) {
+      auto [it, inserted] =
+          groupIndex.emplace(cmd->sharedQueryKey(), batch->groups.size());
+      if (inserted) {
+        batch->groups.emplace_back();
+      }
+      batch->groups[it->second].push_back(cmd);
+    }
+  }
+  if (batch->groups.empty()) {
+    return nullptr;
+  }
+  return batch;
+}
+
+bool TriggerScheduler::work(Batch& batch) {
+  size_t index;
+  while ((index = batch.nextGroup.fetch_add(1)) < batch.groups.size()) {
+    auto& group = batch.groups[index];
+    std::optional<QueryResult> shared;
+    for (size_t i = 0; i < group.size(); ++i) {
+      try {
+        group[i]->run(batch.root, shared, i + 1 == group.size());
+      } catch (const std::exception& exc) {
+        log(ERR,
+            "exception running trigger ",
+            group[i]->triggername,
+            ": ",
+            exc.what(),
+            "\n");
+      }
+    }
+  }
+  return batch.workers.fetch_sub(1) == 1;
+}
+
+void TriggerScheduler::run(const std::shared_ptr<Root>& root) {
+  do {
+    auto batch = takeBatch(root);
+    if (!batch) {
+      continue;
+    }
+
+    auto concurrency = std::max<json_int_t>(
+        1, root->config.getInt("trigger_concurrency", 4));
+    auto numWorkers = std::min(batch->groups.size(), size_t(concurrency));
+    batch->workers = numWorkers;
+    // This thread is one of the workers
+    for (size_t i = 1; i < numWorkers; ++i) {
+      try {
+        getTriggerThreadPool().add([this, batch] {
+          if (work(*batch)) {
+            run(batch->root);
+          }
+        });
+      } catch (const std::exception&) {
+        // The remaining groups are left to the workers that did start
+        batch->workers -= numWorkers - i;
+        break;
+      }
+    }
+    if (!work(*batch)) {
+      // The last worker to finish carries on from here
+      return;
+    }
+  } while (!becomeIdle());
+}
+
+bool TriggerScheduler::becomeIdle() {
+  auto state = state_.lock();
+  if (state->again) {
+    state->again = false;
+    return false;
+  }
+  state->busy = false;
+  return true;
+}
+
 } // namespace watchman
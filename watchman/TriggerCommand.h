@@ -7,15 +7,19 @@
 
 #pragma once
 
-#include <thread>
+#include <folly/Synchronized.h>
+#include <atomic>
+#include <mutex>
+#include <optional>
 
 #include "watchman/ChildProcess.h"
 #include "watchman/PubSub.h"
+#include "watchman/query/QueryResult.h"
 #include "watchman/saved_state/SavedStateInterface.h"
+#include "watchman/watchman_stream.h"
 
 namespace watchman {
 
-class Event;
 class Root;
 struct Query;
 
@@ -29,6 +33,9 @@ struct TriggerCommand {
   ChildProcess::Environment env;
 
   bool append_files;
+  // When set, the command is started once and kept running, and each batch
+  // of changes is written to its stdin as a BSER PDU.
+  bool persistent;
   enum trigger_input_style stdin_style;
   uint32_t max_files_stdin;
 
@@ -40,6 +47,8 @@ struct TriggerCommand {
   /* While we are running, this holds the pid
    * of the running process */
   std::unique_ptr<ChildProcess> current_proc;
+  // For a persistent trigger, the write end of its worker's stdin
+  std::unique_ptr<watchman_stream> worker_input;
 
   TriggerCommand(
       SavedStateFactory savedStateFactory,
@@ -50,6 +59,24 @@ struct TriggerCommand {
   void stop();
   void start(const std::shared_ptr<Root>& root);
 
+  /**
+   * Triggers whose queries have the same key produce the same results, and
+   * can share a single evaluation.
+   */
+  w_string sharedQueryKey() const;
+
+  /**
+   * Called by the root's TriggerScheduler when the root settles.  Evaluates
+   * the query, unless `shared` already holds the results of a trigger with
+   * the same sharedQueryKey, in which case it is left for the next trigger
+   * to use, and hands any results to the command.  If `last` is set, the
+   * results are moved out of `shared` rather than copied.
+   */
+  void run(
+      const std::shared_ptr<Root>& root,
+      std::optional<QueryResult>& shared,
+      bool last);
+
  private:
   TriggerCommand(const TriggerCommand&) = delete;
   TriggerCommand(TriggerCommand&&) = delete;
@@ -57,15 +84,61 @@ struct TriggerCommand {
   TriggerCommand& operator=(const TriggerCommand&) = delete;
   TriggerCommand& operator=(TriggerCommand&&) = delete;
 
-  void run(const std::shared_ptr<Root>& root);
-  bool maybeSpawn(const std::shared_ptr<Root>& root);
+  std::optional<QueryResult> evaluate(const std::shared_ptr<Root>& root);
   bool waitNoIntr();
 
   const SavedStateFactory savedStateFactory_;
-  std::thread triggerThread_;
-  std::shared_ptr<Publisher::Subscriber> subscriber_;
-  std::unique_ptr<Event> ping_;
-  bool stopTrigger_{false};
+  // Held while the scheduler runs this trigger, and while it is stopped
+  std::mutex runMutex_;
+  bool started_{false};
+  std::atomic<bool> stopTrigger_{false};
+};
+
+/**
+ * Runs the triggers of a root on the trigger thread pool each time the root
+ * settles, rather than giving each trigger a thread of its own that wakes on
+ * every settle.  Triggers whose queries are the same share one evaluation,
+ * and up to trigger_concurrency groups of them are evaluated and dispatched
+ * at once.
+ */
+class TriggerScheduler {
+ public:
+  /**
+   * Starts watching `root` for settles, if not already.  Called as each of
+   * its triggers is started.
+   */
+  void start(const std::shared_ptr<Root>& root);
+
+ private:
+  struct Batch {
+    std::shared_ptr<Root> root;
+    std::vector<std::vector<std::shared_ptr<TriggerCommand>>> groups;
+    std::atomic<size_t> nextGroup{0};
+    std::atomic<size_t> workers{0};
+  };
+
+  // Called by the publisher, on whatever thread enqueued the item
+  void schedule();
+  // Runs on the trigger thread pool until no settle is left to handle
+  void run(const std::shared_ptr<Root>& root);
+  // Groups the triggers that are due, or returns nullptr if there are none
+  std::shared_ptr<Batch> takeBatch(const std::shared_ptr<Root>& root);
+  // Runs groups of the batch until there are none left, and returns whether
+  // this was the last worker on it to finish
+  static bool work(Batch& batch);
+  // Returns false, rather than going idle, if another settle may have been
+  // published since the subscriber was last drained
+  bool becomeIdle();
+
+  struct State {
+    std::weak_ptr<Root> root;
+    std::shared_ptr<Publisher::Subscriber> subscriber;
+    // Set while run is queued or running
+    bool busy{false};
+    // Set if schedule was called while busy
+    bool again{false};
+  };
+  folly::Synchronized<State, std::mutex> state_;
 };
 
 } // namespace watchman
@@ -155,4 +155,21 @@ std::string computeWatchmanStateDirectory(const std::string& user) {
 #endif
 }
 
+std::optional<std::string> getExistingUnixSockName(const std::string& user) {
+#ifdef _WIN32
+  (void)user;
+  return std::nullopt;
+#else
+  auto state_dir = computeWatchmanStateDirectory(user);
+  // The same checks that are made when the state dir is set up, so that we
+  // don't talk to a socket that someone else could have put there.
+  struct stat st;
+  if (stat(state_dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) ||
+      st.st_uid != geteuid() || (st.st_mode & 0022)) {
+    return std::nullopt;
+  }
+  return fmt::format("{}/sock", state_dir);
+#endif
+}
+
 } // namespace watchman
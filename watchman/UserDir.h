@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <optional>
 #include <string>
 
 namespace watchman {
@@ -26,4 +27,13 @@ const std::string& getTemporaryDirectory();
  */
 std::string computeWatchmanStateDirectory(const std::string& user);
 
+/**
+ * Returns the path of the unix domain socket in the state directory of the
+ * given user, if that directory already exists and is private to the
+ * current user.  Unlike setting up the state directory, this doesn't create
+ * it or change its permissions, so clients can use it to find a running
+ * server cheaply.
+ */
+std::optional<std::string> getExistingUnixSockName(const std::string& user);
+
 } // namespace watchman
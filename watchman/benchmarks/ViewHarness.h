@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "watchman/InMemoryView.h"
+#include "watchman/root/Root.h"
+#include "watchman/test/lib/FakeFileSystem.h"
+#include "watchman/test/lib/FakeWatcher.h"
+
+namespace watchman {
+
+inline const w_string kBenchRootPath{FAKEFS_ROOT "root"};
+
+/**
+ * A synthetic tree: every directory holds `filesPerDir` files and, down to
+ * `depth` levels below the root, `fanOut` subdirectories named dir0, dir1...
+ * File names cycle through a few suffixes so that queries have something to
+ * select.
+ */
+struct TreeShape {
+  int depth;
+  int fanOut;
+  int filesPerDir;
+
+  static TreeShape fromArgs(const benchmark::State& state) {
+    return TreeShape{
+        int(state.range(0)), int(state.range(1)), int(state.range(2))};
+  }
+};
+
+struct Tree {
+  std::vector<w_string> dirs;
+  std::vector<w_string> files;
+
+  size_t numNodes() const {
+    return dirs.size() + files.size();
+  }
+};
+
+namespace detail {
+inline void buildDir(
+    FakeFileSystem& fs,
+    const std::string& path,
+    const TreeShape& shape,
+    int depth,
+    Tree& tree) {
+  static constexpr const char* kSuffixes[] = {"cpp", "h", "py", "txt"};
+
+  fs.addNode(path.c_str(), fs.fakeDir());
+  tree.dirs.emplace_back(path.data(), path.size());
+  for (int i = 0; i < shape.filesPerDir; ++i) {
+    auto file = fmt::format("{}/file{}.{}", path, i, kSuffixes[i % 4]);
+    fs.addNode(file.c_str(), fs.fakeFile());
+    tree.files.emplace_back(file.data(), file.size());
+  }
+  if (depth < shape.depth) {
+    for (int i = 0; i < shape.fanOut; ++i) {
+      buildDir(fs, fmt::format("{}/dir{}", path, i), shape, depth + 1, tree);
+    }
+  }
+}
+} // namespace detail
+
+inline Tree buildTree(FakeFileSystem& fs, const TreeShape& shape) {
+  Tree tree;
+  detail::buildDir(fs, kBenchRootPath.string(), shape, 0, tree);
+  return tree;
+}
+
+/**
+ * Drives the IO thread of a view over a FakeFileSystem one step at a time,
+ * as InMemoryViewTest does, so that benchmarks measure the view rather than
+ * the kernel.
+ */
+class ViewHarness {
+ public:
+  explicit ViewHarness(FakeFileSystem& fs, bool usePwalk = false)
+      : config{getConfiguration(usePwalk)},
+        watcher{std::make_shared<FakeWatcher>(fs)},
+        view{std::make_shared<InMemoryView>(
+            fs,
+            kBenchRootPath,
+            config,
+            watcher)},
+        pending{view->unsafeAccessPendingFromWatcher()},
+        root{std::make_shared<Root>(
+            fs,
+            kBenchRootPath,
+            "fs_type",
+            w_string_to_json("{}"),
+            config,
+            view,
+            [] {})} {
+    pending.lock()->ping();
+  }
+
+  void step() {
+    view->stepIoThread(root, state, pending);
+  }
+
+  // Delivers the paths as the notify thread would, then lets the IO thread
+  // process them.
+  template <typename Paths>
+  void notify(const Paths& paths) {
+    {
+      auto now = std::chrono::system_clock::now();
+      auto lock = pending.lock();
+      for (auto& path : paths) {
+        lock->add(path, now, W_PENDING_VIA_NOTIFY);
+      }
+      lock->ping();
+    }
+    step();
+  }
+
+  Configuration config;
+  std::shared_ptr<FakeWatcher> watcher;
+  std::shared_ptr<InMemoryView> view;
+  PendingCollection& pending;
+  std::shared_ptr<Root> root;
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+
+ private:
+  static Configuration getConfiguration(bool usePwalk) {
+    json_ref json = json_object();
+    json_object_set(json, "enable_parallel_crawl", json_boolean(usePwalk));
+    return Configuration{std::move(json)};
+  }
+};
+
+} // namespace watchman
@@ -164,6 +164,45 @@ std::vector<char> unpredictable_bser_data() {
   return output;
 }
 
+// A query-style response: a templated array of file records
+std::vector<char> templated_bser_data() {
+  constexpr size_t kRootSize = 10000;
+
+  std::vector<json_ref> values;
+  values.reserve(kRootSize);
+  for (size_t i = 0; i < kRootSize; ++i) {
+    values.push_back(json_object(
+        {{"name", w_string_to_json(w_string::build("dir/file", i))},
+         {"exists", json_true()},
+         {"size", json_integer(i * 37)},
+         {"mtime_ms", json_integer(1661943594000 + i)}}));
+  }
+  json_ref root = json_array(std::move(values));
+  json_array_set_template_new(
+      root,
+      json_array(
+          {typed_string_to_json("name"),
+           typed_string_to_json("exists"),
+           typed_string_to_json("size"),
+           typed_string_to_json("mtime_ms")}));
+
+  bser_ctx_t ctx;
+  ctx.bser_version = 2;
+  ctx.bser_capabilities = 0;
+  std::vector<char> output;
+  ctx.dump = [](const char* buffer, size_t size, void* opaque) -> int {
+    auto& output = *static_cast<std::vector<char>*>(opaque);
+    output.insert(output.end(), buffer, buffer + size);
+    return 0;
+  };
+  if (w_bser_dump(&ctx, root, &output)) {
+    throw std::runtime_error("w_bser_dump failed");
+  }
+
+  fmt::print("generated {} bytes of templated BSER data\n", output.size());
+  return output;
+}
+
 static std::vector<json_ref> leaks;
 
 template <std::vector<char> (*SynthesizeFn)()>
@@ -184,6 +223,21 @@ struct ParseBenchmark {
 template <std::vector<char> (*SynthesizeFn)()>
 std::vector<char> ParseBenchmark<SynthesizeFn>::data = SynthesizeFn();
 
+// Validates the document and reads one field of its last element, which
+// is the least favorable access pattern for a view.
+template <std::vector<char> (*SynthesizeFn)()>
+struct ViewBenchmark {
+  static void run(benchmark::State& state) {
+    auto& data = ParseBenchmark<SynthesizeFn>::data;
+    for (auto _ : state) {
+      auto view = BserView::parse(data.data(), data.data() + data.size());
+      auto last = view.at(view.size() - 1);
+      auto name = last.isObject() ? last.get("name") : std::nullopt;
+      benchmark::DoNotOptimize(name);
+    }
+  }
+};
+
 void bser_parse_predictable(benchmark::State& state) {
   ParseBenchmark<predictable_bser_data>::run(state);
 }
@@ -194,6 +248,26 @@ void bser_parse_unpredictable(benchmark::State& state) {
 }
 BENCHMARK(bser_parse_unpredictable);
 
+void bser_parse_templated(benchmark::State& state) {
+  ParseBenchmark<templated_bser_data>::run(state);
+}
+BENCHMARK(bser_parse_templated);
+
+void bser_view_predictable(benchmark::State& state) {
+  ViewBenchmark<predictable_bser_data>::run(state);
+}
+BENCHMARK(bser_view_predictable);
+
+void bser_view_unpredictable(benchmark::State& state) {
+  ViewBenchmark<unpredictable_bser_data>::run(state);
+}
+BENCHMARK(bser_view_unpredictable);
+
+void bser_view_templated(benchmark::State& state) {
+  ViewBenchmark<templated_bser_data>::run(state);
+}
+BENCHMARK(bser_view_templated);
+
 } // namespace
 
 int main(int argc, char** argv) {
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "watchman/Logging.h"
+#include "watchman/benchmarks/ViewHarness.h"
+
+namespace {
+
+using namespace watchman;
+
+// Args: depth, fan-out, files per directory, parallel crawl
+void crawl(benchmark::State& state) {
+  FakeFileSystem fs;
+  auto tree = buildTree(fs, TreeShape::fromArgs(state));
+  bool usePwalk = state.range(3) != 0;
+
+  std::optional<ViewHarness> harness;
+  for (auto _ : state) {
+    // Tearing down the previous view frees every node, which is not part of
+    // the crawl.
+    state.PauseTiming();
+    harness.reset();
+    harness.emplace(fs, usePwalk);
+    state.ResumeTiming();
+
+    harness->step();
+  }
+  state.SetItemsProcessed(state.iterations() * tree.numNodes());
+}
+
+BENCHMARK(crawl)
+    ->Args({0, 0, 50000, 0})
+    ->Args({2, 32, 16, 0})
+    ->Args({4, 8, 16, 0})
+    ->Args({4, 8, 16, 1})
+    ->Args({8, 2, 64, 0})
+    ->Unit(benchmark::kMillisecond);
+
+// Args: events per batch, distinct files they name
+void event_storm(benchmark::State& state) {
+  FakeFileSystem fs;
+  auto tree = buildTree(fs, TreeShape{2, 16, 32});
+  ViewHarness harness{fs};
+  harness.step();
+
+  auto distinct = std::min(size_t(state.range(1)), tree.files.size());
+  std::vector<w_string> events;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    events.push_back(tree.files[i % distinct]);
+  }
+
+  for (auto _ : state) {
+    harness.notify(events);
+  }
+  state.SetItemsProcessed(state.iterations() * events.size());
+}
+
+BENCHMARK(event_storm)
+    ->Args({1, 1})
+    ->Args({1000, 1000})
+    ->Args({10000, 100})
+    ->Args({8000, 8000})
+    ->Unit(benchmark::kMicrosecond);
+
+// Args: depth, fan-out, files per directory. Half of the top level
+// directories are deleted before each ageOut.
+void age_out(benchmark::State& state) {
+  auto shape = TreeShape::fromArgs(state);
+  size_t agedFiles = 0;
+
+  std::unique_ptr<FakeFileSystem> fs;
+  std::optional<ViewHarness> harness;
+  for (auto _ : state) {
+    state.PauseTiming();
+    harness.reset();
+    fs = std::make_unique<FakeFileSystem>();
+    buildTree(*fs, shape);
+    harness.emplace(*fs);
+    harness->step();
+
+    std::vector<w_string> removed;
+    for (int i = 0; i < shape.fanOut; i += 2) {
+      auto dir = fmt::format("{}/dir{}", kBenchRootPath, i);
+      fs->removeRecursively(dir.c_str());
+      removed.emplace_back(dir.data(), dir.size());
+    }
+    harness->notify(removed);
+    state.ResumeTiming();
+
+    int64_t walked = 0;
+    int64_t files = 0;
+    int64_t dirs = 0;
+    harness->view->ageOut(walked, files, dirs, std::chrono::seconds(0));
+    agedFiles += files;
+  }
+  state.counters["aged_files"] =
+      benchmark::Counter(agedFiles, benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK(age_out)
+    ->Args({2, 32, 16})
+    ->Args({4, 8, 16})
+    ->Unit(benchmark::kMillisecond);
+
+// Args: depth, fan-out, files per directory. Measures the work done each
+// time the view settles with nothing pending.
+void settle(benchmark::State& state) {
+  FakeFileSystem fs;
+  buildTree(fs, TreeShape::fromArgs(state));
+  ViewHarness harness{fs};
+  harness.step();
+
+  for (auto _ : state) {
+    harness.pending.lock()->ping();
+    harness.step();
+  }
+}
+
+BENCHMARK(settle)
+    ->Args({0, 0, 16})
+    ->Args({4, 8, 16})
+    ->Unit(benchmark::kMicrosecond);
+
+} // namespace
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  // The crawl and age out log every time they finish
+  getLog().setStdErrLoggingLevel(OFF);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
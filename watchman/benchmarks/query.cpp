@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+#include <optional>
+#include <stdexcept>
+#include "watchman/Logging.h"
+#include "watchman/benchmarks/ViewHarness.h"
+#include "watchman/bser.h"
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryResult.h"
+#include "watchman/query/eval.h"
+#include "watchman/query/parse.h"
+
+namespace {
+
+using namespace watchman;
+
+// 4369 directories of 256 files each: a little over 1.1 million files
+constexpr TreeShape kShape{3, 16, 256};
+
+// Every this many files changes after the crawl, for `since` queries
+constexpr size_t kChangedFileStride = 100;
+
+class QueryFixture {
+ public:
+  static QueryFixture& get() {
+    static QueryFixture fixture;
+    return fixture;
+  }
+
+  FakeFileSystem fs;
+  Tree tree;
+  ViewHarness harness;
+  w_string clockBeforeChanges;
+
+ private:
+  QueryFixture() : tree{buildTree(fs, kShape)}, harness{fs} {
+    fmt::print("crawling {} files\n", tree.files.size());
+    harness.step();
+
+    clockBeforeChanges = harness.view->getCurrentClockString();
+    std::vector<w_string> changed;
+    for (size_t i = 0; i < tree.files.size(); i += kChangedFileStride) {
+      fs.updateMetadata(
+          tree.files[i].c_str(), [](FileInformation& fi) { fi.size = 1; });
+      changed.push_back(tree.files[i]);
+    }
+    harness.notify(changed);
+  }
+};
+
+enum class Encoding { Json, Bser };
+
+json_ref parseQueryJson(const char* text) {
+  json_error_t err;
+  auto parsed = json_loads(text, JSON_REJECT_DUPLICATES, &err);
+  if (!parsed) {
+    throw std::runtime_error(fmt::format("bad query {}: {}", text, err.text));
+  }
+  return std::move(*parsed);
+}
+
+// Runs `text` as a query against the fixture and encodes its results as a
+// client of `encoding` would receive them. Unless the query picks its own,
+// several fields are rendered so that BSER results use a template.
+void query(
+    benchmark::State& state,
+    const char* text,
+    bool since,
+    Encoding encoding) {
+  auto& fixture = QueryFixture::get();
+  auto& root = fixture.harness.root;
+
+  auto queryJson = parseQueryJson(text);
+  if (!queryJson.get_optional("fields")) {
+    json_object_set(
+        queryJson,
+        "fields",
+        json_array(
+            {w_string_to_json("name"),
+             w_string_to_json("size"),
+             w_string_to_json("exists")}));
+  }
+  // Nothing runs the IO thread to observe the cookie
+  json_object_set(queryJson, "sync_timeout", json_integer(0));
+  if (since) {
+    json_object_set(
+        queryJson, "since", w_string_to_json(fixture.clockBeforeChanges));
+  }
+  auto parsed = parseQuery(root, queryJson);
+
+  std::optional<BserResultEncoding> bserEncoding;
+  bser_ctx_t ctx;
+  ctx.bser_version = 2;
+  ctx.bser_capabilities = 0;
+  ctx.dump = [](const char*, size_t size, void* opaque) -> int {
+    *static_cast<size_t*>(opaque) += size;
+    return 0;
+  };
+  if (encoding == Encoding::Bser) {
+    bserEncoding = BserResultEncoding{ctx.bser_version, ctx.bser_capabilities};
+  }
+
+  size_t results = 0;
+  size_t bytes = 0;
+  for (auto _ : state) {
+    auto res = w_query_execute(
+        parsed.get(), root, nullptr, nullptr, nullptr, bserEncoding);
+    results += res.resultsArray.results.size();
+    if (res.resultsArray.bserRows) {
+      results += res.resultsArray.bserRows->size();
+    }
+    auto files = std::move(res.resultsArray).toJson();
+    if (encoding == Encoding::Bser) {
+      if (w_bser_dump(&ctx, files, &bytes)) {
+        throw std::runtime_error("w_bser_dump failed");
+      }
+    } else {
+      bytes += json_dumps(files, JSON_COMPACT).size();
+    }
+  }
+  state.counters["results"] =
+      benchmark::Counter(results, benchmark::Counter::kAvgIterations);
+  state.SetBytesProcessed(bytes);
+}
+
+#define QUERY_BENCHMARK(name, text, since)                              \
+  BENCHMARK_CAPTURE(query, name##_json, text, since, Encoding::Json)    \
+      ->Unit(benchmark::kMillisecond);                                  \
+  BENCHMARK_CAPTURE(query, name##_bser, text, since, Encoding::Bser)    \
+      ->Unit(benchmark::kMillisecond)
+
+QUERY_BENCHMARK(suffix, R"({"suffix": ["cpp"]})", false);
+QUERY_BENCHMARK(since, R"({"expression": ["type", "f"]})", true);
+QUERY_BENCHMARK(glob_recursive, R"({"glob": ["**/*.h"]})", false);
+QUERY_BENCHMARK(
+    match_wholename,
+    R"({"expression": ["match", "dir1/**/file1*.h", "wholename"]})",
+    false);
+QUERY_BENCHMARK(
+    dedup_relative_root,
+    R"({"relative_root": "dir2", "dedup_results": true,
+        "expression": ["suffix", "py"], "fields": ["name"]})",
+    false);
+
+} // namespace
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  getLog().setStdErrLoggingLevel(OFF);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
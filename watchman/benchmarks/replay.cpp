@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "watchman/EventTrace.h"
+#include "watchman/Logging.h"
+#include "watchman/benchmarks/ViewHarness.h"
+
+/**
+ * Replays an event trace captured by `watchman debug-event-trace` through
+ * FakeWatcher into an InMemoryView, so that IO thread changes can be
+ * measured against a real workload:
+ *
+ *   replay --trace=PATH [--realtime] [--benchmark_...]
+ *
+ * The tree holds every path that the trace names, as a file unless other
+ * paths are beneath it.  Without --realtime the batches are delivered as
+ * fast as the IO thread processes them; with it, each batch waits until
+ * its offset in the trace, so that the settle and coalescing behavior
+ * matches the capture.
+ */
+
+namespace {
+
+using namespace watchman;
+
+std::string tracePath;
+bool realtime = false;
+
+w_string absolutePath(const w_string& relPath) {
+  if (relPath.empty()) {
+    return kBenchRootPath;
+  }
+  return w_string::pathCat({kBenchRootPath, relPath});
+}
+
+void buildTreeForTrace(
+    FakeFileSystem& fs,
+    const std::vector<TracedBatch>& batches) {
+  std::unordered_set<w_string> dirs;
+  std::unordered_set<w_string> files;
+  for (auto& batch : batches) {
+    for (auto& change : batch.changes) {
+      if (change.path.empty()) {
+        continue;
+      }
+      files.insert(change.path);
+      for (auto dir = change.path.piece().dirName(); !dir.empty();
+           dir = dir.dirName()) {
+        if (!dirs.insert(dir.asWString()).second) {
+          break;
+        }
+      }
+    }
+  }
+
+  fs.addNode(kBenchRootPath.c_str(), fs.fakeDir());
+  // Parents sort before their children
+  std::vector<w_string> sortedDirs{dirs.begin(), dirs.end()};
+  std::sort(sortedDirs.begin(), sortedDirs.end());
+  for (auto& dir : sortedDirs) {
+    fs.addNode(absolutePath(dir).c_str(), fs.fakeDir());
+  }
+  for (auto& file : files) {
+    if (!dirs.count(file)) {
+      fs.addNode(absolutePath(file).c_str(), fs.fakeFile());
+    }
+  }
+}
+
+void deliver(ViewHarness& harness, const TracedBatch& batch) {
+  auto now = std::chrono::system_clock::now();
+  std::vector<PendingChange> changes;
+  changes.reserve(batch.changes.size());
+  for (auto& change : batch.changes) {
+    changes.push_back(
+        PendingChange{absolutePath(change.path), now, change.flags});
+  }
+  harness.watcher->queueChanges(std::move(changes));
+  {
+    auto lock = harness.pending.lock();
+    harness.watcher->consumeNotify(harness.root, *lock);
+    lock->ping();
+  }
+  harness.step();
+}
+
+void replay(benchmark::State& state) {
+  if (tracePath.empty()) {
+    state.SkipWithError("pass --trace=PATH");
+    return;
+  }
+  auto batches = readEventTrace(tracePath.c_str());
+  FakeFileSystem fs;
+  buildTreeForTrace(fs, batches);
+
+  size_t changes = 0;
+  for (auto& batch : batches) {
+    changes += batch.changes.size();
+  }
+
+  std::optional<ViewHarness> harness;
+  for (auto _ : state) {
+    state.PauseTiming();
+    harness.reset();
+    harness.emplace(fs);
+    harness->step();
+    state.ResumeTiming();
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto& batch : batches) {
+      if (realtime) {
+        std::this_thread::sleep_until(start + batch.offset);
+      }
+      deliver(*harness, batch);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * changes);
+  state.counters["batches"] = double(batches.size());
+}
+
+BENCHMARK(replay)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+} // namespace
+
+int main(int argc, char** argv) {
+  // Take our own flags out before the benchmark library sees them
+  int kept = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--trace=", 8) == 0) {
+      tracePath = argv[i] + 8;
+    } else if (strcmp(argv[i], "--realtime") == 0) {
+      realtime = true;
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+  argc = kept;
+
+  ::benchmark::Initialize(&argc, argv);
+  if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  // The crawl logs every time it finishes
+  getLog().setStdErrLoggingLevel(OFF);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
@@ -6,6 +6,7 @@
  */
 
 #include <benchmark/benchmark.h>
+#include "watchman/PathBuilder.h"
 #include "watchman/watchman_string.h"
 
 namespace {
@@ -39,6 +40,72 @@ void string_piece_hash(benchmark::State& state) {
 
 BENCHMARK(string_piece_hash);
 
+void string_piece_has_suffix(benchmark::State& state) {
+  w_string_piece name = "SomeComponentWithALongishName.CPP";
+  w_string_piece suffix = "cpp";
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(name.hasSuffix(suffix));
+  }
+}
+
+BENCHMARK(string_piece_has_suffix);
+
+void string_equal_caseless(benchmark::State& state) {
+  w_string_piece a = "watchman/query/SomeComponentWithALongishName.cpp";
+  w_string_piece b = "WATCHMAN/query/somecomponentwithalongishname.CPP";
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(w_string_equal_caseless(a, b));
+  }
+}
+
+BENCHMARK(string_equal_caseless);
+
+void string_piece_as_lower_case(benchmark::State& state) {
+  w_string_piece name = "watchman/query/SomeComponentWithALongishName.cpp";
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(name.asLowerCase());
+  }
+}
+
+BENCHMARK(string_piece_as_lower_case);
+
+void lower_case_buffer(benchmark::State& state) {
+  w_string_piece name = "watchman/query/SomeComponentWithALongishName.cpp";
+  for (auto _ : state) {
+    watchman::LowerCaseBuffer lower{name};
+    benchmark::DoNotOptimize(lower.piece().data());
+  }
+}
+
+BENCHMARK(lower_case_buffer);
+
+void string_path_cat(benchmark::State& state) {
+  w_string root = "/data/users/someone/repo";
+  w_string_piece dir = "watchman/query";
+  w_string_piece name = "SomeComponentWithALongishName.cpp";
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(w_string::pathCat({root, dir, name}));
+  }
+}
+
+BENCHMARK(string_path_cat);
+
+void path_builder_append_components(benchmark::State& state) {
+  w_string root = "/data/users/someone/repo";
+  w_string_piece dir = "watchman/query";
+  w_string_piece name = "SomeComponentWithALongishName.cpp";
+  watchman::PathBuilder buf;
+  for (auto _ : state) {
+    buf.clear();
+    buf.appendComponent(root);
+    buf.appendComponent(dir);
+    buf.appendComponent(name);
+    benchmark::DoNotOptimize(buf.piece());
+  }
+}
+
+BENCHMARK(path_builder_append_components);
+
 } // namespace
 
 int main(int argc, char** argv) {
@@ -6,10 +6,15 @@
  */
 
 #include "watchman/bser.h"
+#include <folly/compression/Compression.h>
 #include "watchman/Logging.h"
 #include "watchman/thirdparty/jansson/jansson_private.h"
 
 #include <math.h>
+#include <algorithm>
+#include <limits>
+#include <string_view>
+#include <unordered_map>
 
 /*
  * This defines a binary serialization of the JSON data objects in this
@@ -42,6 +47,11 @@ namespace {
 #define BSER_TEMPLATE 0x0b
 #define BSER_SKIP 0x0c
 #define BSER_UTF8STRING 0x0d
+#define BSER_COLUMNS 0x0e
+#define BSER_COMPRESSED 0x0f
+
+// The codec identifiers of compressed values
+#define BSER_CODEC_ZSTD 0x01
 
 const char bser_true = BSER_TRUE;
 const char bser_false = BSER_FALSE;
@@ -52,6 +62,15 @@ const char bser_object_hdr = BSER_OBJECT;
 const char bser_template_hdr = BSER_TEMPLATE;
 const char bser_utf8string_hdr = BSER_UTF8STRING;
 const char bser_skip = BSER_SKIP;
+const char bser_columns_hdr = BSER_COLUMNS;
+const char bser_compressed_hdr = BSER_COMPRESSED;
+
+// Values smaller than this are sent as they are; compressing them saves
+// too little to be worth the time
+constexpr json_int_t kCompressionThreshold = 256 * 1024;
+
+// Favors speed: the values are query results that are sent once
+constexpr int kCompressionLevel = 1;
 
 constexpr size_t kMaximumContainerSize = std::numeric_limits<uint32_t>::max();
 
@@ -75,6 +94,68 @@ bool is_bser_version_supported(const bser_ctx_t* ctx) {
   return ctx->bser_version == 1 || ctx->bser_version == 2;
 }
 
+// The size of the integers of the given BSER type
+size_t bser_int_size(char type) {
+  switch (type) {
+    case BSER_INT8:
+      return 1;
+    case BSER_INT16:
+      return 2;
+    case BSER_INT32:
+      return 4;
+    case BSER_INT64:
+    default:
+      return 8;
+  }
+}
+
+// Reads an integer of the given BSER type, without its type byte
+json_int_t bser_raw_int(char type, const char* ptr) {
+  switch (type) {
+    case BSER_INT8: {
+      int8_t i8;
+      memcpy(&i8, ptr, sizeof(i8));
+      return i8;
+    }
+    case BSER_INT16: {
+      int16_t i16;
+      memcpy(&i16, ptr, sizeof(i16));
+      return i16;
+    }
+    case BSER_INT32: {
+      int32_t i32;
+      memcpy(&i32, ptr, sizeof(i32));
+      return i32;
+    }
+    case BSER_INT64:
+    default: {
+      int64_t i64;
+      memcpy(&i64, ptr, sizeof(i64));
+      return i64;
+    }
+  }
+}
+
+// Sets *sum to a + b, or returns false if that overflows
+bool checked_add(json_int_t a, json_int_t b, json_int_t* sum) {
+  if ((b > 0 && a > std::numeric_limits<json_int_t>::max() - b) ||
+      (b < 0 && a < std::numeric_limits<json_int_t>::min() - b)) {
+    return false;
+  }
+  *sum = a + b;
+  return true;
+}
+
+// Sets *difference to a - b, or returns false if that overflows
+bool checked_sub(json_int_t a, json_int_t b, json_int_t* difference) {
+  if ((b < 0 && a > std::numeric_limits<json_int_t>::max() + b) ||
+      (b > 0 && a < std::numeric_limits<json_int_t>::min() + b)) {
+    return false;
+  }
+  *difference = a - b;
+  return true;
+}
+
 int bser_real(const bser_ctx_t* ctx, double val, void* data) {
   char sz = BSER_REAL;
   if (!is_bser_version_supported(ctx)) {
@@ -203,7 +284,19 @@ int bser_template(
 
   // Now the array of arrays of object values.
   // How many objects
-  if (bser_int(ctx, n, data)) {
+  auto rows = json_array_get_bser_rows(array);
+  if (rows &&
+      (rows->version() != ctx->bser_version ||
+       rows->capabilities() != ctx->bser_capabilities)) {
+    // These rows were encoded for a different client
+    return -1;
+  }
+  if (bser_int(ctx, n + (rows ? rows->size() : 0), data)) {
+    return -1;
+  }
+
+  // Rows that were encoded as they were rendered come first
+  if (rows && ctx->dump(rows->data().data(), rows->data().size(), data)) {
     return -1;
   }
 
@@ -239,22 +332,49 @@ int bser_template(
   return 0;
 }
 
-int bser_array(const bser_ctx_t* ctx, const json_ref& array, void* data) {
-  if (!is_bser_version_supported(ctx)) {
-    return -1;
-  }
+int append_to_string(const char* buffer, size_t size, void* data) {
+  static_cast<std::string*>(data)->append(buffer, size);
+  return 0;
+}
 
+int bser_columns(
+    const bser_ctx_t* ctx,
+    const json_ref& array,
+    const json_ref& templ,
+    void* data);
+
+int bser_array_uncached(
+    const bser_ctx_t* ctx,
+    const json_ref& array,
+    void* data) {
   auto templ = json_array_get_template(array);
   if (templ && !templ->array().empty()) {
+    if (ctx->bser_version != 1 &&
+        (ctx->bser_capabilities & BSER_CAP_COLUMNS)) {
+      return bser_columns(ctx, array, *templ, data);
+    }
     return bser_template(ctx, array, *templ, data);
   }
 
+  auto rows = json_array_get_bser_rows(array);
+  if (rows &&
+      (rows->version() != ctx->bser_version ||
+       rows->capabilities() != ctx->bser_capabilities)) {
+    // These rows were encoded for a different client
+    return -1;
+  }
+
   if (ctx->dump(&bser_array_hdr, sizeof(bser_array_hdr), data)) {
     return -1;
   }
 
   auto& arr = array.array();
-  if (bser_int(ctx, arr.size(), data)) {
+  if (bser_int(ctx, arr.size() + (rows ? rows->size() : 0), data)) {
+    return -1;
+  }
+
+  // Without a template, each row is a single value
+  if (rows && ctx->dump(rows->data().data(), rows->data().size(), data)) {
     return -1;
   }
 
@@ -267,6 +387,26 @@ int bser_array(const bser_ctx_t* ctx, const json_ref& array, void* data) {
   return 0;
 }
 
+int bser_array(const bser_ctx_t* ctx, const json_ref& array, void* data) {
+  if (!is_bser_version_supported(ctx)) {
+    return -1;
+  }
+
+  // Never zero, which is the key of compact JSON
+  uint64_t key =
+      (uint64_t(ctx->bser_version) << 32) | uint64_t(ctx->bser_capabilities);
+  auto cached =
+      json_array_cached_encoding(array, key, [&](std::string& out) {
+        bser_ctx_t nested{
+            ctx->bser_version, ctx->bser_capabilities, append_to_string};
+        return bser_array_uncached(&nested, array, &out) == 0;
+      });
+  if (cached) {
+    return ctx->dump(cached->data(), cached->size(), data);
+  }
+  return bser_array_uncached(ctx, array, data);
+}
+
 int bser_object(const bser_ctx_t* ctx, const json_ref& obj, void* data) {
   size_t n;
 
@@ -347,6 +487,41 @@ int measure(const char*, size_t size, void* ptr) {
   return 0;
 }
 
+// Encodes json, which takes size bytes, as a compressed value. Returns
+// nullopt if zstd is unavailable or the value doesn't get any smaller.
+std::optional<std::string>
+bser_compressed(const bser_ctx_t* ctx, const json_ref& json, json_int_t size) {
+  using folly::compression::CodecType;
+  if (!folly::compression::hasCodec(CodecType::ZSTD)) {
+    return std::nullopt;
+  }
+
+  bser_ctx_t str_ctx{
+      ctx->bser_version, ctx->bser_capabilities, append_to_string};
+  std::string encoded;
+  encoded.reserve(size);
+  if (w_bser_dump(&str_ctx, json, &encoded)) {
+    return std::nullopt;
+  }
+  auto compressed =
+      folly::compression::getCodec(CodecType::ZSTD, kCompressionLevel)
+          ->compress(encoded);
+  encoded.clear();
+
+  std::string value;
+  if (str_ctx.dump(&bser_compressed_hdr, 1, &value) ||
+      bser_int(&str_ctx, BSER_CODEC_ZSTD, &value) ||
+      bser_int(&str_ctx, size, &value) ||
+      bser_int(&str_ctx, compressed.size(), &value)) {
+    return std::nullopt;
+  }
+  if (json_int_t(value.size() + compressed.size()) >= size) {
+    return std::nullopt;
+  }
+  value.append(compressed);
+  return value;
+}
+
 } // namespace
 
 int w_bser_write_pdu(
@@ -366,6 +541,15 @@ int w_bser_write_pdu(
     return -1;
   }
 
+  std::optional<std::string> compressed;
+  if (bser_version == 2 && (bser_capabilities & BSER_CAP_COMPRESSED) &&
+      m_size >= kCompressionThreshold) {
+    compressed = bser_compressed(&ctx, json, m_size);
+    if (compressed) {
+      m_size = compressed->size();
+    }
+  }
+
   // To actually write the contents
   ctx.dump = dump;
 
@@ -390,6 +574,10 @@ int w_bser_write_pdu(
     return -1;
   }
 
+  if (compressed) {
+    return dump(compressed->data(), compressed->size(), data);
+  }
+
   if (w_bser_dump(&ctx, json, data)) {
     return -1;
   }
@@ -397,6 +585,73 @@ int w_bser_write_pdu(
   return 0;
 }
 
+BserTemplateRows::BserTemplateRows(
+    uint32_t bser_version,
+    uint32_t bser_capabilities)
+    : ctx_{bser_version, bser_capabilities, append_to_string} {}
+
+void BserTemplateRows::appendNull() {
+  ctx_.dump(&bser_null, sizeof(bser_null), &data_);
+}
+
+void BserTemplateRows::appendBool(bool value) {
+  if (value) {
+    ctx_.dump(&bser_true, sizeof(bser_true), &data_);
+  } else {
+    ctx_.dump(&bser_false, sizeof(bser_false), &data_);
+  }
+}
+
+void BserTemplateRows::appendInt(json_int_t value) {
+  bser_int(&ctx_, value, &data_);
+}
+
+void BserTemplateRows::appendReal(double value) {
+  bser_real(&ctx_, value, &data_);
+}
+
+void BserTemplateRows::appendString(
+    w_string_piece str,
+    w_string_type_t type) {
+  switch (type) {
+    case W_STRING_UNICODE:
+      bser_utf8string(&ctx_, str, &data_);
+      break;
+    case W_STRING_MIXED:
+      bser_mixedstring(&ctx_, str, &data_);
+      break;
+    case W_STRING_BYTE:
+    default:
+      bser_bytestring(&ctx_, str, &data_);
+      break;
+  }
+}
+
+void BserTemplateRows::appendPath(w_string_piece dir, w_string_piece name) {
+  if (dir.empty()) {
+    bser_bytestring(&ctx_, name, &data_);
+    return;
+  }
+  ctx_.dump(&bser_bytestring_hdr, sizeof(bser_bytestring_hdr), &data_);
+  bser_int(&ctx_, dir.size() + 1 + name.size(), &data_);
+  ctx_.dump(dir.data(), dir.size(), &data_);
+  ctx_.dump("/", 1, &data_);
+  ctx_.dump(name.data(), name.size(), &data_);
+}
+
+void BserTemplateRows::appendJson(const json_ref& json) {
+  w_bser_dump(&ctx_, json, &data_);
+}
+
+void BserTemplateRows::commitRow() {
+  committed_ = data_.size();
+  ++numRows_;
+}
+
+void BserTemplateRows::abandonRow() {
+  data_.resize(committed_);
+}
+
 namespace {
 
 /**
@@ -425,6 +680,97 @@ class BserParser {
     return parseValue(*ensure(1));
   }
 
+  /**
+   * Validates the next value in the document and advances past it, without
+   * building a json_ref. Throws the same errors as expectValue would.
+   */
+  void skipValue() {
+    skipValue(*ensure(1));
+  }
+
+  void skipValue(char value_type) {
+    switch (value_type) {
+      case BSER_INT8:
+      case BSER_INT16:
+      case BSER_INT32:
+      case BSER_INT64:
+        parseInteger(value_type);
+        return;
+
+      case BSER_BYTESTRING:
+      case BSER_UTF8STRING:
+        parseString();
+        return;
+
+      case BSER_REAL:
+        parseReal();
+        return;
+
+      case BSER_TRUE:
+      case BSER_FALSE:
+      case BSER_NULL:
+        return;
+
+      case BSER_ARRAY: {
+        BumpDepth scope{depth};
+        size_t count = expectSize("array");
+        for (size_t i = 0; i < count; ++i) {
+          skipValue();
+        }
+        return;
+      }
+
+      case BSER_TEMPLATE: {
+        BumpDepth scope{depth};
+        expectType({BSER_ARRAY});
+        size_t numKeys = expectSize("array");
+        if (numKeys == 0) {
+          throw BserParseError("templates require a non-empty key set");
+        }
+        for (size_t i = 0; i < numKeys; ++i) {
+          expectString();
+        }
+        size_t element_count = expectSize("template");
+        for (size_t i = 0; i < element_count; ++i) {
+          for (size_t k = 0; k < numKeys; ++k) {
+            char type = *ensure(1);
+            if (type != BSER_SKIP) {
+              skipValue(type);
+            }
+          }
+        }
+        return;
+      }
+
+      case BSER_COLUMNS: {
+        BumpDepth scope{depth};
+        size_t numKeys = expectKeySet().size();
+        size_t element_count = expectSize("columns");
+        for (size_t k = 0; k < numKeys; ++k) {
+          parseColumn(element_count, nullptr);
+        }
+        return;
+      }
+
+      case BSER_OBJECT: {
+        BumpDepth scope{depth};
+        size_t element_count = expectSize("object");
+        for (size_t i = 0; i < element_count; ++i) {
+          expectString();
+          skipValue();
+        }
+        return;
+      }
+
+      default:
+        throw BserParseError("invalid bser encoding type: {:02x}", value_type);
+    }
+  }
+
+  const char* position() const {
+    return buf;
+  }
+
   json_ref parseValue(char value_type) {
     switch (value_type) {
       case BSER_INT8:
@@ -456,6 +802,8 @@ class BserParser {
         return json_array(parseArray());
       case BSER_TEMPLATE:
         return parseTemplate();
+      case BSER_COLUMNS:
+        return parseColumns();
       case BSER_OBJECT:
         return parseObject();
       default:
@@ -463,7 +811,6 @@ class BserParser {
     }
   }
 
- private:
   /**
    * Ensures `needed` bytes remain in the document, and advances the `buf`
    * pointer. Returns the old `buf` with the assurance that up to `needed` bytes
@@ -568,6 +915,7 @@ class BserParser {
     return parseString();
   }
 
+ private:
   std::vector<json_ref> parseArray() {
     BumpDepth scope{depth};
 
@@ -586,10 +934,8 @@ class BserParser {
     return parseArray();
   }
 
-  json_ref parseTemplate() {
-    BumpDepth scope{depth};
-
-    // Load in the property names template
+  // Loads the property names of a template or of columns
+  std::vector<w_string> expectKeySet() {
     auto templ = expectArray();
     if (templ.empty()) {
       // To avoid "decompression bombs" -- small documents that expand into huge
@@ -606,6 +952,21 @@ class BserParser {
       }
     }
 
+    // Every object shares the template's key strings
+    std::vector<w_string> keys;
+    keys.reserve(templ.size());
+    for (const auto& template_key : templ) {
+      keys.push_back(json_to_w_string(template_key));
+    }
+    return keys;
+  }
+
+  json_ref parseTemplate() {
+    BumpDepth scope{depth};
+
+    // Load in the property names template
+    auto keys = expectKeySet();
+
     // And the number of objects
     auto element_count = expectSize("template");
 
@@ -613,17 +974,15 @@ class BserParser {
     std::vector<json_ref> rv;
     limitedReservation(rv, element_count);
     for (size_t i = 0; i < element_count; ++i) {
-      std::unordered_map<w_string, json_ref> item;
-      limitedReservation(item, templ.size());
-      for (const auto& template_key : templ) {
+      json_object_map item;
+      limitedReservation(item, keys.size());
+      for (const auto& key : keys) {
         char type = *ensure(1);
         if (type == BSER_SKIP) {
           continue;
         }
 
-        assert(template_key.isString());
-        item.insert_or_assign(
-            json_string_value(template_key), parseValue(type));
+        item.insert_or_assign(key, parseValue(type));
       }
 
       rv.push_back(json_object(std::move(item)));
@@ -632,31 +991,168 @@ class BserParser {
     return json_array(std::move(rv));
   }
 
+  using ColumnFunc = std::function<void(size_t, json_ref)>;
+
+  json_ref parseColumns() {
+    BumpDepth scope{depth};
+
+    auto keys = expectKeySet();
+    auto element_count = expectSize("columns");
+
+    // Validate the columns before allocating the objects, whose number
+    // could otherwise be far larger than the document warrants
+    const char* columns = buf;
+    for (size_t k = 0; k < keys.size(); ++k) {
+      parseColumn(element_count, nullptr);
+    }
+    buf = columns;
+
+    std::vector<json_object_map> items(element_count);
+    for (const auto& key : keys) {
+      ColumnFunc insert = [&](size_t i, json_ref value) {
+        items[i].insert_or_assign(key, std::move(value));
+      };
+      parseColumn(element_count, &insert);
+    }
+
+    std::vector<json_ref> rv;
+    rv.reserve(element_count);
+    for (auto& item : items) {
+      rv.push_back(json_object(std::move(item)));
+    }
+    return json_array(std::move(rv));
+  }
+
+  /**
+   * Reads the values of one key of a columnar array, calling func with the
+   * index and value of each object that has one.  When func is null the
+   * column is only validated.
+   */
+  void parseColumn(size_t count, const ColumnFunc* func) {
+    char kind = expectType(
+        {BSER_ARRAY,
+         BSER_TRUE,
+         BSER_INT8,
+         BSER_INT16,
+         BSER_INT32,
+         BSER_INT64,
+         BSER_BYTESTRING,
+         BSER_UTF8STRING});
+    switch (kind) {
+      case BSER_ARRAY:
+        for (size_t i = 0; i < count; ++i) {
+          char type = *ensure(1);
+          if (type == BSER_SKIP) {
+            continue;
+          }
+          if (func) {
+            (*func)(i, parseValue(type));
+          } else {
+            skipValue(type);
+          }
+        }
+        return;
+
+      case BSER_TRUE: {
+        const char* bits = ensure((count + 7) / 8);
+        if (func) {
+          for (size_t i = 0; i < count; ++i) {
+            (*func)(i, json_boolean((bits[i / 8] >> (i % 8)) & 1));
+          }
+        }
+        return;
+      }
+
+      case BSER_BYTESTRING:
+      case BSER_UTF8STRING: {
+        char prefixType =
+            expectType({BSER_INT8, BSER_INT16, BSER_INT32, BSER_INT64});
+        size_t prefixSize = bser_int_size(prefixType);
+        const char* prefixes = ensure(count * prefixSize);
+        char suffixType =
+            expectType({BSER_INT8, BSER_INT16, BSER_INT32, BSER_INT64});
+        size_t suffixSize = bser_int_size(suffixType);
+        const char* suffixes = ensure(count * suffixSize);
+
+        std::string value;
+        for (size_t i = 0; i < count; ++i) {
+          auto prefix = bser_raw_int(prefixType, prefixes + i * prefixSize);
+          auto suffix = bser_raw_int(suffixType, suffixes + i * suffixSize);
+          if (prefix < 0 || size_t(prefix) > value.size() || suffix < 0) {
+            throw BserParseError("invalid string lengths in column");
+          }
+          value.resize(prefix);
+          value.append(ensure(suffix), suffix);
+          if (func) {
+            (*func)(
+                i,
+                typed_string_to_json(
+                    value.data(),
+                    value.size(),
+                    kind == BSER_BYTESTRING ? W_STRING_BYTE
+                                            : W_STRING_UNICODE));
+          }
+        }
+        return;
+      }
+
+      default: {
+        // Integers, each stored as the difference from the previous one
+        size_t size = bser_int_size(kind);
+        const char* deltas = ensure(count * size);
+        json_int_t value = 0;
+        for (size_t i = 0; i < count; ++i) {
+          auto delta = bser_raw_int(kind, deltas + i * size);
+          if (!checked_add(value, delta, &value)) {
+            throw BserParseError("integer column overflows");
+          }
+          if (func) {
+            (*func)(i, json_integer(value));
+          }
+        }
+        return;
+      }
+    }
+  }
+
   json_ref parseObject() {
     BumpDepth scope{depth};
 
     size_t element_count = expectSize("object");
 
-    std::unordered_map<w_string, json_ref> rv;
+    json_object_map rv;
     limitedReservation(rv, element_count);
 
     for (size_t i = 0; i < element_count; i++) {
       auto key = expectString();
       auto value = expectValue();
 
-      rv.emplace(
-          w_string{
-              key.data(),
-              key.size(),
-              // Hard-coding the string type matches BSER's previous behavior,
-              // but should we respect the type encoded in the BSER document?
-              W_STRING_BYTE},
-          std::move(value));
+      rv.emplace(internKey(key), std::move(value));
     }
 
     return json_object(std::move(rv));
   }
 
+  /**
+   * Documents commonly repeat the same keys across many objects, such as
+   * the entries of a `paths` list or of state metadata, so share one
+   * w_string per distinct key rather than allocating one per occurrence.
+   */
+  w_string internKey(std::string_view key) {
+    auto it = keys_.find(key);
+    if (it != keys_.end()) {
+      return it->second;
+    }
+    // Hard-coding the string type matches BSER's previous behavior,
+    // but should we respect the type encoded in the BSER document?
+    w_string str{key.data(), key.size(), W_STRING_BYTE};
+    if (keys_.size() < kMaximumInternedKeys) {
+      // The key references the input document, which outlives the parser
+      keys_.emplace(key, str);
+    }
+    return str;
+  }
+
   struct BumpDepth {
     explicit BumpDepth(size_t& depth) : depth{depth} {
       if (++depth == kMaximumDepth) {
@@ -670,12 +1166,261 @@ class BserParser {
     size_t& depth;
   };
 
+  // Bounds the cost of interning for documents whose keys never repeat
+  static constexpr size_t kMaximumInternedKeys = 256;
+
   const char* buf;
   const char* const start;
   const char* const end;
   size_t depth = 0;
+  std::unordered_map<std::string_view, w_string> keys_;
 };
 
+// The smallest BSER integer type that holds every value in [min, max]
+char bser_int_type(json_int_t min, json_int_t max) {
+  if (min >= std::numeric_limits<int8_t>::min() &&
+      max <= std::numeric_limits<int8_t>::max()) {
+    return BSER_INT8;
+  }
+  if (min >= std::numeric_limits<int16_t>::min() &&
+      max <= std::numeric_limits<int16_t>::max()) {
+    return BSER_INT16;
+  }
+  if (min >= std::numeric_limits<int32_t>::min() &&
+      max <= std::numeric_limits<int32_t>::max()) {
+    return BSER_INT32;
+  }
+  return BSER_INT64;
+}
+
+template <typename T>
+void append_raw_int(std::string& out, json_int_t value) {
+  T v = T(value);
+  out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+// Writes the smallest BSER integer type that holds all of values, then
+// each value with that size but without a type byte
+int bser_raw_ints(
+    const bser_ctx_t* ctx,
+    const std::vector<json_int_t>& values,
+    void* data) {
+  json_int_t min = 0;
+  json_int_t max = 0;
+  for (auto value : values) {
+    min = std::min(min, value);
+    max = std::max(max, value);
+  }
+  char type = bser_int_type(min, max);
+
+  std::string out;
+  out.reserve(1 + values.size() * bser_int_size(type));
+  out.push_back(type);
+  for (auto value : values) {
+    switch (type) {
+      case BSER_INT8:
+        append_raw_int<int8_t>(out, value);
+        break;
+      case BSER_INT16:
+        append_raw_int<int16_t>(out, value);
+        break;
+      case BSER_INT32:
+        append_raw_int<int32_t>(out, value);
+        break;
+      default:
+        append_raw_int<int64_t>(out, value);
+        break;
+    }
+  }
+  return ctx->dump(out.data(), out.size(), data);
+}
+
+json_int_t cell_int(std::string_view cell) {
+  return BserParser{cell.data(), cell.data() + cell.size()}.expectInteger();
+}
+
+std::string_view cell_string(std::string_view cell) {
+  return BserParser{cell.data(), cell.data() + cell.size()}.expectString();
+}
+
+/**
+ * Writes the values of one key of a columnar array.  cells holds the
+ * encoded value of that key for each object, or a skip.  Columns whose
+ * values are all booleans, all integers or all strings of the same type
+ * get a compact encoding; any others are written value by value.
+ */
+int bser_column(
+    const bser_ctx_t* ctx,
+    const std::vector<std::string_view>& cells,
+    void* data) {
+  auto allOf = [&](std::initializer_list<char> types) {
+    return !cells.empty() &&
+        std::all_of(cells.begin(), cells.end(), [&](std::string_view cell) {
+             return std::find(types.begin(), types.end(), cell[0]) !=
+                 types.end();
+           });
+  };
+
+  if (allOf({BSER_TRUE, BSER_FALSE})) {
+    // A bitset
+    std::string out(1 + (cells.size() + 7) / 8, '\0');
+    out[0] = BSER_TRUE;
+    for (size_t i = 0; i < cells.size(); ++i) {
+      if (cells[i][0] == BSER_TRUE) {
+        out[1 + i / 8] |= char(1 << (i % 8));
+      }
+    }
+    return ctx->dump(out.data(), out.size(), data);
+  }
+
+  if (allOf({BSER_INT8, BSER_INT16, BSER_INT32, BSER_INT64})) {
+    // Each value as the difference from the previous one, which for
+    // clustered values such as mtimes fits in fewer bytes
+    std::vector<json_int_t> deltas;
+    deltas.reserve(cells.size());
+    json_int_t prev = 0;
+    for (auto cell : cells) {
+      json_int_t value = cell_int(cell);
+      json_int_t delta;
+      if (!checked_sub(value, prev, &delta)) {
+        break;
+      }
+      deltas.push_back(delta);
+      prev = value;
+    }
+    if (deltas.size() == cells.size()) {
+      return bser_raw_ints(ctx, deltas, data);
+    }
+  }
+
+  for (char type : {BSER_BYTESTRING, BSER_UTF8STRING}) {
+    if (!allOf({type})) {
+      continue;
+    }
+    // Each string as the length of the prefix it shares with the previous
+    // one and the rest of its bytes
+    std::vector<json_int_t> prefixes;
+    std::vector<json_int_t> suffixes;
+    prefixes.reserve(cells.size());
+    suffixes.reserve(cells.size());
+    std::string bytes;
+    std::string_view prev;
+    for (auto cell : cells) {
+      auto str = cell_string(cell);
+      size_t prefix = 0;
+      size_t limit = std::min(prev.size(), str.size());
+      while (prefix < limit && prev[prefix] == str[prefix]) {
+        ++prefix;
+      }
+      prefixes.push_back(prefix);
+      suffixes.push_back(str.size() - prefix);
+      bytes.append(str.substr(prefix));
+      prev = str;
+    }
+    if (ctx->dump(&type, sizeof(type), data) ||
+        bser_raw_ints(ctx, prefixes, data) ||
+        bser_raw_ints(ctx, suffixes, data)) {
+      return -1;
+    }
+    return ctx->dump(bytes.data(), bytes.size(), data);
+  }
+
+  if (ctx->dump(&bser_array_hdr, sizeof(bser_array_hdr), data)) {
+    return -1;
+  }
+  for (auto cell : cells) {
+    if (ctx->dump(cell.data(), cell.size(), data)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int bser_columns(
+    const bser_ctx_t* ctx,
+    const json_ref& array,
+    const json_ref& templ,
+    void* data) {
+  auto rows = json_array_get_bser_rows(array);
+  if (rows &&
+      (rows->version() != ctx->bser_version ||
+       rows->capabilities() != ctx->bser_capabilities)) {
+    // These rows were encoded for a different client
+    return -1;
+  }
+
+  auto& templ_arr = templ.array();
+  size_t numRows = rows ? rows->size() : 0;
+  size_t n = numRows + json_array_size(array);
+
+  // The encoded value of each key for each object, by key
+  std::vector<std::vector<std::string_view>> columns(templ_arr.size());
+  for (auto& column : columns) {
+    column.reserve(n);
+  }
+
+  // Rows that were encoded as they were rendered come first
+  if (rows) {
+    const auto& encoded = rows->data();
+    BserParser parser{encoded.data(), encoded.data() + encoded.size()};
+    try {
+      for (size_t i = 0; i < numRows; ++i) {
+        for (auto& column : columns) {
+          const char* start = parser.position();
+          char type = *parser.ensure(1);
+          if (type != BSER_SKIP) {
+            parser.skipValue(type);
+          }
+          column.emplace_back(start, parser.position() - start);
+        }
+      }
+    } catch (const BserParseError&) {
+      return -1;
+    }
+  }
+
+  // Then the objects, encoded here so that their values can be classified
+  // the same way
+  bser_ctx_t cellCtx{
+      ctx->bser_version, ctx->bser_capabilities, append_to_string};
+  std::string encoded;
+  std::vector<size_t> cellEnds;
+  cellEnds.reserve((n - numRows) * templ_arr.size());
+  for (auto& obj : array.array()) {
+    for (auto& key : templ_arr) {
+      auto val = json_object_get(obj, json_string_value(key));
+      if (!val) {
+        encoded.push_back(BSER_SKIP);
+      } else if (w_bser_dump(&cellCtx, *val, &encoded)) {
+        return -1;
+      }
+      cellEnds.push_back(encoded.size());
+    }
+  }
+  size_t cellStart = 0;
+  for (size_t cell = 0; cell < cellEnds.size(); ++cell) {
+    columns[cell % columns.size()].emplace_back(
+        encoded.data() + cellStart, cellEnds[cell] - cellStart);
+    cellStart = cellEnds[cell];
+  }
+
+  if (ctx->dump(&bser_columns_hdr, sizeof(bser_columns_hdr), data)) {
+    return -1;
+  }
+  if (bser_array(ctx, templ, data)) {
+    return -1;
+  }
+  if (bser_int(ctx, n, data)) {
+    return -1;
+  }
+  for (auto& column : columns) {
+    if (bser_column(ctx, column, data)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
 } // namespace
 
 std::optional<json_int_t>
@@ -734,3 +1479,203 @@ json_ref bunser(const char* buf, const char* end) {
   }
   return BserParser{buf, end}.expectValue();
 }
+
+BserView BserView::parse(const char* buf, const char* end) {
+  if (buf >= end) {
+    throw BserParseError("document too short");
+  }
+  BserParser parser{buf, end};
+  parser.skipValue();
+  return BserView{buf, parser.position()};
+}
+
+json_type BserView::type() const {
+  if (templ_) {
+    return JSON_OBJECT;
+  }
+  switch (*value_) {
+    case BSER_INT8:
+    case BSER_INT16:
+    case BSER_INT32:
+    case BSER_INT64:
+      return JSON_INTEGER;
+    case BSER_BYTESTRING:
+    case BSER_UTF8STRING:
+      return JSON_STRING;
+    case BSER_REAL:
+      return JSON_REAL;
+    case BSER_TRUE:
+      return JSON_TRUE;
+    case BSER_FALSE:
+      return JSON_FALSE;
+    case BSER_NULL:
+      return JSON_NULL;
+    case BSER_ARRAY:
+    case BSER_TEMPLATE:
+    case BSER_COLUMNS:
+      return JSON_ARRAY;
+    case BSER_OBJECT:
+    default:
+      return JSON_OBJECT;
+  }
+}
+
+json_int_t BserView::asInt() const {
+  if (!isInt()) {
+    throw std::domain_error("BserView::asInt() called on non-integer");
+  }
+  return BserParser{value_, end_}.expectInteger();
+}
+
+bool BserView::asBool() const {
+  if (!isBool()) {
+    throw std::domain_error("BserView::asBool() called on non-boolean");
+  }
+  return *value_ == BSER_TRUE;
+}
+
+double BserView::asReal() const {
+  if (type() != JSON_REAL) {
+    throw std::domain_error("BserView::asReal() called on non-real");
+  }
+  double dval;
+  memcpy(&dval, value_ + 1, sizeof(dval));
+  return dval;
+}
+
+std::string_view BserView::asString() const {
+  if (!isString()) {
+    throw std::domain_error("BserView::asString() called on non-string");
+  }
+  return BserParser{value_, end_}.expectString();
+}
+
+size_t BserView::size() const {
+  if (templ_) {
+    size_t count = 0;
+    forEachField([&](std::string_view, const BserView&) { ++count; });
+    return count;
+  }
+
+  BserParser parser{value_, end_};
+  switch (parser.expectType(
+      {BSER_ARRAY, BSER_OBJECT, BSER_TEMPLATE, BSER_COLUMNS})) {
+    case BSER_TEMPLATE:
+      parser.skipValue(); // the key set
+      return parser.expectSize("template");
+    case BSER_COLUMNS:
+      parser.skipValue(); // the key set
+      return parser.expectSize("columns");
+    case BSER_ARRAY:
+      return parser.expectSize("array");
+    case BSER_OBJECT:
+    default:
+      return parser.expectSize("object");
+  }
+}
+
+BserView BserView::at(size_t index) const {
+  BserParser parser{value_, end_};
+  if (templ_ || !isArray()) {
+    throw std::domain_error("BserView::at() called on non-array");
+  }
+  if (*value_ == BSER_COLUMNS) {
+    // The values of an object are spread over all of the columns
+    throw std::domain_error("BserView::at() called on columnar array");
+  }
+
+  if (parser.expectType({BSER_ARRAY, BSER_TEMPLATE}) == BSER_ARRAY) {
+    if (index >= parser.expectSize("array")) {
+      throw std::out_of_range("BserView::at() index out of range");
+    }
+    for (size_t i = 0; i < index; ++i) {
+      parser.skipValue();
+    }
+    auto* value = parser.position();
+    parser.skipValue();
+    return BserView{value, parser.position()};
+  }
+
+  // Skip over the key set, remembering where it is
+  auto* templ = parser.position();
+  parser.expectType({BSER_ARRAY});
+  size_t numKeys = parser.expectSize("array");
+  for (size_t k = 0; k < numKeys; ++k) {
+    parser.expectString();
+  }
+  if (index >= parser.expectSize("template")) {
+    throw std::out_of_range("BserView::at() index out of range");
+  }
+
+  auto skipRow = [&] {
+    for (size_t k = 0; k < numKeys; ++k) {
+      char type = *parser.ensure(1);
+      if (type != BSER_SKIP) {
+        parser.skipValue(type);
+      }
+    }
+  };
+  for (size_t i = 0; i < index; ++i) {
+    skipRow();
+  }
+  auto* row = parser.position();
+  skipRow();
+  return BserView{row, parser.position(), templ};
+}
+
+std::optional<BserView> BserView::get(std::string_view key) const {
+  if (type() != JSON_OBJECT) {
+    throw std::domain_error("BserView::get() called on non-object");
+  }
+  std::optional<BserView> result;
+  forEachField([&](std::string_view name, const BserView& value) {
+    if (!result && name == key) {
+      result = value;
+    }
+  });
+  return result;
+}
+
+void BserView::forEachField(
+    const std::function<void(std::string_view, const BserView&)>& func)
+    const {
+  if (templ_) {
+    BserParser keys{templ_, end_};
+    keys.expectType({BSER_ARRAY});
+    size_t numKeys = keys.expectSize("array");
+    BserParser values{value_, end_};
+    for (size_t k = 0; k < numKeys; ++k) {
+      auto name = keys.expectString();
+      char type = *values.ensure(1);
+      if (type == BSER_SKIP) {
+        continue;
+      }
+      auto* value = values.position() - 1;
+      values.skipValue(type);
+      func(name, BserView{value, values.position()});
+    }
+    return;
+  }
+
+  BserParser parser{value_, end_};
+  parser.expectType({BSER_OBJECT});
+  size_t count = parser.expectSize("object");
+  for (size_t i = 0; i < count; ++i) {
+    auto name = parser.expectString();
+    auto* value = parser.position();
+    parser.skipValue();
+    func(name, BserView{value, parser.position()});
+  }
+}
+
+json_ref BserView::toJson() const {
+  if (templ_) {
+    json_object_map item;
+    forEachField([&](std::string_view name, const BserView& value) {
+      item.insert_or_assign(
+          w_string{name.data(), name.size(), W_STRING_BYTE}, value.toJson());
+    });
+    return json_object(std::move(item));
+  }
+  return BserParser{value_, end_}.expectValue();
+}
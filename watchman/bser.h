@@ -8,6 +8,10 @@
 #pragma once
 
 #include <fmt/core.h>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
 #include "watchman/thirdparty/jansson/jansson.h"
 
 typedef struct bser_ctx {
@@ -52,6 +56,13 @@ class BserParseTooDeep : public BserParseError {
 // BSERv2 capabilities. Must be powers of 2.
 #define BSER_CAP_DISABLE_UNICODE 0x1
 #define BSER_CAP_DISABLE_UNICODE_FOR_ERRORS 0x2
+// Encode templated arrays column by column; see "Columns of Templated
+// Objects" in website/docs/bser.md.  Offered as the bser-columns capability.
+#define BSER_CAP_COLUMNS 0x4
+// The client can decode compressed values, which large PDUs are then sent
+// as; see "Compressed Values" in website/docs/bser.md.  Offered as the
+// bser-compression capability.
+#define BSER_CAP_COMPRESSED 0x8
 
 int w_bser_write_pdu(
     const uint32_t bser_version,
@@ -61,6 +72,65 @@ int w_bser_write_pdu(
     void* data);
 int w_bser_dump(const bser_ctx_t* ctx, const json_ref& json, void* data);
 
+/**
+ * Accumulates the BSER encoded rows of a templated array directly from
+ * native values, so that a large result set can be serialized without
+ * first building a json_ref object for every row.
+ *
+ * Values must be appended in template order; a row that turns out to be
+ * incomplete can be discarded with abandonRow().  The encoding depends on
+ * the BSER version and capabilities, so the rows can only be written into
+ * a PDU that uses the same ones.  See json_array_set_bser_rows.
+ */
+class BserTemplateRows {
+ public:
+  BserTemplateRows(uint32_t bser_version, uint32_t bser_capabilities);
+
+  uint32_t version() const {
+    return ctx_.bser_version;
+  }
+  uint32_t capabilities() const {
+    return ctx_.bser_capabilities;
+  }
+
+  /// The number of committed rows
+  size_t size() const {
+    return numRows_;
+  }
+  bool empty() const {
+    return numRows_ == 0;
+  }
+
+  /// The encoded values of the committed rows
+  const std::string& data() const {
+    return data_;
+  }
+
+  void appendNull();
+  void appendBool(bool value);
+  void appendInt(json_int_t value);
+  void appendReal(double value);
+  void appendString(w_string_piece str, w_string_type_t type);
+  void appendString(const w_string& str) {
+    appendString(str, str.type());
+  }
+  /// Appends the byte string "dir/name", or just `name` if `dir` is empty,
+  /// without building it first
+  void appendPath(w_string_piece dir, w_string_piece name);
+  /// Appends a value that was already rendered as json
+  void appendJson(const json_ref& json);
+
+  void commitRow();
+  void abandonRow();
+
+ private:
+  bser_ctx_t ctx_;
+  std::string data_;
+  // Length of data_ at the end of the last committed row
+  size_t committed_ = 0;
+  size_t numRows_ = 0;
+};
+
 constexpr size_t kDecodeIntFailed = ~size_t{};
 
 /**
@@ -80,3 +150,85 @@ bunser_int(const char* buf, size_t avail, size_t* needed);
  * Ignores any unused data at the end of the buffer.
  */
 json_ref bunser(const char* buf, const char* end);
+
+/**
+ * A read-only view of a BSER value that decodes on access, rather than
+ * allocating a json_ref for every node of the document up front as bunser
+ * does.  Useful when only a few fields of a large document are needed.
+ *
+ * The value is validated when the view is created, with the same checks as
+ * bunser, so accessors only throw if the value is of the wrong type.  The
+ * view references the underlying buffer, which must outlive it and any
+ * views derived from it.
+ *
+ * Element access is linear in the size of the preceding elements, so
+ * prefer forEachField or toJson when visiting everything.
+ */
+class BserView {
+ public:
+  /**
+   * Validates the value at buf and returns a view of it.  Ignores any unused
+   * data at the end of the buffer.  Throws BserParseError if the value is
+   * malformed.
+   */
+  static BserView parse(const char* buf, const char* end);
+
+  /// Templated arrays are arrays, and each of their rows is an object.
+  /// Columnar arrays are arrays too, but only size() and toJson() can be
+  /// used on them.
+  json_type type() const;
+
+  bool isArray() const {
+    return type() == JSON_ARRAY;
+  }
+  bool isObject() const {
+    return type() == JSON_OBJECT;
+  }
+  bool isString() const {
+    return type() == JSON_STRING;
+  }
+  bool isInt() const {
+    return type() == JSON_INTEGER;
+  }
+  bool isBool() const {
+    auto t = type();
+    return t == JSON_TRUE || t == JSON_FALSE;
+  }
+  bool isNull() const {
+    return type() == JSON_NULL;
+  }
+
+  json_int_t asInt() const;
+  bool asBool() const;
+  double asReal() const;
+  /// References the underlying buffer
+  std::string_view asString() const;
+
+  /// The number of elements of an array or fields of an object
+  size_t size() const;
+
+  /// Returns an element of an array.  Throws out_of_range if index is bad.
+  BserView at(size_t index) const;
+
+  /// Returns the named field of an object, if present
+  std::optional<BserView> get(std::string_view key) const;
+
+  /// Calls func with the name and value of each field of an object
+  void forEachField(
+      const std::function<void(std::string_view, const BserView&)>& func)
+      const;
+
+  /// Decodes the value into a json_ref
+  json_ref toJson() const;
+
+ private:
+  BserView(const char* value, const char* end, const char* templ = nullptr)
+      : value_{value}, end_{end}, templ_{templ} {}
+
+  // The encoded value; for a template row, the first of its values
+  const char* value_;
+  // The end of the encoded value
+  const char* end_;
+  // For a template row, the template's key set
+  const char* templ_;
+};
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include "watchman/Client.h"
+#include "watchman/CpuProfiler.h"
+#include "watchman/watchman_cmd.h"
+
+using namespace watchman;
+
+namespace {
+
+std::string base64Encode(std::string_view data) {
+  static constexpr char kAlphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  out.reserve((data.size() + 2) / 3 * 4);
+  size_t i = 0;
+  for (; i + 2 < data.size(); i += 3) {
+    uint32_t n = (uint8_t(data[i]) << 16) | (uint8_t(data[i + 1]) << 8) |
+        uint8_t(data[i + 2]);
+    out.push_back(kAlphabet[(n >> 18) & 63]);
+    out.push_back(kAlphabet[(n >> 12) & 63]);
+    out.push_back(kAlphabet[(n >> 6) & 63]);
+    out.push_back(kAlphabet[n & 63]);
+  }
+  if (i < data.size()) {
+    uint32_t n = uint8_t(data[i]) << 16;
+    if (i + 1 < data.size()) {
+      n |= uint8_t(data[i + 1]) << 8;
+    }
+    out.push_back(kAlphabet[(n >> 18) & 63]);
+    out.push_back(kAlphabet[(n >> 12) & 63]);
+    out.push_back(i + 1 < data.size() ? kAlphabet[(n >> 6) & 63] : '=');
+    out.push_back('=');
+  }
+  return out;
+}
+
+} // namespace
+
+// Samples the stacks of every thread while they use the CPU and returns
+// them as a profile that `pprof` can read, labeled with thread names.
+//
+// ["debug-cpu-profile"] samples for 10 seconds, 100 times per second of CPU
+// time, and returns the profile base64 encoded in "profile".
+// ["debug-cpu-profile", {"duration_ms": N, "hz": N, "path": PATH}] sets how
+// long and how often to sample, and writes the profile to PATH rather than
+// returning it.
+static UntypedResponse cmd_debug_cpu_profile(Client*, const json_ref& args) {
+  std::chrono::milliseconds duration{10000};
+  int hz = 100;
+  std::optional<w_string> path;
+
+  auto& argv = args.array();
+  if (argv.size() > 1) {
+    auto& options = argv[1];
+    if (!options.isObject()) {
+      throw ErrorResponse("expected an object of options");
+    }
+    if (auto value = options.get_optional("duration_ms")) {
+      duration = std::chrono::milliseconds{value->asInt()};
+    }
+    if (auto value = options.get_optional("hz")) {
+      hz = int(value->asInt());
+    }
+    if (auto value = options.get_optional("path")) {
+      path = json_to_w_string(*value);
+    }
+  }
+  if (duration <= std::chrono::milliseconds::zero() ||
+      duration > std::chrono::minutes{5}) {
+    throw ErrorResponse("duration_ms must be from 1 to 300000");
+  }
+
+  CpuProfile profile;
+  try {
+    profile = collectCpuProfile(duration, hz);
+  } catch (const std::exception& exc) {
+    throw ErrorResponse("failed to collect a CPU profile: {}", exc.what());
+  }
+
+  UntypedResponse resp;
+  resp.set(
+      {{"samples", json_integer(profile.samples)},
+       {"dropped_samples", json_integer(profile.dropped)}});
+  if (path) {
+    if (!folly::writeFile(profile.pprof, path->c_str())) {
+      throw ErrorResponse(
+          "failed to write {}: {}", path->view(), folly::errnoStr(errno));
+    }
+    resp.set("file", w_string_to_json(*path));
+  } else {
+    resp.set(
+        "profile",
+        w_string_to_json(w_string{base64Encode(profile.pprof)}));
+  }
+  return resp;
+}
+W_CMD_REG("debug-cpu-profile", cmd_debug_cpu_profile, CMD_DAEMON, nullptr);
@@ -17,9 +17,13 @@
 #include "watchman/InMemoryView.h"
 #include "watchman/LRUCache.h"
 #include "watchman/Logging.h"
+#include "watchman/PhaseTimeline.h"
 #include "watchman/Poison.h"
+#include "watchman/QueryScheduler.h"
 #include "watchman/QueryableView.h"
+#include "watchman/query/QueryLog.h"
 #include "watchman/root/Root.h"
+#include "watchman/telemetry/WatchmanStats.h"
 #include "watchman/watchman_cmd.h"
 
 namespace watchman {
@@ -54,12 +58,10 @@ static UntypedResponse cmd_debug_show_cursors(
 
   UntypedResponse resp;
 
-  auto map = root->inner.cursors.rlock();
+  auto snapshot = root->inner.cursors.snapshot();
   std::unordered_map<w_string, json_ref> cursors;
-  cursors.reserve(map->size());
-  for (const auto& it : *map) {
-    const auto& name = it.first;
-    const auto& ticks = it.second;
+  cursors.reserve(snapshot.size());
+  for (const auto& [name, ticks] : snapshot) {
     cursors.insert_or_assign(name, json_integer(ticks));
   }
 
@@ -91,6 +93,32 @@ static UntypedResponse cmd_debug_ageout(Client* client, const json_ref& args) {
 }
 W_CMD_REG("debug-ageout", cmd_debug_ageout, CMD_DAEMON, w_cmd_realpath_root);
 
+/* debug-compact-tombstones */
+static UntypedResponse cmd_debug_compact_tombstones(
+    Client* client,
+    const json_ref& args) {
+  /* resolve the root */
+  if (json_array_size(args) != 3) {
+    throw ErrorResponse(
+        "wrong number of arguments for 'debug-compact-tombstones'");
+  }
+
+  auto root = resolveRoot(client, args);
+
+  std::chrono::seconds min_age(args.array()[2].asInt());
+
+  UntypedResponse resp;
+  root->performTombstoneCompaction(min_age);
+
+  resp.set("compacted", json_true());
+  return resp;
+}
+W_CMD_REG(
+    "debug-compact-tombstones",
+    cmd_debug_compact_tombstones,
+    CMD_DAEMON,
+    w_cmd_realpath_root);
+
 static UntypedResponse cmd_debug_poison(Client* client, const json_ref& args) {
   auto root = resolveRoot(client, args);
 
@@ -119,6 +147,57 @@ static UntypedResponse cmd_debug_drop_privs(Client* client, const json_ref&) {
 }
 W_CMD_REG("debug-drop-privs", cmd_debug_drop_privs, CMD_DAEMON, nullptr);
 
+static UntypedResponse cmd_debug_stats(Client*, const json_ref&) {
+  auto stats = json_object();
+  for (auto& [name, value] : getWatchmanStats()->getCounters()) {
+    stats.set(name.c_str(), json_integer(value));
+  }
+
+  UntypedResponse resp;
+  resp.set("stats", std::move(stats));
+  return resp;
+}
+W_CMD_REG("debug-stats", cmd_debug_stats, CMD_DAEMON, nullptr);
+
+static UntypedResponse cmd_debug_query_scheduler(Client*, const json_ref&) {
+  auto stats = getQueryScheduler().getStats();
+
+  UntypedResponse resp;
+  resp.set({
+      {"running", json_integer(stats.running)},
+      {"queued_interactive", json_integer(stats.queuedInteractive)},
+      {"queued_batch", json_integer(stats.queuedBatch)},
+      {"admitted_interactive", json_integer(stats.admittedInteractive)},
+      {"admitted_batch", json_integer(stats.admittedBatch)},
+      {"timed_out", json_integer(stats.timedOut)},
+      {"max_queue_wait_us", json_integer(stats.maxQueueWait.count())},
+  });
+  return resp;
+}
+W_CMD_REG(
+    "debug-query-scheduler",
+    cmd_debug_query_scheduler,
+    CMD_DAEMON,
+    nullptr);
+
+static UntypedResponse cmd_debug_query_log(Client*, const json_ref&) {
+  UntypedResponse resp;
+  auto log = getQueryLog();
+  resp.insert(log.object().begin(), log.object().end());
+  return resp;
+}
+W_CMD_REG("debug-query-log", cmd_debug_query_log, CMD_DAEMON, nullptr);
+
+static UntypedResponse cmd_debug_query_log_clear(Client*, const json_ref&) {
+  clearQueryLog();
+  return UntypedResponse{};
+}
+W_CMD_REG(
+    "debug-query-log-clear",
+    cmd_debug_query_log_clear,
+    CMD_DAEMON,
+    nullptr);
+
 struct DebugSetParallelCrawlCommand
     : TypedCommand<DebugSetParallelCrawlCommand> {
   static constexpr std::string_view name = "debug-set-parallel-crawl";
@@ -212,6 +291,8 @@ static json_ref getDebugSubscriptionInfo(Root* root) {
             {"name", w_string_to_json(sub.first)},
             {"client_id", json_integer(user_client->unique_id)},
             {"last_responses", json_array(std::move(last_responses))},
+            {"backpressure_deferrals",
+             json_integer(sub.second->backpressureDeferrals.load())},
         }));
       }
     }
@@ -293,12 +374,14 @@ struct DebugStatusCommand : PrettyCommand<DebugStatusCommand> {
   using Request = serde::Array<0>;
 
   struct Response : BaseResponse {
+    std::vector<PhaseStatus> startup;
     std::vector<RootDebugStatus> roots;
     std::vector<ClientDebugStatus> clients;
 
     template <typename X>
     void map(X& x) {
       BaseResponse::map(x);
+      x("startup", startup);
       x("roots", roots);
       x("clients", clients);
     }
@@ -307,12 +390,30 @@ struct DebugStatusCommand : PrettyCommand<DebugStatusCommand> {
   static Response handle(Client*, const Request&) {
     Response res;
     res.version = w_string{PACKAGE_VERSION, W_STRING_UNICODE};
+    res.startup = getStartupTimeline().getStatus();
     res.roots = Root::getStatusForAllRoots();
     res.clients = UserClient::getStatusForAllClients();
     return res;
   }
 
+  static void printPhases(
+      const std::vector<PhaseStatus>& phases,
+      std::string_view indent) {
+    for (auto& phase : phases) {
+      fmt::print(
+          "{}{}: {} ms (at {} ms)\n",
+          indent,
+          phase.name,
+          phase.duration_ms,
+          phase.start_ms);
+    }
+  }
+
   static void printResult(const Response& response) {
+    fmt::print("STARTUP\n-------\n");
+    printPhases(response.startup, "");
+    fmt::print("\n");
+
     fmt::print("ROOTS\n-----\n");
     for (auto& root : response.roots) {
       fmt::print("{}\n", root.path);
@@ -326,6 +427,18 @@ struct DebugStatusCommand : PrettyCommand<DebugStatusCommand> {
       fmt::print("  - uptime: {} s\n", root.uptime);
       fmt::print("  - crawl_status: {}\n", root.crawl_status);
       fmt::print("  - done_initial: {}\n", root.done_initial);
+      fmt::print("  - memory: {} bytes", root.memory.total_bytes);
+      if (root.memory.soft_limit_bytes) {
+        fmt::print(
+            " (soft limit {} bytes{})",
+            root.memory.soft_limit_bytes,
+            root.memory.over_limit ? ", exceeded" : "");
+      }
+      fmt::print("\n");
+      if (!root.init_phases.empty()) {
+        fmt::print("  - init:\n");
+        printPhases(root.init_phases, "    - ");
+      }
       fmt::print("\n");
     }
 
@@ -471,5 +584,57 @@ W_CMD_REG(
     CMD_DAEMON,
     w_cmd_realpath_root);
 
+// Writes the changes that the root's watcher reports to a trace file, which
+// benchmarks/replay.cpp can feed through a view.
+//
+// ["debug-event-trace", ROOT, {"path": PATH}] starts writing the trace, up to
+// "max_changes" changes, by default 10 million.
+// ["debug-event-trace", ROOT, {"stop": true}] stops it.
+UntypedResponse debugEventTrace(Client* client, const json_ref& args) {
+  if (json_array_size(args) != 3 || !args.at(2).isObject()) {
+    throw ErrorResponse(
+        "expected ['debug-event-trace', root, {\"path\": path}] or "
+        "['debug-event-trace', root, {\"stop\": true}]");
+  }
+  auto root = resolveRoot(client, args);
+  auto view = std::dynamic_pointer_cast<InMemoryView>(root->view());
+  if (!view) {
+    throw ErrorResponse("root is not an InMemoryView watcher");
+  }
+
+  const auto& options = args.at(2);
+  UntypedResponse resp;
+  if (options.get_default("stop", json_false()).asBool()) {
+    auto changes = view->stopEventTrace();
+    if (!changes) {
+      throw ErrorResponse("no event trace is being written");
+    }
+    resp.set("changes", json_integer(*changes));
+    return resp;
+  }
+
+  auto path = options.get_optional("path");
+  if (!path || !path->isString()) {
+    throw ErrorResponse("'path' must be a string");
+  }
+  auto maxChanges =
+      options.get_default("max_changes", json_integer(10000000)).asInt();
+  if (maxChanges <= 0) {
+    throw ErrorResponse("'max_changes' must be positive");
+  }
+  try {
+    view->startEventTrace(path->asCString(), size_t(maxChanges));
+  } catch (const std::exception& exc) {
+    throw ErrorResponse("failed to start the event trace: {}", exc.what());
+  }
+  resp.set("path", json_ref{*path});
+  return resp;
+}
+W_CMD_REG(
+    "debug-event-trace",
+    debugEventTrace,
+    CMD_DAEMON,
+    w_cmd_realpath_root);
+
 } // namespace
 } // namespace watchman
@@ -8,29 +8,135 @@
 #include <fmt/core.h>
 #include <folly/String.h>
 #include <folly/memory/Malloc.h>
+#include <atomic>
 #include "watchman/Client.h"
+#include "watchman/Serde.h"
+#include "watchman/root/Root.h"
 #include "watchman/watchman_cmd.h"
 
 using namespace watchman;
 
 #if defined(FOLLY_USE_JEMALLOC)
 
+namespace {
+
+void requireProfiling() {
+  if (!folly::usingJEMalloc()) {
+    throw std::runtime_error("jemalloc is not in use");
+  }
+  bool enabled = false;
+  size_t len = sizeof(enabled);
+  if (mallctl("opt.prof", &enabled, &len, nullptr, 0) != 0 || !enabled) {
+    throw std::runtime_error(
+        "jemalloc heap profiling is not enabled; "
+        "start watchman with MALLOC_CONF=prof:true");
+  }
+}
+
+// Allocation sites show which code allocated, but not on behalf of which
+// watch, so each dump is accompanied by the per-root, per-subsystem estimate
+// that debug-status reports.
+json_ref memoryByRoot() {
+  auto result = json_object();
+  for (auto& status : Root::getStatusForAllRoots()) {
+    result.set(status.path, serde::encode(status.memory));
+  }
+  return result;
+}
+
+} // namespace
+
 // This command is present to manually trigger a  heap profile dump when
 // jemalloc is in use.
-static UntypedResponse cmd_debug_prof_dump(Client*, const json_ref&) {
+//
+// ["debug-prof-dump"] writes a dump to jemalloc's default location.
+// ["debug-prof-dump", PREFIX] writes it to PREFIX.N.heap, where N counts up
+// from 0 over the life of the process, so that two dumps can be compared
+// with `jeprof --base=PREFIX.0.heap watchman PREFIX.1.heap`.
+static UntypedResponse cmd_debug_prof_dump(Client*, const json_ref& args) {
   if (!folly::usingJEMalloc()) {
     throw std::runtime_error("jemalloc is not in use");
   }
 
-  auto result = mallctl("prof.dump", nullptr, nullptr, nullptr, 0);
+  static std::atomic<uint64_t> dumpSeq{0};
+
+  std::optional<std::string> fileName;
+  if (args.array().size() > 1) {
+    fileName = fmt::format(
+        "{}.{}.heap", json_to_w_string(args.at(1)).view(), dumpSeq++);
+  }
+
+  int result;
+  if (fileName) {
+    const char* name = fileName->c_str();
+    result = mallctl("prof.dump", nullptr, nullptr, &name, sizeof(name));
+  } else {
+    result = mallctl("prof.dump", nullptr, nullptr, nullptr, 0);
+  }
+
   UntypedResponse resp;
   resp.set(
       "prof.dump",
       w_string_to_json(
           fmt::format("mallctl prof.dump returned: {}", folly::errnoStr(result))
               .c_str()));
+  if (fileName && result == 0) {
+    resp.set("file", w_string_to_json(w_string{fileName->c_str()}));
+  }
+  resp.set("memory", memoryByRoot());
   return resp;
 }
 W_CMD_REG("debug-prof-dump", cmd_debug_prof_dump, CMD_DAEMON, nullptr);
 
+// ["debug-prof-activate", ACTIVE] turns sampling on or off without
+// restarting watchman.
+// ["debug-prof-activate", true, LG_SAMPLE] also discards the samples taken so
+// far and samples on average once every 2^LG_SAMPLE allocated bytes from now
+// on, so that the next dump only covers allocations made after this command.
+static UntypedResponse cmd_debug_prof_activate(
+    Client*,
+    const json_ref& args) {
+  requireProfiling();
+
+  auto& argv = args.array();
+  if (argv.size() < 2 || !argv[1].isBool()) {
+    throw ErrorResponse("expected a boolean to turn sampling on or off");
+  }
+  bool active = argv[1].asBool();
+
+  if (argv.size() > 2) {
+    size_t lgSample = size_t(argv[2].asInt());
+    if (auto result =
+            mallctl("prof.reset", nullptr, nullptr, &lgSample, sizeof(size_t))) {
+      throw ErrorResponse(
+          "mallctl prof.reset failed: {}", folly::errnoStr(result));
+    }
+  }
+
+  bool wasActive = false;
+  size_t len = sizeof(wasActive);
+  if (auto result = mallctl(
+          "prof.active", &wasActive, &len, &active, sizeof(active))) {
+    throw ErrorResponse(
+        "mallctl prof.active failed: {}", folly::errnoStr(result));
+  }
+
+  size_t lgSample = 0;
+  len = sizeof(lgSample);
+  mallctl("prof.lg_sample", &lgSample, &len, nullptr, 0);
+
+  UntypedResponse resp;
+  resp.set(
+      "prof.active",
+      json_object(
+          {{"old", json_boolean(wasActive)}, {"new", json_boolean(active)}}));
+  resp.set("prof.lg_sample", json_integer(lgSample));
+  return resp;
+}
+W_CMD_REG(
+    "debug-prof-activate",
+    cmd_debug_prof_activate,
+    CMD_DAEMON,
+    nullptr);
+
 #endif
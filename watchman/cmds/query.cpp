@@ -6,25 +6,143 @@
  */
 
 #include "watchman/query/Query.h"
+#include <fmt/core.h>
+#include <folly/ScopeGuard.h>
+#include <folly/String.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include "watchman/Client.h"
 #include "watchman/ClientContext.h"
+#include "watchman/Command.h"
+#include "watchman/Errors.h"
+#include "watchman/InMemoryView.h"
+#include "watchman/Logging.h"
 #include "watchman/ProcessUtil.h"
+#include "watchman/UserDir.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/bser.h"
+#include "watchman/fs/FileSystem.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
+#include "watchman/root/Root.h"
 #include "watchman/saved_state/SavedStateFactory.h"
 #include "watchman/watchman_cmd.h"
+#include "watchman/watchman_stream.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 using namespace watchman;
 
-/* query /root {query} */
-static UntypedResponse cmd_query(Client* client, const json_ref& args) {
-  if (json_array_size(args) != 3) {
-    throw ErrorResponse("wrong number of arguments for 'query', expected 3");
+namespace {
+
+#ifndef _WIN32
+int appendToString(const char* buffer, size_t size, void* data) {
+  static_cast<std::string*>(data)->append(buffer, size);
+  return 0;
+}
+
+// Creates a file that exists only for as long as it is open
+std::unique_ptr<watchman_stream> createAnonymousFile() {
+#ifdef __linux__
+  int fd = memfd_create("watchman-results", MFD_CLOEXEC);
+  if (fd == -1) {
+    return nullptr;
+  }
+  return w_stm_fdopen(FileDescriptor(fd, FileDescriptor::FDType::Generic));
+#else
+  char name[WATCHMAN_NAME_MAX];
+  snprintf(
+      name, sizeof(name), "%s/wmanXXXXXX", getTemporaryDirectory().c_str());
+  auto file = w_mkstemp(name);
+  if (file) {
+    unlink(name);
   }
+  return file;
+#endif
+}
 
-  auto root = resolveRoot(client, args);
+// Whether the files can be passed to the client as a descriptor of their own
+bool canSendFilesByDescriptor(Client* client) {
+  // This writes straight to the socket, so nothing may be queued ahead
+  return client->stm && !client->client_mode && client->responses.empty() &&
+      (client->format.type == is_bser || client->format.type == is_bser_v2) &&
+      client->stm->canPassDescriptors();
+}
+
+/**
+ * Writes the files to an anonymous file as a BSER PDU of their own and sends
+ * the response to the client with that file attached in their place. The
+ * client maps the file rather than copying the files out of the socket.
+ *
+ * Returns false, having sent nothing, if the file could not be written.
+ */
+bool sendFilesByDescriptor(
+    Client* client,
+    UntypedResponse& response,
+    const json_ref& files) {
+  uint32_t version = client->format.type == is_bser_v2 ? 2 : 1;
+  // The file is mapped rather than copied, so compressing it would only
+  // cost time
+  uint32_t capabilities = client->format.capabilities & ~BSER_CAP_COMPRESSED;
+
+  auto filesStream = createAnonymousFile();
+  if (!filesStream) {
+    logf(
+        ERR,
+        "unable to create a file for query results: {}\n",
+        folly::errnoStr(errno));
+    return false;
+  }
+  PduBuffer buffer;
+  auto encodeResult = buffer.bserEncodeToStream(
+      version, capabilities, files, filesStream.get());
+  if (encodeResult.hasError()) {
+    logf(
+        ERR,
+        "unable to write query results to a file: {}\n",
+        folly::errnoStr(encodeResult.error()));
+    return false;
+  }
+  auto size = lseek(filesStream->getFileDescriptor().fd(), 0, SEEK_CUR);
+
+  response.set("files_fd", json_object({{"size", json_integer(size)}}));
+  std::string pdu;
+  if (w_bser_write_pdu(
+          version,
+          capabilities,
+          appendToString,
+          std::move(response).toJson(),
+          &pdu)) {
+    throw std::runtime_error("failed to encode the query response");
+  }
+
+  client->stm->setNonBlock(false);
+  SCOPE_EXIT {
+    client->stm->setNonBlock(true);
+  };
+  int wrote = client->stm->writeWithDescriptor(
+      pdu.data(), pdu.size(), filesStream->getFileDescriptor());
+  while (wrote > 0 && size_t(wrote) < pdu.size()) {
+    int x = client->stm->write(pdu.data() + wrote, pdu.size() - wrote);
+    if (x <= 0) {
+      break;
+    }
+    wrote += x;
+  }
+  if (wrote <= 0 || size_t(wrote) != pdu.size()) {
+    throw QueryExecError("failed to send query results to the client");
+  }
+  return true;
+}
+#endif
 
-  const auto& query_spec = args.at(2);
+std::unique_ptr<Query> parseClientQuery(
+    Client* client,
+    const std::shared_ptr<Root>& root,
+    const json_ref& query_spec) {
   auto query = parseQuery(root, query_spec);
   auto clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
   query->clientInfo.clientPid = clientPid;
@@ -35,20 +153,146 @@ static UntypedResponse cmd_query(Client* client, const json_ref& args) {
   if (client->client_mode) {
     query->sync_timeout = std::chrono::milliseconds(0);
   }
+  // The query runs while the client waits for it, so the stream outlives it
+  if (auto* stm = client->stm.get()) {
+    query->isAbandoned = [stm] { return stm->peerHasHungUp(); };
+  }
+  return query;
+}
+
+// Client mode resolves the root of a query without crawling it.  Returns a
+// generator that walks the filesystem if that answers the query just as
+// well, and otherwise crawls the root and returns nullptr so that the usual
+// generators read the view.
+QueryGenerator clientModeGenerator(
+    const std::shared_ptr<Root>& root,
+    const Query& query) {
+  auto view = std::dynamic_pointer_cast<InMemoryView>(root->view());
+  if (!view) {
+    throw RootResolveError("client mode not available");
+  }
+  if (root->config.getBool("client_mode_walk", true) &&
+      InMemoryView::canWalkForQuery(query)) {
+    return [view](
+               const Query* q,
+               const std::shared_ptr<Root>& r,
+               QueryContext* ctx) { view->walkGenerator(r, q, ctx); };
+  }
+  view->clientModeCrawl(root);
+  return nullptr;
+}
 
-  auto res = w_query_execute(query.get(), root, nullptr, getInterface);
+// Everything in the response to a query other than its files
+UntypedResponse makeQueryResponse(
+    const Query& query,
+    const std::shared_ptr<Root>& root,
+    QueryResult& res) {
   UntypedResponse response;
   response.set(
       {{"is_fresh_instance", json_boolean(res.isFreshInstance)},
        {"clock", res.clockAtStartOfQuery.toJson()},
-       {"files", std::move(res.resultsArray).toJson()},
        {"debug", res.debugInfo.render()}});
   if (res.savedStateInfo) {
     response.set("saved-state-info", std::move(*res.savedStateInfo));
   }
+  if (query.exists_only) {
+    response.set("exists", json_boolean(res.limitReached));
+  } else if (query.limit) {
+    response.set("limit_reached", json_boolean(res.limitReached));
+  }
+  if (query.report_cost) {
+    response.set("cost", res.cost.render());
+  }
+  if (res.explain) {
+    response.set("explain", res.explain->render());
+  }
+  if (res.initialCrawlStatCount) {
+    response.set(
+        "initial_crawl_stat_count", json_integer(*res.initialCrawlStatCount));
+  }
 
   add_root_warnings_to_response(response, root);
+  return response;
+}
+
+} // namespace
+
+/* query /root {query} */
+static UntypedResponse cmd_query(Client* client, const json_ref& args) {
+  if (json_array_size(args) != 3) {
+    throw ErrorResponse("wrong number of arguments for 'query', expected 3");
+  }
+
+  auto root = resolveRootWithoutClientModeCrawl(client, args);
+  auto query = parseClientQuery(client, root, args.at(2));
+  QueryGenerator generator;
+  if (client->client_mode) {
+    generator = clientModeGenerator(root, *query);
+  }
+
+  // Stream intermediate chunks straight to the client's socket.  This runs
+  // on the client thread, or on the query's stream writer while the client
+  // thread waits for the generators, so nothing else is writing to it.
+  // Anything already queued must go out first, so in that case we just
+  // buffer as usual.
+  QueryResultsCallback streamResults;
+  if (query->stream_results && client->stm && client->responses.empty()) {
+    streamResults = [client](RenderResult&& chunk) {
+      UntypedResponse response;
+      response.set(
+          {{"streaming", json_boolean(true)},
+           {"files", std::move(chunk).toJson()}});
 
+      client->stm->setNonBlock(false);
+      auto encodeResult = client->writer.pduEncodeToStream(
+          client->format, std::move(response).toJson(), client->stm.get());
+      client->stm->setNonBlock(true);
+      if (encodeResult.hasError()) {
+        throw QueryExecError("failed to stream query results to the client");
+      }
+    };
+  } else if (query->stream_results && client->client_mode) {
+    // There is no socket in client mode, so the chunks are printed ahead of
+    // the final response.
+    streamResults = [](RenderResult&& chunk) {
+      json_dumpf(
+          json_object(
+              {{"streaming", json_boolean(true)},
+               {"files", std::move(chunk).toJson()}}),
+          stdout,
+          JSON_COMPACT);
+      fmt::print("\n");
+      fflush(stdout);
+    };
+  }
+
+  // BSER clients get their results encoded as they are rendered, which
+  // avoids building a json object for every file.
+  std::optional<BserResultEncoding> bserEncoding;
+  if (client->stm && !client->client_mode &&
+      (client->format.type == is_bser || client->format.type == is_bser_v2)) {
+    bserEncoding = BserResultEncoding{
+        client->format.type == is_bser_v2 ? 2u : 1u,
+        client->format.capabilities};
+  }
+
+  auto res = w_query_execute(
+      query.get(),
+      root,
+      std::move(generator),
+      getInterface,
+      std::move(streamResults),
+      bserEncoding);
+  auto response = makeQueryResponse(*query, root, res);
+
+  auto files = std::move(res.resultsArray).toJson();
+#ifndef _WIN32
+  if (query->shm_results && canSendFilesByDescriptor(client) &&
+      sendFilesByDescriptor(client, response, files)) {
+    throw ResponseWasHandledManually{};
+  }
+#endif
+  response.set("files", std::move(files));
   return response;
 }
 W_CMD_REG(
@@ -57,5 +301,210 @@ W_CMD_REG(
     CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER,
     w_cmd_realpath_root);
 
+namespace {
+
+// Realpaths the root of each [root, query] pair, as w_cmd_realpath_root does
+// for a single root
+void realpathMultiQueryRoots(Command& command) {
+  std::vector<json_ref> args = command.args().array();
+  if (args.size() != 1 || !args[0].isArray()) {
+    throw CommandValidationError(
+        "multi-query expects an array of [root, query] pairs");
+  }
+
+  std::vector<json_ref> pairs = args[0].array();
+  for (auto& pair : pairs) {
+    std::vector<json_ref> items =
+        pair.isArray() ? pair.array() : std::vector<json_ref>{};
+    const char* path = items.size() == 2 ? json_string_value(items[0]) : nullptr;
+    if (!path) {
+      throw CommandValidationError(
+          "multi-query expects an array of [root, query] pairs");
+    }
+    try {
+      items[0] = w_string_to_json(realPath(path));
+    } catch (const std::exception& exc) {
+      CommandValidationError::throwf(
+          "Could not resolve {} to the canonical watch path: {}",
+          path,
+          exc.what());
+    }
+    pair = json_array(std::move(items));
+  }
+  args[0] = json_array(std::move(pairs));
+
+  command.args() = json_array(std::move(args));
+}
+
+struct MultiQueryItem {
+  w_string rootName;
+  std::shared_ptr<Root> root;
+  std::unique_ptr<Query> query;
+  std::optional<json_ref> response;
+  std::optional<std::string> error;
+};
+
+} // namespace
+
+/* multi-query [[/root, {query}], ...]
+ * Runs a query against each root concurrently, so that the time taken is
+ * that of the slowest root rather than the sum over all of them. */
+static UntypedResponse cmd_multi_query(Client* client, const json_ref& args) {
+  if (json_array_size(args) != 2 || !args.at(1).isArray()) {
+    throw ErrorResponse(
+        "wrong number of arguments for 'multi-query', expected an array of "
+        "[root, query] pairs");
+  }
+
+  // Resolving roots and parsing queries is quick and needs the client, so it
+  // happens here.  An error in one pair is reported in its result rather than
+  // failing the others.
+  std::vector<MultiQueryItem> items;
+  for (auto& pair : args.at(1).array()) {
+    auto& item = items.emplace_back();
+    try {
+      if (json_array_size(pair) != 2 || !pair.at(0).isString()) {
+        throw ErrorResponse("expected a [root, query] pair");
+      }
+      item.rootName = json_to_w_string(pair.at(0));
+      item.root = resolveRootByName(client, item.rootName.c_str());
+      item.query = parseClientQuery(client, item.root, pair.at(1));
+    } catch (const std::exception& exc) {
+      item.error = exc.what();
+    }
+  }
+
+  // Each query mostly waits for its sync cookie, so they run on threads of
+  // their own rather than tying up the thread pool.
+  auto concurrency = std::min<size_t>(
+      std::max<json_int_t>(cfg_get_int("multi_query_concurrency", 16), 1),
+      items.size());
+  std::atomic<size_t> next{0};
+  std::vector<std::thread> threads;
+  threads.reserve(concurrency);
+  for (size_t t = 0; t < concurrency; ++t) {
+    threads.emplace_back([&, t] {
+      w_set_thread_name("multiquery ", t);
+      for (size_t i = next++; i < items.size(); i = next++) {
+        auto& item = items[i];
+        if (item.error) {
+          continue;
+        }
+        try {
+          auto res = w_query_execute(
+              item.query.get(), item.root, nullptr, getInterface);
+          auto response = makeQueryResponse(*item.query, item.root, res);
+          response.erase(w_string{"version"});
+          response.set("files", std::move(res.resultsArray).toJson());
+          item.response = std::move(response).toJson();
+        } catch (const std::exception& exc) {
+          item.error = exc.what();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::vector<json_ref> results;
+  results.reserve(items.size());
+  for (auto& item : items) {
+    auto result = item.response ? std::move(*item.response) : json_object();
+    if (item.error) {
+      result.set("error", typed_string_to_json(item.error->c_str()));
+    }
+    if (item.root) {
+      result.set("root", w_string_to_json(item.root->root_path));
+    } else if (!item.rootName.empty()) {
+      result.set("root", w_string_to_json(item.rootName));
+    }
+    results.push_back(std::move(result));
+  }
+
+  UntypedResponse response;
+  response.set("results", json_array(std::move(results)));
+  return response;
+}
+W_CMD_REG(
+    "multi-query",
+    cmd_multi_query,
+    CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER,
+    realpathMultiQueryRoots);
+
+/* query-batch /root [{query}, ...]
+ * Runs several queries against one root after a single synchronization with
+ * the filesystem, rather than one for each query. */
+static UntypedResponse cmd_query_batch(Client* client, const json_ref& args) {
+  if (json_array_size(args) != 3 || !args.at(2).isArray()) {
+    throw ErrorResponse(
+        "wrong number of arguments for 'query-batch', expected a root and an "
+        "array of queries");
+  }
+
+  auto root = resolveRoot(client, args);
+
+  // An error in one query is reported in its result rather than failing the
+  // others.
+  std::vector<std::unique_ptr<Query>> queries;
+  std::vector<std::optional<std::string>> errors;
+  std::chrono::milliseconds syncTimeout{0};
+  ClientContext clientInfo{};
+  for (auto& spec : args.at(2).array()) {
+    auto& query = queries.emplace_back();
+    auto& error = errors.emplace_back();
+    try {
+      query = parseClientQuery(client, root, spec);
+      syncTimeout = std::max(syncTimeout, query->sync_timeout);
+      clientInfo = query->clientInfo;
+    } catch (const std::exception& exc) {
+      error = exc.what();
+    }
+  }
+
+  // The longest timeout of any query covers them all; the queries themselves
+  // then don't sync.
+  std::vector<w_string> cookieFileNames;
+  if (syncTimeout.count()) {
+    try {
+      cookieFileNames =
+          root->syncToNow(syncTimeout, clientInfo).cookieFileNames;
+    } catch (const std::exception& exc) {
+      QueryExecError::throwf("synchronization failed: {}", exc.what());
+    }
+  }
+
+  std::vector<json_ref> results;
+  results.reserve(queries.size());
+  for (size_t i = 0; i < queries.size(); ++i) {
+    auto& query = queries[i];
+    if (query) {
+      query->sync_timeout = std::chrono::milliseconds(0);
+      try {
+        auto res = w_query_execute(query.get(), root, nullptr, getInterface);
+        res.debugInfo.cookieFileNames = cookieFileNames;
+        auto response = makeQueryResponse(*query, root, res);
+        response.erase(w_string{"version"});
+        response.set("files", std::move(res.resultsArray).toJson());
+        results.push_back(std::move(response).toJson());
+        continue;
+      } catch (const std::exception& exc) {
+        errors[i] = exc.what();
+      }
+    }
+    results.push_back(
+        json_object({{"error", typed_string_to_json(errors[i]->c_str())}}));
+  }
+
+  UntypedResponse response;
+  response.set("results", json_array(std::move(results)));
+  return response;
+}
+W_CMD_REG(
+    "query-batch",
+    cmd_query_batch,
+    CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER,
+    w_cmd_realpath_root);
+
 /* vim:ts=2:sw=2:et:
  */
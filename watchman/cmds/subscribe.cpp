@@ -6,6 +6,9 @@
  */
 
 #include <folly/MapUtil.h>
+#include <folly/ScopeGuard.h>
+#include <algorithm>
+#include <limits>
 #include "watchman/Client.h"
 #include "watchman/ClientContext.h"
 #include "watchman/Errors.h"
@@ -181,6 +184,28 @@ void ClientSubscription::processSubscriptionImpl() {
           name,
           " until VCS operations complete\n");
       executeQuery = false;
+    } else if (isUnchangedInScope(position)) {
+      // There is nothing to report, so fast-forward as with drop
+      last_sub_tick = position.ticks;
+      query->since_spec = std::make_unique<ClockSpec>(position);
+      log(DBG,
+          "nothing changed in the scope of subscription ",
+          name,
+          ". Advanced ticks to ",
+          last_sub_tick,
+          "\n");
+      executeQuery = false;
+    } else if (client->isBacklogged()) {
+      // Leave since_spec where it is, so that once the client catches up a
+      // single notification covers every change made in the meantime.
+      log(DBG,
+          "deferring subscription notifications for ",
+          name,
+          " until the client reads its pending responses\n");
+      deferredForBackpressure = true;
+      ++backpressureDeferrals;
+      client->hasDeferredSubscriptions_.store(true, std::memory_order_relaxed);
+      executeQuery = false;
     }
 
     if (executeQuery) {
@@ -208,9 +233,70 @@ void ClientSubscription::processSubscriptionImpl() {
   }
 }
 
-void ClientSubscription::updateSubscriptionTicks(QueryResult* res) {
+void ClientSubscription::updateSubscriptionTicks(
+    const ClockSpec& clockAtStartOfQuery) {
   // create a new spec that will be used the next time
-  query->since_spec = std::make_unique<ClockSpec>(res->clockAtStartOfQuery);
+  query->since_spec = std::make_unique<ClockSpec>(clockAtStartOfQuery);
+}
+
+bool ClientSubscription::isUnchangedInScope(ClockPosition position) const {
+  const auto* since_spec = query->since_spec.get();
+  if (!route || !since_spec ||
+      !std::holds_alternative<ClockSpec::Clock>(since_spec->spec) ||
+      since_spec->hasScmParams() || since_spec->hasSavedStateParams()) {
+    return false;
+  }
+
+  auto since = since_spec->evaluate(
+      position, root->view()->getLastAgeOutTickValue(), nullptr);
+  if (since.is_fresh_instance()) {
+    return false;
+  }
+  return root->view()->isUnchangedInScope(
+      *route,
+      ClockPosition(
+          position.rootNumber, std::get<QuerySince::Clock>(since.since).ticks),
+      position);
+}
+
+std::optional<w_string> ClientSubscription::sharedResultKey() const {
+  if (!root->config.getBool("subscription_share_results", true)) {
+    return std::nullopt;
+  }
+
+  // Only plain clock queries depend solely on the query, the since clock and
+  // the state of the root.  Named cursors are advanced by each query, and SCM
+  // aware queries consult the SCM and saved state.
+  const auto* since_spec = query->since_spec.get();
+  const auto* clock = since_spec
+      ? std::get_if<ClockSpec::Clock>(&since_spec->spec)
+      : nullptr;
+  if (!clock || since_spec->hasScmParams() ||
+      since_spec->hasSavedStateParams() || !query->query_spec) {
+    return std::nullopt;
+  }
+
+  // Leave out the fields that only affect when we dispatch, and the original
+  // since, which since_spec has superseded.
+  auto spec = json_object();
+  for (auto& [key, value] : query->query_spec->object()) {
+    if (key == "since" || key == "defer" || key == "drop" ||
+        key == "defer_vcs") {
+      continue;
+    }
+    spec.set(key, json_ref(value));
+  }
+
+  return w_string::build(
+      clock->start_time,
+      ":",
+      clock->pid,
+      ":",
+      clock->position.rootNumber,
+      ":",
+      clock->position.ticks,
+      ":",
+      json_dumps(spec, JSON_SORT_KEYS | JSON_COMPACT));
 }
 
 std::optional<UntypedResponse> ClientSubscription::buildSubscriptionResults(
@@ -243,15 +329,116 @@ std::optional<UntypedResponse> ClientSubscription::buildSubscriptionResults(
   logf(DBG, "running subscription {} {}\n", name, fmt::ptr(this));
 
   try {
-    auto res = w_query_execute(query.get(), root, time_generator, getInterface);
+    auto queryStart = std::chrono::system_clock::now();
+    auto shareKey = sharedResultKey();
+    std::optional<Root::SharedSubscriptionResult> res;
+    std::optional<json_ref> savedStateInfo;
+    // Stays zero for results shared with an identical query
+    QueryCost cost;
+
+    // Set while this subscription is the one evaluating shareKey
+    bool evaluatingShared = false;
+    auto doneEvaluatingShared = [&] {
+      if (evaluatingShared) {
+        evaluatingShared = false;
+        root->sharedSubscriptionResults.lock()->evaluating.erase(*shareKey);
+        root->sharedSubscriptionResultsCond.notify_all();
+      }
+    };
+    SCOPE_EXIT {
+      doneEvaluatingShared();
+    };
+
+    if (shareKey) {
+      auto current = root->view()->getMostRecentRootNumberAndTickValue();
+      auto ageOut = root->view()->getLastAgeOutTickValue();
+      auto shared = root->sharedSubscriptionResults.lock();
+      while (true) {
+        // Results observed after we were dispatched are as good as our own
+        auto it = shared->results.find(*shareKey);
+        if (it != shared->results.end() &&
+            it->second.evaluatedAt.rootNumber == current.rootNumber &&
+            it->second.evaluatedAt.ticks >= current.ticks &&
+            it->second.lastAgeOutTick == ageOut) {
+          res = it->second;
+          log(DBG,
+              "subscription ",
+              name,
+              " reusing the results of an identical query\n");
+          break;
+        }
+        if (shared->evaluating.insert(*shareKey).second) {
+          evaluatingShared = true;
+          break;
+        }
+        log(DBG,
+            "subscription ",
+            name,
+            " waiting for the results of an identical query\n");
+        root->sharedSubscriptionResultsCond.wait(shared.as_lock());
+      }
+    }
 
-    logf(
-        DBG,
-        "subscription {} generated {} results\n",
-        name,
-        res.resultsArray.results.size());
+    if (!res) {
+      auto ageOut = root->view()->getLastAgeOutTickValue();
+      QueryGenerator generator = time_generator;
+      if (changedFiles && since_spec &&
+          std::holds_alternative<ClockSpec::Clock>(since_spec->spec) &&
+          !since_spec->hasScmParams() && !since_spec->hasSavedStateParams()) {
+        generator = [collector = changedFiles](
+                        const Query* q,
+                        const std::shared_ptr<Root>& r,
+                        QueryContext* c) {
+          r->view()->changedFilesGenerator(q, c, *collector);
+        };
+      }
+      auto queryRes =
+          w_query_execute(query.get(), root, generator, getInterface);
+
+      logf(
+          DBG,
+          "subscription {} generated {} results\n",
+          name,
+          queryRes.resultsArray.results.size());
+      if (!queryRes.isFreshInstance) {
+        // A fresh instance is a poor predictor of the next run's results
+        query->expected_results = queryRes.resultsArray.results.size();
+      }
 
-    position = res.clockAtStartOfQuery;
+      res = Root::SharedSubscriptionResult{
+          queryRes.clockAtStartOfQuery.position(),
+          ageOut,
+          queryRes.isFreshInstance,
+          queryRes.clockAtStartOfQuery,
+          queryRes.stateTransCountAtStartOfQuery,
+          std::move(queryRes.resultsArray).toJson()};
+      savedStateInfo = std::move(queryRes.savedStateInfo);
+      cost = queryRes.cost;
+
+      if (shareKey) {
+        // Every subscriber that shares these results would otherwise encode
+        // the same files again
+        json_array_enable_encoding_cache(res->files);
+        {
+          auto shared = root->sharedSubscriptionResults.lock();
+          auto& results = shared->results;
+          // Results from earlier positions can never be reused
+          for (auto it = results.begin(); it != results.end();) {
+            if (it->second.evaluatedAt.rootNumber !=
+                    res->evaluatedAt.rootNumber ||
+                it->second.evaluatedAt.ticks != res->evaluatedAt.ticks) {
+              it = results.erase(it);
+            } else {
+              ++it;
+            }
+          }
+          results.insert_or_assign(*shareKey, *res);
+        }
+        doneEvaluatingShared();
+      }
+    }
+
+    position = res->clockAtStartOfQuery;
 
     // An SCM operation was interleaved with the query execution. This could
     // result in over-reporing query results. Discard our results but, do not
@@ -259,7 +446,8 @@ std::optional<UntypedResponse> ClientSubscription::buildSubscriptionResults(
     // the query is run.
     bool scmAwareQuery = since_spec && since_spec->hasScmParams();
     if (onStateTransition == OnStateTransition::DontAdvance && scmAwareQuery) {
-      if (root->stateTransCount.load() != res.stateTransCountAtStartOfQuery) {
+      if (root->stateTransCount.load() !=
+          res->stateTransCountAtStartOfQuery) {
         log(DBG,
             "discarding SCM aware query results, SCM activity interleaved\n");
         return std::nullopt;
@@ -269,10 +457,11 @@ std::optional<UntypedResponse> ClientSubscription::buildSubscriptionResults(
     // We can suppress empty results, unless this is a source code aware query
     // and the mergeBase has changed or this is a fresh instance.
     bool mergeBaseChanged = scmAwareQuery &&
-        res.clockAtStartOfQuery.scmMergeBase != query->since_spec->scmMergeBase;
-    if (res.resultsArray.results.empty() && !mergeBaseChanged &&
-        !res.isFreshInstance) {
-      updateSubscriptionTicks(&res);
+        res->clockAtStartOfQuery.scmMergeBase !=
+            query->since_spec->scmMergeBase;
+    if (json_array_size(res->files) == 0 && !mergeBaseChanged &&
+        !res->isFreshInstance) {
+      updateSubscriptionTicks(res->clockAtStartOfQuery);
       return std::nullopt;
     }
 
@@ -285,17 +474,39 @@ std::optional<UntypedResponse> ClientSubscription::buildSubscriptionResults(
         std::holds_alternative<ClockSpec::Clock>(since_spec->spec)) {
       response.set("since", since_spec->toJson());
     }
-    updateSubscriptionTicks(&res);
+    updateSubscriptionTicks(res->clockAtStartOfQuery);
 
     response.set(
-        {{"is_fresh_instance", json_boolean(res.isFreshInstance)},
-         {"clock", res.clockAtStartOfQuery.toJson()},
-         {"files", std::move(res.resultsArray).toJson()},
+        {{"is_fresh_instance", json_boolean(res->isFreshInstance)},
+         {"clock", res->clockAtStartOfQuery.toJson()},
+         {"files", json_ref(res->files)},
          {"root", w_string_to_json(root->root_path)},
          {"subscription", w_string_to_json(name)},
          {"unilateral", json_true()}});
-    if (res.savedStateInfo) {
-      response.set({{"saved-state-info", std::move(*res.savedStateInfo)}});
+    if (savedStateInfo) {
+      response.set({{"saved-state-info", std::move(*savedStateInfo)}});
+    }
+    if (query->report_cost) {
+      response.set("cost", cost.render());
+    }
+    if (query->report_timing) {
+      // Wall clock microseconds, so that a client on the same machine can
+      // line them up with when it changed the files
+      auto micros = [](std::chrono::system_clock::time_point time) {
+        return json_integer(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                time.time_since_epoch())
+                .count());
+      };
+      auto times = root->view()->getPipelineTimes();
+      response.set(
+          "timing",
+          json_object(
+              {{"notified_us", micros(times.notified)},
+               {"processed_us", micros(times.processed)},
+               {"settled_us", micros(times.settled)},
+               {"query_start_us", micros(queryStart)},
+               {"query_end_us", micros(std::chrono::system_clock::now())}}));
     }
 
     return response;
@@ -305,6 +516,37 @@ std::optional<UntypedResponse> ClientSubscription::buildSubscriptionResults(
   }
 }
 
+void ClientSubscription::enqueueResults(
+    Client* client,
+    UntypedResponse&& response) {
+  auto* files = folly::get_ptr(response, "files");
+  if (!changeFeedBatchSize || !files ||
+      json_array_size(*files) <= changeFeedBatchSize) {
+    client->enqueueResponse(std::move(response));
+    return;
+  }
+
+  // Every batch but the last is marked partial; the clock is only a
+  // position to resume from once the last batch has been applied.
+  const auto& all = files->array();
+  auto templ = json_array_get_template(*files);
+  for (size_t begin = 0; begin < all.size(); begin += changeFeedBatchSize) {
+    size_t end = std::min(all.size(), begin + changeFeedBatchSize);
+    auto batchFiles = json_array(
+        std::vector<json_ref>(all.begin() + begin, all.begin() + end));
+    if (templ) {
+      json_array_set_template_new(batchFiles, json_ref(*templ));
+    }
+
+    UntypedResponse batch = response;
+    batch.set("files", std::move(batchFiles));
+    if (end < all.size()) {
+      batch.set("partial", json_true());
+    }
+    client->enqueueResponse(std::move(batch));
+  }
+}
+
 ClockSpec ClientSubscription::runSubscriptionRules(
     UserClient* client,
     const std::shared_ptr<Root>& root) {
@@ -315,7 +557,7 @@ ClockSpec ClientSubscription::runSubscriptionRules(
 
   if (response) {
     add_root_warnings_to_response(*response, root);
-    client->enqueueResponse(std::move(*response));
+    enqueueResults(client, std::move(*response));
   }
   return position;
 }
@@ -424,7 +666,7 @@ static UntypedResponse cmd_flush_subscriptions(
       auto sub_result = sub->buildSubscriptionResults(
           root, out_position, OnStateTransition::QueryAnyway);
       if (sub_result) {
-        client->enqueueResponse(std::move(*sub_result));
+        sub->enqueueResults(client, std::move(*sub_result));
         synced.push_back(w_string_to_json(sub_name_str));
       } else {
         no_sync_needed.push_back(w_string_to_json(sub_name_str));
@@ -475,6 +717,63 @@ W_CMD_REG(
     CMD_DAEMON | CMD_ALLOW_ANY_USER,
     w_cmd_realpath_root);
 
+/* A change feed is a subscription that reports each change with the
+ * metadata that a mirror of the root needs to apply it, in batches of at most
+ * `batch_size` files.  Returns query_spec with the fields that it reports. */
+static json_ref parseChangeFeed(
+    const std::shared_ptr<Root>& root,
+    const json_ref& query_spec,
+    const json_ref& feed,
+    uint32_t& batchSize) {
+  if (!feed.isBool() && !feed.isObject()) {
+    throw ErrorResponse("change_feed must be a boolean or an object");
+  }
+  if (feed.isBool() && !feed.asBool()) {
+    batchSize = 0;
+    return query_spec;
+  }
+  if (query_spec.get_optional("fields")) {
+    throw ErrorResponse("fields can't be used with change_feed");
+  }
+
+  bool contentHash = false;
+  json_int_t size = root->config.getInt("change_feed_batch_size", 1024);
+  if (feed.isObject()) {
+    auto hash = feed.get_default("content_hash", json_false());
+    if (!hash.isBool()) {
+      throw ErrorResponse("change_feed.content_hash must be a boolean");
+    }
+    contentHash = hash.asBool();
+    auto jsize = feed.get_default("batch_size", json_integer(size));
+    if (!jsize.isInt()) {
+      throw ErrorResponse("change_feed.batch_size must be an integer");
+    }
+    size = jsize.asInt();
+  }
+  if (size <= 0 || size > std::numeric_limits<uint32_t>::max()) {
+    throw ErrorResponse("change_feed.batch_size must be positive");
+  }
+  batchSize = uint32_t(size);
+
+  std::vector<json_ref> fields{
+      typed_string_to_json("name"),
+      typed_string_to_json("exists"),
+      typed_string_to_json("type"),
+      typed_string_to_json("size"),
+      typed_string_to_json("mtime_ms"),
+      typed_string_to_json("oclock")};
+  if (contentHash) {
+    fields.push_back(typed_string_to_json("content.sha1hex"));
+  }
+
+  auto spec = json_object();
+  for (auto& [key, value] : query_spec.object()) {
+    spec.set(key, json_ref(value));
+  }
+  spec.set("fields", json_array(std::move(fields)));
+  return spec;
+}
+
 /* subscribe /root subname {query}
  * Subscribes the client connection to the specified root. */
 static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
@@ -492,6 +791,11 @@ static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
   }
 
   json_ref query_spec = args.at(3);
+  uint32_t changeFeedBatchSize = 0;
+  if (auto feed = query_spec.get_optional("change_feed")) {
+    query_spec =
+        parseChangeFeed(root, query_spec, *feed, changeFeedBatchSize);
+  }
 
   auto query = parseQuery(root, query_spec);
   auto clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
@@ -500,6 +804,11 @@ static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
       ? std::make_optional(lookupProcessInfo(clientPid))
       : std::nullopt;
   query->subscriptionName = json_to_w_string(jname);
+  if (query->limit) {
+    // The subscription's clock would move past the changes left out
+    throw ErrorResponse(
+        "limit and exists_only are not supported by subscriptions");
+  }
 
   auto defer_list = query_spec.get_optional("defer");
   if (defer_list && !defer_list->isArray()) {
@@ -538,6 +847,19 @@ static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
 
   sub->name = std::move(sub_name);
   sub->query = query;
+  sub->changeFeedBatchSize = changeFeedBatchSize;
+  // Change feeds are long lived and mostly see small deltas, so they are
+  // always evaluated incrementally when their expression allows it.
+  if (changeFeedBatchSize ||
+      root->config.getBool("subscription_incremental", false)) {
+    // Start collecting before the initial results are computed, so that
+    // every change after them is seen.
+    sub->changedFiles = root->view()->collectChangedFiles(query.get());
+  }
+  if (root->config.getBool("subscription_scope_routing", true)) {
+    // As above, so that every change after the initial results is routed
+    sub->route = root->view()->routeSubscription(query.get());
+  }
 
   auto defer = query_spec.get_default("defer_vcs", json_true());
   if (!defer.isBool()) {
@@ -629,7 +951,7 @@ static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
   // return null.
   client->enqueueResponse(std::move(resp));
   if (initial_subscription_results) {
-    client->enqueueResponse(std::move(*initial_subscription_results));
+    sub->enqueueResults(client, std::move(*initial_subscription_results));
   }
   throw ResponseWasHandledManually{};
 }
@@ -41,7 +41,7 @@ static UntypedResponse cmd_trigger_delete(
   }
   tname = json_to_w_string(jname);
 
-  std::unique_ptr<TriggerCommand> cmd;
+  std::shared_ptr<TriggerCommand> cmd;
 
   {
     auto map = root->triggers.wlock();
@@ -51,6 +51,7 @@ static UntypedResponse cmd_trigger_delete(
     } else {
       std::swap(cmd, it->second);
       map->erase(it);
+      root->stateGeneration.fetch_add(1, std::memory_order_release);
       res = true;
     }
   }
@@ -135,7 +136,7 @@ static json_ref build_legacy_trigger(
  * is detected */
 static UntypedResponse cmd_trigger(Client* client, const json_ref& args) {
   bool need_save = true;
-  std::unique_ptr<TriggerCommand> cmd;
+  std::shared_ptr<TriggerCommand> cmd;
 
   auto root = resolveRoot(client, args);
 
@@ -178,6 +179,7 @@ static UntypedResponse cmd_trigger(Client* client, const json_ref& args) {
       // Start the new trigger thread
       cmd->start(root);
       old = std::move(cmd);
+      root->stateGeneration.fetch_add(1, std::memory_order_release);
 
       need_save = true;
     }
@@ -0,0 +1,764 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "FileResults.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <fmt/core.h>
+#include <folly/compression/Compression.h>
+#include <folly/io/Cursor.h>
+#include <folly/io/IOBufQueue.h>
+#include <folly/json/bser/Bser.h>
+
+namespace watchman {
+
+using namespace folly;
+
+namespace {
+
+enum BserType : uint8_t {
+  kArray = 0x00,
+  kObject = 0x01,
+  kBytes = 0x02,
+  kInt8 = 0x03,
+  kInt16 = 0x04,
+  kInt32 = 0x05,
+  kInt64 = 0x06,
+  kReal = 0x07,
+  kTrue = 0x08,
+  kFalse = 0x09,
+  kNull = 0x0a,
+  kTemplate = 0x0b,
+  kSkip = 0x0c,
+  kUtf8 = 0x0d,
+  kColumns = 0x0e,
+  kCompressed = 0x0f,
+};
+
+// The codec identifiers of compressed values
+constexpr int64_t kCodecZstd = 0x01;
+
+size_t intSize(uint8_t type) {
+  switch (type) {
+    case kInt8:
+      return 1;
+    case kInt16:
+      return 2;
+    case kInt32:
+      return 4;
+    case kInt64:
+      return 8;
+    default:
+      throw std::runtime_error(
+          fmt::format("expected a BSER integer type, got {}", type));
+  }
+}
+
+// Reads an integer of the given type that has no type byte of its own
+int64_t rawIntAt(uint8_t type, const uint8_t* ptr) {
+  switch (type) {
+    case kInt8: {
+      int8_t value;
+      memcpy(&value, ptr, sizeof(value));
+      return value;
+    }
+    case kInt16: {
+      int16_t value;
+      memcpy(&value, ptr, sizeof(value));
+      return value;
+    }
+    case kInt32: {
+      int32_t value;
+      memcpy(&value, ptr, sizeof(value));
+      return value;
+    }
+    default: {
+      int64_t value;
+      memcpy(&value, ptr, sizeof(value));
+      return value;
+    }
+  }
+}
+
+enum class Field { Name, Exists, Mtime, Size, Other };
+
+Field fieldNamed(std::string_view name) {
+  if (name == "name") {
+    return Field::Name;
+  } else if (name == "exists") {
+    return Field::Exists;
+  } else if (name == "mtime") {
+    return Field::Mtime;
+  } else if (name == "size") {
+    return Field::Size;
+  }
+  return Field::Other;
+}
+
+// Reads BSER values in place. BSER integers are in host byte order, which
+// is fine for a client on the same host as the server.
+class BserCursor {
+ public:
+  explicit BserCursor(ByteRange range) : range_{range} {}
+
+  ByteRange remaining() const {
+    return range_;
+  }
+
+  uint8_t peekType() const {
+    need(1);
+    return range_[0];
+  }
+
+  uint8_t readType() {
+    auto type = peekType();
+    range_.advance(1);
+    return type;
+  }
+
+  int64_t readInt() {
+    return readIntOfType(readType());
+  }
+
+  std::string_view readString() {
+    auto type = readType();
+    if (type != kBytes && type != kUtf8) {
+      throw std::runtime_error(
+          fmt::format("expected a BSER string, got type {}", type));
+    }
+    auto len = readInt();
+    if (len < 0) {
+      throw std::runtime_error("negative BSER string length");
+    }
+    need(len);
+    std::string_view str{reinterpret_cast<const char*>(range_.data()),
+                         size_t(len)};
+    range_.advance(len);
+    return str;
+  }
+
+  // The next value should be a bool; decodes skip and null as unset
+  std::optional<bool> readOptionalBool() {
+    switch (readType()) {
+      case kTrue:
+        return true;
+      case kFalse:
+        return false;
+      case kSkip:
+      case kNull:
+        return std::nullopt;
+      default:
+        throw std::runtime_error("expected a BSER bool");
+    }
+  }
+
+  // The next value should be a number; decodes skip and null as unset
+  std::optional<int64_t> readOptionalInt() {
+    auto type = readType();
+    switch (type) {
+      case kSkip:
+      case kNull:
+        return std::nullopt;
+      case kReal:
+        return int64_t(readScalar<double>());
+      default:
+        return readIntOfType(type);
+    }
+  }
+
+  void skipValue() {
+    auto type = readType();
+    switch (type) {
+      case kArray: {
+        for (auto n = readInt(); n > 0; --n) {
+          skipValue();
+        }
+        break;
+      }
+      case kObject: {
+        for (auto n = readInt(); n > 0; --n) {
+          readString();
+          skipValue();
+        }
+        break;
+      }
+      case kBytes:
+      case kUtf8: {
+        auto len = readInt();
+        need(len);
+        range_.advance(len);
+        break;
+      }
+      case kReal:
+        need(sizeof(double));
+        range_.advance(sizeof(double));
+        break;
+      case kTrue:
+      case kFalse:
+      case kNull:
+      case kSkip:
+        break;
+      case kTemplate: {
+        auto keys = readType() == kArray ? readInt() : -1;
+        if (keys < 0) {
+          throw std::runtime_error("BSER template keys must be an array");
+        }
+        for (auto i = keys; i > 0; --i) {
+          readString();
+        }
+        for (auto n = readInt() * keys; n > 0; --n) {
+          skipValue();
+        }
+        break;
+      }
+      case kColumns: {
+        auto keys = readKeys();
+        auto count = readCount();
+        SkipColumn skip;
+        for (size_t k = 0; k < keys.size(); ++k) {
+          readColumn(count, skip);
+        }
+        break;
+      }
+      default:
+        readIntOfType(type);
+    }
+  }
+
+  // Reads the key set of a template or of columns
+  std::vector<std::string_view> readKeys() {
+    if (readType() != kArray) {
+      throw std::runtime_error("BSER template keys must be an array");
+    }
+    std::vector<std::string_view> keys;
+    for (auto n = readInt(); n > 0; --n) {
+      keys.push_back(readString());
+    }
+    return keys;
+  }
+
+  size_t readCount() {
+    auto count = readInt();
+    if (count < 0) {
+      throw std::runtime_error("negative BSER container size");
+    }
+    return size_t(count);
+  }
+
+  /**
+   * Reads one column of a columnar array of count objects. Any values that
+   * aren't compactly encoded are left for visitor.value(i, cursor) to
+   * consume; the others are passed to visitor.boolean, visitor.integer or
+   * visitor.string, whose string is only valid during the call.
+   */
+  template <typename Visitor>
+  void readColumn(size_t count, Visitor& visitor) {
+    auto kind = readType();
+    switch (kind) {
+      case kArray:
+        for (size_t i = 0; i < count; ++i) {
+          if (peekType() == kSkip) {
+            range_.advance(1);
+            continue;
+          }
+          visitor.value(i, *this);
+        }
+        return;
+      case kTrue: {
+        auto bits = take((count + 7) / 8);
+        for (size_t i = 0; i < count; ++i) {
+          visitor.boolean(i, (bits[i / 8] >> (i % 8)) & 1);
+        }
+        return;
+      }
+      case kBytes:
+      case kUtf8: {
+        auto prefixType = readType();
+        auto prefixSize = intSize(prefixType);
+        auto prefixes = take(count * prefixSize);
+        auto suffixType = readType();
+        auto suffixSize = intSize(suffixType);
+        auto suffixes = take(count * suffixSize);
+        std::string value;
+        for (size_t i = 0; i < count; ++i) {
+          auto prefix = rawIntAt(prefixType, prefixes.data() + i * prefixSize);
+          auto suffix = rawIntAt(suffixType, suffixes.data() + i * suffixSize);
+          if (prefix < 0 || size_t(prefix) > value.size() || suffix < 0) {
+            throw std::runtime_error("invalid string lengths in BSER column");
+          }
+          auto bytes = take(suffix);
+          value.resize(prefix);
+          value.append(reinterpret_cast<const char*>(bytes.data()), suffix);
+          visitor.string(i, std::string_view{value});
+        }
+        return;
+      }
+      default: {
+        // Each integer is stored as the difference from the previous one
+        auto size = intSize(kind);
+        auto deltas = take(count * size);
+        uint64_t value = 0;
+        for (size_t i = 0; i < count; ++i) {
+          value += uint64_t(rawIntAt(kind, deltas.data() + i * size));
+          visitor.integer(i, int64_t(value));
+        }
+        return;
+      }
+    }
+  }
+
+  dynamic readDynamic() {
+    auto type = peekType();
+    switch (type) {
+      case kArray: {
+        range_.advance(1);
+        auto result = dynamic::array();
+        for (auto n = readInt(); n > 0; --n) {
+          result.push_back(readDynamic());
+        }
+        return result;
+      }
+      case kObject: {
+        range_.advance(1);
+        auto result = dynamic::object();
+        for (auto n = readInt(); n > 0; --n) {
+          std::string key{readString()};
+          result.insert(std::move(key), readDynamic());
+        }
+        return result;
+      }
+      case kBytes:
+      case kUtf8:
+        return std::string{readString()};
+      case kReal:
+        range_.advance(1);
+        return readScalar<double>();
+      case kTrue:
+        range_.advance(1);
+        return true;
+      case kFalse:
+        range_.advance(1);
+        return false;
+      case kNull:
+      case kSkip:
+        range_.advance(1);
+        return nullptr;
+      case kColumns: {
+        range_.advance(1);
+        auto keys = readKeys();
+        auto count = readCount();
+        auto result = dynamic::array();
+        for (size_t i = 0; i < count; ++i) {
+          result.push_back(dynamic::object());
+        }
+        for (auto key : keys) {
+          DynamicColumn column{result, std::string{key}};
+          readColumn(count, column);
+        }
+        return result;
+      }
+      case kTemplate: {
+        range_.advance(1);
+        auto keys = readDynamic();
+        if (!keys.isArray()) {
+          throw std::runtime_error("BSER template keys must be an array");
+        }
+        auto result = dynamic::array();
+        for (auto n = readInt(); n > 0; --n) {
+          auto row = dynamic::object();
+          for (auto& key : keys) {
+            if (peekType() == kSkip) {
+              range_.advance(1);
+              continue;
+            }
+            row.insert(key, readDynamic());
+          }
+          result.push_back(std::move(row));
+        }
+        return result;
+      }
+      default:
+        return readInt();
+    }
+  }
+
+ private:
+  struct SkipColumn {
+    void value(size_t, BserCursor& cursor) {
+      cursor.skipValue();
+    }
+    void boolean(size_t, bool) {}
+    void integer(size_t, int64_t) {}
+    void string(size_t, std::string_view) {}
+  };
+
+  struct DynamicColumn {
+    dynamic& objects;
+    std::string key;
+
+    void value(size_t i, BserCursor& cursor) {
+      objects[i].insert(key, cursor.readDynamic());
+    }
+    void boolean(size_t i, bool value) {
+      objects[i].insert(key, value);
+    }
+    void integer(size_t i, int64_t value) {
+      objects[i].insert(key, value);
+    }
+    void string(size_t i, std::string_view value) {
+      objects[i].insert(key, std::string{value});
+    }
+  };
+
+  void need(int64_t n) const {
+    if (n < 0 || size_t(n) > range_.size()) {
+      throw std::out_of_range("BSER value extends past the end of the PDU");
+    }
+  }
+
+  ByteRange take(int64_t n) {
+    need(n);
+    auto taken = range_.subpiece(0, n);
+    range_.advance(n);
+    return taken;
+  }
+
+  template <typename T>
+  T readScalar() {
+    need(sizeof(T));
+    T value;
+    memcpy(&value, range_.data(), sizeof(T));
+    range_.advance(sizeof(T));
+    return value;
+  }
+
+  int64_t readIntOfType(uint8_t type) {
+    switch (type) {
+      case kInt8:
+        return readScalar<int8_t>();
+      case kInt16:
+        return readScalar<int16_t>();
+      case kInt32:
+        return readScalar<int32_t>();
+      case kInt64:
+        return readScalar<int64_t>();
+      default:
+        throw std::runtime_error(
+            fmt::format("expected a BSER integer, got type {}", type));
+    }
+  }
+
+  ByteRange range_;
+};
+
+void readField(BserCursor& cursor, Field field, FileInfo& file) {
+  switch (field) {
+    case Field::Name:
+      if (cursor.peekType() == kSkip) {
+        cursor.readType();
+      } else {
+        file.name = cursor.readString();
+      }
+      break;
+    case Field::Exists:
+      file.exists = cursor.readOptionalBool();
+      break;
+    case Field::Mtime:
+      file.mtime = cursor.readOptionalInt();
+      break;
+    case Field::Size:
+      file.size = cursor.readOptionalInt();
+      break;
+    case Field::Other:
+      cursor.skipValue();
+      break;
+  }
+}
+
+// Decodes one column of a columnar files array into the files
+struct FileColumn {
+  Field field;
+  std::vector<FileInfo>& files;
+  // Storage for names that were rebuilt from shared prefixes
+  std::vector<std::string>& names;
+
+  void value(size_t i, BserCursor& cursor) {
+    readField(cursor, field, files[i]);
+  }
+  void boolean(size_t i, bool value) {
+    if (field == Field::Exists) {
+      files[i].exists = value;
+    } else if (field != Field::Other) {
+      throw std::runtime_error("unexpected bool column");
+    }
+  }
+  void integer(size_t i, int64_t value) {
+    if (field == Field::Mtime) {
+      files[i].mtime = value;
+    } else if (field == Field::Size) {
+      files[i].size = value;
+    } else if (field != Field::Other) {
+      throw std::runtime_error("unexpected integer column");
+    }
+  }
+  void string(size_t i, std::string_view value) {
+    if (field == Field::Name) {
+      names.resize(files.size());
+      names[i] = value;
+      files[i].name = names[i];
+    } else if (field != Field::Other) {
+      throw std::runtime_error("unexpected string column");
+    }
+  }
+};
+
+template <typename T, typename V>
+void appendColumn(
+    std::vector<T>& column,
+    size_t index,
+    const std::optional<V>& value) {
+  if (!value) {
+    if (!column.empty()) {
+      column.push_back(T{});
+    }
+    return;
+  }
+  // The first file with this field fills in those before it
+  column.resize(index, T{});
+  column.push_back(*value);
+}
+
+} // namespace
+
+std::string_view FileColumns::name(size_t i) const {
+  size_t start = i ? nameEnds_[i - 1] : 0;
+  return std::string_view{names_}.substr(start, nameEnds_[i] - start);
+}
+
+void FileColumns::append(const FileInfo& file) {
+  names_.append(file.name);
+  nameEnds_.push_back(names_.size());
+  appendColumn(exists_, count_, file.exists);
+  appendColumn(mtime_, count_, file.mtime);
+  appendColumn(sizes_, count_, file.size);
+  ++count_;
+}
+
+size_t bserPduLength(const IOBuf* buf) {
+  io::Cursor cursor{buf};
+  uint8_t magic[2];
+  cursor.pull(magic, sizeof(magic));
+  if (magic[0] != 0 || (magic[1] != 1 && magic[1] != 2)) {
+    throw std::runtime_error("not a BSER PDU");
+  }
+  size_t header = sizeof(magic);
+  if (magic[1] == 2) {
+    // Capabilities
+    cursor.skip(sizeof(uint32_t));
+    header += sizeof(uint32_t);
+  }
+  int64_t len;
+  switch (cursor.read<uint8_t>()) {
+    case kInt8:
+      len = cursor.read<int8_t>();
+      header += 1 + sizeof(int8_t);
+      break;
+    case kInt16:
+      len = cursor.read<int16_t>();
+      header += 1 + sizeof(int16_t);
+      break;
+    case kInt32:
+      len = cursor.read<int32_t>();
+      header += 1 + sizeof(int32_t);
+      break;
+    case kInt64:
+      len = cursor.read<int64_t>();
+      header += 1 + sizeof(int64_t);
+      break;
+    default:
+      throw std::runtime_error("BSER PDU length must be an integer");
+  }
+  if (len < 0) {
+    throw std::runtime_error("negative BSER PDU length");
+  }
+  return header + size_t(len);
+}
+
+std::unique_ptr<IOBuf> toBserPdu(const dynamic& value, uint32_t capabilities) {
+  bser::serialization_opts opts;
+  // A v1 PDU is its magic followed by the length and value; v2 has the
+  // capabilities in between, and folly only writes v1
+  IOBufQueue queue{IOBufQueue::cacheChainLength()};
+  queue.append(bser::toBserIOBuf(value, opts));
+  queue.trimStart(2);
+
+  auto pdu = IOBuf::create(2 + sizeof(capabilities));
+  auto header = pdu->writableData();
+  header[0] = 0;
+  header[1] = 2;
+  memcpy(header + 2, &capabilities, sizeof(capabilities));
+  pdu->append(2 + sizeof(capabilities));
+  pdu->prependChain(queue.move());
+  return pdu;
+}
+
+ByteRange bserPduValue(ByteRange pdu) {
+  if (pdu.size() < 2 || pdu[0] != 0 || (pdu[1] != 1 && pdu[1] != 2)) {
+    throw std::runtime_error("not a BSER PDU");
+  }
+  bool v2 = pdu[1] == 2;
+  pdu.advance(2);
+  if (v2) {
+    // Capabilities
+    if (pdu.size() < sizeof(uint32_t)) {
+      throw std::out_of_range("truncated BSER PDU header");
+    }
+    pdu.advance(sizeof(uint32_t));
+  }
+  BserCursor cursor{pdu};
+  auto len = cursor.readInt();
+  auto value = cursor.remaining();
+  if (len < 0 || size_t(len) > value.size()) {
+    throw std::out_of_range("truncated BSER PDU");
+  }
+  return value.subpiece(0, len);
+}
+
+std::unique_ptr<IOBuf> uncompressBserPdu(std::unique_ptr<IOBuf> pdu) {
+  auto range = pdu->coalesce();
+  auto value = bserPduValue(range);
+  if (value.empty() || value[0] != kCompressed) {
+    return pdu;
+  }
+
+  BserCursor cursor{value};
+  cursor.readType();
+  auto codec = cursor.readInt();
+  auto size = cursor.readInt();
+  auto compressedSize = cursor.readInt();
+  auto compressed = cursor.remaining();
+  if (size < 0 || compressedSize < 0 ||
+      size_t(compressedSize) > compressed.size()) {
+    throw std::out_of_range("truncated compressed BSER value");
+  }
+  if (codec != kCodecZstd) {
+    throw std::runtime_error(
+        fmt::format("unknown BSER compression codec {}", codec));
+  }
+  auto uncompressed =
+      compression::getCodec(compression::CodecType::ZSTD)
+          ->uncompress(
+              StringPiece{compressed.subpiece(0, compressedSize)},
+              uint64_t(size));
+
+  // The same header, but with the new length. One contiguous buffer saves
+  // the callers a copy when they coalesce it.
+  std::string result;
+  result.reserve(2 + sizeof(uint32_t) + 1 + sizeof(size) + uncompressed.size());
+  result.append(reinterpret_cast<const char*>(range.data()), 2);
+  if (range[1] == 2) {
+    result.append(
+        reinterpret_cast<const char*>(range.data()) + 2, sizeof(uint32_t));
+  }
+  result.push_back(char(kInt64));
+  result.append(reinterpret_cast<const char*>(&size), sizeof(size));
+  result.append(uncompressed);
+  return IOBuf::fromString(std::move(result));
+}
+
+dynamic parseBserValue(ByteRange value) {
+  BserCursor cursor{value};
+  return cursor.readDynamic();
+}
+
+DeferredFilesResponse parseBserDeferringFiles(ByteRange pdu) {
+  BserCursor cursor{bserPduValue(pdu)};
+  if (cursor.peekType() != kObject) {
+    return DeferredFilesResponse{cursor.readDynamic(), std::nullopt};
+  }
+  cursor.readType();
+
+  DeferredFilesResponse response{dynamic::object(), std::nullopt};
+  for (auto n = cursor.readInt(); n > 0; --n) {
+    auto key = cursor.readString();
+    if (key == "files") {
+      auto start = cursor.remaining();
+      cursor.skipValue();
+      response.files =
+          start.subpiece(0, start.size() - cursor.remaining().size());
+    } else {
+      response.fields.insert(std::string{key}, cursor.readDynamic());
+    }
+  }
+  return response;
+}
+
+void decodeFiles(ByteRange value, const FileCallback& callback) {
+  BserCursor cursor{value};
+  auto type = cursor.readType();
+
+  if (type == kTemplate) {
+    if (cursor.readType() != kArray) {
+      throw std::runtime_error("BSER template keys must be an array");
+    }
+    std::vector<Field> fields;
+    for (auto n = cursor.readInt(); n > 0; --n) {
+      fields.push_back(fieldNamed(cursor.readString()));
+    }
+    for (auto n = cursor.readInt(); n > 0; --n) {
+      FileInfo file;
+      for (auto field : fields) {
+        readField(cursor, field, file);
+      }
+      callback(file);
+    }
+    return;
+  }
+
+  if (type == kColumns) {
+    std::vector<Field> fields;
+    for (auto key : cursor.readKeys()) {
+      fields.push_back(fieldNamed(key));
+    }
+    auto count = cursor.readCount();
+    // Every column is needed before any file is complete
+    std::vector<FileInfo> files(count);
+    std::vector<std::string> names;
+    for (auto field : fields) {
+      FileColumn column{field, files, names};
+      cursor.readColumn(count, column);
+    }
+    for (auto& file : files) {
+      callback(file);
+    }
+    return;
+  }
+
+  if (type != kArray) {
+    throw std::runtime_error("the files of a response must be an array");
+  }
+  for (auto n = cursor.readInt(); n > 0; --n) {
+    FileInfo file;
+    auto fileType = cursor.peekType();
+    if (fileType == kBytes || fileType == kUtf8) {
+      // Queries for just the name get an array of names
+      file.name = cursor.readString();
+    } else if (fileType == kObject) {
+      cursor.readType();
+      for (auto fieldCount = cursor.readInt(); fieldCount > 0; --fieldCount) {
+        readField(cursor, fieldNamed(cursor.readString()), file);
+      }
+    } else {
+      throw std::runtime_error("a file must be a name or an object");
+    }
+    callback(file);
+  }
+}
+
+} // namespace watchman
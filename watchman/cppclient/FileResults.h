@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+/* Decodes the files of a BSER query response without building a
+ * folly::dynamic for each of them. Queries with millions of results spend
+ * most of their time, and memory, on those. Instead the files are either
+ * appended to FileColumns, which keeps one array per field, or handed to a
+ * callback one at a time.
+ *
+ * Only the fields most consumers need are decoded this way: name, exists,
+ * mtime and size. Other fields are skipped.
+ *
+ * Unlike folly::bser, these functions understand BSER v2 PDUs and the
+ * columnar arrays that servers send to clients with BSER_CAP_COLUMNS.
+ */
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <folly/Range.h>
+#include <folly/io/IOBuf.h>
+#include <folly/json/dynamic.h>
+
+namespace watchman {
+
+// The BSER v2 capability asking for templated arrays as columns. See the
+// BSER protocol documentation.
+inline constexpr uint32_t kBserCapColumns = 0x4;
+// The BSER v2 capability offering to decode compressed values
+inline constexpr uint32_t kBserCapCompressed = 0x8;
+
+// The fields that FileInfo and FileColumns hold
+inline constexpr std::string_view kTypedFileFields[] = {
+    "name",
+    "exists",
+    "mtime",
+    "size"};
+
+// One file of a query response. Fields the query didn't ask for are unset.
+// The name is only valid during the callback it is passed to.
+struct FileInfo {
+  std::string_view name;
+  std::optional<bool> exists;
+  std::optional<int64_t> mtime;
+  std::optional<int64_t> size;
+};
+
+// Called for each file of a response. Must not throw.
+using FileCallback = std::function<void(const FileInfo&)>;
+
+/**
+ * The files of a query response, one array per field. The names share a
+ * single buffer. The columns of fields missing from every file are empty;
+ * otherwise files missing a field hold false or 0 in its column.
+ */
+class FileColumns {
+ public:
+  size_t size() const {
+    return count_;
+  }
+
+  std::string_view name(size_t i) const;
+
+  const std::vector<bool>& exists() const {
+    return exists_;
+  }
+  const std::vector<int64_t>& mtime() const {
+    return mtime_;
+  }
+  const std::vector<int64_t>& sizes() const {
+    return sizes_;
+  }
+
+  void append(const FileInfo& file);
+
+ private:
+  size_t count_{0};
+  std::string names_;
+  // Where each name ends in names_
+  std::vector<size_t> nameEnds_;
+  std::vector<bool> exists_;
+  std::vector<int64_t> mtime_;
+  std::vector<int64_t> sizes_;
+};
+
+/**
+ * A response PDU decoded as folly::bser::parseBser would, except for its
+ * files, whose encoded value is left for decodeFiles or parseBserValue. The
+ * range points into the PDU.
+ */
+struct DeferredFilesResponse {
+  folly::dynamic fields;
+  std::optional<folly::ByteRange> files;
+};
+
+DeferredFilesResponse parseBserDeferringFiles(folly::ByteRange pdu);
+
+// Returns the length of the BSER v1 or v2 PDU at the start of buf. Throws
+// std::out_of_range if buf doesn't hold all of its header yet.
+size_t bserPduLength(const folly::IOBuf* buf);
+
+// Encodes value as a BSER v2 PDU with the given capabilities
+std::unique_ptr<folly::IOBuf> toBserPdu(
+    const folly::dynamic& value,
+    uint32_t capabilities);
+
+// Returns the value encoded by a whole BSER PDU
+folly::ByteRange bserPduValue(folly::ByteRange pdu);
+
+// Returns pdu, or if its value was compressed by a server that the client
+// offered kBserCapCompressed to, an equivalent PDU with the value
+// uncompressed. Throws std::runtime_error if it can't be uncompressed.
+std::unique_ptr<folly::IOBuf> uncompressBserPdu(
+    std::unique_ptr<folly::IOBuf> pdu);
+
+// Decodes one BSER encoded value
+folly::dynamic parseBserValue(folly::ByteRange value);
+
+/**
+ * Decodes the files array of a query response, whether plain, templated,
+ * columnar or just names, passing each file to callback. Throws
+ * std::out_of_range or std::runtime_error if the value is malformed.
+ */
+void decodeFiles(folly::ByteRange value, const FileCallback& callback);
+
+} // namespace watchman
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+  Measures the time from writing a file to receiving the subscription
+  notification for it from a running watchman daemon, built on
+  WatchmanClient.
+
+  It subscribes to the files it writes under the given root, with the
+  `timing` query option, so that each notification says when the daemon's
+  notify thread, IO thread, settle and query saw the change. It then
+  writes files in one of these patterns:
+
+  - serial: writes one file, and waits for its notification before the
+    next, measuring latency without any queueing
+  - steady: writes --rate files per second, cycling through --files names
+  - burst: writes --burst files back to back, --rate times per second
+
+  At the end it reports the distribution of the end to end latency and of
+  each stage:
+
+  - notify: from the write until the notify thread handed it on
+  - io: until the IO thread applied it to the view
+  - settle: until the view settled
+  - query: until the subscription query finished
+  - deliver: until the notification was received and decoded here
+
+  The daemon reports when the most recent change went through each stage,
+  so with several writes in flight the stages describe the latest of them.
+
+  Build like CLI.cpp:
+  $ LDFLAGS=$(pkg-config watchmanclient --libs) \
+      CPPFLAGS=$(pkg-config watchmanclient --cflags) \
+      make LatencyTest
+
+  $ ./LatencyTest --root=/path/to/repo --pattern=steady --rate=50
+*/
+
+#include <watchman/cppclient/WatchmanClient.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/core.h>
+#include <folly/executors/InlineExecutor.h>
+#include <folly/init/Init.h>
+#include <folly/io/async/ScopedEventBaseThread.h>
+#include <folly/portability/GFlags.h>
+#include <folly/portability/Unistd.h>
+
+DEFINE_string(root, "", "The watched directory to write files in");
+DEFINE_string(pattern, "serial", "serial, steady or burst");
+DEFINE_int32(count, 200, "Files to write with the serial pattern");
+DEFINE_int32(duration_s, 10, "How long to write for the other patterns");
+DEFINE_int32(rate, 20, "Writes, or bursts, per second");
+DEFINE_int32(burst, 100, "Files written at once with the burst pattern");
+DEFINE_int32(files, 1000, "Distinct file names to cycle through");
+DEFINE_int32(
+    timeout_ms,
+    10000,
+    "How long to wait for a notification before giving up on it");
+
+using namespace watchman;
+using SystemClock = std::chrono::system_clock;
+
+namespace {
+
+constexpr const char* kStages[] = {
+    "notify", "io", "settle", "query", "deliver", "total"};
+
+struct Results {
+  std::mutex mutex;
+  std::condition_variable cond;
+  // When each file name was first written since it was last notified
+  std::unordered_map<std::string, SystemClock::time_point> written;
+  // Microseconds, keyed by stage name
+  std::map<std::string, std::vector<int64_t>> latencies;
+  size_t notifications{0};
+};
+
+int64_t micros(SystemClock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+      .count();
+}
+
+SystemClock::time_point fromMicros(int64_t us) {
+  return SystemClock::time_point{std::chrono::microseconds{us}};
+}
+
+void onNotification(Results& results, const folly::dynamic& data) {
+  auto received = SystemClock::now();
+  auto* files = data.get_ptr("files");
+  auto* timing = data.get_ptr("timing");
+  if (!files || !files->isArray()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(results.mutex);
+  ++results.notifications;
+  std::optional<SystemClock::time_point> earliest;
+  for (auto& file : *files) {
+    auto name = file.isString() ? file.getString() : file["name"].getString();
+    name = name.substr(name.rfind('/') + 1);
+    auto it = results.written.find(name);
+    if (it == results.written.end()) {
+      continue;
+    }
+    results.latencies["total"].push_back(micros(received - it->second));
+    if (!earliest || it->second < *earliest) {
+      earliest = it->second;
+    }
+    results.written.erase(it);
+  }
+
+  if (earliest && timing) {
+    // Each stage ends when the next starts
+    SystemClock::time_point ends[] = {
+        fromMicros((*timing)["notified_us"].asInt()),
+        fromMicros((*timing)["processed_us"].asInt()),
+        fromMicros((*timing)["settled_us"].asInt()),
+        fromMicros((*timing)["query_end_us"].asInt()),
+        received};
+    auto start = *earliest;
+    // Stamps from before the write belong to an earlier change
+    if (ends[0] >= start) {
+      for (size_t i = 0; i < std::size(ends); ++i) {
+        results.latencies[kStages[i]].push_back(
+            std::max<int64_t>(0, micros(ends[i] - start)));
+        start = std::max(start, ends[i]);
+      }
+    }
+  }
+  results.cond.notify_all();
+}
+
+void writeFile(
+    Results& results,
+    const std::filesystem::path& dir,
+    const std::string& name) {
+  {
+    std::lock_guard<std::mutex> lock(results.mutex);
+    results.written.emplace(name, SystemClock::now());
+  }
+  std::ofstream file{dir / name, std::ios::trunc};
+  file << SystemClock::now().time_since_epoch().count() << "\n";
+}
+
+int64_t percentile(const std::vector<int64_t>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  auto index = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+  return sorted[index];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  if (FLAGS_root.empty()) {
+    std::cerr << "--root is required" << std::endl;
+    return 1;
+  }
+  if (FLAGS_pattern != "serial" && FLAGS_pattern != "steady" &&
+      FLAGS_pattern != "burst") {
+    std::cerr << "--pattern must be serial, steady or burst" << std::endl;
+    return 1;
+  }
+
+  auto dir = std::filesystem::path{FLAGS_root} /
+      fmt::format("latency-test-{}", getpid());
+  std::filesystem::create_directories(dir);
+
+  folly::ScopedEventBaseThread sebt;
+  WatchmanClient client{sebt.getEventBase()};
+  client.connect().get();
+  auto watchPath = client.watch(FLAGS_root).get();
+
+  Results results;
+  folly::dynamic query = folly::dynamic::object(
+      "expression", folly::dynamic::array("match", "lat-*"))(
+      "fields", folly::dynamic::array("name"))("timing", true)(
+      "defer_vcs", false)("empty_on_fresh_instance", true);
+  auto subscription = client
+                          .subscribe(
+                              query,
+                              watchPath,
+                              &folly::InlineExecutor::instance(),
+                              [&](folly::Try<folly::dynamic>&& data) {
+                                if (data.hasValue()) {
+                                  onNotification(results, *data);
+                                }
+                              })
+                          .get();
+
+  auto name = [](int i) { return fmt::format("lat-{}", i % FLAGS_files); };
+  auto timeout = std::chrono::milliseconds(FLAGS_timeout_ms);
+  size_t writes = 0;
+  size_t timedOut = 0;
+
+  if (FLAGS_pattern == "serial") {
+    for (int i = 0; i < FLAGS_count; ++i) {
+      auto file = name(i);
+      writeFile(results, dir, file);
+      ++writes;
+      std::unique_lock<std::mutex> lock(results.mutex);
+      if (!results.cond.wait_for(
+              lock, timeout, [&] { return !results.written.count(file); })) {
+        results.written.erase(file);
+        ++timedOut;
+      }
+    }
+  } else {
+    auto perTick = FLAGS_pattern == "burst" ? FLAGS_burst : 1;
+    auto interval = std::chrono::microseconds(1000000 / FLAGS_rate);
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::seconds(FLAGS_duration_s);
+    for (auto next = start; next < deadline; next += interval) {
+      std::this_thread::sleep_until(next);
+      for (int i = 0; i < perTick; ++i) {
+        writeFile(results, dir, name(int(writes++)));
+      }
+    }
+    std::unique_lock<std::mutex> lock(results.mutex);
+    results.cond.wait_for(
+        lock, timeout, [&] { return results.written.empty(); });
+    timedOut = results.written.size();
+  }
+
+  client.unsubscribe(subscription).get();
+  client.close();
+  std::filesystem::remove_all(dir);
+
+  std::lock_guard<std::mutex> lock(results.mutex);
+  fmt::print(
+      "{} pattern: {} writes, {} notifications, {} writes never notified\n",
+      FLAGS_pattern,
+      writes,
+      results.notifications,
+      timedOut);
+  fmt::print(
+      "{:>8} {:>10} {:>10} {:>10} {:>10} {:>10}\n",
+      "stage",
+      "p50 (us)",
+      "p90",
+      "p99",
+      "max",
+      "samples");
+  for (auto stage : kStages) {
+    auto& latencies = results.latencies[stage];
+    std::sort(latencies.begin(), latencies.end());
+    fmt::print(
+        "{:>8} {:>10} {:>10} {:>10} {:>10} {:>10}\n",
+        stage,
+        percentile(latencies, 0.5),
+        percentile(latencies, 0.9),
+        percentile(latencies, 0.99),
+        latencies.empty() ? 0 : latencies.back(),
+        latencies.size());
+  }
+
+  return timedOut ? 1 : 0;
+}
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+  A load generator for a running watchman daemon, built on WatchmanClient.
+
+  It opens a number of connections to the daemon and watches the given
+  root from each. Every connection then issues queries back to back for
+  the duration of the run, optionally while holding subscriptions open.
+  Meanwhile a churn thread keeps modifying files under the root. At the end
+  it reports query throughput and latency percentiles, the subscription
+  notifications that were delivered and the CPU time the daemon used.
+
+  Build like CLI.cpp:
+  $ LDFLAGS=$(pkg-config watchmanclient --libs) \
+      CPPFLAGS=$(pkg-config watchmanclient --cflags) \
+      make LoadTest
+
+  $ ./LoadTest --root=/path/to/repo --connections=16 --subscriptions=4
+*/
+
+#include <watchman/cppclient/WatchmanClient.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/core.h>
+#include <folly/executors/InlineExecutor.h>
+#include <folly/init/Init.h>
+#include <folly/io/async/ScopedEventBaseThread.h>
+#include <folly/json/json.h>
+#include <folly/portability/GFlags.h>
+#include <folly/portability/Unistd.h>
+
+DEFINE_string(root, "", "The directory to watch and to churn files in");
+DEFINE_int32(connections, 8, "Number of client connections");
+DEFINE_int32(duration_s, 10, "How long to run the load for");
+DEFINE_string(
+    query,
+    R"({"expression": ["type", "f"], "fields": ["name"]})",
+    "The query object each connection issues back to back");
+DEFINE_int32(
+    query_delay_ms,
+    0,
+    "Pause between two queries on the same connection");
+DEFINE_int32(subscriptions, 0, "Subscriptions to hold open per connection");
+DEFINE_string(
+    subscribe_query,
+    R"({"expression": ["type", "f"], "fields": ["name"]})",
+    "The query object used for subscriptions");
+DEFINE_int32(churn_files, 100, "Number of files the churn thread rewrites");
+DEFINE_int32(
+    churn_interval_ms,
+    10,
+    "Pause between two writes of the churn thread; 0 disables churn");
+
+using namespace watchman;
+using SteadyClock = std::chrono::steady_clock;
+
+namespace {
+
+struct Connection {
+  std::unique_ptr<WatchmanClient> client;
+  WatchPathPtr watchPath;
+  std::vector<SubscriptionPtr> subscriptions;
+  // Microseconds taken by each successful query
+  std::vector<int64_t> latencies;
+  size_t errors{0};
+};
+
+// Returns the user and system CPU time used so far by the process, or
+// nullopt where that cannot be read.
+std::optional<std::chrono::duration<double>> processCpuTime(int64_t pid) {
+#ifdef __linux__
+  std::ifstream stat{fmt::format("/proc/{}/stat", pid)};
+  std::string line;
+  if (!std::getline(stat, line)) {
+    return std::nullopt;
+  }
+  // The command name may contain spaces; the fields after it do not.
+  auto fields = line.substr(line.rfind(')') + 2);
+  std::istringstream in{fields};
+  std::string field;
+  // utime and stime are fields 14 and 15 of the full line; the state, at
+  // field 3, is the first one after the command name.
+  for (int i = 3; i < 14; ++i) {
+    in >> field;
+  }
+  uint64_t utime = 0;
+  uint64_t stime = 0;
+  if (!(in >> utime >> stime)) {
+    return std::nullopt;
+  }
+  return std::chrono::duration<double>(
+      double(utime + stime) / sysconf(_SC_CLK_TCK));
+#else
+  (void)pid;
+  return std::nullopt;
+#endif
+}
+
+void churn(
+    const std::string& dir,
+    const std::atomic<bool>& done,
+    std::atomic<size_t>& writes) {
+  for (size_t i = 0; !done.load(std::memory_order_relaxed); ++i) {
+    std::ofstream file{
+        fmt::format("{}/churn{}", dir, i % FLAGS_churn_files),
+        std::ios::trunc};
+    file << i << "\n";
+    file.close();
+    writes.fetch_add(1, std::memory_order_relaxed);
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(FLAGS_churn_interval_ms));
+  }
+}
+
+int64_t percentile(const std::vector<int64_t>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  auto index = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+  return sorted[index];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  if (FLAGS_root.empty()) {
+    std::cerr << "--root is required" << std::endl;
+    return 1;
+  }
+
+  folly::ScopedEventBaseThread sebt;
+  auto eb = sebt.getEventBase();
+
+  auto query = folly::parseJson(FLAGS_query);
+  auto subscribeQuery = folly::parseJson(FLAGS_subscribe_query);
+  std::atomic<size_t> notifications{0};
+
+  std::vector<Connection> connections(FLAGS_connections);
+  for (auto& conn : connections) {
+    conn.client = std::make_unique<WatchmanClient>(eb);
+    conn.client->connect().get();
+    conn.watchPath = conn.client->watch(FLAGS_root).get();
+    for (int i = 0; i < FLAGS_subscriptions; ++i) {
+      conn.subscriptions.push_back(
+          conn.client
+              ->subscribe(
+                  subscribeQuery,
+                  conn.watchPath,
+                  &folly::InlineExecutor::instance(),
+                  [&](folly::Try<folly::dynamic>&& data) {
+                    if (data.hasValue()) {
+                      notifications.fetch_add(1, std::memory_order_relaxed);
+                    }
+                  })
+              .get());
+    }
+  }
+
+  auto pid = connections.front()
+                 .client->run(folly::dynamic::array("get-pid"))
+                 .get()["pid"]
+                 .asInt();
+  auto cpuBefore = processCpuTime(pid);
+
+  std::atomic<bool> done{false};
+  std::atomic<size_t> writes{0};
+  std::optional<std::thread> churner;
+  if (FLAGS_churn_interval_ms > 0 && FLAGS_churn_files > 0) {
+    churner.emplace(churn, FLAGS_root, std::cref(done), std::ref(writes));
+  }
+
+  auto start = SteadyClock::now();
+  auto deadline = start + std::chrono::seconds(FLAGS_duration_s);
+  std::vector<std::thread> workers;
+  for (auto& conn : connections) {
+    workers.emplace_back([&] {
+      while (SteadyClock::now() < deadline) {
+        auto queryStart = SteadyClock::now();
+        try {
+          conn.client->query(query, conn.watchPath).get();
+          conn.latencies.push_back(
+              std::chrono::duration_cast<std::chrono::microseconds>(
+                  SteadyClock::now() - queryStart)
+                  .count());
+        } catch (const std::exception& ex) {
+          if (conn.errors++ == 0) {
+            std::cerr << "query failed: " << ex.what() << std::endl;
+          }
+        }
+        if (FLAGS_query_delay_ms > 0) {
+          std::this_thread::sleep_for(
+              std::chrono::milliseconds(FLAGS_query_delay_ms));
+        }
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  std::chrono::duration<double> elapsed = SteadyClock::now() - start;
+  done.store(true, std::memory_order_relaxed);
+  if (churner) {
+    churner->join();
+  }
+  auto cpuAfter = processCpuTime(pid);
+
+  std::vector<int64_t> latencies;
+  size_t errors = 0;
+  for (auto& conn : connections) {
+    latencies.insert(
+        latencies.end(), conn.latencies.begin(), conn.latencies.end());
+    errors += conn.errors;
+    for (auto& sub : conn.subscriptions) {
+      conn.client->unsubscribe(sub).get();
+    }
+    conn.client->close();
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  fmt::print(
+      "{} connections, {} subscriptions each, for {:.1f}s\n",
+      FLAGS_connections,
+      FLAGS_subscriptions,
+      elapsed.count());
+  fmt::print(
+      "queries: {} ok, {} failed, {:.1f}/s\n",
+      latencies.size(),
+      errors,
+      latencies.size() / elapsed.count());
+  fmt::print(
+      "latency (us): p50 {} p99 {} p999 {} max {}\n",
+      percentile(latencies, 0.5),
+      percentile(latencies, 0.99),
+      percentile(latencies, 0.999),
+      latencies.empty() ? 0 : latencies.back());
+  fmt::print(
+      "churn: {} writes, subscription notifications: {}\n",
+      writes.load(),
+      notifications.load());
+  if (cpuBefore && cpuAfter) {
+    auto cpu = *cpuAfter - *cpuBefore;
+    fmt::print(
+        "daemon cpu: {:.2f}s ({:.0f}% of one core)\n",
+        cpu.count(),
+        100 * cpu.count() / elapsed.count());
+  } else {
+    fmt::print("daemon cpu: unavailable on this platform\n");
+  }
+
+  return errors ? 1 : 0;
+}
@@ -128,6 +128,42 @@ SemiFuture<QueryResult> WatchmanClient::query(
           [](folly::dynamic&& res) { return QueryResult{std::move(res)}; });
 }
 
+SemiFuture<ColumnarQueryResult> WatchmanClient::queryColumns(
+    dynamic queryObj,
+    WatchPathPtr path) {
+  auto columns = std::make_shared<FileColumns>();
+  return queryEachFile(
+             std::move(queryObj),
+             std::move(path),
+             [columns](const FileInfo& file) { columns->append(file); })
+      .deferValue([columns](QueryResult&& res) {
+        return ColumnarQueryResult{std::move(res.raw_), std::move(*columns)};
+      });
+}
+
+SemiFuture<QueryResult> WatchmanClient::queryEachFile(
+    dynamic queryObj,
+    WatchPathPtr path,
+    FileCallback callback) {
+  if (!queryObj.get_ptr("fields")) {
+    auto fields = dynamic::array();
+    for (auto field : kTypedFileFields) {
+      fields.push_back(std::string{field});
+    }
+    queryObj["fields"] = std::move(fields);
+  }
+  if (path->relativePath_) {
+    queryObj["relative_root"] = *path->relativePath_;
+  }
+  return conn_
+      ->run(
+          dynamic::array("query", path->root_, std::move(queryObj)),
+          std::move(callback))
+      .semi()
+      .deferValue(
+          [](folly::dynamic&& res) { return QueryResult{std::move(res)}; });
+}
+
 SemiFuture<SubscriptionPtr> WatchmanClient::subscribe(
     dynamic query,
     WatchPathPtr path,
@@ -106,6 +106,13 @@ struct QueryResult {
   folly::dynamic raw_;
 };
 
+// The result of queryColumns. raw_ holds every field of the response but
+// its files.
+struct ColumnarQueryResult {
+  folly::dynamic raw_;
+  FileColumns files;
+};
+
 struct Subscription {
   friend WatchmanClient;
 
@@ -205,6 +212,25 @@ struct WatchmanClient {
       folly::dynamic queryObj,
       WatchPathPtr path);
 
+  /**
+   * As query, but decodes the files straight into one array per field rather
+   * than a folly::dynamic per file. Only the fields in kTypedFileFields are
+   * decoded; they are all requested if queryObj doesn't list its fields.
+   */
+  folly::SemiFuture<ColumnarQueryResult> queryColumns(
+      folly::dynamic queryObj,
+      WatchPathPtr path);
+
+  /**
+   * As queryColumns, but hands each file to callback as it is decoded, on the
+   * CPU executor, rather than keeping any of them. raw_ holds every field of
+   * the response but its files.
+   */
+  folly::SemiFuture<QueryResult> queryEachFile(
+      folly::dynamic queryObj,
+      WatchPathPtr path,
+      FileCallback callback);
+
   /**
    * Establishes a subscription that will trigger callback (via your specified
    * executor) whenever matching files change.
@@ -7,12 +7,15 @@
 
 #include "WatchmanConnection.h"
 
+#include <algorithm>
 #include <cstdlib>
 
 #include <fmt/core.h>
 
 #include <folly/ExceptionWrapper.h>
+#include <folly/ScopeGuard.h>
 #include <folly/SocketAddress.h>
+#include <folly/compression/Compression.h>
 #include <folly/executors/InlineExecutor.h>
 #include <folly/json/bser/Bser.h>
 
@@ -20,6 +23,7 @@
 #include <eden/common/utils/SpawnedProcess.h> // @manual
 #else
 #include <folly/Subprocess.h> // @manual
+#include <sys/mman.h>
 #endif
 
 namespace watchman {
@@ -35,6 +39,7 @@ static const std::vector<dynamic> kUnilateralLabels{"subscription", "log"};
 
 static const dynamic kError("error");
 static const dynamic kCapabilities("capabilities");
+static const dynamic kFilesFd("files_fd");
 
 // We'll just dispatch bser decodes and callbacks inline unless they
 // give us an alternative environment
@@ -128,8 +133,9 @@ Future<dynamic> WatchmanConnection::connect(folly::dynamic versionArgs) {
           folly::SocketAddress addr;
           addr.setFromPath(path);
 
-          shared_this->sock_ =
-              folly::AsyncSocket::newSocket(shared_this->eventBase_.get());
+          shared_this->sock_ = std::shared_ptr<Socket>(
+              new Socket(shared_this->eventBase_.get()),
+              folly::DelayedDestruction::Destructor());
           shared_this->sock_->connect(shared_this.get(), addr);
         });
 
@@ -205,7 +211,14 @@ WatchmanConnection::QueuedCommand::QueuedCommand(const dynamic& command)
     : cmd(command) {}
 
 Future<dynamic> WatchmanConnection::run(const dynamic& command) noexcept {
+  return run(command, FileCallback{});
+}
+
+Future<dynamic> WatchmanConnection::run(
+    const dynamic& command,
+    FileCallback onFile) noexcept {
   auto cmd = std::make_shared<QueuedCommand>(command);
+  cmd->onFile = std::move(onFile);
   if (broken_) {
     cmd->promise.setException(WatchmanError("The connection was broken"));
     return cmd->promise.getFuture();
@@ -219,26 +232,45 @@ Future<dynamic> WatchmanConnection::run(const dynamic& command) noexcept {
   bool shouldWrite;
   {
     std::lock_guard<std::mutex> g(mutex_);
-    // We only need to call sendCommand if we don't have a command in
-    // progress; the completion handler will trigger it once we receive
-    // the response
-    shouldWrite = commandQ_.empty();
+    // Responses come back in the order the commands were sent, so this
+    // one can go out right away unless enough are already waiting for
+    // theirs; the response handler sends it once one arrives
+    shouldWrite = inFlight_ < maxInFlight_;
     commandQ_.push_back(cmd);
   }
 
   if (shouldWrite) {
     eventBase_->runInEventBaseThread(
-        [shared_this = shared_from_this()] { shared_this->sendCommand(); });
+        [shared_this = shared_from_this()] { shared_this->sendCommands(); });
   }
 
   return cmd->promise.getFuture();
 }
 
+void WatchmanConnection::setMaxCommandsInFlight(size_t max) {
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    maxInFlight_ = std::max<size_t>(max, 1);
+  }
+  eventBase_->runInEventBaseThread(
+      [shared_this = shared_from_this()] { shared_this->sendCommands(); });
+}
+
+void WatchmanConnection::setCompressResponses(bool compress) {
+  std::lock_guard<std::mutex> g(mutex_);
+  if (compress && compression::hasCodec(compression::CodecType::ZSTD)) {
+    bserCapabilities_ |= kBserCapCompressed;
+  } else {
+    bserCapabilities_ &= ~kBserCapCompressed;
+  }
+}
+
 // Generate a failure for all queued commands
 void WatchmanConnection::failQueuedCommands(folly::exception_wrapper&& ex) {
   std::lock_guard<std::mutex> g(mutex_);
   auto q = commandQ_;
   commandQ_.clear();
+  inFlight_ = 0;
 
   broken_ = true;
   for (auto& cmd : q) {
@@ -259,29 +291,30 @@ void WatchmanConnection::failQueuedCommands(folly::exception_wrapper&& ex) {
   }
 }
 
-// Sends the next eligible command to the Watchman service
-void WatchmanConnection::sendCommand(bool pop) {
-  std::shared_ptr<QueuedCommand> cmd;
-
+// Sends queued commands to the Watchman service until maxInFlight_ of
+// them are waiting for their responses. Runs in the event base thread.
+void WatchmanConnection::sendCommands() {
+  if (!sock_) {
+    return;
+  }
+  std::unique_ptr<folly::IOBuf> chain;
   {
     std::lock_guard<std::mutex> g(mutex_);
-
-    if (pop) {
-      // We finished processing this one, discard it and focus
-      // on the next item, if any.
-      commandQ_.pop_front();
-    }
-    if (commandQ_.empty()) {
-      return;
+    while (inFlight_ < commandQ_.size() && inFlight_ < maxInFlight_) {
+      auto buf = toBserPdu(commandQ_[inFlight_]->cmd, bserCapabilities_);
+      if (chain) {
+        chain->prependChain(std::move(buf));
+      } else {
+        chain = std::move(buf);
+      }
+      ++inFlight_;
     }
-    cmd = commandQ_.front();
   }
 
-  sock_->writeChain(this, toBserIOBuf(cmd->cmd, serialization_opts()));
-}
-
-void WatchmanConnection::popAndSendCommand() {
-  sendCommand(/* pop = */ true);
+  // A burst of commands goes out in a single write
+  if (chain) {
+    sock_->writeChain(this, std::move(chain));
+  }
 }
 
 // Called when AsyncSocket::writeChain completes
@@ -309,6 +342,19 @@ void WatchmanConnection::readDataAvailable(size_t len) noexcept {
   {
     std::lock_guard<std::mutex> g(mutex_);
     bufQ_.postallocate(len);
+#ifndef _WIN32
+    // Each descriptor comes with the first bytes of the response it belongs
+    // to, so it is queued before that response can be decoded.
+    while (true) {
+      auto received = sock_->popNextReceivedFds().releaseReceived();
+      if (received.empty()) {
+        break;
+      }
+      for (auto& file : received) {
+        receivedFiles_.push_back(std::move(file));
+      }
+    }
+#endif
   }
   cpuExecutor_->add([shared_this = shared_from_this()] {
     shared_this->decodeNextResponse();
@@ -324,7 +370,7 @@ std::unique_ptr<folly::IOBuf> WatchmanConnection::splitNextPdu() {
   // Do we have enough data to decode the next item?
   size_t pdu_len = 0;
   try {
-    pdu_len = decodePduLength(bufQ_.front());
+    pdu_len = bserPduLength(bufQ_.front());
   } catch (const std::out_of_range&) {
     // Don't have enough data yet
     return nullptr;
@@ -364,7 +410,26 @@ void WatchmanConnection::decodeNextResponse() {
     }
 
     try {
-      auto decoded = parseBser(pdu.get());
+      pdu = uncompressBserPdu(std::move(pdu));
+
+      // The response belongs to the front command unless it is unilateral
+      std::shared_ptr<QueuedCommand> front;
+      {
+        std::lock_guard<std::mutex> g(mutex_);
+        if (!commandQ_.empty()) {
+          front = commandQ_.front();
+        }
+      }
+
+      dynamic decoded;
+      std::optional<ByteRange> files;
+      if (front && front->onFile) {
+        auto response = parseBserDeferringFiles(pdu->coalesce());
+        decoded = std::move(response.fields);
+        files = response.files;
+      } else {
+        decoded = parseBserValue(bserPduValue(pdu->coalesce()));
+      }
 
       bool is_unilateral = false;
       // Check for a unilateral response
@@ -372,6 +437,9 @@ void WatchmanConnection::decodeNextResponse() {
         if (decoded.get_ptr(k)) {
           // This is a unilateral response
           if (callback_.has_value()) {
+            if (files) {
+              decoded["files"] = parseBserValue(*files);
+            }
             callback_.value()(watchmanResponseToTry(std::move(decoded)));
             is_unilateral = true;
             break;
@@ -386,28 +454,37 @@ void WatchmanConnection::decodeNextResponse() {
         continue;
       }
 
-      // It's actually a command response; get the cmd so that we
-      // can fulfil its promise
+      // It's actually a command response, to the oldest command that
+      // was sent; get the cmd so that we can fulfil its promise
       std::shared_ptr<QueuedCommand> cmd;
+      bool sendMore;
       {
         std::lock_guard<std::mutex> g(mutex_);
-        if (commandQ_.empty()) {
+        if (inFlight_ == 0) {
           failQueuedCommands(
               std::runtime_error("No commands have been queued"));
           return;
         }
         cmd = commandQ_.front();
+        commandQ_.pop_front();
+        --inFlight_;
+        sendMore = inFlight_ < commandQ_.size();
+      }
+      if (sendMore) {
+        eventBase_->runInEventBaseThread([shared_this = shared_from_this()] {
+          shared_this->sendCommands();
+        });
+      }
+
+      if (decoded.get_ptr(kFilesFd)) {
+        mapFilesFromDescriptor(decoded, cmd->onFile);
+      } else if (files) {
+        decodeFiles(*files, cmd->onFile);
       }
 
       // Dispatch outside of the lock in case it tries to send another
       // command
       cmd->promise.setTry(watchmanResponseToTry(std::move(decoded)));
-
-      // Now we're in a position to send the next queued command.
-      // We remove it after dispatching the try above in case that
-      // queued up more commands; we want to be the one thing that
-      // is responsible for sending the next queued command here
-      popAndSendCommand();
     } catch (...) {
       failQueuedCommands(folly::exception_wrapper{std::current_exception()});
       return;
@@ -415,6 +492,51 @@ void WatchmanConnection::decodeNextResponse() {
   }
 }
 
+// A query issued with shm_results may have its files sent as a descriptor
+// of a file holding them as a BSER PDU, which is mapped here to put them
+// back in the response, or to pass them to onFile if it is set.
+void WatchmanConnection::mapFilesFromDescriptor(
+    dynamic& response,
+    const FileCallback& onFile) {
+#ifndef _WIN32
+  folly::File file;
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    if (receivedFiles_.empty()) {
+      throw WatchmanError("files_fd response arrived without a descriptor");
+    }
+    file = std::move(receivedFiles_.front());
+    receivedFiles_.pop_front();
+  }
+
+  auto size = size_t(response[kFilesFd]["size"].asInt());
+  void* data = nullptr;
+  if (size) {
+    data = mmap(nullptr, size, PROT_READ, MAP_SHARED, file.fd(), 0);
+    if (data == MAP_FAILED) {
+      throw std::system_error(
+          errno, std::generic_category(), "mapping query results");
+    }
+  }
+  SCOPE_EXIT {
+    if (data) {
+      munmap(data, size);
+    }
+  };
+  folly::ByteRange mapped(static_cast<const uint8_t*>(data), size);
+  if (onFile) {
+    decodeFiles(bserPduValue(mapped), onFile);
+  } else {
+    response["files"] = parseBserValue(bserPduValue(mapped));
+  }
+  response.erase(kFilesFd);
+#else
+  (void)response;
+  (void)onFile;
+  throw WatchmanError("files_fd is not supported on this platform");
+#endif
+}
+
 // Called when AsyncSocket hits EOF
 void WatchmanConnection::readEOF() noexcept {
   failQueuedCommands(
@@ -13,12 +13,18 @@
 #include <optional>
 
 #include <folly/ExceptionWrapper.h>
+#include <folly/File.h>
 #include <folly/futures/Future.h>
 #include <folly/io/IOBufQueue.h>
 #include <folly/io/async/AsyncSocket.h>
+#ifndef _WIN32
+#include <folly/io/async/fdsock/AsyncFdSocket.h>
+#endif
 #include <folly/io/async/EventBase.h>
 #include <folly/json/dynamic.h>
 
+#include "FileResults.h"
+
 namespace watchman {
 
 // General watchman error
@@ -48,6 +54,8 @@ class WatchmanConnection
  public:
   using Callback = std::function<void(folly::Try<folly::dynamic>)>;
 
+  static constexpr size_t kDefaultMaxCommandsInFlight = 32;
+
   explicit WatchmanConnection(
       folly::EventBase* eventBase,
       std::optional<std::string>&& sockPath = {},
@@ -72,6 +80,23 @@ class WatchmanConnection
   // If the connection was terminated, will throw immediately
   folly::Future<folly::dynamic> run(const folly::dynamic& command) noexcept;
 
+  // As run, but the files of the response are passed to onFile, on the CPU
+  // executor, as they are decoded rather than included in the result
+  folly::Future<folly::dynamic> run(
+      const folly::dynamic& command,
+      FileCallback onFile) noexcept;
+
+  // Sets how many commands may be sent ahead of the response to the oldest
+  // of them. Watchman answers commands in the order it receives them, so
+  // a lower limit only adds round trips; 1 waits for each response before
+  // sending the next command. Unilateral responses are always told apart.
+  void setMaxCommandsInFlight(size_t max);
+
+  // Offers to decode compressed responses, which Watchman then sends large
+  // ones as. This costs CPU time on both ends, so it only pays where the
+  // socket is slow rather than local. Has no effect if folly lacks zstd.
+  void setCompressResponses(bool compress);
+
   // Close the connection.  All queued commands will be cancelled
   void close();
 
@@ -90,17 +115,20 @@ class WatchmanConnection
   struct QueuedCommand {
     folly::dynamic cmd;
     folly::Promise<folly::dynamic> promise;
+    FileCallback onFile;
 
     explicit QueuedCommand(const folly::dynamic& command);
   };
 
   folly::Future<std::string> getSockPath();
   void failQueuedCommands(folly::exception_wrapper&& ex);
-  void sendCommand(bool pop = false);
-  void popAndSendCommand();
+  void sendCommands();
   void decodeNextResponse();
   folly::Try<folly::dynamic> watchmanResponseToTry(folly::dynamic&& value);
   std::unique_ptr<folly::IOBuf> splitNextPdu();
+  void mapFilesFromDescriptor(
+      folly::dynamic& response,
+      const FileCallback& onFile);
 
   // ConnectCallback
   void connectSuccess() noexcept override;
@@ -124,9 +152,24 @@ class WatchmanConnection
   folly::Executor::KeepAlive<folly::Executor> cpuExecutor_;
   folly::Promise<folly::dynamic> connectPromise_;
   folly::dynamic versionCmd_;
-  std::shared_ptr<folly::AsyncSocket> sock_;
+#ifndef _WIN32
+  // Can receive the descriptors of results sent as shm_results
+  using Socket = folly::AsyncFdSocket;
+#else
+  using Socket = folly::AsyncSocket;
+#endif
+  std::shared_ptr<Socket> sock_;
   std::mutex mutex_;
+  // Commands waiting for their responses, oldest first. The first
+  // inFlight_ of them have been sent.
   std::deque<std::shared_ptr<QueuedCommand>> commandQ_;
+  size_t inFlight_{0};
+  size_t maxInFlight_{kDefaultMaxCommandsInFlight};
+  // Asking for columns shrinks large results; servers that don't know a
+  // capability ignore it
+  uint32_t bserCapabilities_{kBserCapColumns};
+  // Descriptors received with responses, in the order they arrived
+  std::deque<folly::File> receivedFiles_;
   folly::IOBufQueue bufQ_{folly::IOBufQueue::cacheChainLength()};
   bool broken_{false};
   bool closing_{false};
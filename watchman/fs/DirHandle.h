@@ -25,6 +25,42 @@ class DirHandle {
 #ifndef _WIN32
   virtual int getFd() const = 0;
 #endif
+
+  /**
+   * Fills in `stat` for the entry most recently returned by readDir(), when
+   * the handle can do that more cheaply than getFileInformation() on the
+   * entry's full path; for example, a single statx() relative to the open
+   * directory on Linux.
+   *
+   * Returns false, leaving `stat` untouched, if the handle has no cheaper way
+   * or the lookup failed. Callers then fall back to getFileInformation(),
+   * which reports any error.
+   */
+  virtual bool statEntry(FileInformation& stat) {
+    (void)stat;
+    return false;
+  }
+
+  /**
+   * As statEntry(), but for the entry called `name` rather than the one most
+   * recently returned by readDir(), so that a caller can read the whole dir
+   * before it stats the entries.  May be called from several threads at
+   * once, but not at the same time as readDir().
+   */
+  virtual bool statNamedEntry(const char* name, FileInformation& stat) {
+    (void)name;
+    (void)stat;
+    return false;
+  }
+
+  /**
+   * Lets statEntry() and statNamedEntry() take whatever attributes the
+   * kernel has cached for an entry rather than revalidating them.  Listing a
+   * dir on a network filesystem caches the attributes of its entries
+   * (READDIRPLUS on NFS), so statting them just after the listing then
+   * doesn't cost a round trip each.  Must be called before any stats.
+   */
+  virtual void useCachedStats() {}
 };
 
 /**
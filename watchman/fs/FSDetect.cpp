@@ -43,6 +43,40 @@ CaseSensitivity getCaseSensitivityForPath([[maybe_unused]] const char* path) {
 #endif
 }
 
+bool isNetworkFileSystemType(w_string_piece fstype) {
+  // EdenFS mounts may report "nfs", but are served locally and have their
+  // own watcher
+  if (facebook::eden::is_edenfs_fs_type(fstype.view())) {
+    return false;
+  }
+  static const std::string_view kNetworkTypes[] = {
+      "9p",
+      "afpfs",
+      "afs",
+      "ceph",
+      "cifs",
+      "fuse.glusterfs",
+      "fuse.sshfs",
+      "glusterfs",
+      "gpfs",
+      "lustre",
+      "ncpfs",
+      "nfs",
+      "nfs4",
+      "smb",
+      "smb2",
+      "smb3",
+      "smbfs",
+      "webdav",
+  };
+  for (auto type : kNetworkTypes) {
+    if (fstype.view() == type) {
+      return true;
+    }
+  }
+  return false;
+}
+
 } // namespace watchman
 
 // This function is used to return the fstype for a given path
@@ -18,6 +18,10 @@ namespace watchman {
  * case sensitivity of the input path. */
 CaseSensitivity getCaseSensitivityForPath(const char* path);
 
+/** Returns true if fstype, as returned by w_fstype(), names a filesystem
+ * whose metadata is served by another machine. */
+bool isNetworkFileSystemType(w_string_piece fstype);
+
 } // namespace watchman
 
 // Returns the name of the filesystem for the specified path
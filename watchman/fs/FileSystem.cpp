@@ -61,9 +61,37 @@ class RealFileSystem final : public FileSystem {
 
 RealFileSystem gRealFileSystem;
 
+class NetworkFileSystem final : public FileSystem {
+ public:
+  std::unique_ptr<DirHandle> openDir(const char* path, bool strict = true)
+      override {
+    auto dir = watchman::openDir(path, strict);
+    dir->useCachedStats();
+    return dir;
+  }
+
+  FileInformation getFileInformation(
+      const char* path,
+      CaseSensitivity caseSensitive = CaseSensitivity::Unknown) override {
+    // Changes reported by the watcher must see the current attributes
+    return gRealFileSystem.getFileInformation(path, caseSensitive);
+  }
+
+  void touch(const char* path) override {
+    gRealFileSystem.touch(path);
+  }
+
+  bool isRemote() const override {
+    return true;
+  }
+};
+
+NetworkFileSystem gNetworkFileSystem;
+
 } // namespace
 
 FileSystem& realFileSystem = gRealFileSystem;
+FileSystem& networkFileSystem = gNetworkFileSystem;
 
 #if !CAN_OPEN_SYMLINKS
 
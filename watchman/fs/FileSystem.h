@@ -57,10 +57,26 @@ class FileSystem {
    * general open(2)-like API.
    */
   virtual void touch(const char* path) = 0;
+
+  /**
+   * Whether metadata operations are likely to wait on a round trip to
+   * another machine, so that it pays to have more of them in flight.
+   */
+  virtual bool isRemote() const {
+    return false;
+  }
 };
 
 extern FileSystem& realFileSystem;
 
+/**
+ * The real filesystem, as accessed for roots on a network filesystem (see
+ * isNetworkFileSystemType()).  It reports that it isRemote(), so that the
+ * crawler stats the entries of a dir from the attributes that came back with
+ * its listing and keeps more stats in flight.
+ */
+extern FileSystem& networkFileSystem;
+
 /** equivalent to open(2)
  * This function is not intended to be used to create files,
  * just to open a file handle to query its metadata */
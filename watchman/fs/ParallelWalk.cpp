@@ -7,9 +7,10 @@
 
 #include "watchman/fs/ParallelWalk.h"
 #include <fmt/core.h>
+#include <folly/Synchronized.h>
 #include <folly/concurrency/UnboundedQueue.h>
-#include <folly/executors/CPUThreadPoolExecutor.h>
-#include <folly/system/HardwareConcurrency.h>
+#include <mutex>
+#include "watchman/ThreadPool.h"
 
 namespace watchman {
 
@@ -30,13 +31,42 @@ struct ParallelWalkerContext {
   Queue<ReadDirResult> resultQueue{};
   Queue<IoErrorWithPath> errorQueue{};
 
+  // Backpressure. Entries held by resultQueue, and the directory reads that
+  // were put off because it held maxQueuedEntries of them. A deferred read
+  // counts towards readDirTaskCount until it is resumed by nextResult().
+  const size_t maxQueuedEntries;
+  std::atomic<size_t> queuedEntries{0};
+  std::atomic<size_t> maxQueuedEntriesSeen{0};
+  std::atomic<size_t> deferredReadCount{0};
+  folly::Synchronized<std::vector<std::pair<AbsolutePath, size_t>>, std::mutex>
+      deferredReads;
+
   ParallelWalkerContext(
       std::shared_ptr<FileSystem> fileSystem,
       folly::Executor* executor,
-      std::optional<FileInformation> rootStat)
+      std::optional<FileInformation> rootStat,
+      size_t maxQueuedEntries)
       : fileSystem{std::move(fileSystem)},
         executor{executor},
-        rootStat{rootStat} {}
+        rootStat{rootStat},
+        maxQueuedEntries{maxQueuedEntries} {}
+
+  bool isBackedUp() const {
+    return maxQueuedEntries &&
+        queuedEntries.load(std::memory_order_acquire) >= maxQueuedEntries;
+  }
+
+  void enqueueResult(ReadDirResult result) {
+    size_t count = result.entries.size();
+    size_t queued =
+        queuedEntries.fetch_add(count, std::memory_order_acq_rel) + count;
+    size_t seen = maxQueuedEntriesSeen.load(std::memory_order_relaxed);
+    while (queued > seen &&
+           !maxQueuedEntriesSeen.compare_exchange_weak(
+               seen, queued, std::memory_order_relaxed)) {
+    }
+    resultQueue.enqueue(std::move(result));
+  }
 
   // Helper for (resultQueue or errorQueue).dequeue.
   // If no tasks are running, return nullopt.
@@ -59,20 +89,11 @@ struct ParallelWalkerContext {
 
 namespace {
 
-folly::Executor::KeepAlive<> createExecutor(size_t threadCountHint) {
-  size_t hwThreadCount = folly::hardware_concurrency();
-  size_t threadCount = threadCountHint
-      ? std::min(threadCountHint, hwThreadCount)
-      : hwThreadCount;
-  return new folly::CPUThreadPoolExecutor(
-      threadCount, std::make_unique<folly::NamedThreadFactory>("pwalk"));
-}
-
-// Executor used by the readDir tasks. The executor is global to avoid spawning
-// too many threads walking multiple roots.
-folly::Executor* getExecutor(size_t threadCountHint) {
-  static folly::Executor::KeepAlive<> e = createExecutor(threadCountHint);
-  return e.get();
+// Executor used by the readDir tasks. They share the process thread pool
+// with hashing and query work so that walking multiple roots does not spawn
+// more threads than the machine can run.
+folly::Executor* getExecutor() {
+  return getThreadPool().executorFor(WorkClass::Crawl);
 }
 
 folly::fbstring pathJoin(
@@ -87,6 +108,10 @@ folly::fbstring pathJoin(
   return fmt::format("{}/{}", dirName, baseName);
 }
 
+// Tag for a ReadDirTaskCounter that takes over the count held by a deferred
+// read instead of adding its own.
+struct AdoptTaskCount {};
+
 // Update readDirTaskCount. +1 on construction. -1 on destruction.
 class ReadDirTaskCounter {
  public:
@@ -108,6 +133,11 @@ class ReadDirTaskCounter {
     context_->readDirTaskCount.fetch_add(1, std::memory_order_relaxed);
   }
 
+  ReadDirTaskCounter(
+      std::shared_ptr<ParallelWalkerContext> context,
+      AdoptTaskCount)
+      : context_(std::move(context)) {}
+
   ReadDirTaskCounter(const ReadDirTaskCounter& rhs) {
     context_ = rhs.context_;
     context_->readDirTaskCount.fetch_add(1, std::memory_order_relaxed);
@@ -145,20 +175,81 @@ class ReadDirTaskCounter {
  */
 const size_t kApproximateSizePerEntry = 32;
 
+void readDirTask(
+    std::shared_ptr<ParallelWalkerContext> context,
+    AbsolutePath dirFullPath,
+    ReadDirTaskCounter&& counter,
+    size_t dirSizeHint = 0);
+
+// Spawn readDirTask for reads taken off context->deferredReads. Each task
+// adopts the count that its read held while it was deferred.
+void spawnDeferredReads(
+    const std::shared_ptr<ParallelWalkerContext>& context,
+    std::vector<std::pair<AbsolutePath, size_t>> reads) {
+  for (auto& pair : reads) {
+    auto task = [context = context,
+                 path = std::move(pair.first),
+                 counter = ReadDirTaskCounter(context, AdoptTaskCount{}),
+                 sizeHint = pair.second]() mutable {
+      readDirTask(
+          std::move(context), std::move(path), std::move(counter), sizeHint);
+    };
+    context->executor->add(std::move(task));
+  }
+}
+
+// Spawn the deferred reads if the queue has room for their results.
+void resumeDeferredReads(
+    const std::shared_ptr<ParallelWalkerContext>& context) {
+  if (!context->maxQueuedEntries || context->isBackedUp()) {
+    return;
+  }
+  std::vector<std::pair<AbsolutePath, size_t>> reads;
+  context->deferredReads.lock()->swap(reads);
+  spawnDeferredReads(context, std::move(reads));
+}
+
+// Put off reading dirFullPath until nextResult() drains the queue.
+void deferRead(
+    const std::shared_ptr<ParallelWalkerContext>& context,
+    AbsolutePath dirFullPath,
+    size_t dirSizeHint) {
+  context->readDirTaskCount.fetch_add(1, std::memory_order_relaxed);
+  context->deferredReadCount.fetch_add(1, std::memory_order_relaxed);
+  std::vector<std::pair<AbsolutePath, size_t>> reads;
+  {
+    auto deferred = context->deferredReads.lock();
+    deferred->emplace_back(std::move(dirFullPath), dirSizeHint);
+    // The consumer may have drained the queue and found nothing to resume
+    // since the caller looked. It would then wait for results that no task
+    // is going to produce.
+    if (context->isBackedUp()) {
+      return;
+    }
+    deferred->swap(reads);
+  }
+  spawnDeferredReads(context, std::move(reads));
+}
+
 /**
  * Read and stat dirPath's direct children.
  * Push ReadDirResult to context->resultQueue.
  * Push errors to context->errorQueue.
  * Spawn readDirTask for subdirectories.
+ * Defer the read if context->resultQueue is full.
  */
 void readDirTask(
     std::shared_ptr<ParallelWalkerContext> context,
     AbsolutePath dirFullPath,
     ReadDirTaskCounter&& counter,
-    size_t dirSizeHint = 0) {
+    size_t dirSizeHint) {
   if (context->stopped.load(std::memory_order_acquire)) {
     return;
   }
+  if (context->isBackedUp()) {
+    deferRead(context, std::move(dirFullPath), dirSizeHint);
+    return;
+  }
 
   std::unique_ptr<DirHandle> dir;
   try {
@@ -187,16 +278,20 @@ void readDirTask(
     }
     // Get stat() information.
     PathComponent name(d_name);
+    w_string fullPath = w_string::pathCat(
+        {w_string_piece{dirFullPath.data(), dirFullPath.size()},
+         w_string_piece{name.data(), name.size()}});
     FileInformation st;
     if (dirent->has_stat) {
       st = dirent->stat;
-    } else {
-      auto fileFullPath = pathJoin(dirFullPath, name);
+    } else if (!dir->statEntry(st)) {
       try {
-        st = context->fileSystem->getFileInformation(fileFullPath.c_str());
+        st = context->fileSystem->getFileInformation(fullPath.c_str());
       } catch (const std::system_error& err) {
         IoErrorWithPath error{
-            std::move(fileFullPath), err, "getFileInformation"};
+            AbsolutePath{fullPath.data(), fullPath.size()},
+            err,
+            "getFileInformation"};
         context->errorQueue.enqueue(error);
         // Contine checking other entries.
         continue;
@@ -208,8 +303,9 @@ void readDirTask(
     DirEntryOwned entry{
         std::move(name),
         st,
+        std::move(fullPath),
     };
-    entries.push_back(entry);
+    entries.push_back(std::move(entry));
   }
 
   // Figure out subdirs to read before losing ownership of entries.
@@ -228,7 +324,7 @@ void readDirTask(
 
   // Enqueue ReadDirResult before reading subdirs.
   ReadDirResult result{std::move(dirFullPath), std::move(entries), subdirCount};
-  context->resultQueue.enqueue(result);
+  context->enqueueResult(std::move(result));
 
   // Spawn tasks to read subdirs.
   for (auto& pair : subdirsToRead) {
@@ -251,10 +347,10 @@ ParallelWalker::ParallelWalker(
     std::shared_ptr<FileSystem> fileSystem,
     AbsolutePath rootPath,
     std::optional<FileInformation> rootStat,
-    size_t threadCountHint) {
-  auto executor = getExecutor(threadCountHint);
+    size_t maxQueuedEntries) {
+  auto executor = getExecutor();
   context_ = std::make_shared<ParallelWalkerContext>(
-      std::move(fileSystem), executor, rootStat);
+      std::move(fileSystem), executor, rootStat, maxQueuedEntries);
   auto task = [context = context_,
                path = std::move(rootPath),
                counter = ReadDirTaskCounter(context_)]() mutable {
@@ -268,11 +364,28 @@ ParallelWalker::~ParallelWalker() {
 }
 
 std::optional<ReadDirResult> ParallelWalker::nextResult() {
-  return context_->taskAwareDequeue(context_->resultQueue);
+  // Deferred reads count as running tasks, so they must be resumed before
+  // waiting for a result.
+  resumeDeferredReads(context_);
+  auto result = context_->taskAwareDequeue(context_->resultQueue);
+  if (result) {
+    context_->queuedEntries.fetch_sub(
+        result->entries.size(), std::memory_order_acq_rel);
+  }
+  return result;
 }
 
 std::optional<IoErrorWithPath> ParallelWalker::nextError() {
   return context_->taskAwareDequeue(context_->errorQueue);
 }
 
+ParallelWalker::Stats ParallelWalker::getStats() const {
+  Stats stats;
+  stats.maxQueuedEntries =
+      context_->maxQueuedEntriesSeen.load(std::memory_order_relaxed);
+  stats.deferredReads =
+      context_->deferredReadCount.load(std::memory_order_relaxed);
+  return stats;
+}
+
 } // namespace watchman
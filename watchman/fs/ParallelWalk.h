@@ -11,6 +11,7 @@
 #include <vector>
 #include "watchman/fs/FileInformation.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/watchman_string.h"
 
 /** Parallel filesystem walker. Collect path names and stats recursively. */
 
@@ -24,6 +25,9 @@ using AbsolutePath = folly::fbstring;
 struct DirEntryOwned {
   PathComponent name;
   FileInformation stat;
+  // Full path to the entry. Built on the walker thread so that a consumer
+  // applying results on a single thread does not pay for it.
+  w_string fullPath;
 };
 
 /** ReadDir result: names and stats of direct children of a directory. */
@@ -57,19 +61,22 @@ class ParallelWalker final {
   /**
    * Start reading rootPath recursively. Does not block.
    *
-   * threadCountHint specifies the desired thread count to initialize the
-   * global thread pool. It is ignored if the thread pool was initialized.
-   * threadCountHint can be 0, which means the hardware concurrency.
-   * threadCountHint caps at hardware concurrency.
+   * Directories are read as WorkClass::Crawl tasks on the process thread
+   * pool, which is shared with every other walker.
    *
    * Use nextResult() to obtain ReadDirResults.
    * Use nextError() to obtain IoErrorWithPaths.
+   *
+   * If maxQueuedEntries is not 0, directories are not read while the
+   * results waiting for nextResult() hold that many entries. Their reads
+   * resume as nextResult() drains the queue. The bound is soft: reads that
+   * already started still enqueue their results.
    */
   explicit ParallelWalker(
       std::shared_ptr<FileSystem> fileSystem,
       AbsolutePath rootPath,
       std::optional<FileInformation> rootStat,
-      size_t threadCountHint = 0);
+      size_t maxQueuedEntries = 0);
 
   /**
    * Obtain the next ReadDirResult. Might block.
@@ -82,10 +89,23 @@ class ParallelWalker final {
   /**
    * Obtain an occured error. Might block.
    *
+   * Only call this once nextResult() has returned nullopt: reads deferred by
+   * maxQueuedEntries are resumed by nextResult() alone.
+   *
    * After completion, always return nullopt without blocking.
    */
   std::optional<IoErrorWithPath> nextError();
 
+  struct Stats {
+    // The most entries that waited for nextResult() at once.
+    size_t maxQueuedEntries{0};
+    // Directory reads put off because the queue was full.
+    size_t deferredReads{0};
+  };
+
+  /** Queue statistics so far. Does not block. */
+  Stats getStats() const;
+
   /**
    * Discard the walker. Does not block.
    *
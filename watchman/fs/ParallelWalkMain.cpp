@@ -9,10 +9,11 @@
 #include <chrono>
 #include <cstdlib>
 #include <iostream>
+#include "watchman/ThreadPool.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/fs/ParallelWalk.h"
 
-void walk(watchman::AbsolutePath path, size_t threadCountHint) {
+void walk(watchman::AbsolutePath path, size_t maxQueuedEntries) {
   std::cout << path << std::endl;
 
   auto start_time = std::chrono::steady_clock::now();
@@ -22,7 +23,7 @@ void walk(watchman::AbsolutePath path, size_t threadCountHint) {
       fileSystem,
       path,
       fileSystem->getFileInformation(path.c_str()),
-      threadCountHint);
+      maxQueuedEntries);
   size_t directory_count = 0;
   size_t path_count = 0;
   off_t size = 0;
@@ -57,6 +58,9 @@ void walk(watchman::AbsolutePath path, size_t threadCountHint) {
   std::cout << "  Path#: " << path_count << std::endl;
   std::cout << "  Size:  " << size << std::endl;
   std::cout << "  Time:  " << seconds << " seconds" << std::endl;
+  auto stats = walker.getStats();
+  std::cout << "  Max queued entries: " << stats.maxQueuedEntries << std::endl;
+  std::cout << "  Deferred reads: " << stats.deferredReads << std::endl;
 }
 
 int main(int argc, char* argv[]) {
@@ -65,17 +69,15 @@ int main(int argc, char* argv[]) {
   if (argc == 1) {
     std::cerr << "Provide at least a root path to walk" << std::endl;
   } else {
-    size_t thread_count_hint = 0;
     const char* env = std::getenv("PWALK_THREAD");
-    if (env) {
-      thread_count_hint = atoi(env);
-      if (thread_count_hint) {
-        std::cerr << "Using min(" << thread_count_hint << ", nproc) threads"
-                  << std::endl;
-      }
+    if (env && atoi(env)) {
+      std::cerr << "Using " << atoi(env) << " threads" << std::endl;
+      watchman::getThreadPool().start(atoi(env), 1024 * 1024);
     }
+    const char* maxQueued = std::getenv("PWALK_MAX_QUEUED");
+    size_t maxQueuedEntries = maxQueued ? atoi(maxQueued) : 0;
     for (int i = 1; i < argc; ++i) {
-      walk(watchman::AbsolutePath(argv[i]), thread_count_hint);
+      walk(watchman::AbsolutePath(argv[i]), maxQueuedEntries);
     }
   }
   return 0;
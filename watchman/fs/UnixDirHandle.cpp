@@ -9,6 +9,7 @@
 
 #include <fmt/core.h>
 #include <folly/String.h>
+#include <atomic>
 #include <system_error>
 #include "watchman/Logging.h"
 #include "watchman/WatchmanConfig.h"
@@ -17,6 +18,14 @@
 
 #ifndef _WIN32
 #include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#ifdef STATX_BASIC_STATS
+#define WATCHMAN_HAVE_STATX 1
+#endif
 #endif
 
 #ifdef __APPLE__
@@ -54,10 +63,19 @@ typedef struct {
                  // are valid; other bits should be ignored,
                  // e.g., by masking with ~S_IFMT.
   uint64_t ino; // ATTR_CMN_FILEID
+  // getattrlistbulk() returns the dir attributes for directories and the
+  // file attributes for everything else, so these are shared.
   uint32_t link; // ATTR_FILE_LINKCOUNT or ATTR_DIR_LINKCOUNT
-  off_t file_size; // ATTR_FILE_TOTALSIZE
+  off_t size; // ATTR_FILE_TOTALSIZE or ATTR_DIR_DATALENGTH
 
 } __attribute__((packed)) bulk_attr_item;
+
+// Whether bulk_attr_item::size is packed for directories.
+#ifdef ATTR_DIR_DATALENGTH
+constexpr bool kBulkDirSize = true;
+#else
+constexpr bool kBulkDirSize = false;
+#endif
 #endif
 
 #ifndef _WIN32
@@ -72,12 +90,24 @@ class UnixDirHandle : public DirHandle {
 #endif
   DIR* d_{nullptr};
   struct DirEntry ent_;
+#ifdef WATCHMAN_HAVE_STATX
+  // Cleared from whichever thread finds that statx is unavailable
+  std::atomic<bool> useStatx_{false};
+  int statxSync_{AT_STATX_SYNC_AS_STAT};
+#endif
 
  public:
   explicit UnixDirHandle(const char* path, bool strict);
   ~UnixDirHandle() override;
   const DirEntry* readDir() override;
   int getFd() const override;
+#ifdef WATCHMAN_HAVE_STATX
+  bool statEntry(FileInformation& stat) override;
+  bool statNamedEntry(const char* name, FileInformation& stat) override;
+  void useCachedStats() override {
+    statxSync_ = AT_STATX_DONT_SYNC;
+  }
+#endif
 };
 #endif
 
@@ -128,6 +158,19 @@ static bool use_bulkstat_by_default() {
 }
 #endif
 
+#ifdef WATCHMAN_HAVE_STATX
+// Cleared the first time statx() turns out to be unavailable, either because
+// the kernel predates it or because a seccomp policy rejects it, so that we
+// stop trying and let callers use getFileInformation() instead.
+static std::atomic<bool> statx_available{true};
+
+// The fields that FileInformation needs; STATX_BASIC_STATS also asks for
+// STATX_BLOCKS, which some filesystems do not provide.
+constexpr unsigned kStatxMask = STATX_TYPE | STATX_MODE | STATX_NLINK |
+    STATX_UID | STATX_GID | STATX_ATIME | STATX_MTIME | STATX_CTIME |
+    STATX_INO | STATX_SIZE;
+#endif
+
 #ifndef _WIN32
 std::unique_ptr<DirHandle> openDir(const char* path, bool strict) {
   return std::make_unique<UnixDirHandle>(path, strict);
@@ -203,7 +246,13 @@ UnixDirHandle::UnixDirHandle(const char* path, bool strict)
         ATTR_CMN_CHGTIME | ATTR_CMN_ACCTIME | ATTR_CMN_OWNERID |
         ATTR_CMN_GRPID | ATTR_CMN_ACCESSMASK | ATTR_CMN_FILEID;
 
+    // Without ATTR_DIR_DATALENGTH, directories would report a size of 0
+    // where lstat() reports their length; crawls that mix the two would then
+    // see the directory change each time.
     attrlist_.dirattr = ATTR_DIR_LINKCOUNT;
+#ifdef ATTR_DIR_DATALENGTH
+    attrlist_.dirattr |= ATTR_DIR_DATALENGTH;
+#endif
     attrlist_.fileattr = ATTR_FILE_TOTALSIZE | ATTR_FILE_LINKCOUNT;
     return;
   }
@@ -216,6 +265,11 @@ UnixDirHandle::UnixDirHandle(const char* path, bool strict)
         std::generic_category(),
         std::string(strict ? "opendir_nofollow: " : "opendir: ") + path);
   }
+
+#ifdef WATCHMAN_HAVE_STATX
+  useStatx_ = statx_available.load(std::memory_order_relaxed) &&
+      cfg_get_bool("_use_statx", true);
+#endif
 }
 
 const DirEntry* UnixDirHandle::readDir() {
@@ -347,20 +401,20 @@ const DirEntry* UnixDirHandle::readDir() {
     ent_.stat.gid = item->gid;
     ent_.stat.mode = item->mode & ~S_IFMT;
     ent_.stat.ino = item->ino;
+    ent_.stat.nlink = item->link;
+    if (item->objtype != VDIR || kBulkDirSize) {
+      ent_.stat.size = item->size;
+    }
 
     switch (item->objtype) {
       case VREG:
         ent_.stat.mode |= S_IFREG;
-        ent_.stat.size = item->file_size;
-        ent_.stat.nlink = item->link;
         break;
       case VDIR:
         ent_.stat.mode |= S_IFDIR;
-        ent_.stat.nlink = item->link;
         break;
       case VLNK:
         ent_.stat.mode |= S_IFLNK;
-        ent_.stat.size = item->file_size;
         break;
       case VBLK:
         ent_.stat.mode |= S_IFBLK;
@@ -397,6 +451,54 @@ const DirEntry* UnixDirHandle::readDir() {
   return &ent_;
 }
 
+#ifdef WATCHMAN_HAVE_STATX
+bool UnixDirHandle::statEntry(FileInformation& stat) {
+  return statNamedEntry(ent_.d_name, stat);
+}
+
+bool UnixDirHandle::statNamedEntry(const char* name, FileInformation& stat) {
+  if (!useStatx_.load(std::memory_order_relaxed) || !d_) {
+    return false;
+  }
+
+  struct statx stx;
+  if (statx(
+          dirfd(d_),
+          name,
+          AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | statxSync_,
+          kStatxMask,
+          &stx) != 0) {
+    if (errno == ENOSYS || errno == EPERM) {
+      statx_available.store(false, std::memory_order_relaxed);
+      useStatx_.store(false, std::memory_order_relaxed);
+    }
+    return false;
+  }
+  if ((stx.stx_mask & kStatxMask) != kStatxMask) {
+    return false;
+  }
+
+  stat = FileInformation();
+  stat.mode = stx.stx_mode;
+  stat.size = stx.stx_size;
+  stat.uid = stx.stx_uid;
+  stat.gid = stx.stx_gid;
+  stat.ino = stx.stx_ino;
+  stat.dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+  stat.nlink = stx.stx_nlink;
+  auto toTimespec = [](const struct statx_timestamp& ts) {
+    struct timespec result;
+    result.tv_sec = ts.tv_sec;
+    result.tv_nsec = ts.tv_nsec;
+    return result;
+  };
+  stat.atime = toTimespec(stx.stx_atime);
+  stat.mtime = toTimespec(stx.stx_mtime);
+  stat.ctime = toTimespec(stx.stx_ctime);
+  return true;
+}
+#endif
+
 UnixDirHandle::~UnixDirHandle() {
   if (d_) {
     closedir(d_);
@@ -8,6 +8,8 @@
 #include "watchman/fs/DirHandle.h"
 
 #include <folly/ScopeGuard.h>
+#include <mutex>
+#include <unordered_map>
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/fs/WindowsTime.h"
@@ -28,6 +30,9 @@ class WinDirHandle : public DirHandle {
   HANDLE hDirFind_{nullptr};
   char nameBuf_[WATCHMAN_NAME_MAX];
   DirEntry ent_;
+  // Stats of all entries, listed in bulk by the first statNamedEntry() call
+  std::once_flag listOnce_;
+  std::unordered_map<w_string, FileInformation> listed_;
 
  public:
   ~WinDirHandle() {
@@ -75,7 +80,57 @@ class WinDirHandle : public DirHandle {
     }
   }
 
+  // Answered from a listing of the whole dir, which reports the stats of many
+  // entries per call, rather than by opening a handle to each entry.  The
+  // listing restarts the enumeration, so readDir() must not be used after.
+  bool statNamedEntry(const char* name, FileInformation& stat) override {
+    std::call_once(listOnce_, [this] { listAll(); });
+    auto it = listed_.find(w_string{name, W_STRING_BYTE});
+    if (it == listed_.end()) {
+      return false;
+    }
+    stat = it->second;
+    return true;
+  }
+
  private:
+  static FileInformation statFromInfo(const FILE_FULL_DIR_INFO& info) {
+    FileInformation stat(info.FileAttributes);
+    FILETIME_LARGE_INTEGER_to_timespec(info.CreationTime, &stat.ctime);
+    FILETIME_LARGE_INTEGER_to_timespec(info.LastAccessTime, &stat.atime);
+    FILETIME_LARGE_INTEGER_to_timespec(info.LastWriteTime, &stat.mtime);
+    stat.size = info.EndOfFile.QuadPart;
+    return stat;
+  }
+
+  // Leaves listed_ empty if the dir can't be listed this way, so that
+  // callers fall back to getFileInformation(), which reports the error.
+  void listAll() {
+    if (win7_) {
+      return;
+    }
+    auto buf = std::make_unique<uint64_t[]>(sizeof(buf_) / sizeof(uint64_t));
+    auto infoClass = FileFullDirectoryRestartInfo;
+    while (GetFileInformationByHandleEx(
+        (HANDLE)h_.handle(), infoClass, buf.get(), sizeof(buf_))) {
+      infoClass = FileFullDirectoryInfo;
+      auto* info = (FILE_FULL_DIR_INFO*)buf.get();
+      while (true) {
+        listed_.emplace(
+            w_string{
+                info->FileName, info->FileNameLength / sizeof(WCHAR)},
+            statFromInfo(*info));
+        if (info->NextEntryOffset == 0) {
+          break;
+        }
+        info = (FILE_FULL_DIR_INFO*)(((char*)info) + info->NextEntryOffset);
+      }
+    }
+    if (GetLastError() != ERROR_NO_MORE_FILES) {
+      listed_.clear();
+    }
+  }
+
   const DirEntry* readDirWin8() {
     if (!info_) {
       if (!GetFileInformationByHandleEx(
@@ -110,11 +165,7 @@ class WinDirHandle : public DirHandle {
     nameBuf_[len] = 0;
 
     // Populate stat info to speed up the crawler() routine
-    ent_.stat = FileInformation(info_->FileAttributes);
-    FILETIME_LARGE_INTEGER_to_timespec(info_->CreationTime, &ent_.stat.ctime);
-    FILETIME_LARGE_INTEGER_to_timespec(info_->LastAccessTime, &ent_.stat.atime);
-    FILETIME_LARGE_INTEGER_to_timespec(info_->LastWriteTime, &ent_.stat.mtime);
-    ent_.stat.size = info_->EndOfFile.QuadPart;
+    ent_.stat = statFromInfo(*info_);
 
     // Advance the pointer to the next entry ready for the next read
     info_ = info_->NextEntryOffset == 0
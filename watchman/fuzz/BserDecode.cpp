@@ -14,5 +14,10 @@ extern "C" int LLVMFuzzerTestOneInput(void const* data, size_t size) {
   } catch (const BserParseError&) {
     // Caught parse errors are okay.
   }
+  try {
+    // Anything the view accepts must decode without error.
+    BserView::parse(d, d + size).toJson();
+  } catch (const BserParseError&) {
+  }
   return 0;
 }
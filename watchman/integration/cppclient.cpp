@@ -12,6 +12,7 @@
 #include <condition_variable>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include <folly/experimental/io/FsUtil.h>
 #include <folly/init/Init.h>
@@ -140,6 +141,59 @@ int main(int argc, char** argv) {
     LOG(INFO) << "PASS: one-off query saw the touched hit file";
   }
 
+  LOG(INFO) << "Testing a columnar query";
+  auto columns =
+      c.queryColumns(
+           dynamic::object("expression", dynamic::array("name", "hit")),
+           current_dir_ptr)
+          .get();
+  if (columns.files.size() != 1 || columns.files.name(0) != "hit" ||
+      columns.files.exists() != std::vector<bool>{true} ||
+      columns.files.sizes() != std::vector<int64_t>{0} ||
+      columns.files.mtime().size() != 1 || columns.raw_.get_ptr("files") ||
+      !columns.raw_.get_ptr("clock")) {
+    LOG(ERROR) << "FAIL: unexpected columnar result for "
+               << toJson(columns.raw_);
+    return 1;
+  }
+  LOG(INFO) << "PASS: columnar query decoded the hit file";
+
+  LOG(INFO) << "Testing pipelined queries";
+  std::vector<folly::SemiFuture<QueryResult>> pipelined;
+  for (int i = 0; i < 8; ++i) {
+    pipelined.push_back(c.query(
+        dynamic::object(
+            "expression", dynamic::array("name", i % 2 ? "hit" : "miss")),
+        current_dir_ptr));
+  }
+  for (size_t i = 0; i < pipelined.size(); ++i) {
+    auto res = std::move(pipelined[i]).get();
+    if (res.raw_["files"].size() != i % 2) {
+      LOG(ERROR) << "FAIL: pipelined query " << i << " got the response "
+                 << toJson(res.raw_);
+      return 1;
+    }
+  }
+  LOG(INFO) << "PASS: pipelined queries were answered in order";
+
+#ifndef _WIN32
+  LOG(INFO) << "Testing a query with shm_results";
+  auto shm_data =
+      c.query(
+           dynamic::object("expression", dynamic::array("name", "hit"))(
+               "fields", dynamic::array("name"))("shm_results", true),
+           current_dir_ptr)
+          .get();
+  if (shm_data.raw_.get_ptr("files_fd") ||
+      shm_data.raw_["files"].size() != 1 ||
+      shm_data.raw_["files"][0].getString() != "hit") {
+    LOG(ERROR) << "FAIL: unexpected shm_results response "
+               << toJson(shm_data.raw_);
+    return 1;
+  }
+  LOG(INFO) << "PASS: shm_results query returned the hit file";
+#endif
+
   LOG(INFO) << "Flushing subscription";
   auto flush_res =
       c.flushSubscription(sub, std::chrono::milliseconds(1000)).wait().value();
@@ -6,6 +6,8 @@
 # pyre-unsafe
 
 
+import os
+
 from watchman.integration.lib import WatchmanInstance, WatchmanTestCase
 
 
@@ -38,3 +40,36 @@ class TestBulkStat(WatchmanTestCase.WatchmanTestCase):
             self.touchRelative(root, "foo")
             self.touchRelative(root, "bar")
             self.assertFileList(root, ["foo", "bar"])
+
+    def test_statx_on(self) -> None:
+        config = {"_use_statx": True}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            self.getClient(inst, replace_cached=True)
+
+            root = self.mkdtemp()
+            # Populate the tree before watching so that the initial crawl
+            # takes its stat information from the directory handle.
+            self.touchRelative(root, "foo")
+            os.mkdir(os.path.join(root, "dir"))
+            self.touchRelative(root, "dir", "bar")
+            # pyre-fixme[16]: `TestBulkStat` has no attribute `client`.
+            self.client.query("watch", root)
+            self.assertFileList(root, ["foo", "dir", "dir/bar"])
+
+            self.touchRelative(root, "baz")
+            self.assertFileList(root, ["foo", "dir", "dir/bar", "baz"])
+
+    def test_statx_off(self) -> None:
+        config = {"_use_statx": False}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            self.getClient(inst, replace_cached=True)
+
+            root = self.mkdtemp()
+            # pyre-fixme[16]: `TestBulkStat` has no attribute `client`.
+            self.client.query("watch", root)
+
+            self.touchRelative(root, "foo")
+            self.touchRelative(root, "bar")
+            self.assertFileList(root, ["foo", "bar"])
@@ -111,6 +111,7 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             "cmd-debug-get-asserted-states",
             "cmd-debug-get-subscriptions",
             "cmd-debug-poison",
+            "cmd-debug-query-scheduler",
             "cmd-debug-recrawl",
             "cmd-debug-root-status",
             "cmd-debug-set-parallel-crawl",
@@ -130,7 +131,9 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             "cmd-list-capabilities",
             "cmd-log",
             "cmd-log-level",
+            "cmd-multi-query",
             "cmd-query",
+            "cmd-query-batch",
             "cmd-shutdown-server",
             "cmd-since",
             "cmd-state-enter",
@@ -146,7 +149,9 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             "cmd-watch-del-all",
             "cmd-watch-list",
             "cmd-watch-project",
+            "deadline_ms",
             "dedup_results",
+            "explain",
             "field-atime",
             "field-atime_f",
             "field-atime_ms",
@@ -177,12 +182,17 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             "field-symlink_target",
             "field-type",
             "field-uid",
+            "front_coded_names",
             "glob_generator",
+            "limit",
+            "priority",
             "relative_root",
             "saved-state-local",
             "scm-git",
             "scm-hg",
             "scm-since",
+            "sort",
+            "stream_results",
             "suffix-set",
             "term-allof",
             "term-anyof",
@@ -204,6 +214,7 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             "term-true",
             "term-type",
             "watcher-eden",
+            "watcher-poll",
             "wildmatch",
             "wildmatch-multislash",
         }
@@ -0,0 +1,45 @@
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import os
+
+from watchman.integration.lib import WatchmanInstance, WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestClientEventLoop(WatchmanTestCase.WatchmanTestCase):
+    def test_event_loop_serves_clients(self) -> None:
+        config = {"client_event_loop": True, "client_event_loop_threads": 1}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            client = self.getClient(inst, replace_cached=True)
+
+            root = self.mkdtemp()
+            self.touchRelative(root, "foo")
+            client.query("watch", root)
+            self.assertFileList(root, ["foo"])
+
+            client.query("subscribe", root, "sub", {"fields": ["name"]})
+            dat = self.waitForSub("sub", root=root, client=client)[0]
+            self.assertTrue(dat["is_fresh_instance"])
+
+            # A second connection is served by the same I/O thread
+            other = self.getClient(inst, no_cache=True)
+            self.assertEqual(
+                other.query("get-sockname")["version"],
+                client.query("get-sockname")["version"],
+            )
+
+            os.unlink(os.path.join(root, "foo"))
+            dat = self.waitForSub(
+                "sub",
+                root=root,
+                client=client,
+                accept=lambda x: self.findSubscriptionContainingFile(x, "foo"),
+            )
+            self.assertNotEqual(None, dat)
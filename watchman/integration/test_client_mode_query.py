@@ -0,0 +1,80 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import json
+import os
+import os.path
+import subprocess
+import tempfile
+import unittest
+
+
+class TestClientModeQuery(unittest.TestCase):
+    def setUp(self) -> None:
+        self.tempdir = tempfile.TemporaryDirectory()
+        self.root = os.path.join(self.tempdir.name, "root")
+        for name in ("a.py", "b.txt", "sub/c.py"):
+            path = os.path.join(self.root, name)
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            with open(path, "w"):
+                pass
+
+    def tearDown(self) -> None:
+        self.tempdir.cleanup()
+
+    def runQuery(self, query):
+        # Nothing listens here, so the CLI answers the query itself
+        sockpath = os.path.join(self.tempdir.name, "sock")
+        cli_cmd = [
+            os.environ.get("WATCHMAN_BINARY", "watchman"),
+            "--unix-listener-path={0}".format(sockpath),
+            "--named-pipe-path={0}".format(sockpath),
+            "--logfile=/BOGUS",
+            "--statefile=/BOGUS",
+            "--no-spawn",
+            "--no-pretty",
+            "-j",
+        ]
+        proc = subprocess.Popen(
+            cli_cmd,
+            stdin=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+        )
+        stdout, stderr = proc.communicate(
+            input=json.dumps(["query", self.root, query]).encode("ascii")
+        )
+        self.assertEqual(proc.poll(), 0, stderr.decode(errors="replace"))
+        return [json.loads(line) for line in stdout.decode("utf-8").splitlines()]
+
+    def test_suffix_query_walks(self) -> None:
+        [res] = self.runQuery({"suffix": "py", "fields": ["name"], "explain": True})
+        self.assertEqual(["a.py", "sub/c.py"], sorted(res["files"]))
+        [stage] = res["explain"]["generators"]
+        self.assertEqual("walk", stage["method"])
+
+    def test_streamed_results(self) -> None:
+        responses = self.runQuery(
+            {
+                "expression": ["type", "f"],
+                "fields": ["name"],
+                "stream_results": 1,
+            }
+        )
+        files = []
+        for res in responses:
+            files.extend(res["files"])
+        self.assertTrue(responses[0].get("streaming"))
+        self.assertEqual(["a.py", "b.txt", "sub/c.py"], sorted(files))
+
+    def test_path_query_crawls(self) -> None:
+        [res] = self.runQuery({"path": ["sub"], "fields": ["name"], "explain": True})
+        self.assertEqual(["sub/c.py"], res["files"])
+        [stage] = res["explain"]["generators"]
+        self.assertEqual("path", stage["generator"])
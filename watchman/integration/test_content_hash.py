@@ -112,6 +112,35 @@ class TestContentHash(WatchmanTestCase.WatchmanTestCase):
         )
         self.assertEqual(None, res["files"][0]["content.sha1hex"])
 
+    def test_contentXxh3(self) -> None:
+        self.skipIfCapabilityMissing(
+            "field-content.xxh3hex", "built without xxhash support"
+        )
+        root = self.mkdtemp()
+        self.touchRelative(root, "empty")
+        self.write_file_and_hash(os.path.join(root, "foo"), "hello\n")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["empty", "foo"])
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {
+                "path": ["empty", "foo"],
+                "fields": ["name", "content.xxh3hex", "content.sha1hex"],
+            },
+        )
+        files = {f["name"]: f for f in res["files"]}
+        empty_hex = files["empty"]["content.xxh3hex"]
+        self.assertEqual("99aa06d3014798d86001c324468d497f", empty_hex)
+        foo_hex = files["foo"]["content.xxh3hex"]
+        self.assertEqual(32, len(foo_hex))
+        self.assertNotEqual(empty_hex, foo_hex)
+
+        # Each digest is cached separately
+        stats = self.watchmanCommand("debug-contenthash", root)
+        self.assertEqual(stats["size"], 4)
+
     def test_contentHashWarming(self) -> None:
         root = self.mkdtemp()
 
@@ -0,0 +1,40 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import os
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestDebugQueryLog(WatchmanTestCase.WatchmanTestCase):
+    def test_queries_are_logged(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a"])
+        self.watchmanCommand("debug-query-log-clear")
+
+        clock = self.watchmanCommand("clock", root)["clock"]
+        self.watchmanCommand("query", root, {"fields": ["name"]})
+        self.watchmanCommand("query", root, {"fields": ["name"], "since": clock})
+
+        log = self.watchmanCommand("debug-query-log")
+        self.assertIn("slow_queries", log)
+        entries = [
+            e
+            for e in log["queries"]
+            if e["root"].endswith(os.path.basename(root))
+        ]
+        self.assertEqual(2, len(entries))
+        self.assertEqual(1, entries[0]["results"])
+        # The since clock is not part of the query hash
+        self.assertEqual(entries[0]["query_hash"], entries[1]["query_hash"])
+        for key in ("total_ms", "generate_ms", "render_ms", "lock_wait_ms"):
+            self.assertIn(key, entries[0])
@@ -0,0 +1,27 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestDebugStats(WatchmanTestCase.WatchmanTestCase):
+    def test_query_stages_are_reported(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "foo")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["foo"])
+        self.watchmanCommand("query", root, {"fields": ["name"]})
+
+        stats = self.watchmanCommand("debug-stats")["stats"]
+        for stage in ("generate_us", "render_us"):
+            names = [n for n in stats if n.startswith("watchman.query." + stage)]
+            self.assertNotEqual([], names, stage)
+        for name in stats:
+            self.assertTrue(name.startswith("watchman."), name)
@@ -0,0 +1,52 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import json
+import os
+import sys
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestFSEventsShared(WatchmanTestCase.WatchmanTestCase):
+    def checkOSApplicability(self) -> None:
+        if sys.platform != "darwin":
+            self.skipTest("N/A unless macOS")
+
+    def makeRoot(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"fsevents_share_streams": True}))
+        return root
+
+    def sharedStreamRoots(self, root):
+        info = self.watchmanCommand("debug-watcher-info", root)
+        return info["watcher"]["shared_stream_roots"]
+
+    def test_roots_share_a_stream(self) -> None:
+        first = self.makeRoot()
+        second = self.makeRoot()
+
+        # On macOS, we may not always use fsevents
+        if self.watchmanCommand("watch", first)["watcher"] != "fsevents":
+            return
+        self.watchmanCommand("watch", second)
+        self.assertEqual(self.sharedStreamRoots(first), 2)
+
+        self.touchRelative(first, "a")
+        self.touchRelative(second, "b")
+        self.assertFileList(first, [".watchmanconfig", "a"])
+        self.assertFileList(second, [".watchmanconfig", "b"])
+
+        # The remaining root keeps its events once the other is removed
+        self.watchmanCommand("watch-del", first)
+        self.assertWaitForEqual(1, lambda: self.sharedStreamRoots(second))
+        self.touchRelative(second, "c")
+        self.assertFileList(second, [".watchmanconfig", "b", "c"])
@@ -0,0 +1,69 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import json
+import os
+import os.path
+import time
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestHibernate(WatchmanTestCase.WatchmanTestCase):
+    def makeRootAndConfig(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(
+                json.dumps(
+                    {
+                        "idle_hibernate_age_seconds": 1,
+                        "view_snapshot_dir": self.mkdtemp(),
+                    }
+                )
+            )
+        return root
+
+    def isHibernated(self, root):
+        info = self.watchmanCommand("debug-watcher-info", root)
+        return info["view"]["hibernated"]
+
+    def waitForHibernation(self, root):
+        # Every command counts as activity, so give the root time to go idle
+        # between checks rather than polling it awake.
+        for _ in range(10):
+            time.sleep(3)
+            if self.isHibernated(root):
+                return
+        self.fail("%s was not hibernated" % root)
+
+    def test_query_reloads_view(self) -> None:
+        root = self.makeRootAndConfig()
+        self.touchRelative(root, "a")
+        self.touchRelative(root, "b")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, [".watchmanconfig", "a", "b"])
+        clock = self.watchmanCommand("clock", root)["clock"]
+
+        self.waitForHibernation(root)
+
+        # Changes made while hibernated are applied when the view reloads
+        self.touchRelative(root, "c")
+        os.unlink(os.path.join(root, "a"))
+
+        res = self.watchmanCommand(
+            "query", root, {"fields": ["name", "exists"], "since": clock}
+        )
+        self.assertFalse(res["is_fresh_instance"])
+        self.assertCountEqual(
+            [{"name": "a", "exists": False}, {"name": "c", "exists": True}],
+            res["files"],
+        )
+        self.assertFalse(self.isHibernated(root))
+        self.assertFileList(root, [".watchmanconfig", "b", "c"])
@@ -0,0 +1,78 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import json
+import os
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestLazyCrawl(WatchmanTestCase.WatchmanTestCase):
+    def makeRoot(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"lazy_crawl": True}))
+        for dir in ("deferred", "other"):
+            os.mkdir(os.path.join(root, dir))
+            self.touchRelative(root, dir, "a")
+        return root
+
+    def since(self, root, clock, **kwargs):
+        query = {
+            "expression": ["type", "f"],
+            "fields": ["name"],
+            "since": clock,
+            "sync_timeout": 10000,
+        }
+        query.update(kwargs)
+        return self.watchmanCommand("query", root, query)["files"]
+
+    def test_since_crawls_a_deferred_dir(self) -> None:
+        root = self.makeRoot()
+        self.watchmanCommand("watch", root)
+        # Taking the clock doesn't run a query, so nothing beneath the
+        # root's directories is crawled yet
+        clock = self.watchmanCommand("clock", root)["clock"]
+
+        # The query waits for the crawl of the directory it reads, and
+        # reports what it found there
+        self.assertFileListsEqual(
+            self.since(root, clock, relative_root="deferred"), ["a"]
+        )
+
+        # Changes there are observed from now on
+        self.touchRelative(root, "deferred", "b")
+        self.assertWaitForEqual(
+            ["a", "b"],
+            lambda: sorted(self.since(root, clock, relative_root="deferred")),
+        )
+
+        # A query of the whole root crawls the rest of it
+        self.assertFileListsEqual(
+            self.since(root, clock),
+            ["deferred/a", "deferred/b", "other/a"],
+        )
+
+    def test_since_without_sync_timeout_still_crawls(self) -> None:
+        root = self.makeRoot()
+        self.watchmanCommand("watch", root)
+        clock = self.watchmanCommand("clock", root)["clock"]
+
+        # With no sync_timeout, the crawl is bounded by the lock_timeout
+        self.assertFileListsEqual(
+            self.since(
+                root,
+                clock,
+                relative_root="deferred",
+                sync_timeout=0,
+                lock_timeout=10000,
+            ),
+            ["a"],
+        )
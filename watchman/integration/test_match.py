@@ -115,3 +115,71 @@ class TestMatch(WatchmanTestCase.WatchmanTestCase):
             },
         )
         self.assertFileListsEqual(res["files"], ["foo/baz.c"])
+
+    def test_match_literal_prefixes(self) -> None:
+        root = self.mkdtemp()
+        os.makedirs(os.path.join(root, "src", "server", "deep"))
+        os.mkdir(os.path.join(root, "src-old"))
+        self.touchRelative(root, "src", "main.cc")
+        self.touchRelative(root, "src", "server", "a.cc")
+        self.touchRelative(root, "src", "server", "deep", "b.cc")
+        self.touchRelative(root, "src-old", "c.cc")
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(
+            root,
+            [
+                "src",
+                "src/main.cc",
+                "src/server",
+                "src/server/a.cc",
+                "src/server/deep",
+                "src/server/deep/b.cc",
+                "src-old",
+                "src-old/c.cc",
+            ],
+        )
+
+        def query(expression):
+            res = self.watchmanCommand(
+                "query",
+                root,
+                {
+                    "expression": expression,
+                    "case_sensitive": True,
+                    "fields": ["name"],
+                },
+            )
+            return res["files"]
+
+        self.assertFileListsEqual(
+            query(["match", "src/server/**/*.cc", "wholename"]),
+            ["src/server/a.cc", "src/server/deep/b.cc"],
+        )
+        self.assertFileListsEqual(
+            query(["match", "src/*", "wholename"]),
+            ["src/main.cc", "src/server"],
+        )
+        self.assertFileListsEqual(
+            query(["match", "src/server", "wholename"]), ["src/server"]
+        )
+        self.assertFileListsEqual(
+            query(
+                [
+                    "anyof",
+                    ["match", "src/**", "wholename"],
+                    ["match", "src/server/*.cc", "wholename"],
+                ]
+            ),
+            [
+                "src/main.cc",
+                "src/server",
+                "src/server/a.cc",
+                "src/server/deep",
+                "src/server/deep/b.cc",
+            ],
+        )
+        self.assertFileListsEqual(
+            query(["dirname", "src/server"]),
+            ["src/server/a.cc", "src/server/deep", "src/server/deep/b.cc"],
+        )
@@ -0,0 +1,59 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestMultiQuery(WatchmanTestCase.WatchmanTestCase):
+    def test_queries_each_root(self) -> None:
+        root1 = self.mkdtemp()
+        root2 = self.mkdtemp()
+        self.touchRelative(root1, "a")
+        self.touchRelative(root2, "b")
+        self.watchmanCommand("watch", root1)
+        self.watchmanCommand("watch", root2)
+        self.assertFileList(root1, ["a"])
+        self.assertFileList(root2, ["b"])
+
+        res = self.watchmanCommand(
+            "multi-query",
+            [
+                [root1, {"fields": ["name"]}],
+                [root2, {"fields": ["name"]}],
+            ],
+        )
+        results = res["results"]
+        self.assertEqual(2, len(results))
+        self.assertIn("root", results[0])
+        self.assertEqual(["a"], results[0]["files"])
+        self.assertIn("clock", results[0])
+        self.assertEqual(["b"], results[1]["files"])
+
+    def test_errors_are_per_root(self) -> None:
+        root = self.mkdtemp()
+        unwatched = self.mkdtemp()
+        self.touchRelative(root, "a")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a"])
+
+        res = self.watchmanCommand(
+            "multi-query",
+            [
+                [unwatched, {"fields": ["name"]}],
+                [root, {"expression": ["bogus"]}],
+                [root, {"fields": ["name"]}],
+            ],
+        )
+        results = res["results"]
+        self.assertEqual(3, len(results))
+        self.assertIn("error", results[0])
+        self.assertIn("error", results[1])
+        self.assertNotIn("error", results[2])
+        self.assertEqual(["a"], results[2]["files"])
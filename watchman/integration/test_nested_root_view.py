@@ -0,0 +1,46 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import os
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestNestedRootView(WatchmanTestCase.WatchmanTestCase):
+    def test_nested_root_is_served_from_parent(self) -> None:
+        root = self.mkdtemp()
+        sub = os.path.join(root, "sub")
+        os.mkdir(sub)
+        self.touchRelative(root, "top.txt")
+        self.touchRelative(sub, "a.txt")
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["sub", "sub/a.txt", "top.txt"])
+
+        self.watchmanCommand("watch", sub)
+        self.assertFileList(sub, files=["a.txt"])
+        clock = self.watchmanCommand("clock", sub)["clock"]
+
+        # Changes seen by the parent's watcher are reported relative to the
+        # nested root, and changes outside of it are not reported at all
+        self.touchRelative(sub, "b.txt")
+        self.touchRelative(root, "other.txt")
+        self.assertFileList(sub, files=["a.txt", "b.txt"])
+        res = self.watchmanCommand(
+            "query", sub, {"since": clock, "fields": ["name"]}
+        )
+        self.assertEqual(["b.txt"], res["files"])
+
+        # The nested root can't outlive the view it is served from
+        self.watchmanCommand("watch-del", root)
+        self.assertWaitFor(
+            lambda: self.watchmanCommand("watch-list")["roots"] == [],
+            message="nested root is cancelled along with its parent",
+        )
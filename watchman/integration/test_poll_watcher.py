@@ -0,0 +1,73 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import json
+import os
+import os.path
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestPollWatcher(WatchmanTestCase.WatchmanTestCase):
+    def makePolledRoot(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(
+                json.dumps(
+                    {
+                        "watcher": "poll",
+                        "poll_hot_interval_ms": 100,
+                        "poll_cold_interval_ms": 400,
+                    }
+                )
+            )
+        return root
+
+    def test_poll_watcher_finds_changes(self) -> None:
+        root = self.makePolledRoot()
+        os.mkdir(os.path.join(root, "dir"))
+        self.touchRelative(root, "dir", "file")
+        self.touchRelative(root, "top")
+
+        watch = self.watchmanCommand("watch", root)
+        self.assertEqual("poll", watch["watcher"])
+        self.assertFileList(root, [".watchmanconfig", "dir", "dir/file", "top"])
+
+        # Added, modified and removed files are found without a sync
+        clock = self.watchmanCommand("clock", root)["clock"]
+        self.touchRelative(root, "dir", "added")
+        with open(os.path.join(root, "top"), "a") as f:
+            f.write("more")
+        os.unlink(os.path.join(root, "dir", "file"))
+
+        def changed():
+            res = self.watchmanCommand(
+                "query",
+                root,
+                {
+                    "since": clock,
+                    "expression": ["type", "f"],
+                    "fields": ["name"],
+                    "sync_timeout": 0,
+                },
+            )
+            return sorted(res["files"])
+
+        self.assertWaitForEqual(["dir/added", "dir/file", "top"], changed)
+        self.assertFileList(root, [".watchmanconfig", "dir", "dir/added", "top"])
+
+        info = self.watchmanCommand("debug-watcher-info", root)["watcher-debug-info"]
+        self.assertEqual(2, info["dir_count"])
+        self.assertGreater(info["stat_count"], 0)
+
+    def test_poll_watcher_is_not_picked_automatically(self) -> None:
+        root = self.mkdtemp()
+        watch = self.watchmanCommand("watch", root)
+        self.assertNotEqual("poll", watch["watcher"])
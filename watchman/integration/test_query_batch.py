@@ -0,0 +1,55 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryBatch(WatchmanTestCase.WatchmanTestCase):
+    def test_queries_share_one_sync(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "a.txt")
+        self.touchRelative(root, "b.js")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a.txt", "b.js"])
+
+        # Made after the last query, so only seen because of the sync
+        self.touchRelative(root, "c.js")
+
+        res = self.watchmanCommand(
+            "query-batch",
+            root,
+            [
+                {"suffix": "txt", "fields": ["name"]},
+                {"suffix": "js", "fields": ["name"]},
+            ],
+        )
+        results = res["results"]
+        self.assertEqual(2, len(results))
+        self.assertEqual(["a.txt"], results[0]["files"])
+        self.assertIn("clock", results[0])
+        self.assertEqual(["b.js", "c.js"], sorted(results[1]["files"]))
+        self.assertTrue(results[1]["debug"]["cookie_files"])
+
+    def test_errors_are_per_query(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a"])
+
+        res = self.watchmanCommand(
+            "query-batch",
+            root,
+            [{"expression": ["bogus"]}, {"fields": ["name"]}],
+        )
+        results = res["results"]
+        self.assertEqual(2, len(results))
+        self.assertIn("error", results[0])
+        self.assertNotIn("error", results[1])
+        self.assertEqual(["a"], results[1]["files"])
@@ -0,0 +1,61 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryCost(WatchmanTestCase.WatchmanTestCase):
+    def test_cost_is_opt_in(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a"])
+
+        res = self.watchmanCommand("query", root, {"fields": ["name"]})
+        self.assertNotIn("cost", res)
+
+    def test_cost_counts_walked_files(self) -> None:
+        root = self.mkdtemp()
+        for name in ("a", "b", "c"):
+            self.touchRelative(root, name)
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a", "b", "c"])
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"expression": ["name", "a"], "fields": ["name"], "cost": True},
+        )
+        self.assertEqual(["a"], res["files"])
+        cost = res["cost"]
+        self.assertGreaterEqual(cost["walked"], 3)
+        self.assertGreaterEqual(cost["evaluated"], 3)
+        for key in (
+            "stat_calls",
+            "hash_cache_hits",
+            "hash_cache_misses",
+            "lock_wait_ms",
+            "bytes_encoded",
+        ):
+            self.assertIn(key, cost)
+
+    def test_cost_counts_content_hashes(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a"])
+
+        query = {"expression": ["type", "f"], "fields": ["content.sha1hex"]}
+        query["cost"] = True
+        first = self.watchmanCommand("query", root, query)["cost"]
+        self.assertEqual(1, first["hash_cache_misses"])
+        second = self.watchmanCommand("query", root, query)["cost"]
+        self.assertEqual(1, second["hash_cache_hits"])
+        self.assertEqual(0, second["hash_cache_misses"])
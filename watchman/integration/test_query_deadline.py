@@ -0,0 +1,34 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryDeadline(WatchmanTestCase.WatchmanTestCase):
+    def test_query_within_deadline(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "foo")
+        self.watchmanCommand("watch", root)
+
+        res = self.watchmanCommand(
+            "query", root, {"fields": ["name"], "deadline_ms": 60000}
+        )
+        self.assertEqual(["foo"], res["files"])
+
+    def test_bad_deadline(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand("query", root, {"deadline_ms": -1})
+        self.assertIn(
+            "deadline_ms must be an integer value >= 0", str(ctx.exception)
+        )
@@ -0,0 +1,107 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import os
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryExplain(WatchmanTestCase.WatchmanTestCase):
+    def test_explain_is_opt_in(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a"])
+
+        res = self.watchmanCommand("query", root, {"fields": ["name"]})
+        self.assertNotIn("explain", res)
+
+    def test_explain_all_files(self) -> None:
+        root = self.mkdtemp()
+        for name in ("a.c", "b.c", "c.h"):
+            self.touchRelative(root, name)
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a.c", "b.c", "c.h"])
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {
+                "expression": ["allof", ["match", "*.c"], ["type", "f"]],
+                "fields": ["name"],
+                "explain": True,
+            },
+        )
+        self.assertEqual(["a.c", "b.c"], sorted(res["files"]))
+        explain = res["explain"]
+
+        [stage] = explain["generators"]
+        self.assertEqual("all", stage["generator"])
+        self.assertGreaterEqual(stage["walked"], 3)
+        self.assertEqual(2, stage["matched"])
+        self.assertEqual(2, explain["results"])
+
+        # The cheap type term is evaluated before the pattern match
+        expression = explain["expression"]
+        self.assertEqual("allof", expression["term"])
+        self.assertEqual(
+            ["type", "match"], [term["term"] for term in expression["terms"]]
+        )
+
+    def test_explain_each_generator(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "a.c")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a.c"])
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {
+                "path": [""],
+                "suffix": ["c"],
+                "fields": ["name"],
+                "explain": True,
+            },
+        )
+        generators = [stage["generator"] for stage in res["explain"]["generators"]]
+        self.assertEqual(["path", "suffix"], generators)
+        self.assertIsNone(res["explain"]["expression"])
+
+    def test_explain_dirs_only(self) -> None:
+        root = self.mkdtemp()
+        os.makedirs(os.path.join(root, "a", "b"))
+        for name in ("a/b/c.txt", "a/d.txt", "e.txt"):
+            self.touchRelative(root, *name.split("/"))
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a", "a/b", "a/b/c.txt", "a/d.txt", "e.txt"])
+
+        for _ in range(2):
+            res = self.watchmanCommand(
+                "query",
+                root,
+                {"expression": ["type", "d"], "fields": ["name"], "explain": True},
+            )
+            self.assertEqual(["a", "a/b"], sorted(res["files"]))
+            [stage] = res["explain"]["generators"]
+            self.assertEqual("dir_index", stage["method"])
+            self.assertEqual(2, stage["matched"])
+
+        # A file that becomes a dir after the index was built is found too
+        os.unlink(os.path.join(root, "e.txt"))
+        os.mkdir(os.path.join(root, "e.txt"))
+        self.assertWaitForEqual(
+            ["a", "a/b", "e.txt"],
+            lambda: sorted(
+                self.watchmanCommand(
+                    "query", root, {"expression": ["type", "d"], "fields": ["name"]}
+                )["files"]
+            ),
+        )
@@ -0,0 +1,83 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import os
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+def decode_names(coded):
+    names = []
+    previous = []
+    for shared, suffix in coded:
+        name = "/".join(previous[:shared] + [suffix])
+        names.append(name)
+        previous = name.split("/")
+    return names
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryFrontCodedNames(WatchmanTestCase.WatchmanTestCase):
+    def test_front_coded_names(self) -> None:
+        root = self.mkdtemp()
+        os.makedirs(os.path.join(root, "src", "lib"))
+        self.touchRelative(root, "src", "lib", "a.c")
+        self.touchRelative(root, "src", "lib", "ab.c")
+        self.touchRelative(root, "src", "main.c")
+        self.touchRelative(root, "top.txt")
+
+        self.watchmanCommand("watch", root)
+        expected = [
+            "src",
+            "src/lib",
+            "src/lib/a.c",
+            "src/lib/ab.c",
+            "src/main.c",
+            "top.txt",
+        ]
+        self.assertFileList(root, expected)
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"fields": ["name"], "sort": "name", "front_coded_names": True},
+        )
+        self.assertEqual(
+            [
+                [0, "src"],
+                [1, "lib"],
+                [2, "a.c"],
+                [2, "ab.c"],
+                [1, "main.c"],
+                [0, "top.txt"],
+            ],
+            [list(f) for f in res["files"]],
+        )
+
+        # Templated results and unsorted ones decode to the same names
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"fields": ["name", "exists"], "front_coded_names": True},
+        )
+        self.assertEqual(
+            sorted(expected),
+            sorted(decode_names(f["name"] for f in res["files"])),
+        )
+
+    def test_invalid_front_coded_names(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand("query", root, {"front_coded_names": 1})
+        self.assertRegex(
+            str(ctx.exception), "front_coded_names must be a boolean"
+        )
@@ -0,0 +1,91 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import os
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryLimit(WatchmanTestCase.WatchmanTestCase):
+    def test_limit(self) -> None:
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "dir"))
+        for i in range(10):
+            self.touchRelative(root, "dir", "file%d.txt" % i)
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(
+            root, ["dir"] + ["dir/file%d.txt" % i for i in range(10)]
+        )
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"expression": ["suffix", "txt"], "fields": ["name"], "limit": 3},
+        )
+        self.assertEqual(3, len(res["files"]))
+        self.assertTrue(res["limit_reached"])
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"glob": ["dir/*.txt"], "fields": ["name"], "limit": 20},
+        )
+        self.assertEqual(10, len(res["files"]))
+        self.assertFalse(res["limit_reached"])
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"path": ["dir"], "fields": ["name"], "limit": 2},
+        )
+        self.assertEqual(2, len(res["files"]))
+
+    def test_exists_only(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "a.txt")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a.txt"])
+        clock = self.watchmanCommand("clock", root)["clock"]
+
+        res = self.watchmanCommand(
+            "query", root, {"since": clock, "exists_only": True, "fields": ["name"]}
+        )
+        self.assertFalse(res["exists"])
+        self.assertEqual([], res["files"])
+
+        self.touchRelative(root, "b.txt")
+        self.touchRelative(root, "c.txt")
+        self.assertFileList(root, ["a.txt", "b.txt", "c.txt"])
+
+        res = self.watchmanCommand(
+            "query", root, {"since": clock, "exists_only": True, "fields": ["name"]}
+        )
+        self.assertTrue(res["exists"])
+        self.assertEqual(1, len(res["files"]))
+
+    def test_invalid_limit(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand("query", root, {"limit": 0})
+        self.assertRegex(str(ctx.exception), "limit must be a positive integer")
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand("query", root, {"limit": 1, "exists_only": True})
+        self.assertRegex(
+            str(ctx.exception), "limit cannot be combined with exists_only"
+        )
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand("subscribe", root, "sub", {"limit": 1})
+        self.assertRegex(str(ctx.exception), "not supported by subscriptions")
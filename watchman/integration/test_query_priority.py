@@ -0,0 +1,38 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryPriority(WatchmanTestCase.WatchmanTestCase):
+    def test_batch_query(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "foo")
+        self.watchmanCommand("watch", root)
+
+        before = self.watchmanCommand("debug-query-scheduler")
+        res = self.watchmanCommand(
+            "query", root, {"fields": ["name"], "priority": "batch"}
+        )
+        self.assertEqual(["foo"], res["files"])
+
+        after = self.watchmanCommand("debug-query-scheduler")
+        self.assertGreater(after["admitted_batch"], before["admitted_batch"])
+        self.assertEqual(0, after["queued_batch"])
+        self.assertEqual(0, after["timed_out"])
+
+    def test_bad_priority(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand("query", root, {"priority": "urgent"})
+        self.assertIn("priority must be either", str(ctx.exception))
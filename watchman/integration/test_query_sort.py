@@ -0,0 +1,81 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import os
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQuerySort(WatchmanTestCase.WatchmanTestCase):
+    def test_sort_by_name(self) -> None:
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "a"))
+        self.touchRelative(root, "a", "z.txt")
+        self.touchRelative(root, "a.txt")
+        self.touchRelative(root, "b.txt")
+
+        self.watchmanCommand("watch", root)
+        expected = ["a", "a/z.txt", "a.txt", "b.txt"]
+        self.assertFileList(root, expected)
+
+        res = self.watchmanCommand("query", root, {"fields": ["name"], "sort": "name"})
+        self.assertEqual(expected, res["files"])
+
+        res = self.watchmanCommand(
+            "query", root, {"path": [""], "fields": ["name"], "sort": "name"}
+        )
+        self.assertEqual(expected, res["files"])
+
+        res = self.watchmanCommand(
+            "query", root, {"fields": ["name"], "sort": "name", "limit": 2}
+        )
+        self.assertEqual(expected[:2], res["files"])
+        self.assertTrue(res["limit_reached"])
+
+    def test_sort_by_mtime(self) -> None:
+        root = self.mkdtemp()
+        for i in range(5):
+            self.touchRelative(root, "file%d.txt" % i)
+            os.utime(os.path.join(root, "file%d.txt" % i), (i * 1000, i * 1000))
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["file%d.txt" % i for i in range(5)])
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"expression": ["type", "f"], "fields": ["name"], "sort": "mtime"},
+        )
+        self.assertEqual(
+            ["file%d.txt" % i for i in reversed(range(5))], res["files"]
+        )
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {
+                "expression": ["type", "f"],
+                "fields": ["name", "mtime"],
+                "sort": "mtime",
+                "limit": 2,
+            },
+        )
+        self.assertEqual(
+            ["file4.txt", "file3.txt"], [f["name"] for f in res["files"]]
+        )
+
+    def test_invalid_sort(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand("query", root, {"sort": "size"})
+        self.assertRegex(str(ctx.exception), "sort must be one of")
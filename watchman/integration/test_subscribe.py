@@ -343,6 +343,78 @@ class TestSubscribe(WatchmanTestCase.WatchmanTestCase):
             self.assertTrue(dat["canceled"])
             self.assertTrue(dat["unilateral"])
 
+    def test_identical_subscriptions(self) -> None:
+        """Subscriptions with the same query may share their results; make
+        sure that each of them still sees every change."""
+        root = self.mkdtemp()
+        self.touchRelative(root, "lemon")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["lemon"])
+
+        names = ["same%d" % n for n in range(4)]
+        for name in names:
+            self.watchmanCommand(
+                "subscribe", root, name, {"fields": ["name"], "defer": [name]}
+            )
+            dat = self.waitForSub(name, root, remove=True)
+            self.assertFileListsEqual(dat[0]["files"], ["lemon"])
+
+        for fileName in ["lime", "orange"]:
+            self.touchRelative(root, fileName)
+            for name in names:
+                dat = self.waitForSub(
+                    name,
+                    root=root,
+                    accept=lambda x: self.findSubscriptionContainingFile(
+                        x, fileName
+                    ),
+                )
+                self.assertNotEqual(None, dat)
+                self.assertEqual(False, dat[0]["is_fresh_instance"])
+
+    def test_incremental_subscription(self) -> None:
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"subscription_incremental": True}))
+        os.mkdir(os.path.join(root, "a"))
+        os.mkdir(os.path.join(root, "b"))
+        self.touchRelative(root, "a", "lemon")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=[".watchmanconfig", "a", "a/lemon", "b"])
+
+        self.watchmanCommand(
+            "subscribe",
+            root,
+            "inc",
+            {"fields": ["name"], "expression": ["match", "a/**", "wholename"]},
+        )
+        dat = self.waitForSub("inc", root, remove=True)
+        self.assertFileListsEqual(dat[0]["files"], ["a/lemon"])
+
+        for fileName in ["lime", "orange"]:
+            self.touchRelative(root, "b", fileName)
+            self.touchRelative(root, "a", fileName)
+            dat = self.waitForSub(
+                "inc",
+                root=root,
+                accept=lambda x: self.findSubscriptionContainingFile(
+                    x, "a/" + fileName
+                ),
+            )
+            self.assertNotEqual(None, dat)
+            for sub in dat:
+                self.assertEqual(False, sub["is_fresh_instance"])
+                for name in self.normFileList(sub["files"]):
+                    self.assertTrue(name.startswith("a/"), name)
+
+        os.unlink(os.path.join(root, "a", "lime"))
+        dat = self.waitForSub(
+            "inc",
+            root=root,
+            accept=lambda x: self.findSubscriptionContainingFile(x, "a/lime"),
+        )
+        self.assertNotEqual(None, dat)
+
     def test_subscribe(self) -> None:
         root = self.mkdtemp()
         a_dir = os.path.join(root, "a")
@@ -918,6 +990,55 @@ class TestSubscribe(WatchmanTestCase.WatchmanTestCase):
         dat = self.watchmanCommand("subscribe", root, "my_sub", {"fields": ["name"]})
         self.assertEqual(dat["warning"], "subscription name 'my_sub' is not unique")
 
+    def test_change_feed_batches(self) -> None:
+        root = self.mkdtemp()
+        for name in ("a", "b", "c", "d", "e"):
+            self.touchRelative(root, name)
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["a", "b", "c", "d", "e"])
+
+        self.watchmanCommand(
+            "subscribe",
+            root,
+            "feed",
+            {"change_feed": {"batch_size": 2}, "expression": ["type", "f"]},
+        )
+
+        def haveLastBatch(subdata) -> bool:
+            return any("files" in d and not d.get("partial") for d in subdata)
+
+        dat = self.waitForSub("feed", root, accept=haveLastBatch)
+        batches = [d for d in dat if "files" in d]
+        self.assertEqual(3, len(batches))
+        self.assertEqual([True, True], [d["partial"] for d in batches[:2]])
+        self.assertNotIn("partial", batches[2])
+        names = sorted(f["name"] for d in batches for f in d["files"])
+        self.assertEqual(["a", "b", "c", "d", "e"], names)
+        for key in ("exists", "type", "size", "mtime_ms", "oclock"):
+            self.assertIn(key, batches[0]["files"][0])
+
+        self.touchRelative(root, "f")
+        dat = self.waitForSub(
+            "feed",
+            root,
+            accept=lambda subdata: any(
+                f["name"] == "f" for d in subdata for f in d.get("files", [])
+            ),
+        )
+        self.assertNotEqual(None, dat)
+
+    def test_change_feed_rejects_fields(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand(
+                "subscribe",
+                root,
+                "feed",
+                {"change_feed": True, "fields": ["name"]},
+            )
+        self.assertIn("fields can't be used with change_feed", str(ctx.exception))
+
     def findSubscriptionContainingFile(self, subdata, filename):
         filename = norm_relative_path(filename)
         for dat in subdata:
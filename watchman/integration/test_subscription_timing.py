@@ -0,0 +1,56 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import time
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestSubscriptionTiming(WatchmanTestCase.WatchmanTestCase):
+    def requiresPersistentSession(self) -> bool:
+        return True
+
+    def test_timing_is_opt_in(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        self.watchmanCommand("subscribe", root, "plain", {"fields": ["name"]})
+        dat = self.waitForSub("plain", root)[0]
+        self.assertNotIn("timing", dat)
+
+    def test_stages_are_in_order(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=[])
+
+        self.watchmanCommand(
+            "subscribe",
+            root,
+            "timed",
+            {"fields": ["name"], "timing": True, "empty_on_fresh_instance": True},
+        )
+        self.waitForSub("timed", root)
+
+        written_us = int(time.time() * 1000000)
+        self.touchRelative(root, "a")
+        dat = self.waitForSub(
+            "timed", root, accept=lambda subs: any("a" in s["files"] for s in subs)
+        )
+        timing = [s for s in dat if "a" in s["files"]][0]["timing"]
+
+        stages = [
+            timing["notified_us"],
+            timing["processed_us"],
+            timing["settled_us"],
+            timing["query_start_us"],
+            timing["query_end_us"],
+        ]
+        self.assertEqual(sorted(stages), stages)
+        # Allow for a coarse clock on the test's side
+        self.assertGreater(timing["notified_us"], written_us - 1000000)
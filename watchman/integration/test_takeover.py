@@ -0,0 +1,52 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import os
+import unittest
+
+from watchman.integration.lib import WatchmanInstance, WatchmanTestCase
+
+
+@unittest.skipIf(os.name == "nt", "not supported on windows")
+@WatchmanTestCase.expand_matrix
+class TestTakeover(WatchmanTestCase.WatchmanTestCase):
+    def test_takeover_keeps_socket_and_clocks(self) -> None:
+        config = {"view_snapshot_dir": self.mkdtemp(), "change_journal": True}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            root = self.mkdtemp()
+            self.touchRelative(root, "a")
+
+            client = self.getClient(inst)
+            client.query("watch", root)
+            res = client.query("query", root, {"fields": ["name"]})
+            self.assertEqual(["a"], res["files"])
+            clock = client.query("clock", root)["clock"]
+            old_pid = client.query("get-pid")["pid"]
+            client.close()
+
+            # The new service waits for the old one to exit before returning
+            inst.commandViaCLI(["--takeover"])
+            self.assertEqual(0, inst.proc.wait(timeout=60))
+            inst.proc = None
+
+            client = self.getClient(inst)
+            try:
+                self.assertNotEqual(old_pid, client.query("get-pid")["pid"])
+
+                self.touchRelative(root, "b")
+                res = client.query(
+                    "query", root, {"fields": ["name"], "since": clock}
+                )
+                self.assertFalse(res["is_fresh_instance"])
+                self.assertIn("b", res["files"])
+            finally:
+                # Nothing else knows about the service we started
+                client.query("shutdown-server")
+                client.close()
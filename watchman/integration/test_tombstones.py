@@ -0,0 +1,76 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# pyre-unsafe
+
+
+import os
+import os.path
+import shutil
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestTombstones(WatchmanTestCase.WatchmanTestCase):
+    def changedSince(self, root, clock):
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"since": clock, "fields": ["name", "exists", "type"]},
+        )
+        self.assertFalse(res["is_fresh_instance"])
+        return sorted(
+            (f["name"], f["exists"], f["type"])
+            for f in res["files"]
+            if f["name"] != ".watchmanconfig"
+        )
+
+    @WatchmanTestCase.skip_for(transports=["cli"])
+    def test_deleted_files_are_reported_after_compaction(self) -> None:
+        root = self.mkdtemp()
+
+        os.mkdir(os.path.join(root, "a"))
+        self.touchRelative(root, "a", "file.txt")
+        self.touchRelative(root, "b.txt")
+        self.touchRelative(root, "c.txt")
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a", "a/file.txt", "b.txt", "c.txt"])
+        clock = self.watchmanCommand("clock", root)["clock"]
+
+        shutil.rmtree(os.path.join(root, "a"))
+        os.unlink(os.path.join(root, "b.txt"))
+        self.assertFileList(root, ["c.txt"])
+
+        expected = [
+            ("a", False, "d"),
+            ("a/file.txt", False, "f"),
+            ("b.txt", False, "f"),
+        ]
+        self.assertEqual(expected, self.changedSince(root, clock))
+
+        # The deletions are still reported once the nodes are compacted
+        self.watchmanCommand("debug-compact-tombstones", root, 0)
+        self.assertEqual(expected, self.changedSince(root, clock))
+
+        # A clock from after the deletions doesn't see the tombstones
+        later = self.watchmanCommand("clock", root)["clock"]
+        self.assertEqual([], self.changedSince(root, later))
+
+        # Recreating a file replaces its tombstone
+        self.touchRelative(root, "b.txt")
+        self.assertFileList(root, ["b.txt", "c.txt"])
+        self.assertEqual(
+            [("a", False, "d"), ("a/file.txt", False, "f"), ("b.txt", True, "f")],
+            self.changedSince(root, clock),
+        )
+
+        # Tombstones are aged out along with other deleted files
+        self.watchmanCommand("debug-ageout", root, 0)
+        res = self.watchmanCommand("query", root, {"since": clock, "fields": ["name"]})
+        self.assertTrue(res["is_fresh_instance"])
+        self.assertFileList(root, ["b.txt", "c.txt"])
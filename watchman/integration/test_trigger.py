@@ -13,6 +13,7 @@ import os.path
 import re
 import sys
 
+import pywatchman
 from watchman.integration.lib import HELPER_ROOT, WatchmanTestCase
 
 
@@ -68,6 +69,123 @@ class TestTrigger(WatchmanTestCase.WatchmanTestCase):
             message="both triggers fired on update",
         )
 
+    def test_identicalTriggersEachRun(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=[])
+
+        logs = self.mkdtemp()
+        for i in range(3):
+            res = self.watchmanCommand(
+                "trigger",
+                root,
+                {
+                    "name": "t%d" % i,
+                    "expression": ["suffix", "txt"],
+                    "command": [
+                        sys.executable,
+                        os.path.join(HELPER_ROOT, "trig.py"),
+                        os.path.join(logs, "t%d" % i),
+                    ],
+                    "append_files": True,
+                },
+            )
+            self.assertEqual("created", res["disposition"])
+
+        def all_logged(name):
+            for i in range(3):
+                log = os.path.join(logs, "t%d" % i)
+                if not os.path.exists(log):
+                    return False
+                with open(log) as f:
+                    if name not in f.read():
+                        return False
+            return True
+
+        # The triggers share an evaluation of their query, and each is handed
+        # its results
+        self.touchRelative(root, "a.txt")
+        self.assertWaitFor(lambda: all_logged("a.txt"))
+        self.touchRelative(root, "b.txt")
+        self.assertWaitFor(lambda: all_logged("b.txt"))
+
+    def test_persistentTrigger(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=[])
+
+        trigger_log = os.path.join(root, "trigger.log")
+        res = self.watchmanCommand(
+            "trigger",
+            root,
+            {
+                "name": "persistent",
+                "expression": ["suffix", "c"],
+                "command": [
+                    sys.executable,
+                    os.path.join(HELPER_ROOT, "trigbser.py"),
+                    trigger_log,
+                ],
+                "persistent": True,
+                "stdin": ["name", "exists"],
+            },
+        )
+        self.assertEqual("created", res["disposition"])
+
+        def read_batches():
+            if not os.path.exists(trigger_log):
+                return []
+            with open(trigger_log) as f:
+                return [json.loads(line) for line in f]
+
+        def files_are_listed(files):
+            names = set()
+            for batch in read_batches():
+                names.update(item["name"] for item in batch["files"])
+            return names >= set(files)
+
+        self.touchRelative(root, "foo.c")
+        self.assertWaitFor(lambda: files_are_listed(["foo.c"]))
+        self.touchRelative(root, "bar.c")
+        self.assertWaitFor(lambda: files_are_listed(["foo.c", "bar.c"]))
+
+        batches = read_batches()
+        # One worker received every batch
+        self.assertEqual(1, len({batch["pid"] for batch in batches}))
+        self.assertEqual("persistent", batches[-1]["trigger"])
+        self.assertIn("since", batches[-1])
+        self.assertFalse(batches[-1]["files_overflow"])
+
+    def test_persistentTriggerInvalid(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand(
+                "trigger",
+                root,
+                {
+                    "name": "persistent",
+                    "command": ["true"],
+                    "persistent": True,
+                    "append_files": True,
+                },
+            )
+        self.assertIn("cannot be used with persistent", str(ctx.exception))
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand(
+                "trigger",
+                root,
+                {
+                    "name": "persistent",
+                    "command": ["true"],
+                    "persistent": True,
+                    "stdin": "NAME_PER_LINE",
+                },
+            )
+        self.assertIn("must be a field list", str(ctx.exception))
+
     def validate_trigger_output(self, root, files, context) -> None:
         trigger_log = os.path.join(root, "trigger.log")
         trigger_json = os.path.join(root, "trigger.json")
@@ -7,6 +7,7 @@
 # pyre-unsafe
 
 
+import concurrent.futures
 import os
 
 import pywatchman
@@ -132,3 +133,23 @@ class TestWatchProject(WatchmanTestCase.WatchmanTestCase):
         res = self.watchmanCommand("watch-project", abc)
         self.assertEqual(d, norm_absolute_path(res["watch"]))
         self.assertEqual("a/b/c", norm_relative_path(res["relative_path"]))
+
+    def test_concurrentWatchProject(self) -> None:
+        d = self.mkdtemp()
+        make_empty_watchmanconfig(d)
+        abc = os.path.join(d, "a", "b", "c")
+        os.makedirs(abc, 0o777)
+
+        clients = [self.getClient(no_cache=True) for _ in range(8)]
+        for client in clients:
+            self.addCleanup(client.close)
+        with concurrent.futures.ThreadPoolExecutor(len(clients)) as pool:
+            results = list(
+                pool.map(lambda client: client.query("watch-project", abc), clients)
+            )
+
+        for res in results:
+            self.assertEqual(d, norm_absolute_path(res["watch"]))
+            self.assertEqual("a/b/c", norm_relative_path(res["relative_path"]))
+        roots = self.watchmanCommand("watch-list")["roots"]
+        self.assertEqual(1, [norm_absolute_path(r) for r in roots].count(d))
@@ -0,0 +1,25 @@
+#!/usr/bin/env python
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import json
+import os
+import sys
+
+from pywatchman import load
+
+
+log_file_name = sys.argv[1]
+
+# Append each BSER PDU read from stdin to the log file as a line of json,
+# along with our pid so that tests can tell whether we were restarted
+while True:
+    batch = load.load(sys.stdin.buffer, value_encoding="utf-8")
+    if batch is None:
+        break
+    batch["pid"] = os.getpid()
+    with open(log_file_name, "a") as f:
+        f.write(json.dumps(batch) + "\n")
@@ -56,8 +56,11 @@ void add_root_warnings_to_response(
           "'`\n")));
 }
 
-std::shared_ptr<Root>
-doResolveOrCreateRoot(Client* client, const json_ref& args, bool create) {
+std::shared_ptr<Root> doResolveOrCreateRoot(
+    Client* client,
+    const json_ref& args,
+    bool create,
+    bool clientModeCrawl = true) {
   // Assume root is first element
   size_t root_index = 1;
   if (args.array().size() <= root_index) {
@@ -71,15 +74,18 @@ doResolveOrCreateRoot(Client* client, const json_ref& args, bool create) {
         "invalid value for argument {}, expected a string naming the root dir",
         root_index);
   }
-  return resolveRootByName(client, root_name, create);
+  return resolveRootByName(client, root_name, create, clientModeCrawl);
 }
 
-std::shared_ptr<Root>
-resolveRootByName(Client* client, const char* rootName, bool create) {
+std::shared_ptr<Root> resolveRootByName(
+    Client* client,
+    const char* rootName,
+    bool create,
+    bool clientModeCrawl) {
   try {
     std::shared_ptr<Root> root;
     if (client->client_mode) {
-      root = w_root_resolve_for_client_mode(rootName);
+      root = w_root_resolve_for_client_mode(rootName, clientModeCrawl);
     } else {
       if (!client->client_is_owner) {
         // Only the owner is allowed to create watches
@@ -115,6 +121,12 @@ std::shared_ptr<Root> resolveRoot(Client* client, const json_ref& args) {
   return doResolveOrCreateRoot(client, args, false);
 }
 
+std::shared_ptr<Root> resolveRootWithoutClientModeCrawl(
+    Client* client,
+    const json_ref& args) {
+  return doResolveOrCreateRoot(client, args, false, false);
+}
+
 std::shared_ptr<Root> resolveOrCreateRoot(
     Client* client,
     const json_ref& args) {
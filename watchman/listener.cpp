@@ -8,10 +8,12 @@
 #include "watchman/listener.h"
 #include <folly/Exception.h>
 #include <folly/MapUtil.h>
+#include <folly/ScopeGuard.h>
 #include <folly/SocketAddress.h>
 #include <folly/String.h>
 #include <folly/Synchronized.h>
 #include <folly/net/NetworkSocket.h>
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <optional>
@@ -19,6 +21,8 @@
 #include "watchman/Client.h"
 #include "watchman/Constants.h"
 #include "watchman/GroupLookup.h"
+#include "watchman/PerfSample.h"
+#include "watchman/PhaseTimeline.h"
 #include "watchman/SanityCheck.h"
 #include "watchman/Shutdown.h"
 #include "watchman/SignalHandler.h"
@@ -60,6 +64,95 @@ void w_listener_prep_inetd() {
       FileDescriptor::FDType::Unknown);
 }
 
+// A duplicate of the unix domain listening socket, which takeover-server
+// hands to the service that replaces this one.
+static folly::Synchronized<FileDescriptor> takeover_listener_fd;
+
+// Asks the running service to hand over its listening socket and remembers
+// it, like w_listener_prep_inetd, for when we start up the listener.
+// Connections made while we start up queue on the socket rather than being
+// refused.  The running service exits once it has saved its state, views and
+// journals, so the caller must wait for it to release the pidfile lock before
+// loading them.
+bool w_listener_prep_takeover() {
+  if (listener_fd) {
+    throw std::runtime_error(
+        "w_listener_prep_takeover: listener_fd is already assigned");
+  }
+
+  const auto& path = get_unix_sock_name();
+  auto stmResult = w_stm_connect_unix(path.c_str(), 0);
+  if (stmResult.hasError()) {
+    logf(
+        ERR,
+        "takeover: unable to connect to {}: {}\n",
+        path,
+        folly::errnoStr(stmResult.error()));
+    return false;
+  }
+  auto& stm = stmResult.value();
+  stm->setNonBlock(false);
+
+  static constexpr std::string_view kRequest = "[\"takeover-server\"]\n";
+  if (stm->write(kRequest.data(), kRequest.size()) != int(kRequest.size())) {
+    logf(
+        ERR,
+        "takeover: unable to send the request: {}\n",
+        folly::errnoStr(errno));
+    return false;
+  }
+
+  // The response is a single JSON line, with the listening socket attached
+  // to its first byte unless it is an error.
+  int sock = stm->getFileDescriptor().fd();
+  FileDescriptor received;
+  std::string response;
+  while (response.find('\n') == std::string::npos) {
+    char buf[1024];
+    struct iovec iov {
+      buf, sizeof(buf)
+    };
+    struct msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t len;
+    do {
+      len = ::recvmsg(sock, &msg, 0);
+    } while (len == -1 && errno == EINTR);
+    if (len <= 0) {
+      break;
+    }
+
+    for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+          cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+        int fd;
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+        received = FileDescriptor(fd, FileDescriptor::FDType::Socket);
+      }
+    }
+    response.append(buf, len);
+  }
+
+  if (!received) {
+    logf(
+        ERR,
+        "takeover: the running service didn't hand over its socket: {}\n",
+        response.empty() ? std::string("no response") : response);
+    return false;
+  }
+
+  received.setCloExec();
+  logf(ERR, "takeover: received the listening socket for {}\n", path);
+  listener_fd = std::move(received);
+  return true;
+}
+
 #endif
 
 static FileDescriptor get_listener_unix_domain_socket(const char* path) {
@@ -163,72 +256,133 @@ static FileDescriptor create_pipe_server(const char* path) {
       FileDescriptor::FDType::Pipe);
 }
 
-static void named_pipe_accept_loop_internal(
-    std::shared_ptr<watchman_event> listener_event) {
-  HANDLE handles[2];
-  auto olap = OVERLAPPED();
-  HANDLE connected_event = CreateEvent(nullptr, FALSE, TRUE, nullptr);
-  auto path = get_named_pipe_sock_path();
+namespace {
+// An instance of the pipe that a client can connect to
+struct PendingPipe {
+  FileDescriptor pipe;
+  OVERLAPPED olap{};
+  HANDLE connected{nullptr};
+  bool armed{false};
+};
 
-  if (!connected_event) {
+// Creates a fresh instance of the pipe and starts an overlapped connect on
+// it.  A client that connects before the connect is issued signals the event
+// as well, so the caller only has to wait for it.
+void arm_pipe(PendingPipe& pending, const std::string& path) {
+  pending.armed = false;
+  pending.pipe = create_pipe_server(path.c_str());
+  if (!pending.pipe) {
     logf(
         ERR,
-        "named_pipe_accept_loop_internal: CreateEvent failed: {}\n",
+        "CreateNamedPipe({}) failed: {}\n",
+        path,
         win32_strerror(GetLastError()));
     return;
   }
 
-  handles[0] = connected_event;
-  handles[1] = (HANDLE)listener_event->system_handle();
-  olap.hEvent = connected_event;
+  ResetEvent(pending.connected);
+  pending.olap = OVERLAPPED();
+  pending.olap.hEvent = pending.connected;
+  if (!ConnectNamedPipe((HANDLE)pending.pipe.handle(), &pending.olap)) {
+    auto res = GetLastError();
+    if (res == ERROR_PIPE_CONNECTED) {
+      SetEvent(pending.connected);
+    } else if (res != ERROR_IO_PENDING) {
+      logf(ERR, "ConnectNamedPipe: {}\n", win32_strerror(res));
+      pending.pipe = FileDescriptor();
+      return;
+    }
+  } else {
+    SetEvent(pending.connected);
+  }
+  pending.armed = true;
+}
+} // namespace
 
-  logf(ERR, "waiting for pipe clients on {}\n", path);
-  while (!w_is_stopping()) {
-    FileDescriptor client_fd;
-    DWORD res;
+// Keeps numPipes instances of the pipe waiting for clients.  An instance
+// that a client connected to is replaced before the client is started, so a
+// burst of clients finds instances to connect to rather than timing out.
+static void named_pipe_accept_loop_internal(
+    std::shared_ptr<watchman_event> listener_event,
+    size_t numPipes) {
+  auto path = get_named_pipe_sock_path();
+  std::vector<PendingPipe> pipes(numPipes);
+  std::vector<HANDLE> handles;
+  SCOPE_EXIT {
+    for (auto& pending : pipes) {
+      if (pending.armed) {
+        DWORD ignored;
+        CancelIoEx((HANDLE)pending.pipe.handle(), &pending.olap);
+        GetOverlappedResult(
+            (HANDLE)pending.pipe.handle(), &pending.olap, &ignored, TRUE);
+      }
+      if (pending.connected) {
+        CloseHandle(pending.connected);
+      }
+    }
+  };
 
-    client_fd = create_pipe_server(path.c_str());
-    if (!client_fd) {
+  for (auto& pending : pipes) {
+    pending.connected = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (!pending.connected) {
       logf(
           ERR,
-          "CreateNamedPipe(%s) failed: %s\n",
-          path,
+          "named_pipe_accept_loop_internal: CreateEvent failed: {}\n",
           win32_strerror(GetLastError()));
-      continue;
+      return;
     }
+    handles.push_back(pending.connected);
+    arm_pipe(pending, path);
+  }
+  handles.push_back((HANDLE)listener_event->system_handle());
 
-    ResetEvent(connected_event);
-    if (!ConnectNamedPipe((HANDLE)client_fd.handle(), &olap)) {
-      res = GetLastError();
-
-      if (res == ERROR_PIPE_CONNECTED) {
-        UserClient::create(w_stm_fdopen(std::move(client_fd)));
-        continue;
-      }
+  logf(ERR, "waiting for pipe clients on {}\n", path);
+  while (!w_is_stopping()) {
+    // Instances that couldn't be created are retried every second.
+    bool allArmed =
+        std::all_of(pipes.begin(), pipes.end(), [](const auto& pending) {
+          return pending.armed;
+        });
+    auto res = WaitForMultipleObjectsEx(
+        handles.size(),
+        handles.data(),
+        false,
+        allArmed ? INFINITE : 1000,
+        true);
+    if (res == WAIT_OBJECT_0 + pipes.size()) {
+      // Signalled to stop
+      break;
+    }
+    if (res == WAIT_FAILED) {
+      logf(
+          ERR,
+          "WaitForMultipleObjectsEx: ConnectNamedPipe: {}\n",
+          win32_strerror(GetLastError()));
+      break;
+    }
 
-      if (res != ERROR_IO_PENDING) {
-        logf(ERR, "ConnectNamedPipe: {}\n", win32_strerror(GetLastError()));
+    // The wait reports only the first instance with a client. Take every
+    // one that has a client so that none of them wait behind it.
+    for (auto& pending : pipes) {
+      if (!pending.armed) {
+        arm_pipe(pending, path);
         continue;
       }
-
-      res = WaitForMultipleObjectsEx(2, handles, false, INFINITE, true);
-      if (res == WAIT_OBJECT_0 + 1) {
-        // Signalled to stop
-        CancelIoEx((HANDLE)client_fd.handle(), &olap);
+      if (WaitForSingleObject(pending.connected, 0) != WAIT_OBJECT_0) {
         continue;
       }
-
-      if (res != WAIT_OBJECT_0) {
-        logf(
-            ERR,
-            "WaitForMultipleObjectsEx: ConnectNamedPipe: "
-            "unexpected status {}\n",
-            res);
-        CancelIoEx((HANDLE)client_fd.handle(), &olap);
+      DWORD ignored;
+      bool connected = GetOverlappedResult(
+          (HANDLE)pending.pipe.handle(), &pending.olap, &ignored, FALSE);
+      auto err = GetLastError();
+      auto client_fd = std::move(pending.pipe);
+      arm_pipe(pending, path);
+      if (!connected) {
+        logf(ERR, "ConnectNamedPipe: {}\n", win32_strerror(err));
         continue;
       }
+      UserClient::create(w_stm_fdopen(std::move(client_fd)));
     }
-    UserClient::create(w_stm_fdopen(std::move(client_fd)));
   }
   logf(ERR, "is_stopping is true, so acceptor is done\n");
 }
@@ -239,11 +393,19 @@ static void named_pipe_accept_loop() {
   std::shared_ptr<watchman_event> listener_event = w_event_make_named_pipe();
   w_push_listener_thread_event(listener_event);
 
+  // A thread waits on its instances and the listener event, and a single
+  // wait takes at most MAXIMUM_WAIT_OBJECTS handles.
+  constexpr size_t kMaxPipesPerThread = MAXIMUM_WAIT_OBJECTS - 1;
+  size_t numPipes =
+      std::max<json_int_t>(1, cfg_get_int("win32_concurrent_accepts", 32));
+
   std::vector<std::thread> acceptors;
-  for (json_int_t i = 0; i < cfg_get_int("win32_concurrent_accepts", 32); ++i) {
-    acceptors.push_back(std::thread([i, listener_event]() {
+  for (size_t i = 0; numPipes > 0; ++i) {
+    size_t n = std::min(numPipes, kMaxPipesPerThread);
+    numPipes -= n;
+    acceptors.push_back(std::thread([i, n, listener_event]() {
       w_set_thread_name("accept", i);
-      named_pipe_accept_loop_internal(listener_event);
+      named_pipe_accept_loop_internal(listener_event, n);
     }));
   }
   for (auto& thr : acceptors) {
@@ -362,7 +524,18 @@ class AcceptLoop {
   bool joined_{false};
 };
 
+// Logs where the time went between the start of the process and being
+// ready to accept clients.
+static void logStartupTimeline() {
+  PerfSample sample("startup");
+  sample.add_meta("startup", getStartupTimeline().toJson());
+  sample.finish();
+  sample.force_log();
+  sample.log();
+}
+
 bool w_start_listener() {
+  auto listenerStart = std::chrono::steady_clock::now();
 #ifndef _WIN32
   struct sigaction sa;
   sigset_t sigset;
@@ -469,8 +642,9 @@ bool w_start_listener() {
   };
 
   if (listener_fd) {
-    // Assume that it was prepped by w_listener_prep_inetd()
-    logf(ERR, "Using socket from inetd as listening socket\n");
+    // Assume that it was prepped by w_listener_prep_inetd() or
+    // w_listener_prep_takeover()
+    logf(ERR, "Using provided socket as listening socket\n");
   } else {
     listener_fd = get_listener_unix_domain_socket(get_unix_sock_name().c_str());
     if (!listener_fd) {
@@ -480,6 +654,16 @@ bool w_start_listener() {
   }
 
   if (listener_fd && !disable_unix_socket) {
+#ifndef _WIN32
+    {
+      auto takeover = takeover_listener_fd.wlock();
+      *takeover = FileDescriptor(
+          dup(listener_fd.fd()),
+          "dup listener for takeover",
+          FileDescriptor::FDType::Socket);
+      takeover->setCloExec();
+    }
+#endif
     unix_loop = AcceptLoop("unix-listener", std::move(listener_fd));
   }
 
@@ -487,6 +671,9 @@ bool w_start_listener() {
     startSanityCheckThread();
   }
 
+  getStartupTimeline().record("listener", listenerStart);
+  logStartupTimeline();
+
 #ifdef _WIN32
   // Start the named pipes and join them; this will
   // block until the server is shutdown.
@@ -557,5 +744,66 @@ static UntypedResponse cmd_get_pid(Client*, const json_ref&) {
 }
 W_CMD_REG("get-pid", cmd_get_pid, CMD_DAEMON, nullptr);
 
+#ifndef _WIN32
+/* takeover-server
+ * Hands the listening socket to the service that sent this and then exits,
+ * saving the state, views and journals that the new service picks up.  The
+ * response is written as a single JSON line with the socket attached. */
+static UntypedResponse cmd_takeover_server(Client* client, const json_ref&) {
+  // This writes straight to the socket, so nothing may be queued ahead
+  if (!client->stm || client->client_mode || !client->responses.empty() ||
+      !client->stm->canPassDescriptors()) {
+    throw ErrorResponse(
+        "takeover-server must be sent over a unix domain socket");
+  }
+  if (client->format.type != is_json_compact &&
+      client->format.type != is_json_pretty) {
+    throw ErrorResponse("takeover-server must be sent as JSON");
+  }
+
+  auto listener = takeover_listener_fd.wlock();
+  if (!*listener) {
+    throw ErrorResponse("there is no listening socket to hand over");
+  }
+
+  UntypedResponse resp;
+  resp.set("takeover-server", json_true());
+  auto line = json_dumps(std::move(resp).toJson(), JSON_COMPACT) + "\n";
+
+  client->stm->setNonBlock(false);
+  SCOPE_EXIT {
+    client->stm->setNonBlock(true);
+  };
+  int wrote =
+      client->stm->writeWithDescriptor(line.data(), line.size(), *listener);
+  while (wrote > 0 && size_t(wrote) < line.size()) {
+    int x = client->stm->write(line.data() + wrote, line.size() - wrote);
+    if (x <= 0) {
+      break;
+    }
+    wrote += x;
+  }
+  if (wrote <= 0) {
+    // Nothing went out, so the socket wasn't handed over either
+    throw ErrorResponse(
+        "failed to hand over the listening socket: {}",
+        folly::errnoStr(errno));
+  }
+
+  *listener = FileDescriptor();
+  logf(
+      ERR,
+      "takeover-server was requested, handed over the listening socket, "
+      "exiting!\n");
+  w_request_shutdown();
+  throw ResponseWasHandledManually{};
+}
+W_CMD_REG(
+    "takeover-server",
+    cmd_takeover_server,
+    CMD_DAEMON | CMD_POISON_IMMUNE,
+    nullptr);
+#endif
+
 /* vim:ts=2:sw=2:et:
  */
@@ -10,4 +10,5 @@
 #include "watchman/fs/FileDescriptor.h"
 
 void w_listener_prep_inetd();
+bool w_listener_prep_takeover();
 bool w_start_listener();
@@ -14,6 +14,7 @@
 #include <folly/init/Init.h>
 #include <folly/net/NetworkSocket.h>
 #include <folly/portability/Fcntl.h>
+#include <folly/system/HardwareConcurrency.h>
 #include <folly/system/Shell.h>
 
 #include <stdio.h>
@@ -29,8 +30,11 @@
 #include "watchman/Options.h"
 #include "watchman/PDU.h"
 #include "watchman/PerfSample.h"
+#include "watchman/PhaseTimeline.h"
 #include "watchman/ProcessLock.h"
 #include "watchman/ProcessUtil.h"
+#include "watchman/SpawnHelper.h"
+#include "watchman/ThreadPlacement.h"
 #include "watchman/ThreadPool.h"
 #include "watchman/UserDir.h"
 #include "watchman/WatchmanConfig.h"
@@ -40,6 +44,7 @@
 #include "watchman/root/watchlist.h"
 #include "watchman/sockname.h"
 #include "watchman/state.h"
+#include "watchman/telemetry/InstrumentedMutex.h"
 #include "watchman/watchman_cmd.h"
 #include "watchman/watchman_stream.h"
 
@@ -80,6 +85,8 @@ const std::string& get_pid_file() {
 } // namespace
 
 W_CAP_REG("bser-v2")
+W_CAP_REG("bser-columns")
+W_CAP_REG("bser-compression")
 
 /**
  * Log and fatal if Watchman was started with a low priority, which can cause a
@@ -200,14 +207,46 @@ std::optional<std::string> detect_starting_command(pid_t ppid) {
   }
 #endif
 
+  // Fork the spawn helper while we are still small; triggers and SCM
+  // commands are spawned through it once the views have grown large.
+  if (cfg_get_bool("spawn_helper", true)) {
+    watchman::SpawnHelper::start();
+  }
+
   bool res = false;
   {
+    watchman::setLockStatsEnabled(cfg_get_bool("lock_contention_stats", false));
+    if (cfg_get_bool("async_logging", false)) {
+      watchman::getLog().startAsync(cfg_get_int("async_logging_buffer_size", 4096));
+    }
+    // One pool serves query fan-out, symlink reads, parallel crawls and
+    // content hashing for every root.  When the pool is pinned to a set of
+    // CPUs, it is sized to that set rather than to the whole machine.
+    auto poolStart = std::chrono::steady_clock::now();
+    auto poolCpus = watchman::threadRoleConcurrency(watchman::ThreadRole::Pool);
     watchman::getThreadPool().start(
-        cfg_get_int("thread_pool_worker_threads", 16),
-        cfg_get_int("thread_pool_max_items", 1024 * 1024));
+        cfg_get_int(
+            "thread_pool_worker_threads",
+            poolCpus < folly::hardware_concurrency()
+                ? std::max<json_int_t>(4, poolCpus)
+                : std::max<json_int_t>(16, folly::hardware_concurrency())),
+        cfg_get_int("thread_pool_max_items", 1024 * 1024),
+        "ThreadPool-",
+        watchman::ThreadRole::Pool);
+    // Triggers wait on the query work they queue to the shared pool, so
+    // they get a small pool of their own.
+    watchman::getTriggerThreadPool().start(
+        std::max<json_int_t>(1, cfg_get_int("trigger_pool_threads", 4)),
+        cfg_get_int("thread_pool_max_items", 1024 * 1024),
+        "TriggerPool-");
+    watchman::getStartupTimeline().record("thread_pool", poolStart);
 
     ClockSpec::init();
+    // Restoring the saved state re-watches its roots.  Their watchers are
+    // set up here, but they are crawled on their own IO threads.
+    auto stateStart = std::chrono::steady_clock::now();
     w_state_load();
+    watchman::getStartupTimeline().record("state_load", stateStart);
     SCOPE_EXIT {
       w_state_shutdown();
     };
@@ -217,6 +256,7 @@ std::optional<std::string> detect_starting_command(pid_t ppid) {
     cfg_shutdown();
   }
 
+  watchman::getLog().stopAsync();
   log(ERR, "Exiting from service with res=", res, "\n");
 
   if (res) {
@@ -266,12 +306,35 @@ static void close_random_fds() {
 #endif
 }
 
+#ifndef _WIN32
+// How long the service that we take over from has to save its state and exit
+constexpr std::chrono::seconds kTakeoverTimeout{60};
+#endif
+
+/**
+ * If we were asked to, takes over the listening socket of the running
+ * service, which then saves its state and exits.  Returns how long to wait
+ * for it to release the pidfile lock.
+ */
+static std::chrono::milliseconds prep_takeover() {
+#ifndef _WIN32
+  if (flags.takeover) {
+    if (!w_listener_prep_takeover()) {
+      log(ERR, "Failed to take over from the running service\n");
+      exit(1);
+    }
+    return kTakeoverTimeout;
+  }
+#endif
+  return std::chrono::milliseconds::zero();
+}
+
 [[noreturn]] static void run_service_in_foreground() {
   detect_low_process_priority();
   close_random_fds();
 
   auto& pid_file = get_pid_file();
-  auto processLock = ProcessLock::acquire(pid_file);
+  auto processLock = ProcessLock::acquire(pid_file, prep_takeover());
   run_service(processLock.writePid(pid_file), getppid());
 }
 
@@ -315,7 +378,8 @@ static SpawnResult run_service_as_daemon() {
   // and returned (for logging) before we drop stderr. This prevents failure to
   // lock from causing the daemonize process to start and immediately exit with
   // an error, making it hard to track down why a command isn't succeeding.
-  auto acquireResult = ProcessLock::tryAcquire(get_pid_file());
+  auto acquireResult =
+      ProcessLock::tryAcquire(get_pid_file(), prep_takeover());
   if (auto* reason = std::get_if<std::string>(&acquireResult)) {
     return SpawnResult{SpawnResult::FailedToLock, *reason};
   }
@@ -848,24 +912,17 @@ static void setup_sock_name() {
       /*require_absolute=*/logging::log_name != "-");
 }
 
-static ResultErrno<folly::Unit> try_command(
+static ResultErrno<folly::Unit> run_command(
     const Command& command,
-    int timeout) {
-  auto stmResult = w_stm_connect(timeout * 1000);
-  if (stmResult.hasError()) {
-    return stmResult.error();
-  }
-
+    Stream& stream) {
   if (command.isNullCommand()) {
     // We've confirmed we can connect -- there's nothing else to do with the
     // null command.
     return folly::unit;
   }
 
-  auto stream = std::move(stmResult).value();
-
   return command.run(
-      *stream,
+      stream,
       flags.persistent,
       server_format,
       output_format,
@@ -873,6 +930,17 @@ static ResultErrno<folly::Unit> try_command(
                        : (flags.no_pretty ? Pretty::No : Pretty::IfTty));
 }
 
+static ResultErrno<folly::Unit> try_command(
+    const Command& command,
+    int timeout) {
+  auto stmResult = w_stm_connect(timeout * 1000);
+  if (stmResult.hasError()) {
+    return stmResult.error();
+  }
+
+  return run_command(command, *stmResult.value());
+}
+
 static bool try_client_mode_command(const Command& command, bool pretty) {
   auto client = std::make_shared<watchman::Client>();
   client->client_mode = true;
@@ -891,12 +959,9 @@ static bool try_client_mode_command(const Command& command, bool pretty) {
 }
 
 static std::vector<std::string> parse_cmdline(int* argcp, char*** argvp) {
-  cfg_load_global_config_file();
-
   auto daemon_argv = watchman::parseOptions(argcp, argvp);
   watchman::getLog().setStdErrLoggingLevel(
       static_cast<watchman::LogLevel>(logging::log_level));
-  setup_sock_name();
   parse_encoding(flags.server_encoding, &server_format.type);
   parse_encoding(flags.output_encoding, &output_format.type);
   if (flags.output_encoding.empty()) {
@@ -912,6 +977,52 @@ static std::vector<std::string> parse_cmdline(int* argcp, char*** argvp) {
   return daemon_argv;
 }
 
+/**
+ * Loads the config and sets up the state dir.  Only the server, and clients
+ * that can't reach a running server, need to do this.
+ */
+static void load_config_and_sock_name() {
+  static bool loaded = false;
+  if (loaded) {
+    return;
+  }
+  loaded = true;
+  auto start = std::chrono::steady_clock::now();
+  cfg_load_global_config_file();
+  setup_sock_name();
+  watchman::getStartupTimeline().record("config", start);
+}
+
+/**
+ * Connects to an already running server through its unix domain socket,
+ * without loading the config or setting up the state dir.  Returns nullptr
+ * if that isn't possible, in which case the client should set up as usual.
+ */
+static std::unique_ptr<Stream> try_connect_to_running_server() {
+#ifdef _WIN32
+  // Choosing between unix domain sockets and named pipes needs the config
+  return nullptr;
+#else
+  std::string sockname = flags.unix_sock_name;
+  if (sockname.empty()) {
+    auto existing = getExistingUnixSockName(computeUserName());
+    if (!existing) {
+      return nullptr;
+    }
+    sockname = std::move(*existing);
+  } else if (!w_string_piece(sockname).pathIsAbsolute()) {
+    // Leave it to setup_sock_name to report
+    return nullptr;
+  }
+
+  auto stm = w_stm_connect_unix(sockname.c_str(), 0);
+  if (stm.hasError()) {
+    return nullptr;
+  }
+  return std::move(stm).value();
+#endif
+}
+
 static Command build_command_from_stdin() {
   auto err = json_error_t();
   PduBuffer buf;
@@ -1031,6 +1142,22 @@ static int inner_main(int argc, char** argv) {
 
   auto daemon_argv = parse_cmdline(&argc, &argv);
 
+  // Most invocations talk to a server that is already running, so try that
+  // first and only pay for loading the config when it fails.
+  // A takeover talks to the running server only once it has set up to
+  // replace it.
+  bool connect_first = !flags.foreground;
+#ifndef _WIN32
+  connect_first = connect_first && !flags.takeover;
+#endif
+  std::unique_ptr<Stream> stream;
+  if (connect_first) {
+    stream = try_connect_to_running_server();
+  }
+  if (!stream) {
+    load_config_and_sock_name();
+  }
+
 #ifdef _WIN32
   // On Windows its not possible to connect to elevated Watchman daemon from
   // non-elevated processes. To ensure that Watchman daemon will always be
@@ -1047,6 +1174,13 @@ static int inner_main(int argc, char** argv) {
     return 0;
   }
 
+#ifndef _WIN32
+  if (flags.takeover) {
+    run_service_as_daemon().exitIfFailed();
+    return 0;
+  }
+#endif
+
   w_set_thread_name("cli");
   auto cmd = build_command(argc, argv);
   cmd.validateOrExit(output_format);
@@ -1055,7 +1189,12 @@ static int inner_main(int argc, char** argv) {
     return err == ECONNREFUSED || err == ENOENT;
   };
 
-  auto ran = try_command(cmd, 0);
+  auto ran = stream ? run_command(cmd, *stream) : try_command(cmd, 0);
+  stream.reset();
+  if (ran.hasError()) {
+    // Spawning a server and reporting the error both need the config
+    load_config_and_sock_name();
+  }
   if (ran.hasError() && should_start(ran.error())) {
     if (flags.no_spawn) {
       if (!flags.no_local) {
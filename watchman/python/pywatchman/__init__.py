@@ -14,6 +14,7 @@ import time
 import typing
 
 from . import capabilities, encoding
+from .pybser import BSER_CAP_COLUMNS
 
 
 # Sometimes it's really hard to get Python extensions to compile,
@@ -730,7 +731,9 @@ class Bser2WithFallbackCodec(BserCodec):
         )
         bserv2_key = "required"
 
-        self.send(["version", {bserv2_key: ["bser-v2"]}])
+        self.send(
+            ["version", {bserv2_key: ["bser-v2"], "optional": ["bser-columns"]}]
+        )
 
         capabilities = self.receive()
 
@@ -743,6 +746,11 @@ class Bser2WithFallbackCodec(BserCodec):
         if capabilities["capabilities"]["bser-v2"]:
             self.bser_version = 2
             self.bser_capabilities = 0
+            # Large query results are much smaller as columns, and both
+            # decoders understand them. Servers answer every optional
+            # capability that they are asked about.
+            if capabilities["capabilities"]["bser-columns"]:
+                self.bser_capabilities |= BSER_CAP_COLUMNS
         else:
             self.bser_version = 1
             self.bser_capabilities = 0
@@ -521,6 +521,346 @@ bunser_template(const char** ptr, const char* end, const unser_ctx_t* ctx) {
   return arrval;
 }
 
+// The size of the integers of the given type, or 0 if it isn't one
+static int bser_int_size(char type) {
+  switch (type) {
+    case BSER_INT8:
+      return 1;
+    case BSER_INT16:
+      return 2;
+    case BSER_INT32:
+      return 4;
+    case BSER_INT64:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+static int64_t bser_raw_int(char type, const char* buf) {
+  int8_t i8;
+  int16_t i16;
+  int32_t i32;
+  int64_t i64;
+
+  switch (type) {
+    case BSER_INT8:
+      memcpy(&i8, buf, sizeof(i8));
+      return i8;
+    case BSER_INT16:
+      memcpy(&i16, buf, sizeof(i16));
+      return i16;
+    case BSER_INT32:
+      memcpy(&i32, buf, sizeof(i32));
+      return i32;
+    default:
+      memcpy(&i64, buf, sizeof(i64));
+      return i64;
+  }
+}
+
+// Reads an integer type followed by count integers of that type that have
+// no type byte of their own.  Sets *values to the first of them.
+static int bunser_raw_ints(
+    const char** ptr,
+    const char* end,
+    int64_t count,
+    char* type,
+    const char** values) {
+  const char* buf = *ptr;
+  int size;
+
+  if (buf >= end) {
+    PyErr_SetString(PyExc_ValueError, "input buffer too small");
+    return 0;
+  }
+  *type = buf[0];
+  size = bser_int_size(*type);
+  if (!size) {
+    PyErr_Format(
+        PyExc_ValueError, "invalid bser int encoding 0x%02x", buf[0]);
+    return 0;
+  }
+  if (count > (end - buf - 1) / size) {
+    PyErr_SetString(PyExc_ValueError, "input buffer too small for column");
+    return 0;
+  }
+  *values = buf + 1;
+  *ptr = buf + 1 + count * size;
+  return 1;
+}
+
+// Stores the value of key for the object at index i of a columnar array.
+// Steals ele.
+static int set_column_value(
+    PyObject* objs,
+    int mutable,
+    Py_ssize_t i,
+    PyObject* key,
+    Py_ssize_t keyidx,
+    PyObject* ele) {
+  PyObject* obj;
+  int error;
+
+  if (!ele) {
+    return 0;
+  }
+  obj = PyList_GET_ITEM(objs, i);
+  if (mutable) {
+    error = PyDict_SetItem(obj, key, ele);
+    Py_DECREF(ele);
+    return error == 0;
+  }
+  PyTuple_SET_ITEM(((bserObject*)obj)->values, keyidx, ele);
+  return 1;
+}
+
+static int bunser_column(
+    const char** ptr,
+    const char* end,
+    const unser_ctx_t* ctx,
+    PyObject* objs,
+    PyObject* key,
+    Py_ssize_t keyidx) {
+  Py_ssize_t nitems = PyList_GET_SIZE(objs);
+  int mutable = ctx->is_mutable;
+  Py_ssize_t i;
+  char kind;
+
+  if (*ptr >= end) {
+    PyErr_SetString(PyExc_ValueError, "input buffer too small");
+    return 0;
+  }
+  kind = **ptr;
+  *ptr = *ptr + 1;
+
+  switch (kind) {
+    case BSER_ARRAY:
+      for (i = 0; i < nitems; i++) {
+        PyObject* ele;
+        if (*ptr >= end) {
+          PyErr_SetString(PyExc_ValueError, "input buffer too small");
+          return 0;
+        }
+        if (**ptr == BSER_SKIP) {
+          *ptr = *ptr + 1;
+          ele = Py_None;
+          Py_INCREF(ele);
+        } else {
+          ele = bser_loads_recursive(ptr, end, ctx);
+        }
+        if (!set_column_value(objs, mutable, i, key, keyidx, ele)) {
+          return 0;
+        }
+      }
+      return 1;
+
+    case BSER_TRUE: {
+      const char* bits = *ptr;
+      if ((nitems + 7) / 8 > end - bits) {
+        PyErr_SetString(PyExc_ValueError, "input buffer too small for column");
+        return 0;
+      }
+      *ptr = bits + (nitems + 7) / 8;
+      for (i = 0; i < nitems; i++) {
+        PyObject* ele = ((bits[i / 8] >> (i % 8)) & 1) ? Py_True : Py_False;
+        Py_INCREF(ele);
+        if (!set_column_value(objs, mutable, i, key, keyidx, ele)) {
+          return 0;
+        }
+      }
+      return 1;
+    }
+
+    case BSER_BYTESTRING:
+    case BSER_UTF8STRING: {
+      char prefix_type, suffix_type;
+      const char* prefixes;
+      const char* suffixes;
+      int prefix_size, suffix_size;
+      char* value = NULL;
+      int64_t len = 0, cap = 0;
+
+      if (!bunser_raw_ints(ptr, end, nitems, &prefix_type, &prefixes) ||
+          !bunser_raw_ints(ptr, end, nitems, &suffix_type, &suffixes)) {
+        return 0;
+      }
+      prefix_size = bser_int_size(prefix_type);
+      suffix_size = bser_int_size(suffix_type);
+
+      for (i = 0; i < nitems; i++) {
+        int64_t prefix = bser_raw_int(prefix_type, prefixes + i * prefix_size);
+        int64_t suffix = bser_raw_int(suffix_type, suffixes + i * suffix_size);
+        PyObject* ele;
+
+        if (prefix < 0 || prefix > len || suffix < 0 ||
+            suffix > end - *ptr || prefix + suffix > LONG_MAX) {
+          PyErr_SetString(
+              PyExc_ValueError, "invalid string lengths in bser column");
+          PyMem_Free(value);
+          return 0;
+        }
+        len = prefix + suffix;
+        if (len > cap) {
+          char* grown = PyMem_Realloc(value, (size_t)(len * 2));
+          if (!grown) {
+            PyMem_Free(value);
+            PyErr_NoMemory();
+            return 0;
+          }
+          value = grown;
+          cap = len * 2;
+        }
+        memcpy(value + prefix, *ptr, (size_t)suffix);
+        *ptr = *ptr + suffix;
+
+        if (kind == BSER_UTF8STRING) {
+          ele = PyUnicode_Decode(value, (long)len, "utf-8", "strict");
+        } else if (ctx->value_encoding != NULL) {
+          ele = PyUnicode_Decode(
+              value, (long)len, ctx->value_encoding, ctx->value_errors);
+        } else {
+          ele = PyBytes_FromStringAndSize(value, (long)len);
+        }
+        if (!set_column_value(objs, mutable, i, key, keyidx, ele)) {
+          PyMem_Free(value);
+          return 0;
+        }
+      }
+      PyMem_Free(value);
+      return 1;
+    }
+
+    default: {
+      // Each integer is the difference from the previous one
+      char type;
+      const char* deltas;
+      int size;
+      uint64_t ival = 0;
+
+      *ptr = *ptr - 1;
+      if (!bunser_raw_ints(ptr, end, nitems, &type, &deltas)) {
+        return 0;
+      }
+      size = bser_int_size(type);
+      for (i = 0; i < nitems; i++) {
+        ival += (uint64_t)bser_raw_int(type, deltas + i * size);
+        if (!set_column_value(
+                objs,
+                mutable,
+                i,
+                key,
+                keyidx,
+                PyLong_FromLongLong((long long)(int64_t)ival))) {
+          return 0;
+        }
+      }
+      return 1;
+    }
+  }
+}
+
+// Columns hold the values of one key for every object in turn; see
+// "Columns of Templated Objects" in the BSER documentation
+static PyObject*
+bunser_columns(const char** ptr, const char* end, const unser_ctx_t* ctx) {
+  const char* buf = *ptr;
+  int64_t nitems, i;
+  int mutable = ctx->is_mutable;
+  PyObject* objs;
+  PyObject* keys;
+  Py_ssize_t numkeys, keyidx;
+  unser_ctx_t keys_ctx = {0};
+  if (mutable) {
+    keys_ctx.is_mutable = 1;
+    // Decode keys as UTF-8 in this case.
+    keys_ctx.value_encoding = "utf-8";
+    keys_ctx.value_errors = "strict";
+  }
+
+  if (buf + 1 >= end) {
+    PyErr_SetString(
+        PyExc_ValueError, "input buffer to small for columns encoding");
+    return 0;
+  }
+
+  if (buf[1] != BSER_ARRAY) {
+    PyErr_Format(PyExc_ValueError, "Expect ARRAY to follow COLUMNS");
+    return NULL;
+  }
+
+  // skip header
+  buf++;
+  *ptr = buf;
+
+  keys = bunser_array(ptr, end, &keys_ctx);
+  if (!keys) {
+    return NULL;
+  }
+
+  numkeys = PySequence_Length(keys);
+  if (numkeys == 0) {
+    PyErr_Format(PyExc_ValueError, "Expected non-empty ARRAY in COLUMNS");
+    Py_DECREF(keys);
+    return NULL;
+  }
+
+  if (!bunser_int(ptr, end, &nitems)) {
+    Py_DECREF(keys);
+    return 0;
+  }
+
+  // Every object takes at least a bit of each column
+  if (nitems < 0 || nitems / 8 > end - *ptr) {
+    PyErr_Format(PyExc_ValueError, "document too short for columns' size");
+    Py_DECREF(keys);
+    return NULL;
+  }
+
+  objs = PyList_New((Py_ssize_t)nitems);
+  if (!objs) {
+    Py_DECREF(keys);
+    return NULL;
+  }
+  for (i = 0; i < nitems; i++) {
+    PyObject* obj;
+    if (mutable) {
+      obj = PyDict_New();
+    } else {
+      bserObject* bobj = PyObject_New(bserObject, &bserObjectType);
+      if (bobj) {
+        bobj->keys = keys;
+        Py_INCREF(bobj->keys);
+        bobj->values = PyTuple_New(numkeys);
+        if (!bobj->values) {
+          Py_DECREF(bobj);
+          bobj = NULL;
+        }
+      }
+      obj = (PyObject*)bobj;
+    }
+    if (!obj) {
+      goto fail;
+    }
+    PyList_SET_ITEM(objs, i, obj);
+  }
+
+  for (keyidx = 0; keyidx < numkeys; keyidx++) {
+    PyObject* key = mutable ? PyList_GET_ITEM(keys, keyidx) : NULL;
+    if (!bunser_column(ptr, end, ctx, objs, key, keyidx)) {
+      goto fail;
+    }
+  }
+
+  Py_DECREF(keys);
+  return objs;
+
+fail:
+  Py_DECREF(keys);
+  Py_DECREF(objs);
+  return NULL;
+}
+
 PyObject* bser_loads_recursive(
     const char** ptr,
     const char* end,
@@ -625,6 +965,9 @@ PyObject* bser_loads_recursive(
     case BSER_TEMPLATE:
       return bunser_template(ptr, end, ctx);
 
+    case BSER_COLUMNS:
+      return bunser_columns(ptr, end, ctx);
+
     default:
       PyErr_Format(PyExc_ValueError, "unhandled bser opcode 0x%02x", buf[0]);
   }
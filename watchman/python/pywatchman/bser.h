@@ -28,6 +28,10 @@ extern "C" {
 #define BSER_TEMPLATE 0x0b
 #define BSER_SKIP 0x0c
 #define BSER_UTF8STRING 0x0d
+#define BSER_COLUMNS 0x0e
+
+// BSER v2 capability asking for templated arrays as columns
+#define BSER_CAP_COLUMNS 0x4
 
 // An immutable object representation of BSER_OBJECT.
 // Rather than build a hash table, key -> value are obtained
@@ -7,6 +7,7 @@
 import binascii
 import collections.abc as collections_abc
 import ctypes
+import itertools
 import struct
 import sys
 
@@ -25,6 +26,10 @@ BSER_NULL = b"\x0a"
 BSER_TEMPLATE = b"\x0b"
 BSER_SKIP = b"\x0c"
 BSER_UTF8STRING = b"\x0d"
+BSER_COLUMNS = b"\x0e"
+
+# BSER v2 capability asking for templated arrays as columns
+BSER_CAP_COLUMNS = 0x4
 
 STRING_TYPES = (str, bytes)
 unicode = str
@@ -409,6 +414,91 @@ class Bunser:
             arr.append(obj)
         return arr, pos
 
+    @staticmethod
+    def unser_raw_ints(buf, pos, count):
+        """Decodes an integer type followed by count integers of that
+        type that have no type byte of their own"""
+        int_type = _buf_pos(buf, pos)
+        if int_type == BSER_INT8:
+            fmt = "b"
+        elif int_type == BSER_INT16:
+            fmt = "h"
+        elif int_type == BSER_INT32:
+            fmt = "i"
+        elif int_type == BSER_INT64:
+            fmt = "q"
+        else:
+            raise ValueError(
+                "Invalid bser int encoding 0x%s at position %s"
+                % (binascii.hexlify(int_type).decode("ascii"), pos)
+            )
+        fmt = "=%d%s" % (count, fmt)
+        values = struct.unpack_from(fmt, buf, pos + 1)
+        return values, pos + 1 + struct.calcsize(fmt)
+
+    def unser_column(self, buf, pos, nitems):
+        kind = _buf_pos(buf, pos)
+        if kind == BSER_ARRAY:
+            pos += 1
+            column = []
+            for _ in range(nitems):
+                if _buf_pos(buf, pos) == BSER_SKIP:
+                    pos += 1
+                    ele = None
+                else:
+                    ele, pos = self.loads_recursive(buf, pos)
+                column.append(ele)
+            return column, pos
+        elif kind == BSER_TRUE:
+            nbytes = (nitems + 7) // 8
+            bits = struct.unpack_from("=%dB" % nbytes, buf, pos + 1)
+            column = [bool((bits[i >> 3] >> (i & 7)) & 1) for i in range(nitems)]
+            return column, pos + 1 + nbytes
+        elif kind == BSER_BYTESTRING or kind == BSER_UTF8STRING:
+            prefixes, pos = self.unser_raw_ints(buf, pos + 1, nitems)
+            suffixes, pos = self.unser_raw_ints(buf, pos, nitems)
+            column = []
+            value = b""
+            for prefix, suffix in zip(prefixes, suffixes):
+                if prefix < 0 or prefix > len(value) or suffix < 0:
+                    raise ValueError("Invalid string lengths in bser column")
+                suffix_val = struct.unpack_from(tobytes(suffix) + b"s", buf, pos)[0]
+                pos += suffix
+                value = value[:prefix] + suffix_val
+                if kind == BSER_UTF8STRING:
+                    column.append(value.decode("utf-8"))
+                elif self.value_encoding is not None:
+                    column.append(value.decode(self.value_encoding, self.value_errors))
+                else:
+                    column.append(value)
+            return column, pos
+        else:
+            # Each integer is the difference from the previous one
+            deltas, pos = self.unser_raw_ints(buf, pos, nitems)
+            return list(itertools.accumulate(deltas)), pos
+
+    def unser_columns(self, buf, pos):
+        val_type = _buf_pos(buf, pos + 1)
+        if val_type != BSER_ARRAY:
+            raise RuntimeError("Expect ARRAY to follow COLUMNS")
+        # force UTF-8 on keys
+        keys_bunser = Bunser(mutable=self.mutable, value_encoding="utf-8")
+        keys, pos = keys_bunser.unser_array(buf, pos + 1)
+        if not keys:
+            raise ValueError("Expected non-empty ARRAY in COLUMNS")
+        nitems, pos = self.unser_int(buf, pos)
+        columns = []
+        for _ in range(len(keys)):
+            column, pos = self.unser_column(buf, pos, nitems)
+            columns.append(column)
+        arr = []
+        for vals in zip(*columns):
+            if self.mutable:
+                arr.append(dict(zip(keys, vals)))
+            else:
+                arr.append(_BunserDict(keys, list(vals)))
+        return arr, pos
+
     def loads_recursive(self, buf, pos):
         val_type = _buf_pos(buf, pos)
         if (
@@ -437,6 +527,8 @@ class Bunser:
             return self.unser_object(buf, pos)
         elif val_type == BSER_TEMPLATE:
             return self.unser_template(buf, pos)
+        elif val_type == BSER_COLUMNS:
+            return self.unser_columns(buf, pos)
         else:
             raise ValueError(
                 "unhandled bser opcode 0x%s"
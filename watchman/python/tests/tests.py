@@ -367,6 +367,46 @@ class TestBSERDump(unittest.TestCase):
         for i in range(0, len(exp)):
             self.assertItemAttributes(exp[i], res[i])
 
+    def test_columns(self):
+        # A BSER v2 PDU with BSER_CAP_COLUMNS from the C test suite in
+        # watchman: names as shared prefixes and suffixes, exists as a
+        # bitset and sizes as differences
+        columns = (
+            b"\x00\x02\x04\x00\x00\x00\x03\x33"
+            + b"\x0e\x00\x03\x03\x02\x03\x04name\x02\x03\x06exists"
+            + b"\x02\x03\x04size\x03\x03"
+            + b"\x02\x03\x00\x02\x00\x03\x02\x01\x01abcb"
+            + b"\x08\x05"
+            + b"\x04\x2c\x01\x0a\x00\xec\xff"
+        )
+        dec = self.bser_mod.loads(columns)
+        exp = [
+            {"name": b"ab", "exists": True, "size": 300},
+            {"name": b"abc", "exists": False, "size": 310},
+            {"name": b"b", "exists": True, "size": 290},
+        ]
+        self.assertEqual(exp, dec)
+        res = self.bser_mod.loads(columns, False)
+        for i in range(0, len(exp)):
+            self.assertItemAttributes(exp[i], res[i])
+
+        dec = self.bser_mod.loads(columns, value_encoding="utf-8")
+        self.assertEqual("abc", dec[1]["name"])
+
+        # Values that aren't compactly encoded come one by one
+        mixed = (
+            b"\x00\x02\x04\x00\x00\x00\x03\x0f"
+            + b"\x0e\x00\x03\x01\x02\x03\x01x\x03\x03"
+            + b"\x00\x0a\x0c\x03\x07"
+        )
+        self.assertEqual(
+            [{"x": None}, {"x": None}, {"x": 7}], self.bser_mod.loads(mixed)
+        )
+
+        # A string can't share more than the whole of the previous one
+        bad = columns.replace(b"\x03\x00\x02\x00", b"\x03\x00\x03\x00")
+        self.assertRaises(ValueError, self.bser_mod.loads, bad)
+
     def test_pdu_info(self):
         enc = self.bser_mod.dumps(1)
         DEFAULT_BSER_VERSION = 1
@@ -0,0 +1,492 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/CompiledGlob.h"
+#include <folly/Synchronized.h>
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+
+namespace watchman {
+
+namespace {
+
+// Beyond this many distinct patterns, the cache is emptied and starts over
+constexpr size_t kMaxCachedGlobs = 4096;
+
+bool hasSpecials(std::string_view str) {
+  return str.find_first_of("*?[\\") != std::string_view::npos;
+}
+
+char foldCase(char c) {
+  // Like wildmatch, only ASCII letters are folded
+  return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+// Returns the position just past the character class that starts at `pos`.
+size_t skipClass(std::string_view pattern, size_t pos, bool noescape) {
+  ++pos;
+  if (pos < pattern.size() && (pattern[pos] == '!' || pattern[pos] == '^')) {
+    ++pos;
+  }
+  // A leading ']' is a member rather than the end of the class
+  if (pos < pattern.size() && pattern[pos] == ']') {
+    ++pos;
+  }
+  while (pos < pattern.size() && pattern[pos] != ']') {
+    if (pattern[pos] == '\\' && !noescape) {
+      pos += 2;
+      continue;
+    }
+    if (pattern.substr(pos, 2) == "[:") {
+      auto close = pattern.find(":]", pos + 2);
+      if (close != std::string_view::npos) {
+        pos = close + 2;
+        continue;
+      }
+    }
+    ++pos;
+  }
+  return pos + 1;
+}
+
+// Returns the longest run of literal characters that every string matching
+// `pattern` contains, or an empty string if there is none to rely on.
+std::string requiredLiteral(std::string_view pattern, int flags) {
+  // wildmatch collapses runs of slashes in the pattern
+  if (pattern.find("//") != std::string_view::npos) {
+    return {};
+  }
+  bool noescape = flags & WM_NOESCAPE;
+  std::string longest;
+  std::string current;
+  auto endRun = [&] {
+    if (current.size() > longest.size()) {
+      longest = current;
+    }
+    current.clear();
+  };
+
+  size_t pos = 0;
+  while (pos < pattern.size()) {
+    switch (pattern[pos]) {
+      case '*': {
+        auto end =
+            std::min(pattern.find_first_not_of('*', pos), pattern.size());
+        if (end - pos >= 2) {
+          // `**/` and `/**` may match without their slash
+          if (!current.empty() && current.back() == '/') {
+            current.pop_back();
+          }
+          if (end < pattern.size() && pattern[end] == '/') {
+            ++end;
+          }
+        }
+        endRun();
+        pos = end;
+        break;
+      }
+      case '?':
+        endRun();
+        ++pos;
+        break;
+      case '[':
+        endRun();
+        pos = skipClass(pattern, pos, noescape);
+        break;
+      case '\\':
+        if (!noescape && pos + 1 < pattern.size()) {
+          ++pos;
+        }
+        [[fallthrough]];
+      default:
+        current.push_back(pattern[pos]);
+        ++pos;
+    }
+  }
+  endRun();
+  return longest;
+}
+
+} // namespace
+
+std::shared_ptr<const CompiledGlob> CompiledGlob::get(
+    std::string_view pattern,
+    int flags) {
+  static folly::Synchronized<
+      std::unordered_map<std::string, std::shared_ptr<const CompiledGlob>>>
+      cache;
+
+  auto key = std::to_string(flags);
+  key.push_back(':');
+  key.append(pattern);
+
+  {
+    auto rlock = cache.rlock();
+    auto it = rlock->find(key);
+    if (it != rlock->end()) {
+      return it->second;
+    }
+  }
+
+  auto compiled = std::make_shared<const CompiledGlob>(pattern, flags);
+  auto wlock = cache.wlock();
+  if (wlock->size() >= kMaxCachedGlobs) {
+    wlock->clear();
+  }
+  return wlock->emplace(std::move(key), std::move(compiled)).first->second;
+}
+
+CompiledGlob::CompiledGlob(std::string_view pattern, int flags)
+    : pattern_(pattern), flags_(flags) {
+  // wildmatch collapses runs of slashes in the pattern, which the fast paths
+  // below don't attempt to replicate.
+  if (pattern.find("//") != std::string_view::npos) {
+    return;
+  }
+
+  if (!hasSpecials(pattern)) {
+    kind_ = Kind::Literal;
+    literal_ = pattern;
+    return;
+  }
+
+  if (pattern.size() >= 1 && pattern[0] == '*') {
+    auto tail = pattern.substr(1);
+    if (!hasSpecials(tail) && tail.find('/') == std::string_view::npos) {
+      kind_ = Kind::StarSuffix;
+      literal_ = tail;
+      return;
+    }
+  }
+
+  if ((flags & WM_PATHNAME) && pattern.substr(0, 3) == "**/") {
+    auto tail = pattern.substr(3);
+    bool star = !tail.empty() && tail[0] == '*';
+    if (star) {
+      tail = tail.substr(1);
+    }
+    // wildmatch lets `**` descend into directories whose names start with
+    // a period when the final component does too, which mayMatchInside
+    // doesn't model
+    if (!hasSpecials(tail) && tail.find('/') == std::string_view::npos &&
+        (star || (!tail.empty() && tail[0] != '.'))) {
+      kind_ = Kind::DoubleStarName;
+      literal_ = tail;
+      tailStar_ = star;
+      return;
+    }
+  }
+
+  if (pattern.size() >= 2 && pattern.substr(pattern.size() - 2) == "**") {
+    auto prefix = pattern.substr(0, pattern.size() - 2);
+    // With WM_PATHNAME, wildmatch rejects a `**` that doesn't follow a slash
+    if (!hasSpecials(prefix) &&
+        (!(flags & WM_PATHNAME) || prefix.empty() || prefix.back() == '/')) {
+      kind_ = Kind::PrefixDoubleStar;
+      literal_ = prefix;
+      return;
+    }
+  }
+}
+
+bool CompiledGlob::equals(std::string_view a, std::string_view b) const {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  if (!(flags_ & WM_CASEFOLD)) {
+    return a == b;
+  }
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (foldCase(a[i]) != foldCase(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool CompiledGlob::match(std::string_view text) const {
+  // A `*` or `**` never matches the leading period of a name that has one
+  bool leadingPeriod =
+      (flags_ & WM_PERIOD) && !text.empty() && text[0] == '.';
+
+  switch (kind_) {
+    case Kind::Literal:
+      return equals(text, literal_);
+
+    case Kind::StarSuffix:
+      if (leadingPeriod || text.size() < literal_.size()) {
+        return false;
+      }
+      if ((flags_ & WM_PATHNAME) && text.find('/') != std::string_view::npos) {
+        // `*` doesn't match slashes, and the suffix has none
+        return false;
+      }
+      return equals(text.substr(text.size() - literal_.size()), literal_);
+
+    case Kind::PrefixDoubleStar:
+      if (text.size() < literal_.size() ||
+          !equals(text.substr(0, literal_.size()), literal_)) {
+        return false;
+      }
+      if (literal_.empty()) {
+        return !leadingPeriod;
+      }
+      // With WM_PATHNAME, a component that follows a literal slash may only
+      // start with a period if the pattern spells it out.
+      if ((flags_ & WM_PERIOD) && (flags_ & WM_PATHNAME) &&
+          text.size() > literal_.size() && text[literal_.size()] == '.') {
+        return false;
+      }
+      return true;
+
+    case Kind::DoubleStarName: {
+      auto slash = text.rfind('/');
+      auto name =
+          slash == std::string_view::npos ? text : text.substr(slash + 1);
+      if (slash != std::string_view::npos &&
+          !mayMatchInside(text.substr(0, slash))) {
+        return false;
+      }
+      if (!tailStar_) {
+        return equals(name, literal_);
+      }
+      if (((flags_ & WM_PERIOD) && !name.empty() && name[0] == '.') ||
+          name.size() < literal_.size()) {
+        return false;
+      }
+      return equals(name.substr(name.size() - literal_.size()), literal_);
+    }
+
+    case Kind::Wildmatch:
+      break;
+  }
+  return wildmatch(pattern_.c_str(), text.data(), flags_, nullptr) == WM_MATCH;
+}
+
+bool CompiledGlob::mayMatchInside(std::string_view dirName) const {
+  if (kind_ != Kind::DoubleStarName || !(flags_ & WM_PERIOD)) {
+    return true;
+  }
+  // `**` doesn't descend into directories whose names start with a period
+  size_t start = 0;
+  while (start < dirName.size()) {
+    if (dirName[start] == '.') {
+      return false;
+    }
+    auto slash = dirName.find('/', start);
+    if (slash == std::string_view::npos) {
+      break;
+    }
+    start = slash + 1;
+  }
+  return true;
+}
+
+CompiledGlobSet::CompiledGlobSet(
+    const std::vector<std::string>& patterns,
+    int flags)
+    : flags_(flags) {
+  globs_.reserve(patterns.size());
+  for (const auto& pattern : patterns) {
+    auto index = uint32_t(globs_.size());
+    const auto& glob = *globs_.emplace_back(CompiledGlob::get(pattern, flags));
+    switch (glob.kind_) {
+      case CompiledGlob::Kind::Literal:
+        names_[intern(glob.literal_)].push_back(index);
+        break;
+      case CompiledGlob::Kind::StarSuffix:
+        suffixes_.add(intern(glob.literal_), index);
+        break;
+      case CompiledGlob::Kind::PrefixDoubleStar:
+        prefixes_.add(intern(glob.literal_), index);
+        break;
+      case CompiledGlob::Kind::DoubleStarName:
+        if (glob.tailStar_) {
+          baseNameSuffixes_.add(intern(glob.literal_), index);
+        } else {
+          baseNames_[intern(glob.literal_)].push_back(index);
+        }
+        break;
+      case CompiledGlob::Kind::Wildmatch: {
+        auto literal = requiredLiteral(pattern, flags);
+        if (literal.empty()) {
+          unindexed_.push_back(index);
+        } else {
+          addLiteral(literal, index);
+        }
+        break;
+      }
+    }
+  }
+  buildFailLinks();
+}
+
+void CompiledGlobSet::LengthTable::add(std::string_view key, uint32_t index) {
+  table[key].push_back(index);
+  auto it = std::lower_bound(lengths.begin(), lengths.end(), key.size());
+  if (it == lengths.end() || *it != key.size()) {
+    lengths.insert(it, key.size());
+  }
+}
+
+std::string_view CompiledGlobSet::intern(std::string_view literal) {
+  auto& key = keys_.emplace_back(literal);
+  if (flags_ & WM_CASEFOLD) {
+    std::transform(key.begin(), key.end(), key.begin(), foldCase);
+  }
+  return key;
+}
+
+void CompiledGlobSet::addLiteral(std::string_view literal, uint32_t index) {
+  uint32_t node = 0;
+  for (char c : literal) {
+    if (flags_ & WM_CASEFOLD) {
+      c = foldCase(c);
+    }
+    auto& next = trie_[node].next;
+    auto it = std::find_if(next.begin(), next.end(), [c](const auto& edge) {
+      return edge.first == c;
+    });
+    if (it != next.end()) {
+      node = it->second;
+      continue;
+    }
+    auto child = uint32_t(trie_.size());
+    next.emplace_back(c, child);
+    trie_.emplace_back();
+    node = child;
+  }
+  trie_[node].globs.push_back(index);
+}
+
+uint32_t CompiledGlobSet::step(uint32_t node, char c) const {
+  while (true) {
+    for (const auto& [edge, child] : trie_[node].next) {
+      if (edge == c) {
+        return child;
+      }
+    }
+    if (node == 0) {
+      return 0;
+    }
+    node = trie_[node].fail;
+  }
+}
+
+void CompiledGlobSet::buildFailLinks() {
+  // Breadth first, so that the fail link of a node's parent is already known
+  std::deque<uint32_t> queue;
+  for (const auto& edge : trie_[0].next) {
+    queue.push_back(edge.second);
+  }
+  while (!queue.empty()) {
+    auto node = queue.front();
+    queue.pop_front();
+    for (const auto& [c, child] : trie_[node].next) {
+      auto fail = step(trie_[node].fail, c);
+      trie_[child].fail = fail;
+      trie_[child].output =
+          trie_[fail].globs.empty() ? trie_[fail].output : fail;
+      queue.push_back(child);
+    }
+  }
+}
+
+bool CompiledGlobSet::anyMatches(
+    const Table& table,
+    std::string_view key,
+    std::string_view text) const {
+  auto it = table.find(key);
+  if (it == table.end()) {
+    return false;
+  }
+  for (auto index : it->second) {
+    if (globs_[index]->match(text)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CompiledGlobSet::anyMatches(
+    const LengthTable& table,
+    std::string_view folded,
+    bool suffix,
+    std::string_view text) const {
+  for (auto len : table.lengths) {
+    if (len > folded.size()) {
+      break;
+    }
+    auto key = suffix ? folded.substr(folded.size() - len)
+                      : folded.substr(0, len);
+    if (anyMatches(table.table, key, text)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CompiledGlobSet::match(std::string_view text) const {
+  // The tables only find candidates; each is confirmed by its own pattern.
+  std::string foldedText;
+  std::string_view folded = text;
+  if (flags_ & WM_CASEFOLD) {
+    foldedText.resize(text.size());
+    std::transform(text.begin(), text.end(), foldedText.begin(), foldCase);
+    folded = foldedText;
+  }
+
+  if (anyMatches(names_, folded, text) ||
+      anyMatches(suffixes_, folded, true, text) ||
+      anyMatches(prefixes_, folded, false, text)) {
+    return true;
+  }
+
+  if (!baseNames_.empty() || !baseNameSuffixes_.lengths.empty()) {
+    auto slash = folded.rfind('/');
+    auto baseName =
+        slash == std::string_view::npos ? folded : folded.substr(slash + 1);
+    if (anyMatches(baseNames_, baseName, text) ||
+        anyMatches(baseNameSuffixes_, baseName, true, text)) {
+      return true;
+    }
+  }
+
+  for (auto index : unindexed_) {
+    if (globs_[index]->match(text)) {
+      return true;
+    }
+  }
+
+  if (trie_.size() == 1) {
+    return false;
+  }
+  std::vector<bool> tried;
+  uint32_t node = 0;
+  for (char c : folded) {
+    node = step(node, c);
+    for (auto out = node; out != 0; out = trie_[out].output) {
+      for (auto index : trie_[out].globs) {
+        if (tried.empty()) {
+          tried.resize(globs_.size());
+        }
+        if (tried[index]) {
+          continue;
+        }
+        tried[index] = true;
+        if (globs_[index]->match(text)) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+} // namespace watchman
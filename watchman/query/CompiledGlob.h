@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * A wildmatch pattern together with its flags, prepared for matching many
+ * strings.
+ *
+ * Most patterns seen in practice are a plain name, a `*` followed by a
+ * literal suffix such as `*.cpp`, a literal directory prefix followed by
+ * `**`, or either of the first two after `**` and a slash, to match them
+ * in any directory.  Those are recognized once, up front, and matched with
+ * plain string comparisons in linear time; any other pattern is handed to
+ * wildmatch.
+ * Either way, match() returns exactly what wildmatch would.
+ */
+class CompiledGlob {
+ public:
+  /**
+   * Returns the compiled form of `pattern` with the WM_* `flags`, shared
+   * with every other caller that asked for the same pattern and flags.
+   */
+  static std::shared_ptr<const CompiledGlob> get(
+      std::string_view pattern,
+      int flags);
+
+  CompiledGlob(std::string_view pattern, int flags);
+
+  /**
+   * Returns true if `text` matches. `text` must be NUL terminated, as with
+   * wildmatch.
+   */
+  bool match(std::string_view text) const;
+
+  /**
+   * Returns false if no path inside the directory `dirName`, a path
+   * relative to where this pattern is matched, can match.  May return true
+   * for directories that turn out to have no matches.
+   */
+  bool mayMatchInside(std::string_view dirName) const;
+
+  const std::string& pattern() const {
+    return pattern_;
+  }
+
+ private:
+  friend class CompiledGlobSet;
+
+  enum class Kind {
+    // Anything else; evaluated by wildmatch
+    Wildmatch,
+    // No special characters; literal_ is the whole pattern
+    Literal,
+    // `*` followed by literal_, which has no special characters or slashes
+    StarSuffix,
+    // literal_, which has no special characters and is either empty or ends
+    // with a slash, followed by `**`
+    PrefixDoubleStar,
+    // `**/` followed by a final component that is either literal_, or, if
+    // tailStar_ is set, `*` followed by literal_.  Only with WM_PATHNAME.
+    DoubleStarName,
+  };
+
+  bool equals(std::string_view a, std::string_view b) const;
+
+  const std::string pattern_;
+  const int flags_;
+  Kind kind_{Kind::Wildmatch};
+  std::string literal_;
+  bool tailStar_{false};
+};
+
+/**
+ * Patterns that share the same WM_* flags, prepared for finding whether a
+ * string matches any of them.
+ *
+ * Patterns that CompiledGlob recognizes are indexed by their literal: whole
+ * names, suffixes and directory prefixes are looked up in hash tables.  Any
+ * other pattern is indexed by the longest literal that a match must contain;
+ * a single Aho-Corasick pass over the string finds which of those it
+ * contains, and only those patterns are handed to wildmatch.  So the cost of
+ * a match follows the length of the string rather than the number of
+ * patterns.
+ */
+class CompiledGlobSet {
+ public:
+  CompiledGlobSet(const std::vector<std::string>& patterns, int flags);
+
+  /**
+   * Returns true if `text` matches any of the patterns, exactly as wildmatch
+   * would.  `text` must be NUL terminated, as with wildmatch.
+   */
+  bool match(std::string_view text) const;
+
+ private:
+  // Indices into globs_, keyed by a literal.  The keys point into keys_.
+  using Table = std::unordered_map<std::string_view, std::vector<uint32_t>>;
+
+  // A table whose keys are compared with the end or start of the string,
+  // and so are looked up once for each of their lengths.
+  struct LengthTable {
+    Table table;
+    std::vector<size_t> lengths;
+
+    void add(std::string_view key, uint32_t index);
+  };
+
+  struct TrieNode {
+    std::vector<std::pair<char, uint32_t>> next;
+    uint32_t fail{0};
+    // The nearest node along the fail links that ends a literal, or 0
+    uint32_t output{0};
+    // Indices into globs_ whose literal ends here
+    std::vector<uint32_t> globs;
+  };
+
+  std::string_view intern(std::string_view literal);
+  void addLiteral(std::string_view literal, uint32_t index);
+  void buildFailLinks();
+  uint32_t step(uint32_t node, char c) const;
+  bool anyMatches(
+      const Table& table,
+      std::string_view key,
+      std::string_view text) const;
+  bool anyMatches(
+      const LengthTable& table,
+      std::string_view folded,
+      bool suffix,
+      std::string_view text) const;
+
+  const int flags_;
+  std::vector<std::shared_ptr<const CompiledGlob>> globs_;
+  std::deque<std::string> keys_;
+  // Kind::Literal, keyed by the whole string
+  Table names_;
+  // Kind::StarSuffix, keyed by the end of the string
+  LengthTable suffixes_;
+  // Kind::PrefixDoubleStar, keyed by the start of the string
+  LengthTable prefixes_;
+  // Kind::DoubleStarName, keyed by the last component, or by its end if the
+  // pattern has a tail star
+  Table baseNames_;
+  LengthTable baseNameSuffixes_;
+  // Kind::Wildmatch patterns with a required literal, as a trie whose root
+  // is node 0, and those without one
+  std::vector<TrieNode> trie_{1};
+  std::vector<uint32_t> unindexed_;
+};
+
+} // namespace watchman
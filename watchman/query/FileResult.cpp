@@ -6,6 +6,7 @@
  */
 
 #include "watchman/query/FileResult.h"
+#include <stdexcept>
 
 namespace watchman {
 
@@ -19,4 +20,14 @@ std::optional<DType> FileResult::dtype() {
   return statInfo->dtype();
 }
 
+std::optional<FileResult::ContentXxh3> FileResult::getContentXxh3() {
+  throw std::runtime_error("content.xxh3hex is not supported by this watcher");
+}
+
+void FileResult::detach() {}
+
+const void* FileResult::viewNode() const {
+  return nullptr;
+}
+
 } // namespace watchman
@@ -68,6 +68,11 @@ class FileResult {
   using ContentHash = std::array<uint8_t, 20>;
   virtual std::optional<ContentHash> getContentSha1() = 0;
 
+  // Returns the 128-bit XXH3 hash of the file contents.  Views that can't
+  // compute it throw.
+  using ContentXxh3 = std::array<uint8_t, 16>;
+  virtual std::optional<ContentXxh3> getContentXxh3();
+
   // Maybe return the dtype.
   // Returns folly::none if the dtype is not currently known.
   // Returns DType::Unknown if we have dtype data but it doesn't
@@ -106,6 +111,8 @@ class FileResult {
     SymlinkTarget = 1 << 8,
     // Need full stat metadata
     FullFileInformation = 1 << 9,
+    // The getContentXxh3() method will be called
+    ContentXxh3 = 1 << 10,
   };
 
   // Perform a batch fetch to fill in some missing data.
@@ -127,6 +134,19 @@ class FileResult {
   virtual void batchFetchProperties(
       const std::vector<std::unique_ptr<FileResult>>& files) = 0;
 
+  // Copies whatever the accessors read from the view into this result, so
+  // that it can be fetched and rendered after the view's lock has been
+  // released and the view has moved on.  The result then reports the file
+  // as it was when it was detached.  Views whose results don't refer to
+  // memory owned by the view needn't do anything.
+  virtual void detach();
+
+  // Returns the view's node for the file, for the results of views that
+  // generate them from nodes that stay put while the view is unchanged, and
+  // nullptr otherwise and once detached.  It identifies the file without
+  // computing its name.
+  virtual const void* viewNode() const;
+
  protected:
   // To be called by one of the FileResult accessors when it needs
   // to record which properties are required to satisfy the request.
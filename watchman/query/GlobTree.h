@@ -13,11 +13,16 @@
 
 namespace watchman {
 
+class CompiledGlob;
+
 /**
  * A node in the tree of node matching rules.
  */
 struct GlobTree {
   std::string pattern;
+  // pattern, compiled with the flags it is matched with. Set once the whole
+  // tree has been parsed.
+  std::shared_ptr<const CompiledGlob> compiled;
 
   // The list of child rules, excluding any ** rules
   std::vector<std::unique_ptr<GlobTree>> children;
@@ -6,7 +6,14 @@
  */
 
 #include "watchman/query/LocalFileResult.h"
+#include <folly/ScopeGuard.h>
+#include <folly/futures/Future.h>
+#include <algorithm>
 #include "watchman/ContentHash.h"
+#include "watchman/Logging.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/query/QueryResult.h"
 
 namespace watchman {
 
@@ -18,10 +25,32 @@ LocalFileResult::LocalFileResult(
       clock_(clock),
       caseSensitivity_(caseSensitivity) {}
 
+LocalFileResult::LocalFileResult(
+    w_string fullPath,
+    ClockStamp clock,
+    CaseSensitivity caseSensitivity,
+    FileInformation info)
+    : info_(std::move(info)),
+      fullPath_(std::move(fullPath)),
+      clock_(clock),
+      caseSensitivity_(caseSensitivity) {}
+
+namespace {
+// Batches with fewer files to stat than this are stat'd on the calling thread
+constexpr size_t kMinParallelStatFiles = 256;
+} // namespace
+
 void LocalFileResult::getInfo() {
   if (info_.has_value()) {
     return;
   }
+  if (auto* cost = QueryCost::current()) {
+    ++cost->statCalls;
+  }
+  loadInfo();
+}
+
+void LocalFileResult::loadInfo() {
   try {
     info_ = getFileInformation(fullPath_.c_str(), caseSensitivity_);
     exists_ = true;
@@ -112,8 +141,70 @@ std::optional<FileResult::ContentHash> LocalFileResult::getContentSha1() {
   return contentSha1_.value();
 }
 
+std::optional<FileResult::ContentXxh3> LocalFileResult::getContentXxh3() {
+  if (contentXxh3_.empty()) {
+    accessorNeedsProperties(FileResult::Property::ContentXxh3);
+    return std::nullopt;
+  }
+  return contentXxh3_.value();
+}
+
+void LocalFileResult::fetchInfoInParallel(
+    const std::vector<std::unique_ptr<FileResult>>& files) {
+  std::vector<LocalFileResult*> pending;
+  for (auto& f : files) {
+    auto localFile = dynamic_cast<LocalFileResult*>(f.get());
+    if (!localFile->info_.has_value()) {
+      pending.push_back(localFile);
+    }
+  }
+  auto concurrency = size_t(
+      std::max<json_int_t>(1, cfg_get_int("scm_stat_concurrency", 8)));
+  if (pending.size() < kMinParallelStatFiles || concurrency == 1) {
+    // getInfo() will stat them one at a time
+    return;
+  }
+
+  // The workers can't see this thread's cost, so count the stats here
+  if (auto* cost = QueryCost::current()) {
+    cost->statCalls += pending.size();
+  }
+
+  auto statRange = [&pending](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      pending[i]->loadInfo();
+    }
+  };
+  auto perTask = (pending.size() + concurrency - 1) / concurrency;
+  std::vector<folly::Future<folly::Unit>> futures;
+
+  // The tasks reference our locals, so they must be done before we return,
+  // even if we are throwing an exception.
+  SCOPE_EXIT {
+    if (!futures.empty()) {
+      folly::collectAll(futures.begin(), futures.end()).wait();
+    }
+  };
+
+  for (size_t begin = perTask; begin < pending.size(); begin += perTask) {
+    auto end = std::min(pending.size(), begin + perTask);
+    try {
+      futures.emplace_back(folly::via(&getThreadPool(), [&, begin, end] {
+        statRange(begin, end);
+      }));
+    } catch (const std::exception& exc) {
+      // The pool is full or shutting down; do the work ourselves.
+      log(DBG, "stating files inline: ", exc.what(), "\n");
+      statRange(begin, end);
+    }
+  }
+  statRange(0, std::min(pending.size(), perTask));
+}
+
 void LocalFileResult::batchFetchProperties(
     const std::vector<std::unique_ptr<FileResult>>& files) {
+  fetchInfoInParallel(files);
+
   for (auto& f : files) {
     auto localFile = dynamic_cast<LocalFileResult*>(f.get());
     localFile->getInfo();
@@ -124,6 +215,9 @@ void LocalFileResult::batchFetchProperties(
       // symlink" rather than propagating an error. This behavior is relied
       // upon by the field rendering code and checked in test_symlink.py.
       if (localFile->info_->isSymlink()) {
+        if (auto* cost = QueryCost::current()) {
+          ++cost->statCalls;
+        }
         target = readSymbolicLink(localFile->fullPath_.c_str());
       }
       localFile->symlinkTarget_ = target;
@@ -132,12 +226,28 @@ void LocalFileResult::batchFetchProperties(
     if (localFile->neededProperties() & FileResult::Property::ContentSha1) {
       // TODO: find a way to reference a ContentHashCache instance
       // that will work with !InMemoryView based views.
+      if (auto* cost = QueryCost::current()) {
+        ++cost->hashCacheMisses;
+      }
       localFile->contentSha1_ = makeResultWith([&] {
         return ContentHashCache::computeHashImmediate(
             localFile->fullPath_.c_str());
       });
     }
 
+    if (localFile->neededProperties() & FileResult::Property::ContentXxh3) {
+      if (auto* cost = QueryCost::current()) {
+        ++cost->hashCacheMisses;
+      }
+      localFile->contentXxh3_ = makeResultWith([&] {
+        auto value = ContentHashCache::computeHashImmediate(
+            localFile->fullPath_.c_str(), ContentHashAlgorithm::Xxh3);
+        FileResult::ContentXxh3 digest;
+        std::copy_n(value.begin(), digest.size(), digest.begin());
+        return digest;
+      });
+    }
+
     localFile->clearNeededProperties();
   }
 }
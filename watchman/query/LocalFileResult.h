@@ -35,6 +35,13 @@ class LocalFileResult : public FileResult {
       ClockStamp clock,
       CaseSensitivity caseSensitivity);
 
+  // For a file whose information was already read, eg: by a directory walk
+  LocalFileResult(
+      w_string fullPath,
+      ClockStamp clock,
+      CaseSensitivity caseSensitivity,
+      FileInformation info);
+
   // Returns stat-like information about this file.  If the file doesn't
   // exist the stat information will be largely useless (it will be zeroed
   // out), but will report itself as being a regular file.  This is fine
@@ -62,12 +69,20 @@ class LocalFileResult : public FileResult {
 
   // Returns the SHA-1 hash of the file contents
   std::optional<FileResult::ContentHash> getContentSha1() override;
+  std::optional<FileResult::ContentXxh3> getContentXxh3() override;
 
   void batchFetchProperties(
       const std::vector<std::unique_ptr<FileResult>>& files) override;
 
  private:
+  // Stats the file if that hasn't been done yet
   void getInfo();
+  // Stats the file without counting it towards the query's cost
+  void loadInfo();
+  // Stats the files in `files` that need it across the thread pool, if
+  // there are enough of them to be worth it
+  static void fetchInfoInParallel(
+      const std::vector<std::unique_ptr<FileResult>>& files);
   w_string getFullPath();
 
   bool exists_{true};
@@ -77,6 +92,7 @@ class LocalFileResult : public FileResult {
   CaseSensitivity caseSensitivity_;
   std::optional<ResolvedSymlink> symlinkTarget_;
   Result<FileResult::ContentHash> contentSha1_;
+  Result<FileResult::ContentXxh3> contentXxh3_;
 };
 
 } // namespace watchman
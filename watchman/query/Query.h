@@ -7,9 +7,11 @@
 
 #pragma once
 
+#include <functional>
 #include <optional>
 #include "watchman/ClientContext.h"
 #include "watchman/Clock.h"
+#include "watchman/QueryScheduler.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
@@ -24,6 +26,12 @@ class QueryExpr;
 struct QueryFieldRenderer {
   w_string name;
   std::optional<json_ref> (*make)(FileResult* file, const QueryContext* ctx);
+  // If set, appends the value straight to BSER template rows without
+  // building a json_ref.  Returns false if data still needs to be loaded.
+  bool (*encode)(
+      FileResult* file,
+      const QueryContext* ctx,
+      BserTemplateRows& rows) = nullptr;
 };
 
 class QueryFieldList : public std::vector<QueryFieldRenderer*> {
@@ -41,13 +49,52 @@ struct QueryPath {
   int depth;
 };
 
+// The order in which a query's results are produced
+enum class QuerySortOrder {
+  None,
+  // By name relative to the root, comparing one path component at a time
+  Name,
+  // Most recently modified first
+  ModifiedTime,
+};
+
 struct Query {
   CaseSensitivity case_sensitive = CaseSensitivity::CaseInSensitive;
   bool fail_if_no_saved_state = false;
   bool empty_on_fresh_instance = false;
   bool omit_changed_files = false;
   bool dedup_results = false;
+  // Dedup by name even the files that views identify by node, so that the
+  // names of all the results end up in QueryResult::dedupedFileNames.
+  bool dedup_by_name = false;
   uint32_t bench_iterations = 0;
+  // If non-zero, the client has asked for the results to be sent in chunks
+  // of at most this many files as they are rendered.
+  uint32_t stream_results = 0;
+  // The client can map the results from a file passed alongside the
+  // response, rather than read them from the socket.
+  bool shm_results = false;
+  // How the query is scheduled against the queries of other clients
+  QueryPriority priority = QueryPriority::Interactive;
+  // If non-zero, the query produces at most this many results, and stops
+  // walking the view once it has them.
+  uint32_t limit = 0;
+  // The client only wants to know whether anything matches; implies a
+  // limit of 1.
+  bool exists_only = false;
+  // With a limit, the results are the first ones in this order rather than
+  // the first ones found.
+  QuerySortOrder sort = QuerySortOrder::None;
+  // The client asked for the QueryCost to be included in the response.
+  bool report_cost = false;
+  // The client asked for a QueryExplain to be included in the response.
+  bool explain = false;
+  // The client asked for subscription results to include when the changes
+  // went through each stage of the pipeline.
+  bool report_timing = false;
+  // Names are rendered as the number of leading path components shared with
+  // the previous result and the remainder of the name.
+  bool front_coded_names = false;
 
   /**
    * Optional full path to relative root, without and with trailing slash.
@@ -57,10 +104,16 @@ struct Query {
 
   std::optional<std::vector<QueryPath>> paths;
 
-  std::unique_ptr<GlobTree> glob_tree;
+  // Shared between queries with the same globs and flags
+  std::shared_ptr<const GlobTree> glob_tree;
   // Additional flags to pass to wildmatch in the glob_generator
   int glob_flags = 0;
 
+  // The lowercased suffixes from the "suffix" generator, when they are plain
+  // strings that the glob_generator can look up directly rather than match
+  // via glob_tree.
+  std::optional<std::vector<w_string>> suffixes;
+
   struct SettleTimeouts {
     std::chrono::milliseconds settle_period;
     std::chrono::milliseconds settle_timeout;
@@ -80,6 +133,13 @@ struct Query {
    */
   std::chrono::milliseconds sync_timeout;
 
+  /**
+   * If non-zero, the query fails once this long has passed since it started
+   * executing, rather than carry on computing results the client no longer
+   * wants.
+   */
+  std::chrono::milliseconds deadline{0};
+
   uint32_t lock_timeout = 0;
 
   // We can't (and mustn't!) evaluate the clockspec
@@ -99,8 +159,17 @@ struct Query {
   std::optional<w_string> subscriptionName;
   ClientContext clientInfo{0, std::nullopt};
 
+  // Returns true once nobody wants the results anymore, such as when the
+  // client disconnected.  Checked from time to time while the query runs.
+  std::function<bool()> isAbandoned;
+
   bool alwaysIncludeDirectories{false};
 
+  // The number of results the previous run of this query produced, for
+  // queries that are run repeatedly, such as subscriptions.  Used to size
+  // the result storage up front.
+  size_t expected_results{0};
+
   ~Query();
 
   /** Returns true if the supplied name is contained in
@@ -9,6 +9,17 @@
 
 #include "folly/stop_watch.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <utility>
+
+#include "watchman/Errors.h"
+#include "watchman/Logging.h"
+#include "watchman/PathBuilder.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -21,6 +32,48 @@ namespace {
 
 constexpr size_t kMaximumRenderBatchSize = 1024;
 
+// How many calls to isCancelled() share one look at the clock and the client
+constexpr uint32_t kCancelCheckInterval = 1024;
+
+// How many chunks of streamed results may wait for the stream writer
+constexpr size_t kMaxQueuedStreamChunks = 4;
+
+// Find a balance between local memory usage, latency in fetching
+// and the cost of fetching the data needed to re-evaluate this batch.
+// TODO: maybe allow passing this number in via the query?
+constexpr size_t kMaximumEvalBatchSize = 20480;
+
+// The batches of files awaiting data are recycled through a small per-thread
+// pool, so that a thread running the same subscriptions over and over doesn't
+// regrow them from scratch for every query.
+using FileBatch = std::vector<std::unique_ptr<FileResult>>;
+constexpr size_t kMaxPooledBatches = 4;
+
+std::vector<FileBatch>& batchPool() {
+  thread_local std::vector<FileBatch> pool;
+  return pool;
+}
+
+FileBatch takeBatch() {
+  auto& pool = batchPool();
+  if (pool.empty()) {
+    return {};
+  }
+  auto batch = std::move(pool.back());
+  pool.pop_back();
+  return batch;
+}
+
+void recycleBatch(FileBatch&& batch) {
+  batch.clear();
+  auto& pool = batchPool();
+  if (batch.capacity() == 0 || batch.capacity() > kMaximumEvalBatchSize ||
+      pool.size() >= kMaxPooledBatches) {
+    return;
+  }
+  pool.push_back(std::move(batch));
+}
+
 std::optional<json_ref> file_result_to_json(
     const QueryFieldList& fieldList,
     const std::unique_ptr<FileResult>& file,
@@ -28,7 +81,7 @@ std::optional<json_ref> file_result_to_json(
   if (fieldList.size() == 1) {
     return fieldList.front()->make(file.get(), ctx);
   }
-  std::unordered_map<w_string, json_ref> value;
+  json_object_map value;
   value.reserve(fieldList.size());
 
   for (auto& f : fieldList) {
@@ -42,12 +95,137 @@ std::optional<json_ref> file_result_to_json(
   return json_object(std::move(value));
 }
 
+// Orders paths one component at a time, so that everything under "a/" comes
+// right after "a" and ahead of "a.txt"
+bool pathComponentsBefore(w_string_piece a, w_string_piece b) {
+  auto key = [](char c) {
+    return c == '/' ? 0 : static_cast<unsigned char>(c) + 1;
+  };
+  return std::lexicographical_compare(
+      a.data(),
+      a.data() + a.size(),
+      b.data(),
+      b.data() + b.size(),
+      [&](char x, char y) { return key(x) < key(y); });
+}
+
 } // namespace
 
+/**
+ * Writes chunks of streamed results through streamResults, in order, on a
+ * thread of its own.
+ */
+class QueryContext::StreamWriter {
+ public:
+  explicit StreamWriter(const QueryResultsCallback& write)
+      : write_{write}, thread_{[this] { run(); }} {}
+
+  ~StreamWriter() {
+    // The query failed, so the client won't make sense of the rest
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      queue_.clear();
+      done_ = true;
+    }
+    cond_.notify_all();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  // Queues chunk, which holds numRows results, waiting while the queue is
+  // full.  Throws the error from writing an earlier chunk.
+  void push(RenderResult&& chunk, int64_t numRows) {
+    std::unique_lock<std::mutex> lock{mutex_};
+    cond_.wait(lock, [&] {
+      return error_ || queue_.size() < kMaxQueuedStreamChunks;
+    });
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    queue_.emplace_back(std::move(chunk), numRows);
+    queuedRows_ += numRows;
+    cond_.notify_all();
+  }
+
+  // Returns once the queued chunks are written.  Throws the error from
+  // writing any of them.
+  void finish() {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      done_ = true;
+    }
+    cond_.notify_all();
+    thread_.join();
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+
+  // The number of results that were queued and not yet written
+  int64_t queuedRows() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return queuedRows_;
+  }
+
+ private:
+  void run() {
+    w_set_thread_name("streamwriter");
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (true) {
+      cond_.wait(lock, [&] { return done_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      // The entry stays queued while its chunk is written, so that it still
+      // counts against the queue size and the memory limit
+      auto chunk = std::move(queue_.front().first);
+      lock.unlock();
+      try {
+        write_(std::move(chunk));
+      } catch (...) {
+        lock.lock();
+        error_ = std::current_exception();
+        queue_.clear();
+        queuedRows_ = 0;
+        cond_.notify_all();
+        return;
+      }
+      lock.lock();
+      if (queue_.empty()) {
+        // Dropped by the destructor
+        return;
+      }
+      queuedRows_ -= queue_.front().second;
+      queue_.pop_front();
+      cond_.notify_all();
+    }
+  }
+
+  const QueryResultsCallback& write_;
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::pair<RenderResult, int64_t>> queue_;
+  int64_t queuedRows_{0};
+  bool done_{false};
+  std::exception_ptr error_;
+  std::thread thread_;
+};
+
 void QueryContext::resetWholeName() {
   wholename_.reset();
 }
 
+void QueryContext::noteViewStructureGeneration(uint64_t generation) {
+  if (dedupNodesGeneration_ != generation) {
+    // A freed node may now be another file, which must not be dropped as a
+    // duplicate.  Only one generator uses dedupNodes (see dedupByName), so
+    // nothing it emitted is forgotten here.
+    dedupNodes.clear();
+    dedupNodesGeneration_ = generation;
+  }
+}
+
 const w_string& QueryContext::getWholeName() {
   if (!wholename_) {
     wholename_ = computeWholeName(file.get());
@@ -56,6 +234,14 @@ const w_string& QueryContext::getWholeName() {
 }
 
 w_string QueryContext::computeWholeName(FileResult* file) const {
+  auto parent = relativeDirName(file);
+  if (parent.empty()) {
+    return file->baseName().asWString();
+  }
+  return w_string::build(parent, "/", file->baseName());
+}
+
+w_string_piece QueryContext::relativeDirName(FileResult* file) const {
   uint32_t name_start;
 
   if (query->relative_root) {
@@ -69,10 +255,33 @@ w_string QueryContext::computeWholeName(FileResult* file) const {
   // Record the name relative to the root
   auto parent = file->dirName();
   if (name_start > parent.size()) {
-    return file->baseName().asWString();
+    return w_string_piece{};
   }
   parent.advance(name_start);
-  return w_string::build(parent, "/", file->baseName());
+  return parent;
+}
+
+json_ref QueryContext::frontCodeName(const w_string& name) const {
+  auto size = std::min(name.size(), previousName_.size());
+  int64_t shared = 0;
+  size_t suffix = 0;
+  size_t i = 0;
+  for (; i < size && name.data()[i] == previousName_.data()[i]; ++i) {
+    if (name.data()[i] == '/') {
+      ++shared;
+      suffix = i + 1;
+    }
+  }
+  // The previous name may be the directory holding this one
+  if (i == previousName_.size() && i < name.size() && name.data()[i] == '/') {
+    ++shared;
+    suffix = i + 1;
+  }
+  renderedName_ = name;
+  return json_array(
+      {json_integer(shared),
+       w_string_to_json(w_string{
+           name.data() + suffix, name.size() - suffix, name.type()})});
 }
 
 bool QueryContext::dirMatchesRelativeRoot(w_string_piece fullDirectoryPath) {
@@ -99,12 +308,15 @@ bool QueryContext::fileMatchesRelativeRoot(w_string_piece fullFilePath) {
 }
 
 bool QueryContext::fileMatchesRelativeRoot(const watchman_file* f) {
-  // getFullPath() allocates memory; avoid it with this cheap test
+  // Building the full path walks the parent chain; avoid it with this cheap
+  // test
   if (!query->relative_root) {
     return true;
   }
 
-  return dirMatchesRelativeRoot(f->parent->getFullPath());
+  PathBuilder buf;
+  return dirMatchesRelativeRoot(
+      f->parent->getFullPathToChild(buf, w_string_piece()));
 }
 
 QueryContext::QueryContext(
@@ -114,15 +326,25 @@ QueryContext::QueryContext(
     : created(std::chrono::steady_clock::now()),
       query(q),
       root(root),
-      disableFreshInstance{disableFreshInstance} {}
+      dedupByName{q->dedup_by_name},
+      disableFreshInstance{disableFreshInstance},
+      resultLimit_{q->sort == QuerySortOrder::None ? q->limit : 0},
+      evalBatch_{takeBatch()},
+      renderBatch_{takeBatch()} {
+  if (q->explain) {
+    explain.emplace();
+  }
+}
+
+QueryContext::~QueryContext() {
+  recycleBatch(std::move(evalBatch_));
+  recycleBatch(std::move(renderBatch_));
+}
 
 void QueryContext::addToEvalBatch(std::unique_ptr<FileResult>&& file) {
   evalBatch_.emplace_back(std::move(file));
 
-  // Find a balance between local memory usage, latency in fetching
-  // and the cost of fetching the data needed to re-evaluate this batch.
-  // TODO: maybe allow passing this number in via the query?
-  if (evalBatch_.size() >= 20480) {
+  if (evalBatch_.size() >= kMaximumEvalBatchSize) {
     fetchEvalBatchNow();
   }
 }
@@ -135,28 +357,323 @@ void QueryContext::fetchEvalBatchNow() {
   evalBatch_.front()->batchFetchProperties(evalBatch_);
   edenFilePropertiesDurationUs.fetch_add(timer.elapsed().count());
 
-  auto toProcess = std::move(evalBatch_);
+  auto toProcess = std::exchange(evalBatch_, takeBatch());
 
   for (auto& file : toProcess) {
     w_query_process_file(query, this, std::move(file));
   }
+  recycleBatch(std::move(toProcess));
 
   w_assert(evalBatch_.empty(), "should have no files that NeedDataLoad");
 }
 
+void QueryContext::beginExplainStage(const char* generator) {
+  if (!explain) {
+    return;
+  }
+  auto& stage = explain->stages.emplace_back();
+  stage.generator = w_string{generator};
+  explainStageWalked_ = numWalked_;
+  explainStageMatched_ = numMatched_;
+}
+
+void QueryContext::endExplainStage() {
+  if (!explain || explain->stages.empty()) {
+    return;
+  }
+  auto& stage = explain->stages.back();
+  stage.walked = numWalked_ - explainStageWalked_;
+  stage.matched = numMatched_ - explainStageMatched_;
+}
+
+void QueryContext::explainMethod(
+    const char* method,
+    std::optional<int64_t> estimatedFiles) {
+  if (!explain || explain->stages.empty()) {
+    return;
+  }
+  auto& stage = explain->stages.back();
+  stage.method = w_string{method};
+  stage.estimatedFiles = estimatedFiles;
+}
+
+bool QueryContext::isCancelled() {
+  if (cancelReason_ != CancelReason::None) {
+    return true;
+  }
+  if (cancelCheckCountdown_ > 0) {
+    --cancelCheckCountdown_;
+    return false;
+  }
+  cancelCheckCountdown_ = kCancelCheckInterval;
+
+  if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+    cancelReason_ = CancelReason::Deadline;
+  } else if (query->isAbandoned && query->isAbandoned()) {
+    cancelReason_ = CancelReason::ClientGone;
+  }
+  return cancelReason_ != CancelReason::None;
+}
+
+void QueryContext::throwIfCancelled() {
+  if (!isCancelled()) {
+    return;
+  }
+  if (cancelReason_ == CancelReason::Deadline) {
+    QueryExecError::throwf(
+        "the query ran past its deadline_ms of {}", query->deadline.count());
+  }
+  throw QueryExecError("the query was cancelled: its client disconnected");
+}
+
 RenderResult QueryContext::renderResults() {
   std::optional<json_ref> templ;
   if (query->fieldList.size() > 1) {
     // build a template for the serializer
     templ = field_list_to_json_name_array(query->fieldList);
   }
-  return RenderResult{std::move(resultsArray), std::move(templ)};
+  RenderResult result{std::move(resultsArray), std::move(templ)};
+  // Each chunk of streamed results can be decoded on its own
+  previousName_.reset();
+  if (bserRows) {
+    result.bserRows = std::exchange(
+        bserRows,
+        std::make_shared<BserTemplateRows>(
+            bserRows->version(), bserRows->capabilities()));
+  }
+  return result;
+}
+
+void QueryContext::maybeStreamResults() {
+  if (!streamResults) {
+    return;
+  }
+  auto pending = getNumResults() - numStreamedResults_;
+  if (pending < int64_t(query->stream_results)) {
+    return;
+  }
+  numStreamedResults_ += pending;
+  auto chunk = renderResults();
+  resultsArray.clear();
+  if (writeStreamInBackground_) {
+    if (!streamWriter_) {
+      streamWriter_ = std::make_unique<StreamWriter>(streamResults);
+    }
+    streamWriter_->push(std::move(chunk), pending);
+    return;
+  }
+  streamResults(std::move(chunk));
+}
+
+void QueryContext::finishStreamWriter() {
+  writeStreamInBackground_ = false;
+  if (!streamWriter_) {
+    return;
+  }
+  auto writer = std::move(streamWriter_);
+  writer->finish();
+}
+
+void QueryContext::checkResultMemoryLimit() const {
+  if (root->memory_limit_max_results <= 0 ||
+      !root->inner.over_memory_limit.load(std::memory_order_relaxed)) {
+    return;
+  }
+  // Streamed results are no longer held once they are written
+  auto held = getNumResults() - numStreamedResults_ +
+      (streamWriter_ ? streamWriter_->queuedRows() : 0);
+  if (held >= root->memory_limit_max_results) {
+    QueryExecError::throwf(
+        "the watch is over its memory_soft_limit_mb and this query would hold "
+        "more than {} results; narrow the query or use stream_results",
+        root->memory_limit_max_results);
+  }
+}
+
+void QueryContext::addResult(json_ref&& rendered) {
+  checkResultMemoryLimit();
+  resultsArray.push_back(std::move(rendered));
+  if (query->front_coded_names) {
+    previousName_ = renderedName_;
+  }
+  maybeStreamResults();
+}
+
+bool QueryContext::encodeResult(FileResult* file) {
+  checkResultMemoryLimit();
+  for (auto& f : query->fieldList) {
+    if (f->encode) {
+      if (!f->encode(file, this, *bserRows)) {
+        bserRows->abandonRow();
+        return false;
+      }
+      continue;
+    }
+    auto ele = f->make(file, this);
+    if (!ele.has_value()) {
+      bserRows->abandonRow();
+      return false;
+    }
+    bserRows->appendJson(ele.value());
+  }
+  bserRows->commitRow();
+  if (query->front_coded_names) {
+    previousName_ = renderedName_;
+  }
+  maybeStreamResults();
+  return true;
+}
+
+void QueryContext::addMatch(std::unique_ptr<FileResult>&& file) {
+  if (query->sort == QuerySortOrder::None) {
+    maybeRender(std::move(file));
+    return;
+  }
+  if (query->sort == QuerySortOrder::ModifiedTime &&
+      !file->modifiedTime().has_value()) {
+    sortKeyBatch_.emplace_back(std::move(file));
+    if (sortKeyBatch_.size() >= kMaximumRenderBatchSize) {
+      fetchSortKeysNow();
+    }
+    return;
+  }
+  addSortedMatch(std::move(file));
+}
+
+bool QueryContext::sortsBefore(const SortedMatch& a, const SortedMatch& b)
+    const {
+  if (query->sort == QuerySortOrder::ModifiedTime) {
+    return std::tie(a.mtime.tv_sec, a.mtime.tv_nsec) >
+        std::tie(b.mtime.tv_sec, b.mtime.tv_nsec);
+  }
+  return pathComponentsBefore(a.name, b.name);
+}
+
+void QueryContext::addSortedMatch(std::unique_ptr<FileResult>&& file) {
+  SortedMatch match;
+  if (query->sort == QuerySortOrder::ModifiedTime) {
+    match.mtime = file->modifiedTime().value();
+  } else {
+    match.name = computeWholeName(file.get());
+  }
+  match.file = std::move(file);
+
+  // The matches are rendered once the generators are done, by which time
+  // the view lock may have been released and the nodes freed
+  if (!query->limit) {
+    match.file->detach();
+    sortedMatches_.push_back(std::move(match));
+    return;
+  }
+  // Keep only the first `limit` matches, so that a sorted query with a small
+  // limit holds a small heap rather than every match
+  auto before = [this](const SortedMatch& a, const SortedMatch& b) {
+    return sortsBefore(a, b);
+  };
+  if (sortedMatches_.size() >= query->limit) {
+    if (!before(match, sortedMatches_.front())) {
+      return;
+    }
+    std::pop_heap(sortedMatches_.begin(), sortedMatches_.end(), before);
+    sortedMatches_.pop_back();
+  }
+  match.file->detach();
+  sortedMatches_.push_back(std::move(match));
+  std::push_heap(sortedMatches_.begin(), sortedMatches_.end(), before);
+}
+
+void QueryContext::fetchSortKeysNow() {
+  while (!sortKeyBatch_.empty()) {
+    folly::stop_watch<std::chrono::microseconds> timer;
+    sortKeyBatch_.front()->batchFetchProperties(sortKeyBatch_);
+    edenFilePropertiesDurationUs.fetch_add(timer.elapsed().count());
+
+    auto toProcess = std::exchange(sortKeyBatch_, {});
+    for (auto& file : toProcess) {
+      if (file->modifiedTime().has_value()) {
+        addSortedMatch(std::move(file));
+      } else {
+        sortKeyBatch_.emplace_back(std::move(file));
+      }
+    }
+  }
+}
+
+void QueryContext::renderSortedMatches() {
+  if (query->sort == QuerySortOrder::None) {
+    return;
+  }
+  fetchSortKeysNow();
+
+  auto before = [this](const SortedMatch& a, const SortedMatch& b) {
+    return sortsBefore(a, b);
+  };
+  if (query->limit) {
+    std::sort_heap(sortedMatches_.begin(), sortedMatches_.end(), before);
+  } else if (!std::is_sorted(
+                 sortedMatches_.begin(), sortedMatches_.end(), before)) {
+    // The generators produce some orders natively, in which case this is
+    // only a check
+    std::stable_sort(sortedMatches_.begin(), sortedMatches_.end(), before);
+  }
+
+  for (size_t i = 0; i < sortedMatches_.size(); ++i) {
+    throwIfCancelled();
+    while (!tryRender(sortedMatches_[i].file)) {
+      fetchSortedRenderBatch(i);
+    }
+  }
+  sortedMatches_.clear();
+}
+
+bool QueryContext::tryRender(const std::unique_ptr<FileResult>& file) {
+  if (bserRows) {
+    return encodeResult(file.get());
+  }
+  auto maybeRendered = file_result_to_json(query->fieldList, file, this);
+  if (!maybeRendered.has_value()) {
+    return false;
+  }
+  addResult(std::move(maybeRendered.value()));
+  return true;
+}
+
+void QueryContext::fetchSortedRenderBatch(size_t start) {
+  auto end = std::min(sortedMatches_.size(), start + kMaximumRenderBatchSize);
+  std::vector<size_t> indices;
+  auto batch = takeBatch();
+  for (size_t i = start; i < end; ++i) {
+    auto& file = sortedMatches_[i].file;
+    // Rendering a file records what it is missing, so do a trial run on the
+    // ones that haven't been tried yet
+    if (i == start ||
+        !file_result_to_json(query->fieldList, file, this).has_value()) {
+      indices.push_back(i);
+      batch.emplace_back(std::move(file));
+    }
+  }
+
+  folly::stop_watch<std::chrono::microseconds> timer;
+  batch.front()->batchFetchProperties(batch);
+  edenFilePropertiesDurationUs.fetch_add(timer.elapsed().count());
+
+  for (size_t i = 0; i < indices.size(); ++i) {
+    sortedMatches_[indices[i]].file = std::move(batch[i]);
+  }
+  recycleBatch(std::move(batch));
 }
 
 void QueryContext::maybeRender(std::unique_ptr<FileResult>&& file) {
+  if (bserRows) {
+    if (!encodeResult(file.get())) {
+      addToRenderBatch(std::move(file));
+    }
+    return;
+  }
+
   auto maybeRendered = file_result_to_json(query->fieldList, file, this);
   if (maybeRendered.has_value()) {
-    resultsArray.push_back(std::move(maybeRendered.value()));
+    addResult(std::move(maybeRendered.value()));
     return;
   }
 
@@ -165,6 +682,10 @@ void QueryContext::maybeRender(std::unique_ptr<FileResult>&& file) {
 
 void QueryContext::addToRenderBatch(std::unique_ptr<FileResult>&& file) {
   renderBatch_.emplace_back(std::move(file));
+  if (deferRenderFetches) {
+    renderBatch_.back()->detach();
+    return;
+  }
   // TODO: maybe allow passing this number in via the query?
   if (renderBatch_.size() >= kMaximumRenderBatchSize) {
     fetchRenderBatchNow();
@@ -180,16 +701,23 @@ bool QueryContext::fetchRenderBatchNow() {
   renderBatch_.front()->batchFetchProperties(renderBatch_);
   edenFilePropertiesDurationUs.fetch_add(timer.elapsed().count());
 
-  auto toProcess = std::move(renderBatch_);
+  auto toProcess = std::exchange(renderBatch_, takeBatch());
 
   for (auto& file : toProcess) {
+    if (bserRows) {
+      if (!encodeResult(file.get())) {
+        renderBatch_.emplace_back(std::move(file));
+      }
+      continue;
+    }
     auto maybeRendered = file_result_to_json(query->fieldList, file, this);
     if (maybeRendered.has_value()) {
-      resultsArray.push_back(std::move(maybeRendered.value()));
+      addResult(std::move(maybeRendered.value()));
     } else {
       renderBatch_.emplace_back(std::move(file));
     }
   }
+  recycleBatch(std::move(toProcess));
 
   return renderBatch_.empty();
 }
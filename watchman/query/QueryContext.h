@@ -8,8 +8,11 @@
 #pragma once
 
 #include <folly/stop_watch.h>
+#include <ctime>
+#include <optional>
 #include <unordered_set>
 #include "watchman/Clock.h"
+#include "watchman/bser.h"
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/QueryResult.h"
 
@@ -24,6 +27,7 @@ class Root;
 enum class QueryContextState {
   NotStarted,
   WaitingForCookieSync,
+  Queued,
   WaitingForViewLock,
   Generating,
   Rendering,
@@ -37,6 +41,8 @@ struct QueryContext : QueryContextBase {
   std::atomic<QueryContextState> state{QueryContextState::NotStarted};
   std::atomic<std::chrono::milliseconds> cookieSyncDuration{
       std::chrono::milliseconds(0)};
+  std::atomic<std::chrono::milliseconds> queueDuration{
+      std::chrono::milliseconds(0)};
   std::atomic<std::chrono::milliseconds> viewLockWaitDuration{
       std::chrono::milliseconds(0)};
   std::atomic<std::chrono::milliseconds> generationDuration{
@@ -60,10 +66,30 @@ struct QueryContext : QueryContextBase {
   // Rendered results
   std::vector<json_ref> resultsArray;
 
+  // When set and the query has stream_results, rendered results are handed
+  // to this callback in chunks rather than all being held in resultsArray
+  // until the query completes.
+  QueryResultsCallback streamResults;
+
+  // When set, results are encoded into these rows as they are rendered
+  // rather than being added to resultsArray.  Only used for queries with
+  // more than one field, which are rendered using a BSER template.
+  std::shared_ptr<BserTemplateRows> bserRows;
+
   // When deduping the results, set<wholename> of
-  // the files held in results
+  // the files held in results that are not in dedupNodes
   std::unordered_set<w_string> dedup;
 
+  // When deduping the results, the view nodes (see FileResult::viewNode) of
+  // the files held in results, while the nodes haven't been freed since.
+  std::unordered_set<const void*> dedupNodes;
+
+  // Dedup by name even the files that views identify by node.  Set from
+  // Query::dedup_by_name, and by default_generators when more than one
+  // generator runs, since the nodes that one generator saw may be freed
+  // and reused before the next one locks the view.
+  bool dedupByName{false};
+
   // When unconditional_log_if_results_contain_file_prefixes is set
   // and one of those prefixes matches a file in the generated results,
   // that name is added here with the intent that this is passed
@@ -73,13 +99,39 @@ struct QueryContext : QueryContextBase {
   // How many times we suppressed a result due to dedup checking
   uint32_t num_deduped{0};
 
+  // Accumulated as the query executes; see QueryCost::current()
+  QueryCost cost;
+
+  // Set when the query asked to be explained; see Query::explain
+  std::optional<QueryExplain> explain;
+
   // Disable fresh instance queries
   bool disableFreshInstance{false};
 
+  // When the query is cancelled, from Query::deadline
+  std::optional<std::chrono::steady_clock::time_point> deadline;
+
+  // Set by views whose generators hold a lock that writers wait on.  While
+  // set, files that need properties fetched before they can be rendered are
+  // detached from the view (see FileResult::detach) and held until the
+  // generator is done, rather than fetched in batches as they are found, so
+  // that hashing files and reading symlinks doesn't happen under the lock.
+  bool deferRenderFetches{false};
+
+  /**
+   * Called by views with FileResult::viewNode results when they lock the
+   * view for a generator.  Once the view has freed nodes, those in
+   * dedupNodes may be reused for other files, so they are forgotten.  A
+   * query that runs more than one generator dedups by name instead, so
+   * nothing it already emitted is forgotten.
+   */
+  void noteViewStructureGeneration(uint64_t generation);
+
   QueryContext(
       const Query* q,
       const std::shared_ptr<Root>& root,
       bool disableFreshInstance);
+  ~QueryContext();
   QueryContext(const QueryContext&) = delete;
   QueryContext& operator=(const QueryContext&) = delete;
 
@@ -92,6 +144,55 @@ struct QueryContext : QueryContextBase {
     return numWalked_;
   }
 
+  // The number of results rendered so far, including any already streamed
+  int64_t getNumResults() const {
+    return numStreamedResults_ + resultsArray.size() +
+        (bserRows ? bserRows->size() : 0);
+  }
+
+  // Returns true once as many files have matched as the query's limit
+  // allows. Never true for a sorted query, since a file found later may sort
+  // ahead of the others.
+  bool isResultLimitReached() const {
+    return resultLimit_ && numMatched_ >= resultLimit_;
+  }
+
+  // Returns true once the query has run past its deadline or its client has
+  // gone away.  As this is called for every file walked, the clock and the
+  // client are only consulted every so many calls.
+  bool isCancelled();
+
+  // Throws QueryExecError, saying why, if isCancelled()
+  void throwIfCancelled();
+
+  // Generators check this to stop walking early, which also releases the
+  // view lock as soon as possible for a cancelled query.
+  bool shouldStopGenerating() {
+    return isResultLimitReached() || isCancelled();
+  }
+
+  // When the query is being explained, starts a stage for the named
+  // generator.  The files walked and matched until endExplainStage() are
+  // attributed to it.
+  void beginExplainStage(const char* generator);
+  void endExplainStage();
+
+  // Notes how the generator of the current stage finds its files, and how
+  // many it expects to visit if an index can tell cheaply.  Does nothing
+  // unless the query is being explained.
+  void explainMethod(
+      const char* method,
+      std::optional<int64_t> estimatedFiles = std::nullopt);
+
+  int64_t getNumMatched() const {
+    return numMatched_;
+  }
+
+  // Counts a file that matched and is being added to the results
+  void bumpNumMatched() {
+    ++numMatched_;
+  }
+
   void resetWholeName();
 
   /**
@@ -121,6 +222,34 @@ struct QueryContext : QueryContextBase {
   // them to w_query_process_file().
   void fetchEvalBatchNow();
 
+  // Appends a rendered result, handing a chunk to streamResults if it is
+  // set and enough results have accumulated.
+  void addResult(json_ref&& rendered);
+
+  // While a generator runs it holds the view lock, so between
+  // startStreamWriter() and finishStreamWriter() chunks of streamed results
+  // are written by a thread of their own, and a slow client can't hold up
+  // the IO thread or other queries for long.  At most a few chunks wait to
+  // be written; once those are queued, the generator waits for the client.
+  // finishStreamWriter() returns once the queued chunks are written, and
+  // rethrows any error from writing them.
+  void startStreamWriter() {
+    writeStreamInBackground_ = true;
+  }
+  void finishStreamWriter();
+
+  // Renders file into bserRows.  Returns false, leaving bserRows unchanged,
+  // if data still needs to be loaded for one of the fields.
+  bool encodeResult(FileResult* file);
+
+  // Adds a file that matched the query to the results.  For a sorted query
+  // it is held, or dropped if it falls outside the limit, until
+  // renderSortedMatches(); otherwise it is passed on to maybeRender().
+  void addMatch(std::unique_ptr<FileResult>&& file);
+
+  // Puts the matches held by addMatch() in order and renders them.
+  void renderSortedMatches();
+
   void maybeRender(std::unique_ptr<FileResult>&& file);
   void addToRenderBatch(std::unique_ptr<FileResult>&& file);
 
@@ -132,6 +261,16 @@ struct QueryContext : QueryContextBase {
 
   w_string computeWholeName(FileResult* file) const;
 
+  // The dir part of computeWholeName(file), which is empty for files at the
+  // top of the root or relative root.  Refers to the file's dirName().
+  w_string_piece relativeDirName(FileResult* file) const;
+
+  // For Query::front_coded_names: returns name as a [shared, suffix] pair,
+  // where shared counts the leading path components it has in common with
+  // the name of the previous result. The name is only remembered as the
+  // previous one if its result is added.
+  json_ref frontCodeName(const w_string& name) const;
+
   // Returns true if the filename associated with `f` matches
   // the relative_root constraint set on the query.
   // Delegates to dirMatchesRelativeRoot().
@@ -150,11 +289,70 @@ struct QueryContext : QueryContextBase {
   bool dirMatchesRelativeRoot(w_string_piece fullDirectoryPath);
 
  private:
+  void maybeStreamResults();
+
+  // Throws QueryExecError if the watch is over its memory_soft_limit_mb
+  // and the results held for this query, whether rendered as JSON, encoded
+  // into bserRows or waiting for streamWriter_, have reached
+  // memory_limit_max_results.
+  void checkResultMemoryLimit() const;
+
+  struct SortedMatch {
+    // The sort key, depending on Query::sort
+    w_string name;
+    struct timespec mtime {};
+    std::unique_ptr<FileResult> file;
+  };
+
+  bool sortsBefore(const SortedMatch& a, const SortedMatch& b) const;
+  void addSortedMatch(std::unique_ptr<FileResult>&& file);
+  void fetchSortKeysNow();
+
+  // Renders `file` if it has everything its fields need
+  bool tryRender(const std::unique_ptr<FileResult>& file);
+
+  // Loads what the sorted matches from `start` onwards need to render, in
+  // one batch, so that they can still be rendered one at a time in order.
+  void fetchSortedRenderBatch(size_t start);
+
   std::optional<w_string> wholename_;
 
+  // The structure generation of the view that dedupNodes came from
+  std::optional<uint64_t> dedupNodesGeneration_;
+
+  // The name of the last result added, and the one most recently passed to
+  // frontCodeName(), for Query::front_coded_names
+  w_string previousName_;
+  mutable w_string renderedName_;
+
   // Number of files considered as part of running this query
   int64_t numWalked_{0};
 
+  // Number of results already passed to streamResults, or queued for
+  // streamWriter_
+  int64_t numStreamedResults_{0};
+
+  // Set by startStreamWriter(); streamWriter_ is started for the first
+  // chunk that follows
+  class StreamWriter;
+  bool writeStreamInBackground_{false};
+  std::unique_ptr<StreamWriter> streamWriter_;
+
+  // Query::limit for unsorted queries, or zero for no limit
+  const int64_t resultLimit_;
+
+  // Number of files that matched, including those not yet rendered
+  int64_t numMatched_{0};
+
+  // The counts when the current explain stage began
+  int64_t explainStageWalked_{0};
+  int64_t explainStageMatched_{0};
+
+  enum class CancelReason { None, Deadline, ClientGone };
+  CancelReason cancelReason_{CancelReason::None};
+  // Calls to isCancelled() left until it next consults the clock and client
+  uint32_t cancelCheckCountdown_{0};
+
   // Files for which we encountered NeedMoreData and that we
   // will re-evaluate once we have enough of them accumulated
   // to batch fetch the required data
@@ -165,6 +363,13 @@ struct QueryContext : QueryContextBase {
   // expression and are just pending data to be loaded
   // for rendering the result fields.
   std::vector<std::unique_ptr<FileResult>> renderBatch_;
+
+  // The matches of a sorted query.  With a limit, this is a heap of the
+  // first ones in order, with the last of them on top.
+  std::vector<SortedMatch> sortedMatches_;
+
+  // Matches of a sorted query waiting on data for their sort key
+  std::vector<std::unique_ptr<FileResult>> sortKeyBatch_;
 };
 
 } // namespace watchman
@@ -7,10 +7,14 @@
 
 #pragma once
 
+#include <cstdint>
+#include <limits>
 #include <optional>
+#include <string>
 #include <vector>
 #include "watchman/Clock.h"
 #include "watchman/fs/FileDescriptor.h"
+#include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
 
 namespace watchman {
@@ -43,6 +47,57 @@ enum AggregateOp {
   AllOf,
 };
 
+/**
+ * A coarse measure of how expensive an expression is to evaluate for a
+ * single file, used to order the terms of allof and anyof expressions.
+ */
+enum class EvaluationCost {
+  // Only consults fields that the FileResult already holds
+  Cheap,
+  // String comparisons or hash lookups on the file name
+  Moderate,
+  // Pattern matching
+  Expensive,
+};
+
+/**
+ * Text that must appear somewhere in the basename of every file that an
+ * expression matches.
+ */
+struct NameFragment {
+  std::string text;
+  CaseSensitivity caseSensitive;
+};
+
+/**
+ * A stat field that generators with a stat index can look files up by.
+ */
+enum class StatRangeField {
+  Size,
+  // In whole seconds
+  Mtime,
+};
+
+/**
+ * Inclusive bounds on a StatRangeField of the files that an expression
+ * matches.  Empty if min > max.
+ */
+struct StatRange {
+  int64_t min{std::numeric_limits<int64_t>::min()};
+  int64_t max{std::numeric_limits<int64_t>::max()};
+};
+
+/**
+ * A directory that holds every file an expression matches, and the deepest
+ * those files can be below it.  Files directly in the directory are at
+ * depth 0.
+ */
+struct DirDepthBound {
+  // Relative to the query's relative_root; empty for the root itself
+  w_string dirname;
+  uint32_t maxDepth;
+};
+
 /**
  * Describes which part of a simple suffix expression
  */
@@ -94,6 +149,71 @@ class QueryExpr {
    */
   virtual ReturnOnlyFiles listOnlyFiles() const = 0;
 
+  /**
+   * Returns whether evaluate() may be called concurrently from multiple
+   * threads, each with its own QueryContextBase and FileResult.
+   * Used to decide whether a large batch of files can have their
+   * expression evaluated across the thread pool.
+   */
+  virtual bool isThreadSafe() const {
+    return false;
+  }
+
+  virtual EvaluationCost evaluationCost() const {
+    return EvaluationCost::Expensive;
+  }
+
+  /**
+   * Returns a tick value such that this expression can only match files
+   * whose otime ticks are strictly greater than it, or nullopt if the
+   * expression places no such constraint on the files that it matches.
+   * Tree walking generators use this to skip subtrees in which nothing has
+   * changed since that tick.
+   */
+  virtual std::optional<ClockTicks> computeOtimeLowerBound(
+      QueryContextBase* /*ctx*/) const {
+    return std::nullopt;
+  }
+
+  /**
+   * Returns a set of fragments such that every file this expression matches
+   * has at least one of them in its basename, or nullopt if no such set can
+   * be derived. Generators with a filename index use this to visit only the
+   * files whose names contain one of the fragments.
+   */
+  virtual std::optional<std::vector<NameFragment>> computeNameFragments()
+      const {
+    return std::nullopt;
+  }
+
+  /**
+   * Returns the range that `field` of every file this expression matches
+   * falls in, or nullopt if the expression places no such constraint on it.
+   * Generators with a stat index use this to visit only the files in range.
+   */
+  virtual std::optional<StatRange> computeStatRange(
+      StatRangeField /*field*/) const {
+    return std::nullopt;
+  }
+
+  /**
+   * Returns the directory and depth that every file this expression matches
+   * lies within, or nullopt if the expression doesn't limit how deep its
+   * matches can be.  Tree walking generators use this to stop descending
+   * past that depth.
+   */
+  virtual std::optional<DirDepthBound> computeDirDepthBound() const {
+    return std::nullopt;
+  }
+
+  /**
+   * Returns true if this expression can only match directories.  Generators
+   * that know where the directories are use this to visit just them.
+   */
+  virtual bool matchesOnlyDirs() const {
+    return false;
+  }
+
   /**
    * Returns whether this expression is a simple suffix expression, or a part
    * of a simple suffix expression. A simple suffix expression is an allof
@@ -103,6 +223,24 @@ class QueryExpr {
    * pass to eden's globFiles API.
    */
   virtual SimpleSuffixType evaluateSimpleSuffix() const = 0;
+
+  /**
+   * Describes this expression for Query::explain: the term that it was
+   * parsed from and its evaluation cost.  Expressions with subexpressions
+   * add them, in the order in which they are evaluated.
+   */
+  virtual json_ref explain() const;
+
+  // The name of the term that this expression was parsed from
+  const w_string& getTermName() const {
+    return termName_;
+  }
+  void setTermName(w_string name) {
+    termName_ = std::move(name);
+  }
+
+ private:
+  w_string termName_;
 };
 
 } // namespace watchman
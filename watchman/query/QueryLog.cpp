@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/QueryLog.h"
+
+#include <fmt/core.h>
+#include <folly/hash/Hash.h>
+#include <memory>
+
+#include "watchman/RingBuffer.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryContext.h"
+#include "watchman/root/Root.h"
+
+namespace watchman {
+
+namespace {
+
+uint32_t toMs(std::chrono::milliseconds duration) {
+  return uint32_t(std::max(int64_t(0), int64_t(duration.count())));
+}
+
+// Compact with sorted keys, and without the fields that differ between
+// runs of what is otherwise the same query
+std::string canonicalQuery(const Query& query) {
+  if (!query.query_spec || !query.query_spec->isObject()) {
+    return {};
+  }
+  auto canonical = json_object();
+  for (auto& [key, value] : query.query_spec->object()) {
+    if (key != "since" && key != "request_id") {
+      canonical.set(key, json_ref(value));
+    }
+  }
+  return json_dumps(canonical, JSON_COMPACT | JSON_SORT_KEYS);
+}
+
+struct QueryLogs {
+  std::unique_ptr<RingBuffer<QueryLogEntry>> recent;
+  std::unique_ptr<RingBuffer<QueryLogEntry>> slow;
+  std::chrono::milliseconds slowThreshold;
+
+  QueryLogs()
+      : slowThreshold{cfg_get_int("query_log_slow_ms", 1000)} {
+    auto size = cfg_get_int("query_log_size", 256);
+    if (size > 0) {
+      recent = std::make_unique<RingBuffer<QueryLogEntry>>(uint32_t(size));
+      slow = std::make_unique<RingBuffer<QueryLogEntry>>(uint32_t(size));
+    }
+  }
+};
+
+QueryLogs& getQueryLogs() {
+  static QueryLogs* logs = new QueryLogs;
+  return *logs;
+}
+
+json_ref entriesToJson(const std::unique_ptr<RingBuffer<QueryLogEntry>>& ring) {
+  std::vector<json_ref> entries;
+  if (ring) {
+    for (auto& entry : ring->readAll()) {
+      entries.push_back(entry.asJsonValue());
+    }
+  }
+  return json_array(std::move(entries));
+}
+
+} // namespace
+
+QueryLogEntry::QueryLogEntry(const QueryContext& ctx, pid_t pid) {
+  auto elapsed = std::chrono::steady_clock::now() - ctx.created;
+  started = std::chrono::system_clock::now() -
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(elapsed);
+
+  auto canonical = canonicalQuery(*ctx.query);
+  queryHash = folly::hash::fnv64(canonical);
+  clientPid = pid;
+
+  totalMs = toMs(
+      std::chrono::duration_cast<std::chrono::milliseconds>(elapsed));
+  cookieSyncMs = toMs(ctx.cookieSyncDuration.load());
+  lockWaitMs = toMs(ctx.viewLockWaitDuration.load());
+  generateMs = toMs(ctx.generationDuration.load());
+  renderMs = toMs(ctx.renderDuration.load());
+
+  results = uint32_t(ctx.getNumResults());
+  walked = uint32_t(ctx.getNumWalked());
+
+  storeTruncatedTail(rootTail, ctx.root->root_path);
+  storeTruncatedHead(queryHead, canonical);
+}
+
+json_ref QueryLogEntry::asJsonValue() const {
+  return json_object({
+      {"started",
+       json_integer(std::chrono::duration_cast<std::chrono::milliseconds>(
+                        started.time_since_epoch())
+                        .count())},
+      {"query_hash", typed_string_to_json(fmt::format("{:016x}", queryHash))},
+      {"query",
+       w_string_to_json(
+           w_string{queryHead, strnlen(queryHead, kQueryLength)})},
+      {"root",
+       w_string_to_json(w_string{rootTail, strnlen(rootTail, kRootLength)})},
+      {"client_pid", json_integer(clientPid)},
+      {"total_ms", json_integer(totalMs)},
+      {"cookie_sync_ms", json_integer(cookieSyncMs)},
+      {"lock_wait_ms", json_integer(lockWaitMs)},
+      {"generate_ms", json_integer(generateMs)},
+      {"render_ms", json_integer(renderMs)},
+      {"results", json_integer(results)},
+      {"walked", json_integer(walked)},
+  });
+}
+
+void logQueryExecution(const QueryContext& ctx, pid_t clientPid) {
+  auto& logs = getQueryLogs();
+  if (!logs.recent) {
+    return;
+  }
+  QueryLogEntry entry{ctx, clientPid};
+  logs.recent->write(entry);
+  if (logs.slowThreshold.count() > 0 &&
+      std::chrono::milliseconds(entry.totalMs) >= logs.slowThreshold) {
+    logs.slow->write(entry);
+  }
+}
+
+json_ref getQueryLog() {
+  auto& logs = getQueryLogs();
+  return json_object({
+      {"queries", entriesToJson(logs.recent)},
+      {"slow_queries", entriesToJson(logs.slow)},
+      {"slow_query_threshold_ms", json_integer(logs.slowThreshold.count())},
+  });
+}
+
+void clearQueryLog() {
+  auto& logs = getQueryLogs();
+  if (logs.recent) {
+    logs.recent->clear();
+    logs.slow->clear();
+  }
+}
+
+} // namespace watchman
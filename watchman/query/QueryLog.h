@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/portability/SysTypes.h>
+#include <chrono>
+#include <cstdint>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace watchman {
+
+struct QueryContext;
+
+/**
+ * A fixed-size record of one query execution, for the recent and slow query
+ * logs reported by debug-query-log.
+ */
+struct QueryLogEntry {
+  QueryLogEntry() noexcept {
+    // time_point is not noexcept so this can't be defaulted.
+  }
+  QueryLogEntry(const QueryContext& ctx, pid_t clientPid);
+
+  json_ref asJsonValue() const;
+
+  static constexpr size_t kRootLength = 48;
+  static constexpr size_t kQueryLength = 96;
+
+  std::chrono::system_clock::time_point started;
+  // Hash of the query with the fields that vary between invocations of the
+  // same query, such as its since clock, removed.
+  uint64_t queryHash;
+  pid_t clientPid;
+
+  uint32_t totalMs;
+  uint32_t cookieSyncMs;
+  uint32_t lockWaitMs;
+  uint32_t generateMs;
+  uint32_t renderMs;
+
+  uint32_t results;
+  uint32_t walked;
+
+  char rootTail[kRootLength];
+  char queryHead[kQueryLength];
+};
+
+/**
+ * Records a completed query in the recent query log, and in the slow query
+ * log if it took at least query_log_slow_ms.
+ */
+void logQueryExecution(const QueryContext& ctx, pid_t clientPid);
+
+/**
+ * Returns {"queries": [...], "slow_queries": [...]}, oldest first.
+ */
+json_ref getQueryLog();
+
+void clearQueryLog();
+
+} // namespace watchman
@@ -9,11 +9,18 @@
 
 namespace watchman {
 
+namespace {
+thread_local QueryCost* currentQueryCost = nullptr;
+}
+
 json_ref RenderResult::toJson() && {
   auto arr = json_array(std::move(results));
   if (templ) {
     json_array_set_template_new(arr, std::move(*templ));
   }
+  if (bserRows) {
+    json_array_set_bser_rows(arr, std::move(bserRows));
+  }
   return arr;
 }
 
@@ -27,4 +34,56 @@ json_ref QueryDebugInfo::render() const {
   });
 }
 
+json_ref QueryCost::render() const {
+  return json_object({
+      {"walked", json_integer(walked)},
+      {"evaluated", json_integer(evaluated)},
+      {"stat_calls", json_integer(statCalls)},
+      {"hash_cache_hits", json_integer(hashCacheHits)},
+      {"hash_cache_misses", json_integer(hashCacheMisses)},
+      {"lock_wait_ms", json_integer(lockWait.count())},
+      {"bytes_encoded", json_integer(bytesEncoded)},
+  });
+}
+
+json_ref QueryExplainStage::render() const {
+  auto stage = json_object({
+      {"generator", w_string_to_json(generator)},
+      {"walked", json_integer(walked)},
+      {"matched", json_integer(matched)},
+  });
+  if (method) {
+    stage.set("method", w_string_to_json(*method));
+  }
+  if (estimatedFiles) {
+    stage.set("estimated_files", json_integer(*estimatedFiles));
+  }
+  return stage;
+}
+
+json_ref QueryExplain::render() const {
+  std::vector<json_ref> arr;
+  for (auto& stage : stages) {
+    arr.push_back(stage.render());
+  }
+  return json_object({
+      {"generators", json_array(std::move(arr))},
+      {"expression", expression ? *expression : json_null()},
+      {"evaluated", json_integer(evaluated)},
+      {"results", json_integer(results)},
+  });
+}
+
+QueryCost* QueryCost::current() {
+  return currentQueryCost;
+}
+
+QueryCost::Scope::Scope(QueryCost& cost) : previous_{currentQueryCost} {
+  currentQueryCost = &cost;
+}
+
+QueryCost::Scope::~Scope() {
+  currentQueryCost = previous_;
+}
+
 } // namespace watchman
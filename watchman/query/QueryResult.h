@@ -7,6 +7,10 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <unordered_set>
 #include <vector>
 #include "watchman/Clock.h"
@@ -21,15 +25,103 @@ struct QueryDebugInfo {
   json_ref render() const;
 };
 
+// What a query cost to execute. Reported to the client when the query sets
+// `cost`, and always logged with the query's PerfSample.
+struct QueryCost {
+  // Files visited by the generators
+  int64_t walked{0};
+  // Times a file was evaluated against the query
+  int64_t evaluated{0};
+  // Filesystem metadata reads made on behalf of the query
+  int64_t statCalls{0};
+  int64_t hashCacheHits{0};
+  int64_t hashCacheMisses{0};
+  // Time spent waiting for the view lock
+  std::chrono::milliseconds lockWait{0};
+  // Bytes of results encoded while rendering them; only results rendered
+  // directly to BSER are encoded before the response is sent.
+  int64_t bytesEncoded{0};
+
+  json_ref render() const;
+
+  /**
+   * The cost of the query being executed on this thread, or nullptr.
+   * Lets the code fetching file properties account for them without access
+   * to the QueryContext.
+   */
+  static QueryCost* current();
+
+  // Makes `cost` the current cost for the lifetime of the scope.
+  class Scope {
+   public:
+    explicit Scope(QueryCost& cost);
+    ~Scope();
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    QueryCost* previous_;
+  };
+};
+
+// What one generator did for a query. See QueryExplain.
+struct QueryExplainStage {
+  // The generator, as named by the query field that selected it
+  w_string generator;
+  // How the generator found its files, for views that say, eg: the index
+  // that it used
+  std::optional<w_string> method;
+  // How many files the generator expected to visit, when its index could
+  // tell cheaply
+  std::optional<int64_t> estimatedFiles;
+  int64_t walked{0};
+  int64_t matched{0};
+
+  json_ref render() const;
+};
+
+// How a query was executed. Reported to the client when the query sets
+// `explain`.
+struct QueryExplain {
+  // In the order in which they ran
+  std::vector<QueryExplainStage> stages;
+  // The query's expression, with its terms in evaluation order
+  std::optional<json_ref> expression;
+  int64_t evaluated{0};
+  int64_t results{0};
+
+  json_ref render() const;
+};
+
 struct RenderResult {
   std::vector<json_ref> results;
   std::optional<json_ref> templ;
+  // Results that were encoded directly to BSER, against templ if there is
+  // one, or as one value each; they precede the entries in `results`.  See
+  // BserResultEncoding.
+  std::shared_ptr<const BserTemplateRows> bserRows;
 
   json_ref toJson() &&;
 };
 
+// Describes the BSER encoding that the caller will use to send the results.
+// When provided, results are encoded as they are rendered instead of being
+// held as a json_ref per file.  For a query with only the name field, the
+// names are written straight from the view.  The rendered results can then
+// only be serialized with this encoding.
+struct BserResultEncoding {
+  uint32_t version;
+  uint32_t capabilities;
+};
+
+// Receives a chunk of rendered results from a query that was asked to
+// stream them. See Query::stream_results.
+using QueryResultsCallback = std::function<void(RenderResult&& chunk)>;
+
 struct QueryResult {
   bool isFreshInstance;
+  // Whether the query stopped early because it reached its limit
+  bool limitReached{false};
   RenderResult resultsArray;
   // Only populated if the query was set to dedup_results
   std::unordered_set<w_string> dedupedFileNames;
@@ -37,6 +129,12 @@ struct QueryResult {
   uint32_t stateTransCountAtStartOfQuery;
   std::optional<json_ref> savedStateInfo;
   QueryDebugInfo debugInfo;
+  QueryCost cost;
+  // Only populated if the query was set to explain
+  std::optional<QueryExplain> explain;
+  // Only populated if the query was answered before the initial crawl ended:
+  // the number of files it had statted.
+  std::optional<size_t> initialCrawlStatCount;
 };
 
 } // namespace watchman
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/QueryResultCache.h"
+#include "watchman/bser.h"
+#include "watchman/query/Query.h"
+
+namespace watchman {
+
+QueryResultCache::QueryResultCache(size_t maxEntries, size_t maxResults)
+    : cache_{maxEntries, std::chrono::milliseconds{0}},
+      maxResults_{maxResults} {}
+
+std::optional<w_string> QueryResultCache::keyFor(
+    const Query& query,
+    std::optional<BserResultEncoding> bserEncoding) {
+  if (!query.query_spec || !query.query_spec->isObject()) {
+    return std::nullopt;
+  }
+
+  // The since clock is taken from since_spec rather than the query spec, as
+  // that is what the query is evaluated against.
+  w_string since{"-"};
+  if (const auto* since_spec = query.since_spec.get()) {
+    if (since_spec->hasScmParams() || since_spec->hasSavedStateParams()) {
+      return std::nullopt;
+    }
+    if (const auto* clock = std::get_if<ClockSpec::Clock>(&since_spec->spec)) {
+      since = w_string::build(
+          clock->start_time,
+          ":",
+          clock->pid,
+          ":",
+          clock->position.rootNumber,
+          ":",
+          clock->position.ticks);
+    } else if (
+        const auto* timestamp =
+            std::get_if<ClockSpec::Timestamp>(&since_spec->spec)) {
+      since = w_string::build("t:", timestamp->time);
+    } else {
+      return std::nullopt;
+    }
+  }
+
+  // Leave out the fields that only affect how long the query may wait
+  auto spec = json_object();
+  for (auto& [key, value] : query.query_spec->object()) {
+    if (key == "since" || key == "request_id" || key == "sync_timeout" ||
+        key == "lock_timeout") {
+      continue;
+    }
+    spec.set(key, json_ref(value));
+  }
+
+  w_string encoding{"json"};
+  if (bserEncoding && !query.fieldList.empty()) {
+    encoding = w_string::build(
+        "bser", bserEncoding->version, ":", bserEncoding->capabilities);
+  }
+
+  return w_string::build(
+      since,
+      ":",
+      encoding,
+      ":",
+      json_dumps(spec, JSON_SORT_KEYS | JSON_COMPACT));
+}
+
+std::optional<QueryResultCache::Entry> QueryResultCache::get(
+    const w_string& key,
+    ClockRoot rootNumber,
+    uint64_t contentGeneration,
+    ClockTicks lastAgeOutTick) {
+  auto node = cache_.get(key);
+  if (!node) {
+    return std::nullopt;
+  }
+  const auto& entry = node->value();
+  if (entry.rootNumber != rootNumber ||
+      entry.contentGeneration != contentGeneration ||
+      entry.lastAgeOutTick != lastAgeOutTick) {
+    return std::nullopt;
+  }
+  return entry;
+}
+
+void QueryResultCache::set(const w_string& key, Entry&& entry) {
+  auto& results = entry.resultsArray;
+  size_t numResults =
+      results.results.size() + (results.bserRows ? results.bserRows->size() : 0);
+  if (numResults > maxResults_) {
+    // Replacing a stale entry with nothing saves a lookup that can't hit
+    cache_.erase(key);
+    return;
+  }
+  cache_.set(key, std::move(entry));
+}
+
+void QueryResultCache::clear() {
+  cache_.clear();
+}
+
+CacheStats QueryResultCache::stats() const {
+  return cache_.stats();
+}
+
+} // namespace watchman
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <optional>
+#include <unordered_set>
+#include "watchman/Clock.h"
+#include "watchman/LRUCache.h"
+#include "watchman/query/QueryResult.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+struct Query;
+
+/**
+ * Remembers the rendered results of recent queries against a root, so that
+ * a repeat of the same query while the view is unchanged is answered without
+ * evaluating it again.
+ *
+ * Each entry records the view's content generation (see
+ * QueryableView::getContentGeneration) and age-out tick when it was
+ * evaluated, and is only returned while both still hold.  Stale entries are
+ * not purged eagerly; they age out of the LRU as new results are stored.
+ */
+class QueryResultCache {
+ public:
+  struct Entry {
+    ClockRoot rootNumber;
+    uint64_t contentGeneration;
+    ClockTicks lastAgeOutTick;
+    bool isFreshInstance;
+    bool limitReached;
+    RenderResult resultsArray;
+    std::unordered_set<w_string> dedupedFileNames;
+  };
+
+  /**
+   * Holds up to maxEntries results, and doesn't hold results of more than
+   * maxResults files.
+   */
+  QueryResultCache(size_t maxEntries, size_t maxResults);
+
+  /**
+   * Returns the key that identifies `query` in the cache, or nullopt if its
+   * results depend on more than the query and the state of the view.  That
+   * is the case for named cursors, which each query advances, and for SCM
+   * aware queries, which consult the SCM.  Results that are encoded to BSER
+   * as they are rendered can only be reused with the same encoding.
+   */
+  static std::optional<w_string> keyFor(
+      const Query& query,
+      std::optional<BserResultEncoding> bserEncoding);
+
+  /**
+   * Returns the entry for key if it was evaluated against the view at
+   * this position.
+   */
+  std::optional<Entry> get(
+      const w_string& key,
+      ClockRoot rootNumber,
+      uint64_t contentGeneration,
+      ClockTicks lastAgeOutTick);
+
+  /**
+   * Stores entry under key, unless it has too many results.
+   */
+  void set(const w_string& key, Entry&& entry);
+
+  void clear();
+
+  CacheStats stats() const;
+
+ private:
+  LRUCache<w_string, Entry> cache_;
+  const size_t maxResults_;
+};
+
+} // namespace watchman
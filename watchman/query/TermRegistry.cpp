@@ -68,7 +68,27 @@ std::unique_ptr<QueryExpr> parseQueryExpr(Query* query, const json_ref& exp) {
     throw QueryParseError("expected array or string for an expression");
   }
 
-  return getQueryExprParser(name)(query, exp);
+  auto expr = getQueryExprParser(name)(query, exp);
+  expr->setTermName(std::move(name));
+  return expr;
+}
+
+json_ref QueryExpr::explain() const {
+  const char* cost = "expensive";
+  switch (evaluationCost()) {
+    case EvaluationCost::Cheap:
+      cost = "cheap";
+      break;
+    case EvaluationCost::Moderate:
+      cost = "moderate";
+      break;
+    case EvaluationCost::Expensive:
+      break;
+  }
+  return json_object({
+      {"term", w_string_to_json(termName_)},
+      {"cost", typed_string_to_json(cost)},
+  });
 }
 
 } // namespace watchman
@@ -9,6 +9,9 @@
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/TermRegistry.h"
 
+#include <algorithm>
+#include <iterator>
+#include <limits>
 #include <memory>
 #include <queue>
 #include <unordered_set>
@@ -65,6 +68,20 @@ class NotExpr : public QueryExpr {
     return ReturnOnlyFiles::Unrelated;
   }
 
+  EvaluationCost evaluationCost() const override {
+    return expr->evaluationCost();
+  }
+
+  json_ref explain() const override {
+    auto result = QueryExpr::explain();
+    result.set("terms", json_array({expr->explain()}));
+    return result;
+  }
+
+  bool isThreadSafe() const override {
+    return expr->isThreadSafe();
+  }
+
   SimpleSuffixType evaluateSimpleSuffix() const override {
     return SimpleSuffixType::Excluded;
   }
@@ -96,6 +113,14 @@ class TrueExpr : public QueryExpr {
     return ReturnOnlyFiles::Unrelated;
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Cheap;
+  }
+
+  bool isThreadSafe() const override {
+    return true;
+  }
+
   SimpleSuffixType evaluateSimpleSuffix() const override {
     return SimpleSuffixType::Excluded;
   }
@@ -127,6 +152,14 @@ class FalseExpr : public QueryExpr {
     return ReturnOnlyFiles::Unrelated;
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Cheap;
+  }
+
+  bool isThreadSafe() const override {
+    return true;
+  }
+
   SimpleSuffixType evaluateSimpleSuffix() const override {
     return SimpleSuffixType::Excluded;
   }
@@ -180,6 +213,138 @@ class ListExpr : public QueryExpr {
     return allof;
   }
 
+  std::optional<ClockTicks> computeOtimeLowerBound(
+      QueryContextBase* ctx) const override {
+    std::optional<ClockTicks> result;
+    for (auto& expr : exprs) {
+      auto bound = expr->computeOtimeLowerBound(ctx);
+      if (allof) {
+        // Every term must match, so the tightest bound applies.
+        if (bound && (!result || *bound > *result)) {
+          result = bound;
+        }
+      } else {
+        // Any term may match, so every term must be bounded.
+        if (!bound) {
+          return std::nullopt;
+        }
+        if (!result || *bound < *result) {
+          result = bound;
+        }
+      }
+    }
+    return result;
+  }
+
+  std::optional<std::vector<NameFragment>> computeNameFragments()
+      const override {
+    std::optional<std::vector<NameFragment>> result;
+    if (allof) {
+      // Every term must match, so any term's fragments will do. Prefer the
+      // set whose shortest fragment is longest, as longer fragments are
+      // contained in fewer names.
+      auto shortest = [](const std::vector<NameFragment>& fragments) {
+        size_t len = std::numeric_limits<size_t>::max();
+        for (auto& fragment : fragments) {
+          len = std::min(len, fragment.text.size());
+        }
+        return len;
+      };
+      for (auto& expr : exprs) {
+        auto fragments = expr->computeNameFragments();
+        if (fragments &&
+            (!result || shortest(*fragments) > shortest(*result))) {
+          result = std::move(fragments);
+        }
+      }
+      return result;
+    }
+
+    // Any term may match, so every term must have fragments.
+    result.emplace();
+    for (auto& expr : exprs) {
+      auto fragments = expr->computeNameFragments();
+      if (!fragments) {
+        return std::nullopt;
+      }
+      result->insert(
+          result->end(),
+          std::make_move_iterator(fragments->begin()),
+          std::make_move_iterator(fragments->end()));
+    }
+    return result;
+  }
+
+  std::optional<StatRange> computeStatRange(
+      StatRangeField field) const override {
+    std::optional<StatRange> result;
+    for (auto& expr : exprs) {
+      auto range = expr->computeStatRange(field);
+      if (allof) {
+        // Every term must match, so the ranges intersect.
+        if (range) {
+          if (!result) {
+            result = range;
+          } else {
+            result->min = std::max(result->min, range->min);
+            result->max = std::min(result->max, range->max);
+          }
+        }
+      } else {
+        // Any term may match, so every term must be bounded, and the
+        // result spans them all.
+        if (!range) {
+          return std::nullopt;
+        }
+        if (!result) {
+          result = range;
+        } else {
+          result->min = std::min(result->min, range->min);
+          result->max = std::max(result->max, range->max);
+        }
+      }
+    }
+    return result;
+  }
+
+  std::optional<DirDepthBound> computeDirDepthBound() const override {
+    std::optional<DirDepthBound> result;
+    for (auto& expr : exprs) {
+      auto bound = expr->computeDirDepthBound();
+      if (allof) {
+        // Every term must match, so any term's bound will do. Prefer the
+        // shallowest, as it stops the walk soonest.
+        if (bound && (!result || bound->maxDepth < result->maxDepth)) {
+          result = std::move(bound);
+        }
+      } else {
+        // Any term may match, so every term must be bounded within the same
+        // directory.
+        if (!bound || (result && bound->dirname != result->dirname)) {
+          return std::nullopt;
+        }
+        if (!result || bound->maxDepth > result->maxDepth) {
+          result = std::move(bound);
+        }
+      }
+    }
+    return result;
+  }
+
+  bool matchesOnlyDirs() const override {
+    if (allof) {
+      // Every term must match, so any term that only matches dirs will do.
+      return std::any_of(exprs.begin(), exprs.end(), [](const auto& expr) {
+        return expr->matchesOnlyDirs();
+      });
+    }
+    // Any term may match, so every term must only match dirs.
+    return !exprs.empty() &&
+        std::all_of(exprs.begin(), exprs.end(), [](const auto& expr) {
+             return expr->matchesOnlyDirs();
+           });
+  }
+
   static std::unique_ptr<QueryExpr>
   parse(Query* query, const json_ref& term, bool allof) {
     std::vector<std::unique_ptr<QueryExpr>> list;
@@ -206,6 +371,7 @@ class ListExpr : public QueryExpr {
         // Try to aggregate with previous expression
         auto aggExpr = list.back().get()->aggregate(parsed.get(), op);
         if (aggExpr) {
+          aggExpr->setTermName(list.back()->getTermName());
           list.back() = std::move(aggExpr);
         } else {
           list.emplace_back(std::move(parsed));
@@ -213,6 +379,15 @@ class ListExpr : public QueryExpr {
       }
     }
 
+    // Terms have no side effects, so evaluate the cheapest first to give
+    // the short circuiting above the best chance of skipping expensive
+    // pattern matches.  The sort is stable so that terms of equal cost
+    // keep the order in which they were written.
+    std::stable_sort(
+        list.begin(), list.end(), [](const auto& a, const auto& b) {
+          return a->evaluationCost() < b->evaluationCost();
+        });
+
     return std::make_unique<ListExpr>(allof, std::move(list));
   }
 
@@ -337,6 +512,34 @@ class ListExpr : public QueryExpr {
     return result;
   }
 
+  EvaluationCost evaluationCost() const override {
+    auto result = EvaluationCost::Cheap;
+    for (auto& expr : exprs) {
+      result = std::max(result, expr->evaluationCost());
+    }
+    return result;
+  }
+
+  json_ref explain() const override {
+    std::vector<json_ref> terms;
+    terms.reserve(exprs.size());
+    for (auto& expr : exprs) {
+      terms.push_back(expr->explain());
+    }
+    auto result = QueryExpr::explain();
+    result.set("terms", json_array(std::move(terms)));
+    return result;
+  }
+
+  bool isThreadSafe() const override {
+    for (auto& expr : exprs) {
+      if (!expr->isThreadSafe()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
   SimpleSuffixType evaluateSimpleSuffix() const override {
     if (allof) {
       std::vector<SimpleSuffixType> types;
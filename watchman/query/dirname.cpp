@@ -12,6 +12,7 @@
 #include "watchman/query/TermRegistry.h"
 #include "watchman/query/intcompare.h"
 
+#include <limits>
 #include <memory>
 
 using namespace watchman;
@@ -175,10 +176,45 @@ class DirNameExpr : public QueryExpr {
     return std::vector<std::string>{outputPattern.string() + "/**"};
   }
 
+  std::optional<DirDepthBound> computeDirDepthBound() const override {
+    // Generators resolve the directory exactly, so a case insensitive match
+    // can't be bounded this way.  Backslashes are separators to evaluate()
+    // but not to the view.
+    if (caseSensitive == CaseSensitivity::CaseInSensitive ||
+        dirname.view().find('\\') != std::string_view::npos) {
+      return std::nullopt;
+    }
+    switch (depth.op) {
+      case W_QUERY_ICMP_EQ:
+      case W_QUERY_ICMP_LE:
+        if (depth.operand < 0 ||
+            depth.operand >= std::numeric_limits<uint32_t>::max()) {
+          return std::nullopt;
+        }
+        return DirDepthBound{dirname, uint32_t(depth.operand)};
+      case W_QUERY_ICMP_LT:
+        if (depth.operand < 1 ||
+            depth.operand > std::numeric_limits<uint32_t>::max()) {
+          return std::nullopt;
+        }
+        return DirDepthBound{dirname, uint32_t(depth.operand - 1)};
+      default:
+        return std::nullopt;
+    }
+  }
+
   ReturnOnlyFiles listOnlyFiles() const override {
     return ReturnOnlyFiles::Unrelated;
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Moderate;
+  }
+
+  bool isThreadSafe() const override {
+    return true;
+  }
+
   SimpleSuffixType evaluateSimpleSuffix() const override {
     return SimpleSuffixType::Excluded;
   }
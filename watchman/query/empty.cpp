@@ -35,6 +35,14 @@ class ExistsExpr : public QueryExpr {
     return ReturnOnlyFiles::Unrelated;
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Cheap;
+  }
+
+  bool isThreadSafe() const override {
+    return true;
+  }
+
   SimpleSuffixType evaluateSimpleSuffix() const override {
     return SimpleSuffixType::Excluded;
   }
@@ -88,6 +96,14 @@ class EmptyExpr : public QueryExpr {
     return ReturnOnlyFiles::Unrelated;
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Cheap;
+  }
+
+  bool isThreadSafe() const override {
+    return true;
+  }
+
   SimpleSuffixType evaluateSimpleSuffix() const override {
     return SimpleSuffixType::Excluded;
   }
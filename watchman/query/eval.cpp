@@ -9,22 +9,31 @@
 
 #include <fmt/chrono.h>
 #include <folly/ScopeGuard.h>
+#include <folly/futures/Future.h>
+#include <algorithm>
 
 #include "eden/common/utils/ProcessInfoCache.h"
 #include "watchman/ClientContext.h"
 #include "watchman/CommandRegistry.h"
+#include "watchman/CrawlScheduler.h"
 #include "watchman/Errors.h"
 #include "watchman/PerfSample.h"
+#include "watchman/QueryScheduler.h"
 #include "watchman/QueryableView.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/Tracepoint.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/query/GlobTree.h"
-#include "watchman/query/LocalFileResult.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
+#include "watchman/query/QueryLog.h"
+#include "watchman/query/QueryResultCache.h"
+#include "watchman/query/parse.h"
 #include "watchman/root/Root.h"
 #include "watchman/saved_state/SavedStateInterface.h"
 #include "watchman/scm/SCM.h"
 #include "watchman/telemetry/LogEvent.h"
+#include "watchman/telemetry/WatchmanStats.h"
 #include "watchman/telemetry/WatchmanStructuredLogger.h"
 
 using namespace watchman;
@@ -51,13 +60,66 @@ const std::vector<w_string>& getUnconditionalLogFilePrefixes() {
       computeUnconditionalLogFilePrefixes();
   return names;
 }
+
+// Batches smaller than this are evaluated on the calling thread; below this
+// size the cost of dispatching to the thread pool outweighs the benefit.
+constexpr size_t kMinParallelEvalFiles = 8192;
+constexpr size_t kMinFilesPerEvalTask = 2048;
+constexpr size_t kMaxEvalTasks = 16;
+
+// A minimal context for evaluating a query expression on a thread pool
+// worker.  It computes the wholename the same way as the QueryContext
+// but without touching any of its mutable state.
+class ParallelEvalContext final : public QueryContextBase {
+ public:
+  explicit ParallelEvalContext(const QueryContext& ctx) : ctx_(ctx) {
+    clockAtStartOfQuery = ctx.clockAtStartOfQuery;
+    lastAgeOutTickValueAtStartOfQuery = ctx.lastAgeOutTickValueAtStartOfQuery;
+  }
+
+  void setFile(FileResult* file) {
+    file_ = file;
+    wholename_.reset();
+  }
+
+  const w_string& getWholeName() override {
+    if (!wholename_) {
+      wholename_ = ctx_.computeWholeName(file_);
+    }
+    return *wholename_;
+  }
+
+ private:
+  const QueryContext& ctx_;
+  FileResult* file_{nullptr};
+  std::optional<w_string> wholename_;
+};
+
+void evaluateRange(
+    const QueryContext& ctx,
+    const std::vector<std::unique_ptr<FileResult>>& files,
+    std::vector<EvaluateResult>& matches,
+    size_t begin,
+    size_t end) {
+  ParallelEvalContext evalCtx{ctx};
+  for (size_t i = begin; i < end; ++i) {
+    evalCtx.setFile(files[i].get());
+    matches[i] = ctx.query->expr->evaluate(&evalCtx, files[i].get());
+  }
+}
 } // namespace
 
 /* Query evaluator */
 void w_query_process_file(
     const Query* query,
     QueryContext* ctx,
-    std::unique_ptr<FileResult> file) {
+    std::unique_ptr<FileResult> file,
+    bool exprAlreadyMatched) {
+  if (ctx->shouldStopGenerating()) {
+    return;
+  }
+  ++ctx->cost.evaluated;
+
   // TODO: Should this be implicit by assigning a file to the QueryContext? It
   // could be cleared when resetting the file.
   ctx->resetWholeName();
@@ -88,7 +150,7 @@ void w_query_process_file(
 
   // We produce an output for this file if there is no expression,
   // or if the expression matched.
-  if (query->expr) {
+  if (query->expr && !exprAlreadyMatched) {
     auto match = query->expr->evaluate(ctx, ctx->file.get());
 
     if (!match.has_value()) {
@@ -101,10 +163,11 @@ void w_query_process_file(
   }
 
   if (ctx->query->dedup_results) {
-    auto name = ctx->getWholeName();
-
-    auto inserted = ctx->dedup.insert(name);
-    if (!inserted.second) {
+    // The node identifies files from the view without building their names
+    const void* node = ctx->dedupByName ? nullptr : ctx->file->viewNode();
+    bool inserted = node ? ctx->dedupNodes.insert(node).second
+                         : ctx->dedup.insert(ctx->getWholeName()).second;
+    if (!inserted) {
       // Already present in the results, no need to emit it again
       ctx->num_deduped++;
       return;
@@ -121,7 +184,73 @@ void w_query_process_file(
     }
   }
 
-  ctx->maybeRender(std::move(ctx->file));
+  ctx->bumpNumMatched();
+  ctx->addMatch(std::move(ctx->file));
+}
+
+void w_query_process_files(
+    const Query* query,
+    QueryContext* ctx,
+    std::vector<std::unique_ptr<FileResult>> files) {
+  if (ctx->shouldStopGenerating()) {
+    return;
+  }
+  if (files.size() < kMinParallelEvalFiles || !query->expr ||
+      !query->expr->isThreadSafe() ||
+      !ctx->root->config.getBool("query_parallel_eval", true)) {
+    for (auto& file : files) {
+      if (ctx->shouldStopGenerating()) {
+        break;
+      }
+      w_query_process_file(query, ctx, std::move(file));
+    }
+    return;
+  }
+
+  // Fan the expression evaluation out over contiguous ranges of the batch.
+  // Everything else, including re-evaluation of files that need more data,
+  // happens below on this thread in the original order, so the results
+  // are the same as for serial evaluation.
+  auto numTasks = std::min(kMaxEvalTasks, files.size() / kMinFilesPerEvalTask);
+  auto perTask = (files.size() + numTasks - 1) / numTasks;
+  std::vector<EvaluateResult> matches(files.size());
+  std::vector<folly::Future<folly::Unit>> futures;
+
+  // The tasks reference our locals, so they must be done before we return,
+  // even if we are throwing an exception.
+  SCOPE_EXIT {
+    if (!futures.empty()) {
+      folly::collectAll(futures.begin(), futures.end()).wait();
+    }
+  };
+
+  for (size_t begin = perTask; begin < files.size(); begin += perTask) {
+    auto end = std::min(files.size(), begin + perTask);
+    try {
+      futures.emplace_back(folly::via(&getThreadPool(), [&, begin, end] {
+        evaluateRange(*ctx, files, matches, begin, end);
+      }));
+    } catch (const std::exception& exc) {
+      // The pool is full or shutting down; do the work ourselves.
+      log(DBG, "evaluating query inline: ", exc.what(), "\n");
+      evaluateRange(*ctx, files, matches, begin, end);
+    }
+  }
+  evaluateRange(*ctx, files, matches, 0, std::min(files.size(), perTask));
+
+  auto results = folly::collectAll(futures.begin(), futures.end()).get();
+  futures.clear();
+  for (auto& result : results) {
+    result.throwUnlessValue();
+  }
+
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (matches[i].has_value() && !*matches[i]) {
+      continue;
+    }
+    w_query_process_file(
+        query, ctx, std::move(files[i]), matches[i].has_value());
+  }
 }
 
 void time_generator(
@@ -131,32 +260,60 @@ void time_generator(
   root->view()->timeGenerator(query, ctx);
 }
 
+// Runs one of the generators, accounting for what it did in the query's
+// explanation.
+template <typename Generate>
+static void runGenerator(QueryContext* ctx, const char* name, Generate&& generate) {
+  ctx->beginExplainStage(name);
+  // The generators hold the view lock, so streamed chunks are written off
+  // this thread
+  ctx->startStreamWriter();
+  generate();
+  ctx->finishStreamWriter();
+  ctx->endExplainStage();
+}
+
 static void default_generators(
     const Query* query,
     const std::shared_ptr<Root>& root,
     QueryContext* ctx) {
+  bool bySince = ctx->since.is_timestamp() || !ctx->since.is_fresh_instance();
+  int numGenerators = int(bySince) + int(query->paths.has_value()) +
+      int(bool(query->glob_tree));
+  // A file may come from more than one generator, and the view may free and
+  // reuse nodes between them, so only names identify it across generators
+  if (numGenerators > 1 && !ctx->dedupByName) {
+    ctx->dedupByName = true;
+    ctx->dedup.reserve(ctx->dedupNodes.bucket_count());
+    ctx->dedupNodes = {};
+  }
   bool generated = false;
 
   // Time based query
-  if (ctx->since.is_timestamp() || !ctx->since.is_fresh_instance()) {
-    time_generator(query, root, ctx);
+  if (bySince) {
+    runGenerator(ctx, "since", [&] { time_generator(query, root, ctx); });
     generated = true;
   }
 
   if (query->paths.has_value()) {
-    root->view()->pathGenerator(query, ctx);
+    runGenerator(
+        ctx, "path", [&] { root->view()->pathGenerator(query, ctx); });
     generated = true;
   }
 
   if (query->glob_tree) {
-    root->view()->globGenerator(query, ctx);
+    // Suffixes are expressed as a glob tree
+    runGenerator(ctx, query->suffixes ? "suffix" : "glob", [&] {
+      root->view()->globGenerator(query, ctx);
+    });
     generated = true;
   }
 
   // And finally, if there were no other generators, we walk all known
   // files
   if (!generated) {
-    root->view()->allFilesGenerator(query, ctx);
+    runGenerator(
+        ctx, "all", [&] { root->view()->allFilesGenerator(query, ctx); });
   }
 }
 
@@ -168,9 +325,27 @@ static void execute_common(
     QueryGenerator generator,
     const ClientContext& clientInfo) {
   ctx->stopWatch.reset();
+  QueryCost::Scope costScope{ctx->cost};
+  auto* rootPath = ctx->root->root_path.c_str();
+  WATCHMAN_TRACE(query__start, rootPath, uintptr_t(ctx));
 
+  auto expectedResults = ctx->query->expected_results;
+  if (ctx->query->limit) {
+    expectedResults = std::min(expectedResults, size_t(ctx->query->limit));
+  }
   if (ctx->query->dedup_results) {
-    ctx->dedup.reserve(64);
+    if (ctx->dedupByName) {
+      ctx->dedup.reserve(std::max(size_t(64), expectedResults));
+    } else {
+      ctx->dedupNodes.reserve(std::max(size_t(64), expectedResults));
+    }
+  }
+  if (!ctx->bserRows) {
+    if (ctx->streamResults && ctx->query->stream_results) {
+      expectedResults =
+          std::min(expectedResults, size_t(ctx->query->stream_results));
+    }
+    ctx->resultsArray.reserve(expectedResults);
   }
 
   // isFreshInstance is also later set by the value in ctx after generator
@@ -179,27 +354,53 @@ static void execute_common(
     res->isFreshInstance = since_clock && since_clock->is_fresh_instance;
   }
 
+  WATCHMAN_TRACE(query__generate, rootPath, uintptr_t(ctx));
   if (!(res->isFreshInstance && ctx->query->empty_on_fresh_instance)) {
-    if (!generator) {
-      generator = default_generators;
+    if (generator) {
+      runGenerator(
+          ctx, "custom", [&] { generator(ctx->query, ctx->root, ctx); });
+    } else {
+      default_generators(ctx->query, ctx->root, ctx);
     }
-    generator(ctx->query, ctx->root, ctx);
   }
+  // The generators stop early for a cancelled query, so don't render what
+  // they found.
+  ctx->throwIfCancelled();
+  ctx->deferRenderFetches = false;
   ctx->generationDuration = ctx->stopWatch.lap();
   ctx->state = QueryContextState::Rendering;
+  WATCHMAN_TRACE(query__render, rootPath, uintptr_t(ctx), ctx->getNumWalked());
 
   // We may have some file results pending re-evaluation,
   // so make sure that we process them before we get to
   // the render phase below.
   ctx->fetchEvalBatchNow();
+  ctx->renderSortedMatches();
   while (!ctx->fetchRenderBatchNow()) {
     // Depending on the implementation of the query terms and
     // the field renderers, we may need to do a couple of fetches
     // to get all that we need, so we loop until we get them all.
+    ctx->throwIfCancelled();
   }
 
   ctx->renderDuration = ctx->stopWatch.lap();
   ctx->state = QueryContextState::Completed;
+  WATCHMAN_TRACE(query__end, rootPath, uintptr_t(ctx), ctx->getNumResults());
+
+  ctx->cost.walked = ctx->getNumWalked();
+  ctx->cost.lockWait = ctx->viewLockWaitDuration.load();
+  if (ctx->bserRows) {
+    ctx->cost.bytesEncoded = ctx->bserRows->data().size();
+  }
+
+  {
+    auto stats = getWatchmanStats();
+    stats->addDuration(
+        &PipelineStats::queryViewLockWait, ctx->viewLockWaitDuration.load());
+    stats->addDuration(
+        &PipelineStats::queryGenerate, ctx->generationDuration.load());
+    stats->addDuration(&PipelineStats::queryRender, ctx->renderDuration.load());
+  }
 
   // For Eden instances it is possible that when running the query it was
   // discovered that it is actually a fresh instance [e.g. mount generation
@@ -241,8 +442,9 @@ static void execute_common(
       auto meta = json_object({
           {"fresh_instance", json_boolean(res->isFreshInstance)},
           {"num_deduped", json_integer(ctx->num_deduped)},
-          {"num_results", json_integer(ctx->resultsArray.size())},
+          {"num_results", json_integer(ctx->getNumResults())},
           {"num_walked", json_integer(ctx->getNumWalked())},
+          {"cost", ctx->cost.render()},
       });
       if (ctx->query->query_spec) {
         meta.set("query", json_ref(*ctx->query->query_spec));
@@ -259,7 +461,7 @@ static void execute_common(
       queryExecute->event_count = eventCount != samplingRate ? 0 : eventCount;
       queryExecute->fresh_instance = res->isFreshInstance;
       queryExecute->deduped = ctx->num_deduped;
-      queryExecute->results = ctx->resultsArray.size();
+      queryExecute->results = ctx->getNumResults();
       queryExecute->walked = ctx->getNumWalked();
       queryExecute->eden_glob_files_duration_us =
           ctx->edenGlobFilesDurationUs.load(std::memory_order_relaxed);
@@ -281,8 +483,25 @@ static void execute_common(
     }
   }
 
+  res->limitReached =
+      ctx->query->limit && ctx->getNumMatched() >= ctx->query->limit;
+  if (sample) {
+    // Benchmark iterations are not logged
+    logQueryExecution(*ctx, clientInfo.clientPid);
+  }
+
+  if (ctx->explain) {
+    if (ctx->query->expr) {
+      ctx->explain->expression = ctx->query->expr->explain();
+    }
+    ctx->explain->evaluated = ctx->cost.evaluated;
+    ctx->explain->results = ctx->getNumResults();
+    res->explain = std::move(ctx->explain);
+  }
+
   res->resultsArray = ctx->renderResults();
   res->dedupedFileNames = std::move(ctx->dedup);
+  res->cost = ctx->cost;
 }
 
 // Capability indicating support for scm-aware since queries
@@ -292,11 +511,17 @@ QueryResult w_query_execute(
     const Query* query,
     const std::shared_ptr<Root>& root,
     QueryGenerator generator,
-    SavedStateFactory savedStateFactory) {
+    SavedStateFactory savedStateFactory,
+    QueryResultsCallback streamResults,
+    std::optional<BserResultEncoding> bserEncoding) {
   QueryResult res;
+  auto started = std::chrono::steady_clock::now();
   ClockSpec resultClock(ClockPosition{});
   bool disableFreshInstance{false};
   auto requestId = query->request_id;
+  // Callers that supply their own generator know something about the
+  // query that its spec doesn't say, so their results aren't cached.
+  bool usesDefaultGenerators = !generator;
 
   QueryExecute queryExecute;
   PerfSample sample("query_execute");
@@ -305,6 +530,12 @@ QueryResult w_query_execute(
     queryExecute.request_id = requestId->string();
     sample.add_meta("request_id", w_string_to_json(*requestId));
   }
+  root->noteQuery();
+  // Background roots pause their crawls while this runs
+  std::optional<CrawlScheduler::QueryScope> queryScope;
+  if (!root->background_priority) {
+    queryScope.emplace(getCrawlScheduler().beginQuery());
+  }
 
   // We want to check this before we sync, as the SCM may generate changes
   // in the filesystem when running the underlying commands to query it.
@@ -319,6 +550,7 @@ QueryResult w_query_execute(
     // determine if SCM operations ocurred concurrent with query execution.
     res.stateTransCountAtStartOfQuery = root->stateTransCount.load();
     resultClock.scmMergeBaseWith = query->since_spec->scmMergeBaseWith;
+    scm->noteMergeBaseTarget(resultClock.scmMergeBaseWith);
     resultClock.scmMergeBase =
         scm->mergeBaseWith(resultClock.scmMergeBaseWith, requestId);
     // Always update the saved state storage type and key, but conditionally
@@ -387,24 +619,7 @@ QueryResult w_query_execute(
                   requestId);
 
           ClockStamp clock{position.ticks, ::time(nullptr)};
-          for (const auto& path : changedFiles) {
-            auto fullPath = w_string::pathCat({r->root_path, path});
-            if (!c->fileMatchesRelativeRoot(fullPath)) {
-              continue;
-            }
-            // Note well!  At the time of writing the LocalFileResult class
-            // assumes that removed entries must have been regular files.
-            // We don't have enough information returned from
-            // getFilesChangedSinceMergeBaseWith() to distinguish between
-            // deleted files and deleted symlinks.  Also, it is not possible
-            // to see a directory returned from that call; we're only going
-            // to enumerate !dirs for this case.
-            w_query_process_file(
-                q,
-                c,
-                std::make_unique<LocalFileResult>(
-                    fullPath, clock, r->case_sensitive));
-          }
+          r->view()->scmChangesGenerator(q, c, changedFiles, clock);
         };
       } else if (query->fail_if_no_saved_state) {
         throw QueryExecError(
@@ -428,6 +643,9 @@ QueryResult w_query_execute(
     };
   }
   QueryContext ctx{query, root, disableFreshInstance};
+  if (query->deadline.count()) {
+    ctx.deadline = started + query->deadline;
+  }
 
   // Track the query against the root.
   // This is to enable the `watchman debug-status` diagnostic command.
@@ -447,7 +665,40 @@ QueryResult w_query_execute(
           query->settle_timeouts->settle_timeout);
     }
   }
-  if (query->sync_timeout.count()) {
+  // With serve_crawled_subtrees, a query that only reads subtrees that the
+  // initial crawl is done with doesn't wait for the rest of it.
+  if (root->view()->isCrawledForQuery(query)) {
+    auto statCount = root->recrawlInfo.rlock()->statCount;
+    res.initialCrawlStatCount = statCount ? statCount->load() : 0;
+  } else {
+    // With lazy_crawl, the parts of the tree this query reads may not have
+    // been crawled yet.  That is a sync in all but name, so it gets the
+    // sync_timeout, or the lock_timeout of a query that skips the sync.
+    std::chrono::milliseconds crawlTimeout = query->sync_timeout.count()
+        ? query->sync_timeout
+        : std::chrono::milliseconds{query->lock_timeout};
+    if (!crawlTimeout.count()) {
+      crawlTimeout = kDefaultQuerySyncTimeout;
+    }
+    if (ctx.deadline) {
+      crawlTimeout = std::max(
+          std::min(
+              crawlTimeout,
+              std::chrono::duration_cast<std::chrono::milliseconds>(
+                  *ctx.deadline - std::chrono::steady_clock::now())),
+          std::chrono::milliseconds(0));
+    }
+    try {
+      root->view()->crawlForQuery(query).get(crawlTimeout);
+    } catch (const folly::FutureTimeout&) {
+      // The crawl carries on, so a retry finds the directories crawled
+      QueryExecError::throwf(
+          "synchronization failed: timed out after {}ms waiting for deferred "
+          "directories to be crawled",
+          crawlTimeout.count());
+    }
+  }
+  if (query->sync_timeout.count() && !res.initialCrawlStatCount.has_value()) {
     ctx.state = QueryContextState::WaitingForCookieSync;
     ctx.stopWatch.reset();
     try {
@@ -457,6 +708,8 @@ QueryResult w_query_execute(
       QueryExecError::throwf("synchronization failed: {}", exc.what());
     }
     ctx.cookieSyncDuration = ctx.stopWatch.lap();
+    getWatchmanStats()->addDuration(
+        &PipelineStats::queryCookieSync, ctx.cookieSyncDuration.load());
   }
 
   /* The first stage of execution is generation.
@@ -488,6 +741,57 @@ QueryResult w_query_execute(
                                       &root->inner.cursors)
                                 : QuerySince{};
 
+  // A repeat of a query against an unchanged view reuses its results,
+  // unless it asked to be explained, which means running it.
+  std::optional<w_string> cacheKey;
+  std::optional<uint64_t> contentGeneration;
+  if (root->queryResultCache && usesDefaultGenerators &&
+      !query->stream_results && !query->explain &&
+      query->bench_iterations == 0) {
+    contentGeneration = root->view()->getContentGeneration();
+    if (contentGeneration) {
+      cacheKey = QueryResultCache::keyFor(*query, bserEncoding);
+    }
+  }
+  if (cacheKey) {
+    auto cached = root->queryResultCache->get(
+        *cacheKey,
+        ctx.clockAtStartOfQuery.position().rootNumber,
+        *contentGeneration,
+        ctx.lastAgeOutTickValueAtStartOfQuery);
+    if (cached) {
+      log(DBG, "query results reused from an identical query\n");
+      res.isFreshInstance = cached->isFreshInstance;
+      res.limitReached = cached->limitReached;
+      res.resultsArray = std::move(cached->resultsArray);
+      res.dedupedFileNames = std::move(cached->dedupedFileNames);
+      return res;
+    }
+  }
+
+  // Wait for a turn to evaluate, so that one busy client can't hold up the
+  // queries of everyone else.
+  ctx.state = QueryContextState::Queued;
+  ctx.stopWatch.reset();
+  std::chrono::milliseconds queueTimeout{
+      root->config.getInt("query_queue_timeout_ms", 60000)};
+  if (ctx.deadline) {
+    queueTimeout = std::min(
+        queueTimeout,
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            *ctx.deadline - std::chrono::steady_clock::now()));
+  }
+  auto ticket = getQueryScheduler().admit(
+      query->clientInfo.clientPid,
+      root->root_path,
+      query->priority,
+      std::max(queueTimeout, std::chrono::milliseconds(0)));
+  ctx.queueDuration = ctx.stopWatch.lap();
+  getWatchmanStats()->addDuration(
+      &PipelineStats::queryQueueWait, ctx.queueDuration.load());
+  // The sync or the queue may have used up the time the query had
+  ctx.throwIfCancelled();
+
   if (query->bench_iterations > 0) {
     for (uint32_t i = 0; i < query->bench_iterations; ++i) {
       QueryContext c{query, root, ctx.disableFreshInstance};
@@ -498,8 +802,30 @@ QueryResult w_query_execute(
     }
   }
 
+  // Benchmark iterations above discard their results, so only the real
+  // execution streams.
+  if (query->stream_results) {
+    ctx.streamResults = std::move(streamResults);
+  }
+  if (bserEncoding && !query->fieldList.empty()) {
+    ctx.bserRows = std::make_shared<BserTemplateRows>(
+        bserEncoding->version, bserEncoding->capabilities);
+  }
   execute_common(
       &ctx, &queryExecute, &sample, &res, generator, query->clientInfo);
+
+  if (cacheKey) {
+    root->queryResultCache->set(
+        *cacheKey,
+        QueryResultCache::Entry{
+            ctx.clockAtStartOfQuery.position().rootNumber,
+            *contentGeneration,
+            ctx.lastAgeOutTickValueAtStartOfQuery,
+            res.isFreshInstance,
+            res.limitReached,
+            res.resultsArray,
+            res.dedupedFileNames});
+  }
   return res;
 }
 
@@ -9,6 +9,7 @@
 
 #include <functional>
 #include <memory>
+#include <vector>
 #include "watchman/query/FileResult.h"
 #include "watchman/query/QueryResult.h"
 #include "watchman/saved_state/SavedStateInterface.h"
@@ -33,19 +34,40 @@ using QueryGenerator = std::function<void(
  *
  * savedStateFactory allows testing this function without pulling in a wide
  * set of dependencies.
+ *
+ * If the query sets stream_results and streamResults is provided, results
+ * are passed to streamResults in chunks as they are rendered, and only the
+ * final partial chunk is left in the returned QueryResult.
+ *
+ * If bserEncoding is provided, the results are encoded for it as they are
+ * rendered; see BserResultEncoding.
  */
 watchman::QueryResult w_query_execute(
     const watchman::Query* query,
     const std::shared_ptr<watchman::Root>& root,
     watchman::QueryGenerator generator,
-    watchman::SavedStateFactory savedStateFactory);
+    watchman::SavedStateFactory savedStateFactory,
+    watchman::QueryResultsCallback streamResults = nullptr,
+    std::optional<watchman::BserResultEncoding> bserEncoding = std::nullopt);
 
 // Allows a generator to process a file node
-// through the query engine
+// through the query engine.
+// If exprAlreadyMatched is true, the caller has already evaluated the query
+// expression against this file and it matched.
 void w_query_process_file(
     const watchman::Query* query,
     watchman::QueryContext* ctx,
-    std::unique_ptr<watchman::FileResult> file);
+    std::unique_ptr<watchman::FileResult> file,
+    bool exprAlreadyMatched = false);
+
+// Processes a batch of files through the query engine, in order, with the
+// same outcome as calling w_query_process_file on each of them.
+// For large batches, and when the query expression permits it, the
+// expression is first evaluated in parallel on the thread pool.
+void w_query_process_files(
+    const watchman::Query* query,
+    watchman::QueryContext* ctx,
+    std::vector<std::unique_ptr<watchman::FileResult>> files);
 
 void time_generator(
     const watchman::Query* query,
@@ -5,11 +5,14 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <tuple>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
+#include "watchman/bser.h"
 #include "watchman/query/FileResult.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
+#include "watchman/watchman_system.h"
 #include "watchman/watchman_time.h"
 
 namespace watchman {
@@ -17,9 +20,24 @@ namespace watchman {
 namespace {
 
 std::optional<json_ref> make_name(FileResult* file, const QueryContext* ctx) {
+  if (ctx->query->front_coded_names) {
+    return ctx->frontCodeName(ctx->computeWholeName(file));
+  }
   return w_string_to_json(ctx->computeWholeName(file));
 }
 
+bool encode_name(
+    FileResult* file,
+    const QueryContext* ctx,
+    BserTemplateRows& rows) {
+  if (ctx->query->front_coded_names) {
+    rows.appendJson(ctx->frontCodeName(ctx->computeWholeName(file)));
+    return true;
+  }
+  rows.appendPath(ctx->relativeDirName(file), file->baseName());
+  return true;
+}
+
 std::optional<json_ref> make_symlink(FileResult* file, const QueryContext*) {
   auto target = file->readLink();
   if (!target.has_value()) {
@@ -32,14 +50,18 @@ std::optional<json_ref> make_symlink(FileResult* file, const QueryContext*) {
   }
 }
 
-std::optional<json_ref> make_sha1_hex(FileResult* file, const QueryContext*) {
+// Renders the digest returned by getHash, or the reason there is none
+template <typename GetHash>
+std::optional<json_ref> make_content_hash_hex(
+    FileResult* file,
+    GetHash getHash) {
   try {
-    auto hash = file->getContentSha1();
+    auto hash = getHash(file);
     if (!hash.has_value()) {
       // Need to load it still
       return std::nullopt;
     }
-    char buf[40];
+    char buf[std::tuple_size_v<typename decltype(hash)::value_type> * 2];
     static const char* hexDigit = "0123456789abcdef";
     for (size_t i = 0; i < hash->size(); ++i) {
       auto& digit = (*hash)[i];
@@ -66,6 +88,18 @@ std::optional<json_ref> make_sha1_hex(FileResult* file, const QueryContext*) {
   }
 }
 
+std::optional<json_ref> make_sha1_hex(FileResult* file, const QueryContext*) {
+  return make_content_hash_hex(
+      file, [](FileResult* f) { return f->getContentSha1(); });
+}
+
+#ifdef HAVE_XXHASH
+std::optional<json_ref> make_xxh3_hex(FileResult* file, const QueryContext*) {
+  return make_content_hash_hex(
+      file, [](FileResult* f) { return f->getContentXxh3(); });
+}
+#endif
+
 std::optional<json_ref> make_size(FileResult* file, const QueryContext*) {
   auto size = file->size();
   if (!size.has_value()) {
@@ -74,6 +108,18 @@ std::optional<json_ref> make_size(FileResult* file, const QueryContext*) {
   return json_integer(size.value());
 }
 
+bool encode_size(
+    FileResult* file,
+    const QueryContext*,
+    BserTemplateRows& rows) {
+  auto size = file->size();
+  if (!size.has_value()) {
+    return false;
+  }
+  rows.appendInt(size.value());
+  return true;
+}
+
 std::optional<json_ref> make_exists(FileResult* file, const QueryContext*) {
   auto exists = file->exists();
   if (!exists.has_value()) {
@@ -82,27 +128,54 @@ std::optional<json_ref> make_exists(FileResult* file, const QueryContext*) {
   return json_boolean(exists.value());
 }
 
-std::optional<json_ref> make_new(FileResult* file, const QueryContext* ctx) {
-  bool is_new = false;
+bool encode_exists(
+    FileResult* file,
+    const QueryContext*,
+    BserTemplateRows& rows) {
+  auto exists = file->exists();
+  if (!exists.has_value()) {
+    return false;
+  }
+  rows.appendBool(exists.value());
+  return true;
+}
 
+std::optional<bool> is_new(FileResult* file, const QueryContext* ctx) {
   auto* since_clock = std::get_if<QuerySince::Clock>(&ctx->since.since);
   if (since_clock && since_clock->is_fresh_instance) {
-    is_new = true;
-  } else {
-    auto ctime = file->ctime();
-    if (!ctime.has_value()) {
-      // Reconsider this one later
-      return std::nullopt;
-    }
-    if (since_clock) {
-      is_new = ctime->ticks > since_clock->ticks;
-    } else {
-      auto& since_ts = std::get<QuerySince::Timestamp>(ctx->since.since);
-      is_new = since_ts.time > ctime->timestamp;
-    }
+    return true;
   }
 
-  return json_boolean(is_new);
+  auto ctime = file->ctime();
+  if (!ctime.has_value()) {
+    // Reconsider this one later
+    return std::nullopt;
+  }
+  if (since_clock) {
+    return ctime->ticks > since_clock->ticks;
+  }
+  auto& since_ts = std::get<QuerySince::Timestamp>(ctx->since.since);
+  return since_ts.time > ctime->timestamp;
+}
+
+std::optional<json_ref> make_new(FileResult* file, const QueryContext* ctx) {
+  auto value = is_new(file, ctx);
+  if (!value.has_value()) {
+    return std::nullopt;
+  }
+  return json_boolean(value.value());
+}
+
+bool encode_new(
+    FileResult* file,
+    const QueryContext* ctx,
+    BserTemplateRows& rows) {
+  auto value = is_new(file, ctx);
+  if (!value.has_value()) {
+    return false;
+  }
+  rows.appendBool(value.value());
+  return true;
 }
 
 #define MAKE_CLOCK_FIELD(name, member)                      \
@@ -133,39 +206,68 @@ static_assert(
     sizeof(json_int_t) >= sizeof(time_t),
     "json_int_t isn't large enough to hold a time_t");
 
-#define MAKE_INT_FIELD(name, member)           \
-  static std::optional<json_ref> make_##name(  \
-      FileResult* file, const QueryContext*) { \
-    auto stat = file->stat();                  \
-    if (!stat.has_value()) {                   \
-      /* need to load data */                  \
-      return std::nullopt;                     \
-    }                                          \
-    return json_integer(stat->member);         \
-  }
-
-#define MAKE_TIME_INT_FIELD(name, member, scale)                  \
-  static std::optional<json_ref> make_##name(                     \
-      FileResult* file, const QueryContext*) {                    \
-    auto spec = file->member();                                   \
-    if (!spec.has_value()) {                                      \
-      /* need to load data */                                     \
-      return std::nullopt;                                        \
-    }                                                             \
-    return json_integer(                                          \
-        ((int64_t)spec->tv_sec * scale) +                         \
-        ((int64_t)spec->tv_nsec * scale / WATCHMAN_NSEC_IN_SEC)); \
-  }
-
-#define MAKE_TIME_DOUBLE_FIELD(name, member)               \
-  static std::optional<json_ref> make_##name(              \
-      FileResult* file, const QueryContext*) {             \
-    auto spec = file->member();                            \
-    if (!spec.has_value()) {                               \
-      /* need to load data */                              \
-      return std::nullopt;                                 \
-    }                                                      \
-    return json_real(spec->tv_sec + 1e-9 * spec->tv_nsec); \
+#define MAKE_INT_FIELD(name, member)                                  \
+  static std::optional<json_ref> make_##name(                         \
+      FileResult* file, const QueryContext*) {                        \
+    auto stat = file->stat();                                         \
+    if (!stat.has_value()) {                                          \
+      /* need to load data */                                         \
+      return std::nullopt;                                            \
+    }                                                                 \
+    return json_integer(stat->member);                                \
+  }                                                                   \
+  static bool encode_##name(                                          \
+      FileResult* file, const QueryContext*, BserTemplateRows& rows) { \
+    auto stat = file->stat();                                         \
+    if (!stat.has_value()) {                                          \
+      return false;                                                   \
+    }                                                                 \
+    rows.appendInt(stat->member);                                     \
+    return true;                                                      \
+  }
+
+#define MAKE_TIME_INT_FIELD(name, member, scale)                      \
+  static std::optional<json_ref> make_##name(                         \
+      FileResult* file, const QueryContext*) {                        \
+    auto spec = file->member();                                       \
+    if (!spec.has_value()) {                                          \
+      /* need to load data */                                         \
+      return std::nullopt;                                            \
+    }                                                                 \
+    return json_integer(                                              \
+        ((int64_t)spec->tv_sec * scale) +                             \
+        ((int64_t)spec->tv_nsec * scale / WATCHMAN_NSEC_IN_SEC));     \
+  }                                                                   \
+  static bool encode_##name(                                          \
+      FileResult* file, const QueryContext*, BserTemplateRows& rows) { \
+    auto spec = file->member();                                       \
+    if (!spec.has_value()) {                                          \
+      return false;                                                   \
+    }                                                                 \
+    rows.appendInt(                                                   \
+        ((int64_t)spec->tv_sec * scale) +                             \
+        ((int64_t)spec->tv_nsec * scale / WATCHMAN_NSEC_IN_SEC));     \
+    return true;                                                      \
+  }
+
+#define MAKE_TIME_DOUBLE_FIELD(name, member)                          \
+  static std::optional<json_ref> make_##name(                         \
+      FileResult* file, const QueryContext*) {                        \
+    auto spec = file->member();                                       \
+    if (!spec.has_value()) {                                          \
+      /* need to load data */                                         \
+      return std::nullopt;                                            \
+    }                                                                 \
+    return json_real(spec->tv_sec + 1e-9 * spec->tv_nsec);            \
+  }                                                                   \
+  static bool encode_##name(                                          \
+      FileResult* file, const QueryContext*, BserTemplateRows& rows) { \
+    auto spec = file->member();                                       \
+    if (!spec.has_value()) {                                          \
+      return false;                                                   \
+    }                                                                 \
+    rows.appendReal(spec->tv_sec + 1e-9 * spec->tv_nsec);             \
+    return true;                                                      \
   }
 
 /* For each type (e.g. "m"), define fields
@@ -194,36 +296,37 @@ MAKE_INT_FIELD(nlink, nlink)
 
 // clang-format off
 #define MAKE_TIME_FIELD_DEFS(type) \
-  { #type "time", make_##type##time}, \
-  { #type "time_ms", make_##type##time_ms},\
-  { #type "time_us", make_##type##time_us}, \
-  { #type "time_ns", make_##type##time_ns}, \
-  { #type "time_f", make_##type##time_f}
+  { #type "time", make_##type##time, encode_##type##time}, \
+  { #type "time_ms", make_##type##time_ms, encode_##type##time_ms},\
+  { #type "time_us", make_##type##time_us, encode_##type##time_us}, \
+  { #type "time_ns", make_##type##time_ns, encode_##type##time_ns}, \
+  { #type "time_f", make_##type##time_f, encode_##type##time_f}
 // clang-format on
 
-std::optional<json_ref> make_type_field(FileResult* file, const QueryContext*) {
+// Returns the single letter code for the type of file
+std::optional<const char*> file_type_letter(FileResult* file) {
   auto dtype = file->dtype();
   if (dtype.has_value()) {
     switch (*dtype) {
       case DType::Regular:
-        return typed_string_to_json("f", W_STRING_UNICODE);
+        return "f";
       case DType::Dir:
-        return typed_string_to_json("d", W_STRING_UNICODE);
+        return "d";
       case DType::Symlink:
-        return typed_string_to_json("l", W_STRING_UNICODE);
+        return "l";
       case DType::Block:
-        return typed_string_to_json("b", W_STRING_UNICODE);
+        return "b";
       case DType::Char:
-        return typed_string_to_json("c", W_STRING_UNICODE);
+        return "c";
       case DType::Fifo:
-        return typed_string_to_json("p", W_STRING_UNICODE);
+        return "p";
       case DType::Socket:
-        return typed_string_to_json("s", W_STRING_UNICODE);
+        return "s";
       case DType::Whiteout:
         // Whiteout shouldn't generally be visible to userspace,
         // and we don't have a defined letter code for it, so
         // treat it as "who knows!?"
-        return typed_string_to_json("?", W_STRING_UNICODE);
+        return "?";
       case DType::Unknown:
       default:
           // Not enough info; fall through and use the full stat data
@@ -239,34 +342,54 @@ std::optional<json_ref> make_type_field(FileResult* file, const QueryContext*) {
 
   auto stat = optionalStat.value();
   if (stat.isFile()) {
-    return typed_string_to_json("f", W_STRING_UNICODE);
+    return "f";
   }
   if (stat.isDir()) {
-    return typed_string_to_json("d", W_STRING_UNICODE);
+    return "d";
   }
   if (stat.isSymlink()) {
-    return typed_string_to_json("l", W_STRING_UNICODE);
+    return "l";
   }
 #ifndef _WIN32
   if (S_ISBLK(stat.mode)) {
-    return typed_string_to_json("b", W_STRING_UNICODE);
+    return "b";
   }
   if (S_ISCHR(stat.mode)) {
-    return typed_string_to_json("c", W_STRING_UNICODE);
+    return "c";
   }
   if (S_ISFIFO(stat.mode)) {
-    return typed_string_to_json("p", W_STRING_UNICODE);
+    return "p";
   }
   if (S_ISSOCK(stat.mode)) {
-    return typed_string_to_json("s", W_STRING_UNICODE);
+    return "s";
   }
 #endif
 #ifdef S_ISDOOR
   if (S_ISDOOR(stat.mode)) {
-    return typed_string_to_json("D", W_STRING_UNICODE);
+    return "D";
   }
 #endif
-  return typed_string_to_json("?", W_STRING_UNICODE);
+  return "?";
+}
+
+std::optional<json_ref> make_type_field(FileResult* file, const QueryContext*) {
+  auto letter = file_type_letter(file);
+  if (!letter.has_value()) {
+    return std::nullopt;
+  }
+  return typed_string_to_json(letter.value(), W_STRING_UNICODE);
+}
+
+bool encode_type_field(
+    FileResult* file,
+    const QueryContext*,
+    BserTemplateRows& rows) {
+  auto letter = file_type_letter(file);
+  if (!letter.has_value()) {
+    return false;
+  }
+  rows.appendString(letter.value(), W_STRING_UNICODE);
+  return true;
 }
 
 // Helper to construct the list of field defs
@@ -274,30 +397,37 @@ std::unordered_map<w_string, QueryFieldRenderer> build_defs() {
   struct {
     const char* name;
     std::optional<json_ref> (*make)(FileResult* file, const QueryContext* ctx);
+    bool (*encode)(
+        FileResult* file,
+        const QueryContext* ctx,
+        BserTemplateRows& rows) = nullptr;
   } defs[] = {
-      {"name", make_name},
+      {"name", make_name, encode_name},
       {"symlink_target", make_symlink},
-      {"exists", make_exists},
-      {"size", make_size},
-      {"mode", make_mode},
-      {"uid", make_uid},
-      {"gid", make_gid},
+      {"exists", make_exists, encode_exists},
+      {"size", make_size, encode_size},
+      {"mode", make_mode, encode_mode},
+      {"uid", make_uid, encode_uid},
+      {"gid", make_gid, encode_gid},
       MAKE_TIME_FIELD_DEFS(a),
       MAKE_TIME_FIELD_DEFS(m),
       MAKE_TIME_FIELD_DEFS(c),
-      {"ino", make_ino},
-      {"dev", make_dev},
-      {"nlink", make_nlink},
-      {"new", make_new},
+      {"ino", make_ino, encode_ino},
+      {"dev", make_dev, encode_dev},
+      {"nlink", make_nlink, encode_nlink},
+      {"new", make_new, encode_new},
       {"oclock", make_oclock},
       {"cclock", make_cclock},
-      {"type", make_type_field},
+      {"type", make_type_field, encode_type_field},
       {"content.sha1hex", make_sha1_hex},
+#ifdef HAVE_XXHASH
+      {"content.xxh3hex", make_xxh3_hex},
+#endif
   };
   std::unordered_map<w_string, QueryFieldRenderer> map;
   for (auto& def : defs) {
     w_string name(def.name, W_STRING_UNICODE);
-    map.emplace(name, QueryFieldRenderer{name, def.make});
+    map.emplace(name, QueryFieldRenderer{name, def.make, def.encode});
   }
 
   return map;
@@ -6,9 +6,13 @@
  */
 
 #include <folly/ScopeGuard.h>
+#include <folly/Synchronized.h>
+#include <cstring>
 #include <memory>
+#include <unordered_map>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
+#include "watchman/query/CompiledGlob.h"
 #include "watchman/query/GlobTree.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
@@ -148,6 +152,67 @@ bool add_glob(GlobTree* tree, const w_string& glob_str) {
   return true;
 }
 
+// Compiles the pattern of every node below `node` for matching with `flags`,
+// in the way that the glob generator matches them.
+void compile_tree(GlobTree* node, int flags) {
+  for (auto& kid : node->children) {
+    kid->compiled = CompiledGlob::get(kid->pattern, flags);
+    compile_tree(kid.get(), flags);
+  }
+  for (auto& kid : node->doublestar_children) {
+    // ** patterns are matched against the whole path below the node
+    kid->compiled = CompiledGlob::get(kid->pattern, flags | WM_PATHNAME);
+    compile_tree(kid.get(), flags);
+  }
+}
+
+// Beyond this many distinct glob sets, the cache is emptied and starts over
+constexpr size_t kMaxCachedGlobTrees = 1024;
+
+// Returns the tree for `globs`, matched with `flags`. Tools tend to send the
+// same glob sets over and over, so trees are shared between queries.
+std::shared_ptr<const GlobTree> get_glob_tree(
+    const std::vector<w_string>& globs,
+    int flags) {
+  static folly::Synchronized<
+      std::unordered_map<std::string, std::shared_ptr<const GlobTree>>>
+      cache;
+
+  auto key = std::to_string(flags);
+  for (const auto& glob : globs) {
+    key.push_back('\0');
+    key.append(glob.data(), glob.size());
+  }
+
+  {
+    auto rlock = cache.rlock();
+    auto it = rlock->find(key);
+    if (it != rlock->end()) {
+      return it->second;
+    }
+  }
+
+  auto tree = make_unique<GlobTree>("", 0);
+  for (const auto& glob : globs) {
+    if (!add_glob(tree.get(), glob)) {
+      throw QueryParseError("failed to compile multi-glob");
+    }
+  }
+  compile_tree(tree.get(), flags);
+
+  auto wlock = cache.wlock();
+  if (wlock->size() >= kMaxCachedGlobTrees) {
+    wlock->clear();
+  }
+  return wlock->emplace(std::move(key), std::move(tree)).first->second;
+}
+
+// The flags that the glob generator matches the nodes of the tree with
+int glob_match_flags(const Query* res) {
+  return res->glob_flags |
+      (res->case_sensitive == CaseSensitivity::CaseSensitive ? 0 : WM_CASEFOLD);
+}
+
 } // namespace
 
 void parse_globs(Query* res, const json_ref& query) {
@@ -179,15 +244,11 @@ void parse_globs(Query* res, const json_ref& query) {
   res->glob_flags = (includedotfiles.asBool() ? 0 : WM_PERIOD) |
       (noescape.asBool() ? WM_NOESCAPE : 0);
 
-  res->glob_tree = make_unique<GlobTree>("", 0);
+  std::vector<w_string> patterns;
   for (i = 0; i < json_array_size(*globs); i++) {
-    const auto& ele = globs->at(i);
-    const auto& pattern = json_to_w_string(ele);
-
-    if (!add_glob(res->glob_tree.get(), pattern)) {
-      throw QueryParseError("failed to compile multi-glob");
-    }
+    patterns.push_back(json_to_w_string(globs->at(i)));
   }
+  res->glob_tree = get_glob_tree(patterns, glob_match_flags(res));
 }
 
 static w_string parse_suffix(const json_ref& ele) {
@@ -224,18 +285,30 @@ void parse_suffixes(Query* res, const json_ref& query) {
   res->dedup_results = true;
   // Suffix queries are defined as being case insensitive
   res->glob_flags = WM_CASEFOLD;
-  res->glob_tree = make_unique<GlobTree>("", 0);
 
+  std::vector<w_string> patterns;
+  std::vector<w_string> plainSuffixes;
+  bool allPlain = true;
   for (auto& ele : suffixArray) {
     if (!ele.isString()) {
       throw QueryParseError("'suffix' must be a string or an array of strings");
     }
 
     auto suff = parse_suffix(ele);
-    auto pattern = w_string::build("**/*.", suff);
-    if (!add_glob(res->glob_tree.get(), pattern)) {
-      throw QueryParseError("failed to compile multi-glob");
+    patterns.push_back(w_string::build("**/*.", suff));
+
+    // A suffix containing glob metacharacters has to be matched by the
+    // glob tree; a plain one can be served from the view's suffix index.
+    if (suff.empty() || suff.data()[suff.size() - 1] == '.' ||
+        strpbrk(suff.c_str(), "/*?[\\") != nullptr) {
+      allPlain = false;
     }
+    plainSuffixes.push_back(std::move(suff));
+  }
+  res->glob_tree = get_glob_tree(patterns, glob_match_flags(res));
+
+  if (allPlain) {
+    res->suffixes = std::move(plainSuffixes);
   }
 }
 
@@ -12,6 +12,7 @@
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/TermRegistry.h"
 
+#include <limits>
 #include <memory>
 
 namespace watchman {
@@ -123,6 +124,33 @@ class SizeExpr : public QueryExpr {
     return std::make_unique<SizeExpr>(comp);
   }
 
+  std::optional<StatRange> computeStatRange(
+      StatRangeField field) const override {
+    if (field != StatRangeField::Size) {
+      return std::nullopt;
+    }
+    constexpr auto kMin = std::numeric_limits<int64_t>::min();
+    constexpr auto kMax = std::numeric_limits<int64_t>::max();
+    int64_t operand = comp.operand;
+    switch (comp.op) {
+      case W_QUERY_ICMP_EQ:
+        return StatRange{operand, operand};
+      case W_QUERY_ICMP_GT:
+        return operand == kMax ? StatRange{kMax, kMin}
+                               : StatRange{operand + 1, kMax};
+      case W_QUERY_ICMP_GE:
+        return StatRange{operand, kMax};
+      case W_QUERY_ICMP_LT:
+        return operand == kMin ? StatRange{kMax, kMin}
+                               : StatRange{kMin, operand - 1};
+      case W_QUERY_ICMP_LE:
+        return StatRange{kMin, operand};
+      case W_QUERY_ICMP_NE:
+      default:
+        return std::nullopt;
+    }
+  }
+
   std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity) const override {
     // `size` doesn't constrain the path.
@@ -133,6 +161,14 @@ class SizeExpr : public QueryExpr {
     return ReturnOnlyFiles::Unrelated;
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Cheap;
+  }
+
+  bool isThreadSafe() const override {
+    return true;
+  }
+
   SimpleSuffixType evaluateSimpleSuffix() const override {
     return SimpleSuffixType::Excluded;
   }
@@ -5,11 +5,15 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 #include "GlobEscaping.h"
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
+#include "watchman/query/CompiledGlob.h"
 #include "watchman/query/FileResult.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryExpr.h"
@@ -57,30 +61,124 @@ w_string_piece trimGlobAfterDoubleStar(w_string_piece pattern) {
   }
   return pattern;
 }
+
+/// Returns the part of \param pattern after its last slash outside of a
+/// character class. With WM_PATHNAME, that part can't match a slash, so it
+/// is matched against the basename.
+w_string_piece globAfterLastSlash(w_string_piece pattern, bool noescape) {
+  bool inClass = false;
+  const char* pos = pattern.data();
+  const char* end = pattern.data() + pattern.size();
+  const char* start = pos;
+  while (pos < end) {
+    if (*pos == '\\' && !noescape) {
+      // skip the escaped character
+      ++pos;
+    } else if (inClass) {
+      inClass = *pos != ']';
+    } else if (*pos == '[') {
+      inClass = true;
+    } else if (*pos == '/') {
+      start = pos + 1;
+    }
+    ++pos;
+  }
+  return w_string_piece{start, end};
+}
+
+/// Returns the longest run of literal characters in \param pattern, which
+/// every string the pattern matches must contain.
+std::string longestGlobLiteral(w_string_piece pattern, bool noescape) {
+  std::string longest;
+  std::string current;
+  auto endRun = [&] {
+    if (current.size() > longest.size()) {
+      longest = current;
+    }
+    current.clear();
+  };
+
+  const char* pos = pattern.data();
+  const char* end = pattern.data() + pattern.size();
+  while (pos < end) {
+    switch (*pos) {
+      case '*':
+      case '?':
+        endRun();
+        ++pos;
+        break;
+      case '[':
+        // Skip the class; a leading ']' is a member rather than its end
+        endRun();
+        ++pos;
+        if (pos < end && (*pos == '!' || *pos == '^')) {
+          ++pos;
+        }
+        if (pos < end && *pos == ']') {
+          ++pos;
+        }
+        while (pos < end && *pos != ']') {
+          if (*pos == '\\' && !noescape) {
+            ++pos;
+          }
+          ++pos;
+        }
+        ++pos;
+        break;
+      case '\\':
+        if (!noescape && pos + 1 < end) {
+          ++pos;
+        }
+        [[fallthrough]];
+      default:
+        current.push_back(*pos);
+        ++pos;
+    }
+  }
+  endRun();
+  return longest;
+}
 } // namespace
+
 class WildMatchExpr : public QueryExpr {
-  std::string pattern;
+  // More than one when an anyof list of match terms with the same options
+  // was aggregated into this one.
+  std::vector<std::string> patterns;
   CaseSensitivity caseSensitive;
   bool wholename;
   bool noescape;
   bool includedotfiles;
+  int flags;
+  std::shared_ptr<const CompiledGlob> glob;
+  // Built on first use, so that aggregating a long list one term at a time
+  // doesn't build it for every prefix of the list.
+  std::once_flag globSetOnce;
+  std::unique_ptr<const CompiledGlobSet> globSet;
 
  public:
   WildMatchExpr(
-      const char* pat,
+      std::vector<std::string> pats,
       CaseSensitivity caseSensitive,
       bool wholename,
       bool noescape,
       bool includedotfiles)
-      : pattern(pat),
+      : patterns(std::move(pats)),
         caseSensitive(caseSensitive),
         wholename(wholename),
         noescape(noescape),
-        includedotfiles(includedotfiles) {}
+        includedotfiles(includedotfiles),
+        flags(
+            (includedotfiles ? 0 : WM_PERIOD) | (noescape ? WM_NOESCAPE : 0) |
+            (wholename ? WM_PATHNAME : 0) |
+            (caseSensitive == CaseSensitivity::CaseInSensitive ? WM_CASEFOLD
+                                                               : 0)) {
+    if (patterns.size() == 1) {
+      glob = CompiledGlob::get(patterns[0], flags);
+    }
+  }
 
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
     w_string_piece str;
-    bool res;
 
     if (wholename) {
       str = ctx->getWholeName();
@@ -94,17 +192,13 @@ class WildMatchExpr : public QueryExpr {
     str = normBuf;
 #endif
 
-    res =
-        wildmatch(
-            pattern.c_str(),
-            str.data(),
-            (includedotfiles ? 0 : WM_PERIOD) | (noescape ? WM_NOESCAPE : 0) |
-                (wholename ? WM_PATHNAME : 0) |
-                (caseSensitive == CaseSensitivity::CaseInSensitive ? WM_CASEFOLD
-                                                                   : 0),
-            0) == WM_MATCH;
-
-    return res;
+    if (glob) {
+      return glob->match(str.view());
+    }
+    std::call_once(globSetOnce, [this] {
+      globSet = std::make_unique<CompiledGlobSet>(patterns, flags);
+    });
+    return globSet->match(str.view());
   }
 
   static std::unique_ptr<QueryExpr>
@@ -165,7 +259,7 @@ class WildMatchExpr : public QueryExpr {
     }
 
     return std::make_unique<WildMatchExpr>(
-        pattern,
+        std::vector<std::string>{pattern},
         case_sensitive,
         !strcmp(scope, "wholename"),
         noescape,
@@ -182,8 +276,43 @@ class WildMatchExpr : public QueryExpr {
     return parse(query, term, CaseSensitivity::CaseInSensitive);
   }
 
+  std::unique_ptr<QueryExpr> aggregate(
+      const QueryExpr* other,
+      const AggregateOp op) const override {
+    if (op != AggregateOp::AnyOf) {
+      return nullptr;
+    }
+    auto* otherExpr = dynamic_cast<const WildMatchExpr*>(other);
+    if (!otherExpr || otherExpr->flags != flags) {
+      return nullptr;
+    }
+    std::vector<std::string> merged;
+    merged.reserve(patterns.size() + otherExpr->patterns.size());
+    merged.insert(merged.end(), patterns.begin(), patterns.end());
+    merged.insert(
+        merged.end(), otherExpr->patterns.begin(), otherExpr->patterns.end());
+    return std::make_unique<WildMatchExpr>(
+        std::move(merged), caseSensitive, wholename, noescape, includedotfiles);
+  }
+
   std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity outputCaseSensitive) const override {
+    std::vector<std::string> bounds;
+    for (const auto& pattern : patterns) {
+      auto bound = patternGlobUpperBound(pattern, outputCaseSensitive);
+      if (!bound) {
+        return std::nullopt;
+      }
+      bounds.push_back(std::move(*bound));
+    }
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+    return bounds;
+  }
+
+  std::optional<std::string> patternGlobUpperBound(
+      const std::string& pattern,
+      CaseSensitivity outputCaseSensitive) const {
     if (caseSensitive == CaseSensitivity::CaseInSensitive &&
         outputCaseSensitive != CaseSensitivity::CaseInSensitive) {
       // The caller asked for a case-sensitive upper bound, so treat imatch as
@@ -205,14 +334,43 @@ class WildMatchExpr : public QueryExpr {
     if (noescape) {
       outputPattern = convertNoEscapeGlobToGlob(outputPattern);
     }
-    return std::vector<std::string>{
-        trimGlobAfterDoubleStar(outputPattern).string()};
+    return trimGlobAfterDoubleStar(outputPattern).string();
+  }
+
+  std::optional<std::vector<NameFragment>> computeNameFragments()
+      const override {
+    // Any of the patterns may match, so every one needs a fragment
+    std::vector<NameFragment> fragments;
+    for (const auto& pattern : patterns) {
+      w_string_piece basenamePattern = pattern;
+      if (wholename) {
+        basenamePattern = globAfterLastSlash(pattern, noescape);
+        if (basenamePattern.contains("**")) {
+          // May match any number of path components
+          return std::nullopt;
+        }
+      }
+      auto literal = longestGlobLiteral(basenamePattern, noescape);
+      if (literal.empty()) {
+        return std::nullopt;
+      }
+      fragments.push_back({std::move(literal), caseSensitive});
+    }
+    return fragments;
   }
 
   ReturnOnlyFiles listOnlyFiles() const override {
     return ReturnOnlyFiles::Unrelated;
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Expensive;
+  }
+
+  bool isThreadSafe() const override {
+    return true;
+  }
+
   SimpleSuffixType evaluateSimpleSuffix() const override {
     return SimpleSuffixType::Excluded;
   }
@@ -19,6 +19,9 @@ using namespace watchman;
 class NameExpr : public QueryExpr {
   w_string name;
   std::unordered_set<w_string> set;
+  // Views of the strings in set, allowing lookups without allocating a
+  // w_string for each candidate file.
+  std::unordered_set<w_string_piece> setPieces;
   CaseSensitivity caseSensitive;
   bool wholename;
   explicit NameExpr(
@@ -27,28 +30,25 @@ class NameExpr : public QueryExpr {
       bool wholename)
       : set(std::move(set)),
         caseSensitive(caseSensitive),
-        wholename(wholename) {}
+        wholename(wholename) {
+    setPieces.reserve(this->set.size());
+    for (auto& element : this->set) {
+      setPieces.insert(element.piece());
+    }
+  }
 
  public:
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
     if (!set.empty()) {
-      bool matched;
-      w_string str;
+      w_string_piece str =
+          wholename ? ctx->getWholeName().piece() : file->baseName();
 
-      if (wholename) {
-        str = ctx->getWholeName();
-        if (caseSensitive == CaseSensitivity::CaseInSensitive) {
-          str = str.piece().asLowerCase();
-        }
-      } else {
-        str = caseSensitive == CaseSensitivity::CaseInSensitive
-            ? file->baseName().asLowerCase()
-            : file->baseName().asWString();
+      if (caseSensitive == CaseSensitivity::CaseInSensitive) {
+        // The set holds lowercased names
+        LowerCaseBuffer lower{str};
+        return setPieces.find(lower.piece()) != setPieces.end();
       }
-
-      matched = set.find(str) != set.end();
-
-      return matched;
+      return setPieces.find(str) != setPieces.end();
     }
 
     w_string_piece str;
@@ -151,6 +151,38 @@ class NameExpr : public QueryExpr {
     return parse(query, term, CaseSensitivity::CaseInSensitive);
   }
 
+  std::unique_ptr<QueryExpr> aggregate(
+      const QueryExpr* other,
+      const AggregateOp op) const override {
+    if (op != AggregateOp::AnyOf) {
+      return nullptr;
+    }
+    auto* otherExpr = dynamic_cast<const NameExpr*>(other);
+    if (!otherExpr || otherExpr->caseSensitive != caseSensitive ||
+        otherExpr->wholename != wholename) {
+      return nullptr;
+    }
+    std::unordered_set<w_string> merged;
+    merged.reserve(set.size() + otherExpr->set.size() + 2);
+    addToSet(merged);
+    otherExpr->addToSet(merged);
+    return std::unique_ptr<QueryExpr>(
+        new NameExpr(std::move(merged), caseSensitive, wholename));
+  }
+
+  // Adds what this term matches to a set in the form that evaluate() looks
+  // up.
+  void addToSet(std::unordered_set<w_string>& out) const {
+    if (!set.empty()) {
+      out.insert(set.begin(), set.end());
+    } else if (!name.empty()) {
+      out.insert(
+          caseSensitive == CaseSensitivity::CaseInSensitive
+              ? name.piece().asLowerCase(name.type())
+              : name);
+    }
+  }
+
   std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity outputCaseSensitive) const override {
     if (caseSensitive == CaseSensitivity::CaseInSensitive &&
@@ -183,10 +215,37 @@ class NameExpr : public QueryExpr {
         globUpperBound.begin(), globUpperBound.end());
   }
 
+  std::optional<std::vector<NameFragment>> computeNameFragments()
+      const override {
+    std::vector<NameFragment> fragments;
+    auto add = [&](const w_string& str) {
+      w_string_piece piece = str;
+      fragments.push_back(
+          {(wholename ? piece.baseName() : piece).string(), caseSensitive});
+    };
+    if (!set.empty()) {
+      fragments.reserve(set.size());
+      for (const auto& s : set) {
+        add(s);
+      }
+    } else {
+      add(name);
+    }
+    return fragments;
+  }
+
   ReturnOnlyFiles listOnlyFiles() const override {
     return ReturnOnlyFiles::Unrelated;
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Moderate;
+  }
+
+  bool isThreadSafe() const override {
+    return true;
+  }
+
   SimpleSuffixType evaluateSimpleSuffix() const override {
     return SimpleSuffixType::Excluded;
   }
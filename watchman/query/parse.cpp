@@ -6,6 +6,7 @@
  */
 
 #include <fmt/core.h>
+#include <limits>
 
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
@@ -89,20 +90,25 @@ void parse_relative_root(
     Query* res,
     const json_ref& query) {
   auto relative_root = query.get_optional("relative_root");
-  if (!relative_root) {
-    return;
-  }
-
-  if (!relative_root->isString()) {
-    throw QueryParseError("'relative_root' must be a string");
+  w_string path;
+  if (relative_root) {
+    if (!relative_root->isString()) {
+      throw QueryParseError("'relative_root' must be a string");
+    }
+    path = json_to_w_string(*relative_root).normalizeSeparators();
   }
 
-  auto path = json_to_w_string(*relative_root).normalizeSeparators();
   if (path.empty()) {
     // An empty relative_root is equivalent to not specifying
     // a relative root.  Importantly, we want to avoid setting
     // relative_root to "" because that introduces some complexities
     // in handling that case for eg: eden.
+    if (root->viewOwner) {
+      // The view holds the owner's whole tree; only produce files from
+      // this root's part of it, named relative to this root.
+      res->relative_root = root->root_path;
+      res->relative_root_slash = w_string::build(root->root_path, "/");
+    }
     return;
   }
 
@@ -176,6 +182,17 @@ void parse_sync(Query* res, const json_ref& query) {
       parse_nonnegative_integer("sync_timeout", sync_timeout)};
 }
 
+W_CAP_REG("deadline_ms")
+
+void parse_deadline(Query* res, const json_ref& query) {
+  auto deadline = query.get_optional("deadline_ms");
+  if (!deadline) {
+    return;
+  }
+  res->deadline = std::chrono::milliseconds{
+      parse_nonnegative_integer("deadline_ms", *deadline)};
+}
+
 void parse_lock_timeout(Query* res, const json_ref& query) {
   auto lock_timeout = query.get_default(
       "lock_timeout",
@@ -224,6 +241,30 @@ void parse_omit_changed_files(Query* res, const json_ref& query) {
       parse_bool_param(query, "omit_changed_files", false);
 }
 
+W_CAP_REG("cost")
+
+void parse_cost(Query* res, const json_ref& query) {
+  res->report_cost = parse_bool_param(query, "cost", false);
+}
+
+W_CAP_REG("timing")
+
+void parse_timing(Query* res, const json_ref& query) {
+  res->report_timing = parse_bool_param(query, "timing", false);
+}
+
+W_CAP_REG("explain")
+
+void parse_explain(Query* res, const json_ref& query) {
+  res->explain = parse_bool_param(query, "explain", false);
+}
+
+W_CAP_REG("front_coded_names")
+
+void parse_front_coded_names(Query* res, const json_ref& query) {
+  res->front_coded_names = parse_bool_param(query, "front_coded_names", false);
+}
+
 void parse_empty_on_fresh_instance(Query* res, const json_ref& query) {
   res->empty_on_fresh_instance =
       parse_bool_param(query, "empty_on_fresh_instance", false);
@@ -246,6 +287,89 @@ void parse_benchmark(Query* res, const json_ref& query) {
   }
 }
 
+W_CAP_REG("stream_results")
+
+void parse_stream_results(Query* res, const json_ref& query) {
+  auto stream = query.get_optional("stream_results");
+  if (!stream) {
+    return;
+  }
+  if (!stream->isInt() || stream->asInt() <= 0 ||
+      stream->asInt() > std::numeric_limits<uint32_t>::max()) {
+    throw QueryParseError("stream_results must be a positive integer");
+  }
+  res->stream_results = stream->asInt();
+}
+
+W_CAP_REG("shm_results")
+
+void parse_shm_results(Query* res, const json_ref& query) {
+  res->shm_results = parse_bool_param(query, "shm_results", false);
+}
+
+W_CAP_REG("priority")
+
+void parse_priority(Query* res, const json_ref& query) {
+  auto priority = query.get_optional("priority");
+  if (!priority) {
+    return;
+  }
+  if (!priority->isString()) {
+    throw QueryParseError("priority must be a string");
+  }
+  auto name = json_to_w_string(*priority);
+  if (name == "interactive") {
+    res->priority = QueryPriority::Interactive;
+  } else if (name == "batch") {
+    res->priority = QueryPriority::Batch;
+  } else {
+    throw QueryParseError(
+        "priority must be either \"interactive\" or \"batch\"");
+  }
+}
+
+W_CAP_REG("limit")
+
+void parse_limit(Query* res, const json_ref& query) {
+  res->exists_only = parse_bool_param(query, "exists_only", false);
+  if (res->exists_only) {
+    res->limit = 1;
+  }
+
+  auto limit = query.get_optional("limit");
+  if (!limit) {
+    return;
+  }
+  if (res->exists_only) {
+    throw QueryParseError("limit cannot be combined with exists_only");
+  }
+  if (!limit->isInt() || limit->asInt() <= 0 ||
+      limit->asInt() > std::numeric_limits<uint32_t>::max()) {
+    throw QueryParseError("limit must be a positive integer");
+  }
+  res->limit = limit->asInt();
+}
+
+W_CAP_REG("sort")
+
+void parse_sort(Query* res, const json_ref& query) {
+  auto sort = query.get_optional("sort");
+  if (!sort) {
+    return;
+  }
+  if (!sort->isString()) {
+    throw QueryParseError("sort must be a string");
+  }
+  auto order = json_to_w_string(*sort);
+  if (order == "name") {
+    res->sort = QuerySortOrder::Name;
+  } else if (order == "mtime") {
+    res->sort = QuerySortOrder::ModifiedTime;
+  } else {
+    throw QueryParseError("sort must be one of \"name\" or \"mtime\"");
+  }
+}
+
 void parse_case_sensitive(
     Query* res,
     const std::shared_ptr<Root>& root,
@@ -271,12 +395,22 @@ std::shared_ptr<Query> parseQuery(
   parse_case_sensitive(res, root, query);
   parse_sync(res, query);
   parse_dedup(res, query);
+  parse_stream_results(res, query);
+  parse_shm_results(res, query);
+  parse_priority(res, query);
+  parse_limit(res, query);
+  parse_sort(res, query);
   parse_lock_timeout(res, query);
+  parse_deadline(res, query);
   parse_relative_root(root, res, query);
   parse_empty_on_fresh_instance(res, query);
   parse_fail_if_no_saved_state(res, query);
   parse_omit_changed_files(res, query);
   parse_always_include_directories(res, query);
+  parse_cost(res, query);
+  parse_timing(res, query);
+  parse_explain(res, query);
+  parse_front_coded_names(res, query);
 
   /* Look for path generators */
   parse_paths(res, query);
@@ -6,7 +6,13 @@
  */
 
 #include <fmt/core.h>
+#include <folly/Synchronized.h>
+#include <algorithm>
+#include <cctype>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include "watchman/Errors.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/query/FileResult.h"
@@ -21,27 +27,279 @@
 
 using namespace watchman;
 
-class PcreExpr : public QueryExpr {
-  pcre2_code* re;
-  pcre2_match_data* matchData;
-  bool wholename;
+namespace {
+
+// Beyond this many distinct patterns, the cache is emptied and starts over
+constexpr size_t kMaxCachedRegexes = 1024;
+
+struct MatchDataDeleter {
+  void operator()(pcre2_match_data* matchData) const {
+    pcre2_match_data_free(matchData);
+  }
+};
+
+// Each thread reuses a single match data for every regex and call. We only
+// need to know whether there is a match, so it is sized for the whole match
+// alone.
+pcre2_match_data* threadMatchData() {
+  thread_local std::unique_ptr<pcre2_match_data, MatchDataDeleter> matchData{
+      pcre2_match_data_create(1, nullptr)};
+  if (!matchData) {
+    throw std::bad_alloc();
+  }
+  return matchData.get();
+}
 
+/**
+ * A compiled regex, shared by every query that uses the same pattern and
+ * options. Matching only reads it, so it may be used from any thread.
+ */
+class CompiledRegex {
  public:
-  explicit PcreExpr(pcre2_code* re, pcre2_match_data* matchData, bool wholename)
-      : re(re), matchData(matchData), wholename(wholename) {}
+  explicit CompiledRegex(pcre2_code* re) : re_(re) {
+    // Fall back to the interpreter if JIT is unsupported on this platform
+    // or for this pattern.
+    pcre2_jit_compile(re_, PCRE2_JIT_COMPLETE);
+  }
+
+  ~CompiledRegex() {
+    pcre2_code_free(re_);
+  }
+
+  CompiledRegex(const CompiledRegex&) = delete;
+  CompiledRegex& operator=(const CompiledRegex&) = delete;
+
+  bool match(w_string_piece str) const {
+    // pcre2_match uses the JIT compiled code when there is some.
+    int rc = pcre2_match(
+        re_,
+        reinterpret_cast<const unsigned char*>(str.data()),
+        str.size(),
+        0,
+        0,
+        threadMatchData(),
+        nullptr);
+    // Errors are either PCRE2_ERROR_NOMATCH or non actionable. Thus only match
+    // when we get a positive return value.
+    return rc >= 0;
+  }
+
+  /**
+   * Returns the regex for `pattern` compiled with the PCRE2 `options`,
+   * sharing it with every earlier caller that asked for the same. Throws
+   * QueryParseError if the pattern is invalid.
+   */
+  static std::shared_ptr<const CompiledRegex>
+  get(const char* pattern, uint32_t options, const char* which);
 
-  ~PcreExpr() override {
-    if (re) {
-      pcre2_code_free(re);
+ private:
+  pcre2_code* re_;
+};
+
+std::shared_ptr<const CompiledRegex>
+CompiledRegex::get(const char* pattern, uint32_t options, const char* which) {
+  static folly::Synchronized<
+      std::unordered_map<std::string, std::shared_ptr<const CompiledRegex>>>
+      cache;
+
+  auto key = std::to_string(options);
+  key.push_back(':');
+  key.append(pattern);
+
+  {
+    auto rlock = cache.rlock();
+    auto it = rlock->find(key);
+    if (it != rlock->end()) {
+      return it->second;
     }
-    if (matchData) {
-      pcre2_match_data_free(matchData);
+  }
+
+  size_t erroff = 0;
+  int errcode = 0;
+  auto re = pcre2_compile(
+      reinterpret_cast<const unsigned char*>(pattern),
+      PCRE2_ZERO_TERMINATED,
+      options,
+      &errcode,
+      &erroff,
+      nullptr);
+  if (!re) {
+    // From PCRE2 documentation:
+    // https://www.pcre.org/current/doc/html/pcre2api.html#SEC32: "None of the
+    // messages are very long; a buffer size of 120 code units is ample"
+    PCRE2_UCHAR buffer[120];
+    static_assert(
+        sizeof(char) == sizeof(PCRE2_UCHAR),
+        "Watchman uses the 8-bit PCRE2 library");
+    pcre2_get_error_message(errcode, buffer, 120);
+    throw QueryParseError(fmt::format(
+        "invalid {}: code {} {} at offset {} in {}",
+        which,
+        errcode,
+        reinterpret_cast<const char*>(&buffer),
+        erroff,
+        pattern));
+  }
+  auto compiled = std::make_shared<const CompiledRegex>(re);
+
+  auto wlock = cache.wlock();
+  if (wlock->size() >= kMaxCachedRegexes) {
+    wlock->clear();
+  }
+  return wlock->emplace(std::move(key), std::move(compiled)).first->second;
+}
+
+// Returns the position just past the character class that starts at pos
+const char* skipRegexClass(const char* pos, const char* end) {
+  ++pos;
+  if (pos < end && *pos == '^') {
+    ++pos;
+  }
+  // A leading ']' is a member rather than the end of the class
+  if (pos < end && *pos == ']') {
+    ++pos;
+  }
+  while (pos < end && *pos != ']') {
+    if (*pos == '\\') {
+      pos = std::min(pos + 2, end);
+    } else if (pos[0] == '[' && pos + 1 < end && pos[1] == ':') {
+      // POSIX class such as [:alpha:]
+      auto close = std::string_view(pos, end - pos).find(":]");
+      pos = close == std::string_view::npos ? end : pos + close + 2;
+    } else {
+      ++pos;
     }
   }
+  return std::min(pos + 1, end);
+}
+
+// Returns the position just past the group that starts at pos
+const char* skipRegexGroup(const char* pos, const char* end) {
+  size_t depth = 0;
+  while (pos < end) {
+    switch (*pos) {
+      case '\\':
+        pos = std::min(pos + 2, end);
+        continue;
+      case '[':
+        pos = skipRegexClass(pos, end);
+        continue;
+      case '(':
+        ++depth;
+        break;
+      case ')':
+        if (--depth == 0) {
+          return pos + 1;
+        }
+        break;
+    }
+    ++pos;
+  }
+  return end;
+}
+
+// Returns the longest run of literal characters that every string matched by
+// the regex must contain, or an empty string if none could be found. Only
+// the simple constructs are understood; groups, classes and escapes are
+// skipped over, and patterns that use alternation or inline options aren't
+// analyzed at all.
+std::string longestRegexLiteral(std::string_view pattern) {
+  if (pattern.find('|') != std::string_view::npos ||
+      pattern.find("(?") != std::string_view::npos ||
+      pattern.find("\\Q") != std::string_view::npos) {
+    return {};
+  }
+
+  std::string longest;
+  std::string current;
+  auto endRun = [&] {
+    if (current.size() > longest.size()) {
+      longest = current;
+    }
+    current.clear();
+  };
+
+  const char* pos = pattern.data();
+  const char* end = pattern.data() + pattern.size();
+  while (pos < end) {
+    switch (*pos) {
+      case '*':
+      case '?':
+      case '{':
+        // The preceding character is optional
+        if (!current.empty()) {
+          current.pop_back();
+        }
+        endRun();
+        if (*pos == '{') {
+          auto close = std::string_view(pos, end - pos).find('}');
+          pos = close == std::string_view::npos ? end : pos + close;
+        }
+        ++pos;
+        break;
+      case '+':
+      case '.':
+      case '^':
+      case '$':
+      case ')':
+        endRun();
+        ++pos;
+        break;
+      case '[':
+        endRun();
+        pos = skipRegexClass(pos, end);
+        break;
+      case '(':
+        endRun();
+        pos = skipRegexGroup(pos, end);
+        break;
+      case '\\':
+        if (pos + 1 < end && !isalnum(uint8_t(pos[1]))) {
+          current.push_back(pos[1]);
+          pos += 2;
+          break;
+        }
+        // A character type, back reference or character code. Skip it along
+        // with any digits it may take.
+        endRun();
+        if (pos + 1 < end && pos[1] == 'c') {
+          ++pos;
+        }
+        pos = std::min(pos + 2, end);
+        while (pos < end && isalnum(uint8_t(*pos))) {
+          ++pos;
+        }
+        break;
+      default:
+        current.push_back(*pos);
+        ++pos;
+    }
+  }
+  endRun();
+  return longest;
+}
+
+} // namespace
+
+class PcreExpr : public QueryExpr {
+  std::shared_ptr<const CompiledRegex> re;
+  std::string literal;
+  CaseSensitivity caseSensitive;
+  bool wholename;
+
+ public:
+  PcreExpr(
+      std::shared_ptr<const CompiledRegex> re,
+      std::string literal,
+      CaseSensitivity caseSensitive,
+      bool wholename)
+      : re(std::move(re)),
+        literal(std::move(literal)),
+        caseSensitive(caseSensitive),
+        wholename(wholename) {}
 
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
     w_string_piece str;
-    int rc;
 
     if (wholename) {
       str = ctx->getWholeName();
@@ -49,20 +307,7 @@ class PcreExpr : public QueryExpr {
       str = file->baseName();
     }
 
-    logf(ERR, "NAME: {}\n", str);
-
-    rc = pcre2_match(
-        re,
-        reinterpret_cast<const unsigned char*>(str.data()),
-        str.size(),
-        0,
-        0,
-        matchData,
-        nullptr);
-    logf(ERR, "RC: {}\n", rc);
-    // Errors are either PCRE2_ERROR_NOMATCH or non actionable. Thus only match
-    // when we get a positive return value.
-    return rc >= 0;
+    return re->match(str);
   }
 
   static std::unique_ptr<QueryExpr>
@@ -70,8 +315,6 @@ class PcreExpr : public QueryExpr {
     const char *pattern, *scope = "basename";
     const char* which =
         caseSensitive == CaseSensitivity::CaseInSensitive ? "ipcre" : "pcre";
-    size_t erroff = 0;
-    int errcode = 0;
 
     if (term.array().size() > 1 && term.at(1).isString()) {
       pattern = json_string_value(term.at(1));
@@ -95,40 +338,16 @@ class PcreExpr : public QueryExpr {
           fmt::format("Invalid scope '{}' for {} expression", scope, which));
     }
 
-    logf(ERR, "PATTERN: {}\n", pattern);
-
-    auto re = pcre2_compile(
-        reinterpret_cast<const unsigned char*>(pattern),
-        PCRE2_ZERO_TERMINATED,
+    auto re = CompiledRegex::get(
+        pattern,
         caseSensitive == CaseSensitivity::CaseInSensitive ? PCRE2_CASELESS : 0,
-        &errcode,
-        &erroff,
-        nullptr);
-    if (!re) {
-      // From PCRE2 documentation:
-      // https://www.pcre.org/current/doc/html/pcre2api.html#SEC32: "None of the
-      // messages are very long; a buffer size of 120 code units is ample"
-      PCRE2_UCHAR buffer[120];
-      static_assert(
-          sizeof(char) == sizeof(PCRE2_UCHAR),
-          "Watchman uses the 8-bit PCRE2 library");
-      pcre2_get_error_message(errcode, buffer, 120);
-      throw QueryParseError(fmt::format(
-          "invalid {}: code {} {} at offset {} in {}",
-          which,
-          errcode,
-          reinterpret_cast<const char*>(&buffer),
-          erroff,
-          pattern));
-    }
-
-    auto matchData = pcre2_match_data_create_from_pattern(re, nullptr);
-    if (!matchData) {
-      throw std::bad_alloc();
-    }
+        which);
 
     return std::make_unique<PcreExpr>(
-        re, matchData, !strcmp(scope, "wholename"));
+        std::move(re),
+        longestRegexLiteral(pattern),
+        caseSensitive,
+        !strcmp(scope, "wholename"));
   }
   static std::unique_ptr<QueryExpr> parsePcre(
       Query* query,
@@ -154,10 +373,28 @@ class PcreExpr : public QueryExpr {
     return std::nullopt;
   }
 
+  std::optional<std::vector<NameFragment>> computeNameFragments()
+      const override {
+    if (wholename || literal.empty()) {
+      // A wholename regex can find its literal in any path component
+      return std::nullopt;
+    }
+    return std::vector<NameFragment>{{literal, caseSensitive}};
+  }
+
   ReturnOnlyFiles listOnlyFiles() const override {
     return ReturnOnlyFiles::Unrelated;
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Expensive;
+  }
+
+  bool isThreadSafe() const override {
+    // The compiled regex is only read and each thread has its own match data.
+    return true;
+  }
+
   SimpleSuffixType evaluateSimpleSuffix() const override {
     return SimpleSuffixType::Excluded;
   }
@@ -98,6 +98,35 @@ class SinceExpr : public QueryExpr {
     return tval >= since_ts->time;
   }
 
+  std::optional<ClockTicks> computeOtimeLowerBound(
+      QueryContextBase* ctx) const override {
+    if (field != since_what::SINCE_OCLOCK) {
+      return std::nullopt;
+    }
+    auto since = spec->evaluate(
+        ctx->clockAtStartOfQuery.position(),
+        ctx->lastAgeOutTickValueAtStartOfQuery);
+    auto* since_clock = std::get_if<QuerySince::Clock>(&since.since);
+    if (!since_clock || since_clock->is_fresh_instance) {
+      return std::nullopt;
+    }
+    return since_clock->ticks;
+  }
+
+  std::optional<StatRange> computeStatRange(
+      StatRangeField statField) const override {
+    // mtime and ctime are always compared with a timestamp
+    if (statField != StatRangeField::Mtime ||
+        field != since_what::SINCE_MTIME) {
+      return std::nullopt;
+    }
+    auto* since_ts = std::get_if<ClockSpec::Timestamp>(&spec->spec);
+    if (!since_ts) {
+      return std::nullopt;
+    }
+    return StatRange{int64_t(since_ts->time), StatRange{}.max};
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref& term) {
     auto selected_field = since_what::SINCE_OCLOCK;
     const char* fieldname = "oclock";
@@ -171,6 +200,14 @@ class SinceExpr : public QueryExpr {
     return ReturnOnlyFiles::Unrelated;
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Cheap;
+  }
+
+  bool isThreadSafe() const override {
+    return true;
+  }
+
   SimpleSuffixType evaluateSimpleSuffix() const override {
     return SimpleSuffixType::Excluded;
   }
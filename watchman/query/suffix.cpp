@@ -12,6 +12,7 @@
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/TermRegistry.h"
 
+#include <algorithm>
 #include <memory>
 #include <unordered_set>
 
@@ -19,10 +20,20 @@ using namespace watchman;
 
 class SuffixExpr : public QueryExpr {
   std::unordered_set<w_string> suffixSet_;
+  // Views of the strings in suffixSet_, allowing lookups without
+  // allocating a w_string for each candidate file.
+  std::unordered_set<w_string_piece> suffixPieces_;
+  size_t maxSuffixLen_{0};
 
  public:
   explicit SuffixExpr(std::unordered_set<w_string>&& suffixSet)
-      : suffixSet_(std::move(suffixSet)) {}
+      : suffixSet_(std::move(suffixSet)) {
+    suffixPieces_.reserve(suffixSet_.size());
+    for (auto& suffix : suffixSet_) {
+      suffixPieces_.insert(suffix.piece());
+      maxSuffixLen_ = std::max(maxSuffixLen_, size_t(suffix.size()));
+    }
+  }
 
   EvaluateResult evaluate(QueryContextBase*, FileResult* file) override {
     if (suffixSet_.size() < 3) {
@@ -35,8 +46,13 @@ class SuffixExpr : public QueryExpr {
       }
       return false;
     }
-    auto suffix = file->baseName().asLowerCaseSuffix();
-    return suffix && (suffixSet_.find(*suffix) != suffixSet_.end());
+
+    auto suffix = file->baseName().suffix();
+    if (suffix.empty() || suffix.size() > maxSuffixLen_) {
+      return false;
+    }
+    LowerCaseBuffer lower{suffix};
+    return suffixPieces_.find(lower.piece()) != suffixPieces_.end();
   }
 
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref& term) {
@@ -101,6 +117,14 @@ class SuffixExpr : public QueryExpr {
     return ReturnOnlyFiles::Unrelated;
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Cheap;
+  }
+
+  bool isThreadSafe() const override {
+    return true;
+  }
+
   SimpleSuffixType evaluateSimpleSuffix() const override {
     return SimpleSuffixType::Suffix;
   }
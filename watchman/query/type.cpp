@@ -120,6 +120,18 @@ class TypeExpr : public QueryExpr {
     return ReturnOnlyFiles::Yes;
   }
 
+  bool matchesOnlyDirs() const override {
+    return arg == 'd';
+  }
+
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Cheap;
+  }
+
+  bool isThreadSafe() const override {
+    return true;
+  }
+
   SimpleSuffixType evaluateSimpleSuffix() const override {
     if (arg == 'f') {
       return SimpleSuffixType::Type;
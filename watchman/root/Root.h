@@ -7,13 +7,19 @@
 
 #pragma once
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "watchman/Clock.h"
 #include "watchman/CookieSync.h"
 #include "watchman/IgnoreSet.h"
+#include "watchman/NamedCursorMap.h"
 #include "watchman/PendingCollection.h"
+#include "watchman/PhaseTimeline.h"
 #include "watchman/PubSub.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Serde.h"
@@ -25,13 +31,17 @@
 /* Prune out nodes that were deleted roughly 12-36 hours ago */
 #define DEFAULT_GC_AGE (86400 / 2)
 #define DEFAULT_GC_INTERVAL 86400
+/* Compact files deleted more than 5 minutes ago into tombstones */
+#define DEFAULT_TOMBSTONE_AGE 300
 
 namespace watchman {
 
 class Root;
 struct TriggerCommand;
+class TriggerScheduler;
 class QueryableView;
 struct QueryContext;
+class QueryResultCache;
 struct RootMetadata;
 struct ClientContext;
 
@@ -164,6 +174,29 @@ struct RootQueryInfo : serde::Object {
   }
 };
 
+struct RootMemoryUsage : serde::Object {
+  int64_t view_bytes = 0;
+  int64_t pending_bytes = 0;
+  int64_t content_hash_cache_bytes = 0;
+  int64_t symlink_cache_bytes = 0;
+  int64_t subscription_bytes = 0;
+  int64_t total_bytes = 0;
+  int64_t soft_limit_bytes = 0;
+  bool over_limit = false;
+
+  template <typename X>
+  void map(X& x) {
+    x("view_bytes", view_bytes);
+    x("pending_bytes", pending_bytes);
+    x("content_hash_cache_bytes", content_hash_cache_bytes);
+    x("symlink_cache_bytes", symlink_cache_bytes);
+    x("subscription_bytes", subscription_bytes);
+    x("total_bytes", total_bytes);
+    x("soft_limit_bytes", soft_limit_bytes);
+    x("over_limit", over_limit);
+  }
+};
+
 struct RootDebugStatus : serde::Object {
   w_string path;
   w_string fstype;
@@ -179,6 +212,8 @@ struct RootDebugStatus : serde::Object {
   bool cancelled;
   bool enable_parallel_crawl;
   w_string crawl_status;
+  RootMemoryUsage memory;
+  std::vector<PhaseStatus> init_phases;
 
   template <typename X>
   void map(X& x) {
@@ -196,6 +231,8 @@ struct RootDebugStatus : serde::Object {
     x("cancelled", cancelled);
     x("crawl-status", crawl_status);
     x("enable_parallel_crawl", enable_parallel_crawl);
+    x("memory", memory);
+    x("init_phases", init_phases);
   }
 };
 
@@ -215,12 +252,26 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
 
   /* map of rule id => struct TriggerCommand */
   folly::Synchronized<
-      std::unordered_map<w_string, std::unique_ptr<TriggerCommand>>>
+      std::unordered_map<w_string, std::shared_ptr<TriggerCommand>>>
       triggers;
+  /* runs the triggers when the root settles */
+  const std::unique_ptr<TriggerScheduler> triggerScheduler;
+  /* bumped whenever triggers is modified, so that the state saver knows
+   * which roots it needs to re-encode */
+  std::atomic<uint64_t> stateGeneration{0};
+  /* wall clock time of the most recent query, and its value when the state
+   * was last asked to save it.  Persisted so that roots are restored most
+   * recently queried first. */
+  std::atomic<time_t> lastQueryTime{0};
+  std::atomic<time_t> lastQueryTimeSaved{0};
 
   const std::chrono::steady_clock::time_point startTime =
       std::chrono::steady_clock::now();
 
+  /* how long loading the config, setting up the watcher, the initial crawl
+   * and the first content cache warming took */
+  PhaseTimeline initTimeline;
+
   CookieSync cookies;
 
   /* mutable config items */
@@ -231,6 +282,11 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   Configuration config;
 
   const std::chrono::milliseconds trigger_settle{0};
+  /**
+   * When larger than trigger_settle, the settle period adapts to the gaps
+   * between events, up to this long.
+   */
+  const std::chrono::milliseconds trigger_settle_max{0};
   /**
    * Don't GC more often than this.
    *
@@ -241,10 +297,35 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
    * When GCing, age out files older than this.
    */
   const std::chrono::seconds gc_age{DEFAULT_GC_AGE};
+  /**
+   * Compact files deleted longer ago than this into tombstones, checking no
+   * more often than this.
+   *
+   * If zero, then never compact.
+   */
+  const std::chrono::seconds tombstone_age{DEFAULT_TOMBSTONE_AGE};
   const std::chrono::seconds idle_reap_age{0};
 
+  /**
+   * Once the estimated memory held for this root exceeds this many bytes,
+   * caches are dropped and deleted nodes aged out on settle.
+   *
+   * If zero, then memory is not limited.
+   */
+  const int64_t memory_soft_limit_bytes{0};
+  /**
+   * While over memory_soft_limit_bytes, queries that would hold more than
+   * this many unstreamed results are rejected.  Zero disables rejection.
+   */
+  const int64_t memory_limit_max_results{0};
+
   const bool allow_crawling_other_mounts;
 
+  /* set by "root_priority": "background".  The threads of a background root
+   * run at a lower priority and give way to queries against other roots;
+   * see CrawlScheduler. */
+  const bool background_priority;
+
   // Stream of broadcast unilateral items emitted by this root
   std::shared_ptr<Publisher> unilateralResponses;
 
@@ -273,6 +354,48 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   std::atomic<uint32_t> stateTransCount{0};
   folly::Synchronized<ClientStateAssertions> assertedStates;
 
+  // The outcome of a subscription query, kept so that other subscriptions
+  // with the same query and since clock (typically from several clients
+  // watching this root) can reuse it rather than evaluate it again.
+  struct SharedSubscriptionResult {
+    // The root position the query observed; the result is only reusable
+    // while the root is still at this position.
+    ClockPosition evaluatedAt;
+    ClockTicks lastAgeOutTick;
+    bool isFreshInstance;
+    ClockSpec clockAtStartOfQuery;
+    uint32_t stateTransCountAtStartOfQuery;
+    // The rendered "files" array; never modified once published.
+    json_ref files;
+  };
+  struct SharedSubscriptionResults {
+    // Keyed by ClientSubscription::sharedResultKey(). Only holds results for
+    // the current root position; older ones are pruned as new ones are
+    // added.
+    std::unordered_map<w_string, SharedSubscriptionResult> results;
+    // Keys that a subscription is evaluating right now.  Subscriptions with
+    // the same key, such as every deferred subscription released by a
+    // state-leave, wait for its results instead of evaluating them too.
+    std::unordered_set<w_string> evaluating;
+  };
+  folly::Synchronized<SharedSubscriptionResults, std::mutex>
+      sharedSubscriptionResults;
+  // Notified when a key is removed from SharedSubscriptionResults::evaluating
+  std::condition_variable sharedSubscriptionResultsCond;
+
+  // Results of recent queries, reused by identical queries while the view
+  // is unchanged.  Null unless query_result_cache_size is set.
+  const std::unique_ptr<QueryResultCache> queryResultCache;
+
+  // Set on a root that is nested in another watched root on the same
+  // filesystem.  Such a root is served from its owner's view, restricted to
+  // its own directory, rather than by a watcher and crawl of its own; the
+  // owner's threads keep the view up to date and forward its settles.
+  const std::shared_ptr<Root> viewOwner;
+
+  // The roots whose viewOwner is this root
+  folly::Synchronized<std::vector<std::weak_ptr<Root>>> projectedRoots;
+
   struct Inner {
     /**
      * Initially false and set to false by the iothread after scheduleRecrawl.
@@ -289,7 +412,7 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
     std::atomic<bool> cancelled{false};
 
     /* map of cursor name => last observed tick value */
-    folly::Synchronized<std::unordered_map<w_string, ClockTicks>> cursors;
+    NamedCursorMap cursors;
 
     /// Set by connection threads and read on the iothread.
     std::atomic<std::chrono::steady_clock::time_point> last_cmd_timestamp{
@@ -297,6 +420,15 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
 
     /// Only accessed on the iothread.
     std::chrono::steady_clock::time_point last_reap_timestamp;
+
+    /// Only accessed on the iothread.
+    std::chrono::steady_clock::time_point last_tombstone_timestamp;
+
+    /// Only accessed on the iothread.
+    std::chrono::steady_clock::time_point last_memory_mitigation_timestamp;
+
+    /// Set by the iothread and read by query threads.
+    std::atomic<bool> over_memory_limit{false};
   } inner;
 
   // For debugging and diagnostic purposes, this set references
@@ -320,11 +452,15 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
       std::optional<json_ref> config_file,
       Configuration config,
       std::shared_ptr<QueryableView> view,
-      SaveGlobalStateHook saveGlobalStateHook);
+      SaveGlobalStateHook saveGlobalStateHook,
+      std::shared_ptr<Root> viewOwner = nullptr);
   ~Root();
 
   void considerAgeOut();
   void performAgeOut(std::chrono::seconds min_age);
+  void performTombstoneCompaction(std::chrono::seconds min_age);
+  RootMemoryUsage getMemoryUsage() const;
+  void considerMemoryLimit();
   folly::SemiFuture<folly::Unit> waitForSettle(
       std::chrono::milliseconds settle_period);
   CookieSync::SyncResult syncToNow(
@@ -340,10 +476,16 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
 
   // Returns true if the caller should stop the watch.
   bool considerReap();
+  // Forwards a settle of this root's view to the roots projected from it,
+  // and stops those that have been idle for too long.
+  void settleProjectedRoots();
   bool removeFromWatched();
   void stopThreads(std::string_view reason);
   bool stopWatch(std::string_view reason);
   json_ref triggerListToJson() const;
+  // Records that a query ran against this root now.  Asks for the state to
+  // be saved when the persisted time is more than a minute stale.
+  void noteQuery();
 
   static std::vector<RootDebugStatus> getStatusForAllRoots();
   RootDebugStatus getStatus() const;
@@ -357,7 +499,8 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   }
 
  private:
-  const std::shared_ptr<QueryableView> view_;
+  // Only released by the destructor, which hands it off to the thread pool
+  std::shared_ptr<QueryableView> view_;
 
   /// A hook that allows saving Watchman's state after key operations. Usually
   /// holds w_state_save.
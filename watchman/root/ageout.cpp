@@ -5,14 +5,104 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include "watchman/Logging.h"
 #include "watchman/QueryableView.h"
+#include "watchman/query/QueryResultCache.h"
 #include "watchman/root/Root.h"
 #include "watchman/telemetry/LogEvent.h"
 #include "watchman/telemetry/WatchmanStructuredLogger.h"
 
 using namespace watchman;
 
+namespace {
+// Unilateral responses are small json objects; this is a rough charge for
+// each one held for a subscriber.
+constexpr int64_t kEstimatedUnilateralItemBytes = 256;
+// Don't drop the caches and age out more often than this while over the
+// soft limit, so that queries still get some use out of the caches.
+constexpr std::chrono::seconds kMemoryMitigationInterval{60};
+} // namespace
+
+RootMemoryUsage Root::getMemoryUsage() const {
+  auto viewUsage = view()->getMemoryUsage();
+
+  RootMemoryUsage usage;
+  usage.view_bytes = viewUsage.viewBytes;
+  usage.pending_bytes = viewUsage.pendingBytes;
+  usage.content_hash_cache_bytes = viewUsage.contentHashCacheBytes;
+  usage.symlink_cache_bytes = viewUsage.symlinkCacheBytes;
+  usage.subscription_bytes =
+      unilateralResponses->getItemCount() * kEstimatedUnilateralItemBytes;
+  usage.total_bytes = usage.view_bytes + usage.pending_bytes +
+      usage.content_hash_cache_bytes + usage.symlink_cache_bytes +
+      usage.subscription_bytes;
+  usage.soft_limit_bytes = memory_soft_limit_bytes;
+  usage.over_limit = inner.over_memory_limit.load(std::memory_order_relaxed);
+  return usage;
+}
+
+void Root::considerMemoryLimit() {
+  if (memory_soft_limit_bytes == 0) {
+    return;
+  }
+
+  auto usage = getMemoryUsage();
+  bool over = usage.total_bytes > memory_soft_limit_bytes;
+  bool wasOver = inner.over_memory_limit.exchange(over);
+  if (!over) {
+    if (wasOver) {
+      logf(
+          ERR,
+          "{}: memory use is back under the soft limit: {} of {} bytes\n",
+          root_path,
+          usage.total_bytes,
+          memory_soft_limit_bytes);
+    }
+    return;
+  }
+  if (!wasOver) {
+    logf(
+        ERR,
+        "{}: memory use {} exceeds the soft limit of {} bytes "
+        "(view {}, pending {}, content hash cache {}, symlink cache {}, "
+        "subscriptions {}); dropping caches and aging out deleted files\n",
+        root_path,
+        usage.total_bytes,
+        memory_soft_limit_bytes,
+        usage.view_bytes,
+        usage.pending_bytes,
+        usage.content_hash_cache_bytes,
+        usage.symlink_cache_bytes,
+        usage.subscription_bytes);
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  if (wasOver &&
+      now < inner.last_memory_mitigation_timestamp + kMemoryMitigationInterval) {
+    return;
+  }
+  inner.last_memory_mitigation_timestamp = now;
+
+  view()->shrinkMemory();
+  if (queryResultCache) {
+    queryResultCache->clear();
+  }
+  // Deleted files are the only nodes we can shed without losing state that
+  // queries depend on.
+  performAgeOut(std::chrono::seconds(0));
+}
+
 void Root::considerAgeOut() {
+  considerMemoryLimit();
+
+  if (tombstone_age.count() != 0) {
+    auto now = std::chrono::steady_clock::now();
+    if (now > inner.last_tombstone_timestamp + tombstone_age) {
+      inner.last_tombstone_timestamp = now;
+      performTombstoneCompaction(tombstone_age);
+    }
+  }
+
   if (gc_interval.count() == 0) {
     return;
   }
@@ -40,17 +130,7 @@ void Root::performAgeOut(std::chrono::seconds min_age) {
   view()->ageOut(walked, files, dirs, std::chrono::seconds(min_age));
 
   // Age out cursors too.
-  {
-    auto cursors = inner.cursors.wlock();
-    auto it = cursors->begin();
-    while (it != cursors->end()) {
-      if (it->second < view()->getLastAgeOutTickValue()) {
-        it = cursors->erase(it);
-      } else {
-        ++it;
-      }
-    }
-  }
+  inner.cursors.eraseBefore(view()->getLastAgeOutTickValue());
   auto root_metadata = getRootMetadata();
 
   if (sample.finish()) {
@@ -82,5 +162,26 @@ void Root::performAgeOut(std::chrono::seconds min_age) {
   }
 }
 
+void Root::performTombstoneCompaction(std::chrono::seconds min_age) {
+  // Deleted files are only kept for since queries, which need no more than
+  // their name and clocks, so shed the rest of their nodes well before they
+  // are aged out.
+  watchman::PerfSample sample("compact_tombstones");
+
+  int64_t walked = 0;
+  int64_t files = 0;
+  view()->compactTombstones(walked, files, min_age);
+
+  if (sample.finish()) {
+    sample.add_meta(
+        "compact_tombstones",
+        json_object(
+            {{"walked", json_integer(walked)},
+             {"files", json_integer(files)}}));
+    sample.add_root_metadata(getRootMetadata());
+    sample.log();
+  }
+}
+
 /* vim:ts=2:sw=2:et:
  */
@@ -6,14 +6,44 @@
  */
 
 #include "watchman/watchman_dir.h"
+#include "watchman/NodeArena.h"
+#include "watchman/PathBuilder.h"
 #include "watchman/watchman_file.h"
 
 void watchman_dir::Deleter::operator()(watchman_file* file) const {
   free_file_node(file);
 }
 
-watchman_dir::watchman_dir(w_string name, watchman_dir* parent)
-    : name(std::move(name)), parent(parent) {}
+void watchman_dir::Deleter::operator()(watchman_dir* dir) const {
+  auto* arena = dir->arena;
+  if (dir->parent) {
+    arena->dirNames().release(dir->name);
+  }
+  dir->~watchman_dir();
+  arena->deallocate(dir, sizeof(watchman_dir));
+}
+
+watchman_dir::watchman_dir(
+    w_string name,
+    watchman_dir* parent,
+    watchman::NodeArena* arena)
+    : name(std::move(name)), parent(parent), arena(arena) {}
+
+watchman_dir::Ptr watchman_dir::makeRoot(
+    w_string name,
+    watchman::NodeArena& arena) {
+  auto* mem = arena.allocate(sizeof(watchman_dir));
+  return Ptr{new (mem) watchman_dir(std::move(name), nullptr, &arena)};
+}
+
+watchman_dir::Ptr watchman_dir::make(
+    w_string_piece name,
+    watchman_dir* parent) {
+  auto* arena = parent->arena;
+  auto internedName = arena->dirNames().intern(name);
+  auto* mem = arena->allocate(sizeof(watchman_dir));
+  return Ptr{new (mem) watchman_dir(std::move(internedName), parent, arena)};
+}
 
 w_string watchman_dir::getFullPath() const {
   return getFullPathToChild(w_string_piece());
@@ -27,6 +57,15 @@ watchman_file* watchman_dir::getChildFile(w_string_piece name_2) const {
   return it->second.get();
 }
 
+const watchman::Tombstone* watchman_dir::getTombstone(
+    w_string_piece name_2) const {
+  auto it = tombstones.find(name_2);
+  if (it == tombstones.end()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
 watchman_dir* watchman_dir::getChildDir(w_string_piece name_2) const {
   auto it = dirs.find(name_2);
   if (it == dirs.end()) {
@@ -35,36 +74,58 @@ watchman_dir* watchman_dir::getChildDir(w_string_piece name_2) const {
   return it->second.get();
 }
 
-w_string watchman_dir::getFullPathToChild(w_string_piece extra) const {
+namespace {
+
+// Length of the full path to extra, not including a NUL terminator.
+uint32_t fullPathLength(const watchman_dir* dir, w_string_piece extra) {
   uint32_t length = 0;
   if (extra.size()) {
     length = extra.size() + 1 /* separator */;
   }
-  for (const watchman_dir* d = this; d; d = d->parent) {
+  for (const watchman_dir* d = dir; d; d = d->parent) {
     length += d->name.size() + 1 /* separator OR final NUL terminator */;
   }
+  return length - 1;
+}
 
-  auto* s = watchman::StringHeader::alloc(length - 1, W_STRING_BYTE);
-
-  char* buf = s->buf();
-  char* end = buf + s->len;
-
-  *end = 0;
+// Writes the full path to extra backwards from end, which must be preceded
+// by fullPathLength() bytes.
+void writeFullPath(const watchman_dir* dir, w_string_piece extra, char* end) {
   if (extra.size()) {
     end -= extra.size();
     memcpy(end, extra.data(), extra.size());
   }
-  for (const watchman_dir* d = this; d; d = d->parent) {
-    if (d != this || (extra.size())) {
+  for (const watchman_dir* d = dir; d; d = d->parent) {
+    if (d != dir || (extra.size())) {
       --end;
       *end = '/';
     }
     end -= d->name.size();
     memcpy(end, d->name.data(), d->name.size());
   }
+}
+
+} // namespace
+
+w_string watchman_dir::getFullPathToChild(w_string_piece extra) const {
+  auto* s = watchman::StringHeader::alloc(
+      fullPathLength(this, extra), W_STRING_BYTE);
+
+  char* end = s->buf() + s->len;
+  *end = 0;
+  writeFullPath(this, extra, end);
 
   return w_string{s};
 }
 
+w_string_piece watchman_dir::getFullPathToChild(
+    watchman::PathBuilder& out,
+    w_string_piece extra) const {
+  out.clear();
+  auto length = fullPathLength(this, extra);
+  writeFullPath(this, extra, out.extend(length) + length);
+  return out.piece();
+}
+
 /* vim:ts=2:sw=2:et:
  */
@@ -6,10 +6,187 @@
  */
 
 #include "watchman/watchman_file.h"
+#include <folly/Synchronized.h>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include "watchman/NodeArena.h"
 #ifdef __APPLE__
 #include <sys/attr.h> // @manual
 #endif
 
+namespace watchman {
+
+namespace {
+
+struct Owner {
+  dev_t dev;
+  uid_t uid;
+  gid_t gid;
+
+  bool operator==(const Owner& other) const {
+    return dev == other.dev && uid == other.uid && gid == other.gid;
+  }
+};
+
+// The distinct owners seen by any file node. Entries are never removed or
+// changed once published, so they can be read without locking.
+class OwnerTable {
+ public:
+  static constexpr uint32_t kCapacity = 1024;
+
+  OwnerTable() {
+    // Zero-filled nodes refer to entry 0
+    owners_[0] = Owner{};
+    size_.store(1, std::memory_order_release);
+  }
+
+  // Returns the index of owner, adding it if necessary, or nullopt if the
+  // table is full.
+  std::optional<uint32_t> intern(const Owner& owner, uint32_t hint) {
+    auto size = size_.load(std::memory_order_acquire);
+    // Most of the time a file keeps the owner it had
+    if (hint < size && owners_[hint] == owner) {
+      return hint;
+    }
+    for (uint32_t i = 0; i < size; ++i) {
+      if (owners_[i] == owner) {
+        return i;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    size = size_.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < size; ++i) {
+      if (owners_[i] == owner) {
+        return i;
+      }
+    }
+    if (size == kCapacity) {
+      return std::nullopt;
+    }
+    owners_[size] = owner;
+    size_.store(size + 1, std::memory_order_release);
+    return size;
+  }
+
+  const Owner& get(uint32_t index) const {
+    return owners_[index];
+  }
+
+ private:
+  std::array<Owner, kCapacity> owners_;
+  std::atomic<uint32_t> size_{0};
+  std::mutex mutex_;
+};
+
+// Both tables are leaked so that nodes may be destroyed during shutdown
+OwnerTable& getOwnerTable() {
+  static auto* table = new OwnerTable;
+  return *table;
+}
+
+// The complete information of the nodes whose values don't fit
+using SpilledMap =
+    std::unordered_map<const CompactFileInformation*, FileInformation>;
+
+folly::Synchronized<SpilledMap>& getSpilled() {
+  static auto* spilled = new folly::Synchronized<SpilledMap>;
+  return *spilled;
+}
+
+bool fitsSeconds(const struct timespec& ts) {
+  return ts.tv_sec >= 0 &&
+      uint64_t(ts.tv_sec) <= std::numeric_limits<uint32_t>::max();
+}
+
+struct timespec makeTimespec(uint32_t sec, uint32_t nsec) {
+  struct timespec ts;
+  ts.tv_sec = sec;
+  ts.tv_nsec = nsec;
+  return ts;
+}
+
+} // namespace
+
+CompactFileInformation::~CompactFileInformation() {
+  if (spilled_) {
+    getSpilled().wlock()->erase(this);
+  }
+}
+
+CompactFileInformation& CompactFileInformation::operator=(
+    const FileInformation& info) {
+  mode_ = info.mode;
+  size_ = info.size;
+  ino_ = info.ino;
+#ifdef _WIN32
+  fileAttributes_ = info.fileAttributes;
+#endif
+
+  auto owner =
+      getOwnerTable().intern(Owner{info.dev, info.uid, info.gid}, owner_);
+  bool fits = owner.has_value() &&
+      uint64_t(info.nlink) <= std::numeric_limits<uint32_t>::max() &&
+      fitsSeconds(info.atime) && fitsSeconds(info.mtime) &&
+      fitsSeconds(info.ctime);
+  if (!fits) {
+    getSpilled().wlock()->insert_or_assign(this, info);
+    spilled_ = true;
+    return *this;
+  }
+  if (spilled_) {
+    getSpilled().wlock()->erase(this);
+    spilled_ = false;
+  }
+
+  owner_ = *owner;
+  nlink_ = uint32_t(info.nlink);
+  atimeSec_ = uint32_t(info.atime.tv_sec);
+  atimeNsec_ = uint32_t(info.atime.tv_nsec);
+  mtimeSec_ = uint32_t(info.mtime.tv_sec);
+  mtimeNsec_ = uint32_t(info.mtime.tv_nsec);
+  ctimeSec_ = uint32_t(info.ctime.tv_sec);
+  ctimeNsec_ = uint32_t(info.ctime.tv_nsec);
+  return *this;
+}
+
+FileInformation CompactFileInformation::decode() const {
+  if (spilled_) {
+    return getSpilled().rlock()->at(this);
+  }
+
+  auto info = typeInfo();
+  info.size = size_;
+  info.ino = ino_t(ino_);
+  info.nlink = nlink_t(nlink_);
+  const auto& owner = getOwnerTable().get(owner_);
+  info.dev = owner.dev;
+  info.uid = owner.uid;
+  info.gid = owner.gid;
+  info.atime = makeTimespec(atimeSec_, atimeNsec_);
+  info.mtime = makeTimespec(mtimeSec_, mtimeNsec_);
+  info.ctime = makeTimespec(ctimeSec_, ctimeNsec_);
+  return info;
+}
+
+struct timespec CompactFileInformation::atime() const {
+  return spilled_ ? decode().atime : makeTimespec(atimeSec_, atimeNsec_);
+}
+
+struct timespec CompactFileInformation::mtime() const {
+  return spilled_ ? decode().mtime : makeTimespec(mtimeSec_, mtimeNsec_);
+}
+
+struct timespec CompactFileInformation::ctime() const {
+  return spilled_ ? decode().ctime : makeTimespec(ctimeSec_, ctimeNsec_);
+}
+
+} // namespace watchman
+
 void watchman_file::removeFromFileList() {
   if (next) {
     next->prev = prev;
@@ -24,6 +201,24 @@ void watchman_file::removeFromFileList() {
   }
 }
 
+void watchman_file::removeFromSuffixList() {
+  if (suffixNext) {
+    suffixNext->suffixPrev = suffixPrev;
+  }
+  if (suffixPrev) {
+    *suffixPrev = suffixNext;
+  }
+}
+
+void watchman_file::removeFromNameList() {
+  if (nameNext) {
+    nameNext->namePrev = namePrev;
+  }
+  if (namePrev) {
+    *namePrev = nameNext;
+  }
+}
+
 /* We embed our name string in the tail end of the struct that we're
  * allocating here.  This turns out to be more memory efficient due
  * to the way that the allocator bins sizeof(watchman_file); there's
@@ -31,12 +226,19 @@ void watchman_file::removeFromFileList() {
  * to be about the right size to fit a typical filename.
  * Embedding the name in the end allows us to make the most of this
  * memory and free up the separate heap allocation for file_name.
+ * The node is carved out of the parent dir's arena, which packs nodes of
+ * similar size together in slabs.
  */
+static size_t file_node_size(size_t name_len) {
+  return sizeof(watchman_file) + sizeof(uint32_t) + name_len + 1;
+}
+
 std::unique_ptr<watchman_file, watchman_dir::Deleter> watchman_file::make(
     const w_string& name,
     watchman_dir* parent) {
-  auto file = (watchman_file*)calloc(
-      1, sizeof(watchman_file) + sizeof(uint32_t) + name.size() + 1);
+  auto size = file_node_size(name.size());
+  auto file = (watchman_file*)parent->arena->allocate(size);
+  memset(file, 0, size);
   std::unique_ptr<watchman_file, watchman_dir::Deleter> filePtr(
       file, watchman_dir::Deleter());
 
@@ -55,11 +257,15 @@ std::unique_ptr<watchman_file, watchman_dir::Deleter> watchman_file::make(
 
 watchman_file::~watchman_file() {
   removeFromFileList();
+  removeFromSuffixList();
+  removeFromNameList();
 }
 
 void free_file_node(struct watchman_file* file) {
+  auto* arena = file->parent->arena;
+  auto size = file_node_size(file->getName().size());
   file->~watchman_file();
-  free(file);
+  arena->deallocate(file, size);
 }
 
 /* vim:ts=2:sw=2:et:
@@ -9,9 +9,11 @@
 #include <folly/String.h>
 #include "watchman/Logging.h"
 #include "watchman/QueryableView.h"
+#include "watchman/ThreadPool.h"
 #include "watchman/TriggerCommand.h"
 #include "watchman/fs/DirHandle.h"
 #include "watchman/fs/FSDetect.h"
+#include "watchman/query/QueryResultCache.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/watchlist.h"
 
@@ -21,6 +23,25 @@ namespace {
 /// Idle out watches that haven't had activity in several days
 inline constexpr json_int_t kDefaultReapAge = 86400 * 5;
 inline constexpr json_int_t kDefaultSettlePeriod = 20;
+
+// The parallel crawler calls startWatchDir from its walker threads, which the
+// watchers available on these platforms support.
+#if defined(__linux__) || defined(__APPLE__)
+inline constexpr bool kDefaultEnableParallelCrawl = true;
+#else
+inline constexpr bool kDefaultEnableParallelCrawl = false;
+#endif
+
+std::unique_ptr<QueryResultCache> makeQueryResultCache(
+    const Configuration& config) {
+  auto size = config.getInt("query_result_cache_size", 0);
+  if (size <= 0) {
+    return nullptr;
+  }
+  return std::make_unique<QueryResultCache>(
+      size_t(size),
+      size_t(config.getInt("query_result_cache_max_results", 10000)));
+}
 } // namespace
 
 void ClientStateAssertions::queueAssertion(
@@ -188,6 +209,18 @@ w_string computeCookieDir(
   return root_path;
 }
 
+bool parseBackgroundPriority(const Configuration& config) {
+  std::string_view priority = config.getString("root_priority", "normal");
+  if (priority == "background") {
+    return true;
+  }
+  if (priority != "normal") {
+    throw std::runtime_error(
+        "root_priority must be either \"normal\" or \"background\"");
+  }
+  return false;
+}
+
 } // namespace
 
 IgnoreSet computeIgnoreSet(
@@ -216,6 +249,23 @@ IgnoreSet computeIgnoreSet(
     }
   }
 
+  if (auto globs = config.get("ignore_globs")) {
+    if (!globs->isArray()) {
+      logf(ERR, "ignore_globs must be an array of strings\n");
+    } else {
+      for (auto& jglob : globs->array()) {
+        if (!jglob.isString()) {
+          logf(ERR, "ignore_globs must be an array of strings\n");
+          continue;
+        }
+
+        auto pattern = json_to_w_string(jglob);
+        result.addGlob(root_path, pattern.view());
+        logf(DBG, "ignoring paths matching {}\n", pattern);
+      }
+    }
+  }
+
   auto ignores = getIgnoreVcs(config);
   for (auto& jignore : ignores.array()) {
     if (!jignore.isString()) {
@@ -242,27 +292,43 @@ Root::Root(
     std::optional<json_ref> config_file,
     Configuration config_,
     std::shared_ptr<QueryableView> view,
-    SaveGlobalStateHook saveGlobalStateHook)
+    SaveGlobalStateHook saveGlobalStateHook,
+    std::shared_ptr<Root> viewOwner)
     : RootConfig{
           root_path,
           fs_type,
           getCaseSensitivityForPath(root_path.c_str()),
           computeIgnoreSet(root_path, config_),
           fileSystem.getFileInformation(root_path.c_str())},
+      triggerScheduler(std::make_unique<TriggerScheduler>()),
       cookies(
           fileSystem,
           computeCookieDir(root_path, config_, case_sensitive, ignore)),
-      enable_parallel_crawl{config_.getBool("enable_parallel_crawl", false)},
+      enable_parallel_crawl{config_.getBool(
+          "enable_parallel_crawl",
+          kDefaultEnableParallelCrawl)},
       config_file(std::move(config_file)),
       config(std::move(config_)),
       trigger_settle(int(config.getInt("settle", kDefaultSettlePeriod))),
+      trigger_settle_max(int(config.getInt("settle_max", 0))),
       gc_interval(
           int(config.getInt("gc_interval_seconds", DEFAULT_GC_INTERVAL))),
       gc_age(int(config.getInt("gc_age_seconds", DEFAULT_GC_AGE))),
+      tombstone_age(int(
+          config.getInt("tombstone_age_seconds", DEFAULT_TOMBSTONE_AGE))),
       idle_reap_age(
           int(config.getInt("idle_reap_age_seconds", kDefaultReapAge))),
+      memory_soft_limit_bytes{
+          config.getInt("memory_soft_limit_mb", 0) * 1024 * 1024},
+      memory_limit_max_results{
+          config.getInt("memory_limit_max_results", 100000)},
       allow_crawling_other_mounts{config_.getBool("allow_crawling_other_mounts", false)},
-      unilateralResponses(std::make_shared<Publisher>()),
+      background_priority{parseBackgroundPriority(config)},
+      unilateralResponses(std::make_shared<Publisher>(
+          config.getInt("subscription_max_unread_items", 1000),
+          Publisher::OverflowPolicy::Coalesce)),
+      queryResultCache{makeQueryResultCache(config)},
+      viewOwner{std::move(viewOwner)},
       view_{std::move(view)},
       saveGlobalStateHook_{std::move(saveGlobalStateHook)} {
   // This just opens and releases the dir.  If an exception is thrown
@@ -274,9 +340,11 @@ Root::Root(
   ++live_roots;
 
   inner.last_cmd_timestamp = std::chrono::steady_clock::now();
+  inner.last_tombstone_timestamp = std::chrono::steady_clock::now();
 
-  if (!view_->requiresCrawl) {
-    // This watcher can resolve queries without needing a crawl.
+  if (!view_->requiresCrawl || this->viewOwner) {
+    // This watcher can resolve queries without needing a crawl, or the
+    // owner of the view does the crawling.
     inner.done_initial = true;
     auto crawlInfo = recrawlInfo.wlock();
     crawlInfo->shouldRecrawl = false;
@@ -288,6 +356,20 @@ Root::Root(
 Root::~Root() {
   logf(DBG, "root: final ref on {}\n", root_path);
   --live_roots;
+
+  // Freeing the view of a large root takes seconds, so don't hold up the
+  // command or thread that dropped the last reference to the root, or the
+  // lock on the watched roots that it may hold.  If the pool has already
+  // been stopped, the view is freed here as the task is discarded.
+  try {
+    getThreadPool().add([view = std::move(view_)] {}, WorkClass::Hash);
+  } catch (const std::exception& exc) {
+    logf(
+        DBG,
+        "freeing the view of {} inline: {}\n",
+        root_path,
+        folly::exceptionStr(exc).toStdString());
+  }
 }
 
 RootMetadata Root::getRootMetadata() const {
@@ -6,14 +6,29 @@
  */
 
 #include <fmt/chrono.h>
+#include <folly/ScopeGuard.h>
+#include <folly/futures/Future.h>
+#include <algorithm>
 #include <chrono>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
 
 #include "watchman/Errors.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/PerfSample.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/Tracepoint.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/fs/ParallelWalk.h"
+#include "watchman/query/GlobTree.h"
+#include "watchman/query/Query.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/warnerr.h"
+#include "watchman/scm/SCM.h"
+#include "watchman/telemetry/WatchmanStats.h"
 #include "watchman/telemetry/LogEvent.h"
 #include "watchman/telemetry/WatchmanStructuredLogger.h"
 #include "watchman/watcher/Watcher.h"
@@ -22,7 +37,101 @@
 
 namespace watchman {
 
+namespace {
+
+// Whether path is dir or lies beneath it
+bool isWithin(const w_string& path, const w_string& dir) {
+  return path.piece().startsWith(dir) && is_path_prefix(path, dir);
+}
+
+bool overlaps(const w_string& a, const w_string& b) {
+  return isWithin(a, b) || isWithin(b, a);
+}
+
+// Adds the dirs that the glob generator reads below `dir` for `node`: those
+// named literally, down to the first pattern with wildcards.
+void addGlobScopes(
+    const GlobTree& node,
+    const w_string& dir,
+    std::vector<w_string>& scopes) {
+  auto hasSpecials = std::any_of(
+      node.children.begin(), node.children.end(), [](const auto& kid) {
+        return kid->had_specials;
+      });
+  if (hasSpecials || !node.doublestar_children.empty()) {
+    scopes.push_back(dir);
+    return;
+  }
+  for (auto& kid : node.children) {
+    auto path = w_string::pathCat(
+        {dir, w_string_piece(kid->pattern.data(), kid->pattern.size())});
+    if (kid->is_leaf) {
+      scopes.push_back(std::move(path));
+    } else {
+      addGlobScopes(*kid, path, scopes);
+    }
+  }
+}
+
+// The paths that the query may produce results from, and beneath them
+std::vector<w_string> queryScopes(const Query* query, const w_string& root) {
+  const auto& base = query->relative_root ? *query->relative_root : root;
+  // A since query walks everything changed below the base
+  if (query->since_spec || (!query->paths && !query->glob_tree)) {
+    return {base};
+  }
+
+  std::vector<w_string> scopes;
+  if (query->paths) {
+    for (auto& path : *query->paths) {
+      scopes.push_back(
+          path.name.empty() ? base : w_string::pathCat({base, path.name}));
+    }
+  }
+  if (query->glob_tree) {
+    // Suffixes and case-insensitive globs don't name dirs literally
+    if (query->suffixes ||
+        query->case_sensitive == CaseSensitivity::CaseInSensitive) {
+      scopes.push_back(base);
+    } else {
+      addGlobScopes(*query->glob_tree, base, scopes);
+    }
+  }
+  return scopes;
+}
+
+// Whether no dir in `outstanding` is `path`, beneath it, or above it, down to
+// `root`.
+bool isSubtreeComplete(
+    const std::set<w_string>& outstanding,
+    const w_string& root,
+    const w_string& path) {
+  for (auto it = outstanding.lower_bound(path);
+       it != outstanding.end() && it->piece().startsWith(path);
+       ++it) {
+    if (isWithin(*it, path)) {
+      return false;
+    }
+  }
+  // The crawl of a dir above the path has yet to find it
+  auto dir = path;
+  while (dir.size() > root.size() && isWithin(dir, root)) {
+    dir = dir.dirName();
+    if (outstanding.count(dir)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
 folly::SemiFuture<folly::Unit> InMemoryView::waitUntilReadyToQuery() {
+  // Queries that need more than the crawl has done still wait for it in
+  // their cookie sync.
+  if (config_.getBool("serve_crawled_subtrees", false)) {
+    return folly::makeSemiFuture();
+  }
   auto [p, f] = folly::makePromiseContract<folly::Unit>();
   auto pending = pendingFromWatcher_.lock();
   pending->addSync(std::move(p));
@@ -30,11 +139,147 @@ folly::SemiFuture<folly::Unit> InMemoryView::waitUntilReadyToQuery() {
   return std::move(f);
 }
 
+bool InMemoryView::deferCrawl(const Root& root, const w_string& fullPath) {
+  if (!lazyCrawlDepth_ || fullPath == rootPath_ ||
+      !isWithin(fullPath, rootPath_) || root.cookies.isCookieDir(fullPath) ||
+      root.ignore.isIgnoreVCS(fullPath)) {
+    return false;
+  }
+  size_t depth = 1;
+  for (size_t i = rootPath_.size() + 1; i < fullPath.size(); ++i) {
+    if (is_slash(fullPath.data()[i])) {
+      ++depth;
+    }
+  }
+  if (depth != lazyCrawlDepth_) {
+    return false;
+  }
+
+  auto lazy = lazyCrawl_.lock();
+  for (auto& prefix : lazy->prefixes) {
+    if (overlaps(fullPath, prefix)) {
+      return false;
+    }
+  }
+  lazy->deferred.insert(fullPath);
+  return true;
+}
+
+std::vector<w_string> InMemoryView::takeDeferredCrawls(const Query* query) {
+  // The query can only produce results from beneath these
+  const auto& base = query->relative_root ? *query->relative_root : rootPath_;
+  std::vector<w_string> wanted;
+  if (query->paths) {
+    for (auto& path : *query->paths) {
+      wanted.push_back(
+          path.name.empty() ? base : w_string::pathCat({base, path.name}));
+    }
+  } else {
+    wanted.push_back(base);
+  }
+
+  std::vector<w_string> toCrawl;
+  {
+    auto lazy = lazyCrawl_.lock();
+    for (auto& path : wanted) {
+      auto covered = std::any_of(
+          lazy->prefixes.begin(),
+          lazy->prefixes.end(),
+          [&](const w_string& prefix) { return isWithin(path, prefix); });
+      if (!covered) {
+        lazy->prefixes.push_back(path);
+      }
+    }
+    for (auto it = lazy->deferred.begin(); it != lazy->deferred.end();) {
+      auto wantedDir = std::any_of(
+          wanted.begin(), wanted.end(), [&](const w_string& path) {
+            return overlaps(*it, path);
+          });
+      if (wantedDir) {
+        toCrawl.push_back(*it);
+        it = lazy->deferred.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  return toCrawl;
+}
+
+folly::SemiFuture<folly::Unit> InMemoryView::crawlForQuery(const Query* query) {
+  std::vector<w_string> toCrawl;
+  if (lazyCrawlDepth_) {
+    toCrawl = takeDeferredCrawls(query);
+  }
+  // The IO thread reloads a hibernated view before it resolves any sync.
+  // This query is already in Root::queries, so the view can't hibernate
+  // once we've seen that it isn't.
+  bool hibernated = *hibernated_.lock();
+  if (toCrawl.empty() && !hibernated) {
+    return folly::makeSemiFuture();
+  }
+
+  if (!toCrawl.empty()) {
+    logf(DBG, "lazy_crawl: crawling {} deferred dirs\n", toCrawl.size());
+  }
+  auto now = std::chrono::system_clock::now();
+  auto [p, f] = folly::makePromiseContract<folly::Unit>();
+  auto pending = pendingFromWatcher_.lock();
+  for (auto& dir : toCrawl) {
+    pending->add(dir, now, W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY);
+  }
+  pending->addSync(std::move(p));
+  pending->ping();
+  return std::move(f);
+}
+
+bool InMemoryView::isCrawledForQuery(const Query* query) const {
+  auto scopes = queryScopes(query, rootPath_);
+  auto progress = crawlProgress_.lock();
+  if (!progress->tracking) {
+    return false;
+  }
+  return std::all_of(scopes.begin(), scopes.end(), [&](const w_string& path) {
+    return isSubtreeComplete(progress->outstanding, rootPath_, path);
+  });
+}
+
+void InMemoryView::updateCrawlProgress(
+    PendingChanges& coll,
+    const w_string& path) {
+  if (!crawlProgress_.lock()->tracking) {
+    return;
+  }
+  // The crawl of `path` queued those of the dirs it found
+  auto queued = coll.recursiveItemsWithin(path);
+
+  auto progress = crawlProgress_.lock();
+  bool requeued = false;
+  for (auto& dir : queued) {
+    requeued = requeued || dir == path;
+    progress->outstanding.insert(std::move(dir));
+  }
+  if (!requeued) {
+    progress->outstanding.erase(path);
+  }
+}
+
 void InMemoryView::fullCrawl(
     const std::shared_ptr<Root>& root,
     PendingCollection& pendingFromWatcher,
     PendingChanges& localPending) {
-  root->recrawlInfo.wlock()->crawlStart = std::chrono::steady_clock::now();
+  // Background roots take turns at crawling, so that several of them
+  // recrawling at once do not swamp the disk.
+  std::optional<CrawlScheduler::CrawlToken> crawlToken;
+  if (root->background_priority) {
+    crawlToken.emplace(getCrawlScheduler().acquireBackgroundCrawl(
+        size_t(std::max<json_int_t>(
+            1, cfg_get_int("background_crawl_concurrency", 1))),
+        stopThreads_));
+  }
+
+  auto crawlStart = std::chrono::steady_clock::now();
+  root->recrawlInfo.wlock()->crawlStart = crawlStart;
 
   PerfSample sample("full-crawl");
 
@@ -47,6 +292,19 @@ void InMemoryView::fullCrawl(
   fullCrawlStatCount_ = std::make_shared<std::atomic<size_t>>(0);
   root->recrawlInfo.wlock()->statCount = fullCrawlStatCount_;
 
+  // lazy_crawl leaves subtrees out of the crawl, so they can't be complete
+  if (!lazyCrawlDepth_ &&
+      root->config.getBool("serve_crawled_subtrees", false)) {
+    auto progress = crawlProgress_.lock();
+    progress->tracking = true;
+    progress->outstanding = {root->root_path};
+  }
+  SCOPE_EXIT {
+    auto progress = crawlProgress_.lock();
+    progress->tracking = false;
+    progress->outstanding.clear();
+  };
+
   auto start = std::chrono::system_clock::now();
   pendingFromWatcher.lock()->add(root->root_path, start, W_PENDING_RECURSIVE);
   while (true) {
@@ -61,17 +319,21 @@ void InMemoryView::fullCrawl(
       auto lock = pendingFromWatcher.lock();
       localPending.append(lock->stealItems(), lock->stealSyncs());
     }
+    fromNotifyThread_.drainInto(localPending);
     if (localPending.empty()) {
       break;
     }
 
-    (void)processAllPending(root, *view, localPending);
+    (void)processAllPending(root, view, localPending);
   }
 
   auto recrawlInfo = root->recrawlInfo.wlock();
   recrawlInfo->shouldRecrawl = false;
   recrawlInfo->crawlFinish = std::chrono::steady_clock::now();
   recrawlInfo->statCount = nullptr;
+  // Recrawls are not recorded, as the timeline keeps the first crawl
+  root->initTimeline.record(
+      "initial_crawl", crawlStart, recrawlInfo->crawlFinish);
   fullCrawlStatCount_ = nullptr;
   root->inner.done_initial.store(true, std::memory_order_release);
 
@@ -110,14 +372,51 @@ InMemoryView::Continue InMemoryView::doSettleThings(
             std::chrono::steady_clock::now() - *state.lastUnsettle)
       : std::chrono::milliseconds{0};
 
+  // Only the first settle after a change marks when that change settled
+  auto settledAt = std::chrono::system_clock::now();
+  if (lastSettled_.load(std::memory_order_relaxed) <
+      lastProcessed_.load(std::memory_order_relaxed)) {
+    lastSettled_.store(settledAt, std::memory_order_relaxed);
+  }
+
+  auto warmStart = std::chrono::steady_clock::now();
   warmContentCache();
+  warmSymlinkCache();
+  if (root.inner.done_initial.load(std::memory_order_acquire) &&
+      root.initTimeline.record("cache_warm", warmStart)) {
+    // The root is now fully initialized
+    PerfSample sample("root-init");
+    sample.add_root_metadata(root.getRootMetadata());
+    sample.add_meta("init", root.initTimeline.toJson());
+    sample.finish();
+    sample.force_log();
+    sample.log();
+  }
+  refreshScmMergeBases(root);
+  if (journal_) {
+    journal_->flush(mostRecentTick_.load());
+  }
+  saveSnapshot(/*force=*/false);
+  {
+    // Under the view lock, so that no change is made between the two
+    auto view = view_.rlock();
+    subscriptionRouter_.settled(
+        ClockPosition(rootNumber_, mostRecentTick_),
+        view->getStructureGeneration());
+  }
 
-  root.unilateralResponses->enqueue(json_object({{"settled", json_true()}}));
+  root.unilateralResponses->enqueue(
+      json_object({{"settled", json_true()}}), "settled");
+  root.settleProjectedRoots();
 
   if (root.considerReap()) {
     root.stopWatch("Watch was idle for too long");
     return Continue::Stop;
   }
+  if (considerHibernate(root)) {
+    state.currentTimeout = state.biggestTimeout;
+    return Continue::Continue;
+  }
 
   std::optional<std::chrono::milliseconds> nextPendingSettle;
 
@@ -153,7 +452,9 @@ void InMemoryView::clientModeCrawl(const std::shared_ptr<Root>& root) {
 
 namespace {
 
-std::chrono::milliseconds getBiggestTimeout(const Root& root) {
+std::chrono::milliseconds getBiggestTimeout(
+    const Root& root,
+    std::chrono::seconds idleHibernateAge) {
   std::chrono::milliseconds biggest_timeout = root.gc_interval;
 
   if (biggest_timeout.count() == 0 ||
@@ -161,6 +462,10 @@ std::chrono::milliseconds getBiggestTimeout(const Root& root) {
        root.idle_reap_age < biggest_timeout)) {
     biggest_timeout = root.idle_reap_age;
   }
+  if (biggest_timeout.count() == 0 ||
+      (idleHibernateAge.count() != 0 && idleHibernateAge < biggest_timeout)) {
+    biggest_timeout = idleHibernateAge;
+  }
   if (biggest_timeout.count() == 0) {
     biggest_timeout = std::chrono::hours(24);
   }
@@ -170,8 +475,12 @@ std::chrono::milliseconds getBiggestTimeout(const Root& root) {
 } // namespace
 
 void InMemoryView::ioThread(const std::shared_ptr<Root>& root) {
-  IoThreadState state{getBiggestTimeout(*root)};
+  IoThreadState state{getBiggestTimeout(*root, idleHibernateAge_)};
   state.currentTimeout = root->trigger_settle;
+  if (root->trigger_settle_max > root->trigger_settle) {
+    state.adaptiveSettle.emplace(
+        root->trigger_settle, root->trigger_settle_max);
+  }
   // Injects a temporary blocks, only in test code. This is to
   // force the iothread to loose a race with the notify thread.
   // TODO: Support something like EdenFS FaultInjector so that we can do
@@ -179,8 +488,28 @@ void InMemoryView::ioThread(const std::shared_ptr<Root>& root) {
   if (config_.getBool("inject_block_in_io_thread_start", false)) {
     sleep(10);
   }
+  lastSnapshotTime_ = std::chrono::steady_clock::now();
+  loadSnapshot();
   while (Continue::Continue == stepIoThread(root, state, pendingFromWatcher_)) {
   }
+  // Fail any syncs the notify thread queued after our last pass, as
+  // stopThreads() did for those in pendingFromWatcher_.
+  PendingChanges leftover;
+  fromNotifyThread_.drainInto(leftover);
+  for (auto& sync : leftover.stealSyncs()) {
+    sync.setException(std::runtime_error("Watch shutting down"));
+  }
+  if (journal_ && journal_->isOpen()) {
+    // The journal brings the last snapshot up to date, which is much
+    // cheaper than saving a new one.
+    journal_->flush(mostRecentTick_.load(), /*close=*/true);
+  } else if (root->inner.done_initial.load(std::memory_order_acquire)) {
+    // Persist the view so that the next daemon instance can start warm.
+    saveSnapshot(/*force=*/true);
+    if (journal_) {
+      journal_->flush(mostRecentTick_.load(), /*close=*/true);
+    }
+  }
 }
 
 InMemoryView::Continue InMemoryView::stepIoThread(
@@ -195,7 +524,9 @@ InMemoryView::Continue InMemoryView::stepIoThread(
     state.lastUnsettle = std::chrono::steady_clock::now();
     // Reduce sleep timeout to the settle duration ready for the next loop
     // through.
-    state.currentTimeout = root->trigger_settle;
+    state.currentTimeout = state.adaptiveSettle
+        ? state.adaptiveSettle->settlePeriod()
+        : root->trigger_settle;
   };
 
   if (!root->inner.done_initial.load(std::memory_order_acquire)) {
@@ -207,15 +538,19 @@ InMemoryView::Continue InMemoryView::stepIoThread(
   }
 
   // Wait for the notify thread to give us pending items, or for
-  // the settle period to expire
+  // the settle period to expire. Batches it queued meanwhile are taken
+  // without sleeping; it only pings us once we announced that we may sleep.
   {
     logf(DBG, "poll_events timeout={}ms\n", state.currentTimeout);
-    auto targetPendingLock =
-        pendingFromWatcher.lockAndWait(state.currentTimeout);
+    auto targetPendingLock = fromNotifyThread_.prepareToWait()
+        ? pendingFromWatcher.lockAndWait(state.currentTimeout)
+        : pendingFromWatcher.lock();
+    fromNotifyThread_.finishWait();
     logf(DBG, " ... wake up\n");
     state.localPending.append(
         targetPendingLock->stealItems(), targetPendingLock->stealSyncs());
   }
+  fromNotifyThread_.drainInto(state.localPending);
 
   if (root->inner.cancelled.load(std::memory_order_acquire)) {
     // The root was cancelled. Root::cancel will call stopThreads() soon, so
@@ -223,6 +558,19 @@ InMemoryView::Continue InMemoryView::stepIoThread(
     return Continue::Stop;
   }
 
+  if (*hibernated_.lock()) {
+    bool idle = state.localPending.empty();
+    if (stashWhileHibernated(*root, state.localPending)) {
+      if (idle && root->considerReap()) {
+        root->stopWatch("Watch was idle for too long");
+        return Continue::Stop;
+      }
+      state.currentTimeout = state.biggestTimeout;
+      return Continue::Continue;
+    }
+    thaw(*root, state.localPending);
+  }
+
   // Has a Watcher indicated this root needs a recrawl?
   // TODO: scheduleRecrawl should be replaced with a regular event published in
   // the PendingCollection.
@@ -249,6 +597,12 @@ InMemoryView::Continue InMemoryView::stepIoThread(
 
   // Otherwise we have pending items to stat and crawl
 
+  if (state.adaptiveSettle && state.lastUnsettle) {
+    state.adaptiveSettle->noteIdleGap(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - *state.lastUnsettle));
+  }
+
   // Some Linux kernels between 5.3 and 5.6 will report inotify events before
   // the file has been evicted from the cache, causing Watchman to incorrectly
   // think the file is still on disk after it's unlinked. If configured, allow
@@ -261,15 +615,24 @@ InMemoryView::Continue InMemoryView::stepIoThread(
     std::this_thread::sleep_for(std::chrono::milliseconds(notify_sleep_ms));
   }
 
+  auto applyStart = std::chrono::steady_clock::now();
   auto view = view_.wlock();
 
   mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
 
-  auto isDesynced = processAllPending(root, *view, state.localPending);
+  auto isDesynced = processAllPending(root, view, state.localPending);
+  getWatchmanStats()->addDuration(
+      &PipelineStats::applyPending,
+      std::chrono::steady_clock::now() - applyStart);
+  lastProcessed_.store(
+      std::chrono::system_clock::now(), std::memory_order_relaxed);
   if (isDesynced == IsDesynced::Yes) {
     logf(ERR, "recrawl complete, aborting all pending cookies\n");
     root->cookies.abortAllCookies();
   }
+  view.unlock();
+
+  warmContentCacheWhileBusy();
 
   // Always mark unsettled after processing events because settle durations
   // should only include idle time, not time spent processing events.
@@ -279,10 +642,16 @@ InMemoryView::Continue InMemoryView::stepIoThread(
 
 InMemoryView::IsDesynced InMemoryView::processAllPending(
     const std::shared_ptr<Root>& root,
-    ViewDatabase& view,
+    SynchronizedViewDatabase::WLockedPtr& view,
     PendingChanges& coll) {
   auto desyncState = IsDesynced::No;
 
+  auto yieldAfter =
+      std::chrono::milliseconds(config_.getInt("view_lock_yield_ms", 20));
+  auto backgroundMaxPause = std::chrono::milliseconds(
+      config_.getInt("background_max_pause_ms", 1000));
+  auto lockAcquired = std::chrono::steady_clock::now();
+
   // Don't resolve any of these until any recursive crawls are done.
   std::vector<std::vector<folly::Promise<folly::Unit>>> allSyncs;
 
@@ -294,6 +663,8 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
   // to all pending change events.
   std::vector<w_string> pendingCookies;
 
+  auto stats = getWatchmanStats();
+
   while (!coll.empty()) {
     logf(
         DBG,
@@ -301,39 +672,100 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
         coll.getPendingItemCount(),
         rootPath_);
 
+    WATCHMAN_TRACE(
+        pending__stolen, rootPath_.c_str(), coll.getPendingItemCount());
+    // The entries go back to the pool together once they are processed
     auto pending = coll.stealItems();
     auto syncs = coll.stealSyncs();
     if (syncs.empty()) {
       w_check(
-          pending != nullptr,
+          !pending.empty(),
           "coll.stealItems() and coll.size() did not agree about its size");
     } else {
       allSyncs.push_back(std::move(syncs));
     }
 
-    while (pending) {
-      if (!stopThreads_.load(std::memory_order_acquire)) {
-        if (pending->flags & W_PENDING_IS_DESYNCED) {
-          // The watcher is desynced but some cookies might be written to disk
-          // while the recursive crawl is ongoing. We are going to specifically
-          // ignore these cookies during that recursive crawl to avoid a race
-          // condition where cookies might be seen before some files have been
-          // observed as changed on disk. Due to this, and the fact that cookies
-          // notifications might simply have been dropped by the watcher, we
-          // need to abort the pending cookies to force them to be recreated on
-          // disk, and thus re-seen.
-          if (pending->flags & W_PENDING_CRAWL_ONLY) {
-            desyncState = IsDesynced::Yes;
-          }
+    auto batchStart = std::chrono::system_clock::now();
+    for (auto* item = pending.head(); item; item = item->next) {
+      // The system clock may have stepped back since the change was noticed
+      if ((item->flags & W_PENDING_VIA_NOTIFY) && item->now <= batchStart) {
+        stats->addDuration(
+            &PipelineStats::notifyToProcess, batchStart - item->now);
+      }
+    }
+
+    // A large batch, such as from a source control checkout, has its stats
+    // made on the thread pool up front rather than one at a time below.
+    auto prefetched = collectPendingStats(*root, pending);
+    if (!prefetched.empty()) {
+      // The stats don't touch the view, so let queries in while they run,
+      // as if the lock were being yielded between items.
+      bool unlocked = yieldAfter.count() > 0;
+      if (unlocked) {
+        view.unlock();
+      }
+      prefetchPendingStats(*root, prefetched);
+      if (unlocked) {
+        view = view_.wlock();
+        mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
+        lockAcquired = std::chrono::steady_clock::now();
+      }
+    }
+    size_t nextPrefetched = 0;
+
+    for (auto* item = pending.head(); item; item = item->next) {
+      if (stopThreads_.load(std::memory_order_acquire)) {
+        break;
+      }
+      if (item->flags & W_PENDING_IS_DESYNCED) {
+        // The watcher is desynced but some cookies might be written to disk
+        // while the recursive crawl is ongoing. We are going to specifically
+        // ignore these cookies during that recursive crawl to avoid a race
+        // condition where cookies might be seen before some files have been
+        // observed as changed on disk. Due to this, and the fact that cookies
+        // notifications might simply have been dropped by the watcher, we
+        // need to abort the pending cookies to force them to be recreated on
+        // disk, and thus re-seen.
+        if (item->flags & W_PENDING_CRAWL_ONLY) {
+          desyncState = IsDesynced::Yes;
         }
+      }
 
-        // processPath may insert new pending items into `coll`
-        processPath(root, view, coll, *pending, nullptr, pendingCookies);
+      const PrefetchedStat* prefetchedStat = nullptr;
+      if (nextPrefetched < prefetched.size() &&
+          prefetched[nextPrefetched].item == item) {
+        prefetchedStat = &prefetched[nextPrefetched++];
       }
 
-      // TODO: Document that continuing to run this loop when stopThreads_ is
-      // true fixes a stack overflow when pending is long.
-      pending = std::move(pending->next);
+      // processPath may insert new pending items into `coll`
+      processPath(
+          root,
+          *view,
+          coll,
+          *item,
+          nullptr,
+          pendingCookies,
+          nullptr,
+          prefetchedStat);
+      if (item->flags & W_PENDING_RECURSIVE) {
+        updateCrawlProgress(coll, item->path);
+      }
+
+      if (yieldAfter.count() > 0 &&
+          std::chrono::steady_clock::now() - lockAcquired >= yieldAfter) {
+        // Let any waiting queries in.  The view is consistent between
+        // items, and cookies are not notified until the end, so a query
+        // that syncs to now will still wait for the whole batch.
+        view.unlock();
+        if (root->background_priority) {
+          getCrawlScheduler().yieldToQueries(backgroundMaxPause);
+        } else {
+          std::this_thread::yield();
+        }
+        view = view_.wlock();
+        mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
+        lockAcquired = std::chrono::steady_clock::now();
+      }
     }
   }
 
@@ -368,7 +800,9 @@ void InMemoryView::processPath(
     PendingChanges& coll,
     const PendingChange& pending,
     const FileInformation* pre_stat,
-    std::vector<w_string>& pendingCookies) {
+    std::vector<w_string>& pendingCookies,
+    watchman_dir* parentDir,
+    const PrefetchedStat* prefetched) {
   w_check(
       pending.path.size() >= rootPath_.size(),
       "full_path must be a descendant of the root directory\n",
@@ -418,10 +852,23 @@ void InMemoryView::processPath(
     return;
   }
 
+  if (auto* scm = getSCM(); scm && scm->isCommitStateFile(pending.path)) {
+    // Refresh the merge bases once things settle
+    scmStateChanged_.store(true, std::memory_order_release);
+  }
+
   if (pending.path == rootPath_ || (pending.flags & W_PENDING_CRAWL_ONLY)) {
     crawler(root, view, coll, pending, pendingCookies);
   } else {
-    statPath(*root, root->cookies, view, coll, pending, pre_stat);
+    statPath(
+        *root,
+        root->cookies,
+        view,
+        coll,
+        pending,
+        pre_stat,
+        parentDir,
+        prefetched);
   }
 }
 
@@ -436,8 +883,225 @@ void apply_dir_size_hint(watchman_dir* dir, uint32_t ndirs, uint32_t nfiles) {
   }
 }
 
+// A change made to a dir this soon after it was statted may not move its
+// timestamps on filesystems with a coarse timestamp resolution
+constexpr std::chrono::seconds kCrawlStampResolution{2};
+
+int64_t toNanoseconds(const struct timespec& ts) {
+  return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Returns the stamp of a dir with stat st, taken no later than `now`, before
+ * its entries were read.  There is none if a change made after the entries
+ * were read could leave the timestamps as they are.
+ */
+std::optional<DirCrawlStamp> makeCrawlStamp(
+    const FileInformation& st,
+    std::chrono::system_clock::time_point now) {
+  auto limit =
+      std::chrono::system_clock::to_time_t(now - kCrawlStampResolution);
+  if (st.mtime.tv_sec >= limit || st.ctime.tv_sec >= limit) {
+    return std::nullopt;
+  }
+  return DirCrawlStamp{toNanoseconds(st.mtime), toNanoseconds(st.ctime)};
+}
+
+// How statCrawlEntries() spreads the stats of a dir across the thread pool
+struct StatFanOut {
+  // Dirs with fewer entries to stat than this are statted on the IO thread
+  size_t minEntries;
+  size_t minEntriesPerTask;
+  size_t maxTasks;
+};
+
+constexpr StatFanOut kLocalStatFanOut{256, 128, 8};
+// A remote stat mostly waits on the network, so many more can overlap
+constexpr StatFanOut kRemoteStatFanOut{32, 8, 32};
+
+// How prefetchPendingStats() spreads the stats of a batch of pending items.
+// Releasing and reacquiring the view lock around them isn't free, so it
+// takes more items than a dir's entries to be worth it.
+constexpr StatFanOut kLocalPendingStatFanOut{1024, 256, 16};
+constexpr StatFanOut kRemotePendingStatFanOut{64, 16, 32};
+
+// An entry that crawler() will pass to processPath()
+struct CrawlEntry {
+  w_string name;
+  w_string fullPath;
+  PendingFlags flags;
+  std::optional<FileInformation> stat;
+};
+
+void statCrawlEntries(
+    DirHandle& osdir,
+    std::vector<CrawlEntry>& entries,
+    const std::vector<size_t>& indices,
+    size_t begin,
+    size_t end) {
+  for (size_t i = begin; i < end; ++i) {
+    auto& entry = entries[indices[i]];
+    FileInformation st;
+    if (osdir.statNamedEntry(entry.name.c_str(), st)) {
+      entry.stat = st;
+    }
+  }
+}
+
+/**
+ * Stats the entries that the dir handle didn't report stat information
+ * for.  Large dirs are split into ranges that are statted on the thread
+ * pool, so that the IO thread doesn't wait on one stat at a time.  Entries
+ * that can't be statted relative to the dir are left for statPath().
+ */
+void statCrawlEntries(
+    DirHandle& osdir,
+    std::vector<CrawlEntry>& entries,
+    bool parallel,
+    const StatFanOut& fanOut) {
+  std::vector<size_t> indices;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (!entries[i].stat) {
+      indices.push_back(i);
+    }
+  }
+  if (!parallel || indices.size() < fanOut.minEntries) {
+    statCrawlEntries(osdir, entries, indices, 0, indices.size());
+    return;
+  }
+
+  auto numTasks =
+      std::min(fanOut.maxTasks, indices.size() / fanOut.minEntriesPerTask);
+  auto perTask = (indices.size() + numTasks - 1) / numTasks;
+  std::vector<folly::Future<folly::Unit>> futures;
+
+  // The tasks reference our locals, so they must be done before we return,
+  // even if we are throwing an exception.
+  SCOPE_EXIT {
+    if (!futures.empty()) {
+      folly::collectAll(futures.begin(), futures.end()).wait();
+    }
+  };
+
+  for (size_t begin = perTask; begin < indices.size(); begin += perTask) {
+    auto end = std::min(indices.size(), begin + perTask);
+    try {
+      futures.emplace_back(folly::via(
+          getThreadPool().executorFor(WorkClass::Crawl), [&, begin, end] {
+            statCrawlEntries(osdir, entries, indices, begin, end);
+          }));
+    } catch (const std::exception& exc) {
+      // The pool is full or shutting down; do the work ourselves.
+      log(DBG, "statting crawl entries inline: ", exc.what(), "\n");
+      statCrawlEntries(osdir, entries, indices, begin, end);
+    }
+  }
+  statCrawlEntries(
+      osdir, entries, indices, 0, std::min(indices.size(), perTask));
+}
+
 } // namespace
 
+std::vector<InMemoryView::PrefetchedStat> InMemoryView::collectPendingStats(
+    const Root& root,
+    const PendingChain& pending) const {
+  std::vector<PrefetchedStat> stats;
+  if (!root.config.getBool("pending_parallel_stat", true)) {
+    return stats;
+  }
+  const auto& fanOut = fileSystem_.isRemote() ? kRemotePendingStatFanOut
+                                              : kLocalPendingStatFanOut;
+
+  // Mirrors the items that processPath() passes on to statPath() and that
+  // statPath() then stats.
+  bool hasFileInformation = watcher_->flags & WATCHER_HAS_FILE_INFORMATION;
+  for (auto* item = pending.head(); item; item = item->next) {
+    if (item->flags.contains(W_PENDING_CRAWL_ONLY) ||
+        item->flags.contains(W_PENDING_VIA_PWALK) ||
+        (item->stat && hasFileInformation) || item->path == rootPath_ ||
+        root.cookies.isCookiePrefix(item->path) ||
+        root.ignore.isIgnoreDir(item->path) ||
+        root.ignore.isIgnoreGlob(item->path)) {
+      continue;
+    }
+    stats.push_back(PrefetchedStat{item, {}, {}, {}});
+  }
+
+  if (stats.size() < fanOut.minEntries) {
+    stats.clear();
+  }
+  return stats;
+}
+
+void InMemoryView::prefetchPendingStats(
+    const Root& root,
+    std::vector<PrefetchedStat>& stats) const {
+  const auto& fanOut = fileSystem_.isRemote() ? kRemotePendingStatFanOut
+                                              : kLocalPendingStatFanOut;
+
+  // Siblings are statted by the same task, which keeps the lookups of their
+  // parent's path warm and the tasks' dentry lookups apart.
+  auto dirOf = [&](size_t i) { return stats[i].item->path.piece().dirName(); };
+  std::vector<size_t> order(stats.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return dirOf(a) < dirOf(b);
+  });
+
+  auto statRange = [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      auto& entry = stats[order[i]];
+      entry.issued = std::chrono::system_clock::now();
+      try {
+        entry.st = fileSystem_.getFileInformation(
+            entry.item->path.c_str(), root.case_sensitive);
+      } catch (const std::system_error& exc) {
+        entry.error = exc.code();
+      }
+    }
+  };
+
+  // Cut the batch at dir boundaries where we can, but don't let one huge dir
+  // leave the other tasks idle.
+  auto numTasks =
+      std::min(fanOut.maxTasks, order.size() / fanOut.minEntriesPerTask);
+  auto perTask = (order.size() + numTasks - 1) / numTasks;
+  std::vector<std::pair<size_t, size_t>> ranges;
+  for (size_t begin = 0; begin < order.size();) {
+    auto end = std::min(order.size(), begin + perTask);
+    while (end < order.size() && end - begin < 2 * perTask &&
+           dirOf(order[end]) == dirOf(order[end - 1])) {
+      ++end;
+    }
+    ranges.emplace_back(begin, end);
+    begin = end;
+  }
+
+  std::vector<folly::Future<folly::Unit>> futures;
+
+  // The tasks reference our locals, so they must be done before we return,
+  // even if we are throwing an exception.
+  SCOPE_EXIT {
+    if (!futures.empty()) {
+      folly::collectAll(futures.begin(), futures.end()).wait();
+    }
+  };
+
+  for (size_t i = 1; i < ranges.size(); ++i) {
+    auto [begin, end] = ranges[i];
+    try {
+      futures.emplace_back(folly::via(
+          getThreadPool().executorFor(WorkClass::Crawl),
+          [&statRange, begin = begin, end = end] { statRange(begin, end); }));
+    } catch (const std::exception& exc) {
+      // The pool is full or shutting down; do the work ourselves.
+      log(DBG, "statting pending items inline: ", exc.what(), "\n");
+      statRange(begin, end);
+    }
+  }
+  statRange(ranges[0].first, ranges[0].second);
+}
+
 void InMemoryView::crawler(
     const std::shared_ptr<Root>& root,
     ViewDatabase& view,
@@ -489,15 +1153,47 @@ void InMemoryView::crawler(
     }
   }
 
+  // A recrawl doesn't need to read the dirs whose mtime and ctime haven't
+  // moved since they were last read: they have the same entries.  The
+  // entries that the view holds are still statted, and their subdirs
+  // crawled, as changes to those don't touch the dir.
+  bool skipUnchanged = recursive &&
+      root->config.getBool("recrawl_skip_unchanged_dirs", true);
+
+  // Only this crawler can skip a dir, so it takes over once there are stamps.
+  // While subtrees are served as they complete, the root's dirs are crawled
+  // one at a time so that they complete one at a time.
   if (recursive &&
-      root->enable_parallel_crawl.load(std::memory_order_acquire)) {
+      root->enable_parallel_crawl.load(std::memory_order_acquire) &&
+      !(skipUnchanged && dir->crawlStamp) &&
+      !(pending.path == rootPath_ && crawlProgress_.lock()->tracking)) {
     return crawlerParallel(root, view, coll, pending, pendingCookies);
   }
 
   auto& path = pending.path;
 
+  // The dir is statted before it is read, so that any change to its entries
+  // that the read may miss moves its timestamps past the stamp
+  std::optional<DirCrawlStamp> stamp;
+  if (skipUnchanged) {
+    try {
+      stamp = makeCrawlStamp(
+          fileSystem_.getFileInformation(path.c_str(), root->case_sensitive),
+          pending.now);
+    } catch (const std::system_error& err) {
+      logf(DBG, "getFileInformation({}) threw {}\n", path, err.what());
+    }
+  }
+  bool readEntries =
+      !(stamp && dir->crawlStamp == stamp && dir->last_check_existed);
+
   logf(
-      DBG, "opendir({}) recursive={} stat_all={}\n", path, recursive, stat_all);
+      DBG,
+      "opendir({}) recursive={} stat_all={} read_entries={}\n",
+      path,
+      recursive,
+      stat_all,
+      readEntries);
 
   /* Start watching and open the dir for crawling.
    * Whether we open the dir prior to watching or after is watcher specific,
@@ -513,6 +1209,9 @@ void InMemoryView::crawler(
     view.markDirDeleted(dir, getClock(pending.now), true);
     return;
   }
+  if (fileSystem_.isRemote()) {
+    osdir->useCachedStats();
+  }
 
   if (dir->files.empty()) {
     // Pre-size our hash(es) if we can, so that we can avoid collisions
@@ -528,63 +1227,118 @@ void InMemoryView::crawler(
     // st.st_nlink is usually number of dirs + 2 (., ..).
     // If it is less than 2 then it doesn't follow that convention.
     // We just pass it through for the dir size hint and the hash
-    // table implementation will round that up to the next power of 2
+    // table implementation will round that up to the next power of 2.
+    // The file hint defaults to the small-mode capacity of the child map;
+    // larger directories grow the table on demand.
     apply_dir_size_hint(
         dir,
         num_dirs,
-        uint32_t(root->config.getInt("hint_num_files_per_dir", 64)));
+        uint32_t(root->config.getInt(
+            "hint_num_files_per_dir",
+            DirChildMap<watchman_dir::Ptr>::kSmallCapacity)));
   }
 
   /* flag for delete detection */
   for (auto& it : dir->files) {
     auto file = it.second.get();
-    if (file->exists) {
+    if (file->exists && readEntries) {
       file->maybe_deleted = true;
     }
   }
 
+  // Classify each entry against ignore_dirs with a single automaton step
+  // from this dir, before its full path is built for statPath().
+  auto ignoreState = root->ignore.match(path);
+
+  // The whole dir is read before any of its entries are statted, so that
+  // the stats can be issued together
+  std::vector<CrawlEntry> entries;
   try {
-    while (const DirEntry* dirent = osdir->readDir()) {
-      // Don't follow parent/self links
-      if (dirent->d_name[0] == '.' &&
-          (!strcmp(dirent->d_name, ".") || !strcmp(dirent->d_name, ".."))) {
-        continue;
+    if (!readEntries) {
+      PendingFlags newFlags = W_PENDING_RECURSIVE;
+      if (pending.flags & W_PENDING_IS_DESYNCED) {
+        newFlags.set(W_PENDING_IS_DESYNCED);
       }
-
-      // Queue it up for analysis if the file is newly existing
-      w_string name(dirent->d_name, W_STRING_BYTE);
-      struct watchman_file* file = dir->getChildFile(name);
-      if (file) {
-        file->maybe_deleted = false;
+      for (auto& it : dir->files) {
+        auto file = it.second.get();
+        if (file->exists) {
+          entries.emplace_back(CrawlEntry{
+              file->getName().asWString(),
+              dir->getFullPathToChild(file->getName()),
+              newFlags});
+        }
       }
-      if (!file || !file->exists || stat_all || recursive) {
-        auto full_path = dir->getFullPathToChild(name);
+    } else {
+      while (const DirEntry* dirent = osdir->readDir()) {
+        // Don't follow parent/self links
+        if (dirent->d_name[0] == '.' &&
+            (!strcmp(dirent->d_name, ".") || !strcmp(dirent->d_name, ".."))) {
+          continue;
+        }
 
-        PendingFlags newFlags;
-        if (recursive || !file || !file->exists) {
-          newFlags.set(W_PENDING_RECURSIVE);
+        // Queue it up for analysis if the file is newly existing
+        w_string name(dirent->d_name, W_STRING_BYTE);
+        struct watchman_file* file = dir->getChildFile(name);
+        if (file) {
+          file->maybe_deleted = false;
         }
-        if (pending.flags & W_PENDING_IS_DESYNCED) {
-          newFlags.set(W_PENDING_IS_DESYNCED);
+        if (root->ignore.isIgnoreDirState(
+                root->ignore.descend(ignoreState, name.piece()))) {
+          logf(DBG, "{}/{} matches ignore_dir rules\n", path, name);
+          continue;
         }
+        if (!file || !file->exists || stat_all || recursive) {
+          auto full_path = dir->getFullPathToChild(name);
+          if (root->ignore.isIgnoreGlob(full_path)) {
+            logf(DBG, "{} matches ignore_globs rules\n", full_path);
+            continue;
+          }
 
-        logf(
-            DBG,
-            "in crawler calling processPath on {} oldflags={} newflags={}\n",
-            full_path,
-            pending.flags.asRaw(),
-            newFlags.asRaw());
+          PendingFlags newFlags;
+          if (recursive || !file || !file->exists) {
+            newFlags.set(W_PENDING_RECURSIVE);
+          }
+          if (pending.flags & W_PENDING_IS_DESYNCED) {
+            newFlags.set(W_PENDING_IS_DESYNCED);
+          }
 
-        PendingChange full_pending{std::move(full_path), pending.now, newFlags};
-        processPath(
-            root,
-            view,
-            coll,
-            full_pending,
-            dirent->has_stat ? &dirent->stat : nullptr,
-            pendingCookies);
+          auto& entry = entries.emplace_back(
+              CrawlEntry{std::move(name), std::move(full_path), newFlags});
+          if (dirent->has_stat) {
+            entry.stat = dirent->stat;
+          }
+        }
       }
     }
+
+    statCrawlEntries(
+        *osdir,
+        entries,
+        root->config.getBool("crawl_parallel_stat", true),
+        fileSystem_.isRemote() ? kRemoteStatFanOut : kLocalStatFanOut);
+
+    for (auto& entry : entries) {
+      logf(
+          DBG,
+          "in crawler calling processPath on {} oldflags={} newflags={}\n",
+          entry.fullPath,
+          pending.flags.asRaw(),
+          entry.flags.asRaw());
+
+      PendingChange full_pending{
+          std::move(entry.fullPath), pending.now, entry.flags};
+      processPath(
+          root,
+          view,
+          coll,
+          full_pending,
+          entry.stat ? &*entry.stat : nullptr,
+          pendingCookies);
+    }
+
+    if (skipUnchanged) {
+      dir->crawlStamp = stamp;
+    }
   } catch (const std::system_error& exc) {
     log(ERR,
         "Error while reading dir ",
@@ -592,6 +1346,7 @@ void InMemoryView::crawler(
         ": ",
         exc.what(),
         ", re-adding to pending list to re-assess\n");
+    dir->crawlStamp.reset();
     coll.add(path, pending.now, {});
   }
   osdir.reset();
@@ -623,7 +1378,8 @@ class CrawlerFileSystem : public FileSystem {
     (void)strict;
     // Match ignore handling in statPath().
     w_string fullPath{path};
-    if (root_->ignore.isIgnoreDir(fullPath)) {
+    if (root_->ignore.isIgnoreDir(fullPath) ||
+        root_->ignore.isIgnoreGlob(fullPath)) {
       return nullptr;
     }
     if ((root_->root_path != fullPath &&
@@ -631,10 +1387,17 @@ class CrawlerFileSystem : public FileSystem {
         !root_->cookies.isCookieDir(fullPath)) {
       return nullptr;
     }
+    if (view_.deferCrawl(*root_, fullPath)) {
+      return nullptr;
+    }
     // Use watcher->startWatchDir to ensure side effects are applied
     // in the right order (ex. inotify_add_watch before opendir).
     // This requires startWatchDir to be thread-safe.
-    return watcher_->startWatchDir(root_, path);
+    auto dir = watcher_->startWatchDir(root_, path);
+    if (dir && fileSystem_.isRemote()) {
+      dir->useCachedStats();
+    }
+    return dir;
   }
 
   FileInformation getFileInformation(
@@ -649,9 +1412,11 @@ class CrawlerFileSystem : public FileSystem {
 
   CrawlerFileSystem(
       FileSystem& fileSystem,
+      InMemoryView& view,
       std::shared_ptr<Root> root,
       std::shared_ptr<Watcher> watcher)
       : fileSystem_{fileSystem},
+        view_{view},
         root_{std::move(root)},
         watcher_{std::move(watcher)} {}
 
@@ -663,12 +1428,75 @@ class CrawlerFileSystem : public FileSystem {
 
  private:
   FileSystem& fileSystem_;
+  InMemoryView& view_;
   std::shared_ptr<Root> root_;
   std::shared_ptr<Watcher> watcher_;
 };
 
+bool did_file_change(
+    const FileInformation* saved,
+    const FileInformation* fresh) {
+  /* we have to compare this way because the stat structure
+   * may contain fields that vary and that don't impact our
+   * understanding of the file */
+
+#define FIELD_CHG(name)             \
+  if (saved->name != fresh->name) { \
+    return true;                    \
+  }
+
+  // Can't compare with memcmp due to padding and garbage in the struct
+  // on OpenBSD, which has a 32-bit tv_sec + 64-bit tv_nsec
+#define TIMESPEC_FIELD_CHG(wat)                           \
+  {                                                       \
+    struct timespec a = saved->wat##time;                 \
+    struct timespec b = fresh->wat##time;                 \
+    if (a.tv_sec != b.tv_sec || a.tv_nsec != b.tv_nsec) { \
+      return true;                                        \
+    }                                                     \
+  }
+
+  FIELD_CHG(mode);
+
+  if (!saved->isDir()) {
+    FIELD_CHG(size);
+    FIELD_CHG(nlink);
+  }
+  FIELD_CHG(dev);
+  FIELD_CHG(ino);
+  FIELD_CHG(uid);
+  FIELD_CHG(gid);
+  // Don't care about st_blocks
+  // Don't care about st_blksize
+  // Don't care about st_atimespec
+  TIMESPEC_FIELD_CHG(m);
+  TIMESPEC_FIELD_CHG(c);
+
+  return false;
+}
 } // namespace
 
+bool InMemoryView::isUnchangedEntry(
+    const watchman_dir& dir,
+    const watchman_file& file,
+    w_string_piece name,
+    const FileInformation& st) const {
+  if (!file.exists || processedPaths_) {
+    return false;
+  }
+  auto saved = file.stat.decode();
+  if (did_file_change(&saved, &st)) {
+    return false;
+  }
+  // statPath would also (re)establish the directory node for a directory,
+  // or prune it for a former directory.
+  auto dirEnt = dir.getChildDir(name);
+  if (st.isDir()) {
+    return dirEnt && dirEnt->last_check_existed;
+  }
+  return !dirEnt;
+}
+
 void InMemoryView::crawlerParallel(
     const std::shared_ptr<Root>& root,
     ViewDatabase& view,
@@ -690,15 +1518,32 @@ void InMemoryView::crawlerParallel(
   // Unlike crawler(), do not call the crawler function recursively
   // (via W_PENDING_RECURSIVE), and avoid extra syscalls.
 
+  // Record the crawl stamps that let crawler() skip reading these dirs when
+  // they are next recrawled.  A subdir's stamp comes from the stat that the
+  // walker took while reading its parent.
+  const bool recordStamps =
+      root->config.getBool("recrawl_skip_unchanged_dirs", true);
+  std::unordered_map<w_string, std::optional<DirCrawlStamp>> dirStamps;
+  if (recordStamps) {
+    try {
+      dirStamps[pending.path] = makeCrawlStamp(
+          fileSystem_.getFileInformation(
+              pending.path.c_str(), root->case_sensitive),
+          pending.now);
+    } catch (const std::system_error& err) {
+      logf(DBG, "getFileInformation({}) threw {}\n", path, err.what());
+    }
+  }
+
   std::shared_ptr<CrawlerFileSystem> fs =
-      std::make_shared<CrawlerFileSystem>(fileSystem_, root, watcher_);
-  size_t threadCountHint = config_.getInt("parallel_crawl_thread_count", 0);
+      std::make_shared<CrawlerFileSystem>(fileSystem_, *this, root, watcher_);
   ParallelWalker walker{
       std::move(fs),
       path,
       root->allow_crawling_other_mounts ? std::nullopt
                                         : std::optional{root->stat},
-      threadCountHint};
+      static_cast<size_t>(root->config.getInt(
+          "crawl_max_queued_entries", kDefaultCrawlMaxQueuedEntries))};
 
   // Step 1: Process readDir results.
   while (true) {
@@ -715,6 +1560,15 @@ void InMemoryView::crawlerParallel(
       dirView->files.reserve(dirResult.entries.size());
       dirView->dirs.reserve(dirResult.subdirCount);
     }
+    if (recordStamps) {
+      auto stamp = dirStamps.find(dirPath);
+      if (stamp != dirStamps.end()) {
+        dirView->crawlStamp = stamp->second;
+        dirStamps.erase(stamp);
+      } else {
+        dirView->crawlStamp.reset();
+      }
+    }
     for (auto& it : dirView->files) {
       auto fileView = it.second.get();
       if (fileView->exists) {
@@ -723,25 +1577,38 @@ void InMemoryView::crawlerParallel(
     }
 
     // Step 1b: Update files in the dirView via statPath().
-    // Prepare the stat so statPath can avoid syscall.
+    // Prepare the stat so statPath can avoid syscall. The walker threads have
+    // already built the full paths, and every entry shares dirView as its
+    // parent, so this thread only has to apply the changes to the view.
+    // A recrawl mostly finds what the view already holds; those entries are
+    // left alone so that only real differences are applied.
     for (auto& entry : dirResult.entries) {
-      w_string name{entry.name.c_str(), W_STRING_BYTE};
+      if (recordStamps && entry.stat.isDir()) {
+        dirStamps[entry.fullPath] = makeCrawlStamp(entry.stat, pending.now);
+      }
+      auto name = entry.fullPath.piece().baseName();
       watchman_file* fileView = dirView->getChildFile(name);
       if (fileView) {
         fileView->maybe_deleted = false;
+        if (isUnchangedEntry(*dirView, *fileView, name, entry.stat)) {
+          if (fullCrawlStatCount_) {
+            fullCrawlStatCount_->fetch_add(1, std::memory_order_release);
+          }
+          continue;
+        }
       }
-      auto fullPath = dirView->getFullPathToChild(name);
       processPath(
           root,
           view,
           coll,
           PendingChange{
-              std::move(fullPath),
+              std::move(entry.fullPath),
               pending.now,
               inheritFlags,
           },
           &entry.stat,
-          pendingCookies);
+          pendingCookies,
+          dirView);
     }
 
     // Step 1c: Mark for deletion.
@@ -759,7 +1626,8 @@ void InMemoryView::crawlerParallel(
                 inheritFlags,
             },
             nullptr,
-            pendingCookies);
+            pendingCookies,
+            dirView);
       }
     }
   }
@@ -785,51 +1653,22 @@ void InMemoryView::crawlerParallel(
       }
     }
   }
-}
 
-namespace {
-bool did_file_change(
-    const FileInformation* saved,
-    const FileInformation* fresh) {
-  /* we have to compare this way because the stat structure
-   * may contain fields that vary and that don't impact our
-   * understanding of the file */
-
-#define FIELD_CHG(name)             \
-  if (saved->name != fresh->name) { \
-    return true;                    \
-  }
-
-  // Can't compare with memcmp due to padding and garbage in the struct
-  // on OpenBSD, which has a 32-bit tv_sec + 64-bit tv_nsec
-#define TIMESPEC_FIELD_CHG(wat)                           \
-  {                                                       \
-    struct timespec a = saved->wat##time;                 \
-    struct timespec b = fresh->wat##time;                 \
-    if (a.tv_sec != b.tv_sec || a.tv_nsec != b.tv_nsec) { \
-      return true;                                        \
-    }                                                     \
-  }
-
-  FIELD_CHG(mode);
-
-  if (!saved->isDir()) {
-    FIELD_CHG(size);
-    FIELD_CHG(nlink);
+  auto stats = walker.getStats();
+  logf(
+      DBG,
+      "crawlerParallel({}): at most {} entries queued, {} reads deferred\n",
+      path,
+      stats.maxQueuedEntries,
+      stats.deferredReads);
+  size_t seen = parallelCrawlMaxQueuedEntries_.load(std::memory_order_relaxed);
+  while (stats.maxQueuedEntries > seen &&
+         !parallelCrawlMaxQueuedEntries_.compare_exchange_weak(
+             seen, stats.maxQueuedEntries, std::memory_order_relaxed)) {
   }
-  FIELD_CHG(dev);
-  FIELD_CHG(ino);
-  FIELD_CHG(uid);
-  FIELD_CHG(gid);
-  // Don't care about st_blocks
-  // Don't care about st_blksize
-  // Don't care about st_atimespec
-  TIMESPEC_FIELD_CHG(m);
-  TIMESPEC_FIELD_CHG(c);
-
-  return false;
+  parallelCrawlDeferredReads_.fetch_add(
+      stats.deferredReads, std::memory_order_relaxed);
 }
-} // namespace
 
 void InMemoryView::statPath(
     const Root& root,
@@ -837,7 +1676,9 @@ void InMemoryView::statPath(
     ViewDatabase& view,
     PendingChanges& coll,
     const PendingChange& pending,
-    const FileInformation* pre_stat) {
+    const FileInformation* pre_stat,
+    watchman_dir* parentDir,
+    const PrefetchedStat* prefetched) {
   bool recursive = pending.flags.contains(W_PENDING_RECURSIVE);
   const bool via_notify = pending.flags.contains(W_PENDING_VIA_NOTIFY);
   const PendingFlags desynced_flag = pending.flags & W_PENDING_IS_DESYNCED;
@@ -845,22 +1686,40 @@ void InMemoryView::statPath(
   // viaPwalk is true iff calling from crawlerParallel.
   bool viaPwalk = pending.flags.contains(W_PENDING_VIA_PWALK);
 
+  WATCHMAN_TRACE(stat__start, rootPath_.c_str(), pending.path.c_str());
+  SCOPE_EXIT {
+    WATCHMAN_TRACE(stat__end, rootPath_.c_str(), pending.path.c_str());
+  };
+
   if (root.ignore.isIgnoreDir(pending.path)) {
     logf(DBG, "{} matches ignore_dir rules\n", pending.path);
     return;
   }
+  if (root.ignore.isIgnoreGlob(pending.path)) {
+    logf(DBG, "{} matches ignore_globs rules\n", pending.path);
+    return;
+  }
 
   auto& path = pending.path;
   w_check(!path.empty(), "must have path");
-  auto dir_name = pending.path.dirName();
-  auto file_name = pending.path.baseName();
+  auto dir_name = pending.path.piece().dirName();
+  auto file_name = pending.path.piece().baseName();
   w_check(!dir_name.empty(), "must have dir_name");
-  auto parentDir = view.resolveDir(dir_name, true);
+  if (!parentDir) {
+    parentDir = view.resolveDir(dir_name.asWString(), true);
+  }
 
   auto file = parentDir->getChildFile(file_name);
 
   auto dir_ent = parentDir->getChildDir(file_name);
 
+  if (!pre_stat && pending.stat &&
+      (watcher_->flags & WATCHER_HAS_FILE_INFORMATION)) {
+    // The watcher told us what the path looked like when it changed; any
+    // later change would have replaced or cleared this.
+    pre_stat = pending.stat.get();
+  }
+
   FileInformation st;
   std::error_code errcode;
   if (pre_stat) {
@@ -870,7 +1729,23 @@ void InMemoryView::statPath(
     // file is missing (see "Step 1c" in crawlerParallel). Treat as deleted
     // without an extra getFileInformation() call.
     errcode = make_error_code(error_code::no_such_file_or_directory);
+  } else if (prefetched) {
+    st = prefetched->st;
+    errcode = prefetched->error;
+    if (errcode == error_code::no_such_file_or_directory) {
+      negativeStats_.insert(path, prefetched->issued);
+    }
+  } else if (
+      via_notify && (!file || !file->exists) &&
+      (!dir_ent || !dir_ent->last_check_existed) &&
+      negativeStats_.isMissing(
+          path, pending.latestNow(), std::chrono::system_clock::now())) {
+    // A trailing notification for a path that we already found missing
+    // after it was noticed, so there is nothing new to see.
+    log(DBG, "skipping stat of ", path, ", recently found missing\n");
+    errcode = make_error_code(error_code::no_such_file_or_directory);
   } else {
+    auto statIssued = std::chrono::system_clock::now();
     try {
       st = fileSystem_.getFileInformation(path.c_str(), root.case_sensitive);
       log(DBG,
@@ -894,6 +1769,12 @@ void InMemoryView::statPath(
           exc.what(),
           "\n");
     }
+    if (errcode == error_code::no_such_file_or_directory) {
+      negativeStats_.insert(path, statIssued);
+    }
+  }
+  if (!errcode && negativeStats_.size() > 0) {
+    negativeStats_.erase(path);
   }
 
   if (processedPaths_) {
@@ -929,13 +1810,14 @@ void InMemoryView::statPath(
         file->exists = false;
         view.markFileChanged(file, getClock(pending.now));
       }
-    } else {
+    } else if (!parentDir->getTombstone(file_name)) {
       // It was created and removed before we could ever observe it
       // in the filesystem.  We need to generate a deleted file
       // representation of it now, so that subscription clients can
-      // be notified of this event
+      // be notified of this event.  (A tombstone means that we already
+      // reported its deletion.)
       file = view.getOrCreateChildFile(
-          parentDir, file_name, getClock(pending.now));
+          parentDir, file_name.asWString(), getClock(pending.now));
       log(DBG,
           "getFileInformation(",
           path,
@@ -962,7 +1844,7 @@ void InMemoryView::statPath(
           "speculatively look at parent dir {}\n",
           path,
           dir_name);
-      coll.add(dir_name, pending.now, W_PENDING_CRAWL_ONLY);
+      coll.add(dir_name.asWString(), pending.now, W_PENDING_CRAWL_ONLY);
     }
 
   } else if (errcode.value()) {
@@ -979,7 +1861,7 @@ void InMemoryView::statPath(
   } else {
     if (!file) {
       file = view.getOrCreateChildFile(
-          parentDir, file_name, getClock(pending.now));
+          parentDir, file_name.asWString(), getClock(pending.now));
     }
 
     if (!file->exists) {
@@ -991,7 +1873,8 @@ void InMemoryView::statPath(
        * to crawl it again */
       recursive = true;
     }
-    if (!file->exists || via_notify || did_file_change(&file->stat, &st)) {
+    auto saved = file->stat.decode();
+    if (!file->exists || via_notify || did_file_change(&saved, &st)) {
       logf(
           DBG,
           "file changed exists={} via_notify={} stat-changed={} isdir={} size={} {}\n",
@@ -1008,12 +1891,12 @@ void InMemoryView::statPath(
       // examine any children because we cannot assume that the kernel will
       // have given us the correct hints about this change.  BTRFS is one
       // example of a filesystem where this has been observed to happen.
-      if (file->stat.ino != st.ino) {
+      if (file->stat.ino() != st.ino) {
         recursive = true;
       }
     }
 
-    memcpy(&file->stat, &st, sizeof(file->stat));
+    file->stat = st;
     watcher_->startWatchFile(file);
 
     if (st.isDir()) {
@@ -1033,10 +1916,15 @@ void InMemoryView::statPath(
         return;
       }
 
+      if (recursive && !dir_ent && deferCrawl(root, pending.path)) {
+        // lazy_crawl: crawlForQuery crawls it once a query needs it
+        return;
+      }
+
       // Don't recurse if our parent is an ignore dir or via crawlerParallel
       // (already recursive)
       if (!viaPwalk &&
-          (!root.ignore.isIgnoreVCS(dir_name) ||
+          (!root.ignore.isIgnoreVCS(dir_name.asWString()) ||
            // but do if we're looking at the cookie dir (stat_path is never
            // called for the root itself)
            cookies.isCookieDir(pending.path))) {
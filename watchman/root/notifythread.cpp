@@ -7,6 +7,7 @@
 
 #include "watchman/Constants.h"
 #include "watchman/InMemoryView.h"
+#include "watchman/Tracepoint.h"
 #include "watchman/root/Root.h"
 #include "watchman/watcher/Watcher.h"
 
@@ -20,6 +21,13 @@ namespace watchman {
 void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
   PendingChanges fromWatcher;
 
+  auto coalesceThreshold =
+      uint32_t(config_.getInt("pending_coalesce_threshold", 0));
+  auto coalesceWindow = std::chrono::milliseconds(
+      config_.getInt("pending_coalesce_window_ms", 1000));
+  fromWatcher.setCoalescing(coalesceThreshold, coalesceWindow);
+  pendingFromWatcher_.lock()->setCoalescing(coalesceThreshold, coalesceWindow);
+
   if (!watcher_->start(root)) {
     logf(
         ERR,
@@ -44,6 +52,10 @@ void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
     }
     do {
       auto resultFlags = watcher_->consumeNotify(root, fromWatcher);
+      WATCHMAN_TRACE(
+          watcher__consumed,
+          rootPath_.c_str(),
+          fromWatcher.getPendingItemCount());
 
       if (resultFlags.cancelSelf) {
         root->cancel("Watcher noticed root has been removed.");
@@ -54,10 +66,28 @@ void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
       }
     } while (watcher_->waitNotify(0));
 
-    if (!fromWatcher.empty()) {
+    if (fromWatcher.empty()) {
+      continue;
+    }
+    if (eventTracing_.load(std::memory_order_acquire)) {
+      auto trace = eventTrace_.lock();
+      if (*trace) {
+        (*trace)->record(std::chrono::steady_clock::now(), fromWatcher);
+      }
+    }
+    // Before the handoff, so that it's never later than the IO thread's
+    lastNotified_.store(
+        std::chrono::system_clock::now(), std::memory_order_relaxed);
+    // Once stopping, go through pendingFromWatcher_ which refuses new syncs
+    auto pushed = stopThreads_.load(std::memory_order_acquire)
+        ? PendingChangesQueue::PushResult::Full
+        : fromNotifyThread_.tryPush(fromWatcher);
+    if (pushed == PendingChangesQueue::PushResult::Full) {
       auto lock = pendingFromWatcher_.lock();
       lock->append(fromWatcher.stealItems(), fromWatcher.stealSyncs());
       lock->ping();
+    } else if (pushed == PendingChangesQueue::PushResult::QueuedConsumerIdle) {
+      pendingFromWatcher_.lock()->ping();
     }
   }
 }
@@ -21,7 +21,8 @@ bool Root::considerReap() {
   if (now > inner.last_cmd_timestamp.load(std::memory_order_acquire) +
               idle_reap_age &&
       (triggers.rlock()->empty()) && (now > inner.last_reap_timestamp) &&
-      !unilateralResponses->hasSubscribers()) {
+      !unilateralResponses->hasSubscribers() &&
+      projectedRoots.rlock()->empty()) {
     // We haven't had any activity in a while, and there are no registered
     // triggers or subscriptions against this watch.
     log(ERR,
@@ -40,5 +41,25 @@ bool Root::considerReap() {
   return false;
 }
 
+void Root::settleProjectedRoots() {
+  std::vector<std::shared_ptr<Root>> roots;
+  {
+    auto projected = projectedRoots.rlock();
+    for (auto& weak : *projected) {
+      if (auto root = weak.lock()) {
+        roots.push_back(std::move(root));
+      }
+    }
+  }
+
+  for (auto& root : roots) {
+    root->unilateralResponses->enqueue(
+        json_object({{"settled", json_true()}}), "settled");
+    if (root->considerReap()) {
+      root->stopWatch("Watch was idle for too long");
+    }
+  }
+}
+
 /* vim:ts=2:sw=2:et:
  */
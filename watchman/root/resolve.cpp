@@ -6,8 +6,12 @@
  */
 
 #include <fmt/core.h>
+#include <folly/ScopeGuard.h>
 #include <folly/String.h>
+#include <folly/Synchronized.h>
+#include <folly/futures/SharedPromise.h>
 #include <system_error>
+#include <unordered_map>
 #include "watchman/Errors.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/fs/FSDetect.h"
@@ -110,6 +114,12 @@ static void check_allowed_fs(const char* filename, const w_string& fs_type) {
   }
 }
 
+using PendingRoot = folly::SharedPromise<std::shared_ptr<Root>>;
+
+// The roots being created, by path
+folly::Synchronized<std::unordered_map<w_string, std::shared_ptr<PendingRoot>>>
+    pending_roots;
+
 std::optional<json_ref> load_root_config(const char* path) {
   char cfgfilename[WATCHMAN_NAME_MAX];
   snprintf(cfgfilename, sizeof(cfgfilename), "%s/.watchmanconfig", path);
@@ -126,6 +136,129 @@ std::optional<json_ref> load_root_config(const char* path) {
   return json_load_file(cfgfilename, 0);
 }
 
+/**
+ * Returns the watched root that a new root at root_str can be served from,
+ * or nullptr if it needs a watcher and crawl of its own.
+ *
+ * That is a root containing root_str, on the same filesystem, whose view is
+ * kept in memory and doesn't ignore root_str.  The new root must not have a
+ * .watchmanconfig of its own, as the view applies the owner's ignores and
+ * settings.
+ */
+std::shared_ptr<Root> find_view_owner(
+    const w_string& root_str,
+    const std::optional<json_ref>& config_file,
+    const Configuration& config) {
+  if (config_file || !config.getBool("share_nested_root_views", true)) {
+    return nullptr;
+  }
+
+  std::optional<FileInformation> info;
+  auto map = watched_roots.rlock();
+  for (auto& [path, candidate] : *map) {
+    auto owner = candidate->viewOwner ? candidate->viewOwner : candidate;
+    if (!root_str.startsWith(w_string::build(owner->root_path, "/")) ||
+        owner->inner.cancelled.load(std::memory_order_acquire) ||
+        !std::dynamic_pointer_cast<InMemoryView>(owner->view()) ||
+        owner->ignore.isIgnored(root_str.data(), root_str.size())) {
+      continue;
+    }
+    if (!info) {
+      info = getFileInformation(root_str.c_str());
+    }
+    if (info->dev != owner->stat.dev) {
+      continue;
+    }
+    return owner;
+  }
+  return nullptr;
+}
+
+// Creates the root at root_str, which the caller found to be unwatched
+std::shared_ptr<Root> create_root(
+    const char* filename_cstr,
+    const w_string& root_str,
+    bool* created) {
+  w_string_piece filename{filename_cstr};
+  std::shared_ptr<Root> root;
+
+  auto fs_type = w_fstype(filename_cstr);
+  check_allowed_fs(root_str.c_str(), fs_type);
+
+  if (!root_check_restrict(root_str.c_str())) {
+    bool enforcing;
+    auto root_files = cfg_compute_root_files(&enforcing);
+    auto root_files_list = cfg_pretty_print_root_files(root_files.value());
+    RootResolveError::throwf(
+        "Your watchman administrator has configured watchman "
+        "to prevent watching path `{}`.  None of the files "
+        "listed in global config root_files are "
+        "present and enforce_root_files is set to true.  "
+        "root_files is defined by the `{}` config file and "
+        "includes {}.  One or more of these files must be "
+        "present in order to allow a watch.  Try pulling "
+        "and checking out a newer version of the project?",
+        root_str,
+        cfg_get_global_config_file_path(),
+        root_files_list);
+  }
+
+  try {
+    auto configStart = std::chrono::steady_clock::now();
+    auto config_file = load_root_config(root_str.c_str());
+    Configuration config{config_file};
+    auto owner = find_view_owner(root_str, config_file, config);
+    if (owner) {
+      logf(ERR, "serving {} from the view of {}\n", root_str, owner->root_path);
+    }
+    auto watcherStart = std::chrono::steady_clock::now();
+    auto view = owner ? owner->view()
+                      : WatcherRegistry::initWatcher(root_str, fs_type, config);
+    auto watcherEnd = std::chrono::steady_clock::now();
+    root = std::make_shared<Root>(
+        WatcherRegistry::fileSystemFor(fs_type, config),
+        root_str,
+        fs_type,
+        config_file,
+        config,
+        std::move(view),
+        &w_state_save,
+        owner);
+    root->initTimeline.record("config", configStart, watcherStart);
+    root->initTimeline.record("watcher_init", watcherStart, watcherEnd);
+
+    {
+      auto wlock = watched_roots.wlock();
+      auto& map = *wlock;
+      auto& existing = map[root->root_path];
+      if (existing) {
+        // Someone beat us in this race
+        root = existing;
+        *created = false;
+      } else {
+        existing = root;
+        *created = true;
+        if (owner) {
+          owner->projectedRoots.wlock()->push_back(root);
+        }
+      }
+    }
+
+    return root;
+  } catch (const std::system_error& exc) {
+    if (exc.code() == std::errc::not_connected) {
+      RootNotConnectedError::throwf(
+          "\"{}\" was able to be opened, but we were unable to read its "
+          "contents. If \"{}\" is located on a FUSE or network mount, "
+          "please ensure that you have mounted it correctly, including "
+          "validating any required credentials or certificates.\n",
+          filename,
+          filename);
+    }
+    throw;
+  }
+}
+
 } // namespace
 
 std::shared_ptr<Root>
@@ -212,66 +345,37 @@ root_resolve(const char* filename_cstr, bool auto_watch, bool* created) {
 
   logf(DBG, "Want to watch {} -> {}\n", filename, root_str);
 
-  auto fs_type = w_fstype(filename_cstr);
-  check_allowed_fs(root_str.c_str(), fs_type);
-
-  if (!root_check_restrict(root_str.c_str())) {
-    bool enforcing;
-    auto root_files = cfg_compute_root_files(&enforcing);
-    auto root_files_list = cfg_pretty_print_root_files(root_files.value());
-    RootResolveError::throwf(
-        "Your watchman administrator has configured watchman "
-        "to prevent watching path `{}`.  None of the files "
-        "listed in global config root_files are "
-        "present and enforce_root_files is set to true.  "
-        "root_files is defined by the `{}` config file and "
-        "includes {}.  One or more of these files must be "
-        "present in order to allow a watch.  Try pulling "
-        "and checking out a newer version of the project?",
-        root_str,
-        cfg_get_global_config_file_path(),
-        root_files_list);
+  // Requests for the same new root, such as many tools running
+  // watch-project as a workspace opens, share a single creation rather
+  // than each detecting the filesystem, loading the config and starting a
+  // watcher only for all but one of those roots to be thrown away.
+  std::shared_ptr<PendingRoot> pending;
+  bool leader = false;
+  {
+    auto map = pending_roots.wlock();
+    auto& entry = (*map)[root_str];
+    if (!entry) {
+      entry = std::make_shared<PendingRoot>();
+      leader = true;
+    }
+    pending = entry;
+  }
+  if (!leader) {
+    // Rethrows the creator's error, if it failed
+    return pending->getSemiFuture().get();
   }
 
+  SCOPE_EXIT {
+    pending_roots.wlock()->erase(root_str);
+  };
   try {
-    auto config_file = load_root_config(root_str.c_str());
-    Configuration config{config_file};
-    root = std::make_shared<Root>(
-        realFileSystem,
-        root_str,
-        fs_type,
-        config_file,
-        config,
-        WatcherRegistry::initWatcher(root_str, fs_type, config),
-        &w_state_save);
-
-    {
-      auto wlock = watched_roots.wlock();
-      auto& map = *wlock;
-      auto& existing = map[root->root_path];
-      if (existing) {
-        // Someone beat us in this race
-        root = existing;
-        *created = false;
-      } else {
-        existing = root;
-        *created = true;
-      }
-    }
-
-    return root;
-  } catch (const std::system_error& exc) {
-    if (exc.code() == std::errc::not_connected) {
-      RootNotConnectedError::throwf(
-          "\"{}\" was able to be opened, but we were unable to read its "
-          "contents. If \"{}\" is located on a FUSE or network mount, "
-          "please ensure that you have mounted it correctly, including "
-          "validating any required credentials or certificates.\n",
-          filename,
-          filename);
-    }
+    root = create_root(filename_cstr, root_str, created);
+  } catch (...) {
+    pending->setException(folly::exception_wrapper{std::current_exception()});
     throw;
   }
+  pending->setValue(root);
+  return root;
 }
 
 std::shared_ptr<Root> w_root_resolve(const char* filename, bool auto_watch) {
@@ -280,7 +384,9 @@ std::shared_ptr<Root> w_root_resolve(const char* filename, bool auto_watch) {
 
   if (created) {
     try {
-      root->view()->startThreads(root);
+      if (!root->viewOwner) {
+        root->view()->startThreads(root);
+      }
     } catch (const std::exception& e) {
       log(ERR, "w_root_resolve, while calling startThreads: ", e.what());
       root->cancel(
@@ -292,11 +398,13 @@ std::shared_ptr<Root> w_root_resolve(const char* filename, bool auto_watch) {
   return root;
 }
 
-std::shared_ptr<Root> w_root_resolve_for_client_mode(const char* filename) {
+std::shared_ptr<Root> w_root_resolve_for_client_mode(
+    const char* filename,
+    bool crawl) {
   bool created = false;
   auto root = root_resolve(filename, true, &created);
 
-  if (created) {
+  if (created && crawl) {
     auto view = std::dynamic_pointer_cast<InMemoryView>(root->view());
     if (!view) {
       throw RootResolveError("client mode not available");
@@ -17,8 +17,11 @@ std::shared_ptr<watchman::Root> w_root_resolve(
     const char* path,
     bool auto_watch);
 
+// Resolves a root for a client mode command.  A newly created root is crawled
+// unless crawl is false.
 std::shared_ptr<watchman::Root> w_root_resolve_for_client_mode(
-    const char* filename);
+    const char* filename,
+    bool crawl = true);
 
 std::shared_ptr<watchman::Root>
 root_resolve(const char* filename, bool auto_watch, bool* created);
@@ -0,0 +1,627 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <fmt/chrono.h>
+#include <folly/ScopeGuard.h>
+#include <folly/String.h>
+#include <folly/system/MemoryMapping.h>
+#include <algorithm>
+#include <cstdio>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "watchman/ChangeJournal.h"
+#include "watchman/InMemoryView.h"
+#include "watchman/Logging.h"
+#include "watchman/PerfSample.h"
+#include "watchman/root/Root.h"
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+
+/* The view snapshot is a flat binary dump of a ViewDatabase that can be
+ * memory mapped and replayed into an empty view when the daemon restarts.
+ *
+ * Layout (native byte order, every record is 8-byte aligned):
+ *
+ *   SnapshotHeader
+ *   root path bytes, padded
+ *   numDirs x { SnapshotDirRecord, name bytes, padded }
+ *   numFiles x { SnapshotRecord, name bytes, padded }
+ *
+ * Dir records are written in pre-order so that a dir's parent always
+ * precedes it; dir index 0 is the root itself and has no record, so its
+ * crawl stamp is kept in the header.  The crawl stamps let the crawl after
+ * a restart skip reading the dirs that haven't changed since.  File records
+ * are written oldest change first so that replaying them rebuilds the
+ * recency index in the same order.
+ *
+ * The snapshot is a host-local cache rather than an interchange format, so
+ * FileInformation is stored verbatim and any mismatch in version or struct
+ * size causes the snapshot to be ignored.
+ */
+
+namespace watchman {
+
+namespace {
+
+constexpr char kSnapshotMagic[8] = {'W', 'M', 'V', 'S', 'N', 'A', 'P', '1'};
+constexpr uint32_t kSnapshotVersion = 3;
+
+// A DirCrawlStamp, if the dir has one
+struct SnapshotCrawlStamp {
+  uint8_t valid;
+  uint8_t padding[7];
+  int64_t mtimeNs;
+  int64_t ctimeNs;
+};
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t statSize;
+  uint64_t numDirs;
+  uint64_t numFiles;
+  uint32_t rootPathLen;
+  uint32_t reserved;
+  // The most recent tick of the view when it was saved
+  uint64_t ticks;
+  // Clocks before this tick may be missing changes from the snapshot
+  uint64_t lastAgeOutTicks;
+  SnapshotCrawlStamp rootCrawlStamp;
+};
+
+struct SnapshotDirRecord {
+  // Index of the containing dir
+  uint32_t parent;
+  uint32_t nameLen;
+  uint8_t exists;
+  uint8_t padding[7];
+  SnapshotCrawlStamp crawlStamp;
+};
+
+struct SnapshotRecord {
+  // Index of the containing dir
+  uint32_t parent;
+  uint32_t nameLen;
+  uint8_t exists;
+  uint8_t padding[7];
+  uint64_t otimeTicks;
+  int64_t otimeTimestamp;
+  uint64_t ctimeTicks;
+  int64_t ctimeTimestamp;
+  FileInformation stat;
+};
+
+static_assert(std::is_trivially_copyable_v<FileInformation>);
+static_assert(sizeof(SnapshotHeader) % 8 == 0);
+static_assert(sizeof(SnapshotDirRecord) % 8 == 0);
+
+size_t padded(size_t len) {
+  return (len + 7) & ~size_t(7);
+}
+
+SnapshotCrawlStamp encodeCrawlStamp(const watchman_dir* dir) {
+  SnapshotCrawlStamp encoded{};
+  if (dir->crawlStamp) {
+    encoded.valid = 1;
+    encoded.mtimeNs = dir->crawlStamp->mtimeNs;
+    encoded.ctimeNs = dir->crawlStamp->ctimeNs;
+  }
+  return encoded;
+}
+
+std::optional<DirCrawlStamp> decodeCrawlStamp(
+    const SnapshotCrawlStamp& encoded) {
+  if (!encoded.valid) {
+    return std::nullopt;
+  }
+  return DirCrawlStamp{encoded.mtimeNs, encoded.ctimeNs};
+}
+
+class SnapshotWriter {
+ public:
+  explicit SnapshotWriter(const char* path) : file_(fopen(path, "wb")) {
+    if (!file_) {
+      throw std::system_error(
+          errno, std::generic_category(), fmt::format("fopen {}", path));
+    }
+  }
+
+  ~SnapshotWriter() {
+    if (file_) {
+      fclose(file_);
+    }
+  }
+
+  void write(const void* data, size_t len) {
+    if (len && fwrite(data, 1, len, file_) != len) {
+      throw std::system_error(errno, std::generic_category(), "fwrite");
+    }
+  }
+
+  void writeName(w_string_piece name) {
+    static const char kZeroes[8] = {0};
+    write(name.data(), name.size());
+    write(kZeroes, padded(name.size()) - name.size());
+  }
+
+  void close() {
+    auto file = file_;
+    file_ = nullptr;
+    if (fclose(file) != 0) {
+      throw std::system_error(errno, std::generic_category(), "fclose");
+    }
+  }
+
+ private:
+  FILE* file_;
+};
+
+class SnapshotReader {
+ public:
+  explicit SnapshotReader(folly::ByteRange data) : data_(data) {}
+
+  template <typename T>
+  const T& read() {
+    return *reinterpret_cast<const T*>(take(sizeof(T)));
+  }
+
+  w_string_piece readName(uint32_t len) {
+    auto* ptr = reinterpret_cast<const char*>(take(padded(len)));
+    return w_string_piece{ptr, len};
+  }
+
+ private:
+  const uint8_t* take(size_t len) {
+    if (len > data_.size()) {
+      throw std::runtime_error("view snapshot is truncated");
+    }
+    auto* ptr = data_.data();
+    data_.advance(len);
+    return ptr;
+  }
+
+  folly::ByteRange data_;
+};
+
+// Past this many changes while hibernated, the view is reloaded so that
+// they are applied rather than held on to.
+constexpr uint32_t kMaxHibernatedPendingItems = 65536;
+
+} // namespace
+
+void ViewDatabase::saveSnapshot(
+    const char* path,
+    ClockTicks ticks,
+    ClockTicks lastAgeOutTicks) const {
+  std::vector<const watchman_dir*> dirs;
+  std::unordered_map<const watchman_dir*, uint32_t> dirIndex;
+
+  // Pre-order walk so that parents are always written before children
+  dirs.push_back(rootDir_.get());
+  dirIndex[rootDir_.get()] = 0;
+  for (size_t i = 0; i < dirs.size(); ++i) {
+    for (auto& it : dirs[i]->dirs) {
+      dirIndex[it.second.get()] = uint32_t(dirs.size());
+      dirs.push_back(it.second.get());
+    }
+  }
+
+  std::vector<const watchman_file*> files;
+  for (auto* file = latestFile_; file; file = file->next) {
+    files.push_back(file);
+  }
+
+  SnapshotHeader header{};
+  memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+  header.version = kSnapshotVersion;
+  header.statSize = sizeof(FileInformation);
+  header.numDirs = dirs.size() - 1;
+  header.numFiles = files.size();
+  header.rootPathLen = rootPath_.size();
+  header.ticks = ticks;
+  // Tombstones are not saved, so neither are the deletions that they record
+  header.lastAgeOutTicks =
+      std::max(lastAgeOutTicks, rootDir_->maxTombstoneTicks);
+  header.rootCrawlStamp = encodeCrawlStamp(rootDir_.get());
+
+  SnapshotWriter writer{path};
+  writer.write(&header, sizeof(header));
+  writer.writeName(rootPath_);
+
+  for (size_t i = 1; i < dirs.size(); ++i) {
+    auto* dir = dirs[i];
+    SnapshotDirRecord record{};
+    record.parent = dirIndex[dir->parent];
+    record.nameLen = dir->name.size();
+    record.exists = dir->last_check_existed;
+    record.crawlStamp = encodeCrawlStamp(dir);
+    writer.write(&record, sizeof(record));
+    writer.writeName(dir->name);
+  }
+
+  // Oldest first, so that replay rebuilds the recency index in order
+  for (auto it = files.rbegin(); it != files.rend(); ++it) {
+    auto* file = *it;
+    auto name = file->getName();
+    SnapshotRecord record{};
+    record.parent = dirIndex[file->parent];
+    record.nameLen = name.size();
+    record.exists = file->exists;
+    record.otimeTicks = file->otime.ticks;
+    record.otimeTimestamp = file->otime.timestamp;
+    record.ctimeTicks = file->ctime.ticks;
+    record.ctimeTimestamp = file->ctime.timestamp;
+    record.stat = file->stat.decode();
+    writer.write(&record, sizeof(record));
+    writer.writeName(name);
+  }
+
+  writer.close();
+}
+
+ViewDatabase::SnapshotInfo ViewDatabase::readSnapshotInfo(const char* path) {
+  folly::MemoryMapping mapping{path};
+  SnapshotReader reader{mapping.range()};
+
+  auto& header = reader.read<SnapshotHeader>();
+  if (memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 ||
+      header.version != kSnapshotVersion) {
+    throw std::runtime_error("view snapshot has an incompatible format");
+  }
+  return SnapshotInfo{header.ticks, header.lastAgeOutTicks};
+}
+
+size_t ViewDatabase::loadSnapshot(
+    const char* path,
+    std::optional<ClockTicks> ticks) {
+  w_check(
+      latestFile_ == nullptr && rootDir_->dirs.empty() &&
+          rootDir_->files.empty(),
+      "snapshots can only be loaded into an empty view");
+  ++structureGeneration_;
+
+  folly::MemoryMapping mapping{path};
+  SnapshotReader reader{mapping.range()};
+
+  auto& header = reader.read<SnapshotHeader>();
+  if (memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 ||
+      header.version != kSnapshotVersion ||
+      header.statSize != sizeof(FileInformation)) {
+    throw std::runtime_error("view snapshot has an incompatible format");
+  }
+  if (reader.readName(header.rootPathLen) != rootPath_) {
+    throw std::runtime_error("view snapshot is for a different root");
+  }
+
+  // If anything goes wrong part way through, leave the view empty
+  // rather than partially populated.
+  auto clearOnError = folly::makeGuard([&] {
+    recencyIndex_.clear();
+    if (recencyLog_) {
+      recencyLog_->clear();
+    }
+    rootDir_->files.clear();
+    rootDir_->dirs.clear();
+    rootDir_->crawlStamp.reset();
+  });
+
+  std::vector<watchman_dir*> dirs;
+  dirs.reserve(header.numDirs + 1);
+  dirs.push_back(rootDir_.get());
+  rootDir_->crawlStamp = decodeCrawlStamp(header.rootCrawlStamp);
+
+  for (uint64_t i = 0; i < header.numDirs; ++i) {
+    auto& record = reader.read<SnapshotDirRecord>();
+    auto name = reader.readName(record.nameLen);
+    if (record.parent >= dirs.size()) {
+      throw std::runtime_error("view snapshot has a corrupt dir record");
+    }
+    auto* parent = dirs[record.parent];
+    auto child = watchman_dir::make(name, parent);
+    child->last_check_existed = record.exists;
+    child->crawlStamp = decodeCrawlStamp(record.crawlStamp);
+    auto* childPtr = child.get();
+    // Keyed by the name owned by the child node
+    parent->dirs[childPtr->name] = std::move(child);
+    dirs.push_back(childPtr);
+  }
+
+  for (uint64_t i = 0; i < header.numFiles; ++i) {
+    auto& record = reader.read<SnapshotRecord>();
+    auto name = reader.readName(record.nameLen);
+    if (record.parent >= dirs.size()) {
+      throw std::runtime_error("view snapshot has a corrupt file record");
+    }
+    auto* file = getOrCreateChildFile(
+        dirs[record.parent],
+        name.asWString(),
+        ClockStamp{
+            ticks.value_or(record.ctimeTicks), time_t(record.ctimeTimestamp)});
+    file->exists = record.exists;
+    file->stat = record.stat;
+    markFileChanged(
+        file,
+        ClockStamp{
+            ticks.value_or(record.otimeTicks),
+            time_t(record.otimeTimestamp)});
+  }
+
+  clearOnError.dismiss();
+  return header.numFiles;
+}
+
+void ViewDatabase::replayChanges(
+    const std::vector<ChangeJournal::Change>& changes) {
+  ++structureGeneration_;
+  for (auto& change : changes) {
+    auto fullPath = w_string::pathCat({rootPath_, change.path});
+    auto* dir = resolveDir(fullPath.dirName(), /*create=*/true);
+    ClockStamp stamp{change.ticks, change.timestamp};
+    auto* file = getOrCreateChildFile(dir, fullPath.baseName(), stamp);
+    file->exists = change.exists;
+    markFileChanged(file, stamp);
+  }
+}
+
+std::optional<w_string> InMemoryView::getSnapshotPath() const {
+  auto dir = config_.getString("view_snapshot_dir", nullptr);
+  if (!dir) {
+    return std::nullopt;
+  }
+  // The root path is validated against the header on load, so a hash
+  // collision merely costs a full crawl.
+  return w_string::format(
+      "{}/{}-{:08x}.snapshot",
+      dir,
+      rootPath_.piece().baseName(),
+      rootPath_.hashValue());
+}
+
+void InMemoryView::loadSnapshot() {
+  auto path = getSnapshotPath();
+  if (!path) {
+    return;
+  }
+  if (config_.getBool("change_journal", false)) {
+    journal_ =
+        std::make_unique<ChangeJournal>(w_string::build(*path, ".journal"));
+  }
+
+  PerfSample sample("load-view-snapshot");
+  try {
+    auto view = view_.wlock();
+    auto info = ViewDatabase::readSnapshotInfo(path->c_str());
+    std::optional<ChangeJournal::Contents> journal;
+    if (journal_) {
+      journal = ChangeJournal::read(journal_->path().c_str());
+    }
+
+    if (journal && journal->closedCleanly &&
+        journal->snapshotTicks == info.ticks) {
+      // Carry on from the ticks of the previous instance, so that the
+      // clocks it handed out still mean the same thing.
+      auto numFiles = view->loadSnapshot(path->c_str(), std::nullopt);
+      view->replayChanges(journal->changes);
+      for (auto writer : journal->writers) {
+        writer.position.ticks = journal->lastTicks;
+        ClockSpec::honorPreviousInstance(rootNumber_, writer);
+      }
+      mostRecentTick_ = journal->lastTicks + 1;
+      lastAgeOutTick_ = info.lastAgeOutTicks;
+      try {
+        journal_->resume(ClockSpec::currentInstance(
+            ClockPosition{rootNumber_, mostRecentTick_.load()}));
+      } catch (const std::exception& exc) {
+        // The next settle saves a snapshot and starts a new journal
+        logf(
+            ERR,
+            "failed to reopen change journal {}: {}\n",
+            journal_->path(),
+            folly::exceptionStr(exc).toStdString());
+      }
+      logf(
+          ERR,
+          "loaded {} files from view snapshot {} and {} changes from its "
+          "journal; clocks up to tick {} remain valid\n",
+          numFiles,
+          *path,
+          journal->changes.size(),
+          journal->lastTicks);
+    } else {
+      auto numFiles =
+          view->loadSnapshot(path->c_str(), mostRecentTick_.load());
+      logf(ERR, "loaded {} files from view snapshot {}\n", numFiles, *path);
+    }
+    lastSnapshotTick_ = mostRecentTick_.load();
+    lastSnapshotTime_ = std::chrono::steady_clock::now();
+  } catch (const std::exception& exc) {
+    logf(
+        DBG,
+        "not using view snapshot {}: {}\n",
+        *path,
+        folly::exceptionStr(exc).toStdString());
+  }
+  if (journal_) {
+    view_.wlock()->setChangeJournal(journal_.get());
+  }
+  sample.finish();
+  sample.log();
+}
+
+void InMemoryView::saveSnapshot(bool force) {
+  auto path = getSnapshotPath();
+  if (!path) {
+    return;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  auto tick = mostRecentTick_.load();
+  if (tick == lastSnapshotTick_) {
+    // Nothing has changed since the last save
+    return;
+  }
+  if (journal_) {
+    // Until a snapshot is saved there is no journal to extend it, and once
+    // the journal grows too large, folding it into a snapshot compacts it.
+    force = force || !journal_->isOpen() ||
+        journal_->size() >
+            size_t(config_.getInt("change_journal_max_bytes", 64 << 20));
+  }
+  if (!force &&
+      now - lastSnapshotTime_ <
+          std::chrono::seconds(
+              config_.getInt("view_snapshot_interval_seconds", 600))) {
+    return;
+  }
+
+  PerfSample sample("save-view-snapshot");
+  auto tmpPath = w_string::build(*path, ".tmp");
+  try {
+    view_.rlock()->saveSnapshot(tmpPath.c_str(), tick, lastAgeOutTick_);
+    if (rename(tmpPath.c_str(), path->c_str()) != 0) {
+      throw std::system_error(
+          errno, std::generic_category(), fmt::format("rename {}", *path));
+    }
+    lastSnapshotTick_ = tick;
+    lastSnapshotTime_ = now;
+    logf(DBG, "saved view snapshot {}\n", *path);
+    if (journal_) {
+      journal_->reset(
+          tick, ClockSpec::currentInstance(ClockPosition{rootNumber_, tick}));
+    }
+  } catch (const std::exception& exc) {
+    remove(tmpPath.c_str());
+    logf(
+        ERR,
+        "failed to save view snapshot {}: {}\n",
+        *path,
+        folly::exceptionStr(exc).toStdString());
+  }
+  sample.finish();
+  sample.log();
+}
+
+bool InMemoryView::considerHibernate(Root& root) {
+  if (idleHibernateAge_.count() == 0 || !getSnapshotPath()) {
+    return false;
+  }
+
+  // Triggers, subscriptions and projected roots need to see changes as
+  // they happen, so as with reaping, only a root without them hibernates.
+  auto now = std::chrono::steady_clock::now();
+  if (now <= root.inner.last_cmd_timestamp.load(std::memory_order_acquire) +
+              idleHibernateAge_ ||
+      !root.triggers.rlock()->empty() ||
+      root.unilateralResponses->hasSubscribers() ||
+      !root.projectedRoots.rlock()->empty()) {
+    return false;
+  }
+
+  // Nothing is freed unless the snapshot has everything in the view
+  saveSnapshot(/*force=*/true);
+  if (lastSnapshotTick_ != mostRecentTick_.load()) {
+    return false;
+  }
+
+  auto hibernated = hibernated_.lock();
+  if (!root.queries.rlock()->empty()) {
+    return false;
+  }
+
+  PerfSample sample("hibernate-view");
+  size_t numFiles = 0;
+  {
+    auto view = view_.wlock();
+    for (auto* f = view->getLatestFile(); f; f = f->next) {
+      ++numFiles;
+    }
+    // Tombstones are not saved, so neither are the deletions that they
+    // record; clocks from before them become fresh instances.
+    if (auto* dir = view->resolveDir(rootPath_, false)) {
+      lastAgeOutTick_ = std::max(lastAgeOutTick_, dir->maxTombstoneTicks);
+    }
+    view->clear();
+  }
+  *statIndex_.lock() = nullptr;
+  *dirIndex_.lock() = nullptr;
+  shrinkMemory();
+  *hibernated = true;
+  sample.finish();
+  sample.log();
+
+  logf(
+      ERR,
+      "root {} has had no activity in {}, hibernating its view of {} files\n",
+      rootPath_,
+      idleHibernateAge_,
+      numFiles);
+  return true;
+}
+
+bool InMemoryView::stashWhileHibernated(Root& root, PendingChanges& pending) {
+  auto items = pending.stealItems();
+  auto syncs = pending.stealSyncs();
+
+  // Syncs and cookies are waiting for the view to catch up, and new
+  // triggers and subscriptions need to see changes as they happen.
+  bool wanted = !syncs.empty() || root.recrawlInfo.rlock()->shouldRecrawl ||
+      !root.triggers.rlock()->empty() ||
+      root.unilateralResponses->hasSubscribers() ||
+      !root.projectedRoots.rlock()->empty() ||
+      hibernatedPending_.getPendingItemCount() + items.size() >
+          kMaxHibernatedPendingItems;
+  for (auto* p = items.head(); p && !wanted; p = p->next) {
+    wanted = root.cookies.isCookiePrefix(p->path);
+  }
+
+  if (wanted) {
+    pending.append(std::move(items), std::move(syncs));
+    return false;
+  }
+  hibernatedPending_.append(std::move(items), {});
+  return true;
+}
+
+void InMemoryView::thaw(Root& root, PendingChanges& pending) {
+  PerfSample sample("thaw-view");
+  auto path = getSnapshotPath();
+  auto hibernated = hibernated_.lock();
+  {
+    auto view = view_.wlock();
+    // The journal already extends the snapshot
+    view->setChangeJournal(nullptr);
+    try {
+      // The snapshot was saved at the current tick, so the ticks it
+      // recorded are still the view's.
+      auto numFiles = view->loadSnapshot(path->c_str(), std::nullopt);
+      logf(
+          ERR,
+          "reloaded {} files of hibernated view from {} with {} changes "
+          "since\n",
+          numFiles,
+          *path,
+          hibernatedPending_.getPendingItemCount());
+    } catch (const std::exception& exc) {
+      logf(
+          ERR,
+          "failed to reload hibernated view from {}: {}\n",
+          *path,
+          folly::exceptionStr(exc).toStdString());
+      root.scheduleRecrawl("hibernated view could not be reloaded");
+    }
+    view->setChangeJournal(journal_.get());
+  }
+  pending.append(hibernatedPending_.stealItems(), {});
+  *hibernated = false;
+  sample.finish();
+  sample.log();
+}
+
+} // namespace watchman
@@ -5,6 +5,8 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <fmt/core.h>
+#include <algorithm>
 #include "watchman/QueryableView.h"
 #include "watchman/TriggerCommand.h"
 #include "watchman/root/Root.h"
@@ -18,6 +20,12 @@ void Root::recrawlTriggered(const char* why) {
 }
 
 void Root::scheduleRecrawl(const char* why) {
+  if (viewOwner) {
+    // Only the owner crawls the view
+    viewOwner->scheduleRecrawl(why);
+    return;
+  }
+
   {
     auto info = recrawlInfo.wlock();
 
@@ -45,6 +53,10 @@ void Root::scheduleRecrawl(const char* why) {
 }
 
 void Root::stopThreads(std::string_view reason) {
+  if (viewOwner) {
+    // The view's threads belong to the owner
+    return;
+  }
   view()->stopThreads(reason);
 }
 
@@ -72,6 +84,28 @@ bool Root::cancel(std::string_view reason) {
     }
   }
 
+  if (viewOwner) {
+    auto projected = viewOwner->projectedRoots.wlock();
+    projected->erase(
+        std::remove_if(
+            projected->begin(),
+            projected->end(),
+            [&](const std::weak_ptr<Root>& weak) {
+              auto other = weak.lock();
+              return !other || other.get() == this;
+            }),
+        projected->end());
+  }
+
+  // The roots projected from this one can't be updated without its threads
+  std::vector<std::weak_ptr<Root>> projected;
+  std::swap(projected, *projectedRoots.wlock());
+  for (auto& weak : projected) {
+    if (auto other = weak.lock()) {
+      other->cancel(fmt::format("{} was cancelled", root_path));
+    }
+  }
+
   return true;
 }
 
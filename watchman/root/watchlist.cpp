@@ -193,6 +193,9 @@ RootDebugStatus Root::getStatus() const {
         case QueryContextState::WaitingForCookieSync:
           queryState = "WaitingForCookieSync";
           break;
+        case QueryContextState::Queued:
+          queryState = "Queued";
+          break;
         case QueryContextState::WaitingForViewLock:
           queryState = "WaitingForViewLock";
           break;
@@ -257,6 +260,8 @@ RootDebugStatus Root::getStatus() const {
   obj.cancelled = inner.cancelled;
   obj.crawl_status = w_string{crawl_status.data(), crawl_status.size()};
   obj.enable_parallel_crawl = enable_parallel_crawl;
+  obj.memory = getMemoryUsage();
+  obj.init_phases = initTimeline.getStatus();
   return obj;
 }
 
@@ -273,6 +278,21 @@ json_ref Root::triggerListToJson() const {
   return json_array(std::move(arr));
 }
 
+void Root::noteQuery() {
+  // Only the restore order depends on this, so it is not worth rewriting
+  // the state file for every query.
+  static constexpr time_t kSaveInterval = 60;
+
+  auto now = ::time(nullptr);
+  lastQueryTime.store(now, std::memory_order_relaxed);
+  auto saved = lastQueryTimeSaved.load(std::memory_order_relaxed);
+  if (now - saved >= kSaveInterval &&
+      lastQueryTimeSaved.compare_exchange_strong(saved, now)) {
+    stateGeneration.fetch_add(1, std::memory_order_release);
+    saveGlobalStateHook_();
+  }
+}
+
 void w_root_free_watched_roots() {
   int last, interval;
   time_t started;
@@ -6,10 +6,15 @@
  */
 
 #include "watchman/saved_state/LocalSavedStateInterface.h"
+#include <folly/Synchronized.h>
+#include <unordered_map>
+#include <unordered_set>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
+#include "watchman/fs/DirHandle.h"
 #include "watchman/fs/FileInformation.h"
+#include "watchman/fs/FileSystem.h"
 #include "watchman/scm/SCM.h"
 
 static const int kDefaultMaxCommits{10};
@@ -18,6 +23,72 @@ W_CAP_REG("saved-state-local")
 
 namespace watchman {
 
+namespace {
+
+// The names in a saved state project directory.  A new interface is built
+// for every saved state query, so the listing is shared through
+// storageListings and revalidated with one stat of the directory: adding,
+// removing or renaming a saved state changes the directory's mtime.
+struct StorageListing {
+  ino_t ino;
+  struct timespec mtime;
+  std::unordered_set<w_string> names;
+
+  bool isCurrent(const FileInformation& info) const {
+    return ino == info.ino && mtime.tv_sec == info.mtime.tv_sec &&
+        mtime.tv_nsec == info.mtime.tv_nsec;
+  }
+};
+
+folly::Synchronized<
+    std::unordered_map<w_string, std::shared_ptr<const StorageListing>>>
+    storageListings;
+
+// Returns the listing of dir, or nullptr if it cannot be listed, in which
+// case the caller checks each path itself.
+std::shared_ptr<const StorageListing> getStorageListing(const w_string& dir) {
+  FileInformation info;
+  try {
+    info = getFileInformation(dir.c_str());
+  } catch (const std::exception&) {
+    return nullptr;
+  }
+  // A symlink's own mtime does not change with the directory it names
+  if (!info.isDir()) {
+    return nullptr;
+  }
+
+  {
+    auto listings = storageListings.rlock();
+    auto it = listings->find(dir);
+    if (it != listings->end() && it->second->isCurrent(info)) {
+      return it->second;
+    }
+  }
+
+  auto listing = std::make_shared<StorageListing>();
+  listing->ino = info.ino;
+  listing->mtime = info.mtime;
+  try {
+    auto handle = openDir(dir.c_str());
+    while (const DirEntry* entry = handle->readDir()) {
+      listing->names.emplace(entry->d_name, W_STRING_BYTE);
+    }
+  } catch (const std::exception& ex) {
+    log(DBG, "Failed to list saved states in ", dir, ": ", ex.what(), "\n");
+    return nullptr;
+  }
+
+  // With coarse mtimes a saved state written later in the same second
+  // would not be noticed, so only remember listings of settled directories.
+  if (::time(nullptr) - info.mtime.tv_sec > 1) {
+    storageListings.wlock()->insert_or_assign(dir, listing);
+  }
+  return listing;
+}
+
+} // namespace
+
 LocalSavedStateInterface::LocalSavedStateInterface(
     const json_ref& savedStateConfig,
     const SCM* scm)
@@ -61,15 +132,21 @@ LocalSavedStateInterface::getMostRecentSavedStateImpl(
     w_string_piece lookupCommitId) const {
   auto commitIds =
       scm_->getCommitsPriorToAndIncluding(lookupCommitId, maxCommits_);
+  auto listing =
+      getStorageListing(w_string::pathCat({localStoragePath_, project_}));
   for (auto& commitId : commitIds) {
-    auto path = getLocalPath(commitId);
+    auto filename = getFilename(commitId);
+    if (listing && listing->names.count(filename) == 0) {
+      continue;
+    }
+    auto path = w_string::pathCat({localStoragePath_, project_, filename});
     // We could return a path that no longer exists if the path is removed
     // (for example by saved state GC) after we check that the path exists
     // here, but before the client reads the state. We've explicitly chosen to
     // return the state without additional safety guarantees, and leave it to
     // the client to ensure GC happens only after states are no longer likely
     // to be used.
-    if (w_path_exists(path.c_str())) {
+    if (listing || w_path_exists(path.c_str())) {
       log(DBG, "Found saved state for commit ", commitId, "\n");
       SavedStateInterface::SavedStateResult result;
       result.commitId = commitId;
@@ -86,13 +163,15 @@ LocalSavedStateInterface::getMostRecentSavedStateImpl(
   return result;
 }
 
-w_string LocalSavedStateInterface::getLocalPath(w_string_piece commitId) const {
-  w_string filename;
+w_string LocalSavedStateInterface::getFilename(w_string_piece commitId) const {
   if (!projectMetadata_) {
-    filename = w_string::build(commitId);
-  } else {
-    filename = w_string::build(commitId, w_string("_"), *projectMetadata_);
+    return w_string::build(commitId);
   }
-  return w_string::pathCat({localStoragePath_, project_, filename});
+  return w_string::build(commitId, w_string("_"), *projectMetadata_);
+}
+
+w_string LocalSavedStateInterface::getLocalPath(w_string_piece commitId) const {
+  return w_string::pathCat(
+      {localStoragePath_, project_, getFilename(commitId)});
 }
 } // namespace watchman
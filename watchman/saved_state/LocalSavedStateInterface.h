@@ -24,6 +24,10 @@ namespace watchman {
 // saved state is not available, returns an error message in the saved state
 // info JSON. If a saved state is available, returns the local path for the
 // state in the saved state info JSON, along with the saved state commit id.
+//
+// The listing of the project directory is cached across queries and
+// revalidated against the directory's mtime, so repeated lookups only stat
+// the directory.
 class LocalSavedStateInterface : public SavedStateInterface {
  public:
   LocalSavedStateInterface(const json_ref& savedStateConfig, const SCM* scm);
@@ -33,6 +37,9 @@ class LocalSavedStateInterface : public SavedStateInterface {
   w_string getLocalPath(w_string_piece commitId) const;
 
  private:
+  // The name of the saved state for commitId within the project directory
+  w_string getFilename(w_string_piece commitId) const;
+
   json_int_t maxCommits_;
   w_string localStoragePath_;
   const SCM* scm_;
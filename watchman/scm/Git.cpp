@@ -12,6 +12,7 @@
 #include "watchman/ChildProcess.h"
 #include "watchman/CommandRegistry.h"
 #include "watchman/Logging.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/fs/FileSystem.h"
 
 // Capability indicating support for the git SCM
@@ -72,6 +73,7 @@ namespace watchman {
 Git::Git(w_string_piece rootPath, w_string_piece scmRoot)
     : SCM(rootPath, scmRoot),
       indexPath_(fmt::format("{}/.git/index", getSCMRoot())),
+      headPath_(fmt::format("{}/.git/HEAD", getSCMRoot())),
       commitsPrior_(Configuration(), "scm_git_commits_prior", 32, 10),
       mergeBases_(Configuration(), "scm_git_mergebase", 32, 10),
       filesChangedSinceMergeBaseWith_(
@@ -91,6 +93,36 @@ ChildProcess::Options Git::makeGitOptions(
   return opt;
 }
 
+template <typename Func>
+auto Git::tryInProcess(std::string_view description, Func&& func) const
+    -> std::optional<std::invoke_result_t<Func, LibGit2Repository&>> {
+  auto inProcess = inProcess_.wlock();
+  if (!inProcess->opened) {
+    inProcess->opened = true;
+    if (cfg_get_bool("git_in_process", true)) {
+      inProcess->repo = LibGit2Repository::open(getRootPath());
+    }
+  }
+  if (!inProcess->repo) {
+    return std::nullopt;
+  }
+  try {
+    return func(*inProcess->repo);
+  } catch (const SCMError& exc) {
+    log(DBG,
+        "failed to ",
+        description,
+        " in-process, running git instead: ",
+        exc.what(),
+        "\n");
+    return std::nullopt;
+  }
+}
+
+bool Git::isCommitStateFile(w_string_piece fullPath) const {
+  return fullPath == indexPath_ || fullPath == headPath_;
+}
+
 struct timespec Git::getIndexMtime() const {
   try {
     auto info =
@@ -118,6 +150,13 @@ w_string Git::mergeBaseWith(
       .get(
           key,
           [this, commit, requestId](const std::string&) {
+            if (auto base = tryInProcess(
+                    "query for the merge base", [&](LibGit2Repository& repo) {
+                      return repo.mergeBaseWithHead(commit);
+                    })) {
+              return folly::makeFuture(std::move(*base));
+            }
+
             auto result = runGit(
                 {gitExecutablePath(), "merge-base", commit, "HEAD"},
                 makeGitOptions(requestId),
@@ -152,6 +191,14 @@ std::vector<w_string> Git::getFilesChangedSinceMergeBaseWith(
           key,
           [this, commit = std::move(commitCopy), requestId](
               const std::string&) {
+            if (auto files = tryInProcess(
+                    "query for files changed since merge base",
+                    [&](LibGit2Repository& repo) {
+                      return repo.filesChangedSince(commit);
+                    })) {
+              return folly::makeFuture(std::move(*files));
+            }
+
             auto result = runGit(
                 {gitExecutablePath(), "diff", "--name-only", "-z", commit},
                 makeGitOptions(requestId),
@@ -168,6 +215,13 @@ std::vector<w_string> Git::getFilesChangedSinceMergeBaseWith(
 std::chrono::time_point<std::chrono::system_clock> Git::getCommitDate(
     w_string_piece commitId,
     const std::optional<w_string>& requestId) const {
+  if (auto time = tryInProcess(
+          "get commit date", [&](LibGit2Repository& repo) {
+            return repo.getCommitTime(commitId);
+          })) {
+    return system_clock::from_time_t(*time);
+  }
+
   auto result = runGit(
       {gitExecutablePath(), "log", "--format:%ct", "-n", "1", commitId.view()},
       makeGitOptions(requestId),
@@ -196,6 +250,14 @@ std::vector<w_string> Git::getCommitsPriorToAndIncluding(
           key,
           [this, commit = std::move(commitCopy), numCommits, requestId](
               const std::string&) {
+            if (auto commits = tryInProcess(
+                    "get prior commits", [&](LibGit2Repository& repo) {
+                      return repo.getCommitsPriorToAndIncluding(
+                          commit, numCommits);
+                    })) {
+              return folly::makeFuture(std::move(*commits));
+            }
+
             auto result = runGit(
                 {gitExecutablePath(),
                  "log",
@@ -7,10 +7,15 @@
 
 #pragma once
 
+#include <folly/Synchronized.h>
 #include <chrono>
+#include <memory>
+#include <optional>
+#include <type_traits>
 #include <vector>
 #include "watchman/ChildProcess.h"
 #include "watchman/LRUCache.h"
+#include "watchman/scm/LibGit2Repository.h"
 #include "watchman/scm/SCM.h"
 
 namespace watchman {
@@ -33,17 +38,33 @@ class Git : public SCM {
       w_string_piece commitId,
       int numCommits,
       const std::optional<w_string>& requestId = std::nullopt) const override;
+  bool isCommitStateFile(w_string_piece fullPath) const override;
 
  private:
   std::string indexPath_;
+  std::string headPath_;
   mutable LRUCache<std::string, std::vector<w_string>> commitsPrior_;
   mutable LRUCache<std::string, w_string> mergeBases_;
   mutable LRUCache<std::string, std::vector<w_string>>
       filesChangedSinceMergeBaseWith_;
 
+  struct InProcessRepository {
+    // Whether opening the repository has been attempted
+    bool opened{false};
+    // nullptr if the repository is read by running git
+    std::unique_ptr<LibGit2Repository> repo;
+  };
+  mutable folly::Synchronized<InProcessRepository> inProcess_;
+
   ChildProcess::Options makeGitOptions(
       const std::optional<w_string>& requestId) const;
   struct timespec getIndexMtime() const;
+
+  // Calls func with the in-process repository, returning nullopt if there
+  // is none or it fails, in which case the caller runs git instead.
+  template <typename Func>
+  auto tryInProcess(std::string_view description, Func&& func) const
+      -> std::optional<std::invoke_result_t<Func, LibGit2Repository&>>;
 };
 
 } // namespace watchman
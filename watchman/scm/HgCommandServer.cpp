@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/HgCommandServer.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include <system_error>
+
+namespace watchman {
+
+namespace {
+
+ChildProcess::Options withServerStdio(ChildProcess::Options options) {
+  options.pipeStdin();
+  options.pipeStdout();
+  // Errors from commands come back over the protocol; anything else the
+  // server prints would fill up a pipe that nobody reads.
+  options.nullStderr();
+  return options;
+}
+
+// FileDescriptor reads and writes at most INT_MAX bytes at a time
+constexpr size_t kMaxChunk = 1 << 30;
+
+uint32_t decodeLength(const unsigned char* buf) {
+  return (uint32_t(buf[0]) << 24) | (uint32_t(buf[1]) << 16) |
+      (uint32_t(buf[2]) << 8) | uint32_t(buf[3]);
+}
+
+void appendLength(std::string& out, uint32_t len) {
+  out.push_back(char((len >> 24) & 0xff));
+  out.push_back(char((len >> 16) & 0xff));
+  out.push_back(char((len >> 8) & 0xff));
+  out.push_back(char(len & 0xff));
+}
+
+} // namespace
+
+HgCommandServer::HgCommandServer(
+    std::string_view hgPath,
+    ChildProcess::Options options)
+    : process_(
+          {hgPath, "serve", "--cmdserver", "pipe"},
+          withServerStdio(std::move(options))),
+      stdin_(process_.takePipe(STDIN_FILENO)),
+      stdout_(process_.takePipe(STDOUT_FILENO)) {}
+
+HgCommandServer::~HgCommandServer() {
+  // The server exits once its input is closed
+  stdin_.reset();
+  process_.kill();
+  process_.wait();
+}
+
+std::string HgCommandServer::encodeRunCommand(
+    const std::vector<std::string_view>& args) {
+  std::string payload;
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (i > 0) {
+      payload.push_back('\0');
+    }
+    payload.append(args[i]);
+  }
+  std::string request = "runcommand\n";
+  appendLength(request, payload.size());
+  request.append(payload);
+  return request;
+}
+
+HgCommandServer::Result HgCommandServer::runCommand(
+    const std::vector<std::string_view>& args) {
+  if (!ready_) {
+    readHello();
+  }
+  writeFully(encodeRunCommand(args));
+
+  std::string output;
+  std::string error;
+  std::string data;
+  while (true) {
+    auto channel = readMessage(data);
+    switch (channel) {
+      case 'o':
+        output.append(data);
+        break;
+      case 'e':
+        error.append(data);
+        break;
+      case 'r':
+        if (data.size() != 4) {
+          throw std::runtime_error(fmt::format(
+              "hg command server sent a {} byte result", data.size()));
+        }
+        return Result{
+            int(decodeLength(reinterpret_cast<const unsigned char*>(
+                data.data()))),
+            w_string{output.data(), output.size()},
+            w_string{error.data(), error.size()}};
+      case 'I':
+      case 'L':
+        // None of our commands read input, and the server has no way to
+        // recover from us refusing it.
+        throw std::runtime_error("hg command server asked for input");
+      default:
+        // Upper case channels are required to be handled; others, such as
+        // 'd' for debug output, may be ignored.
+        if (channel >= 'A' && channel <= 'Z') {
+          throw std::runtime_error(fmt::format(
+              "hg command server used unknown channel '{}'", channel));
+        }
+        break;
+    }
+  }
+}
+
+void HgCommandServer::readHello() {
+  std::string hello;
+  if (readMessage(hello) != 'o') {
+    throw std::runtime_error("hg command server didn't say hello");
+  }
+  // The hello message is a set of "field: value" lines, one of which lists
+  // the commands that the server understands.
+  bool canRunCommands = false;
+  std::vector<w_string_piece> lines;
+  w_string_piece{hello}.split(lines, '\n');
+  for (auto& line : lines) {
+    if (line.startsWith("capabilities:")) {
+      std::vector<w_string_piece> capabilities;
+      line.split(capabilities, ' ');
+      for (auto& capability : capabilities) {
+        canRunCommands = canRunCommands || capability == "runcommand";
+      }
+    }
+  }
+  if (!canRunCommands) {
+    throw std::runtime_error("hg command server can't run commands");
+  }
+  ready_ = true;
+}
+
+char HgCommandServer::readMessage(std::string& data) {
+  unsigned char header[5];
+  readFully(header, sizeof(header));
+  auto channel = char(header[0]);
+  auto length = decodeLength(header + 1);
+
+  data.clear();
+  if (channel == 'I' || channel == 'L') {
+    // The length is how much input the server wants, not what follows
+    return channel;
+  }
+  data.resize(length);
+  readFully(data.data(), length);
+  return channel;
+}
+
+void HgCommandServer::readFully(void* buf, size_t size) {
+  auto* out = static_cast<char*>(buf);
+  while (size > 0) {
+    auto result = stdout_->read.read(out, int(std::min(size, kMaxChunk)));
+    if (result.hasError()) {
+      if (result.error() == std::errc::interrupted) {
+        continue;
+      }
+      throw std::system_error(
+          result.error(), "reading from the hg command server");
+    }
+    if (result.value() == 0) {
+      throw std::runtime_error("hg command server exited");
+    }
+    out += result.value();
+    size -= result.value();
+  }
+}
+
+void HgCommandServer::writeFully(std::string_view data) {
+  while (!data.empty()) {
+    auto result = stdin_->write.write(
+        data.data(), int(std::min(data.size(), kMaxChunk)));
+    if (result.hasError()) {
+      if (result.error() == std::errc::interrupted) {
+        continue;
+      }
+      throw std::system_error(
+          result.error(), "writing to the hg command server");
+    }
+    data.remove_prefix(result.value());
+  }
+}
+
+} // namespace watchman
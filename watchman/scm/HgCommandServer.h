@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "watchman/ChildProcess.h"
+#include "watchman/fs/Pipe.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * A long-running `hg serve --cmdserver pipe` process for one repository.
+ * Each command runs inside the already started server, avoiding the cost of
+ * starting Mercurial's Python interpreter for every SCM query.
+ *
+ * The server runs one command at a time, so an instance must only be used by
+ * one thread at a time.  Once runCommand() has thrown, the server is in an
+ * unknown state and must be discarded.
+ */
+class HgCommandServer {
+ public:
+  struct Result {
+    // The exit status of the command
+    int status;
+    w_string output;
+    w_string error;
+  };
+
+  /**
+   * Starts the server.  `hgPath` is the hg executable, and `options` set up
+   * its environment and working directory; its stdio is set up here.
+   * Doesn't wait for the server to be ready.
+   */
+  HgCommandServer(std::string_view hgPath, ChildProcess::Options options);
+  ~HgCommandServer();
+
+  HgCommandServer(const HgCommandServer&) = delete;
+  HgCommandServer& operator=(const HgCommandServer&) = delete;
+
+  /**
+   * Runs `hg <args>` in the server and returns its output.  Throws if the
+   * server can't be talked to.
+   */
+  Result runCommand(const std::vector<std::string_view>& args);
+
+  // public for testing
+  static std::string encodeRunCommand(
+      const std::vector<std::string_view>& args);
+
+ private:
+  void readHello();
+  // Reads the next message, returning its channel.  The input channels, 'I'
+  // and 'L', carry no data.
+  char readMessage(std::string& data);
+  void readFully(void* buf, size_t size);
+  void writeFully(std::string_view data);
+
+  ChildProcess process_;
+  std::unique_ptr<Pipe> stdin_;
+  std::unique_ptr<Pipe> stdout_;
+  bool ready_{false};
+};
+
+} // namespace watchman
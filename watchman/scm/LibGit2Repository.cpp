@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watchman_system.h"
+
+#include "watchman/scm/LibGit2Repository.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include "watchman/Logging.h"
+#include "watchman/scm/SCM.h"
+
+#ifdef HAVE_LIBGIT2
+#include <git2.h>
+#endif
+
+namespace watchman {
+
+#ifdef HAVE_LIBGIT2
+
+namespace {
+
+template <typename T, void (*Free)(T*)>
+struct GitFree {
+  void operator()(T* ptr) const {
+    Free(ptr);
+  }
+};
+
+using CommitPtr =
+    std::unique_ptr<git_commit, GitFree<git_commit, git_commit_free>>;
+using DiffPtr = std::unique_ptr<git_diff, GitFree<git_diff, git_diff_free>>;
+using ObjectPtr =
+    std::unique_ptr<git_object, GitFree<git_object, git_object_free>>;
+using RevwalkPtr =
+    std::unique_ptr<git_revwalk, GitFree<git_revwalk, git_revwalk_free>>;
+using TreePtr = std::unique_ptr<git_tree, GitFree<git_tree, git_tree_free>>;
+
+void check(int error, std::string_view what) {
+  if (error >= 0) {
+    return;
+  }
+  auto* err = git_error_last();
+  SCMError::throwf(
+      "libgit2 failed to {}: {}",
+      what,
+      err && err->message ? err->message : "unknown error");
+}
+
+CommitPtr lookupCommit(git_repository* repo, w_string_piece commitId) {
+  git_object* object = nullptr;
+  check(
+      git_revparse_single(&object, repo, commitId.string().c_str()),
+      fmt::format("resolve {}", commitId));
+  ObjectPtr owned{object};
+
+  git_object* commit = nullptr;
+  check(
+      git_object_peel(&commit, object, GIT_OBJECT_COMMIT),
+      fmt::format("resolve {} to a commit", commitId));
+  return CommitPtr{reinterpret_cast<git_commit*>(commit)};
+}
+
+} // namespace
+
+LibGit2Repository::LibGit2Repository(git_repository* repo) : repo_{repo} {}
+
+LibGit2Repository::~LibGit2Repository() {
+  git_repository_free(repo_);
+}
+
+std::unique_ptr<LibGit2Repository> LibGit2Repository::open(
+    w_string_piece path) {
+  static std::once_flag initialized;
+  std::call_once(initialized, [] { git_libgit2_init(); });
+
+  git_repository* repo = nullptr;
+  if (git_repository_open_ext(&repo, path.string().c_str(), 0, nullptr) < 0) {
+    auto* err = git_error_last();
+    log(ERR,
+        "libgit2 can't open ",
+        path,
+        ", so git will be run instead: ",
+        err && err->message ? err->message : "unknown error",
+        "\n");
+    return nullptr;
+  }
+  return std::unique_ptr<LibGit2Repository>(new LibGit2Repository(repo));
+}
+
+w_string LibGit2Repository::mergeBaseWithHead(w_string_piece commitId) {
+  auto commit = lookupCommit(repo_, commitId);
+  git_oid head;
+  check(git_reference_name_to_id(&head, repo_, "HEAD"), "resolve HEAD");
+  git_oid base;
+  check(
+      git_merge_base(&base, repo_, git_commit_id(commit.get()), &head),
+      "find the merge base");
+  return w_string{git_oid_tostr_s(&base)};
+}
+
+std::vector<w_string> LibGit2Repository::filesChangedSince(
+    w_string_piece commitId) {
+  auto commit = lookupCommit(repo_, commitId);
+  git_tree* tree = nullptr;
+  check(git_commit_tree(&tree, commit.get()), "read the commit's tree");
+  TreePtr ownedTree{tree};
+
+  git_diff* diff = nullptr;
+  check(
+      git_diff_tree_to_workdir_with_index(&diff, repo_, tree, nullptr),
+      "diff the working copy");
+  DiffPtr ownedDiff{diff};
+
+  std::vector<w_string> files;
+  auto numDeltas = git_diff_num_deltas(diff);
+  files.reserve(numDeltas);
+  for (size_t i = 0; i < numDeltas; ++i) {
+    auto* delta = git_diff_get_delta(diff, i);
+    files.emplace_back(
+        delta->new_file.path ? delta->new_file.path : delta->old_file.path);
+  }
+  return files;
+}
+
+time_t LibGit2Repository::getCommitTime(w_string_piece commitId) {
+  auto commit = lookupCommit(repo_, commitId);
+  return static_cast<time_t>(git_commit_time(commit.get()));
+}
+
+std::vector<w_string> LibGit2Repository::getCommitsPriorToAndIncluding(
+    w_string_piece commitId,
+    int numCommits) {
+  auto commit = lookupCommit(repo_, commitId);
+  git_revwalk* walk = nullptr;
+  check(git_revwalk_new(&walk, repo_), "walk the history");
+  RevwalkPtr ownedWalk{walk};
+  check(git_revwalk_sorting(walk, GIT_SORT_TIME), "walk the history");
+  check(
+      git_revwalk_push(walk, git_commit_id(commit.get())),
+      "walk the history");
+
+  std::vector<w_string> commits;
+  git_oid oid;
+  while (commits.size() < size_t(std::max(numCommits, 0)) &&
+         git_revwalk_next(&oid, walk) == 0) {
+    commits.emplace_back(git_oid_tostr_s(&oid));
+  }
+  return commits;
+}
+
+#else
+
+// Without libgit2, open() never returns an instance, so the rest is
+// unreachable.
+
+LibGit2Repository::LibGit2Repository(git_repository* repo) : repo_{repo} {}
+
+LibGit2Repository::~LibGit2Repository() = default;
+
+std::unique_ptr<LibGit2Repository> LibGit2Repository::open(w_string_piece) {
+  return nullptr;
+}
+
+w_string LibGit2Repository::mergeBaseWithHead(w_string_piece) {
+  SCMError::throwf("watchman was built without libgit2");
+}
+
+std::vector<w_string> LibGit2Repository::filesChangedSince(w_string_piece) {
+  SCMError::throwf("watchman was built without libgit2");
+}
+
+time_t LibGit2Repository::getCommitTime(w_string_piece) {
+  SCMError::throwf("watchman was built without libgit2");
+}
+
+std::vector<w_string> LibGit2Repository::getCommitsPriorToAndIncluding(
+    w_string_piece,
+    int) {
+  SCMError::throwf("watchman was built without libgit2");
+}
+
+#endif
+
+} // namespace watchman
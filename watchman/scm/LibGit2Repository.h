@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <ctime>
+#include <memory>
+#include <vector>
+#include "watchman/watchman_string.h"
+
+struct git_repository;
+
+namespace watchman {
+
+/**
+ * Reads a git repository in-process with libgit2, to answer the questions
+ * that the Git SCM otherwise asks by running git.
+ *
+ * Methods throw SCMError if libgit2 fails, for example if the repository
+ * uses a format it doesn't understand.  An instance must only be used by one
+ * thread at a time.
+ */
+class LibGit2Repository {
+ public:
+  /**
+   * Opens the repository containing `path`.  Returns nullptr if it can't be
+   * opened, or if watchman was built without libgit2.
+   */
+  static std::unique_ptr<LibGit2Repository> open(w_string_piece path);
+  ~LibGit2Repository();
+
+  LibGit2Repository(const LibGit2Repository&) = delete;
+  LibGit2Repository& operator=(const LibGit2Repository&) = delete;
+
+  // The merge base of `commitId` and HEAD, like `git merge-base`
+  w_string mergeBaseWithHead(w_string_piece commitId);
+
+  // The files that differ between `commitId` and the working copy, like
+  // `git diff --name-only`
+  std::vector<w_string> filesChangedSince(w_string_piece commitId);
+
+  time_t getCommitTime(w_string_piece commitId);
+
+  // Up to `numCommits` ids, starting with `commitId` and walking back by
+  // commit time, like `git log -n`
+  std::vector<w_string> getCommitsPriorToAndIncluding(
+      w_string_piece commitId,
+      int numCommits);
+
+ private:
+  explicit LibGit2Repository(git_repository* repo);
+
+  git_repository* repo_;
+};
+
+} // namespace watchman
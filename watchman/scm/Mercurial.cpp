@@ -9,6 +9,7 @@
 #include <fmt/core.h>
 #include <folly/String.h>
 #include <folly/portability/SysTime.h>
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <cstdio>
@@ -38,36 +39,44 @@ std::string hgExecutablePath() {
   return "hg";
 }
 
-struct MercurialResult {
-  w_string output;
-};
+[[noreturn]] void throwMercurialError(
+    const std::vector<std::string_view>& cmdline,
+    std::string_view description,
+    std::string output,
+    std::string error) {
+  replaceEmbeddedNulls(output);
+  replaceEmbeddedNulls(error);
+  SCMError::throwf(
+      "failed to {}\ncmd = {}\nstdout = {}\nstderr = {}",
+      description,
+      folly::join(" ", cmdline),
+      output,
+      error);
+}
 
-MercurialResult runMercurial(
+w_string runMercurial(
     std::vector<std::string_view> cmdline,
     ChildProcess::Options options,
     std::string_view description) {
+  options.nullStdin();
+  options.pipeStdout();
+  options.pipeStderr();
   ChildProcess proc{cmdline, std::move(options)};
   auto outputs = proc.communicate();
   auto status = proc.wait();
   if (status) {
-    auto output =
-        std::string{outputs.first ? outputs.first->view() : std::string_view{}};
-    auto error = std::string{
-        outputs.second ? outputs.second->view() : std::string_view{}};
-    replaceEmbeddedNulls(output);
-    replaceEmbeddedNulls(error);
-    SCMError::throwf(
-        "failed to {}\ncmd = {}\nstdout = {}\nstderr = {}",
+    throwMercurialError(
+        cmdline,
         description,
-        folly::join(" ", cmdline),
-        output,
-        error);
+        std::string{outputs.first ? outputs.first->view() : std::string_view{}},
+        std::string{
+            outputs.second ? outputs.second->view() : std::string_view{}});
   }
 
   if (outputs.first) {
-    return MercurialResult{std::move(*outputs.first)};
+    return std::move(*outputs.first);
   } else {
-    return MercurialResult{""};
+    return w_string{""};
   }
 }
 
@@ -117,14 +126,80 @@ ChildProcess::Options Mercurial::makeHgOptions(
   // rather than whatever is hardcoded in its config.
   opt.environment().set("WATCHMAN_SOCK", get_sock_name_legacy());
 
-  opt.nullStdin();
-  opt.pipeStdout();
-  opt.pipeStderr();
   opt.chdir(getRootPath());
 
   return opt;
 }
 
+std::unique_ptr<HgCommandServer> Mercurial::takeCommandServer() const {
+  auto server = idleCommandServers_.withWLock(
+      [](auto& idle) -> std::unique_ptr<HgCommandServer> {
+        if (idle.empty()) {
+          return nullptr;
+        }
+        auto server = std::move(idle.back());
+        idle.pop_back();
+        return server;
+      });
+  if (!server) {
+    server = std::make_unique<HgCommandServer>(
+        hgExecutablePath(), makeHgOptions(std::nullopt));
+  }
+  return server;
+}
+
+void Mercurial::returnCommandServer(
+    std::unique_ptr<HgCommandServer> server) const {
+  idleCommandServers_.withWLock([&](auto& idle) {
+    if (idle.size() < maxCommandServers_) {
+      idle.push_back(std::move(server));
+    }
+  });
+}
+
+w_string Mercurial::runHg(
+    std::vector<std::string_view> args,
+    const std::optional<w_string>& requestId,
+    std::string_view description) const {
+  auto hg = hgExecutablePath();
+  std::vector<std::string_view> cmdline{hg};
+  cmdline.insert(cmdline.end(), args.begin(), args.end());
+
+  // A command server's environment is fixed when it starts, so commands
+  // that carry a request id always get their own process.
+  if (maxCommandServers_ > 0 && (!requestId || requestId->empty())) {
+    std::optional<HgCommandServer::Result> result;
+    std::unique_ptr<HgCommandServer> server;
+    try {
+      server = takeCommandServer();
+      result = server->runCommand(args);
+    } catch (const std::exception& exc) {
+      // The server is in an unknown state, so it is discarded, and this
+      // command is run the usual way instead
+      server.reset();
+      log(ERR,
+          "hg command server for ",
+          getRootPath(),
+          " failed: ",
+          exc.what(),
+          "\n");
+    }
+    if (result) {
+      returnCommandServer(std::move(server));
+      if (result->status) {
+        throwMercurialError(
+            cmdline,
+            description,
+            result->output.string(),
+            result->error.string());
+      }
+      return std::move(result->output);
+    }
+  }
+
+  return runMercurial(cmdline, makeHgOptions(requestId), description);
+}
+
 Mercurial::Mercurial(w_string_piece rootPath, w_string_piece scmRoot)
     : SCM(rootPath, scmRoot),
       dirStatePath_(fmt::format("{}/.hg/dirstate", getSCMRoot())),
@@ -134,7 +209,24 @@ Mercurial::Mercurial(w_string_piece rootPath, w_string_piece scmRoot)
           Configuration(),
           "scm_hg_files_since_mergebase",
           32,
-          10) {}
+          10),
+      maxCommandServers_(
+          std::max<json_int_t>(0, cfg_get_int("hg_command_servers", 2))) {
+  if (maxCommandServers_ > 0) {
+    // Start a server now, so that the first SCM query doesn't have to wait
+    // for it; it gets ready in the background.
+    try {
+      returnCommandServer(takeCommandServer());
+    } catch (const std::exception& exc) {
+      log(ERR,
+          "failed to start an hg command server for ",
+          getRootPath(),
+          ": ",
+          exc.what(),
+          "\n");
+    }
+  }
+}
 
 struct timespec Mercurial::getDirStateMtime() const {
   try {
@@ -152,6 +244,10 @@ struct timespec Mercurial::getDirStateMtime() const {
   }
 }
 
+bool Mercurial::isCommitStateFile(w_string_piece fullPath) const {
+  return fullPath == dirStatePath_;
+}
+
 w_string Mercurial::mergeBaseWith(
     w_string_piece commitId,
     const std::optional<w_string>& requestId) const {
@@ -164,24 +260,24 @@ w_string Mercurial::mergeBaseWith(
           key,
           [this, commit, requestId](const std::string&) {
             auto revset = fmt::format("ancestor(.,{})", commit);
-            auto result = runMercurial(
-                {hgExecutablePath(), "log", "-T", "{node}", "-r", revset},
-                makeHgOptions(requestId),
+            auto output = runHg(
+                {"log", "-T", "{node}", "-r", revset},
+                requestId,
                 "query for the merge base");
 
-            if (result.output.empty()) {
+            if (output.empty()) {
               SCMError::throwf(
                   "no output was returned from `hg log -T{{node}} -r {}",
                   revset);
             }
 
-            if (result.output.size() != 40) {
+            if (output.size() != 40) {
               SCMError::throwf(
                   "expected merge base to be a 40 character string, got {}",
-                  result.output.view());
+                  output.view());
             }
 
-            return folly::makeFuture(result.output);
+            return folly::makeFuture(output);
           })
       .get()
       ->value();
@@ -204,9 +300,8 @@ std::vector<w_string> Mercurial::getFilesChangedSinceMergeBaseWith(
           key,
           [this, commit = std::move(commitCopy), requestId](
               const std::string&) {
-            auto result = runMercurial(
-                {hgExecutablePath(),
-                 "--traceback",
+            auto output = runHg(
+                {"--traceback",
                  "status",
                  "-n",
                  "--rev",
@@ -214,11 +309,11 @@ std::vector<w_string> Mercurial::getFilesChangedSinceMergeBaseWith(
                  // The "" argument at the end causes paths to be printed out
                  // relative to the cwd (set to root path above).
                  ""},
-                makeHgOptions(requestId),
+                requestId,
                 "query for files changed since merge base");
 
             std::vector<w_string> lines;
-            result.output.piece().split(lines, '\n');
+            output.piece().split(lines, '\n');
             return folly::makeFuture(lines);
           })
       .get()
@@ -228,17 +323,11 @@ std::vector<w_string> Mercurial::getFilesChangedSinceMergeBaseWith(
 time_point<system_clock> Mercurial::getCommitDate(
     w_string_piece commitId,
     const std::optional<w_string>& requestId) const {
-  auto result = runMercurial(
-      {hgExecutablePath(),
-       "--traceback",
-       "log",
-       "-r",
-       commitId.data(),
-       "-T",
-       "{date}\n"},
-      makeHgOptions(requestId),
+  auto output = runHg(
+      {"--traceback", "log", "-r", commitId.view(), "-T", "{date}\n"},
+      requestId,
       "get commit date");
-  return Mercurial::convertCommitDate(result.output.c_str());
+  return Mercurial::convertCommitDate(output.c_str());
 }
 
 time_point<system_clock> Mercurial::convertCommitDate(const char* commitDate) {
@@ -268,19 +357,13 @@ std::vector<w_string> Mercurial::getCommitsPriorToAndIncluding(
               const std::string&) {
             auto revset = fmt::format(
                 "reverse(last(_firstancestors({}), {}))\n", commit, numCommits);
-            auto result = runMercurial(
-                {hgExecutablePath(),
-                 "--traceback",
-                 "log",
-                 "-r",
-                 revset,
-                 "-T",
-                 "{node}\n"},
-                makeHgOptions(requestId),
+            auto output = runHg(
+                {"--traceback", "log", "-r", revset, "-T", "{node}\n"},
+                requestId,
                 "get prior commits");
 
             std::vector<w_string> lines;
-            w_string_piece(result.output).split(lines, '\n');
+            w_string_piece(output).split(lines, '\n');
             return folly::makeFuture(lines);
           })
       .get()
@@ -8,9 +8,12 @@
 #pragma once
 #include "watchman/watchman_system.h"
 
+#include <folly/Synchronized.h>
+#include <memory>
 #include <string>
 #include "watchman/ChildProcess.h"
 #include "watchman/LRUCache.h"
+#include "watchman/scm/HgCommandServer.h"
 #include "watchman/scm/SCM.h"
 
 namespace watchman {
@@ -35,6 +38,7 @@ class Mercurial : public SCM {
       w_string_piece commitId,
       int numCommits,
       const std::optional<w_string>& requestId = std::nullopt) const override;
+  bool isCommitStateFile(w_string_piece fullPath) const override;
 
  private:
   std::string dirStatePath_;
@@ -43,10 +47,26 @@ class Mercurial : public SCM {
   mutable LRUCache<std::string, std::vector<w_string>>
       filesChangedSinceMergeBaseWith_;
 
-  // Returns options for invoking hg
+  // The most command servers to keep for this repository; zero means hg is
+  // always run as a separate process.
+  size_t maxCommandServers_;
+  // Command servers that aren't running a command right now
+  mutable folly::Synchronized<std::vector<std::unique_ptr<HgCommandServer>>>
+      idleCommandServers_;
+
+  // Returns options for invoking hg, without its stdio set up
   ChildProcess::Options makeHgOptions(
       const std::optional<w_string>& requestId) const;
   struct timespec getDirStateMtime() const;
+
+  // Runs `hg <args>` and returns its output, using a command server when
+  // possible.  Throws SCMError if the command fails.
+  w_string runHg(
+      std::vector<std::string_view> args,
+      const std::optional<w_string>& requestId,
+      std::string_view description) const;
+  std::unique_ptr<HgCommandServer> takeCommandServer() const;
+  void returnCommandServer(std::unique_ptr<HgCommandServer> server) const;
 };
 
 } // namespace watchman
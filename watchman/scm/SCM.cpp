@@ -6,6 +6,7 @@
  */
 
 #include "watchman/scm/SCM.h"
+#include <algorithm>
 #include <memory>
 #include "watchman/Logging.h"
 #include "watchman/fs/FileInformation.h"
@@ -30,6 +31,51 @@ const w_string& SCM::getSCMRoot() const {
   return scmRoot_;
 }
 
+void SCM::noteMergeBaseTarget(w_string_piece commitId) {
+  auto targets = mergeBaseTargets_.wlock();
+  auto it = std::find_if(
+      targets->begin(), targets->end(), [&](const w_string& target) {
+        return target.piece() == commitId;
+      });
+  if (it == targets->begin() && it != targets->end()) {
+    return;
+  }
+  if (it != targets->end()) {
+    targets->erase(it);
+  }
+  targets->push_front(commitId.asWString());
+  if (targets->size() > kMaxMergeBaseTargets) {
+    targets->pop_back();
+  }
+}
+
+void SCM::refreshMergeBases(const std::vector<w_string>& extraTargets) const {
+  std::vector<w_string> targets;
+  {
+    auto recent = mergeBaseTargets_.rlock();
+    targets.assign(recent->begin(), recent->end());
+  }
+  for (auto& target : extraTargets) {
+    if (std::find(targets.begin(), targets.end(), target) == targets.end()) {
+      targets.push_back(target);
+    }
+  }
+
+  for (auto& target : targets) {
+    try {
+      auto base = mergeBaseWith(target);
+      log(DBG, "refreshed merge base with ", target, ": ", base, "\n");
+    } catch (const std::exception& exc) {
+      log(DBG,
+          "failed to refresh merge base with ",
+          target,
+          ": ",
+          exc.what(),
+          "\n");
+    }
+  }
+}
+
 std::optional<w_string> findFileInDirTree(
     w_string_piece rootPath,
     std::initializer_list<w_string_piece> candidates) {
@@ -7,7 +7,9 @@
 
 #pragma once
 
+#include <folly/Synchronized.h>
 #include <chrono>
+#include <deque>
 #include <optional>
 #include <vector>
 #include "watchman/Errors.h"
@@ -86,8 +88,26 @@ class SCM {
       int numCommits,
       const std::optional<w_string>& requestId = std::nullopt) const = 0;
 
+  // Returns true if fullPath is a file that changes when the working copy
+  // moves to another commit, such as by a checkout or rebase.
+  virtual bool isCommitStateFile(w_string_piece fullPath) const = 0;
+
+  // Remembers a commit that a query finds the merge base with, so that
+  // refreshMergeBases() keeps it warm.
+  void noteMergeBaseTarget(w_string_piece commitId);
+
+  // Computes the merge base with each recently queried target and each of
+  // `extraTargets`, so that the next query after the working copy moves
+  // finds it cached.  Meant to be run in the background.
+  void refreshMergeBases(const std::vector<w_string>& extraTargets) const;
+
  private:
+  // How many recently queried merge base targets are remembered
+  static constexpr size_t kMaxMergeBaseTargets = 4;
+
   w_string rootPath_;
   w_string scmRoot_;
+  // Most recently queried first
+  folly::Synchronized<std::deque<w_string>> mergeBaseTargets_;
 };
 } // namespace watchman
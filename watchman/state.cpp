@@ -6,20 +6,22 @@
  */
 
 #include "watchman/state.h"
+#include <folly/FileUtil.h>
 #include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <algorithm>
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
 #include "watchman/Options.h"
-#include "watchman/PDU.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Shutdown.h"
+#include "watchman/StateFile.h"
 #include "watchman/TriggerCommand.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/resolve.h"
 #include "watchman/root/watchlist.h"
 #include "watchman/saved_state/SavedStateFactory.h"
-#include "watchman/watchman_stream.h"
 
 using namespace watchman;
 
@@ -40,6 +42,15 @@ struct state {
 folly::Synchronized<state, std::mutex> saveState;
 std::condition_variable stateCond;
 std::thread state_saver_thread;
+
+/** The encoded record of a root as of its stateGeneration.  Only accessed
+ * by the state saver thread. */
+struct RootRecord {
+  std::weak_ptr<Root> root;
+  uint64_t generation;
+  std::string bytes;
+};
+std::unordered_map<w_string, RootRecord> rootRecords;
 } // namespace
 
 static bool do_state_save();
@@ -83,22 +94,25 @@ bool w_state_load() {
 
   std::optional<json_ref> state;
   try {
-    state = json_load_file(flags.watchman_state_file.c_str(), 0);
-  } catch (const std::system_error& exc) {
-    if (exc.code() == watchman::error_code::no_such_file_or_directory) {
-      // No need to alarm anyone if we've never written a state file
+    std::string data;
+    if (!folly::readFile(flags.watchman_state_file.c_str(), data)) {
+      if (errno == ENOENT) {
+        // No need to alarm anyone if we've never written a state file
+        return false;
+      }
+      log(ERR,
+          "failed to read ",
+          flags.watchman_state_file,
+          ": ",
+          folly::errnoStr(errno),
+          "\n");
       return false;
     }
-    logf(
-        ERR,
-        "failed to load json from {}: {}\n",
-        flags.watchman_state_file,
-        folly::exceptionStr(exc).toStdString());
-    return false;
+    state = decodeStateFile(data);
   } catch (const std::exception& exc) {
     logf(
         ERR,
-        "failed to parse json from {}: {}\n",
+        "failed to parse state from {}: {}\n",
         flags.watchman_state_file,
         folly::exceptionStr(exc).toStdString());
     return false;
@@ -112,31 +126,65 @@ bool w_state_load() {
 }
 
 static bool do_state_save() {
-  PduBuffer buffer;
+  std::string data;
+  try {
+    data = beginStateFile(json_object(
+        {{"version",
+          typed_string_to_json(PACKAGE_VERSION, W_STRING_UNICODE)}}));
 
-  auto state = json_object();
+    logf(DBG, "saving state\n");
 
-  auto file = w_stm_open(
-      flags.watchman_state_file.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0600);
-  if (!file) {
-    log(ERR,
-        "save_state: unable to open ",
-        flags.watchman_state_file,
-        " for write: ",
-        folly::errnoStr(errno),
-        "\n");
+    std::vector<std::shared_ptr<Root>> roots;
+    {
+      auto map = watched_roots.rlock();
+      for (const auto& it : *map) {
+        roots.push_back(it.second);
+      }
+    }
+
+    // Only roots whose triggers changed since the last save are
+    // re-encoded; roots that are no longer watched drop out.
+    std::unordered_map<w_string, RootRecord> records;
+    for (auto& root : roots) {
+      auto generation = root->stateGeneration.load(std::memory_order_acquire);
+      auto it = rootRecords.find(root->root_path);
+      if (it == rootRecords.end() || it->second.root.lock() != root ||
+          it->second.generation != generation) {
+        std::string bytes;
+        appendStateRecord(
+            bytes,
+            json_object(
+                {{"path", w_string_to_json(root->root_path)},
+                 {"triggers", root->triggerListToJson()},
+                 {"last_query",
+                  json_integer(root->lastQueryTime.load(
+                      std::memory_order_relaxed))}}));
+        it = rootRecords.insert_or_assign(
+            root->root_path, RootRecord{root, generation, std::move(bytes)})
+                 .first;
+      }
+      data.append(it->second.bytes);
+      records.emplace(root->root_path, std::move(it->second));
+    }
+    rootRecords = std::move(records);
+  } catch (const std::exception& exc) {
+    log(ERR, "save_state: ", exc.what(), "\n");
     return false;
   }
 
-  state.set("version", typed_string_to_json(PACKAGE_VERSION, W_STRING_UNICODE));
-
-  /* now ask the different subsystems to fill out the state */
-  if (!w_root_save_state(state)) {
+  // Write a new file and rename it over the old one, so that a crash
+  // mid-save never leaves a truncated state file behind.
+  try {
+    folly::writeFileAtomic(flags.watchman_state_file, data, 0600);
+  } catch (const std::system_error& exc) {
+    log(ERR,
+        "save_state: unable to write ",
+        flags.watchman_state_file,
+        ": ",
+        exc.what(),
+        "\n");
     return false;
   }
-
-  /* we've prepared what we're going to save, so write it out */
-  buffer.jsonEncodeToStream(state, file.get(), JSON_INDENT(4));
   return true;
 }
 
@@ -151,37 +199,88 @@ void w_state_save() {
   stateCond.notify_one();
 }
 
-bool w_root_save_state(json_ref& state) {
-  bool result = true;
+namespace {
 
-  std::vector<json_ref> watched_dirs;
+void restoreRoot(const json_ref& obj) {
+  bool created = false;
+  size_t j;
 
-  logf(DBG, "saving state\n");
+  auto triggers = obj.get("triggers");
+  auto path = json_object_get(obj, "path");
+  const char* filename = path ? json_string_value(*path) : nullptr;
 
-  {
-    auto map = watched_roots.rlock();
-    for (const auto& it : *map) {
-      auto root = it.second;
+  std::shared_ptr<Root> root;
+  try {
+    root = root_resolve(filename, true, &created);
+  } catch (const std::exception&) {
+    return;
+  }
 
-      auto obj = json_object();
+  if (auto lastQuery = obj.get_optional("last_query");
+      lastQuery && lastQuery->isInt()) {
+    root->lastQueryTime.store(lastQuery->asInt(), std::memory_order_relaxed);
+    root->lastQueryTimeSaved.store(
+        lastQuery->asInt(), std::memory_order_relaxed);
+    root->stateGeneration.fetch_add(1, std::memory_order_release);
+  }
 
-      json_object_set_new(obj, "path", w_string_to_json(root->root_path));
+  {
+    auto wlock = root->triggers.wlock();
+    auto& map = *wlock;
+
+    /* re-create the trigger configuration */
+    for (j = 0; j < json_array_size(triggers); j++) {
+      const auto& tobj = triggers.at(j);
 
-      auto triggers = root->triggerListToJson();
-      json_object_set_new(obj, "triggers", std::move(triggers));
+      // Legacy rules format
+      auto rarray = tobj.get_optional("rules");
+      if (rarray) {
+        continue;
+      }
 
-      watched_dirs.push_back(std::move(obj));
+      try {
+        auto cmd = std::make_unique<TriggerCommand>(getInterface, root, tobj);
+        cmd->start(root);
+        auto& mapEntry = map[cmd->triggername];
+        mapEntry = std::move(cmd);
+        root->stateGeneration.fetch_add(1, std::memory_order_release);
+      } catch (const std::exception& exc) {
+        watchman::log(
+            watchman::ERR,
+            "loading trigger for ",
+            root->root_path,
+            ": ",
+            exc.what(),
+            "\n");
+      }
     }
   }
 
-  json_object_set_new(state, "watched", json_array(std::move(watched_dirs)));
+  if (created && !root->viewOwner) {
+    try {
+      root->view()->startThreads(root);
+    } catch (const std::exception& e) {
+      watchman::log(
+          watchman::ERR,
+          "root_start(",
+          root->root_path,
+          ") failed: ",
+          e.what(),
+          "\n");
+      root->cancel(
+          fmt::format("Error starting threads for root: {}", e.what()));
+    }
+  }
+}
 
-  return result;
+json_int_t lastQueryOf(const json_ref& obj) {
+  auto lastQuery = obj.get_optional("last_query");
+  return lastQuery && lastQuery->isInt() ? lastQuery->asInt() : 0;
 }
 
-bool w_root_load_state(const json_ref& state) {
-  size_t i;
+} // namespace
 
+bool w_root_load_state(const json_ref& state) {
   auto watched = state.get_optional("watched");
   if (!watched) {
     return true;
@@ -191,68 +290,30 @@ bool w_root_load_state(const json_ref& state) {
     return false;
   }
 
-  for (i = 0; i < json_array_size(*watched); i++) {
-    const auto& obj = watched->at(i);
-    bool created = false;
-    size_t j;
-
-    auto triggers = obj.get("triggers");
-    auto path = json_object_get(obj, "path");
-    const char* filename = path ? json_string_value(*path) : nullptr;
-
-    std::shared_ptr<Root> root;
-    try {
-      root = root_resolve(filename, true, &created);
-    } catch (const std::exception&) {
-      continue;
-    }
-
-    {
-      auto wlock = root->triggers.wlock();
-      auto& map = *wlock;
-
-      /* re-create the trigger configuration */
-      for (j = 0; j < json_array_size(triggers); j++) {
-        const auto& tobj = triggers.at(j);
-
-        // Legacy rules format
-        auto rarray = tobj.get_optional("rules");
-        if (rarray) {
-          continue;
-        }
-
-        try {
-          auto cmd = std::make_unique<TriggerCommand>(getInterface, root, tobj);
-          cmd->start(root);
-          auto& mapEntry = map[cmd->triggername];
-          mapEntry = std::move(cmd);
-        } catch (const std::exception& exc) {
-          watchman::log(
-              watchman::ERR,
-              "loading trigger for ",
-              root->root_path,
-              ": ",
-              exc.what(),
-              "\n");
-        }
-      }
-    }
-
-    if (created) {
-      try {
-        root->view()->startThreads(root);
-      } catch (const std::exception& e) {
-        watchman::log(
-            watchman::ERR,
-            "root_start(",
-            root->root_path,
-            ") failed: ",
-            e.what(),
-            "\n");
-        root->cancel(
-            fmt::format("Error starting threads for root: {}", e.what()));
+  // Restore the most recently queried roots first, several at a time, so
+  // that the roots people are working in become queryable soonest.
+  std::vector<json_ref> roots = watched->array();
+  std::stable_sort(
+      roots.begin(), roots.end(), [](const json_ref& a, const json_ref& b) {
+        return lastQueryOf(a) > lastQueryOf(b);
+      });
+
+  auto concurrency = std::min<size_t>(
+      std::max<json_int_t>(cfg_get_int("root_restore_concurrency", 4), 1),
+      roots.size());
+  std::atomic<size_t> next{0};
+  std::vector<std::thread> threads;
+  threads.reserve(concurrency);
+  for (size_t t = 0; t < concurrency; ++t) {
+    threads.emplace_back([&, t] {
+      w_set_thread_name("restore ", t);
+      for (size_t i = next++; i < roots.size(); i = next++) {
+        restoreRoot(roots[i]);
       }
-    }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
   }
 
   return true;
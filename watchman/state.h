@@ -13,5 +13,4 @@ void w_state_shutdown();
 void w_state_save();
 bool w_state_load();
 
-bool w_root_save_state(json_ref& state);
 bool w_root_load_state(const json_ref& state);
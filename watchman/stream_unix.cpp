@@ -7,6 +7,7 @@
 
 #include <folly/SocketAddress.h>
 #include <folly/net/NetworkSocket.h>
+#include <algorithm>
 #include <memory>
 #include "watchman/Constants.h"
 #include "watchman/Logging.h"
@@ -24,11 +25,19 @@
 #ifdef HAVE_SYS_SOCKET_H
 #include <sys/socket.h> // @manual
 #endif
+#ifndef _WIN32
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h> // @manual
+#endif
 
 using namespace watchman;
 
 static const int kWriteTimeout = 60000;
 
+// Stays within the minimum IOV_MAX that POSIX guarantees
+static const int kMaxWriteBuffers = 16;
+
 namespace {
 // This trait allows w_poll_events to wait on either a PipeEvent or
 // a descriptor contained in a UnixStream
@@ -169,25 +178,30 @@ class UnixStream : public watchman_stream {
     return res.value();
   }
 
+  // Waits, up to timeoutMs, until the peer can accept more data
+  bool waitWritable(int timeoutMs = kWriteTimeout) {
+    struct pollfd pfd;
+    pfd.fd = fd.system_handle();
+    pfd.events = POLLOUT;
+#ifdef _WIN32
+    if (WSAPoll(&pfd, 1, timeoutMs) == 0) {
+      errno = map_win32_err(WSAGetLastError());
+      return false;
+    }
+#else
+    if (poll(&pfd, 1, timeoutMs) == 0) {
+      return false;
+    }
+#endif
+    return !(pfd.revents & (POLLERR | POLLHUP));
+  }
+
   int write(const void* buf, int size) override {
     if (blocking_) {
       int wrote = 0;
 
       while (size > 0) {
-        struct pollfd pfd;
-        pfd.fd = fd.system_handle();
-        pfd.events = POLLOUT;
-#ifdef _WIN32
-        if (WSAPoll(&pfd, 1, kWriteTimeout) == 0) {
-          errno = map_win32_err(WSAGetLastError());
-          break;
-        }
-#else
-        if (poll(&pfd, 1, kWriteTimeout) == 0) {
-          break;
-        }
-#endif
-        if (pfd.revents & (POLLERR | POLLHUP)) {
+        if (!waitWritable()) {
           break;
         }
         auto x = fd.write(buf, size);
@@ -224,10 +238,126 @@ class UnixStream : public watchman_stream {
     return x.value();
   }
 
+#ifndef _WIN32
+  int writev(const StreamBuffer* bufs, int count) override {
+    // Any further buffers are left for the caller's next call
+    struct iovec iov[kMaxWriteBuffers];
+    int n = std::min(count, kMaxWriteBuffers);
+    for (int i = 0; i < n; ++i) {
+      iov[i].iov_base = const_cast<void*>(bufs[i].data);
+      iov[i].iov_len = bufs[i].size;
+    }
+
+    if (!blocking_) {
+      auto x = ::writev(fd.fd(), iov, n);
+      if (x == -1) {
+        return -1;
+      }
+      errno = 0;
+      return static_cast<int>(x);
+    }
+
+    int wrote = 0;
+    struct iovec* cur = iov;
+    while (true) {
+      while (n > 0 && cur->iov_len == 0) {
+        ++cur;
+        --n;
+      }
+      if (n == 0 || !waitWritable()) {
+        break;
+      }
+      auto x = ::writev(fd.fd(), cur, n);
+      if (x == -1) {
+        break;
+      }
+      if (x == 0) {
+        errno = 0;
+        break;
+      }
+
+      wrote += static_cast<int>(x);
+      for (size_t left = x; left > 0;) {
+        auto step = std::min(left, cur->iov_len);
+        cur->iov_base = static_cast<char*>(cur->iov_base) + step;
+        cur->iov_len -= step;
+        left -= step;
+        if (cur->iov_len == 0) {
+          ++cur;
+          --n;
+        }
+      }
+    }
+    return wrote == 0 && n > 0 ? -1 : wrote;
+  }
+
+  bool canPassDescriptors() const override {
+    struct stat st;
+    return fstat(fd.fd(), &st) == 0 && S_ISSOCK(st.st_mode);
+  }
+
+  int writeWithDescriptor(
+      const void* buf,
+      int size,
+      const FileDescriptor& descriptor) override {
+    if (blocking_ && !waitWritable()) {
+      return -1;
+    }
+
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(buf);
+    iov.iov_len = size;
+
+    union {
+      struct cmsghdr hdr;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    int passed = descriptor.fd();
+    memcpy(CMSG_DATA(cmsg), &passed, sizeof(passed));
+
+    auto x = ::sendmsg(fd.fd(), &msg, 0);
+    if (x == -1) {
+      return -1;
+    }
+    errno = 0;
+    return static_cast<int>(x);
+  }
+#endif
+
   watchman_event* getEvents() override {
     return &evt;
   }
 
+  bool isWritable() override {
+    return waitWritable(0);
+  }
+
+  bool peerHasHungUp() override {
+#ifdef _WIN32
+    return false;
+#else
+    // A peer that only shut down its writing side still wants our response,
+    // and gets POLLRDHUP rather than POLLHUP.
+    struct pollfd pfd;
+    pfd.fd = fd.system_handle();
+    pfd.events = 0;
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & (POLLHUP | POLLERR));
+#endif
+  }
+
   void setNonBlock(bool nonb) override {
     if (nonb) {
       fd.setNonBlock();
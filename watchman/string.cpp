@@ -6,6 +6,7 @@
  */
 
 #include <stdarg.h>
+#include <cstring>
 #include <new>
 #include <ostream>
 #include <stdexcept>
@@ -39,6 +40,63 @@ static void w_string_delref(StringHeader* str);
 static StringHeader*
 w_string_new_len_typed(const char* str, uint32_t len, w_string_type_t type);
 
+namespace {
+
+// Case folding for file names is ASCII-only.  Unlike tolower(), these do not
+// depend on the process locale, and they avoid a function call per byte.
+
+inline char asciiToLower(char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c | 0x20) : c;
+}
+
+// Lowercases the ASCII uppercase letters in each of the 8 bytes of word,
+// leaving all other bytes untouched.  None of the additions can carry into
+// the neighbouring byte because the high bit of each byte is masked off.
+inline uint64_t asciiToLower8(uint64_t word) {
+  constexpr uint64_t kOnes = 0x0101010101010101ULL;
+  constexpr uint64_t kHighBits = kOnes * 0x80;
+  uint64_t low = word & ~kHighBits;
+  uint64_t atLeastA = low + kOnes * (0x80 - 'A');
+  uint64_t aboveZ = low + kOnes * (0x80 - 'Z' - 1);
+  uint64_t isUpper = atLeastA & ~aboveZ & ~word & kHighBits;
+  // 0x80 >> 2 == 0x20, the ASCII case bit
+  return word | (isUpper >> 2);
+}
+
+inline uint64_t loadWord(const char* p) {
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+void lowerCaseInto(const char* str, size_t len, char* buf) {
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+    auto word = asciiToLower8(loadWord(str + i));
+    memcpy(buf + i, &word, sizeof(word));
+  }
+  for (; i < len; ++i) {
+    buf[i] = asciiToLower(str[i]);
+  }
+}
+
+bool equalsCaseInsensitive(const char* a, const char* b, size_t len) {
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+    if (asciiToLower8(loadWord(a + i)) != asciiToLower8(loadWord(b + i))) {
+      return false;
+    }
+  }
+  for (; i < len; ++i) {
+    if (asciiToLower(a[i]) != asciiToLower(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
 // string piece
 
 w_string_piece::w_string_piece(w_string_piece&& other) noexcept
@@ -56,12 +114,19 @@ w_string w_string_piece::asLowerCase(w_string_type_t stringType) const {
   // allocation.
 
   uint32_t len = size();
-  return w_string::generate(len, stringType, [&](char* buf) {
-    for (uint32_t i = 0; i < len; ++i) {
-      // TODO: `tolower` depends on locale.
-      buf[i] = static_cast<char>(tolower(static_cast<unsigned char>(str_[i])));
-    }
-  });
+  return w_string::generate(
+      len, stringType, [&](char* buf) { lowerCaseInto(str_, len, buf); });
+}
+
+LowerCaseBuffer::LowerCaseBuffer(w_string_piece str) : size_{str.size()} {
+  if (size_ < kInlineSize) {
+    data_ = inline_;
+  } else {
+    heap_ = std::make_unique<char[]>(size_ + 1);
+    data_ = heap_.get();
+  }
+  lowerCaseInto(str.data(), size_, data_);
+  data_[size_] = 0;
 }
 
 std::optional<w_string> w_string_piece::asLowerCaseSuffix(
@@ -202,19 +267,7 @@ bool w_string_piece::startsWithCaseInsensitive(w_string_piece prefix) const {
     return false;
   }
 
-  auto me = str_;
-  auto pref = prefix.str_;
-
-  const char* const end = prefix.str_ + prefix.len_;
-  while (pref < end) {
-    // TODO: `tolower` depends on locale.
-    if (tolower((uint8_t)*me) != tolower((uint8_t)*pref)) {
-      return false;
-    }
-    ++pref;
-    ++me;
-  }
-  return true;
+  return equalsCaseInsensitive(str_, prefix.str_, prefix.len_);
 }
 
 // string
@@ -581,18 +634,10 @@ void w_string_delref(StringHeader* str) {
 }
 
 bool w_string_equal_caseless(w_string_piece a, w_string_piece b) {
-  uint32_t i;
-
   if (a.size() != b.size()) {
     return false;
   }
-  for (i = 0; i < a.size(); i++) {
-    // TODO: `tolower` depends on locale.
-    if (tolower((uint8_t)a[i]) != tolower((uint8_t)b[i])) {
-      return false;
-    }
-  }
-  return true;
+  return equalsCaseInsensitive(a.data(), b.data(), a.size());
 }
 
 bool w_string_piece::hasSuffix(w_string_piece suffix) const {
@@ -609,8 +654,7 @@ bool w_string_piece::hasSuffix(w_string_piece suffix) const {
   }
 
   for (i = 0; i < suffix.size(); i++) {
-    // TODO: `tolower` depends on locale.
-    if (tolower((uint8_t)str_[base + i]) != suffix[i]) {
+    if (asciiToLower(str_[base + i]) != suffix[i]) {
       return false;
     }
   }
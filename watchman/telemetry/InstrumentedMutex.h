@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+#include "watchman/telemetry/WatchmanStats.h"
+
+namespace watchman {
+
+namespace detail {
+inline std::atomic<bool> lockStatsEnabled{false};
+} // namespace detail
+
+/**
+ * Enables timing of InstrumentedMutex acquisitions; set from the
+ * lock_contention_stats option at startup.
+ */
+inline void setLockStatsEnabled(bool enabled) {
+  detail::lockStatsEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+inline bool lockStatsEnabled() {
+  return detail::lockStatsEnabled.load(std::memory_order_relaxed);
+}
+
+using LockDuration = StatsGroupBase::Duration LockStats::*;
+
+/**
+ * Wraps Mutex, for use with folly::Synchronized, to record in LockStats how
+ * long threads wait to acquire it and how long they then hold it. Nothing is
+ * timed unless lockStatsEnabled().
+ */
+template <typename Mutex, LockDuration Wait, LockDuration Hold>
+class InstrumentedMutex {
+ public:
+  void lock() {
+    if (!lockStatsEnabled()) {
+      mutex_.lock();
+      return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    mutex_.lock();
+    acquiredAt_ = std::chrono::steady_clock::now();
+    getWatchmanStats()->addDuration(Wait, acquiredAt_ - start);
+  }
+
+  bool try_lock() {
+    if (!mutex_.try_lock()) {
+      return false;
+    }
+    if (lockStatsEnabled()) {
+      acquiredAt_ = std::chrono::steady_clock::now();
+    }
+    return true;
+  }
+
+  void unlock() {
+    // Only the holder reads or writes acquiredAt_
+    auto acquiredAt = acquiredAt_;
+    acquiredAt_ = {};
+    mutex_.unlock();
+    if (acquiredAt != std::chrono::steady_clock::time_point{}) {
+      getWatchmanStats()->addDuration(
+          Hold, std::chrono::steady_clock::now() - acquiredAt);
+    }
+  }
+
+ protected:
+  Mutex mutex_;
+
+ private:
+  // Set while held if the acquisition was timed
+  std::chrono::steady_clock::time_point acquiredAt_;
+};
+
+/**
+ * InstrumentedMutex for a shared mutex. Readers are only timed while they
+ * wait: there may be any number of them holding the lock at once.
+ */
+template <typename Mutex, LockDuration Wait, LockDuration Hold>
+class InstrumentedSharedMutex : public InstrumentedMutex<Mutex, Wait, Hold> {
+ public:
+  void lock_shared() {
+    if (!lockStatsEnabled()) {
+      this->mutex_.lock_shared();
+      return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    this->mutex_.lock_shared();
+    getWatchmanStats()->addDuration(
+        Wait, std::chrono::steady_clock::now() - start);
+  }
+
+  bool try_lock_shared() {
+    return this->mutex_.try_lock_shared();
+  }
+
+  void unlock_shared() {
+    this->mutex_.unlock_shared();
+  }
+};
+
+} // namespace watchman
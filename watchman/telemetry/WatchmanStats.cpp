@@ -9,6 +9,9 @@
 
 #include <memory>
 
+#include <fb303/ServiceData.h>
+#include <folly/String.h>
+
 namespace watchman {
 
 void WatchmanStats::flush() {
@@ -19,6 +22,18 @@ void WatchmanStats::flush() {
   facebook::fb303::ServiceData::get()->getQuantileStatMap()->flushAll();
 }
 
+std::map<std::string, int64_t> WatchmanStats::getCounters() {
+  flush();
+  std::map<std::string, int64_t> counters;
+  for (auto& [name, value] :
+       facebook::fb303::ServiceData::get()->getCounters()) {
+    if (folly::StringPiece{name}.startsWith("watchman.")) {
+      counters.emplace(name, value);
+    }
+  }
+  return counters;
+}
+
 WatchmanStatsPtr getWatchmanStats() {
   // A running Watchman daemon only needs a single WatchmanStats instance. Avoid
   // atomic reference counts with RefPtr::singleton. We could use
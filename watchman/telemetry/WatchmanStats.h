@@ -7,7 +7,9 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
+#include <string>
 
 #include <folly/ThreadLocal.h>
 
@@ -20,6 +22,52 @@ namespace watchman {
 
 using StatsGroupBase = facebook::eden::StatsGroupBase;
 using TelemetryStats = facebook::eden::TelemetryStats;
+template <typename T>
+using StatsGroup = facebook::eden::StatsGroup<T>;
+
+/**
+ * Latency of each stage of the event and query pipelines. Stat names are
+ * dotted by pipeline and stage, and debug-stats reports them.
+ */
+struct PipelineStats : StatsGroup<PipelineStats> {
+  // From a watcher noticing a change to the IO thread processing it
+  Duration notifyToProcess{"watchman.events.notify_to_process_us"};
+  // The IO thread applying a batch of pending changes to the view
+  Duration applyPending{"watchman.events.apply_pending_us"};
+
+  Duration queryCookieSync{"watchman.query.cookie_sync_us"};
+  // Waiting for the QueryScheduler to admit the query
+  Duration queryQueueWait{"watchman.query.queue_wait_us"};
+  Duration queryViewLockWait{"watchman.query.view_lock_wait_us"};
+  Duration queryGenerate{"watchman.query.generate_us"};
+  Duration queryRender{"watchman.query.render_us"};
+
+  // Serializing a PDU for a client, trigger or the state file, and writing
+  // it out to the stream
+  Duration pduEncode{"watchman.pdu.encode_us"};
+  Duration pduWrite{"watchman.pdu.write_us"};
+
+  // Structured log events dropped because the queue to the logging thread
+  // was full
+  Counter structuredLogDropped{"watchman.telemetry.dropped_events"};
+};
+
+/**
+ * How long threads wait for, and then hold, the busiest locks. Only recorded
+ * with the lock_contention_stats option; see InstrumentedMutex.
+ */
+struct LockStats : StatsGroup<LockStats> {
+  Duration viewWait{"watchman.lock.view.wait_us"};
+  Duration viewHold{"watchman.lock.view.hold_us"};
+  Duration pendingWait{"watchman.lock.pending.wait_us"};
+  Duration pendingHold{"watchman.lock.pending.hold_us"};
+  Duration settlesWait{"watchman.lock.pending_settles.wait_us"};
+  Duration settlesHold{"watchman.lock.pending_settles.hold_us"};
+  Duration cookiesWait{"watchman.lock.cookies.wait_us"};
+  Duration cookiesHold{"watchman.lock.cookies.hold_us"};
+  Duration lruCacheWait{"watchman.lock.lru_cache.wait_us"};
+  Duration lruCacheHold{"watchman.lock.lru_cache.hold_us"};
+};
 
 class WatchmanStats : public facebook::eden::RefCounted {
  public:
@@ -46,6 +94,12 @@ class WatchmanStats : public facebook::eden::RefCounted {
    */
   void flush();
 
+  /**
+   * Returns the current value of every exported watchman stat, keyed by
+   * name. Flushes first.
+   */
+  std::map<std::string, int64_t> getCounters();
+
   template <typename T>
   T& getStatsForCurrentThread() = delete;
 
@@ -56,6 +110,8 @@ class WatchmanStats : public facebook::eden::RefCounted {
   using ThreadLocal = folly::ThreadLocal<T, ThreadLocalTag, void>;
 
   ThreadLocal<TelemetryStats> telemetryStats_;
+  ThreadLocal<PipelineStats> pipelineStats_;
+  ThreadLocal<LockStats> lockStats_;
 };
 
 using WatchmanStatsPtr = facebook::eden::RefPtr<WatchmanStats>;
@@ -66,6 +122,16 @@ WatchmanStats::getStatsForCurrentThread<TelemetryStats>() {
   return *telemetryStats_.get();
 }
 
+template <>
+inline PipelineStats& WatchmanStats::getStatsForCurrentThread<PipelineStats>() {
+  return *pipelineStats_.get();
+}
+
+template <>
+inline LockStats& WatchmanStats::getStatsForCurrentThread<LockStats>() {
+  return *lockStats_.get();
+}
+
 WatchmanStatsPtr getWatchmanStats();
 
 } // namespace watchman
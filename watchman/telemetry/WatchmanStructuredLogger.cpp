@@ -7,7 +7,9 @@
 
 #include "watchman/telemetry/WatchmanStructuredLogger.h"
 
+#include <vector>
 #include "eden/common/telemetry/StructuredLoggerFactory.h"
+#include "watchman/Logging.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/telemetry/WatchmanStats.h"
 
@@ -18,7 +20,82 @@ using UserInfo = facebook::eden::UserInfo;
 WatchmanStructuredLogger::WatchmanStructuredLogger(
     std::shared_ptr<ScribeLogger> scribeLogger,
     SessionInfo sessionInfo)
-    : ScubaStructuredLogger{std::move(scribeLogger), std::move(sessionInfo)} {}
+    : ScubaStructuredLogger{std::move(scribeLogger), std::move(sessionInfo)} {
+  if (!cfg_get_bool("structured_logging_async", true)) {
+    return;
+  }
+  async_ = std::make_unique<AsyncState>(
+      std::max<json_int_t>(
+          1, cfg_get_int("structured_logging_queue_size", 4096)),
+      std::max<json_int_t>(
+          1, cfg_get_int("structured_logging_batch_size", 64)),
+      std::chrono::milliseconds{std::max<json_int_t>(
+          0, cfg_get_int("structured_logging_flush_interval_ms", 1000))});
+  async_->drainer = std::thread([this] {
+    w_set_thread_name("structlog");
+    drainAsync();
+  });
+}
+
+WatchmanStructuredLogger::~WatchmanStructuredLogger() {
+  if (async_) {
+    async_->queue.blockingWrite(nullptr);
+    async_->drainer.join();
+  }
+}
+
+void WatchmanStructuredLogger::logDynamicEvent(DynamicEvent event) {
+  if (!async_) {
+    ScubaStructuredLogger::logDynamicEvent(std::move(event));
+    return;
+  }
+  if (!async_->queue.write(std::make_unique<DynamicEvent>(std::move(event)))) {
+    async_->dropped.fetch_add(1, std::memory_order_relaxed);
+    getWatchmanStats()->increment(&PipelineStats::structuredLogDropped);
+  }
+}
+
+void WatchmanStructuredLogger::drainAsync() {
+  std::vector<std::unique_ptr<DynamicEvent>> batch;
+  batch.reserve(async_->batchSize);
+  uint64_t reportedDropped = 0;
+  bool stopping = false;
+
+  while (!stopping) {
+    std::unique_ptr<DynamicEvent> event;
+    async_->queue.blockingRead(event);
+    if (!event) {
+      break;
+    }
+    batch.push_back(std::move(event));
+
+    // Gather more events for the batch until it is full or it is time to
+    // flush what we have.
+    auto deadline = std::chrono::steady_clock::now() + async_->flushInterval;
+    while (batch.size() < async_->batchSize &&
+           async_->queue.tryReadUntil(deadline, event)) {
+      if (!event) {
+        stopping = true;
+        break;
+      }
+      batch.push_back(std::move(event));
+    }
+
+    for (auto& queued : batch) {
+      ScubaStructuredLogger::logDynamicEvent(std::move(*queued));
+    }
+    batch.clear();
+
+    auto dropped = async_->dropped.load(std::memory_order_relaxed);
+    if (dropped != reportedDropped) {
+      log(ERR,
+          "dropped ",
+          dropped - reportedDropped,
+          " structured log events because the queue was full\n");
+      reportedDropped = dropped;
+    }
+  }
+}
 
 std::shared_ptr<StructuredLogger> getLogger() {
   static std::shared_ptr<StructuredLogger> logger = facebook::eden::
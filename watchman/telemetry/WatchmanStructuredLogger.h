@@ -7,6 +7,11 @@
 
 #pragma once
 
+#include <folly/MPMCQueue.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
 #include "eden/common/telemetry/ScribeLogger.h"
 #include "eden/common/telemetry/ScubaStructuredLogger.h"
 #include "eden/common/telemetry/SessionInfo.h"
@@ -20,16 +25,50 @@ using ScribeLogger = facebook::eden::ScribeLogger;
 using ScubaStructuredLogger = facebook::eden::ScubaStructuredLogger;
 using StructuredLogger = facebook::eden::StructuredLogger;
 
+/**
+ * Logs structured events to scribe.
+ *
+ * Unless `structured_logging_async` is disabled, events are handed to a
+ * bounded queue rather than encoded and written by the thread that logs
+ * them, so that telemetry stays off the query and IO paths.  A background
+ * thread encodes and writes them in batches.  Events logged while the queue
+ * is full are dropped and counted.
+ */
 class WatchmanStructuredLogger : public ScubaStructuredLogger {
  public:
   explicit WatchmanStructuredLogger(
       std::shared_ptr<ScribeLogger> scribeLogger,
       SessionInfo sessionInfo);
-  virtual ~WatchmanStructuredLogger() override = default;
+  // Writes out the queued events
+  virtual ~WatchmanStructuredLogger() override;
 
  protected:
   virtual DynamicEvent populateDefaultFields(
       std::optional<const char*> type) override;
+
+  void logDynamicEvent(DynamicEvent event) override;
+
+ private:
+  struct AsyncState {
+    AsyncState(
+        size_t queueSize,
+        size_t batchSize,
+        std::chrono::milliseconds flushInterval)
+        : queue{queueSize},
+          batchSize{batchSize},
+          flushInterval{flushInterval} {}
+
+    // A null event asks the drainer to stop
+    folly::MPMCQueue<std::unique_ptr<DynamicEvent>> queue;
+    const size_t batchSize;
+    const std::chrono::milliseconds flushInterval;
+    std::atomic<uint64_t> dropped{0};
+    std::thread drainer;
+  };
+
+  void drainAsync();
+
+  std::unique_ptr<AsyncState> async_;
 };
 
 std::shared_ptr<StructuredLogger> getLogger();
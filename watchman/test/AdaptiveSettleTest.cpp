@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/AdaptiveSettle.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+TEST(AdaptiveSettleTest, starts_at_minimum) {
+  AdaptiveSettle settle{20ms, 1000ms};
+  EXPECT_EQ(20ms, settle.settlePeriod());
+}
+
+TEST(AdaptiveSettleTest, grows_with_gaps_in_a_burst) {
+  AdaptiveSettle settle{20ms, 1000ms};
+  for (int i = 0; i < 50; ++i) {
+    settle.noteIdleGap(50ms);
+  }
+  EXPECT_EQ(100ms, settle.settlePeriod());
+
+  // Shorter pauses bring the period back down gradually
+  settle.noteIdleGap(10ms);
+  EXPECT_GT(settle.settlePeriod(), 20ms);
+  EXPECT_LT(settle.settlePeriod(), 100ms);
+}
+
+TEST(AdaptiveSettleTest, stays_within_bounds) {
+  AdaptiveSettle settle{20ms, 300ms};
+  for (int i = 0; i < 50; ++i) {
+    settle.noteIdleGap(250ms);
+  }
+  EXPECT_EQ(300ms, settle.settlePeriod());
+
+  for (int i = 0; i < 50; ++i) {
+    settle.noteIdleGap(1ms);
+  }
+  EXPECT_EQ(20ms, settle.settlePeriod());
+}
+
+TEST(AdaptiveSettleTest, resets_after_quiet_spell) {
+  AdaptiveSettle settle{20ms, 1000ms};
+  settle.noteIdleGap(200ms);
+  EXPECT_EQ(400ms, settle.settlePeriod());
+  settle.noteIdleGap(5000ms);
+  EXPECT_EQ(20ms, settle.settlePeriod());
+}
@@ -5,6 +5,7 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
 #include <fcntl.h>
 #include <fmt/core.h>
 #include <folly/logging/xlog.h>
@@ -12,6 +13,7 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <vector>
 #include "watchman/watchman_system.h"
 
 #include "watchman/thirdparty/libart/src/art.h"
@@ -230,6 +232,33 @@ TEST(Art, insert_iter) {
   }
 }
 
+TEST(Art, iter_order_with_high_bytes) {
+  art_tree<int> t;
+  std::vector<std::string> keys;
+  // Enough children under one node to make it a Node16, with bytes on both
+  // sides of 0x80
+  for (int c : {0x01, 0x7f, 0x80, 0xff, 0x20, 0xc3, 0x41, 0x90, 0x10}) {
+    keys.push_back(std::string("a") + char(c));
+    t.insert(keys.back(), c);
+  }
+  std::sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) {
+    return (unsigned char)a[1] < (unsigned char)b[1];
+  });
+
+  std::vector<std::string> order;
+  t.iter([&](const std::string& key, int&) {
+    order.push_back(key);
+    return 0;
+  });
+  EXPECT_EQ(keys, order);
+
+  for (auto& key : keys) {
+    auto value = t.search(key);
+    ASSERT_NE(nullptr, value);
+    EXPECT_EQ((unsigned char)key[1], *value);
+  }
+}
+
 template <typename T>
 struct prefix_data {
   int count;
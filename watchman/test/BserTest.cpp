@@ -8,6 +8,7 @@
 #include "watchman/bser.h"
 #include <fmt/core.h>
 #include <folly/ScopeGuard.h>
+#include <folly/compression/Compression.h>
 #include <folly/logging/xlog.h>
 #include <folly/portability/GTest.h>
 #include "watchman/thirdparty/jansson/jansson_private.h"
@@ -114,6 +115,15 @@ struct {
      "]",
      "[\"name\", \"age\"]"},
     {"[{}, {}, {}, {}, {}]", "[]"},
+    {"["
+     "{\"dir\": true, \"mtime\": 1700000000, \"name\": \"src/a.cpp\", "
+     "\"size\": 9223372036854775807}, "
+     "{\"dir\": false, \"mtime\": 1700000005, \"name\": \"src/ab.cpp\", "
+     "\"size\": -9223372036854775808}, "
+     "{\"dir\": true, \"mtime\": 1699999990, \"name\": \"src\", "
+     "\"size\": 0}"
+     "]",
+     "[\"name\", \"dir\", \"mtime\", \"size\"]"},
 };
 
 struct {
@@ -164,6 +174,11 @@ void check_roundtrip(
   EXPECT_TRUE(json_equal(expected.value(), decoded))
       << "round-tripped json_equal: " << jdump;
   EXPECT_EQ(jdump, input) << "round-tripped";
+
+  auto viewed = BserView::parse(dump_buf->data(), end).toJson();
+  EXPECT_TRUE(json_equal(expected.value(), viewed))
+      << "BserView round-tripped: "
+      << json_dumps(viewed, JSON_ENCODE_ANY | JSON_SORT_KEYS);
 }
 
 void check_serialization(
@@ -300,6 +315,11 @@ TEST(Bser, bser_tests) {
         BSER_CAP_DISABLE_UNICODE | BSER_CAP_DISABLE_UNICODE_FOR_ERRORS,
         template_tests[i].json_text,
         template_tests[i].template_text);
+    check_roundtrip(
+        2,
+        BSER_CAP_COLUMNS,
+        template_tests[i].json_text,
+        template_tests[i].template_text);
   }
 
   for (int i = 0; i < num_serial; i++) {
@@ -478,6 +498,10 @@ TEST(Bser, fuzz_examples) {
         bunser(data.get(), data.get() + input.size());
       } catch (const BserParseError&) {
       }
+      try {
+        BserView::parse(data.get(), data.get() + input.size()).toJson();
+      } catch (const BserParseError&) {
+      }
     }
   }
 }
@@ -491,6 +515,278 @@ TEST(Bser, detect_array_stack_overflow) {
     str += rec;
   }
   EXPECT_THROW((bunser(str.data(), str.data() + str.size())), BserParseTooDeep);
+  EXPECT_THROW(
+      (BserView::parse(str.data(), str.data() + str.size())), BserParseTooDeep);
+}
+
+TEST(Bser, view_accesses_fields_without_decoding) {
+  json_error_t jerr;
+  auto input = json_loads(
+      "[{\"name\": \"fred\", \"age\": 20}, {\"age\": 30}, \"x\", 1.5, null]",
+      0,
+      &jerr);
+  ASSERT_TRUE(input) << jerr.text;
+  auto plain = bdumps(2, 0, input.value());
+  ASSERT_TRUE(plain);
+
+  auto view = BserView::parse(plain->data(), plain->data() + plain->size());
+  ASSERT_TRUE(view.isArray());
+  EXPECT_EQ(5, view.size());
+  EXPECT_EQ("fred", view.at(0).get("name")->asString());
+  EXPECT_EQ(20, view.at(0).get("age")->asInt());
+  EXPECT_FALSE(view.at(1).get("name"));
+  EXPECT_EQ("x", view.at(2).asString());
+  EXPECT_EQ(1.5, view.at(3).asReal());
+  EXPECT_TRUE(view.at(4).isNull());
+  EXPECT_THROW(view.at(5), std::out_of_range);
+  EXPECT_THROW(view.at(2).asInt(), std::domain_error);
+
+  // The same rows, encoded as a template
+  json_array_set_template_new(
+      input.value(), json_loads("[\"name\", \"age\"]", 0, &jerr).value());
+  auto templated = bdumps(2, 0, input.value());
+  ASSERT_TRUE(templated);
+
+  auto tview =
+      BserView::parse(templated->data(), templated->data() + templated->size());
+  ASSERT_TRUE(tview.isArray());
+  EXPECT_EQ(5, tview.size());
+  ASSERT_TRUE(tview.at(0).isObject());
+  EXPECT_EQ(2, tview.at(0).size());
+  EXPECT_EQ("fred", tview.at(0).get("name")->asString());
+  EXPECT_EQ(30, tview.at(1).get("age")->asInt());
+  EXPECT_EQ(1, tview.at(1).size());
+  EXPECT_FALSE(tview.at(1).get("name"));
+  EXPECT_TRUE(json_equal(
+      bunser(templated->data(), templated->data() + templated->size()),
+      tview.toJson()));
+
+  // Truncated documents are rejected up front
+  EXPECT_THROW(
+      BserView::parse(plain->data(), plain->data() + plain->size() - 1),
+      BserParseError);
+}
+
+TEST(Bser, template_rows_match_templated_objects) {
+  auto templ = json_array(
+      {typed_string_to_json("name", W_STRING_UNICODE),
+       typed_string_to_json("exists", W_STRING_UNICODE),
+       typed_string_to_json("size", W_STRING_UNICODE)});
+
+  for (uint32_t version : {1, 2}) {
+    auto objects = json_array(
+        {json_object(
+             {{"name", typed_string_to_json("foo.txt", W_STRING_UNICODE)},
+              {"exists", json_true()},
+              {"size", json_integer(70000)}}),
+         json_object(
+             {{"name", typed_string_to_json("bar", W_STRING_BYTE)},
+              {"exists", json_false()},
+              {"size", json_integer(12)}})});
+    json_array_set_template_new(objects, json_ref(templ));
+
+    auto rows = std::make_shared<BserTemplateRows>(version, 0);
+    rows->appendString(w_string{"foo.txt", W_STRING_UNICODE});
+    rows->appendBool(true);
+    rows->appendInt(70000);
+    rows->commitRow();
+    // An abandoned partial row leaves no trace
+    rows->appendString(w_string{"partial", W_STRING_UNICODE});
+    rows->abandonRow();
+    rows->appendString(w_string{"bar", W_STRING_BYTE});
+    rows->appendJson(json_false());
+    rows->appendInt(12);
+    rows->commitRow();
+    EXPECT_EQ(2, rows->size());
+
+    auto encoded = json_array({});
+    json_array_set_template_new(encoded, json_ref(templ));
+    json_array_set_bser_rows(encoded, rows);
+
+    auto expected = bdumps(version, 0, objects);
+    auto actual = bdumps(version, 0, encoded);
+    ASSERT_TRUE(expected);
+    ASSERT_TRUE(actual);
+    EXPECT_EQ(*expected, *actual) << "version " << version;
+
+    // The rows can't be written with a different encoding, or as JSON
+    EXPECT_EQ(nullptr, bdumps(version, BSER_CAP_DISABLE_UNICODE, encoded));
+    EXPECT_THROW(json_dumps(encoded, 0), std::runtime_error);
+  }
+}
+
+TEST(Bser, rows_without_template_match_plain_arrays) {
+  for (uint32_t version : {1, 2}) {
+    auto names = json_array(
+        {typed_string_to_json("top", W_STRING_BYTE),
+         typed_string_to_json("dir/file.txt", W_STRING_BYTE),
+         typed_string_to_json("last", W_STRING_BYTE)});
+
+    auto rows = std::make_shared<BserTemplateRows>(version, 0);
+    rows->appendPath(w_string_piece{}, "top");
+    rows->commitRow();
+    rows->appendPath("dir", "file.txt");
+    rows->commitRow();
+
+    // Rows come ahead of the values in the array
+    auto encoded = json_array({typed_string_to_json("last", W_STRING_BYTE)});
+    json_array_set_bser_rows(encoded, rows);
+
+    auto expected = bdumps(version, 0, names);
+    auto actual = bdumps(version, 0, encoded);
+    ASSERT_TRUE(expected);
+    ASSERT_TRUE(actual);
+    EXPECT_EQ(*expected, *actual) << "version " << version;
+    EXPECT_EQ(nullptr, bdumps(version, BSER_CAP_DISABLE_UNICODE, encoded));
+  }
+}
+
+TEST(Bser, columns_encode_each_kind_compactly) {
+  auto str = [](const char* s) {
+    return typed_string_to_json(s, W_STRING_BYTE);
+  };
+  auto file = [&](const char* name, bool exists, json_int_t size) {
+    return json_object(
+        {{"name", str(name)},
+         {"exists", json_boolean(exists)},
+         {"size", json_integer(size)}});
+  };
+  auto templ = json_array({str("name"), str("exists"), str("size")});
+  auto objects = json_array(
+      {file("ab", true, 300), file("abc", false, 310), file("b", true, 290)});
+  json_array_set_template_new(objects, json_ref(templ));
+
+  auto encoded = bdumps(2, BSER_CAP_COLUMNS, objects);
+  ASSERT_TRUE(encoded);
+  EXPECT_EQ(
+      S("\x0e\x00\x03\x03\x02\x03\x04"
+        "name"
+        "\x02\x03\x06"
+        "exists"
+        "\x02\x03\x04"
+        "size"
+        "\x03\x03"
+        // Names: shared prefix lengths, suffix lengths, then the suffixes
+        "\x02\x03\x00\x02\x00\x03\x02\x01\x01"
+        "abcb"
+        // Exists: a bitset
+        "\x08\x05"
+        // Sizes: the differences from the previous size
+        "\x04\x2c\x01\x0a\x00\xec\xff"),
+      *encoded);
+  auto end = encoded->data() + encoded->size();
+  EXPECT_TRUE(json_equal(objects, bunser(encoded->data(), end)));
+  EXPECT_EQ(3, BserView::parse(encoded->data(), end).size());
+
+  // Rows encoded as they were rendered produce the same columns
+  auto rows = std::make_shared<BserTemplateRows>(2, BSER_CAP_COLUMNS);
+  for (auto& obj : objects.array()) {
+    rows->appendJson(*obj.get_optional("name"));
+    rows->appendJson(*obj.get_optional("exists"));
+    rows->appendJson(*obj.get_optional("size"));
+    rows->commitRow();
+  }
+  auto fromRows = json_array({});
+  json_array_set_template_new(fromRows, json_ref(templ));
+  json_array_set_bser_rows(fromRows, rows);
+  auto rowsEncoded = bdumps(2, BSER_CAP_COLUMNS, fromRows);
+  ASSERT_TRUE(rowsEncoded);
+  EXPECT_EQ(*encoded, *rowsEncoded);
+
+  // Version 1 has no capabilities, so it keeps using templates
+  auto v1 = bdumps(1, BSER_CAP_COLUMNS, objects);
+  ASSERT_TRUE(v1);
+  EXPECT_EQ('\x0b', (*v1)[0]);
+
+  // A name can't share more than the whole of the previous one
+  auto bad = *encoded;
+  bad[bad.find(S("\x02\x03\x00\x02\x00")) + 3] = 3;
+  EXPECT_THROW(bunser(bad.data(), bad.data() + bad.size()), BserParseError);
+  EXPECT_THROW(
+      BserView::parse(bad.data(), bad.data() + bad.size()), BserParseError);
+
+  // Truncated columns are rejected
+  EXPECT_THROW(bunser(encoded->data(), end - 1), BserParseError);
+}
+
+TEST(Bser, large_values_are_compressed_when_offered) {
+  using folly::compression::CodecType;
+  if (!folly::compression::hasCodec(CodecType::ZSTD)) {
+    GTEST_SKIP() << "folly was built without zstd";
+  }
+
+  std::vector<json_ref> names;
+  for (int i = 0; i < 20000; ++i) {
+    auto name = fmt::format("dir{}/file{}.txt", i / 100, i);
+    names.push_back(w_string_to_json(w_string{name}));
+  }
+  auto files = json_array(std::move(names));
+  auto writePdu = [&](uint32_t capabilities, const json_ref& value) {
+    std::string pdu;
+    EXPECT_EQ(
+        0, w_bser_write_pdu(2, capabilities, dump_to_string, value, &pdu));
+    // Skip the magic and capabilities
+    size_t needed;
+    auto len = bunser_int(pdu.data() + 6, pdu.size() - 6, &needed);
+    EXPECT_TRUE(len.has_value());
+    EXPECT_EQ(pdu.size() - 6 - needed, size_t(len.value_or(0)));
+    return pdu.substr(6 + needed);
+  };
+
+  auto plain = writePdu(0, files);
+  auto compressed = writePdu(BSER_CAP_COMPRESSED, files);
+  ASSERT_EQ('\x0f', compressed[0]);
+  EXPECT_LT(compressed.size(), plain.size() / 4);
+
+  // The codec, the uncompressed length and the compressed length
+  std::vector<json_int_t> ints;
+  size_t pos = 1;
+  for (int i = 0; i < 3; ++i) {
+    size_t needed;
+    auto value = bunser_int(
+        compressed.data() + pos, compressed.size() - pos, &needed);
+    ASSERT_TRUE(value.has_value());
+    ints.push_back(*value);
+    pos += needed;
+  }
+  EXPECT_EQ(1, ints[0]);
+  EXPECT_EQ(json_int_t(plain.size()), ints[1]);
+  EXPECT_EQ(json_int_t(compressed.size() - pos), ints[2]);
+  auto uncompressed = folly::compression::getCodec(CodecType::ZSTD)
+                          ->uncompress(
+                              folly::StringPiece{compressed}.subpiece(pos),
+                              uint64_t(ints[1]));
+  EXPECT_EQ(plain, uncompressed);
+
+  // Small values aren't worth it
+  auto small = json_array({w_string_to_json("foo.txt")});
+  EXPECT_EQ(writePdu(0, small), writePdu(BSER_CAP_COMPRESSED, small));
+}
+
+TEST(Bser, cached_array_encodings_are_reused) {
+  auto file = json_object({{"name", w_string_to_json("foo.txt")}});
+  auto files = json_array({file});
+  auto expectedBser = bdumps(2, 0, files);
+  auto expectedJson = json_dumps(files, JSON_COMPACT);
+  ASSERT_TRUE(expectedBser);
+
+  json_array_enable_encoding_cache(files);
+  auto bser = bdumps(2, 0, files);
+  ASSERT_TRUE(bser);
+  EXPECT_EQ(*expectedBser, *bser);
+  EXPECT_EQ(expectedJson, json_dumps(files, JSON_COMPACT));
+
+  // Later encodings copy the cached bytes rather than look at the values
+  json_object_set(file, "name", w_string_to_json("bar.txt"));
+  bser = bdumps(2, 0, files);
+  ASSERT_TRUE(bser);
+  EXPECT_EQ(*expectedBser, *bser);
+  EXPECT_EQ(expectedJson, json_dumps(files, JSON_COMPACT));
+
+  // Each BSER version and set of capabilities is encoded separately
+  auto v1 = bdumps(1, 0, files);
+  ASSERT_TRUE(v1);
+  EXPECT_NE(std::string::npos, v1->find("bar.txt"));
 }
 
 } // namespace
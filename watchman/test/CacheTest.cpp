@@ -151,6 +151,49 @@ TEST(CacheTest, future) {
       << "cache should still be full (no excess) but has " << cache.size();
 }
 
+TEST(CacheTest, sharded) {
+  using Cache = ShardedLRUCache<int, int>;
+  using Node = typename Cache::NodeType;
+
+  Cache small(5, kErrorTTL);
+  EXPECT_EQ(small.numShards(), 1) << "small caches are not split";
+
+  Cache cache(1024, kErrorTTL, std::chrono::seconds(300), 8);
+  EXPECT_EQ(cache.numShards(), 8);
+
+  for (int i = 0; i < 2048; ++i) {
+    EXPECT_NE(cache.set(i, int(i)), nullptr) << "inserted";
+  }
+  EXPECT_LE(cache.size(), 1024) << "limit is respected across shards";
+  EXPECT_TRUE(cache.get(2047)) << "most recent item survives";
+  EXPECT_EQ(cache.get(0), nullptr) << "oldest item was evicted";
+
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.cacheStore, 2048);
+  EXPECT_EQ(stats.size, cache.size());
+
+  cache.clear();
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(cache.stats().clearCount, 1);
+
+  folly::ManualExecutor exec;
+  auto now = std::chrono::steady_clock::now();
+  auto failGetter = [&exec](int k) {
+    return folly::makeFuture(k).via(&exec).thenTry(
+        [](folly::Try<int>&&) -> int { throw std::runtime_error("bleet"); });
+  };
+
+  auto f = cache.get(1, failGetter, now);
+  exec.drain();
+  EXPECT_TRUE(std::move(f).get()->result().hasException());
+
+  // The error is remembered until its TTL has passed
+  std::shared_ptr<const Node> node = cache.get(1, now);
+  ASSERT_NE(node, nullptr);
+  EXPECT_TRUE(node->result().hasException());
+  EXPECT_EQ(cache.get(1, now + kErrorTTL), nullptr) << "error expired";
+}
+
 int main(int argc, char* argv[]) {
   testing::InitGoogleTest(&argc, argv);
   folly::init(&argc, &argv);
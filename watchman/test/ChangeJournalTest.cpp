@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ChangeJournal.h"
+#include <folly/FileUtil.h>
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <string>
+
+using namespace watchman;
+
+namespace {
+
+ClockSpec::Clock makeWriter(int pid, ClockRoot root, ClockTicks ticks) {
+  return ClockSpec::Clock{1000, pid, ClockPosition{root, ticks}};
+}
+
+} // namespace
+
+TEST(ChangeJournal, missing_journal) {
+  folly::test::TemporaryDirectory dir;
+  auto path = (dir.path() / "journal").string();
+  EXPECT_FALSE(ChangeJournal::read(path.c_str()).has_value());
+}
+
+TEST(ChangeJournal, round_trip) {
+  folly::test::TemporaryDirectory dir;
+  w_string path{(dir.path() / "journal").string().c_str()};
+
+  ChangeJournal journal{path};
+  EXPECT_FALSE(journal.isOpen());
+  // Ignored until the journal is reset
+  journal.append(5, 100, "ignored", true);
+
+  journal.reset(10, makeWriter(1, 7, 10));
+  EXPECT_TRUE(journal.isOpen());
+  journal.append(11, 101, "foo/bar", true);
+  journal.append(12, 102, "baz", false);
+  journal.flush(13);
+
+  auto contents = ChangeJournal::read(path.c_str());
+  ASSERT_TRUE(contents.has_value());
+  EXPECT_FALSE(contents->closedCleanly);
+
+  journal.flush(14, /*close=*/true);
+  EXPECT_FALSE(journal.isOpen());
+
+  contents = ChangeJournal::read(path.c_str());
+  ASSERT_TRUE(contents.has_value());
+  EXPECT_TRUE(contents->closedCleanly);
+  EXPECT_EQ(10, contents->snapshotTicks);
+  EXPECT_EQ(14, contents->lastTicks);
+  ASSERT_EQ(1, contents->writers.size());
+  EXPECT_EQ(1, contents->writers[0].pid);
+  EXPECT_EQ(7, contents->writers[0].position.rootNumber);
+  ASSERT_EQ(2, contents->changes.size());
+  EXPECT_EQ(11, contents->changes[0].ticks);
+  EXPECT_EQ(101, contents->changes[0].timestamp);
+  EXPECT_EQ(w_string{"foo/bar"}, contents->changes[0].path);
+  EXPECT_TRUE(contents->changes[0].exists);
+  EXPECT_EQ(w_string{"baz"}, contents->changes[1].path);
+  EXPECT_FALSE(contents->changes[1].exists);
+}
+
+TEST(ChangeJournal, resume_records_new_writer) {
+  folly::test::TemporaryDirectory dir;
+  w_string path{(dir.path() / "journal").string().c_str()};
+
+  {
+    ChangeJournal journal{path};
+    journal.reset(10, makeWriter(1, 7, 10));
+    journal.append(11, 101, "a", true);
+    journal.flush(11, /*close=*/true);
+  }
+  {
+    ChangeJournal journal{path};
+    journal.resume(makeWriter(2, 3, 12));
+    journal.append(12, 102, "b", true);
+    journal.flush(12, /*close=*/true);
+  }
+
+  auto contents = ChangeJournal::read(path.c_str());
+  ASSERT_TRUE(contents.has_value());
+  ASSERT_EQ(2, contents->writers.size());
+  EXPECT_EQ(2, contents->writers[1].pid);
+  EXPECT_EQ(12, contents->writers[1].position.ticks);
+  ASSERT_EQ(2, contents->changes.size());
+  EXPECT_EQ(12, contents->lastTicks);
+  EXPECT_TRUE(contents->closedCleanly);
+}
+
+TEST(ChangeJournal, reset_drops_changes_in_snapshot) {
+  folly::test::TemporaryDirectory dir;
+  w_string path{(dir.path() / "journal").string().c_str()};
+
+  ChangeJournal journal{path};
+  journal.reset(10, makeWriter(1, 7, 10));
+  journal.append(11, 101, "old", true);
+  journal.append(13, 103, "new", true);
+  // A snapshot at tick 12 has the first change but not the second
+  journal.reset(12, makeWriter(1, 7, 12));
+  journal.flush(13);
+
+  auto contents = ChangeJournal::read(path.c_str());
+  ASSERT_TRUE(contents.has_value());
+  EXPECT_EQ(12, contents->snapshotTicks);
+  ASSERT_EQ(1, contents->changes.size());
+  EXPECT_EQ(w_string{"new"}, contents->changes[0].path);
+}
+
+TEST(ChangeJournal, torn_record_ends_journal) {
+  folly::test::TemporaryDirectory dir;
+  auto pathStr = (dir.path() / "journal").string();
+  w_string path{pathStr.c_str()};
+
+  {
+    ChangeJournal journal{path};
+    journal.reset(10, makeWriter(1, 7, 10));
+    journal.append(11, 101, "kept", true);
+    journal.flush(11);
+    journal.append(12, 102, "torn", true);
+    journal.flush(12, /*close=*/true);
+  }
+
+  std::string data;
+  ASSERT_TRUE(folly::readFile(pathStr.c_str(), data));
+  // Cut the last record in half
+  data.resize(data.size() - 20);
+  ASSERT_TRUE(folly::writeFile(data, pathStr.c_str()));
+
+  auto contents = ChangeJournal::read(path.c_str());
+  ASSERT_TRUE(contents.has_value());
+  ASSERT_EQ(2, contents->changes.size());
+  EXPECT_EQ(w_string{"torn"}, contents->changes[1].path);
+  // Only the record of the clean shutdown at tick 12 was cut
+  EXPECT_EQ(11, contents->lastTicks);
+  EXPECT_FALSE(contents->closedCleanly);
+}
@@ -5,10 +5,12 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <fmt/core.h>
 #include <folly/portability/GTest.h>
 #include <folly/test/TestUtils.h>
 #include <list>
 #include "watchman/ChildProcess.h"
+#include "watchman/SpawnHelper.h"
 #include "watchman/watchman_system.h"
 
 using watchman::ChildProcess;
@@ -100,3 +102,28 @@ TEST(ChildProcess, inputThreaded) {
 TEST(ChildProcess, inputNotThreaded) {
   test_pipe_input(false);
 }
+
+TEST(ChildProcess, spawnHelper) {
+#ifdef __linux__
+  // Leaves the helper running for the rest of the tests, which then spawn
+  // through it too.
+  ASSERT_TRUE(watchman::SpawnHelper::start());
+
+  Options opts;
+  opts.pipeStdout();
+  opts.nullStderr();
+  opts.chdir("/");
+  opts.setFlags(POSIX_SPAWN_SETPGROUP);
+  ChildProcess proc(
+      {"/bin/sh", "-c", "echo $PPID; pwd; echo ignored >&2"}, std::move(opts));
+  auto outputs = proc.communicate();
+  EXPECT_EQ(0, proc.wait());
+  // The helper made the child ours, so that we can wait for it
+  EXPECT_EQ(fmt::format("{}\n/\n", getpid()), outputs.first.value().view());
+
+  Options badOpts;
+  EXPECT_THROW(
+      ChildProcess({"/nonexistent/command"}, std::move(badOpts)),
+      std::system_error);
+#endif
+}
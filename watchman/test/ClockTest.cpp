@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/Clock.h"
+#include <folly/portability/GTest.h>
+#include <folly/portability/Unistd.h>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+using namespace watchman;
+
+namespace {
+
+class ClockTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ClockSpec::init();
+  }
+};
+
+} // namespace
+
+TEST_F(ClockTest, clock_strings_round_trip) {
+  ClockPosition position{3, 12345};
+  auto str = position.toClockString();
+  // A second request for the same position is served from the cache
+  EXPECT_EQ(str, position.toClockString());
+
+  ClockSpec spec{w_string_to_json(str)};
+  auto* clock = std::get_if<ClockSpec::Clock>(&spec.spec);
+  ASSERT_NE(nullptr, clock);
+  EXPECT_EQ(::getpid(), clock->pid);
+  EXPECT_EQ(3, clock->position.rootNumber);
+  EXPECT_EQ(12345, clock->position.ticks);
+  EXPECT_EQ(str, ClockSpec{position}.position().toClockString());
+
+  EXPECT_NE(str, ClockPosition(3, 12346).toClockString());
+}
+
+TEST_F(ClockTest, clock_id_string_fits_buffer) {
+  char buf[128];
+  ASSERT_TRUE(clock_id_string(1, 2, buf, sizeof(buf)));
+  EXPECT_EQ(ClockPosition(1, 2).toClockString(), w_string{buf});
+
+  auto len = strlen(buf);
+  EXPECT_TRUE(clock_id_string(1, 2, buf, len + 1));
+  EXPECT_FALSE(clock_id_string(1, 2, buf, len));
+}
+
+TEST_F(ClockTest, parses_clocks_of_other_instances) {
+  ClockSpec spec{typed_string_to_json("c:100:42:7:9")};
+  auto* clock = std::get_if<ClockSpec::Clock>(&spec.spec);
+  ASSERT_NE(nullptr, clock);
+  EXPECT_EQ(100, clock->start_time);
+  EXPECT_EQ(42, clock->pid);
+  EXPECT_EQ(7, clock->position.rootNumber);
+  EXPECT_EQ(9, clock->position.ticks);
+
+  ClockSpec oldStyle{typed_string_to_json("c:42:9")};
+  clock = std::get_if<ClockSpec::Clock>(&oldStyle.spec);
+  ASSERT_NE(nullptr, clock);
+  EXPECT_EQ(0, clock->start_time);
+  EXPECT_EQ(9, clock->position.ticks);
+}
+
+TEST_F(ClockTest, rejects_invalid_clocks) {
+  EXPECT_THROW(ClockSpec{typed_string_to_json("c:nope")}, std::domain_error);
+  EXPECT_THROW(ClockSpec{typed_string_to_json("x:1:2")}, std::domain_error);
+}
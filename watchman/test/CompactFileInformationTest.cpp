@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <utility>
+#include "watchman/watchman_file.h"
+
+using namespace watchman;
+
+namespace {
+
+FileInformation makeInfo() {
+  FileInformation info;
+#ifndef _WIN32
+  info.mode = S_IFREG | 0644;
+#else
+  info.mode = _S_IFREG;
+#endif
+  info.size = 123456;
+  info.uid = 1000;
+  info.gid = 100;
+  info.ino = 4242;
+  info.dev = 7;
+  info.nlink = 1;
+  info.atime = {1700000000, 1};
+  info.mtime = {1700000001, 999999999};
+  info.ctime = {1700000002, 500};
+  return info;
+}
+
+void expectSame(const FileInformation& a, const FileInformation& b) {
+  EXPECT_EQ(a.mode, b.mode);
+  EXPECT_EQ(a.size, b.size);
+  EXPECT_EQ(a.uid, b.uid);
+  EXPECT_EQ(a.gid, b.gid);
+  EXPECT_EQ(a.ino, b.ino);
+  EXPECT_EQ(a.dev, b.dev);
+  EXPECT_EQ(a.nlink, b.nlink);
+  for (auto [x, y] : {std::pair{a.atime, b.atime},
+                      std::pair{a.mtime, b.mtime},
+                      std::pair{a.ctime, b.ctime}}) {
+    EXPECT_EQ(x.tv_sec, y.tv_sec);
+    EXPECT_EQ(x.tv_nsec, y.tv_nsec);
+  }
+}
+
+} // namespace
+
+TEST(CompactFileInformationTest, smaller_than_file_information) {
+  EXPECT_LT(sizeof(CompactFileInformation), sizeof(FileInformation));
+}
+
+TEST(CompactFileInformationTest, default_decodes_to_zero) {
+  CompactFileInformation compact;
+  expectSame(FileInformation{}, compact.decode());
+}
+
+TEST(CompactFileInformationTest, round_trips) {
+  auto info = makeInfo();
+  CompactFileInformation compact;
+  compact = info;
+  EXPECT_FALSE(compact.isSpilled());
+  expectSame(info, compact.decode());
+  EXPECT_TRUE(compact.isFile());
+  EXPECT_FALSE(compact.isDir());
+  EXPECT_EQ(info.size, compact.size());
+  EXPECT_EQ(info.mtime.tv_nsec, compact.mtime().tv_nsec);
+
+  // Another owner gets its own entry in the table
+  info.uid = 1001;
+  compact = info;
+  EXPECT_FALSE(compact.isSpilled());
+  expectSame(info, compact.decode());
+}
+
+TEST(CompactFileInformationTest, spills_values_that_dont_fit) {
+  auto info = makeInfo();
+  info.mtime.tv_sec = -1;
+  CompactFileInformation compact;
+  compact = info;
+  EXPECT_TRUE(compact.isSpilled());
+  expectSame(info, compact.decode());
+  EXPECT_EQ(-1, compact.mtime().tv_sec);
+  EXPECT_EQ(info.size, compact.size());
+
+  // Values that fit again are packed once more
+  auto packed = makeInfo();
+  compact = packed;
+  EXPECT_FALSE(compact.isSpilled());
+  expectSame(packed, compact.decode());
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/CompiledGlob.h"
+#include <folly/portability/GTest.h>
+#include <string>
+#include <vector>
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+
+using namespace watchman;
+
+namespace {
+
+const std::vector<std::string> kPatterns = {
+    "",
+    "foo",
+    "Foo.c",
+    "a/b/foo.c",
+    "a//b",
+    ".hidden",
+    "*",
+    "*.c",
+    "*.C",
+    "*c",
+    "*/foo.c",
+    "*.c/",
+    "**",
+    "*.*",
+    "a/**",
+    "a/b/**",
+    "a**",
+    "A/**",
+    "**/*.c",
+    "**/*",
+    "**/foo.c",
+    "**/.hidden",
+    "**/*/foo.c",
+    "a/*.c",
+    "?oo",
+    "[fb]oo",
+    "foo\\*",
+    "a/***",
+    "**/b",
+    "a/**/foo.c",
+    "[[:alpha:]]oo",
+    "b*/*.c",
+    "[]]x",
+};
+
+const std::vector<std::string> kTexts = {
+    "",
+    "foo",
+    "FOO",
+    "foo.c",
+    "Foo.c",
+    ".c",
+    ".foo.c",
+    "c",
+    "a",
+    "a/",
+    "a/b",
+    "a/b/",
+    "a/foo.c",
+    "a/.foo.c",
+    ".a/foo.c",
+    "a/.b/foo.c",
+    ".a/.hidden",
+    "a/b/foo.c",
+    "A/b/foo.c",
+    "a//b",
+    "b/a/foo.c",
+    "ab/c",
+    ".hidden",
+    "foo*",
+    "boo",
+    "b",
+    "x/b",
+    "]x",
+    "boo/x.c",
+};
+
+} // namespace
+
+TEST(CompiledGlob, matches_like_wildmatch) {
+  for (int flags = 0; flags <= (WM_CASEFOLD | WM_PATHNAME | WM_PERIOD |
+                                WM_NOESCAPE);
+       ++flags) {
+    for (const auto& pattern : kPatterns) {
+      CompiledGlob glob(pattern, flags);
+      for (const auto& text : kTexts) {
+        bool expected =
+            wildmatch(pattern.c_str(), text.c_str(), flags, nullptr) ==
+            WM_MATCH;
+        EXPECT_EQ(glob.match(text), expected)
+            << "pattern [" << pattern << "] text [" << text << "] flags "
+            << flags;
+      }
+    }
+  }
+}
+
+TEST(CompiledGlob, shared_by_pattern_and_flags) {
+  auto a = CompiledGlob::get("*.c", WM_PATHNAME);
+  EXPECT_EQ(a, CompiledGlob::get("*.c", WM_PATHNAME));
+  EXPECT_NE(a, CompiledGlob::get("*.c", WM_PATHNAME | WM_CASEFOLD));
+  EXPECT_NE(a, CompiledGlob::get("*.h", WM_PATHNAME));
+  EXPECT_EQ(a->pattern(), "*.c");
+}
+
+TEST(CompiledGlob, may_match_inside_agrees_with_wildmatch) {
+  for (int flags = WM_PATHNAME; flags <= (WM_CASEFOLD | WM_PATHNAME |
+                                          WM_PERIOD | WM_NOESCAPE);
+       ++flags) {
+    if (!(flags & WM_PATHNAME)) {
+      continue;
+    }
+    for (const auto& pattern : kPatterns) {
+      CompiledGlob glob(pattern, flags);
+      for (const auto& text : kTexts) {
+        auto slash = text.rfind('/');
+        if (slash == std::string::npos ||
+            glob.mayMatchInside(std::string_view(text).substr(0, slash))) {
+          continue;
+        }
+        EXPECT_NE(
+            WM_MATCH, wildmatch(pattern.c_str(), text.c_str(), flags, nullptr))
+            << "pattern [" << pattern << "] text [" << text << "] flags "
+            << flags;
+      }
+    }
+  }
+
+  EXPECT_FALSE(CompiledGlob("**/*.c", WM_PATHNAME | WM_PERIOD)
+                   .mayMatchInside("a/.git"));
+  EXPECT_TRUE(CompiledGlob("**/*.c", WM_PATHNAME).mayMatchInside("a/.git"));
+}
+
+TEST(CompiledGlobSet, matches_like_any_pattern) {
+  // Every run of consecutive patterns, so that each kind of pattern is
+  // combined with the others
+  std::vector<std::vector<std::string>> sets;
+  for (size_t begin = 0; begin < kPatterns.size(); ++begin) {
+    for (size_t end = begin + 1; end <= kPatterns.size(); ++end) {
+      sets.emplace_back(kPatterns.begin() + begin, kPatterns.begin() + end);
+    }
+  }
+
+  for (int flags = 0; flags <= (WM_CASEFOLD | WM_PATHNAME | WM_PERIOD |
+                                WM_NOESCAPE);
+       ++flags) {
+    for (const auto& patterns : sets) {
+      CompiledGlobSet globs(patterns, flags);
+      for (const auto& text : kTexts) {
+        bool expected = false;
+        for (const auto& pattern : patterns) {
+          expected = expected ||
+              wildmatch(pattern.c_str(), text.c_str(), flags, nullptr) ==
+                  WM_MATCH;
+        }
+        EXPECT_EQ(globs.match(text), expected)
+            << "patterns [" << patterns.front() << "] to ["
+            << patterns.back() << "] text [" << text << "] flags " << flags;
+      }
+    }
+  }
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ContentHashStore.h"
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <string>
+
+#ifndef _WIN32
+
+using namespace watchman;
+
+namespace {
+
+ContentHashStore::HashValue makeHash(uint8_t seed) {
+  ContentHashStore::HashValue hash;
+  for (size_t i = 0; i < hash.size(); ++i) {
+    hash[i] = uint8_t(seed + i);
+  }
+  return hash;
+}
+
+ContentHashStoreKey
+makeKey(w_string_piece path, uint64_t size, time_t sec, uint64_t ino) {
+  ContentHashStoreKey key{path, size, {}, ino};
+  key.mtime.tv_sec = sec;
+  key.mtime.tv_nsec = 42;
+  return key;
+}
+
+} // namespace
+
+TEST(ContentHashStore, round_trip) {
+  folly::test::TemporaryDirectory dir;
+  auto path = (dir.path() / "store").string();
+  ContentHashStore store(path, 128);
+  EXPECT_EQ(store.capacity(), 128);
+
+  auto key = makeKey("/root/foo", 10, 1000, 7);
+  EXPECT_FALSE(store.lookup(key).has_value());
+
+  store.store(key, makeHash(1));
+  auto found = store.lookup(key);
+  ASSERT_TRUE(found.has_value());
+  EXPECT_EQ(*found, makeHash(1));
+
+  store.store(key, makeHash(2));
+  EXPECT_EQ(*store.lookup(key), makeHash(2));
+}
+
+TEST(ContentHashStore, metadata_mismatch) {
+  folly::test::TemporaryDirectory dir;
+  auto path = (dir.path() / "store").string();
+  ContentHashStore store(path, 128);
+
+  store.store(makeKey("/root/foo", 10, 1000, 7), makeHash(1));
+
+  EXPECT_FALSE(store.lookup(makeKey("/root/foo", 11, 1000, 7)).has_value())
+      << "size differs";
+  EXPECT_FALSE(store.lookup(makeKey("/root/foo", 10, 1001, 7)).has_value())
+      << "mtime differs";
+  EXPECT_FALSE(store.lookup(makeKey("/root/foo", 10, 1000, 8)).has_value())
+      << "inode differs";
+  EXPECT_FALSE(store.lookup(makeKey("/root/bar", 10, 1000, 7)).has_value())
+      << "path differs";
+}
+
+TEST(ContentHashStore, persists_across_reopen) {
+  folly::test::TemporaryDirectory dir;
+  auto path = (dir.path() / "store").string();
+  auto key = makeKey("/root/foo", 10, 1000, 7);
+
+  {
+    ContentHashStore store(path, 128);
+    store.store(key, makeHash(3));
+  }
+  {
+    ContentHashStore store(path, 128);
+    auto found = store.lookup(key);
+    ASSERT_TRUE(found.has_value());
+    EXPECT_EQ(*found, makeHash(3));
+  }
+  {
+    // A different capacity discards the old table
+    ContentHashStore store(path, 256);
+    EXPECT_FALSE(store.lookup(key).has_value());
+  }
+}
+
+TEST(ContentHashStore, evicts_when_full) {
+  folly::test::TemporaryDirectory dir;
+  auto path = (dir.path() / "store").string();
+  ContentHashStore store(path, 64);
+
+  for (uint8_t i = 0; i < 255; ++i) {
+    auto name = std::to_string(i);
+    store.store(makeKey(name, i, 1000, i), makeHash(i));
+  }
+
+  // The most recently stored entry always survives
+  auto found = store.lookup(makeKey("254", 254, 1000, 254));
+  ASSERT_TRUE(found.has_value());
+  EXPECT_EQ(*found, makeHash(254));
+}
+
+#endif
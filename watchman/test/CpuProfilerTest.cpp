@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CpuProfiler.h"
+
+#include <fmt/core.h>
+#include <folly/portability/GTest.h>
+#include <algorithm>
+
+using namespace watchman;
+
+namespace {
+
+// The top level fields of an encoded profile that these tests look at
+struct DecodedProfile {
+  size_t numSamples{0};
+  size_t numLocations{0};
+  size_t numFunctions{0};
+  std::vector<std::string> strings;
+  uint64_t period{0};
+};
+
+uint64_t readVarint(std::string_view& data) {
+  uint64_t value = 0;
+  for (int shift = 0;; shift += 7) {
+    auto byte = uint8_t(data.front());
+    data.remove_prefix(1);
+    value |= uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+}
+
+DecodedProfile decode(std::string_view data) {
+  DecodedProfile profile;
+  while (!data.empty()) {
+    auto tag = readVarint(data);
+    auto field = tag >> 3;
+    if ((tag & 7) == 0) {
+      auto value = readVarint(data);
+      if (field == 12) {
+        profile.period = value;
+      }
+      continue;
+    }
+    EXPECT_EQ(2, tag & 7);
+    auto len = readVarint(data);
+    auto bytes = data.substr(0, len);
+    data.remove_prefix(len);
+    switch (field) {
+      case 2:
+        ++profile.numSamples;
+        break;
+      case 4:
+        ++profile.numLocations;
+        break;
+      case 5:
+        ++profile.numFunctions;
+        break;
+      case 6:
+        profile.strings.emplace_back(bytes);
+        break;
+    }
+  }
+  return profile;
+}
+
+bool contains(const std::vector<std::string>& strings, std::string_view str) {
+  return std::find(strings.begin(), strings.end(), str) != strings.end();
+}
+
+} // namespace
+
+TEST(CpuProfilerTest, samples_and_symbols_are_shared) {
+  size_t symbolized = 0;
+  PprofBuilder builder{
+      std::chrono::milliseconds{10}, [&](uintptr_t address, bool) {
+        ++symbolized;
+        return PprofBuilder::Frame{
+            // Two addresses in each function
+            fmt::format("func{}", address / 2),
+            "file.cpp",
+            int64_t(address)};
+      }};
+
+  uintptr_t first[] = {1, 2, 4};
+  uintptr_t second[] = {3, 2, 4};
+  builder.addSample(first, 3, "io 1");
+  builder.addSample(first, 3, "io 1");
+  builder.addSample(first, 3, "notify 1");
+  builder.addSample(second, 3, "io 1");
+
+  auto profile = decode(builder.encode(
+      std::chrono::system_clock::now(), std::chrono::seconds{1}));
+  // The repeated sample is counted once with a value of 2
+  EXPECT_EQ(3, profile.numSamples);
+  // The leaf frames differ; 2 and 4 are shared
+  EXPECT_EQ(4, profile.numLocations);
+  EXPECT_EQ(4, symbolized);
+  // func0, func1 (for both 2 and 3) and func2
+  EXPECT_EQ(3, profile.numFunctions);
+  EXPECT_EQ(10000000, profile.period);
+
+  ASSERT_FALSE(profile.strings.empty());
+  EXPECT_EQ("", profile.strings[0]);
+  EXPECT_TRUE(contains(profile.strings, "io 1"));
+  EXPECT_TRUE(contains(profile.strings, "notify 1"));
+  EXPECT_TRUE(contains(profile.strings, "thread"));
+  EXPECT_TRUE(contains(profile.strings, "file.cpp"));
+}
+
+TEST(CpuProfilerTest, unsymbolized_addresses_are_named_by_address) {
+  PprofBuilder builder{
+      std::chrono::milliseconds{10},
+      [](uintptr_t, bool) { return PprofBuilder::Frame{}; }};
+  uintptr_t stack[] = {0x1234};
+  builder.addSample(stack, 1, "client");
+
+  auto profile = decode(builder.encode(
+      std::chrono::system_clock::now(), std::chrono::seconds{1}));
+  EXPECT_TRUE(contains(profile.strings, "0x1234"));
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "watchman/DirChildMap.h"
+
+using namespace watchman;
+
+namespace {
+using Map = DirChildMap<std::unique_ptr<std::string>>;
+
+// Insert a value that owns the key memory, as watchman_dir does.
+std::string* insert(Map& map, const std::string& name) {
+  auto value = std::make_unique<std::string>(name);
+  w_string_piece key{value->data(), value->size()};
+  auto& slot = map[key];
+  slot = std::move(value);
+  return slot.get();
+}
+
+std::string* lookup(const Map& map, const std::string& name) {
+  auto it = map.find(w_string_piece{name.data(), name.size()});
+  if (it == map.end()) {
+    return nullptr;
+  }
+  return it->second.get();
+}
+} // namespace
+
+TEST(DirChildMapTest, small_mode) {
+  Map map;
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(nullptr, lookup(map, "nope"));
+
+  for (int i = 0; i < int(Map::kSmallCapacity); ++i) {
+    insert(map, std::to_string(i));
+  }
+  EXPECT_EQ(Map::kSmallCapacity, map.size());
+  for (int i = 0; i < int(Map::kSmallCapacity); ++i) {
+    auto* found = lookup(map, std::to_string(i));
+    ASSERT_NE(nullptr, found);
+    EXPECT_EQ(std::to_string(i), *found);
+  }
+
+  EXPECT_EQ(1, map.erase(w_string_piece{"3"}));
+  EXPECT_EQ(0, map.erase(w_string_piece{"3"}));
+  EXPECT_EQ(nullptr, lookup(map, "3"));
+  EXPECT_EQ(Map::kSmallCapacity - 1, map.size());
+}
+
+TEST(DirChildMapTest, grows_into_hash_mode_and_erases) {
+  Map map;
+  std::map<std::string, bool> expected;
+  for (int i = 0; i < 1000; ++i) {
+    auto name = "file" + std::to_string(i);
+    insert(map, name);
+    expected[name] = true;
+  }
+  EXPECT_EQ(1000, map.size());
+
+  // Remove every third entry to exercise backward-shift deletion.
+  for (int i = 0; i < 1000; i += 3) {
+    auto name = "file" + std::to_string(i);
+    EXPECT_EQ(1, map.erase(w_string_piece{name.data(), name.size()}));
+    expected.erase(name);
+  }
+  EXPECT_EQ(expected.size(), map.size());
+
+  for (int i = 0; i < 1000; ++i) {
+    auto name = "file" + std::to_string(i);
+    auto* found = lookup(map, name);
+    if (expected.count(name)) {
+      ASSERT_NE(nullptr, found) << name;
+      EXPECT_EQ(name, *found);
+    } else {
+      EXPECT_EQ(nullptr, found) << name;
+    }
+  }
+
+  size_t iterated = 0;
+  for (auto& it : map) {
+    EXPECT_TRUE(expected.count(*it.second));
+    EXPECT_EQ(it.first.size(), it.second->size());
+    ++iterated;
+  }
+  EXPECT_EQ(expected.size(), iterated);
+}
+
+TEST(DirChildMapTest, operator_brackets_finds_existing) {
+  Map map;
+  auto* first = insert(map, "a");
+  auto& again = map[w_string_piece{"a"}];
+  EXPECT_EQ(first, again.get());
+  EXPECT_EQ(1, map.size());
+}
+
+TEST(DirChildMapTest, reserve_preserves_contents) {
+  Map map;
+  insert(map, "x");
+  insert(map, "y");
+  map.reserve(100);
+  EXPECT_EQ(2, map.size());
+  EXPECT_NE(nullptr, lookup(map, "x"));
+  EXPECT_NE(nullptr, lookup(map, "y"));
+  for (int i = 0; i < 100; ++i) {
+    insert(map, std::to_string(i));
+  }
+  EXPECT_EQ(102, map.size());
+  EXPECT_NE(nullptr, lookup(map, "x"));
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GMock.h>
+#include <folly/portability/GTest.h>
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryExpr.h"
+#include "watchman/query/TermRegistry.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+
+using namespace watchman;
+using namespace testing;
+
+namespace {
+std::optional<std::pair<std::string, uint32_t>> expr_to_depth_bound(
+    std::string expression_json) {
+  json_error_t err{};
+  auto expression = json_loads(expression_json.c_str(), JSON_DECODE_ANY, &err);
+  if (!expression.has_value()) {
+    ADD_FAILURE() << "JSON parse error in fixture: " << err.text << " at "
+                  << err.source << ":" << err.line << ":" << err.column;
+    return std::nullopt;
+  }
+  Query query;
+  query.case_sensitive = CaseSensitivity::CaseSensitive;
+  auto expr = watchman::parseQueryExpr(&query, *expression);
+  auto bound = expr->computeDirDepthBound();
+  if (!bound) {
+    return std::nullopt;
+  }
+  return std::make_pair(bound->dirname.string(), bound->maxDepth);
+}
+} // namespace
+
+TEST(DirDepthBoundTest, dirname_depth) {
+  EXPECT_THAT(
+      expr_to_depth_bound(R"( ["dirname", "foo", ["depth", "eq", 0]] )"),
+      Optional(Pair("foo", 0)));
+  EXPECT_THAT(
+      expr_to_depth_bound(R"( ["dirname", "foo/", ["depth", "le", 2]] )"),
+      Optional(Pair("foo", 2)));
+  EXPECT_THAT(
+      expr_to_depth_bound(R"( ["dirname", "", ["depth", "lt", 2]] )"),
+      Optional(Pair("", 1)));
+}
+
+TEST(DirDepthBoundTest, unbounded_dirname) {
+  EXPECT_THAT(expr_to_depth_bound(R"( ["dirname", "foo"] )"), Eq(std::nullopt));
+  EXPECT_THAT(
+      expr_to_depth_bound(R"( ["dirname", "foo", ["depth", "ge", 2]] )"),
+      Eq(std::nullopt));
+  EXPECT_THAT(
+      expr_to_depth_bound(R"( ["dirname", "foo", ["depth", "lt", 0]] )"),
+      Eq(std::nullopt));
+  EXPECT_THAT(
+      expr_to_depth_bound(R"( ["idirname", "foo", ["depth", "eq", 0]] )"),
+      Eq(std::nullopt));
+}
+
+TEST(DirDepthBoundTest, compound_expressions) {
+  EXPECT_THAT(
+      expr_to_depth_bound(
+          R"( ["allof", ["dirname", "foo", ["depth", "le", 3]],
+                        ["dirname", "foo/bar", ["depth", "eq", 1]],
+                        ["suffix", "h"]] )"),
+      Optional(Pair("foo/bar", 1)));
+  EXPECT_THAT(
+      expr_to_depth_bound(
+          R"( ["anyof", ["dirname", "foo", ["depth", "le", 3]],
+                        ["dirname", "foo", ["depth", "eq", 1]]] )"),
+      Optional(Pair("foo", 3)));
+  EXPECT_THAT(
+      expr_to_depth_bound(
+          R"( ["anyof", ["dirname", "foo", ["depth", "eq", 0]],
+                        ["dirname", "bar", ["depth", "eq", 0]]] )"),
+      Eq(std::nullopt));
+  EXPECT_THAT(
+      expr_to_depth_bound(
+          R"( ["not", ["dirname", "foo", ["depth", "eq", 0]]] )"),
+      Eq(std::nullopt));
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/EventTrace.h"
+#include <folly/FileUtil.h>
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <string>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+TEST(EventTrace, round_trip) {
+  folly::test::TemporaryDirectory dir;
+  auto path = (dir.path() / "trace").string();
+  auto wallNow = std::chrono::system_clock::now();
+  auto start = std::chrono::steady_clock::now();
+
+  EventTraceWriter writer{path.c_str(), w_string{"/root"}, 100};
+  {
+    PendingChanges changes;
+    changes.add(w_string{"/root"}, wallNow, W_PENDING_RECURSIVE);
+    EXPECT_TRUE(writer.record(start, changes));
+  }
+  {
+    PendingChanges changes;
+    changes.add(w_string{"/root/foo/bar"}, wallNow, W_PENDING_VIA_NOTIFY);
+    changes.add(w_string{"/root/baz"}, wallNow, W_PENDING_VIA_NOTIFY);
+    EXPECT_TRUE(writer.record(start + 25ms, changes));
+  }
+  EXPECT_EQ(3, writer.close());
+
+  auto batches = readEventTrace(path.c_str());
+  ASSERT_EQ(2, batches.size());
+  EXPECT_EQ(0ns, batches[0].offset);
+  ASSERT_EQ(1, batches[0].changes.size());
+  EXPECT_EQ(w_string{""}, batches[0].changes[0].path);
+  EXPECT_EQ(W_PENDING_RECURSIVE, batches[0].changes[0].flags);
+
+  EXPECT_EQ(25ms, batches[1].offset);
+  ASSERT_EQ(2, batches[1].changes.size());
+  // Most recently added first
+  EXPECT_EQ(w_string{"baz"}, batches[1].changes[0].path);
+  EXPECT_EQ(w_string{"foo/bar"}, batches[1].changes[1].path);
+  EXPECT_EQ(W_PENDING_VIA_NOTIFY, batches[1].changes[1].flags);
+}
+
+TEST(EventTrace, stops_at_max_changes) {
+  folly::test::TemporaryDirectory dir;
+  auto path = (dir.path() / "trace").string();
+  auto now = std::chrono::steady_clock::now();
+
+  EventTraceWriter writer{path.c_str(), w_string{"/root"}, 2};
+  PendingChanges changes;
+  changes.add(w_string{"/root/a"}, {}, W_PENDING_VIA_NOTIFY);
+  changes.add(w_string{"/root/b"}, {}, W_PENDING_VIA_NOTIFY);
+  changes.add(w_string{"/root/c"}, {}, W_PENDING_VIA_NOTIFY);
+  EXPECT_FALSE(writer.record(now, changes));
+  EXPECT_FALSE(writer.record(now + 1s, changes));
+  EXPECT_EQ(2, writer.close());
+
+  auto batches = readEventTrace(path.c_str());
+  ASSERT_EQ(1, batches.size());
+  EXPECT_EQ(2, batches[0].changes.size());
+}
+
+TEST(EventTrace, torn_record_ends_the_trace) {
+  folly::test::TemporaryDirectory dir;
+  auto path = (dir.path() / "trace").string();
+
+  EventTraceWriter writer{path.c_str(), w_string{"/root"}, 100};
+  PendingChanges changes;
+  changes.add(w_string{"/root/a"}, {}, W_PENDING_VIA_NOTIFY);
+  writer.record(std::chrono::steady_clock::now(), changes);
+  writer.close();
+
+  std::string data;
+  ASSERT_TRUE(folly::readFile(path.c_str(), data));
+  data.pop_back();
+  ASSERT_TRUE(folly::writeFile(data, path.c_str()));
+  EXPECT_TRUE(readEventTrace(path.c_str()).empty());
+}
+
+TEST(EventTrace, rejects_other_files) {
+  folly::test::TemporaryDirectory dir;
+  auto path = (dir.path() / "trace").string();
+  ASSERT_TRUE(folly::writeFile(std::string{"not a trace"}, path.c_str()));
+  EXPECT_THROW(readEventTrace(path.c_str()), std::runtime_error);
+}
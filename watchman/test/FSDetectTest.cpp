@@ -132,3 +132,15 @@ TEST(FSType, fstype_two_entries) {
       find_fstype_in_linux_proc_mounts(
           "/data/users/wez/fbsourcenoslash", mount_data_btrfs));
 }
+
+TEST(FSType, network_types) {
+  using watchman::isNetworkFileSystemType;
+  EXPECT_TRUE(isNetworkFileSystemType("nfs"));
+  EXPECT_TRUE(isNetworkFileSystemType("nfs4"));
+  EXPECT_TRUE(isNetworkFileSystemType("cifs"));
+  EXPECT_TRUE(isNetworkFileSystemType("fuse.sshfs"));
+  EXPECT_FALSE(isNetworkFileSystemType("btrfs"));
+  EXPECT_FALSE(isNetworkFileSystemType("fuse"));
+  EXPECT_FALSE(isNetworkFileSystemType("edenfs"));
+  EXPECT_FALSE(isNetworkFileSystemType(""));
+}
@@ -107,6 +107,64 @@ TEST(Ignore, correctness) {
   run_correctness_test(&state, tests, sizeof(tests) / sizeof(tests[0]));
 }
 
+TEST(Ignore, incremental_matches_full_path) {
+  IgnoreSet state;
+  init_state(&state);
+
+  auto top = state.match("baz/foo/bar");
+  EXPECT_FALSE(state.isIgnoredState(top));
+  EXPECT_TRUE(state.isIgnoredState(state.descend(top, "qux")));
+  EXPECT_FALSE(state.isIgnoredState(state.descend(top, "other")));
+
+  auto hg = state.match(".hg");
+  EXPECT_FALSE(state.isIgnoreDirState(hg));
+  auto store = state.descend(hg, "store");
+  EXPECT_FALSE(state.isIgnoredState(store));
+  EXPECT_TRUE(state.isIgnoredState(state.descend(store, "data")));
+
+  EXPECT_TRUE(state.isIgnoreDirState(state.match("foo/buck-out")));
+  EXPECT_FALSE(state.isIgnoreDirState(state.match("foo/buck-out/gen")));
+  EXPECT_FALSE(state.isIgnoreDirState(state.match("foo/buck")));
+}
+
+TEST(Ignore, longest_entry_wins) {
+  IgnoreSet state;
+  state.add(w_string("out/keep/deep", W_STRING_UNICODE), false);
+  state.add(w_string("out", W_STRING_UNICODE), false);
+  state.add(w_string("out/keep", W_STRING_UNICODE), true);
+
+  static const struct test_case tests[] = {
+      {"out", true},
+      {"out/other", true},
+      {"out/keep", false},
+      {"out/keep/file", false},
+      {"out/keep/dir/file", true},
+      {"out/keep/deep", true},
+      {"outside", false},
+  };
+  run_correctness_test(&state, tests, std::size(tests));
+}
+
+TEST(Ignore, globs) {
+  IgnoreSet state;
+  w_string root{"/root", W_STRING_UNICODE};
+  state.addGlob(root, "**/node_modules");
+  state.addGlob(root, "**/*.o");
+
+  EXPECT_TRUE(state.hasIgnoreGlobs());
+  EXPECT_TRUE(state.isIgnoreGlob(w_string{"/root/node_modules"}));
+  EXPECT_TRUE(state.isIgnoreGlob(w_string{"/root/a/b/node_modules"}));
+  EXPECT_TRUE(state.isIgnoreGlob(w_string{"/root/a/foo.o"}));
+  EXPECT_FALSE(state.isIgnoreGlob(w_string{"/root/a/foo.cpp"}));
+  EXPECT_FALSE(state.isIgnoreGlob(w_string{"/root/node_modules_x"}));
+  EXPECT_FALSE(state.isIgnoreGlob(w_string{"/other/node_modules"}));
+
+  const char* path = "/root/src/node_modules/left-pad";
+  EXPECT_TRUE(state.isIgnored(path, strlen_uint32("/root/src/node_modules")));
+  EXPECT_TRUE(state.isIgnored(path, strlen_uint32(path)));
+  EXPECT_FALSE(state.isIgnored(path, strlen_uint32("/root/src")));
+}
+
 // Load up the words data file and build a list of strings from that list.
 // Each of those strings is prefixed with the supplied string.
 // If there are fewer than limit entries available in the data file, we will
@@ -6,12 +6,22 @@
  */
 
 #include "watchman/InMemoryView.h"
+#include <fmt/core.h>
 #include <folly/executors/ManualExecutor.h>
 #include <folly/portability/GTest.h>
+#include <algorithm>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include "watchman/Errors.h"
 #include "watchman/fs/FSDetect.h"
 #include "watchman/query/GlobTree.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
+#include "watchman/query/TermRegistry.h"
+#include "watchman/query/parse.h"
 #include "watchman/root/Root.h"
 #include "watchman/test/lib/FakeFileSystem.h"
 #include "watchman/test/lib/FakeWatcher.h"
@@ -81,6 +91,126 @@ TEST_P(InMemoryViewTest, drive_initial_crawl) {
   EXPECT_STREQ("dir/file.txt", ctx.resultsArray.at(1).asCString());
 }
 
+TEST_P(InMemoryViewTest, dedup_results_by_node) {
+  fs.defineContents({FAKEFS_ROOT "root/dir/file.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.dedup_results = true;
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+
+  QueryContext ctx{&query, root, false};
+  view->pathGenerator(&query, &ctx);
+  view->pathGenerator(&query, &ctx);
+
+  EXPECT_EQ(2, ctx.resultsArray.size());
+  EXPECT_EQ(2, ctx.num_deduped);
+  // View nodes don't need their names to be deduped
+  EXPECT_EQ(2, ctx.dedupNodes.size());
+  EXPECT_TRUE(ctx.dedup.empty());
+
+  query.dedup_by_name = true;
+  QueryContext byName{&query, root, false};
+  view->pathGenerator(&query, &byName);
+  view->pathGenerator(&query, &byName);
+
+  EXPECT_EQ(2, byName.resultsArray.size());
+  EXPECT_EQ(
+      (std::unordered_set<w_string>{w_string{"dir"}, w_string{"dir/file.txt"}}),
+      byName.dedup);
+}
+
+TEST_P(InMemoryViewTest, dedup_by_name_survives_freed_nodes) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/dir/file.txt",
+      FAKEFS_ROOT "root/gone/file.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.dedup_results = true;
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"dir", 1});
+
+  // As default_generators sets it for a query with several generators
+  QueryContext ctx{&query, root, false};
+  ctx.dedupByName = true;
+  view->pathGenerator(&query, &ctx);
+  auto numResults = ctx.resultsArray.size();
+  ASSERT_LT(0, numResults);
+
+  // Free some nodes between the generators
+  fs.removeRecursively(FAKEFS_ROOT "root/gone");
+  pending.lock()->add(
+      FAKEFS_ROOT "root/gone",
+      {},
+      W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  int64_t walked, files, dirs;
+  view->ageOut(walked, files, dirs, std::chrono::seconds(0));
+
+  // What the first generator emitted is still a duplicate
+  view->pathGenerator(&query, &ctx);
+  EXPECT_EQ(numResults, ctx.resultsArray.size());
+  EXPECT_EQ(numResults, ctx.num_deduped);
+  EXPECT_EQ(1, ctx.dedup.count(w_string{"dir/file.txt"}));
+}
+
+TEST_P(InMemoryViewTest, scm_changes_are_grouped_by_directory) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/dir/a.txt",
+      FAKEFS_ROOT "root/dir/b.txt",
+      FAKEFS_ROOT "root/other/c.txt",
+      FAKEFS_ROOT "root/top.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  std::vector<w_string> changed{
+      "dir/b.txt", "top.txt", "other/c.txt", "dir/a.txt"};
+  ClockStamp clock{1, 0};
+
+  Query query;
+  query.fieldList.add("name");
+
+  QueryContext ctx{&query, root, false};
+  view->scmChangesGenerator(&query, &ctx, changed, clock);
+
+  ASSERT_EQ(4, ctx.resultsArray.size());
+  EXPECT_STREQ("top.txt", ctx.resultsArray.at(0).asCString());
+  EXPECT_STREQ("dir/a.txt", ctx.resultsArray.at(1).asCString());
+  EXPECT_STREQ("dir/b.txt", ctx.resultsArray.at(2).asCString());
+  EXPECT_STREQ("other/c.txt", ctx.resultsArray.at(3).asCString());
+
+  query.relative_root = w_string::pathCat({root_path, "dir"});
+  query.relative_root_slash = w_string::build(*query.relative_root, "/");
+
+  QueryContext relative{&query, root, false};
+  view->scmChangesGenerator(&query, &relative, changed, clock);
+
+  ASSERT_EQ(2, relative.resultsArray.size());
+  EXPECT_STREQ("a.txt", relative.resultsArray.at(0).asCString());
+  EXPECT_STREQ("b.txt", relative.resultsArray.at(1).asCString());
+}
+
 TEST_P(InMemoryViewTest, respond_to_watcher_events) {
   getLog().setStdErrLoggingLevel(DBG);
 
@@ -146,6 +276,51 @@ TEST_P(InMemoryViewTest, respond_to_watcher_events) {
   EXPECT_EQ(100, two.get("size").asInt());
 }
 
+TEST_P(InMemoryViewTest, trusts_metadata_from_watcher_events) {
+  fs.defineContents({FAKEFS_ROOT "root/dir/file.txt"});
+  watcher->flags |= WATCHER_HAS_FILE_INFORMATION;
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("size");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"dir/file.txt", 0});
+
+  auto querySize = [&] {
+    QueryContext ctx{&query, root, false};
+    view->pathGenerator(&query, &ctx);
+    EXPECT_EQ(1, ctx.resultsArray.size());
+    return ctx.resultsArray.at(0).get("size").asInt();
+  };
+
+  fs.updateMetadata(FAKEFS_ROOT "root/dir/file.txt", [&](FileInformation& fi) {
+    fi.size = 100;
+  });
+
+  // The metadata delivered with the event is used instead of stat'ing.
+  auto stat = std::make_shared<FileInformation>(
+      fs.getFileInformation(FAKEFS_ROOT "root/dir/file.txt"));
+  stat->size = 42;
+  pending.lock()->add(
+      FAKEFS_ROOT "root/dir/file.txt", {}, W_PENDING_VIA_NOTIFY, stat);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  EXPECT_EQ(42, querySize());
+
+  // An event without metadata is stat'ed as usual.
+  pending.lock()->add(
+      FAKEFS_ROOT "root/dir/file.txt", {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  EXPECT_EQ(100, querySize());
+}
+
 TEST_P(InMemoryViewTest, wait_for_respond_to_watcher_events) {
   getLog().setStdErrLoggingLevel(DBG);
 
@@ -269,7 +444,7 @@ TEST_P(
     const auto& viewdb = view->unsafeAccessViewDatabase();
     auto* dir = viewdb.resolveDir(FAKEFS_ROOT "root");
     auto* file = dir->getChildFile("file.txt");
-    return file->stat.size;
+    return file->stat.size();
   });
 
   // Have Watcher publish change to "/root" but this watcher does not have
@@ -350,7 +525,7 @@ TEST_P(
     const auto& viewdb = view->unsafeAccessViewDatabase();
     auto* dir = viewdb.resolveDir(FAKEFS_ROOT "root/dir");
     auto* file = dir->getChildFile("file.txt");
-    return file->stat.size;
+    return file->stat.size();
   });
 
   // Have Watcher publish its change events but this watcher does not have
@@ -416,7 +591,7 @@ TEST_P(
     const auto& viewdb = view->unsafeAccessViewDatabase();
     auto* dir = viewdb.resolveDir(FAKEFS_ROOT "root/dir");
     auto* file = dir->getChildFile("file.txt");
-    EXPECT_EQ(100, file->stat.size);
+    EXPECT_EQ(100, file->stat.size());
   });
 
   executor.drain();
@@ -467,6 +642,47 @@ TEST_P(InMemoryViewTest, waitUntilReadyToQuery_waits_for_initial_crawl) {
   std::move(syncFuture).get();
 }
 
+TEST_P(InMemoryViewTest, serve_crawled_subtrees_does_not_wait_for_crawl) {
+  json_ref json = json_object();
+  json_object_set(json, "enable_parallel_crawl", json_boolean(GetParam()));
+  json_object_set(json, "serve_crawled_subtrees", json_true());
+  Configuration serveConfig{std::move(json)};
+  auto serveView =
+      std::make_shared<InMemoryView>(fs, root_path, serveConfig, watcher);
+  auto& servePending = serveView->unsafeAccessPendingFromWatcher();
+  servePending.lock()->ping();
+
+  fs.defineContents({FAKEFS_ROOT "root/dir/file.txt"});
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      serveConfig,
+      serveView,
+      [] {});
+
+  Query query;
+  query.fieldList.add("name");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+
+  EXPECT_TRUE(serveView->waitUntilReadyToQuery().isReady());
+  // Nothing is crawled until the crawl starts
+  EXPECT_FALSE(serveView->isCrawledForQuery(&query));
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue, serveView->stepIoThread(root, state, servePending));
+
+  // Once the crawl is over, queries sync as usual
+  EXPECT_FALSE(serveView->isCrawledForQuery(&query));
+
+  QueryContext ctx{&query, root, false};
+  serveView->pathGenerator(&query, &ctx);
+  EXPECT_EQ(2, ctx.resultsArray.size());
+}
+
 TEST_P(InMemoryViewTest, directory_removal_does_not_report_parent) {
   getLog().setStdErrLoggingLevel(DBG);
 
@@ -524,6 +740,455 @@ TEST_P(InMemoryViewTest, directory_removal_does_not_report_parent) {
   // notification from the watcher for that directory.
 }
 
+TEST_P(InMemoryViewTest, sorted_matches_outlive_their_nodes) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/dir/b.txt",
+      FAKEFS_ROOT "root/dir/a.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+  query.sort = QuerySortOrder::Name;
+
+  QueryContext ctx{&query, root, false};
+  view->pathGenerator(&query, &ctx);
+
+  // Delete and age out the files before the sorted matches are rendered,
+  // as the IO thread may once the generator releases the view lock
+  fs.removeRecursively(FAKEFS_ROOT "root/dir");
+  pending.lock()->add(
+      FAKEFS_ROOT "root/dir",
+      {},
+      W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  int64_t walked, files, dirs;
+  view->ageOut(walked, files, dirs, std::chrono::seconds(0));
+
+  ctx.renderSortedMatches();
+  ASSERT_EQ(3, ctx.resultsArray.size());
+  EXPECT_EQ("dir", ctx.resultsArray.at(0).asString());
+  EXPECT_EQ("dir/a.txt", ctx.resultsArray.at(1).asString());
+  EXPECT_EQ("dir/b.txt", ctx.resultsArray.at(2).asString());
+}
+
+TEST_P(InMemoryViewTest, path_generator_skips_subtrees_unchanged_since_clock) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/b/two.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto beforeChanges = view->getMostRecentRootNumberAndTickValue();
+
+  fs.updateMetadata(FAKEFS_ROOT "root/b/two.txt", [&](FileInformation& fi) {
+    fi.size = 100;
+  });
+  pending.lock()->add(FAKEFS_ROOT "root/b/two.txt", {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+  query.expr = parseQueryExpr(
+      &query,
+      json_array(
+          {w_string_to_json("since"),
+           w_string_to_json(beforeChanges.toClockString())}));
+
+  QueryContext ctx{&query, root, false};
+  ctx.clockAtStartOfQuery =
+      ClockSpec{view->getMostRecentRootNumberAndTickValue()};
+  ctx.lastAgeOutTickValueAtStartOfQuery = 0;
+  view->pathGenerator(&query, &ctx);
+
+  ASSERT_EQ(1, ctx.resultsArray.size());
+  EXPECT_STREQ("b/two.txt", ctx.resultsArray.at(0).asCString());
+  // Neither the unchanged entries in the root nor anything under a/ was
+  // visited.
+  EXPECT_EQ(1, ctx.getNumWalked());
+}
+
+TEST_P(InMemoryViewTest, suffix_generator_uses_suffix_index) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.cpp",
+      FAKEFS_ROOT "root/a/two.h",
+      FAKEFS_ROOT "root/b/Three.CPP",
+      FAKEFS_ROOT "root/b/four.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  parse_suffixes(
+      &query,
+      json_object({{"suffix", json_array({w_string_to_json("cpp")})}}));
+  ASSERT_TRUE(query.suffixes.has_value());
+
+  QueryContext ctx{&query, root, false};
+  view->globGenerator(&query, &ctx);
+
+  ASSERT_EQ(2, ctx.resultsArray.size());
+  // The crawl order is not fixed, so compare as a set
+  std::set<std::string> names{
+      ctx.resultsArray.at(0).asCString(), ctx.resultsArray.at(1).asCString()};
+  EXPECT_EQ((std::set<std::string>{"a/one.cpp", "b/Three.CPP"}), names);
+  // Only the files with a matching suffix were visited.
+  EXPECT_EQ(2, ctx.getNumWalked());
+}
+
+TEST_P(InMemoryViewTest, hashes_are_fetched_after_the_generator) {
+  fs.defineContents({FAKEFS_ROOT "root/dir/file.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("size");
+  query.fieldList.add("content.sha1hex");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+
+  QueryContext ctx{&query, root, false};
+  view->pathGenerator(&query, &ctx);
+
+  // The dir has no hash to fetch, but the file is held until the view's
+  // lock has been released
+  EXPECT_TRUE(ctx.deferRenderFetches);
+  ASSERT_EQ(1, ctx.resultsArray.size());
+  EXPECT_STREQ("dir", ctx.resultsArray.at(0).get("name").asCString());
+
+  // The file is reported as it was when it was found
+  fs.updateMetadata(FAKEFS_ROOT "root/dir/file.txt", [&](FileInformation& fi) {
+    fi.size = 1234;
+  });
+  pending.lock()->add(
+      FAKEFS_ROOT "root/dir/file.txt", {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  ctx.deferRenderFetches = false;
+  while (!ctx.fetchRenderBatchNow()) {
+  }
+  ASSERT_EQ(2, ctx.resultsArray.size());
+  auto file = ctx.resultsArray.at(1);
+  EXPECT_STREQ("dir/file.txt", file.get("name").asCString());
+  EXPECT_EQ(0, file.get("size").asInt());
+}
+
+TEST_P(InMemoryViewTest, stream_results_delivers_chunks) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/dir/a.txt",
+      FAKEFS_ROOT "root/dir/b.txt",
+      FAKEFS_ROOT "root/dir/c.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+  query.stream_results = 3;
+
+  std::vector<size_t> chunkSizes;
+  QueryContext ctx{&query, root, false};
+  ctx.streamResults = [&](RenderResult&& chunk) {
+    chunkSizes.push_back(chunk.results.size());
+  };
+  view->pathGenerator(&query, &ctx);
+
+  // Four results: dir and its three files.  The final partial chunk is left
+  // for the caller to send with the rest of the response.
+  EXPECT_EQ((std::vector<size_t>{3}), chunkSizes);
+  EXPECT_EQ(1, ctx.resultsArray.size());
+  EXPECT_EQ(4, ctx.getNumResults());
+}
+
+TEST_P(InMemoryViewTest, stream_results_are_written_off_thread) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/dir/a.txt",
+      FAKEFS_ROOT "root/dir/b.txt",
+      FAKEFS_ROOT "root/dir/c.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+  query.stream_results = 1;
+
+  std::vector<w_string> names;
+  std::vector<std::thread::id> writers;
+  QueryContext ctx{&query, root, false};
+  ctx.streamResults = [&](RenderResult&& chunk) {
+    for (auto& result : chunk.results) {
+      names.push_back(result.asString());
+    }
+    writers.push_back(std::this_thread::get_id());
+  };
+  ctx.startStreamWriter();
+  view->pathGenerator(&query, &ctx);
+  ctx.finishStreamWriter();
+
+  // Every chunk is written, by a thread other than the one that holds the
+  // view lock
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ(
+      (std::vector<w_string>{"dir", "dir/a.txt", "dir/b.txt", "dir/c.txt"}),
+      names);
+  ASSERT_EQ(4, writers.size());
+  for (auto& writer : writers) {
+    EXPECT_NE(std::this_thread::get_id(), writer);
+  }
+  EXPECT_EQ(4, ctx.getNumResults());
+}
+
+TEST_P(InMemoryViewTest, a_failed_stream_write_fails_the_query) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/dir/a.txt",
+      FAKEFS_ROOT "root/dir/b.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+  query.stream_results = 1;
+
+  QueryContext ctx{&query, root, false};
+  ctx.streamResults = [](RenderResult&&) {
+    throw QueryExecError("failed to stream query results to the client");
+  };
+  ctx.startStreamWriter();
+  EXPECT_THROW(
+      {
+        view->pathGenerator(&query, &ctx);
+        ctx.finishStreamWriter();
+      },
+      QueryExecError);
+}
+
+TEST_P(InMemoryViewTest, lazy_crawl_defers_directories_until_queried) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/hot/a.txt",
+      FAKEFS_ROOT "root/cold/b.txt",
+      FAKEFS_ROOT "root/other/c.txt",
+  });
+
+  Configuration lazyConfig{json_object({
+      {"enable_parallel_crawl", json_boolean(GetParam())},
+      {"lazy_crawl", json_true()},
+      {"lazy_crawl_hot_prefixes", json_array({w_string_to_json("hot")})},
+  })};
+  auto lazyView =
+      std::make_shared<InMemoryView>(fs, root_path, lazyConfig, watcher);
+  auto& lazyPending = lazyView->unsafeAccessPendingFromWatcher();
+  lazyPending.lock()->ping();
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      lazyConfig,
+      lazyView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue, lazyView->stepIoThread(root, state, lazyPending));
+
+  Query all;
+  all.fieldList.add("name");
+  all.paths.emplace();
+  all.paths->emplace_back(QueryPath{"", 1});
+  auto names = [&] {
+    QueryContext ctx{&all, root, false};
+    lazyView->pathGenerator(&all, &ctx);
+    std::set<std::string> result;
+    for (size_t i = 0; i < ctx.resultsArray.size(); ++i) {
+      result.insert(ctx.resultsArray.at(i).asCString());
+    }
+    return result;
+  };
+
+  // Only the hot prefix was crawled
+  EXPECT_EQ(
+      (std::set<std::string>{"cold", "hot", "hot/a.txt", "other"}), names());
+
+  Query cold;
+  cold.fieldList.add("name");
+  cold.paths.emplace();
+  cold.paths->emplace_back(QueryPath{"cold", 1});
+  auto crawled = lazyView->crawlForQuery(&cold);
+  EXPECT_FALSE(crawled.isReady());
+  EXPECT_EQ(
+      Continue::Continue, lazyView->stepIoThread(root, state, lazyPending));
+  EXPECT_TRUE(crawled.isReady());
+  std::move(crawled).get();
+
+  std::set<std::string> expected{
+      "cold", "cold/b.txt", "hot", "hot/a.txt", "other"};
+  EXPECT_EQ(expected, names());
+
+  // Nothing is left to crawl for the same query
+  EXPECT_TRUE(lazyView->crawlForQuery(&cold).isReady());
+}
+
+TEST_P(InMemoryViewTest, recrawl_skips_reading_unchanged_directories) {
+  fs.defineContents({FAKEFS_ROOT "root/dir/file.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+  auto names = [&](std::optional<ClockTicks> since) {
+    QueryContext ctx{&query, root, false};
+    if (since) {
+      ctx.since = QuerySince::Clock{false, *since};
+      view->timeGenerator(&query, &ctx);
+    } else {
+      view->pathGenerator(&query, &ctx);
+    }
+    std::set<std::string> result;
+    for (size_t i = 0; i < ctx.resultsArray.size(); ++i) {
+      result.insert(ctx.resultsArray.at(i).asCString());
+    }
+    return result;
+  };
+  auto recrawl = [&] {
+    root->scheduleRecrawl("test");
+    pending.lock()->ping();
+    EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+    EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  };
+
+  // The fake filesystem leaves the dir's timestamps alone when a file is
+  // added, so the recrawl can't see it, but it still sees the changed file.
+  fs.touch(FAKEFS_ROOT "root/dir/new.txt");
+  fs.updateMetadata(FAKEFS_ROOT "root/dir/file.txt", [&](FileInformation& fi) {
+    fi.size = 100;
+  });
+  auto beforeRecrawl = view->getMostRecentRootNumberAndTickValue();
+  recrawl();
+
+  EXPECT_EQ(
+      (std::set<std::string>{"dir/file.txt"}), names(beforeRecrawl.ticks));
+  EXPECT_EQ(
+      (std::set<std::string>{"dir", "dir/file.txt"}), names(std::nullopt));
+
+  fs.updateMetadata(FAKEFS_ROOT "root/dir", [&](FileInformation& fi) {
+    fi.mtime.tv_sec = 100;
+  });
+  recrawl();
+
+  EXPECT_EQ(
+      (std::set<std::string>{"dir", "dir/file.txt", "dir/new.txt"}),
+      names(std::nullopt));
+}
+
+TEST_P(InMemoryViewTest, large_batches_of_events_are_statted_in_parallel) {
+  // Enough changes to have their stats made on the thread pool
+  constexpr int kFilesPerDir = 600;
+  fs.defineContents({FAKEFS_ROOT "root/a/", FAKEFS_ROOT "root/b/"});
+  auto pathOf = [](const char* dir, int i) {
+    return fmt::format(FAKEFS_ROOT "root/{}/{}.txt", dir, i);
+  };
+  for (int i = 0; i < kFilesPerDir; ++i) {
+    fs.touch(pathOf("a", i).c_str());
+    fs.touch(pathOf("b", i).c_str());
+  }
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  // Like a checkout that modifies every file in one dir and deletes every
+  // file in another
+  for (int i = 0; i < kFilesPerDir; ++i) {
+    fs.updateMetadata(
+        pathOf("a", i).c_str(), [&](FileInformation& fi) { fi.size = 100; });
+    fs.removeRecursively(pathOf("b", i).c_str());
+  }
+  {
+    auto lock = pending.lock();
+    for (int i = 0; i < kFilesPerDir; ++i) {
+      lock->add(w_string{pathOf("a", i)}, {}, W_PENDING_VIA_NOTIFY);
+      lock->add(w_string{pathOf("b", i)}, {}, W_PENDING_VIA_NOTIFY);
+    }
+    lock->ping();
+  }
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("size");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+
+  QueryContext ctx{&query, root, false};
+  view->pathGenerator(&query, &ctx);
+
+  // Just the dirs and the modified files still exist
+  ASSERT_EQ(2 + kFilesPerDir, ctx.resultsArray.size());
+  for (size_t i = 0; i < ctx.resultsArray.size(); ++i) {
+    auto result = ctx.resultsArray.at(i);
+    std::string name = result.get("name").asCString();
+    if (name != "a" && name != "b") {
+      EXPECT_EQ("a/", name.substr(0, 2));
+      EXPECT_EQ(100, result.get("size").asInt());
+    }
+  }
+}
+
 INSTANTIATE_TEST_CASE_P(
     InMemoryViewTests,
     InMemoryViewTest,
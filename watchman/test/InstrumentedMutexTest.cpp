@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/telemetry/InstrumentedMutex.h"
+#include <folly/SharedMutex.h>
+#include <folly/Synchronized.h>
+#include <folly/portability/GTest.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace watchman;
+
+namespace {
+
+using TestSharedMutex = InstrumentedSharedMutex<
+    folly::SharedMutex,
+    &LockStats::viewWait,
+    &LockStats::viewHold>;
+using TestMutex = InstrumentedMutex<
+    std::mutex,
+    &LockStats::pendingWait,
+    &LockStats::pendingHold>;
+
+class InstrumentedMutexTest : public testing::TestWithParam<bool> {
+ protected:
+  void SetUp() override {
+    setLockStatsEnabled(GetParam());
+  }
+  void TearDown() override {
+    setLockStatsEnabled(false);
+  }
+};
+
+} // namespace
+
+TEST_P(InstrumentedMutexTest, synchronized_readers_and_writers) {
+  folly::Synchronized<int, TestSharedMutex> value{0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 1000; ++j) {
+        ++*value.wlock();
+        EXPECT_GE(*value.rlock(), 1);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(4000, *value.rlock());
+}
+
+TEST_P(InstrumentedMutexTest, waits_on_condition_variable) {
+  folly::Synchronized<bool, TestMutex> ready{false};
+  std::condition_variable_any cond;
+
+  std::thread setter{[&] {
+    *ready.lock() = true;
+    cond.notify_all();
+  }};
+
+  auto lock = ready.lock();
+  cond.wait(lock.as_lock(), [&] { return *lock; });
+  EXPECT_TRUE(*lock);
+  lock.unlock();
+  setter.join();
+}
+
+TEST_P(InstrumentedMutexTest, try_lock) {
+  TestSharedMutex mutex;
+  ASSERT_TRUE(mutex.try_lock());
+  EXPECT_FALSE(mutex.try_lock_shared());
+  mutex.unlock();
+  ASSERT_TRUE(mutex.try_lock_shared());
+  EXPECT_FALSE(mutex.try_lock());
+  mutex.unlock_shared();
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Enabled,
+    InstrumentedMutexTest,
+    testing::Values(false, true));
@@ -6,6 +6,7 @@
  */
 
 #include <benchmark/benchmark.h>
+#include <fmt/core.h>
 #include "watchman/thirdparty/jansson/jansson.h"
 
 namespace {
@@ -50,6 +51,28 @@ void encode_zero_point_zero(benchmark::State& state) {
 }
 BENCHMARK(encode_zero_point_zero);
 
+void encode_file_results(benchmark::State& state) {
+  constexpr size_t N = 10000;
+
+  std::vector<json_ref> arr;
+  arr.reserve(N);
+  for (size_t i = 0; i < N; ++i) {
+    arr.push_back(json_object(
+        {{"name",
+          w_string_to_json(
+              w_string{fmt::format("some/directory/path/file{}.cpp", i)})},
+         {"size", json_integer(i * 37)},
+         {"exists", json_true()}}));
+  }
+
+  json_ref array = json_array(std::move(arr));
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(json_dumps(array, JSON_COMPACT));
+  }
+}
+BENCHMARK(encode_file_results);
+
 void decode_doubles(benchmark::State& state) {
   // 3.7 ^ 500 still fits in a double.
   constexpr size_t N = 500;
@@ -75,6 +98,28 @@ void decode_doubles(benchmark::State& state) {
 
 BENCHMARK(decode_doubles);
 
+// Like a query naming many explicit paths
+void decode_paths(benchmark::State& state) {
+  constexpr size_t N = 10000;
+
+  std::vector<json_ref> arr;
+  arr.reserve(N);
+  for (size_t i = 0; i < N; ++i) {
+    arr.push_back(w_string_to_json(
+        w_string{fmt::format("some/directory/path/file{}.cpp", i)}));
+  }
+
+  auto encoded = json_dumps(json_array(std::move(arr)), JSON_COMPACT);
+
+  for (auto _ : state) {
+    json_error_t err;
+    benchmark::DoNotOptimize(
+        json_loadb(encoded.data(), encoded.size(), 0, &err));
+  }
+}
+
+BENCHMARK(decode_paths);
+
 } // namespace
 
 BENCHMARK_MAIN();
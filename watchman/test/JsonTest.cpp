@@ -6,6 +6,7 @@
  */
 
 #include <gtest/gtest.h>
+#include <string_view>
 #include "watchman/thirdparty/jansson/jansson_private.h"
 
 namespace {
@@ -55,6 +56,126 @@ TEST(JsonTest, double_round_trip) {
   }
 }
 
+// Objects with a single key, so that sorting keys makes no difference
+json_ref singleKeyObject(const char* key, json_ref value) {
+  return json_object({{key, std::move(value)}});
+}
+
+// JSON_SORT_KEYS bypasses the compact fast path but encodes the same
+std::string dumpGeneric(const json_ref& json) {
+  return json_dumps(json, JSON_COMPACT | JSON_SORT_KEYS);
+}
+
+TEST(JsonTest, compact_encoding) {
+  auto json = json_array(
+      {json_null(),
+       json_true(),
+       json_false(),
+       json_integer(-42),
+       json_real(1.5),
+       w_string_to_json("plain"),
+       json_array(),
+       json_object(),
+       singleKeyObject("k", json_array({json_integer(1), json_integer(2)}))});
+  EXPECT_EQ(
+      R"([null,true,false,-42,1.5,"plain",[],{},{"k":[1,2]}])",
+      json_dumps(json, JSON_COMPACT));
+  EXPECT_EQ(dumpGeneric(json), json_dumps(json, JSON_COMPACT));
+}
+
+TEST(JsonTest, compact_escapes_strings) {
+  auto dump = [](const char* str) {
+    return json_dumps(
+        json_array({typed_string_to_json(str, W_STRING_BYTE)}), JSON_COMPACT);
+  };
+  EXPECT_EQ(R"(["a\"b\\c"])", dump("a\"b\\c"));
+  EXPECT_EQ(R"(["\b\f\n\r\t\u0001\u001f"])", dump("\b\f\n\r\t\x01\x1f"));
+  // Neither slashes nor DEL are escaped
+  EXPECT_EQ("[\"a/b\x7f\"]", dump("a/b\x7f"));
+  // Multi-byte sequences are copied verbatim
+  EXPECT_EQ("[\"caf\xc3\xa9 \xe2\x82\xac\"]", dump("caf\xc3\xa9 \xe2\x82\xac"));
+}
+
+TEST(JsonTest, compact_matches_generic_encoder) {
+  const char* specials[] = {"\"", "\\", "\n", "\x02", "\xc3\xa9", "/"};
+  std::vector<json_ref> values;
+  for (size_t length = 0; length < 20; ++length) {
+    for (size_t at = 0; at <= length; ++at) {
+      for (auto special : specials) {
+        std::string str(length, 'x');
+        str.insert(at, special);
+        values.push_back(typed_string_to_json(str.c_str(), W_STRING_BYTE));
+      }
+    }
+  }
+  // Large enough to be flushed through the callback several times
+  auto json = singleKeyObject("values", json_array(std::move(values)));
+  EXPECT_EQ(dumpGeneric(json), json_dumps(json, JSON_COMPACT));
+}
+
+TEST(JsonTest, compact_stops_at_nul_like_generic_encoder) {
+  auto json = json_array({typed_string_to_json("ab\0cd", 5, W_STRING_BYTE)});
+  EXPECT_EQ(R"(["ab"])", json_dumps(json, JSON_COMPACT));
+  EXPECT_EQ(dumpGeneric(json), json_dumps(json, JSON_COMPACT));
+}
+
+TEST(JsonTest, compact_rejects_invalid_utf8) {
+  auto json = json_array({typed_string_to_json("ok\xff", W_STRING_BYTE)});
+  EXPECT_THROW(json_dumps(json, JSON_COMPACT), std::runtime_error);
+  EXPECT_THROW(dumpGeneric(json), std::runtime_error);
+}
+
+json_ref parse(std::string_view text) {
+  json_error_t err;
+  auto value = json_loadb(text.data(), text.size(), JSON_DECODE_ANY, &err);
+  if (!value) {
+    throw std::runtime_error(err.text);
+  }
+  return *value;
+}
+
+TEST(JsonTest, parse_strings) {
+  const char* specials[] = {"\\\"", "\\\\", "\\n", "\\u00e9", "\xc3\xa9", "/"};
+  const char* decoded[] = {"\"", "\\", "\n", "\xc3\xa9", "\xc3\xa9", "/"};
+  for (size_t length = 0; length < 20; ++length) {
+    for (size_t at = 0; at <= length; ++at) {
+      for (size_t i = 0; i < std::size(specials); ++i) {
+        std::string text(length, 'x');
+        text.insert(at, specials[i]);
+        std::string expected(length, 'x');
+        expected.insert(at, decoded[i]);
+        SCOPED_TRACE(text);
+        EXPECT_EQ(
+            expected,
+            json_to_w_string(parse("\"" + text + "\"")).string());
+      }
+    }
+  }
+}
+
+TEST(JsonTest, parse_empty_key) {
+  auto value = parse(R"({"": 1, "a": ""})");
+  EXPECT_EQ(1, json_integer_value(value.get("")));
+  EXPECT_EQ("", json_to_w_string(value.get("a")).string());
+}
+
+TEST(JsonTest, parse_error_position_after_plain_run) {
+  std::string text = "[\"abcdefghij\nk\"]";
+  json_error_t err;
+  EXPECT_FALSE(json_loadb(text.data(), text.size(), 0, &err));
+  EXPECT_STREQ("unexpected newline near '\"abcdefghij'", err.text);
+  EXPECT_EQ(1, err.line);
+  EXPECT_EQ(12, err.column);
+  EXPECT_EQ(12, err.position);
+}
+
+TEST(JsonTest, parse_rejects_control_characters_and_nul) {
+  using namespace std::literals;
+  EXPECT_THROW(parse("\"abcdefghij\x01\""), std::runtime_error);
+  EXPECT_THROW(parse("\"abcdefghij\0\""sv), std::runtime_error);
+  EXPECT_THROW(parse("\"abcdefghij\xff\""), std::runtime_error);
+}
+
 TEST(JsonTest, too_deep_parse_tree) {
   std::string document(10000, '[');
 
@@ -62,4 +183,38 @@ TEST(JsonTest, too_deep_parse_tree) {
   json_loads(document.c_str(), JSON_DECODE_ANY, &err);
 }
 
+TEST(JsonTest, object_keeps_insertion_order) {
+  auto json = json_object({{"z", json_integer(1)}, {"a", json_integer(2)}});
+  json.set("m", json_integer(3));
+  json.set("z", json_integer(4));
+  EXPECT_EQ(R"({"z":4,"a":2,"m":3})", json_dumps(json, JSON_COMPACT));
+  EXPECT_EQ(R"({"a":2,"m":3,"z":4})", dumpGeneric(json));
+}
+
+TEST(JsonTest, object_lookups_past_index_threshold) {
+  json_object_map map;
+  size_t count = json_object_map::kIndexThreshold * 3;
+  for (size_t i = 0; i < count; ++i) {
+    map.insert_or_assign(
+        w_string{fmt::format("key{}", i)}, json_integer(json_int_t(i)));
+  }
+  EXPECT_FALSE(map.emplace(w_string{"key3"}, json_null()));
+  map.insert_or_assign(w_string{"key40"}, json_integer(-1));
+  ASSERT_EQ(count, map.size());
+
+  auto json = json_object(map);
+  for (size_t i = 0; i < count; ++i) {
+    auto key = fmt::format("key{}", i);
+    EXPECT_EQ(i == 40 ? -1 : json_int_t(i), json.get(key.c_str()).asInt());
+  }
+  EXPECT_FALSE(json.get_optional("key"));
+  EXPECT_THROW(json.object().at("missing"), std::out_of_range);
+
+  // Copies index their own keys
+  json_object_map copy{map};
+  map = json_object_map{};
+  auto last = fmt::format("key{}", count - 1);
+  EXPECT_EQ(json_int_t(count - 1), copy.at(last).asInt());
+}
+
 } // namespace
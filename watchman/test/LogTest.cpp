@@ -30,5 +30,26 @@ TEST(Log, logging) {
   EXPECT_TRUE(logged);
 }
 
+TEST(Log, async_logging_preserves_order) {
+  Log log;
+  auto sub = log.subscribe(DBG, [] {});
+
+  log.startAsync(4);
+  for (int i = 0; i < 10; ++i) {
+    log.logf(DBG, "message {}\n", i);
+  }
+  log.stopAsync();
+
+  std::vector<std::shared_ptr<const watchman::Publisher::Item>> pending;
+  sub->getPending(pending);
+  ASSERT_EQ(10, pending.size());
+  for (int i = 0; i < 10; ++i) {
+    auto& line = json_to_w_string(pending[i]->payload.get("log"));
+    std::string text{line.data(), line.size()};
+    EXPECT_NE(std::string::npos, text.find(fmt::format("message {}\n", i)))
+        << text;
+  }
+}
+
 /* vim:ts=2:sw=2:et:
  */
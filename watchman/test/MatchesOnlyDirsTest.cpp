@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryExpr.h"
+#include "watchman/query/TermRegistry.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+
+using namespace watchman;
+
+namespace {
+bool expr_matches_only_dirs(const char* expression_json) {
+  json_error_t err{};
+  auto expression = json_loads(expression_json, JSON_DECODE_ANY, &err);
+  if (!expression.has_value()) {
+    ADD_FAILURE() << "JSON parse error in fixture: " << err.text << " at "
+                  << err.source << ":" << err.line << ":" << err.column;
+    return false;
+  }
+  Query query;
+  query.case_sensitive = CaseSensitivity::CaseSensitive;
+  auto expr = watchman::parseQueryExpr(&query, *expression);
+  return expr->matchesOnlyDirs();
+}
+} // namespace
+
+TEST(MatchesOnlyDirsTest, type) {
+  EXPECT_TRUE(expr_matches_only_dirs(R"( ["type", "d"] )"));
+  EXPECT_FALSE(expr_matches_only_dirs(R"( ["type", "f"] )"));
+  EXPECT_FALSE(expr_matches_only_dirs(R"( ["not", ["type", "d"]] )"));
+  EXPECT_FALSE(expr_matches_only_dirs(R"( ["true"] )"));
+}
+
+TEST(MatchesOnlyDirsTest, allof) {
+  EXPECT_TRUE(expr_matches_only_dirs(
+      R"( ["allof", ["name", "build"], ["type", "d"]] )"));
+  EXPECT_FALSE(expr_matches_only_dirs(
+      R"( ["allof", ["name", "build"], ["exists"]] )"));
+}
+
+TEST(MatchesOnlyDirsTest, anyof) {
+  EXPECT_TRUE(expr_matches_only_dirs(
+      R"( ["anyof", ["type", "d"],
+                    ["allof", ["type", "d"], ["match", "*.app"]]] )"));
+  EXPECT_FALSE(
+      expr_matches_only_dirs(R"( ["anyof", ["type", "d"], ["type", "l"]] )"));
+}
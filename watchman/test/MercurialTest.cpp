@@ -16,3 +16,14 @@ TEST(Mercurial, convertCommitDate) {
   auto expected = 1529420960;
   EXPECT_EQ(result, expected);
 }
+
+TEST(Mercurial, encodeRunCommand) {
+  using namespace std::string_literals;
+  EXPECT_EQ(
+      "runcommand\n\0\0\0\x12log\0-r\0.\0-T\0{node}"s,
+      watchman::HgCommandServer::encodeRunCommand(
+          {"log", "-r", ".", "-T", "{node}"}));
+  EXPECT_EQ(
+      "runcommand\n\0\0\0\x07status\0"s,
+      watchman::HgCommandServer::encodeRunCommand({"status", ""}));
+}
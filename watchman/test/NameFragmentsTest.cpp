@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GMock.h>
+#include <folly/portability/GTest.h>
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryExpr.h"
+#include "watchman/query/TermRegistry.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+
+using namespace watchman;
+using namespace testing;
+
+namespace {
+std::optional<std::vector<std::string>> expr_to_fragments(
+    std::string expression_json) {
+  json_error_t err{};
+  auto expression = json_loads(expression_json.c_str(), JSON_DECODE_ANY, &err);
+  if (!expression.has_value()) {
+    ADD_FAILURE() << "JSON parse error in fixture: " << err.text << " at "
+                  << err.source << ":" << err.line << ":" << err.column;
+    return std::nullopt;
+  }
+  Query query;
+  query.case_sensitive = CaseSensitivity::CaseSensitive;
+  auto expr = watchman::parseQueryExpr(&query, *expression);
+  auto fragments = expr->computeNameFragments();
+  if (!fragments) {
+    return std::nullopt;
+  }
+  std::vector<std::string> texts;
+  for (auto& fragment : *fragments) {
+    texts.push_back(fragment.text);
+  }
+  return texts;
+}
+} // namespace
+
+TEST(NameFragmentsTest, match_basename_uses_longest_literal) {
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["match", "*Con?troller*.js"] )"),
+      Optional(ElementsAre("troller")));
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["match", "a[bcdefgh]ij"] )"),
+      Optional(ElementsAre("ij")));
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["match", "\\*star\\*"] )"),
+      Optional(ElementsAre("*star*")));
+  EXPECT_THAT(expr_to_fragments(R"( ["match", "*"] )"), Eq(std::nullopt));
+}
+
+TEST(NameFragmentsTest, match_wholename_uses_last_component) {
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["match", "longdirname/*.cpp", "wholename"] )"),
+      Optional(ElementsAre(".cpp")));
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["match", "src/*[/]x", "wholename"] )"),
+      Optional(ElementsAre("x")));
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["match", "src/**", "wholename"] )"),
+      Eq(std::nullopt));
+}
+
+TEST(NameFragmentsTest, name_uses_basenames) {
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["name", ["foo.txt", "bar.txt"]] )"),
+      Optional(UnorderedElementsAre("foo.txt", "bar.txt")));
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["name", "dir/README", "wholename"] )"),
+      Optional(ElementsAre("README")));
+}
+
+TEST(NameFragmentsTest, pcre_literals) {
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["pcre", "^test_.*\\.py$"] )"),
+      Optional(ElementsAre("test_")));
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["pcre", "abcx?yz"] )"),
+      Optional(ElementsAre("abc")));
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["pcre", "\\x41BC"] )"), Eq(std::nullopt));
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["pcre", "foo|barbaz"] )"), Eq(std::nullopt));
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["pcre", "(?i)foo"] )"), Eq(std::nullopt));
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["pcre", "foo", "wholename"] )"),
+      Eq(std::nullopt));
+}
+
+TEST(NameFragmentsTest, compound_expressions) {
+  EXPECT_THAT(
+      expr_to_fragments(
+          R"( ["allof", ["match", "*ab*"], ["match", "*longer*"]] )"),
+      Optional(ElementsAre("longer")));
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["allof", ["type", "f"], ["match", "*abc*"]] )"),
+      Optional(ElementsAre("abc")));
+  EXPECT_THAT(
+      expr_to_fragments(
+          R"( ["anyof", ["match", "*abc*"], ["match", "*xyz*"]] )"),
+      Optional(UnorderedElementsAre("abc", "xyz")));
+  EXPECT_THAT(
+      expr_to_fragments(R"( ["anyof", ["match", "*abc*"], ["type", "f"]] )"),
+      Eq(std::nullopt));
+}
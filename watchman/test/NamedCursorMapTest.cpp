@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/NamedCursorMap.h"
+#include <folly/portability/GTest.h>
+#include <algorithm>
+#include <thread>
+
+using namespace watchman;
+
+TEST(NamedCursorMap, exchange_returns_previous_ticks) {
+  NamedCursorMap cursors;
+  w_string name{"n:foo"};
+  EXPECT_FALSE(cursors.exchange(name, 5).has_value());
+  EXPECT_EQ(5, cursors.exchange(name, 8));
+  EXPECT_EQ(8, cursors.exchange(name, 9));
+  EXPECT_FALSE(cursors.exchange(w_string{"n:bar"}, 9).has_value());
+}
+
+TEST(NamedCursorMap, erase_before) {
+  NamedCursorMap cursors;
+  cursors.exchange(w_string{"n:old"}, 3);
+  cursors.exchange(w_string{"n:new"}, 10);
+  cursors.eraseBefore(5);
+
+  auto snapshot = cursors.snapshot();
+  ASSERT_EQ(1, snapshot.size());
+  EXPECT_EQ(w_string{"n:new"}, snapshot[0].first);
+  EXPECT_EQ(10, snapshot[0].second);
+  EXPECT_FALSE(cursors.exchange(w_string{"n:old"}, 11).has_value());
+}
+
+TEST(NamedCursorMap, concurrent_exchanges_see_every_tick_once) {
+  NamedCursorMap cursors;
+  w_string name{"n:shared"};
+  constexpr int kThreads = 4;
+  constexpr int kPerThread = 1000;
+
+  std::vector<std::vector<ClockTicks>> seen(kThreads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kPerThread; ++i) {
+        ClockTicks ticks = 1 + t * kPerThread + i;
+        if (auto previous = cursors.exchange(name, ticks)) {
+          seen[t].push_back(*previous);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // Each tick handed to the cursor is read back by exactly one later
+  // exchange, except for the one it is left at.
+  std::vector<ClockTicks> all;
+  for (auto& ticks : seen) {
+    all.insert(all.end(), ticks.begin(), ticks.end());
+  }
+  std::sort(all.begin(), all.end());
+  EXPECT_EQ(kThreads * kPerThread - 1, all.size());
+  EXPECT_EQ(all.end(), std::adjacent_find(all.begin(), all.end()));
+}
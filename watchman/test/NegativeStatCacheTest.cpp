@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/NegativeStatCache.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+TEST(NegativeStatCacheTest, only_covers_changes_noticed_before_the_stat) {
+  NegativeStatCache cache{1000ms};
+  auto checked = std::chrono::system_clock::now();
+  cache.insert(w_string{"a/tmp"}, checked);
+
+  EXPECT_TRUE(cache.isMissing(w_string{"a/tmp"}, checked - 5ms, checked));
+  EXPECT_TRUE(cache.isMissing(w_string{"a/tmp"}, checked, checked + 10ms));
+  // Noticed after the stat, so the path may have been recreated
+  EXPECT_FALSE(
+      cache.isMissing(w_string{"a/tmp"}, checked + 1ms, checked + 10ms));
+  EXPECT_FALSE(cache.isMissing(w_string{"a/other"}, checked, checked));
+}
+
+TEST(NegativeStatCacheTest, entries_expire) {
+  NegativeStatCache cache{100ms};
+  auto checked = std::chrono::system_clock::now();
+  cache.insert(w_string{"a/tmp"}, checked);
+
+  EXPECT_TRUE(cache.isMissing(w_string{"a/tmp"}, checked, checked + 100ms));
+  EXPECT_FALSE(cache.isMissing(w_string{"a/tmp"}, checked, checked + 101ms));
+  // Nor trusted if the clock went backwards
+  EXPECT_FALSE(cache.isMissing(w_string{"a/tmp"}, checked, checked - 1ms));
+}
+
+TEST(NegativeStatCacheTest, erase_when_seen_to_exist) {
+  NegativeStatCache cache{1000ms};
+  auto checked = std::chrono::system_clock::now();
+  cache.insert(w_string{"a/tmp"}, checked);
+  cache.erase(w_string{"a/tmp"});
+  EXPECT_FALSE(cache.isMissing(w_string{"a/tmp"}, checked, checked));
+  EXPECT_EQ(0, cache.size());
+}
+
+TEST(NegativeStatCacheTest, bounded) {
+  NegativeStatCache cache{1000ms, 4};
+  auto checked = std::chrono::system_clock::now();
+  for (int i = 0; i < 4; ++i) {
+    cache.insert(w_string::build("old", i), checked);
+  }
+  EXPECT_EQ(4, cache.size());
+
+  // Expired entries make room first
+  cache.insert(w_string{"new"}, checked + 2000ms);
+  EXPECT_EQ(1, cache.size());
+  EXPECT_TRUE(
+      cache.isMissing(w_string{"new"}, checked + 2000ms, checked + 2000ms));
+}
+
+TEST(NegativeStatCacheTest, disabled_by_zero_ttl) {
+  NegativeStatCache cache{0ms};
+  auto checked = std::chrono::system_clock::now();
+  cache.insert(w_string{"a/tmp"}, checked);
+  EXPECT_EQ(0, cache.size());
+  EXPECT_FALSE(cache.isMissing(w_string{"a/tmp"}, checked, checked));
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <cstring>
+#include <vector>
+#include "watchman/NodeArena.h"
+
+using namespace watchman;
+
+TEST(NodeArenaTest, allocations_are_aligned_and_distinct) {
+  NodeArena arena;
+  std::vector<void*> ptrs;
+  for (size_t size = 1; size <= 300; ++size) {
+    auto* p = arena.allocate(size);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(p) % NodeArena::kGranularity);
+    memset(p, int(size), size);
+    ptrs.push_back(p);
+  }
+  for (size_t i = 0; i < ptrs.size(); ++i) {
+    auto* bytes = static_cast<unsigned char*>(ptrs[i]);
+    auto size = i + 1;
+    for (size_t j = 0; j < size; ++j) {
+      ASSERT_EQ(static_cast<unsigned char>(size), bytes[j]);
+    }
+  }
+  for (size_t i = 0; i < ptrs.size(); ++i) {
+    arena.deallocate(ptrs[i], i + 1);
+  }
+  EXPECT_EQ(0, arena.getStats().slabAllocations);
+  EXPECT_EQ(0, arena.getStats().allocatedBytes);
+}
+
+TEST(NodeArenaTest, freed_blocks_are_reused) {
+  NodeArena arena;
+  auto* a = arena.allocate(200);
+  arena.deallocate(a, 200);
+  auto* b = arena.allocate(200);
+  EXPECT_EQ(a, b);
+  arena.deallocate(b, 200);
+}
+
+TEST(NodeArenaTest, empty_slabs_are_released) {
+  NodeArena arena;
+  constexpr size_t kSize = 256;
+  constexpr size_t kCount = 4 * NodeArena::kSlabSize / kSize;
+
+  std::vector<void*> ptrs;
+  for (size_t i = 0; i < kCount; ++i) {
+    ptrs.push_back(arena.allocate(kSize));
+  }
+  EXPECT_GE(arena.getStats().slabs, 4);
+  EXPECT_EQ(kCount, arena.getStats().slabAllocations);
+
+  for (auto* p : ptrs) {
+    arena.deallocate(p, kSize);
+  }
+  // One empty slab is retained per size class.
+  EXPECT_EQ(1, arena.getStats().slabs);
+  EXPECT_EQ(0, arena.getStats().slabAllocations);
+}
+
+TEST(NodeArenaTest, large_allocations_bypass_slabs) {
+  NodeArena arena;
+  auto* p = arena.allocate(NodeArena::kMaxSlabAllocation + 1);
+  EXPECT_EQ(0, arena.getStats().slabs);
+  EXPECT_EQ(1, arena.getStats().largeAllocations);
+  arena.deallocate(p, NodeArena::kMaxSlabAllocation + 1);
+  EXPECT_EQ(0, arena.getStats().largeAllocations);
+}
+
+TEST(NodeArenaTest, huge_page_chunks_are_released) {
+  NodeArena arena{/*hugePages=*/true};
+  constexpr size_t kSize = 256;
+  constexpr size_t kCount = 4 * NodeArena::kChunkSize / kSize;
+
+  std::vector<void*> ptrs;
+  for (size_t i = 0; i < kCount; ++i) {
+    auto* p = arena.allocate(kSize);
+    memset(p, 0xa5, kSize);
+    ptrs.push_back(p);
+  }
+  // Chunks are only mapped where huge pages are available
+  auto chunks = arena.getStats().chunks;
+  EXPECT_LE(chunks, 5);
+
+  for (auto* p : ptrs) {
+    arena.deallocate(p, kSize);
+  }
+  EXPECT_EQ(1, arena.getStats().slabs);
+  // Only the chunk holding the retained empty slab is still mapped
+  EXPECT_EQ(chunks ? 1 : 0, arena.getStats().chunks);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include "watchman/NodeArena.h"
+#include "watchman/PathComponentTable.h"
+#include "watchman/watchman_dir.h"
+
+using namespace watchman;
+
+TEST(PathComponentTableTest, equal_components_share_storage) {
+  PathComponentTable table;
+  auto a = table.intern("src");
+  auto b = table.intern(w_string{"src"});
+  auto c = table.intern("test");
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(a.data(), b.data());
+  EXPECT_NE(a.data(), c.data());
+  EXPECT_EQ(2, table.size());
+}
+
+TEST(PathComponentTableTest, released_when_unused) {
+  PathComponentTable table;
+  auto a = table.intern("src");
+  table.intern("src");
+  table.release("src");
+  EXPECT_EQ(1, table.size());
+  table.release("src");
+  EXPECT_EQ(0, table.size());
+
+  // Callers keep their own reference
+  EXPECT_EQ("src", a);
+  auto b = table.intern("src");
+  EXPECT_NE(a.data(), b.data());
+}
+
+TEST(PathComponentTableTest, dir_nodes_share_names) {
+  NodeArena arena;
+  {
+    auto root = watchman_dir::makeRoot(w_string{"/root"}, arena);
+    auto first = watchman_dir::make("src", root.get());
+    auto second = watchman_dir::make("src", first.get());
+    EXPECT_EQ(first->name.data(), second->name.data());
+    EXPECT_EQ(1, arena.dirNames().size());
+  }
+  EXPECT_EQ(0, arena.dirNames().size());
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PDU.h"
+#include <folly/portability/GTest.h>
+#include <string>
+#include <thread>
+#include "watchman/Constants.h"
+#include "watchman/fs/Pipe.h"
+#include "watchman/watchman_stream.h"
+
+using namespace watchman;
+
+namespace {
+
+class PduTest : public testing::TestWithParam<PduType> {
+ protected:
+  PduTest() {
+    SocketPair pair;
+    reader = w_stm_fdopen(std::move(pair.read));
+    writer = w_stm_fdopen(std::move(pair.write));
+    reader->setNonBlock(false);
+    writer->setNonBlock(false);
+  }
+
+  PduFormat format() const {
+    return PduFormat{GetParam(), 0};
+  }
+
+  json_ref decode() {
+    json_error_t err;
+    auto decoded = in.decodeNext(reader.get(), &err);
+    EXPECT_TRUE(decoded) << err.text;
+    return decoded ? std::move(*decoded) : json_null();
+  }
+
+  std::unique_ptr<watchman_stream> reader;
+  std::unique_ptr<watchman_stream> writer;
+  PduBuffer in;
+  PduBuffer out;
+};
+
+TEST_P(PduTest, buffered_pdus_are_written_on_flush) {
+  for (int i = 0; i < 3; ++i) {
+    auto pdu = json_object({{"n", json_integer(i)}});
+    ASSERT_TRUE(out.pduEncodeBuffered(format(), pdu, writer.get()).hasValue());
+  }
+
+  // Nothing reached the socket yet
+  reader->setNonBlock(true);
+  char c;
+  EXPECT_EQ(-1, reader->read(&c, 1));
+  reader->setNonBlock(false);
+
+  ASSERT_TRUE(out.flushToStream(writer.get()).hasValue());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(i, json_integer_value(decode().get("n")));
+  }
+}
+
+TEST_P(PduTest, pdus_larger_than_the_buffer_arrive_intact) {
+  std::string big(kIoBufSize * 2 + 17, 'x');
+  auto pdu = json_object({{"big", w_string_to_json(w_string{big})}});
+
+  // The socket holds less than the PDU, so it must be drained meanwhile
+  std::thread sender{[&] {
+    EXPECT_TRUE(out.pduEncodeBuffered(
+                       format(), json_object({{"small", json_true()}}),
+                       writer.get())
+                    .hasValue());
+    EXPECT_TRUE(out.pduEncodeToStream(format(), pdu, writer.get()).hasValue());
+  }};
+  EXPECT_TRUE(decode().get("small").isTrue());
+  EXPECT_EQ(big, json_string_value(decode().get("big")));
+  sender.join();
+}
+
+TEST_P(PduTest, pipelined_pdus_are_decoded_from_the_buffer) {
+  for (int i = 0; i < 3; ++i) {
+    auto pdu = json_object({{"n", json_integer(i)}});
+    ASSERT_TRUE(out.pduEncodeBuffered(format(), pdu, writer.get()).hasValue());
+  }
+  ASSERT_TRUE(out.flushToStream(writer.get()).hasValue());
+  // Half of a fourth PDU
+  PduBuffer partial;
+  ASSERT_TRUE(partial
+                  .pduEncodeBuffered(
+                      format(),
+                      json_object({{"n", json_integer(3)}}),
+                      writer.get())
+                  .hasValue());
+  ASSERT_GT(partial.wpos, 2);
+  auto half = partial.wpos / 2;
+  ASSERT_EQ(int(half), writer->write(partial.buf, half));
+
+  EXPECT_FALSE(in.hasBufferedPdu());
+  // The first decode reads everything that has arrived
+  EXPECT_EQ(0, json_integer_value(decode().get("n")));
+  for (int i = 1; i < 3; ++i) {
+    EXPECT_TRUE(in.hasBufferedPdu());
+    EXPECT_EQ(i, json_integer_value(decode().get("n")));
+  }
+  EXPECT_FALSE(in.hasBufferedPdu());
+}
+
+TEST(Stream, default_writev_writes_the_first_nonempty_buffer) {
+  class RecordingStream : public watchman_stream {
+   public:
+    std::string written;
+
+    int read(void*, int) override {
+      return -1;
+    }
+    int write(const void* buf, int size) override {
+      written.append(static_cast<const char*>(buf), size);
+      return size;
+    }
+    watchman_event* getEvents() override {
+      return nullptr;
+    }
+    void setNonBlock(bool) override {}
+    bool rewind() override {
+      return false;
+    }
+    bool shutdown() override {
+      return false;
+    }
+    bool peerIsOwner() override {
+      return false;
+    }
+    pid_t getPeerProcessID() const override {
+      return 0;
+    }
+    const FileDescriptor& getFileDescriptor() const override {
+      return fd;
+    }
+
+   private:
+    FileDescriptor fd;
+  };
+
+  RecordingStream stm;
+  StreamBuffer bufs[] = {{"", 0}, {"ab", 2}, {"cd", 2}};
+  EXPECT_EQ(2, stm.writev(bufs, 3));
+  EXPECT_EQ("ab", stm.written);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Pdu,
+    PduTest,
+    testing::Values(is_json_compact, is_bser, is_bser_v2));
+
+} // namespace
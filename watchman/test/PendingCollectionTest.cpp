@@ -11,6 +11,7 @@
 #include <folly/logging/xlog.h>
 #include <folly/portability/GTest.h>
 #include <chrono>
+#include <list>
 
 using namespace watchman;
 
@@ -59,10 +60,9 @@ void build_list(
 size_t process_items(PendingCollection::LockedPtr& coll) {
   size_t drained = 0;
 
-  auto item = coll->stealItems();
-  while (item) {
+  auto items = coll->stealItems();
+  for (auto* item = items.head(); item; item = item->next) {
     drained++;
-    item = std::move(item->next);
   }
   return drained;
 }
@@ -145,7 +145,7 @@ class WrappedPendingCollection : public PendingCollectionBase {
  public:
   WrappedPendingCollection() : PendingCollectionBase{cond} {}
 
-  std::condition_variable cond;
+  std::condition_variable_any cond;
 };
 
 /**
@@ -160,7 +160,7 @@ class NaivePendingCollection {
       const w_string& path,
       std::chrono::system_clock::time_point now,
       PendingFlags flags) {
-    for (std::shared_ptr<watchman_pending_fs> p = head_; p; p = p->next) {
+    for (auto p = head_.begin(); p != head_.end(); ++p) {
       if (path.piece().startsWith(p->path) &&
           watchman::is_path_prefix(path, p->path)) {
         if ((p->flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) ==
@@ -170,7 +170,7 @@ class NaivePendingCollection {
       }
     }
 
-    for (std::shared_ptr<watchman_pending_fs> p = head_; p; p = p->next) {
+    for (auto p = head_.begin(); p != head_.end(); ++p) {
       if (p->path == path) {
         // consolidateItem
         p->flags.set(
@@ -185,38 +185,30 @@ class NaivePendingCollection {
     // maybePruneObsoletedChildren
     if ((flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) ==
         W_PENDING_RECURSIVE) {
-      std::shared_ptr<watchman_pending_fs>* prev = &head_;
-      auto p = head_;
-      while (p) {
-        if (watchman::is_path_prefix(p->path, path)) {
-          (*prev) = p->next;
-          p = p->next;
-        } else {
-          prev = &(*prev)->next;
-          p = p->next;
-        }
-      }
+      head_.remove_if([&](const PendingChange& p) {
+        return watchman::is_path_prefix(p.path, path);
+      });
     }
 
-    auto p = std::make_shared<watchman_pending_fs>(path, now, flags);
-    p->next = head_;
-    head_ = p;
+    head_.push_front(PendingChange{path, now, flags});
   }
 
   size_t getPendingItemCount() const {
-    size_t i = 0;
-    for (auto p = head_; p; p = p->next) {
-      ++i;
-    }
-    return i;
+    return head_.size();
   }
 
-  std::shared_ptr<watchman_pending_fs> stealItems() {
-    return std::exchange(head_, nullptr);
+  PendingChain stealItems() {
+    PendingChain chain;
+    for (auto p = head_.rbegin(); p != head_.rend(); ++p) {
+      chain.pushFront(std::move(*p));
+    }
+    head_.clear();
+    return chain;
   }
 
  private:
-  std::shared_ptr<watchman_pending_fs> head_;
+  // Most recently added first
+  std::list<PendingChange> head_;
 };
 
 using PCTypes = ::testing::Types<PendingChanges, NaivePendingCollection>;
@@ -231,7 +223,8 @@ TYPED_TEST(PendingCollectionFixture, add_one_item) {
 
   this->coll.add(path, this->now, flags);
 
-  auto item = this->coll.stealItems();
+  auto items = this->coll.stealItems();
+  auto* item = items.head();
   ASSERT_NE(nullptr, item);
   EXPECT_EQ(nullptr, item->next);
   EXPECT_EQ(w_string{"foo/bar"}, item->path);
@@ -244,7 +237,8 @@ TYPED_TEST(PendingCollectionFixture, add_two_items) {
   this->coll.add(w_string{"foo/bar"}, this->now, flags);
   this->coll.add(w_string{"foo/baz"}, this->now, flags);
 
-  auto item = this->coll.stealItems();
+  auto items = this->coll.stealItems();
+  auto* item = items.head();
   ASSERT_NE(nullptr, item);
   EXPECT_NE(nullptr, item->next);
   EXPECT_EQ(w_string{"foo/baz"}, item->path);
@@ -262,7 +256,8 @@ TYPED_TEST(PendingCollectionFixture, same_item_consolidates) {
   this->coll.add(w_string{"foo/bar"}, this->now, flags);
   this->coll.add(w_string{"foo/bar"}, this->now, flags);
 
-  auto item = this->coll.stealItems();
+  auto items = this->coll.stealItems();
+  auto* item = items.head();
   ASSERT_NE(nullptr, item);
   EXPECT_EQ(nullptr, item->next);
   EXPECT_EQ(w_string{"foo/bar"}, item->path);
@@ -273,7 +268,8 @@ TYPED_TEST(PendingCollectionFixture, prune_obsoleted_children) {
   this->coll.add(w_string{"foo/bar"}, this->now, 0);
   this->coll.add(w_string{"foo"}, this->now, W_PENDING_RECURSIVE);
 
-  auto item = this->coll.stealItems();
+  auto items = this->coll.stealItems();
+  auto* item = items.head();
   ASSERT_NE(nullptr, item);
   EXPECT_EQ(nullptr, item->next);
   EXPECT_EQ(w_string{"foo"}, item->path);
@@ -286,7 +282,8 @@ TYPED_TEST(
   this->coll.add(w_string{"foo"}, this->now, W_PENDING_RECURSIVE);
   this->coll.add(w_string{"foo/bar"}, this->now, 0);
 
-  auto item = this->coll.stealItems();
+  auto items = this->coll.stealItems();
+  auto* item = items.head();
   ASSERT_NE(nullptr, item);
   EXPECT_EQ(nullptr, item->next);
   EXPECT_EQ(w_string{"foo"}, item->path);
@@ -301,7 +298,8 @@ TYPED_TEST(
   this->coll.add(w_string{"foo"}, this->now, W_PENDING_RECURSIVE);
   this->coll.add(w_string{"foo/bar/baz/qux"}, this->now, 0);
 
-  auto item = this->coll.stealItems();
+  auto items = this->coll.stealItems();
+  auto* item = items.head();
   ASSERT_NE(nullptr, item);
   EXPECT_EQ(nullptr, item->next);
   EXPECT_EQ(w_string{"foo"}, item->path);
@@ -313,7 +311,8 @@ TYPED_TEST(PendingCollectionFixture, unrelated_prefixes_dont_prune) {
   this->coll.add(w_string{"foo/bar"}, this->now, flags);
   this->coll.add(w_string{"f"}, this->now, W_PENDING_RECURSIVE);
 
-  auto item = this->coll.stealItems();
+  auto items = this->coll.stealItems();
+  auto* item = items.head();
   ASSERT_NE(nullptr, item);
   EXPECT_NE(nullptr, item->next);
   EXPECT_EQ(w_string{"f"}, item->path);
@@ -333,7 +332,8 @@ TYPED_TEST(PendingCollectionFixture, queue_crawl_then_notify) {
 
   // TODO: Why are these paths not returned bottom-up?
 
-  auto item = this->coll.stealItems();
+  auto items = this->coll.stealItems();
+  auto* item = items.head();
   ASSERT_NE(nullptr, item);
   EXPECT_NE(nullptr, item->next);
   EXPECT_EQ(w_string{"foo/bar"}, item->path);
@@ -350,7 +350,8 @@ TYPED_TEST(PendingCollectionFixture, queue_notify_then_crawl) {
   this->coll.add(
       w_string{"foo"}, this->now, W_PENDING_CRAWL_ONLY | W_PENDING_RECURSIVE);
 
-  auto item = this->coll.stealItems();
+  auto items = this->coll.stealItems();
+  auto* item = items.head();
   ASSERT_NE(nullptr, item);
   EXPECT_NE(nullptr, item->next);
   EXPECT_EQ(w_string{"foo"}, item->path);
@@ -382,7 +383,8 @@ TYPED_TEST(PendingCollectionFixture, real_example) {
 
   EXPECT_EQ(3, this->coll.getPendingItemCount());
 
-  auto item = this->coll.stealItems();
+  auto items = this->coll.stealItems();
+  auto* item = items.head();
   ASSERT_NE(nullptr, item);
   EXPECT_NE(nullptr, item->next);
 
@@ -394,3 +396,183 @@ TYPED_TEST(PendingCollectionFixture, real_example) {
   ASSERT_NE(nullptr, item);
   EXPECT_EQ(nullptr, item->next);
 }
+
+TEST(Pending, add_batch_merges_and_prunes) {
+  auto now = std::chrono::system_clock::now();
+  std::vector<PendingChange> batch{
+      {w_string{"foo/bar/baz"}, now, W_PENDING_VIA_NOTIFY},
+      {w_string{"qux"}, now, W_PENDING_VIA_NOTIFY},
+      {w_string{"foo/bar"}, now, W_PENDING_VIA_NOTIFY | W_PENDING_RECURSIVE},
+      {w_string{"qux"}, now, W_PENDING_NONRECURSIVE_SCAN},
+      {w_string{"foo/bar/quux"}, now, W_PENDING_VIA_NOTIFY},
+  };
+
+  PendingChanges coll;
+  coll.addBatch(batch);
+  EXPECT_TRUE(batch.empty());
+  EXPECT_EQ(2, coll.getPendingItemCount());
+
+  auto items = coll.stealItems();
+  auto* item = items.head();
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(w_string{"qux"}, item->path);
+  EXPECT_EQ(W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN, item->flags);
+
+  item = item->next;
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(nullptr, item->next);
+  EXPECT_EQ(w_string{"foo/bar"}, item->path);
+  EXPECT_EQ(W_PENDING_VIA_NOTIFY | W_PENDING_RECURSIVE, item->flags);
+}
+
+TEST(Pending, latest_change_decides_metadata) {
+  auto now = std::chrono::system_clock::now();
+  auto first = std::make_shared<FileInformation>();
+  auto second = std::make_shared<FileInformation>();
+
+  PendingChanges coll;
+  coll.add(w_string{"foo"}, now, W_PENDING_VIA_NOTIFY, first);
+  coll.add(w_string{"foo"}, now, W_PENDING_VIA_NOTIFY, second);
+  coll.add(w_string{"bar"}, now, W_PENDING_VIA_NOTIFY, first);
+  coll.add(w_string{"bar"}, now, W_PENDING_VIA_NOTIFY);
+
+  std::vector<PendingChange> batch{
+      {w_string{"baz"}, now, W_PENDING_VIA_NOTIFY},
+      {w_string{"baz"}, now, W_PENDING_VIA_NOTIFY, second},
+  };
+  coll.addBatch(batch);
+  EXPECT_EQ(3, coll.getPendingItemCount());
+
+  auto items = coll.stealItems();
+  for (auto* item = items.head(); item; item = item->next) {
+    if (item->path == w_string{"bar"}) {
+      EXPECT_EQ(nullptr, item->stat);
+    } else {
+      EXPECT_EQ(second, item->stat) << item->path;
+    }
+  }
+}
+
+TEST(Pending, coalesces_children_into_directory_scan) {
+  auto now = std::chrono::system_clock::now();
+  PendingChanges coll;
+  coll.setCoalescing(3, std::chrono::milliseconds{1000});
+
+  coll.add(
+      w_string{"foo/sub"}, now, W_PENDING_VIA_NOTIFY | W_PENDING_RECURSIVE);
+  coll.add(w_string{"foo/a"}, now, W_PENDING_VIA_NOTIFY);
+  coll.add(w_string{"foo/b"}, now, W_PENDING_VIA_NOTIFY);
+  coll.add(w_string{"foo/c"}, now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(4, coll.getPendingItemCount());
+
+  // The fourth plain child tips foo over the threshold.
+  coll.add(w_string{"foo/d"}, now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(2, coll.getPendingItemCount());
+
+  // Absorbed by the pending scan of foo.
+  coll.add(w_string{"foo/e"}, now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(2, coll.getPendingItemCount());
+
+  auto items = coll.stealItems();
+  auto* item = items.head();
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(w_string{"foo"}, item->path);
+  EXPECT_EQ(W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN, item->flags);
+
+  item = item->next;
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(nullptr, item->next);
+  EXPECT_EQ(w_string{"foo/sub"}, item->path);
+}
+
+TEST(Pending, coalescing_window_expires) {
+  auto now = std::chrono::system_clock::now();
+  PendingChanges coll;
+  coll.setCoalescing(2, std::chrono::milliseconds{100});
+
+  coll.add(w_string{"foo/a"}, now, W_PENDING_VIA_NOTIFY);
+  coll.add(w_string{"foo/b"}, now, W_PENDING_VIA_NOTIFY);
+  coll.add(
+      w_string{"foo/c"}, now + std::chrono::seconds{1}, W_PENDING_VIA_NOTIFY);
+
+  EXPECT_EQ(3, coll.getPendingItemCount());
+}
+
+TEST(Pending, queue_hands_over_batches_in_order) {
+  auto now = std::chrono::system_clock::now();
+  PendingChangesQueue queue{2};
+
+  PendingChanges batch;
+  batch.add(w_string{"foo"}, now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(PendingChangesQueue::PushResult::Queued, queue.tryPush(batch));
+  EXPECT_TRUE(batch.empty());
+
+  batch.add(w_string{"bar"}, now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(PendingChangesQueue::PushResult::Queued, queue.tryPush(batch));
+
+  // Full, so the changes stay with the producer
+  batch.add(w_string{"baz"}, now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(PendingChangesQueue::PushResult::Full, queue.tryPush(batch));
+  EXPECT_EQ(1, batch.getPendingItemCount());
+
+  // Nothing to wait for while batches are queued
+  EXPECT_FALSE(queue.prepareToWait());
+
+  PendingChanges drained;
+  EXPECT_EQ(2, queue.drainInto(drained));
+  EXPECT_EQ(2, drained.getPendingItemCount());
+  EXPECT_EQ(0, queue.drainInto(drained));
+}
+
+TEST(Pending, queue_wakes_only_an_idle_consumer) {
+  auto now = std::chrono::system_clock::now();
+  PendingChangesQueue queue;
+  PendingChanges batch;
+
+  EXPECT_TRUE(queue.prepareToWait());
+  batch.add(w_string{"foo"}, now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(
+      PendingChangesQueue::PushResult::QueuedConsumerIdle,
+      queue.tryPush(batch));
+
+  queue.finishWait();
+  batch.add(w_string{"bar"}, now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(PendingChangesQueue::PushResult::Queued, queue.tryPush(batch));
+
+  PendingChanges drained;
+  EXPECT_EQ(2, queue.drainInto(drained));
+}
+
+TEST(Pending, processed_entries_are_reused) {
+  auto now = std::chrono::system_clock::now();
+  PendingChanges coll;
+  coll.add(w_string{"foo"}, now, W_PENDING_VIA_NOTIFY);
+
+  const watchman_pending_fs* first;
+  {
+    auto items = coll.stealItems();
+    EXPECT_EQ(1, items.size());
+    first = items.head();
+  }
+
+  PendingChanges other;
+  other.add(w_string{"bar"}, now, W_PENDING_VIA_NOTIFY);
+  auto items = other.stealItems();
+  EXPECT_EQ(first, items.head());
+  EXPECT_EQ(w_string{"bar"}, items.head()->path);
+  EXPECT_EQ(nullptr, items.head()->next);
+  EXPECT_EQ(nullptr, items.head()->stat);
+}
+
+TEST(Pending, lists_recursive_items_within_a_dir) {
+  auto now = std::chrono::system_clock::now();
+  PendingChanges coll;
+  coll.add(w_string{"foo/a"}, now, W_PENDING_RECURSIVE);
+  coll.add(w_string{"foo/b"}, now, W_PENDING_VIA_NOTIFY);
+  coll.add(w_string{"foobar"}, now, W_PENDING_RECURSIVE);
+  coll.add(w_string{"bar/c"}, now, W_PENDING_RECURSIVE);
+
+  auto items = coll.recursiveItemsWithin(w_string{"foo"});
+  ASSERT_EQ(1, items.size());
+  EXPECT_EQ(w_string{"foo/a"}, items[0]);
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PhaseTimeline.h"
+
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+TEST(PhaseTimelineTest, phases_are_ordered_by_start) {
+  PhaseTimeline timeline;
+  auto origin = PhaseTimeline::Clock::now();
+  EXPECT_TRUE(timeline.record("crawl", origin + 10ms, origin + 40ms));
+  EXPECT_TRUE(timeline.record("config", origin, origin + 5ms));
+  EXPECT_TRUE(timeline.record("watcher", origin + 5ms, origin + 10ms));
+
+  auto status = timeline.getStatus();
+  ASSERT_EQ(3, status.size());
+  EXPECT_EQ("config", status[0].name);
+  EXPECT_EQ(0, status[0].start_ms);
+  EXPECT_EQ(5, status[0].duration_ms);
+  EXPECT_EQ("watcher", status[1].name);
+  EXPECT_EQ(5, status[1].start_ms);
+  EXPECT_EQ("crawl", status[2].name);
+  EXPECT_EQ(10, status[2].start_ms);
+  EXPECT_EQ(30, status[2].duration_ms);
+
+  auto json = timeline.toJson();
+  EXPECT_EQ(5, json.get("config").asInt());
+  EXPECT_EQ(30, json.get("crawl").asInt());
+  EXPECT_EQ(40, json.get("total").asInt());
+}
+
+TEST(PhaseTimelineTest, only_the_first_occurrence_is_kept) {
+  PhaseTimeline timeline;
+  auto origin = PhaseTimeline::Clock::now();
+  EXPECT_TRUE(timeline.record("crawl", origin, origin + 20ms));
+  EXPECT_FALSE(timeline.record("crawl", origin + 1s, origin + 2s));
+  EXPECT_TRUE(timeline.has("crawl"));
+  EXPECT_FALSE(timeline.has("cache_warm"));
+
+  auto phases = timeline.phases();
+  ASSERT_EQ(1, phases.size());
+  EXPECT_EQ(20ms, phases[0].duration);
+}
+
+TEST(PhaseTimelineTest, empty_timeline_has_no_total) {
+  PhaseTimeline timeline;
+  EXPECT_TRUE(timeline.getStatus().empty());
+  EXPECT_FALSE(timeline.toJson().get_optional("total"));
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/PollSchedule.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+TEST(PollSchedule, paths_are_due_after_the_hot_interval) {
+  PollSchedule schedule{1s, 8s};
+  PollSchedule::clock::time_point start;
+  schedule.insert("/root", start);
+  schedule.insert("/root/a", start + 100ms);
+  // Inserting again doesn't move it
+  schedule.insert("/root", start + 500ms);
+
+  EXPECT_EQ(start + 1s, schedule.nextDue());
+  EXPECT_FALSE(schedule.popDue(start + 999ms).has_value());
+  EXPECT_EQ(w_string{"/root"}, schedule.popDue(start + 2s));
+  EXPECT_EQ(w_string{"/root/a"}, schedule.popDue(start + 2s));
+  EXPECT_FALSE(schedule.popDue(start + 2s).has_value());
+  EXPECT_FALSE(schedule.nextDue().has_value());
+  EXPECT_EQ(2, schedule.size());
+}
+
+TEST(PollSchedule, unchanged_paths_cool_down) {
+  PollSchedule schedule{1s, 4s};
+  auto now = PollSchedule::clock::time_point{};
+  schedule.insert("/root", now);
+
+  for (auto expected : {1s, 2s, 4s, 4s}) {
+    auto due = *schedule.nextDue();
+    EXPECT_EQ(now + expected, due);
+    EXPECT_FALSE(schedule.popDue(due - 1ms).has_value());
+    now = due;
+    EXPECT_EQ(w_string{"/root"}, schedule.popDue(now));
+    schedule.reschedule("/root", false, now);
+  }
+  EXPECT_EQ(0, schedule.numHot());
+}
+
+TEST(PollSchedule, a_change_makes_a_path_hot_again) {
+  PollSchedule schedule{1s, 60s};
+  auto now = PollSchedule::clock::time_point{};
+  schedule.insert("/root", now);
+  for (int i = 0; i < 10; ++i) {
+    now = *schedule.nextDue();
+    schedule.reschedule(*schedule.popDue(now), false, now);
+  }
+  EXPECT_EQ(now + 60s, schedule.nextDue());
+  EXPECT_EQ(0, schedule.numHot());
+
+  now = *schedule.nextDue();
+  schedule.reschedule(*schedule.popDue(now), true, now);
+  EXPECT_EQ(now + 1s, schedule.nextDue());
+  EXPECT_EQ(1, schedule.numHot());
+}
+
+TEST(PollSchedule, erased_paths_are_not_rescheduled) {
+  PollSchedule schedule{1s, 8s};
+  auto now = PollSchedule::clock::time_point{};
+  schedule.insert("/root", now);
+  schedule.insert("/root/gone", now);
+
+  EXPECT_EQ(w_string{"/root"}, schedule.popDue(now + 1s));
+  // Erased while queued
+  schedule.erase("/root/gone");
+  EXPECT_FALSE(schedule.popDue(now + 1s).has_value());
+
+  // Erased while handed out
+  schedule.erase("/root");
+  schedule.reschedule("/root", true, now + 1s);
+  EXPECT_FALSE(schedule.nextDue().has_value());
+  EXPECT_EQ(0, schedule.size());
+}
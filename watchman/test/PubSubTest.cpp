@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include "watchman/PubSub.h"
+
+using namespace watchman;
+
+namespace {
+std::vector<json_int_t> drain(Publisher::Subscriber& sub) {
+  std::vector<std::shared_ptr<const Publisher::Item>> pending;
+  sub.getPending(pending);
+  std::vector<json_int_t> values;
+  for (auto& item : pending) {
+    values.push_back(item->payload.asInt());
+  }
+  return values;
+}
+} // namespace
+
+TEST(PubSub, drop_skips_oldest_for_slow_subscriber) {
+  auto pub = std::make_shared<Publisher>(3, Publisher::OverflowPolicy::Drop);
+  auto slow = pub->subscribe(nullptr);
+  auto fast = pub->subscribe(nullptr);
+
+  for (json_int_t i = 1; i <= 5; ++i) {
+    pub->enqueue(json_integer(i));
+    drain(*fast);
+  }
+
+  EXPECT_EQ((std::vector<json_int_t>{3, 4, 5}), drain(*slow));
+  EXPECT_EQ(2, slow->takeDropped());
+  EXPECT_EQ(0, slow->takeDropped());
+  EXPECT_EQ(0, fast->takeDropped());
+}
+
+TEST(PubSub, coalesce_keeps_unkeyed_items) {
+  auto pub =
+      std::make_shared<Publisher>(2, Publisher::OverflowPolicy::Coalesce);
+  auto sub = pub->subscribe(nullptr);
+
+  pub->enqueue(json_integer(0));
+  for (json_int_t i = 1; i <= 10; ++i) {
+    pub->enqueue(json_integer(i), "settled");
+  }
+
+  auto values = drain(*sub);
+  ASSERT_LE(values.size(), 4);
+  EXPECT_EQ(0, values.front());
+  EXPECT_EQ(10, values.back());
+  EXPECT_EQ(0, sub->takeDropped());
+}
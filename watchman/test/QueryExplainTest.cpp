@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryExpr.h"
+#include "watchman/query/TermRegistry.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+
+using namespace watchman;
+
+namespace {
+std::string explain_expr(const char* expression_json) {
+  json_error_t err{};
+  auto expression = json_loads(expression_json, JSON_DECODE_ANY, &err);
+  if (!expression.has_value()) {
+    ADD_FAILURE() << "JSON parse error in fixture: " << err.text << " at "
+                  << err.source << ":" << err.line << ":" << err.column;
+    return "";
+  }
+  Query query;
+  query.case_sensitive = CaseSensitivity::CaseSensitive;
+  auto expr = watchman::parseQueryExpr(&query, *expression);
+  return json_dumps(expr->explain(), JSON_COMPACT | JSON_SORT_KEYS);
+}
+} // namespace
+
+TEST(QueryExplainTest, terms_are_named_with_their_cost) {
+  EXPECT_EQ(
+      R"({"cost":"cheap","term":"true"})", explain_expr(R"( "true" )"));
+  EXPECT_EQ(
+      R"({"cost":"expensive","term":"match"})",
+      explain_expr(R"( ["match", "*.c"] )"));
+}
+
+TEST(QueryExplainTest, lists_terms_in_evaluation_order) {
+  EXPECT_EQ(
+      R"({"cost":"expensive","term":"allof","terms":[)"
+      R"({"cost":"cheap","term":"type"},)"
+      R"({"cost":"expensive","term":"not","terms":[)"
+      R"({"cost":"expensive","term":"match"}]}]})",
+      explain_expr(
+          R"( ["allof", ["not", ["match", "*.o"]], ["type", "f"]] )"));
+}
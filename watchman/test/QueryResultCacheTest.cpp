@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/QueryResultCache.h"
+#include <folly/portability/GTest.h>
+#include "watchman/query/Query.h"
+
+using namespace watchman;
+
+namespace {
+
+std::unique_ptr<Query> makeQuery(json_ref spec) {
+  auto query = std::make_unique<Query>();
+  query->query_spec = std::move(spec);
+  return query;
+}
+
+QueryResultCache::Entry makeEntry(uint64_t generation, size_t numResults) {
+  QueryResultCache::Entry entry{1, generation, 0, false, false, {}, {}};
+  for (size_t i = 0; i < numResults; ++i) {
+    entry.resultsArray.results.push_back(json_integer(i));
+  }
+  return entry;
+}
+
+} // namespace
+
+TEST(QueryResultCache, key_ignores_fields_that_dont_affect_results) {
+  auto a = makeQuery(json_object(
+      {{"suffix", typed_string_to_json("cpp")},
+       {"request_id", typed_string_to_json("a")},
+       {"sync_timeout", json_integer(100)}}));
+  auto b = makeQuery(json_object(
+      {{"request_id", typed_string_to_json("b")},
+       {"suffix", typed_string_to_json("cpp")}}));
+  auto c = makeQuery(json_object({{"suffix", typed_string_to_json("h")}}));
+
+  auto keyA = QueryResultCache::keyFor(*a, std::nullopt);
+  ASSERT_TRUE(keyA.has_value());
+  EXPECT_EQ(keyA, QueryResultCache::keyFor(*b, std::nullopt));
+  EXPECT_NE(keyA, QueryResultCache::keyFor(*c, std::nullopt));
+}
+
+TEST(QueryResultCache, key_includes_since) {
+  auto a = makeQuery(json_object({{"suffix", typed_string_to_json("cpp")}}));
+  auto b = makeQuery(json_object({{"suffix", typed_string_to_json("cpp")}}));
+  b->since_spec = std::make_unique<ClockSpec>(ClockPosition{1, 5});
+
+  EXPECT_NE(
+      QueryResultCache::keyFor(*a, std::nullopt),
+      QueryResultCache::keyFor(*b, std::nullopt));
+}
+
+TEST(QueryResultCache, named_cursors_are_not_cached) {
+  auto query = makeQuery(json_object({{"suffix", typed_string_to_json("cpp")}}));
+  query->since_spec = std::make_unique<ClockSpec>();
+  query->since_spec->spec = ClockSpec::NamedCursor{w_string{"n:foo"}};
+  EXPECT_FALSE(QueryResultCache::keyFor(*query, std::nullopt).has_value());
+}
+
+TEST(QueryResultCache, entries_are_invalidated_by_changes) {
+  QueryResultCache cache{4, 100};
+  w_string key{"key"};
+  cache.set(key, makeEntry(7, 3));
+
+  auto hit = cache.get(key, 1, 7, 0);
+  ASSERT_TRUE(hit.has_value());
+  EXPECT_EQ(3, hit->resultsArray.results.size());
+
+  EXPECT_FALSE(cache.get(key, 1, 8, 0).has_value());
+  EXPECT_FALSE(cache.get(key, 2, 7, 0).has_value());
+  EXPECT_FALSE(cache.get(key, 1, 7, 1).has_value());
+}
+
+TEST(QueryResultCache, large_results_are_not_cached) {
+  QueryResultCache cache{4, 2};
+  w_string key{"key"};
+  cache.set(key, makeEntry(7, 1));
+  cache.set(key, makeEntry(8, 3));
+
+  EXPECT_FALSE(cache.get(key, 1, 7, 0).has_value());
+  EXPECT_FALSE(cache.get(key, 1, 8, 0).has_value());
+  EXPECT_EQ(0, cache.stats().size);
+}
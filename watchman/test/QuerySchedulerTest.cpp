@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/QueryScheduler.h"
+#include <folly/portability/GTest.h>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+#include "watchman/Errors.h"
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+const w_string kRoot{"/root"};
+
+size_t numQueued(const QueryScheduler& scheduler) {
+  auto stats = scheduler.getStats();
+  return stats.queuedInteractive + stats.queuedBatch;
+}
+
+/**
+ * Queues queries one at a time, so that they arrive in a known order, and
+ * records the order in which they are admitted.  Each query finishes as
+ * soon as it is admitted.
+ */
+class Arrivals {
+ public:
+  explicit Arrivals(QueryScheduler& scheduler) : scheduler_{scheduler} {}
+
+  ~Arrivals() {
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  void add(pid_t client, QueryPriority priority) {
+    auto expected = numQueued(scheduler_) + 1;
+    threads_.emplace_back([this, client, priority] {
+      auto ticket = scheduler_.admit(client, kRoot, priority, 10s);
+      std::lock_guard<std::mutex> lock{mutex_};
+      order_.push_back(client);
+    });
+    while (numQueued(scheduler_) < expected) {
+      std::this_thread::sleep_for(1ms);
+    }
+  }
+
+  std::vector<pid_t> finish() {
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+    threads_.clear();
+    return order_;
+  }
+
+ private:
+  QueryScheduler& scheduler_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::vector<pid_t> order_;
+};
+
+} // namespace
+
+TEST(QueryScheduler, queues_beyond_the_running_limit) {
+  QueryScheduler scheduler{{2, 2, 2, 1}};
+  std::optional<QueryScheduler::Ticket> first{
+      scheduler.admit(1, kRoot, QueryPriority::Interactive, 1s)};
+  auto second = scheduler.admit(2, kRoot, QueryPriority::Interactive, 1s);
+  EXPECT_EQ(2, scheduler.getStats().running);
+
+  {
+    Arrivals arrivals{scheduler};
+    arrivals.add(3, QueryPriority::Interactive);
+    EXPECT_EQ(1, scheduler.getStats().queuedInteractive);
+    first.reset();
+    EXPECT_EQ(std::vector<pid_t>{3}, arrivals.finish());
+  }
+  EXPECT_EQ(1, scheduler.getStats().running);
+  EXPECT_EQ(3, scheduler.getStats().admittedInteractive);
+}
+
+TEST(QueryScheduler, a_busy_client_waits_while_others_run) {
+  QueryScheduler scheduler{{4, 1, 4, 1}};
+  auto busy = scheduler.admit(1, kRoot, QueryPriority::Interactive, 1s);
+  EXPECT_THROW(
+      scheduler.admit(1, kRoot, QueryPriority::Interactive, 10ms),
+      QueryExecError);
+  EXPECT_EQ(1, scheduler.getStats().timedOut);
+  EXPECT_EQ(0, numQueued(scheduler));
+
+  auto other = scheduler.admit(2, kRoot, QueryPriority::Interactive, 1s);
+  EXPECT_EQ(2, scheduler.getStats().running);
+}
+
+TEST(QueryScheduler, unattributed_queries_skip_the_client_limit) {
+  // Say, a trigger and a saved-state query, neither with a peer pid
+  QueryScheduler scheduler{{3, 1, 2, 1}};
+  auto trigger = scheduler.admit(
+      QueryScheduler::kUnattributed, kRoot, QueryPriority::Batch, 1s);
+  auto internal = scheduler.admit(
+      QueryScheduler::kUnattributed, kRoot, QueryPriority::Batch, 10ms);
+  EXPECT_EQ(2, scheduler.getStats().running);
+
+  // The root limit still holds them back
+  EXPECT_THROW(
+      scheduler.admit(
+          QueryScheduler::kUnattributed, kRoot, QueryPriority::Batch, 10ms),
+      QueryExecError);
+  auto other = scheduler.admit(
+      QueryScheduler::kUnattributed, "/other", QueryPriority::Batch, 1s);
+  EXPECT_EQ(3, scheduler.getStats().running);
+}
+
+TEST(QueryScheduler, roots_have_their_own_limit) {
+  QueryScheduler scheduler{{4, 4, 1, 1}};
+  auto first = scheduler.admit(1, kRoot, QueryPriority::Interactive, 1s);
+  EXPECT_THROW(
+      scheduler.admit(2, kRoot, QueryPriority::Interactive, 10ms),
+      QueryExecError);
+  auto other = scheduler.admit(2, "/other", QueryPriority::Interactive, 1s);
+}
+
+TEST(QueryScheduler, interactive_queries_get_weighted_turns) {
+  QueryScheduler scheduler{{1, 10, 10, 2}};
+  std::optional<QueryScheduler::Ticket> running{
+      scheduler.admit(0, kRoot, QueryPriority::Interactive, 1s)};
+
+  Arrivals arrivals{scheduler};
+  arrivals.add(1, QueryPriority::Batch);
+  arrivals.add(2, QueryPriority::Batch);
+  arrivals.add(3, QueryPriority::Interactive);
+  arrivals.add(4, QueryPriority::Interactive);
+  arrivals.add(5, QueryPriority::Interactive);
+  running.reset();
+
+  // Two interactive turns for each batch turn, while both are waiting
+  EXPECT_EQ((std::vector<pid_t>{3, 4, 1, 5, 2}), arrivals.finish());
+  EXPECT_EQ(2, scheduler.getStats().admittedBatch);
+}
+
+TEST(QueryScheduler, the_client_with_the_fewest_running_goes_first) {
+  QueryScheduler scheduler{{2, 2, 10, 1}};
+  auto busy = scheduler.admit(1, kRoot, QueryPriority::Interactive, 1s);
+  std::optional<QueryScheduler::Ticket> running{
+      scheduler.admit(3, kRoot, QueryPriority::Interactive, 1s)};
+
+  Arrivals arrivals{scheduler};
+  arrivals.add(1, QueryPriority::Interactive);
+  arrivals.add(2, QueryPriority::Interactive);
+  running.reset();
+
+  // Client 2 arrived later, but client 1 already has a query running
+  EXPECT_EQ((std::vector<pid_t>{2, 1}), arrivals.finish());
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/RecencyIndex.h"
+#include <folly/portability/GTest.h>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <unordered_set>
+#include <vector>
+
+using namespace watchman;
+
+namespace {
+
+struct Node {
+  Node* next = nullptr;
+  struct {
+    ClockTicks ticks = 0;
+  } otime;
+  int id = 0;
+};
+
+// A recency list that always moves changed nodes to its head, like the
+// view's file list.
+class RecencyList {
+ public:
+  explicit RecencyList(size_t numNodes, size_t blockSize) : index(blockSize) {
+    for (size_t i = 0; i < numNodes; ++i) {
+      auto& node = nodes.emplace_back();
+      node.id = int(i);
+    }
+  }
+
+  void change(int id, ClockTicks ticks) {
+    auto* node = &nodes[id];
+    for (Node** link = &head; *link; link = &(*link)->next) {
+      if (*link == node) {
+        *link = node->next;
+        break;
+      }
+    }
+    node->otime.ticks = ticks;
+    node->next = head;
+    head = node;
+    index.nodeInserted(node);
+  }
+
+  std::vector<int> changedAfterByWalking(ClockTicks ticks) const {
+    std::vector<int> ids;
+    for (Node* node = head; node && node->otime.ticks > ticks;
+         node = node->next) {
+      ids.push_back(node->id);
+    }
+    return ids;
+  }
+
+  std::vector<int> changedAfterOldestFirst(
+      ClockTicks ticks,
+      size_t limit = SIZE_MAX) const {
+    std::vector<int> ids;
+    index.forEachAfterOldestFirst(head, ticks, [&](Node* node) {
+      ids.push_back(node->id);
+      return ids.size() < limit;
+    });
+    return ids;
+  }
+
+  Node* seekByWalking(ClockTicks ticks) const {
+    Node* node = head;
+    while (node && node->otime.ticks > ticks) {
+      node = node->next;
+    }
+    return node;
+  }
+
+  std::deque<Node> nodes;
+  Node* head = nullptr;
+  RecencyIndex<Node> index;
+};
+
+} // namespace
+
+TEST(RecencyIndexTest, seek_matches_walk) {
+  RecencyList list(1000, 8);
+  ClockTicks ticks = 1;
+  for (int i = 0; i < 1000; ++i) {
+    list.change(i, ticks);
+    if (i % 3 == 0) {
+      ++ticks;
+    }
+  }
+  // Change some files again so that their checkpoints go stale
+  for (int i = 0; i < 1000; i += 7) {
+    list.change(i, ++ticks);
+  }
+  EXPECT_GT(list.index.numCheckpoints(), 0);
+
+  for (ClockTicks t = 0; t <= ticks + 1; ++t) {
+    ASSERT_EQ(list.seekByWalking(t), list.index.seek(list.head, t))
+        << "ticks " << t;
+  }
+}
+
+TEST(RecencyIndexTest, oldest_first_is_reverse_of_walk) {
+  RecencyList list(500, 4);
+  ClockTicks ticks = 1;
+  for (int round = 0; round < 3; ++round) {
+    for (int i = round; i < 500; i += round + 1) {
+      list.change(i, ++ticks);
+    }
+  }
+
+  for (ClockTicks t = 0; t <= ticks; t += 5) {
+    auto expected = list.changedAfterByWalking(t);
+    std::reverse(expected.begin(), expected.end());
+    ASSERT_EQ(expected, list.changedAfterOldestFirst(t)) << "ticks " << t;
+  }
+}
+
+TEST(RecencyIndexTest, oldest_first_stops_early) {
+  RecencyList list(100, 4);
+  for (int i = 0; i < 100; ++i) {
+    list.change(i, i + 1);
+  }
+  EXPECT_EQ(
+      (std::vector<int>{50, 51, 52}), list.changedAfterOldestFirst(50, 3));
+}
+
+TEST(RecencyIndexTest, rebuild_after_removal) {
+  RecencyList list(100, 4);
+  for (int i = 0; i < 100; ++i) {
+    list.change(i, i / 10 + 1);
+  }
+  // Drop the oldest half of the list, as aging out would
+  auto* node = list.head;
+  for (int i = 0; i < 49; ++i) {
+    node = node->next;
+  }
+  node->next = nullptr;
+  list.index.rebuild(list.head);
+
+  for (ClockTicks t = 0; t <= 12; ++t) {
+    ASSERT_EQ(list.seekByWalking(t), list.index.seek(list.head, t))
+        << "ticks " << t;
+  }
+}
+
+TEST(RecencyIndexTest, seek_after_nodes_removed) {
+  RecencyList list(100, 4);
+  for (int i = 0; i < 100; ++i) {
+    list.change(i, i + 1);
+  }
+  EXPECT_GT(list.index.numCheckpoints(), 0);
+
+  // Unlink every third node, as a slice of aging out would
+  std::unordered_set<const Node*> removed;
+  for (Node** link = &list.head; *link;) {
+    if ((*link)->id % 3 == 0) {
+      removed.insert(*link);
+      *link = (*link)->next;
+    } else {
+      link = &(*link)->next;
+    }
+  }
+  list.index.nodesRemoved(removed);
+
+  for (ClockTicks t = 0; t <= 101; ++t) {
+    auto* node = list.index.seek(list.head, t);
+    ASSERT_EQ(0, removed.count(node)) << "ticks " << t;
+    ASSERT_EQ(list.seekByWalking(t), node) << "ticks " << t;
+  }
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/RecencyLog.h"
+#include <folly/portability/GTest.h>
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <vector>
+
+using namespace watchman;
+
+namespace {
+
+struct Node {
+  Node* next = nullptr;
+  const int* parent = nullptr;
+  struct {
+    ClockTicks ticks = 0;
+  } otime;
+  int id = 0;
+  bool listed = false;
+};
+
+const int kEven = 0;
+const int kOdd = 1;
+
+// A recency list that always moves changed nodes to its head, like the
+// view's file list.
+class RecencyList {
+ public:
+  explicit RecencyList(size_t numNodes) {
+    for (size_t i = 0; i < numNodes; ++i) {
+      auto& node = nodes.emplace_back();
+      node.id = int(i);
+      node.parent = i % 2 ? &kOdd : &kEven;
+    }
+  }
+
+  void change(int id, ClockTicks ticks) {
+    auto* node = &nodes[id];
+    for (Node** link = &head; *link; link = &(*link)->next) {
+      if (*link == node) {
+        *link = node->next;
+        break;
+      }
+    }
+    auto previousTicks = node->otime.ticks;
+    bool wasListed = node->listed;
+    node->otime.ticks = ticks;
+    node->next = head;
+    node->listed = true;
+    head = node;
+    log.nodeChanged(node, wasListed, previousTicks);
+  }
+
+  std::vector<int> changedAfterByWalking(ClockTicks ticks, bool oddOnly)
+      const {
+    std::vector<int> ids;
+    for (Node* node = head; node && node->otime.ticks > ticks;
+         node = node->next) {
+      if (!oddOnly || node->parent == &kOdd) {
+        ids.push_back(node->id);
+      }
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+  }
+
+  std::vector<int> changedAfterFromLog(ClockTicks ticks, bool oddOnly) const {
+    std::vector<int> ids;
+    size_t walked = 0;
+    log.forEachAfter(
+        ticks,
+        [&](const int* parent) { return !oddOnly || parent == &kOdd; },
+        [&](Node* node) {
+          ids.push_back(node->id);
+          return true;
+        },
+        walked);
+    std::sort(ids.begin(), ids.end());
+    return ids;
+  }
+
+  std::deque<Node> nodes;
+  Node* head = nullptr;
+  RecencyLog<Node> log;
+};
+
+} // namespace
+
+TEST(RecencyLog, matches_walking_the_list) {
+  RecencyList list{500};
+  std::mt19937 rng{7};
+  ClockTicks ticks = 1;
+  for (int i = 0; i < 20000; ++i) {
+    // Several changes often share a tick, sometimes to the same node
+    if (rng() % 3 == 0) {
+      ++ticks;
+    }
+    list.change(int(rng() % list.nodes.size()), ticks);
+  }
+  // Stale entries were swept out along the way
+  EXPECT_LT(list.log.size(), 5000);
+
+  for (ClockTicks since = 0; since <= ticks; since += 97) {
+    for (bool oddOnly : {false, true}) {
+      EXPECT_EQ(
+          list.changedAfterByWalking(since, oddOnly),
+          list.changedAfterFromLog(since, oddOnly))
+          << "since " << since << " oddOnly " << oddOnly;
+    }
+  }
+}
+
+TEST(RecencyLog, same_tick_changes_are_reported_once) {
+  RecencyList list{3};
+  list.change(0, 1);
+  list.change(1, 1);
+  list.change(0, 1);
+  list.change(0, 2);
+  list.change(0, 2);
+  EXPECT_EQ(3, list.log.size());
+  EXPECT_EQ((std::vector<int>{0, 1}), list.changedAfterFromLog(0, false));
+  EXPECT_EQ((std::vector<int>{0}), list.changedAfterFromLog(1, false));
+}
+
+TEST(RecencyLog, rebuild_and_remove) {
+  RecencyList list{4};
+  for (int i = 0; i < 4; ++i) {
+    list.change(i, ClockTicks(i + 1));
+  }
+  list.log.rebuild(list.head);
+  EXPECT_EQ(4, list.log.size());
+  EXPECT_EQ(
+      (std::vector<int>{1, 2, 3}), list.changedAfterFromLog(1, false));
+
+  list.log.nodesRemoved({&list.nodes[2]});
+  EXPECT_EQ((std::vector<int>{1, 3}), list.changedAfterFromLog(1, false));
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GMock.h>
+#include <folly/portability/GTest.h>
+#include <limits>
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryExpr.h"
+#include "watchman/query/TermRegistry.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+
+using namespace watchman;
+using namespace testing;
+
+namespace {
+constexpr auto kMin = std::numeric_limits<int64_t>::min();
+constexpr auto kMax = std::numeric_limits<int64_t>::max();
+
+std::optional<std::pair<int64_t, int64_t>> expr_to_range(
+    std::string expression_json,
+    StatRangeField field) {
+  json_error_t err{};
+  auto expression = json_loads(expression_json.c_str(), JSON_DECODE_ANY, &err);
+  if (!expression.has_value()) {
+    ADD_FAILURE() << "JSON parse error in fixture: " << err.text << " at "
+                  << err.source << ":" << err.line << ":" << err.column;
+    return std::nullopt;
+  }
+  Query query;
+  auto expr = watchman::parseQueryExpr(&query, *expression);
+  auto range = expr->computeStatRange(field);
+  if (!range) {
+    return std::nullopt;
+  }
+  return std::make_pair(range->min, range->max);
+}
+
+std::optional<std::pair<int64_t, int64_t>> size_range(std::string json) {
+  return expr_to_range(std::move(json), StatRangeField::Size);
+}
+
+std::optional<std::pair<int64_t, int64_t>> mtime_range(std::string json) {
+  return expr_to_range(std::move(json), StatRangeField::Mtime);
+}
+} // namespace
+
+TEST(StatRangeTest, size_comparisons) {
+  EXPECT_THAT(
+      size_range(R"( ["size", "eq", 10] )"), Optional(Pair(10, 10)));
+  EXPECT_THAT(
+      size_range(R"( ["size", "gt", 10] )"), Optional(Pair(11, kMax)));
+  EXPECT_THAT(
+      size_range(R"( ["size", "ge", 10] )"), Optional(Pair(10, kMax)));
+  EXPECT_THAT(
+      size_range(R"( ["size", "lt", 10] )"), Optional(Pair(kMin, 9)));
+  EXPECT_THAT(
+      size_range(R"( ["size", "le", 10] )"), Optional(Pair(kMin, 10)));
+  EXPECT_THAT(size_range(R"( ["size", "ne", 10] )"), Eq(std::nullopt));
+  EXPECT_THAT(mtime_range(R"( ["size", "gt", 10] )"), Eq(std::nullopt));
+}
+
+TEST(StatRangeTest, since_mtime) {
+  EXPECT_THAT(
+      mtime_range(R"( ["since", 1000, "mtime"] )"),
+      Optional(Pair(1000, kMax)));
+  EXPECT_THAT(mtime_range(R"( ["since", 1000, "ctime"] )"), Eq(std::nullopt));
+  EXPECT_THAT(mtime_range(R"( ["since", 1000] )"), Eq(std::nullopt));
+  EXPECT_THAT(size_range(R"( ["since", 1000, "mtime"] )"), Eq(std::nullopt));
+}
+
+TEST(StatRangeTest, compound_expressions) {
+  EXPECT_THAT(
+      size_range(
+          R"( ["allof", ["size", "gt", 10], ["size", "lt", 100], ["type", "f"]] )"),
+      Optional(Pair(11, 99)));
+  EXPECT_THAT(
+      size_range(R"( ["anyof", ["size", "eq", 5], ["size", "eq", 50]] )"),
+      Optional(Pair(5, 50)));
+  EXPECT_THAT(
+      size_range(R"( ["anyof", ["size", "eq", 5], ["type", "f"]] )"),
+      Eq(std::nullopt));
+  EXPECT_THAT(
+      size_range(R"( ["not", ["size", "eq", 5]] )"), Eq(std::nullopt));
+}
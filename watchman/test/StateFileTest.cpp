@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/StateFile.h"
+#include <folly/portability/GTest.h>
+#include <stdexcept>
+#include <string>
+
+using namespace watchman;
+
+namespace {
+
+json_ref rootRecord(const char* path, json_int_t lastQuery) {
+  return json_object(
+      {{"path", typed_string_to_json(path, W_STRING_BYTE)},
+       {"triggers",
+        json_array({json_object(
+            {{"name", typed_string_to_json("build", W_STRING_UNICODE)}})})},
+       {"last_query", json_integer(lastQuery)}});
+}
+
+std::string beginWithFirstRoot() {
+  auto data = beginStateFile(json_object(
+      {{"version", typed_string_to_json("2026.10.14", W_STRING_UNICODE)}}));
+  appendStateRecord(data, rootRecord("/first", 10));
+  return data;
+}
+
+std::string encode() {
+  auto data = beginWithFirstRoot();
+  appendStateRecord(data, rootRecord("/second", 20));
+  return data;
+}
+
+} // namespace
+
+TEST(StateFile, round_trips_the_binary_format) {
+  auto state = decodeStateFile(encode());
+  EXPECT_EQ(w_string{"2026.10.14"}, state.get("version").asString());
+
+  auto watched = state.get("watched");
+  ASSERT_EQ(2, json_array_size(watched));
+  EXPECT_TRUE(json_equal(rootRecord("/first", 10), watched.at(0)));
+  EXPECT_TRUE(json_equal(rootRecord("/second", 20), watched.at(1)));
+}
+
+TEST(StateFile, a_header_with_no_roots_watches_nothing) {
+  auto state = decodeStateFile(beginStateFile(json_object()));
+  EXPECT_EQ(0, json_array_size(state.get("watched")));
+}
+
+TEST(StateFile, reads_the_json_that_older_versions_wrote) {
+  auto state = decodeStateFile(
+      R"({"version": "2024.01.01", "watched": [)"
+      R"({"path": "/first", "triggers": []}]})");
+  EXPECT_EQ(w_string{"2024.01.01"}, state.get("version").asString());
+
+  auto watched = state.get("watched");
+  ASSERT_EQ(1, json_array_size(watched));
+  EXPECT_EQ(w_string{"/first"}, watched.at(0).get("path").asString());
+}
+
+TEST(StateFile, rejects_malformed_json) {
+  EXPECT_THROW(decodeStateFile(R"({"watched": [)"), std::runtime_error);
+}
+
+TEST(StateFile, rejects_truncated_records) {
+  auto data = encode();
+  auto lastRecord = beginWithFirstRoot().size();
+  // Cut into the body of the last record, into its length prefix and into
+  // the format version
+  for (size_t size :
+       {data.size() - 1, lastRecord + 2, kStateMagic.size() + 2}) {
+    EXPECT_THROW(
+        decodeStateFile(std::string_view{data}.substr(0, size)),
+        std::runtime_error)
+        << "truncated to " << size << " bytes";
+  }
+}
+
+TEST(StateFile, rejects_unknown_format_versions) {
+  auto data = encode();
+  data[kStateMagic.size()] = char(kStateFormatVersion + 1);
+  EXPECT_THROW(decodeStateFile(data), std::runtime_error);
+}
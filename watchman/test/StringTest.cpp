@@ -7,6 +7,7 @@
 
 #include <folly/portability/GTest.h>
 #include <string>
+#include "watchman/PathBuilder.h"
 #include "watchman/watchman_string.h"
 
 TEST(String, fmt) {
@@ -133,6 +134,52 @@ TEST(String, concat) {
   EXPECT_EQ(str, w_string("one2three1.2false"));
 }
 
+TEST(String, case_folding_is_ascii_only) {
+  // Long enough to exercise both the word-at-a-time and the tail loops
+  EXPECT_EQ(
+      w_string_piece("Some/Mixed_Case@Path[With]Punctuation.TXT").asLowerCase(),
+      w_string("some/mixed_case@path[with]punctuation.txt"));
+  // Bytes outside of ASCII are left alone
+  EXPECT_EQ(
+      w_string_piece("\xC3\x89"
+                     "COLE-\xC3\x89"
+                     "T\xC3\x89")
+          .asLowerCase(),
+      w_string("\xC3\x89"
+               "cole-\xC3\x89"
+               "t\xC3\x89"));
+
+  EXPECT_TRUE(w_string_equal_caseless(
+      "Some/Mixed_Case@Path.TXT", "some/mixed_case@path.txt"));
+  // '@' and '`' differ only in the case bit, but are not letters
+  EXPECT_FALSE(w_string_equal_caseless("@not_a_lETTER", "`not_a_letter"));
+  EXPECT_FALSE(w_string_equal_caseless("[bracketed]xyz", "{bracketed}xyz"));
+  EXPECT_FALSE(w_string_equal_caseless("abcdefghij", "abcdefghik"));
+
+  EXPECT_TRUE(w_string_piece("FOO/Bar/baz.CPP").startsWithCaseInsensitive(
+      "foo/bar/BAZ"));
+  EXPECT_FALSE(w_string_piece("foo/bar/baz.cpp").startsWithCaseInsensitive(
+      "foo/bar/bax"));
+
+  EXPECT_TRUE(w_string_piece("Main.CPP").hasSuffix("cpp"));
+  EXPECT_FALSE(w_string_piece("Main.CPX").hasSuffix("cpp"));
+}
+
+TEST(String, lowercase_buffer) {
+  watchman::LowerCaseBuffer short_name{"Some/Mixed_Case@Path.TXT"};
+  EXPECT_EQ(short_name.piece(), "some/mixed_case@path.txt");
+  EXPECT_EQ(0, short_name.piece().data()[short_name.piece().size()]);
+
+  watchman::LowerCaseBuffer empty{w_string_piece{}};
+  EXPECT_TRUE(empty.piece().empty());
+
+  // Too long to be held inline
+  std::string long_name(1000, 'A');
+  watchman::LowerCaseBuffer long_buffer{long_name};
+  EXPECT_EQ(long_buffer.piece(), std::string(1000, 'a'));
+  EXPECT_EQ(0, long_buffer.piece().data()[1000]);
+}
+
 TEST(String, lowercase_suffix) {
   EXPECT_FALSE(w_string("").asLowerCaseSuffix());
   EXPECT_EQ(w_string(".").asLowerCaseSuffix(), std::nullopt);
@@ -257,6 +304,30 @@ TEST(String, path_cat) {
   EXPECT_EQ(7, str.size());
 }
 
+TEST(String, path_builder) {
+  watchman::PathBuilder buf;
+  EXPECT_EQ(w_string_piece(""), buf.piece());
+
+  buf.appendComponent("");
+  buf.appendComponent("foo");
+  buf.appendComponent("");
+  buf.appendComponent("bar");
+  EXPECT_EQ(w_string_piece("foo/bar"), buf.piece());
+  EXPECT_EQ(w_string::pathCat({"", "foo", "", "bar"}), buf.asWString());
+
+  buf.truncate(3);
+  buf.append(".txt");
+  EXPECT_EQ(w_string_piece("foo.txt"), buf.piece());
+
+  // Longer than the inline buffer
+  std::string longName(watchman::PathBuilder::kInlineSize * 2, 'x');
+  buf.appendComponent(longName);
+  EXPECT_EQ("foo.txt/" + longName, buf.asWString().string());
+
+  buf.clear();
+  EXPECT_EQ(0, buf.size());
+}
+
 TEST(String, basename_dirname) {
   auto str = w_string_piece("foo/bar").baseName().asWString();
   EXPECT_EQ(str, "bar");
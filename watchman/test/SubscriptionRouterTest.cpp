@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SubscriptionRouter.h"
+
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+namespace {
+
+constexpr ClockRoot kRoot = 1;
+
+class SubscriptionRouterTest : public testing::Test {
+ protected:
+  SubscriptionRouter router{100};
+
+  void settle(ClockTicks ticks, uint64_t structureGeneration = 0) {
+    router.settled(ClockPosition{kRoot, ticks}, structureGeneration);
+  }
+
+  bool isUnchanged(
+      const SubscriptionRoute& route,
+      ClockTicks since,
+      ClockTicks now) {
+    return router.isUnchangedSince(
+        route, ClockPosition{kRoot, since}, ClockPosition{kRoot, now});
+  }
+};
+
+} // namespace
+
+TEST_F(SubscriptionRouterTest, only_changes_in_scope_are_routed) {
+  settle(1);
+  auto foo = router.addRoute({"/root/foo"}, ClockPosition{kRoot, 1});
+  auto bar = router.addRoute({"/root/bar/baz"}, ClockPosition{kRoot, 1});
+  EXPECT_TRUE(router.isRouting());
+
+  router.pathChanged("/root/foo/a/b");
+  settle(2);
+  EXPECT_FALSE(isUnchanged(*foo, 1, 2));
+  EXPECT_TRUE(isUnchanged(*foo, 2, 2));
+  EXPECT_TRUE(isUnchanged(*bar, 1, 2));
+
+  // A dir above the scope counts, its neighbours don't
+  router.pathChanged("/root/bar");
+  router.pathChanged("/root/foobar");
+  settle(3);
+  EXPECT_TRUE(isUnchanged(*foo, 2, 3));
+  EXPECT_FALSE(isUnchanged(*bar, 2, 3));
+}
+
+TEST_F(SubscriptionRouterTest, unknown_unless_settled_at_now) {
+  settle(1);
+  auto foo = router.addRoute({"/root/foo"}, ClockPosition{kRoot, 1});
+  settle(2);
+  EXPECT_TRUE(isUnchanged(*foo, 1, 2));
+  // Changes after the settle haven't been routed yet
+  EXPECT_FALSE(isUnchanged(*foo, 1, 3));
+  // Nor were changes before the route was added collected
+  EXPECT_FALSE(isUnchanged(*foo, 0, 2));
+}
+
+TEST_F(SubscriptionRouterTest, overflow_and_structure_changes_route_to_all) {
+  settle(1);
+  auto foo = router.addRoute({"/root/foo"}, ClockPosition{kRoot, 1});
+  settle(2);
+
+  for (int i = 0; i < 101; ++i) {
+    router.pathChanged(w_string::build("/root/other/", i));
+  }
+  settle(3);
+  EXPECT_FALSE(isUnchanged(*foo, 2, 3));
+
+  settle(4, /*structureGeneration=*/1);
+  EXPECT_FALSE(isUnchanged(*foo, 3, 4));
+  settle(5, /*structureGeneration=*/1);
+  EXPECT_TRUE(isUnchanged(*foo, 4, 5));
+}
+
+TEST_F(SubscriptionRouterTest, dropped_routes_are_forgotten) {
+  settle(1);
+  auto foo = router.addRoute({"/root/foo"}, ClockPosition{kRoot, 1});
+  auto foo2 = router.addRoute({"/root/foo"}, ClockPosition{kRoot, 1});
+  foo.reset();
+  settle(2);
+  EXPECT_TRUE(router.isRouting());
+
+  router.pathChanged("/root/foo/a");
+  settle(3);
+  EXPECT_FALSE(isUnchanged(*foo2, 2, 3));
+
+  foo2.reset();
+  settle(4);
+  EXPECT_FALSE(router.isRouting());
+}
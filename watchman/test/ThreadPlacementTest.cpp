@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadPlacement.h"
+
+#include <folly/portability/GTest.h>
+#include <stdexcept>
+
+using namespace watchman;
+
+namespace {
+
+ThreadPlacement parse(const char* spec) {
+  json_error_t err;
+  return parseThreadPlacement(json_loads(spec, 0, &err).value());
+}
+
+} // namespace
+
+TEST(ThreadPlacementTest, empty_spec_changes_nothing) {
+  EXPECT_TRUE(parse("{}").empty());
+}
+
+TEST(ThreadPlacementTest, parses_every_setting) {
+  auto placement = parse(
+      R"({"cpus": [6, "2-4", 3], "nice": 5, "policy": "batch",)"
+      R"( "qos": "utility"})");
+  EXPECT_EQ((std::vector<unsigned>{2, 3, 4, 6}), placement.cpus);
+  ASSERT_TRUE(placement.nice);
+  EXPECT_EQ(5, *placement.nice);
+  EXPECT_EQ(ThreadPlacement::Policy::Batch, placement.policy);
+  EXPECT_EQ(ThreadPlacement::Qos::Utility, placement.qos);
+  EXPECT_FALSE(placement.empty());
+}
+
+TEST(ThreadPlacementTest, rejects_malformed_specs) {
+  EXPECT_THROW(parse("[]"), std::domain_error);
+  EXPECT_THROW(parse(R"({"cpus": 3})"), std::domain_error);
+  EXPECT_THROW(parse(R"({"cpus": [-1]})"), std::domain_error);
+  EXPECT_THROW(parse(R"({"cpus": ["4-2"]})"), std::domain_error);
+  EXPECT_THROW(parse(R"({"cpus": ["1-2x"]})"), std::domain_error);
+  EXPECT_THROW(parse(R"({"nice": 40})"), std::domain_error);
+  EXPECT_THROW(parse(R"({"policy": "fifo"})"), std::domain_error);
+  EXPECT_THROW(parse(R"({"qos": "interactive"})"), std::domain_error);
+  EXPECT_THROW(parse(R"({"affinity": [0]})"), std::domain_error);
+}
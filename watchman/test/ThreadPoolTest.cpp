@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <vector>
+
+#include "watchman/ThreadPool.h"
+
+using namespace watchman;
+
+TEST(ThreadPoolTest, higher_classes_run_first) {
+  ThreadPool pool;
+  pool.start(1, 1024);
+
+  // Occupy the only worker while the other tasks are queued
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  pool.add([released] { released.wait(); }, WorkClass::Hash);
+
+  std::mutex mutex;
+  std::vector<WorkClass> order;
+  std::promise<void> done;
+  auto record = [&](WorkClass workClass) {
+    std::lock_guard<std::mutex> lock(mutex);
+    order.push_back(workClass);
+    if (order.size() == 4) {
+      done.set_value();
+    }
+  };
+
+  pool.add([&] { record(WorkClass::Hash); }, WorkClass::Hash);
+  pool.executorFor(WorkClass::Crawl)->add([&] { record(WorkClass::Crawl); });
+  pool.add([&] { record(WorkClass::Query); });
+  pool.add([&] { record(WorkClass::Symlink); }, WorkClass::Symlink);
+
+  release.set_value();
+  done.get_future().wait();
+  pool.stop();
+
+  std::vector<WorkClass> expected{
+      WorkClass::Query,
+      WorkClass::Symlink,
+      WorkClass::Crawl,
+      WorkClass::Hash};
+  EXPECT_EQ(expected, order);
+}
+
+TEST(ThreadPoolTest, starts_on_first_add) {
+  ThreadPool pool;
+  std::promise<void> ran;
+  pool.add([&] { ran.set_value(); }, WorkClass::Crawl);
+  ran.get_future().wait();
+  pool.stop();
+}
+
+TEST(ThreadPoolTest, idle_workers_steal_tasks) {
+  ThreadPool pool;
+  pool.start(2, 1024);
+
+  // The inner task is queued on the worker running the outer one, which
+  // waits for it, so it can only run if the other worker steals it.
+  std::promise<void> done;
+  pool.add([&] {
+    std::promise<void> inner;
+    pool.add([&] { inner.set_value(); });
+    inner.get_future().wait();
+    done.set_value();
+  });
+  done.get_future().wait();
+  pool.stop();
+}
+
+TEST(ThreadPoolTest, full_queue_blocks_until_there_is_room) {
+  ThreadPool pool;
+  pool.start(1, 3);
+
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  pool.add([released] { released.wait(); });
+
+  std::atomic<int> ran{0};
+  pool.add([&] { ++ran; });
+  auto adder = std::async(std::launch::async, [&] {
+    pool.add([&] { ++ran; });
+    pool.add([&] { ++ran; });
+  });
+  EXPECT_EQ(
+      std::future_status::timeout,
+      adder.wait_for(std::chrono::milliseconds(100)));
+
+  release.set_value();
+  adder.get();
+  pool.stop();
+  EXPECT_EQ(3, ran.load());
+}
+
+TEST(ThreadPoolTest, workers_are_not_blocked_by_a_full_queue) {
+  ThreadPool pool;
+  pool.start(1, 2);
+
+  std::atomic<int> ran{0};
+  std::promise<void> done;
+  pool.add([&] {
+    for (int i = 0; i < 5; ++i) {
+      pool.add([&] {
+        if (++ran == 5) {
+          done.set_value();
+        }
+      });
+    }
+  });
+  done.get_future().wait();
+  pool.stop();
+}
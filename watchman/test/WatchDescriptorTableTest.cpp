@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/WatchDescriptorTable.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+TEST(WatchDescriptorTable, paths_are_built_from_parents) {
+  WatchDescriptorTable table;
+  table.insert(1, "/root");
+  table.insert(2, "/root/src");
+  table.insert(3, "/root/src/lib");
+  table.insert(4, "/root/test/lib");
+
+  EXPECT_EQ(w_string{"/root"}, table.path(1));
+  EXPECT_EQ(w_string{"/root/src"}, table.path(2));
+  EXPECT_EQ(w_string{"/root/src/lib"}, table.path(3));
+  // The parent of 4 isn't watched
+  EXPECT_EQ(w_string{"/root/test/lib"}, table.path(4));
+  EXPECT_FALSE(table.path(5).has_value());
+  EXPECT_EQ(4, table.size());
+  // "src" and "lib"
+  EXPECT_EQ(2, table.numNames());
+}
+
+TEST(WatchDescriptorTable, children_follow_a_rename) {
+  WatchDescriptorTable table;
+  table.insert(1, "/root");
+  table.insert(2, "/root/a");
+  table.insert(3, "/root/a/b");
+
+  table.insert(2, "/root/c");
+  EXPECT_EQ(w_string{"/root/c"}, table.path(2));
+  EXPECT_EQ(w_string{"/root/c/b"}, table.path(3));
+
+  // New dirs below the new name find their parent
+  table.insert(4, "/root/c/d");
+  EXPECT_EQ(w_string{"/root/c/d"}, table.path(4));
+  EXPECT_EQ(4, table.size());
+}
+
+TEST(WatchDescriptorTable, erased_parents_are_kept_for_their_children) {
+  WatchDescriptorTable table;
+  table.insert(1, "/root");
+  table.insert(2, "/root/a");
+  table.insert(3, "/root/a/b");
+
+  table.erase(2);
+  EXPECT_FALSE(table.path(2).has_value());
+  EXPECT_EQ(w_string{"/root/a/b"}, table.path(3));
+  EXPECT_EQ(2, table.size());
+
+  table.erase(3);
+  EXPECT_FALSE(table.path(3).has_value());
+  EXPECT_EQ(1, table.size());
+  EXPECT_EQ(0, table.numNames());
+
+  // A dir recreated with the same name gets a new descriptor
+  table.insert(4, "/root/a");
+  table.insert(5, "/root/a/b");
+  EXPECT_EQ(w_string{"/root/a/b"}, table.path(5));
+}
+
+TEST(WatchDescriptorTable, replaced_dir_keeps_its_path) {
+  WatchDescriptorTable table;
+  table.insert(1, "/root");
+  table.insert(2, "/root/a");
+  // /root/a was replaced before the old one was erased
+  table.insert(3, "/root/a");
+  table.erase(2);
+
+  table.insert(4, "/root/a/b");
+  EXPECT_EQ(w_string{"/root/a"}, table.path(3));
+  EXPECT_EQ(w_string{"/root/a/b"}, table.path(4));
+  table.erase(4);
+  table.erase(3);
+  EXPECT_EQ(0, table.numNames());
+}
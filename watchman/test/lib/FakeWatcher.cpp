@@ -26,17 +26,26 @@ std::unique_ptr<DirHandle> FakeWatcher::startWatchDir(
   return fileSystem_.openDir(path);
 }
 
+void FakeWatcher::queueChanges(std::vector<PendingChange> changes) {
+  auto queued = queued_.wlock();
+  for (auto& change : changes) {
+    queued->push_back(std::move(change));
+  }
+}
+
 bool FakeWatcher::waitNotify(int timeoutms) {
   (void)timeoutms;
-  throw std::logic_error{"waitNotify not implemented"};
+  return !queued_.rlock()->empty();
 }
 
 Watcher::ConsumeNotifyRet FakeWatcher::consumeNotify(
     const std::shared_ptr<Root>& root,
     PendingChanges& coll) {
   (void)root;
-  (void)coll;
-  throw std::logic_error{"consumeNotify not implemented"};
+  std::vector<PendingChange> changes;
+  queued_.wlock()->swap(changes);
+  coll.addBatch(changes);
+  return {false};
 }
 
 } // namespace watchman
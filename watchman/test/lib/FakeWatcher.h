@@ -7,6 +7,9 @@
 
 #pragma once
 
+#include <folly/Synchronized.h>
+#include <vector>
+#include "watchman/PendingCollection.h"
 #include "watchman/watcher/Watcher.h"
 
 namespace watchman {
@@ -23,6 +26,13 @@ class FakeWatcher : public Watcher {
       const std::shared_ptr<Root>& root,
       const char* path) override;
 
+  /**
+   * Queues changes for the next consumeNotify, as if the kernel had
+   * reported them.
+   */
+  void queueChanges(std::vector<PendingChange> changes);
+
+  // Returns whether changes are queued, without waiting for any
   bool waitNotify(int timeoutms) override;
   ConsumeNotifyRet consumeNotify(
       const std::shared_ptr<Root>& root,
@@ -31,6 +41,7 @@ class FakeWatcher : public Watcher {
  private:
   FileSystem& fileSystem_;
   bool failsToStart_;
+  folly::Synchronized<std::vector<PendingChange>> queued_;
 };
 
 } // namespace watchman
@@ -12,6 +12,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <charconv>
+#include <cstdint>
 
 #include "jansson.h"
 #include "jansson_private.h"
@@ -221,6 +223,11 @@ static int do_dump(
     case JSON_ARRAY: {
       auto& arr = json.array();
 
+      if (json_array_get_bser_rows(json)) {
+        // Pre-encoded BSER rows have no JSON representation
+        return -1;
+      }
+
       if (dump("[", 1, data)) {
         return -1;
       }
@@ -278,9 +285,9 @@ static int do_dump(
       }
 
       if (flags & JSON_SORT_KEYS) {
-        using Pair = std::pair<const w_string, json_ref>;
+        using Pair = json_object_map::value_type;
 
-        std::vector<Pair*> items;
+        std::vector<const Pair*> items;
         items.reserve(object->map.size());
         for (auto& item : object->map) {
           items.push_back(&item);
@@ -346,6 +353,238 @@ static int do_dump(
   }
 }
 
+namespace {
+
+/**
+ * Encodes compact JSON, which is what JSON clients are sent, without the
+ * overheads of do_dump. The output is accumulated in a buffer so that the
+ * callback sees a few large chunks rather than every token, and strings are
+ * scanned for characters that need escaping eight bytes at a time.
+ *
+ * Produces exactly what do_dump produces for JSON_COMPACT.
+ */
+class CompactDumper {
+ public:
+  CompactDumper(json_dump_callback_t callback, void* data)
+      : callback_{callback}, data_{data} {}
+
+  // Returns false if the value cannot be encoded or the callback failed
+  bool dump(const json_ref& json) {
+    return dumpValue(json) && flush();
+  }
+
+ private:
+  static constexpr size_t kBufferSize = 4096;
+
+  // Identifies compact JSON among the encodings an array may cache
+  static constexpr uint64_t kCompactEncodingKey = 0;
+
+  bool flush() {
+    if (len_ && callback_(buf_, len_, data_)) {
+      return false;
+    }
+    len_ = 0;
+    return true;
+  }
+
+  bool append(const char* str, size_t size) {
+    if (size > kBufferSize - len_) {
+      if (!flush()) {
+        return false;
+      }
+      if (size > kBufferSize) {
+        return callback_(str, size, data_) == 0;
+      }
+    }
+    memcpy(buf_ + len_, str, size);
+    len_ += size;
+    return true;
+  }
+
+  bool put(char c) {
+    if (len_ == kBufferSize && !flush()) {
+      return false;
+    }
+    buf_[len_++] = c;
+    return true;
+  }
+
+  bool dumpString(const char* str, size_t size) {
+    static constexpr char kHex[] = "0123456789abcdef";
+
+    if (!put('"')) {
+      return false;
+    }
+    const char* pos = str;
+    const char* end = str + size;
+    // The start of the bytes that can be copied verbatim
+    const char* run = pos;
+    while (pos < end) {
+      while (end - pos >= 8) {
+        uint64_t word;
+        memcpy(&word, pos, sizeof(word));
+        if (jsonp_has_special_byte(word)) {
+          break;
+        }
+        pos += 8;
+      }
+      if (pos == end) {
+        break;
+      }
+
+      auto c = (unsigned char)*pos;
+      if (c >= 0x80) {
+        // Validates the sequence, which is copied verbatim
+        int32_t codepoint;
+        const char* next = utf8_iterate(pos, &codepoint);
+        if (!next) {
+          return false;
+        }
+        pos = next;
+        continue;
+      }
+      if (c >= 0x20 && c != '"' && c != '\\') {
+        ++pos;
+        continue;
+      }
+
+      if (!append(run, pos - run)) {
+        return false;
+      }
+      if (c == 0) {
+        // do_dump sees the C string, which ends here
+        run = pos = end;
+        break;
+      }
+      char seq[6] = {'\\', 0};
+      size_t length = 2;
+      switch (c) {
+        case '\\':
+        case '"':
+          seq[1] = c;
+          break;
+        case '\b':
+          seq[1] = 'b';
+          break;
+        case '\f':
+          seq[1] = 'f';
+          break;
+        case '\n':
+          seq[1] = 'n';
+          break;
+        case '\r':
+          seq[1] = 'r';
+          break;
+        case '\t':
+          seq[1] = 't';
+          break;
+        default:
+          seq[1] = 'u';
+          seq[2] = '0';
+          seq[3] = '0';
+          seq[4] = kHex[c >> 4];
+          seq[5] = kHex[c & 0xf];
+          length = 6;
+          break;
+      }
+      if (!append(seq, length)) {
+        return false;
+      }
+      run = ++pos;
+    }
+    return append(run, pos - run) && put('"');
+  }
+
+  bool dumpString(const w_string& str) {
+    return dumpString(str.data(), str.size());
+  }
+
+  bool dumpValue(const json_ref& json) {
+    switch (json.type()) {
+      case JSON_NULL:
+        return append("null", 4);
+
+      case JSON_TRUE:
+        return append("true", 4);
+
+      case JSON_FALSE:
+        return append("false", 5);
+
+      case JSON_INTEGER: {
+        char buffer[MAX_INTEGER_STR_LENGTH];
+        auto result = std::to_chars(
+            buffer, buffer + sizeof(buffer), json_integer_value(json));
+        return append(buffer, result.ptr - buffer);
+      }
+
+      case JSON_REAL: {
+        char buffer[MAX_REAL_STR_LENGTH];
+        int size =
+            jsonp_dtostr(buffer, MAX_REAL_STR_LENGTH, json_real_value(json));
+        return size >= 0 && append(buffer, size);
+      }
+
+      case JSON_STRING:
+        return dumpString(json_to_w_string(json));
+
+      case JSON_ARRAY: {
+        auto cached = json_array_cached_encoding(
+            json, kCompactEncodingKey, [&](std::string& out) {
+              CompactDumper nested{dump_to_string, &out};
+              return nested.dumpArray(json) && nested.flush();
+            });
+        if (cached) {
+          return append(cached->data(), cached->size());
+        }
+        return dumpArray(json);
+      }
+
+      case JSON_OBJECT: {
+        auto& map = json_to_object(json.get())->map;
+        if (!put('{')) {
+          return false;
+        }
+        bool first = true;
+        for (auto& [key, value] : map) {
+          if ((!first && !put(',')) || !dumpString(key) || !put(':') ||
+              !dumpValue(value)) {
+            return false;
+          }
+          first = false;
+        }
+        return put('}');
+      }
+
+      default:
+        return false;
+    }
+  }
+
+  bool dumpArray(const json_ref& json) {
+    if (json_array_get_bser_rows(json)) {
+      // Pre-encoded BSER rows have no JSON representation
+      return false;
+    }
+    auto& arr = json.array();
+    if (!put('[')) {
+      return false;
+    }
+    for (size_t i = 0; i < arr.size(); ++i) {
+      if ((i && !put(',')) || !dumpValue(arr[i])) {
+        return false;
+      }
+    }
+    return put(']');
+  }
+
+  json_dump_callback_t callback_;
+  void* data_;
+  char buf_[kBufferSize];
+  size_t len_{0};
+};
+
+} // namespace
+
 std::string json_dumps(const json_ref& json, size_t flags) {
   std::string strbuff;
 
@@ -377,5 +616,9 @@ int json_dump_callback(
       return -1;
   }
 
+  if ((flags & ~JSON_ENCODE_ANY) == JSON_COMPACT) {
+    CompactDumper dumper{callback, data};
+    return dumper.dump(json) ? 0 : -1;
+  }
   return do_dump(json, flags, 0, callback, data);
 }
@@ -13,7 +13,9 @@
 #include <stdio.h>
 #include <atomic>
 #include <cstdlib> /* for size_t */
+#include <functional>
 #include <map>
+#include <memory>
 #include <optional>
 #include <string>
 #include <type_traits>
@@ -21,6 +23,9 @@
 #include <vector>
 #include "watchman/thirdparty/jansson/utf.h"
 
+class BserTemplateRows;
+class json_object_map;
+
 /* types */
 
 enum json_type : char {
@@ -152,7 +157,7 @@ class json_ref {
    * Throws domain_error if this is not an object.
    * This is useful for iterating over the object contents, etc.
    */
-  const std::unordered_map<w_string, json_ref>& object() const;
+  const json_object_map& object() const;
 
   /** Returns a reference to the array value at the specified index.
    * Throws out_of_range or domain_error if the index is bad or if
@@ -219,9 +224,80 @@ class json_ref {
   json_int_t asInt() const;
 };
 
+/**
+ * The members of a JSON object, in insertion order.
+ *
+ * Most objects, such as command arguments, PDU metadata and rendered files,
+ * have only a handful of keys.  A linear scan of a flat vector finds those
+ * faster than hashing, and costs one allocation rather than one per key
+ * plus a bucket array.  Objects that grow past kIndexThreshold keys also
+ * get a hash index so that lookups stay constant time.
+ */
+class json_object_map {
+ public:
+  using value_type = std::pair<w_string, json_ref>;
+  using const_iterator = std::vector<value_type>::const_iterator;
+
+  static constexpr size_t kIndexThreshold = 16;
+
+  json_object_map() = default;
+  explicit json_object_map(std::unordered_map<w_string, json_ref> values);
+
+  json_object_map(const json_object_map& other);
+  json_object_map& operator=(const json_object_map& other);
+  json_object_map(json_object_map&& other) noexcept = default;
+  json_object_map& operator=(json_object_map&& other) noexcept = default;
+
+  size_t size() const noexcept {
+    return entries_.size();
+  }
+  bool empty() const noexcept {
+    return entries_.empty();
+  }
+  const_iterator begin() const noexcept {
+    return entries_.begin();
+  }
+  const_iterator end() const noexcept {
+    return entries_.end();
+  }
+
+  const_iterator find(w_string_piece key) const;
+  size_t count(w_string_piece key) const {
+    return find(key) != end();
+  }
+
+  /**
+   * Returns the value of key.
+   * Throws out_of_range if key is not present.
+   */
+  const json_ref& at(w_string_piece key) const;
+
+  void reserve(size_t size) {
+    entries_.reserve(size);
+  }
+
+  /** Sets key to value, replacing any value it already had. */
+  void insert_or_assign(w_string key, json_ref value);
+
+  /**
+   * Adds key with value, unless key is already present.
+   * Returns whether it was added.
+   */
+  bool emplace(w_string key, json_ref value);
+
+ private:
+  void append(w_string key, json_ref value);
+
+  std::vector<value_type> entries_;
+  // Views of the keys in entries_, which never move because w_string's
+  // data is not stored inline, to their positions.
+  std::unique_ptr<std::unordered_map<w_string_piece, uint32_t>> index_;
+};
+
 /* construction, destruction, reference counting */
 
 json_ref json_object();
+json_ref json_object(json_object_map values);
 json_ref json_object(std::unordered_map<w_string, json_ref> values);
 json_ref json_object(
     std::initializer_list<std::pair<const char*, json_ref>> values);
@@ -298,6 +374,30 @@ size_t json_array_size(const json_ref& array);
 int json_array_set_template_new(const json_ref& json, json_ref&& templ);
 std::optional<json_ref> json_array_get_template(const json_ref& array);
 
+/* Attaches rows that were BSER encoded against the array's template as they
+ * were produced; they are emitted before the array's own elements.  Such an
+ * array can only be serialized as BSER with the same version and
+ * capabilities, and not as JSON. */
+int json_array_set_bser_rows(
+    const json_ref& json,
+    std::shared_ptr<const BserTemplateRows> rows);
+const BserTemplateRows* json_array_get_bser_rows(const json_ref& array);
+
+/* Makes the array keep its serializations: once it has been encoded as
+ * compact JSON, or as BSER with some version and capabilities, encoding it
+ * that way again copies the bytes. For arrays that are sent to many clients
+ * and never modified again. */
+int json_array_enable_encoding_cache(const json_ref& json);
+
+/* Returns the bytes of the array in the encoding identified by key, which
+ * encode produces into its argument the first time. Returns nullptr, without
+ * calling encode, if the array does not keep its serializations. Also returns
+ * nullptr if encode fails. */
+std::shared_ptr<const std::string> json_array_cached_encoding(
+    const json_ref& array,
+    uint64_t key,
+    const std::function<bool(std::string&)>& encode);
+
 const char* json_string_value(const json_ref& string);
 json_int_t json_integer_value(const json_ref& integer);
 double json_real_value(const json_ref& real);
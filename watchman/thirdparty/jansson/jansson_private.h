@@ -8,24 +8,32 @@
 #ifndef JANSSON_PRIVATE_H
 #define JANSSON_PRIVATE_H
 
+#include <folly/Synchronized.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <algorithm>
 #include <unordered_map>
 #include <vector>
 #include "jansson.h"
 
 struct json_object_t : json_t {
-  std::unordered_map<w_string, json_ref> map;
+  json_object_map map;
 
-  explicit json_object_t(std::unordered_map<w_string, json_ref> values);
+  explicit json_object_t(json_object_map values);
+};
 
-  typename std::unordered_map<w_string, json_ref>::iterator findCString(
-      const char* key);
+struct json_encoding_cache_t {
+  // Keyed as described by json_array_cached_encoding
+  folly::Synchronized<
+      std::unordered_map<uint64_t, std::shared_ptr<const std::string>>>
+      encodings;
 };
 
 struct json_array_t : json_t {
   std::vector<json_ref> table;
   std::optional<json_ref> templ;
+  std::shared_ptr<const BserTemplateRows> bserRows;
+  std::unique_ptr<json_encoding_cache_t> encodingCache;
 
   json_array_t(std::vector<json_ref> values);
   json_array_t(std::initializer_list<json_ref> values);
@@ -86,6 +94,18 @@ void jsonp_error_vset(
     const char* msg,
     va_list ap);
 
+/* Whether any of the 8 bytes in word is a control character, a quote, a
+   backslash, or part of a multi-byte UTF-8 sequence: the bytes that string
+   encoding and decoding cannot just copy. */
+inline bool jsonp_has_special_byte(uint64_t word) {
+  constexpr uint64_t kOnes = 0x0101010101010101ull;
+  constexpr uint64_t kHighBits = 0x8080808080808080ull;
+  auto hasZeroByte = [](uint64_t x) { return (x - kOnes) & ~x & kHighBits; };
+  return ((word - kOnes * 0x20) & ~word & kHighBits) |
+      hasZeroByte(word ^ (kOnes * '"')) | hasZeroByte(word ^ (kOnes * '\\')) |
+      (word & kHighBits);
+}
+
 /* Locale independent string<->double conversions */
 int jsonp_strtod(std::string& strbuffer, double* out);
 int jsonp_dtostr(char* buffer, size_t size, double value);
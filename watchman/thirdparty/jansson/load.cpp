@@ -55,6 +55,12 @@ typedef int (*get_func)(void* data);
    behaviour of ferror(). */
 typedef int (*error_func)(void* data);
 
+typedef struct {
+  const char* data;
+  size_t len;
+  size_t pos;
+} buffer_data_t;
+
 namespace {
 
 // We could write the JSON parser to use O(1) stack depth, but in the short term
@@ -71,6 +77,9 @@ typedef struct {
   int line;
   int column, last_column;
   size_t position;
+  /* Set when the input is a buffer in memory, which lets the lexer consume
+     runs of plain string characters without going through get. */
+  buffer_data_t* contiguous;
 } stream_t;
 
 struct lex_t {
@@ -178,6 +187,7 @@ static void stream_init(stream_t* stream, get_func get, error_func error, void*
   stream->line = 1;
   stream->column = 0;
   stream->position = 0;
+  stream->contiguous = nullptr;
 }
 
 static int stream_get(stream_t* stream, json_error_t* error) {
@@ -289,6 +299,41 @@ static void lex_unget_unsave(lex_t* lex, int c) {
   }
 }
 
+/* Saves and consumes the bytes up to the next one in the input that is not
+   plain ASCII inside a string, if the input is contiguous. None of them is a
+   newline or the start of a UTF-8 sequence, so each is one column. */
+static void lex_save_plain_run(lex_t* lex) {
+  stream_t* stream = &lex->stream;
+  buffer_data_t* input = stream->contiguous;
+  if (!input || stream->state != STREAM_STATE_OK ||
+      stream->buffer[stream->buffer_pos] != '\0') {
+    return;
+  }
+
+  const char* start = input->data + input->pos;
+  const char* end = input->data + input->len;
+  const char* p = start;
+  while (end - p >= 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    if (jsonp_has_special_byte(word))
+      break;
+    p += 8;
+  }
+  while (p < end) {
+    unsigned char c = *p;
+    if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\')
+      break;
+    p++;
+  }
+
+  size_t length = p - start;
+  lex->saved_text.append(start, length);
+  input->pos += length;
+  stream->position += length;
+  stream->column += (int)length;
+}
+
 static void lex_save_cached(lex_t* lex) {
   while (lex->stream.buffer[lex->stream.buffer_pos] != '\0') {
     lex_save(lex, lex->stream.buffer[lex->stream.buffer_pos]);
@@ -329,6 +374,7 @@ static void lex_scan_string(lex_t* lex, json_error_t* error) {
   lex->value.string.clear();
   lex->token = TOKEN_INVALID;
 
+  lex_save_plain_run(lex);
   c = lex_get_save(lex, error);
 
   while (c != '"') {
@@ -365,8 +411,17 @@ static void lex_scan_string(lex_t* lex, json_error_t* error) {
         error_set(error, lex, "invalid escape");
         goto out;
       }
-    } else
+    } else {
+      lex_save_plain_run(lex);
       c = lex_get_save(lex, error);
+    }
+  }
+
+  if (lex->saved_text.find('\\') == std::string::npos) {
+    /* Nothing to unescape; strip the quotes */
+    lex->value.string.assign(lex->saved_text, 1, lex->saved_text.size() - 2);
+    lex->token = TOKEN_STRING;
+    return;
   }
 
   /* the actual value is at most of the same length as the source
@@ -669,10 +724,8 @@ parse_object(lex_t* lex, size_t flags, json_error_t* error) {
       return std::nullopt;
     }
 
+    // May be empty: the key "" is valid
     auto key = lex_steal_string(lex);
-    if (key.empty()) {
-      return std::nullopt;
-    }
 
     if (flags & JSON_REJECT_DUPLICATES) {
       if (json_object_get(object, key.c_str())) {
@@ -824,31 +877,25 @@ parse_json(lex_t* lex, size_t flags, json_error_t* error) {
   return result;
 }
 
-typedef struct {
-  const char* data;
-  int pos;
-} string_data_t;
-
-static int string_get(void* data) {
+static int buffer_get(void* data) {
   char c;
-  string_data_t* stream = (string_data_t*)data;
-  c = stream->data[stream->pos];
-  if (c == '\0')
+  auto stream = (buffer_data_t*)data;
+  if (stream->pos >= stream->len)
     return EOF;
-  else {
-    stream->pos++;
-    return (unsigned char)c;
-  }
+
+  c = stream->data[stream->pos];
+  stream->pos++;
+  return (unsigned char)c;
 }
 
-static int string_error(void*) {
+static int buffer_error(void*) {
   return 0;
 }
 
 std::optional<json_ref>
 json_loads(const char* string, size_t flags, json_error_t* error) {
   lex_t lex;
-  string_data_t stream_data;
+  buffer_data_t stream_data;
 
   jsonp_error_init(error, "<string>");
 
@@ -857,36 +904,19 @@ json_loads(const char* string, size_t flags, json_error_t* error) {
     return std::nullopt;
   }
 
+  /* The string ends at its NUL, like the input of json_loadb ends at its
+     length */
   stream_data.data = string;
   stream_data.pos = 0;
+  stream_data.len = strlen(string);
 
-  if (lex_init(&lex, string_get, string_error, (void*)&stream_data))
+  if (lex_init(&lex, buffer_get, buffer_error, (void*)&stream_data))
     return std::nullopt;
+  lex.stream.contiguous = &stream_data;
 
   return parse_json(&lex, flags, error);
 }
 
-typedef struct {
-  const char* data;
-  size_t len;
-  size_t pos;
-} buffer_data_t;
-
-static int buffer_get(void* data) {
-  char c;
-  auto stream = (buffer_data_t*)data;
-  if (stream->pos >= stream->len)
-    return EOF;
-
-  c = stream->data[stream->pos];
-  stream->pos++;
-  return (unsigned char)c;
-}
-
-static int buffer_error(void*) {
-  return 0;
-}
-
 std::optional<json_ref> json_loadb(
     const char* buffer,
     size_t buflen,
@@ -908,6 +938,7 @@ std::optional<json_ref> json_loadb(
 
   if (lex_init(&lex, buffer_get, buffer_error, (void*)&stream_data))
     return std::nullopt;
+  lex.stream.contiguous = &stream_data;
 
   return parse_json(&lex, flags, error);
 }
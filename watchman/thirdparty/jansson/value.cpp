@@ -173,27 +173,139 @@ bool json_ref::asBool() const {
 
 /*** object ***/
 
-const std::unordered_map<w_string, json_ref>& json_ref::object() const {
+namespace {
+
+// Only short keys are interned, so that a caller building keys at runtime
+// cannot grow the table without bound
+constexpr size_t kMaximumInternedKeyLength = 64;
+constexpr size_t kMaximumInternedKeys = 1024;
+
+/**
+ * Keys given as C strings are almost always literals, such as field names
+ * that repeat in every object of a result, so share one w_string per
+ * distinct key rather than allocating one per object.
+ */
+w_string internKey(const char* key) {
+  std::string_view view{key};
+  if (view.size() > kMaximumInternedKeyLength) {
+    return w_string{view.data(), view.size(), W_STRING_UNICODE};
+  }
+  // Per-thread so that no lock is needed; the views reference the
+  // w_strings' data
+  thread_local std::unordered_map<std::string_view, w_string> keys;
+  auto it = keys.find(view);
+  if (it != keys.end()) {
+    return it->second;
+  }
+  w_string str{view.data(), view.size(), W_STRING_UNICODE};
+  if (keys.size() < kMaximumInternedKeys) {
+    keys.emplace(str.view(), str);
+  }
+  return str;
+}
+
+} // namespace
+
+json_object_map::json_object_map(
+    std::unordered_map<w_string, json_ref> values) {
+  entries_.reserve(values.size());
+  for (auto& [key, value] : values) {
+    append(key, std::move(value));
+  }
+}
+
+json_object_map::json_object_map(const json_object_map& other) {
+  *this = other;
+}
+
+json_object_map& json_object_map::operator=(const json_object_map& other) {
+  if (this != &other) {
+    entries_.clear();
+    index_.reset();
+    entries_.reserve(other.size());
+    for (auto& [key, value] : other) {
+      append(key, value);
+    }
+  }
+  return *this;
+}
+
+json_object_map::const_iterator json_object_map::find(
+    w_string_piece key) const {
+  if (index_) {
+    auto it = index_->find(key);
+    return it == index_->end() ? end() : begin() + it->second;
+  }
+  return std::find_if(begin(), end(), [&](const value_type& entry) {
+    return entry.first.view() == key.view();
+  });
+}
+
+const json_ref& json_object_map::at(w_string_piece key) const {
+  auto it = find(key);
+  if (it == end()) {
+    throw std::out_of_range(
+        fmt::format("key '{}' is not present in this json object", key.view()));
+  }
+  return it->second;
+}
+
+void json_object_map::insert_or_assign(w_string key, json_ref value) {
+  auto it = find(key);
+  if (it != end()) {
+    entries_[it - begin()].second = std::move(value);
+    return;
+  }
+  append(std::move(key), std::move(value));
+}
+
+bool json_object_map::emplace(w_string key, json_ref value) {
+  if (find(key) != end()) {
+    return false;
+  }
+  append(std::move(key), std::move(value));
+  return true;
+}
+
+void json_object_map::append(w_string key, json_ref value) {
+  entries_.emplace_back(std::move(key), std::move(value));
+  if (index_) {
+    index_->emplace(
+        entries_.back().first.piece(), uint32_t(entries_.size() - 1));
+  } else if (entries_.size() > kIndexThreshold) {
+    index_ = std::make_unique<std::unordered_map<w_string_piece, uint32_t>>();
+    index_->reserve(entries_.size() * 2);
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      index_->emplace(entries_[i].first.piece(), uint32_t(i));
+    }
+  }
+}
+
+const json_object_map& json_ref::object() const {
   if (type() != JSON_OBJECT) {
     throw std::domain_error("json_ref::object() called for non-object");
   }
   return json_to_object(ref_)->map;
 }
 
-json_object_t::json_object_t(std::unordered_map<w_string, json_ref> values)
+json_object_t::json_object_t(json_object_map values)
     : json_t{JSON_OBJECT}, map{std::move(values)} {}
 
-json_ref json_object(std::unordered_map<w_string, json_ref> values) {
+json_ref json_object(json_object_map values) {
   return json_ref::takeOwnership(new json_object_t(std::move(values)));
 }
 
+json_ref json_object(std::unordered_map<w_string, json_ref> values) {
+  return json_object(json_object_map{std::move(values)});
+}
+
 json_ref json_object(
     std::initializer_list<std::pair<const char*, json_ref>> values) {
-  std::unordered_map<w_string, json_ref> object;
+  json_object_map object;
   object.reserve(values.size());
 
   for (auto& it : values) {
-    object.emplace(w_string{it.first, W_STRING_UNICODE}, it.second);
+    object.emplace(internKey(it.first), it.second);
   }
 
   return json_object(std::move(object));
@@ -211,19 +323,13 @@ size_t json_object_size(const json_ref& json) {
   return json_to_object(json.get())->map.size();
 }
 
-typename std::unordered_map<w_string, json_ref>::iterator
-json_object_t::findCString(const char* key) {
-  w_string key_string(key, W_STRING_BYTE);
-  return map.find(key_string);
-}
-
 json_ref json_ref::get_default(const char* key, json_ref defval) const {
   if (type() != JSON_OBJECT) {
     return defval;
   }
-  auto object = json_to_object(ref_);
-  auto it = object->findCString(key);
-  if (it == object->map.end()) {
+  auto& map = json_to_object(ref_)->map;
+  auto it = map.find(key);
+  if (it == map.end()) {
     return defval;
   }
   return it->second;
@@ -233,9 +339,9 @@ const json_ref& json_ref::get(const char* key) const {
   if (type() != JSON_OBJECT) {
     throw std::domain_error("json_ref::get called on a non object type");
   }
-  auto object = json_to_object(ref_);
-  auto it = object->findCString(key);
-  if (it == object->map.end()) {
+  auto& map = json_to_object(ref_)->map;
+  auto it = map.find(key);
+  if (it == map.end()) {
     throw std::range_error(
         std::string("key '") + key + "' is not present in this json object");
   }
@@ -247,9 +353,9 @@ std::optional<json_ref> json_ref::get_optional(const char* key) const {
     return std::nullopt;
   }
 
-  auto object = json_to_object(ref_);
-  auto it = object->findCString(key);
-  if (it == object->map.end()) {
+  auto& map = json_to_object(ref_)->map;
+  auto it = map.find(key);
+  if (it == map.end()) {
     return std::nullopt;
   }
   return it->second;
@@ -260,9 +366,9 @@ std::optional<json_ref> json_object_get(const json_ref& json, const char* key) {
     return std::nullopt;
   }
 
-  auto* object = json_to_object(json.get());
-  auto it = object->findCString(key);
-  if (it == object->map.end()) {
+  auto& map = json_to_object(json.get())->map;
+  auto it = map.find(key);
+  if (it == map.end()) {
     return std::nullopt;
   }
   return it->second;
@@ -297,7 +403,7 @@ void json_ref::set(const char* key, json_ref&& val) {
   w_assert(json_is_object(ref_), "json_ref::set called for non object type");
 #endif
 
-  json_to_object(ref_)->map.insert_or_assign(w_string{key}, std::move(val));
+  json_to_object(ref_)->map.insert_or_assign(internKey(key), std::move(val));
 }
 
 int json_object_set_new(
@@ -384,6 +490,61 @@ std::optional<json_ref> json_array_get_template(const json_ref& array) {
   return json_to_array(array.get())->templ;
 }
 
+int json_array_set_bser_rows(
+    const json_ref& json,
+    std::shared_ptr<const BserTemplateRows> rows) {
+  if (!json.isArray()) {
+    return 0;
+  }
+  json_to_array(json.get())->bserRows = std::move(rows);
+  return 1;
+}
+
+const BserTemplateRows* json_array_get_bser_rows(const json_ref& array) {
+  if (!array.isArray()) {
+    return nullptr;
+  }
+  return json_to_array(array.get())->bserRows.get();
+}
+
+int json_array_enable_encoding_cache(const json_ref& json) {
+  if (!json.isArray()) {
+    return 0;
+  }
+  auto* array = json_to_array(json.get());
+  if (!array->encodingCache) {
+    array->encodingCache = std::make_unique<json_encoding_cache_t>();
+  }
+  return 1;
+}
+
+std::shared_ptr<const std::string> json_array_cached_encoding(
+    const json_ref& array,
+    uint64_t key,
+    const std::function<bool(std::string&)>& encode) {
+  if (!array.isArray()) {
+    return nullptr;
+  }
+  auto* cache = json_to_array(array.get())->encodingCache.get();
+  if (!cache) {
+    return nullptr;
+  }
+  {
+    auto encodings = cache->encodings.rlock();
+    auto it = encodings->find(key);
+    if (it != encodings->end()) {
+      return it->second;
+    }
+  }
+  // Concurrent encoders may both get here; they produce the same bytes
+  auto encoded = std::make_shared<std::string>();
+  if (!encode(*encoded)) {
+    return nullptr;
+  }
+  auto encodings = cache->encodings.wlock();
+  return encodings->emplace(key, std::move(encoded)).first->second;
+}
+
 size_t json_array_size(const json_ref& json) {
   if (!json.isArray()) {
     return 0;
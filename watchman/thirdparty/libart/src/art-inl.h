@@ -1,7 +1,11 @@
 #include <memory>
 
-#ifdef __SSE__
+#if defined(__SSE2__)
 #include <emmintrin.h>
+#define ART_NODE16_SIMD 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define ART_NODE16_SIMD 1
 #endif
 #include <algorithm>
 #include <new>
@@ -23,6 +27,43 @@ template <typename T, typename Deleter, typename... Args>
 std::unique_ptr<T, Deleter> make_unique_with_deleter(Args&&... args) {
   return std::unique_ptr<T, Deleter>(new T(std::forward<Args>(args)...));
 }
+
+#ifdef ART_NODE16_SIMD
+#if !defined(__SSE2__)
+// NEON has no movemask; weight each lane by its bit and sum each half
+inline unsigned neonMovemask(uint8x16_t matches) {
+  static const uint8_t kBits[16] = {
+      1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+  auto bits = vandq_u8(matches, vld1q_u8(kBits));
+  return vaddv_u8(vget_low_u8(bits)) | (vaddv_u8(vget_high_u8(bits)) << 8);
+}
+#endif
+
+// Returns a bitfield with bit i set if keys[i] == c, for all 16 keys of a
+// Node16.  Callers mask off the keys past num_children.
+inline unsigned node16Equal(const unsigned char* keys, unsigned char c) {
+#if defined(__SSE2__)
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(
+      _mm_set1_epi8(char(c)), _mm_loadu_si128((const __m128i*)keys)));
+#else
+  return neonMovemask(vceqq_u8(vdupq_n_u8(c), vld1q_u8(keys)));
+#endif
+}
+
+// As node16Equal, but with bit i set if c < keys[i]
+inline unsigned node16Less(const unsigned char* keys, unsigned char c) {
+#if defined(__SSE2__)
+  // SSE2 only compares signed bytes; flipping the sign bit of both sides
+  // gives the unsigned order
+  auto bias = _mm_set1_epi8(char(0x80));
+  return _mm_movemask_epi8(_mm_cmplt_epi8(
+      _mm_xor_si128(_mm_set1_epi8(char(c)), bias),
+      _mm_xor_si128(_mm_loadu_si128((const __m128i*)keys), bias)));
+#else
+  return neonMovemask(vcltq_u8(vdupq_n_u8(c), vld1q_u8(keys)));
+#endif
+}
+#endif
 }
 
 // The ART implementation requires that no key be a full prefix of an existing
@@ -252,16 +293,11 @@ void art_tree<ValueType, KeyType>::Node16::addChild(
     NodePtr&& child) {
   if (this->num_children < 16) {
     unsigned idx;
-#ifdef __SSE__
-    __m128i cmp;
-    unsigned mask, bitfield;
-
-    // Compare the key to all 16 stored keys
-    cmp = _mm_cmplt_epi8(_mm_set1_epi8(c), _mm_loadu_si128((__m128i*)keys));
-
-    // Use a mask to ignore children that don't exist
-    mask = (1 << this->num_children) - 1;
-    bitfield = _mm_movemask_epi8(cmp) & mask;
+#ifdef ART_NODE16_SIMD
+    // Compare the key to all 16 stored keys, and use a mask to ignore
+    // children that don't exist
+    unsigned mask = (1u << this->num_children) - 1;
+    unsigned bitfield = detail::node16Less(keys, c) & mask;
 
     // Check if less than any
     if (bitfield) {
@@ -301,16 +337,11 @@ void art_tree<ValueType, KeyType>::Node16::addChild(
 template <typename ValueType, typename KeyType>
 typename art_tree<ValueType, KeyType>::NodePtr*
 art_tree<ValueType, KeyType>::Node16::findChild(unsigned char c) {
-#ifdef __SSE__
-  __m128i cmp;
-  int mask, bitfield;
-
-  // Compare the key to all 16 stored keys
-  cmp = _mm_cmpeq_epi8(_mm_set1_epi8(c), _mm_loadu_si128((__m128i*)keys));
-
-  // Use a mask to ignore children that don't exist
-  mask = (1 << this->num_children) - 1;
-  bitfield = _mm_movemask_epi8(cmp) & mask;
+#ifdef ART_NODE16_SIMD
+  // Compare the key to all 16 stored keys, and use a mask to ignore
+  // children that don't exist
+  unsigned mask = (1u << this->num_children) - 1;
+  unsigned bitfield = detail::node16Equal(keys, c) & mask;
 
   /*
    * If we have a match (any bit set) then we can
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/PollSchedule.h"
+#include <algorithm>
+
+namespace watchman {
+
+PollSchedule::PollSchedule(
+    clock::duration hotInterval,
+    clock::duration coldInterval)
+    : hotInterval_(hotInterval),
+      coldInterval_(std::max(hotInterval, coldInterval)) {}
+
+void PollSchedule::insert(const w_string& path, clock::time_point now) {
+  auto due = now + hotInterval_;
+  auto [it, inserted] = entries_.emplace(path, Entry{hotInterval_, due, true});
+  if (inserted) {
+    queue_.emplace(due, path);
+  }
+}
+
+void PollSchedule::erase(const w_string& path) {
+  auto it = entries_.find(path);
+  if (it == entries_.end()) {
+    return;
+  }
+  if (it->second.queued) {
+    queue_.erase({it->second.due, path});
+  }
+  entries_.erase(it);
+}
+
+std::optional<w_string> PollSchedule::popDue(clock::time_point now) {
+  if (queue_.empty() || queue_.begin()->first > now) {
+    return std::nullopt;
+  }
+  auto path = queue_.begin()->second;
+  queue_.erase(queue_.begin());
+  entries_.at(path).queued = false;
+  return path;
+}
+
+void PollSchedule::reschedule(
+    const w_string& path,
+    bool changed,
+    clock::time_point now) {
+  auto it = entries_.find(path);
+  if (it == entries_.end() || it->second.queued) {
+    return;
+  }
+  auto& entry = it->second;
+  entry.interval =
+      changed ? hotInterval_ : std::min(entry.interval * 2, coldInterval_);
+  entry.due = now + entry.interval;
+  entry.queued = true;
+  queue_.emplace(entry.due, path);
+}
+
+std::optional<PollSchedule::clock::time_point> PollSchedule::nextDue() const {
+  if (queue_.empty()) {
+    return std::nullopt;
+  }
+  return queue_.begin()->first;
+}
+
+size_t PollSchedule::numHot() const {
+  return std::count_if(entries_.begin(), entries_.end(), [&](const auto& it) {
+    return it.second.interval == hotInterval_;
+  });
+}
+
+} // namespace watchman
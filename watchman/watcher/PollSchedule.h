@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Decides when each dir watched by the poll watcher is next checked.
+ *
+ * A dir that changed when it was last checked is checked again after the hot
+ * interval.  Each check that finds no change doubles the interval of the dir,
+ * up to the cold interval, so the dirs that are being worked in are checked
+ * far more often than the bulk of the tree, which is not.
+ *
+ * Dirs are handed out in the order in which they became due.
+ *
+ * PollSchedule is not thread safe.
+ */
+class PollSchedule {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  PollSchedule(clock::duration hotInterval, clock::duration coldInterval);
+
+  /**
+   * Adds path to the schedule, due after the hot interval.  Does nothing if
+   * it is already scheduled.
+   */
+  void insert(const w_string& path, clock::time_point now);
+
+  void erase(const w_string& path);
+
+  /**
+   * Returns the path that has been due the longest, if any is due at now.
+   * It is not handed out again until it is passed to reschedule().
+   */
+  std::optional<w_string> popDue(clock::time_point now);
+
+  /**
+   * Schedules the next check of a path that was returned by popDue(),
+   * according to whether that check found a change.  Does nothing if the
+   * path was erased in the meantime.
+   */
+  void reschedule(const w_string& path, bool changed, clock::time_point now);
+
+  /**
+   * Returns when the next path is due, or nullopt if none are scheduled.
+   */
+  std::optional<clock::time_point> nextDue() const;
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+  /**
+   * Returns the number of paths that are checked at the hot interval.
+   */
+  size_t numHot() const;
+
+ private:
+  struct Entry {
+    clock::duration interval;
+    clock::time_point due;
+    // Whether (due, path) is in queue_, which is not the case between
+    // popDue() and reschedule().
+    bool queued;
+  };
+
+  const clock::duration hotInterval_;
+  const clock::duration coldInterval_;
+  std::unordered_map<w_string, Entry> entries_;
+  std::set<std::pair<clock::time_point, w_string>> queue_;
+};
+
+} // namespace watchman
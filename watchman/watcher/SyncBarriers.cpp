@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/SyncBarriers.h"
+#include "watchman/watchman_system.h"
+
+#ifndef _WIN32
+#include <poll.h>
+
+namespace watchman {
+
+folly::SemiFuture<folly::Unit> SyncBarriers::request() {
+  auto [p, f] = folly::makePromiseContract<folly::Unit>();
+  {
+    auto pending = pending_.wlock();
+    pending->push_back(std::move(p));
+    if (pending->size() == 1) {
+      ignore_result(write(pipe_.write.fd(), "B", 1));
+    }
+  }
+  return std::move(f);
+}
+
+std::vector<folly::Promise<folly::Unit>> SyncBarriers::take() {
+  auto pending = pending_.wlock();
+  if (!pending->empty()) {
+    char buf[64];
+    while (read(pipe_.read.fd(), buf, sizeof(buf)) > 0) {
+    }
+  }
+  return std::exchange(*pending, {});
+}
+
+bool isReadableNow(int fd) {
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+} // namespace watchman
+
+#endif // _WIN32
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <folly/futures/Future.h>
+#include <vector>
+#include "watchman/fs/Pipe.h"
+
+#ifndef _WIN32
+
+namespace watchman {
+
+/**
+ * Sync barriers requested of a watcher whose events are queued by the kernel
+ * as each change is made, such as inotify and fanotify. Every change that
+ * completed before a barrier was requested is already sitting in the
+ * watcher's queue, so once the notify thread has drained that queue, the
+ * barrier can be placed behind the drained events in the PendingCollection.
+ * The IO thread completes it after processing them, which synchronizes a
+ * query without touching a cookie file and waiting for its event.
+ */
+class SyncBarriers {
+ public:
+  /**
+   * Queues a barrier and wakes the notify thread, which must be polling
+   * wakeFd().
+   */
+  folly::SemiFuture<folly::Unit> request();
+
+  /**
+   * Readable while barriers are queued.
+   */
+  int wakeFd() const {
+    return pipe_.read.fd();
+  }
+
+  /**
+   * Called on the notify thread before it drains the watcher's queue.
+   * Returns the barriers requested so far, which must be added to the
+   * pending changes after the drained events.
+   */
+  std::vector<folly::Promise<folly::Unit>> take();
+
+ private:
+  Pipe pipe_;
+  folly::Synchronized<std::vector<folly::Promise<folly::Unit>>> pending_;
+};
+
+/**
+ * Returns true if fd has data to read right now.
+ */
+bool isReadableNow(int fd);
+
+} // namespace watchman
+
+#endif // _WIN32
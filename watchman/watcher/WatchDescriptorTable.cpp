@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/WatchDescriptorTable.h"
+#include <string>
+#include <vector>
+
+namespace watchman {
+
+void WatchDescriptorTable::insert(int wd, w_string_piece path) {
+  auto parent = find(path.dirName());
+  // Stale entries mustn't make a dir its own ancestor
+  for (auto ancestor = parent; ancestor != kNoParent;
+       ancestor = entries_.at(ancestor).parent) {
+    if (ancestor == wd) {
+      parent = kNoParent;
+      break;
+    }
+  }
+
+  auto it = entries_.find(wd);
+  if (it == entries_.end()) {
+    it = entries_.emplace(wd, Entry{kNoParent, 0, false, w_string()}).first;
+  } else {
+    unlink(wd, it->second);
+  }
+  auto& entry = it->second;
+  if (!entry.watched) {
+    entry.watched = true;
+    ++numWatched_;
+  }
+
+  entry.parent = parent;
+  if (parent == kNoParent) {
+    entry.name = w_string{path.data(), path.size()};
+  } else {
+    entry.name = names_.intern(path.baseName());
+    ++entries_.at(parent).children;
+  }
+  // The key refers to the name of the entry that inserted it
+  byName_.erase(Key{parent, entry.name.piece()});
+  byName_.emplace(Key{parent, entry.name.piece()}, wd);
+}
+
+std::optional<w_string> WatchDescriptorTable::path(int wd) const {
+  auto it = entries_.find(wd);
+  if (it == entries_.end() || !it->second.watched) {
+    return std::nullopt;
+  }
+
+  std::vector<w_string_piece> names;
+  size_t size = 0;
+  for (const auto* entry = &it->second;;
+       entry = &entries_.at(entry->parent)) {
+    names.push_back(entry->name.piece());
+    size += entry->name.size() + 1;
+    if (entry->parent == kNoParent) {
+      break;
+    }
+  }
+
+  std::string path;
+  path.reserve(size);
+  for (auto name = names.rbegin(); name != names.rend(); ++name) {
+    if (!path.empty()) {
+      path.push_back('/');
+    }
+    path.append(name->data(), name->size());
+  }
+  return w_string{path.data(), path.size()};
+}
+
+void WatchDescriptorTable::erase(int wd) {
+  auto it = entries_.find(wd);
+  if (it == entries_.end() || !it->second.watched) {
+    return;
+  }
+  it->second.watched = false;
+  --numWatched_;
+  maybeRemove(wd);
+}
+
+void WatchDescriptorTable::reserve(size_t count) {
+  entries_.reserve(count);
+  byName_.reserve(count);
+}
+
+int WatchDescriptorTable::find(w_string_piece path) const {
+  if (path.empty()) {
+    return kNoParent;
+  }
+  auto it = byName_.find(Key{kNoParent, path});
+  if (it != byName_.end()) {
+    return it->second;
+  }
+  auto parent = find(path.dirName());
+  if (parent == kNoParent) {
+    return kNoParent;
+  }
+  it = byName_.find(Key{parent, path.baseName()});
+  return it == byName_.end() ? kNoParent : it->second;
+}
+
+void WatchDescriptorTable::unlink(int wd, Entry& entry) {
+  // A newer dir of the same name may have taken over the key
+  auto it = byName_.find(Key{entry.parent, entry.name.piece()});
+  if (it != byName_.end() && it->second == wd) {
+    byName_.erase(it);
+  }
+
+  auto parent = entry.parent;
+  if (parent != kNoParent) {
+    names_.release(entry.name.piece());
+    entry.parent = kNoParent;
+  }
+  entry.name = w_string();
+
+  if (parent != kNoParent) {
+    --entries_.at(parent).children;
+    maybeRemove(parent);
+  }
+}
+
+void WatchDescriptorTable::maybeRemove(int wd) {
+  auto it = entries_.find(wd);
+  if (it == entries_.end() || it->second.watched || it->second.children) {
+    return;
+  }
+  unlink(wd, it->second);
+  entries_.erase(wd);
+}
+
+} // namespace watchman
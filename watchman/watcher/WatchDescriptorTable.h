@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <optional>
+#include <unordered_map>
+#include "watchman/PathComponentTable.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Maps the watch descriptors of a watcher to the dirs that they watch.
+ *
+ * Storing the full path of every dir repeats the path of its parent over and
+ * over, which adds up to hundreds of megabytes for trees with hundreds of
+ * thousands of dirs.  Instead, each entry holds the descriptor of its parent
+ * and its own name, interned in a PathComponentTable, and the full path is
+ * built by walking the parents when it is asked for.  A dir whose parent is
+ * not watched holds its full path.
+ *
+ * As a consequence, when a dir is renamed by inserting its descriptor under
+ * its new path, the paths of the dirs below it follow.
+ *
+ * An erased descriptor whose dir still has watched children is kept, without
+ * being reported, until the last of them is erased.
+ *
+ * WatchDescriptorTable is not thread safe.
+ */
+class WatchDescriptorTable {
+ public:
+  /**
+   * Records that wd watches the dir at path, replacing whatever it watched
+   * before.
+   */
+  void insert(int wd, w_string_piece path);
+
+  /**
+   * Returns the full path of the dir that wd watches, if any.
+   */
+  std::optional<w_string> path(int wd) const;
+
+  void erase(int wd);
+
+  void reserve(size_t count);
+
+  /**
+   * Returns the number of watched dirs.
+   */
+  size_t size() const {
+    return numWatched_;
+  }
+
+  /**
+   * Returns the number of distinct dir names held.
+   */
+  size_t numNames() const {
+    return names_.size();
+  }
+
+ private:
+  static constexpr int kNoParent = -1;
+
+  struct Entry {
+    int parent;
+    // The number of entries whose parent this is
+    uint32_t children;
+    bool watched;
+    // Interned, unless parent is kNoParent
+    w_string name;
+  };
+
+  struct Key {
+    int parent;
+    w_string_piece name;
+
+    bool operator==(const Key& other) const {
+      return parent == other.parent && name == other.name;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return key.name.hashValue() ^ std::hash<int>()(key.parent);
+    }
+  };
+
+  // Returns the watched descriptor of the dir at path, or kNoParent
+  int find(w_string_piece path) const;
+
+  // Removes the entry from its parent and from byName_
+  void unlink(int wd, Entry& entry);
+
+  // Drops the entry if it is no longer watched and has no children
+  void maybeRemove(int wd);
+
+  std::unordered_map<int, Entry> entries_;
+  // Keyed by a piece of the entry's own name
+  std::unordered_map<Key, int, KeyHash> byName_;
+  PathComponentTable names_;
+  size_t numWatched_{0};
+};
+
+} // namespace watchman
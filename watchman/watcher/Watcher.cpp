@@ -6,9 +6,25 @@
  */
 
 #include "watchman/watcher/Watcher.h"
+#include "watchman/Logging.h"
+#include "watchman/WatchmanConfig.h"
 
 namespace watchman {
 
+RecrawlScope parseRecrawlScope(const Configuration& config) {
+  std::string_view scope = config.getString("recrawl_scope", "exact");
+  if (scope == "root") {
+    return RecrawlScope::Root;
+  }
+  if (scope == "recent") {
+    return RecrawlScope::Recent;
+  }
+  if (scope != "exact") {
+    logf(ERR, "unknown recrawl_scope \"{}\", using \"exact\"\n", scope);
+  }
+  return RecrawlScope::Exact;
+}
+
 Watcher::Watcher(const char* name, unsigned flags) : name(name), flags(flags) {}
 
 Watcher::~Watcher() {}
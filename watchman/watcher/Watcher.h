@@ -19,10 +19,28 @@ struct watchman_file;
 
 namespace watchman {
 
+class Configuration;
 class QueryableView;
 class InMemoryView;
 class Root;
 
+/**
+ * How much of a watch is recrawled after its watcher loses events, from the
+ * `recrawl_scope` setting.
+ */
+enum class RecrawlScope {
+  // Always recrawl the whole root.
+  Root,
+  // Recrawl only the subtrees that the watcher reports lost events under,
+  // when it knows them.
+  Exact,
+  // As Exact, and when the watcher cannot tell, guess from the directories
+  // that changed shortly before the loss.
+  Recent,
+};
+
+RecrawlScope parseRecrawlScope(const Configuration& config);
+
 class TerminalWatcherError : public std::runtime_error {
  public:
   using std::runtime_error::runtime_error;
@@ -40,6 +58,9 @@ class Watcher : public std::enable_shared_from_this<Watcher> {
 #define WATCHER_HAS_PER_FILE_NOTIFICATIONS 1
   // if the watcher is comprised of multiple watchers
 #define WATCHER_HAS_SPLIT_WATCH 4
+  // if the watcher may attach the metadata delivered with an event to its
+  // PendingChange, which is then trusted instead of stat'ing the path
+#define WATCHER_HAS_FILE_INFORMATION 8
   unsigned flags;
 
   Watcher(const char* name, unsigned flags);
@@ -71,6 +92,17 @@ class Watcher : public std::enable_shared_from_this<Watcher> {
     return folly::SemiFuture<folly::Unit>::makeEmpty();
   }
 
+  /**
+   * If the returned SemiFuture is valid(), then this watcher can synchronize
+   * without a cookie file: the future completes once InMemoryView has
+   * processed every change made before the call.
+   *
+   * Otherwise, a cookie file must be used.
+   */
+  virtual folly::SemiFuture<folly::Unit> syncBarrier() {
+    return folly::SemiFuture<folly::Unit>::makeEmpty();
+  }
+
   // Initiate an OS-level watch on the provided file
   virtual bool startWatchFile(watchman_file* file);
 
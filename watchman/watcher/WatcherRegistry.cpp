@@ -14,6 +14,7 @@
 #include "watchman/Logging.h"
 #include "watchman/QueryableView.h"
 #include "watchman/WatchmanConfig.h"
+#include "watchman/fs/FSDetect.h"
 #include "watchman/watcher/Watcher.h"
 
 using namespace watchman;
@@ -48,6 +49,16 @@ const WatcherRegistry* WatcherRegistry::getWatcherByName(
   return &it->second;
 }
 
+FileSystem& WatcherRegistry::fileSystemFor(
+    const w_string& fstype,
+    const Configuration& config) {
+  if (isNetworkFileSystemType(fstype) &&
+      config.getBool("network_fs_cached_stats", true)) {
+    return networkFileSystem;
+  }
+  return realFileSystem;
+}
+
 // Helper to DRY in the two success paths in the function below
 static inline std::shared_ptr<watchman::QueryableView> reportWatcher(
     const std::string& watcherName,
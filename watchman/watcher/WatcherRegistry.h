@@ -48,6 +48,15 @@ class WatcherRegistry {
       const w_string& fstype,
       const Configuration& config);
 
+  /**
+   * Returns the FileSystem through which roots of type fstype are crawled:
+   * networkFileSystem for a network filesystem, unless the
+   * network_fs_cached_stats config is false, or realFileSystem.
+   */
+  static FileSystem& fileSystemFor(
+      const w_string& fstype,
+      const Configuration& config);
+
   const std::string& getName() const {
     return name_;
   }
@@ -73,10 +82,10 @@ class RegisterWatcher : public WatcherRegistry {
       : WatcherRegistry(
             name,
             [](const w_string& root_path,
-               const w_string& /*fstype*/,
+               const w_string& fstype,
                const Configuration& config) {
               return std::make_shared<InMemoryView>(
-                  realFileSystem,
+                  fileSystemFor(fstype, config),
                   root_path,
                   config,
                   std::make_shared<WATCHER>(root_path, config));
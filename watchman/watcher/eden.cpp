@@ -7,9 +7,12 @@
 
 #include <cpptoml.h>
 #include <fmt/core.h>
+#include <folly/Function.h>
 #include <folly/ScopeGuard.h>
 #include <folly/String.h>
+#include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
+#include <folly/futures/SharedPromise.h>
 #include <folly/io/async/AsyncSocket.h>
 #include <folly/io/async/EventBase.h>
 #include <folly/io/async/EventBaseManager.h>
@@ -21,6 +24,7 @@
 #include <thrift/lib/cpp2/async/RocketClientChannel.h>
 #include <algorithm>
 #include <chrono>
+#include <deque>
 #include <iterator>
 #include <thread>
 #include "eden/common/utils/FSDetect.h"
@@ -37,6 +41,7 @@
 #include "watchman/query/QueryContext.h"
 #include "watchman/query/eval.h"
 #include "watchman/root/Root.h"
+#include "watchman/scm/Mercurial.h"
 #include "watchman/scm/SCM.h"
 #include "watchman/thirdparty/wildmatch/wildmatch.h"
 #include "watchman/watcher/Watcher.h"
@@ -103,16 +108,31 @@ struct NameAndDType {
  * We have a single instance of the callback object that we schedule
  * each time we get an update from the eden server.  If we are already
  * scheduled we will cancel it and reschedule it.
+ * `beforeSettle` runs before the settle is announced; errors that it
+ * throws are logged and otherwise ignored.
  */
 class SettleCallback : public folly::HHWheelTimer::Callback {
  public:
-  SettleCallback(folly::EventBase* eventBase, std::shared_ptr<Root> root)
-      : eventBase_(eventBase), root_(std::move(root)) {}
+  SettleCallback(
+      folly::EventBase* eventBase,
+      std::shared_ptr<Root> root,
+      folly::Function<void()> beforeSettle = nullptr)
+      : eventBase_(eventBase),
+        root_(std::move(root)),
+        beforeSettle_(std::move(beforeSettle)) {}
 
   void timeoutExpired() noexcept override {
+    if (beforeSettle_) {
+      try {
+        beforeSettle_();
+      } catch (const std::exception& exc) {
+        log(ERR, "error while preparing for settle: ", exc.what(), "\n");
+      }
+    }
     try {
       auto settledPayload = json_object({{"settled", json_true()}});
-      root_->unilateralResponses->enqueue(std::move(settledPayload));
+      root_->unilateralResponses->enqueue(
+          std::move(settledPayload), "settled");
     } catch (const std::exception& exc) {
       log(ERR,
           "error while dispatching settle payload; cancel watch: ",
@@ -131,6 +151,7 @@ class SettleCallback : public folly::HHWheelTimer::Callback {
  private:
   folly::EventBase* eventBase_;
   std::shared_ptr<Root> root_;
+  folly::Function<void()> beforeSettle_;
 };
 
 // Resolve the eden socket; On POSIX systems we use the .eden dir that is
@@ -216,17 +237,120 @@ class GetJournalPositionCallback : public folly::HHWheelTimer::Callback {
   std::string mountPoint_;
 };
 
+/**
+ * File attributes fetched from EdenFS, shared by all the queries on a mount
+ * so that queries evaluated around the same settle don't each fetch them.
+ *
+ * The attributes are tagged with the journal position at the start of the
+ * query that fetched them, and are only handed to queries that started at
+ * or before that position: fetching them again could not give such a query
+ * an older view of the files. A store from a later position replaces the
+ * whole cache, and entries are dropped after `ttl` regardless.
+ */
+class EdenAttributeCache {
+ public:
+  struct Entry {
+    std::optional<FileInformationOrError> fileInfo;
+    std::optional<EntryInformationOrError> entryInfo;
+    std::optional<SHA1Result> sha1;
+  };
+
+  EdenAttributeCache(size_t maxBatchSize, std::chrono::milliseconds ttl)
+      : maxBatchSize_{maxBatchSize}, ttl_{ttl} {}
+
+  // The maximum number of files to request from EdenFS in one call, or 0
+  // for no limit.
+  size_t maxBatchSize() const {
+    return maxBatchSize_;
+  }
+
+  // Returns the cached `field` of each of `names`, as seen by a query that
+  // started at `ticks`.
+  template <typename T>
+  std::vector<std::optional<T>> lookup(
+      ClockTicks ticks,
+      const std::vector<std::string>& names,
+      std::optional<T> Entry::*field) const {
+    std::vector<std::optional<T>> result(names.size());
+    if (ttl_.count() == 0) {
+      return result;
+    }
+    auto state = state_.rlock();
+    if (state->ticks < ticks || isExpired(*state)) {
+      return result;
+    }
+    for (size_t i = 0; i < names.size(); ++i) {
+      auto it = state->entries.find(names[i]);
+      if (it != state->entries.end()) {
+        result[i] = it->second.*field;
+      }
+    }
+    return result;
+  }
+
+  // Remember the `field` of each of `names` that has a value, fetched by a
+  // query that started at `ticks`.
+  template <typename T>
+  void store(
+      ClockTicks ticks,
+      const std::vector<std::string>& names,
+      const std::vector<std::optional<T>>& values,
+      std::optional<T> Entry::*field) {
+    if (ttl_.count() == 0) {
+      return;
+    }
+    auto state = state_.wlock();
+    if (ticks > state->ticks || isExpired(*state)) {
+      state->entries.clear();
+      state->ticks = ticks;
+      state->storedAt = std::chrono::steady_clock::now();
+    } else if (ticks < state->ticks) {
+      // Superseded by attributes from a later journal position
+      return;
+    }
+    for (size_t i = 0; i < names.size(); ++i) {
+      if (values[i].has_value()) {
+        state->entries[names[i]].*field = values[i];
+      }
+    }
+    if (state->entries.size() > kMaxEntries) {
+      state->entries.clear();
+    }
+  }
+
+ private:
+  static constexpr size_t kMaxEntries = 100000;
+
+  struct State {
+    ClockTicks ticks{0};
+    std::chrono::steady_clock::time_point storedAt;
+    std::unordered_map<std::string, Entry> entries;
+  };
+
+  bool isExpired(const State& state) const {
+    return std::chrono::steady_clock::now() - state.storedAt > ttl_;
+  }
+
+  const size_t maxBatchSize_;
+  const std::chrono::milliseconds ttl_;
+  folly::Synchronized<State> state_;
+};
+
 class EdenFileResult : public FileResult {
  public:
   EdenFileResult(
       const w_string& rootPath,
       std::shared_ptr<apache::thrift::RequestChannel> thriftChannel,
+      std::shared_ptr<EdenAttributeCache> attributeCache,
+      ClockTicks queryTicks,
       const w_string& fullName,
       ClockTicks* ticks = nullptr,
       bool isNew = false,
       DType dtype = DType::Unknown)
       : rootPath_(rootPath),
         thriftChannel_{std::move(thriftChannel)},
+        attributeCache_{std::move(attributeCache)},
+        queryTicks_{queryTicks},
         fullName_(fullName),
         dtype_(dtype) {
     otime_.ticks = ctime_.ticks = 0;
@@ -443,7 +567,6 @@ class EdenFileResult : public FileResult {
     auto client = getEdenClient(thriftChannel_);
     loadFileInformation(
         client.get(),
-        rootPath_,
         getFileInformationNames,
         getFileInformationFiles,
         onlyEntryInfoNeeded);
@@ -452,21 +575,17 @@ class EdenFileResult : public FileResult {
     loadSymlinkTargets(client.get(), getSymlinkFiles);
 
     if (!getShaFiles.empty()) {
-      std::vector<SHA1Result> sha1s;
-      client->sync_getSHA1(
-          sha1s, std::string{rootPath_.view()}, getShaNames, getSyncBehavior());
-
-      if (sha1s.size() != getShaFiles.size()) {
-        log(ERR,
-            "Requested SHA-1 of ",
-            getShaFiles.size(),
-            " but Eden returned ",
-            sha1s.size(),
-            " results -- ignoring");
-      } else {
-        auto sha1Iter = sha1s.begin();
-        for (auto& edenFile : getShaFiles) {
-          edenFile->sha1_ = *sha1Iter++;
+      auto sha1s = fetchAttributes(
+          getShaNames,
+          &EdenAttributeCache::Entry::sha1,
+          [&](std::vector<std::string> names) {
+            return client->semifuture_getSHA1(
+                std::string{rootPath_.view()}, names, getSyncBehavior());
+          });
+
+      for (size_t i = 0; i < getShaFiles.size(); ++i) {
+        if (sha1s[i].has_value()) {
+          getShaFiles[i]->sha1_ = std::move(sha1s[i]);
         }
       }
     }
@@ -475,6 +594,9 @@ class EdenFileResult : public FileResult {
  private:
   w_string rootPath_;
   std::shared_ptr<apache::thrift::RequestChannel> thriftChannel_;
+  std::shared_ptr<EdenAttributeCache> attributeCache_;
+  // The journal position at the start of the query producing this result
+  ClockTicks queryTicks_;
   w_string fullName_;
   std::optional<FileInformation> stat_;
   std::optional<bool> exists_;
@@ -503,45 +625,99 @@ class EdenFileResult : public FileResult {
     }
   }
 
-  static void loadFileInformation(
+  // Fetch the `field` attribute of each of `names`, taking what it can from
+  // the attribute cache. The remaining names are split into batches of at
+  // most maxBatchSize() files that are all sent to EdenFS before waiting on
+  // any of them. A name is left without a value if EdenFS didn't return one.
+  template <typename T, typename FetchBatch>
+  std::vector<std::optional<T>> fetchAttributes(
+      const std::vector<std::string>& names,
+      std::optional<T> EdenAttributeCache::Entry::*field,
+      FetchBatch&& fetchBatch) const {
+    auto results = attributeCache_->lookup(queryTicks_, names, field);
+
+    std::vector<size_t> missing;
+    for (size_t i = 0; i < results.size(); ++i) {
+      if (!results[i].has_value()) {
+        missing.push_back(i);
+      }
+    }
+    if (missing.empty()) {
+      return results;
+    }
+
+    auto batchSize = attributeCache_->maxBatchSize();
+    if (batchSize == 0) {
+      batchSize = missing.size();
+    }
+
+    folly::DrivableExecutor* executor =
+        folly::EventBaseManager::get()->getEventBase();
+    std::vector<folly::Future<std::vector<T>>> futures;
+    for (size_t begin = 0; begin < missing.size(); begin += batchSize) {
+      auto end = std::min(begin + batchSize, missing.size());
+      std::vector<std::string> batchNames;
+      batchNames.reserve(end - begin);
+      for (auto i = begin; i < end; ++i) {
+        batchNames.push_back(names[missing[i]]);
+      }
+      futures.emplace_back(fetchBatch(std::move(batchNames)).via(executor));
+    }
+
+    for (size_t batch = 0; batch < futures.size(); ++batch) {
+      auto batchResults = std::move(futures[batch]).getVia(executor);
+      auto begin = batch * batchSize;
+      auto expected = std::min(batchSize, missing.size() - begin);
+      if (batchResults.size() != expected) {
+        log(ERR,
+            "Requested attributes of ",
+            expected,
+            " files but Eden returned ",
+            batchResults.size(),
+            " results\n");
+      }
+      for (size_t i = 0; i < std::min(expected, batchResults.size()); ++i) {
+        results[missing[begin + i]] = std::move(batchResults[i]);
+      }
+    }
+
+    attributeCache_->store(queryTicks_, names, results, field);
+    return results;
+  }
+
+  void loadFileInformation(
       StreamingEdenServiceAsyncClient* client,
-      const w_string& rootPath,
       const std::vector<std::string>& names,
       const std::vector<EdenFileResult*>& outFiles,
-      bool onlyEntryInfoNeeded) {
+      bool onlyEntryInfoNeeded) const {
     w_assert(
         names.size() == outFiles.size(), "names.size must == outFiles.size");
     if (names.empty()) {
       return;
     }
 
+    // Files that Eden didn't return information for are treated as missing
     auto applyResults = [&](const auto& edenInfo) {
-      if (names.size() != edenInfo.size()) {
-        log(ERR,
-            "Requested file information of ",
-            names.size(),
-            " files but Eden returned information for ",
-            edenInfo.size(),
-            " files. Treating missing entries as missing files.");
-      }
-
-      auto infoIter = edenInfo.begin();
-      for (auto& edenFileResult : outFiles) {
-        if (infoIter == edenInfo.end()) {
-          edenFileResult->setExists(false);
+      for (size_t i = 0; i < outFiles.size(); ++i) {
+        if (edenInfo[i].has_value()) {
+          outFiles[i]->applyInformationOrError(*edenInfo[i]);
         } else {
-          edenFileResult->applyInformationOrError(*infoIter);
-          ++infoIter;
+          outFiles[i]->setExists(false);
         }
       }
     };
 
     if (onlyEntryInfoNeeded) {
-      std::vector<EntryInformationOrError> info;
       try {
-        client->sync_getEntryInformation(
-            info, std::string{rootPath.view()}, names, getSyncBehavior());
-        applyResults(info);
+        applyResults(fetchAttributes(
+            names,
+            &EdenAttributeCache::Entry::entryInfo,
+            [&](std::vector<std::string> batchNames) {
+              return client->semifuture_getEntryInformation(
+                  std::string{rootPath_.view()},
+                  batchNames,
+                  getSyncBehavior());
+            }));
         return;
       } catch (const TApplicationException& ex) {
         if (TApplicationException::UNKNOWN_METHOD != ex.getType()) {
@@ -553,10 +729,13 @@ class EdenFileResult : public FileResult {
       }
     }
 
-    std::vector<FileInformationOrError> info;
-    client->sync_getFileInformation(
-        info, std::string{rootPath.view()}, names, getSyncBehavior());
-    applyResults(info);
+    applyResults(fetchAttributes(
+        names,
+        &EdenAttributeCache::Entry::fileInfo,
+        [&](std::vector<std::string> batchNames) {
+          return client->semifuture_getFileInformation(
+              std::string{rootPath_.view()}, batchNames, getSyncBehavior());
+        }));
   }
 
   void applyInformationOrError(const EntryInformationOrError& infoOrErr) {
@@ -613,6 +792,20 @@ static std::string escapeGlobSpecialChars(w_string_piece str) {
  * We need to respect the ignore_dirs configuration setting and
  * also remove anything that doesn't match the relative_root constraint
  * in the query. */
+bool isFilteredOut(
+    QueryContext* ctx,
+    const std::string& relative_root,
+    const std::string& name) {
+  auto full = w_string::pathCat({ctx->root->root_path, relative_root, name});
+
+  if (!ctx->fileMatchesRelativeRoot(full)) {
+    // Not in the desired area, so filter it out
+    return true;
+  }
+
+  return ctx->root->ignore.isIgnored(full.data(), full.size());
+}
+
 void filterOutPaths(
     std::vector<NameAndDType>& files,
     QueryContext* ctx,
@@ -621,17 +814,8 @@ void filterOutPaths(
       std::remove_if(
           files.begin(),
           files.end(),
-          [ctx, relative_root](const NameAndDType& item) {
-            w_string full;
-            full = w_string::pathCat(
-                {ctx->root->root_path, relative_root, item.name});
-
-            if (!ctx->fileMatchesRelativeRoot(full)) {
-              // Not in the desired area, so filter it out
-              return true;
-            }
-
-            return ctx->root->ignore.isIgnored(full.data(), full.size());
+          [ctx, &relative_root](const NameAndDType& item) {
+            return isFilteredOut(ctx, relative_root, item.name);
           }),
       files.end());
 }
@@ -728,6 +912,121 @@ std::vector<NameAndDType> globNameAndDType(
   }
 }
 
+/**
+ * Shares the results of globs between queries on the same mount, so that
+ * many clients running the same query after a change cost one glob in
+ * EdenFS and one transfer of the file list.
+ *
+ * Results are keyed by the glob patterns and options, and tagged with the
+ * journal position that the glob is known to be at least as recent as: the
+ * latest position at the start of any query that used the cache.  As with
+ * EdenAttributeCache, they are only handed to queries that started at or
+ * before that position.  That includes queries that ask while the glob is
+ * still in flight, which wait for it rather than issuing their own.  A query
+ * from a later position empties the cache, as do `ttl` passing and the
+ * cached results adding up to more than `maxFiles` files.
+ */
+class EdenGlobCache {
+ public:
+  using Files = std::vector<NameAndDType>;
+
+  EdenGlobCache(std::chrono::milliseconds ttl, size_t maxFiles)
+      : ttl_{ttl}, maxFiles_{maxFiles} {}
+
+  // Returns the files matching the glob identified by `key`, for a query
+  // that started at `position`, calling `fetch` to glob them if no other
+  // query has or is.
+  std::shared_ptr<const Files> get(
+      const ClockPosition& position,
+      const std::string& key,
+      folly::FunctionRef<Files()> fetch) {
+    if (ttl_.count() == 0) {
+      return std::make_shared<const Files>(fetch());
+    }
+
+    std::shared_ptr<Entry> entry;
+    bool fetching = false;
+    {
+      auto state = state_.wlock();
+      if (state->rootNumber != position.rootNumber ||
+          state->ticks < position.ticks || isExpired(*state)) {
+        state->entries.clear();
+        state->numFiles = 0;
+        if (state->rootNumber != position.rootNumber) {
+          state->rootNumber = position.rootNumber;
+          state->ticks = position.ticks;
+        } else {
+          state->ticks = std::max(state->ticks, position.ticks);
+        }
+        state->storedAt = std::chrono::steady_clock::now();
+      }
+      auto& slot = state->entries[key];
+      if (!slot) {
+        slot = std::make_shared<Entry>();
+        fetching = true;
+      }
+      entry = slot;
+    }
+
+    if (!fetching) {
+      return entry->promise.getSemiFuture().get();
+    }
+
+    std::shared_ptr<const Files> files;
+    try {
+      files = std::make_shared<const Files>(fetch());
+    } catch (const std::exception&) {
+      entry->promise.setException(
+          folly::exception_wrapper{std::current_exception()});
+      finish(key, entry, std::nullopt);
+      throw;
+    }
+    entry->promise.setValue(files);
+    finish(key, entry, files->size());
+    return files;
+  }
+
+ private:
+  struct Entry {
+    folly::SharedPromise<std::shared_ptr<const Files>> promise;
+  };
+
+  struct State {
+    ClockRoot rootNumber{0};
+    ClockTicks ticks{0};
+    std::chrono::steady_clock::time_point storedAt;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+    size_t numFiles{0};
+  };
+
+  bool isExpired(const State& state) const {
+    return std::chrono::steady_clock::now() - state.storedAt > ttl_;
+  }
+
+  // Accounts for the completed `entry`, which matched `numFiles` files, or
+  // drops it if its glob failed or it doesn't fit in the cache
+  void finish(
+      const std::string& key,
+      const std::shared_ptr<Entry>& entry,
+      std::optional<size_t> numFiles) {
+    auto state = state_.wlock();
+    auto it = state->entries.find(key);
+    if (it == state->entries.end() || it->second != entry) {
+      // Already emptied by a later query
+      return;
+    }
+    if (numFiles && state->numFiles + *numFiles <= maxFiles_) {
+      state->numFiles += *numFiles;
+      return;
+    }
+    state->entries.erase(it);
+  }
+
+  const std::chrono::milliseconds ttl_;
+  const size_t maxFiles_;
+  folly::Synchronized<State> state_;
+};
+
 namespace {
 
 /**
@@ -760,21 +1059,204 @@ std::shared_ptr<apache::thrift::RequestChannel> makeThriftChannel(
 
 } // namespace
 
+/**
+ * Answers SCM-aware queries on an EdenFS Mercurial checkout.  Instead of
+ * running `hg status`, the files changed since a merge base are computed
+ * by EdenFS, from the difference between the merge base and the working
+ * copy's commit plus the status of the working copy.  Merge bases are
+ * still computed by hg, but cached by the pair of the target and the
+ * working copy's commit, which, unlike the dirstate, doesn't change as
+ * files are added or removed.
+ *
+ * Falls back to hg whenever EdenFS can't answer, for instance because the
+ * working copy moved while the status was computed.
+ */
+class EdenMercurial final : public Mercurial {
+ public:
+  EdenMercurial(
+      w_string_piece rootPath,
+      w_string_piece scmRoot,
+      std::shared_ptr<apache::thrift::RequestChannel> thriftChannel,
+      std::string mountPoint)
+      : Mercurial{rootPath, scmRoot},
+        thriftChannel_{std::move(thriftChannel)},
+        mountPoint_{std::move(mountPoint)},
+        parentMergeBases_{Configuration(), "scm_eden_mergebase", 32, 10},
+        filesChangedSince_{
+            Configuration(),
+            "scm_eden_files_since_mergebase",
+            32,
+            10} {}
+
+  w_string mergeBaseWith(
+      w_string_piece commitId,
+      const std::optional<w_string>& requestId) const override {
+    std::string parent;
+    try {
+      parent = getWorkingCopyParent();
+    } catch (const std::exception& exc) {
+      log(ERR,
+          "unable to get the EdenFS working copy parent: ",
+          exc.what(),
+          "\n");
+      return Mercurial::mergeBaseWith(commitId, requestId);
+    }
+
+    auto key = fmt::format("{}:{}", commitId, parent);
+    auto commit = w_string{commitId.view()};
+    return parentMergeBases_
+        .get(
+            key,
+            [this, commit, requestId](const std::string&) {
+              return folly::makeFuture(
+                  Mercurial::mergeBaseWith(commit, requestId));
+            })
+        .get()
+        ->value();
+  }
+
+  std::vector<w_string> getFilesChangedSinceMergeBaseWith(
+      w_string_piece commitId,
+      w_string_piece clock,
+      const std::optional<w_string>& requestId) const override {
+    auto key = fmt::format("{}:{}", commitId, clock);
+    auto commit = std::string{commitId.view()};
+    try {
+      return filesChangedSince_
+          .get(
+              key,
+              [this, commit](const std::string&) {
+                return folly::makeFuture(getFilesChangedSince(commit));
+              })
+          .get()
+          ->value();
+    } catch (const std::exception& exc) {
+      log(ERR,
+          "EdenFS could not compute the files changed since ",
+          commitId,
+          ", falling back to hg: ",
+          exc.what(),
+          "\n");
+      return Mercurial::getFilesChangedSinceMergeBaseWith(
+          commitId, clock, requestId);
+    }
+  }
+
+ private:
+  std::string getWorkingCopyParent() const {
+    auto client = getEdenClient(thriftChannel_);
+    JournalPosition position;
+    client->sync_getCurrentJournalPosition(position, mountPoint_);
+    auto& hash = *position.snapshotHash();
+    // Older EdenFS versions report the 20 byte binary form
+    return hash.size() == 20 ? folly::hexlify(hash) : hash;
+  }
+
+  std::vector<w_string> getFilesChangedSince(const std::string& commit) const {
+    auto parent = getWorkingCopyParent();
+    auto client = getEdenClient(thriftChannel_);
+
+    std::vector<std::string> paths;
+    auto addEntries = [&](const ScmStatus& status) {
+      if (!status.errors()->empty()) {
+        auto& [path, error] = *status.errors()->begin();
+        SCMError::throwf("EdenFS status error for {}: {}", path, error);
+      }
+      for (auto& [path, fileStatus] : *status.entries()) {
+        if (fileStatus != ScmFileStatus::IGNORED) {
+          paths.push_back(path);
+        }
+      }
+    };
+
+    if (commit != parent) {
+      ScmStatus committed;
+      client->sync_getScmStatusBetweenRevisions(
+          committed, mountPoint_, commit, parent);
+      addEntries(committed);
+    }
+
+    GetScmStatusParams params;
+    params.mountPoint() = mountPoint_;
+    params.commit() = parent;
+    params.listIgnored() = false;
+    GetScmStatusResult workingCopy;
+    // Fails if the working copy has moved off parent in the meantime
+    client->sync_getScmStatusV2(workingCopy, params);
+    addEntries(*workingCopy.status());
+
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+    std::vector<w_string> result;
+    result.reserve(paths.size());
+    for (auto& path : paths) {
+      result.emplace_back(path.data(), path.size());
+    }
+    return result;
+  }
+
+  std::shared_ptr<apache::thrift::RequestChannel> thriftChannel_;
+  std::string mountPoint_;
+  // Keyed by the target and the working copy parent
+  mutable LRUCache<std::string, w_string> parentMergeBases_;
+  mutable LRUCache<std::string, std::vector<w_string>> filesChangedSince_;
+};
+
+std::unique_ptr<SCM> makeEdenSCM(
+    const w_string& rootPath,
+    const Configuration& config,
+    std::shared_ptr<apache::thrift::RequestChannel> thriftChannel) {
+  if (config.getBool("eden_scm_status", true)) {
+    auto scmRoot = findFileInDirTree(rootPath, {".hg", ".git"});
+    if (scmRoot && scmRoot->piece().baseName() == ".hg") {
+      return std::make_unique<EdenMercurial>(
+          rootPath,
+          scmRoot->piece().dirName(),
+          std::move(thriftChannel),
+          rootPath.string());
+    }
+  }
+  return SCM::scmForPath(rootPath);
+}
+
 class EdenView final : public QueryableView {
  public:
   explicit EdenView(const w_string& root_path, const Configuration& config)
-      : QueryableView{root_path, /*requiresCrawl=*/false},
+      : EdenView{
+            root_path,
+            config,
+            makeThriftChannel(
+                root_path,
+                config.getInt("eden_retry_connection_count", 3))} {}
+
+  EdenView(
+      const w_string& root_path,
+      const Configuration& config,
+      std::shared_ptr<apache::thrift::RequestChannel> thriftChannel)
+      : QueryableView{
+            root_path,
+            /*requiresCrawl=*/false,
+            makeEdenSCM(root_path, config, thriftChannel)},
         rootPath_(root_path),
-        thriftChannel_(makeThriftChannel(
-            rootPath_,
-            config.getInt("eden_retry_connection_count", 3))),
+        thriftChannel_(std::move(thriftChannel)),
         mountPoint_(root_path.string()),
         splitGlobPattern_(config.getBool("eden_split_glob_pattern", false)),
         thresholdForFreshInstance_(config.getInt(
             "eden_file_count_threshold_for_fresh_instance",
             10000)),
         enableGlobUpperBounds_(
-            config.getBool("eden_enable_glob_upper_bounds", true)) {}
+            config.getBool("eden_enable_glob_upper_bounds", true)),
+        journalCacheMaxFiles_(
+            config.getInt("eden_journal_cache_max_files", 100000)),
+        attributeCache_(std::make_shared<EdenAttributeCache>(
+            config.getInt("eden_attribute_batch_size", 1024),
+            std::chrono::milliseconds(
+                config.getInt("eden_attribute_cache_ttl_ms", 1000)))),
+        globCache_(std::make_unique<EdenGlobCache>(
+            std::chrono::milliseconds(
+                config.getInt("eden_glob_cache_ttl_ms", 1000)),
+            config.getInt("eden_glob_cache_max_files", 100000))) {}
 
   void timeGenerator(const Query* /*query*/, QueryContext* ctx) const override {
     ctx->generationStarted();
@@ -803,6 +1285,8 @@ class EdenView final : public QueryableView {
       auto file = make_unique<EdenFileResult>(
           rootPath_,
           thriftChannel_,
+          attributeCache_,
+          ctx->clockAtStartOfQuery.position().ticks,
           w_string::pathCat({mountPoint_, item.name}),
           &resultTicks,
           isNew,
@@ -877,32 +1361,30 @@ class EdenView final : public QueryableView {
       bool includeDotfiles,
       bool includeDir = true,
       const std::string& relative_root = "") const {
-    auto client = getEdenClient(thriftChannel_);
-
     bool listOnlyFiles = false;
     if (ctx->query->expr) {
       listOnlyFiles =
           ctx->query->expr->listOnlyFiles() == QueryExpr::ReturnOnlyFiles::Yes;
     }
     folly::stop_watch<std::chrono::microseconds> timer;
-    auto fileInfo = globNameAndDType(
-        client.get(),
-        mountPoint_,
-        globStrings,
-        includeDotfiles,
-        splitGlobPattern_,
-        listOnlyFiles,
-        relative_root);
+    auto fileInfo = globFiles(
+        ctx, globStrings, includeDotfiles, listOnlyFiles, relative_root);
     ctx->edenGlobFilesDurationUs.store(
         timer.elapsed().count(), std::memory_order_relaxed);
 
-    // Filter out any ignored files
-    filterOutPaths(fileInfo, ctx, relative_root);
+    size_t numWalked = 0;
+    for (auto& item : *fileInfo) {
+      // Filter out any ignored files
+      if (isFilteredOut(ctx, relative_root, item.name)) {
+        continue;
+      }
+      ++numWalked;
 
-    for (auto& item : fileInfo) {
       auto file = make_unique<EdenFileResult>(
           rootPath_,
           thriftChannel_,
+          attributeCache_,
+          ctx->clockAtStartOfQuery.position().ticks,
           w_string::pathCat({mountPoint_, relative_root, item.name}),
           /*ticks=*/nullptr,
           /*isNew=*/false,
@@ -919,7 +1401,7 @@ class EdenView final : public QueryableView {
       w_query_process_file(ctx->query, ctx, std::move(file));
     }
 
-    ctx->bumpNumWalked(fileInfo.size());
+    ctx->bumpNumWalked(numWalked);
   }
 
   // Helper for computing a relative path prefix piece.
@@ -1093,9 +1575,13 @@ class EdenView final : public QueryableView {
               //
               // Thus, we're guarantee to only receive one notification per
               // settleTimeout/2 and no more, regardless of how much
-              // writing is done in the repository.
-              subscriberEventBase_.timer().scheduleTimeout(
-                  &getJournalPositionCallback, settleTimeout / 2);
+              // writing is done in the repository. Notifications that
+              // arrive while the call is pending are coalesced into it
+              // rather than pushing it back.
+              if (!getJournalPositionCallback.isScheduled()) {
+                subscriberEventBase_.timer().scheduleTimeout(
+                    &getJournalPositionCallback, settleTimeout / 2);
+              }
             } catch (const std::exception& exc) {
               log(ERR,
                   "Exception while processing eden subscription: ",
@@ -1140,7 +1626,8 @@ class EdenView final : public QueryableView {
 
     try {
       // Prepare the callback
-      SettleCallback settleCallback{&subscriberEventBase_, root};
+      SettleCallback settleCallback{
+          &subscriberEventBase_, root, [this] { prefetchJournalDelta(); }};
       GetJournalPositionCallback getJournalPositionCallback{
           &subscriberEventBase_, thriftChannel_, mountPoint_};
       // Figure out the correct value for settling
@@ -1257,17 +1744,43 @@ class EdenView final : public QueryableView {
       globPatterns = getGlobPatternsForAllFiles(ctx);
     }
 
-    auto client = getEdenClient(thriftChannel_);
-    return globNameAndDType(
-        client.get(),
-        mountPoint_,
-        std::move(globPatterns),
+    return *globFiles(
+        ctx,
+        globPatterns,
         /*includeDotfiles=*/true,
-        splitGlobPattern_,
         /*listOnlyFiles=*/false,
         relative_root);
   }
 
+  /**
+   * Returns the files that match the glob, sharing the result with other
+   * queries through globCache_.
+   */
+  std::shared_ptr<const std::vector<NameAndDType>> globFiles(
+      QueryContext* ctx,
+      const std::vector<std::string>& globPatterns,
+      bool includeDotfiles,
+      bool listOnlyFiles,
+      const std::string& relative_root) const {
+    auto key = fmt::format(
+        "{}:{}:{}", includeDotfiles, listOnlyFiles, relative_root);
+    for (auto& pattern : globPatterns) {
+      key.push_back('\0');
+      key.append(pattern);
+    }
+    return globCache_->get(ctx->clockAtStartOfQuery.position(), key, [&] {
+      auto client = getEdenClient(thriftChannel_);
+      return globNameAndDType(
+          client.get(),
+          mountPoint_,
+          globPatterns,
+          includeDotfiles,
+          splitGlobPattern_,
+          listOnlyFiles,
+          relative_root);
+    });
+  }
+
   struct GetAllChangesSinceResult {
     ClockTicks ticks;
     std::vector<NameAndDType> fileInfo;
@@ -1287,13 +1800,76 @@ class EdenView final : public QueryableView {
     return result;
   }
 
-  GetAllChangesSinceResult getAllChangesSinceStreaming(
-      QueryContext* ctx) const {
+  /**
+   * The changes that EdenFS reported between two journal positions of a
+   * mount generation.
+   */
+  struct JournalDelta {
+    ClockTicks from;
+    ClockTicks to;
+    // -1 = removed
+    // 0 = changed
+    // 1 = added
+    std::unordered_map<std::string, int> byFile;
+    std::unordered_map<std::string, EdenDtype> dtypes;
+  };
+
+  /**
+   * Recently streamed journal deltas, each starting where the previous one
+   * ended. A since query whose clock is one of these boundaries is answered
+   * from memory, only streaming what EdenFS recorded after the last one.
+   */
+  struct JournalCache {
+    ClockRoot mountGeneration{0};
+    std::deque<std::shared_ptr<const JournalDelta>> deltas;
+    // Sum of the number of paths in deltas
+    size_t numFiles{0};
+  };
+
+  static void mergeDtype(
+      std::unordered_map<std::string, EdenDtype>& dtypes,
+      const std::string& name,
+      EdenDtype dtype) {
+    auto [element, inserted] = dtypes.emplace(name, dtype);
+    if (!inserted && element->second != dtype) {
+      // Due to streamChangesSince not providing any ordering guarantee,
+      // Watchman can't tell what DType a file has in the case where it
+      // changed. Thus let's fallback to an UNKNOWN type, and Watchman
+      // will later query the actual DType from EdenFS.
+      element->second = EdenDtype::UNKNOWN;
+    }
+  }
+
+  /**
+   * Engineers usually don't work on a thousands of files, but on an giant
+   * monorepo, the set of files changed in between 2 revisions can be very
+   * large, and continuing down this route would force Watchman to fetch
+   * metadata about a ton of files, causing delay in answering the query and
+   * large amount of network traffic.
+   *
+   * On these monorepos, tools also set the empty_on_fresh_instance flag, thus
+   * we can simply pretend to return a fresh instance and an empty fileInfo
+   * list.
+   */
+  bool exceedsFreshInstanceThreshold(QueryContext* ctx, size_t numFiles)
+      const {
+    return thresholdForFreshInstance_ != 0 &&
+        numFiles > thresholdForFreshInstance_ &&
+        ctx->query->empty_on_fresh_instance;
+  }
+
+  /**
+   * Stream the changes EdenFS recorded since `from`. Returns nullptr if the
+   * stream failed or more than `maxFiles` files changed, unless `maxFiles`
+   * is 0.
+   */
+  std::shared_ptr<const JournalDelta> streamJournalDelta(
+      ClockRoot mountGeneration,
+      ClockTicks from,
+      size_t maxFiles) const {
     JournalPosition position;
-    position.mountGeneration() = ctx->clockAtStartOfQuery.position().rootNumber;
-    // dial back to the sequence number from the query
-    position.sequenceNumber() =
-        std::get<QuerySince::Clock>(ctx->since.since).ticks;
+    position.mountGeneration() = mountGeneration;
+    position.sequenceNumber() = from;
 
     StreamChangesSinceParams params;
     params.mountPoint() = mountPoint_;
@@ -1302,14 +1878,9 @@ class EdenView final : public QueryableView {
     auto client = getEdenClient(thriftChannel_);
     auto [resultChangesSince, stream] = client->sync_streamChangesSince(params);
 
-    GetAllChangesSinceResult result;
-    result.ticks = *resultChangesSince.toPosition()->sequenceNumber();
-
-    // -1 = removed
-    // 0 = changed
-    // 1 = added
-    std::unordered_map<std::string, int> byFile;
-    std::unordered_map<std::string, EdenDtype> dtypes;
+    auto delta = std::make_shared<JournalDelta>();
+    delta->from = from;
+    delta->to = *resultChangesSince.toPosition()->sequenceNumber();
     bool freshInstance = false;
 
     std::move(stream).subscribeInline(
@@ -1330,6 +1901,7 @@ class EdenView final : public QueryableView {
 
           const auto& change = changeTry.value();
           auto& name = *change.name();
+          auto& byFile = delta->byFile;
 
           // Changes needs to be deduplicated so a file that was added and then
           // removed is reported as MODIFIED.
@@ -1346,29 +1918,9 @@ class EdenView final : public QueryableView {
             case ScmFileStatus::IGNORED:
               break;
           }
+          mergeDtype(delta->dtypes, name, *change.dtype());
 
-          auto dtype = *change.dtype();
-          auto [element, inserted] = dtypes.emplace(name, dtype);
-          if (!inserted && element->second != dtype) {
-            // Due to streamChangesSince not providing any ordering guarantee,
-            // Watchman can't tell what DType a file has in the case where it
-            // changed. Thus let's fallback to an UNKNOWN type, and Watchman
-            // will later query the actual DType from EdenFS.
-            element->second = EdenDtype::UNKNOWN;
-          }
-
-          // Engineers usually don't work on a thousands of files, but on an
-          // giant monorepo, the set of files changed in between 2 revisions
-          // can be very large, and continuing down this route would force
-          // Watchman to fetch metadata about a ton of files, causing delay in
-          // answering the query and large amount of network traffic.
-          //
-          // On these monorepos, tools also set the empty_on_fresh_instance
-          // flag, thus we can simply pretend to return a fresh instance and an
-          // empty fileInfo list.
-          if (thresholdForFreshInstance_ != 0 &&
-              byFile.size() > thresholdForFreshInstance_ &&
-              ctx->query->empty_on_fresh_instance) {
+          if (maxFiles != 0 && delta->byFile.size() > maxFiles) {
             freshInstance = true;
             return false;
           }
@@ -1377,14 +1929,159 @@ class EdenView final : public QueryableView {
         });
 
     if (freshInstance) {
-      result = makeFreshInstance(ctx);
-    } else {
-      for (auto& [name, count] : byFile) {
-        result.fileInfo.emplace_back(name, getDTypeFromEden(dtypes[name]));
+      return nullptr;
+    }
+    return delta;
+  }
+
+  /**
+   * Return the cached deltas that cover the journal from `since` onwards, or
+   * an empty vector if `since` isn't one of their boundaries.
+   */
+  std::vector<std::shared_ptr<const JournalDelta>> getCachedJournalDeltas(
+      ClockRoot mountGeneration,
+      ClockTicks since) const {
+    std::vector<std::shared_ptr<const JournalDelta>> result;
+    auto cache = journalCache_.rlock();
+    if (cache->mountGeneration != mountGeneration) {
+      return result;
+    }
+    auto it = std::find_if(
+        cache->deltas.begin(), cache->deltas.end(), [&](const auto& delta) {
+          return delta->from == since;
+        });
+    result.assign(it, cache->deltas.end());
+    return result;
+  }
+
+  /**
+   * Remember a freshly streamed delta so that later queries can reuse it.
+   */
+  void cacheJournalDelta(
+      ClockRoot mountGeneration,
+      std::shared_ptr<const JournalDelta> delta) const {
+    if (journalCacheMaxFiles_ == 0 || delta->from == delta->to ||
+        delta->byFile.size() > journalCacheMaxFiles_) {
+      return;
+    }
+
+    auto cache = journalCache_.wlock();
+    bool extendsChain = cache->mountGeneration == mountGeneration &&
+        !cache->deltas.empty() && cache->deltas.back()->to == delta->from;
+    if (!extendsChain) {
+      if (cache->mountGeneration == mountGeneration &&
+          !cache->deltas.empty() && cache->deltas.back()->to >= delta->to) {
+        // A concurrent query already cached more recent changes
+        return;
+      }
+      cache->mountGeneration = mountGeneration;
+      cache->deltas.clear();
+      cache->numFiles = 0;
+    }
+
+    cache->numFiles += delta->byFile.size();
+    cache->deltas.push_back(std::move(delta));
+    while (cache->numFiles > journalCacheMaxFiles_) {
+      cache->numFiles -= cache->deltas.front()->byFile.size();
+      cache->deltas.pop_front();
+    }
+  }
+
+  /**
+   * Called by the subscriber thread when the mount settles, before
+   * subscribers are told about it. Streams the changes since the end of the
+   * cached deltas into the journal cache, so that the since queries that
+   * subscribers issue in response are answered from memory rather than each
+   * asking EdenFS for the same changes. Nothing is fetched until a query has
+   * started the chain of cached deltas.
+   */
+  void prefetchJournalDelta() const {
+    if (journalCacheMaxFiles_ == 0) {
+      return;
+    }
+    ClockRoot mountGeneration;
+    ClockTicks from;
+    {
+      auto cache = journalCache_.rlock();
+      if (cache->deltas.empty()) {
+        return;
+      }
+      mountGeneration = cache->mountGeneration;
+      from = cache->deltas.back()->to;
+    }
+
+    try {
+      auto delta =
+          streamJournalDelta(mountGeneration, from, journalCacheMaxFiles_);
+      if (delta) {
+        cacheJournalDelta(mountGeneration, std::move(delta));
+      }
+    } catch (const EdenError& err) {
+      // The mount generation changed or the journal was truncated; the
+      // next query will find out and start a new chain.
+      log(DBG,
+          "not prefetching EdenFS journal changes: ",
+          err.what(),
+          "\n");
+    }
+  }
+
+  GetAllChangesSinceResult getAllChangesSinceStreaming(
+      QueryContext* ctx) const {
+    auto mountGeneration = ctx->clockAtStartOfQuery.position().rootNumber;
+    // dial back to the sequence number from the query
+    auto since = std::get<QuerySince::Clock>(ctx->since.since).ticks;
+
+    auto deltas = getCachedJournalDeltas(mountGeneration, since);
+    auto from = deltas.empty() ? since : deltas.back()->to;
+    // Changes up to the start of the query must be reported; when another
+    // query has already streamed past that point, there is nothing to fetch.
+    if (deltas.empty() ||
+        from < ctx->clockAtStartOfQuery.position().ticks) {
+      auto delta = streamJournalDelta(
+          mountGeneration,
+          from,
+          ctx->query->empty_on_fresh_instance ? thresholdForFreshInstance_
+                                              : 0);
+      if (!delta) {
+        return makeFreshInstance(ctx);
+      }
+      cacheJournalDelta(mountGeneration, delta);
+      deltas.push_back(std::move(delta));
+    }
+
+    GetAllChangesSinceResult result;
+    result.ticks = deltas.back()->to;
+
+    if (deltas.size() == 1) {
+      auto& delta = *deltas.front();
+      for (auto& [name, count] : delta.byFile) {
+        result.fileInfo.emplace_back(
+            name, getDTypeFromEden(delta.dtypes.at(name)));
         if (count > 0) {
           result.createdFileNames.emplace(name);
         }
       }
+      return result;
+    }
+
+    std::unordered_map<std::string, int> byFile;
+    std::unordered_map<std::string, EdenDtype> dtypes;
+    for (auto& delta : deltas) {
+      for (auto& [name, count] : delta->byFile) {
+        byFile[name] += count;
+        mergeDtype(dtypes, name, delta->dtypes.at(name));
+      }
+    }
+    if (exceedsFreshInstanceThreshold(ctx, byFile.size())) {
+      return makeFreshInstance(ctx);
+    }
+
+    for (auto& [name, count] : byFile) {
+      result.fileInfo.emplace_back(name, getDTypeFromEden(dtypes[name]));
+      if (count > 0) {
+        result.createdFileNames.emplace(name);
+      }
     }
 
     return result;
@@ -1445,6 +2142,10 @@ class EdenView final : public QueryableView {
   bool splitGlobPattern_;
   unsigned int thresholdForFreshInstance_;
   bool enableGlobUpperBounds_;
+  size_t journalCacheMaxFiles_;
+  mutable folly::Synchronized<JournalCache> journalCache_;
+  std::shared_ptr<EdenAttributeCache> attributeCache_;
+  std::unique_ptr<EdenGlobCache> globCache_;
 };
 
 #ifdef _WIN32
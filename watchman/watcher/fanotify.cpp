@@ -0,0 +1,394 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/String.h>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "eden/common/utils/FSDetect.h"
+#include "watchman/Constants.h"
+#include "watchman/InMemoryView.h"
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/Pipe.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/SyncBarriers.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watcher/WatcherRegistry.h"
+
+#if defined(HAVE_FANOTIFY_INIT) && defined(FAN_REPORT_DFID_NAME)
+
+using namespace watchman;
+
+#define WATCHMAN_FANOTIFY_MASK                                          \
+  FAN_ATTRIB | FAN_CREATE | FAN_DELETE | FAN_DELETE_SELF | FAN_MODIFY | \
+      FAN_MOVE_SELF | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR
+
+#define WATCHMAN_FANOTIFY_ENTRY_CHANGES \
+  (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO)
+
+/**
+ * Watches a root by marking the filesystem that contains it, rather than each
+ * of its directories as inotify must. Setting up the watch costs the same no
+ * matter how large the tree, and is not bounded by max_user_watches.
+ *
+ * Events identify the directory they happened in by file handle, which is
+ * resolved back to a path with open_by_handle_at. Events elsewhere on the
+ * filesystem are discarded. Marking a filesystem requires CAP_SYS_ADMIN, so
+ * without it this watcher fails to start and auto-detection moves on to
+ * inotify.
+ */
+struct FanotifyWatcher : public Watcher {
+  FileDescriptor fanfd_;
+  // Any descriptor on the watched filesystem, for open_by_handle_at
+  FileDescriptor mountfd_;
+  Pipe terminatePipe_;
+  SyncBarriers syncBarriers_;
+  const w_string rootPath_;
+  // rootPath_ with a trailing slash, to match the paths beneath it
+  const w_string rootPrefix_;
+
+  /**
+   * Published from consumeNotify so getDebugInfo can read a recent value.
+   */
+  std::atomic<uint64_t> totalEventsSeen_ = 0;
+  std::atomic<uint64_t> foreignEventsSeen_ = 0;
+
+  // Changes gathered from a single read of ebuf, reused between reads so
+  // that its capacity is retained.
+  std::vector<PendingChange> batch_;
+
+  // Directory paths resolved during a single read of ebuf, keyed by the
+  // bytes of their file handle; a burst of changes tends to land in a few
+  // directories.
+  std::unordered_map<std::string, std::optional<w_string>> dirCache_;
+
+  char ebuf[WATCHMAN_BATCH_LIMIT * 64];
+
+  FanotifyWatcher(const w_string& rootPath, const Configuration& config);
+
+  std::unique_ptr<DirHandle> startWatchDir(
+      const std::shared_ptr<Root>& root,
+      const char* path) override;
+
+  Watcher::ConsumeNotifyRet consumeNotify(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll) override;
+
+  bool waitNotify(int timeoutms) override;
+
+  folly::SemiFuture<folly::Unit> syncBarrier() override {
+    return syncBarriers_.request();
+  }
+
+  void stopThreads() override;
+
+  json_ref getDebugInfo() override;
+  void clearDebugInfo() override;
+
+ private:
+  // Returns the path of the directory identified by `handle`, or nullopt if
+  // it no longer exists.
+  std::optional<w_string> resolveDir(struct file_handle* handle);
+
+  // Reads and processes one buffer of events, setting `cancel` if the watch
+  // needs to be cancelled. Returns false if there were none to read.
+  bool readEvents(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll,
+      bool& cancel);
+
+  // Appends the changes for one event to batch_. Returns true if the root
+  // directory was removed and the watch needs to be cancelled.
+  bool processEvent(
+      const std::shared_ptr<Root>& root,
+      const struct fanotify_event_metadata* meta,
+      std::chrono::system_clock::time_point now);
+};
+
+FanotifyWatcher::FanotifyWatcher(
+    const w_string& rootPath,
+    const Configuration& /*config*/)
+    : Watcher("fanotify", WATCHER_HAS_PER_FILE_NOTIFICATIONS),
+      rootPath_(rootPath),
+      rootPrefix_(w_string::build(rootPath, "/")) {
+  fanfd_ = FileDescriptor(
+      fanotify_init(
+          FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME,
+          O_RDONLY | O_CLOEXEC),
+      "fanotify_init",
+      FileDescriptor::FDType::Generic);
+
+  if (fanotify_mark(
+          fanfd_.fd(),
+          FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+          WATCHMAN_FANOTIFY_MASK,
+          AT_FDCWD,
+          rootPath.c_str()) == -1) {
+    throw std::system_error(errno, std::generic_category(), "fanotify_mark");
+  }
+
+  mountfd_ = FileDescriptor(
+      open(rootPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC),
+      "open root for fanotify",
+      FileDescriptor::FDType::Generic);
+
+  // Events are useless if their handles can't be resolved, which needs
+  // CAP_DAC_READ_SEARCH, so make sure that works before committing to it.
+  struct {
+    struct file_handle handle;
+    unsigned char bytes[MAX_HANDLE_SZ];
+  } rootHandle;
+  rootHandle.handle.handle_bytes = MAX_HANDLE_SZ;
+  int mountId;
+  if (name_to_handle_at(
+          AT_FDCWD, rootPath.c_str(), &rootHandle.handle, &mountId, 0) == -1) {
+    throw std::system_error(
+        errno, std::generic_category(), "name_to_handle_at");
+  }
+  FileDescriptor(
+      open_by_handle_at(mountfd_.fd(), &rootHandle.handle, O_PATH | O_CLOEXEC),
+      "open_by_handle_at",
+      FileDescriptor::FDType::Generic);
+}
+
+std::unique_ptr<DirHandle> FanotifyWatcher::startWatchDir(
+    const std::shared_ptr<Root>&,
+    const char* path) {
+  // The filesystem mark already covers every directory, so there is nothing
+  // to add here. Carry out our very strict opendir to ensure that we're not
+  // traversing symlinks in the context of this root
+  return openDir(path);
+}
+
+std::optional<w_string> FanotifyWatcher::resolveDir(
+    struct file_handle* handle) {
+  std::string key(
+      reinterpret_cast<const char*>(handle),
+      sizeof(*handle) + handle->handle_bytes);
+  auto it = dirCache_.find(key);
+  if (it != dirCache_.end()) {
+    return it->second;
+  }
+
+  std::optional<w_string> dirName;
+  FileDescriptor dirfd(
+      open_by_handle_at(mountfd_.fd(), handle, O_PATH | O_CLOEXEC),
+      FileDescriptor::FDType::Generic);
+  if (dirfd) {
+    try {
+      auto path = dirfd.getOpenedPath();
+      // The kernel decorates the paths of unlinked directories
+      constexpr std::string_view kDeleted{" (deleted)"};
+      auto view = path.view();
+      if (view.size() < kDeleted.size() ||
+          view.substr(view.size() - kDeleted.size()) != kDeleted) {
+        dirName = std::move(path);
+      }
+    } catch (const std::system_error& exc) {
+      logf(DBG, "fanotify: failed to resolve a directory: {}\n", exc.what());
+    }
+  } else {
+    logf(DBG, "fanotify: open_by_handle_at: {}\n", folly::errnoStr(errno));
+  }
+  dirCache_.emplace(std::move(key), dirName);
+  return dirName;
+}
+
+bool FanotifyWatcher::processEvent(
+    const std::shared_ptr<Root>& root,
+    const struct fanotify_event_metadata* meta,
+    std::chrono::system_clock::time_point now) {
+  if (meta->mask & FAN_Q_OVERFLOW) {
+    /* we missed something, will need to re-crawl */
+    root->scheduleRecrawl("FAN_Q_OVERFLOW");
+    return false;
+  }
+
+  // Moving the root leaves its handle resolvable, but at a path outside of
+  // the root, so check for the root directly.
+  if ((meta->mask & (FAN_DELETE_SELF | FAN_MOVE_SELF)) &&
+      access(rootPath_.c_str(), F_OK) != 0) {
+    logf(ERR, "root dir {} has been (re)moved, canceling watch\n", rootPath_);
+    return true;
+  }
+
+  const char* end = reinterpret_cast<const char*>(meta) + meta->event_len;
+  const char* ptr = reinterpret_cast<const char*>(meta) + meta->metadata_len;
+  while (ptr + sizeof(struct fanotify_event_info_header) <= end) {
+    auto* info = reinterpret_cast<const struct fanotify_event_info_fid*>(ptr);
+    if (info->hdr.len == 0) {
+      break;
+    }
+    ptr += info->hdr.len;
+    if (info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME &&
+        info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID) {
+      continue;
+    }
+
+    auto* handle = reinterpret_cast<struct file_handle*>(
+        const_cast<unsigned char*>(info->handle));
+    auto dirName = resolveDir(handle);
+    if (!dirName) {
+      // The directory is gone; its removal is reported as a change to its
+      // parent.
+      continue;
+    }
+
+    if (*dirName != rootPath_ &&
+        !w_string_piece(*dirName).startsWith(rootPrefix_)) {
+      foreignEventsSeen_.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+
+    w_string name = *dirName;
+    if (info->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+      const char* fileName = reinterpret_cast<const char*>(
+          handle->f_handle + handle->handle_bytes);
+      if (strcmp(fileName, ".") != 0) {
+        name = w_string::pathCat({*dirName, fileName});
+      }
+    }
+
+    logf(DBG, "fanotify: mask={:x} {}\n", meta->mask, name);
+
+    PendingFlags pending_flags = W_PENDING_VIA_NOTIFY;
+    if ((meta->mask & (FAN_DELETE_SELF | FAN_MOVE_SELF)) &&
+        name != rootPath_) {
+      // We need to examine the parent and potentially crawl down
+      name = name.dirName();
+    }
+    if (meta->mask & WATCHMAN_FANOTIFY_ENTRY_CHANGES) {
+      pending_flags.set(W_PENDING_RECURSIVE);
+    }
+    batch_.push_back(PendingChange{name, now, pending_flags});
+
+    if (meta->mask & WATCHMAN_FANOTIFY_ENTRY_CHANGES) {
+      // As with inotify, the directory containing the entry changed too
+      batch_.push_back(PendingChange{*dirName, now, W_PENDING_VIA_NOTIFY});
+    }
+  }
+  return false;
+}
+
+Watcher::ConsumeNotifyRet FanotifyWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  auto barriers = syncBarriers_.take();
+
+  // A barrier has to wait for all of the events queued before it was
+  // requested, so drain the queue for one.
+  bool cancel = false;
+  while (!cancel && readEvents(root, coll, cancel) && !barriers.empty()) {
+  }
+
+  for (auto& barrier : barriers) {
+    coll.addSync(std::move(barrier));
+  }
+  return {cancel};
+}
+
+bool FanotifyWatcher::readEvents(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll,
+    bool& cancel) {
+  ssize_t n = read(fanfd_.fd(), ebuf, sizeof(ebuf));
+  if (n == -1) {
+    if (errno == EINTR || errno == EAGAIN) {
+      return false;
+    }
+    logf(
+        FATAL,
+        "read({}, {}): error {}\n",
+        fanfd_.fd(),
+        sizeof(ebuf),
+        folly::errnoStr(errno));
+  }
+
+  logf(DBG, "fanotify read: returned {}.\n", n);
+  auto now = std::chrono::system_clock::now();
+
+  size_t eventsSeen = 0;
+  dirCache_.clear();
+  for (auto* meta = reinterpret_cast<struct fanotify_event_metadata*>(ebuf);
+       FAN_EVENT_OK(meta, n);
+       meta = FAN_EVENT_NEXT(meta, n)) {
+    if (meta->vers != FANOTIFY_METADATA_VERSION) {
+      logf(FATAL, "fanotify: unexpected metadata version {}\n", meta->vers);
+    }
+    cancel |= processEvent(root, meta, now);
+    ++eventsSeen;
+  }
+
+  coll.addBatch(batch_);
+
+  // Relaxed because we don't really care exactly when the value is visible.
+  totalEventsSeen_.fetch_add(eventsSeen, std::memory_order_relaxed);
+
+  return true;
+}
+
+bool FanotifyWatcher::waitNotify(int timeoutms) {
+  struct pollfd pfd[3];
+  pfd[0].fd = fanfd_.fd();
+  pfd[0].events = POLLIN;
+  pfd[1].fd = terminatePipe_.read.fd();
+  pfd[1].events = POLLIN;
+  pfd[2].fd = syncBarriers_.wakeFd();
+  pfd[2].events = POLLIN;
+
+  int n = poll(pfd, std::size(pfd), timeoutms);
+
+  if (n > 0) {
+    if (pfd[1].revents) {
+      // We were signalled via signalThreads
+      return false;
+    }
+    return pfd[0].revents != 0 || pfd[2].revents != 0;
+  }
+  return false;
+}
+
+void FanotifyWatcher::stopThreads() {
+  ignore_result(write(terminatePipe_.write.fd(), "X", 1));
+}
+
+json_ref FanotifyWatcher::getDebugInfo() {
+  return json_object({
+      {"total_event_count", json_integer(totalEventsSeen_.load())},
+      {"foreign_event_count", json_integer(foreignEventsSeen_.load())},
+  });
+}
+
+void FanotifyWatcher::clearDebugInfo() {
+  totalEventsSeen_.store(0, std::memory_order_release);
+  foreignEventsSeen_.store(0, std::memory_order_release);
+}
+
+namespace {
+std::shared_ptr<QueryableView> detectFanotify(
+    const w_string& root_path,
+    const w_string& fstype,
+    const Configuration& config) {
+  if (facebook::eden::is_edenfs_fs_type(fstype.string())) {
+    throw std::runtime_error("cannot watch EdenFS file systems with fanotify");
+  }
+  return std::make_shared<InMemoryView>(
+      WatcherRegistry::fileSystemFor(fstype, config),
+      root_path,
+      config,
+      std::make_shared<FanotifyWatcher>(root_path, config));
+}
+} // namespace
+
+// Preferred over inotify where it can be used
+static WatcherRegistry reg("fanotify", detectFanotify, 1);
+
+#endif // HAVE_FANOTIFY_INIT && FAN_REPORT_DFID_NAME
+
+/* vim:ts=2:sw=2:et:
+ */
@@ -7,6 +7,7 @@
 
 #include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <algorithm>
 #include <condition_variable>
 #include <iterator>
 #include <mutex>
@@ -23,9 +24,14 @@
 
 #include "watchman/watcher/fsevents.h"
 
+#include <dispatch/dispatch.h>
+#include <map>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include "watchman/root/Root.h"
+#include "watchman/thirdparty/libart/src/art.h"
 #include "watchman/telemetry/LogEvent.h"
 #include "watchman/telemetry/WatchmanStructuredLogger.h"
 
@@ -46,6 +52,16 @@ struct CFDeleter {
 template <typename T>
 using unique_ref = std::unique_ptr<std::remove_pointer_t<T>, CFDeleter>;
 
+bool isRootRemoved(
+    const w_string& path,
+    const w_string& root_path,
+    const std::optional<w_string>& subdir) {
+  if (subdir) {
+    return path == *subdir;
+  }
+  return path == root_path;
+}
+
 } // namespace
 
 struct FSEventsStream {
@@ -153,6 +169,112 @@ static void log_drop_event(const std::shared_ptr<Root>& root, bool isKernel) {
   sample.log();
 }
 
+bool FSEventsWatcher::raiseLatencyAfterDrop() {
+  auto raised = std::min(latency_ * 2, maxLatency_);
+  if (raised <= latency_) {
+    return false;
+  }
+  logf(
+      ERR,
+      "fsevents dropped events, raising the stream latency from {} to {} "
+      "seconds\n",
+      latency_,
+      raised);
+  latency_ = raised;
+  return true;
+}
+
+bool FSEventsWatcher::canScopeRecrawl(
+    const Root& root,
+    w_string_piece path,
+    FSEventStreamEventFlags eventFlags) const {
+  // fseventsd names the directory it dropped events under; when that is
+  // strictly inside the root, recrawling it covers everything we missed.
+  return recrawlScope_ != RecrawlScope::Root &&
+      (eventFlags & kFSEventStreamEventFlagMustScanSubDirs) &&
+      path.size() > root.root_path.size() &&
+      path.startsWith(root.root_path) &&
+      is_slash(path[root.root_path.size()]);
+}
+
+bool FSEventsWatcher::decodeEvent(
+    const std::shared_ptr<Root>& root,
+    w_string path,
+    FSEventStreamEventFlags eventFlags,
+    std::chrono::system_clock::time_point now,
+    FSEventsBatch& batch) {
+  char flags_label[128];
+  w_expand_flags(kflags, eventFlags, flags_label, sizeof(flags_label));
+  logf(DBG, "fsevents: got {} {:x} {}\n", path, eventFlags, flags_label);
+
+  bool dropped = eventFlags &
+      (kFSEventStreamEventFlagUserDropped |
+       kFSEventStreamEventFlagKernelDropped);
+  if (dropped && !subdir && !canScopeRecrawl(*root, path, eventFlags)) {
+    // The whole root will be recrawled, so nothing after this matters.
+    batch.control.emplace_back(std::move(path), eventFlags);
+    return false;
+  }
+
+  if ((eventFlags &
+       (kFSEventStreamEventFlagUnmount | kFSEventStreamEventFlagRootChanged)) ||
+      ((eventFlags & kFSEventStreamEventFlagItemRemoved) &&
+       isRootRemoved(path, root->root_path, subdir))) {
+    batch.control.emplace_back(std::move(path), eventFlags);
+    return false;
+  }
+
+  if (!hasFileWatching_ && path.size() < root->root_path.size()) {
+    // The test_watch_del_all appear to trigger this?
+    log(ERR,
+        "Got an event on a directory parent to the root directory: {}?\n",
+        path);
+    return true;
+  }
+
+  PendingFlags flags = W_PENDING_VIA_NOTIFY;
+
+  if (eventFlags &
+      (kFSEventStreamEventFlagMustScanSubDirs |
+       kFSEventStreamEventFlagItemRenamed)) {
+    flags.set(W_PENDING_RECURSIVE);
+  } else if (eventFlags & kFSEventStreamEventFlagItemRenamed) {
+    // FSEvents does not reliably report the individual files renamed in the
+    // hierarchy.
+    flags.set(W_PENDING_NONRECURSIVE_SCAN);
+  } else if (!hasFileWatching_) {
+    flags.set(W_PENDING_NONRECURSIVE_SCAN);
+  }
+
+  if (dropped) {
+    flags.set(W_PENDING_IS_DESYNCED);
+    batch.control.emplace_back(w_string{path}, eventFlags);
+  }
+
+  if (hasFileWatching_ && path.size() > root->root_path.size() &&
+      (eventFlags &
+       (kFSEventStreamEventFlagItemRenamed |
+        kFSEventStreamEventFlagItemCreated |
+        kFSEventStreamEventFlagItemRemoved))) {
+    // When the list of directory entries is modified, we hear
+    // about the modification, but perhaps not the directory
+    // change itself. Its mtime probably changed, so synthesize
+    // an event to consider it for examination.
+    //
+    // Note these two issues:
+    // - https://github.com/facebook/watchman/issues/305
+    // - https://github.com/facebook/watchman/issues/307
+    //
+    // Watchman does not guarantee minimal notifications, but limiting
+    // the event types above should avoid unnecessary results in
+    // queries.
+    batch.changes.push_back({path.dirName(), now, W_PENDING_VIA_NOTIFY});
+  }
+
+  batch.changes.push_back({std::move(path), now, flags});
+  return true;
+}
+
 void FSEventsWatcher::fse_callback(
     ConstFSEventStreamRef,
     void* clientCallBackInfo,
@@ -164,8 +286,10 @@ void FSEventsWatcher::fse_callback(
   auto paths = reinterpret_cast<char**>(eventPaths);
   auto stream = reinterpret_cast<FSEventsStream*>(clientCallBackInfo);
   auto root = stream->root;
-  std::vector<watchman_fsevent> items;
+  FSEventsBatch batch;
   auto watcher = stream->watcher;
+  // A stream replaced below is kept alive until we are done with its events
+  std::unique_ptr<FSEventsStream> retired;
 
   stream->watcher->totalEventsSeen_.fetch_add(
       numEvents, std::memory_order_relaxed);
@@ -182,6 +306,7 @@ void FSEventsWatcher::fse_callback(
     if (stream->inject_drop) {
       stream->lost_sync = true;
       log_drop_event(root, false);
+      watcher->raiseLatencyAfterDrop();
       goto do_resync;
     }
 
@@ -200,6 +325,26 @@ void FSEventsWatcher::fse_callback(
         log_drop_event(
             root, eventFlags[i] & kFSEventStreamEventFlagKernelDropped);
 
+        if (watcher->raiseLatencyAfterDrop() &&
+            !watcher->attemptResyncOnDrop_ &&
+            watcher->stream_.get() == stream) {
+          // The drop will still propagate and trigger a recrawl, which covers
+          // anything missed while switching to a stream with the new latency.
+          std::optional<w_string> failure_reason;
+          auto replacement = fse_stream_make(
+              root, watcher, kFSEventStreamEventIdSinceNow, failure_reason);
+          if (replacement && FSEventStreamStart(replacement->stream)) {
+            std::swap(watcher->stream_, replacement);
+            retired = std::move(replacement);
+          } else {
+            logf(
+                ERR,
+                "Failed to rebuild fsevent stream ({}) with a raised "
+                "latency, keeping the current stream\n",
+                failure_reason ? *failure_reason : w_string{});
+          }
+        }
+
         if (watcher->attemptResyncOnDrop_) {
         // fseventsd has a reliable journal so we can attempt to resync.
         do_resync:
@@ -268,7 +413,8 @@ void FSEventsWatcher::fse_callback(
 
 propagate:
 
-  items.reserve(numEvents);
+  batch.changes.reserve(numEvents);
+  auto now = std::chrono::system_clock::now();
   for (i = 0; i < numEvents; i++) {
     const char* path = paths[i];
 
@@ -298,15 +444,18 @@ propagate:
       continue;
     }
 
-    items.emplace_back(w_string(path, len), eventFlags[i]);
     if (!stream->lost_sync) {
       stream->last_good = eventIds[i];
     }
+    if (!watcher->decodeEvent(
+            root, w_string(path, len), eventFlags[i], now, batch)) {
+      break;
+    }
   }
 
-  if (!items.empty()) {
+  if (!batch.changes.empty() || !batch.control.empty()) {
     auto wlock = watcher->items_.lock();
-    wlock->items.push_back(std::move(items));
+    wlock->items.push_back(std::move(batch));
     watcher->fseCond_.notify_one();
   }
 }
@@ -408,7 +557,7 @@ std::unique_ptr<FSEventsStream> FSEventsWatcher::fse_stream_make(
 
   CFArrayAppendValue(parray.get(), cpath.get());
 
-  latency = root->config.getDouble("fsevents_latency", 0.01),
+  latency = watcher->latency_;
   logf(
       DBG,
       "FSEventStreamCreate for path {} with latency {} seconds\n",
@@ -541,6 +690,389 @@ void FSEventsWatcher::FSEventsThread(const std::shared_ptr<Root>& root) {
   logf(DBG, "fse_thread done\n");
 }
 
+/**
+ * One FSEvents stream covering every root on a device whose watch enables
+ * `fsevents_share_streams`, so that the number of streams, and of threads
+ * serving them, stays the same as roots are added.
+ *
+ * The stream is scheduled on a serial dispatch queue rather than on a run
+ * loop thread of its own.  Its callback routes each event to the roots that
+ * contain it through an art_tree of the root paths, and each root's
+ * FSEventsWatcher consumes the events routed to it as usual.  A stream's
+ * paths are fixed, so attaching or detaching a root replaces the stream,
+ * starting from the last event seen when the device has a journal.
+ */
+class FSEventsSharedStream {
+ public:
+  FSEventsSharedStream(dev_t dev, bool fileEvents, double latency);
+  ~FSEventsSharedStream();
+
+  /** Returns the stream for these parameters, creating it if needed. */
+  static std::shared_ptr<FSEventsSharedStream>
+  get(dev_t dev, bool fileEvents, double latency);
+
+  bool attach(
+      const std::shared_ptr<Root>& root,
+      FSEventsWatcher* watcher,
+      std::optional<w_string>& failure_reason);
+  void detach(FSEventsWatcher* watcher);
+
+  /** Delivers whatever FSEvents has queued for the stream. */
+  void flush();
+
+  size_t rootCount() const {
+    return targets_.lock()->size();
+  }
+
+ private:
+  struct Target {
+    std::shared_ptr<Root> root;
+    FSEventsWatcher* watcher;
+  };
+
+  struct Routed {
+    FSEventsBatch batch;
+    // decodeEvent ended the batch; the rest of the callback is discarded
+    bool ended{false};
+  };
+
+  static void fse_callback(
+      ConstFSEventStreamRef,
+      void* clientCallBackInfo,
+      size_t numEvents,
+      void* eventPaths,
+      const FSEventStreamEventFlags eventFlags[],
+      const FSEventStreamEventId eventIds[]);
+
+  /**
+   * Replaces the stream with one covering the attached roots, or stops it
+   * if there are none.  Keeps the current stream on failure.  Must run on
+   * queue_, so that it never overlaps with a callback.
+   */
+  bool rebuild(std::optional<w_string>& failure_reason);
+  bool rebuildOnQueue(std::optional<w_string>& failure_reason);
+
+  const dev_t dev_;
+  const bool fileEvents_;
+  const double latency_;
+  dispatch_queue_t queue_;
+  // Keyed by the root path with a trailing slash, so that lookups by
+  // prefix stop at path boundaries.
+  folly::Synchronized<art_tree<Target, w_string>, std::mutex> targets_;
+  // Replaced on queue_, and read by flush().
+  folly::Synchronized<FSEventStreamRef, std::mutex> stream_{nullptr};
+  // The id to start a replacement stream from.  Only accessed on queue_.
+  FSEventStreamEventId lastEventId_{0};
+};
+
+FSEventsSharedStream::FSEventsSharedStream(
+    dev_t dev,
+    bool fileEvents,
+    double latency)
+    : dev_{dev},
+      fileEvents_{fileEvents},
+      latency_{latency},
+      queue_{
+          dispatch_queue_create("watchman.fsevents", DISPATCH_QUEUE_SERIAL)} {}
+
+FSEventsSharedStream::~FSEventsSharedStream() {
+  // Detaching the last root stopped the stream unless its rebuild failed
+  auto stream = *stream_.lock();
+  if (stream) {
+    FSEventStreamStop(stream);
+    FSEventStreamInvalidate(stream);
+    FSEventStreamRelease(stream);
+  }
+  dispatch_release(queue_);
+}
+
+std::shared_ptr<FSEventsSharedStream>
+FSEventsSharedStream::get(dev_t dev, bool fileEvents, double latency) {
+  using Key = std::tuple<dev_t, bool, double>;
+  static folly::Synchronized<
+      std::map<Key, std::weak_ptr<FSEventsSharedStream>>,
+      std::mutex>
+      streams;
+
+  auto locked = streams.lock();
+  for (auto it = locked->begin(); it != locked->end();) {
+    if (it->second.expired()) {
+      it = locked->erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  auto& entry = (*locked)[Key{dev, fileEvents, latency}];
+  auto stream = entry.lock();
+  if (!stream) {
+    stream = std::make_shared<FSEventsSharedStream>(dev, fileEvents, latency);
+    entry = stream;
+  }
+  return stream;
+}
+
+bool FSEventsSharedStream::attach(
+    const std::shared_ptr<Root>& root,
+    FSEventsWatcher* watcher,
+    std::optional<w_string>& failure_reason) {
+  auto key = w_string::build(root->root_path, "/");
+  targets_.lock()->insert(key, Target{root, watcher});
+  if (rebuildOnQueue(failure_reason)) {
+    return true;
+  }
+  targets_.lock()->erase(key);
+  return false;
+}
+
+void FSEventsSharedStream::detach(FSEventsWatcher* watcher) {
+  // Released once the stream no longer covers the root
+  art_tree<Target, w_string>::LeafPtr detached;
+  {
+    auto targets = targets_.lock();
+    std::optional<w_string> key;
+    targets->iter([&](const w_string& path, Target& target) {
+      if (target.watcher != watcher) {
+        return 0;
+      }
+      key = path;
+      return 1;
+    });
+    if (!key) {
+      return;
+    }
+    detached = targets->erase(*key);
+  }
+
+  std::optional<w_string> failure_reason;
+  if (!rebuildOnQueue(failure_reason)) {
+    // The current stream keeps covering the root, but nothing routes its
+    // events anywhere.
+    logf(
+        ERR,
+        "Failed to rebuild the shared fsevents stream without a root: {}\n",
+        failure_reason ? *failure_reason : w_string{});
+  }
+}
+
+void FSEventsSharedStream::flush() {
+  FSEventStreamRef stream;
+  {
+    auto locked = stream_.lock();
+    stream = *locked;
+    if (stream) {
+      FSEventStreamRetain(stream);
+    }
+  }
+  if (stream) {
+    FSEventStreamFlushSync(stream);
+    FSEventStreamRelease(stream);
+  }
+}
+
+bool FSEventsSharedStream::rebuildOnQueue(
+    std::optional<w_string>& failure_reason) {
+  struct Request {
+    FSEventsSharedStream* self;
+    std::optional<w_string>& failure_reason;
+    bool ok;
+  } request{this, failure_reason, false};
+
+  dispatch_sync_f(queue_, &request, [](void* context) {
+    auto request = static_cast<Request*>(context);
+    request->ok = request->self->rebuild(request->failure_reason);
+  });
+  return request.ok;
+}
+
+bool FSEventsSharedStream::rebuild(std::optional<w_string>& failure_reason) {
+  unique_ref<CFMutableArrayRef> parray{
+      CFArrayCreateMutable(nullptr, 0, &kCFTypeArrayCallBacks)};
+  if (!parray) {
+    failure_reason = w_string("CFArrayCreateMutable failed", W_STRING_UNICODE);
+    return false;
+  }
+
+  bool ok = true;
+  targets_.lock()->iter([&](const w_string& key, Target&) {
+    // Without the trailing slash of the key
+    unique_ref<CFStringRef> cpath{CFStringCreateWithBytes(
+        nullptr,
+        (const UInt8*)key.data(),
+        key.size() - 1,
+        kCFStringEncodingUTF8,
+        false)};
+    if (!cpath) {
+      ok = false;
+      return 1;
+    }
+    CFArrayAppendValue(parray.get(), cpath.get());
+    return 0;
+  });
+  if (!ok) {
+    failure_reason =
+        w_string("CFStringCreateWithBytes failed", W_STRING_UNICODE);
+    return false;
+  }
+
+  FSEventStreamRef replacement = nullptr;
+  auto numPaths = CFArrayGetCount(parray.get());
+  if (numPaths > 0) {
+    // Replay from the last event the current stream delivered, so that the
+    // other roots miss nothing while the streams are swapped.  That needs
+    // the device's journal, like fsevents_try_resync.
+    FSEventStreamEventId since = kFSEventStreamEventIdSinceNow;
+    unique_ref<CFUUIDRef> uuid{FSEventsCopyUUIDForDevice(dev_)};
+    if (lastEventId_ && uuid) {
+      since = lastEventId_;
+    }
+
+    auto ctx = FSEventStreamContext();
+    ctx.info = this;
+    FSEventStreamCreateFlags flags =
+        kFSEventStreamCreateFlagNoDefer | kFSEventStreamCreateFlagWatchRoot;
+    if (fileEvents_) {
+      flags |= kFSEventStreamCreateFlagFileEvents;
+    }
+    logf(
+        DBG,
+        "FSEventStreamCreate for {} shared roots with latency {} seconds\n",
+        numPaths,
+        latency_);
+    replacement = FSEventStreamCreate(
+        nullptr, fse_callback, &ctx, parray.get(), since, latency_, flags);
+    if (!replacement) {
+      failure_reason = w_string("FSEventStreamCreate failed", W_STRING_UNICODE);
+      return false;
+    }
+
+    FSEventStreamSetDispatchQueue(replacement, queue_);
+    if (!FSEventStreamStart(replacement)) {
+      FSEventStreamInvalidate(replacement);
+      FSEventStreamRelease(replacement);
+      failure_reason = w_string::build(
+          "FSEventStreamStart failed, look at your log file ",
+          logging::log_name,
+          " for lines mentioning FSEvents and see ",
+          cfg_get_trouble_url(),
+          "#fsevents for more information\n");
+      return false;
+    }
+  }
+
+  FSEventStreamRef previous;
+  {
+    auto locked = stream_.lock();
+    previous = *locked;
+    *locked = replacement;
+  }
+  if (previous) {
+    FSEventStreamStop(previous);
+    FSEventStreamInvalidate(previous);
+    FSEventStreamRelease(previous);
+  }
+  return true;
+}
+
+void FSEventsSharedStream::fse_callback(
+    ConstFSEventStreamRef,
+    void* clientCallBackInfo,
+    size_t numEvents,
+    void* eventPaths,
+    const FSEventStreamEventFlags eventFlags[],
+    const FSEventStreamEventId eventIds[]) {
+  // Events above the roots that concern everything beneath them
+  constexpr FSEventStreamEventFlags kParentFlags =
+      kFSEventStreamEventFlagMustScanSubDirs |
+      kFSEventStreamEventFlagUserDropped |
+      kFSEventStreamEventFlagKernelDropped | kFSEventStreamEventFlagUnmount |
+      kFSEventStreamEventFlagRootChanged;
+
+  auto self = reinterpret_cast<FSEventsSharedStream*>(clientCallBackInfo);
+  auto paths = reinterpret_cast<char**>(eventPaths);
+  auto now = std::chrono::system_clock::now();
+  std::unordered_map<FSEventsWatcher*, Routed> routed;
+
+  // Held until the batches are queued, so that a detached watcher is never
+  // handed any more events.
+  auto targets = self->targets_.lock();
+
+  for (size_t i = 0; i < numEvents; i++) {
+    const char* path = paths[i];
+    auto flags = eventFlags[i];
+
+    if (flags & kFSEventStreamEventFlagHistoryDone) {
+      // Marks the end of the replay after a rebuild
+      continue;
+    }
+    // A wrapped id can't be replayed from
+    self->lastEventId_ =
+        (flags & kFSEventStreamEventFlagEventIdsWrapped) ? 0 : eventIds[i];
+
+    uint32_t len = strlen(path);
+    while (len > 0 && path[len - 1] == '/') {
+      len--;
+    }
+    auto key = w_string::build(w_string_piece{path, len}, "/");
+
+    auto deliver = [&](Target& target) {
+      auto watcher = target.watcher;
+      watcher->totalEventsSeen_.fetch_add(1, std::memory_order_relaxed);
+      if (watcher->ringBuffer_) {
+        watcher->ringBuffer_->write(FSEventsLogEntry{flags, path});
+      }
+
+      auto& r = routed[watcher];
+      if (r.ended || target.root->ignore.isIgnored(path, len)) {
+        return;
+      }
+      if (flags &
+          (kFSEventStreamEventFlagUserDropped |
+           kFSEventStreamEventFlagKernelDropped)) {
+        log_drop_event(
+            target.root, flags & kFSEventStreamEventFlagKernelDropped);
+      }
+      if (!watcher->decodeEvent(
+              target.root, w_string(path, len), flags, now, r.batch)) {
+        r.ended = true;
+      }
+    };
+
+    // Every root at or above the path sees it, since roots may nest
+    bool contained = false;
+    for (uint32_t prefix = 1; prefix <= key.size(); prefix++) {
+      if (key.data()[prefix - 1] != '/') {
+        continue;
+      }
+      auto target = targets->search(
+          reinterpret_cast<const unsigned char*>(key.data()), prefix);
+      if (target) {
+        deliver(*target);
+        contained = true;
+      }
+    }
+
+    if (!contained && (flags & kParentFlags)) {
+      targets->iterPrefix(
+          reinterpret_cast<const unsigned char*>(key.data()),
+          key.size(),
+          [&](const w_string&, Target& target) {
+            deliver(target);
+            return 0;
+          });
+    }
+  }
+
+  for (auto& [watcher, r] : routed) {
+    if (r.batch.changes.empty() && r.batch.control.empty()) {
+      continue;
+    }
+    auto wlock = watcher->items_.lock();
+    wlock->items.push_back(std::move(r.batch));
+    watcher->fseCond_.notify_one();
+  }
+}
+
 FSEventsWatcher::FSEventsWatcher(
     bool hasFileWatching,
     const Configuration& config,
@@ -548,9 +1080,16 @@ FSEventsWatcher::FSEventsWatcher(
     : Watcher(
           hasFileWatching ? "fsevents" : "dirfsevents",
           hasFileWatching ? WATCHER_HAS_PER_FILE_NOTIFICATIONS : 0),
+      shareStreams_{
+          !dir && config.getBool("fsevents_share_streams", false)},
       attemptResyncOnDrop_{config.getBool("fsevents_try_resync", false)},
       hasFileWatching_{hasFileWatching},
       enableStreamFlush_{config.getBool("fsevents_enable_stream_flush", true)},
+      recrawlScope_{parseRecrawlScope(config)},
+      latency_{config.getDouble("fsevents_latency", 0.01)},
+      maxLatency_{std::max(
+          latency_,
+          config.getDouble("fsevents_max_latency", kDefaultMaxLatency))},
       subdir{std::move(dir)} {
   // TODO: Add ring buffer logging for events in the shared kqueue+fsevents
   // logger.
@@ -574,7 +1113,36 @@ FSEventsWatcher::FSEventsWatcher(
 
 FSEventsWatcher::~FSEventsWatcher() = default;
 
+bool FSEventsWatcher::startShared(const std::shared_ptr<Root>& root) {
+  struct stat st;
+  if (stat(root->root_path.c_str(), &st)) {
+    root->failure_reason = w_string::build(
+        "failed to stat(",
+        root->root_path,
+        "): ",
+        folly::errnoStr(errno),
+        "\n");
+    return false;
+  }
+
+  auto shared =
+      FSEventsSharedStream::get(st.st_dev, hasFileWatching_, latency_);
+  if (!shared->attach(root, this, root->failure_reason)) {
+    logf(
+        ERR,
+        "failed to attach to the shared fsevents stream: {}\n",
+        *root->failure_reason);
+    return false;
+  }
+  sharedStream_ = std::move(shared);
+  return true;
+}
+
 bool FSEventsWatcher::start(const std::shared_ptr<Root>& root) {
+  if (shareStreams_) {
+    return startShared(root);
+  }
+
   // Spin up the fsevents processing thread; it owns a ref on the root
 
   auto self = std::dynamic_pointer_cast<FSEventsWatcher>(shared_from_this());
@@ -657,7 +1225,11 @@ folly::SemiFuture<folly::Unit> FSEventsWatcher::flushPendingEvents() {
    */
 
   // Ensure all events queued by FSEvents are pushed into wlock->items.
-  FSEventStreamFlushSync(stream_->stream);
+  if (sharedStream_) {
+    sharedStream_->flush();
+  } else {
+    FSEventStreamFlushSync(stream_->stream);
+  }
 
   // Now return a Future that is fulfilled when all of the items have been
   // processed by InMemoryView.
@@ -679,23 +1251,11 @@ bool FSEventsWatcher::waitNotify(int timeoutms) {
   return !wlock->items.empty() || !wlock->syncs.empty();
 }
 
-namespace {
-bool isRootRemoved(
-    const w_string& path,
-    const w_string& root_path,
-    const std::optional<w_string>& subdir) {
-  if (subdir) {
-    return path == *subdir;
-  }
-  return path == root_path;
-}
-} // namespace
-
 Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
     const std::shared_ptr<Root>& root,
     PendingChanges& coll) {
   char flags_label[128];
-  std::vector<std::vector<watchman_fsevent>> items;
+  std::vector<FSEventsBatch> items;
   std::vector<folly::Promise<folly::Unit>> syncs;
   bool cancelSelf = false;
 
@@ -705,24 +1265,19 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
     std::swap(syncs, wlock->syncs);
   }
 
-  auto now = std::chrono::system_clock::now();
-
-  for (auto& vec : items) {
-    for (auto& item : vec) {
+  for (auto& batch : items) {
+    for (auto& item : batch.control) {
       w_expand_flags(kflags, item.flags, flags_label, sizeof(flags_label));
-      logf(
-          DBG,
-          "fsevents: got {} {:x} {}\n",
-          item.path,
-          item.flags,
-          flags_label);
 
       if (item.flags &
           (kFSEventStreamEventFlagUserDropped |
            kFSEventStreamEventFlagKernelDropped)) {
-        if (!subdir) {
+        if (!subdir && !canScopeRecrawl(*root, item.path, item.flags)) {
           root->scheduleRecrawl(flags_label);
-          break;
+        } else if (!subdir) {
+          // decodeEvent queued a recursive, desynced crawl of item.path
+          auto reason = fmt::format("{}: {}", item.path, flags_label);
+          root->recrawlTriggered(reason.c_str());
         } else {
           w_assert(
               item.flags & kFSEventStreamEventFlagMustScanSubDirs,
@@ -730,85 +1285,36 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
           auto reason = fmt::format("{}: {}", *subdir, flags_label);
           root->recrawlTriggered(reason.c_str());
         }
-      }
-
-      if (item.flags & kFSEventStreamEventFlagUnmount) {
+      } else if (item.flags & kFSEventStreamEventFlagUnmount) {
         logf(
             ERR,
             "kFSEventStreamEventFlagUnmount {}, cancel watch\n",
             item.path);
         cancelSelf = true;
-        break;
-      }
-
-      if ((item.flags & kFSEventStreamEventFlagItemRemoved) &&
-          isRootRemoved(item.path, root->root_path, subdir)) {
-        log(ERR, "Root directory removed, cancel watch\n");
-        cancelSelf = true;
-        break;
-      }
-
-      if (item.flags & kFSEventStreamEventFlagRootChanged) {
+      } else if (item.flags & kFSEventStreamEventFlagRootChanged) {
         logf(
             ERR,
             "kFSEventStreamEventFlagRootChanged {}, cancel watch\n",
             item.path);
         cancelSelf = true;
-        break;
-      }
-
-      if (!hasFileWatching_ && item.path.size() < root->root_path.size()) {
-        // The test_watch_del_all appear to trigger this?
-        log(ERR,
-            "Got an event on a directory parent to the root directory: {}?\n",
-            item.path);
-        continue;
-      }
-
-      PendingFlags flags = W_PENDING_VIA_NOTIFY;
-
-      if (item.flags &
-          (kFSEventStreamEventFlagMustScanSubDirs |
-           kFSEventStreamEventFlagItemRenamed)) {
-        flags.set(W_PENDING_RECURSIVE);
-      } else if (item.flags & kFSEventStreamEventFlagItemRenamed) {
-        // FSEvents does not reliably report the individual files renamed in the
-        // hierarchy.
-        flags.set(W_PENDING_NONRECURSIVE_SCAN);
-      } else if (!hasFileWatching_) {
-        flags.set(W_PENDING_NONRECURSIVE_SCAN);
-      }
-
-      if (item.flags &
-          (kFSEventStreamEventFlagUserDropped |
-           kFSEventStreamEventFlagKernelDropped)) {
-        flags.set(W_PENDING_IS_DESYNCED);
+      } else {
+        log(ERR, "Root directory removed, cancel watch\n");
+        cancelSelf = true;
       }
+    }
 
-      coll.add(item.path, now, flags);
-
-      if (hasFileWatching_ && item.path.size() > root->root_path.size() &&
-          (item.flags &
-           (kFSEventStreamEventFlagItemRenamed |
-            kFSEventStreamEventFlagItemCreated |
-            kFSEventStreamEventFlagItemRemoved))) {
-        // When the list of directory entries is modified, we hear
-        // about the modification, but perhaps not the directory
-        // change itself. Its mtime probably changed, so synthesize
-        // an event to consider it for examination.
-        //
-        // Note these two issues:
-        // - https://github.com/facebook/watchman/issues/305
-        // - https://github.com/facebook/watchman/issues/307
-        //
-        // Watchman does not guarantee minimal notifications, but limiting
-        // the event types above should avoid unnecessary results in
-        // queries.
-        coll.add(item.path.dirName(), now, W_PENDING_VIA_NOTIFY);
-      }
+    if (batch_.empty()) {
+      batch_ = std::move(batch.changes);
+    } else {
+      std::move(
+          batch.changes.begin(),
+          batch.changes.end(),
+          std::back_inserter(batch_));
     }
   }
 
+  coll.addBatch(batch_);
+
   for (auto& sync : syncs) {
     coll.addSync(std::move(sync));
   }
@@ -817,6 +1323,12 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
 }
 
 void FSEventsWatcher::stopThreads() {
+  if (sharedStream_) {
+    // Kept until the watcher is destroyed, since flushPendingEvents may
+    // still be using it.
+    sharedStream_->detach(this);
+    return;
+  }
   write(fsePipe_.write.fd(), "X", 1);
 }
 
@@ -835,10 +1347,15 @@ json_ref FSEventsWatcher::getDebugInfo() {
     }
     events = json_array(std::move(elements));
   }
-  return json_object({
+  auto info = json_object({
       {"events", events},
       {"total_event_count", json_integer(totalEventsSeen_.load())},
   });
+  if (sharedStream_) {
+    info.set(
+        "shared_stream_roots", json_integer(sharedStream_->rootCount()));
+  }
+  return info;
 }
 
 void FSEventsWatcher::clearDebugInfo() {
@@ -871,6 +1388,10 @@ UntypedResponse FSEventsWatcher::cmd_debug_fsevents_inject_drop(
     throw ErrorResponse("root is not using the fsevents watcher");
   }
 
+  if (watcher->sharedStream_) {
+    throw ErrorResponse("fsevents_share_streams is enabled");
+  }
+
   if (!watcher->attemptResyncOnDrop_) {
     throw ErrorResponse("fsevents_try_resync is not enabled");
   }
@@ -7,7 +7,9 @@
 
 #pragma once
 
+#include <chrono>
 #include <optional>
+#include <vector>
 #include "watchman/RingBuffer.h"
 #include "watchman/fs/Pipe.h"
 #include "watchman/watcher/Watcher.h"
@@ -19,6 +21,7 @@ namespace watchman {
 
 class Client;
 class Configuration;
+class FSEventsSharedStream;
 struct FSEventsStream;
 struct FSEventsLogEntry;
 
@@ -30,6 +33,17 @@ struct watchman_fsevent {
       : path(std::move(path)), flags(flags) {}
 };
 
+/**
+ * The events of one fse_callback invocation, decoded on the FSEvents thread
+ * so that the consumer only has to merge them into its PendingChanges.
+ */
+struct FSEventsBatch {
+  std::vector<PendingChange> changes;
+  // Events for the consumer to act on itself: drops, and whatever ended the
+  // batch early (an unmount, or the root being removed or changed).
+  std::vector<watchman_fsevent> control;
+};
+
 class FSEventsWatcher : public Watcher {
  public:
   explicit FSEventsWatcher(
@@ -67,11 +81,46 @@ class FSEventsWatcher : public Watcher {
       const json_ref& args);
 
  private:
+  friend class FSEventsSharedStream;
+
+  /**
+   * Attaches the root to the shared stream for its device instead of
+   * starting a stream and thread of its own.
+   */
+  bool startShared(const std::shared_ptr<Root>& root);
+
   static std::unique_ptr<FSEventsStream> fse_stream_make(
       const std::shared_ptr<Root>& root,
       FSEventsWatcher* watcher,
       FSEventStreamEventId since,
       std::optional<w_string>& failure_reason);
+
+  /**
+   * Decodes one event into `batch`. Returns false if this event ends the
+   * batch, in which case any further events of the callback are discarded.
+   */
+  bool decodeEvent(
+      const std::shared_ptr<Root>& root,
+      w_string path,
+      FSEventStreamEventFlags eventFlags,
+      std::chrono::system_clock::time_point now,
+      FSEventsBatch& batch);
+
+  /**
+   * Doubles latency_, up to maxLatency_, so that fseventsd can coalesce more
+   * events before it has to drop them again. Returns true if it changed.
+   */
+  bool raiseLatencyAfterDrop();
+
+  /**
+   * Whether events dropped with these flags at `path` can be recovered from
+   * by recrawling just that subtree rather than the whole root.
+   */
+  bool canScopeRecrawl(
+      const Root& root,
+      w_string_piece path,
+      FSEventStreamEventFlags eventFlags) const;
+
   static void fse_callback(
       ConstFSEventStreamRef,
       void* clientCallBackInfo,
@@ -80,23 +129,35 @@ class FSEventsWatcher : public Watcher {
       const FSEventStreamEventFlags eventFlags[],
       const FSEventStreamEventId eventIds[]);
 
+  static constexpr double kDefaultMaxLatency = 0.5;
+
   watchman::Pipe fsePipe_;
 
   std::condition_variable fseCond_;
   struct Items {
     // Unflattened queue of pending events. The fse_callback function will push
-    // exactly one vector to the end of this one, flattening the vector would
+    // exactly one batch to the end of this one, flattening the batches would
     // require extra copying and allocations.
-    std::vector<std::vector<watchman_fsevent>> items;
+    std::vector<FSEventsBatch> items;
     // Sync requests to be inserted into PendingCollection.
     std::vector<folly::Promise<folly::Unit>> syncs;
   };
   folly::Synchronized<Items, std::mutex> items_;
 
   std::unique_ptr<FSEventsStream> stream_;
+  // Set instead of stream_ when the root is on a shared stream.
+  std::shared_ptr<FSEventsSharedStream> sharedStream_;
+  const bool shareStreams_{false};
   const bool attemptResyncOnDrop_{false};
   const bool hasFileWatching_{false};
   const bool enableStreamFlush_{true};
+  const RecrawlScope recrawlScope_;
+  // The latency for the next stream, raised after each drop up to
+  // maxLatency_. Only accessed on the FSEvents thread.
+  double latency_;
+  const double maxLatency_;
+  // Reused by consumeNotify to merge the queued batches.
+  std::vector<PendingChange> batch_;
   std::optional<w_string> subdir{std::nullopt};
 
   // Incremented in fse_callback
@@ -5,6 +5,7 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <fmt/core.h>
 #include <folly/String.h>
 #include <folly/Synchronized.h>
 #include <atomic>
@@ -19,6 +20,8 @@
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/fs/Pipe.h"
 #include "watchman/root/Root.h"
+#include "watchman/watcher/SyncBarriers.h"
+#include "watchman/watcher/WatchDescriptorTable.h"
 #include "watchman/watcher/Watcher.h"
 #include "watchman/watcher/WatcherRegistry.h"
 
@@ -126,6 +129,7 @@ struct InotifyWatcher : public Watcher {
   /* we use one inotify instance per watched root dir */
   FileDescriptor infd;
   Pipe terminatePipe_;
+  SyncBarriers syncBarriers_;
 
   /**
    * If not null, holds a fixed-size ring of the last `inotify_ring_log_size`
@@ -139,14 +143,28 @@ struct InotifyWatcher : public Watcher {
   std::atomic<uint64_t> totalEventsSeen_ = 0;
 
   struct maps {
-    /* map of active watch descriptor to name of the corresponding dir */
-    std::unordered_map<int, w_string> wd_to_name;
+    /* active watch descriptors and the dirs they watch */
+    WatchDescriptorTable wd_to_name;
     /* map of inotify cookie to corresponding name */
     std::unordered_map<uint32_t, pending_move> move_map;
+    /* map of watch descriptor to when it last reported an event, kept
+     * only for RecrawlScope::Recent */
+    std::unordered_map<int, std::chrono::system_clock::time_point> recent_wds;
   };
 
   folly::Synchronized<maps> maps;
 
+  // Changes gathered from a single read of ibuf, reused between reads so
+  // that its capacity is retained.
+  std::vector<PendingChange> batch_;
+
+  const RecrawlScope recrawlScope_;
+  // With RecrawlScope::Recent, an overflow recrawls the directories that
+  // reported events within this window, if there are at most
+  // recrawlMaxDirs_ of them.
+  const std::chrono::milliseconds recrawlWindow_;
+  const size_t recrawlMaxDirs_;
+
   // Make the buffer big enough for 16k entries, which
   // happens to be the default fs.inotify.max_queued_events
   char ibuf
@@ -164,15 +182,33 @@ struct InotifyWatcher : public Watcher {
 
   bool waitNotify(int timeoutms) override;
 
-  // Process a single inotify event and add it to the pending collection if
-  // needed. Returns true if the root directory was removed and the watch needs
-  // to be cancelled.
+  folly::SemiFuture<folly::Unit> syncBarrier() override {
+    return syncBarriers_.request();
+  }
+
+  // Reads and processes one buffer of events. Returns true if the watch
+  // needs to be cancelled.
+  bool readEvents(const std::shared_ptr<Root>& root, PendingChanges& coll);
+
+  // Process a single inotify event and append any resulting changes to
+  // `batch`. The caller holds the maps lock for the whole buffer. Returns true
+  // if the root directory was removed and the watch needs to be cancelled.
   bool process_inotify_event(
       const std::shared_ptr<Root>& root,
-      PendingChanges& coll,
+      struct maps& lockedMaps,
+      std::vector<PendingChange>& batch,
       struct inotify_event* ine,
       std::chrono::system_clock::time_point now);
 
+  // Queues recursive crawls of the directories that changed recently, in
+  // place of a whole-root recrawl after IN_Q_OVERFLOW. Returns false if
+  // there is no usable set of directories.
+  bool scheduleRecentRecrawl(
+      const std::shared_ptr<Root>& root,
+      struct maps& lockedMaps,
+      std::vector<PendingChange>& batch,
+      std::chrono::system_clock::time_point now);
+
   void stopThreads() override;
 
   json_ref getDebugInfo() override;
@@ -180,7 +216,10 @@ struct InotifyWatcher : public Watcher {
 };
 
 InotifyWatcher::InotifyWatcher(const Configuration& config)
-    : Watcher("inotify", WATCHER_HAS_PER_FILE_NOTIFICATIONS) {
+    : Watcher("inotify", WATCHER_HAS_PER_FILE_NOTIFICATIONS),
+      recrawlScope_{parseRecrawlScope(config)},
+      recrawlWindow_(config.getInt("recrawl_scope_window_ms", 5000)),
+      recrawlMaxDirs_(config.getInt("recrawl_scope_max_dirs", 1024)) {
 #ifdef HAVE_INOTIFY_INIT1
   infd = FileDescriptor(
       inotify_init1(IN_CLOEXEC), FileDescriptor::FDType::Generic);
@@ -224,7 +263,7 @@ std::unique_ptr<DirHandle> InotifyWatcher::startWatchDir(
   // record mapping
   {
     auto wlock = maps.wlock();
-    wlock->wd_to_name[newwd] = dir_name;
+    wlock->wd_to_name.insert(newwd, dir_name);
   }
   logf(DBG, "adding {} -> {} mapping\n", newwd, path);
 
@@ -233,7 +272,8 @@ std::unique_ptr<DirHandle> InotifyWatcher::startWatchDir(
 
 bool InotifyWatcher::process_inotify_event(
     const std::shared_ptr<Root>& root,
-    PendingChanges& coll,
+    struct maps& lockedMaps,
+    std::vector<PendingChange>& batch,
     struct inotify_event* ine,
     std::chrono::system_clock::time_point now) {
   char flags_label[128];
@@ -253,20 +293,18 @@ bool InotifyWatcher::process_inotify_event(
 
   if (ine->wd == -1 && (ine->mask & IN_Q_OVERFLOW)) {
     /* we missed something, will need to re-crawl */
-    root->scheduleRecrawl("IN_Q_OVERFLOW");
+    if (recrawlScope_ != RecrawlScope::Recent ||
+        !scheduleRecentRecrawl(root, lockedMaps, batch, now)) {
+      root->scheduleRecrawl("IN_Q_OVERFLOW");
+    }
   } else if (ine->wd != -1) {
+    if (recrawlScope_ == RecrawlScope::Recent) {
+      lockedMaps.recent_wds[ine->wd] = now;
+    }
     w_string name;
     char buf[WATCHMAN_NAME_MAX];
     PendingFlags pending_flags = W_PENDING_VIA_NOTIFY;
-    std::optional<w_string> dir_name;
-
-    {
-      auto rlock = maps.rlock();
-      auto it = rlock->wd_to_name.find(ine->wd);
-      if (it != rlock->wd_to_name.end()) {
-        dir_name = it->second;
-      }
-    }
+    std::optional<w_string> dir_name = lockedMaps.wd_to_name.path(ine->wd);
 
     if (dir_name) {
       if (ine->len > 0) {
@@ -289,19 +327,15 @@ bool InotifyWatcher::process_inotify_event(
             (IN_MOVED_FROM | IN_ISDIR)) {
       // record this as a pending move, so that we can automatically
       // watch the target when we get the other side of it.
-      {
-        auto wlock = maps.wlock();
-        wlock->move_map.emplace(ine->cookie, pending_move(now, name));
-      }
+      lockedMaps.move_map.emplace(ine->cookie, pending_move(now, name));
 
       log(DBG, "recording move_from ", ine->cookie, " ", name, "\n");
     }
 
     if (ine->len > 0 &&
         (ine->mask & (IN_MOVED_TO | IN_ISDIR)) == (IN_MOVED_FROM | IN_ISDIR)) {
-      auto wlock = maps.wlock();
-      auto it = wlock->move_map.find(ine->cookie);
-      if (it != wlock->move_map.end()) {
+      auto it = lockedMaps.move_map.find(ine->cookie);
+      if (it != lockedMaps.move_map.end()) {
         auto& old = it->second;
         int wd =
             inotify_add_watch(infd.fd(), name.c_str(), WATCHMAN_INOTIFY_MASK);
@@ -325,7 +359,7 @@ bool InotifyWatcher::process_inotify_event(
         } else {
           logf(DBG, "moved {} -> {}\n", old.name.c_str(), name.c_str());
           // TODO: assert that there is no entry in wd_to_name
-          wlock->wd_to_name[wd] = name;
+          lockedMaps.wd_to_name.insert(wd, name);
         }
       } else {
         logf(
@@ -362,13 +396,14 @@ bool InotifyWatcher::process_inotify_event(
           "add_pending for inotify mask={:x} {}\n",
           ine->mask,
           name.c_str());
-      coll.add(name, now, pending_flags);
+      batch.push_back(PendingChange{name, now, pending_flags});
 
       if (ine->mask & (IN_CREATE | IN_DELETE)) {
         // When a directory's child is created or unlinked, inotify does not
         // tell us its parent has also changed. It should be rescanned, so
         // synthesize an event for the IO thread here.
-        coll.add(name.dirName(), now, W_PENDING_VIA_NOTIFY);
+        batch.push_back(
+            PendingChange{name.dirName(), now, W_PENDING_VIA_NOTIFY});
       }
 
       // The kernel removed the wd -> name mapping, so let's update
@@ -380,8 +415,7 @@ bool InotifyWatcher::process_inotify_event(
             ine->mask,
             ine->wd,
             dir_name.value());
-        auto wlock = maps.wlock();
-        wlock->wd_to_name.erase(ine->wd);
+        lockedMaps.wd_to_name.erase(ine->wd);
       }
 
     } else if ((ine->mask & (IN_MOVE_SELF | IN_IGNORED)) == 0) {
@@ -400,13 +434,70 @@ bool InotifyWatcher::process_inotify_event(
   return false;
 }
 
+bool InotifyWatcher::scheduleRecentRecrawl(
+    const std::shared_ptr<Root>& root,
+    struct maps& lockedMaps,
+    std::vector<PendingChange>& batch,
+    std::chrono::system_clock::time_point now) {
+  std::vector<w_string> dirs;
+  for (auto& [wd, when] : lockedMaps.recent_wds) {
+    if (now - when > recrawlWindow_) {
+      continue;
+    }
+    auto dir = lockedMaps.wd_to_name.path(wd);
+    if (!dir) {
+      continue;
+    }
+    if (*dir == root->root_path || dirs.size() >= recrawlMaxDirs_) {
+      // Nothing to be gained over recrawling the root
+      return false;
+    }
+    dirs.push_back(std::move(*dir));
+  }
+  if (dirs.empty()) {
+    return false;
+  }
+
+  auto reason = fmt::format(
+      "IN_Q_OVERFLOW: recrawling {} recently changed directories",
+      dirs.size());
+  root->recrawlTriggered(reason.c_str());
+  for (auto& dir : dirs) {
+    batch.push_back(PendingChange{
+        std::move(dir), now, W_PENDING_RECURSIVE | W_PENDING_IS_DESYNCED});
+  }
+  return true;
+}
+
 Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
     const std::shared_ptr<Root>& root,
     PendingChanges& coll) {
+  auto barriers = syncBarriers_.take();
+
+  // We may have been woken for a barrier alone, and infd blocks, so only
+  // read when there is something to read. A barrier has to wait for all of
+  // the events queued before it was requested, so drain the queue for one.
+  bool cancel = false;
+  while (!cancel && isReadableNow(infd.fd())) {
+    cancel = readEvents(root, coll);
+    if (barriers.empty()) {
+      break;
+    }
+  }
+
+  for (auto& barrier : barriers) {
+    coll.addSync(std::move(barrier));
+  }
+  return {cancel};
+}
+
+bool InotifyWatcher::readEvents(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
   int n = read(infd.fd(), &ibuf, sizeof(ibuf));
   if (n == -1) {
     if (errno == EINTR) {
-      return {false};
+      return false;
     }
     logf(
         FATAL,
@@ -422,13 +513,21 @@ Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
   struct inotify_event* ine;
   bool cancel = false;
   size_t eventsSeen = 0;
-  for (char* iptr = ibuf; iptr < ibuf + n; iptr += sizeof(*ine) + ine->len) {
-    ine = (struct inotify_event*)iptr;
+  {
+    // Resolve the whole buffer under a single acquisition of the maps lock
+    // rather than locking once or twice per event; a large checkout fills
+    // ibuf on every read.
+    auto wlock = maps.wlock();
+    for (char* iptr = ibuf; iptr < ibuf + n; iptr += sizeof(*ine) + ine->len) {
+      ine = (struct inotify_event*)iptr;
 
-    cancel |= process_inotify_event(root, coll, ine, now);
-    ++eventsSeen;
+      cancel |= process_inotify_event(root, *wlock, batch_, ine, now);
+      ++eventsSeen;
+    }
   }
 
+  coll.addBatch(batch_);
+
   // Relaxed because we don't really care exactly when the value is visible.
   totalEventsSeen_.fetch_add(eventsSeen, std::memory_order_relaxed);
 
@@ -456,17 +555,28 @@ Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
         ++it;
       }
     }
+
+    auto recent = wlock->recent_wds.begin();
+    while (recent != wlock->recent_wds.end()) {
+      if (now - recent->second > recrawlWindow_) {
+        recent = wlock->recent_wds.erase(recent);
+      } else {
+        ++recent;
+      }
+    }
   }
 
-  return {cancel};
+  return cancel;
 }
 
 bool InotifyWatcher::waitNotify(int timeoutms) {
-  struct pollfd pfd[2];
+  struct pollfd pfd[3];
   pfd[0].fd = infd.fd();
   pfd[0].events = POLLIN;
   pfd[1].fd = terminatePipe_.read.fd();
   pfd[1].events = POLLIN;
+  pfd[2].fd = syncBarriers_.wakeFd();
+  pfd[2].events = POLLIN;
 
   int n = poll(pfd, std::size(pfd), timeoutms);
 
@@ -475,7 +585,7 @@ bool InotifyWatcher::waitNotify(int timeoutms) {
       // We were signalled via signalThreads
       return false;
     }
-    return pfd[0].revents != 0;
+    return pfd[0].revents != 0 || pfd[2].revents != 0;
   }
   return false;
 }
@@ -493,9 +603,18 @@ json_ref InotifyWatcher::getDebugInfo() {
     }
     events = json_array(std::move(arr));
   }
+  size_t numWatches;
+  size_t numDirNames;
+  {
+    auto rlock = maps.rlock();
+    numWatches = rlock->wd_to_name.size();
+    numDirNames = rlock->wd_to_name.numNames();
+  }
   return json_object({
       {"events", events},
       {"total_event_count", json_integer(totalEventsSeen_.load())},
+      {"watch_count", json_integer(numWatches)},
+      {"distinct_dir_names", json_integer(numDirNames)},
   });
 }
 
@@ -520,7 +639,7 @@ std::shared_ptr<QueryableView> detectInotify(
     throw std::runtime_error("cannot watch EdenFS file systems with inotify");
   }
   return std::make_shared<InMemoryView>(
-      realFileSystem,
+      WatcherRegistry::fileSystemFor(fstype, config),
       root_path,
       config,
       std::make_shared<InotifyWatcher>(config));
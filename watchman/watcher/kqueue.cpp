@@ -63,7 +63,8 @@ KQueueWatcher::KQueueWatcher(
     bool recursive)
     : Watcher("kqueue", 0),
       maps_(maps(config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS))),
-      recursive_(recursive) {
+      recursive_(recursive),
+      watchFiles_(!recursive || config.getBool("kqueue_watch_files", true)) {
   kq_fd = FileDescriptor(kqueue(), "kqueue", FileDescriptor::FDType::Generic);
   kq_fd.setCloExec();
 }
@@ -71,6 +72,11 @@ KQueueWatcher::KQueueWatcher(
 bool KQueueWatcher::startWatchFile(struct watchman_file* file) {
   struct kevent k;
 
+  if (!watchFiles_) {
+    // The parent directory's watch covers it
+    return true;
+  }
+
   auto full_name = file->parent->getFullPathToChild(file->getName());
   {
     auto rlock = maps_.rlock();
@@ -295,6 +301,10 @@ Watcher::ConsumeNotifyRet KQueueWatcher::consumeNotify(
       // TODO(xavierd): I believe we need this in case a file is replaced by a
       // directory.
       flags |= W_PENDING_RECURSIVE;
+    } else if (!watchFiles_) {
+      // Nothing watches the children individually, so look at each of them
+      // to find out which one changed.
+      flags |= W_PENDING_NONRECURSIVE_SCAN;
     } else {
       // You might be tempted to use W_PENDING_NONRECURSIVE_SCAN here, but this
       // would lead to scanning the changed directories too, which when used in
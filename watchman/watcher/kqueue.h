@@ -32,6 +32,9 @@ struct KQueueWatcher : public Watcher {
   };
   folly::Synchronized<maps> maps_;
   bool recursive_;
+  // When false (kqueue_watch_files), a recursive watch holds descriptors for
+  // directories only, and rescans a directory when it reports a change.
+  const bool watchFiles_;
 
   struct kevent keventbuf[WATCHMAN_BATCH_LIMIT];
 
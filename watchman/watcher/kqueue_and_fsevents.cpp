@@ -294,11 +294,11 @@ void KQueueAndFSEventsWatcher::injectRecrawl(w_string path) {
 namespace {
 std::shared_ptr<InMemoryView> makeKQueueAndFSEventsWatcher(
     const w_string& root_path,
-    const w_string& /*fstype*/,
+    const w_string& fstype,
     const Configuration& config) {
   if (config.getBool("prefer_split_fsevents_watcher", false)) {
     return std::make_shared<InMemoryView>(
-        realFileSystem,
+        WatcherRegistry::fileSystemFor(fstype, config),
         root_path,
         config,
         std::make_shared<KQueueAndFSEventsWatcher>(root_path, config));
@@ -0,0 +1,484 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Synchronized.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "eden/common/utils/FSDetect.h"
+#include "watchman/Errors.h"
+#include "watchman/InMemoryView.h"
+#include "watchman/Logging.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/fs/FileSystem.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/PollSchedule.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watcher/WatcherRegistry.h"
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+
+namespace watchman {
+
+namespace {
+
+using SteadyClock = std::chrono::steady_clock;
+
+// A change made to a dir this soon after it was statted may not move its
+// timestamps on filesystems with a coarse timestamp resolution
+constexpr std::chrono::seconds kStampResolution{2};
+
+// A slice ends after this long even if it has stats left to spend, so that
+// cookies keep being looked for while a large tree is polled
+constexpr std::chrono::milliseconds kMaxSliceDuration{100};
+
+int64_t toNanoseconds(const struct timespec& ts) {
+  return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Returns the stamp of a dir with stat st, taken no later than `now`.  There
+ * is none if the dir could still change without moving its timestamps, in
+ * which case it is treated as changed when it is next polled.
+ */
+std::optional<DirCrawlStamp> pollStamp(
+    const FileInformation& st,
+    std::chrono::system_clock::time_point now) {
+  auto limit = std::chrono::system_clock::to_time_t(now - kStampResolution);
+  if (st.mtime.tv_sec >= limit || st.ctime.tv_sec >= limit) {
+    return std::nullopt;
+  }
+  return DirCrawlStamp{toNanoseconds(st.mtime), toNanoseconds(st.ctime)};
+}
+
+/**
+ * Returns a hash of the fields of st that InMemoryView::statPath compares to
+ * decide whether a file changed.
+ */
+uint64_t fileSignature(const FileInformation& st) {
+  uint64_t hash = 14695981039346656037ULL;
+  auto mix = [&](uint64_t value) {
+    hash = (hash ^ value) * 1099511628211ULL;
+    hash ^= hash >> 29;
+  };
+  mix(uint64_t(st.mode));
+  mix(st.size);
+  mix(uint64_t(st.nlink));
+  mix(uint64_t(st.ino));
+  mix(uint64_t(st.dev));
+  mix(uint64_t(st.uid));
+  mix(uint64_t(st.gid));
+  mix(uint64_t(toNanoseconds(st.mtime)));
+  mix(uint64_t(toNanoseconds(st.ctime)));
+  return hash;
+}
+
+bool isGone(const std::error_code& code) {
+  return code == error_code::no_such_file_or_directory ||
+      code == error_code::not_a_directory;
+}
+
+} // namespace
+
+/**
+ * Finds changes by statting what the crawler found, for filesystems that
+ * can't tell us about them, such as network and FUSE mounts.
+ *
+ * Each dir is polled on its own schedule (see PollSchedule): its timestamps
+ * tell us whether entries were added or removed, in which case it is crawled
+ * again, and its files are statted to tell whether they changed.  Dirs are
+ * polled in time slices on the notify thread, limited to a number of stats
+ * per second and to a fraction of the time.  Outstanding sync cookies are
+ * looked for separately, so that a sync doesn't wait for the next poll of
+ * the dir that holds them.
+ */
+class PollWatcher : public Watcher {
+ public:
+  PollWatcher(const w_string& rootPath, const Configuration& config);
+
+  std::unique_ptr<DirHandle> startWatchDir(
+      const std::shared_ptr<Root>& root,
+      const char* path) override;
+
+  bool startWatchFile(watchman_file* file) override;
+
+  bool waitNotify(int timeoutms) override;
+  ConsumeNotifyRet consumeNotify(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll) override;
+  void stopThreads() override;
+
+  json_ref getDebugInfo() override;
+  void clearDebugInfo() override;
+
+ private:
+  enum class PollResult { Unchanged, Changed, Gone };
+
+  struct PolledDir {
+    // When this is unset, the dir is crawled when it is next polled
+    std::optional<DirCrawlStamp> stamp;
+    // The signatures of the files in this dir, keyed by name.  Child dirs
+    // are polled on their own.
+    std::unordered_map<w_string, uint64_t> files;
+  };
+
+  struct State {
+    std::unordered_map<w_string, PolledDir> dirs;
+    PollSchedule schedule;
+  };
+
+  // Polls the dir at path, adding what changed to coll.
+  PollResult pollDir(
+      const std::shared_ptr<Root>& root,
+      const w_string& path,
+      PendingChanges& coll);
+
+  void checkCookies(const std::shared_ptr<Root>& root, PendingChanges& coll);
+
+  // Returns when consumeNotify next has something to do
+  SteadyClock::time_point nextWake();
+
+  const w_string rootPath_;
+  const std::chrono::milliseconds cookieInterval_;
+  const double maxStatsPerSecond_;
+  const double maxBusyFraction_;
+
+  folly::Synchronized<State, std::mutex> state_;
+
+  std::mutex wakeMutex_;
+  std::condition_variable wakeCond_;
+  bool stopping_{false};
+
+  // The rest is only used on the notify thread
+
+  // Stats that may be issued before the budget runs out; negative when a
+  // large dir overdrew it
+  double statTokens_;
+  SteadyClock::time_point lastRefill_;
+  // The next slice may not start before this, to keep to maxBusyFraction_
+  SteadyClock::time_point nextSlice_;
+  SteadyClock::time_point nextCookieCheck_;
+  // Cookies already found, which the IO thread has yet to see
+  std::unordered_set<w_string> foundCookies_;
+
+  std::atomic<uint64_t> statCount_{0};
+  std::atomic<uint64_t> changeCount_{0};
+  std::atomic<uint64_t> sliceCount_{0};
+};
+
+PollWatcher::PollWatcher(const w_string& rootPath, const Configuration& config)
+    : Watcher("poll", WATCHER_HAS_FILE_INFORMATION),
+      rootPath_(rootPath),
+      cookieInterval_(config.getInt("poll_cookie_interval_ms", 100)),
+      maxStatsPerSecond_(std::max<int64_t>(
+          1,
+          config.getInt("poll_max_stats_per_second", 10000))),
+      maxBusyFraction_(
+          std::clamp<int64_t>(
+              config.getInt("poll_max_cpu_percent", 10), 1, 100) /
+          100.0),
+      state_(State{
+          {},
+          PollSchedule{
+              std::chrono::milliseconds(
+                  config.getInt("poll_hot_interval_ms", 1000)),
+              std::chrono::milliseconds(
+                  config.getInt("poll_cold_interval_ms", 30000))}}),
+      statTokens_(maxStatsPerSecond_),
+      lastRefill_(SteadyClock::now()) {}
+
+std::unique_ptr<DirHandle> PollWatcher::startWatchDir(
+    const std::shared_ptr<Root>& root,
+    const char* path) {
+  // Stamp the dir before the crawler reads it, so that anything added after
+  // that moves its timestamps past the stamp
+  auto stamp = pollStamp(
+      getFileInformation(path, root->case_sensitive),
+      std::chrono::system_clock::now());
+  auto osdir = openDir(path);
+
+  w_string dirPath{path, W_STRING_BYTE};
+  auto state = state_.lock();
+  state->dirs[dirPath].stamp = stamp;
+  state->schedule.insert(dirPath, SteadyClock::now());
+  return osdir;
+}
+
+bool PollWatcher::startWatchFile(watchman_file* file) {
+  if (file->stat.isDir()) {
+    return true;
+  }
+  auto signature = fileSignature(file->stat.decode());
+  auto dirPath = file->parent->getFullPath();
+
+  auto state = state_.lock();
+  auto it = state->dirs.find(dirPath);
+  if (it != state->dirs.end()) {
+    it->second.files.insert_or_assign(file->getName().asWString(), signature);
+  }
+  return true;
+}
+
+SteadyClock::time_point PollWatcher::nextWake() {
+  auto nextDue = state_.lock()->schedule.nextDue();
+  if (!nextDue) {
+    return nextCookieCheck_;
+  }
+  return std::min(nextCookieCheck_, std::max(*nextDue, nextSlice_));
+}
+
+bool PollWatcher::waitNotify(int timeoutms) {
+  auto wake = nextWake();
+  std::unique_lock<std::mutex> lock(wakeMutex_);
+  wakeCond_.wait_until(
+      lock,
+      std::min(wake, SteadyClock::now() + std::chrono::milliseconds(timeoutms)),
+      [&] { return stopping_; });
+  return !stopping_ && SteadyClock::now() >= wake;
+}
+
+void PollWatcher::stopThreads() {
+  {
+    std::lock_guard<std::mutex> lock(wakeMutex_);
+    stopping_ = true;
+  }
+  wakeCond_.notify_all();
+}
+
+void PollWatcher::checkCookies(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  auto cookies = root->cookies.getOutstandingCookieFileList();
+  std::unordered_set<w_string> stillFound;
+  auto now = std::chrono::system_clock::now();
+  uint64_t stats = 0;
+  for (auto& cookie : cookies) {
+    if (foundCookies_.count(cookie)) {
+      stillFound.insert(cookie);
+      continue;
+    }
+    ++stats;
+    try {
+      getFileInformation(cookie.c_str(), root->case_sensitive);
+    } catch (const std::system_error&) {
+      continue;
+    }
+    coll.add(cookie, now, W_PENDING_VIA_NOTIFY);
+    stillFound.insert(cookie);
+  }
+  statCount_.fetch_add(stats, std::memory_order_relaxed);
+  foundCookies_ = std::move(stillFound);
+}
+
+PollWatcher::PollResult PollWatcher::pollDir(
+    const std::shared_ptr<Root>& root,
+    const w_string& path,
+    PendingChanges& coll) {
+  std::optional<DirCrawlStamp> oldStamp;
+  std::vector<std::pair<w_string, uint64_t>> files;
+  {
+    auto state = state_.lock();
+    auto it = state->dirs.find(path);
+    if (it == state->dirs.end()) {
+      return PollResult::Gone;
+    }
+    oldStamp = it->second.stamp;
+    files.assign(it->second.files.begin(), it->second.files.end());
+  }
+
+  auto now = std::chrono::system_clock::now();
+  std::optional<DirCrawlStamp> stamp;
+  try {
+    stamp = pollStamp(
+        getFileInformation(path.c_str(), root->case_sensitive), now);
+  } catch (const std::system_error& err) {
+    if (!isGone(err.code())) {
+      logf(DBG, "poll: getFileInformation({}) threw {}\n", path, err.what());
+      return PollResult::Unchanged;
+    }
+    coll.add(path, now, W_PENDING_VIA_NOTIFY);
+    changeCount_.fetch_add(1, std::memory_order_relaxed);
+    return PollResult::Gone;
+  }
+  size_t stats = 1;
+  size_t changes = 0;
+
+  if (!oldStamp || !(stamp == oldStamp)) {
+    // Entries may have been added or removed.  If only the stamp was too
+    // recent to trust, look for them without reporting the dir as changed.
+    coll.add(
+        path,
+        now,
+        oldStamp ? W_PENDING_VIA_NOTIFY : W_PENDING_CRAWL_ONLY);
+    ++changes;
+  }
+
+  std::vector<std::pair<w_string, uint64_t>> updated;
+  std::vector<w_string> removed;
+  if (!files.empty()) {
+    std::unique_ptr<DirHandle> osdir;
+    try {
+      osdir = openDir(path.c_str());
+    } catch (const std::system_error& err) {
+      logf(DBG, "poll: openDir({}) threw {}\n", path, err.what());
+    }
+    for (auto& [name, signature] : files) {
+      auto fullPath = w_string::pathCat({path, name});
+      FileInformation st;
+      ++stats;
+      try {
+        if (!osdir || !osdir->statNamedEntry(name.c_str(), st)) {
+          st = getFileInformation(fullPath.c_str(), root->case_sensitive);
+        }
+      } catch (const std::system_error& err) {
+        if (isGone(err.code())) {
+          coll.add(fullPath, now, W_PENDING_VIA_NOTIFY);
+          removed.push_back(name);
+          ++changes;
+        }
+        continue;
+      }
+      auto newSignature = fileSignature(st);
+      if (newSignature != signature) {
+        coll.add(
+            fullPath,
+            now,
+            W_PENDING_VIA_NOTIFY,
+            std::make_shared<FileInformation>(st));
+        updated.emplace_back(name, newSignature);
+        ++changes;
+      }
+    }
+  }
+
+  statTokens_ -= stats;
+  statCount_.fetch_add(stats, std::memory_order_relaxed);
+  changeCount_.fetch_add(changes, std::memory_order_relaxed);
+
+  auto state = state_.lock();
+  auto it = state->dirs.find(path);
+  if (it != state->dirs.end()) {
+    it->second.stamp = stamp;
+    for (auto& [name, signature] : updated) {
+      it->second.files.insert_or_assign(name, signature);
+    }
+    for (auto& name : removed) {
+      it->second.files.erase(name);
+    }
+  }
+  return changes ? PollResult::Changed : PollResult::Unchanged;
+}
+
+Watcher::ConsumeNotifyRet PollWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  auto sliceStart = SteadyClock::now();
+
+  if (sliceStart >= nextCookieCheck_) {
+    checkCookies(root, coll);
+    nextCookieCheck_ = sliceStart + cookieInterval_;
+  }
+
+  std::chrono::duration<double> sinceRefill = sliceStart - lastRefill_;
+  statTokens_ = std::min(
+      maxStatsPerSecond_,
+      statTokens_ + sinceRefill.count() * maxStatsPerSecond_);
+  lastRefill_ = sliceStart;
+
+  if (sliceStart < nextSlice_) {
+    return {false};
+  }
+
+  while (statTokens_ >= 1 &&
+         SteadyClock::now() - sliceStart < kMaxSliceDuration) {
+    auto path = state_.lock()->schedule.popDue(sliceStart);
+    if (!path) {
+      break;
+    }
+    auto result = pollDir(root, *path, coll);
+    auto state = state_.lock();
+    if (result == PollResult::Gone) {
+      if (*path == rootPath_) {
+        return {true};
+      }
+      state->dirs.erase(*path);
+      state->schedule.erase(*path);
+    } else {
+      state->schedule.reschedule(
+          *path, result == PollResult::Changed, SteadyClock::now());
+    }
+  }
+  sliceCount_.fetch_add(1, std::memory_order_relaxed);
+
+  auto sliceEnd = SteadyClock::now();
+  // Stay idle long enough that polling takes at most maxBusyFraction_ of the
+  // time, and until the stat budget has recovered
+  nextSlice_ = sliceEnd +
+      std::chrono::duration_cast<SteadyClock::duration>(
+          (sliceEnd - sliceStart) * (1 / maxBusyFraction_ - 1));
+  if (statTokens_ < 1) {
+    nextSlice_ = std::max(
+        nextSlice_,
+        sliceEnd +
+            std::chrono::duration_cast<SteadyClock::duration>(
+                std::chrono::duration<double>(
+                    (1 - statTokens_) / maxStatsPerSecond_)));
+  }
+  return {false};
+}
+
+json_ref PollWatcher::getDebugInfo() {
+  auto state = state_.lock();
+  return json_object({
+      {"dir_count", json_integer(state->schedule.size())},
+      {"hot_dir_count", json_integer(state->schedule.numHot())},
+      {"stat_count", json_integer(statCount_.load())},
+      {"change_count", json_integer(changeCount_.load())},
+      {"slice_count", json_integer(sliceCount_.load())},
+  });
+}
+
+void PollWatcher::clearDebugInfo() {
+  statCount_.store(0, std::memory_order_release);
+  changeCount_.store(0, std::memory_order_release);
+  sliceCount_.store(0, std::memory_order_release);
+}
+
+namespace {
+std::shared_ptr<QueryableView> detectPoll(
+    const w_string& root_path,
+    const w_string& fstype,
+    const Configuration& config) {
+  if (facebook::eden::is_edenfs_fs_type(fstype.string())) {
+    throw std::runtime_error("cannot watch EdenFS file systems by polling");
+  }
+  if (config.getString("watcher", "auto") != "poll") {
+    // Polling is far more expensive than being told about changes, so it is
+    // never picked in place of a watcher that failed
+    throw std::runtime_error("only used when \"watcher\" is set to \"poll\"");
+  }
+  return std::make_shared<InMemoryView>(
+      WatcherRegistry::fileSystemFor(fstype, config),
+      root_path,
+      config,
+      std::make_shared<PollWatcher>(root_path, config));
+}
+} // namespace
+
+// Only used when it is asked for; see detectPoll
+static WatcherRegistry reg("poll", detectPoll, -1);
+
+} // namespace watchman
+
+/* vim:ts=2:sw=2:et:
+ */
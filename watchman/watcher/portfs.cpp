@@ -11,6 +11,7 @@
 #include <folly/String.h>
 #include <folly/Synchronized.h>
 #include <memory>
+#include <vector>
 #include "watchman/InMemoryView.h"
 
 #ifdef HAVE_PORT_CREATE
@@ -21,6 +22,9 @@ struct watchman_port_file {
   file_obj_t port_file;
   w_string name;
   bool is_dir;
+  // An event dissociates the file_obj; it stays in port_files so that the
+  // next do_watch can re-arm it without allocating it again.
+  bool associated;
 };
 
 using watchman::FileDescriptor;
@@ -39,7 +43,9 @@ struct PortFSWatcher : public Watcher {
   std::unique_ptr<watchman_port_file> root_delete_w_port_file;
   bool root_deleted;
 
-  port_event_t portevents[WATCHMAN_BATCH_LIMIT];
+  // Sized by portfs_batch_size; consumeNotify drains the port in chunks of
+  // this many events.
+  std::vector<port_event_t> portevents;
 
   explicit PortFSWatcher(watchman_root* root);
 
@@ -75,17 +81,24 @@ static const struct flag_map pflags[] = {
     {0, nullptr},
 };
 
+static void set_port_file_times(
+    watchman_port_file* f,
+    const watchman::FileInformation& finfo) {
+  f->port_file.fo_atime = finfo.atime;
+  f->port_file.fo_mtime = finfo.mtime;
+  f->port_file.fo_ctime = finfo.ctime;
+  f->is_dir = finfo.isDir();
+}
+
 static std::unique_ptr<watchman_port_file> make_port_file(
     const w_string& name,
     const watchman::FileInformation& finfo) {
   auto f = std::make_unique<watchman_port_file>();
 
   f->name = name;
-  f->port_file.fo_name = (char*)name.c_str();
-  f->port_file.fo_atime = finfo.atime;
-  f->port_file.fo_mtime = finfo.mtime;
-  f->port_file.fo_ctime = finfo.ctime;
-  f->is_dir = finfo.isDir();
+  f->port_file.fo_name = (char*)f->name.c_str();
+  f->associated = false;
+  set_port_file_times(f.get(), finfo);
 
   return f;
 }
@@ -95,6 +108,8 @@ PortFSWatcher::PortFSWatcher(watchman_root* root)
       port_fd(port_create(), "port_create()"),
       port_delete_fd(port_create(), "port_create()"),
       root_deleted(false) {
+  portevents.resize(std::max<json_int_t>(
+      1, root->config.getInt("portfs_batch_size", WATCHMAN_BATCH_LIMIT)));
   auto wlock = port_files.wlock();
   wlock->reserve(root->config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS));
   port_fd.setCloExec();
@@ -106,15 +121,22 @@ bool PortFSWatcher::do_watch(
     const watchman::FileInformation& finfo,
     bool throw_on_error) {
   auto wlock = port_files.wlock();
-  if (wlock->find(name) != wlock->end()) {
-    // Already watching it
-    return true;
+  watchman_port_file* rawFile;
+  auto it = wlock->find(name);
+  if (it != wlock->end()) {
+    if (it->second->associated) {
+      // Already watching it
+      return true;
+    }
+    // Re-arm after an event, reusing the file_obj
+    rawFile = it->second.get();
+    set_port_file_times(rawFile, finfo);
+  } else {
+    auto f = make_port_file(name, finfo);
+    rawFile = f.get();
+    wlock->emplace(name, std::move(f));
   }
 
-  auto f = make_port_file(name, finfo);
-  auto rawFile = f.get();
-  wlock->emplace(name, std::move(f));
-
   logf(DBG, "watching {}\n", name);
   errno = 0;
   if (port_associate(
@@ -135,6 +157,7 @@ bool PortFSWatcher::do_watch(
     }
     return false;
   }
+  rawFile->associated = true;
 
   return true;
 }
@@ -179,7 +202,7 @@ bool PortFSWatcher::startWatchFile(struct watchman_file* file) {
     return false;
   }
 
-  return do_watch(name, file->stat, false);
+  return do_watch(name, file->stat.decode(), false);
 }
 
 std::unique_ptr<DirHandle> PortFSWatcher::startWatchDir(
@@ -219,60 +242,80 @@ Watcher::ConsumeNotifyRet PortFSWatcher::consumeNotify(
     return {false, true};
   }
 
-  errno = 0;
+  gettimeofday(&now, nullptr);
 
-  n = 1;
-  if (port_getn(
-          port_fd.fd(),
-          portevents,
-          sizeof(portevents) / sizeof(portevents[0]),
-          &n,
-          nullptr)) {
-    if (errno == EINTR) {
-      return {false, false};
+  // Take everything that is queued, a buffer at a time, so that a burst of
+  // events is handled in one pass rather than one wakeup per buffer. Only
+  // the first call blocks.
+  bool first = true;
+  bool any = false;
+  while (true) {
+    struct timespec zero = {0, 0};
+    errno = 0;
+    n = 1;
+    // On ETIME, n still holds the number of events that were retrieved
+    bool timedOut = false;
+    if (port_getn(
+            port_fd.fd(),
+            portevents.data(),
+            portevents.size(),
+            &n,
+            first ? nullptr : &zero)) {
+      if (errno == EINTR) {
+        break;
+      }
+      if (errno != ETIME) {
+        logf(FATAL, "port_getn: {}\n", folly::errnoStr(errno));
+      }
+      timedOut = true;
+    }
+    first = false;
+
+    logf(DBG, "port_getn: n={}\n", n);
+
+    auto wlock = port_files.wlock();
+
+    for (i = 0; i < n; i++) {
+      struct watchman_port_file* f;
+      uint32_t pe = portevents[i].portev_events;
+      char flags_label[128];
+
+      f = (struct watchman_port_file*)portevents[i].portev_user;
+      w_expand_flags(pflags, pe, flags_label, sizeof(flags_label));
+      logf(DBG, "port: {} [{:x} {}]\n", f->port_file.fo_name, pe, flags_label);
+
+      if ((pe & (FILE_RENAME_FROM | UNMOUNTED | MOUNTEDOVER | FILE_DELETE)) &&
+          (f->name == root->root_path)) {
+        logf(
+            ERR,
+            "root dir {} has been (re)moved (code {:x} {}), canceling watch\n",
+            root->root_path,
+            pe,
+            flags_label);
+        return {false, true};
+      }
+      coll->add(
+          f->name,
+          now,
+          (f->is_dir ? W_PENDING_RECURSIVE : 0) | W_PENDING_VIA_NOTIFY);
+      any = true;
+
+      // It was port_dissociate'd implicitly.  We'll re-establish a
+      // watch later when portfs_root_start_watch_(file|dir) are called again
+      if (pe & (FILE_RENAME_FROM | FILE_DELETE)) {
+        // Gone for good; don't keep its file_obj around for reuse
+        wlock->erase(f->name);
+      } else {
+        f->associated = false;
+      }
     }
-    logf(FATAL, "port_getn: {}\n", folly::errnoStr(errno));
-  }
-
-  logf(DBG, "port_getn: n={}\n", n);
-
-  if (n == 0) {
-    return {false, false};
-  }
-
-  auto wlock = port_files.wlock();
 
-  gettimeofday(&now, nullptr);
-  for (i = 0; i < n; i++) {
-    struct watchman_port_file* f;
-    uint32_t pe = portevents[i].portev_events;
-    char flags_label[128];
-
-    f = (struct watchman_port_file*)portevents[i].portev_user;
-    w_expand_flags(pflags, pe, flags_label, sizeof(flags_label));
-    logf(DBG, "port: {} [{:x} {}]\n", f->port_file.fo_name, pe, flags_label);
-
-    if ((pe & (FILE_RENAME_FROM | UNMOUNTED | MOUNTEDOVER | FILE_DELETE)) &&
-        (f->name == root->root_path)) {
-      logf(
-          ERR,
-          "root dir {} has been (re)moved (code {:x} {}), canceling watch\n",
-          root->root_path,
-          pe,
-          flags_label);
-      return {false, true};
+    if (timedOut || n < portevents.size()) {
+      break;
     }
-    coll->add(
-        f->name,
-        now,
-        (f->is_dir ? W_PENDING_RECURSIVE : 0) | W_PENDING_VIA_NOTIFY);
-
-    // It was port_dissociate'd implicitly.  We'll re-establish a
-    // watch later when portfs_root_start_watch_(file|dir) are called again
-    wlock->erase(f->name);
   }
 
-  return {true, false};
+  return {any, false};
 }
 
 bool PortFSWatcher::waitNotify(int timeoutms) {
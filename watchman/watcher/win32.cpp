@@ -8,6 +8,7 @@
 #include <folly/Synchronized.h>
 #include "watchman/InMemoryView.h"
 #include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/WindowsTime.h"
 #include "watchman/portability/WinError.h"
 #include "watchman/root/Root.h"
 #include "watchman/watcher/Watcher.h"
@@ -17,8 +18,13 @@
 #include <condition_variable>
 #include <iterator>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 using namespace watchman;
 
@@ -27,21 +33,312 @@ using namespace watchman;
 namespace {
 
 constexpr DWORD kNetworkBufSize = 64 * 1024;
+constexpr json_int_t kDefaultQueueDepth = 4;
 
 struct Item {
   w_string path;
   PendingFlags flags;
+  std::shared_ptr<const FileInformation> stat;
 
-  Item(w_string&& path, PendingFlags flags)
-      : path(std::move(path)), flags(flags) {}
+  Item(
+      w_string&& path,
+      PendingFlags flags,
+      std::shared_ptr<const FileInformation> stat = nullptr)
+      : path(std::move(path)), flags(flags), stat(std::move(stat)) {}
 };
 
+// The same subset of the metadata that a directory listing provides
+std::shared_ptr<const FileInformation> fileInformationFromNotify(
+    const FILE_NOTIFY_EXTENDED_INFORMATION& notify) {
+  auto info = std::make_shared<FileInformation>(notify.FileAttributes);
+  FILETIME_LARGE_INTEGER_to_timespec(notify.CreationTime, &info->ctime);
+  FILETIME_LARGE_INTEGER_to_timespec(notify.LastAccessTime, &info->atime);
+  FILETIME_LARGE_INTEGER_to_timespec(
+      notify.LastModificationTime, &info->mtime);
+  info->size = notify.FileSize.QuadPart;
+  return info;
+}
+
+/**
+ * One overlapped read of directory changes and the buffer that it fills.
+ * Several of these are kept in flight so that the kernel has somewhere to put
+ * the events of a burst while the thread is busy with an earlier buffer.
+ * Reads on a handle complete in the order in which they were issued.
+ */
+struct PendingRead {
+  std::vector<uint8_t> buf;
+  OVERLAPPED olap = OVERLAPPED();
+  HANDLE event{INVALID_HANDLE_VALUE};
+  // Whether it was issued for FILE_NOTIFY_EXTENDED_INFORMATION records
+  bool extended{false};
+  // The next USN of the journal when the read was issued. Every change that
+  // the read after this one reports was recorded at or after it.
+  std::optional<USN> usnAtIssue;
+};
+
+using ReadDirectoryChangesExWFunc = BOOL(WINAPI*)(
+    HANDLE,
+    LPVOID,
+    DWORD,
+    BOOL,
+    DWORD,
+    LPDWORD,
+    LPOVERLAPPED,
+    LPOVERLAPPED_COMPLETION_ROUTINE,
+    READ_DIRECTORY_NOTIFY_INFORMATION_CLASS);
+
+// ReadDirectoryChangesExW is only available since Windows 10 1709
+ReadDirectoryChangesExWFunc getReadDirectoryChangesExW() {
+  static auto func = (ReadDirectoryChangesExWFunc)GetProcAddress(
+      GetModuleHandle("kernel32.dll"), "ReadDirectoryChangesExW");
+  return func;
+}
+
+/**
+ * Replays the NTFS change journal of the volume that holds the root, so that
+ * changes lost to an overflowed ReadDirectoryChangesW buffer can be caught up
+ * on without recrawling the whole tree.
+ */
+class UsnJournal {
+ public:
+  /**
+   * Returns nullptr if the journal is not available, for instance because the
+   * volume is not NTFS or because we lack the privileges to read it.
+   */
+  static std::unique_ptr<UsnJournal> open(const w_string& rootPath);
+
+  /**
+   * Returns the USN that the next change will be recorded at.
+   */
+  std::optional<USN> nextUsn();
+
+  /**
+   * Adds an item for each change beneath the root recorded since `from`.
+   * Returns false if that could not be done, for instance because the
+   * records from there have already been purged from the journal.
+   */
+  bool replay(const Root& root, USN from, std::list<Item>& items);
+
+ private:
+  UsnJournal(FileDescriptor volume, DWORDLONG journalId)
+      : volume_{std::move(volume)}, journalId_{journalId} {}
+
+  std::optional<USN_JOURNAL_DATA_V0> query();
+  std::optional<w_string> resolveDir(
+      DWORDLONG fileId,
+      std::unordered_map<DWORDLONG, std::optional<w_string>>& dirPaths);
+
+  FileDescriptor volume_;
+  DWORDLONG journalId_;
+};
+
+std::unique_ptr<UsnJournal> UsnJournal::open(const w_string& rootPath) {
+  auto wpath = rootPath.piece().asWideUNC();
+  WCHAR mountPoint[MAX_PATH];
+  WCHAR volumeName[MAX_PATH];
+  if (!GetVolumePathNameW(wpath.c_str(), mountPoint, MAX_PATH) ||
+      !GetVolumeNameForVolumeMountPointW(mountPoint, volumeName, MAX_PATH)) {
+    logf(
+        DBG,
+        "no USN journal for {}: failed to resolve its volume: {}\n",
+        rootPath,
+        win32_strerror(GetLastError()));
+    return nullptr;
+  }
+
+  // The volume is opened by its name without the trailing backslash
+  std::wstring volume{volumeName};
+  if (!volume.empty() && volume.back() == L'\\') {
+    volume.pop_back();
+  }
+
+  FileDescriptor handle(
+      intptr_t(CreateFileW(
+          volume.c_str(),
+          GENERIC_READ,
+          FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+          nullptr,
+          OPEN_EXISTING,
+          0,
+          nullptr)),
+      FileDescriptor::FDType::Generic);
+  if (!handle) {
+    logf(
+        DBG,
+        "no USN journal for {}: failed to open its volume: {}\n",
+        rootPath,
+        win32_strerror(GetLastError()));
+    return nullptr;
+  }
+
+  std::unique_ptr<UsnJournal> journal{new UsnJournal(std::move(handle), 0)};
+  auto data = journal->query();
+  if (!data) {
+    return nullptr;
+  }
+  journal->journalId_ = data->UsnJournalID;
+  return journal;
+}
+
+std::optional<USN_JOURNAL_DATA_V0> UsnJournal::query() {
+  USN_JOURNAL_DATA_V0 data;
+  DWORD bytes;
+  if (!DeviceIoControl(
+          (HANDLE)volume_.handle(),
+          FSCTL_QUERY_USN_JOURNAL,
+          nullptr,
+          0,
+          &data,
+          sizeof(data),
+          &bytes,
+          nullptr)) {
+    logf(
+        DBG,
+        "FSCTL_QUERY_USN_JOURNAL failed: {}\n",
+        win32_strerror(GetLastError()));
+    return std::nullopt;
+  }
+  return data;
+}
+
+std::optional<USN> UsnJournal::nextUsn() {
+  auto data = query();
+  if (!data || data->UsnJournalID != journalId_) {
+    // The journal was deleted or recreated
+    return std::nullopt;
+  }
+  return data->NextUsn;
+}
+
+std::optional<w_string> UsnJournal::resolveDir(
+    DWORDLONG fileId,
+    std::unordered_map<DWORDLONG, std::optional<w_string>>& dirPaths) {
+  auto it = dirPaths.find(fileId);
+  if (it != dirPaths.end()) {
+    return it->second;
+  }
+
+  auto desc = FILE_ID_DESCRIPTOR();
+  desc.dwSize = sizeof(desc);
+  desc.Type = FileIdType;
+  desc.FileId.QuadPart = fileId;
+
+  std::optional<w_string> path;
+  FileDescriptor dir(
+      intptr_t(OpenFileById(
+          (HANDLE)volume_.handle(),
+          &desc,
+          0,
+          FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+          nullptr,
+          FILE_FLAG_BACKUP_SEMANTICS)),
+      FileDescriptor::FDType::Generic);
+  if (dir) {
+    try {
+      path = dir.getOpenedPath();
+    } catch (const std::exception& exc) {
+      logf(DBG, "failed to resolve directory {}: {}\n", fileId, exc.what());
+    }
+  }
+  // A directory that can no longer be opened was deleted, and the record of
+  // its removal, under an ancestor that still exists, covers its children.
+  dirPaths.emplace(fileId, path);
+  return path;
+}
+
+bool UsnJournal::replay(const Root& root, USN from, std::list<Item>& items) {
+  auto end = nextUsn();
+  if (!end) {
+    return false;
+  }
+
+  auto rd = READ_USN_JOURNAL_DATA_V0();
+  rd.StartUsn = from;
+  rd.ReasonMask = 0xFFFFFFFF;
+  rd.UsnJournalID = journalId_;
+
+  std::vector<uint8_t> buf(kNetworkBufSize);
+  std::unordered_map<DWORDLONG, std::optional<w_string>> dirPaths;
+  std::unordered_set<w_string> seen;
+
+  while (rd.StartUsn < *end) {
+    DWORD bytes = 0;
+    if (!DeviceIoControl(
+            (HANDLE)volume_.handle(),
+            FSCTL_READ_USN_JOURNAL,
+            &rd,
+            sizeof(rd),
+            buf.data(),
+            buf.size(),
+            &bytes,
+            nullptr)) {
+      // ERROR_JOURNAL_ENTRY_DELETED if the records were purged
+      logf(
+          ERR,
+          "FSCTL_READ_USN_JOURNAL from {} failed: {}\n",
+          rd.StartUsn,
+          win32_strerror(GetLastError()));
+      return false;
+    }
+    if (bytes <= sizeof(USN)) {
+      break;
+    }
+
+    for (DWORD offset = sizeof(USN); offset < bytes;) {
+      auto record = reinterpret_cast<USN_RECORD_V2*>(buf.data() + offset);
+      offset += record->RecordLength;
+      if (record->MajorVersion != 2) {
+        continue;
+      }
+
+      auto parent = resolveDir(record->ParentFileReferenceNumber, dirPaths);
+      if (!parent || !is_path_prefix(*parent, root.root_path)) {
+        continue;
+      }
+
+      w_string name(
+          reinterpret_cast<const WCHAR*>(
+              reinterpret_cast<const char*>(record) + record->FileNameOffset),
+          record->FileNameLength / sizeof(WCHAR));
+      auto full = w_string::pathCat({*parent, name});
+      if (root.ignore.isIgnored(full.data(), full.size())) {
+        continue;
+      }
+
+      // A file usually has several records per change; one item is plenty.
+      bool removed = record->Reason &
+          (USN_REASON_FILE_DELETE | USN_REASON_RENAME_OLD_NAME);
+      if (!seen.insert(full).second && !removed) {
+        continue;
+      }
+      bool isDir = record->FileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+      items.emplace_back(
+          w_string{full},
+          removed && isDir ? W_PENDING_RECURSIVE : PendingFlags{});
+      if (record->Reason &
+          (USN_REASON_FILE_CREATE | USN_REASON_FILE_DELETE |
+           USN_REASON_RENAME_OLD_NAME | USN_REASON_RENAME_NEW_NAME)) {
+        // As with ReadDirectoryChangesW, rescan the parent whose entries
+        // changed.
+        items.emplace_back(w_string{*parent}, PendingFlags{});
+      }
+    }
+
+    rd.StartUsn = *reinterpret_cast<USN*>(buf.data());
+  }
+
+  return true;
+}
+
 } // namespace
 
 struct WinWatcher : public Watcher {
   HANDLE ping{INVALID_HANDLE_VALUE};
-  HANDLE olapEvent{INVALID_HANDLE_VALUE};
+  std::vector<PendingRead> reads;
   FileDescriptor dir_handle;
+  // Whether to ask for FILE_NOTIFY_EXTENDED_INFORMATION records; cleared if
+  // the handle does not support them. Only used by readChangesThread.
+  bool extendedInfo{false};
 
   std::condition_variable cond;
   folly::Synchronized<std::list<Item>, std::mutex> changedItems;
@@ -61,10 +358,22 @@ struct WinWatcher : public Watcher {
   bool start(const std::shared_ptr<Root>& root) override;
   void stopThreads() override;
   void readChangesThread(const std::shared_ptr<Root>& root);
+
+ private:
+  bool issueRead(PendingRead& read, DWORD size, DWORD filter);
+  void decodeChanges(
+      const std::shared_ptr<Root>& root,
+      const PendingRead& read,
+      std::list<Item>& items);
 };
 
 WinWatcher::WinWatcher(const w_string& root_path, const Configuration& config)
-    : Watcher("win32", WATCHER_HAS_PER_FILE_NOTIFICATIONS) {
+    : Watcher(
+          "win32",
+          WATCHER_HAS_PER_FILE_NOTIFICATIONS | WATCHER_HAS_FILE_INFORMATION),
+      extendedInfo{
+          config.getBool("win32_rdcw_extended_info", true) &&
+          getReadDirectoryChangesExW() != nullptr} {
   auto wpath = root_path.piece().asWideUNC();
 
   // Create an overlapped handle so that we can avoid blocking forever
@@ -92,11 +401,17 @@ WinWatcher::WinWatcher(const w_string& root_path, const Configuration& config)
         std::string("failed to create event: ") +
         win32_strerror(GetLastError()));
   }
-  olapEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
-  if (!olapEvent) {
-    throw std::runtime_error(
-        std::string("failed to create event: ") +
-        win32_strerror(GetLastError()));
+
+  reads.resize(std::max<json_int_t>(
+      1, config.getInt("win32_rdcw_queue_depth", kDefaultQueueDepth)));
+  for (auto& read : reads) {
+    read.event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (!read.event) {
+      throw std::runtime_error(
+          std::string("failed to create event: ") +
+          win32_strerror(GetLastError()));
+    }
+    read.olap.hEvent = read.event;
   }
 }
 
@@ -104,8 +419,10 @@ WinWatcher::~WinWatcher() {
   if (ping != INVALID_HANDLE_VALUE) {
     CloseHandle(ping);
   }
-  if (olapEvent != INVALID_HANDLE_VALUE) {
-    CloseHandle(olapEvent);
+  for (auto& read : reads) {
+    if (read.event != INVALID_HANDLE_VALUE && read.event) {
+      CloseHandle(read.event);
+    }
   }
 }
 
@@ -113,12 +430,136 @@ void WinWatcher::stopThreads() {
   SetEvent(ping);
 }
 
+bool WinWatcher::issueRead(PendingRead& read, DWORD size, DWORD filter) {
+  read.buf.resize(size);
+  ResetEvent(read.event);
+
+  if (extendedInfo) {
+    if (getReadDirectoryChangesExW()(
+            (HANDLE)dir_handle.handle(),
+            read.buf.data(),
+            size,
+            TRUE,
+            filter,
+            nullptr,
+            &read.olap,
+            nullptr,
+            ReadDirectoryNotifyExtendedInformation)) {
+      return true;
+    }
+    DWORD err = GetLastError();
+    if (err != ERROR_INVALID_FUNCTION && err != ERROR_INVALID_PARAMETER &&
+        err != ERROR_NOT_SUPPORTED) {
+      return false;
+    }
+    // Network filesystems may not provide the extended information
+    logf(
+        ERR,
+        "ReadDirectoryChangesExW is not supported ({}), "
+        "falling back to ReadDirectoryChangesW\n",
+        win32_strerror(err));
+    extendedInfo = false;
+  }
+
+  return ReadDirectoryChangesW(
+      (HANDLE)dir_handle.handle(),
+      read.buf.data(),
+      size,
+      TRUE,
+      filter,
+      nullptr,
+      &read.olap,
+      nullptr);
+}
+
+void WinWatcher::decodeChanges(
+    const std::shared_ptr<Root>& root,
+    const PendingRead& read,
+    std::list<Item>& items) {
+  // isDir and stat are only known from the extended information
+  auto decode = [&](const WCHAR* fileName,
+                    DWORD fileNameLength,
+                    DWORD action,
+                    std::optional<bool> isDir,
+                    std::shared_ptr<const FileInformation> stat) {
+    // FileNameLength is in BYTES, but FileName is WCHAR
+    DWORD n_chars = fileNameLength / sizeof(fileName[0]);
+    w_string name(fileName, n_chars);
+
+    auto full = w_string::pathCat({root->root_path, name});
+
+    if (root->ignore.isIgnored(full.data(), full.size())) {
+      return;
+    }
+
+    // If we have a delete or rename-away it may be part of
+    // a recursive tree remove or rename.  In that situation
+    // the notifications that we'll receive from the OS will
+    // be from the leaves and bubble up to the root of the
+    // delete/rename.  We want to flag those paths for recursive
+    // analysis so that we can prune children from the trie
+    // that is built when we pass this to the pending list
+    // later.  We don't do that here in this thread because
+    // we're trying to minimize latency in this context.
+    // Files have no children, so this is skipped when we know that the
+    // entry is not a directory.
+    bool removed = action == FILE_ACTION_REMOVED ||
+        action == FILE_ACTION_RENAMED_OLD_NAME;
+    items.emplace_back(
+        w_string{full},
+        removed && isDir.value_or(true) ? W_PENDING_RECURSIVE
+                                        : PendingFlags{},
+        removed ? nullptr : std::move(stat));
+
+    if (!name.empty() &&
+        (action == FILE_ACTION_ADDED || action == FILE_ACTION_REMOVED ||
+         action == FILE_ACTION_RENAMED_OLD_NAME ||
+         action == FILE_ACTION_RENAMED_NEW_NAME)) {
+      // ReadDirectoryChangesW provides change events when the child
+      // entry list changes, but may not provide a notification for
+      // the parent when its mtime changes. It should be rescanned, so
+      // synthesize an event for the IO thread here.
+      items.emplace_back(full.dirName(), PendingFlags{});
+    }
+  };
+
+  // The queued reads may have been issued before a fallback from the
+  // extended information, so go by the format that each one was issued with.
+  auto* entry = read.buf.data();
+  while (true) {
+    DWORD next;
+    if (read.extended) {
+      auto notify = (PFILE_NOTIFY_EXTENDED_INFORMATION)entry;
+      decode(
+          notify->FileName,
+          notify->FileNameLength,
+          notify->Action,
+          (notify->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0,
+          fileInformationFromNotify(*notify));
+      next = notify->NextEntryOffset;
+    } else {
+      auto notify = (PFILE_NOTIFY_INFORMATION)entry;
+      decode(
+          notify->FileName,
+          notify->FileNameLength,
+          notify->Action,
+          std::nullopt,
+          nullptr);
+      next = notify->NextEntryOffset;
+    }
+
+    // Advance to next item
+    if (next == 0) {
+      break;
+    }
+    entry += next;
+  }
+}
+
 void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
-  std::vector<uint8_t> buf;
-  auto olap = OVERLAPPED();
-  BOOL initiate_read = true;
-  HANDLE handles[2] = {olapEvent, ping};
   DWORD bytes;
+  // The oldest read in flight, which is the next one to complete
+  size_t head = 0;
 
   w_set_thread_name("readchange ", root->root_path.view());
   watchman::log(watchman::DBG, "initializing\n");
@@ -129,38 +570,45 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
   // deletes to fail.
   auto extraLatency = root->config.getInt("win32_batch_latency_ms", 30);
 
-  DWORD size = root->config.getInt("win32_rdcw_buf_size", 16384);
+  DWORD size = root->config.getInt("win32_rdcw_buf_size", kNetworkBufSize);
 
   DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
       FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE |
       FILE_NOTIFY_CHANGE_LAST_WRITE;
 
+  std::unique_ptr<UsnJournal> journal;
+  if (root->config.getBool("win32_usn_catchup", true)) {
+    journal = UsnJournal::open(root->root_path);
+  }
+  // Where to replay the journal from if the next read to complete overflowed
+  std::optional<USN> catchupFrom;
+
+  auto issue = [&](PendingRead& read) {
+    read.usnAtIssue = journal ? journal->nextUsn() : std::nullopt;
+    read.extended = extendedInfo;
+    if (issueRead(read, size, filter)) {
+      return true;
+    }
+    DWORD err = GetLastError();
+    logf(
+        ERR,
+        "ReadDirectoryChangesW: failed, cancel watch. {}\n",
+        win32_strerror(err));
+    root->cancel(
+        fmt::format("ReadDirectoryChangesW failed: {}", win32_strerror(err)));
+    return false;
+  };
+
   // Block until winmatch_root_st is waiting for our initialization
   {
     auto wlock = changedItems.lock();
 
-    olap.hEvent = olapEvent;
-
-    buf.resize(size);
-
-    if (!ReadDirectoryChangesW(
-            (HANDLE)dir_handle.handle(),
-            &buf[0],
-            size,
-            TRUE,
-            filter,
-            nullptr,
-            &olap,
-            nullptr)) {
-      DWORD err = GetLastError();
-      logf(
-          ERR,
-          "ReadDirectoryChangesW: failed, cancel watch. {}\n",
-          win32_strerror(err));
-      root->cancel(
-          fmt::format("ReadDirectoryChangesW failed: {}", win32_strerror(err)));
-      return;
+    for (auto& read : reads) {
+      if (!issue(read)) {
+        return;
+      }
     }
+    catchupFrom = reads[head].usnAtIssue;
     // Signal that we are done with init.  We MUST do this AFTER our first
     // successful ReadDirectoryChangesW, otherwise there is a race condition
     // where we'll miss observing the cookie for a query that comes in
@@ -168,35 +616,34 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
     logf(DBG, "ReadDirectoryChangesW signalling as init done\n");
     cond.notify_one();
   }
-  initiate_read = false;
 
   std::list<Item> items;
 
-  // The mutex must not be held when we enter the loop
-  while (!root->inner.cancelled) {
-    if (initiate_read) {
-      if (!ReadDirectoryChangesW(
-              (HANDLE)dir_handle.handle(),
-              &buf[0],
-              size,
-              TRUE,
-              filter,
-              nullptr,
-              &olap,
-              nullptr)) {
-        DWORD err = GetLastError();
+  // Catches up on the changes that an overflowed read lost, from the journal
+  // if possible, and otherwise by recrawling the whole tree.
+  auto overflowed = [&](const char* reason) {
+    if (journal && catchupFrom) {
+      auto replayed = items.size();
+      if (journal->replay(*root, *catchupFrom, items)) {
         logf(
             ERR,
-            "ReadDirectoryChangesW: failed, cancel watch. {}\n",
-            win32_strerror(err));
-        root->cancel(fmt::format(
-            "ReadDirectoryChangesW failed: {}", win32_strerror(err)));
-        break;
-      } else {
-        initiate_read = false;
+            "{}; caught up on {} changes from the USN journal\n",
+            reason,
+            items.size() - replayed);
+        return;
       }
+      logf(ERR, "{}; failed to catch up from the USN journal\n", reason);
     }
+    root->recrawlTriggered(reason);
+    items.emplace_back(
+        w_string{root->root_path},
+        PendingFlags{W_PENDING_IS_DESYNCED | W_PENDING_RECURSIVE});
+  };
 
+  // The mutex must not be held when we enter the loop
+  while (!root->inner.cancelled) {
+    auto& read = reads[head];
+    HANDLE handles[2] = {read.event, ping};
     watchman::log(watchman::DBG, "waiting for change notifications\n");
     DWORD status = WaitForMultipleObjects(
         2,
@@ -212,9 +659,10 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
     watchman::log(watchman::DBG, "wait returned with status ", status, "\n");
 
     if (status == WAIT_OBJECT_0) {
+      bool retry = false;
       bytes = 0;
       if (!GetOverlappedResult(
-              (HANDLE)dir_handle.handle(), &olap, &bytes, FALSE)) {
+              (HANDLE)dir_handle.handle(), &read.olap, &bytes, FALSE)) {
         DWORD err = GetLastError();
         logf(
             ERR,
@@ -223,7 +671,18 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
             err,
             win32_strerror(err));
 
-        if (err == ERROR_INVALID_PARAMETER && size > kNetworkBufSize) {
+        if (err == ERROR_INVALID_PARAMETER && read.extended) {
+          // Network filesystems may only turn down the extended information
+          // once the read completes
+          logf(
+              ERR,
+              "retrying watch for {} without extended information\n",
+              root->root_path);
+          extendedInfo = false;
+          retry = true;
+        } else if (
+            err == ERROR_INVALID_PARAMETER &&
+            read.buf.size() > kNetworkBufSize) {
           // May be a network buffer related size issue; the docs say that
           // we can hit this when watching a UNC path. Let's downsize and
           // retry the read just one time
@@ -233,16 +692,9 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
               "with smaller buffer\n",
               root->root_path);
           size = kNetworkBufSize;
-          initiate_read = true;
-          continue;
-        }
-
-        if (err == ERROR_NOTIFY_ENUM_DIR) {
-          root->recrawlTriggered(
-              "GetOverlappedResult failed with ERROR_NOTIFY_ENUM_DIR");
-          items.emplace_back(
-              w_string{root->root_path},
-              PendingFlags{W_PENDING_IS_DESYNCED | W_PENDING_RECURSIVE});
+          retry = true;
+        } else if (err == ERROR_NOTIFY_ENUM_DIR) {
+          overflowed("GetOverlappedResult failed with ERROR_NOTIFY_ENUM_DIR");
         } else {
           logf(ERR, "Cancelling watch for {}\n", root->root_path);
           root->cancel(fmt::format(
@@ -250,66 +702,22 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
               win32_strerror(err)));
           break;
         }
+      } else if (bytes == 0) {
+        overflowed("ReadDirectoryChangesW overflowed");
       } else {
-        if (bytes == 0) {
-          root->recrawlTriggered("ReadDirectoryChangesW overflowed");
-          items.emplace_back(
-              w_string{root->root_path},
-              PendingFlags{W_PENDING_IS_DESYNCED | W_PENDING_RECURSIVE});
-        } else {
-          PFILE_NOTIFY_INFORMATION notify =
-              (PFILE_NOTIFY_INFORMATION)buf.data();
-
-          while (true) {
-            // FileNameLength is in BYTES, but FileName is WCHAR
-            DWORD n_chars =
-                notify->FileNameLength / sizeof(notify->FileName[0]);
-            w_string name(notify->FileName, n_chars);
-
-            auto full = w_string::pathCat({root->root_path, name});
-
-            if (!root->ignore.isIgnored(full.data(), full.size())) {
-              // If we have a delete or rename-away it may be part of
-              // a recursive tree remove or rename.  In that situation
-              // the notifications that we'll receive from the OS will
-              // be from the leaves and bubble up to the root of the
-              // delete/rename.  We want to flag those paths for recursive
-              // analysis so that we can prune children from the trie
-              // that is built when we pass this to the pending list
-              // later.  We don't do that here in this thread because
-              // we're trying to minimize latency in this context.
-              items.emplace_back(
-                  w_string{full},
-                  (notify->Action == FILE_ACTION_REMOVED ||
-                   notify->Action == FILE_ACTION_RENAMED_OLD_NAME)
-                      ? W_PENDING_RECURSIVE
-                      : 0);
-
-              if (!name.empty() &&
-                  (notify->Action == FILE_ACTION_ADDED ||
-                   notify->Action == FILE_ACTION_REMOVED ||
-                   notify->Action == FILE_ACTION_RENAMED_OLD_NAME ||
-                   notify->Action == FILE_ACTION_RENAMED_NEW_NAME)) {
-                // ReadDirectoryChangesW provides change events when the child
-                // entry list changes, but may not provide a notification for
-                // the parent when its mtime changes. It should be rescanned, so
-                // synthesize an event for the IO thread here.
-                items.emplace_back(full.dirName(), PendingFlags{});
-              }
-            }
-
-            // Advance to next item
-            if (notify->NextEntryOffset == 0) {
-              break;
-            }
-            notify = (PFILE_NOTIFY_INFORMATION)(notify->NextEntryOffset +
-                                                (char*)notify);
-          }
-        }
+        decodeChanges(root, read, items);
+      }
 
-        ResetEvent(olapEvent);
-        initiate_read = true;
+      if (!retry) {
+        // The next read reports changes from no earlier than when this one
+        // was issued.
+        catchupFrom = read.usnAtIssue;
+      }
+      // Reissue this read behind the others that are still in flight
+      if (!issue(read)) {
+        break;
       }
+      head = (head + 1) % reads.size();
     } else if (status == WAIT_OBJECT_0 + 1) {
       logf(ERR, "signalled\n");
       break;
@@ -410,7 +818,11 @@ Watcher::ConsumeNotifyRet WinWatcher::consumeNotify(
         " ",
         item.flags.format(),
         "\n");
-    coll.add(item.path, now, W_PENDING_VIA_NOTIFY | item.flags);
+    coll.add(
+        item.path,
+        now,
+        W_PENDING_VIA_NOTIFY | item.flags,
+        std::move(item.stat));
   }
 
   // The readChangesThread cancels itself.
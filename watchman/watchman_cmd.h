@@ -48,12 +48,21 @@ std::shared_ptr<watchman::Root> resolveOrCreateRoot(
     watchman::Client* client,
     const json_ref& args);
 
+// Like resolveRoot(), but in client mode leaves a new root uncrawled, for a
+// query that walks the filesystem itself; see InMemoryView::walkGenerator.
+// Anything else must InMemoryView::clientModeCrawl() the root before
+// reading its view.
+std::shared_ptr<watchman::Root> resolveRootWithoutClientModeCrawl(
+    watchman::Client* client,
+    const json_ref& args);
+
 // Similar to resolveRoot() or resolveOrCreateRoot() but takes a root
 // string instead of json_ref.
 std::shared_ptr<watchman::Root> resolveRootByName(
     watchman::Client* client,
     const char* rootName,
-    bool create = false);
+    bool create = false,
+    bool clientModeCrawl = true);
 
 void add_root_warnings_to_response(
     watchman::UntypedResponse& response,
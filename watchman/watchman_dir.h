@@ -6,9 +6,32 @@
  */
 
 #pragma once
-#include <unordered_map>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include "watchman/Clock.h"
+#include "watchman/DirChildMap.h"
+#include "watchman/Tombstone.h"
 #include "watchman/watchman_string.h"
 
+namespace watchman {
+class NodeArena;
+class PathBuilder;
+
+/**
+ * The mtime and ctime of a dir, in nanoseconds since the epoch, taken before
+ * its entries were read by the crawler.
+ */
+struct DirCrawlStamp {
+  int64_t mtimeNs;
+  int64_t ctimeNs;
+
+  bool operator==(const DirCrawlStamp& other) const {
+    return mtimeNs == other.mtimeNs && ctimeNs == other.ctimeNs;
+  }
+};
+} // namespace watchman
+
 struct watchman_file;
 
 struct watchman_dir {
@@ -17,22 +40,58 @@ struct watchman_dir {
   w_string name;
   /* the parent dir */
   watchman_dir* parent;
+  /* the allocator that owns this node and all of its descendants */
+  watchman::NodeArena* arena;
 
-  /* files contained in this dir (keyed by file->name) */
+  /* Returns file and dir nodes to the arena they were allocated from */
   struct Deleter {
     void operator()(watchman_file*) const;
+    void operator()(watchman_dir*) const;
   };
-  std::unordered_map<w_string_piece, std::unique_ptr<watchman_file, Deleter>>
-      files;
+  using Ptr = std::unique_ptr<watchman_dir, Deleter>;
+
+  /* files contained in this dir (keyed by file->name) */
+  watchman::DirChildMap<std::unique_ptr<watchman_file, Deleter>> files;
 
   /* child dirs contained in this dir (keyed by dir->name) */
-  std::unordered_map<w_string_piece, std::unique_ptr<watchman_dir>> dirs;
+  watchman::DirChildMap<Ptr> dirs;
+
+  /* deleted files that were compacted out of files (keyed by their name) */
+  watchman::DirChildMap<watchman::Tombstone> tombstones;
+
+  // The largest otime tick of any file in or below this dir.  Maintained
+  // by ViewDatabase::markFileChanged and never lowered, so it is an upper
+  // bound that allows tree walking generators to skip unchanged subtrees.
+  watchman::ClockTicks maxOtimeTicks{0};
+
+  // The largest otime tick of any tombstone in or below this dir.  Like
+  // maxOtimeTicks it is an upper bound, but it is recomputed when tombstones
+  // are aged out.
+  watchman::ClockTicks maxTombstoneTicks{0};
 
   // If we think this dir was deleted, we'll avoid recursing
   // to its children when processing deletes.
   bool last_check_existed{true};
 
-  watchman_dir(w_string name, watchman_dir* parent);
+  /* Set when a recursive crawl read all of the entries of this dir, so that
+   * a later one can tell whether there can be any new or removed entries.
+   * See InMemoryView::crawler. */
+  std::optional<watchman::DirCrawlStamp> crawlStamp;
+
+  watchman_dir(w_string name, watchman_dir* parent, watchman::NodeArena* arena);
+
+  /**
+   * Allocates a root dir node from arena.  All descendants of the returned
+   * node will be allocated from the same arena, so it must outlive the node.
+   */
+  static Ptr makeRoot(w_string name, watchman::NodeArena& arena);
+
+  /**
+   * Allocates a child dir node from the parent's arena, sharing the arena's
+   * copy of name.  The caller is responsible for linking it into
+   * parent->dirs, keyed by the returned node's name.
+   */
+  static Ptr make(w_string_piece name, watchman_dir* parent);
 
   watchman_dir* getChildDir(w_string_piece name) const;
 
@@ -42,6 +101,12 @@ struct watchman_dir {
    */
   watchman_file* getChildFile(w_string_piece name) const;
 
+  /**
+   * Returns the tombstone left by the deleted direct child file named name,
+   * or nullptr if there is none.
+   */
+  const watchman::Tombstone* getTombstone(w_string_piece name) const;
+
   /**
    * Walk up to the chain of dirs via ->parent to and then produce the full path
    * to this dir.
@@ -59,4 +124,13 @@ struct watchman_dir {
    * the path to the child.
    */
   w_string getFullPathToChild(w_string_piece child) const;
+
+  /**
+   * Like getFullPathToChild, but builds the path in `out` rather than
+   * allocating a string.  The returned piece is valid until `out` is next
+   * modified.
+   */
+  w_string_piece getFullPathToChild(
+      watchman::PathBuilder& out,
+      w_string_piece child) const;
 };
@@ -11,6 +11,102 @@
 #include "watchman/fs/FileInformation.h"
 #include "watchman/watchman_dir.h"
 
+namespace watchman {
+
+/**
+ * The stat information cached in a file node, packed into a little over half
+ * of the size of a FileInformation.
+ *
+ * Times are kept as unsigned 32-bit seconds since the epoch, and the dev, uid
+ * and gid, which rarely differ between the files of a watch, as an index into
+ * a table of owners that is shared by every node. The complete information of
+ * a file whose values don't fit (a time before 1970 or after 2106, a huge
+ * link count, or a new owner once the table is full) is instead spilled into
+ * a side table keyed by the node.
+ *
+ * File nodes are zero-filled rather than constructed, and that is equivalent
+ * to the default state.
+ */
+class CompactFileInformation {
+ public:
+  CompactFileInformation() = default;
+  CompactFileInformation(const CompactFileInformation&) = delete;
+  CompactFileInformation& operator=(const CompactFileInformation&) = delete;
+  ~CompactFileInformation();
+
+  CompactFileInformation& operator=(const FileInformation& info);
+
+  // Returns the complete stat information.
+  FileInformation decode() const;
+
+  // These don't need a complete decode.
+  mode_t mode() const {
+    return mode_;
+  }
+  uint64_t size() const {
+    return size_;
+  }
+  ino_t ino() const {
+    return ino_t(ino_);
+  }
+#ifdef _WIN32
+  uint32_t fileAttributes() const {
+    return fileAttributes_;
+  }
+#endif
+  struct timespec atime() const;
+  struct timespec mtime() const;
+  struct timespec ctime() const;
+
+  DType dtype() const {
+    return typeInfo().dtype();
+  }
+  bool isSymlink() const {
+    return typeInfo().isSymlink();
+  }
+  bool isDir() const {
+    return typeInfo().isDir();
+  }
+  bool isFile() const {
+    return typeInfo().isFile();
+  }
+
+  bool isSpilled() const {
+    return spilled_;
+  }
+
+ private:
+  // A FileInformation with only the fields that determine the file type
+  FileInformation typeInfo() const {
+    FileInformation info;
+    info.mode = mode_;
+#ifdef _WIN32
+    info.fileAttributes = fileAttributes_;
+#endif
+    return info;
+  }
+
+  uint64_t size_{0};
+  uint64_t ino_{0};
+  mode_t mode_{0};
+  uint32_t nlink_{0};
+  // Index into the table of owners
+  uint32_t owner_{0};
+  uint32_t atimeSec_{0};
+  uint32_t atimeNsec_{0};
+  uint32_t mtimeSec_{0};
+  uint32_t mtimeNsec_{0};
+  uint32_t ctimeSec_{0};
+  uint32_t ctimeNsec_{0};
+#ifdef _WIN32
+  uint32_t fileAttributes_{0};
+#endif
+  // Whether the complete information is in the side table
+  bool spilled_{false};
+};
+
+} // namespace watchman
+
 struct watchman_file {
   /* the parent dir */
   watchman_dir* parent;
@@ -20,6 +116,14 @@ struct watchman_file {
    * previous file node, or the head of the list. */
   struct watchman_file **prev, *next;
 
+  /* linkage to files with the same lowercased suffix, maintained in the
+   * same way as prev/next when the view's suffix index is enabled */
+  struct watchman_file **suffixPrev, *suffixNext;
+
+  /* linkage to files with the same name, maintained in the same way as
+   * prev/next when the view's name index is enabled */
+  struct watchman_file **namePrev, *nameNext;
+
   /* the time we last observed a change to this file */
   watchman::ClockStamp otime;
   /* the time we first observed this file OR the time
@@ -34,7 +138,7 @@ struct watchman_file {
 
   /* cache stat results so we can tell if an entry
    * changed */
-  watchman::FileInformation stat;
+  watchman::CompactFileInformation stat;
 
   inline w_string_piece getName() const {
     uint32_t len;
@@ -43,6 +147,8 @@ struct watchman_file {
   }
 
   void removeFromFileList();
+  void removeFromSuffixList();
+  void removeFromNameList();
 
   watchman_file() = delete;
   watchman_file(const watchman_file&) = delete;
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <errno.h>
 #include <memory>
 #include "watchman/fs/FileDescriptor.h"
 
@@ -24,11 +25,68 @@ class Event {
   virtual bool isSocket() = 0;
 };
 
+/// One of the buffers written, in order, by Stream::writev
+struct StreamBuffer {
+  const void* data;
+  size_t size;
+};
+
 class Stream {
  public:
   virtual ~Stream() = default;
   virtual int read(void* buf, int size) = 0;
   virtual int write(const void* buf, int size) = 0;
+
+  /**
+   * Writes the buffers as though they were concatenated, returning the
+   * number of bytes written, which may stop short of their total, or -1 on
+   * error. Streams that can do so hand several buffers to the kernel at
+   * once; this default writes the first one that isn't empty.
+   */
+  virtual int writev(const StreamBuffer* bufs, int count) {
+    for (int i = 0; i < count; ++i) {
+      if (bufs[i].size) {
+        return write(bufs[i].data, static_cast<int>(bufs[i].size));
+      }
+    }
+    return 0;
+  }
+
+  /// Whether writeWithDescriptor can pass descriptors to the peer
+  virtual bool canPassDescriptors() const {
+    return false;
+  }
+
+  /**
+   * Like write, but also passes a duplicate of descriptor to the peer, which
+   * receives it along with the bytes written. Fails with ENOTSUP unless
+   * canPassDescriptors.
+   */
+  virtual int writeWithDescriptor(
+      const void* /*buf*/,
+      int /*size*/,
+      const FileDescriptor& /*descriptor*/) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  /**
+   * Whether the peer can accept more data right now, without waiting.
+   * Streams that can't tell say that it can.
+   */
+  virtual bool isWritable() {
+    return true;
+  }
+
+  /**
+   * Whether the peer has closed its end of the connection, as far as can be
+   * told without reading from it.  Streams that can't tell say that it
+   * hasn't.
+   */
+  virtual bool peerHasHungUp() {
+    return false;
+  }
+
   virtual Event* getEvents() = 0;
   virtual void setNonBlock(bool nonBlock) = 0;
   virtual bool rewind() = 0;
@@ -297,6 +297,36 @@ class w_string_piece {
 
 bool w_string_equal_caseless(w_string_piece a, w_string_piece b);
 
+namespace watchman {
+
+/**
+ * An ASCII lowercased, NUL terminated copy of a string, held on the stack
+ * when it is short enough.  Case-insensitive lookups against lowercased
+ * keys can probe with it for every candidate name without allocating.
+ */
+class LowerCaseBuffer {
+ public:
+  explicit LowerCaseBuffer(w_string_piece str);
+
+  LowerCaseBuffer(const LowerCaseBuffer&) = delete;
+  LowerCaseBuffer& operator=(const LowerCaseBuffer&) = delete;
+
+  w_string_piece piece() const noexcept {
+    return w_string_piece{data_, size_};
+  }
+
+ private:
+  // Longer than nearly all file names and many whole names
+  static constexpr size_t kInlineSize = 256;
+
+  char inline_[kInlineSize];
+  std::unique_ptr<char[]> heap_;
+  char* data_;
+  size_t size_;
+};
+
+} // namespace watchman
+
 /**
  * w_string is a reference-counted, immutable, 8-bit string type.
  * It can hold known-unicode text, known-binary data, or a mixture of both.
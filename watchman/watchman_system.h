@@ -88,6 +88,9 @@ char* realpath(const char* filename, char* target);
 #if HAVE_SYS_INOTIFY_H
 #include <sys/inotify.h>
 #endif
+#if HAVE_SYS_FANOTIFY_H
+#include <sys/fanotify.h>
+#endif
 #if HAVE_SYS_EVENT_H
 #include <sys/event.h> // @manual
 #endif